@@ -1,6 +1,7 @@
-QT       += core gui sql concurrent
+# opengl and openglwidgets are for the accelerated thumbnail grid, GpuBinner only needs gui
+QT       += core gui sql concurrent opengl
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets openglwidgets
 
 CONFIG += c++17
 
@@ -13,54 +14,66 @@ DEFINES += CURRENT_APP_VERSION=\"\\\"$${VERSION}\\\"\"
 
 SOURCES += \
     aboutwindow.cpp \
-    autostretcher.cpp \
-    catalog.cpp \
-    fileprocessfilter.cpp \
-    filerepository.cpp \
+    blinkwindow.cpp \
+    contactsheetdialog.cpp \
+    detailprefetcher.cpp \
+    diagnosticsdialog.cpp \
+    exportdialog.cpp \
+    facetindex.cpp \
+    facetmodel.cpp \
     fileviewmodel.cpp \
     filtergroupbox.cpp \
     filterview.cpp \
-    fitsfile.cpp \
-    fitsprocessor.cpp \
-    foldercrawler.cpp \
     folderviewmodel.cpp \
-    imageprocessor.cpp \
+    groupedfilemodel.cpp \
+    guibenchmark.cpp \
     main.cpp \
     mainwindow.cpp \
-    mock_foldercrawler.cpp \
-    mock_newfileprocessor.cpp \
     modelloadingdialog.cpp \
-    newfileprocessor.cpp \
+    pixmapcache.cpp \
+    previewwindow.cpp \
     searchfolderdialog.cpp \
+    selectionstats.cpp \
+    skymapdialog.cpp \
+    skymapview.cpp \
     sortfilterproxymodel.cpp \
+    sortkeys.cpp \
+    stackwindow.cpp \
+    stallwatchdog.cpp \
+    tagdetailscache.cpp \
     thumbnailcache.cpp \
-    xisfprocessor.cpp
+    thumbnailgridview.cpp
 
 HEADERS += \
     aboutwindow.h \
-    astrofile.h \
-    autostretcher.h \
-    catalog.h \
-    fileprocessfilter.h \
-    fileprocessor.h \
-    filerepository.h \
+    blinkwindow.h \
+    contactsheetdialog.h \
+    detailprefetcher.h \
+    diagnosticsdialog.h \
+    exportdialog.h \
+    facetindex.h \
+    facetmodel.h \
     fileviewmodel.h \
     filtergroupbox.h \
     filterview.h \
-    fitsfile.h \
-    fitsprocessor.h \
-    foldercrawler.h \
     folderviewmodel.h \
-    imageprocessor.h \
+    groupedfilemodel.h \
+    guibenchmark.h \
     mainwindow.h \
-    mock_foldercrawler.h \
-    mock_newfileprocessor.h \
     modelloadingdialog.h \
-    newfileprocessor.h \
+    pixmapcache.h \
+    previewwindow.h \
     searchfolderdialog.h \
+    selectionstats.h \
+    skymapdialog.h \
+    skymapview.h \
     sortfilterproxymodel.h \
+    sortkeys.h \
+    stackwindow.h \
+    stallwatchdog.h \
+    tagdetailscache.h \
     thumbnailcache.h \
-    xisfprocessor.h
+    thumbnailgridview.h
 
 FORMS += \
     aboutwindow.ui \
@@ -74,26 +87,17 @@ TRANSLATIONS += \
 RESOURCES += \
     Resources.qrc
 
-LIBS += -L$$PWD/../external/build/libs/ -lpcl -llcms -llz4 -lRFC6234 -lcfitsio -lzlib
+include(engine.pri)
 
 win32 {
-    LIBS += -L$$PWD/../external/build/libs/Release
-    LIBS += -luser32 -luserenv -ladvapi32 -lpthreadVC2
-    DEFINES += __PCL_WINDOWS WIN32 WIN64 __PCL_NO_WIN32_MINIMUM_VERSIONS UNICODE _UNICODE _WINDOWS _NDEBUG
-    QMAKE_CXXFLAGS = "/EHsc /MP /FS"
+    # The stack of the GUI thread in the stall log, see StallWatchdog
+    LIBS += -ldbghelp
     RC_ICONS = resources/Icons/win.ico/app.ico
 }
 macx {
-    DEFINES += __PCL_MACOSX
     ICON = resources/Icons/mac.icns
 }
-linux {
-DEFINES += __PCL_LINUX
-}
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
-
-INCLUDEPATH += $$PWD/../external/cfitsio
-INCLUDEPATH += $$PWD/../external/pcl/include
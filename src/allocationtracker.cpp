@@ -0,0 +1,170 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "allocationtracker.h"
+
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Constant initialized, so allocations made before main are counted too
+static AllocationCounter unscopedCounter {"other"};
+static thread_local AllocationCounter* currentCounter = nullptr;
+
+static QMutex& countersMutex()
+{
+    static QMutex mutex;
+    return mutex;
+}
+
+static QList<AllocationCounter*>& counters()
+{
+    static QList<AllocationCounter*> list {&unscopedCounter};
+    return list;
+}
+
+AllocationCounter &AllocationTracker::counter(const char *name)
+{
+    QMutexLocker locker(&countersMutex());
+    for (AllocationCounter* counter : counters())
+    {
+        if (std::strcmp(counter->name, name) == 0)
+            return *counter;
+    }
+    AllocationCounter* counter = new AllocationCounter {name};
+    counters().append(counter);
+    return *counter;
+}
+
+QJsonObject AllocationTracker::toJson()
+{
+    QJsonObject json;
+    if (!isEnabled())
+        return json;
+
+    QMutexLocker locker(&countersMutex());
+    for (const AllocationCounter* counter : counters())
+    {
+        QJsonObject summary;
+        summary.insert("allocations", counter->allocations.load(std::memory_order_relaxed));
+        summary.insert("bytes", counter->bytes.load(std::memory_order_relaxed));
+        summary.insert("entries", counter->entries.load(std::memory_order_relaxed));
+        json.insert(counter->name, summary);
+    }
+    return json;
+}
+
+// Called from the allocator, so it must not allocate
+void AllocationTracker::record(std::size_t bytes)
+{
+    AllocationCounter* counter = currentCounter != nullptr ? currentCounter : &unscopedCounter;
+    counter->allocations.fetch_add(1, std::memory_order_relaxed);
+    counter->bytes.fetch_add(qint64(bytes), std::memory_order_relaxed);
+}
+
+AllocationCounter *AllocationTracker::enter(AllocationCounter *counter)
+{
+    counter->entries.fetch_add(1, std::memory_order_relaxed);
+    AllocationCounter* previous = currentCounter;
+    currentCounter = counter;
+    return previous;
+}
+
+void AllocationTracker::leave(AllocationCounter *previous)
+{
+    currentCounter = previous;
+}
+
+#ifdef ASTROCAT_ALLOCATION_TRACKING
+#if defined(__GLIBC__)
+
+// operator new of libstdc++ allocates with malloc, so these count it as well
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+
+void* malloc(std::size_t size) noexcept
+{
+    AllocationTracker::record(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t count, std::size_t size) noexcept
+{
+    AllocationTracker::record(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, std::size_t size) noexcept
+{
+    AllocationTracker::record(size);
+    return __libc_realloc(pointer, size);
+}
+}
+
+#else
+
+static void* allocate(std::size_t size)
+{
+    AllocationTracker::record(size);
+    if (size == 0)
+        size = 1;
+    for (;;)
+    {
+        if (void* pointer = std::malloc(size))
+            return pointer;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+
+#endif
+#endif
@@ -0,0 +1,93 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef ALLOCATIONTRACKER_H
+#define ALLOCATIONTRACKER_H
+
+#include <QJsonObject>
+
+#include <atomic>
+#include <cstddef>
+
+// The allocations made in one kind of AllocationScope, by every thread
+struct AllocationCounter
+{
+    const char* name;
+    std::atomic<qint64> allocations {0};
+    std::atomic<qint64> bytes {0};
+    // The scopes entered, to tell the allocations of one call
+    std::atomic<qint64> entries {0};
+};
+
+/*!
+ * \brief The AllocationTracker class
+ * Counts the heap allocations, and the bytes asked for, of the innermost AllocationScope
+ * the allocating thread is in. Allocations outside any scope are counted as "other".
+ *
+ * Only built with CONFIG+=allocation_tracking, which replaces the global operator new,
+ * and with glibc also malloc, calloc and realloc, which the Qt containers allocate with.
+ * Otherwise the scopes cost nothing and isEnabled is false.
+ */
+class AllocationTracker
+{
+public:
+#ifdef ASTROCAT_ALLOCATION_TRACKING
+    static constexpr bool isEnabled() { return true; }
+#else
+    static constexpr bool isEnabled() { return false; }
+#endif
+
+    // Made on first use and kept for the life of the application, like the Metrics
+    static AllocationCounter& counter(const char* name);
+    // Per scope name: allocations, bytes and entries. Empty when not enabled.
+    static QJsonObject toJson();
+
+    static void record(std::size_t bytes);
+
+private:
+    friend class AllocationScope;
+    static AllocationCounter* enter(AllocationCounter* counter);
+    static void leave(AllocationCounter* previous);
+};
+
+/*!
+ * \brief The AllocationScope class
+ * Counts the allocations of the thread from its construction to its destruction in a
+ * counter. The allocations of a nested scope are counted in the nested scope only.
+ */
+class AllocationScope
+{
+public:
+#ifdef ASTROCAT_ALLOCATION_TRACKING
+    explicit AllocationScope(AllocationCounter& counter) : previous(AllocationTracker::enter(&counter)) {}
+    ~AllocationScope() { AllocationTracker::leave(previous); }
+
+private:
+    AllocationCounter* previous;
+#else
+    explicit AllocationScope(AllocationCounter& counter) { Q_UNUSED(counter); }
+#endif
+};
+
+#endif // ALLOCATIONTRACKER_H
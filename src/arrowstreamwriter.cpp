@@ -0,0 +1,505 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "arrowstreamwriter.h"
+
+#include <QtEndian>
+
+#include <memory>
+
+// Rows of a record batch
+#define ARROW_BATCH_ROWS 65536
+// Of the messages and of the buffers of their bodies
+#define ARROW_ALIGNMENT 8
+
+// Format.fbs and Schema.fbs of Arrow
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_DICTIONARY_BATCH 2
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_UNIT_MILLISECOND 1
+
+/*
+ * A flatbuffer is written front to back here: a table, then what its offsets point
+ * to, so every offset is forward as flatbuffers needs. Each vtable is written right
+ * before its table. Scalars are aligned to their size from the start of the buffer.
+ */
+struct FlatNode;
+using FlatRef = std::shared_ptr<FlatNode>;
+
+struct FlatField
+{
+    int slot;
+    int size; // Of a scalar, 0 for an offset to ref
+    quint64 value;
+    FlatRef ref;
+};
+
+struct FlatNode
+{
+    enum Kind { Table, TableVector, StructVector, String };
+    Kind kind;
+    QList<FlatField> fields;
+    QList<FlatRef> elements;
+    QByteArray bytes;
+    int count = 0;
+    int align = 4;
+};
+
+static FlatField scalar(int slot, int size, quint64 value)
+{
+    return {slot, size, value, nullptr};
+}
+
+static FlatField offset(int slot, const FlatRef& ref)
+{
+    return {slot, 0, 0, ref};
+}
+
+static FlatRef table(const QList<FlatField>& fields)
+{
+    auto node = std::make_shared<FlatNode>();
+    node->kind = FlatNode::Table;
+    node->fields = fields;
+    return node;
+}
+
+static FlatRef tables(const QList<FlatRef>& elements)
+{
+    auto node = std::make_shared<FlatNode>();
+    node->kind = FlatNode::TableVector;
+    node->elements = elements;
+    return node;
+}
+
+static FlatRef structs(const QByteArray& bytes, int count, int align)
+{
+    auto node = std::make_shared<FlatNode>();
+    node->kind = FlatNode::StructVector;
+    node->bytes = bytes;
+    node->count = count;
+    node->align = align;
+    return node;
+}
+
+static FlatRef string(const QString& text)
+{
+    auto node = std::make_shared<FlatNode>();
+    node->kind = FlatNode::String;
+    node->bytes = text.toUtf8();
+    return node;
+}
+
+class FlatWriter
+{
+public:
+    QByteArray finish(const FlatRef& root)
+    {
+        put(0, 4);
+        patch(0, write(*root));
+        return out;
+    }
+
+private:
+    QByteArray out;
+
+    void pad(int align)
+    {
+        while (out.size() % align != 0)
+            out.append('\0');
+    }
+
+    void put(quint64 value, int size)
+    {
+        for (int i = 0; i < size; i++)
+            out.append(char((value >> (8 * i)) & 0xff));
+    }
+
+    void patch(int position, qint64 target)
+    {
+        qToLittleEndian<quint32>(quint32(target - position), out.data() + position);
+    }
+
+    // Returns the position offsets to the node point to
+    int write(const FlatNode& node)
+    {
+        switch (node.kind)
+        {
+        case FlatNode::Table:
+            return writeTable(node);
+        case FlatNode::TableVector:
+        {
+            pad(4);
+            const int position = out.size();
+            put(node.elements.count(), 4);
+            const int slots = out.size();
+            for (int i = 0; i < node.elements.count(); i++)
+                put(0, 4);
+            for (int i = 0; i < node.elements.count(); i++)
+                patch(slots + 4 * i, write(*node.elements.at(i)));
+            return position;
+        }
+        case FlatNode::StructVector:
+        {
+            // The elements after the length are aligned
+            while (out.size() % 4 != 0 || (out.size() + 4) % node.align != 0)
+                out.append('\0');
+            const int position = out.size();
+            put(node.count, 4);
+            out.append(node.bytes);
+            return position;
+        }
+        case FlatNode::String:
+        {
+            pad(4);
+            const int position = out.size();
+            put(node.bytes.size(), 4);
+            out.append(node.bytes);
+            out.append('\0');
+            return position;
+        }
+        }
+        return 0;
+    }
+
+    int writeTable(const FlatNode& node)
+    {
+        // The inline layout: the offset to the vtable, then each field aligned to its size
+        int tableAlign = 4;
+        int slotCount = 0;
+        int size = 4;
+        QVector<int> fieldOffsets;
+        for (auto& field : node.fields)
+        {
+            const int fieldSize = field.size == 0 ? 4 : field.size;
+            tableAlign = qMax(tableAlign, fieldSize);
+            slotCount = qMax(slotCount, field.slot + 1);
+            size = (size + fieldSize - 1) / fieldSize * fieldSize;
+            fieldOffsets.append(size);
+            size += fieldSize;
+        }
+
+        pad(2);
+        const int vtable = out.size();
+        put(4 + 2 * slotCount, 2);
+        put(size, 2);
+        QVector<int> slots(slotCount, 0);
+        for (int i = 0; i < node.fields.count(); i++)
+            slots[node.fields.at(i).slot] = fieldOffsets.at(i);
+        for (int slot : slots)
+            put(slot, 2);
+
+        pad(tableAlign);
+        const int position = out.size();
+        put(quint32(position - vtable), 4);
+        for (int i = 0; i < node.fields.count(); i++)
+        {
+            const FlatField& field = node.fields.at(i);
+            while (out.size() < position + fieldOffsets.at(i))
+                out.append('\0');
+            put(field.value, field.size == 0 ? 4 : field.size);
+        }
+        for (int i = 0; i < node.fields.count(); i++)
+        {
+            if (node.fields.at(i).ref)
+                patch(position + fieldOffsets.at(i), write(*node.fields.at(i).ref));
+        }
+        return position;
+    }
+};
+
+static FlatRef intType(int bitWidth)
+{
+    return table({scalar(0, 4, bitWidth), scalar(1, 1, 1)});
+}
+
+static FlatRef field(const ArrowColumn& column, qint64 dictionaryId)
+{
+    int typeType = ARROW_TYPE_UTF8;
+    FlatRef type = table({});
+    switch (column.type)
+    {
+    case ArrowInt64:
+        typeType = ARROW_TYPE_INT;
+        type = intType(64);
+        break;
+    case ArrowFloat64:
+        typeType = ARROW_TYPE_FLOATING_POINT;
+        type = table({scalar(0, 2, ARROW_PRECISION_DOUBLE)});
+        break;
+    case ArrowTimestampMillis:
+        typeType = ARROW_TYPE_TIMESTAMP;
+        type = table({scalar(0, 2, ARROW_UNIT_MILLISECOND), offset(1, string("UTC"))});
+        break;
+    case ArrowUtf8:
+    case ArrowDictionaryUtf8:
+        break;
+    }
+    QList<FlatField> fields = {offset(0, string(column.name)), scalar(1, 1, 1), scalar(2, 1, typeType), offset(3, type), offset(5, tables({}))};
+    // The type of the field is the one of the values, the indices are int32
+    if (column.type == ArrowDictionaryUtf8)
+        fields.append(offset(4, table({scalar(0, 8, quint64(dictionaryId)), offset(1, intType(32)), scalar(2, 1, 0)})));
+    return table(fields);
+}
+
+static FlatRef message(int headerType, const FlatRef& header, qint64 bodyLength)
+{
+    return table({scalar(0, 2, ARROW_METADATA_V5), scalar(1, 1, headerType), offset(2, header), scalar(3, 8, quint64(bodyLength))});
+}
+
+// A field node or a buffer, two longs
+static void appendLongPair(QByteArray& bytes, qint64 first, qint64 second)
+{
+    char pair[16];
+    qToLittleEndian<qint64>(first, pair);
+    qToLittleEndian<qint64>(second, pair + 8);
+    bytes.append(pair, sizeof(pair));
+}
+
+static qint64 aligned(qint64 size)
+{
+    return (size + ARROW_ALIGNMENT - 1) / ARROW_ALIGNMENT * ARROW_ALIGNMENT;
+}
+
+/*!
+ * \brief recordBatch
+ * The RecordBatch table of length rows with a node per column and the buffers of the
+ * body, laid out one after the other, each aligned.
+ */
+static FlatRef recordBatch(qint64 length, const QList<QPair<qint64, qint64>>& nodes, const QList<QByteArray>& buffers)
+{
+    QByteArray nodeBytes;
+    for (auto& node : nodes)
+        appendLongPair(nodeBytes, node.first, node.second);
+    QByteArray bufferBytes;
+    qint64 bodyOffset = 0;
+    for (auto& buffer : buffers)
+    {
+        appendLongPair(bufferBytes, bodyOffset, buffer.size());
+        bodyOffset += aligned(buffer.size());
+    }
+    return table({scalar(0, 8, quint64(length)), offset(1, structs(nodeBytes, nodes.count(), 8)), offset(2, structs(bufferBytes, buffers.count(), 8))});
+}
+
+static qint64 bodyLength(const QList<QByteArray>& buffers)
+{
+    qint64 length = 0;
+    for (auto& buffer : buffers)
+        length += aligned(buffer.size());
+    return length;
+}
+
+static void appendInt32(QByteArray& bytes, qint32 value)
+{
+    char le[4];
+    qToLittleEndian<qint32>(value, le);
+    bytes.append(le, sizeof(le));
+}
+
+ArrowStreamWriter::ArrowStreamWriter(QIODevice *device, const QList<ArrowColumn> &columns)
+    : device(device), columns(columns), data(columns.count())
+{
+    for (int i = 0; i < columns.count(); i++)
+    {
+        for (int k = 0; k < columns.at(i).dictionary.count(); k++)
+            data[i].indexes.insert(columns.at(i).dictionary.at(k), k);
+        if (columns.at(i).type == ArrowUtf8)
+            appendInt32(data[i].values, 0);
+    }
+}
+
+bool ArrowStreamWriter::writeMessage(const QByteArray &metadata, const QList<QByteArray> &buffers)
+{
+    // The continuation marker and the length, then the flatbuffer padded so the body is aligned
+    QByteArray prefix;
+    appendInt32(prefix, -1);
+    appendInt32(prefix, qint32(aligned(8 + metadata.size()) - 8));
+    QByteArray bytes = prefix + metadata;
+    bytes.append(QByteArray(aligned(bytes.size()) - bytes.size(), '\0'));
+    for (auto& buffer : buffers)
+    {
+        bytes.append(buffer);
+        bytes.append(QByteArray(aligned(buffer.size()) - buffer.size(), '\0'));
+    }
+    return device->write(bytes) == bytes.size();
+}
+
+/*!
+ * \brief ArrowStreamWriter::begin
+ * The schema, then a dictionary batch per dictionary column, whose id is its index.
+ */
+bool ArrowStreamWriter::begin()
+{
+    QList<FlatRef> fields;
+    for (int i = 0; i < columns.count(); i++)
+        fields.append(field(columns.at(i), i));
+    const FlatRef schema = table({scalar(0, 2, 0), offset(1, tables(fields))});
+    if (!writeMessage(FlatWriter().finish(message(ARROW_HEADER_SCHEMA, schema, 0)), {}))
+        return false;
+
+    for (int i = 0; i < columns.count(); i++)
+    {
+        const ArrowColumn& column = columns.at(i);
+        if (column.type != ArrowDictionaryUtf8)
+            continue;
+        QByteArray offsets;
+        QByteArray text;
+        appendInt32(offsets, 0);
+        for (auto& value : column.dictionary)
+        {
+            text.append(value.toUtf8());
+            appendInt32(offsets, qint32(text.size()));
+        }
+        const QList<QByteArray> buffers = {QByteArray(), offsets, text};
+        const qint64 length = column.dictionary.count();
+        const FlatRef batch = table({scalar(0, 8, quint64(i)), offset(1, recordBatch(length, {{length, 0}}, buffers)), scalar(2, 1, 0)});
+        if (!writeMessage(FlatWriter().finish(message(ARROW_HEADER_DICTIONARY_BATCH, batch, bodyLength(buffers))), buffers))
+            return false;
+    }
+    return true;
+}
+
+void ArrowStreamWriter::appendValid(int column, bool valid)
+{
+    ColumnData& columnData = data[column];
+    const qint64 bit = rows;
+    if (bit % 8 == 0)
+        columnData.validity.append('\0');
+    if (valid)
+        columnData.validity[int(bit / 8)] = char(columnData.validity.at(int(bit / 8)) | (1 << (bit % 8)));
+    else
+        columnData.nullCount++;
+}
+
+void ArrowStreamWriter::appendNull(int column)
+{
+    appendValid(column, false);
+    ColumnData& columnData = data[column];
+    switch (columns.at(column).type)
+    {
+    case ArrowUtf8:
+        appendInt32(columnData.values, qint32(columnData.text.size()));
+        break;
+    case ArrowDictionaryUtf8:
+        appendInt32(columnData.values, 0);
+        break;
+    default:
+        columnData.values.append(QByteArray(8, '\0'));
+        break;
+    }
+}
+
+void ArrowStreamWriter::appendInt(int column, qint64 value)
+{
+    appendValid(column, true);
+    char le[8];
+    qToLittleEndian<qint64>(value, le);
+    data[column].values.append(le, sizeof(le));
+}
+
+void ArrowStreamWriter::appendDouble(int column, double value)
+{
+    appendValid(column, true);
+    char le[8];
+    qToLittleEndian<double>(value, le);
+    data[column].values.append(le, sizeof(le));
+}
+
+void ArrowStreamWriter::appendText(int column, const QString &text)
+{
+    ColumnData& columnData = data[column];
+    if (columns.at(column).type == ArrowDictionaryUtf8)
+    {
+        auto index = columnData.indexes.constFind(text);
+        if (index == columnData.indexes.constEnd())
+        {
+            appendNull(column);
+            return;
+        }
+        appendValid(column, true);
+        appendInt32(columnData.values, index.value());
+        return;
+    }
+    appendValid(column, true);
+    columnData.text.append(text.toUtf8());
+    appendInt32(columnData.values, qint32(columnData.text.size()));
+}
+
+void ArrowStreamWriter::appendTimestamp(int column, qint64 msecsSinceEpoch)
+{
+    appendInt(column, msecsSinceEpoch);
+}
+
+bool ArrowStreamWriter::endRow()
+{
+    rows++;
+    return rows < ARROW_BATCH_ROWS || writeBatch();
+}
+
+/*!
+ * \brief ArrowStreamWriter::writeBatch
+ * The rows appended since the last batch. A column without nulls has no validity
+ * buffer. The columns are emptied for the next batch.
+ */
+bool ArrowStreamWriter::writeBatch()
+{
+    if (rows == 0)
+        return true;
+    QList<QPair<qint64, qint64>> nodes;
+    QList<QByteArray> buffers;
+    for (int i = 0; i < columns.count(); i++)
+    {
+        ColumnData& columnData = data[i];
+        nodes.append({rows, columnData.nullCount});
+        buffers.append(columnData.nullCount == 0 ? QByteArray() : columnData.validity);
+        buffers.append(columnData.values);
+        if (columns.at(i).type == ArrowUtf8)
+            buffers.append(columnData.text);
+
+        columnData.validity.clear();
+        columnData.values.clear();
+        columnData.text.clear();
+        columnData.nullCount = 0;
+        if (columns.at(i).type == ArrowUtf8)
+            appendInt32(columnData.values, 0);
+    }
+    const qint64 length = rows;
+    rows = 0;
+    return writeMessage(FlatWriter().finish(message(ARROW_HEADER_RECORD_BATCH, recordBatch(length, nodes, buffers), bodyLength(buffers))), buffers);
+}
+
+bool ArrowStreamWriter::finish()
+{
+    if (!writeBatch())
+        return false;
+    QByteArray end;
+    appendInt32(end, -1);
+    appendInt32(end, 0);
+    return device->write(end) == end.size();
+}
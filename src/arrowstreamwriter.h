@@ -0,0 +1,102 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef ARROWSTREAMWRITER_H
+#define ARROWSTREAMWRITER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+enum ArrowColumnType
+{
+    ArrowInt64,
+    ArrowFloat64,
+    ArrowUtf8,
+    // Indices into a dictionary of the values, written once before the batches
+    ArrowDictionaryUtf8,
+    // Milliseconds since the epoch, in UTC
+    ArrowTimestampMillis,
+};
+
+struct ArrowColumn
+{
+    QString name;
+    ArrowColumnType type;
+    // Every value of an ArrowDictionaryUtf8 column
+    QStringList dictionary;
+};
+
+/*!
+ * \brief The ArrowStreamWriter class
+ * Writes a table in the Arrow IPC streaming format, which pyarrow, pandas, polars and
+ * DuckDB read without parsing: the schema, a dictionary batch per dictionary column,
+ * then the record batches as the rows are appended, and the end of stream marker. The
+ * flatbuffers of the messages are encoded here, without the Arrow or flatbuffers
+ * libraries. Every column is nullable, values are little-endian.
+ */
+class ArrowStreamWriter
+{
+public:
+    ArrowStreamWriter(QIODevice* device, const QList<ArrowColumn>& columns);
+
+    // The schema and the dictionaries. Returns false when they could not be written.
+    bool begin();
+    // The value of each column of a row is appended in turn, then the row is ended
+    void appendNull(int column);
+    void appendInt(int column, qint64 value);
+    void appendDouble(int column, double value);
+    // Of an ArrowUtf8 or ArrowDictionaryUtf8 column. A value not in the dictionary is null.
+    void appendText(int column, const QString& text);
+    void appendTimestamp(int column, qint64 msecsSinceEpoch);
+    // Writes a record batch once there are enough rows. Returns false when it could not be written.
+    bool endRow();
+    // The last record batch and the end of stream marker
+    bool finish();
+
+private:
+    struct ColumnData
+    {
+        QByteArray validity;
+        QByteArray values; // Fixed width values, the int32 offsets of utf8, or the int32 indices
+        QByteArray text; // The bytes of utf8
+        qint64 nullCount = 0;
+        QHash<QString, qint32> indexes; // Of the values of the dictionary
+    };
+
+    void appendValid(int column, bool valid);
+    bool writeBatch();
+    bool writeMessage(const QByteArray& metadata, const QList<QByteArray>& buffers);
+
+    QIODevice* device;
+    QList<ArrowColumn> columns;
+    QVector<ColumnData> data;
+    qint64 rows = 0;
+};
+
+#endif // ARROWSTREAMWRITER_H
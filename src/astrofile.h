@@ -25,11 +25,20 @@
 #ifndef ASTROFILE_H
 #define ASTROFILE_H
 
+#include "fileformats.h"
+#include "filerecord.h"
+#include "observingnight.h"
+#include "placeholderhash.h"
+#include "tagmap.h"
+
+#include <QAtomicInt>
 #include <QDateTime>
-#include <QFileInfo>
 #include <QString>
 #include <QImage>
 
+#include <cmath>
+#include <limits>
+
 enum ThumbnailLoadStatus
 {
     ThumbnailLoaded,
@@ -37,6 +46,33 @@ enum ThumbnailLoadStatus
     ThumbnailFailedToProcess
 };
 
+// Sizes of the thumbnail pyramid stored for every file. The processors make the
+// largest level, and the repository scales the smaller ones from it.
+#define THUMBNAIL_LEVEL_COUNT 4
+static const int thumbnailLevelSizes[THUMBNAIL_LEVEL_COUNT] = {64, 128, 256, 512};
+#define LARGEST_THUMBNAIL_SIZE (thumbnailLevelSizes[THUMBNAIL_LEVEL_COUNT - 1])
+// The tiny thumbnail, kept in memory for every file
+#define TINY_THUMBNAIL_SIZE 20
+// The linear thumbnail, kept so thumbnails can be stretched again, see LinearThumbnail
+#define LINEAR_THUMBNAIL_SIZE 256
+#define LINEAR_THUMBNAIL_LEVEL -1
+// Of the way the thumbnails are made. Rows made by an older one are made again in the
+// background, see Catalog::outdatedThumbnails. 2 added the PlaceholderHash.
+#define THUMBNAIL_VERSION 2
+// Larger frames are read a band of rows at a time when they are binned, instead of whole
+#define STREAMED_FRAME_BYTES (256LL * 1024 * 1024)
+
+// The smallest level at least size pixels large, so thumbnails are only scaled down
+inline int thumbnailLevelFor(int size)
+{
+    for (int level = 0; level < THUMBNAIL_LEVEL_COUNT; level++)
+    {
+        if (thumbnailLevelSizes[level] >= size)
+            return level;
+    }
+    return THUMBNAIL_LEVEL_COUNT - 1;
+}
+
 enum TagExtractStatus
 {
     TagExtracted,
@@ -51,12 +87,48 @@ enum AstroFileProcessStatus
     AstroFileFailedToProcess
 };
 
-enum AstroFileType
+// Why a file failed to process. Kept with the row, the file is not tried again
+// until its size or modification time changes, see Catalog::shouldProcessFile.
+enum AstroFileFailureReason
 {
-    UnknownType = -1,
-    Fits,
-    Xisf,
-    Image
+    NoFailure,
+    FailureUnsupportedType, // No processor for the file type
+    FailureUnreadable,      // The file could not be opened
+    FailureInvalidFile      // The processor could not load it, like a truncated file or an unsupported subformat
+};
+
+// Of the last time the bytes of the file were hashed again and checked against its
+// hash, see IntegrityVerifier. A changed file is unverified until it is checked again.
+enum AstroFileIntegrity
+{
+    IntegrityUnverified,
+    IntegrityIntact,
+    IntegrityMismatch,      // The bytes changed, the size and modification time did not
+    IntegrityUnreadable     // Reading the file failed
+};
+
+// Measured on the binned frame the thumbnail is made of, see FrameAnalyzer.
+// NaN, and a star count of -1, until the frame is measured.
+struct FrameQuality
+{
+    float background = std::numeric_limits<float>::quiet_NaN(); // Median, in pixel values
+    float noise = std::numeric_limits<float>::quiet_NaN(); // Of the background, 1.4826 times its MAD
+    int starCount = -1;
+    float fwhm = std::numeric_limits<float>::quiet_NaN(); // Median of the stars, in pixels of the full frame
+    float eccentricity = std::numeric_limits<float>::quiet_NaN(); // Median of the stars, 0 for round ones
+
+    bool isMeasured() const { return starCount >= 0; }
+};
+
+// The position of the frame found from its stars, see PlateSolver. NaN until it is solved.
+struct PlateSolution
+{
+    double ra = std::numeric_limits<double>::quiet_NaN(); // Degrees, of the center of the frame
+    double dec = std::numeric_limits<double>::quiet_NaN();
+    double rotation = std::numeric_limits<double>::quiet_NaN(); // Degrees from the y axis of the frame to north, counterclockwise
+    double scale = std::numeric_limits<double>::quiet_NaN(); // Arcseconds per pixel
+
+    bool isSolved() const { return !std::isnan(ra); }
 };
 
 struct AstroFile
@@ -70,76 +142,101 @@ struct AstroFile
     QString FileExtension;
     QDateTime CreatedTime;
     QDateTime LastModifiedTime;
+    qint64 FileSize = 0; // Bytes, 0 for rows written before it was kept
+    quint64 FileDevice = 0; // With FileInode, the file whichever hard link it is found by, see FileRecord
+    quint64 FileInode = 0; // 0 where the platform has none, and for rows written before it was kept
     QString FileHash;
     QString ImageHash;
-    QMap<QString, QString> Tags;
-
-    QImage thumbnail;
-    QImage tinyThumbnail;
+    QString QuickHash; // Size and sampled blocks, FileHash is only computed when this collides
+    quint64 PerceptualHash = 0; // Of the thumbnail, for near duplicates, see PerceptualHash
+    PlaceholderHash Placeholder; // Of the thumbnail, painted until it is loaded
+    QByteArray StretchParameters; // Of the thumbnail, see StretchParams::toByteArray
+    FrameQuality Quality;
+    PlateSolution Solution; // Only looked for in frames without OBJCTRA and OBJCTDEC
+    TagMap Tags;
+
+    // Read once from the Tags for filtering and showing the rows, see updateFacets
+    QString Object;
+    QString Instrument;
+    QString Filter;
+    QDate ObservationDate;
+    qint64 ObservationTime = ObservingNight::missingTime; // Milliseconds since the epoch of DATE-OBS
+    QDate ObservationNight; // The date of the evening of the night, see ObservingNight
+    double ExposureTime = 0; // Seconds, 0 if unknown
+
+    QImage thumbnail; // The largest level when processed, the level asked for when loaded
+    int thumbnailLevel = THUMBNAIL_LEVEL_COUNT - 1;
+    QImage tinyThumbnail; // Moved to the atlas of the Catalog when added, see Catalog::tinyThumbnail
+    // In the TinyThumbnailAtlas of the Catalog. The one field the Catalog changes in the
+    // rows it holds, when it compacts the atlas, so it is atomic.
+    QAtomicInt tinyThumbnailSlot = -1;
+    quint64 rowHandle = 0; // Of the row in the Catalog, see RowHandles
+    QImage linearThumbnail; // Before the stretch, when processed, see FileProcessor::getLinearThumbnail
     ThumbnailLoadStatus thumbnailStatus;
     TagExtractStatus tagStatus;
     AstroFileProcessStatus processStatus;
+    AstroFileFailureReason FailureReason = NoFailure;
+    int ThumbnailVersion = 0; // THUMBNAIL_VERSION when processed, 0 for rows written before it was kept
+    AstroFileIntegrity Integrity = IntegrityUnverified;
     bool IsHidden;
 
     AstroFile()
     {
     }
 
-    AstroFile(const AstroFile& other)
-        : Id(other.Id),
-          FileName(other.FileName),
-          FullPath(other.FullPath),
-          DirectoryPath(other.DirectoryPath),
-          VolumeName(other.VolumeName),
-          FileType(other.FileType),
-          FileExtension(other.FileExtension),
-          CreatedTime(other.CreatedTime),
-          LastModifiedTime(other.LastModifiedTime),
-          FileHash(other.FileHash),
-          ImageHash(other.ImageHash),
-          Tags(other.Tags),
-          thumbnail(other.thumbnail),
-          tinyThumbnail(other.tinyThumbnail),
-          thumbnailStatus(other.thumbnailStatus),
-          tagStatus(other.tagStatus),
-          processStatus(other.processStatus),
-          IsHidden(other.IsHidden)
+    // Every member is implicitly shared or trivial, so a copy only takes references,
+    // and moves are left to the compiler.
+    AstroFile(const AstroFile& other) = default;
+    AstroFile(AstroFile&& other) noexcept = default;
+    AstroFile& operator=(const AstroFile& other) = default;
+    AstroFile& operator=(AstroFile&& other) noexcept = default;
+
+    void updateFacets()
+    {
+        Object = Tags.value(TagObject);
+        Instrument = Tags.value(TagInstrument);
+        Filter = Tags.value(TagFilter);
+        ObservationDate = QDate::fromString(Tags.value(TagDateObs), Qt::ISODate);
+        ObservationTime = ObservingNight::parseTime(Tags.value(TagDateObs));
+        ObservationNight = ObservingNight::nightOf(ObservationTime, DirectoryPath);
+        ExposureTime = Tags.value(TagExposureTime).toDouble();
+    }
+
+    // Once they are in the db the pixels are only read from there, into the thumbnail
+    // cache of the view. The tiny thumbnail stays, the Catalog moves it to its atlas.
+    void dropThumbnailPixels()
+    {
+        thumbnail = QImage();
+        linearThumbnail = QImage();
+    }
+
+    // Files without a FileHash have a unique QuickHash, so they are only duplicates of themselves
+    QString duplicateKey() const
     {
+        return FileHash.isEmpty() ? FullPath : FileHash;
     }
 
-    AstroFile(const QFileInfo& fileInfo)
+    // Nothing is read from the disk, the record has it all already
+    AstroFile(const FileRecord& record)
     {
-        FullPath = fileInfo.absoluteFilePath();
-        CreatedTime = fileInfo.birthTime();
-        LastModifiedTime = fileInfo.lastModified();
-        DirectoryPath = fileInfo.canonicalPath();
-        FileName = fileInfo.baseName();
-        FileExtension = fileInfo.suffix();
+        FullPath = record.FullPath;
+        CreatedTime = record.birthTime();
+        LastModifiedTime = record.lastModified();
+        FileSize = record.Size;
+        FileDevice = record.Device;
+        FileInode = record.Inode;
+        DirectoryPath = record.CanonicalDirectory;
+        // Same as QFileInfo::baseName and suffix
+        const QString name = record.fileName();
+        const int firstDot = name.indexOf('.');
+        const int lastDot = name.lastIndexOf('.');
+        FileName = firstDot == -1 ? name : name.left(firstDot);
+        FileExtension = lastDot == -1 ? QString() : name.mid(lastDot + 1);
 
         IsHidden = false;
 
-        QString suffix = FileExtension.toLower();
-        if ( suffix == "fits")
-            FileType = AstroFileType::Fits;
-        else if (suffix == "fit")
-            FileType = AstroFileType::Fits;
-        else if (suffix== "xisf")
-            FileType = AstroFileType::Xisf;
-        else if (suffix == "png")
-            FileType = AstroFileType::Image;
-        else if (suffix == "jpg")
-            FileType = AstroFileType::Image;
-        else if (suffix == "gif")
-            FileType = AstroFileType::Image;
-        else if (suffix == "jpeg")
-            FileType = AstroFileType::Image;
-        else if (suffix == "tif")
-            FileType = AstroFileType::Image;
-        else if (suffix == "tiff")
-            FileType = AstroFileType::Image;
-        else if (suffix == "bmp")
-            FileType = AstroFileType::Image;
-        else FileType = AstroFileType::UnknownType;
+        // The header phase checks it against the signature in the head of the file
+        FileType = FileFormats::typeOfName(name);
     }
 };
 
@@ -0,0 +1,640 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "asyncfileio.h"
+#include "metrics.h"
+#include "objectstore.h"
+
+#include <QDebug>
+#include <QDir>
+
+#if defined(Q_OS_LINUX)
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(Q_OS_WIN)
+#include <io.h>
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+// Reads in flight at once when there is no volume to take the depth from, and the
+// most any volume gets, which is also the size of the rings
+#define DEFAULT_QUEUE_DEPTH 32
+#define MAX_QUEUE_DEPTH     64
+
+// Reads of an object past its prefetched head are fetched in windows of this size
+#define PREFETCHED_OBJECT_WINDOW (1024 * 1024)
+
+#if defined(Q_OS_LINUX)
+typedef int NativeHandle;
+#define INVALID_NATIVE_HANDLE -1
+#elif defined(Q_OS_WIN)
+typedef HANDLE NativeHandle;
+#define INVALID_NATIVE_HANDLE INVALID_HANDLE_VALUE
+#endif
+
+namespace {
+
+// Counts the bytes of a completed read against the volume
+void throttle(VolumeIo* volume, const FileReadRequest& request)
+{
+    if (volume != nullptr && request.bytesRead > 0)
+        volume->throttle(request.bytesRead);
+}
+
+#if defined(Q_OS_LINUX) || defined(Q_OS_WIN)
+
+// A block is read in full up to the end of the file. A direct read asks for whole
+// blocks of DIRECT_IO_ALIGNMENT, and gets less in the last one.
+bool isComplete(const FileReadRequest& request, qint64 end)
+{
+    return request.bytesRead == qBound<qint64>(0, end - request.offset, request.length);
+}
+
+int queueDepthOf(VolumeIo* volume)
+{
+    const int depth = volume != nullptr ? volume->policy().queueDepth : DEFAULT_QUEUE_DEPTH;
+    return qBound(1, depth, MAX_QUEUE_DEPTH);
+}
+
+struct NativeRead
+{
+    NativeHandle handle;
+    FileReadRequest* request;
+    qint64 end; // The size of the file
+};
+
+#endif
+
+#if !defined(Q_OS_LINUX)
+
+// Where the reads can not be queued, and for files QFile opened that the native
+// reads can not use
+bool readSequentially(QFile& file, QVector<FileReadRequest>& requests, VolumeIo* volume)
+{
+    const qint64 end = file.size();
+    bool complete = true;
+    for (auto& request : requests)
+    {
+        request.bytesRead = file.seek(request.offset) ? file.read(request.buffer, request.length) : -1;
+        throttle(volume, request);
+        complete &= isComplete(request, end);
+    }
+    return complete;
+}
+
+#endif
+
+#if defined(Q_OS_LINUX)
+
+/*!
+ * \brief The IoRing class
+ * An io_uring, set up with the system calls themselves, so there is no liburing to
+ * depend on. Each thread has its own, see ofThread, and only queues reads to it.
+ */
+class IoRing
+{
+public:
+    explicit IoRing(unsigned entries);
+    ~IoRing();
+
+    bool isValid() const { return ringFd >= 0; }
+
+    // Returns false when the submission queue is full
+    bool queueRead(const NativeRead& read, quint64 userData);
+    // Submits the queued reads and waits for at least one to complete
+    bool submitAndWait();
+    bool nextCompletion(quint64& userData, int& result);
+
+    // The ring of the calling thread, nullptr when the kernel has none
+    static IoRing* ofThread();
+    // Closes the ring of the calling thread, which cancels the reads in flight, and no
+    // thread sets up one again
+    static void abandon();
+
+private:
+    int ringFd = -1;
+    unsigned submissionEntries = 0;
+    unsigned queued = 0; // Not submitted yet
+
+    void* submissionRing = MAP_FAILED;
+    void* completionRing = MAP_FAILED;
+    size_t submissionRingSize = 0;
+    size_t completionRingSize = 0;
+    io_uring_sqe* submissionEntryArray = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t submissionEntryArraySize = 0;
+
+    unsigned* submissionHead = nullptr;
+    unsigned* submissionTail = nullptr;
+    unsigned* submissionMask = nullptr;
+    unsigned* submissionIndices = nullptr;
+    unsigned* completionHead = nullptr;
+    unsigned* completionTail = nullptr;
+    unsigned* completionMask = nullptr;
+    io_uring_cqe* completions = nullptr;
+};
+
+IoRing::IoRing(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (ringFd < 0)
+        return;
+
+    submissionEntries = params.sq_entries;
+    submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap)
+        submissionRingSize = completionRingSize = qMax(submissionRingSize, completionRingSize);
+
+    submissionRing = mmap(nullptr, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    completionRing = singleMap ? submissionRing
+                               : mmap(nullptr, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    submissionEntryArraySize = params.sq_entries * sizeof(io_uring_sqe);
+    submissionEntryArray = static_cast<io_uring_sqe*>(mmap(nullptr, submissionEntryArraySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+    if (submissionRing == MAP_FAILED || completionRing == MAP_FAILED || submissionEntryArray == MAP_FAILED)
+    {
+        close(ringFd);
+        ringFd = -1;
+        return;
+    }
+
+    char* sq = static_cast<char*>(submissionRing);
+    submissionHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    submissionTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    submissionMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    submissionIndices = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(completionRing);
+    completionHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    completionTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    completionMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    completions = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+IoRing::~IoRing()
+{
+    if (submissionEntryArray != MAP_FAILED)
+        munmap(submissionEntryArray, submissionEntryArraySize);
+    if (completionRing != MAP_FAILED && completionRing != submissionRing)
+        munmap(completionRing, completionRingSize);
+    if (submissionRing != MAP_FAILED)
+        munmap(submissionRing, submissionRingSize);
+    if (ringFd >= 0)
+        close(ringFd);
+}
+
+bool IoRing::queueRead(const NativeRead &read, quint64 userData)
+{
+    const unsigned tail = *submissionTail;
+    if (tail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE) >= submissionEntries)
+        return false;
+
+    const unsigned index = tail & *submissionMask;
+    io_uring_sqe* entry = &submissionEntryArray[index];
+    memset(entry, 0, sizeof(*entry));
+    entry->opcode = IORING_OP_READ;
+    entry->fd = read.handle;
+    entry->addr = quint64(reinterpret_cast<quintptr>(read.request->buffer));
+    entry->len = unsigned(read.request->length);
+    entry->off = quint64(read.request->offset);
+    entry->user_data = userData;
+    submissionIndices[index] = index;
+    __atomic_store_n(submissionTail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+    return true;
+}
+
+bool IoRing::submitAndWait()
+{
+    for (;;)
+    {
+        const int submitted = int(syscall(__NR_io_uring_enter, ringFd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+        if (submitted >= 0)
+        {
+            queued -= unsigned(submitted);
+            return true;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return false;
+    }
+}
+
+bool IoRing::nextCompletion(quint64 &userData, int &result)
+{
+    const unsigned head = *completionHead;
+    if (head == __atomic_load_n(completionTail, __ATOMIC_ACQUIRE))
+        return false;
+    const io_uring_cqe& completion = completions[head & *completionMask];
+    userData = completion.user_data;
+    result = completion.res;
+    __atomic_store_n(completionHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Once a ring could not be set up, as on kernels before 5.1 or where seccomp forbids
+// it, no thread tries again
+static std::atomic<bool> ringsUnavailable {false};
+static thread_local std::unique_ptr<IoRing> threadRing;
+
+IoRing* IoRing::ofThread()
+{
+    if (threadRing)
+        return threadRing.get();
+    if (ringsUnavailable)
+        return nullptr;
+    threadRing.reset(new IoRing(MAX_QUEUE_DEPTH));
+    if (threadRing->isValid())
+        return threadRing.get();
+    threadRing.reset();
+    ringsUnavailable = true;
+    return nullptr;
+}
+
+void IoRing::abandon()
+{
+    ringsUnavailable = true;
+    threadRing.reset();
+}
+
+// Reads the rest of a block after the part of it the ring read
+void readRest(const NativeRead& read, qint64 done)
+{
+    FileReadRequest& request = *read.request;
+    while (done < request.length && request.offset + done < read.end)
+    {
+        const ssize_t bytes = pread(read.handle, request.buffer + done, size_t(request.length - done), off_t(request.offset + done));
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+        {
+            request.bytesRead = -1;
+            return;
+        }
+        if (bytes == 0)
+            break;
+        done += bytes;
+    }
+    request.bytesRead = done;
+}
+
+bool readNative(QVector<NativeRead>& reads, int depth, VolumeIo* volume)
+{
+    static std::atomic<qint64>& queuedCount = Metrics::counter("io.queued_reads");
+    IoRing* ring = IoRing::ofThread();
+    int next = 0;
+    int inFlight = 0;
+    while (ring != nullptr && (next < reads.count() || inFlight > 0))
+    {
+        while (next < reads.count() && inFlight < depth && ring->queueRead(reads.at(next), quint64(next)))
+        {
+            next++;
+            inFlight++;
+        }
+        if (!ring->submitAndWait())
+        {
+            // Not expected once the ring was set up
+            qWarning() << "io_uring_enter failed:" << strerror(errno);
+            IoRing::abandon();
+            return false;
+        }
+
+        quint64 index;
+        int result;
+        while (ring->nextCompletion(index, result))
+        {
+            inFlight--;
+            queuedCount++;
+            const NativeRead& read = reads.at(int(index));
+            if (result == -EINVAL || result == -EOPNOTSUPP)
+                readRest(read, 0); // IORING_OP_READ is from 5.6
+            else if (result < 0)
+                read.request->bytesRead = -1;
+            else if (result < read.request->length)
+                readRest(read, result); // Short, at the end of the file or interrupted
+            else
+                read.request->bytesRead = result;
+            throttle(volume, *read.request);
+        }
+    }
+
+    // Every read when there is no ring
+    for (; next < reads.count(); next++)
+    {
+        readRest(reads.at(next), 0);
+        throttle(volume, *reads.at(next).request);
+    }
+
+    bool complete = true;
+    for (auto& read : reads)
+        complete &= isComplete(*read.request, read.end);
+    return complete;
+}
+
+NativeHandle openNative(const QString& path)
+{
+    return ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+}
+
+void closeNative(NativeHandle handle)
+{
+    ::close(handle);
+}
+
+#elif defined(Q_OS_WIN)
+
+// Overlapped reads, completed in the order they were issued. Each read in flight has
+// an OVERLAPPED of its own, reused by the read depth places after it.
+bool readNative(QVector<NativeRead>& reads, int depth, VolumeIo* volume)
+{
+    static std::atomic<qint64>& queuedCount = Metrics::counter("io.queued_reads");
+    const int count = reads.count();
+    QVector<OVERLAPPED> overlapped(qMin(depth, count));
+    for (auto& slot : overlapped)
+    {
+        memset(&slot, 0, sizeof(slot));
+        slot.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    }
+
+    QVector<bool> issued(count, false);
+    int next = 0;
+    for (int done = 0; done < count; done++)
+    {
+        for (; next < count && next - done < overlapped.count(); next++)
+        {
+            FileReadRequest& request = *reads.at(next).request;
+            OVERLAPPED& slot = overlapped[next % overlapped.count()];
+            HANDLE event = slot.hEvent;
+            memset(&slot, 0, sizeof(slot));
+            slot.hEvent = event;
+            slot.Offset = DWORD(request.offset);
+            slot.OffsetHigh = DWORD(request.offset >> 32);
+            ResetEvent(event);
+            if (ReadFile(reads.at(next).handle, request.buffer, DWORD(request.length), nullptr, &slot) || GetLastError() == ERROR_IO_PENDING)
+                issued[next] = true;
+            else
+                request.bytesRead = GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+        }
+
+        FileReadRequest& request = *reads.at(done).request;
+        if (issued.at(done))
+        {
+            DWORD bytes = 0;
+            if (GetOverlappedResult(reads.at(done).handle, &overlapped[done % overlapped.count()], &bytes, TRUE))
+                request.bytesRead = bytes;
+            else
+                request.bytesRead = GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+            queuedCount++;
+        }
+        throttle(volume, request);
+    }
+
+    for (auto& slot : overlapped)
+        CloseHandle(slot.hEvent);
+
+    bool complete = true;
+    for (auto& read : reads)
+        complete &= isComplete(*read.request, read.end);
+    return complete;
+}
+
+NativeHandle openNative(const QString& path)
+{
+    return CreateFileW(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(path).utf16()), GENERIC_READ,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                       FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+}
+
+void closeNative(NativeHandle handle)
+{
+    CloseHandle(handle);
+}
+
+#endif
+
+} // namespace
+
+bool AsyncFileIo::read(QFile &file, QVector<FileReadRequest> &requests, VolumeIo *volume, bool unbuffered)
+{
+    if (requests.isEmpty())
+        return true;
+
+#if defined(Q_OS_LINUX)
+    QVector<NativeRead> reads;
+    reads.reserve(requests.count());
+    for (auto& request : requests)
+        reads.append({file.handle(), &request, file.size()});
+
+    // O_DIRECT for these reads only. A file system without it refuses the flag, and
+    // the reads that fail direct are read again through the cache.
+    const int flags = unbuffered ? fcntl(file.handle(), F_GETFL) : -1;
+    const bool direct = flags != -1 && fcntl(file.handle(), F_SETFL, flags | O_DIRECT) == 0;
+    bool complete = readNative(reads, queueDepthOf(volume), volume);
+    if (direct)
+    {
+        fcntl(file.handle(), F_SETFL, flags);
+        if (!complete)
+            complete = readNative(reads, queueDepthOf(volume), volume);
+    }
+    return complete;
+#elif defined(Q_OS_WIN)
+    // The handle QFile opened is not overlapped, the reads go through one that is
+    const HANDLE fileHandle = reinterpret_cast<HANDLE>(_get_osfhandle(file.handle()));
+    const DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    HANDLE handle = unbuffered ? ReOpenFile(fileHandle, GENERIC_READ, share, FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING) : INVALID_HANDLE_VALUE;
+    const bool direct = handle != INVALID_HANDLE_VALUE;
+    if (!direct)
+        handle = ReOpenFile(fileHandle, GENERIC_READ, share, FILE_FLAG_OVERLAPPED);
+    if (handle == INVALID_HANDLE_VALUE)
+        return readSequentially(file, requests, volume);
+    QVector<NativeRead> reads;
+    reads.reserve(requests.count());
+    for (auto& request : requests)
+        reads.append({handle, &request, file.size()});
+    bool complete = readNative(reads, queueDepthOf(volume), volume);
+    CloseHandle(handle);
+    if (direct && !complete)
+        complete = read(file, requests, volume, false);
+    return complete;
+#else
+    Q_UNUSED(unbuffered);
+    return readSequentially(file, requests, volume);
+#endif
+}
+
+QVector<QByteArray> AsyncFileIo::readHeads(const QStringList &paths, qint64 length)
+{
+    // The objects of an object store are fetched together with range requests
+    QStringList objectPaths;
+    QStringList filePaths;
+    bool hasObjects = false;
+    for (auto& path : paths)
+    {
+        const bool isObject = ObjectStore::isObjectPath(path);
+        hasObjects = hasObjects || isObject;
+        objectPaths.append(isObject ? path : QString());
+        filePaths.append(isObject ? QString() : path);
+    }
+    if (hasObjects)
+    {
+        QVector<QByteArray> heads = ObjectStore::readHeads(objectPaths, length);
+        const QVector<QByteArray> fileHeads = readHeads(filePaths, length);
+        for (int i = 0; i < paths.count(); i++)
+        {
+            if (!filePaths.at(i).isEmpty())
+                heads[i] = fileHeads.at(i);
+        }
+        return heads;
+    }
+
+    QVector<QByteArray> heads(paths.count());
+    QVector<FileReadRequest> requests(paths.count());
+
+#if defined(Q_OS_LINUX) || defined(Q_OS_WIN)
+    QVector<NativeRead> reads;
+    reads.reserve(paths.count());
+    for (int i = 0; i < paths.count(); i++)
+    {
+        if (paths.at(i).isEmpty())
+            continue;
+        NativeHandle handle = openNative(paths.at(i));
+        if (handle == INVALID_NATIVE_HANDLE)
+            continue;
+        heads[i].resize(length);
+        requests[i] = {0, length, heads[i].data()};
+        reads.append({handle, &requests[i], std::numeric_limits<qint64>::max()});
+    }
+    readNative(reads, DEFAULT_QUEUE_DEPTH, nullptr);
+    for (auto& read : reads)
+        closeNative(read.handle);
+#else
+    for (int i = 0; i < paths.count(); i++)
+    {
+        QFile file(paths.at(i));
+        if (paths.at(i).isEmpty() || !file.open(QIODevice::ReadOnly))
+            continue;
+        heads[i].resize(length);
+        requests[i] = {0, length, heads[i].data()};
+        QVector<FileReadRequest> request = {requests.at(i)};
+        readSequentially(file, request, nullptr);
+        requests[i] = request.at(0);
+    }
+#endif
+
+    for (int i = 0; i < heads.count(); i++)
+    {
+        if (requests.at(i).bytesRead <= 0)
+            heads[i].clear();
+        else
+            heads[i].truncate(int(requests.at(i).bytesRead));
+    }
+    return heads;
+}
+
+bool AsyncFileIo::isQueued()
+{
+#if defined(Q_OS_LINUX)
+    return IoRing::ofThread() != nullptr;
+#elif defined(Q_OS_WIN)
+    return true;
+#else
+    return false;
+#endif
+}
+
+PrefetchedFile::PrefetchedFile(const QString &path, const QByteArray &head) : _file(path), _head(head)
+{
+}
+
+bool PrefetchedFile::open(OpenMode mode)
+{
+    if (mode != QIODevice::ReadOnly)
+        return false;
+    return QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+void PrefetchedFile::close()
+{
+    _file.close();
+    QIODevice::close();
+}
+
+qint64 PrefetchedFile::readData(char *data, qint64 maxSize)
+{
+    const qint64 offset = pos();
+    if (offset + maxSize <= _head.size())
+    {
+        memcpy(data, _head.constData() + offset, size_t(maxSize));
+        return maxSize;
+    }
+
+    if (ObjectStore::isObjectPath(_file.fileName()))
+        return readObject(data, offset, maxSize);
+    if (!_file.isOpen() && !_file.open(QIODevice::ReadOnly))
+        return -1;
+    if (!_file.seek(offset))
+        return -1;
+    return _file.read(data, maxSize);
+}
+
+qint64 PrefetchedFile::readObject(char *data, qint64 offset, qint64 maxSize)
+{
+    if (offset < _windowOffset || offset + maxSize > _windowOffset + _window.size())
+    {
+        // The headers that do not fit the head are read on in small steps, a window
+        // saves a range request for each of them
+        const qint64 start = offset / PREFETCHED_OBJECT_WINDOW * PREFETCHED_OBJECT_WINDOW;
+        const qint64 end = (offset + maxSize + PREFETCHED_OBJECT_WINDOW - 1) / PREFETCHED_OBJECT_WINDOW * PREFETCHED_OBJECT_WINDOW;
+        _window.resize(end - start);
+        QVector<FileReadRequest> request = {{start, end - start, _window.data()}};
+        ObjectStore::read(_file.fileName(), request);
+        if (request.at(0).bytesRead < 0)
+        {
+            _window.clear();
+            return -1;
+        }
+        _window.truncate(request.at(0).bytesRead);
+        _windowOffset = start;
+    }
+
+    const qint64 length = qBound<qint64>(0, _windowOffset + _window.size() - offset, maxSize);
+    memcpy(data, _window.constData() + (offset - _windowOffset), size_t(length));
+    return length;
+}
+
+qint64 PrefetchedFile::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
@@ -0,0 +1,106 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef ASYNCFILEIO_H
+#define ASYNCFILEIO_H
+
+#include "volumeio.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>
+#include <QStringList>
+#include <QVector>
+
+// Of the blocks and buffers of unbuffered reads: a page, and a whole number of the
+// sectors of any disk
+#define DIRECT_IO_ALIGNMENT 4096
+
+// A block of a file to read, into a buffer of at least length bytes
+struct FileReadRequest
+{
+    qint64 offset = 0;
+    qint64 length = 0;
+    char* buffer = nullptr;
+    qint64 bytesRead = 0; // Less than length at the end of the file, -1 when the read failed
+};
+
+/*!
+ * \brief The AsyncFileIo class
+ * Reads many blocks at once, so a fast disk has a deep queue of reads to work on
+ * instead of one blocking read at a time. On Linux the reads are queued to an
+ * io_uring of the calling thread, on Windows they are overlapped reads. Elsewhere,
+ * and where the kernel has no io_uring, they are read one after the other.
+ *
+ * The calls return once every block is read, the threads that decode the files get
+ * them from memory and never wait for the disk.
+ */
+class AsyncFileIo
+{
+public:
+    // Reads the blocks of the file, as many at once as the queue depth of the volume.
+    // The volume is paced as each read completes. Returns false when a block could not
+    // be read in full, up to the end of the file. Unbuffered reads go past the page
+    // cache where the file system allows it, their offsets, lengths and buffers
+    // aligned to DIRECT_IO_ALIGNMENT.
+    static bool read(QFile& file, QVector<FileReadRequest>& requests, VolumeIo* volume = nullptr, bool unbuffered = false);
+
+    // The first length bytes of each file, all read together, shorter for a shorter file.
+    // Empty for an empty path and for a file that could not be read. The files are open
+    // at the same time, the caller passes a few dozen at a time.
+    static QVector<QByteArray> readHeads(const QStringList& paths, qint64 length);
+
+    // Whether the reads are queued to the kernel, rather than read one after the other
+    static bool isQueued();
+};
+
+/*!
+ * \brief The PrefetchedFile class
+ * A file of which the head was read ahead, see AsyncFileIo::readHeads. Reads within the
+ * head are served from memory, the file is only opened for reads past it. Reads past
+ * the head of an object are fetched a window at a time.
+ */
+class PrefetchedFile : public QIODevice
+{
+public:
+    PrefetchedFile(const QString& path, const QByteArray& head);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return false; }
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    QFile _file;
+    QByteArray _head;
+    QByteArray _window;
+    qint64 _windowOffset = 0;
+
+    qint64 readObject(char* data, qint64 offset, qint64 maxSize);
+};
+
+#endif // ASYNCFILEIO_H
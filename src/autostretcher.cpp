@@ -22,11 +22,19 @@
     SOFTWARE.
 */
 
+#include "allocationtracker.h"
 #include "autostretcher.h"
+#include "framebufferpool.h"
+#include "metrics.h"
 
 #include <QElapsedTimer>
+#include <QList>
+#include <QtConcurrent>
 #include <QDebug>
 #include <QtGlobal>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
 /*
@@ -53,8 +61,30 @@
  * needed. The spec was mainly giving floating point examples and calculations in the
  * [0,1] range, and therefore we followed that practise. We porobably can get away without
  * normalizing the input.
+ *
+ * The frame is not normalized in a float copy. The statistics are normalized once, and
+ * the normalization is folded into the constants of the display function, so the stretch
+ * works on the pixel values as they are. The input is either a buffer that is stretched
+ * in place, or the stored (big-endian) pixels of a mapped FITS file. The BZERO and BSCALE
+ * of scaled integer images are folded in the same way, see setScaling.
  */
 
+// Pixels sampled from each channel for the statistics, when there is no histogram
+#define STATISTICS_SAMPLE_SIZE 250000
+
+// Rows of the image written by one task of a parallel stretchToImage, and rows
+// scanned or packed between two checks of the cancellation token
+#define STRETCH_BAND_ROWS 64
+
+// 8 and 16 bit pixels take at most 65536 values, so a histogram or a lookup table over all
+// of them is small. Their statistics are exact, and they are stretched with a lookup table.
+template <typename T>
+constexpr bool isSmallInteger = std::is_integral<T>::value && sizeof(T) <= 2;
+
+// The range of stored parameters is in the values of this sample type
+template <typename T>
+constexpr int sampleTypeOf = int(sizeof(T) * 8) * (std::is_floating_point<T>::value ? -1 : 1);
+
 template<typename T>
 AutoStretcher<T>::AutoStretcher(int width, int height, int numberOfChannels, int fitsDataType)
 {
@@ -62,41 +92,60 @@ AutoStretcher<T>::AutoStretcher(int width, int height, int numberOfChannels, int
     _height = height;
     _numberOfChannels = numberOfChannels;
     _fitsDataType = fitsDataType;
+    _data = nullptr;
+    _storedData = nullptr;
+    _out = nullptr;
+    _histograms = nullptr;
+    _zero = 0;
+    stretchParams = StretchParams();
 }
 
 template<typename T>
 AutoStretcher<T>::~AutoStretcher()
 {
-    delete [] _normalData;
+    FrameBufferPool::release(reinterpret_cast<unsigned char*>(_histograms));
+}
+
+template<typename T>
+void AutoStretcher<T>::setCancellationToken(const CancellationToken &token)
+{
+    _cancellationToken = token;
 }
 
 template<typename T>
 void AutoStretcher<T>::setData(T *data)
 {
     _data = data;
-    getRange();
-    normalize();
+    _storedData = nullptr;
+    _out = data;
 }
 
+/*!
+ * \brief AutoStretcher::setStoredData
+ * \param storedData The data unit of an uncompressed FITS file, see fitsStoredPixel
+ * \param out Receives the frame from stretch(), the stored data is not modified. Not needed
+ *        when the frame is only stretched with stretchToImage().
+ */
 template<typename T>
-void AutoStretcher<T>::normalize()
+void AutoStretcher<T>::setStoredData(const unsigned char *storedData, T *out)
 {
-    _normalData = new float[_width*_height*_numberOfChannels];
-    T* it = _data;
-    float* fIt = _normalData;
-    float range = _rangeMax - _rangeMin;
-    for (int c = 0; c < _numberOfChannels; c++)
-    {
-        for (int i = 0; i < _height; i++)
-        {
-            for (int j = 0; j < _width; j++)
-            {
-                    *fIt = (float)*it / range;
-                    it++;
-                    fIt++;
-            }
-        }
-    }
+    _data = nullptr;
+    _storedData = storedData;
+    _out = out;
+}
+
+/*!
+ * \brief AutoStretcher::setScaling
+ * A physical value is stored * bscale + bzero, so normalized over the range it is
+ * (stored + bzero / bscale) / range, with the range of the stored values. Only the
+ * offset is left to fold into the statistics and the constants, the scale cancels
+ * out. bscale is positive.
+ */
+template<typename T>
+void AutoStretcher<T>::setScaling(double bscale, double bzero)
+{
+    Q_ASSERT(bscale > 0);
+    _zero = float(bzero / bscale);
 }
 
 template<typename T>
@@ -105,23 +154,86 @@ StretchParams AutoStretcher<T>::getParams()
     return stretchParams;
 }
 
-template <typename T>
-float median(T* data, int len, int sampleSize)
+/*!
+ * \brief AutoStretcher::setParams
+ * Uses the parameters stored from an earlier calculateParams() of the same frame, so
+ * the frame is not scanned for statistics. Returns false, and leaves the parameters unset,
+ * when they do not fit the frame.
+ */
+template<typename T>
+bool AutoStretcher<T>::setParams(const StretchParams &params)
 {
-    std::vector<float> d;
-    int jump = len/sampleSize;
-    if (jump == 0)
-        jump = 1;
-    T* it = data;
-    int count = 0;
-    while (it < (data + len))
-    {
-        d.push_back(*it);
-        it += jump;
-        count++;
-    }
-    std::sort(d.begin(), d.end());
-    return d[count/2];
+    if (params.numberOfChannels != _numberOfChannels || params.sampleType != sampleTypeOf<T> || !(params.rangeMax > params.rangeMin))
+        return false;
+
+    stretchParams = params;
+    _rangeMin = T(params.rangeMin);
+    _rangeMax = T(params.rangeMax);
+    _range = _rangeMax - _rangeMin;
+    if (_range == 0)
+        return false;
+    calculateConstants();
+    return true;
+}
+
+/*!
+ * \brief StretchParams::toByteArray
+ * The struct as it is, in native byte order, like the catalog snapshot. A stored value
+ * of any other size is rejected by fromByteArray and the statistics are calculated again.
+ */
+QByteArray StretchParams::toByteArray() const
+{
+    return QByteArray(reinterpret_cast<const char*>(this), sizeof(StretchParams));
+}
+
+bool StretchParams::fromByteArray(const QByteArray &data, StretchParams &params)
+{
+    if (data.size() != sizeof(StretchParams))
+        return false;
+    memcpy(&params, data.constData(), sizeof(StretchParams));
+    return params.numberOfChannels >= 1 && params.numberOfChannels <= 3;
+}
+
+// The MidtonesTransferFunction of AutoStretcher
+static float midtonesTransfer(float x, float m)
+{
+    if (x == 0.0f)
+        return 0;
+    if (x == 1.0f)
+        return 1;
+    if (x == m)
+        return 0.5f;
+    Q_ASSERT((2 * m - 1) * x - m != 0);
+    return (m - 1) * x / ((2 * m - 1) * x - m);
+}
+
+/*!
+ * \brief StretchParam::fromStatistics
+ * The parameters of the screen transfer function of a channel, from its normalized
+ * median and median absolute deviation.
+ */
+StretchParam StretchParam::fromStatistics(float median, float mad, float B, float C)
+{
+    float normalizedMedian = 1.4826f * mad;
+    int A = median > 0.5 ? 1 : 0;
+    float S;
+    if (A == 1 || normalizedMedian == 0)
+        S = 0;
+    else
+        S = fmin(1, fmax(0, median + C * normalizedMedian));
+
+    float H;
+    if (A == 0 || normalizedMedian == 0)
+        H = 1;
+    else
+        H = fmin(1, fmax(0, median - C * normalizedMedian));
+
+    float M;
+    if (A == 0)
+        M = midtonesTransfer(median - S, B);
+    else
+        M = midtonesTransfer(B, H - median);
+    return {A, B, C, S, H, M, median, mad};
 }
 
 template <typename T>
@@ -135,178 +247,398 @@ float medianf(std::vector<T> &data)
 template <typename T>
 void AutoStretcher<T>::calculateParams()
 {
+    static LatencyHistogram& paramsLatency = Metrics::histogram(QString("stretch.params.") + fitsPixelTypeName<T>());
+    static AllocationCounter& stretchAllocations = AllocationTracker::counter("stretch");
+    ScopedLatency latency(paramsLatency);
+    AllocationScope allocations(stretchAllocations);
     QElapsedTimer timer;
     timer.start();
-    int sampleSize = 250000;
 
-    int channelSize = _width * _height;
+    scanFrame();
+    if (_cancellationToken.isCanceled())
+        return;
     float* channelMedians = new float[_numberOfChannels];
     for (int k = 0; k < _numberOfChannels; k++)
     {
-        float* channelArr = &_normalData[k*channelSize];
-//        T* channelArr = &_data[k*channelSize];
-        float channelMedian = median(channelArr, channelSize, sampleSize);
+        float channelMedian;
+        float med;
+        if constexpr (isSmallInteger<T>)
+            histogramStatistics(k, channelMedian, med);
+        else
+            sampledStatistics(k, channelMedian, med);
 //        qDebug() << "median took" << timer.elapsed() << "milliseconds";
         channelMedians[k] = channelMedian;
 
-        float* it = _normalData;
-//        T* it = _data;
-        std::vector<float> v;
-        int jump = channelSize/sampleSize;
-        if (jump == 0)
-            jump = 1;
-        int counter = jump;
-        for (int i = 0; i < _height; i++)
-        {
-            for (int j = 0; j < _width; j++)
-            {
-                counter--;
-                if (counter != 0)
-                    continue;
-                counter = jump;
-                v.push_back(abs((*it) - channelMedian));
-                it++;
-            }
-        }
-        float med = medianf(v);
-
 //        qDebug() << "medianf took" << timer.elapsed() << "milliseconds";
-        float normalizedMedian = 1.4826f * med;
-
-        float B = 0.25f;
-        float C = -2.8f;
-        int A = channelMedian > 0.5 ? 1: 0;
-        float S;
-        if (A == 1)
-            S = 0;
-        else if (normalizedMedian == 0)
-        {
-            S = 0;
-        }
-        else
-        {
-            S = fmin(1, fmax(0, channelMedian + C * normalizedMedian));
-        }
-
-        float H;
-        if (A == 0)
-            H = 1;
-        else if (normalizedMedian == 0)
-        {
-            H = 1;
-        }
-        else
-        {
-            H = fmin(1, fmax(0, channelMedian - C * normalizedMedian));
-        }
-
-        float M;
-        if (A == 0)
-        {
-            M = MidtonesTransferFunction(channelMedian - S, B);
-        }
-        else
-        {
-            M = MidtonesTransferFunction(B, H - channelMedian);
-        }
-        stretchParams.channel[k] = {A, B, C, S, H, M};
+        stretchParams.channel[k] = StretchParam::fromStatistics(channelMedian, med);
 //        qDebug() << "Channel took" << timer.elapsed() << "milliseconds";
     }
+    stretchParams.numberOfChannels = _numberOfChannels;
+    stretchParams.sampleType = sampleTypeOf<T>;
+    stretchParams.rangeMin = _rangeMin;
+    stretchParams.rangeMax = _rangeMax;
+    calculateConstants();
 
     delete [] channelMedians;
 }
 
+template <typename T>
+void AutoStretcher<T>::calculateConstants()
+{
+    for (int k = 0; k < _numberOfChannels; k++)
+    {
+        const StretchParam& p = stretchParams.channel[k];
+
+        // The same display function, taking the pixel values instead of the normalized ones
+        stretchConstants[k] = {p.S * _range - _zero, p.H * _range - _zero, p.M - 1, 2 * p.M - 1, (p.H - p.S) * p.M * _range};
+    }
+}
+
+/*!
+ * \brief AutoStretcher::sampledStatistics
+ * Median and median absolute deviation (of the normalized values) of channel k,
+ * estimated from the pixels sampled by scanFrame.
+ */
+template <typename T>
+void AutoStretcher<T>::sampledStatistics(int k, float& median, float& mad)
+{
+    std::vector<float>& samples = _samples[k];
+    float sampleMedian = medianf(samples);
+
+    std::vector<float> deviations;
+    deviations.reserve(samples.size());
+    for (float sample : samples)
+        deviations.push_back(fabs(sample - sampleMedian));
+
+    median = (sampleMedian + _zero) / _range;
+    mad = medianf(deviations) / _range;
+}
+
+// The value of the element at position target, if the values counted in histogram were sorted
+static long long histogramElement(const long long* histogram, long long bins, long long target)
+{
+    long long seen = 0;
+    for (long long bin = 0; bin < bins; bin++)
+    {
+        seen += histogram[bin];
+        if (seen > target)
+            return bin;
+    }
+    return bins - 1;
+}
+
+/*!
+ * \brief AutoStretcher::histogramStatistics
+ * Exact median and median absolute deviation of channel k, for 8 and 16 bit pixels,
+ * from the histogram made by scanFrame. The deviations from the median are counted
+ * from the histogram too, so no pixels are copied or sorted.
+ */
+template <typename T>
+void AutoStretcher<T>::histogramStatistics(int k, float& median, float& mad)
+{
+    if constexpr (isSmallInteger<T>)
+    {
+        const long long offset = std::numeric_limits<T>::min();
+        const long long bins = (long long)std::numeric_limits<T>::max() - offset + 1;
+        const long long channelSize = (long long)_width * _height;
+        const long long* histogram = &_histograms[k * bins];
+
+        long long medianBin = histogramElement(histogram, bins, channelSize / 2);
+
+        std::vector<long long> deviations(bins, 0);
+        for (long long bin = 0; bin < bins; bin++)
+            deviations[qAbs(bin - medianBin)] += histogram[bin];
+
+        median = ((float)(medianBin + offset) + _zero) / _range;
+        mad = (float)histogramElement(deviations.data(), bins, channelSize / 2) / _range;
+    }
+    else
+    {
+        // Only called for 8 and 16 bit pixels
+        Q_UNUSED(k);
+        median = mad = 0;
+    }
+}
+
+/*!
+ * \brief AutoStretcher::scanFrame
+ * The one pass over the frame before the stretch. Finds the range of the pixels, and
+ * collects what calculateParams needs: the histogram of each channel for 8 and 16 bit
+ * pixels, about STATISTICS_SAMPLE_SIZE pixels of each channel otherwise. Returns
+ * early, with the statistics incomplete, when the token is canceled.
+ */
 template<typename T>
-void AutoStretcher<T>::getRange()
+void AutoStretcher<T>::scanFrame()
 {
-    T* it = (T*)_data;
-    _rangeMax = _rangeMin = *it;
+    const long long channelSize = (long long)_width * _height;
+    const long long bandSize = (long long)STRETCH_BAND_ROWS * _width;
 
-    for (int i = 0; i < _height; i++)
+    if constexpr (isSmallInteger<T>)
     {
-        for (int j = 0; j < _width; j++)
+        const long long offset = std::numeric_limits<T>::min();
+        const long long bins = (long long)std::numeric_limits<T>::max() - offset + 1;
+        // Taken from the pool, a 16 bit histogram of three channels is over a megabyte
+        const size_t histogramsSize = bins * _numberOfChannels * sizeof(long long);
+        FrameBufferPool::release(reinterpret_cast<unsigned char*>(_histograms));
+        _histograms = reinterpret_cast<long long*>(FrameBufferPool::acquire(histogramsSize));
+        Q_CHECK_PTR(_histograms);
+        memset(_histograms, 0, histogramsSize);
+        for (int k = 0; k < _numberOfChannels; k++)
         {
-            for (int k = 0; k < _numberOfChannels; k++)
+            long long* histogram = &_histograms[k * bins];
+            for (long long first = k * channelSize; first < (k + 1) * channelSize; first += bandSize)
             {
-                T x = *it;
-                if (x > _rangeMax)
-                    _rangeMax = x;
-                if (x < _rangeMin)
-                    _rangeMin = x;
-                it++;
+                if (_cancellationToken.isCanceled())
+                    return;
+                const long long last = qMin(first + bandSize, (k + 1) * channelSize);
+                for (long long index = first; index < last; index++)
+                    histogram[pixel(index) - offset]++;
+            }
+        }
+
+        // The range is the lowest and the highest bin in use
+        long long lowest = bins - 1;
+        long long highest = 0;
+        for (int k = 0; k < _numberOfChannels; k++)
+        {
+            const long long* histogram = &_histograms[k * bins];
+            for (long long bin = 0; bin < bins; bin++)
+            {
+                if (histogram[bin] == 0)
+                    continue;
+                lowest = qMin(lowest, bin);
+                highest = qMax(highest, bin);
+            }
+        }
+        _rangeMin = T(lowest + offset);
+        _rangeMax = T(highest + offset);
+    }
+    else
+    {
+        long long jump = channelSize / STATISTICS_SAMPLE_SIZE;
+        if (jump == 0)
+            jump = 1;
+
+        _rangeMax = _rangeMin = pixel(0);
+        for (int k = 0; k < _numberOfChannels; k++)
+        {
+            std::vector<float>& samples = _samples[k];
+            samples.clear();
+            samples.reserve(channelSize / jump + 1);
+            long long nextSample = k * channelSize;
+            for (long long first = k * channelSize; first < (k + 1) * channelSize; first += bandSize)
+            {
+                if (_cancellationToken.isCanceled())
+                    return;
+                const long long last = qMin(first + bandSize, (k + 1) * channelSize);
+                bool ranged = false;
+                if constexpr (std::is_same<T, float>::value)
+                {
+                    if (_data != nullptr)
+                    {
+                        PixelKernels::get().floatRange(_data + first, last - first, _rangeMin, _rangeMax);
+                        ranged = true;
+                    }
+                }
+                for (long long index = first; index < last && !ranged; index++)
+                {
+                    T x = pixel(index);
+                    if (x > _rangeMax)
+                        _rangeMax = x;
+                    if (x < _rangeMin)
+                        _rangeMin = x;
+                }
+                for (; nextSample < last; nextSample += jump)
+                    samples.push_back(pixel(nextSample));
             }
         }
     }
+    _range = _rangeMax - _rangeMin;
 }
 
 template<typename T>
 void AutoStretcher<T>::stretch()
 {
-    T* dit = (T*)_data;
-    float* it = _normalData;
-    float range = _rangeMax - _rangeMin;
-    Q_ASSERT(range != 0);
+    T* dit = _out;
+    const long long channelSize = (long long)_width * _height;
+    Q_ASSERT(_range != 0);
 
     for (int k = 0; k < _numberOfChannels; k++)
     {
-        auto sp = stretchParams.channel[k];
-        const float m = sp.M;
-        const float s = sp.S;
-        const float h = sp.H;
-        const float l = 0;
-        const float r = 1;
-        const float A = m-1;
-        const float B = 2*m-1;
-        const float C = (h-s)*m;
-        for (int i = 0; i < _height; i++)
+        const StretchConstants constants = stretchConstants[k];
+        for (long long index = k * channelSize; index < (k + 1) * channelSize; index++)
+            dit[index] = (T)stretchedValue(constants, pixel(index));
+    }
+}
+
+/*!
+ * \brief AutoStretcher::stretchToImage
+ * Stretches the frame straight into an 8 bit image: Grayscale8 for one channel, RGB32
+ * for three planar channels. The frame is not modified.
+ *
+ * 8 and 16 bit pixels go through a lookup table per channel, built from the stretch
+ * parameters, instead of evaluating the display function for every pixel.
+ *
+ * With parallel, bands of rows are done on the global thread pool. Only for a single
+ * large image, thumbnails are already made for many files at the same time. Bands not
+ * started yet are skipped once the token is canceled, and a null image is returned.
+ */
+template<typename T>
+QImage AutoStretcher<T>::stretchToImage(bool parallel)
+{
+    static LatencyHistogram& imageLatency = Metrics::histogram(QString("stretch.image.") + fitsPixelTypeName<T>());
+    static AllocationCounter& stretchAllocations = AllocationTracker::counter("stretch");
+    ScopedLatency latency(imageLatency);
+    AllocationScope allocations(stretchAllocations);
+    if (_cancellationToken.isCanceled())
+        return QImage();
+    Q_ASSERT(_range != 0);
+    Q_ASSERT(_numberOfChannels == 1 || _numberOfChannels == 3);
+
+    const long long size = (long long)_width * _height;
+
+    // The image is made over a buffer of the pool, which gets it back when the image is freed.
+    // Scanlines are 32-bit aligned, like the ones QImage allocates.
+    const int depth = _numberOfChannels == 3 ? 4 : 1;
+    const qsizetype bytesPerLine = ((qsizetype)_width * depth + 3) & ~qsizetype(3);
+    uchar* bits = FrameBufferPool::acquire(bytesPerLine * _height);
+    if (bits == nullptr)
+        return QImage();
+    QImage image(bits, _width, _height, bytesPerLine, _numberOfChannels == 3 ? QImage::Format_RGB32 : QImage::Format_Grayscale8,
+                 FrameBufferPool::releaseImageBuffer, bits);
+
+    auto packBands = [&](auto packRows)
+    {
+        auto packBand = [&](int firstRow)
+        {
+            if (!_cancellationToken.isCanceled())
+                packRows(firstRow, qMin(firstRow + STRETCH_BAND_ROWS, _height));
+        };
+
+        if (!parallel || _height <= STRETCH_BAND_ROWS)
         {
-            for (int j = 0; j < _width; j++)
+            for (int firstRow = 0; firstRow < _height; firstRow += STRETCH_BAND_ROWS)
+                packBand(firstRow);
+            return;
+        }
+
+        // Each band writes its own scanlines, the frame and the table are only read
+        QList<int> bands;
+        for (int firstRow = 0; firstRow < _height; firstRow += STRETCH_BAND_ROWS)
+            bands.append(firstRow);
+        QtConcurrent::blockingMap(bands, packBand);
+    };
+
+    auto pack = [&](auto value)
+    {
+        packBands([&](int firstRow, int lastRow)
+        {
+            for (int i = firstRow; i < lastRow; i++)
             {
-                const float x = *it;
-                const float X = x - s;
-
-//                float stretched = DisplayFunction(x, m, s, h, l, r);
-                // ---- The following is equivalent to the DisplayFunction call above
-                float stretched  = 0;
-                if (x < s)
-                    stretched = 0;
-                else if (x > h)
-                    stretched = 1;
+                const long long row = (long long)i * _width;
+                if (_numberOfChannels == 3)
+                {
+                    auto* scanLine = reinterpret_cast<QRgb*>(bits + i * bytesPerLine);
+                    for (int j = 0; j < _width; j++)
+                        scanLine[j] = qRgb(value(0, row + j), value(1, size + row + j), value(2, 2 * size + row + j));
+                }
                 else
                 {
-                    stretched = A / (B - C/X);
+                    auto* scanLine = bits + i * bytesPerLine;
+                    for (int j = 0; j < _width; j++)
+                        scanLine[j] = value(0, row + j);
                 }
-                // ----
+            }
+        });
+    };
 
-                float stretchedAndRanged = stretched*255;
-                *dit = (T)stretchedAndRanged;
-                dit++;
-                it++;
+    // Float frames in memory are stretched and packed a row at a time by the PixelKernels
+    auto packFloats = [&](const float* data)
+    {
+        const PixelKernels& kernels = PixelKernels::get();
+        packBands([&](int firstRow, int lastRow)
+        {
+            std::vector<unsigned char> planes(_numberOfChannels == 3 ? 3 * _width : 0);
+            for (int i = firstRow; i < lastRow; i++)
+            {
+                const long long row = (long long)i * _width;
+                uchar* scanLine = bits + i * bytesPerLine;
+                if (_numberOfChannels == 1)
+                {
+                    kernels.stretchFloats(data + row, _width, stretchConstants[0], scanLine);
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                    kernels.stretchFloats(data + k * size + row, _width, stretchConstants[k], planes.data() + k * _width);
+                kernels.packRgb32(planes.data(), planes.data() + _width, planes.data() + 2 * _width, _width, reinterpret_cast<QRgb*>(scanLine));
             }
+        });
+    };
+
+    if constexpr (isSmallInteger<T>)
+    {
+        const long long offset = std::numeric_limits<T>::min();
+        const long long values = (long long)std::numeric_limits<T>::max() - offset + 1;
+        std::vector<unsigned char> table(values * _numberOfChannels);
+        for (int k = 0; k < _numberOfChannels; k++)
+        {
+            for (long long v = 0; v < values; v++)
+                table[k * values + v] = (unsigned char)stretchedValue(stretchConstants[k], (float)(T)(v + offset));
         }
+        pack([&](int k, long long index) -> unsigned char { return table[k * values + (pixel(index) - offset)]; });
     }
+    else if (std::is_same<T, float>::value && _data != nullptr)
+        packFloats(reinterpret_cast<const float*>(_data));
+    else
+        pack([&](int k, long long index) -> unsigned char { return (unsigned char)stretchedValue(stretchConstants[k], pixel(index)); });
+
+    if (_cancellationToken.isCanceled())
+        return QImage();
+    return image;
 }
 
+/*!
+ * \brief AutoStretcher::linearImage
+ * The frame before the stretch, with 16 bits per channel, as Grayscale16 or RGBX64. The
+ * pixel values are normalized like the display function takes them, over the range of
+ * the parameters, and clipped to [0,1]. A null image when canceled.
+ */
 template<typename T>
-float AutoStretcher<T>::MidtonesTransferFunction(float x, float m)
+QImage AutoStretcher<T>::linearImage()
 {
-    if (x == 0.0f)
-    {
-        return 0;
-    }
-
-    if (x == 1.0f)
-    {
-        return 1;
-    }
-
-    if (x == m)
+    Q_ASSERT(_range != 0);
+    QImage image(_width, _height, _numberOfChannels == 3 ? QImage::Format_RGBX64 : QImage::Format_Grayscale16);
+    if (image.isNull())
+        return image;
+
+    const long long size = (long long)_width * _height;
+    const float scale = 65535.0f / _range;
+    auto linear = [&](long long index) -> quint16 { return quint16(qBound(0.0f, (float(pixel(index)) + _zero) * scale + 0.5f, 65535.0f)); };
+    for (int y = 0; y < _height; y++)
     {
-        return 0.5f;
+        if (_cancellationToken.isCanceled())
+            return QImage();
+        const long long row = (long long)y * _width;
+        if (_numberOfChannels == 3)
+        {
+            auto* scanLine = reinterpret_cast<QRgba64*>(image.scanLine(y));
+            for (int x = 0; x < _width; x++)
+                scanLine[x] = qRgba64(linear(row + x), linear(size + row + x), linear(2 * size + row + x), 65535);
+        }
+        else
+        {
+            auto* scanLine = reinterpret_cast<quint16*>(image.scanLine(y));
+            for (int x = 0; x < _width; x++)
+                scanLine[x] = linear(row + x);
+        }
     }
+    return image;
+}
 
-    Q_ASSERT((2 * m - 1) * x - m != 0);
-    return (m - 1) * x / ( (2 * m - 1) * x - m);
+template<typename T>
+float AutoStretcher<T>::MidtonesTransferFunction(float x, float m)
+{
+    return midtonesTransfer(x, m);
 }
 
 template<typename T>
@@ -349,6 +681,7 @@ float AutoStretcher<T>::DisplayFunction(float x, float m, float s, float h, floa
 
 
 template class AutoStretcher<int8_t>;
+template class AutoStretcher<uint8_t>;
 template class AutoStretcher<int16_t>;
 template class AutoStretcher<int32_t>;
 template class AutoStretcher<int64_t>;
@@ -356,3 +689,4 @@ template class AutoStretcher<float>;
 template class AutoStretcher<double>;
 template class AutoStretcher<uint16_t>;
 template class AutoStretcher<uint32_t>;
+template class AutoStretcher<uint64_t>;
@@ -25,6 +25,15 @@
 #ifndef AUTOSTRETCHER_H
 #define AUTOSTRETCHER_H
 
+#include "cancellationtoken.h"
+#include "fitspixels.h"
+#include "pixelkernels.h"
+
+#include <QByteArray>
+#include <QImage>
+
+#include <vector>
+
 struct StretchParam
 {
     int A;
@@ -33,11 +42,26 @@ struct StretchParam
     float S;
     float H;
     float M;
+    // The normalized statistics of the channel the others were made of
+    float median;
+    float mad;
+
+    // B is the target background, and C the shadows clipping in normalized MADs
+    static StretchParam fromStatistics(float median, float mad, float B = 0.25f, float C = -2.8f);
 };
 
+// The parameters of each channel, and the pixel range they were normalized with
 struct StretchParams
 {
     StretchParam channel[3];
+    int numberOfChannels;
+    int sampleType; // Like BITPIX: bits per sample, negative for floating point
+    double rangeMin;
+    double rangeMax;
+
+    // Stored with the file, so it can be stretched again without the statistics
+    QByteArray toByteArray() const;
+    static bool fromByteArray(const QByteArray& data, StretchParams& params);
 };
 
 template <typename T>
@@ -47,10 +71,20 @@ public:
     AutoStretcher(int width, int height, int numberOfChannels, int fitsDataType);
     ~AutoStretcher();
     void setData(T* data);
+    void setStoredData(const unsigned char* storedData, T* out);
     void stretch();
+    QImage stretchToImage(bool parallel = false);
+    QImage linearImage();
     void calculateParams();
-    void normalize();
+    bool setParams(const StretchParams& params);
     StretchParams getParams();
+    // Checked between bands of rows. A canceled calculateParams leaves the parameters
+    // unset, and a canceled stretchToImage returns a null image.
+    void setCancellationToken(const CancellationToken& token);
+    // The pixels are the stored values of a FITS image, which BSCALE and BZERO scale to
+    // its physical values. The statistics and the display function are of the physical
+    // values, the pixels are not converted. Set before the parameters.
+    void setScaling(double bscale, double bzero);
 private:
     int _width;
     int _height;
@@ -58,16 +92,47 @@ private:
     int _fitsDataType;
     T _rangeMax;
     T _rangeMin;
+    float _range;
+    float _zero; // BZERO in stored values, BZERO / BSCALE
     T* _data;
-    float* _normalData;
+    const unsigned char* _storedData;
+    T* _out;
     StretchParams stretchParams;
+    CancellationToken _cancellationToken;
+
+    inline T pixel(long long index) const
+    {
+        return _storedData != nullptr ? fitsStoredPixel<T>(_storedData + index * sizeof(T)) : _data[index];
+    }
+
+    // Collected by scanFrame for calculateParams
+    long long* _histograms;
+    std::vector<float> _samples[3];
+
+    // Constants of the display function of a channel, in pixel values rather than normalized ones
+    using StretchConstants = DisplayConstants;
+    StretchConstants stretchConstants[3];
+
+    // The display function of a pixel value, in [0,255]
+    inline float stretchedValue(const StretchConstants& c, float v) const
+    {
+        // Equivalent to DisplayFunction(v / range, M, S, H, 0, 1)
+        if (v < c.s)
+            return 0;
+        if (v > c.h)
+            return 255;
+        return c.A / (c.B - c.C / (v - c.s)) * 255;
+    }
 
     float MidtonesTransferFunction(float x, float m);
     float ClippingFunction(float x, float s, float h);
     float ExpansionFunction(float x, float l, float r);
 
     float DisplayFunction(float x, float m, float s, float h, float l, float r);
-    void getRange();
+    void scanFrame();
+    void calculateConstants();
+    void sampledStatistics(int k, float& median, float& mad);
+    void histogramStatistics(int k, float& median, float& mad);
 };
 
 #endif // AUTOSTRETCHER_H
@@ -0,0 +1,14 @@
+# astrocat-bench, QTest benchmarks of the image kernels over synthetic frames
+
+QT += core gui sql concurrent testlib
+QT -= widgets
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = astrocat-bench
+
+SOURCES += \
+    kernelbench.cpp
+
+include(../engine.pri)
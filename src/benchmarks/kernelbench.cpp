@@ -0,0 +1,436 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "autostretcher.h"
+#include "debayer.h"
+#include "fitsfile.h"
+#include "hasher.h"
+#include "syntheticframe.h"
+#include "thumbnailcodec.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QtTest>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// The time a full resolution preview tile set of a 26 MP one shot color frame may take
+// to demosaic with VNG on the thread pool
+#define DEMOSAIC_VNG_TARGET_MS 100
+
+// Runs of the VNG target benchmark, the median is reported
+#define DEMOSAIC_VNG_TARGET_RUNS 5
+
+struct FrameSize
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+static const FrameSize frameSizes[] = {
+    {"16MP", SYNTHETIC_16MP_WIDTH, SYNTHETIC_16MP_HEIGHT},
+    {"26MP", SYNTHETIC_26MP_WIDTH, SYNTHETIC_26MP_HEIGHT},
+    {"61MP", SYNTHETIC_61MP_WIDTH, SYNTHETIC_61MP_HEIGHT},
+};
+
+// Every sample type AutoStretcher is instantiated for
+static const int sampleTypes[] = {BYTE_IMG, SBYTE_IMG, SHORT_IMG, USHORT_IMG, LONG_IMG, ULONG_IMG, LONGLONG_IMG, ULONGLONG_IMG, FLOAT_IMG, DOUBLE_IMG};
+
+static const BayerPattern bayerPatterns[] = {RGGB, BGGR, GRBG, GBRG};
+
+static const char* sampleTypeName(int bitpix)
+{
+    return visitFitsSampleType(bitpix, [](auto sample) { return fitsPixelTypeName<decltype(sample)>(); });
+}
+
+static const char* bayerPatternName(BayerPattern pattern)
+{
+    switch (pattern)
+    {
+    case RGGB: return "RGGB";
+    case BGGR: return "BGGR";
+    case GRBG: return "GRBG";
+    case GBRG: return "GBRG";
+    default: return "mono";
+    }
+}
+
+/*!
+ * \brief The KernelBench class
+ * Times the kernels an image goes through when it is ingested or previewed, over
+ * synthetic frames the size of common cameras, mono and one shot color. Run with
+ * -bench or -functions to pick them, QTest prints the time of each row. The XXH64
+ * hashes are checked against the reference values before they are timed.
+ */
+class KernelBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void stretchParams_data();
+    void stretchParams();
+    void stretchToImage_data();
+    void stretchToImage();
+    void demosaic_data();
+    void demosaic();
+    void demosaicVngTarget();
+    void extractImage_data();
+    void extractImage();
+    void encodeThumbnail_data();
+    void encodeThumbnail();
+    void decodeThumbnail_data();
+    void decodeThumbnail();
+    void xxh64ReferenceVectors_data();
+    void xxh64ReferenceVectors();
+    void hash_data();
+    void hash();
+
+private:
+    // The last frame made, the rows of a benchmark are ordered so it is mostly reused
+    std::unique_ptr<SyntheticFrame> lastFrame;
+    const SyntheticFrame& frame(int width, int height, BayerPattern pattern);
+    template <typename T>
+    std::vector<T> colorPlanes(int width, int height);
+    void addStretchRows();
+    QImage thumbnail();
+};
+
+const SyntheticFrame& KernelBench::frame(int width, int height, BayerPattern pattern)
+{
+    if (!lastFrame || lastFrame->spec().width != width || lastFrame->spec().height != height || lastFrame->spec().bayerPattern != pattern)
+    {
+        SyntheticFrameSpec spec;
+        spec.width = width;
+        spec.height = height;
+        spec.bayerPattern = pattern;
+        lastFrame = std::make_unique<SyntheticFrame>(spec);
+    }
+    return *lastFrame;
+}
+
+// The three planes of a one shot color frame, as the stretcher gets them after the demosaic
+template <typename T>
+std::vector<T> KernelBench::colorPlanes(int width, int height)
+{
+    const std::vector<T> mosaic = frame(width, height, RGGB).pixels<T>();
+    std::vector<T> planes(3 * (size_t)width * height);
+    ::demosaic<T>(DemosaicBilinear, RGGB, [&mosaic](long long i) { return mosaic[i]; }, width, height, 1, planes.data(), true);
+    return planes;
+}
+
+void KernelBench::initTestCase()
+{
+    // Settings of their own, the algorithms are picked by the rows
+    QCoreApplication::setOrganizationName("Astrocat");
+    QCoreApplication::setApplicationName("astrocat-bench");
+}
+
+// Every sample type of mono frames, and the types of color frames cameras and stacks write
+void KernelBench::addStretchRows()
+{
+    QTest::addColumn<int>("bitpix");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+    QTest::addColumn<int>("channels");
+
+    for (auto& size : frameSizes)
+    {
+        for (int bitpix : sampleTypes)
+            QTest::addRow("%s mono %s", sampleTypeName(bitpix), size.name) << bitpix << size.width << size.height << 1;
+        for (int bitpix : {USHORT_IMG, FLOAT_IMG})
+            QTest::addRow("%s color %s", sampleTypeName(bitpix), size.name) << bitpix << size.width << size.height << 3;
+    }
+}
+
+void KernelBench::stretchParams_data()
+{
+    addStretchRows();
+}
+
+void KernelBench::stretchParams()
+{
+    QFETCH(int, bitpix);
+    QFETCH(int, width);
+    QFETCH(int, height);
+    QFETCH(int, channels);
+
+    visitFitsSampleType(bitpix, [&](auto sample) {
+        using T = decltype(sample);
+        std::vector<T> pixels = channels == 3 ? colorPlanes<T>(width, height) : frame(width, height, None).pixels<T>();
+        AutoStretcher<T> stretcher(width, height, channels, FitsSampleType<T>::dataType);
+        stretcher.setData(pixels.data());
+        QBENCHMARK {
+            stretcher.calculateParams();
+        }
+    });
+}
+
+void KernelBench::stretchToImage_data()
+{
+    addStretchRows();
+}
+
+void KernelBench::stretchToImage()
+{
+    QFETCH(int, bitpix);
+    QFETCH(int, width);
+    QFETCH(int, height);
+    QFETCH(int, channels);
+
+    visitFitsSampleType(bitpix, [&](auto sample) {
+        using T = decltype(sample);
+        std::vector<T> pixels = channels == 3 ? colorPlanes<T>(width, height) : frame(width, height, None).pixels<T>();
+        AutoStretcher<T> stretcher(width, height, channels, FitsSampleType<T>::dataType);
+        stretcher.setData(pixels.data());
+        stretcher.calculateParams();
+        QBENCHMARK {
+            QImage image = stretcher.stretchToImage();
+            QVERIFY(!image.isNull());
+        }
+    });
+}
+
+void KernelBench::demosaic_data()
+{
+    QTest::addColumn<int>("pattern");
+    QTest::addColumn<int>("method");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+
+    for (auto& size : frameSizes)
+    {
+        for (BayerPattern pattern : bayerPatterns)
+        {
+            QTest::addRow("%s superpixel %s", bayerPatternName(pattern), size.name) << int(pattern) << int(DemosaicSuperpixel) << size.width << size.height;
+            QTest::addRow("%s bilinear %s", bayerPatternName(pattern), size.name) << int(pattern) << int(DemosaicBilinear) << size.width << size.height;
+            QTest::addRow("%s vng %s", bayerPatternName(pattern), size.name) << int(pattern) << int(DemosaicVng) << size.width << size.height;
+        }
+    }
+}
+
+// 16 bit frames, like the ones of color cameras. Thumbnails are demosaiced on one thread,
+// and previews at full resolution on the pool, like in FitsFile.
+void KernelBench::demosaic()
+{
+    QFETCH(int, pattern);
+    QFETCH(int, method);
+    QFETCH(int, width);
+    QFETCH(int, height);
+
+    const BayerPattern bayerPattern = BayerPattern(pattern);
+    const DemosaicMethod demosaicMethod = DemosaicMethod(method);
+    const std::vector<uint16_t> mosaic = frame(width, height, bayerPattern).pixels<uint16_t>();
+    std::vector<uint16_t> planes(3 * demosaicedWidth(demosaicMethod, width, 1) * demosaicedHeight(demosaicMethod, height, 1));
+    auto pixels = [&mosaic](long long i) { return mosaic[i]; };
+    const bool parallel = demosaicMethod != DemosaicSuperpixel;
+    QBENCHMARK {
+        ::demosaic<uint16_t>(demosaicMethod, bayerPattern, pixels, width, height, 1, planes.data(), parallel);
+    }
+}
+
+/*!
+ * \brief KernelBench::demosaicVngTarget
+ * The median time of a VNG demosaic of a 26 MP frame on the pool, against
+ * DEMOSAIC_VNG_TARGET_MS, with a warning when it is over. The target assumes the pool
+ * of a desktop; the time scales with the number of threads.
+ */
+void KernelBench::demosaicVngTarget()
+{
+    const int width = SYNTHETIC_26MP_WIDTH;
+    const int height = SYNTHETIC_26MP_HEIGHT;
+    const std::vector<uint16_t> mosaic = frame(width, height, RGGB).pixels<uint16_t>();
+    std::vector<uint16_t> planes(3 * (size_t)width * height);
+    auto pixels = [&mosaic](long long i) { return mosaic[i]; };
+
+    std::vector<qint64> times;
+    for (int run = 0; run < DEMOSAIC_VNG_TARGET_RUNS; run++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        ::demosaic<uint16_t>(DemosaicVng, RGGB, pixels, width, height, 1, planes.data(), true);
+        times.push_back(timer.elapsed());
+    }
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    const qint64 median = times[times.size() / 2];
+
+    qInfo("VNG 26MP: %lld ms on %d threads, target %d ms", median, QThreadPool::globalInstance()->maxThreadCount(), DEMOSAIC_VNG_TARGET_MS);
+    if (median > DEMOSAIC_VNG_TARGET_MS)
+        qWarning("VNG 26MP is over its target of %d ms", DEMOSAIC_VNG_TARGET_MS);
+}
+
+void KernelBench::extractImage_data()
+{
+    QTest::addColumn<int>("bitpix");
+    QTest::addColumn<int>("pattern");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+
+    for (auto& size : frameSizes)
+    {
+        QTest::addRow("uint16 mono %s", size.name) << int(USHORT_IMG) << int(None) << size.width << size.height;
+        QTest::addRow("uint16 RGGB %s", size.name) << int(USHORT_IMG) << int(RGGB) << size.width << size.height;
+        QTest::addRow("float mono %s", size.name) << int(FLOAT_IMG) << int(None) << size.width << size.height;
+    }
+}
+
+// The whole image of a file in memory, like the processors make the thumbnail: read,
+// binned, hashed, measured and stretched
+void KernelBench::extractImage()
+{
+    QFETCH(int, bitpix);
+    QFETCH(int, pattern);
+    QFETCH(int, width);
+    QFETCH(int, height);
+
+    SyntheticFrameSpec spec;
+    spec.width = width;
+    spec.height = height;
+    spec.bitpix = bitpix;
+    spec.bayerPattern = BayerPattern(pattern);
+    const QByteArray file = SyntheticFrame(spec).toFits();
+    QVERIFY(!file.isEmpty());
+
+    QBENCHMARK {
+        FitsFile fits;
+        QVERIFY(fits.loadFile("synthetic.fits", reinterpret_cast<const uchar*>(file.constData()), file.size()));
+        fits.setAnalyzeFrame(true);
+        fits.setMakeLinearImage(true);
+        fits.extractTags();
+        fits.extractImage(LARGEST_THUMBNAIL_SIZE);
+        QVERIFY(!fits.getImage().isNull());
+    }
+}
+
+// A color thumbnail of the largest size, made like the processors make it
+QImage KernelBench::thumbnail()
+{
+    std::vector<uint16_t> planes = colorPlanes<uint16_t>(SYNTHETIC_16MP_WIDTH, SYNTHETIC_16MP_HEIGHT);
+    AutoStretcher<uint16_t> stretcher(SYNTHETIC_16MP_WIDTH, SYNTHETIC_16MP_HEIGHT, 3, TUSHORT);
+    stretcher.setData(planes.data());
+    stretcher.calculateParams();
+    return stretcher.stretchToImage().scaled(QSize(LARGEST_THUMBNAIL_SIZE, LARGEST_THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+void KernelBench::encodeThumbnail_data()
+{
+    QTest::addColumn<int>("format");
+
+    QTest::addRow("png") << int(ThumbnailFormatPng);
+    QTest::addRow("lz4") << int(ThumbnailFormatLz4Raw);
+    QTest::addRow("jpeg") << int(ThumbnailFormatJpeg);
+}
+
+void KernelBench::encodeThumbnail()
+{
+    QFETCH(int, format);
+
+    const QImage image = thumbnail();
+    QBENCHMARK {
+        QByteArray data = ThumbnailCodec::encode(image, ThumbnailFormat(format));
+        QVERIFY(!data.isEmpty());
+    }
+}
+
+void KernelBench::decodeThumbnail_data()
+{
+    encodeThumbnail_data();
+}
+
+void KernelBench::decodeThumbnail()
+{
+    QFETCH(int, format);
+
+    const QByteArray data = ThumbnailCodec::encode(thumbnail(), ThumbnailFormat(format));
+    QBENCHMARK {
+        QImage image = ThumbnailCodec::decode(data, ThumbnailFormat(format));
+        QVERIFY(!image.isNull());
+    }
+}
+
+void KernelBench::xxh64ReferenceVectors_data()
+{
+    QTest::addColumn<QByteArray>("input");
+    QTest::addColumn<QByteArray>("expected");
+
+    // The values of the reference implementation, with a seed of 0. The longer inputs
+    // go through the 32 byte stripes, the shorter ones only through the tail.
+    QTest::addRow("empty") << QByteArray("") << QByteArray("ef46db3751d8e999");
+    QTest::addRow("a") << QByteArray("a") << QByteArray("d24ec4f1a98c6e5b");
+    QTest::addRow("abc") << QByteArray("abc") << QByteArray("44bc2cf5ad770999");
+    QTest::addRow("message digest") << QByteArray("message digest") << QByteArray("066ed728fceeb3be");
+    QTest::addRow("fox") << QByteArray("The quick brown fox jumps over the lazy dog") << QByteArray("0b242d361fda71bc");
+    QTest::addRow("digits") << QByteArray("12345678901234567890123456789012345678901234567890123456789012345678901234567890")
+                            << QByteArray("e04a477f19ee145d");
+}
+
+// In one call, and streamed in chunks that do not line up with the stripes
+void KernelBench::xxh64ReferenceVectors()
+{
+    QFETCH(QByteArray, input);
+    QFETCH(QByteArray, expected);
+
+    const QByteArray prefixed = Hasher::prefixOf(HashAlgorithmXxh64) + expected;
+    QCOMPARE(Hasher::hash(input.constData(), input.size(), HashAlgorithmXxh64), prefixed);
+
+    Hasher hasher(HashAlgorithmXxh64);
+    for (qsizetype offset = 0; offset < input.size(); offset += 7)
+        hasher.addData(input.constData() + offset, qMin<qsizetype>(7, input.size() - offset));
+    QCOMPARE(hasher.result(), prefixed);
+}
+
+void KernelBench::hash_data()
+{
+    QTest::addColumn<int>("algorithm");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+
+    for (auto& size : frameSizes)
+    {
+        QTest::addRow("sha1 %s", size.name) << int(HashAlgorithmSha1) << size.width << size.height;
+        QTest::addRow("xxh64 %s", size.name) << int(HashAlgorithmXxh64) << size.width << size.height;
+    }
+}
+
+// The pixels of a 16 bit frame, the size of its file
+void KernelBench::hash()
+{
+    QFETCH(int, algorithm);
+    QFETCH(int, width);
+    QFETCH(int, height);
+
+    const std::vector<uint16_t> pixels = frame(width, height, None).pixels<uint16_t>();
+    QBENCHMARK {
+        QByteArray hash = Hasher::hash(reinterpret_cast<const char*>(pixels.data()), qint64(pixels.size() * sizeof(uint16_t)), HashAlgorithm(algorithm));
+        QVERIFY(!hash.isEmpty());
+    }
+}
+
+QTEST_GUILESS_MAIN(KernelBench)
+
+#include "kernelbench.moc"
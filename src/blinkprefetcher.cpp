@@ -0,0 +1,199 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "blinkprefetcher.h"
+#include "filereader.h"
+#include "fitsfile.h"
+#include "metrics.h"
+
+#include <QSettings>
+
+// Frames rendered on each side of the current one
+#define BLINK_PREFETCH_FRAMES 8
+#define BLINK_FRAME_SIZE 1920
+
+BlinkPrefetcher::BlinkPrefetcher(QObject *parent) : QObject(parent)
+{
+    frameSize = BLINK_FRAME_SIZE;
+    prefetchFrames = qMax(1, QSettings().value("BlinkPrefetchFrames", BLINK_PREFETCH_FRAMES).toInt());
+}
+
+BlinkPrefetcher::~BlinkPrefetcher()
+{
+    closing = true;
+    pool.clear();
+    pool.waitForDone();
+}
+
+void BlinkPrefetcher::setFrames(const QStringList &paths, const QByteArray &stretchParameters)
+{
+    QMutexLocker locker(&mutex);
+    pool.clear();
+    this->paths = paths;
+    hasStretchParams = StretchParams::fromByteArray(stretchParameters, stretchParams);
+    current = 0;
+    generation++;
+    ready.clear();
+    queued.clear();
+}
+
+void BlinkPrefetcher::setFrameSize(int size)
+{
+    QMutexLocker locker(&mutex);
+    if (size == frameSize)
+        return;
+    pool.clear();
+    frameSize = size;
+    generation++;
+    ready.clear();
+    queued.clear();
+}
+
+int BlinkPrefetcher::frameCount() const
+{
+    return paths.size();
+}
+
+QString BlinkPrefetcher::framePath(int index) const
+{
+    return paths.value(index);
+}
+
+bool BlinkPrefetcher::setCurrent(int index, QImage &frame)
+{
+    QMutexLocker locker(&mutex);
+    current = qBound(0, index, paths.size() - 1);
+
+    for (auto i = ready.begin(); i != ready.end();)
+    {
+        if (isNearCurrent(i.key()))
+            ++i;
+        else
+            i = ready.erase(i);
+    }
+    queueMissing();
+
+    auto found = ready.constFind(current);
+    if (found == ready.constEnd())
+        return false;
+    frame = found.value();
+    return true;
+}
+
+/*!
+ * \brief BlinkPrefetcher::queueMissing
+ * Queues the frames around the current one that are neither ready nor queued. Nearer
+ * frames have a higher priority, and of two as near the next one goes first, as frames
+ * are mostly stepped forward. Until the shared stretch is known, only the current frame
+ * is queued, so every frame is stretched like it.
+ */
+void BlinkPrefetcher::queueMissing()
+{
+    if (paths.isEmpty())
+        return;
+
+    const int reach = hasStretchParams ? prefetchFrames : 0;
+    for (int distance = 0; distance <= reach; distance++)
+    {
+        for (int index : {current + distance, current - distance})
+        {
+            if (index < 0 || index >= paths.size() || ready.contains(index) || queued.contains(index))
+                continue;
+            queued.insert(index);
+            const int priority = 2 * (reach - distance) + (index >= current ? 1 : 0);
+            const quint64 frameGeneration = generation;
+            pool.start([this, index, frameGeneration]() { render(index, frameGeneration); }, priority);
+        }
+    }
+}
+
+/*!
+ * \brief BlinkPrefetcher::render
+ * Runs on the pool. The frame is binned while it is read, like a thumbnail, and its
+ * pixels are not hashed.
+ */
+void BlinkPrefetcher::render(int index, quint64 frameGeneration)
+{
+    QString path;
+    int size;
+    StretchParams params;
+    bool hasParams;
+    {
+        QMutexLocker locker(&mutex);
+        if (closing || frameGeneration != generation || !isNearCurrent(index))
+        {
+            if (frameGeneration == generation)
+                queued.remove(index);
+            return;
+        }
+        path = paths[index];
+        size = frameSize;
+        params = stretchParams;
+        hasParams = hasStretchParams;
+    }
+
+    QImage image;
+    StretchParams usedParams;
+    {
+        static LatencyHistogram& frameLatency = Metrics::histogram("blink.frame");
+        ScopedLatency latency(frameLatency);
+
+        FileReader reader;
+        FitsFile fits;
+        fits.setHashImage(false);
+        if (hasParams)
+            fits.setStretchParams(params);
+        if (reader.open(path) && fits.loadFile(path, reader.data(), reader.size()))
+        {
+            fits.extractTags();
+            fits.extractImage(size / 2);
+            image = fits.getImage();
+            if (!image.isNull() && qMax(image.width(), image.height()) > size)
+                image = image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            usedParams = fits.getStretchParams();
+        }
+    }
+
+    {
+        QMutexLocker locker(&mutex);
+        if (frameGeneration != generation)
+            return;
+        queued.remove(index);
+        if (!isNearCurrent(index))
+            return;
+        // A frame that could not be read is kept as a null image, so it is not read again
+        ready.insert(index, image);
+        if (!hasStretchParams && !image.isNull())
+        {
+            stretchParams = usedParams;
+            hasStretchParams = true;
+            queueMissing();
+        }
+    }
+    emit frameReady(index);
+}
+
+bool BlinkPrefetcher::isNearCurrent(int index) const
+{
+    return qAbs(index - current) <= prefetchFrames;
+}
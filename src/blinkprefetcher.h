@@ -0,0 +1,90 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef BLINKPREFETCHER_H
+#define BLINKPREFETCHER_H
+
+#include "autostretcher.h"
+#include "taskscheduler.h"
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+
+#include <atomic>
+
+/*!
+ * \brief The BlinkPrefetcher class
+ * The frames of a blink sequence, rendered ahead of the one shown.
+ *
+ * The frames within BlinkPrefetchFrames of the current one are read, binned to the
+ * frame size and stretched on worker threads, the next ones first. They are kept until
+ * the current frame moves away from them, so at most 2 * BlinkPrefetchFrames + 1
+ * frames are held. Every frame is stretched with the same parameters, so a change of
+ * brightness from one frame to the next is in the data and not in the stretch.
+ */
+class BlinkPrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BlinkPrefetcher(QObject *parent = nullptr);
+    ~BlinkPrefetcher();
+
+    // The FITS files in blink order. The stretch is the stored one of a frame, or empty
+    // to take the one of the first frame rendered.
+    void setFrames(const QStringList& paths, const QByteArray& stretchParameters);
+    // Pixels on the longer side of the rendered frames
+    void setFrameSize(int size);
+    int frameCount() const;
+    QString framePath(int index) const;
+    // Moves to the frame. Returns true with the frame when it is done, a null one if it could not
+    // be read, otherwise frameReady is emitted when it is.
+    bool setCurrent(int index, QImage& frame);
+
+signals:
+    void frameReady(int index);
+
+private:
+    QStringList paths;
+    int frameSize;
+    int prefetchFrames;
+
+    mutable QMutex mutex;
+    StretchParams stretchParams;
+    bool hasStretchParams = false;
+    int current = 0;
+    quint64 generation = 0; // Of the frames, tasks of older ones are dropped
+    QHash<int, QImage> ready;
+    QSet<int> queued;
+    TaskGroup pool {InteractivePriority};
+    std::atomic<bool> closing {false};
+
+    void queueMissing();
+    void render(int index, quint64 frameGeneration);
+    bool isNearCurrent(int index) const;
+};
+
+#endif // BLINKPREFETCHER_H
@@ -0,0 +1,137 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "blinkwindow.h"
+
+#include <QFileInfo>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScreen>
+#include <QSettings>
+
+// Milliseconds each frame is shown while playing
+#define BLINK_INTERVAL 250
+
+BlinkWindow::BlinkWindow(const QStringList &paths, int startIndex, const QByteArray &stretchParameters, QWidget *parent) : QWidget(parent, Qt::Window)
+{
+    setWindowTitle(tr("Blink"));
+    resize(1024, 768);
+    setFocusPolicy(Qt::StrongFocus);
+
+    currentIndex = qBound(0, startIndex, paths.size() - 1);
+    prefetcher.setFrames(paths, stretchParameters);
+    connect(&prefetcher, &BlinkPrefetcher::frameReady, this, &BlinkWindow::frameReady);
+
+    playTimer.setInterval(QSettings().value("BlinkInterval", BLINK_INTERVAL).toInt());
+    connect(&playTimer, &QTimer::timeout, this, [this]() {
+        // Waits on a frame that is not ready yet, rather than skipping it
+        if (imageIndex == currentIndex)
+            step(currentIndex + 1 < prefetcher.frameCount() ? 1 : -currentIndex);
+    });
+}
+
+void BlinkWindow::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+
+    // Rendered at the resolution of the screen, so a maximized window shows them as they are
+    const QSize screenSize = screen()->size() * screen()->devicePixelRatio();
+    prefetcher.setFrameSize(qMax(screenSize.width(), screenSize.height()));
+    step(0);
+}
+
+void BlinkWindow::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::black);
+    painter.setPen(Qt::gray);
+
+    if (image.isNull())
+    {
+        painter.drawText(rect(), Qt::AlignCenter, imageIndex == currentIndex ? tr("Could not read the frame") : tr("Loading..."));
+    }
+    else
+    {
+        QSize size = image.size().scaled(this->size(), Qt::KeepAspectRatio);
+        QRect target(QPoint((width() - size.width()) / 2, (height() - size.height()) / 2), size);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(target, image);
+    }
+
+    QString caption = QString("%1 / %2  %3").arg(currentIndex + 1).arg(prefetcher.frameCount()).arg(QFileInfo(prefetcher.framePath(currentIndex)).fileName());
+    painter.drawText(rect().adjusted(8, 8, -8, -8), Qt::AlignLeft | Qt::AlignTop, caption);
+}
+
+void BlinkWindow::keyPressEvent(QKeyEvent *event)
+{
+    switch (event->key())
+    {
+    case Qt::Key_Right:
+    case Qt::Key_Down:
+        step(1);
+        break;
+    case Qt::Key_Left:
+    case Qt::Key_Up:
+        step(-1);
+        break;
+    case Qt::Key_Home:
+        step(-currentIndex);
+        break;
+    case Qt::Key_End:
+        step(prefetcher.frameCount() - 1 - currentIndex);
+        break;
+    case Qt::Key_Space:
+        if (playTimer.isActive())
+            playTimer.stop();
+        else
+            playTimer.start();
+        break;
+    case Qt::Key_Escape:
+        close();
+        break;
+    default:
+        QWidget::keyPressEvent(event);
+    }
+}
+
+void BlinkWindow::step(int delta)
+{
+    if (prefetcher.frameCount() == 0)
+        return;
+
+    currentIndex = qBound(0, currentIndex + delta, prefetcher.frameCount() - 1);
+    QImage frame;
+    if (prefetcher.setCurrent(currentIndex, frame))
+    {
+        image = frame;
+        imageIndex = currentIndex;
+    }
+    update();
+}
+
+void BlinkWindow::frameReady(int index)
+{
+    if (index == currentIndex)
+        step(0);
+}
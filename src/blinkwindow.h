@@ -0,0 +1,59 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef BLINKWINDOW_H
+#define BLINKWINDOW_H
+
+#include "blinkprefetcher.h"
+
+#include <QTimer>
+#include <QWidget>
+
+/*!
+ * \brief The BlinkWindow class
+ * Steps through frames to cull them, see BlinkPrefetcher. The arrow keys step, space
+ * plays and pauses, and the last frame shown stays up until the next one is ready.
+ */
+class BlinkWindow : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit BlinkWindow(const QStringList& paths, int startIndex, const QByteArray& stretchParameters, QWidget *parent = nullptr);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void showEvent(QShowEvent *event) override;
+
+private:
+    BlinkPrefetcher prefetcher;
+    int currentIndex;
+    QImage image; // Of imageIndex, shown until the current frame is ready
+    int imageIndex = -1;
+    QTimer playTimer;
+
+    void step(int delta);
+    void frameReady(int index);
+};
+
+#endif // BLINKWINDOW_H
@@ -0,0 +1,238 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "calibrationindex.h"
+
+#include <QSet>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#define MSECS_PER_DAY (24 * 3600 * 1000LL)
+
+/*!
+ * \brief normalized
+ * Numbers written as 100, 100.0 or 1E2 by different programs are the same setup.
+ */
+static QString normalized(const QString& value)
+{
+    bool ok = false;
+    double number = value.trimmed().toDouble(&ok);
+    return ok ? QString::number(number) : value.trimmed();
+}
+
+CalibrationIndex::FrameType CalibrationIndex::frameType(const AstroFile &astroFile)
+{
+    const QString type = astroFile.Tags.value(TagImageType).toLower();
+    if (type.isEmpty())
+        return UnknownFrame;
+    if (type.contains("bias") || type.contains("offset") || type.contains("zero"))
+        return BiasFrame;
+    // Dark flats are darks, they match the EXPTIME of the flats
+    if (type.contains("dark"))
+        return DarkFrame;
+    if (type.contains("flat"))
+        return FlatFrame;
+    if (type.contains("light") || type.contains("object") || type.contains("science"))
+        return LightFrame;
+    return UnknownFrame;
+}
+
+QString CalibrationIndex::frameTypeName(FrameType type)
+{
+    switch (type)
+    {
+    case LightFrame:
+        return "Light";
+    case DarkFrame:
+        return "Dark";
+    case FlatFrame:
+        return "Flat";
+    case BiasFrame:
+        return "Bias";
+    case UnknownFrame:
+        break;
+    }
+    return QString();
+}
+
+QString CalibrationIndex::groupKey(const QString &setup, FrameType type, const QString &variant)
+{
+    return setup + QChar(0x1F) + QString::number(type) + QChar(0x1F) + variant;
+}
+
+void CalibrationIndex::clear()
+{
+    entries.clear();
+    groups.clear();
+}
+
+void CalibrationIndex::insert(const AstroFile &astroFile)
+{
+    remove(astroFile.Id);
+
+    if (astroFile.ObservationTime == ObservingNight::missingTime)
+        return;
+
+    Entry entry;
+    entry.type = frameType(astroFile);
+    entry.time = astroFile.ObservationTime;
+    entry.night = astroFile.ObservationNight.toJulianDay();
+    bool ok = false;
+    entry.temperature = astroFile.Tags.value(TagCcdTemp).toDouble(&ok);
+    if (!ok)
+        entry.temperature = std::numeric_limits<double>::quiet_NaN();
+
+    const QString offset = astroFile.Tags.value(TagOffset, astroFile.Tags.value(TagBlackLevel));
+    const QString setup = QStringList({
+        astroFile.Instrument,
+        normalized(astroFile.Tags.value(TagGain)),
+        normalized(offset),
+        normalized(astroFile.Tags.value(TagXBinning, "1")),
+        normalized(astroFile.Tags.value(TagYBinning, "1"))
+    }).join(QChar(0x1E));
+    const QString filter = astroFile.Filter;
+    const QString exposure = normalized(astroFile.Tags.value(TagExposureTime));
+
+    switch (entry.type)
+    {
+    case DarkFrame:
+        entry.key = groupKey(setup, DarkFrame, exposure);
+        break;
+    case FlatFrame:
+        entry.key = groupKey(setup, FlatFrame, filter);
+        break;
+    case BiasFrame:
+        entry.key = groupKey(setup, BiasFrame, QString());
+        break;
+    case LightFrame:
+    case UnknownFrame:
+        entry.setup = setup;
+        entry.filter = filter;
+        entry.exposure = exposure;
+        break;
+    }
+
+    if (!entry.key.isEmpty())
+    {
+        QVector<Frame>& frames = groups[entry.key];
+        Frame frame = {entry.time, entry.temperature, astroFile.Id};
+        auto position = std::upper_bound(frames.begin(), frames.end(), frame.time, [](qint64 time, const Frame& f) { return time < f.time; });
+        frames.insert(position, frame);
+    }
+    entries.insert(astroFile.Id, entry);
+}
+
+void CalibrationIndex::remove(int id)
+{
+    auto it = entries.find(id);
+    if (it == entries.end())
+        return;
+
+    if (!it->key.isEmpty())
+    {
+        auto group = groups.find(it->key);
+        if (group != groups.end())
+        {
+            // Frames taken at the same time are next to each other
+            auto position = std::lower_bound(group->begin(), group->end(), it->time, [](const Frame& f, qint64 time) { return f.time < time; });
+            while (position != group->end() && position->time == it->time && position->id != id)
+                ++position;
+            if (position != group->end() && position->id == id)
+                group->erase(position);
+            if (group->isEmpty())
+                groups.erase(group);
+        }
+    }
+    entries.erase(it);
+}
+
+QVector<int> CalibrationIndex::matching(const QVector<int> &lightIds, int days, double temperatureTolerance) const
+{
+    struct Session
+    {
+        QString key;
+        qint64 firstTime;
+        qint64 lastTime;
+        double minTemperature;
+        double maxTemperature;
+        bool hasTemperature;
+    };
+
+    // One lookup per group and night of the lights. The temperatures of a night are
+    // close, so the range of the night stands for each of its lights.
+    QHash<QString, Session> sessions;
+    for (int id : lightIds)
+    {
+        auto it = entries.constFind(id);
+        if (it == entries.constEnd() || !it->key.isEmpty())
+            continue;
+
+        const QString night = QString::number(it->night);
+        const QString keys[] = {
+            groupKey(it->setup, DarkFrame, it->exposure),
+            groupKey(it->setup, FlatFrame, it->filter),
+            groupKey(it->setup, BiasFrame, QString())
+        };
+        for (auto& key : keys)
+        {
+            if (!groups.contains(key))
+                continue;
+
+            auto session = sessions.find(key + QChar(0x1F) + night);
+            if (session == sessions.end())
+            {
+                sessions.insert(key + QChar(0x1F) + night, {key, it->time, it->time, it->temperature, it->temperature, !std::isnan(it->temperature)});
+                continue;
+            }
+            session->firstTime = qMin(session->firstTime, it->time);
+            session->lastTime = qMax(session->lastTime, it->time);
+            if (std::isnan(it->temperature))
+            {
+                session->hasTemperature = false;
+            }
+            else
+            {
+                session->minTemperature = qMin(session->minTemperature, it->temperature);
+                session->maxTemperature = qMax(session->maxTemperature, it->temperature);
+            }
+        }
+    }
+
+    const qint64 window = days * MSECS_PER_DAY;
+    QSet<int> found;
+    for (auto& session : sessions)
+    {
+        const QVector<Frame> frames = groups.value(session.key);
+        auto frame = std::lower_bound(frames.begin(), frames.end(), session.firstTime - window, [](const Frame& f, qint64 time) { return f.time < time; });
+        for (; frame != frames.end() && frame->time <= session.lastTime + window; ++frame)
+        {
+            if (session.hasTemperature && !std::isnan(frame->temperature)
+                && (frame->temperature < session.minTemperature - temperatureTolerance || frame->temperature > session.maxTemperature + temperatureTolerance))
+                continue;
+            found.insert(frame->id);
+        }
+    }
+    return QVector<int>(found.begin(), found.end());
+}
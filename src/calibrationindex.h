@@ -0,0 +1,100 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef CALIBRATIONINDEX_H
+#define CALIBRATIONINDEX_H
+
+#include "astrofile.h"
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+/*!
+ * \brief The CalibrationIndex class
+ * The darks, flats and bias frames of the catalog, for finding the ones that calibrate
+ * a selection of light frames without a scan of every file.
+ *
+ * Frames are grouped by their setup signature (INSTRUME, GAIN, OFFSET and binning),
+ * their frame type, and what else the type has to match: the EXPTIME of darks and the
+ * FILTER of flats. Each group is kept sorted by DATE-OBS, so the frames taken within
+ * a number of days of a night are a binary search. Light frames are grouped by night
+ * before the lookup, so a selection of a whole session costs one search per group.
+ *
+ * Frames without a DATE-OBS are not indexed.
+ */
+class CalibrationIndex
+{
+public:
+    enum FrameType
+    {
+        UnknownFrame,
+        LightFrame,
+        DarkFrame,
+        FlatFrame,
+        BiasFrame
+    };
+
+    // From IMAGETYP, which capture programs spell differently
+    static FrameType frameType(const AstroFile& astroFile);
+    // Empty for UnknownFrame
+    static QString frameTypeName(FrameType type);
+
+    void clear();
+    void insert(const AstroFile& astroFile);
+    void remove(int id);
+    int count() const { return entries.count(); }
+
+    // Ids of the calibration frames of the same setup as the lights, taken within days of
+    // them, and at most temperatureTolerance degrees from their CCD-TEMP when both have one.
+    // Frames of an unknown type are taken as lights.
+    QVector<int> matching(const QVector<int>& lightIds, int days, double temperatureTolerance) const;
+
+private:
+    struct Frame
+    {
+        qint64 time; // Milliseconds since the epoch of DATE-OBS
+        double temperature; // NaN without a CCD-TEMP
+        int id;
+    };
+
+    struct Entry
+    {
+        FrameType type;
+        qint64 time;
+        qint64 night; // Julian day, see ObservingNight
+        double temperature;
+        QString key; // Of the group of a calibration frame
+        // The parts of the keys of a light frame
+        QString setup;
+        QString filter;
+        QString exposure;
+    };
+
+    QHash<int, Entry> entries;
+    QHash<QString, QVector<Frame>> groups; // Sorted by time
+
+    static QString groupKey(const QString& setup, FrameType type, const QString& variant);
+};
+
+#endif // CALIBRATIONINDEX_H
@@ -23,9 +23,25 @@
 */
 
 #include "catalog.h"
+#include "catalogsnapshot.h"
+#include "metrics.h"
+#include "stringpool.h"
 
+#include <QBitArray>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QThread>
 #include <QTimer>
 
+#include <algorithm>
+#include <optional>
+
+// Bounds of the interval between notifications to the GUI
+#define MIN_FLUSH_INTERVAL_MS 50
+#define MAX_FLUSH_INTERVAL_MS 1000
+// The GUI spends at most about 1/FLUSH_COST_FACTOR of its time on the notifications
+#define FLUSH_COST_FACTOR 10
 
 // We should check if the folder is a child folder of an
 // existing search folder.
@@ -33,10 +49,12 @@
 // child folders
 Catalog::Catalog(QObject *parent)
 {
-//    QTimer *timer = new QTimer(this);
+    // A child moves to the catalog thread with the Catalog
+    timer.setParent(this);
+    timer.setSingleShot(true);
+    timer.setInterval(MIN_FLUSH_INTERVAL_MS);
     connect(&timer, &QTimer::timeout, this, QOverload<>::of(&Catalog::pushProcessedQueue));
     astroFilesQueue = 0;
-    timer.start(500);
 }
 
 Catalog::~Catalog()
@@ -47,61 +65,81 @@ Catalog::~Catalog()
 void Catalog::cancel()
 {
     cancelSignaled = true;
-    timer.stop();
+    QMetaObject::invokeMethod(&timer, &QTimer::stop, Qt::QueuedConnection);
 }
 
 void Catalog::addSearchFolder(const QString &folder)
 {
-    QMutexLocker locker(&searchFoldersMutex);
-    searchFolders.append(folder);
+    QWriteLocker locker(&searchFoldersLock);
+    searchFolders.insert(folder);
 }
 
 void Catalog::addSearchFolder(const QList<QString> &folders)
 {
-    QMutexLocker locker(&searchFoldersMutex);
-    searchFolders.append(folders);
+    QWriteLocker locker(&searchFoldersLock);
+    for (auto& folder : folders)
+        searchFolders.insert(folder);
 }
 
 void Catalog::removeSearchFolder(const QString &folder)
 {
-    QMutexLocker locker(&searchFoldersMutex);
-    searchFolders.removeOne(folder);
+    QWriteLocker locker(&searchFoldersLock);
+    searchFolders.remove(folder);
 }
 
 void Catalog::removeAllSearchFolders()
 {
-    QMutexLocker locker(&searchFoldersMutex);
+    QWriteLocker locker(&searchFoldersLock);
     searchFolders.clear();
 }
 
 void Catalog::impAddAstroFile(const AstroFile &astroFile, bool shouldEmit)
 {
-    QMutexLocker locker(&listMutex);
+    static LatencyHistogram& lockWait = Metrics::histogram("catalog.write_lock_wait");
+    std::optional<ScopedLatency> waiting(std::in_place, lockWait);
+    QWriteLocker locker(&listLock);
+    waiting.reset();
+    retryPaths.remove(astroFile.FullPath);
 
     // Check if this file already exists
-    // We should probably check by id, but we don't have that mapping
-    // Getting the index is O(n), and it may take a long time to
-    // call it on initialization of large DBs.
-    // i.e. don't call `int index = astroFileIndex(astroFile);` here
 
     auto existing = getAstroFileByPath(astroFile.FullPath);
     if (existing == nullptr)
     {
         AstroFile* a = new AstroFile(astroFile);
+        // Thumbnails are loaded from the db when shown, only the tiny one stays in memory,
+        // in the atlas
+        a->dropThumbnailPixels();
+        a->tinyThumbnail = QImage();
+        a->tinyThumbnailSlot = storeTinyThumbnail(astroFile);
+        setFacets(a);
+        a->rowHandle = rowHandles.add(a);
         astroFiles.append(a);
-        filePathToIdMap.insert(astroFile.FullPath, a);
+        columns.append(*a);
+        pathIndex.insert(a);
+        idToRowMap.insert(a->Id, astroFiles.count() - 1);
+        addToDuplicateGroup(a);
+        addToSizeIndex(a);
+        addToIdentityIndex(a);
+        calibrationFrames.insert(*a);
+        smartCollections.insert(*a);
+        if (a->PerceptualHash != 0)
+            perceptualHashesStale = true;
         if (shouldEmit)
         {
 //            emit AstroFilesAdded(1);
             astroFilesQueueMutex.lock();
             astroFilesQueue++;
             astroFilesQueueMutex.unlock();
+            scheduleFlush();
 
         }
     }
     else
     {
-        int index = astroFileIndex(astroFile);
+        // The db keeps the id of a file that is written again; the row is still looked up by
+        // the existing id, as a file deleted and found again gets a new one
+        int index = rowOfId(existing->Id);
         if (index == -1)
         {
             qDebug()<<"=== BUG: Found two files with same path"<<astroFile.FullPath;
@@ -110,28 +148,138 @@ void Catalog::impAddAstroFile(const AstroFile &astroFile, bool shouldEmit)
             return;
         }
         AstroFile* a = new AstroFile(astroFile);
+        a->dropThumbnailPixels();
+        a->tinyThumbnail = QImage();
+        a->tinyThumbnailSlot = storeTinyThumbnail(astroFile);
+        if (existing->tinyThumbnailSlot != a->tinyThumbnailSlot)
+            tinyThumbnails.remove(existing->tinyThumbnailSlot);
+        setFacets(a);
+        // Same row, so the same handle
+        a->rowHandle = existing->rowHandle;
+        rowHandles.replace(a->rowHandle, a);
         astroFiles[index] = a;
-        filePathToIdMap.insert(astroFile.FullPath, a);
-        delete existing;
-        emit AstroFileUpdated(astroFile, index);
+        columns.replace(index, *a);
+        pathIndex.insert(a);
+        idToRowMap.remove(existing->Id);
+        idToRowMap.insert(a->Id, index);
+        removeFromDuplicateGroup(existing);
+        addToDuplicateGroup(a);
+        removeFromSizeIndex(existing);
+        addToSizeIndex(a);
+        removeFromIdentityIndex(existing);
+        addToIdentityIndex(a);
+        calibrationFrames.remove(existing->Id);
+        calibrationFrames.insert(*a);
+        smartCollections.remove(existing->Id);
+        smartCollections.insert(*a);
+        if (a->PerceptualHash != existing->PerceptualHash || a->Id != existing->Id)
+            perceptualHashesStale = true;
+        rowHandles.retire(existing);
+        astroFilesQueueMutex.lock();
+        updatedIdsQueue.insert(a->Id);
+        astroFilesQueueMutex.unlock();
+        scheduleFlush();
+    }
+}
+
+/*!
+ * \brief Catalog::storeTinyThumbnail
+ * Returns the slot of the tiny thumbnail of the file in the atlas. The rows of the
+ * snapshot come without one, they already have their slot in the atlas it loaded.
+ */
+int Catalog::storeTinyThumbnail(const AstroFile &astroFile)
+{
+    // The caller must hold listLock for writing
+    if (astroFile.tinyThumbnail.isNull())
+        return astroFile.tinyThumbnailSlot;
+    return tinyThumbnails.insert(astroFile.tinyThumbnail);
+}
+
+/*!
+ * \brief Catalog::setFacets
+ * Values repeated across rows are interned in the StringPool, so rows with the same
+ * folder, object or filter share one string.
+ */
+void Catalog::setFacets(AstroFile *astroFile)
+{
+    astroFile->DirectoryPath = StringPool::intern(astroFile->DirectoryPath);
+    astroFile->VolumeName = StringPool::intern(astroFile->VolumeName);
+    astroFile->FileExtension = StringPool::intern(astroFile->FileExtension);
+    astroFile->Tags = StringPool::internTags(astroFile->Tags);
+    astroFile->updateFacets();
+}
+
+/*!
+ * \brief Catalog::scheduleFlush
+ * Starts the timer for the waiting additions and updates, if it is not running yet.
+ * The interval follows the cost the GUI reported for the previous notifications.
+ */
+void Catalog::scheduleFlush()
+{
+    if (cancelSignaled)
+        return;
+    if (QThread::currentThread() != timer.thread())
+    {
+        QMetaObject::invokeMethod(this, [this]() { scheduleFlush(); }, Qt::QueuedConnection);
+        return;
     }
+    if (timer.isActive())
+        return;
+
+    qint64 cost = notificationCostMsecs.exchange(0);
+    timer.setInterval(int(qBound<qint64>(MIN_FLUSH_INTERVAL_MS, cost * FLUSH_COST_FACTOR, MAX_FLUSH_INTERVAL_MS)));
+    timer.start();
+}
+
+void Catalog::reportNotificationCost(qint64 msecs)
+{
+    notificationCostMsecs += msecs;
 }
 
+/*!
+ * \brief Catalog::pushProcessedQueue
+ * Sends the added rows, then the updated rows as ranges of consecutive rows. Updates
+ * are queued by id, so rows removed in the meantime do not shift them.
+ */
 void Catalog::pushProcessedQueue()
 {
     int local = 0;
+    QSet<int> updatedIds;
     astroFilesQueueMutex.lock();
     if (astroFilesQueue > 0)
     {
         local = astroFilesQueue;
         astroFilesQueue = 0;
     }
+    updatedIds.swap(updatedIdsQueue);
     astroFilesQueueMutex.unlock();
     if (local > 0)
     {
         qDebug()<<"Pushing " << local;
         emit AstroFilesAdded(local);
     }
+    if (updatedIds.isEmpty())
+        return;
+
+    QList<int> rows;
+    {
+        QReadLocker locker(&listLock);
+        for (int id : updatedIds)
+        {
+            int row = idToRowMap.value(id, -1);
+            if (row != -1)
+                rows.append(row);
+        }
+    }
+    std::sort(rows.begin(), rows.end());
+    for (int i = 0; i < rows.count();)
+    {
+        int last = i;
+        while (last + 1 < rows.count() && rows.at(last + 1) == rows.at(last) + 1)
+            last++;
+        emit AstroFilesUpdated(rows.at(i), rows.at(last));
+        i = last + 1;
+    }
 }
 
 void Catalog::addAstroFile(const AstroFile& astroFile)
@@ -147,105 +295,849 @@ void Catalog::addAstroFiles(const QList<AstroFile> &files)
             return;
         impAddAstroFile(a, true);
     }
-//    emit AstroFilesAdded(files.count());
+}
+
+void Catalog::finishAddingAstroFiles()
+{
+    // The db loads the model in pages. This is called after the last page was added.
+    pushProcessedQueue();
+    qDebug() << "String pool:" << StringPool::count() << "strings, saved" << StringPool::savedBytes() / 1024 << "KB";
     emit DoneAddingAstrofiles();
 }
 
 void Catalog::deleteAstroFile(const AstroFile &astroFile)
 {
-    QMutexLocker locker(&listMutex);
+    QWriteLocker locker(&listLock);
 
-    int index = astroFileIndex(astroFile);
+    int index = rowOfId(astroFile.Id);
 
     if (index == -1)
         return;
 
-    auto a = astroFiles.at(index);
-    astroFiles.removeAt(index);
-    filePathToIdMap.remove(a->FullPath);
-//    emit AstroFileRemoved(astroFile, index);
-    delete a;
+    removeRow(index);
+}
+
+/*!
+ * \brief Catalog::updateFileHashes
+ * \param files
+ *
+ * Only the FileHash of these files changed, which happens when their quick hash
+ * collided with another file and the full hash had to be computed.
+ */
+void Catalog::updateFileHashes(const QList<AstroFile> &files)
+{
+    QWriteLocker locker(&listLock);
+
+    for (auto& astroFile : files)
+    {
+        auto existing = getAstroFileByPath(astroFile.FullPath);
+        if (existing == nullptr)
+            continue;
+
+        int index = rowOfId(existing->Id);
+        if (index == -1)
+            continue;
+
+        AstroFile* a = new AstroFile(*existing);
+        a->FileHash = astroFile.FileHash;
+        replaceRow(index, existing, a);
+        astroFilesQueueMutex.lock();
+        updatedIdsQueue.insert(a->Id);
+        astroFilesQueueMutex.unlock();
+    }
+    scheduleFlush();
+}
+
+/*!
+ * \brief Catalog::updateIntegrity
+ * \param files
+ *
+ * Only the Integrity of these files changed, once they were verified, see IntegrityVerifier.
+ */
+void Catalog::updateIntegrity(const QList<AstroFile> &files)
+{
+    QWriteLocker locker(&listLock);
+
+    for (auto& astroFile : files)
+    {
+        auto existing = getAstroFileByPath(astroFile.FullPath);
+        if (existing == nullptr || existing->Id != astroFile.Id || existing->Integrity == astroFile.Integrity)
+            continue;
+
+        int index = rowOfId(existing->Id);
+        if (index == -1)
+            continue;
+
+        AstroFile* a = new AstroFile(*existing);
+        a->Integrity = astroFile.Integrity;
+        replaceRow(index, existing, a);
+        astroFilesQueueMutex.lock();
+        updatedIdsQueue.insert(a->Id);
+        astroFilesQueueMutex.unlock();
+    }
+    scheduleFlush();
+}
+
+/*!
+ * \brief Catalog::updateSolutions
+ * \param files
+ *
+ * Only the Solution of these files changed, once they were plate solved, see PlateSolver.
+ * Their rows get the position of the solution.
+ */
+void Catalog::updateSolutions(const QList<AstroFile> &files)
+{
+    QWriteLocker locker(&listLock);
+
+    for (auto& astroFile : files)
+    {
+        auto existing = getAstroFileByPath(astroFile.FullPath);
+        if (existing == nullptr || existing->Id != astroFile.Id)
+            continue;
+
+        int index = rowOfId(existing->Id);
+        if (index == -1)
+            continue;
+
+        AstroFile* a = new AstroFile(*existing);
+        a->Solution = astroFile.Solution;
+        replaceRow(index, existing, a);
+        astroFilesQueueMutex.lock();
+        updatedIdsQueue.insert(a->Id);
+        astroFilesQueueMutex.unlock();
+    }
+    scheduleFlush();
+}
+
+/*!
+ * \brief Catalog::updatePerceptualHashes
+ * \param files
+ *
+ * Only the PerceptualHash of these files changed, which happens when the repository
+ * computed it for rows written before it was kept.
+ */
+void Catalog::updatePerceptualHashes(const QList<AstroFile> &files)
+{
+    QWriteLocker locker(&listLock);
+
+    for (auto& astroFile : files)
+    {
+        auto existing = getAstroFileByPath(astroFile.FullPath);
+        if (existing == nullptr)
+            continue;
+        int index = rowOfId(existing->Id);
+        if (index == -1)
+            continue;
+        AstroFile* a = new AstroFile(*existing);
+        a->PerceptualHash = astroFile.PerceptualHash;
+        replaceRow(index, existing, a);
+    }
+    perceptualHashesStale = true;
+}
+
+/*!
+ * \brief Catalog::addToDuplicateGroup
+ * The caller must hold the write lock. Files without a FileHash are in no group,
+ * their quick hash did not collide with any other file.
+ */
+void Catalog::addToDuplicateGroup(const AstroFile *astroFile)
+{
+    if (astroFile->FileHash.isEmpty())
+        return;
+    duplicateGroups[astroFile->FileHash].append(astroFile->Id);
+}
+
+void Catalog::removeFromDuplicateGroup(const AstroFile *astroFile)
+{
+    if (astroFile->FileHash.isEmpty())
+        return;
+    auto it = duplicateGroups.find(astroFile->FileHash);
+    if (it == duplicateGroups.end())
+        return;
+    it->removeOne(astroFile->Id);
+    if (it->isEmpty())
+        duplicateGroups.erase(it);
+}
+
+void Catalog::addToSizeIndex(AstroFile *astroFile)
+{
+    // The caller must hold the write lock
+    if (astroFile->FileSize > 0)
+        filesBySize.insert(astroFile->FileSize, astroFile);
+}
+
+void Catalog::removeFromSizeIndex(AstroFile *astroFile)
+{
+    // The caller must hold the write lock
+    if (astroFile->FileSize > 0)
+        filesBySize.remove(astroFile->FileSize, astroFile);
+}
+
+void Catalog::addToIdentityIndex(AstroFile *astroFile)
+{
+    // The caller must hold the write lock
+    if (astroFile->FileInode != 0)
+        filesByInode.insert(astroFile->FileInode, astroFile);
+}
+
+void Catalog::removeFromIdentityIndex(AstroFile *astroFile)
+{
+    // The caller must hold the write lock
+    if (astroFile->FileInode != 0)
+        filesByInode.remove(astroFile->FileInode, astroFile);
+}
+
+QVector<int> Catalog::duplicatesOf(const QString &fileHash)
+{
+    QReadLocker locker(&listLock);
+    QVector<int> group = duplicateGroups.value(fileHash);
+    return group.count() > 1 ? group : QVector<int>();
+}
+
+QVector<int> Catalog::allDuplicates()
+{
+    QReadLocker locker(&listLock);
+    QVector<int> ids;
+    for (auto& group : duplicateGroups)
+    {
+        if (group.count() > 1)
+            ids.append(group);
+    }
+    return ids;
+}
+
+/*!
+ * \brief Catalog::nearDuplicatesOf
+ * \param id
+ * \param radius
+ *
+ * Searches the BK-tree of the perceptual hashes, building it first if files were
+ * added or changed since the last search. Files without a hash have no near duplicates.
+ */
+QVector<int> Catalog::nearDuplicatesOf(int id, int radius)
+{
+    static LatencyHistogram& searchLatency = Metrics::histogram("catalog.near_duplicates");
+    ScopedLatency latency(searchLatency);
+
+    QMutexLocker indexLocker(&perceptualHashesMutex);
+    QReadLocker locker(&listLock);
+
+    if (perceptualHashesStale.exchange(false))
+    {
+        perceptualHashes.clear();
+        perceptualHashOfId.clear();
+        perceptualHashes.reserve(astroFiles.count());
+        for (auto a : astroFiles)
+        {
+            if (a->PerceptualHash == 0)
+                continue;
+            perceptualHashes.insert(a->Id, a->PerceptualHash);
+            perceptualHashOfId.insert(a->Id, a->PerceptualHash);
+        }
+    }
+
+    QVector<int> ids;
+    const quint64 hash = perceptualHashOfId.value(id);
+    if (hash == 0)
+        return ids;
+    ids = perceptualHashes.find(hash, radius);
+    ids.removeIf([&](int found) { return !idToRowMap.contains(found); });
+    return ids;
+}
+
+QVector<int> Catalog::matchingCalibration(const QVector<int> &lightIds, int days, double temperatureTolerance)
+{
+    static LatencyHistogram& matchLatency = Metrics::histogram("catalog.calibration_match");
+    ScopedLatency latency(matchLatency);
+
+    QReadLocker locker(&listLock);
+    return calibrationFrames.matching(lightIds, days, temperatureTolerance);
+}
+
+void Catalog::setSmartCollection(const SmartCollection &collection)
+{
+    {
+        QWriteLocker locker(&listLock);
+        smartCollections.setCollection(collection, astroFiles);
+    }
+    emit smartCollectionsChanged();
+}
+
+void Catalog::removeSmartCollection(const QString &name)
+{
+    {
+        QWriteLocker locker(&listLock);
+        smartCollections.removeCollection(name);
+    }
+    emit smartCollectionsChanged();
+}
+
+// The collections of the last days are found again once the date changed
+void Catalog::refreshSmartCollections()
+{
+    {
+        QReadLocker locker(&listLock);
+        if (!smartCollections.isStale())
+            return;
+    }
+    QWriteLocker locker(&listLock);
+    smartCollections.refresh(astroFiles);
+}
+
+QVector<int> Catalog::smartCollectionMembers(const QString &name)
+{
+    refreshSmartCollections();
+    QReadLocker locker(&listLock);
+    return smartCollections.members(name);
+}
+
+QList<QPair<QString, int>> Catalog::smartCollectionCounts()
+{
+    refreshSmartCollections();
+    QReadLocker locker(&listLock);
+    return smartCollections.counts();
 }
 
 void Catalog::deleteAstroFiles(const QList<AstroFile> &files)
 {
+    QWriteLocker locker(&listLock);
+
+    // Remove all files in a single pass over the rows, instead of one
+    // removeAt (and one index lookup) per file.
+    QSet<int> ids;
     for (auto& a : files)
+        ids.insert(a.Id);
+
+    int firstRemoved = -1;
+    QList<AstroFile*> remaining;
+    remaining.reserve(astroFiles.count());
+    QBitArray removedRows(astroFiles.count());
+    for (int row = 0; row < astroFiles.count(); row++)
     {
-        deleteAstroFile(a);
+        auto a = astroFiles.at(row);
+        if (ids.contains(a->Id))
+        {
+            if (firstRemoved == -1)
+                firstRemoved = row;
+            removedRows.setBit(row);
+            pathIndex.remove(a->FullPath);
+            idToRowMap.remove(a->Id);
+            removeFromDuplicateGroup(a);
+            removeFromSizeIndex(a);
+            removeFromIdentityIndex(a);
+            calibrationFrames.remove(a->Id);
+            smartCollections.remove(a->Id);
+            tinyThumbnails.remove(a->tinyThumbnailSlot);
+            rowHandles.remove(a->rowHandle);
+            rowHandles.retire(a);
+        }
+        else
+            remaining.append(a);
     }
+
+    if (firstRemoved == -1)
+        return;
+
+    astroFiles.swap(remaining);
+    columns.remove(removedRows);
+    firstStaleRow = qMin(firstStaleRow, firstRemoved);
 }
 
 void Catalog::deleteAstroFileRow(int row)
 {
-    QMutexLocker locker(&listMutex);
+    QWriteLocker locker(&listLock);
+    removeRow(row);
+}
+
+void Catalog::removeRow(int row)
+{
     auto a = astroFiles.at(row);
     astroFiles.removeAt(row);
-    filePathToIdMap.remove(a->FullPath);
-    delete a;
+    columns.remove(row);
+    pathIndex.remove(a->FullPath);
+    idToRowMap.remove(a->Id);
+    removeFromDuplicateGroup(a);
+    removeFromSizeIndex(a);
+    removeFromIdentityIndex(a);
+    calibrationFrames.remove(a->Id);
+    smartCollections.remove(a->Id);
+    tinyThumbnails.remove(a->tinyThumbnailSlot);
+
+    // Every row after this one moved up by one. Their entries in idToRowMap
+    // are fixed up lazily by the next lookup that needs them.
+    firstStaleRow = qMin(firstStaleRow, row);
+    rowHandles.remove(a->rowHandle);
+    rowHandles.retire(a);
+}
+
+/*!
+ * \brief Catalog::replaceRow
+ * The caller must hold the write lock. The view reads the rows through their handles
+ * without a lock, so a row is never changed in place: the writer changes a copy, which
+ * takes the place of the row here, and the row is retired. The copy keeps the id, the
+ * handle and the tiny thumbnail of the row.
+ */
+void Catalog::replaceRow(int row, AstroFile *existing, AstroFile *astroFile)
+{
+    rowHandles.replace(astroFile->rowHandle, astroFile);
+    astroFiles[row] = astroFile;
+    columns.replace(row, *astroFile);
+    pathIndex.remove(existing->FullPath);
+    pathIndex.insert(astroFile);
+    removeFromDuplicateGroup(existing);
+    addToDuplicateGroup(astroFile);
+    removeFromSizeIndex(existing);
+    addToSizeIndex(astroFile);
+    removeFromIdentityIndex(existing);
+    addToIdentityIndex(astroFile);
+    calibrationFrames.remove(existing->Id);
+    calibrationFrames.insert(*astroFile);
+    smartCollections.remove(existing->Id);
+    smartCollections.insert(*astroFile);
+    rowHandles.retire(existing);
+}
+
+void Catalog::reindexStaleRows()
+{
+    for (int row = firstStaleRow; row < astroFiles.count(); row++)
+        idToRowMap[astroFiles.at(row)->Id] = row;
+    firstStaleRow = INT_MAX;
 }
 
 int Catalog::astroFileIndex(const AstroFile &astroFile)
 {
-    QMutexLocker locker(&listMutex);
+    return astroFileIndex(astroFile.Id);
+}
 
-    int index = 0;
-    for (auto& a : astroFiles)
+int Catalog::astroFileIndex(int id)
+{
     {
-        if (a->Id == astroFile.Id)
-        {
-            return index;
-        }
-        index++;
+        QReadLocker locker(&listLock);
+
+        auto it = idToRowMap.constFind(id);
+        if (it == idToRowMap.constEnd())
+            return -1;
+
+        // Rows before the first removed row have not moved
+        if (it.value() < firstStaleRow)
+            return it.value();
     }
-    return -1;
+
+    // QReadWriteLock can't upgrade a read lock, so take the write lock to reindex
+    QWriteLocker locker(&listLock);
+    return rowOfId(id);
+}
+
+int Catalog::rowOfId(int id)
+{
+    // The caller must hold the write lock, because this may reindex rows
+    auto it = idToRowMap.constFind(id);
+    if (it == idToRowMap.constEnd())
+        return -1;
+
+    if (it.value() < firstStaleRow)
+        return it.value();
+
+    reindexStaleRows();
+    return idToRowMap.value(id, -1);
+}
+
+/*!
+ * \brief Catalog::readColumns
+ * Calls reader with the columns of the rows, under the read lock, so the columns do
+ * not change while they are read. reader must not call back into the Catalog.
+ */
+void Catalog::readColumns(const std::function<void (const CatalogColumns &)> &reader)
+{
+    QReadLocker locker(&listLock);
+    reader(columns);
 }
 
 AstroFile* Catalog::getAstroFile(int row)
 {
-    QMutexLocker locker(&listMutex);
+    QReadLocker locker(&listLock);
     return astroFiles.at(row);
 }
 
-AstroFile *Catalog::getAstroFileByPath(QString path)
+quint64 Catalog::handleOfRow(int row)
 {
-    QMutexLocker locker(&listMutex);
+    QReadLocker locker(&listLock);
+    return row >= 0 && row < astroFiles.count() ? astroFiles.at(row)->rowHandle : 0;
+}
 
-    if (!filePathToIdMap.contains(path))
-        return nullptr;
-    return filePathToIdMap[path];
+const AstroFile *Catalog::astroFileOfHandle(quint64 handle) const
+{
+    return rowHandles.value(handle);
 }
 
-bool Catalog::shouldProcessFile(const QFileInfo &fileInfo)
+QList<AstroFile> Catalog::getAstroFiles()
 {
-    QMutexLocker locker(&listMutex);
+    QReadLocker locker(&listLock);
 
-    QString path = fileInfo.absoluteFilePath();
+    QList<AstroFile> files;
+    files.reserve(astroFiles.count());
+    for (auto a : astroFiles)
+        files.append(*a);
+    return files;
+}
 
-    searchFoldersMutex.lock();
-    bool isInSearchFolders = false;
-    for (auto s : searchFolders)
+void Catalog::setTinyThumbnails(const TinyThumbnailAtlas &atlas)
+{
+    QWriteLocker locker(&listLock);
+    tinyThumbnails = atlas;
+}
+
+void Catalog::writeSnapshot(const QString &path, int schemaVersion, qint64 catalogId, qint64 changeCounter)
+{
+    QList<AstroFile> files;
+    TinyThumbnailAtlas atlas;
     {
-        if (path.contains(s))
+        // The slots of the rows only match the atlas taken under the same lock
+        QReadLocker locker(&listLock);
+        files.reserve(astroFiles.count());
+        for (auto a : astroFiles)
+            files.append(*a);
+        atlas = tinyThumbnails;
+    }
+    if (tinyThumbnailsDropped || !CatalogSnapshot::write(path, files, atlas, schemaVersion, catalogId, changeCounter))
+        CatalogSnapshot::remove(path);
+}
+
+AstroFile *Catalog::getAstroFileByPath(const QString& path)
+{
+    // The caller must hold listLock
+    return pathIndex.value(path);
+}
+
+AstroFile *Catalog::getAstroFileByPath(const FileRecord &record)
+{
+    // The caller must hold listLock
+    return pathIndex.value(record.FullPath, record.pathHash());
+}
+
+bool Catalog::shouldProcessFile(const FileRecord &record)
+{
+    static std::atomic<qint64>& skippedFailures = Metrics::counter("catalog.skipped_failures");
+    const QString& path = record.FullPath;
+
+    if (!isInSearchFolders(path))
+        return false;
+
+    static LatencyHistogram& lockWait = Metrics::histogram("catalog.read_lock_wait");
+    std::optional<ScopedLatency> waiting(std::in_place, lockWait);
+    QReadLocker locker(&listLock);
+    waiting.reset();
+    auto a = getAstroFileByPath(record);
+    if (a == nullptr)
+        return true;
+
+    // Only the header phase of this file made it to the db, finish it, or
+    // retryFailedFiles or outdatedThumbnails asked for it
+    if (a->processStatus == NeedsToBeProcessed || retryPaths.contains(path))
+        return true;
+
+    // A failed file is only tried again once it changed, a partial copy usually grows
+    if (a->processStatus == AstroFileFailedToProcess)
+    {
+        if (record.Size != a->FileSize || record.LastModifiedTime != a->LastModifiedTime.toMSecsSinceEpoch())
+            return true;
+        skippedFailures++;
+        return false;
+    }
+
+    return (record.LastModifiedTime > a->LastModifiedTime.toMSecsSinceEpoch());
+}
+
+// Stats the files once listLock is released, the volume may be slow
+static QVector<FileRecord> recordsOfPaths(const QStringList& paths)
+{
+    QVector<FileRecord> files;
+    files.reserve(paths.count());
+    for (auto& path : paths)
+        files.append(FileRecord::ofPath(path));
+    return files;
+}
+
+QVector<FileRecord> Catalog::retryFailedFiles()
+{
+    QStringList paths;
+    {
+        QWriteLocker locker(&listLock);
+        for (auto a : astroFiles)
         {
-            isInSearchFolders = true;
-            break;
+            if (a->processStatus != AstroFileFailedToProcess)
+                continue;
+            retryPaths.insert(a->FullPath);
+            paths.append(a->FullPath);
         }
     }
-    searchFoldersMutex.unlock();
+    return recordsOfPaths(paths);
+}
 
-    if (!isInSearchFolders)
+bool Catalog::takeOutdatedThumbnail(const AstroFile* astroFile, QStringList& paths)
+{
+    // The caller must hold listLock for writing
+    if (astroFile == nullptr || astroFile->processStatus != AstroFileProcessed || astroFile->ThumbnailVersion >= THUMBNAIL_VERSION)
         return false;
+    // Already on its way, or made again and failed
+    if (retryPaths.contains(astroFile->FullPath))
+        return false;
+    retryPaths.insert(astroFile->FullPath);
+    paths.append(astroFile->FullPath);
+    return true;
+}
 
-    auto a = getAstroFileByPath(path);
-    if (a == nullptr)
+QVector<FileRecord> Catalog::outdatedThumbnails(const QStringList& paths)
+{
+    QStringList outdated;
+    {
+        QWriteLocker locker(&listLock);
+        for (auto& path : paths)
+            takeOutdatedThumbnail(getAstroFileByPath(path), outdated);
+    }
+    return recordsOfPaths(outdated);
+}
+
+QVector<FileRecord> Catalog::outdatedThumbnails(int limit)
+{
+    QStringList outdated;
+    {
+        QWriteLocker locker(&listLock);
+        for (auto a : astroFiles)
+        {
+            if (outdated.count() >= limit)
+                break;
+            takeOutdatedThumbnail(a, outdated);
+        }
+    }
+    return recordsOfPaths(outdated);
+}
+
+void Catalog::remapFolder(const QString &oldRoot, const QString &newRoot)
+{
+    const QString oldPrefix = oldRoot.endsWith('/') ? oldRoot : oldRoot + '/';
+    const QString newPrefix = newRoot.endsWith('/') ? newRoot : newRoot + '/';
+
+    QWriteLocker locker(&listLock);
+    // The path index is not in path order, a volume moves seldom enough to look at every file
+    QList<AstroFile*> moved;
+    for (auto a : astroFiles)
+    {
+        if (a->FullPath.startsWith(oldPrefix) && pathIndex.value(newPrefix + a->FullPath.mid(oldPrefix.length())) == nullptr)
+            moved.append(a);
+    }
+
+    for (auto existing : moved)
+    {
+        int row = rowOfId(existing->Id);
+        if (row == -1)
+            continue;
+        AstroFile* a = new AstroFile(*existing);
+        a->FullPath = newPrefix + a->FullPath.mid(oldPrefix.length());
+        if (a->DirectoryPath == QDir::cleanPath(oldRoot))
+            a->DirectoryPath = QDir::cleanPath(newRoot);
+        else if (a->DirectoryPath.startsWith(oldPrefix))
+            a->DirectoryPath = newPrefix + a->DirectoryPath.mid(oldPrefix.length());
+        setFacets(a);
+        replaceRow(row, existing, a);
+        astroFilesQueueMutex.lock();
+        updatedIdsQueue.insert(a->Id);
+        astroFilesQueueMutex.unlock();
+    }
+    locker.unlock();
+
+    if (!moved.isEmpty())
+        scheduleFlush();
+}
+
+QList<AstroFile> Catalog::moveCandidates(const FileRecord &record)
+{
+    QList<AstroFile> candidates;
+    const QDateTime lastModified = record.lastModified();
+
+    QReadLocker locker(&listLock);
+    if (getAstroFileByPath(record) != nullptr)
+        return candidates;
+    for (auto it = filesBySize.constFind(record.Size); it != filesBySize.constEnd() && it.key() == record.Size; ++it)
+    {
+        // Only files that were processed have what a move would keep
+        const AstroFile* a = it.value();
+        if (a->LastModifiedTime == lastModified && a->processStatus == AstroFileProcessed)
+            candidates.append(*a);
+    }
+    return candidates;
+}
+
+bool Catalog::moveAstroFile(const QString &oldPath, const FileRecord &record, const QString &volumeName, AstroFile &moved)
+{
+    const AstroFile target(record);
+
+    QWriteLocker locker(&listLock);
+    AstroFile* existing = getAstroFileByPath(oldPath);
+    if (existing == nullptr || getAstroFileByPath(record) != nullptr)
+        return false;
+    int row = rowOfId(existing->Id);
+    if (row == -1)
+        return false;
+
+    AstroFile* a = new AstroFile(*existing);
+    a->FullPath = target.FullPath;
+    a->DirectoryPath = target.DirectoryPath;
+    a->FileName = target.FileName;
+    a->FileExtension = target.FileExtension;
+    a->VolumeName = volumeName;
+    a->FileDevice = target.FileDevice;
+    a->FileInode = target.FileInode;
+    setFacets(a);
+    replaceRow(row, existing, a);
+    moved = *a;
+
+    astroFilesQueueMutex.lock();
+    updatedIdsQueue.insert(a->Id);
+    astroFilesQueueMutex.unlock();
+    locker.unlock();
+    scheduleFlush();
+    return true;
+}
+
+bool Catalog::aliasOf(const FileRecord &record, const QString &volumeName, AstroFile &alias, int &sourceId)
+{
+    if (!record.hasIdentity())
+        return false;
+    const QDateTime lastModified = record.lastModified();
+
+    // The candidates are copied, and their files stat'ed once listLock is released, the
+    // volume may be slow
+    QList<AstroFile> candidates;
+    {
+        QReadLocker locker(&listLock);
+        if (getAstroFileByPath(record) != nullptr)
+            return false;
+        for (auto it = filesByInode.constFind(record.Inode); it != filesByInode.constEnd() && it.key() == record.Inode; ++it)
+        {
+            // The size and time guard against an inode that was freed and given to another
+            // file since the row was written
+            const AstroFile* a = it.value();
+            if (a->FileDevice != record.Device || a->processStatus != AstroFileProcessed ||
+                a->FileSize != record.Size || a->LastModifiedTime != lastModified)
+                continue;
+            candidates.append(*a);
+            // The alias gets a tile of its own once it is added
+            candidates.last().tinyThumbnail = tinyThumbnails.tile(a->tinyThumbnailSlot).copy();
+        }
+    }
+
+    for (auto& candidate : candidates)
+    {
+        // A rename or a move on the same file system keeps the inode, and the row of the
+        // file is still at its old path until the crawl finds it gone. It is a move, the
+        // row keeps its id, see FileProcessFilter::rebindMovedFile.
+        if (!QFileInfo::exists(candidate.FullPath))
+            continue;
+
+        const AstroFile target(record);
+        alias = candidate;
+        alias.Id = 0;
+        alias.FullPath = target.FullPath;
+        alias.DirectoryPath = target.DirectoryPath;
+        alias.FileName = target.FileName;
+        alias.FileExtension = target.FileExtension;
+        alias.CreatedTime = target.CreatedTime;
+        alias.VolumeName = volumeName;
+        alias.tinyThumbnailSlot = -1;
+        sourceId = candidate.Id;
         return true;
+    }
+    return false;
+}
+
+bool Catalog::hasFile(const QString &path)
+{
+    QReadLocker locker(&listLock);
+    return getAstroFileByPath(path) != nullptr;
+}
+
+QImage Catalog::tinyThumbnail(const AstroFile &astroFile)
+{
+    QReadLocker locker(&listLock);
+    // The tile shares the atlas, which a writer may grow once the lock is released
+    return tinyThumbnails.tile(astroFile.tinyThumbnailSlot).copy();
+}
+
+qint64 Catalog::tinyThumbnailBytes()
+{
+    QReadLocker locker(&listLock);
+    return tinyThumbnails.bytes();
+}
+
+/*!
+ * \brief Catalog::dropTinyThumbnails
+ * The atlas is compacted afterwards, so the bytes are given back, and the rows
+ * moved to their new slots.
+ */
+qint64 Catalog::dropTinyThumbnails(qint64 bytes, const QSet<int> &keepIds)
+{
+    QWriteLocker locker(&listLock);
+    qint64 dropped = 0;
+    for (auto a : astroFiles)
+    {
+        if (dropped >= bytes)
+            break;
+        if (a->tinyThumbnailSlot == -1 || keepIds.contains(a->Id))
+            continue;
+        dropped += TinyThumbnailAtlas::tileBytes();
+        tinyThumbnails.remove(a->tinyThumbnailSlot);
+        a->tinyThumbnailSlot = -1;
+    }
+    if (dropped == 0)
+        return 0;
+
+    const QVector<int> newSlots = tinyThumbnails.compact();
+    for (auto a : astroFiles)
+    {
+        if (a->tinyThumbnailSlot != -1)
+            a->tinyThumbnailSlot = newSlots.value(a->tinyThumbnailSlot, -1);
+    }
+    tinyThumbnailsDropped = true;
+    return dropped;
+}
+
+bool Catalog::isInSearchFolders(const QString &path)
+{
+    QReadLocker locker(&searchFoldersLock);
+    return searchFolders.containsPrefixOf(path);
+}
+
+QStringList Catalog::getFilePathsInDirectory(const QString &directory)
+{
+    QStringList paths;
+    QString prefix = directory.endsWith('/') ? directory : directory + '/';
+
+    QReadLocker locker(&listLock);
+    // The path index is not in path order. Only the directories the watcher saw change
+    // are asked for, so one pass over the files is cheaper than keeping them in order.
+    for (auto a : astroFiles)
+    {
+        if (a->FullPath.startsWith(prefix) && a->FullPath.indexOf('/', prefix.length()) == -1)
+            paths.append(a->FullPath);
+    }
+    return paths;
+}
+
+QStringList Catalog::getFilePaths()
+{
+    QReadLocker locker(&listLock);
 
-    return (fileInfo.lastModified() > a->LastModifiedTime);
+    QStringList paths;
+    paths.reserve(astroFiles.count());
+    for (auto a : astroFiles)
+        paths.append(a->FullPath);
+    return paths;
 }
 
 int Catalog::getNumberOfItems()
 {
-    QMutexLocker locker(&listMutex);
+    QReadLocker locker(&listLock);
 
     return astroFiles.count();
 }
@@ -26,12 +26,28 @@
 #define CATALOG_H
 
 #include "astrofile.h"
+#include "calibrationindex.h"
+#include "catalogcolumns.h"
+#include "filerecord.h"
+#include "pathindex.h"
+#include "pathtrie.h"
+#include "perceptualhash.h"
+#include "rowhandles.h"
+#include "smartcollection.h"
+#include "tinythumbnailatlas.h"
 
 #include <QObject>
-#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
 #include <QRecursiveMutex>
+#include <QSet>
 #include <QTimer>
 
+#include <atomic>
+#include <climits>
+#include <functional>
+
 class Catalog : public QObject
 {
     Q_OBJECT
@@ -57,42 +73,162 @@ public:
 //     * while there is also a large number of requests for "addAstroFile"
 //     * coming from the db.
 //     */
-    bool shouldProcessFile(const QFileInfo& fileInfo);
+    bool shouldProcessFile(const FileRecord& record);
+    bool isInSearchFolders(const QString& path);
+    // The files that failed to process, which shouldProcessFile then accepts once
+    // even though they did not change
+    QVector<FileRecord> retryFailedFiles();
+    // The processed files of these paths, or up to limit of all of them, whose thumbnails
+    // were made by an older THUMBNAIL_VERSION. shouldProcessFile then accepts them once.
+    QVector<FileRecord> outdatedThumbnails(const QStringList& paths);
+    QVector<FileRecord> outdatedThumbnails(int limit);
+    // Thread safe. Moves the files under oldRoot to the same paths under newRoot, for a
+    // volume mounted somewhere else. A file already at its new path is left where it was.
+    void remapFolder(const QString& oldRoot, const QString& newRoot);
+    // Thread safe. The files the new file may have been moved or renamed from: they
+    // have its size and modification time. Empty when the catalog has the path already.
+    QList<AstroFile> moveCandidates(const FileRecord& record);
+    // Thread safe. Rebinds the row of oldPath to the file, which keeps its id, keywords
+    // and thumbnail. Returns false when oldPath is gone or the new path is taken.
+    bool moveAstroFile(const QString& oldPath, const FileRecord& record, const QString& volumeName, AstroFile& moved);
+    // Thread safe. When the file is a hard link of a processed file, the row of that file
+    // at the path of the link, without an id, and the id of the file in sourceId.
+    // Returns false when the catalog has the path already or no file with its identity.
+    bool aliasOf(const FileRecord& record, const QString& volumeName, AstroFile& alias, int& sourceId);
+    // Thread safe
+    bool hasFile(const QString& path);
+    // Thread safe. A copy of the tile of the row in the atlas, null if it has none.
+    QImage tinyThumbnail(const AstroFile& astroFile);
+    // Thread safe. The bytes of the tiny thumbnails of the rows.
+    qint64 tinyThumbnailBytes();
+    // Thread safe. Drops the tiny thumbnails of the rows not in keepIds, about bytes of
+    // them, the view then waits for the full thumbnail. Returns the bytes dropped.
+    qint64 dropTinyThumbnails(qint64 bytes, const QSet<int>& keepIds);
 
 
     int getNumberOfItems();
     int astroFileIndex(const AstroFile& astroFile); // Returns the 0-based row number of the object. -1 on failure
+    int astroFileIndex(int id);
+    // The AstroFiles handed out stay valid until the main thread is back in its event loop
     AstroFile* getAstroFile(int row);
+    // The handle follows the file when rows before it are removed, see RowHandles.
+    // 0 if there is no such row.
+    quint64 handleOfRow(int row);
+    // Lock free. nullptr if the file of the handle was removed.
+    const AstroFile* astroFileOfHandle(quint64 handle) const;
+    void readColumns(const std::function<void(const CatalogColumns&)>& reader);
+    QList<AstroFile> getAstroFiles();
+    QStringList getFilePathsInDirectory(const QString& directory); // Only the files directly in the directory
+    // Thread safe. The paths of every file, see CatalogReconciler
+    QStringList getFilePaths();
+    // Ids of the files with this FileHash, empty if there is only one
+    QVector<int> duplicatesOf(const QString& fileHash);
+    // Ids of every file that has a duplicate
+    QVector<int> allDuplicates();
+    // Ids of the files whose perceptual hash is at most radius bits from the one of the file, itself included
+    QVector<int> nearDuplicatesOf(int id, int radius);
+    // Ids of the darks, flats and bias frames for these light frames, see CalibrationIndex::matching
+    QVector<int> matchingCalibration(const QVector<int>& lightIds, int days, double temperatureTolerance);
+    // Thread safe. Adds the collection, or replaces the one of the same name, and finds
+    // its files. Its members then follow the rows, see SmartCollectionIndex.
+    void setSmartCollection(const SmartCollection& collection);
+    void removeSmartCollection(const QString& name);
+    // Thread safe. The ids of the files of the collection
+    QVector<int> smartCollectionMembers(const QString& name);
+    // Thread safe. The name and the number of files of each collection
+    QList<QPair<QString, int>> smartCollectionCounts();
+    // Called by the GUI with the time it took to handle a notification, to pace the next ones
+    void reportNotificationCost(qint64 msecs);
 
 public slots:
     void addAstroFile(const AstroFile& astroFile);
     void addAstroFiles(const QList<AstroFile>& files);
+    void finishAddingAstroFiles();
 
     void deleteAstroFile(const AstroFile& astroFile);
     void deleteAstroFiles(const QList<AstroFile>& files);
     void deleteAstroFileRow(int row);
+    void updateFileHashes(const QList<AstroFile>& files);
+    void updatePerceptualHashes(const QList<AstroFile>& files);
+    void updateIntegrity(const QList<AstroFile>& files);
+    void updateSolutions(const QList<AstroFile>& files);
+
+    // Before the rows that have their tiny thumbnails in it, when the catalog is empty
+    void setTinyThumbnails(const TinyThumbnailAtlas& atlas);
+    void writeSnapshot(const QString& path, int schemaVersion, qint64 catalogId, qint64 changeCounter);
 
 signals:
 //    void AstroFileAdded(AstroFile astroFile, int row);
     void AstroFilesAdded(int numberAdded);
-    void AstroFileUpdated(AstroFile astroFile, int row);
+    void AstroFilesUpdated(int firstRow, int lastRow);
     void AstroFileRemoved(AstroFile astroFile, int row);
     void DoneAddingAstrofiles();
+    // A collection was set or removed
+    void smartCollectionsChanged();
 
 private:
-    QRecursiveMutex listMutex;
-    QRecursiveMutex searchFoldersMutex;
+    // GUI reads (getAstroFile) and the processing workers (shouldProcessFile) only
+    // take read locks, so they run concurrently and only wait for actual writes.
+    QReadWriteLock listLock;
+    QReadWriteLock searchFoldersLock;
 
-    QList<QString> searchFolders;
+    PathTrie searchFolders;
     QList<AstroFile*> astroFiles;
-    QMap<QString, AstroFile*> filePathToIdMap;
-
-    AstroFile* getAstroFileByPath(QString path);
+    CatalogColumns columns; // Row for row with astroFiles
+    PathIndex pathIndex;
+    RowHandles rowHandles;
+    QHash<int, int> idToRowMap;
+    int firstStaleRow = INT_MAX;
+    TinyThumbnailAtlas tinyThumbnails; // Of the rows, by AstroFile::tinyThumbnailSlot
+    QSet<QString> retryPaths; // Of retryFailedFiles and outdatedThumbnails, until the file is written again
+
+    void setFacets(AstroFile* astroFile);
+    int storeTinyThumbnail(const AstroFile& astroFile);
+    bool takeOutdatedThumbnail(const AstroFile* astroFile, QStringList& paths);
+    void addToDuplicateGroup(const AstroFile* astroFile);
+    void removeFromDuplicateGroup(const AstroFile* astroFile);
+    void addToSizeIndex(AstroFile* astroFile);
+    void removeFromSizeIndex(AstroFile* astroFile);
+    void addToIdentityIndex(AstroFile* astroFile);
+    void removeFromIdentityIndex(AstroFile* astroFile);
+
+    AstroFile* getAstroFileByPath(const QString& path);
+    AstroFile* getAstroFileByPath(const FileRecord& record); // Without hashing the path again
+    int rowOfId(int id);
+    void removeRow(int row);
+    void replaceRow(int row, AstroFile* existing, AstroFile* astroFile);
+    void reindexStaleRows();
     void impAddAstroFile(const AstroFile& astroFile, bool shouldEmit = true);
+    // Additions and updates are sent together, at an interval that follows how long
+    // the GUI took to handle the previous ones. The timer only runs while they wait.
     QTimer timer;
     void pushProcessedQueue();
+    void scheduleFlush();
     QRecursiveMutex astroFilesQueueMutex;
     int astroFilesQueue;
+    QSet<int> updatedIdsQueue;
+    std::atomic<qint64> notificationCostMsecs {0};
+
+    // Ids of the files by FileHash, kept up to date as rows are added, changed and removed
+    QHash<QString, QVector<int>> duplicateGroups;
+    // The files by FileSize, for moveCandidates. Rows without a size are not in it.
+    QMultiHash<qint64, AstroFile*> filesBySize;
+    // The files by FileInode, for aliasOf. Rows without an identity are not in it.
+    QMultiHash<quint64, AstroFile*> filesByInode;
+    // Kept up to date the same way
+    CalibrationIndex calibrationFrames;
+    SmartCollectionIndex smartCollections;
+    void refreshSmartCollections();
+
+    // Built again by nearDuplicatesOf when files were added or changed since.
+    // Removed files are left in it, and skipped by the search.
+    QMutex perceptualHashesMutex;
+    PerceptualHashIndex perceptualHashes;
+    QHash<int, quint64> perceptualHashOfId;
+    std::atomic<bool> perceptualHashesStale {true};
+    // The snapshot is not written once tiny thumbnails were dropped, so the next
+    // start loads them from the db
+    std::atomic<bool> tinyThumbnailsDropped {false};
     volatile bool cancelSignaled = false;
 };
 
@@ -0,0 +1,228 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "catalogclient.h"
+#include "metrics.h"
+
+#include <QDebug>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSettings>
+#include <QTimer>
+#include <QUrlQuery>
+
+// The files of a page of the full sync
+#define CLIENT_PAGE_SIZE 200
+// For the answers that are not held by the server
+#define CLIENT_REQUEST_TIMEOUT 30000
+// How long the server holds a /changes request without changes
+#define CLIENT_CHANGES_WAIT 25000
+// Before the server is asked again after it could not be reached
+#define CLIENT_RETRY_INTERVAL 10000
+
+CatalogClient::CatalogClient(FileRepository *fileRepository, QObject *parent) : QObject(parent), repository(fileRepository)
+{
+    network = new QNetworkAccessManager(this);
+}
+
+void CatalogClient::start(const QUrl &serverUrl, const QString &accessToken, int level)
+{
+    url = serverUrl;
+    token = accessToken;
+    thumbnailLevel = qBound(0, level, THUMBNAIL_LEVEL_COUNT - 1);
+    requestInfo();
+}
+
+QNetworkReply *CatalogClient::get(const QString &path, const QList<QPair<QString, QString>> &queryItems, int timeout)
+{
+    QUrl requestUrl(url);
+    requestUrl.setPath(path);
+    QUrlQuery query;
+    query.setQueryItems(queryItems);
+    requestUrl.setQuery(query);
+    QNetworkRequest request(requestUrl);
+    request.setTransferTimeout(timeout);
+    if (!token.isEmpty())
+        request.setRawHeader("Authorization", "Bearer " + token.toUtf8());
+    return network->get(request);
+}
+
+/*!
+ * \brief CatalogClient::requestInfo
+ * Follows the changes from where the last sync stopped, when the server and the
+ * replica are the ones it was made of. Reads the whole catalog again otherwise.
+ */
+void CatalogClient::requestInfo()
+{
+    QNetworkReply* reply = get("/catalog", {}, CLIENT_REQUEST_TIMEOUT);
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        reply->deleteLater();
+        CatalogInfo info;
+        if (reply->error() != QNetworkReply::NoError || !CatalogProtocol::decodeInfo(reply->readAll(), info))
+        {
+            retry(reply->errorString());
+            return;
+        }
+        if (info.protocolVersion != CATALOG_PROTOCOL_VERSION)
+        {
+            qWarning() << "The catalog server speaks version" << info.protocolVersion << "of the protocol instead of" << CATALOG_PROTOCOL_VERSION;
+            return;
+        }
+
+        QSettings settings;
+        settings.beginGroup("CatalogServer");
+        serverCatalogId = info.catalogId;
+        if (settings.value("ServerCatalogId").toLongLong() == info.catalogId && settings.value("ReplicaCatalogId").toLongLong() == repository->catalogId())
+        {
+            changeSeq = settings.value("ChangeSeq").toLongLong();
+            requestChanges();
+            return;
+        }
+
+        qDebug() << "Reading the catalog of" << url.toDisplayString();
+        // The changes made while the pages are read are followed after them
+        changeSeq = info.lastSeq;
+        syncedPaths.clear();
+        requestFiles(0);
+    });
+}
+
+void CatalogClient::requestFiles(int afterId)
+{
+    QNetworkReply* reply = get("/files", {{"after", QString::number(afterId)}, {"limit", QString::number(CLIENT_PAGE_SIZE)}, {"level", QString::number(thumbnailLevel)}}, CLIENT_REQUEST_TIMEOUT);
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        reply->deleteLater();
+        QList<ServedFile> files;
+        if (reply->error() != QNetworkReply::NoError || !CatalogProtocol::decodeFiles(reply->readAll(), files))
+        {
+            retry(reply->errorString());
+            return;
+        }
+        writeFiles(files);
+        for (auto& file : files)
+            syncedPaths.insert(file.astroFile.FullPath);
+        if (files.count() < CLIENT_PAGE_SIZE)
+            finishFullSync();
+        else
+            requestFiles(files.last().astroFile.Id);
+    });
+}
+
+/*!
+ * \brief CatalogClient::finishFullSync
+ * Deletes the files the server no longer has, and follows the changes from the seq
+ * the pages were read at.
+ */
+void CatalogClient::finishFullSync()
+{
+    QStringList deleted;
+    for (auto& fullPath : FileRepository::filePaths())
+    {
+        if (!syncedPaths.contains(fullPath))
+            deleted.append(fullPath);
+    }
+    syncedPaths.clear();
+    if (!deleted.isEmpty())
+        repository->deleteAstrofiles(deleted);
+
+    QSettings settings;
+    settings.beginGroup("CatalogServer");
+    settings.setValue("ServerCatalogId", serverCatalogId);
+    settings.setValue("ReplicaCatalogId", repository->catalogId());
+    saveChangeSeq(changeSeq);
+    requestChanges();
+}
+
+void CatalogClient::requestChanges()
+{
+    QNetworkReply* reply = get("/changes", {{"since", QString::number(changeSeq)}, {"level", QString::number(thumbnailLevel)}, {"wait", QString::number(CLIENT_CHANGES_WAIT)}},
+                               CLIENT_CHANGES_WAIT + CLIENT_REQUEST_TIMEOUT);
+    connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+        reply->deleteLater();
+        CatalogDelta delta;
+        if (reply->error() != QNetworkReply::NoError || !CatalogProtocol::decodeDelta(reply->readAll(), delta))
+        {
+            retry(reply->errorString());
+            return;
+        }
+        // The log was pruned past the last sync, or the server has another catalog
+        if (!delta.isComplete || delta.catalogId != serverCatalogId)
+        {
+            QSettings().remove("CatalogServer/ServerCatalogId");
+            requestInfo();
+            return;
+        }
+
+        static std::atomic<qint64>& changedCount = Metrics::counter("catalog_client.files_changed");
+        changedCount += delta.files.count() + delta.deletedPaths.count();
+        writeFiles(delta.files);
+        if (!delta.deletedPaths.isEmpty())
+            repository->deleteAstrofiles(delta.deletedPaths);
+        saveChangeSeq(delta.lastSeq);
+        requestChanges();
+    });
+}
+
+/*!
+ * \brief CatalogClient::writeFiles
+ * Writes the files with their thumbnails, decoded, as the indexer writes the files it
+ * processed. Their ids are the ones of the replica, and the device and inode of the
+ * server mean nothing here.
+ */
+void CatalogClient::writeFiles(const QList<ServedFile> &files)
+{
+    if (files.isEmpty())
+        return;
+
+    QList<AstroFile> astroFiles;
+    astroFiles.reserve(files.count());
+    for (auto& file : files)
+    {
+        AstroFile astroFile(file.astroFile);
+        astroFile.Id = 0;
+        astroFile.FileDevice = 0;
+        astroFile.FileInode = 0;
+        astroFile.tinyThumbnail = ThumbnailCodec::decode(file.tinyThumbnail, file.tinyThumbnailFormat);
+        astroFile.thumbnail = ThumbnailCodec::decode(file.thumbnail, file.thumbnailFormat);
+        astroFile.thumbnailLevel = thumbnailLevel;
+        if (astroFile.thumbnailStatus == ThumbnailLoaded && astroFile.thumbnail.isNull() && astroFile.tinyThumbnail.isNull())
+            astroFile.thumbnailStatus = ThumbnailNotProcessedYet;
+        astroFiles.append(astroFile);
+    }
+    repository->addOrUpdateAstrofiles(astroFiles);
+}
+
+void CatalogClient::saveChangeSeq(qint64 seq)
+{
+    changeSeq = seq;
+    QSettings().setValue("CatalogServer/ChangeSeq", seq);
+}
+
+void CatalogClient::retry(const QString &error)
+{
+    qWarning() << "Could not sync with the catalog server" << url.toDisplayString() << ":" << error;
+    syncedPaths.clear();
+    QTimer::singleShot(CLIENT_RETRY_INTERVAL, this, &CatalogClient::requestInfo);
+}
@@ -0,0 +1,81 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef CATALOGCLIENT_H
+#define CATALOGCLIENT_H
+
+#include "catalogprotocol.h"
+#include "filerepository.h"
+
+#include <QObject>
+#include <QSet>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+/*!
+ * \brief The CatalogClient class
+ * Keeps the db of the app a replica of the catalog of a CatalogServer, see
+ * FileRepository::ReplicaAccess. The first sync reads the catalog a page at a time,
+ * the later ones follow its change log from where the last one stopped, so a restart
+ * only reads what changed since. The catalog is written like the indexer writes it,
+ * so the view follows the replica as it follows an ingest.
+ *
+ * Lives on the repository thread.
+ */
+class CatalogClient : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CatalogClient(FileRepository* fileRepository, QObject *parent = nullptr);
+
+public slots:
+    // level is the level of the thumbnails kept, see thumbnailLevelSizes
+    void start(const QUrl& serverUrl, const QString& accessToken, int level);
+
+private slots:
+    void requestInfo();
+
+private:
+    QNetworkReply* get(const QString& path, const QList<QPair<QString, QString>>& queryItems, int timeout);
+    void requestFiles(int afterId);
+    void requestChanges();
+    void writeFiles(const QList<ServedFile>& files);
+    void finishFullSync();
+    void saveChangeSeq(qint64 seq);
+    void retry(const QString& error);
+
+    FileRepository* repository;
+    QNetworkAccessManager* network;
+    QUrl url;
+    QString token;
+    int thumbnailLevel = 0;
+    qint64 serverCatalogId = 0;
+    qint64 changeSeq = 0;
+    // The paths the full sync was sent, the others are deleted once it is done
+    QSet<QString> syncedPaths;
+};
+
+#endif // CATALOGCLIENT_H
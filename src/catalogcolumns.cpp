@@ -0,0 +1,215 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#include "catalogcolumns.h"
+#include "calibrationindex.h"
+#include "integrityverifier.h"
+#include "skycoordinates.h"
+
+#include <cmath>
+#include <limits>
+
+static const double missingKey = std::numeric_limits<double>::quiet_NaN();
+
+void CatalogColumns::append(const AstroFile &astroFile)
+{
+    const int row = count();
+    ids.append(0);
+    for (auto& facet : facets)
+        facet.append(0);
+    observationNights.append(0);
+    statuses.append(RowStatus());
+    observationTimes.append(missingKey);
+    exposureTimes.append(missingKey);
+    temperatures.append(missingKey);
+    ras.append(missingKey);
+    decs.append(missingKey);
+    starCounts.append(missingKey);
+    fwhms.append(missingKey);
+    fileSizes.append(0);
+    set(row, astroFile);
+}
+
+void CatalogColumns::replace(int row, const AstroFile &astroFile)
+{
+    if (row >= 0 && row < count())
+        set(row, astroFile);
+}
+
+void CatalogColumns::remove(int row)
+{
+    if (row < 0 || row >= count())
+        return;
+
+    removeFromCoverage(row);
+    ids.removeAt(row);
+    for (auto& facet : facets)
+        facet.removeAt(row);
+    observationNights.removeAt(row);
+    statuses.removeAt(row);
+    observationTimes.removeAt(row);
+    exposureTimes.removeAt(row);
+    fileSizes.removeAt(row);
+    temperatures.removeAt(row);
+    ras.removeAt(row);
+    decs.removeAt(row);
+    starCounts.removeAt(row);
+    fwhms.removeAt(row);
+}
+
+template<typename T>
+static void removeRows(QVector<T>& column, const QBitArray& rows)
+{
+    int kept = 0;
+    for (int row = 0; row < column.count(); row++)
+    {
+        if (row < rows.size() && rows.testBit(row))
+            continue;
+        column[kept++] = column.at(row);
+    }
+    column.resize(kept);
+}
+
+void CatalogColumns::remove(const QBitArray &rows)
+{
+    for (int row = 0; row < qMin(qsizetype(count()), rows.size()); row++)
+    {
+        if (rows.testBit(row))
+            removeFromCoverage(row);
+    }
+    removeRows(ids, rows);
+    for (auto& facet : facets)
+        removeRows(facet, rows);
+    removeRows(observationNights, rows);
+    removeRows(statuses, rows);
+    removeRows(observationTimes, rows);
+    removeRows(exposureTimes, rows);
+    removeRows(fileSizes, rows);
+    removeRows(temperatures, rows);
+    removeRows(ras, rows);
+    removeRows(decs, rows);
+    removeRows(starCounts, rows);
+    removeRows(fwhms, rows);
+}
+
+double CatalogColumns::sortValue(SortKey key, int row) const
+{
+    switch (key)
+    {
+    case ObservationTimeKey:
+        return observationTimes.at(row);
+    case ExposureTimeKey:
+        return exposureTimes.at(row);
+    case TemperatureKey:
+        return temperatures.at(row);
+    case StarCountKey:
+        return starCounts.at(row);
+    case FwhmKey:
+        return fwhms.at(row);
+    case ObjectKey:
+    case NoSortKey:
+        break;
+    }
+    return missingKey;
+}
+
+const QVector<double> &CatalogColumns::numberColumn(NumberColumn column) const
+{
+    switch (column)
+    {
+    case ExposureTimeColumn:
+        return exposureTimes;
+    case TemperatureColumn:
+        return temperatures;
+    case RaColumn:
+        return ras;
+    case DecColumn:
+        return decs;
+    case StarCountColumn:
+        return starCounts;
+    case FwhmColumn:
+        return fwhms;
+    case ObservationTimeColumn:
+    case NumberColumnCount:
+        break;
+    }
+    return observationTimes;
+}
+
+int CatalogColumns::valueId(const QString &value)
+{
+    auto iter = valueIds.constFind(value);
+    if (iter != valueIds.constEnd())
+        return iter.value();
+
+    const int id = values.count();
+    values.append(value);
+    valueIds.insert(value, id);
+    return id;
+}
+
+void CatalogColumns::removeFromCoverage(int row)
+{
+    coverage.remove(ras.at(row), decs.at(row), facets[FilterFacet].at(row), exposureTimes.at(row));
+}
+
+void CatalogColumns::set(int row, const AstroFile &astroFile)
+{
+    // The row is added to the coverage again with its new values. New rows have no position yet.
+    removeFromCoverage(row);
+    ids[row] = astroFile.Id;
+    facets[ObjectFacet][row] = valueId(astroFile.Object);
+    facets[InstrumentFacet][row] = valueId(astroFile.Instrument);
+    facets[FilterFacet][row] = valueId(astroFile.Filter);
+    facets[ExtensionFacet][row] = valueId(astroFile.FileExtension);
+    facets[FolderFacet][row] = valueId(astroFile.DirectoryPath);
+    facets[FrameTypeFacet][row] = valueId(CalibrationIndex::frameTypeName(CalibrationIndex::frameType(astroFile)));
+    facets[IntegrityFacet][row] = valueId(IntegrityVerifier::integrityName(astroFile.Integrity));
+    observationNights[row] = astroFile.ObservationNight.toJulianDay();
+    observationTimes[row] = astroFile.ObservationTime != ObservingNight::missingTime ? double(astroFile.ObservationTime) : missingKey;
+    bool ok = false;
+    double exposureTime = astroFile.Tags.value(TagExposureTime).toDouble(&ok);
+    exposureTimes[row] = ok ? exposureTime : missingKey;
+    fileSizes[row] = astroFile.FileSize;
+    double temperature = astroFile.Tags.value(TagCcdTemp).toDouble(&ok);
+    temperatures[row] = ok ? temperature : missingKey;
+
+    double ra;
+    double dec;
+    const bool hasPosition = SkyCoordinates::parseRa(astroFile.Tags.value(TagObjectRa), ra) && SkyCoordinates::parseDec(astroFile.Tags.value(TagObjectDec), dec);
+    // Frames without OBJCTRA and OBJCTDEC are at their plate solution, if they have one
+    const PlateSolution& solution = astroFile.Solution;
+    ras[row] = hasPosition ? ra : solution.isSolved() ? solution.ra : missingKey;
+    decs[row] = hasPosition ? dec : solution.isSolved() ? solution.dec : missingKey;
+    coverage.add(ras.at(row), decs.at(row), facets[FilterFacet].at(row), exposureTimes.at(row));
+
+    const FrameQuality& quality = astroFile.Quality;
+    starCounts[row] = quality.isMeasured() ? quality.starCount : missingKey;
+    fwhms[row] = quality.isMeasured() && !std::isnan(quality.fwhm) ? quality.fwhm : missingKey;
+
+    RowStatus& status = statuses[row];
+    status.thumbnailStatus = astroFile.thumbnailStatus;
+    status.tagStatus = astroFile.tagStatus;
+    status.processStatus = astroFile.processStatus;
+    status.isHidden = astroFile.IsHidden;
+}
@@ -0,0 +1,181 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#ifndef CATALOGCOLUMNS_H
+#define CATALOGCOLUMNS_H
+
+#include "astrofile.h"
+#include "skycoverage.h"
+
+#include <QBitArray>
+#include <QDate>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+/*!
+ * \brief The CatalogColumns class
+ * The fields of the catalog rows that are filtered on, stored column by column in
+ * contiguous arrays, so a scan of all the rows only touches the columns it reads
+ * instead of every AstroFile.
+ *
+ * Facet values are stored as ids into one table of distinct values, shared by all
+ * the facets, so rows with the same value have the same id.
+ *
+ * Rows are in the order of the Catalog rows, which keeps them in sync.
+ */
+class CatalogColumns
+{
+public:
+    enum Facet
+    {
+        ObjectFacet,
+        InstrumentFacet,
+        FilterFacet,
+        ExtensionFacet,
+        FolderFacet,
+        FrameTypeFacet,
+        IntegrityFacet,
+        FacetCount
+    };
+
+    // Keys the rows can be sorted by, see SortKeys
+    enum SortKey
+    {
+        NoSortKey,
+        ObservationTimeKey,
+        ObjectKey,
+        ExposureTimeKey,
+        TemperatureKey,
+        StarCountKey,
+        FwhmKey
+    };
+
+    // The number columns handed out whole, see numberColumn
+    enum NumberColumn
+    {
+        ObservationTimeColumn,
+        ExposureTimeColumn,
+        TemperatureColumn,
+        RaColumn,
+        DecColumn,
+        StarCountColumn,
+        FwhmColumn,
+        NumberColumnCount
+    };
+
+    struct RowStatus
+    {
+        quint8 thumbnailStatus;
+        quint8 tagStatus;
+        quint8 processStatus;
+        quint8 isHidden;
+    };
+
+    /*!
+     * \brief The RowView class
+     * One row of the columns. Only valid while the columns are not changed.
+     */
+    class RowView
+    {
+    public:
+        RowView(const CatalogColumns* columns, int row) : columns(columns), row(row) {}
+        int id() const { return columns->ids.at(row); }
+        int facetId(Facet facet) const { return columns->facets[facet].at(row); }
+        const QString& facetValue(Facet facet) const { return columns->values.at(facetId(facet)); }
+        // Julian day of the observing night, see ObservingNight
+        qint64 observationNight() const { return columns->observationNights.at(row); }
+        // NaN without a valid value, milliseconds since the epoch and seconds
+        double observationTime() const { return columns->observationTimes.at(row); }
+        double exposureTime() const { return columns->exposureTimes.at(row); }
+        // Bytes, 0 for rows written before it was kept
+        qint64 fileSize() const { return columns->fileSizes.at(row); }
+        // Degrees, NaN without a valid OBJCTRA and OBJCTDEC
+        double ra() const { return columns->ras.at(row); }
+        double dec() const { return columns->decs.at(row); }
+        // NaN until the frame is measured, see FrameQuality
+        double starCount() const { return columns->starCounts.at(row); }
+        double fwhm() const { return columns->fwhms.at(row); }
+        RowStatus status() const { return columns->statuses.at(row); }
+
+    private:
+        const CatalogColumns* columns;
+        int row;
+    };
+
+    int count() const { return ids.count(); }
+    RowView row(int row) const { return RowView(this, row); }
+    int valueCount() const { return values.count(); }
+    const QString& value(int id) const { return values.at(id); }
+
+    // Whole columns, for readers that hand them out without copying the rows, see the
+    // Python module. A copy shares the data until the columns are changed.
+    const QVector<int>& idColumn() const { return ids; }
+    const QVector<int>& facetColumn(Facet facet) const { return facets[facet]; }
+    const QVector<qint64>& observationNightColumn() const { return observationNights; }
+    const QVector<qint64>& fileSizeColumn() const { return fileSizes; }
+    const QVector<double>& numberColumn(NumberColumn column) const;
+    const QStringList& valueList() const { return values; }
+    // Of the rows with a position, by the FilterFacet and exposure time of the rows
+    const SkyCoverage& skyCoverage() const { return coverage; }
+
+    void append(const AstroFile& astroFile);
+    void replace(int row, const AstroFile& astroFile);
+    void remove(int row);
+    // Removes the rows whose bit is set, in one pass
+    void remove(const QBitArray& rows);
+
+    // The number a row sorts on, NaN without a value. Objects sort on their collated names and have none.
+    double sortValue(SortKey key, int row) const;
+
+private:
+    QVector<int> ids;
+    QVector<int> facets[FacetCount];
+    QVector<qint64> observationNights; // Julian days, the smallest qint64 without a valid DATE-OBS
+    QVector<RowStatus> statuses;
+
+    // Sort keys, parsed once per row. NaN when the row has no value.
+    QVector<double> observationTimes; // Milliseconds since the epoch of DATE-OBS
+    QVector<double> exposureTimes;
+    QVector<qint64> fileSizes;
+    QVector<double> temperatures;
+
+    // Parsed from OBJCTRA and OBJCTDEC, see SkyCoordinates
+    QVector<double> ras;
+    QVector<double> decs;
+
+    // From the FrameQuality, for culling
+    QVector<double> starCounts;
+    QVector<double> fwhms;
+
+    QStringList values;
+    QHash<QString, int> valueIds;
+
+    SkyCoverage coverage;
+
+    int valueId(const QString& value);
+    void set(int row, const AstroFile& astroFile);
+    void removeFromCoverage(int row);
+};
+
+#endif // CATALOGCOLUMNS_H
@@ -0,0 +1,143 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "catalogprotocol.h"
+
+#include <QDataStream>
+#include <QMap>
+
+static void writeFiles(QDataStream& out, const QList<ServedFile>& files)
+{
+    out << qint32(files.count());
+    for (auto& file : files)
+    {
+        const AstroFile& astroFile = file.astroFile;
+        const FrameQuality& quality = astroFile.Quality;
+        out << qint32(astroFile.Id) << astroFile.FileName << astroFile.FullPath << astroFile.DirectoryPath << astroFile.VolumeName
+            << qint32(astroFile.FileType) << astroFile.FileExtension << astroFile.CreatedTime << astroFile.LastModifiedTime
+            << astroFile.FileSize << astroFile.FileHash << astroFile.ImageHash << astroFile.QuickHash << astroFile.PerceptualHash
+            << astroFile.Placeholder.toByteArray() << astroFile.StretchParameters
+            << quality.background << quality.noise << qint32(quality.starCount) << quality.fwhm << quality.eccentricity
+            << astroFile.Tags.toMap()
+            << qint32(astroFile.thumbnailStatus) << qint32(astroFile.tagStatus) << qint32(astroFile.processStatus)
+            << qint32(astroFile.FailureReason) << qint32(astroFile.ThumbnailVersion) << astroFile.IsHidden
+            << file.tinyThumbnail << qint32(file.tinyThumbnailFormat) << file.thumbnail << qint32(file.thumbnailFormat);
+    }
+}
+
+static bool readFiles(QDataStream& in, QList<ServedFile>& files)
+{
+    qint32 count = 0;
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        ServedFile file;
+        AstroFile& astroFile = file.astroFile;
+        FrameQuality& quality = astroFile.Quality;
+        qint32 id = 0;
+        qint32 fileType = 0;
+        QByteArray placeholder;
+        qint32 starCount = -1;
+        QMap<QString, QString> tags;
+        qint32 thumbnailStatus = 0;
+        qint32 tagStatus = 0;
+        qint32 processStatus = 0;
+        qint32 failureReason = 0;
+        qint32 thumbnailVersion = 0;
+        qint32 tinyThumbnailFormat = 0;
+        qint32 thumbnailFormat = 0;
+        in >> id >> astroFile.FileName >> astroFile.FullPath >> astroFile.DirectoryPath >> astroFile.VolumeName
+           >> fileType >> astroFile.FileExtension >> astroFile.CreatedTime >> astroFile.LastModifiedTime
+           >> astroFile.FileSize >> astroFile.FileHash >> astroFile.ImageHash >> astroFile.QuickHash >> astroFile.PerceptualHash
+           >> placeholder >> astroFile.StretchParameters
+           >> quality.background >> quality.noise >> starCount >> quality.fwhm >> quality.eccentricity
+           >> tags
+           >> thumbnailStatus >> tagStatus >> processStatus
+           >> failureReason >> thumbnailVersion >> astroFile.IsHidden
+           >> file.tinyThumbnail >> tinyThumbnailFormat >> file.thumbnail >> thumbnailFormat;
+        astroFile.Id = id;
+        astroFile.FileType = AstroFileType(fileType);
+        astroFile.Placeholder = PlaceholderHash::fromByteArray(placeholder);
+        quality.starCount = starCount;
+        astroFile.Tags = TagMap(tags);
+        astroFile.thumbnailStatus = ThumbnailLoadStatus(thumbnailStatus);
+        astroFile.tagStatus = TagExtractStatus(tagStatus);
+        astroFile.processStatus = AstroFileProcessStatus(processStatus);
+        astroFile.FailureReason = AstroFileFailureReason(failureReason);
+        astroFile.ThumbnailVersion = thumbnailVersion;
+        file.tinyThumbnailFormat = ThumbnailFormat(tinyThumbnailFormat);
+        file.thumbnailFormat = ThumbnailFormat(thumbnailFormat);
+        files.append(file);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+QByteArray CatalogProtocol::encodeInfo(const CatalogInfo &info)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << info.protocolVersion << info.catalogId << info.lastSeq;
+    return data;
+}
+
+bool CatalogProtocol::decodeInfo(const QByteArray &data, CatalogInfo &info)
+{
+    QDataStream in(data);
+    in >> info.protocolVersion >> info.catalogId >> info.lastSeq;
+    return in.status() == QDataStream::Ok;
+}
+
+QByteArray CatalogProtocol::encodeFiles(const QList<ServedFile> &files)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    writeFiles(out, files);
+    return data;
+}
+
+bool CatalogProtocol::decodeFiles(const QByteArray &data, QList<ServedFile> &files)
+{
+    QDataStream in(data);
+    return readFiles(in, files);
+}
+
+QByteArray CatalogProtocol::encodeDelta(const CatalogDelta &delta)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << delta.catalogId << delta.lastSeq << delta.isComplete;
+    writeFiles(out, delta.files);
+    out << delta.deletedPaths;
+    return data;
+}
+
+bool CatalogProtocol::decodeDelta(const QByteArray &data, CatalogDelta &delta)
+{
+    QDataStream in(data);
+    in >> delta.catalogId >> delta.lastSeq >> delta.isComplete;
+    if (!readFiles(in, delta.files))
+        return false;
+    in >> delta.deletedPaths;
+    return in.status() == QDataStream::Ok;
+}
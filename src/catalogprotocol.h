@@ -0,0 +1,72 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef CATALOGPROTOCOL_H
+#define CATALOGPROTOCOL_H
+
+#include "servedfile.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
+
+// Of the encoding below. The CatalogClient does not sync from a server of another version.
+#define CATALOG_PROTOCOL_VERSION 1
+
+// The answer to /catalog
+struct CatalogInfo
+{
+    qint32 protocolVersion = CATALOG_PROTOCOL_VERSION;
+    qint64 catalogId = 0;
+    qint64 lastSeq = 0; // Of the change log when it was asked, the changes are followed from it
+};
+
+// The answer to /changes
+struct CatalogDelta
+{
+    qint64 catalogId = 0;
+    qint64 lastSeq = 0; // To ask from next time
+    bool isComplete = true; // False when the log was pruned past the seq asked from, every file is read again
+    QList<ServedFile> files; // Added or updated since
+    QStringList deletedPaths; // Deleted since, or in a folder that was detached
+};
+
+/*!
+ * \brief The CatalogProtocol class
+ * The binary encoding of the answers of the CatalogServer, a QDataStream of the fields.
+ * The keywords of a file are a map and its thumbnails the bytes the server stored,
+ * with their ThumbnailFormat, so they are decoded once, by the client.
+ */
+class CatalogProtocol
+{
+public:
+    static QByteArray encodeInfo(const CatalogInfo& info);
+    static bool decodeInfo(const QByteArray& data, CatalogInfo& info);
+    static QByteArray encodeFiles(const QList<ServedFile>& files);
+    static bool decodeFiles(const QByteArray& data, QList<ServedFile>& files);
+    static QByteArray encodeDelta(const CatalogDelta& delta);
+    static bool decodeDelta(const QByteArray& data, CatalogDelta& delta);
+};
+
+#endif // CATALOGPROTOCOL_H
@@ -0,0 +1,120 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "catalogreconciler.h"
+#include "directorywalker.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "pathtrie.h"
+#include "volumeio.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QStorageInfo>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+// Directories listed at the same time on a local disk, and on a network drive
+#define RECONCILE_LOCAL_CONCURRENCY     4
+#define RECONCILE_NETWORK_CONCURRENCY   1
+
+/*!
+ * \brief CatalogReconciler::missingFiles
+ * Groups the paths under each search folder that is there by their directory and
+ * lists the directories of a folder in parallel, as many at a time as its volume
+ * takes. Stops with what it found so far when the token is canceled.
+ */
+QStringList CatalogReconciler::missingFiles(const QStringList &paths, const QStringList &folders, const CancellationToken &token)
+{
+    static LatencyHistogram& reconcileLatency = Metrics::histogram("reconcile.latency");
+    ScopedLatency latency(reconcileLatency);
+
+    QStringList missing;
+    QMutex missingMutex;
+    int listedDirectories = 0;
+
+    for (auto& folder : folders)
+    {
+        const QString root = QDir::cleanPath(folder);
+        if (ObjectStore::isObjectPath(root) || !QFileInfo(root).isDir() || QDir(root).isEmpty())
+            continue;
+
+        PathTrie trie;
+        trie.insert(root);
+        QHash<QString, QStringList> pathsByDirectory;
+        for (auto& path : paths)
+        {
+            if (trie.containsPrefixOf(path))
+                pathsByDirectory[path.left(path.lastIndexOf('/'))].append(path);
+        }
+        if (pathsByDirectory.isEmpty())
+            continue;
+
+        const QList<QString> directories = pathsByDirectory.keys();
+        QThreadPool pool;
+        pool.setMaxThreadCount(VolumeIo::isNetworkFileSystem(QStorageInfo(root)) ? RECONCILE_NETWORK_CONCURRENCY : RECONCILE_LOCAL_CONCURRENCY);
+        QtConcurrent::blockingMap(&pool, directories, [&](const QString& directory) {
+            if (token.isCanceled())
+                return;
+            const QStringList gone = missingInDirectory(directory, pathsByDirectory.value(directory));
+            QMutexLocker locker(&missingMutex);
+            missing.append(gone);
+        });
+        listedDirectories += directories.count();
+        if (token.isCanceled())
+            break;
+    }
+
+    std::sort(missing.begin(), missing.end());
+    Metrics::counter("reconcile.directories_listed") += listedDirectories;
+    Metrics::counter("reconcile.missing_files") += missing.count();
+    return missing;
+}
+
+QStringList CatalogReconciler::missingInDirectory(const QString &directory, const QStringList &paths)
+{
+    QVector<FileRecord> files;
+    QStringList subDirectories;
+    if (!DirectoryWalker::list(directory, files, subDirectories))
+    {
+        // Unreadable is not gone
+        return QFileInfo::exists(directory) ? QStringList() : paths;
+    }
+
+    QSet<QString> found;
+    found.reserve(files.count());
+    for (auto& record : files)
+        found.insert(record.FullPath);
+
+    QStringList gone;
+    for (auto& path : paths)
+    {
+        if (!found.contains(path))
+            gone.append(path);
+    }
+    return gone;
+}
@@ -0,0 +1,56 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef CATALOGRECONCILER_H
+#define CATALOGRECONCILER_H
+
+#include "cancellationtoken.h"
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+/*!
+ * \brief The CatalogReconciler class
+ * Finds the files of the catalog that are not on disk any more, without processing
+ * anything. The paths are grouped by their directory in memory, and each directory
+ * is listed once with the DirectoryWalker, so a disk costs one bulk listing per
+ * directory instead of a stat per file.
+ *
+ * Only the search folders that are there are looked at. A folder that is not a
+ * directory, or is empty, is taken for a volume that is not mounted and its files
+ * are kept. Folders of an object store are skipped, listing them is a request per
+ * directory. A directory that is there but cannot be listed keeps its files.
+ */
+class CatalogReconciler
+{
+public:
+    // Thread safe. The paths under the folders whose files are gone, in path order.
+    static QStringList missingFiles(const QStringList& paths, const QStringList& folders, const CancellationToken& token = CancellationToken());
+
+private:
+    static QStringList missingInDirectory(const QString& directory, const QStringList& paths);
+};
+
+#endif // CATALOGRECONCILER_H
@@ -0,0 +1,262 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "catalogprotocol.h"
+#include "catalogserver.h"
+#include "metrics.h"
+
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QUrl>
+#include <QUrlQuery>
+
+// Requests with a longer head are not ours, the connection is dropped
+#define MAX_REQUEST_LENGTH 8192
+// The files of a /files page, without a limit, and at most
+#define SERVER_DEFAULT_PAGE_SIZE 200
+#define SERVER_MAX_PAGE_SIZE 1000
+// The changes of a /changes answer at most, the client asks again for the rest
+#define SERVER_CHANGES_PAGE 500
+// How often the held /changes requests look for changes
+#define SERVER_CHANGES_POLL_INTERVAL 1000
+// The longest a /changes request is held
+#define SERVER_MAX_WAIT (60 * 1000)
+
+CatalogServer::CatalogServer(FileRepository *fileRepository, QObject *parent) : QObject(parent), repository(fileRepository)
+{
+    waitTimer = new QTimer(this);
+    waitTimer->setInterval(SERVER_CHANGES_POLL_INTERVAL);
+    connect(waitTimer, &QTimer::timeout, this, &CatalogServer::answerWaitingChanges);
+}
+
+bool CatalogServer::listen(quint16 port, const QString &accessToken)
+{
+    close();
+    token = accessToken;
+    server = new QTcpServer(this);
+    connect(server, &QTcpServer::newConnection, this, &CatalogServer::newConnection);
+    if (!server->listen(QHostAddress::Any, port))
+    {
+        qWarning() << "Catalog server could not listen on port" << port << ":" << server->errorString();
+        return false;
+    }
+    waitTimer->start();
+    return true;
+}
+
+void CatalogServer::close()
+{
+    waitTimer->stop();
+    waiting.clear();
+    delete server;
+    server = nullptr;
+}
+
+void CatalogServer::newConnection()
+{
+    while (QTcpSocket* socket = server->nextPendingConnection())
+    {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { readRequest(socket); });
+        readRequest(socket);
+    }
+}
+
+/*!
+ * \brief CatalogServer::readRequest
+ * Answers the request once its head is read. One request per connection, the body
+ * of a GET is ignored.
+ */
+void CatalogServer::readRequest(QTcpSocket *socket)
+{
+    if (socket->property("answered").toBool())
+        return;
+    const QByteArray head = socket->peek(MAX_REQUEST_LENGTH);
+    const int end = head.indexOf("\r\n\r\n");
+    if (end < 0)
+    {
+        if (head.size() >= MAX_REQUEST_LENGTH)
+            socket->abort();
+        return;
+    }
+    socket->read(end + 4);
+    socket->setProperty("answered", true);
+
+    const QList<QByteArray> lines = head.left(end).split('\n');
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    if (requestLine.count() != 3 || requestLine.at(0) != "GET")
+    {
+        respond(socket, 405);
+        return;
+    }
+    if (!token.isEmpty())
+    {
+        bool authorized = false;
+        for (int i = 1; i < lines.count() && !authorized; i++)
+        {
+            const QByteArray line = lines.at(i).trimmed();
+            const int colon = line.indexOf(':');
+            authorized = colon > 0 && line.left(colon).trimmed().toLower() == "authorization"
+                && line.mid(colon + 1).trimmed() == "Bearer " + token.toUtf8();
+        }
+        if (!authorized)
+        {
+            respond(socket, 401);
+            return;
+        }
+    }
+
+    const QUrl url(QString::fromUtf8(requestLine.at(1)));
+    const QUrlQuery query(url);
+    bool levelOk = true;
+    const int level = query.hasQueryItem("level") ? query.queryItemValue("level").toInt(&levelOk) : THUMBNAIL_LEVEL_COUNT - 1;
+    if (!levelOk || level < 0 || level >= THUMBNAIL_LEVEL_COUNT)
+    {
+        respond(socket, 400);
+        return;
+    }
+
+    if (url.path() == "/catalog")
+    {
+        answer(socket, InteractivePriority, [this](const CancellationToken&) {
+            CatalogInfo info;
+            info.catalogId = repository->catalogId();
+            info.lastSeq = repository->latestChangeSeq();
+            return CatalogProtocol::encodeInfo(info);
+        });
+    }
+    else if (url.path() == "/files")
+    {
+        const int after = query.queryItemValue("after").toInt();
+        const int limit = qBound(1, query.hasQueryItem("limit") ? query.queryItemValue("limit").toInt() : SERVER_DEFAULT_PAGE_SIZE, SERVER_MAX_PAGE_SIZE);
+        answer(socket, IngestPriority, [this, after, limit, level](const CancellationToken&) {
+            return CatalogProtocol::encodeFiles(repository->servedFilesAfter(after, limit, level));
+        });
+    }
+    else if (url.path() == "/changes")
+    {
+        const qint64 since = query.queryItemValue("since").toLongLong();
+        const int wait = qBound(0, query.queryItemValue("wait").toInt(), SERVER_MAX_WAIT);
+        // Answered right away when there are changes already
+        if (wait > 0 && FileRepository::changesSince(since, 1).Changes.isEmpty())
+            waiting.append({socket, since, level, QDeadlineTimer(wait)});
+        else
+            answerChanges(socket, since, level);
+    }
+    else
+    {
+        respond(socket, 404);
+    }
+}
+
+/*!
+ * \brief CatalogServer::answer
+ * Runs work on the repository thread, and answers with what it returns. The answer is
+ * dropped with the socket when the client hung up before.
+ */
+void CatalogServer::answer(QTcpSocket *socket, RequestPriority priority, std::function<QByteArray(const CancellationToken&)> work)
+{
+    static std::atomic<qint64>& requestCount = Metrics::counter("catalog_server.requests");
+    requestCount++;
+    auto watcher = new QFutureWatcher<QByteArray>(socket);
+    connect(watcher, &QFutureWatcher<QByteArray>::finished, socket, [socket, watcher]() {
+        if (watcher->isCanceled())
+            respond(socket, 503);
+        else
+            respond(socket, 200, watcher->result());
+    });
+    watcher->setFuture(repository->submit<QByteArray>(priority, work));
+}
+
+/*!
+ * \brief CatalogServer::answerChanges
+ * The CatalogDelta of the first SERVER_CHANGES_PAGE changes after since. A file
+ * changed many times is sent once, as it is now. The paths that are no longer in the
+ * catalog, or are in a detached folder, are sent as deleted.
+ */
+void CatalogServer::answerChanges(QTcpSocket *socket, qint64 since, int level)
+{
+    answer(socket, IngestPriority, [this, since, level](const CancellationToken&) {
+        const FileChanges changes = FileRepository::changesSince(since, SERVER_CHANGES_PAGE);
+        CatalogDelta delta;
+        delta.catalogId = repository->catalogId();
+        delta.lastSeq = changes.LastSeq;
+        delta.isComplete = changes.IsComplete;
+        if (!changes.IsComplete)
+            return CatalogProtocol::encodeDelta(delta);
+
+        QSet<QString> changedPaths;
+        QStringList paths;
+        for (auto& change : changes.Changes)
+        {
+            if (!changedPaths.contains(change.FullPath))
+            {
+                changedPaths.insert(change.FullPath);
+                paths.append(change.FullPath);
+            }
+        }
+        delta.files = repository->servedFilesAt(paths, level);
+        for (auto& file : delta.files)
+            changedPaths.remove(file.astroFile.FullPath);
+        for (auto& path : paths)
+        {
+            if (changedPaths.contains(path))
+                delta.deletedPaths.append(path);
+        }
+        return CatalogProtocol::encodeDelta(delta);
+    });
+}
+
+void CatalogServer::answerWaitingChanges()
+{
+    for (int i = waiting.count() - 1; i >= 0; i--)
+    {
+        const WaitingChanges request = waiting.at(i);
+        if (!request.socket)
+        {
+            waiting.removeAt(i);
+        }
+        else if (request.deadline.hasExpired() || !FileRepository::changesSince(request.since, 1).Changes.isEmpty())
+        {
+            waiting.removeAt(i);
+            answerChanges(request.socket, request.since, request.level);
+        }
+    }
+}
+
+void CatalogServer::respond(QTcpSocket *socket, int status, const QByteArray &body)
+{
+    static const QHash<int, QByteArray> reasons = {
+        {200, "OK"}, {400, "Bad Request"}, {401, "Unauthorized"}, {404, "Not Found"},
+        {405, "Method Not Allowed"}, {503, "Service Unavailable"},
+    };
+    QByteArray response = "HTTP/1.1 " + QByteArray::number(status) + ' ' + reasons.value(status) + "\r\n";
+    response += "Content-Type: application/octet-stream\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    socket->write(response);
+    socket->write(body);
+    socket->disconnectFromHost();
+}
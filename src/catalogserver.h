@@ -0,0 +1,88 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef CATALOGSERVER_H
+#define CATALOGSERVER_H
+
+#include "filerepository.h"
+
+#include <QDeadlineTimer>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+class QTimer;
+
+/*!
+ * \brief The CatalogServer class
+ * Serves the catalog of the command line indexer over HTTP, so machines that do not
+ * share its disk keep a replica of it, see CatalogClient. Every answer is a
+ * CatalogProtocol encoding:
+ *     GET /catalog                              the CatalogInfo
+ *     GET /files?after=<id>&limit=<n>&level=<l> the files after an id, the lowest ids first
+ *     GET /changes?since=<seq>&level=<l>&wait=<msecs>
+ *                                               the CatalogDelta after a seq of the change log,
+ *                                               held until there is one or wait is over
+ * The thumbnails are the ones of the level asked for, see thumbnailLevelSizes.
+ * With a token, every request has to come with "Authorization: Bearer <token>".
+ *
+ * Lives on the main thread, the catalog is read on the repository thread.
+ */
+class CatalogServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit CatalogServer(FileRepository* fileRepository, QObject *parent = nullptr);
+    bool listen(quint16 port, const QString& accessToken);
+    void close();
+
+private slots:
+    void newConnection();
+    void answerWaitingChanges();
+
+private:
+    // A /changes request held until there are changes
+    struct WaitingChanges
+    {
+        QPointer<QTcpSocket> socket;
+        qint64 since;
+        int level;
+        QDeadlineTimer deadline;
+    };
+
+    void readRequest(QTcpSocket* socket);
+    void answer(QTcpSocket* socket, RequestPriority priority, std::function<QByteArray(const CancellationToken&)> work);
+    void answerChanges(QTcpSocket* socket, qint64 since, int level);
+    static void respond(QTcpSocket* socket, int status, const QByteArray& body = QByteArray());
+
+    FileRepository* repository;
+    QTcpServer* server = nullptr;
+    QTimer* waitTimer = nullptr;
+    QString token;
+    QList<WaitingChanges> waiting;
+};
+
+#endif // CATALOGSERVER_H
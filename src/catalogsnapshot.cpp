@@ -0,0 +1,422 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "catalogsnapshot.h"
+#include "stringpool.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QSaveFile>
+
+#include <cstring>
+#include <limits>
+
+#define SNAPSHOT_MAGIC 0x4e534341 // "ACSN" in native byte order
+#define SNAPSHOT_VERSION 10
+
+/*
+ * File layout. Everything is written in native byte order; the magic number
+ * fails to match on a machine with a different byte order.
+ *
+ *  SnapshotHeader
+ *  qint64[stringCount]              offsets of the strings, relative to the string block
+ *  string block                     qint32 length followed by UTF-16 data, per string
+ *  SnapshotRow[rowCount]
+ *  SnapshotTag[tagCount]
+ *  TileSize[tileCount]              of the TinyThumbnailAtlas
+ *  tile block                       the tiles of the TinyThumbnailAtlas, read with one copy
+ *
+ * Strings are interned, so a directory path or a tag value shared by thousands of
+ * rows is stored, and later allocated, only once.
+ */
+struct SnapshotHeader
+{
+    quint32 magic;
+    qint32 snapshotVersion;
+    qint32 schemaVersion;
+    qint32 rowCount;
+    qint64 catalogId;
+    qint64 changeCounter;
+    qint32 stringCount;
+    qint32 tagCount;
+    qint64 stringOffsetsOffset;
+    qint64 stringsOffset;
+    qint64 rowsOffset;
+    qint64 tagsOffset;
+    qint64 tileSizesOffset;
+    qint64 tilesOffset;
+    qint32 tileCount;
+};
+
+struct SnapshotRow
+{
+    qint32 id;
+    qint32 fileName;
+    qint32 fullPath;
+    qint32 directoryPath;
+    qint32 volumeName;
+    qint32 fileExtension;
+    qint32 fileHash;
+    qint32 imageHash;
+    qint32 fileType;
+    qint32 tagStatus;
+    qint32 thumbnailStatus;
+    qint32 processStatus;
+    qint32 isHidden;
+    qint32 tagCount;
+    qint32 firstTag;
+    qint32 tinyThumbnailSlot;
+    qint64 createdTime;
+    qint64 lastModifiedTime;
+    quint64 perceptualHash;
+    qint32 starCount;
+    float background;
+    float noise;
+    float fwhm;
+    float eccentricity;
+    qint64 fileSize;
+    quint64 fileDevice;
+    quint64 fileInode;
+    qint32 failureReason;
+    qint32 thumbnailVersion;
+    qint32 integrity;
+    double solutionRa;
+    double solutionDec;
+    double solutionRotation;
+    double solutionScale;
+    quint8 placeholderHash[PLACEHOLDER_HASH_BYTES];
+};
+
+struct SnapshotTag
+{
+    qint32 key;
+    qint32 value;
+};
+
+#define INVALID_DATE_TIME std::numeric_limits<qint64>::min()
+
+static qint64 toSnapshotTime(const QDateTime& dateTime)
+{
+    return dateTime.isValid() ? dateTime.toMSecsSinceEpoch() : INVALID_DATE_TIME;
+}
+
+static QDateTime fromSnapshotTime(qint64 time)
+{
+    return time == INVALID_DATE_TIME ? QDateTime() : QDateTime::fromMSecsSinceEpoch(time);
+}
+
+class StringInterner
+{
+public:
+    qint32 intern(const QString& string)
+    {
+        auto it = indexes.constFind(string);
+        if (it != indexes.constEnd())
+            return it.value();
+        qint32 index = strings.count();
+        indexes.insert(string, index);
+        strings.append(string);
+        return index;
+    }
+
+    QList<QString> strings;
+
+private:
+    QHash<QString, qint32> indexes;
+};
+
+CatalogSnapshot::CatalogSnapshot()
+{
+    data = nullptr;
+    size = 0;
+}
+
+CatalogSnapshot::~CatalogSnapshot()
+{
+    close();
+}
+
+bool CatalogSnapshot::write(const QString &path, const QList<AstroFile> &astroFiles, const TinyThumbnailAtlas &tinyThumbnails,
+                            int schemaVersion, qint64 catalogId, qint64 changeCounter)
+{
+    StringInterner interner;
+    QVector<SnapshotRow> rows;
+    QVector<SnapshotTag> tags;
+    rows.reserve(astroFiles.count());
+
+    for (auto& a : astroFiles)
+    {
+        SnapshotRow row;
+        row.id = a.Id;
+        row.fileName = interner.intern(a.FileName);
+        row.fullPath = interner.intern(a.FullPath);
+        row.directoryPath = interner.intern(a.DirectoryPath);
+        row.volumeName = interner.intern(a.VolumeName);
+        row.fileExtension = interner.intern(a.FileExtension);
+        row.fileHash = interner.intern(a.FileHash);
+        row.imageHash = interner.intern(a.ImageHash);
+        row.fileType = a.FileType;
+        row.tagStatus = a.tagStatus;
+        row.thumbnailStatus = a.thumbnailStatus;
+        row.processStatus = a.processStatus;
+        row.isHidden = a.IsHidden;
+        row.createdTime = toSnapshotTime(a.CreatedTime);
+        row.lastModifiedTime = toSnapshotTime(a.LastModifiedTime);
+        row.perceptualHash = a.PerceptualHash;
+        row.starCount = a.Quality.starCount;
+        row.background = a.Quality.background;
+        row.noise = a.Quality.noise;
+        row.fwhm = a.Quality.fwhm;
+        row.eccentricity = a.Quality.eccentricity;
+        row.fileSize = a.FileSize;
+        row.fileDevice = a.FileDevice;
+        row.fileInode = a.FileInode;
+        row.failureReason = a.FailureReason;
+        row.thumbnailVersion = a.ThumbnailVersion;
+        row.integrity = a.Integrity;
+        row.solutionRa = a.Solution.ra;
+        row.solutionDec = a.Solution.dec;
+        row.solutionRotation = a.Solution.rotation;
+        row.solutionScale = a.Solution.scale;
+        memcpy(row.placeholderHash, a.Placeholder.bytes.data(), PLACEHOLDER_HASH_BYTES);
+        row.firstTag = tags.count();
+        row.tagCount = a.Tags.count();
+        for (auto iter = a.Tags.constBegin(); iter != a.Tags.constEnd(); ++iter)
+            tags.append({interner.intern(iter.key()), interner.intern(iter.value())});
+        row.tinyThumbnailSlot = a.tinyThumbnailSlot;
+        rows.append(row);
+    }
+
+    QVector<qint64> stringOffsets;
+    QByteArray stringBlock;
+    stringOffsets.reserve(interner.strings.count());
+    for (auto& string : interner.strings)
+    {
+        stringOffsets.append(stringBlock.size());
+        qint32 length = string.length();
+        stringBlock.append((const char*)&length, sizeof(length));
+        stringBlock.append((const char*)string.utf16(), length * sizeof(char16_t));
+        // Keep every length field 4-byte aligned
+        while (stringBlock.size() % 4 != 0)
+            stringBlock.append('\0');
+    }
+
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.snapshotVersion = SNAPSHOT_VERSION;
+    header.schemaVersion = schemaVersion;
+    header.rowCount = rows.count();
+    header.catalogId = catalogId;
+    header.changeCounter = changeCounter;
+    header.stringCount = interner.strings.count();
+    header.tagCount = tags.count();
+    header.stringOffsetsOffset = sizeof(SnapshotHeader);
+    header.stringsOffset = header.stringOffsetsOffset + stringOffsets.count() * sizeof(qint64);
+    header.rowsOffset = header.stringsOffset + stringBlock.size();
+    header.tagsOffset = header.rowsOffset + rows.count() * sizeof(SnapshotRow);
+    header.tileCount = tinyThumbnails.slotCount();
+    header.tileSizesOffset = header.tagsOffset + tags.count() * sizeof(SnapshotTag);
+    header.tilesOffset = header.tileSizesOffset + header.tileCount * sizeof(TinyThumbnailAtlas::TileSize);
+
+    // QSaveFile only replaces the old snapshot once the new one is fully written
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "Could not write catalog snapshot: " << out.errorString();
+        return false;
+    }
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)stringOffsets.constData(), stringOffsets.count() * sizeof(qint64));
+    out.write(stringBlock);
+    out.write((const char*)rows.constData(), rows.count() * sizeof(SnapshotRow));
+    out.write((const char*)tags.constData(), tags.count() * sizeof(SnapshotTag));
+    out.write((const char*)tinyThumbnails.tileSizes().constData(), header.tileCount * sizeof(TinyThumbnailAtlas::TileSize));
+    out.write(tinyThumbnails.tileData());
+    return out.commit();
+}
+
+void CatalogSnapshot::remove(const QString &path)
+{
+    QFile::remove(path);
+}
+
+bool CatalogSnapshot::open(const QString &path)
+{
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    size = file.size();
+    if (size < (qint64)sizeof(SnapshotHeader))
+    {
+        close();
+        return false;
+    }
+
+    data = file.map(0, size);
+    if (data == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    auto header = reinterpret_cast<const SnapshotHeader*>(data);
+    if (header->magic != SNAPSHOT_MAGIC || header->snapshotVersion != SNAPSHOT_VERSION ||
+        header->tagsOffset > size || header->rowsOffset > size || header->tileSizesOffset > size || header->tileCount < 0 ||
+        header->tilesOffset + header->tileCount * TinyThumbnailAtlas::tileBytes() != size)
+    {
+        close();
+        return false;
+    }
+
+    if (!loadStrings())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool CatalogSnapshot::loadStrings()
+{
+    auto header = reinterpret_cast<const SnapshotHeader*>(data);
+    auto offsets = reinterpret_cast<const qint64*>(data + header->stringOffsetsOffset);
+    qint64 blockSize = header->rowsOffset - header->stringsOffset;
+
+    strings.clear();
+    strings.reserve(header->stringCount);
+    for (int i = 0; i < header->stringCount; i++)
+    {
+        qint64 offset = offsets[i];
+        if (offset < 0 || offset + (qint64)sizeof(qint32) > blockSize)
+            return false;
+        const uchar* it = data + header->stringsOffset + offset;
+        qint32 length = *reinterpret_cast<const qint32*>(it);
+        if (length < 0 || offset + (qint64)sizeof(qint32) + length * (qint64)sizeof(char16_t) > blockSize)
+            return false;
+        strings.append(QString((const QChar*)(it + sizeof(qint32)), length));
+    }
+    return true;
+}
+
+bool CatalogSnapshot::isValidFor(int schemaVersion, qint64 catalogId, qint64 changeCounter) const
+{
+    if (data == nullptr)
+        return false;
+    auto header = reinterpret_cast<const SnapshotHeader*>(data);
+    return header->schemaVersion == schemaVersion && header->catalogId == catalogId && header->changeCounter == changeCounter;
+}
+
+int CatalogSnapshot::count() const
+{
+    if (data == nullptr)
+        return 0;
+    return reinterpret_cast<const SnapshotHeader*>(data)->rowCount;
+}
+
+QList<AstroFile> CatalogSnapshot::read(int first, int count)
+{
+    QList<AstroFile> astroFiles;
+    if (data == nullptr)
+        return astroFiles;
+
+    auto header = reinterpret_cast<const SnapshotHeader*>(data);
+    auto rows = reinterpret_cast<const SnapshotRow*>(data + header->rowsOffset);
+    auto tags = reinterpret_cast<const SnapshotTag*>(data + header->tagsOffset);
+
+    int last = qMin(first + count, header->rowCount);
+    astroFiles.reserve(last - first);
+    for (int i = first; i < last; i++)
+    {
+        const SnapshotRow& row = rows[i];
+        AstroFile a;
+        a.Id = row.id;
+        a.FileName = strings.value(row.fileName);
+        a.FullPath = strings.value(row.fullPath);
+        a.DirectoryPath = StringPool::intern(strings.value(row.directoryPath));
+        a.VolumeName = StringPool::intern(strings.value(row.volumeName));
+        a.FileExtension = StringPool::intern(strings.value(row.fileExtension));
+        a.FileHash = strings.value(row.fileHash);
+        a.ImageHash = strings.value(row.imageHash);
+        a.FileType = AstroFileType(row.fileType);
+        a.tagStatus = TagExtractStatus(row.tagStatus);
+        a.thumbnailStatus = ThumbnailLoadStatus(row.thumbnailStatus);
+        a.processStatus = AstroFileProcessStatus(row.processStatus);
+        a.IsHidden = row.isHidden;
+        a.CreatedTime = fromSnapshotTime(row.createdTime);
+        a.LastModifiedTime = fromSnapshotTime(row.lastModifiedTime);
+        a.PerceptualHash = row.perceptualHash;
+        a.Quality.starCount = row.starCount;
+        a.Quality.background = row.background;
+        a.Quality.noise = row.noise;
+        a.Quality.fwhm = row.fwhm;
+        a.Quality.eccentricity = row.eccentricity;
+        a.FileSize = row.fileSize;
+        a.FileDevice = row.fileDevice;
+        a.FileInode = row.fileInode;
+        a.FailureReason = AstroFileFailureReason(row.failureReason);
+        a.ThumbnailVersion = row.thumbnailVersion;
+        a.Integrity = AstroFileIntegrity(row.integrity);
+        a.Solution.ra = row.solutionRa;
+        a.Solution.dec = row.solutionDec;
+        a.Solution.rotation = row.solutionRotation;
+        a.Solution.scale = row.solutionScale;
+        memcpy(a.Placeholder.bytes.data(), row.placeholderHash, PLACEHOLDER_HASH_BYTES);
+
+        if (row.firstTag >= 0 && row.firstTag + row.tagCount <= header->tagCount)
+        {
+            for (int t = row.firstTag; t < row.firstTag + row.tagCount; t++)
+            {
+                const QString key = strings.value(tags[t].key);
+                a.Tags.insert(key, StringPool::internTagValue(key, strings.value(tags[t].value)));
+            }
+        }
+        // In the atlas of readTinyThumbnails
+        a.tinyThumbnailSlot = row.tinyThumbnailSlot < header->tileCount ? row.tinyThumbnailSlot : -1;
+        astroFiles.append(a);
+    }
+    return astroFiles;
+}
+
+bool CatalogSnapshot::readTinyThumbnails(TinyThumbnailAtlas &atlas)
+{
+    if (data == nullptr)
+        return false;
+
+    auto header = reinterpret_cast<const SnapshotHeader*>(data);
+    auto tileSizes = reinterpret_cast<const TinyThumbnailAtlas::TileSize*>(data + header->tileSizesOffset);
+    return atlas.assign(reinterpret_cast<const char*>(data + header->tilesOffset), size - header->tilesOffset, tileSizes, header->tileCount);
+}
+
+void CatalogSnapshot::close()
+{
+    strings.clear();
+    if (data != nullptr)
+        file.unmap(const_cast<uchar*>(data));
+    data = nullptr;
+    size = 0;
+    if (file.isOpen())
+        file.close();
+}
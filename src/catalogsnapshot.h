@@ -0,0 +1,70 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef CATALOGSNAPSHOT_H
+#define CATALOGSNAPSHOT_H
+
+#include "astrofile.h"
+#include "tinythumbnailatlas.h"
+
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+/*!
+ * \brief The CatalogSnapshot class
+ * A versioned, memory-mapped binary image of the Catalog rows, their interned
+ * strings and tiny thumbnails. It is only used when it was written against the
+ * same database (catalog id), schema version and change counter, so it can
+ * replace reading the model from SQLite at startup.
+ */
+class CatalogSnapshot
+{
+public:
+    CatalogSnapshot();
+    ~CatalogSnapshot();
+
+    static bool write(const QString& path, const QList<AstroFile>& astroFiles, const TinyThumbnailAtlas& tinyThumbnails,
+                      int schemaVersion, qint64 catalogId, qint64 changeCounter);
+    static void remove(const QString& path);
+
+    bool open(const QString& path);
+    bool isValidFor(int schemaVersion, qint64 catalogId, qint64 changeCounter) const;
+    int count() const;
+    // The rows keep the slots of their tiny thumbnails in this atlas
+    QList<AstroFile> read(int first, int count);
+    bool readTinyThumbnails(TinyThumbnailAtlas& atlas);
+    void close();
+
+private:
+    QFile file;
+    const uchar* data;
+    qint64 size;
+    QVector<QString> strings;
+
+    bool loadStrings();
+};
+
+#endif // CATALOGSNAPSHOT_H
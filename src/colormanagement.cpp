@@ -0,0 +1,130 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "colormanagement.h"
+
+#include <QColorSpace>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+
+#include <lcms2.h>
+
+#include <memory>
+
+// Transforms kept, the oldest is dropped first. Most libraries use a handful of profiles.
+#define TRANSFORM_CACHE_SIZE 16
+
+// QImage::Format_RGB32 and Format_ARGB32 are 0xAARRGGBB words, BGRA bytes on little endian hosts
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+#define THUMBNAIL_PIXEL_TYPE TYPE_BGRA_8
+#else
+#define THUMBNAIL_PIXEL_TYPE TYPE_ARGB_8
+#endif
+
+namespace
+{
+    // Shared, so a transform dropped from the cache lives until the threads using it are done
+    typedef std::shared_ptr<void> Transform;
+
+    QMutex cacheMutex;
+    QHash<QByteArray, Transform> transforms;
+    QQueue<QByteArray> transformOrder;
+
+    // Null when either profile can not be read, or they are not both RGB
+    Transform createTransform(const QByteArray& sourceProfile, const QByteArray& targetProfile)
+    {
+        cmsHPROFILE source = cmsOpenProfileFromMem(sourceProfile.constData(), cmsUInt32Number(sourceProfile.size()));
+        cmsHPROFILE target = targetProfile.isEmpty() ? cmsCreate_sRGBProfile()
+                                                     : cmsOpenProfileFromMem(targetProfile.constData(), cmsUInt32Number(targetProfile.size()));
+        cmsHTRANSFORM transform = nullptr;
+        if (source != nullptr && target != nullptr
+            && cmsGetColorSpace(source) == cmsSigRgbData && cmsGetColorSpace(target) == cmsSigRgbData)
+        {
+            // No cache of the last pixel, so one transform can be used by several threads at
+            // once. 8 bit transforms are optimized by Little CMS into precalculated tables.
+            transform = cmsCreateTransform(source, THUMBNAIL_PIXEL_TYPE, target, THUMBNAIL_PIXEL_TYPE,
+                                           INTENT_PERCEPTUAL, cmsFLAGS_NOCACHE | cmsFLAGS_COPY_ALPHA);
+        }
+        if (source != nullptr)
+            cmsCloseProfile(source);
+        if (target != nullptr)
+            cmsCloseProfile(target);
+        if (transform == nullptr)
+            return Transform();
+        return Transform(transform, cmsDeleteTransform);
+    }
+
+    // Profiles that fail are cached too, so they are not parsed again for every file
+    Transform transformFor(const QByteArray& sourceProfile, const QByteArray& targetProfile)
+    {
+        const QByteArray key = QByteArray::number(sourceProfile.size()) + ':' + sourceProfile + targetProfile;
+        QMutexLocker locker(&cacheMutex);
+        auto it = transforms.constFind(key);
+        if (it != transforms.constEnd())
+            return it.value();
+
+        // Built under the lock, so a profile shared by a batch of files is built once
+        Transform transform = createTransform(sourceProfile, targetProfile);
+        if (transformOrder.size() >= TRANSFORM_CACHE_SIZE)
+            transforms.remove(transformOrder.dequeue());
+        transforms.insert(key, transform);
+        transformOrder.enqueue(key);
+        return transform;
+    }
+}
+
+/*!
+ * \brief ColorManagement::convert
+ * The image is converted to RGB32 first unless it already has 32 bit pixels. Grayscale
+ * thumbnails have no color to manage and are left as they are.
+ */
+bool ColorManagement::convert(QImage &image, const QByteArray &sourceProfile, const QByteArray &targetProfile)
+{
+    if (image.isNull() || sourceProfile.isEmpty() || sourceProfile == targetProfile || image.isGrayscale())
+        return false;
+
+    Transform transform = transformFor(sourceProfile, targetProfile);
+    if (!transform)
+        return false;
+
+    if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32)
+        image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+
+    // In place, the whole image in one call
+    uchar* pixels = image.bits();
+    const cmsUInt32Number stride = cmsUInt32Number(image.bytesPerLine());
+    cmsDoTransformLineStride(transform.get(), pixels, pixels, cmsUInt32Number(image.width()), cmsUInt32Number(image.height()),
+                             stride, stride, 0, 0);
+    image.setColorSpace(targetProfile.isEmpty() ? QColorSpace(QColorSpace::SRgb) : QColorSpace::fromIccProfile(targetProfile));
+    return true;
+}
+
+void ColorManagement::clearCache()
+{
+    QMutexLocker locker(&cacheMutex);
+    transforms.clear();
+    transformOrder.clear();
+}
@@ -0,0 +1,49 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef COLORMANAGEMENT_H
+#define COLORMANAGEMENT_H
+
+#include <QByteArray>
+#include <QImage>
+
+/*!
+ * \brief The ColorManagement class
+ * Converts the 8 bit thumbnails from the ICC profile embedded in their file to a
+ * display profile, with the bundled Little CMS. Only the downscaled thumbnail is
+ * converted, never the full frame. Transforms are built once per pair of profiles
+ * and shared by the processing threads.
+ */
+class ColorManagement
+{
+public:
+    // Converts image in place from sourceProfile to targetProfile, sRGB when empty.
+    // Images without a profile, or with one that is not RGB or can not be read, are
+    // left as they are. Returns whether the image was converted.
+    static bool convert(QImage& image, const QByteArray& sourceProfile, const QByteArray& targetProfile = QByteArray());
+    // Drops the cached transforms
+    static void clearCache();
+};
+
+#endif // COLORMANAGEMENT_H
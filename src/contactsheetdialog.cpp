@@ -0,0 +1,172 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "contactsheetdialog.h"
+
+#include <QDialogButtonBox>
+#include <QDir>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QFormLayout>
+#include <QHBoxLayout>
+#include <QMessageBox>
+#include <QSettings>
+#include <QVBoxLayout>
+
+#define CONTACT_SHEET_PROGRESS_INTERVAL_MS 250
+#define CONTACT_SHEET_COLUMNS 6
+#define CONTACT_SHEET_ROWS 4
+
+ContactSheetDialog::ContactSheetDialog(FileRepository *repository, const QVector<ContactSheetExporter::Item> &items, const QString &title, QWidget *parent)
+    : QDialog(parent), repository(repository), items(items)
+{
+    setWindowTitle(tr("Contact Sheet of %n File(s)", "", items.count()));
+    resize(520, 0);
+    QSettings settings;
+
+    const QString folder = settings.value("ContactSheetFolder", QDir::homePath()).toString();
+    fileEdit = new QLineEdit(QDir(folder).filePath(tr("contact sheet.pdf")));
+    QPushButton* browseButton = new QPushButton(tr("Browse..."));
+    connect(browseButton, &QPushButton::clicked, this, &ContactSheetDialog::chooseFile);
+    QHBoxLayout* fileLayout = new QHBoxLayout;
+    fileLayout->addWidget(fileEdit, 1);
+    fileLayout->addWidget(browseButton);
+
+    titleEdit = new QLineEdit(title);
+    formatCombo = new QComboBox;
+    formatCombo->addItem(tr("PDF"), ContactSheetExporter::PdfSheets);
+    formatCombo->addItem(tr("PNG, a file per page"), ContactSheetExporter::PngSheets);
+    formatCombo->setCurrentIndex(qBound(0, settings.value("ContactSheetFormat", 0).toInt(), 1));
+    connect(formatCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this]() {
+        const QFileInfo info(fileEdit->text());
+        const QString suffix = formatCombo->currentData().toInt() == ContactSheetExporter::PngSheets ? "png" : "pdf";
+        fileEdit->setText(info.dir().filePath(info.completeBaseName() + "." + suffix));
+    });
+    columnsSpin = new QSpinBox;
+    columnsSpin->setRange(1, 16);
+    columnsSpin->setValue(settings.value("ContactSheetColumns", CONTACT_SHEET_COLUMNS).toInt());
+    rowsSpin = new QSpinBox;
+    rowsSpin->setRange(1, 16);
+    rowsSpin->setValue(settings.value("ContactSheetRows", CONTACT_SHEET_ROWS).toInt());
+
+    QFormLayout* form = new QFormLayout;
+    form->addRow(tr("File"), fileLayout);
+    form->addRow(tr("Title"), titleEdit);
+    form->addRow(tr("Format"), formatCombo);
+    form->addRow(tr("Columns"), columnsSpin);
+    form->addRow(tr("Rows"), rowsSpin);
+
+    progressBar = new QProgressBar;
+    progressBar->setValue(0);
+    statusLabel = new QLabel;
+
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Cancel);
+    exportButton = buttons->addButton(tr("Export"), QDialogButtonBox::AcceptRole);
+    connect(exportButton, &QPushButton::clicked, this, &ContactSheetDialog::startExport);
+    connect(buttons, &QDialogButtonBox::rejected, this, &ContactSheetDialog::reject);
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addLayout(form);
+    layout->addWidget(progressBar);
+    layout->addWidget(statusLabel);
+    layout->addWidget(buttons);
+
+    progressTimer.setInterval(CONTACT_SHEET_PROGRESS_INTERVAL_MS);
+    connect(&progressTimer, &QTimer::timeout, this, &ContactSheetDialog::updateProgress);
+}
+
+void ContactSheetDialog::chooseFile()
+{
+    const bool png = formatCombo->currentData().toInt() == ContactSheetExporter::PngSheets;
+    const QString file = QFileDialog::getSaveFileName(this, tr("Export To"), fileEdit->text(), png ? tr("PNG (*.png)") : tr("PDF (*.pdf)"));
+    if (!file.isEmpty())
+        fileEdit->setText(file);
+}
+
+void ContactSheetDialog::startExport()
+{
+    const QString file = fileEdit->text();
+    const QFileInfo info(file);
+    if (file.isEmpty() || !QDir().mkpath(info.absolutePath()))
+    {
+        QMessageBox::warning(this, windowTitle(), tr("Can not write to %1").arg(file));
+        return;
+    }
+    QSettings settings;
+    settings.setValue("ContactSheetFolder", info.absolutePath());
+    settings.setValue("ContactSheetFormat", formatCombo->currentIndex());
+    settings.setValue("ContactSheetColumns", columnsSpin->value());
+    settings.setValue("ContactSheetRows", rowsSpin->value());
+
+    for (QWidget* widget : std::initializer_list<QWidget*>{fileEdit, titleEdit, formatCombo, columnsSpin, rowsSpin, exportButton})
+        widget->setEnabled(false);
+
+    exporter = new ContactSheetExporter(repository, this);
+    connect(exporter, &ContactSheetExporter::finished, this, &ContactSheetDialog::exportFinished);
+    progressTimer.start();
+    exporter->start(items, file, ContactSheetExporter::Format(formatCombo->currentData().toInt()),
+                    columnsSpin->value(), rowsSpin->value(), titleEdit->text());
+    // Nothing to write finishes at once
+    if (exporter != nullptr)
+    {
+        progressBar->setRange(0, qMax(1, exporter->pageCount()));
+        updateProgress();
+    }
+}
+
+void ContactSheetDialog::updateProgress()
+{
+    if (exporter == nullptr)
+        return;
+    progressBar->setValue(exporter->pagesDone());
+    statusLabel->setText(tr("%1 of %2 pages").arg(exporter->pagesDone()).arg(exporter->pageCount()));
+}
+
+void ContactSheetDialog::exportFinished(int pagesWritten, const QString &error)
+{
+    progressTimer.stop();
+    exporter->deleteLater();
+    exporter = nullptr;
+    if (!error.isEmpty())
+    {
+        QMessageBox::warning(this, windowTitle(), error);
+        statusLabel->setText(tr("Wrote %n page(s)", "", pagesWritten));
+        for (QWidget* widget : std::initializer_list<QWidget*>{fileEdit, titleEdit, formatCombo, columnsSpin, rowsSpin, exportButton})
+            widget->setEnabled(true);
+        return;
+    }
+    accept();
+}
+
+/*!
+ * \brief ContactSheetDialog::reject
+ * Cancels the export in progress, the pages written so far are kept.
+ */
+void ContactSheetDialog::reject()
+{
+    if (exporter != nullptr)
+        exporter->cancel();
+    else
+        QDialog::reject();
+}
@@ -0,0 +1,76 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef CONTACTSHEETDIALOG_H
+#define CONTACTSHEETDIALOG_H
+
+#include "contactsheetexporter.h"
+
+#include <QComboBox>
+#include <QDialog>
+#include <QLabel>
+#include <QLineEdit>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QTimer>
+
+/*!
+ * \brief The ContactSheetDialog class
+ * Exports contact sheets of files with a ContactSheetExporter, showing the pages
+ * written while it runs.
+ */
+class ContactSheetDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    ContactSheetDialog(FileRepository* repository, const QVector<ContactSheetExporter::Item>& items, const QString& title, QWidget *parent = nullptr);
+
+protected:
+    void reject() override;
+
+private slots:
+    void chooseFile();
+    void startExport();
+    void updateProgress();
+    void exportFinished(int pagesWritten, const QString& error);
+
+private:
+    FileRepository* repository;
+    QVector<ContactSheetExporter::Item> items;
+    ContactSheetExporter* exporter = nullptr;
+
+    QLineEdit* fileEdit;
+    QLineEdit* titleEdit;
+    QComboBox* formatCombo;
+    QSpinBox* columnsSpin;
+    QSpinBox* rowsSpin;
+    QProgressBar* progressBar;
+    QLabel* statusLabel;
+    QPushButton* exportButton;
+    QTimer progressTimer;
+};
+
+#endif // CONTACTSHEETDIALOG_H
@@ -0,0 +1,307 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "contactsheetexporter.h"
+#include "astrofile.h"
+#include "filerepository.h"
+#include "metrics.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QFontMetrics>
+#include <QPageSize>
+#include <QPainter>
+#include <QPdfWriter>
+
+// An A4 page in landscape at 150 dpi
+#define CONTACT_SHEET_WIDTH 1754
+#define CONTACT_SHEET_HEIGHT 1240
+#define CONTACT_SHEET_DPI 150
+#define CONTACT_SHEET_MARGIN 48
+#define CONTACT_SHEET_SPACING 12
+#define CONTACT_SHEET_FONT_SIZE 13
+#define CONTACT_SHEET_HEADER_FONT_SIZE 18
+
+// Pages rendered or waiting to be written, beyond one per worker
+#define CONTACT_SHEET_PAGES_AHEAD 2
+
+ContactSheetExporter::ContactSheetExporter(FileRepository *repository, QObject *parent) : QObject(parent), repository(repository)
+{
+}
+
+ContactSheetExporter::~ContactSheetExporter()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void ContactSheetExporter::start(const QVector<Item> &items, const QString &destination, Format format, int columns, int rows, const QString &title)
+{
+    this->items = items;
+    this->destination = destination;
+    this->format = format;
+    this->columns = qMax(1, columns);
+    this->rows = qMax(1, rows);
+    this->title = title;
+    const int perPage = this->columns * this->rows;
+    pages = (items.count() + perPage - 1) / perPage;
+    written = 0;
+
+    QMutexLocker locker(&mutex);
+    if (pages == 0)
+    {
+        locker.unlock();
+        emit finished(0, QString());
+        return;
+    }
+    startRenders();
+}
+
+/*!
+ * \brief ContactSheetExporter::cancel
+ * The pages being painted are dropped, the ones written are kept. The PDF is closed
+ * with the pages it has.
+ */
+void ContactSheetExporter::cancel()
+{
+    cancellationToken.cancel();
+    pool.clear();
+    QMutexLocker locker(&mutex);
+    // The pages that were dropped are never written, so no worker would finish
+    if (!writing && pages > 0 && nextToWrite < pages)
+    {
+        writing = true;
+        locker.unlock();
+        finish();
+    }
+}
+
+// Keeps the pages in flight at the limit. The caller must hold the mutex.
+void ContactSheetExporter::startRenders()
+{
+    const int limit = pool.maxThreadCount() + CONTACT_SHEET_PAGES_AHEAD;
+    while (nextToRender < pages && nextToRender - nextToWrite < limit && !cancellationToken.isCanceled())
+    {
+        const int page = nextToRender++;
+        pool.start([this, page]() { renderPage(page); }, -page);
+    }
+}
+
+/*!
+ * \brief ContactSheetExporter::renderPage
+ * Runs on the pool. The thumbnails of the page are read in one batch, and painted
+ * fitted into their cells above their captions.
+ */
+void ContactSheetExporter::renderPage(int page)
+{
+    static LatencyHistogram& pageLatency = Metrics::histogram("contact_sheet.page");
+    if (cancellationToken.isCanceled())
+        return;
+
+    QImage image;
+    {
+        ScopedLatency latency(pageLatency);
+        const int perPage = columns * rows;
+        const int first = page * perPage;
+        const int last = qMin(first + perPage, int(items.count()));
+
+        QFont font;
+        font.setPixelSize(CONTACT_SHEET_FONT_SIZE);
+        QFont boldFont = font;
+        boldFont.setBold(true);
+        QFont headerFont = font;
+        headerFont.setPixelSize(CONTACT_SHEET_HEADER_FONT_SIZE);
+        const int lineHeight = QFontMetrics(font).height();
+        const int headerHeight = QFontMetrics(headerFont).height() + CONTACT_SHEET_SPACING;
+        int captionLines = 0;
+        for (int i = first; i < last; i++)
+            captionLines = qMax(captionLines, 1 + int(items.at(i).caption.count()));
+
+        const int cellWidth = (CONTACT_SHEET_WIDTH - 2 * CONTACT_SHEET_MARGIN - (columns - 1) * CONTACT_SHEET_SPACING) / columns;
+        const int cellHeight = (CONTACT_SHEET_HEIGHT - 2 * CONTACT_SHEET_MARGIN - headerHeight - (rows - 1) * CONTACT_SHEET_SPACING) / rows;
+        const int thumbnailHeight = qMax(1, cellHeight - captionLines * lineHeight - CONTACT_SHEET_SPACING / 2);
+        const int level = thumbnailLevelFor(qMax(cellWidth, thumbnailHeight));
+
+        QVector<int> ids;
+        for (int i = first; i < last; i++)
+            ids.append(items.at(i).id);
+        const ThumbnailBatch batch = repository->readThumbnails(ids, level);
+        QHash<int, QImage> thumbnails;
+        for (int i = 0; i < batch.ids.count(); i++)
+            thumbnails.insert(batch.ids.at(i), batch.images.at(i));
+        if (cancellationToken.isCanceled())
+            return;
+
+        image = QImage(CONTACT_SHEET_WIDTH, CONTACT_SHEET_HEIGHT, QImage::Format_RGB32);
+        image.setDotsPerMeterX(int(CONTACT_SHEET_DPI / 0.0254));
+        image.setDotsPerMeterY(int(CONTACT_SHEET_DPI / 0.0254));
+        image.fill(Qt::white);
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.setRenderHint(QPainter::TextAntialiasing);
+        painter.setPen(Qt::black);
+
+        painter.setFont(headerFont);
+        const QRect header(CONTACT_SHEET_MARGIN, CONTACT_SHEET_MARGIN, CONTACT_SHEET_WIDTH - 2 * CONTACT_SHEET_MARGIN, headerHeight);
+        painter.drawText(header, Qt::AlignLeft | Qt::AlignTop, title);
+        painter.drawText(header, Qt::AlignRight | Qt::AlignTop, tr("Page %1 of %2").arg(page + 1).arg(pages));
+
+        for (int i = first; i < last; i++)
+        {
+            const Item& item = items.at(i);
+            const int cell = i - first;
+            const int x = CONTACT_SHEET_MARGIN + (cell % columns) * (cellWidth + CONTACT_SHEET_SPACING);
+            const int y = CONTACT_SHEET_MARGIN + headerHeight + (cell / columns) * (cellHeight + CONTACT_SHEET_SPACING);
+
+            const QImage thumbnail = thumbnails.value(item.id);
+            if (thumbnail.isNull())
+            {
+                painter.fillRect(x, y, cellWidth, thumbnailHeight, QColor(224, 224, 224));
+            }
+            else
+            {
+                const QSize size = thumbnail.size().scaled(cellWidth, thumbnailHeight, Qt::KeepAspectRatio);
+                painter.drawImage(QRect(x + (cellWidth - size.width()) / 2, y + (thumbnailHeight - size.height()) / 2, size.width(), size.height()), thumbnail);
+            }
+
+            int lineY = y + thumbnailHeight + CONTACT_SHEET_SPACING / 2;
+            painter.setFont(boldFont);
+            painter.drawText(QRect(x, lineY, cellWidth, lineHeight), Qt::AlignLeft | Qt::AlignVCenter,
+                             QFontMetrics(boldFont).elidedText(item.title, Qt::ElideMiddle, cellWidth));
+            painter.setFont(font);
+            const QFontMetrics metrics(font);
+            for (const QString& line : item.caption)
+            {
+                lineY += lineHeight;
+                painter.drawText(QRect(x, lineY, cellWidth, lineHeight), Qt::AlignLeft | Qt::AlignVCenter, metrics.elidedText(line, Qt::ElideRight, cellWidth));
+            }
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    rendered.insert(page, image);
+    if (writing)
+        return;
+    writing = true;
+    locker.unlock();
+    writePages();
+}
+
+/*!
+ * \brief ContactSheetExporter::writePages
+ * Writes the rendered pages that are next in order, until the next one is not rendered
+ * yet. Only one worker writes at a time, the one that set writing.
+ */
+void ContactSheetExporter::writePages()
+{
+    QMutexLocker locker(&mutex);
+    while (rendered.contains(nextToWrite) && !cancellationToken.isCanceled())
+    {
+        const int page = nextToWrite;
+        const QImage image = rendered.take(page);
+        locker.unlock();
+        QString pageError;
+        const bool ok = writePage(page, image, pageError);
+        locker.relock();
+        if (!ok)
+        {
+            error = pageError;
+            cancellationToken.cancel();
+            pool.clear();
+            break;
+        }
+        nextToWrite++;
+        written = nextToWrite;
+        startRenders();
+    }
+
+    // The worker that renders the next page writes it
+    if (nextToWrite < pages && !cancellationToken.isCanceled())
+    {
+        writing = false;
+        return;
+    }
+    locker.unlock();
+    finish();
+}
+
+bool ContactSheetExporter::writePage(int page, const QImage &image, QString &pageError)
+{
+    if (format == PngSheets)
+    {
+        const QString path = pngPath(page);
+        if (!image.save(path, "PNG"))
+        {
+            pageError = tr("Could not write %1").arg(path);
+            return false;
+        }
+        return true;
+    }
+
+    if (pdfWriter == nullptr)
+    {
+        pdfWriter = std::make_unique<QPdfWriter>(destination);
+        pdfWriter->setPageSize(QPageSize(QPageSize::A4));
+        pdfWriter->setPageOrientation(QPageLayout::Landscape);
+        pdfWriter->setPageMargins(QMarginsF(0, 0, 0, 0));
+        pdfWriter->setResolution(CONTACT_SHEET_DPI);
+        pdfWriter->setTitle(title);
+        pdfPainter = std::make_unique<QPainter>();
+        if (!pdfPainter->begin(pdfWriter.get()))
+        {
+            pageError = tr("Could not write %1").arg(destination);
+            return false;
+        }
+    }
+    else if (!pdfWriter->newPage())
+    {
+        pageError = tr("Could not write %1").arg(destination);
+        return false;
+    }
+    pdfPainter->drawImage(pdfPainter->viewport(), image);
+    return true;
+}
+
+// Closes the PDF and reports. Called once, by the worker that wrote the last page or by cancel.
+void ContactSheetExporter::finish()
+{
+    QString finishError;
+    {
+        QMutexLocker locker(&mutex);
+        if (pdfPainter != nullptr)
+            pdfPainter->end();
+        pdfPainter.reset();
+        pdfWriter.reset();
+        rendered.clear();
+        finishError = error;
+    }
+    emit finished(written, finishError);
+}
+
+QString ContactSheetExporter::pngPath(int page) const
+{
+    const QFileInfo info(destination);
+    return info.dir().filePath(QString("%1-%2.png").arg(info.completeBaseName()).arg(page + 1, 3, 10, QChar('0')));
+}
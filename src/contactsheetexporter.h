@@ -0,0 +1,117 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef CONTACTSHEETEXPORTER_H
+#define CONTACTSHEETEXPORTER_H
+
+#include "cancellationtoken.h"
+#include "taskscheduler.h"
+
+#include <QImage>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+class FileRepository;
+class QPainter;
+class QPdfWriter;
+
+/*!
+ * \brief The ContactSheetExporter class
+ * Writes pages of thumbnails with their captions, a PDF of them or a PNG per page.
+ *
+ * The thumbnails are the level of the pyramid that fits a cell, read from the
+ * repository, so no file is decoded. Pages are laid out and painted on worker threads
+ * in parallel, then written in their order by whichever worker finishes the next one.
+ * At most a few pages more than there are workers are held at once, so the memory
+ * does not grow with the number of pages.
+ */
+class ContactSheetExporter : public QObject
+{
+    Q_OBJECT
+public:
+    enum Format
+    {
+        PdfSheets,
+        PngSheets // name-001.png, name-002.png... next to the destination
+    };
+
+    struct Item
+    {
+        int id = 0;
+        QString title; // The first line of the caption, in bold
+        QStringList caption;
+    };
+
+    explicit ContactSheetExporter(FileRepository* repository, QObject *parent = nullptr);
+    ~ContactSheetExporter();
+
+    // The title is printed at the top of every page, with its number
+    void start(const QVector<Item>& items, const QString& destination, Format format, int columns, int rows, const QString& title);
+    void cancel();
+
+    // Thread safe, for the progress
+    int pagesDone() const { return written; }
+    int pageCount() const { return pages; }
+
+signals:
+    // error is empty when every page was written
+    void finished(int pagesWritten, const QString& error);
+
+private:
+    FileRepository* repository;
+    QVector<Item> items;
+    QString destination;
+    Format format = PdfSheets;
+    int columns = 1;
+    int rows = 1;
+    QString title;
+    int pages = 0;
+    std::atomic<int> written = 0;
+    CancellationToken cancellationToken;
+    TaskGroup pool {InteractivePriority};
+
+    QMutex mutex;
+    QMap<int, QImage> rendered; // Waiting for the pages before them to be written
+    int nextToRender = 0;
+    int nextToWrite = 0;
+    bool writing = false;
+    QString error;
+    std::unique_ptr<QPdfWriter> pdfWriter;
+    std::unique_ptr<QPainter> pdfPainter;
+
+    void startRenders();
+    void renderPage(int page);
+    void writePages();
+    bool writePage(int page, const QImage& image, QString& pageError);
+    void finish();
+    QString pngPath(int page) const;
+};
+
+#endif // CONTACTSHEETEXPORTER_H
@@ -0,0 +1,518 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef DEBAYER_H
+#define DEBAYER_H
+
+#include "cancellationtoken.h"
+#include "fitspixels.h"
+
+#include <QList>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+enum BayerPattern
+{
+    None, // Mono Image
+    RGGB,
+    BGGR,
+    GRBG,
+    GBRG,
+    Unsupported
+};
+
+enum DemosaicMethod
+{
+    DemosaicSuperpixel, // Half resolution, one RGB pixel per 2x2 cell. Used for thumbnails.
+    DemosaicBilinear,   // Full resolution
+    DemosaicVng         // Full resolution, interpolated along the edges. Used for previews.
+};
+
+// Rows of the output handled by one task of a parallel demosaic, and rows done between
+// two checks of the cancellation token
+#define DEMOSAIC_BAND_ROWS 64
+
+// Pixels of a row VNG computes the gradients and sums of at a time, in arrays on the
+// stack, which the compiler knows the rows are not written through
+#define VNG_CHUNK_PIXELS 128
+
+/*!
+ * \brief debayerSuperpixels
+ * Makes a superpixel image out of a bayer frame: one RGB pixel for each 2x2 cell,
+ * averaged over factor x factor cells, written as three planes (red, green, blue)
+ * of (width/2/factor) x (height/2/factor) pixels into out. Only the output rows
+ * [firstRow, lastRow) are written.
+ *
+ * RedX and RedY are the position of the red pixel in the cell, blue is on the
+ * other corner and green on the remaining two. Being template parameters, the
+ * inner loops are straight-line code that the compiler can vectorize.
+ */
+template <typename T, int RedX, int RedY, typename Pixels>
+void debayerSuperpixels(const Pixels& pixels, long long width, long long height, int factor, T* out, long long firstRow, long long lastRow)
+{
+    const long long outWidth = width / 2 / factor;
+    const long long outHeight = height / 2 / factor;
+    const long long size = outWidth * outHeight;
+    T* red = out;
+    T* green = out + size;
+    T* blue = out + 2 * size;
+
+    if (factor == 1)
+    {
+        for (long long y = firstRow; y < lastRow; y++)
+        {
+            const long long redRow = (2 * y + RedY) * width + RedX;
+            const long long blueRow = (2 * y + 1 - RedY) * width + 1 - RedX;
+            const long long greenRow1 = (2 * y + RedY) * width + 1 - RedX;
+            const long long greenRow2 = (2 * y + 1 - RedY) * width + RedX;
+            T* redIt = red + y * outWidth;
+            T* greenIt = green + y * outWidth;
+            T* blueIt = blue + y * outWidth;
+            for (long long x = 0; x < outWidth; x++)
+            {
+                redIt[x]   = pixels(redRow + 2 * x);
+                greenIt[x] = T((PixelSum<T>(pixels(greenRow1 + 2 * x)) + pixels(greenRow2 + 2 * x)) / 2);
+                blueIt[x]  = pixels(blueRow + 2 * x);
+            }
+        }
+        return;
+    }
+
+    const long long cells = (long long)factor * factor;
+    std::vector<PixelSum<T>> redSums(outWidth);
+    std::vector<PixelSum<T>> greenSums(outWidth);
+    std::vector<PixelSum<T>> blueSums(outWidth);
+
+    for (long long y = firstRow; y < lastRow; y++)
+    {
+        std::fill(redSums.begin(), redSums.end(), 0);
+        std::fill(greenSums.begin(), greenSums.end(), 0);
+        std::fill(blueSums.begin(), blueSums.end(), 0);
+        for (long long i = y * factor; i < (y + 1) * factor; i++)
+        {
+            const long long redRow = (2 * i + RedY) * width + RedX;
+            const long long blueRow = (2 * i + 1 - RedY) * width + 1 - RedX;
+            const long long greenRow1 = (2 * i + RedY) * width + 1 - RedX;
+            const long long greenRow2 = (2 * i + 1 - RedY) * width + RedX;
+            for (long long j = 0; j < outWidth * factor; j++)
+            {
+                redSums[j / factor]   += pixels(redRow + 2 * j);
+                greenSums[j / factor] += PixelSum<T>(pixels(greenRow1 + 2 * j)) + pixels(greenRow2 + 2 * j);
+                blueSums[j / factor]  += pixels(blueRow + 2 * j);
+            }
+        }
+        for (long long x = 0; x < outWidth; x++)
+        {
+            red[y * outWidth + x]   = T(redSums[x] / cells);
+            green[y * outWidth + x] = T(greenSums[x] / (2 * cells));
+            blue[y * outWidth + x]  = T(blueSums[x] / cells);
+        }
+    }
+}
+
+// Mirrors an index that is one past either edge back into [0, n). Keeps the parity, so
+// the mirrored pixel has the same color in the CFA.
+inline long long mirrorIndex(long long i, long long n)
+{
+    return i < 0 ? -i : (i >= n ? 2 * (n - 1) - i : i);
+}
+
+/*!
+ * \brief demosaicBilinear
+ * Full resolution demosaic: the two missing colors of each pixel are the average of
+ * the nearest pixels of that color (two or four of them). Writes three planes of
+ * width x height pixels into out, for the rows [firstRow, lastRow). The frame must
+ * be at least 2x2.
+ *
+ * The neighbours of the edge pixels are mirrored back into the frame.
+ */
+template <typename T, int RedX, int RedY, typename Pixels>
+void demosaicBilinear(const Pixels& pixels, long long width, long long height, T* out, long long firstRow, long long lastRow)
+{
+    const long long size = width * height;
+    T* red = out;
+    T* green = out + size;
+    T* blue = out + 2 * size;
+
+    auto average2 = [&](long long a, long long b) -> T
+    {
+        return T((PixelSum<T>(pixels(a)) + pixels(b)) / 2);
+    };
+    auto average4 = [&](long long a, long long b, long long c, long long d) -> T
+    {
+        return T((PixelSum<T>(pixels(a)) + pixels(b) + pixels(c) + pixels(d)) / 4);
+    };
+
+    for (long long y = firstRow; y < lastRow; y++)
+    {
+        const long long up = mirrorIndex(y - 1, height) * width;
+        const long long row = y * width;
+        const long long down = mirrorIndex(y + 1, height) * width;
+        const bool redRow = (y & 1) == RedY;
+
+        // Interpolates the pixel at x, with its left and right neighbours at l and r
+        auto site = [&](long long x, long long l, long long r)
+        {
+            const long long i = row + x;
+            const bool redColumn = (x & 1) == RedX;
+            if (redRow == redColumn)
+            {
+                // Red or blue site, green on the cross and the other color on the diagonals
+                green[i] = average4(up + x, down + x, row + l, row + r);
+                (redRow ? red : blue)[i] = pixels(i);
+                (redRow ? blue : red)[i] = average4(up + l, up + r, down + l, down + r);
+            }
+            else
+            {
+                // Green site, between the red and the blue pixels of its row and column
+                green[i] = pixels(i);
+                (redRow ? red : blue)[i] = average2(row + l, row + r);
+                (redRow ? blue : red)[i] = average2(up + x, down + x);
+            }
+        };
+
+        site(0, 1, 1);
+        for (long long x = 1; x < width - 1; x++)
+            site(x, x - 1, x + 1);
+        site(width - 1, width - 2, width - 2);
+    }
+}
+
+// A value interpolated in float, clamped to the range of T
+template <typename T>
+inline T clampedSample(float value)
+{
+    if constexpr (std::is_floating_point<T>::value)
+        return T(value);
+    else
+        return T(std::clamp(std::round(value), float(std::numeric_limits<T>::lowest()), float(std::numeric_limits<T>::max())));
+}
+
+// The pixel at (DX, DY) from column x of the middle one of five rows
+template <int DX, int DY>
+inline float vngAt(const float* const* rows, long long x)
+{
+    return rows[DY + 2][x + DX];
+}
+
+/*!
+ * \brief vngGradient
+ * The gradient towards (DX, DY), one of the eight directions: the differences along
+ * it of the pixels two apart, which have the same color, with half of the ones of
+ * the neighbouring lines.
+ */
+template <int DX, int DY>
+inline float vngGradient(const float* const* rows, long long x)
+{
+    float gradient = std::abs(vngAt<DX, DY>(rows, x) - vngAt<-DX, -DY>(rows, x)) + std::abs(vngAt<2 * DX, 2 * DY>(rows, x) - vngAt<0, 0>(rows, x));
+    if constexpr (DX == 0 || DY == 0)
+    {
+        // The lines on both sides
+        constexpr int PX = DY;
+        constexpr int PY = DX;
+        gradient += 0.5f * (std::abs(vngAt<DX + PX, DY + PY>(rows, x) - vngAt<PX - DX, PY - DY>(rows, x))
+                            + std::abs(vngAt<DX - PX, DY - PY>(rows, x) - vngAt<-PX - DX, -PY - DY>(rows, x))
+                            + std::abs(vngAt<2 * DX + PX, 2 * DY + PY>(rows, x) - vngAt<PX, PY>(rows, x))
+                            + std::abs(vngAt<2 * DX - PX, 2 * DY - PY>(rows, x) - vngAt<-PX, -PY>(rows, x)));
+    }
+    else
+    {
+        gradient += 0.5f * (std::abs(vngAt<0, DY>(rows, x) - vngAt<-2 * DX, -DY>(rows, x))
+                            + std::abs(vngAt<DX, 0>(rows, x) - vngAt<-DX, -2 * DY>(rows, x)));
+    }
+    return gradient;
+}
+
+// The sums of the colors of the directions of a pixel of VNG, for its two kinds of sites
+struct VngSums
+{
+    float count = 0;
+    // Of a red or blue site: its color, the opposite one and green
+    float own = 0;
+    float opposite = 0;
+    float green = 0;
+    // Of a green site: green, the color of its row and the one of its column
+    float greenOwn = 0;
+    float horizontal = 0;
+    float vertical = 0;
+};
+
+/*!
+ * \brief addVngDirection
+ * Adds the mean colors of the pixels on the side of (DX, DY) of the pixel at x to its
+ * sums, times weight, 1 when its gradient towards it is within the threshold and 0
+ * otherwise: a 3x3 block towards an axis, seven pixels towards a diagonal. The pixels
+ * are summed by the parity of their offset, which makes them the same color for every
+ * site, so a row has no branch on the pattern and is vectorized.
+ */
+template <int DX, int DY>
+inline void addVngDirection(const float* const* rows, long long x, float weight, VngSums& sums)
+{
+    // The number of pixels of each parity: even, odd column, odd row, both odd
+    constexpr float evenCount = 2;
+    constexpr float columnCount = DX == 0 ? 4 : (DY == 0 ? 1 : 2);
+    constexpr float rowCount = DY == 0 ? 4 : (DX == 0 ? 1 : 2);
+    constexpr float oddCount = DX == 0 || DY == 0 ? 2 : 1;
+
+    float even;
+    float column;
+    float row;
+    float odd;
+    if constexpr (DX == 0)
+    {
+        even = vngAt<0, 0>(rows, x) + vngAt<0, 2 * DY>(rows, x);
+        column = vngAt<-1, 0>(rows, x) + vngAt<1, 0>(rows, x) + vngAt<-1, 2 * DY>(rows, x) + vngAt<1, 2 * DY>(rows, x);
+        row = vngAt<0, DY>(rows, x);
+        odd = vngAt<-1, DY>(rows, x) + vngAt<1, DY>(rows, x);
+    }
+    else if constexpr (DY == 0)
+    {
+        even = vngAt<0, 0>(rows, x) + vngAt<2 * DX, 0>(rows, x);
+        column = vngAt<DX, 0>(rows, x);
+        row = vngAt<0, -1>(rows, x) + vngAt<0, 1>(rows, x) + vngAt<2 * DX, -1>(rows, x) + vngAt<2 * DX, 1>(rows, x);
+        odd = vngAt<DX, -1>(rows, x) + vngAt<DX, 1>(rows, x);
+    }
+    else
+    {
+        even = vngAt<0, 0>(rows, x) + vngAt<2 * DX, 2 * DY>(rows, x);
+        column = vngAt<DX, 0>(rows, x) + vngAt<DX, 2 * DY>(rows, x);
+        row = vngAt<0, DY>(rows, x) + vngAt<2 * DX, DY>(rows, x);
+        odd = vngAt<DX, DY>(rows, x);
+    }
+    sums.count += weight;
+    sums.own += weight * even / evenCount;
+    sums.opposite += weight * odd / oddCount;
+    sums.green += weight * (column + row) / (columnCount + rowCount);
+    sums.greenOwn += weight * (even + odd) / (evenCount + oddCount);
+    sums.horizontal += weight * column / columnCount;
+    sums.vertical += weight * row / rowCount;
+}
+
+/*!
+ * \brief demosaicVng
+ * Full resolution demosaic by variable number of gradients (Chang, Cheung and Pang): the
+ * gradient of the 5x5 neighbourhood of each pixel is measured in eight directions from
+ * differences of pixels of the same color, and the missing colors are interpolated from
+ * the directions whose gradient is below a threshold only, so edges and stars are not
+ * smeared across. Writes three planes of width x height pixels into out, for the rows
+ * [firstRow, lastRow). The frame must be at least 3x3.
+ *
+ * The rows of the band and two on each side are read once, as floats with two mirrored
+ * pixels past each edge and padded to whole chunks. The gradients, the weights of the
+ * directions and their sums are then computed VNG_CHUNK_PIXELS of a row at a time, by
+ * loops of a constant count without branches that the compiler vectorizes, even at -O2.
+ * The weights are kept in memory rather than compared again, as the compiler would turn
+ * a multiply by a compared weight back into a branch. Only the last loop tells the
+ * sites apart.
+ */
+template <typename T, int RedX, int RedY, typename Pixels>
+void demosaicVng(const Pixels& pixels, long long width, long long height, T* out, long long firstRow, long long lastRow)
+{
+    const long long size = width * height;
+    const long long chunks = (width + VNG_CHUNK_PIXELS - 1) / VNG_CHUNK_PIXELS;
+    const long long stride = chunks * VNG_CHUNK_PIXELS + 4;
+    std::vector<float> band((lastRow - firstRow + 4) * stride);
+    for (long long y = firstRow - 2; y < lastRow + 2; y++)
+    {
+        const long long source = mirrorIndex(y, height) * width;
+        float* line = band.data() + (y - firstRow + 2) * stride + 2;
+        for (long long x = 0; x < width; x++)
+            line[x] = float(pixels(source + x));
+        line[-1] = line[1];
+        line[-2] = line[2];
+        line[width] = line[width - 2];
+        line[width + 1] = line[width - 3];
+    }
+
+    for (long long y = firstRow; y < lastRow; y++)
+    {
+        const float* rows[5];
+        for (int i = 0; i < 5; i++)
+            rows[i] = band.data() + (y - firstRow + i) * stride + 2;
+        const bool redRow = (y & 1) == RedY;
+        T* rowColors[3] = {out + y * width, out + size + y * width, out + 2 * size + y * width};
+        T* rowColor = rowColors[redRow ? 0 : 2];
+        T* columnColor = rowColors[redRow ? 2 : 0];
+
+        for (long long x0 = 0; x0 < width; x0 += VNG_CHUNK_PIXELS)
+        {
+            float weights[8][VNG_CHUNK_PIXELS];
+            for (int i = 0; i < VNG_CHUNK_PIXELS; i++)
+            {
+                const long long x = x0 + i;
+                weights[0][i] = vngGradient<0, -1>(rows, x);
+                weights[1][i] = vngGradient<0, 1>(rows, x);
+                weights[2][i] = vngGradient<-1, 0>(rows, x);
+                weights[3][i] = vngGradient<1, 0>(rows, x);
+                weights[4][i] = vngGradient<-1, -1>(rows, x);
+                weights[5][i] = vngGradient<1, -1>(rows, x);
+                weights[6][i] = vngGradient<-1, 1>(rows, x);
+                weights[7][i] = vngGradient<1, 1>(rows, x);
+            }
+            // The gradients within the threshold, by direction so the loops are not nested
+            float minimum[VNG_CHUNK_PIXELS];
+            float maximum[VNG_CHUNK_PIXELS];
+            for (int i = 0; i < VNG_CHUNK_PIXELS; i++)
+                minimum[i] = maximum[i] = weights[0][i];
+            for (int d = 1; d < 8; d++)
+            {
+                for (int i = 0; i < VNG_CHUNK_PIXELS; i++)
+                {
+                    minimum[i] = std::min(minimum[i], weights[d][i]);
+                    maximum[i] = std::max(maximum[i], weights[d][i]);
+                }
+            }
+            for (int i = 0; i < VNG_CHUNK_PIXELS; i++)
+                minimum[i] = 1.5f * minimum[i] + 0.5f * (maximum[i] - minimum[i]);
+            for (int d = 0; d < 8; d++)
+            {
+                for (int i = 0; i < VNG_CHUNK_PIXELS; i++)
+                    weights[d][i] = weights[d][i] <= minimum[i] ? 1.0f : 0.0f;
+            }
+
+            // The differences of the missing colors from the one of the pixel, for either site
+            float differences[4][VNG_CHUNK_PIXELS];
+            for (int i = 0; i < VNG_CHUNK_PIXELS; i++)
+            {
+                const long long x = x0 + i;
+                VngSums sums;
+                addVngDirection<0, -1>(rows, x, weights[0][i], sums);
+                addVngDirection<0, 1>(rows, x, weights[1][i], sums);
+                addVngDirection<-1, 0>(rows, x, weights[2][i], sums);
+                addVngDirection<1, 0>(rows, x, weights[3][i], sums);
+                addVngDirection<-1, -1>(rows, x, weights[4][i], sums);
+                addVngDirection<1, -1>(rows, x, weights[5][i], sums);
+                addVngDirection<-1, 1>(rows, x, weights[6][i], sums);
+                addVngDirection<1, 1>(rows, x, weights[7][i], sums);
+                differences[0][i] = (sums.opposite - sums.own) / sums.count;
+                differences[1][i] = (sums.green - sums.own) / sums.count;
+                differences[2][i] = (sums.horizontal - sums.greenOwn) / sums.count;
+                differences[3][i] = (sums.vertical - sums.greenOwn) / sums.count;
+            }
+
+            // The missing colors differ from the pixel as their means differ from the mean of its color
+            const int count = int(std::min<long long>(VNG_CHUNK_PIXELS, width - x0));
+            for (int i = 0; i < count; i++)
+            {
+                const long long x = x0 + i;
+                const float value = rows[2][x];
+                if (((x & 1) == RedX) == redRow)
+                {
+                    rowColor[x] = pixels(y * width + x);
+                    columnColor[x] = clampedSample<T>(value + differences[0][i]);
+                    rowColors[1][x] = clampedSample<T>(value + differences[1][i]);
+                }
+                else
+                {
+                    rowColors[1][x] = pixels(y * width + x);
+                    rowColor[x] = clampedSample<T>(value + differences[2][i]);
+                    columnColor[x] = clampedSample<T>(value + differences[3][i]);
+                }
+            }
+        }
+    }
+}
+
+template <typename T, int RedX, int RedY, typename Pixels>
+void demosaicPattern(DemosaicMethod method, const Pixels& pixels, long long width, long long height, int factor, T* out, bool parallel, const CancellationToken& token)
+{
+    long long rows = method == DemosaicSuperpixel ? height / 2 / factor : height;
+    // Too small for the neighbourhood of VNG
+    if (method == DemosaicVng && (width < 3 || height < 3))
+        method = DemosaicBilinear;
+    auto runBand = [&](long long firstRow)
+    {
+        if (token.isCanceled())
+            return;
+        long long lastRow = qMin(firstRow + DEMOSAIC_BAND_ROWS, rows);
+        if (method == DemosaicSuperpixel)
+            debayerSuperpixels<T, RedX, RedY>(pixels, width, height, factor, out, firstRow, lastRow);
+        else if (method == DemosaicVng)
+            demosaicVng<T, RedX, RedY>(pixels, width, height, out, firstRow, lastRow);
+        else
+            demosaicBilinear<T, RedX, RedY>(pixels, width, height, out, firstRow, lastRow);
+    };
+
+    if (!parallel || rows <= DEMOSAIC_BAND_ROWS)
+    {
+        for (long long firstRow = 0; firstRow < rows; firstRow += DEMOSAIC_BAND_ROWS)
+            runBand(firstRow);
+        return;
+    }
+
+    QList<long long> bands;
+    for (long long firstRow = 0; firstRow < rows; firstRow += DEMOSAIC_BAND_ROWS)
+        bands.append(firstRow);
+    QtConcurrent::blockingMap(bands, runBand);
+}
+
+inline long long demosaicedWidth(DemosaicMethod method, long long width, int factor)
+{
+    return method == DemosaicSuperpixel ? width / 2 / factor : width;
+}
+
+inline long long demosaicedHeight(DemosaicMethod method, long long height, int factor)
+{
+    return method == DemosaicSuperpixel ? height / 2 / factor : height;
+}
+
+/*!
+ * \brief demosaic
+ * Demosaics a bayer frame of width x height pixels into three planes in out, each of
+ * demosaicedWidth x demosaicedHeight pixels. The superpixel method is averaged over
+ * factor x factor cells, the bilinear and VNG methods ignore factor.
+ *
+ * With parallel, the rows are split into bands that run on the global thread pool.
+ * Thumbnails are not done in parallel, many files are processed at the same time already.
+ * Once the token is canceled the remaining bands are skipped, and out is left incomplete.
+ */
+template <typename T, typename Pixels>
+void demosaic(DemosaicMethod method, BayerPattern pattern, const Pixels& pixels, long long width, long long height, int factor, T* out, bool parallel = false,
+              const CancellationToken& token = CancellationToken())
+{
+    switch (pattern)
+    {
+    case RGGB:
+        demosaicPattern<T, 0, 0>(method, pixels, width, height, factor, out, parallel, token);
+        break;
+    case BGGR:
+        demosaicPattern<T, 1, 1>(method, pixels, width, height, factor, out, parallel, token);
+        break;
+    case GRBG:
+        demosaicPattern<T, 1, 0>(method, pixels, width, height, factor, out, parallel, token);
+        break;
+    case GBRG:
+        demosaicPattern<T, 0, 1>(method, pixels, width, height, factor, out, parallel, token);
+        break;
+    default:
+        break;
+    }
+}
+
+#endif // DEBAYER_H
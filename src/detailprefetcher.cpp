@@ -0,0 +1,130 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "detailprefetcher.h"
+#include "catalog.h"
+#include "filerepository.h"
+#include "sortfilterproxymodel.h"
+#include "tagdetailscache.h"
+
+// Rows loaded on each side of the focused one
+#define DETAIL_PREFETCH_NEIGHBORS 2
+// How long the cursor rests on a row before it is focused
+#define DETAIL_HOVER_MSECS 80
+// Preview images kept, about 1 MB each
+#define DETAIL_PREVIEW_CACHE_SIZE 16
+// Preview images loaded at once
+#define DETAIL_PREFETCH_THREADS 2
+
+DetailPrefetcher::DetailPrefetcher(FileRepository *repository, Catalog *catalog, SortFilterProxyModel *model, TagDetailsCache *tagDetailsCache, QObject *parent)
+    : QObject(parent), repository(repository), catalog(catalog), model(model), tagDetailsCache(tagDetailsCache), previews(DETAIL_PREVIEW_CACHE_SIZE)
+{
+    hoverTimer.setSingleShot(true);
+    hoverTimer.setInterval(DETAIL_HOVER_MSECS);
+    connect(&hoverTimer, &QTimer::timeout, this, &DetailPrefetcher::prefetch);
+    pool.setMaxThreadCount(DETAIL_PREFETCH_THREADS);
+}
+
+DetailPrefetcher::~DetailPrefetcher()
+{
+    generation++;
+    pool.clear();
+    pool.waitForDone();
+}
+
+void DetailPrefetcher::setHovered(const QModelIndex &index)
+{
+    if (!index.isValid() || index == focus)
+        return;
+    focus = index;
+    hoverTimer.start();
+}
+
+void DetailPrefetcher::setCurrent(const QModelIndex &index)
+{
+    if (!index.isValid() || (index == focus && !hoverTimer.isActive()))
+        return;
+    focus = index;
+    hoverTimer.stop();
+    prefetch();
+}
+
+QImage DetailPrefetcher::previewImage(int id) const
+{
+    const QImage* image = previews.object(id);
+    return image != nullptr ? *image : QImage();
+}
+
+/*!
+ * \brief DetailPrefetcher::prefetch
+ * Only FITS files have a preview. The loads of the previews that did not start are
+ * dropped, and the ones that did are kept when they are done.
+ */
+void DetailPrefetcher::prefetch()
+{
+    if (!focus.isValid())
+        return;
+
+    pool.clear();
+    loadingPreviews.clear();
+    const quint64 loadGeneration = ++generation;
+
+    QVector<int> ids;
+    const int row = focus.row();
+    for (int distance = 0; distance <= DETAIL_PREFETCH_NEIGHBORS; distance++)
+    {
+        for (int neighbor : {row + distance, row - distance})
+        {
+            if (neighbor < 0 || neighbor >= model->rowCount() || (distance == 0 && !ids.isEmpty()))
+                continue;
+            const QModelIndex sourceIndex = model->mapToSource(model->index(neighbor, 0));
+            const AstroFile* astroFile = sourceIndex.isValid() ? catalog->getAstroFile(sourceIndex.row()) : nullptr;
+            if (astroFile == nullptr)
+                continue;
+            const int id = astroFile->Id;
+            ids.append(id);
+            if (astroFile->FileType != AstroFileType::Fits || astroFile->thumbnailStatus != ThumbnailLoaded
+                    || previews.contains(id) || loadingPreviews.contains(id))
+                continue;
+            loadingPreviews.insert(id);
+            pool.start([this, id, loadGeneration]() { loadPreview(id, loadGeneration); }, DETAIL_PREFETCH_NEIGHBORS - distance);
+        }
+    }
+    tagDetailsCache->prefetch(ids);
+}
+
+// Runs on the pool
+void DetailPrefetcher::loadPreview(int id, quint64 loadGeneration)
+{
+    if (loadGeneration != generation)
+        return;
+    const ThumbnailBatch batch = repository->readThumbnails({id}, THUMBNAIL_LEVEL_COUNT - 1);
+    if (batch.images.isEmpty() || batch.images.first().isNull())
+        return;
+    const QImage image = batch.images.first();
+    QMetaObject::invokeMethod(this, [this, id, image]() {
+        loadingPreviews.remove(id);
+        previews.insert(id, new QImage(image));
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,84 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef DETAILPREFETCHER_H
+#define DETAILPREFETCHER_H
+
+#include "taskscheduler.h"
+
+#include <QCache>
+#include <QImage>
+#include <QObject>
+#include <QPersistentModelIndex>
+#include <QSet>
+#include <QTimer>
+
+#include <atomic>
+
+class Catalog;
+class FileRepository;
+class SortFilterProxyModel;
+class TagDetailsCache;
+
+/*!
+ * \brief The DetailPrefetcher class
+ * Loads what the details and the preview of a file show before it is selected: its
+ * keywords, into the TagDetailsCache, and the largest level of its thumbnail pyramid,
+ * which the preview shows until its own image is rendered.
+ *
+ * The focus is the row under the cursor, or the current or selected one. The focused
+ * row and DETAIL_PREFETCH_NEIGHBORS rows on each side of it in the order of the view
+ * are loaded, nearest first. A new focus drops the loads that did not start yet. The
+ * hovered row is only focused once the cursor rests on it.
+ * Only used from the GUI thread.
+ */
+class DetailPrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    DetailPrefetcher(FileRepository* repository, Catalog* catalog, SortFilterProxyModel* model, TagDetailsCache* tagDetailsCache, QObject *parent = nullptr);
+    ~DetailPrefetcher();
+
+    void setHovered(const QModelIndex& index);
+    void setCurrent(const QModelIndex& index);
+    // The prefetched image of the file, null when there is none
+    QImage previewImage(int id) const;
+
+private:
+    FileRepository* repository;
+    Catalog* catalog;
+    SortFilterProxyModel* model;
+    TagDetailsCache* tagDetailsCache;
+    QPersistentModelIndex focus;
+    QTimer hoverTimer;
+    QCache<int, QImage> previews;
+    QSet<int> loadingPreviews;
+    TaskGroup pool {InteractivePriority};
+    std::atomic<quint64> generation {0}; // Of the focus, loads of an older one are dropped
+
+    void prefetch();
+    void loadPreview(int id, quint64 loadGeneration);
+};
+
+#endif // DETAILPREFETCHER_H
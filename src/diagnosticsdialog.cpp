@@ -0,0 +1,258 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "diagnosticsdialog.h"
+#include "allocationtracker.h"
+#include "filerepository.h"
+#include "memorybudget.h"
+#include "metrics.h"
+#include "pixelkernels.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileDialog>
+#include <QHeaderView>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLabel>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTabWidget>
+#include <QVBoxLayout>
+
+#define DIAGNOSTICS_REFRESH_INTERVAL_MS 1000
+
+// The ingest runs shown, the newest first
+#define INGEST_RUNS_SHOWN 200
+
+static QTableWidget* createTable(const QStringList& headers)
+{
+    QTableWidget* table = new QTableWidget(0, headers.count());
+    table->setHorizontalHeaderLabels(headers);
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    table->setSelectionMode(QAbstractItemView::NoSelection);
+    table->verticalHeader()->hide();
+    table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    return table;
+}
+
+DiagnosticsDialog::DiagnosticsDialog(QWidget *parent) : QDialog(parent)
+{
+    setWindowTitle(tr("Diagnostics"));
+    resize(640, 480);
+
+    counterTable = createTable({tr("Counter"), tr("Value")});
+    histogramTable = createTable({tr("Stage"), tr("Count"), tr("Mean (ms)"), tr("p50 (ms)"), tr("p90 (ms)"), tr("p99 (ms)"), tr("Max (ms)")});
+    memoryTable = createTable({tr("Memory"), tr("MB"), tr("Evicted under pressure")});
+    memoryLabel = new QLabel;
+    allocationTable = createTable({tr("Scope"), tr("Allocations"), tr("MB"), tr("Per call"), tr("Per file")});
+    ingestRunsTable = createTable({tr("Started"), tr("Duration (s)"), tr("Files"), tr("MB"), tr("Files/s"), tr("MB/s"),
+                                   tr("Failed"), tr("Peak RSS (MB)"), tr("Threads")});
+    ingestRunsTable->setSelectionMode(QAbstractItemView::SingleSelection);
+    ingestRunsTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    ingestStagesTable = createTable({tr("Stage"), tr("Count"), tr("Total (s)"), tr("Mean (ms)"), tr("p50 (ms)"), tr("p90 (ms)"),
+                                     tr("p99 (ms)"), tr("Max (ms)")});
+    connect(ingestRunsTable, &QTableWidget::itemSelectionChanged, this, &DiagnosticsDialog::showIngestRunStages);
+
+    QWidget* livePage = new QWidget;
+    QVBoxLayout* liveLayout = new QVBoxLayout(livePage);
+    liveLayout->addWidget(new QLabel(tr("Latencies")));
+    liveLayout->addWidget(histogramTable, 2);
+    liveLayout->addWidget(new QLabel(tr("Counters")));
+    liveLayout->addWidget(counterTable, 1);
+    if (AllocationTracker::isEnabled())
+    {
+        liveLayout->addWidget(new QLabel(tr("Allocations")));
+        liveLayout->addWidget(allocationTable, 1);
+    }
+    liveLayout->addWidget(memoryLabel);
+    liveLayout->addWidget(memoryTable, 1);
+    liveLayout->addWidget(new QLabel(tr("Pixel kernels: %1").arg(PixelKernels::levelName(PixelKernels::level()))));
+
+    QPushButton* exportButton = new QPushButton(tr("Export..."));
+    connect(exportButton, &QPushButton::clicked, this, &DiagnosticsDialog::exportIngestRuns);
+    QWidget* ingestPage = new QWidget;
+    QVBoxLayout* ingestLayout = new QVBoxLayout(ingestPage);
+    ingestLayout->addWidget(ingestRunsTable, 2);
+    ingestLayout->addWidget(new QLabel(tr("Stages of the selected ingest")));
+    ingestLayout->addWidget(ingestStagesTable, 1);
+    ingestLayout->addWidget(exportButton, 0, Qt::AlignRight);
+
+    QTabWidget* tabs = new QTabWidget;
+    tabs->addTab(livePage, tr("Now"));
+    tabs->addTab(ingestPage, tr("Ingest runs"));
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(tabs);
+
+    refreshTimer.setInterval(DIAGNOSTICS_REFRESH_INTERVAL_MS);
+    connect(&refreshTimer, &QTimer::timeout, this, &DiagnosticsDialog::refresh);
+}
+
+void DiagnosticsDialog::showEvent(QShowEvent *event)
+{
+    QDialog::showEvent(event);
+    refresh();
+    loadIngestRuns();
+    refreshTimer.start();
+}
+
+void DiagnosticsDialog::hideEvent(QHideEvent *event)
+{
+    refreshTimer.stop();
+    QDialog::hideEvent(event);
+}
+
+void DiagnosticsDialog::refresh()
+{
+    const QJsonObject json = Metrics::toJson();
+    auto milliseconds = [](const QJsonValue& micros) { return QString::number(micros.toDouble() / 1000, 'f', 2); };
+
+    const QJsonObject counters = json.value("counters").toObject();
+    counterTable->setRowCount(counters.count());
+    int row = 0;
+    for (auto iter = counters.constBegin(); iter != counters.constEnd(); ++iter, row++)
+    {
+        counterTable->setItem(row, 0, new QTableWidgetItem(iter.key()));
+        counterTable->setItem(row, 1, new QTableWidgetItem(QString::number(iter.value().toInteger())));
+    }
+
+    const QJsonObject histograms = json.value("histograms").toObject();
+    histogramTable->setRowCount(histograms.count());
+    row = 0;
+    for (auto iter = histograms.constBegin(); iter != histograms.constEnd(); ++iter, row++)
+    {
+        const QJsonObject summary = iter.value().toObject();
+        histogramTable->setItem(row, 0, new QTableWidgetItem(iter.key()));
+        histogramTable->setItem(row, 1, new QTableWidgetItem(QString::number(summary.value("count").toInteger())));
+        histogramTable->setItem(row, 2, new QTableWidgetItem(milliseconds(summary.value("mean_us"))));
+        histogramTable->setItem(row, 3, new QTableWidgetItem(milliseconds(summary.value("p50_us"))));
+        histogramTable->setItem(row, 4, new QTableWidgetItem(milliseconds(summary.value("p90_us"))));
+        histogramTable->setItem(row, 5, new QTableWidgetItem(milliseconds(summary.value("p99_us"))));
+        histogramTable->setItem(row, 6, new QTableWidgetItem(milliseconds(summary.value("max_us"))));
+    }
+
+    auto megabytes = [](qint64 bytes) { return QString::number(bytes / (1024.0 * 1024.0), 'f', 1); };
+
+    // Per file of the files written, as every file goes through each stage about once
+    const QJsonObject allocations = json.value("allocations").toObject();
+    const qint64 files = counters.value("repository.files_written").toInteger();
+    allocationTable->setRowCount(allocations.count());
+    row = 0;
+    for (auto iter = allocations.constBegin(); iter != allocations.constEnd(); ++iter, row++)
+    {
+        const QJsonObject summary = iter.value().toObject();
+        const qint64 count = summary.value("allocations").toInteger();
+        const qint64 entries = summary.value("entries").toInteger();
+        allocationTable->setItem(row, 0, new QTableWidgetItem(iter.key()));
+        allocationTable->setItem(row, 1, new QTableWidgetItem(QString::number(count)));
+        allocationTable->setItem(row, 2, new QTableWidgetItem(megabytes(summary.value("bytes").toInteger())));
+        allocationTable->setItem(row, 3, new QTableWidgetItem(entries > 0 ? QString::number(double(count) / entries, 'f', 1) : QString()));
+        allocationTable->setItem(row, 4, new QTableWidgetItem(files > 0 ? QString::number(double(count) / files, 'f', 1) : QString()));
+    }
+
+    const QList<MemoryBudget::Usage> usages = MemoryBudget::usage();
+    qint64 total = 0;
+    memoryTable->setRowCount(usages.count());
+    row = 0;
+    for (auto& usage : usages)
+    {
+        memoryTable->setItem(row, 0, new QTableWidgetItem(usage.name));
+        memoryTable->setItem(row, 1, new QTableWidgetItem(megabytes(usage.bytes)));
+        memoryTable->setItem(row, 2, new QTableWidgetItem(usage.evictable ? tr("Yes") : tr("No")));
+        total += usage.bytes;
+        row++;
+    }
+    memoryLabel->setText(tr("Memory: %1 of %2 MB").arg(megabytes(total), megabytes(MemoryBudget::budget())));
+}
+
+void DiagnosticsDialog::loadIngestRuns()
+{
+    auto megabytes = [](const QJsonValue& bytes) { return QString::number(bytes.toDouble() / (1024.0 * 1024.0), 'f', 1); };
+
+    ingestRuns = FileRepository::ingestRuns(INGEST_RUNS_SHOWN);
+    ingestRunsTable->setRowCount(ingestRuns.count());
+    int row = 0;
+    for (auto& run : ingestRuns)
+    {
+        const QDateTime started = QDateTime::fromString(run.value("started_at").toString(), Qt::ISODate).toLocalTime();
+        ingestRunsTable->setItem(row, 0, new QTableWidgetItem(locale().toString(started, QLocale::ShortFormat)));
+        ingestRunsTable->setItem(row, 1, new QTableWidgetItem(QString::number(run.value("duration_ms").toDouble() / 1000, 'f', 1)));
+        ingestRunsTable->setItem(row, 2, new QTableWidgetItem(QString::number(run.value("files").toInteger())));
+        ingestRunsTable->setItem(row, 3, new QTableWidgetItem(megabytes(run.value("bytes"))));
+        ingestRunsTable->setItem(row, 4, new QTableWidgetItem(QString::number(run.value("files_per_second").toDouble(), 'f', 1)));
+        ingestRunsTable->setItem(row, 5, new QTableWidgetItem(QString::number(run.value("mb_per_second").toDouble(), 'f', 1)));
+        ingestRunsTable->setItem(row, 6, new QTableWidgetItem(QString::number(run.value("failed_files").toInteger())));
+        ingestRunsTable->setItem(row, 7, new QTableWidgetItem(megabytes(run.value("peak_resident_bytes"))));
+        ingestRunsTable->setItem(row, 8, new QTableWidgetItem(QString::number(run.value("threads").toInteger())));
+        row++;
+    }
+    ingestStagesTable->setRowCount(0);
+}
+
+void DiagnosticsDialog::showIngestRunStages()
+{
+    const int row = ingestRunsTable->currentRow();
+    if (row < 0 || row >= ingestRuns.count())
+    {
+        ingestStagesTable->setRowCount(0);
+        return;
+    }
+
+    auto milliseconds = [](const QJsonValue& micros) { return QString::number(micros.toDouble() / 1000, 'f', 2); };
+    const QJsonObject stages = ingestRuns.at(row).value("stages").toObject();
+    ingestStagesTable->setRowCount(stages.count());
+    int stageRow = 0;
+    for (auto iter = stages.constBegin(); iter != stages.constEnd(); ++iter, stageRow++)
+    {
+        const QJsonObject summary = iter.value().toObject();
+        ingestStagesTable->setItem(stageRow, 0, new QTableWidgetItem(iter.key()));
+        ingestStagesTable->setItem(stageRow, 1, new QTableWidgetItem(QString::number(summary.value("count").toInteger())));
+        ingestStagesTable->setItem(stageRow, 2, new QTableWidgetItem(QString::number(summary.value("total_us").toDouble() / 1000000, 'f', 1)));
+        ingestStagesTable->setItem(stageRow, 3, new QTableWidgetItem(milliseconds(summary.value("mean_us"))));
+        ingestStagesTable->setItem(stageRow, 4, new QTableWidgetItem(milliseconds(summary.value("p50_us"))));
+        ingestStagesTable->setItem(stageRow, 5, new QTableWidgetItem(milliseconds(summary.value("p90_us"))));
+        ingestStagesTable->setItem(stageRow, 6, new QTableWidgetItem(milliseconds(summary.value("p99_us"))));
+        ingestStagesTable->setItem(stageRow, 7, new QTableWidgetItem(milliseconds(summary.value("max_us"))));
+    }
+}
+
+// The reports shown, as a JSON array, the newest first
+void DiagnosticsDialog::exportIngestRuns()
+{
+    const QString path = QFileDialog::getSaveFileName(this, tr("Export Ingest Runs"), "ingest-runs.json", tr("JSON (*.json)"));
+    if (path.isEmpty())
+        return;
+
+    QJsonArray runs;
+    for (auto& run : ingestRuns)
+        runs.append(run);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        QMessageBox::warning(this, tr("Export Ingest Runs"), tr("Could not write %1: %2").arg(path, file.errorString()));
+        return;
+    }
+    file.write(QJsonDocument(runs).toJson());
+}
@@ -0,0 +1,69 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef DIAGNOSTICSDIALOG_H
+#define DIAGNOSTICSDIALOG_H
+
+#include <QDialog>
+#include <QJsonObject>
+#include <QLabel>
+#include <QTableWidget>
+#include <QTimer>
+
+/*!
+ * \brief The DiagnosticsDialog class
+ * Shows the Metrics counters and latency histograms, the allocations per scope when
+ * built with allocation tracking, and the MemoryBudget, refreshed every second while open. A second tab has the reports of the last ingests from the
+ * db, with the stages of the selected one, and exports them as JSON.
+ */
+class DiagnosticsDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit DiagnosticsDialog(QWidget *parent = nullptr);
+
+protected:
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private slots:
+    void refresh();
+    void loadIngestRuns();
+    void showIngestRunStages();
+    void exportIngestRuns();
+
+private:
+    QTableWidget* counterTable;
+    QTableWidget* histogramTable;
+    QTableWidget* memoryTable;
+    QTableWidget* allocationTable;
+    QLabel* memoryLabel;
+    QTableWidget* ingestRunsTable;
+    QTableWidget* ingestStagesTable;
+    QList<QJsonObject> ingestRuns;
+    QTimer refreshTimer;
+};
+
+#endif // DIAGNOSTICSDIALOG_H
@@ -0,0 +1,445 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "directorywalker.h"
+#include "fileformats.h"
+#include "objectstore.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#elif defined(Q_OS_MAC)
+#include <fcntl.h>
+#include <sys/attr.h>
+#include <sys/vnode.h>
+#include <unistd.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+#include <cstring>
+
+// Directory entries fetched per call, a few hundred at a time
+#define DIRECTORY_READ_BUFFER_SIZE (64 * 1024)
+
+// The suffixes the FileFormats declare
+bool DirectoryWalker::isImageFileName(const QString &name)
+{
+    return FileFormats::isKnownFileName(name);
+}
+
+bool DirectoryWalker::list(const QString &directory, QVector<FileRecord> &files, QStringList &subDirectories)
+{
+    if (ObjectStore::isObjectPath(directory))
+        return ObjectStore::list(directory, files, subDirectories);
+
+    // One realpath for the directory, instead of one for each of its files
+    const QString canonicalDirectory = QFileInfo(directory).canonicalFilePath();
+    if (canonicalDirectory.isEmpty())
+        return false;
+
+    QVector<FileRecord> listedFiles;
+    QStringList listedDirectories;
+    if (!listNative(directory, canonicalDirectory, listedFiles, listedDirectories))
+    {
+        // File systems without the bulk call, and the platforms we have none for
+        listedFiles.clear();
+        listedDirectories.clear();
+        if (!listPortable(directory, canonicalDirectory, listedFiles, listedDirectories))
+            return false;
+    }
+    for (auto& record : listedFiles)
+    {
+        if (record.PathHash == 0)
+            record.PathHash = FileRecord::hashOf(record.FullPath);
+    }
+    files.append(listedFiles);
+    subDirectories.append(listedDirectories);
+    return true;
+}
+
+// A link is listed as the file it points to, in that file's directory
+static void appendLinkTarget(const QString& path, QVector<FileRecord>& files)
+{
+    const QFileInfo fileInfo(path);
+    if (fileInfo.isFile())
+        files.append(FileRecord::ofFileInfo(fileInfo));
+}
+
+bool DirectoryWalker::listPortable(const QString &directory, const QString &canonicalDirectory, QVector<FileRecord> &files, QStringList &subDirectories)
+{
+    QDirIterator it(directory, QDir::Files | QDir::AllDirs | QDir::NoDotAndDotDot);
+    while (it.hasNext())
+    {
+        it.next();
+        const QFileInfo fileInfo = it.fileInfo();
+        if (fileInfo.isDir())
+        {
+            if (!fileInfo.isSymLink())
+                subDirectories.append(fileInfo.filePath());
+            continue;
+        }
+        if (!isImageFileName(fileInfo.fileName()))
+            continue;
+        if (fileInfo.isSymLink())
+        {
+            appendLinkTarget(fileInfo.filePath(), files);
+            continue;
+        }
+        FileRecord record = FileRecord::ofFileInfo(fileInfo);
+        record.CanonicalDirectory = canonicalDirectory;
+        files.append(record);
+    }
+    return true;
+}
+
+#if defined(Q_OS_LINUX)
+
+// The record getdents64 fills, glibc has no declaration of it
+struct LinuxDirent64
+{
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+enum EntryKind
+{
+    EntryOther,
+    EntryFile,
+    EntryDirectory,
+    EntryLink
+};
+
+static EntryKind kindOfMode(mode_t mode)
+{
+    if (S_ISREG(mode))
+        return EntryFile;
+    if (S_ISDIR(mode))
+        return EntryDirectory;
+    if (S_ISLNK(mode))
+        return EntryLink;
+    return EntryOther;
+}
+
+// Does not follow links. Relative to the open directory, so the path is not walked again.
+static EntryKind statAt(int directoryFd, const char* name, FileRecord& record)
+{
+#ifdef STATX_BTIME
+    struct statx st;
+    if (statx(directoryFd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_BTIME | STATX_INO, &st) != 0)
+        return EntryOther;
+    record.Size = qint64(st.stx_size);
+    record.LastModifiedTime = qint64(st.stx_mtime.tv_sec) * 1000 + st.stx_mtime.tv_nsec / 1000000;
+    if (st.stx_mask & STATX_BTIME)
+        record.CreatedTime = qint64(st.stx_btime.tv_sec) * 1000 + st.stx_btime.tv_nsec / 1000000;
+    record.Device = makedev(st.stx_dev_major, st.stx_dev_minor);
+    record.Inode = st.stx_ino;
+    return kindOfMode(st.stx_mode);
+#else
+    struct stat st;
+    if (fstatat(directoryFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        return EntryOther;
+    record.Size = qint64(st.st_size);
+    record.LastModifiedTime = qint64(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+    record.Device = st.st_dev;
+    record.Inode = st.st_ino;
+    return kindOfMode(st.st_mode);
+#endif
+}
+
+/*!
+ * \brief DirectoryWalker::listNative
+ * getdents64 gives the name, type and inode of a few hundred entries per call. Only
+ * the image files are then stat'ed, relative to the directory handle.
+ */
+bool DirectoryWalker::listNative(const QString &directory, const QString &canonicalDirectory, QVector<FileRecord> &files, QStringList &subDirectories)
+{
+    const int directoryFd = ::open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd < 0)
+        return false;
+
+    const QString prefix = directory.endsWith('/') ? directory : directory + '/';
+    QByteArray buffer(DIRECTORY_READ_BUFFER_SIZE, Qt::Uninitialized);
+    bool ok = true;
+    for (;;)
+    {
+        const long count = syscall(SYS_getdents64, directoryFd, buffer.data(), buffer.size());
+        if (count <= 0)
+        {
+            ok = count == 0;
+            break;
+        }
+        for (long offset = 0; offset < count; )
+        {
+            const LinuxDirent64* entry = reinterpret_cast<const LinuxDirent64*>(buffer.constData() + offset);
+            offset += entry->d_reclen;
+
+            // Hidden entries, and . and ..
+            const char* name = entry->d_name;
+            if (name[0] == '.')
+                continue;
+
+            FileRecord record;
+            bool isStated = false;
+            EntryKind kind = EntryOther;
+            switch (entry->d_type)
+            {
+            case DT_REG: kind = EntryFile; break;
+            case DT_DIR: kind = EntryDirectory; break;
+            case DT_LNK: kind = EntryLink; break;
+            case DT_UNKNOWN:
+                // Some network and older file systems do not fill in the type
+                kind = statAt(directoryFd, name, record);
+                isStated = true;
+                break;
+            default:
+                break;
+            }
+
+            if (kind == EntryDirectory)
+            {
+                subDirectories.append(prefix + QFile::decodeName(name));
+                continue;
+            }
+            if (kind != EntryFile && kind != EntryLink)
+                continue;
+            const QString fileName = QFile::decodeName(name);
+            if (!isImageFileName(fileName))
+                continue;
+            if (kind == EntryLink)
+            {
+                appendLinkTarget(prefix + fileName, files);
+                continue;
+            }
+            // Replaced by a link or a directory since it was listed
+            if (!isStated && statAt(directoryFd, name, record) != EntryFile)
+                continue;
+            record.FullPath = prefix + fileName;
+            record.CanonicalDirectory = canonicalDirectory;
+            files.append(record);
+        }
+    }
+    ::close(directoryFd);
+    return ok;
+}
+
+#elif defined(Q_OS_MAC)
+
+static qint64 msecsOf(const struct timespec& time)
+{
+    return qint64(time.tv_sec) * 1000 + time.tv_nsec / 1000000;
+}
+
+template <typename T>
+static T readAttribute(const char*& field)
+{
+    T value;
+    memcpy(&value, field, sizeof(T));
+    field += sizeof(T);
+    return value;
+}
+
+/*!
+ * \brief DirectoryWalker::listNative
+ * getattrlistbulk returns the name, device, type, times, file id and size of many
+ * entries per call, so nothing is stat'ed on its own but links.
+ */
+bool DirectoryWalker::listNative(const QString &directory, const QString &canonicalDirectory, QVector<FileRecord> &files, QStringList &subDirectories)
+{
+    const int directoryFd = ::open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directoryFd < 0)
+        return false;
+
+    struct attrlist attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributes.commonattr = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_NAME | ATTR_CMN_ERROR | ATTR_CMN_DEVID | ATTR_CMN_OBJTYPE |
+            ATTR_CMN_CRTIME | ATTR_CMN_MODTIME | ATTR_CMN_FILEID;
+    attributes.fileattr = ATTR_FILE_DATALENGTH;
+
+    const QString prefix = directory.endsWith('/') ? directory : directory + '/';
+    QByteArray buffer(DIRECTORY_READ_BUFFER_SIZE, Qt::Uninitialized);
+    bool ok = true;
+    for (;;)
+    {
+        const int count = getattrlistbulk(directoryFd, &attributes, buffer.data(), buffer.size(), 0);
+        if (count <= 0)
+        {
+            ok = count == 0;
+            break;
+        }
+        const char* entry = buffer.constData();
+        for (int i = 0; i < count; i++)
+        {
+            // The attributes follow each other in the order of their bits, and only
+            // the ones in returned are there
+            const char* field = entry;
+            entry += readAttribute<quint32>(field);
+            const attribute_set_t returned = readAttribute<attribute_set_t>(field);
+            if ((returned.commonattr & ATTR_CMN_ERROR) && readAttribute<quint32>(field) != 0)
+                continue;
+            QString fileName;
+            if (returned.commonattr & ATTR_CMN_NAME)
+            {
+                const char* reference = field;
+                const attrreference_t name = readAttribute<attrreference_t>(field);
+                fileName = QFile::decodeName(reference + name.attr_dataoffset);
+            }
+            FileRecord record;
+            if (returned.commonattr & ATTR_CMN_DEVID)
+                record.Device = quint64(readAttribute<dev_t>(field));
+            fsobj_type_t type = VNON;
+            if (returned.commonattr & ATTR_CMN_OBJTYPE)
+                type = readAttribute<fsobj_type_t>(field);
+            if (returned.commonattr & ATTR_CMN_CRTIME)
+                record.CreatedTime = msecsOf(readAttribute<struct timespec>(field));
+            if (returned.commonattr & ATTR_CMN_MODTIME)
+                record.LastModifiedTime = msecsOf(readAttribute<struct timespec>(field));
+            if (returned.commonattr & ATTR_CMN_FILEID)
+                record.Inode = readAttribute<quint64>(field);
+            if (returned.fileattr & ATTR_FILE_DATALENGTH)
+                record.Size = readAttribute<off_t>(field);
+
+            if (fileName.isEmpty() || fileName.startsWith('.'))
+                continue;
+            if (type == VDIR)
+            {
+                subDirectories.append(prefix + fileName);
+                continue;
+            }
+            if ((type != VREG && type != VLNK) || !isImageFileName(fileName))
+                continue;
+            if (type == VLNK)
+            {
+                appendLinkTarget(prefix + fileName, files);
+                continue;
+            }
+            record.FullPath = prefix + fileName;
+            record.CanonicalDirectory = canonicalDirectory;
+            files.append(record);
+        }
+    }
+    ::close(directoryFd);
+    return ok;
+}
+
+#elif defined(Q_OS_WIN)
+
+static qint64 msecsOf(const LARGE_INTEGER& time)
+{
+    // 100ns intervals since 1601
+    return (time.QuadPart - Q_INT64_C(116444736000000000)) / 10000;
+}
+
+/*!
+ * \brief DirectoryWalker::listNative
+ * GetFileInformationByHandleEx returns the directory in large batches, with the size,
+ * times and file id of every entry. The volume serial number is read once for all.
+ */
+bool DirectoryWalker::listNative(const QString &directory, const QString &canonicalDirectory, QVector<FileRecord> &files, QStringList &subDirectories)
+{
+    HANDLE handle = CreateFileW(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(directory).utf16()), FILE_LIST_DIRECTORY,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    BY_HANDLE_FILE_INFORMATION directoryInformation;
+    const quint64 device = GetFileInformationByHandle(handle, &directoryInformation) ? directoryInformation.dwVolumeSerialNumber : 0;
+
+    const QString prefix = directory.endsWith('/') ? directory : directory + '/';
+    // The entries are aligned to 8 bytes
+    QVector<quint64> buffer(DIRECTORY_READ_BUFFER_SIZE / sizeof(quint64));
+    FILE_INFO_BY_HANDLE_CLASS infoClass = FileIdBothDirectoryRestartInfo;
+    bool ok = true;
+    for (;;)
+    {
+        if (!GetFileInformationByHandleEx(handle, infoClass, buffer.data(), DWORD(buffer.size() * sizeof(quint64))))
+        {
+            ok = GetLastError() == ERROR_NO_MORE_FILES;
+            break;
+        }
+        infoClass = FileIdBothDirectoryInfo;
+
+        const char* next = reinterpret_cast<const char*>(buffer.constData());
+        while (next != nullptr)
+        {
+            const FILE_ID_BOTH_DIR_INFO* info = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO*>(next);
+            next = info->NextEntryOffset != 0 ? next + info->NextEntryOffset : nullptr;
+
+            const QString fileName = QString::fromWCharArray(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            if (fileName == "." || fileName == ".." || (info->FileAttributes & FILE_ATTRIBUTE_HIDDEN))
+                continue;
+            const bool isLink = info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT;
+            if (info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                // Junctions and links to directories are not followed
+                if (!isLink)
+                    subDirectories.append(prefix + fileName);
+                continue;
+            }
+            if (!isImageFileName(fileName))
+                continue;
+            if (isLink)
+            {
+                appendLinkTarget(prefix + fileName, files);
+                continue;
+            }
+            FileRecord record;
+            record.FullPath = prefix + fileName;
+            record.CanonicalDirectory = canonicalDirectory;
+            record.Size = info->EndOfFile.QuadPart;
+            record.LastModifiedTime = msecsOf(info->LastWriteTime);
+            record.CreatedTime = msecsOf(info->CreationTime);
+            record.Device = device;
+            record.Inode = quint64(info->FileId.QuadPart);
+            files.append(record);
+        }
+    }
+    CloseHandle(handle);
+    return ok;
+}
+
+#else
+
+bool DirectoryWalker::listNative(const QString &directory, const QString &canonicalDirectory, QVector<FileRecord> &files, QStringList &subDirectories)
+{
+    Q_UNUSED(directory);
+    Q_UNUSED(canonicalDirectory);
+    Q_UNUSED(files);
+    Q_UNUSED(subDirectories);
+    return false;
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef DIRECTORYWALKER_H
+#define DIRECTORYWALKER_H
+
+#include "filerecord.h"
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/*!
+ * \brief The DirectoryWalker class
+ * Lists one directory with the bulk enumeration of the platform: getdents64 and
+ * statx against the directory handle on Linux, getattrlistbulk on macOS and
+ * GetFileInformationByHandleEx with FileIdBothDirectoryInfo on Windows. The name,
+ * type, size, times and file id of the entries come back together, so only image
+ * files are looked at one by one, and only where the listing does not carry their
+ * size already.
+ *
+ * Same as the QDirIterator it replaces, hidden entries are skipped, links to files
+ * are listed as the files, and links to directories are not followed. Directories
+ * of an object store are listed by ObjectStore.
+ */
+class DirectoryWalker
+{
+public:
+    // Appends the image files and the subdirectories of directory. False if it
+    // could not be opened.
+    static bool list(const QString& directory, QVector<FileRecord>& files, QStringList& subDirectories);
+
+    static bool isImageFileName(const QString& name);
+
+private:
+    static bool listNative(const QString& directory, const QString& canonicalDirectory, QVector<FileRecord>& files, QStringList& subDirectories);
+    static bool listPortable(const QString& directory, const QString& canonicalDirectory, QVector<FileRecord>& files, QStringList& subDirectories);
+};
+
+#endif // DIRECTORYWALKER_H
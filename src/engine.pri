@@ -0,0 +1,207 @@
+# The ingest pipeline, shared by the app and the astrocat-index command line indexer
+
+QT += core gui sql concurrent network
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/allocationtracker.cpp \
+    $$PWD/arrowstreamwriter.cpp \
+    $$PWD/asyncfileio.cpp \
+    $$PWD/autostretcher.cpp \
+    $$PWD/blinkprefetcher.cpp \
+    $$PWD/calibrationindex.cpp \
+    $$PWD/cancellationtoken.cpp \
+    $$PWD/catalog.cpp \
+    $$PWD/catalogclient.cpp \
+    $$PWD/catalogcolumns.cpp \
+    $$PWD/catalogprotocol.cpp \
+    $$PWD/catalogreconciler.cpp \
+    $$PWD/catalogserver.cpp \
+    $$PWD/catalogsnapshot.cpp \
+    $$PWD/colormanagement.cpp \
+    $$PWD/contactsheetexporter.cpp \
+    $$PWD/directorywalker.cpp \
+    $$PWD/fileexporter.cpp \
+    $$PWD/fileformats.cpp \
+    $$PWD/fileimporter.cpp \
+    $$PWD/fileprocessfilter.cpp \
+    $$PWD/filereader.cpp \
+    $$PWD/filerepository.cpp \
+    $$PWD/fitsfile.cpp \
+    $$PWD/fitsheadereditor.cpp \
+    $$PWD/fitsheaderscanner.cpp \
+    $$PWD/fitsprocessor.cpp \
+    $$PWD/foldercrawler.cpp \
+    $$PWD/folderwatcher.cpp \
+    $$PWD/frameanalyzer.cpp \
+    $$PWD/framebufferpool.cpp \
+    $$PWD/gpubinner.cpp \
+    $$PWD/hasher.cpp \
+    $$PWD/imageprocessor.cpp \
+    $$PWD/indexingengine.cpp \
+    $$PWD/indexingservice.cpp \
+    $$PWD/ingestserver.cpp \
+    $$PWD/integrityverifier.cpp \
+    $$PWD/linearimagereader.cpp \
+    $$PWD/linearthumbnail.cpp \
+    $$PWD/memorybudget.cpp \
+    $$PWD/metrics.cpp \
+    $$PWD/mock_foldercrawler.cpp \
+    $$PWD/mock_newfileprocessor.cpp \
+    $$PWD/newfileprocessor.cpp \
+    $$PWD/objectstore.cpp \
+    $$PWD/observingnight.cpp \
+    $$PWD/pathindex.cpp \
+    $$PWD/pathtrie.cpp \
+    $$PWD/repositoryrequest.cpp \
+    $$PWD/rowhandles.cpp \
+    $$PWD/perceptualhash.cpp \
+    $$PWD/placeholderhash.cpp \
+    $$PWD/platesolver.cpp \
+    $$PWD/previewstacker.cpp \
+    $$PWD/quadindex.cpp \
+    $$PWD/rawprocessor.cpp \
+    $$PWD/pixelkernels.cpp \
+    $$PWD/sandboxedprocessor.cpp \
+    $$PWD/serprocessor.cpp \
+    $$PWD/skycoordinates.cpp \
+    $$PWD/skycoverage.cpp \
+    $$PWD/smartcollection.cpp \
+    $$PWD/stringpool.cpp \
+    $$PWD/syntheticframe.cpp \
+    $$PWD/tagmap.cpp \
+    $$PWD/tagtailcodec.cpp \
+    $$PWD/taskscheduler.cpp \
+    $$PWD/thumbnailcachesimulator.cpp \
+    $$PWD/thumbnailcodec.cpp \
+    $$PWD/thumbnailstore.cpp \
+    $$PWD/thumbnailtrace.cpp \
+    $$PWD/threadpriority.cpp \
+    $$PWD/tinythumbnailatlas.cpp \
+    $$PWD/tiledpreview.cpp \
+    $$PWD/volumeio.cpp \
+    $$PWD/volumeregistry.cpp \
+    $$PWD/xisfblockdecoder.cpp \
+    $$PWD/xisfheaderreader.cpp \
+    $$PWD/xisfprocessor.cpp
+
+HEADERS += \
+    $$PWD/allocationtracker.h \
+    $$PWD/arrowstreamwriter.h \
+    $$PWD/astrofile.h \
+    $$PWD/asyncfileio.h \
+    $$PWD/autostretcher.h \
+    $$PWD/blinkprefetcher.h \
+    $$PWD/calibrationindex.h \
+    $$PWD/cancellationtoken.h \
+    $$PWD/catalog.h \
+    $$PWD/catalogclient.h \
+    $$PWD/catalogcolumns.h \
+    $$PWD/catalogprotocol.h \
+    $$PWD/catalogreconciler.h \
+    $$PWD/catalogserver.h \
+    $$PWD/catalogsnapshot.h \
+    $$PWD/colormanagement.h \
+    $$PWD/contactsheetexporter.h \
+    $$PWD/debayer.h \
+    $$PWD/directorystate.h \
+    $$PWD/directorywalker.h \
+    $$PWD/filechange.h \
+    $$PWD/fileexporter.h \
+    $$PWD/fileformats.h \
+    $$PWD/fileimporter.h \
+    $$PWD/fileprocessfilter.h \
+    $$PWD/fileprocessor.h \
+    $$PWD/filerecord.h \
+    $$PWD/filereader.h \
+    $$PWD/filerepository.h \
+    $$PWD/fitsfile.h \
+    $$PWD/fitsheadereditor.h \
+    $$PWD/fitsheaderscanner.h \
+    $$PWD/fitspixels.h \
+    $$PWD/fitsprocessor.h \
+    $$PWD/foldercrawler.h \
+    $$PWD/folderwatcher.h \
+    $$PWD/frameanalyzer.h \
+    $$PWD/framebufferpool.h \
+    $$PWD/gpubinner.h \
+    $$PWD/hasher.h \
+    $$PWD/imageprocessor.h \
+    $$PWD/indexingengine.h \
+    $$PWD/indexingservice.h \
+    $$PWD/ingestserver.h \
+    $$PWD/integrityverifier.h \
+    $$PWD/integrationstats.h \
+    $$PWD/linearimagereader.h \
+    $$PWD/linearthumbnail.h \
+    $$PWD/memorybudget.h \
+    $$PWD/metrics.h \
+    $$PWD/mock_foldercrawler.h \
+    $$PWD/mock_newfileprocessor.h \
+    $$PWD/newfileprocessor.h \
+    $$PWD/objectstore.h \
+    $$PWD/observingnight.h \
+    $$PWD/pathindex.h \
+    $$PWD/pathtrie.h \
+    $$PWD/repositoryrequest.h \
+    $$PWD/rowhandles.h \
+    $$PWD/perceptualhash.h \
+    $$PWD/placeholderhash.h \
+    $$PWD/platesolver.h \
+    $$PWD/previewstacker.h \
+    $$PWD/quadindex.h \
+    $$PWD/rawprocessor.h \
+    $$PWD/pixelkernels.h \
+    $$PWD/sandboxedprocessor.h \
+    $$PWD/serprocessor.h \
+    $$PWD/servedfile.h \
+    $$PWD/skycoordinates.h \
+    $$PWD/skycoverage.h \
+    $$PWD/smartcollection.h \
+    $$PWD/stagequeue.h \
+    $$PWD/stringpool.h \
+    $$PWD/syntheticframe.h \
+    $$PWD/tagmap.h \
+    $$PWD/tagtailcodec.h \
+    $$PWD/taskscheduler.h \
+    $$PWD/thumbnailbatch.h \
+    $$PWD/thumbnailcachesimulator.h \
+    $$PWD/thumbnailcodec.h \
+    $$PWD/thumbnailstore.h \
+    $$PWD/thumbnailtrace.h \
+    $$PWD/threadpriority.h \
+    $$PWD/tinythumbnailatlas.h \
+    $$PWD/tiledpreview.h \
+    $$PWD/volumeio.h \
+    $$PWD/volumerecord.h \
+    $$PWD/volumeregistry.h \
+    $$PWD/xisfblockdecoder.h \
+    $$PWD/xisfheaderreader.h \
+    $$PWD/xisfprocessor.h
+
+LIBS += -L$$PWD/../external/build/libs/ -lpcl -llcms -llz4 -lRFC6234 -lcfitsio -lzlib
+
+win32 {
+    LIBS += -L$$PWD/../external/build/libs/Release
+    LIBS += -luser32 -luserenv -ladvapi32 -lpsapi -lpthreadVC2
+    DEFINES += __PCL_WINDOWS WIN32 WIN64 __PCL_NO_WIN32_MINIMUM_VERSIONS UNICODE _UNICODE _WINDOWS _NDEBUG
+    QMAKE_CXXFLAGS = "/EHsc /MP /FS"
+}
+macx {
+    DEFINES += __PCL_MACOSX
+}
+linux {
+DEFINES += __PCL_LINUX
+}
+
+# Counts the allocations of each AllocationScope, qmake CONFIG+=allocation_tracking
+allocation_tracking {
+    DEFINES += ASTROCAT_ALLOCATION_TRACKING
+}
+
+INCLUDEPATH += $$PWD/../external/cfitsio
+INCLUDEPATH += $$PWD/../external/lcms
+INCLUDEPATH += $$PWD/../external/lz4
+INCLUDEPATH += $$PWD/../external/pcl/include
+INCLUDEPATH += $$PWD/../external/zlib
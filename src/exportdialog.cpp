@@ -0,0 +1,166 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "exportdialog.h"
+
+#include <QDialogButtonBox>
+#include <QDir>
+#include <QFileDialog>
+#include <QFormLayout>
+#include <QHBoxLayout>
+#include <QLocale>
+#include <QMessageBox>
+#include <QSettings>
+#include <QVBoxLayout>
+
+#define EXPORT_PROGRESS_INTERVAL_MS 500
+
+// The first seconds of a copy say little about its throughput, no time left is shown before
+#define EXPORT_ETA_MIN_MSECS 2000
+
+// Failures listed when the export is done, the others are counted
+#define EXPORT_FAILURES_SHOWN 20
+
+ExportDialog::ExportDialog(const QVector<FileExporter::Item> &items, QWidget *parent) : QDialog(parent), items(items)
+{
+    setWindowTitle(tr("Export %n File(s)", "", items.count()));
+    resize(520, 0);
+    for (auto& item : items)
+        totalBytes += item.size;
+
+    folderEdit = new QLineEdit(QSettings().value("ExportFolder").toString());
+    QPushButton* browseButton = new QPushButton(tr("Browse..."));
+    connect(browseButton, &QPushButton::clicked, this, &ExportDialog::chooseFolder);
+    QHBoxLayout* folderLayout = new QHBoxLayout;
+    folderLayout->addWidget(folderEdit, 1);
+    folderLayout->addWidget(browseButton);
+
+    modeCombo = new QComboBox;
+    modeCombo->addItem(tr("Copy"), FileExporter::CopyFiles);
+    modeCombo->addItem(tr("Hard link, copy across volumes"), FileExporter::HardLinkFiles);
+    verifyCheck = new QCheckBox(tr("Check the copies against the file hashes of the catalog"));
+
+    QFormLayout* form = new QFormLayout;
+    form->addRow(tr("Folder"), folderLayout);
+    form->addRow(tr("Export as"), modeCombo);
+    form->addRow(QString(), verifyCheck);
+
+    progressBar = new QProgressBar;
+    progressBar->setRange(0, items.count());
+    progressBar->setValue(0);
+    statusLabel = new QLabel(tr("%1 in %n file(s)", "", items.count()).arg(QLocale().formattedDataSize(totalBytes)));
+
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Cancel);
+    exportButton = buttons->addButton(tr("Export"), QDialogButtonBox::AcceptRole);
+    connect(exportButton, &QPushButton::clicked, this, &ExportDialog::startExport);
+    connect(buttons, &QDialogButtonBox::rejected, this, &ExportDialog::reject);
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addLayout(form);
+    layout->addWidget(progressBar);
+    layout->addWidget(statusLabel);
+    layout->addWidget(buttons);
+
+    progressTimer.setInterval(EXPORT_PROGRESS_INTERVAL_MS);
+    connect(&progressTimer, &QTimer::timeout, this, &ExportDialog::updateProgress);
+}
+
+void ExportDialog::chooseFolder()
+{
+    const QString folder = QFileDialog::getExistingDirectory(this, tr("Export To"), folderEdit->text());
+    if (!folder.isEmpty())
+        folderEdit->setText(folder);
+}
+
+void ExportDialog::startExport()
+{
+    const QString folder = folderEdit->text();
+    if (folder.isEmpty() || !QDir().mkpath(folder))
+    {
+        QMessageBox::warning(this, windowTitle(), tr("Can not write to the folder %1").arg(folder));
+        return;
+    }
+    QSettings().setValue("ExportFolder", folder);
+
+    folderEdit->setEnabled(false);
+    modeCombo->setEnabled(false);
+    verifyCheck->setEnabled(false);
+    exportButton->setEnabled(false);
+
+    exporter = new FileExporter(this);
+    connect(exporter, &FileExporter::finished, this, &ExportDialog::exportFinished);
+    elapsed.start();
+    progressTimer.start();
+    exporter->start(items, folder, FileExporter::ExportMode(modeCombo->currentData().toInt()), verifyCheck->isChecked());
+}
+
+void ExportDialog::updateProgress()
+{
+    const int files = exporter->filesDone();
+    const qint64 bytes = exporter->bytesDone();
+    const qint64 msecs = qMax<qint64>(elapsed.elapsed(), 1);
+    const double bytesPerSecond = bytes * 1000.0 / msecs;
+    progressBar->setValue(files);
+
+    QString status = tr("%1 of %2 files, %3 of %4, %5/s")
+            .arg(files).arg(items.count())
+            .arg(QLocale().formattedDataSize(bytes), QLocale().formattedDataSize(totalBytes), QLocale().formattedDataSize(qint64(bytesPerSecond)));
+    if (msecs >= EXPORT_ETA_MIN_MSECS && bytesPerSecond > 0)
+    {
+        const int secondsLeft = int((totalBytes - bytes) / bytesPerSecond);
+        status += tr(", %1:%2 left").arg(secondsLeft / 60).arg(secondsLeft % 60, 2, 10, QChar('0'));
+    }
+    statusLabel->setText(status);
+}
+
+void ExportDialog::exportFinished(int exported, const QStringList &failures)
+{
+    progressTimer.stop();
+    updateProgress();
+    statusLabel->setText(tr("Exported %n file(s) in %1 s", "", exported).arg(elapsed.elapsed() / 1000.0, 0, 'f', 1));
+    exporter->deleteLater();
+    exporter = nullptr;
+
+    if (!failures.isEmpty())
+    {
+        QStringList shown = failures.mid(0, EXPORT_FAILURES_SHOWN);
+        if (failures.count() > shown.count())
+            shown.append(tr("and %n more", "", failures.count() - shown.count()));
+        QMessageBox::warning(this, windowTitle(), tr("%n file(s) could not be exported:", "", failures.count()) + "\n\n" + shown.join('\n'));
+    }
+    accept();
+}
+
+/*!
+ * \brief ExportDialog::reject
+ * Cancels the export in progress. The files being copied are finished, the others
+ * are not started.
+ */
+void ExportDialog::reject()
+{
+    if (exporter != nullptr)
+        exporter->cancel();
+    else
+        QDialog::reject();
+}
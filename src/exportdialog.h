@@ -0,0 +1,76 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef EXPORTDIALOG_H
+#define EXPORTDIALOG_H
+
+#include "fileexporter.h"
+
+#include <QCheckBox>
+#include <QComboBox>
+#include <QDialog>
+#include <QElapsedTimer>
+#include <QLabel>
+#include <QLineEdit>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QTimer>
+
+/*!
+ * \brief The ExportDialog class
+ * Copies or links the selected files to a folder with a FileExporter, showing the
+ * files and bytes done, the throughput and the time left while it runs.
+ */
+class ExportDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    ExportDialog(const QVector<FileExporter::Item>& items, QWidget *parent = nullptr);
+
+protected:
+    void reject() override;
+
+private slots:
+    void chooseFolder();
+    void startExport();
+    void updateProgress();
+    void exportFinished(int exported, const QStringList& failures);
+
+private:
+    QVector<FileExporter::Item> items;
+    qint64 totalBytes = 0;
+    FileExporter* exporter = nullptr;
+
+    QLineEdit* folderEdit;
+    QComboBox* modeCombo;
+    QCheckBox* verifyCheck;
+    QProgressBar* progressBar;
+    QLabel* statusLabel;
+    QPushButton* exportButton;
+    QTimer progressTimer;
+    QElapsedTimer elapsed;
+};
+
+#endif // EXPORTDIALOG_H
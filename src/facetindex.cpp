@@ -0,0 +1,262 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#include "facetindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Rows the bitmaps grow by at least, so appending rows does not resize them every time
+#define FACET_INDEX_MIN_CAPACITY 1024
+
+void FacetIndex::clear()
+{
+    for (auto& postings : facets)
+        postings = Postings();
+    rowDays.clear();
+    sortedDays.clear();
+    sortedDaysValid = false;
+    rowPositions.clear();
+    sortedDecs.clear();
+    sortedDecsValid = false;
+    rows = 0;
+    capacity = 0;
+}
+
+void FacetIndex::reserve(int count)
+{
+    if (count <= capacity)
+        return;
+
+    int newCapacity = qMax(FACET_INDEX_MIN_CAPACITY, capacity);
+    while (newCapacity < count)
+        newCapacity *= 2;
+    for (auto& postings : facets)
+    {
+        for (auto& bitmap : postings.rows)
+            bitmap.resize(newCapacity);
+    }
+    capacity = newCapacity;
+}
+
+void FacetIndex::appendRow(const CatalogColumns::RowView &rowView)
+{
+    reserve(rows + 1);
+    const int row = rows++;
+    for (int facet = 0; facet < CatalogColumns::FacetCount; facet++)
+    {
+        facets[facet].rowValues.append(-1);
+        setValue(facets[facet], row, rowView, Facet(facet));
+    }
+    rowDays.append(rowView.observationNight());
+    sortedDaysValid = false;
+    rowPositions.append(qMakePair(rowView.ra(), rowView.dec()));
+    sortedDecsValid = false;
+}
+
+void FacetIndex::updateRow(int row, const CatalogColumns::RowView &rowView)
+{
+    if (row < 0 || row >= rows)
+        return;
+
+    for (int facet = 0; facet < CatalogColumns::FacetCount; facet++)
+        setValue(facets[facet], row, rowView, Facet(facet));
+
+    const qint64 day = rowView.observationNight();
+    if (rowDays.at(row) != day)
+    {
+        rowDays[row] = day;
+        sortedDaysValid = false;
+    }
+
+    const QPair<double, double> position(rowView.ra(), rowView.dec());
+    // NaN never compares equal, rows without a position are left as they are
+    if (position != rowPositions.at(row) && !(std::isnan(position.second) && std::isnan(rowPositions.at(row).second)))
+    {
+        rowPositions[row] = position;
+        sortedDecsValid = false;
+    }
+}
+
+void FacetIndex::setValue(Postings &postings, int row, const CatalogColumns::RowView &rowView, Facet facet)
+{
+    // Value ids are dense, so they index the local ids without hashing the value
+    const int valueId = rowView.facetId(facet);
+    if (valueId >= postings.localIds.count())
+        postings.localIds.resize(valueId + 1, -1);
+
+    int id = postings.localIds.at(valueId);
+    if (id == -1)
+    {
+        id = postings.values.count();
+        postings.localIds[valueId] = id;
+        postings.values.append(rowView.facetValue(facet));
+        postings.rows.append(QBitArray(capacity));
+    }
+
+    const int oldId = postings.rowValues.at(row);
+    if (oldId == id)
+        return;
+    if (oldId != -1)
+        postings.rows[oldId].clearBit(row);
+    postings.rows[id].setBit(row);
+    postings.rowValues[row] = id;
+}
+
+/*!
+ * \brief FacetIndex::rowsWhere
+ * The rows whose value of the facet is accepted. accept is only called once for every
+ * distinct value.
+ */
+QBitArray FacetIndex::rowsWhere(Facet facet, const std::function<bool(const QString&)>& accept) const
+{
+    const Postings& postings = facets[facet];
+    QBitArray result(capacity);
+    for (int id = 0; id < postings.values.count(); id++)
+    {
+        if (accept(postings.values.at(id)))
+            result |= postings.rows.at(id);
+    }
+    return result;
+}
+
+/*!
+ * \brief FacetIndex::rowsInDateRange
+ * The rows of the nights from minDate to maxDate, both included. Rows without a valid
+ * DATE-OBS sort before every date, so like before they are only in ranges without
+ * a minimum date.
+ */
+QBitArray FacetIndex::rowsInDateRange(const QDate &minDate, const QDate &maxDate) const
+{
+    QBitArray result(capacity);
+    if (!minDate.isValid() && !maxDate.isValid())
+    {
+        result.fill(true, 0, rows);
+        return result;
+    }
+
+    if (!sortedDaysValid)
+    {
+        sortedDays.resize(rows);
+        for (int row = 0; row < rows; row++)
+            sortedDays[row] = qMakePair(rowDays.at(row), row);
+        std::sort(sortedDays.begin(), sortedDays.end());
+        sortedDaysValid = true;
+    }
+
+    const qint64 first = minDate.isValid() ? minDate.toJulianDay() : std::numeric_limits<qint64>::min();
+    const qint64 last = maxDate.isValid() ? maxDate.toJulianDay() : std::numeric_limits<qint64>::max();
+    auto iter = std::lower_bound(sortedDays.constBegin(), sortedDays.constEnd(), qMakePair(first, std::numeric_limits<int>::min()));
+    for (; iter != sortedDays.constEnd() && iter->first <= last; ++iter)
+        result.setBit(iter->second);
+    return result;
+}
+
+/*!
+ * \brief FacetIndex::rowsInRegion
+ * The rows whose position is in the region. The rows of its band of declination are
+ * found with a binary search, and tested one by one.
+ */
+QBitArray FacetIndex::rowsInRegion(const SkyRegion &region) const
+{
+    QBitArray result(capacity);
+    if (!region.isActive())
+    {
+        result.fill(true, 0, rows);
+        return result;
+    }
+
+    if (!sortedDecsValid)
+    {
+        sortedDecs.clear();
+        sortedDecs.reserve(rows);
+        for (int row = 0; row < rows; row++)
+        {
+            if (!std::isnan(rowPositions.at(row).second))
+                sortedDecs.append(qMakePair(rowPositions.at(row).second, row));
+        }
+        std::sort(sortedDecs.begin(), sortedDecs.end());
+        sortedDecsValid = true;
+    }
+
+    auto iter = std::lower_bound(sortedDecs.constBegin(), sortedDecs.constEnd(), qMakePair(region.minDec(), std::numeric_limits<int>::min()));
+    for (; iter != sortedDecs.constEnd() && iter->first <= region.maxDec(); ++iter)
+    {
+        const QPair<double, double>& position = rowPositions.at(iter->second);
+        if (region.contains(position.first, position.second))
+            result.setBit(iter->second);
+    }
+    return result;
+}
+
+/*!
+ * \brief FacetIndex::countValues
+ * Counts the bits each posting list has in common with rows, eight bytes at a time,
+ * without building the intersections.
+ */
+QHash<QString, int> FacetIndex::countValues(Facet facet, const QBitArray &rows, const QBitArray &excludedRows) const
+{
+    const Postings& postings = facets[facet];
+    QHash<QString, int> counts;
+    // The bitmaps of the index are all capacity bits long
+    qsizetype size = qMin(rows.size(), qsizetype(capacity));
+    if (!excludedRows.isNull())
+        size = qMin(size, excludedRows.size());
+    const qsizetype bytes = (size + 7) / 8;
+    const char* rowBits = rows.bits();
+    const char* excludedBits = excludedRows.isNull() ? nullptr : excludedRows.bits();
+
+    for (int id = 0; id < postings.values.count(); id++)
+    {
+        const char* valueBits = postings.rows.at(id).bits();
+        int count = 0;
+        qsizetype byte = 0;
+        for (; byte + 8 <= bytes; byte += 8)
+        {
+            quint64 valueWord;
+            quint64 rowWord;
+            std::memcpy(&valueWord, valueBits + byte, 8);
+            std::memcpy(&rowWord, rowBits + byte, 8);
+            quint64 word = valueWord & rowWord;
+            if (excludedBits != nullptr)
+            {
+                quint64 excludedWord;
+                std::memcpy(&excludedWord, excludedBits + byte, 8);
+                word &= ~excludedWord;
+            }
+            count += qPopulationCount(word);
+        }
+        for (; byte < bytes; byte++)
+        {
+            quint8 bits = quint8(valueBits[byte]) & quint8(rowBits[byte]);
+            if (excludedBits != nullptr)
+                bits &= ~quint8(excludedBits[byte]);
+            count += qPopulationCount(bits);
+        }
+        if (count > 0)
+            counts.insert(postings.values.at(id), count);
+    }
+    return counts;
+}
@@ -0,0 +1,95 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#ifndef FACETINDEX_H
+#define FACETINDEX_H
+
+#include "catalogcolumns.h"
+#include "skycoordinates.h"
+
+#include <QBitArray>
+#include <QDate>
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+/*!
+ * \brief The FacetIndex class
+ * Posting lists of the rows of the catalog, for evaluating the filters of the
+ * SortFilterProxyModel as bitmap operations instead of row by row.
+ *
+ * For every facet, each distinct value has a bitmap of the rows with that value, so a
+ * filter only looks at the distinct values. Observing nights are kept sorted, so a
+ * date range is a binary search. Sky positions are kept sorted by declination, so a
+ * region of the sky is a binary search for its band of declination, and only the
+ * rows in the band are tested.
+ *
+ * Rows are read from the CatalogColumns, in the order of the source model. When rows
+ * are removed or moved, the index has to be built again.
+ */
+class FacetIndex
+{
+public:
+    typedef CatalogColumns::Facet Facet;
+
+    void clear();
+    int rowCount() const { return rows; }
+    void appendRow(const CatalogColumns::RowView& row);
+    void updateRow(int row, const CatalogColumns::RowView& rowView);
+
+    // Bitmaps have one bit per row, at least rowCount() long
+    QBitArray rowsWhere(Facet facet, const std::function<bool(const QString&)>& accept) const;
+    // An invalid date is an open end of the range
+    QBitArray rowsInDateRange(const QDate& minDate, const QDate& maxDate) const;
+    // Rows without a position are in no region
+    QBitArray rowsInRegion(const SkyRegion& region) const;
+    // The rows of each value among rows and not among excludedRows, by value. A null excludedRows excludes none.
+    QHash<QString, int> countValues(Facet facet, const QBitArray& rows, const QBitArray& excludedRows = QBitArray()) const;
+
+private:
+    struct Postings
+    {
+        QVector<int> localIds; // By value id of the CatalogColumns, -1 if no row has it
+        QStringList values;
+        QVector<QBitArray> rows;
+        QVector<int> rowValues;
+    };
+    Postings facets[CatalogColumns::FacetCount];
+    QVector<qint64> rowDays;
+    mutable QVector<QPair<qint64, int>> sortedDays;
+    mutable bool sortedDaysValid = false;
+    QVector<QPair<double, double>> rowPositions; // Right ascension and declination
+    mutable QVector<QPair<double, int>> sortedDecs; // Only the rows with a position
+    mutable bool sortedDecsValid = false;
+    int rows = 0;
+    int capacity = 0;
+
+    void reserve(int count);
+    void setValue(Postings& postings, int row, const CatalogColumns::RowView& rowView, Facet facet);
+};
+
+#endif // FACETINDEX_H
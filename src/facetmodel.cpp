@@ -0,0 +1,178 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "facetmodel.h"
+#include "integrationstats.h"
+
+#include <algorithm>
+
+// Count changes are shown at most this often, about once a frame
+#define FACET_MODEL_UPDATE_INTERVAL_MS 16
+
+FacetModel::FacetModel(QObject *parent) : QAbstractListModel(parent)
+{
+    updateTimer.setSingleShot(true);
+    updateTimer.setInterval(FACET_MODEL_UPDATE_INTERVAL_MS);
+    connect(&updateTimer, &QTimer::timeout, this, &FacetModel::applyPendingCounts);
+}
+
+void FacetModel::addValue(const QString &value, double exposure)
+{
+    changeCount(value, 1, exposure);
+}
+
+void FacetModel::removeValue(const QString &value, double exposure)
+{
+    changeCount(value, -1, -exposure);
+}
+
+void FacetModel::changeCount(const QString &value, int change, double exposure)
+{
+    pendingCounts[value] += change;
+    if (exposure != 0)
+        pendingExposures[value] += exposure;
+    if (!updateTimer.isActive())
+        updateTimer.start();
+}
+
+int FacetModel::rowOf(const QString &value) const
+{
+    return std::lower_bound(values.begin(), values.end(), value) - values.begin();
+}
+
+/*!
+ * \brief FacetModel::applyPendingCounts
+ * Adds the values that appeared, removes the ones no row has anymore, and updates the
+ * count of the others. A checked value stays until it is unchecked, so its filter can
+ * still be removed.
+ */
+void FacetModel::applyPendingCounts()
+{
+    for (auto it = pendingCounts.constBegin(); it != pendingCounts.constEnd(); ++it)
+    {
+        const QString& value = it.key();
+        int count = counts.value(value) + it.value();
+        int row = rowOf(value);
+        bool exists = row < values.count() && values.at(row) == value;
+
+        const double exposure = count > 0 ? exposures.value(value) + pendingExposures.value(value) : 0;
+
+        if (count > 0 || checkedValues.contains(value))
+        {
+            counts.insert(value, qMax(count, 0));
+            exposures.insert(value, exposure);
+            if (exists)
+            {
+                if (it.value() != 0 || pendingExposures.contains(value))
+                    emit dataChanged(index(row), index(row), {Qt::DisplayRole});
+                continue;
+            }
+            beginInsertRows(QModelIndex(), row, row);
+            values.insert(row, value);
+            endInsertRows();
+        }
+        else
+        {
+            counts.remove(value);
+            exposures.remove(value);
+            if (!exists)
+                continue;
+            beginRemoveRows(QModelIndex(), row, row);
+            values.removeAt(row);
+            endRemoveRows();
+        }
+    }
+    pendingCounts.clear();
+    pendingExposures.clear();
+}
+
+void FacetModel::setProjectedCounts(const QHash<QString, int> &projectedCounts)
+{
+    this->projectedCounts = projectedCounts;
+    if (!values.isEmpty())
+        emit dataChanged(index(0), index(values.count() - 1), {Qt::ToolTipRole});
+}
+
+int FacetModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return values.count();
+}
+
+QVariant FacetModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= values.count())
+        return QVariant();
+
+    const QString& value = values.at(index.row());
+    switch (role)
+    {
+    case Qt::DisplayRole:
+    {
+        // The exposure is only shown for the facets that have one
+        const double exposure = exposures.value(value);
+        if (exposure > 0)
+            return QString("%1 (%2, %3)").arg(value).arg(counts.value(value)).arg(IntegrationStats::formatDuration(exposure));
+        return QString("%1 (%2)").arg(value).arg(counts.value(value));
+    }
+    case Qt::ToolTipRole:
+    {
+        auto projected = projectedCounts.constFind(value);
+        if (checkedValues.contains(value) || projected == projectedCounts.constEnd())
+            return value;
+        return tr("%1\nChecking it shows %n file(s)", nullptr, projected.value()).arg(value);
+    }
+    case Qt::CheckStateRole:
+        return checkedValues.contains(value) ? Qt::Checked : Qt::Unchecked;
+    }
+    return QVariant();
+}
+
+bool FacetModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (role != Qt::CheckStateRole || !index.isValid() || index.row() >= values.count())
+        return false;
+
+    const QString name = values.at(index.row());
+    int state = value.toInt();
+    if (state == Qt::Checked)
+        checkedValues.insert(name);
+    else
+        checkedValues.remove(name);
+    emit dataChanged(index, index, {Qt::CheckStateRole});
+    emit checkStateChanged(name, state);
+
+    // An unchecked value no row has anymore is removed on the next update
+    if (state != Qt::Checked && counts.value(name) == 0)
+        changeCount(name, 0);
+    return true;
+}
+
+Qt::ItemFlags FacetModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return Qt::NoItemFlags;
+    return Qt::ItemIsEnabled | Qt::ItemIsUserCheckable;
+}
@@ -0,0 +1,80 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FACETMODEL_H
+#define FACETMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+/*!
+ * \brief The FacetModel class
+ * The values of one facet (objects, instruments, ...) with the number of rows that
+ * have each of them and their total exposure, shown as checkable items in a list view,
+ * so only the visible values are drawn however many there are.
+ *
+ * Count changes are collected and applied at most once a frame, and only the values
+ * whose count changed are updated. Values are kept sorted.
+ */
+class FacetModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit FacetModel(QObject *parent = nullptr);
+
+    // exposure is the EXPTIME of the row, in seconds
+    void addValue(const QString& value, double exposure = 0);
+    void removeValue(const QString& value, double exposure = 0);
+    // The files shown if each unchecked value were checked, see SortFilterProxyModel::facetProjectionsChanged
+    void setProjectedCounts(const QHash<QString, int>& projectedCounts);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+signals:
+    void checkStateChanged(QString value, int state);
+
+private slots:
+    void applyPendingCounts();
+
+private:
+    QStringList values; // Sorted, one row each
+    QHash<QString, int> counts;
+    QHash<QString, double> exposures; // Seconds
+    QSet<QString> checkedValues;
+    QHash<QString, int> projectedCounts; // Shown in the tool tips
+    QHash<QString, int> pendingCounts; // Changes not applied yet
+    QHash<QString, double> pendingExposures;
+    QTimer updateTimer;
+
+    void changeCount(const QString& value, int change, double exposure = 0);
+    int rowOf(const QString& value) const;
+};
+
+#endif // FACETMODEL_H
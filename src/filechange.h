@@ -0,0 +1,67 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FILECHANGE_H
+#define FILECHANGE_H
+
+#include <QList>
+#include <QString>
+
+// Stored in the operation column of file_changes
+enum FileChangeOperation
+{
+    FileAdded = 0,
+    // Also the changes logged before the operation was, which may be any of them
+    FileUpdated = 1,
+    FileDeleted = 2,
+};
+
+/*!
+ * \brief The FileChange struct
+ * One row of the change log of the fits table. Seq grows with every change, so a
+ * consumer that kept the Seq of the last change it saw asks for the ones after it.
+ */
+struct FileChange
+{
+    qint64 Seq = 0;
+    int FitsId = 0;
+    QString FullPath;
+    FileChangeOperation Operation = FileUpdated;
+};
+
+/*!
+ * \brief The FileChanges struct
+ * The changes after a sequence number, see FileRepository::changesSince. When the log
+ * was pruned past that number, IsComplete is false and the consumer reads every file
+ * again.
+ */
+struct FileChanges
+{
+    QList<FileChange> Changes;
+    // The Seq to ask from next time
+    qint64 LastSeq = 0;
+    bool IsComplete = true;
+};
+
+#endif // FILECHANGE_H
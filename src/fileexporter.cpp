@@ -0,0 +1,243 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fileexporter.h"
+#include "hasher.h"
+#include "metrics.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QSettings>
+
+#if defined(Q_OS_LINUX)
+#include <cerrno>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#elif defined(Q_OS_MAC)
+#include <sys/clonefile.h>
+#include <unistd.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+// Files copied at the same time, unless set with the ExportCopyThreads setting
+#define DEFAULT_EXPORT_THREADS  4
+
+// Read back at a time to verify a copy
+#define VERIFY_CHUNK_SIZE       (4 * 1024 * 1024)
+
+// Handed to the kernel at a time by copy_file_range, so a cancel is seen between them
+#define KERNEL_COPY_CHUNK_SIZE  (64 * 1024 * 1024)
+
+FileExporter::FileExporter(QObject *parent) : QObject(parent)
+{
+    pool.setMaxThreadCount(qMax(1, QSettings().value("ExportCopyThreads", DEFAULT_EXPORT_THREADS).toInt()));
+}
+
+FileExporter::~FileExporter()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void FileExporter::cancel()
+{
+    cancellationToken.cancel();
+}
+
+/*!
+ * \brief FileExporter::start
+ * The names in the destination are picked here, before any file is copied, so two
+ * files of the same name always get the same numbers.
+ */
+void FileExporter::start(const QVector<Item> &items, const QString &destination, ExportMode exportMode, bool shouldVerify)
+{
+    mode = exportMode;
+    verify = shouldVerify;
+    total = items.count();
+    if (total == 0)
+    {
+        emit finished(0, {});
+        return;
+    }
+
+    const QDir destinationDir(destination);
+    QSet<QString> names;
+    for (auto& item : items)
+    {
+        const QFileInfo info(item.fullPath);
+        QString name = info.fileName();
+        for (int n = 2; names.contains(name.toLower()) || destinationDir.exists(name); n++)
+            name = QString("%1_%2%3").arg(info.completeBaseName()).arg(n).arg(info.suffix().isEmpty() ? "" : "." + info.suffix());
+        names.insert(name.toLower());
+
+        const QString destinationPath = destinationDir.filePath(name);
+        pool.start([this, item, destinationPath]() {
+            // Files not started when the export is canceled are neither exported nor failed
+            QString error;
+            bool exported = false;
+            if (!cancellationToken.isCanceled())
+                exported = exportFile(item, destinationPath, error) && (!verify || verifyFile(item, destinationPath, error));
+            fileDone(item.size, exported, error.isEmpty() ? QString() : item.fullPath + ": " + error);
+        });
+    }
+}
+
+void FileExporter::fileDone(qint64 size, bool exported, const QString &failure)
+{
+    bytes += size;
+    QMutexLocker locker(&failuresMutex);
+    if (exported)
+        exportedFiles++;
+    if (!failure.isEmpty())
+        failures.append(failure);
+    if (++done == total)
+        emit finished(exportedFiles, failures);
+}
+
+bool FileExporter::exportFile(const Item &item, const QString &destinationPath, QString &error)
+{
+    static std::atomic<qint64>& linkedCount = Metrics::counter("exporter.files_linked");
+    if (mode == HardLinkFiles)
+    {
+#if defined(Q_OS_WIN)
+        const bool linked = CreateHardLinkW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(destinationPath).utf16()),
+                                            reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(item.fullPath).utf16()), nullptr);
+#else
+        const bool linked = ::link(QFile::encodeName(item.fullPath).constData(), QFile::encodeName(destinationPath).constData()) == 0;
+#endif
+        if (linked)
+        {
+            linkedCount++;
+            return true;
+        }
+        // Another volume, copied instead
+    }
+    return copyFile(item.fullPath, destinationPath, error);
+}
+
+/*!
+ * \brief FileExporter::copyFile
+ * Clones the file, or has the kernel copy it, and falls back to QFile::copy. The copy
+ * keeps the modification time of the file.
+ */
+bool FileExporter::copyFile(const QString &sourcePath, const QString &destinationPath, QString &error)
+{
+    static std::atomic<qint64>& clonedCount = Metrics::counter("exporter.files_cloned");
+    static std::atomic<qint64>& copiedCount = Metrics::counter("exporter.files_copied");
+    bool copied = false;
+#if defined(Q_OS_LINUX)
+    QFile source(sourcePath);
+    QFile destination(destinationPath);
+    if (source.open(QIODevice::ReadOnly) && destination.open(QIODevice::WriteOnly | QIODevice::NewOnly))
+    {
+        if (::ioctl(destination.handle(), FICLONE, source.handle()) == 0)
+        {
+            clonedCount++;
+            copied = true;
+        }
+        else
+        {
+            qint64 left = source.size();
+            ssize_t copiedBytes = 1;
+            while (left > 0 && copiedBytes > 0)
+            {
+                copiedBytes = ::copy_file_range(source.handle(), nullptr, destination.handle(), nullptr, size_t(qMin<qint64>(left, KERNEL_COPY_CHUNK_SIZE)), 0);
+                if (copiedBytes > 0)
+                    left -= copiedBytes;
+            }
+            copied = left == 0;
+        }
+        if (copied)
+            destination.setFileTime(QFileInfo(source).lastModified(), QFileDevice::FileModificationTime);
+        destination.close();
+        // Not supported between these file systems, copied by Qt below
+        if (!copied)
+            destination.remove();
+    }
+#elif defined(Q_OS_MAC)
+    // Fails on other file systems than APFS, and between volumes
+    if (::clonefile(QFile::encodeName(sourcePath).constData(), QFile::encodeName(destinationPath).constData(), 0) == 0)
+    {
+        clonedCount++;
+        copied = true;
+    }
+#endif
+    if (!copied)
+    {
+        // CopyFileEx on Windows, which clones on ReFS
+        QFile source(sourcePath);
+        copied = source.copy(destinationPath);
+        if (!copied)
+            error = source.errorString();
+        else
+        {
+            QFile destination(destinationPath);
+            if (destination.open(QIODevice::ReadWrite))
+                destination.setFileTime(QFileInfo(sourcePath).lastModified(), QFileDevice::FileModificationTime);
+        }
+    }
+    if (copied)
+        copiedCount++;
+    return copied;
+}
+
+bool FileExporter::verifyFile(const Item &item, const QString &destinationPath, QString &error)
+{
+    static std::atomic<qint64>& verifiedCount = Metrics::counter("exporter.files_verified");
+    QFile destination(destinationPath);
+    if (item.size > 0 && destination.size() != item.size)
+    {
+        error = tr("The copy has %1 bytes instead of %2").arg(destination.size()).arg(item.size);
+        return false;
+    }
+    // Rows made before the file hash are only checked by size
+    if (item.fileHash.isEmpty())
+        return true;
+    if (!destination.open(QIODevice::ReadOnly))
+    {
+        error = destination.errorString();
+        return false;
+    }
+
+    Hasher hasher(Hasher::algorithmOf(item.fileHash));
+    QByteArray chunk(VERIFY_CHUNK_SIZE, Qt::Uninitialized);
+    qint64 read;
+    while ((read = destination.read(chunk.data(), chunk.size())) > 0)
+    {
+        if (cancellationToken.isCanceled())
+            return false;
+        hasher.addData(chunk.constData(), read);
+    }
+    if (read < 0 || hasher.result() != item.fileHash.toLatin1())
+    {
+        error = tr("The copy does not match the file hash of the catalog");
+        return false;
+    }
+    verifiedCount++;
+    return true;
+}
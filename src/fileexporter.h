@@ -0,0 +1,99 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FILEEXPORTER_H
+#define FILEEXPORTER_H
+
+#include "cancellationtoken.h"
+
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <atomic>
+
+/*!
+ * \brief The FileExporter class
+ * Copies or hard links files into a folder, a few at a time. Copies are cloned where
+ * the file system can (Btrfs, XFS, APFS) and made by the kernel otherwise on Linux,
+ * without going through a buffer of ours. A hard link that can not be made, to another
+ * volume, falls back to a copy.
+ *
+ * Files of the same name get a number, so the files of several folders fit in one.
+ * With verify, each copy is read back and its hash checked against the FileHash of
+ * its row, when it has one.
+ */
+class FileExporter : public QObject
+{
+    Q_OBJECT
+public:
+    enum ExportMode
+    {
+        CopyFiles,
+        HardLinkFiles
+    };
+
+    struct Item
+    {
+        QString fullPath;
+        qint64 size = 0;
+        QString fileHash;
+    };
+
+    explicit FileExporter(QObject *parent = nullptr);
+    ~FileExporter();
+
+    void start(const QVector<Item>& items, const QString& destination, ExportMode mode, bool verify);
+    void cancel();
+
+    // Thread safe, for the progress
+    int filesDone() const { return done; }
+    qint64 bytesDone() const { return bytes; }
+
+signals:
+    // failures has a line per file that could not be exported, canceled files are in neither
+    void finished(int exported, const QStringList& failures);
+
+private:
+    bool exportFile(const Item& item, const QString& destinationPath, QString& error);
+    bool verifyFile(const Item& item, const QString& destinationPath, QString& error);
+    void fileDone(qint64 size, bool exported, const QString& failure);
+    static bool copyFile(const QString& sourcePath, const QString& destinationPath, QString& error);
+
+    QThreadPool pool;
+    CancellationToken cancellationToken;
+    ExportMode mode = CopyFiles;
+    bool verify = false;
+    std::atomic<int> done = 0;
+    std::atomic<qint64> bytes = 0;
+    int total = 0;
+
+    QMutex failuresMutex;
+    int exportedFiles = 0;
+    QStringList failures;
+};
+
+#endif // FILEEXPORTER_H
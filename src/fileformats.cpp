@@ -0,0 +1,109 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fileformats.h"
+
+// The bytes of the head the signatures are looked for in, one FITS card
+#define FORMAT_SIGNATURE_SIZE 80
+
+static bool matches(const FileFormats::Signature& signature, const QByteArray& start)
+{
+    return start.mid(signature.offset, signature.bytes.size()) == signature.bytes;
+}
+
+const QVector<FileFormats::Format>& FileFormats::all()
+{
+    static const QVector<Format> formats = {
+        // A gzip signature says nothing about what it compresses, so .fits.gz goes by its name
+        {Fits, {".fits", ".fit", ".fts", ".fz", ".fits.gz", ".fit.gz", ".fts.gz"}, {{0, QByteArray("SIMPLE  =")}}},
+        {Xisf, {".xisf"}, {{0, QByteArray("XISF0100")}}},
+        {Image, {".jpg", ".jpeg", ".png", ".gif", ".tif", ".tiff", ".bmp"},
+         {{0, QByteArray("\xFF\xD8\xFF")}, {0, QByteArray("\x89PNG\r\n\x1A\n")}, {0, QByteArray("GIF87a")}, {0, QByteArray("GIF89a")},
+          {0, QByteArray("II*\0", 4)}, {0, QByteArray("MM\0*", 4)}, {0, QByteArray("BM")}}},
+        // Most raws are TIFF files, only CR2, RW2 and the ISO media based CR3 tell themselves apart
+        {Raw, {".cr2", ".cr3", ".nef", ".nrw", ".arw", ".dng", ".pef", ".rw2"},
+         {{0, QByteArray("II*\0\x10\0\0\0CR", 10)}, {4, QByteArray("ftypcrx ")}, {0, QByteArray("IIU\0", 4)},
+          {0, QByteArray("II*\0", 4)}, {0, QByteArray("MM\0*", 4)}}},
+        {Ser, {".ser"}, {{0, QByteArray("LUCAM-RECORDER")}}},
+    };
+    return formats;
+}
+
+AstroFileType FileFormats::typeOfName(const QString &name)
+{
+    AstroFileType type = UnknownType;
+    int matchedLength = 0;
+    for (auto& format : all())
+    {
+        for (auto& suffix : format.suffixes)
+        {
+            if (suffix.length() > matchedLength && name.endsWith(suffix, Qt::CaseInsensitive))
+            {
+                type = format.type;
+                matchedLength = suffix.length();
+            }
+        }
+    }
+    return type;
+}
+
+AstroFileType FileFormats::typeOfHead(const QByteArray &head)
+{
+    const QByteArray start = head.left(FORMAT_SIGNATURE_SIZE);
+    AstroFileType type = UnknownType;
+    int matchedLength = 0;
+    for (auto& format : all())
+    {
+        for (auto& signature : format.signatures)
+        {
+            if (signature.bytes.size() > matchedLength && matches(signature, start))
+            {
+                type = format.type;
+                matchedLength = signature.bytes.size();
+            }
+        }
+    }
+    return type;
+}
+
+bool FileFormats::hasSignatureOf(AstroFileType type, const QByteArray &head)
+{
+    const QByteArray start = head.left(FORMAT_SIGNATURE_SIZE);
+    for (auto& format : all())
+    {
+        if (format.type != type)
+            continue;
+        for (auto& signature : format.signatures)
+        {
+            if (matches(signature, start))
+                return true;
+        }
+    }
+    return false;
+}
+
+bool FileFormats::isKnownFileName(const QString &name)
+{
+    return typeOfName(name) != UnknownType;
+}
@@ -0,0 +1,78 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FILEFORMATS_H
+#define FILEFORMATS_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+enum AstroFileType
+{
+    UnknownType = -1,
+    Fits,
+    Xisf,
+    Image,
+    Raw, // Camera raw, see RawProcessor
+    Ser // Planetary video, see SerProcessor
+};
+
+/*!
+ * \brief The FileFormats class
+ * The formats there is a FileProcessor for, with the file name suffixes and the
+ * signatures at the start of the file each one declares. The crawler lists the files
+ * by the suffixes, and the processor is picked by the signature in the head of the
+ * file when it has one, so a file whose suffix lies still goes to the right decoder.
+ */
+class FileFormats
+{
+public:
+    struct Signature
+    {
+        int offset;
+        QByteArray bytes;
+    };
+
+    struct Format
+    {
+        AstroFileType type;
+        QStringList suffixes; // With the dot, compared without case
+        QList<Signature> signatures;
+    };
+
+    static const QVector<Format>& all();
+    // By the longest suffix, UnknownType if none matches
+    static AstroFileType typeOfName(const QString& name);
+    // By the longest signature in the first FORMAT_SIGNATURE_SIZE bytes, UnknownType if
+    // none matches. A camera raw built on TIFF has the signature of a TIFF image.
+    static AstroFileType typeOfHead(const QByteArray& head);
+    // Whether the head has one of the signatures of the type
+    static bool hasSignatureOf(AstroFileType type, const QByteArray& head);
+    static bool isKnownFileName(const QString& name);
+};
+
+#endif // FILEFORMATS_H
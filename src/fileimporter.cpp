@@ -0,0 +1,207 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fileimporter.h"
+#include "fileformats.h"
+#include "metrics.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QThread>
+
+#if defined(Q_OS_LINUX)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+// Imported files are handed to the filter this many at a time, so their header phases run together
+#define IMPORT_BATCH_SIZE           16
+
+// Larger files are copied in chunks and read again by the processor
+#define IMPORT_TEE_MAX_BYTES        (256 * 1024 * 1024)
+#define IMPORT_COPY_CHUNK_SIZE      (4 * 1024 * 1024)
+
+// The import waits this long at most for the processor to take the bytes of the files
+// before, in steps of IMPORT_WAIT_STEP_MSECS, so it does not read ahead of the decoding
+#define IMPORT_MAX_WAIT_MSECS       10000
+#define IMPORT_WAIT_STEP_MSECS      20
+
+// Suffix of a file being written
+#define IMPORT_PART_SUFFIX          ".part"
+
+FileImporter::FileImporter(QObject *parent) : QObject(parent)
+{
+}
+
+void FileImporter::setProcessor(NewFileProcessor *newFileProcessor)
+{
+    processor = newFileProcessor;
+}
+
+void FileImporter::cancel()
+{
+    cancelSignaled = true;
+}
+
+void FileImporter::importFolder(const QString &source, const QString &destination)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const QDir sourceDir(source);
+    const QDir destinationDir(destination);
+    int files = 0;
+    int failed = 0;
+    qint64 bytes = 0;
+    QVector<FileRecord> batch;
+
+    QDirIterator it(source, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (it.hasNext() && !cancelSignaled)
+    {
+        const QString sourcePath = it.next();
+        const QString destinationPath = destinationDir.filePath(sourceDir.relativeFilePath(sourcePath));
+        const QFileInfo sourceInfo(sourcePath);
+        const QFileInfo destinationInfo(destinationPath);
+        if (destinationInfo.exists() && destinationInfo.size() == sourceInfo.size())
+            continue;
+        if (!importFile(sourcePath, destinationPath))
+        {
+            qWarning() << "Could not import" << sourcePath << "to" << destinationPath;
+            failed++;
+            continue;
+        }
+        files++;
+        bytes += sourceInfo.size();
+        if (FileFormats::isKnownFileName(sourceInfo.fileName()))
+            batch.append(FileRecord::ofPath(destinationPath));
+        if (batch.count() >= IMPORT_BATCH_SIZE)
+        {
+            emit filesFound(batch);
+            batch.clear();
+        }
+    }
+    if (!batch.isEmpty())
+        emit filesFound(batch);
+
+    qDebug() << "Imported" << files << "files," << bytes / (1024 * 1024) << "MB from" << source << "in" << elapsed.elapsed() << "ms";
+    emit folderImported(source, files, bytes, failed);
+}
+
+/*!
+ * \brief FileImporter::importFile
+ * Reads the file whole, writes it, or clones it, and hands the bytes to the processor
+ * before the file appears under its name. Other files than the ones of known formats,
+ * and the larger ones, are only copied.
+ */
+bool FileImporter::importFile(const QString &sourcePath, const QString &destinationPath)
+{
+    static std::atomic<qint64>& teedCount = Metrics::counter("importer.files_teed");
+    static std::atomic<qint64>& clonedCount = Metrics::counter("importer.files_cloned");
+    static std::atomic<qint64>& bytesCount = Metrics::counter("importer.bytes");
+
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly))
+        return false;
+    const QFileInfo destinationInfo(destinationPath);
+    if (!QDir().mkpath(destinationInfo.absolutePath()))
+        return false;
+    const QString partPath = destinationPath + IMPORT_PART_SUFFIX;
+    QFile destination(partPath);
+    if (!destination.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    const bool tee = FileFormats::isKnownFileName(destinationInfo.fileName()) && source.size() <= IMPORT_TEE_MAX_BYTES;
+    QByteArray contents;
+    bool copied = false;
+    if (tee)
+    {
+        contents = source.readAll();
+        if (contents.size() != source.size())
+        {
+            destination.remove();
+            return false;
+        }
+    }
+#if defined(Q_OS_LINUX)
+    // Shares the blocks of the source on Btrfs and XFS, nothing is written
+    if (::ioctl(destination.handle(), FICLONE, source.handle()) == 0)
+    {
+        clonedCount++;
+        copied = true;
+    }
+#endif
+    if (!copied)
+        copied = tee ? destination.write(contents) == contents.size() : copyInChunks(source, destination);
+    // The archive keeps the time the frame was taken
+    if (copied)
+        destination.setFileTime(QFileInfo(source).lastModified(), QFileDevice::FileModificationTime);
+    destination.close();
+    if (!copied || destination.error() != QFileDevice::NoError)
+    {
+        destination.remove();
+        return false;
+    }
+
+    if (tee && processor != nullptr)
+    {
+        waitForRoom(contents.size());
+        processor->announceContents(destinationPath, contents);
+        teedCount++;
+    }
+    QFile::remove(destinationPath);
+    if (!QFile::rename(partPath, destinationPath))
+    {
+        QFile::remove(partPath);
+        return false;
+    }
+    bytesCount += source.size();
+    return true;
+}
+
+bool FileImporter::copyInChunks(QFile &source, QFile &destination)
+{
+    QByteArray chunk(IMPORT_COPY_CHUNK_SIZE, Qt::Uninitialized);
+    while (!cancelSignaled)
+    {
+        const qint64 read = source.read(chunk.data(), chunk.size());
+        if (read < 0)
+            return false;
+        if (read == 0)
+            return true;
+        if (destination.write(chunk.constData(), read) != read)
+            return false;
+    }
+    return false;
+}
+
+// The processor drops the oldest bytes it was handed past its budget
+void FileImporter::waitForRoom(qint64 bytes)
+{
+    QElapsedTimer waited;
+    waited.start();
+    while (!processor->hasRoomForContents(bytes) && waited.elapsed() < IMPORT_MAX_WAIT_MSECS && !cancelSignaled)
+        QThread::msleep(IMPORT_WAIT_STEP_MSECS);
+}
@@ -0,0 +1,74 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FILEIMPORTER_H
+#define FILEIMPORTER_H
+
+#include "filerecord.h"
+#include "newfileprocessor.h"
+
+#include <QFile>
+#include <QObject>
+#include <QVector>
+
+/*!
+ * \brief The FileImporter class
+ * Copies the files of a card or a capture drive into a folder of the archive, reading
+ * each file once. The bytes read are written to the destination, cloned there instead
+ * where the file system can, and handed to the processor with the file, so the header,
+ * hashes and thumbnail are made from them and the copy is not read back. The files are
+ * registered at their destination.
+ *
+ * A file is written next to its destination and renamed once complete, so the crawler
+ * and the watcher never see it half written. Files already at the destination with
+ * the same size are skipped, so an import can be run again after it was stopped.
+ *
+ * Lives on a thread of its own.
+ */
+class FileImporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileImporter(QObject *parent = nullptr);
+    void setProcessor(NewFileProcessor* newFileProcessor);
+    void cancel();
+
+public slots:
+    // The files of source and its subfolders go to the same subfolders of destination
+    void importFolder(const QString& source, const QString& destination);
+
+signals:
+    void filesFound(const QVector<FileRecord>& files);
+    void folderImported(const QString& source, int files, qint64 bytes, int failed);
+
+private:
+    bool importFile(const QString& sourcePath, const QString& destinationPath);
+    bool copyInChunks(QFile& source, QFile& destination);
+    void waitForRoom(qint64 bytes);
+
+    NewFileProcessor* processor = nullptr;
+    volatile bool cancelSignaled = false;
+};
+
+#endif // FILEIMPORTER_H
@@ -23,6 +23,12 @@
 */
 
 #include "fileprocessfilter.h"
+#include "filereader.h"
+#include "filerepository.h"
+#include "metrics.h"
+#include "volumeregistry.h"
+
+#include <QFileInfo>
 
 FileProcessFilter::FileProcessFilter(QObject *parent) : QObject(parent)
 {
@@ -38,15 +44,221 @@ void FileProcessFilter::cancel()
     cancelSignaled = true;
 }
 
-void FileProcessFilter::filterFile(QFileInfo fileInfo)
+void FileProcessFilter::setShard(int index, int count)
+{
+    shardCount = qMax(1, count);
+    shardIndex = qBound(0, index, shardCount - 1);
+}
+
+/*!
+ * \brief FileProcessFilter::shardOfDirectory
+ * FNV-1a of the path, which unlike qHash is the same in every process and on every
+ * platform, so all indexers agree on who takes which directory.
+ */
+int FileProcessFilter::shardOfDirectory(const QString &directory, int count)
+{
+    quint32 hash = 2166136261u;
+    for (QChar c : directory)
+    {
+        hash ^= c.unicode();
+        hash *= 16777619u;
+    }
+    return hash % quint32(count);
+}
+
+void FileProcessFilter::filterFiles(const QVector<FileRecord>& files)
 {
+    static LatencyHistogram& batchLatency = Metrics::histogram("filter.batch");
+    static std::atomic<qint64>& acceptedCount = Metrics::counter("filter.accepted");
+    ScopedLatency latency(batchLatency);
+
+    if (!isCatalogLoaded)
+    {
+        holdUntilLoaded(files);
+        return;
+    }
+
+    QVector<FileRecord> accepted;
+    QVector<FileRecord> deferred;
+    for (auto& record : files)
+    {
+        if (cancelSignaled)
+            return;
+        if (shardCount > 1 && shardOfDirectory(record.absolutePath(), shardCount) != shardIndex)
+            continue;
+        if (isProcessing(record) || !catalog->shouldProcessFile(record) || aliasHardLink(record) || rebindMovedFile(record))
+            continue;
+        if (waitForLinkedFile(record))
+        {
+            deferred.append(record);
+            continue;
+        }
+        accepted.append(record);
+        processingFiles.insert(record.FullPath, record);
+        if (record.hasIdentity())
+            processingIdentities.insert(FileIdentity(record.Device, record.Inode), record.FullPath);
+    }
+    acceptedCount += accepted.count();
     if (cancelSignaled)
         return;
-    if (!catalog->shouldProcessFile(fileInfo))
+    if (!deferred.isEmpty())
+        emit filesDeferred(deferred);
+    if (!accepted.isEmpty())
+        emit shouldProcess(accepted);
+}
+
+/*!
+ * \brief FileProcessFilter::isProcessing
+ * The same version of a file that is being processed, listed again by a crawl or the
+ * watcher, or resumed from the ingest journal while a crawl finds it too.
+ */
+bool FileProcessFilter::isProcessing(const FileRecord &record) const
+{
+    auto it = processingFiles.constFind(record.FullPath);
+    return it != processingFiles.constEnd() && it->Size == record.Size && it->LastModifiedTime == record.LastModifiedTime;
+}
+
+/*!
+ * \brief FileProcessFilter::aliasHardLink
+ * A new file with the device and inode of a processed file is a hard link of it, the
+ * same bytes under another name. It gets a copy of the row of that file, with its
+ * hashes, keywords and thumbnails, and is not read. Reflinks and copies have an inode
+ * of their own and are processed.
+ */
+bool FileProcessFilter::aliasHardLink(const FileRecord &record)
+{
+    static std::atomic<qint64>& aliasedCount = Metrics::counter("filter.aliased");
+    AstroFile alias;
+    int sourceId = 0;
+    if (!catalog->aliasOf(record, VolumeRegistry::nameOf(record.CanonicalDirectory), alias, sourceId))
+        return false;
+    aliasedCount++;
+    emit fileAliased(alias, sourceId);
+    return true;
+}
+
+/*!
+ * \brief FileProcessFilter::rebindMovedFile
+ * A new file with the size and modification time of a file that is gone, and the
+ * same quick hash, is that file moved or renamed. Its row moves to the new path
+ * with its keywords and thumbnail, and the file is not processed again.
+ *
+ * The files of a volume that is not mounted are gone too, but kept until it is back,
+ * see IndexingEngine::checkVolume. A copy of one of them, with its time kept, is not
+ * a move: the volume the row was written on must be mounted where the row has it.
+ */
+bool FileProcessFilter::rebindMovedFile(const FileRecord &record)
+{
+    static std::atomic<qint64>& movedCount = Metrics::counter("filter.moved");
+    const QList<AstroFile> candidates = catalog->moveCandidates(record);
+    QString quickHash;
+    for (auto& candidate : candidates)
+    {
+        // A copy leaves the original where it was
+        if (candidate.QuickHash.isEmpty() || QFileInfo::exists(candidate.FullPath))
+            continue;
+        if (VolumeRegistry::nameOf(candidate.DirectoryPath) != candidate.VolumeName)
+            continue;
+        if (quickHash.isEmpty())
+            quickHash = FileReader::quickHashOfFile(record.FullPath);
+        if (quickHash != candidate.QuickHash)
+            continue;
+
+        AstroFile moved;
+        if (!catalog->moveAstroFile(candidate.FullPath, record, VolumeRegistry::nameOf(record.CanonicalDirectory), moved))
+            continue;
+        movedCount++;
+        emit fileMoved(moved);
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * \brief FileProcessFilter::waitForLinkedFile
+ * A hard link of a file that is being processed waits for it, see releaseAliases,
+ * instead of being read a second time alongside it.
+ */
+bool FileProcessFilter::waitForLinkedFile(const FileRecord &record)
+{
+    if (!record.hasIdentity())
+        return false;
+    auto it = processingIdentities.constFind(FileIdentity(record.Device, record.Inode));
+    if (it == processingIdentities.constEnd() || it.value() == record.FullPath)
+        return false;
+    waitingAliases.insert(it.value(), record);
+    return true;
+}
+
+void FileProcessFilter::releaseAliases(const QString &fullPath)
+{
+    auto it = processingFiles.find(fullPath);
+    if (it == processingFiles.end())
         return;
+    if (it->hasIdentity())
+        processingIdentities.remove(FileIdentity(it->Device, it->Inode));
+    processingFiles.erase(it);
+
+    // Aliased when the file was processed, processed themselves otherwise
+    const QList<FileRecord> waiting = waitingAliases.values(fullPath);
+    waitingAliases.remove(fullPath);
+    if (!waiting.isEmpty())
+        filterFiles(QVector<FileRecord>(waiting.begin(), waiting.end()));
+}
+
+void FileProcessFilter::forwardDirectoryManifest(const QList<DirectoryState> &updated, const QStringList &removed)
+{
+    // Passing the manifest through here keeps it behind the shouldProcess signals
+    // of the same crawl, so the receiver has already counted those files as jobs.
     if (cancelSignaled)
         return;
-    emit shouldProcess(fileInfo);
+    if (!isCatalogLoaded)
+    {
+        heldManifests.append({updated, removed});
+        return;
+    }
+    emit directoryManifestUpdated(updated, removed);
 }
 
+/*!
+ * \brief FileProcessFilter::holdUntilLoaded
+ * The crawl starts while the catalog is still loading. Its files are checked against
+ * the db instead, so the ones that did not change, usually nearly all of them, are
+ * dropped right away. The others wait for the catalog, which the filter needs to tell
+ * moved files and hard links from new ones, and whose rows must not be written while
+ * it loads.
+ */
+void FileProcessFilter::holdUntilLoaded(const QVector<FileRecord> &files)
+{
+    static std::atomic<qint64>& reconciledCount = Metrics::counter("filter.reconciled_from_db");
+    QVector<FileRecord> candidates;
+    for (auto& record : files)
+    {
+        if (shardCount > 1 && shardOfDirectory(record.absolutePath(), shardCount) != shardIndex)
+            continue;
+        if (catalog->isInSearchFolders(record.FullPath))
+            candidates.append(record);
+    }
+
+    const QSet<QString> unchanged = FileRepository::unchangedFiles(candidates);
+    reconciledCount += unchanged.count();
+    for (auto& record : candidates)
+    {
+        if (!unchanged.contains(record.FullPath))
+            heldFiles.append(record);
+    }
+}
 
+void FileProcessFilter::catalogLoaded()
+{
+    if (isCatalogLoaded)
+        return;
+    isCatalogLoaded = true;
+
+    QVector<FileRecord> files;
+    files.swap(heldFiles);
+    filterFiles(files);
+    for (auto& manifest : heldManifests)
+        forwardDirectoryManifest(manifest.first, manifest.second);
+    heldManifests.clear();
+}
@@ -26,9 +26,14 @@
 #define FILEPROCESSFILTER_H
 
 #include "catalog.h"
+#include "directorystate.h"
+#include "filerecord.h"
 
-#include <QFileInfo>
+#include <QHash>
+#include <QMultiHash>
 #include <QObject>
+#include <QPair>
+#include <QVector>
 
 class FileProcessFilter : public QObject
 {
@@ -38,15 +43,54 @@ public:
     virtual void setCatalog(Catalog* cat);
     virtual void cancel();
 
+    // Only files in the directories of shard index of count are processed, so several
+    // indexers can split one tree between them. Call before filtering starts.
+    void setShard(int index, int count);
+    static int shardOfDirectory(const QString& directory, int count);
+
 public slots:
-    void filterFile(QFileInfo fileInfo);
+    void filterFiles(const QVector<FileRecord>& files);
+    void forwardDirectoryManifest(const QList<DirectoryState>& updated, const QStringList& removed);
+    // The file accepted at fullPath is done, its hard links that waited for it are filtered again
+    void releaseAliases(const QString& fullPath);
+    // Filters the files held while the catalog loaded, see filterFiles
+    void catalogLoaded();
 
 signals:
-    void shouldProcess(QFileInfo fileInfo);
+    void shouldProcess(const QVector<FileRecord>& files);
+    // A new file was the file of a row moved or renamed, and took over that row in the catalog
+    void fileMoved(const AstroFile& astroFile);
+    // A new file was a hard link of the file of sourceId, and is written with its row
+    void fileAliased(const AstroFile& alias, int sourceId);
+    // Hard links held back until the file they link to is done, see waitForLinkedFile
+    void filesDeferred(const QVector<FileRecord>& files);
+    void directoryManifestUpdated(const QList<DirectoryState>& updated, const QStringList& removed);
 
 private:
+    typedef QPair<quint64, quint64> FileIdentity; // Device and inode
+
+    bool aliasHardLink(const FileRecord& record);
+    bool rebindMovedFile(const FileRecord& record);
+    bool waitForLinkedFile(const FileRecord& record);
+    bool isProcessing(const FileRecord& record) const;
+    void holdUntilLoaded(const QVector<FileRecord>& files);
+
     Catalog* catalog;
     volatile bool cancelSignaled = false;
+    int shardIndex = 0;
+    int shardCount = 1;
+
+    // Until the catalog is loaded, the files the db does not have as they are, and the
+    // manifests of their crawls, which must not be recorded before the files are journaled
+    bool isCatalogLoaded = false;
+    QVector<FileRecord> heldFiles;
+    QList<QPair<QList<DirectoryState>, QStringList>> heldManifests;
+
+    // The accepted files that are not done yet, by path, and by identity for the ones that have one
+    QHash<FileIdentity, QString> processingIdentities;
+    QHash<QString, FileRecord> processingFiles;
+    // Hard links of those files, by the path of the file they wait for
+    QMultiHash<QString, FileRecord> waitingAliases;
 };
 
 #endif // FILEPROCESSFILTER_H
@@ -26,6 +26,8 @@
 #define FILEPROCESSOR_H
 
 #include "astrofile.h"
+#include "cancellationtoken.h"
+#include "filereader.h"
 
 class FileProcessor
 {
@@ -33,12 +35,41 @@ public:
     virtual ~FileProcessor() {};
 
     virtual bool loadFile(const AstroFile& astroFile) = 0;
+
+    // Loads from data that was already read by the reader. Processors that can
+    // not decode from memory fall back to reading the file themselves.
+    virtual bool loadFile(const AstroFile& astroFile, const FileReader& reader) { Q_UNUSED(reader); return loadFile(astroFile); }
+    // Loads only what extractTags needs, for the header phase. The whole file by default.
+    virtual bool loadHeader(const AstroFile& astroFile) { return loadFile(astroFile); }
+    // The same from the head of the file, read ahead with the heads of other files (see
+    // AsyncFileIo::readHeads). Reads past the head go to the file. Empty when not read.
+    virtual bool loadHeader(const AstroFile& astroFile, const QByteArray& head) { Q_UNUSED(head); return loadHeader(astroFile); }
     virtual void extractTags() = 0;
     virtual void extractThumbnail() = 0;
     virtual QMap<QString, QString> getTags() = 0;
     virtual QImage getThumbnail() = 0;
     virtual QImage getTinyThumbnail() = 0;
-    virtual QByteArray getImageHash() = 0;
+    virtual QByteArray getImageHash() = 0; // Hex encoded, see Hasher
+
+    // The StretchParams of the thumbnail, see StretchParams::toByteArray. Empty when
+    // the processor does not stretch. loadFile reuses the ones stored in the AstroFile.
+    virtual QByteArray getStretchParams() { return QByteArray(); }
+    // The thumbnail before the stretch, see LinearThumbnail. Null when the processor
+    // does not stretch.
+    virtual QImage getLinearThumbnail() { return QImage(); }
+
+    // Measured during extractThumbnail, see FrameAnalyzer. Not measured by default.
+    virtual FrameQuality getFrameQuality() { return FrameQuality(); }
+
+    // Closes the file and forgets its results, so the processor can load the next file
+    virtual void reset() = 0;
+
+    // Checked while the pixels are decoded. A canceled extractThumbnail leaves the
+    // thumbnail null, the results are then not of the whole file.
+    void setCancellationToken(const CancellationToken& token) { cancellationToken = token; }
+
+protected:
+    CancellationToken cancellationToken;
 };
 
 #endif // FILEPROCESSOR_H
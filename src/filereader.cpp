@@ -0,0 +1,297 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "filereader.h"
+
+#include "asyncfileio.h"
+#include "framebufferpool.h"
+#include "hasher.h"
+#include "objectstore.h"
+
+#if defined(Q_OS_LINUX) || defined(Q_OS_MAC)
+#include <fcntl.h>
+#endif
+
+// Reads used when the file can not be mapped, and the slices fed to the hash
+#define FILE_READ_CHUNK_SIZE (4 * 1024 * 1024)
+
+// Bytes of a file read between two checks of the cancellation token
+#define FILE_READ_CANCEL_SIZE (64 * 1024 * 1024)
+
+// The quick hash covers the start of the file (all FITS/XISF headers we have seen
+// fit in it), three blocks at 1/4, 1/2 and 3/4 of the file, and the end of the file
+#define QUICK_HASH_HEAD_SIZE    (64 * 1024)
+#define QUICK_HASH_BLOCK_SIZE   (16 * 1024)
+
+// A byte of every page is touched by prefetch, and the token checked every chunk
+#define PREFETCH_PAGE_SIZE 4096
+
+FileReader::FileReader()
+{
+    _mapped = nullptr;
+    _buffer = nullptr;
+    _data = nullptr;
+    _size = 0;
+    _volume = nullptr;
+}
+
+FileReader::~FileReader()
+{
+    if (_mapped != nullptr)
+    {
+        _file.unmap(_mapped);
+#if defined(Q_OS_LINUX)
+        // The pages the decode faulted in, once it is done with them
+        if (cacheMode() != CachedIngest)
+            posix_fadvise(_file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    }
+    FrameBufferPool::release(_buffer);
+}
+
+IngestCacheMode FileReader::cacheMode() const
+{
+    // Only the ingest reads files with their volume, a file opened to be looked at stays cached
+    return _volume != nullptr ? _volume->policy().cacheMode : CachedIngest;
+}
+
+/*!
+ * \brief readCancelably
+ * Reads the chunks with read, FILE_READ_CANCEL_SIZE of them at a time, checking the
+ * token in between. Returns false when a read failed or the token was canceled.
+ */
+template <typename Read>
+static bool readCancelably(QVector<FileReadRequest>& chunks, qint64 chunkSize, const CancellationToken& token, Read read)
+{
+    const int batch = int(qMax<qint64>(1, FILE_READ_CANCEL_SIZE / chunkSize));
+    for (int first = 0; first < chunks.count(); first += batch)
+    {
+        if (token.isCanceled())
+            return false;
+        QVector<FileReadRequest> slice = chunks.mid(first, batch);
+        if (!read(slice))
+            return false;
+    }
+    return true;
+}
+
+bool FileReader::open(const QString &filePath, VolumeIo* volume, const CancellationToken& token)
+{
+    _volume = volume;
+    _file.setFileName(filePath);
+    if (ObjectStore::isObjectPath(filePath))
+        return readObject(token);
+    if (!_file.open(QIODevice::ReadOnly))
+        return false;
+
+    _size = _file.size();
+#if defined(Q_OS_MAC)
+    // Direct reads too, macOS has no O_DIRECT
+    if (cacheMode() != CachedIngest)
+        fcntl(_file.handle(), F_NOCACHE, 1);
+#endif
+
+    if (_volume != nullptr && (!_volume->policy().mapFiles || cacheMode() == DirectIngest))
+    {
+#if defined(Q_OS_LINUX)
+        // Larger read-ahead for the sequential read, and the page cache is not kept
+        // for a file that is only decoded from our buffer
+        posix_fadvise(_file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+        bool read = readInChunks(cacheMode() == DirectIngest, token);
+        if (cacheMode() != CachedIngest)
+            posix_fadvise(_file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+        return read;
+#else
+        return readInChunks(cacheMode() == DirectIngest, token);
+#endif
+    }
+
+    _mapped = _size > 0 ? _file.map(0, _size) : nullptr;
+    if (_mapped == nullptr)
+        return readInChunks(false, token);
+
+#if defined(Q_OS_LINUX)
+    // Starts reading the whole file in before the first page fault
+    posix_fadvise(_file.handle(), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+    _data = _mapped;
+    return true;
+}
+
+bool FileReader::openContents(const QString &filePath, const QByteArray &contents)
+{
+    _file.setFileName(filePath);
+    _contents = contents;
+    _size = _contents.size();
+    _data = reinterpret_cast<const uchar*>(_contents.constData());
+    return true;
+}
+
+/*!
+ * \brief FileReader::readInChunks
+ * Reads the file into a pooled buffer, in the chunks of the volume. Direct reads ask
+ * for whole blocks of DIRECT_IO_ALIGNMENT, up to past the end of the file.
+ */
+bool FileReader::readInChunks(bool direct, const CancellationToken& token)
+{
+    auto alignUp = [](qint64 value) { return (value + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT; };
+    const qint64 capacity = direct ? alignUp(_size) : _size;
+    _buffer = FrameBufferPool::acquire(size_t(qMax<qint64>(capacity, 1)));
+    if (_buffer == nullptr)
+        return false;
+
+    qint64 chunkSize = _volume != nullptr && _volume->policy().readChunkSize > 0 ? _volume->policy().readChunkSize : FILE_READ_CHUNK_SIZE;
+    if (direct)
+        chunkSize = alignUp(chunkSize);
+    QVector<FileReadRequest> chunks;
+    chunks.reserve(int((capacity + chunkSize - 1) / chunkSize));
+    for (qint64 offset = 0; offset < capacity; offset += chunkSize)
+        chunks.append({offset, qMin<qint64>(chunkSize, capacity - offset), reinterpret_cast<char*>(_buffer) + offset});
+    if (!readCancelably(chunks, chunkSize, token, [&](QVector<FileReadRequest>& slice) { return AsyncFileIo::read(_file, slice, _volume, direct); }))
+        return false;
+
+    _data = _buffer;
+    return true;
+}
+
+/*!
+ * \brief FileReader::readObject
+ * Fetches the whole object into a pooled buffer, in ranges of the chunk size of its
+ * volume, as many at once as its queue depth.
+ */
+bool FileReader::readObject(const CancellationToken& token)
+{
+    _size = ObjectStore::sizeOf(_file.fileName());
+    if (_size < 0)
+        return false;
+    _buffer = FrameBufferPool::acquire(size_t(qMax<qint64>(_size, 1)));
+    if (_buffer == nullptr)
+        return false;
+
+    const qint64 chunkSize = _volume != nullptr && _volume->policy().readChunkSize > 0 ? _volume->policy().readChunkSize : FILE_READ_CHUNK_SIZE;
+    QVector<FileReadRequest> chunks;
+    for (qint64 offset = 0; offset < _size; offset += chunkSize)
+        chunks.append({offset, qMin<qint64>(chunkSize, _size - offset), reinterpret_cast<char*>(_buffer) + offset});
+    if (!readCancelably(chunks, chunkSize, token, [&](QVector<FileReadRequest>& slice) { return ObjectStore::read(_file.fileName(), slice, _volume); }))
+        return false;
+
+    _data = _buffer;
+    return true;
+}
+
+void FileReader::prefetch(const CancellationToken &token) const
+{
+    // A file that could not be mapped was read already
+    if (_mapped == nullptr)
+        return;
+
+    uchar sum = 0;
+    for (qint64 chunk = 0; chunk < _size; chunk += FILE_READ_CHUNK_SIZE)
+    {
+        if (token.isCanceled())
+            return;
+        const qint64 end = qMin<qint64>(chunk + FILE_READ_CHUNK_SIZE, _size);
+        for (qint64 offset = chunk; offset < end; offset += PREFETCH_PAGE_SIZE)
+            sum += static_cast<const volatile uchar*>(_mapped)[offset];
+    }
+    Q_UNUSED(sum);
+}
+
+QByteArray FileReader::fileHash(const CancellationToken& token) const
+{
+    if (_fileHash.isEmpty() && _data != nullptr)
+    {
+        // A mapped file is read from the disk as it is hashed
+        Hasher hash;
+        for (qint64 offset = 0; offset < _size; offset += FILE_READ_CHUNK_SIZE)
+        {
+            if (token.isCanceled())
+                return QByteArray();
+            hash.addData(reinterpret_cast<const char*>(_data) + offset, qMin<qint64>(FILE_READ_CHUNK_SIZE, _size - offset));
+        }
+        _fileHash = hash.result();
+    }
+    return _fileHash;
+}
+
+// Offsets and lengths of the blocks covered by the quick hash of a file of this size
+static QList<QPair<qint64, qint64>> quickHashBlocks(qint64 size)
+{
+    if (size <= QUICK_HASH_HEAD_SIZE + 4 * QUICK_HASH_BLOCK_SIZE)
+        return {{0, size}};
+
+    return {
+        {0, QUICK_HASH_HEAD_SIZE},
+        {size / 4, QUICK_HASH_BLOCK_SIZE},
+        {size / 2, QUICK_HASH_BLOCK_SIZE},
+        {size / 4 * 3, QUICK_HASH_BLOCK_SIZE},
+        {size - QUICK_HASH_BLOCK_SIZE, QUICK_HASH_BLOCK_SIZE}
+    };
+}
+
+static QString quickHashString(qint64 size, Hasher& hasher)
+{
+    return QString::number(size) + ':' + hasher.result();
+}
+
+QString FileReader::quickHash() const
+{
+    if (_data == nullptr)
+        return QString();
+
+    // Always XXH64, the quick hash is only compared with other quick hashes
+    Hasher hasher(HashAlgorithmXxh64);
+    for (auto& block : quickHashBlocks(_size))
+        hasher.addData(reinterpret_cast<const char*>(_data) + block.first, block.second);
+    return quickHashString(_size, hasher);
+}
+
+QString FileReader::quickHashOfFile(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    // The blocks are read together
+    qint64 size = file.size();
+    const QList<QPair<qint64, qint64>> blocks = quickHashBlocks(size);
+    qint64 length = 0;
+    for (auto& block : blocks)
+        length += block.second;
+    QByteArray data(int(length), Qt::Uninitialized);
+    QVector<FileReadRequest> requests;
+    qint64 offset = 0;
+    for (auto& block : blocks)
+    {
+        requests.append({block.first, block.second, data.data() + offset});
+        offset += block.second;
+    }
+    if (!AsyncFileIo::read(file, requests))
+        return QString();
+
+    Hasher hasher(HashAlgorithmXxh64);
+    hasher.addData(data.constData(), data.size());
+    return quickHashString(size, hasher);
+}
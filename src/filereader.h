@@ -0,0 +1,91 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include "cancellationtoken.h"
+#include "volumeio.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+/*!
+ * \brief The FileReader class
+ * Reads a file once, and hands the same bytes to the whole-file hash and to the
+ * decoders. The file is memory-mapped when possible, otherwise it is read in
+ * large chunks. Files of a volume whose policy does not map them are read in the
+ * chunks of the volume, as many in flight as its queue depth (see AsyncFileIo):
+ * solid state volumes with a deep queue, spinning disks and network shares
+ * sequentially and paced by the volume.
+ *
+ * What the ingest read is dropped from the page cache once the reader is done with
+ * it, or read past the cache, see IngestCacheMode. Other readers leave it cached.
+ * Objects of an object store are fetched whole, see ObjectStore. The bytes of a file
+ * handed over by the program that wrote it are used as they are, see IngestServer.
+ * The data stays valid until the reader is destroyed.
+ */
+class FileReader
+{
+public:
+    FileReader();
+    ~FileReader();
+
+    // A file read rather than mapped is read FILE_READ_CANCEL_SIZE at a time, and not
+    // opened when the token is canceled before the end
+    bool open(const QString& filePath, VolumeIo* volume = nullptr, const CancellationToken& token = CancellationToken());
+    // The file at filePath is not read, contents is what it holds
+    bool openContents(const QString& filePath, const QByteArray& contents);
+    const uchar* data() const { return _data; }
+    qint64 size() const { return _size; }
+    QString filePath() const { return _file.fileName(); }
+
+    // Reads the pages of a mapped file in, so whoever uses the data next does not wait for the disk
+    void prefetch(const CancellationToken& token) const;
+
+    // Hash of the whole file, hex encoded by the Hasher. Computed on first use, empty
+    // when the token is canceled before the end.
+    QByteArray fileHash(const CancellationToken& token = CancellationToken()) const;
+
+    // Cheap fingerprint of the file: its size and the hash of a few sampled blocks
+    QString quickHash() const;
+    static QString quickHashOfFile(const QString& filePath);
+
+private:
+    QFile _file;
+    uchar* _mapped;
+    uchar* _buffer; // From the FrameBufferPool
+    QByteArray _contents; // Of openContents
+    const uchar* _data;
+    qint64 _size;
+    mutable QByteArray _fileHash;
+    VolumeIo* _volume;
+
+    IngestCacheMode cacheMode() const;
+    bool readInChunks(bool direct, const CancellationToken& token);
+    bool readObject(const CancellationToken& token);
+};
+
+#endif // FILEREADER_H
@@ -0,0 +1,119 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FILERECORD_H
+#define FILERECORD_H
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QString>
+
+/*!
+ * \brief The FileRecord struct
+ * What listing a directory told us about one of its files. It goes down the ingest
+ * pipeline instead of a QFileInfo, so the filter and the processor do not stat the
+ * file, or resolve its directory, again. CanonicalDirectory is resolved once per
+ * listed directory and shared by all its files.
+ *
+ * Device and Inode identify the file itself, whichever of its hard links it was
+ * listed by. The volume serial number and the file id on Windows.
+ *
+ * PathHash is hashOf(FullPath), worked out once when the file is listed, for the
+ * catalog's path index. 0 where the record was made some other way.
+ */
+struct FileRecord
+{
+    QString FullPath;
+    QString CanonicalDirectory;
+    qint64 Size = 0;
+    qint64 LastModifiedTime = 0; // msecs since epoch
+    qint64 CreatedTime = 0; // msecs since epoch, 0 where the file system does not keep it
+    quint64 Device = 0;
+    quint64 Inode = 0; // 0 where the platform has none, the file has no identity then
+    quint64 PathHash = 0;
+
+    QString fileName() const
+    {
+        return FullPath.mid(FullPath.lastIndexOf('/') + 1);
+    }
+
+    QString absolutePath() const
+    {
+        return FullPath.left(FullPath.lastIndexOf('/'));
+    }
+
+    bool hasIdentity() const
+    {
+        return Inode != 0;
+    }
+
+    quint64 pathHash() const
+    {
+        return PathHash != 0 ? PathHash : hashOf(FullPath);
+    }
+
+    // FNV-1a over the UTF-16 code units, 64 bit
+    static quint64 hashOf(const QString& path)
+    {
+        quint64 hash = 14695981039346656037ull;
+        for (QChar c : path)
+        {
+            hash ^= c.unicode();
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    QDateTime lastModified() const
+    {
+        return QDateTime::fromMSecsSinceEpoch(LastModifiedTime);
+    }
+
+    QDateTime birthTime() const
+    {
+        return CreatedTime != 0 ? QDateTime::fromMSecsSinceEpoch(CreatedTime) : QDateTime();
+    }
+
+    // For the paths that do not come from a directory listing. Stats the file.
+    static FileRecord ofPath(const QString& path)
+    {
+        return ofFileInfo(QFileInfo(path));
+    }
+
+    static FileRecord ofFileInfo(const QFileInfo& fileInfo)
+    {
+        FileRecord record;
+        record.FullPath = fileInfo.absoluteFilePath();
+        record.CanonicalDirectory = fileInfo.canonicalPath();
+        record.Size = fileInfo.size();
+        const QDateTime lastModified = fileInfo.lastModified();
+        record.LastModifiedTime = lastModified.isValid() ? lastModified.toMSecsSinceEpoch() : 0;
+        const QDateTime created = fileInfo.birthTime();
+        record.CreatedTime = created.isValid() ? created.toMSecsSinceEpoch() : 0;
+        record.PathHash = hashOf(record.FullPath);
+        return record;
+    }
+};
+
+#endif // FILERECORD_H
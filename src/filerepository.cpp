@@ -22,28 +22,272 @@
     SOFTWARE.
 */
 
+#include "allocationtracker.h"
+#include "arrowstreamwriter.h"
+#include "catalogsnapshot.h"
+#include "filereader.h"
 #include "filerepository.h"
+#include "hasher.h"
+#include "linearthumbnail.h"
+#include "metrics.h"
+#include "perceptualhash.h"
+#include "skycoordinates.h"
+#include "stringpool.h"
+#include "thumbnailcodec.h"
 
-#include <QBuffer>
+#include <QDataStream>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QLocale>
 #include <QPixmap>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QSettings>
 #include <QSqlDatabase>
 #include <QSqlDriver>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QStandardPaths>
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrent>
 
-#define DB_SCHEMA_VERSION 1
+#include <cmath>
+#include <iterator>
+
+#define DB_SCHEMA_VERSION 33
+#define DB_READER_BUSY_TIMEOUT 5000
+#define MODEL_PAGE_SIZE 2000
+// The change log keeps the last FILE_CHANGES_KEPT changes. Readers that are further behind load every file again.
+#define FILE_CHANGES_KEPT 200000
+// The reports of the last INGEST_RUNS_KEPT ingests are kept, see addIngestRun
+#define INGEST_RUNS_KEPT 1000
+// The export is written to its file in chunks of this many bytes
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+// Suffix of the exports written as an Arrow IPC stream instead of CSV
+#define EXPORT_ARROW_SUFFIX ".arrows"
+// The portable catalog of a volume, under its root
+#define VOLUME_CATALOG_FILE ".astrocat/catalog.db"
+// Ids bound to one execution of the thumbnail batch statements
+#define THUMBNAIL_BATCH_SIZE 32
+// Long operations commit and let the waiting requests run after this many rows
+#define DELETE_CHUNK_SIZE 2000
+#define BACKFILL_CHUNK_SIZE 200
+// Files of quick hash collisions read in full at the same time, see resolveQuickHashCollisions
+#define COLLISION_HASH_THREADS 2
+#define RESTRETCH_CHUNK_SIZE 500
+// The page cache is a quarter of the db, within these bounds
+#define DB_MIN_CACHE_SIZE (16 * 1024 * 1024)
+#define DB_MAX_CACHE_SIZE (256 * 1024 * 1024)
+#define DB_MAX_MMAP_SIZE (1024LL * 1024 * 1024)
+#define DB_PAGE_SIZE 8192
+// Maintenance runs when the engine is idle, at most this often, see runMaintenance
+#define MAINTENANCE_INTERVAL (10 * 60 * 1000)
+#define VACUUM_PAGES_PER_SLICE 512
+// The rows a data migration commits at a time, see runMigrations
+#define MIGRATION_CHUNK_SIZE 2000
+// The files of a removed search folder are kept this many days, DetachedFolderDays, see detachFolder
+#define DETACHED_FOLDER_DAYS 30
+
+// A dictionary for the tag tails is trained once the db has this many, see trainTagDictionary
+#define TAG_DICTIONARY_MIN_FILES 500
+// and trained again once it has this many times the tails it was trained on
+#define TAG_DICTIONARY_RETRAIN_FACTOR 4
+// The tails a dictionary is trained on, spread over the db
+#define TAG_DICTIONARY_SAMPLE_FILES 2000
+
+/*!
+ * \brief The TagColumn struct
+ * The keywords the view shows and filters on are kept in typed columns of the fits
+ * table, the filtered ones indexed. All the other keywords of a file are kept in one
+ * blob of the tag_tails table, which is only read when asked for, see loadTags.
+ */
+struct TagColumn
+{
+    const char* key;
+    const char* column;
+    const char* type;
+    bool indexed;
+};
+
+static const TagColumn tagColumns[] = {
+    {"OBJECT",   "Object",       "TEXT",    true},
+    {"INSTRUME", "Instrument",   "TEXT",    true},
+    {"FILTER",   "Filter",       "TEXT",    true},
+    {"DATE-OBS", "DateObs",      "TEXT",    true},
+    {"EXPTIME",  "ExposureTime", "REAL",    false},
+    {"GAIN",     "Gain",         "REAL",    false},
+    {"CCD-TEMP", "CcdTemp",      "REAL",    false},
+    {"OBJCTRA",  "ObjectRa",     "TEXT",    false},
+    {"OBJCTDEC", "ObjectDec",    "TEXT",    false},
+    {"NAXIS1",   "Width",        "INTEGER", false},
+    {"NAXIS2",   "Height",       "INTEGER", false},
+    {"NAXIS3",   "Depth",        "INTEGER", false},
+    {"BAYERPAT", "BayerPattern", "TEXT",    false},
+    {"BLKLEVEL", "BlackLevel",   "REAL",    false},
+};
+
+static bool isTagColumnKey(const QString& key)
+{
+    for (auto& column : tagColumns)
+    {
+        if (key == QLatin1String(column.key))
+            return true;
+    }
+    return false;
+}
+
+// Numbers are bound as numbers, anything that does not parse is kept as text
+static QVariant tagColumnValue(const TagColumn& column, const QString& value)
+{
+    bool ok = false;
+    if (qstrcmp(column.type, "REAL") == 0)
+    {
+        double number = value.toDouble(&ok);
+        if (ok)
+            return number;
+    }
+    else if (qstrcmp(column.type, "INTEGER") == 0)
+    {
+        qlonglong number = value.toLongLong(&ok);
+        if (ok)
+            return number;
+    }
+    return value;
+}
+
+// The keywords of the file that have no column, compressed. Empty if there are none.
+static QByteArray encodeTagTail(const TagTailCodec& codec, const TagMap& tags)
+{
+    QMap<QString, QString> tail;
+    for (auto iter = tags.constBegin(); iter != tags.constEnd(); ++iter)
+    {
+        if (!isTagColumnKey(iter.key()))
+            tail.insert(iter.key(), iter.value());
+    }
+    return codec.encode(tail);
+}
+
+static QMap<QString, QString> decodeTagTail(const TagTailCodec& codec, const QByteArray& blob)
+{
+    QMap<QString, QString> tail;
+    if (!codec.decode(blob, tail))
+        qDebug() << "DB: Could not decode a tag tail of dictionary" << TagTailCodec::dictionaryIdOf(blob);
+    return tail;
+}
+
+// The words a file is searched by, besides its name and folder: the keywords people
+// search for, and the forms they type them in
+static QString searchKeywords(const TagMap& tags)
+{
+    QStringList words;
+    for (auto key : {TagObject, TagInstrument, TagTelescope, TagFilter, TagImageType})
+        words.append(tags.value(key));
+
+    // NGC 7000 is typed NGC7000 too
+    const QString object = tags.value(TagObject);
+    if (object.contains(' '))
+        words.append(QString(object).remove(' '));
+    // And an exposure of 300 seconds 300s
+    bool ok = false;
+    double exposure = tags.value(TagExposureTime).toDouble(&ok);
+    if (ok)
+        words.append(QString::number(exposure) + "s");
+    // The date, without the time
+    words.append(tags.value(TagDateObs).left(10));
+    return words.join(' ');
+}
+
+/*!
+ * \brief searchMatch
+ * The FTS5 query of a search: every word of the text has to be in the file, and is
+ * matched as a prefix, so the word being typed already matches. Words are quoted, so
+ * the FTS5 operators and punctuation in them are searched as they are.
+ */
+static QString searchMatch(const QString& text)
+{
+    QStringList terms;
+    for (auto& word : text.split(' ', Qt::SkipEmptyParts))
+        terms.append("\"" + QString(word).replace('"', "\"\"") + "\"*");
+    return terms.join(' ');
+}
+
+// The keywords of the file that have a column
+static TagMap columnTags(const TagMap& tags)
+{
+    TagMap columns;
+    for (auto& column : tagColumns)
+    {
+        auto iter = tags.constFind(column.key);
+        if (iter != tags.constEnd())
+            columns.insert(iter.key(), iter.value());
+    }
+    return columns;
+}
+
+// A FileHash that can be compared to the ones computed now
+static bool isCurrentHash(const QString& fileHash)
+{
+    return !fileHash.isEmpty() && Hasher::algorithmOf(fileHash) == Hasher::defaultAlgorithm();
+}
 
 FileRepository::FileRepository(QObject *parent) : QObject(parent)
 {
+    // New thumbnails are written in this format. Older rows keep the format they
+    // were written with, which is recorded in the thumbnails.format column.
+    QSettings settings;
+    thumbnailFormat = ThumbnailCodec::formatFromString(settings.value("ThumbnailFormat", "lz4").toString());
+    collisionHashPool.setMaxThreadCount(COLLISION_HASH_THREADS);
+}
 
+FileRepository::~FileRepository()
+{
+    // The collisions left unresolved are resolved again by getDuplicateFiles. The file
+    // being hashed stops at its next chunk, so this does not wait for a whole file.
+    cancellationToken.cancel();
+    collisionHashPool.waitForDone();
 }
 
 void FileRepository::cancel()
 {
-    cancelSignaled = true;
+    cancellationToken.cancel();
+    // The writes still run, and skip their files themselves. What was already
+    // written is kept consistent, like the manifest of the files in the db.
+    requests.cancelFrom(MaintenancePriority);
+}
+
+/*!
+ * \brief FileRepository::runNextRequest
+ * Queued once for every submitted request. Runs the waiting request of the highest
+ * priority, which is not necessarily the one this call was queued for. Requests that
+ * already ran from yieldRequests leave nothing to run.
+ */
+void FileRepository::runNextRequest()
+{
+    RequestQueue::Request request;
+    if (requests.take(request))
+        runRequest(request);
+}
+
+void FileRepository::runRequest(RequestQueue::Request &request)
+{
+    request.run(request.token.isCanceled());
+}
+
+/*!
+ * \brief FileRepository::yieldRequests
+ * Called by long requests between their chunks, outside of a transaction. Runs the
+ * waiting requests of a higher priority than theirs, so ingest writes do not wait
+ * for a maintenance pass over the whole db.
+ */
+void FileRepository::yieldRequests(RequestPriority priority)
+{
+    RequestQueue::Request request;
+    while (requests.take(request, priority))
+        runRequest(request);
 }
 
 /*!
@@ -65,6 +309,13 @@ void FileRepository::initialize()
     qDebug() << "Initializing File Repository";
     createDatabase();
     migrateDatabase();
+    loadCatalogState();
+    loadTagDictionaries(db);
+    if (accessMode() != SharedReaderAccess)
+    {
+        pruneFileChanges();
+        runMigrations(true);
+    }
     qDebug() << "Done Initializing File Repository";
 }
 
@@ -85,20 +336,133 @@ void FileRepository::createDatabase()
         return;
     }
 
-    auto location = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
-    QDir dir{location};
-    dir.mkpath(dir.absolutePath());
+    thumbnailStore.reset(new ThumbnailStore(ThumbnailStore::pathForDatabase(databaseFilePath())));
 
+    const AccessMode mode = accessMode();
     db = QSqlDatabase::addDatabase(DRIVER);
-    db.setDatabaseName(location + "/astrocat.db");
+    db.setDatabaseName(databaseFilePath());
+    if (mode == SharedReaderAccess)
+    {
+        // The indexer owns the shared db, it is never written from here
+        db.setConnectOptions(QString("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=%1").arg(DB_READER_BUSY_TIMEOUT));
+    }
+    else
+    {
+        QDir dir = QFileInfo(databaseFilePath()).absoluteDir();
+        dir.mkpath(dir.absolutePath());
+    }
     if(!db.open())
     {
         auto message = QString("db.open() failed: %1").arg(db.lastError().text());
         emit dbFailedToInitialize(message);
         return;
     }
+    tuneConnection(db);
+    if (mode == SharedReaderAccess)
+        return;
     db.exec("PRAGMA foreign_keys = ON");
-    db.exec("PRAGMA cache_size = -100000");
+    // Only applies to a new db, before its first table. Older dbs are converted to
+    // incremental vacuum by the migration to version 18.
+    db.exec(QString("PRAGMA page_size = %1").arg(DB_PAGE_SIZE));
+    db.exec("PRAGMA auto_vacuum = INCREMENTAL");
+
+    if (mode == SharedWriterAccess)
+    {
+        // WAL needs shared memory between the connections, which network filesystems
+        // do not have. Readers on other machines wait for the commits instead.
+        db.exec("PRAGMA journal_mode = DELETE");
+        db.exec("PRAGMA synchronous = FULL");
+        return;
+    }
+
+    // WAL lets the read-only connections keep reading while the single
+    // writer connection (this one) commits ingest batches.
+    db.exec("PRAGMA journal_mode = WAL");
+    db.exec("PRAGMA synchronous = NORMAL");
+}
+
+/*!
+ * \brief FileRepository::tuneConnection
+ * Sizes the page cache and the memory map of a connection to the db file. The db is
+ * not mapped on a network share, where the file can change under the mapping.
+ */
+void FileRepository::tuneConnection(QSqlDatabase& connection)
+{
+    const qint64 dbSize = QFileInfo(databaseFilePath()).size();
+    const qint64 cacheSize = qBound<qint64>(DB_MIN_CACHE_SIZE, dbSize / 4, DB_MAX_CACHE_SIZE);
+    // A negative cache_size is in KiB
+    connection.exec(QString("PRAGMA cache_size = -%1").arg(cacheSize / 1024));
+    if (accessMode() == LocalAccess)
+        connection.exec(QString("PRAGMA mmap_size = %1").arg(qMin<qint64>(dbSize * 2, DB_MAX_MMAP_SIZE)));
+}
+
+static QString& databaseFilePathOverride()
+{
+    static QString path;
+    return path;
+}
+
+/*!
+ * \brief FileRepository::databaseFilePath
+ * Returns the full path of the Catalog Database file.
+ */
+QString FileRepository::databaseFilePath()
+{
+    if (!databaseFilePathOverride().isEmpty())
+        return databaseFilePathOverride();
+
+    auto location = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    return location + "/astrocat.db";
+}
+
+void FileRepository::setDatabaseFilePath(const QString &path)
+{
+    databaseFilePathOverride() = QFileInfo(path).absoluteFilePath();
+}
+
+static FileRepository::AccessMode& accessModeSetting()
+{
+    static FileRepository::AccessMode mode = FileRepository::LocalAccess;
+    return mode;
+}
+
+void FileRepository::setAccessMode(AccessMode mode)
+{
+    accessModeSetting() = mode;
+}
+
+FileRepository::AccessMode FileRepository::accessMode()
+{
+    return accessModeSetting();
+}
+
+bool FileRepository::isIndexedElsewhere()
+{
+    return accessMode() == SharedReaderAccess || accessMode() == ReplicaAccess;
+}
+
+/*!
+ * \brief FileRepository::readerConnection
+ * Returns a read-only connection owned by the calling thread, opening it on first use.
+ *
+ * QSqlDatabase connections can only be used from the thread that created them, so
+ * every reader thread gets its own connection. Together with WAL mode, this keeps
+ * thumbnail and query traffic from queueing up behind ingest commits on the writer.
+ */
+QSqlDatabase FileRepository::readerConnection()
+{
+    const QString connectionName = QString("astrocat_reader_%1").arg((quintptr)QThread::currentThreadId());
+    if (QSqlDatabase::contains(connectionName))
+        return QSqlDatabase::database(connectionName);
+
+    QSqlDatabase reader = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    reader.setDatabaseName(databaseFilePath());
+    reader.setConnectOptions(QString("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=%1").arg(DB_READER_BUSY_TIMEOUT));
+    if (!reader.open())
+        qDebug() << "Failed to open reader connection: " << reader.lastError();
+    else
+        tuneConnection(reader);
+    return reader;
 }
 
 /*!
@@ -124,6 +488,16 @@ void FileRepository::migrateDatabase()
         }
     }
 
+    if (accessMode() == SharedReaderAccess)
+    {
+        // Only the indexer that owns the shared db migrates it
+        emit dbFailedToInitialize(QString("The shared catalog has schema version %1 instead of %2. Update the indexer that keeps it.")
+                                  .arg(dbCurrentSchemaVersion).arg(DB_SCHEMA_VERSION));
+        return;
+    }
+
+    // The schema changes are quick. The rows are migrated after this, a chunk at a
+    // time, by the steps this schedules, see runMigrations.
     QSqlDatabase::database().transaction();
     migrateFromVersion(dbCurrentSchemaVersion);
     QSqlDatabase::database().commit();
@@ -139,12 +513,182 @@ void FileRepository::migrateDatabase()
  */
 void FileRepository::migrateFromVersion(int oldVersion)
 {
+    if (oldVersion > 0)
+        createMigrationsTable();
+
     switch (oldVersion)
     {
     case 0:
         // This is a new installation. Just create the tables and return
         createTables();
         break;
+    case 1:
+        // Version 2 records the encoding of each thumbnail. All thumbnails
+        // written by version 1 are PNG, so they are still readable as-is.
+        db.exec(QString("ALTER TABLE thumbnails ADD COLUMN format INTEGER DEFAULT %1").arg(ThumbnailFormatPng));
+        [[fallthrough]];
+    case 2:
+        // Version 3 keeps a change counter, which is used to validate the catalog snapshot.
+        createCatalogStateTable();
+        [[fallthrough]];
+    case 3:
+        // Version 4 keeps the directory manifest, used for incremental crawls.
+        createDirectoriesTable();
+        [[fallthrough]];
+    case 4:
+        // Version 5 adds the quick hash. Older rows have a FileHash already, and get a
+        // quick hash the next time duplicates are searched for.
+        db.exec("ALTER TABLE fits ADD COLUMN QuickHash TEXT");
+        db.exec("CREATE INDEX idx_fits_quickhash ON fits(QuickHash)");
+        [[fallthrough]];
+    case 5:
+        // Version 6 keeps the stretch parameters of the thumbnail. Older rows have none,
+        // and have their statistics calculated when they are rendered again.
+        db.exec("ALTER TABLE fits ADD COLUMN StretchParameters BLOB");
+        [[fallthrough]];
+    case 6:
+        // Version 7 keeps a pyramid of thumbnails. Older rows only have the thumbnail
+        // in the thumbnails table, which is shown at every level.
+        createThumbnailLevelsTable();
+        [[fallthrough]];
+    case 7:
+        // Version 8 indexes the directory of the files, for folder operations.
+        db.exec("CREATE INDEX idx_fits_directorypath ON fits(DirectoryPath)");
+        [[fallthrough]];
+    case 8:
+        // Version 9 keeps the keywords in tag columns and tag tails instead of one
+        // row per keyword in the tags table.
+        migrateTagsToColumns();
+        [[fallthrough]];
+    case 9:
+        // Version 10 logs the changes to the fits table, for the readers of a shared catalog.
+        createFileChangesTable();
+        [[fallthrough]];
+    case 10:
+        // Version 11 adds the perceptual hash. Older rows get one from their tiny
+        // thumbnail the next time duplicates are searched for.
+        db.exec("ALTER TABLE fits ADD COLUMN PerceptualHash INTEGER");
+        db.exec("CREATE INDEX idx_fits_perceptualhash ON fits(PerceptualHash)");
+        [[fallthrough]];
+    case 11:
+        // Version 12 keeps the position of the files in degrees, parsed from OBJCTRA and OBJCTDEC.
+        db.exec("ALTER TABLE fits ADD COLUMN RaDegrees REAL");
+        db.exec("ALTER TABLE fits ADD COLUMN DecDegrees REAL");
+        db.exec("CREATE INDEX idx_fits_decdegrees ON fits(DecDegrees)");
+        scheduleMigration("sky_positions");
+        [[fallthrough]];
+    case 12:
+        // Version 13 adds the full text search of the files.
+        createSearchTable();
+        scheduleMigration("search_keywords");
+        [[fallthrough]];
+    case 13:
+        // Version 14 adds the quality of the frames. Older rows are measured the next time they are processed.
+        db.exec("ALTER TABLE fits ADD COLUMN Background REAL");
+        db.exec("ALTER TABLE fits ADD COLUMN Noise REAL");
+        db.exec("ALTER TABLE fits ADD COLUMN StarCount INTEGER");
+        db.exec("ALTER TABLE fits ADD COLUMN Fwhm REAL");
+        db.exec("ALTER TABLE fits ADD COLUMN Eccentricity REAL");
+        db.exec("CREATE INDEX idx_fits_starcount ON fits(StarCount)");
+        db.exec("CREATE INDEX idx_fits_fwhm ON fits(Fwhm)");
+        [[fallthrough]];
+    case 14:
+        // Version 15 keeps the thumbnail pyramid in pack files next to the db.
+        addThumbnailPackColumns();
+        scheduleMigration("thumbnail_packs");
+        [[fallthrough]];
+    case 15:
+        // Version 16 keeps the size of the files and why they failed to process. Older
+        // failed rows have no size, and are tried once more the next time they are crawled.
+        db.exec("ALTER TABLE fits ADD COLUMN FileSize INTEGER");
+        db.exec("ALTER TABLE fits ADD COLUMN FailureReason INTEGER");
+        [[fallthrough]];
+    case 16:
+        // Version 17 keeps the volumes of the search folders. Older volumes are recorded
+        // the next time their folders are crawled.
+        createVolumesTable();
+        [[fallthrough]];
+    case 17:
+        // Version 18 gives the free pages back with the incremental vacuum of
+        // runMaintenance, which is only turned on by a full vacuum
+        scheduleMigration("vacuum");
+        [[fallthrough]];
+    case 18:
+        // Version 19 migrates the rows in chunks, with the migrations table created above
+        [[fallthrough]];
+    case 19:
+        // Version 20 keeps the version of the thumbnails. Older rows are 0, and their
+        // thumbnails are made again in the background.
+        db.exec("ALTER TABLE fits ADD COLUMN ThumbnailVersion INTEGER DEFAULT 0");
+        [[fallthrough]];
+    case 20:
+        // Version 21 keeps the PlaceholderHash of the thumbnail. Older rows have none
+        // until their thumbnails are made again, see THUMBNAIL_VERSION.
+        db.exec("ALTER TABLE fits ADD COLUMN PlaceholderHash BLOB");
+        [[fallthrough]];
+    case 21:
+        // Version 22 keeps the device and inode of the file, to find its hard links.
+        // Older rows have none until they are processed again.
+        db.exec("ALTER TABLE fits ADD COLUMN FileDevice INTEGER DEFAULT 0");
+        db.exec("ALTER TABLE fits ADD COLUMN FileInode INTEGER DEFAULT 0");
+        [[fallthrough]];
+    case 22:
+        // Version 23 journals the jobs of the ingest, so an interrupted one resumes.
+        createIngestJobsTable();
+        [[fallthrough]];
+    case 23:
+        // Version 24 keeps the integration time of each object, filter and instrument,
+        // filled from the rows already there.
+        createIntegrationStatsTable();
+        [[fallthrough]];
+    case 24:
+        // Version 25 keeps the planes of color images and data cubes in a column. Older
+        // rows keep NAXIS3 in their tag tail until they are processed again.
+        db.exec("ALTER TABLE fits ADD COLUMN Depth INTEGER");
+        [[fallthrough]];
+    case 25:
+        // Version 26 keeps a report of each ingest, see addIngestRun.
+        createIngestRunsTable();
+        [[fallthrough]];
+    case 26:
+        // Version 27 logs whether a file was added, updated or deleted. Older changes
+        // are logged as updates, which is what they were read as before.
+        if (!db.record("file_changes").contains("operation"))
+            db.exec(QString("ALTER TABLE file_changes ADD COLUMN operation INTEGER DEFAULT %1").arg(FileUpdated));
+        createFileChangesTriggers();
+        [[fallthrough]];
+    case 27:
+        // Version 28 keeps the saved smart collections, see saveSmartCollection.
+        createSmartCollectionsTable();
+        [[fallthrough]];
+    case 28:
+        // Version 29 keeps the last verification of each file, see recordVerifications.
+        createVerificationsTable();
+        [[fallthrough]];
+    case 29:
+        // Version 30 keeps where the frames without OBJCTRA and OBJCTDEC were solved, see recordSolutions.
+        createPlateSolutionsTable();
+        [[fallthrough]];
+    case 30:
+        // Version 31 compresses the tag tails with a dictionary, see trainTagDictionary.
+        // The older tails are compressed again once it is trained.
+        createTagDictionariesTable();
+        [[fallthrough]];
+    case 31:
+        // Version 32 keeps the files of the removed search folders, see detachFolder.
+        createDetachedFoldersTable();
+        [[fallthrough]];
+    case 32:
+        // Version 33 keeps the folders added back in a removed one, see attachFolder,
+        // and leaves the hidden files out of integration_stats.
+        if (!db.record("detached_folders").contains("Attached"))
+            db.exec("ALTER TABLE detached_folders ADD COLUMN Attached INTEGER DEFAULT 0");
+        loadDetachedFolders();
+        for (auto& trigger : {"fits_insert_stats", "fits_delete_stats", "fits_update_stats"})
+            db.exec(QString("DROP TRIGGER IF EXISTS %1").arg(QLatin1String(trigger)));
+        db.exec("DROP TABLE IF EXISTS integration_stats");
+        createIntegrationStatsTable();
+        break;
     default:
         // Should not get here
         break;
@@ -157,13 +701,17 @@ void FileRepository::migrateFromVersion(int oldVersion)
 /*!
  * \brief FileRepository::createTables
  * Creates all tables for the Database.
- * We are using three tables: FITS, TAGS, and THUMBNAILS
+ * The main tables are FITS, with the keywords of tagColumns, TAG_TAILS and THUMBNAILS
  *
  * Application settings are not stored in the Database.
  * If this function fails, we will emit the dbFailedToInitialize signal
  */
 void FileRepository::createTables()
 {
+    QString tagColumnDefinitions;
+    for (auto& column : tagColumns)
+        tagColumnDefinitions += QString(", %1 %2").arg(column.column, column.type);
+
     QSqlQuery fitsquery(
         "CREATE TABLE fits ("
             "id INTEGER PRIMARY KEY AUTOINCREMENT, "
@@ -180,7 +728,24 @@ void FileRepository::createTables()
             "ProcessStatus INTEGER,"
             "FileHash TEXT,"
             "ImageHash TEXT,"
-            "IsHidden INTEGER)");
+            "IsHidden INTEGER,"
+            "QuickHash TEXT,"
+            "StretchParameters BLOB,"
+            "PerceptualHash INTEGER,"
+            "RaDegrees REAL,"
+            "DecDegrees REAL,"
+            "Background REAL,"
+            "Noise REAL,"
+            "StarCount INTEGER,"
+            "Fwhm REAL,"
+            "Eccentricity REAL,"
+            "FileSize INTEGER,"
+            "FailureReason INTEGER,"
+            "ThumbnailVersion INTEGER DEFAULT 0,"
+            "PlaceholderHash BLOB,"
+            "FileDevice INTEGER DEFAULT 0,"
+            "FileInode INTEGER DEFAULT 0"
+            + tagColumnDefinitions + ")");
 
     if(!fitsquery.isActive())
     {
@@ -195,33 +760,60 @@ void FileRepository::createTables()
         return;
     }
 
-    QSqlQuery tagsquery(
-        "CREATE TABLE tags ("
-            "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-            "fits_id INTEGER, "
-            "tagKey TEXT, "
-            "tagValue TEXT, "
-            "FOREIGN KEY(fits_id) REFERENCES fits(id) ON DELETE CASCADE)");
+    QSqlQuery fitsQuickHashIndexQuery("CREATE INDEX idx_fits_quickhash ON fits(QuickHash);");
+    if(!fitsQuickHashIndexQuery.isActive())
+    {
+        emit dbFailedToInitialize(fitsQuickHashIndexQuery.lastError().text());
+        return;
+    }
+
+    QSqlQuery fitsPerceptualHashIndexQuery("CREATE INDEX idx_fits_perceptualhash ON fits(PerceptualHash);");
+    if(!fitsPerceptualHashIndexQuery.isActive())
+    {
+        emit dbFailedToInitialize(fitsPerceptualHashIndexQuery.lastError().text());
+        return;
+    }
 
-    if(!tagsquery.isActive())
+    // Cone searches look up the band of declination first, see FacetIndex::rowsInRegion
+    QSqlQuery fitsDecIndexQuery("CREATE INDEX idx_fits_decdegrees ON fits(DecDegrees);");
+    if(!fitsDecIndexQuery.isActive())
     {
-        emit dbFailedToInitialize(tagsquery.lastError().text());
+        emit dbFailedToInitialize(fitsDecIndexQuery.lastError().text());
         return;
     }
 
-    QSqlQuery tagsFitsIdIndexQuery("CREATE INDEX idx_ftags_fitsid ON tags(fits_id);");
-    if(!tagsFitsIdIndexQuery.isActive())
+    // Culling sorts and filters on the quality of the frames
+    QSqlQuery fitsStarCountIndexQuery("CREATE INDEX idx_fits_starcount ON fits(StarCount);");
+    if(!fitsStarCountIndexQuery.isActive())
     {
-        emit dbFailedToInitialize(tagsFitsIdIndexQuery.lastError().text());
+        emit dbFailedToInitialize(fitsStarCountIndexQuery.lastError().text());
         return;
     }
 
+    QSqlQuery fitsFwhmIndexQuery("CREATE INDEX idx_fits_fwhm ON fits(Fwhm);");
+    if(!fitsFwhmIndexQuery.isActive())
+    {
+        emit dbFailedToInitialize(fitsFwhmIndexQuery.lastError().text());
+        return;
+    }
+
+    QSqlQuery fitsDirectoryPathIndexQuery("CREATE INDEX idx_fits_directorypath ON fits(DirectoryPath);");
+    if(!fitsDirectoryPathIndexQuery.isActive())
+    {
+        emit dbFailedToInitialize(fitsDirectoryPathIndexQuery.lastError().text());
+        return;
+    }
+
+    createTagColumnIndexes();
+    createTagTailsTable();
+
     QSqlQuery thumbnailsquery(
         "CREATE TABLE thumbnails ("
             "id INTEGER PRIMARY KEY AUTOINCREMENT, "
             "fits_id INTEGER, "
             "thumbnail BLOB, "
             "tiny_thumbnail BLOB, "
+            "format INTEGER DEFAULT 0, "
             "FOREIGN KEY(fits_id) REFERENCES fits(id) ON DELETE CASCADE)");
 
     if(!thumbnailsquery.isActive())
@@ -236,404 +828,4655 @@ void FileRepository::createTables()
         emit dbFailedToInitialize(thumbnailsFitsIdIndexQuery.lastError().text());
         return;
     }
+
+    createCatalogStateTable();
+    createDirectoriesTable();
+    createThumbnailLevelsTable();
+    addThumbnailPackColumns();
+    createFileChangesTable();
+    createSearchTable();
+    createVolumesTable();
+    createIngestJobsTable();
+    createIntegrationStatsTable();
+    createIngestRunsTable();
+    createSmartCollectionsTable();
+    createVerificationsTable();
+    createPlateSolutionsTable();
+    createTagDictionariesTable();
+    createDetachedFoldersTable();
+    createMigrationsTable();
 }
 
-QList<AstroFile> FileRepository::getAstrofilesInFolder(const QString& fullPath)
+/*!
+ * \brief FileRepository::createSearchTable
+ * An FTS5 table of the file names, folders and keywords of the files, with the fits id
+ * as rowid. Words are indexed by their first 2 and 3 letters too, so the prefix queries
+ * of searchFiles do not scan the whole vocabulary.
+ *
+ * Rows are written with the fits rows in addOrUpdateAstrofiles, and removed with them
+ * by a trigger.
+ */
+void FileRepository::createSearchTable()
 {
-    QList<AstroFile> files;
-    QSqlQuery query;
-    QString paddedFullPath;
+    QSqlQuery searchQuery(
+        "CREATE VIRTUAL TABLE fits_search USING fts5("
+            "FileName, DirectoryPath, Keywords, "
+            "tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3')");
 
-    // If the full path does not end with a '/', append it, otherwise the `LIKE` statement
-    // may match other folders that start with the same name.
-    if (fullPath.endsWith('/'))
-        paddedFullPath = fullPath;
-    else
-        paddedFullPath = fullPath + '/';
-
-    query.prepare("SELECT * FROM fits WHERE FullPath LIKE :fullPathString");
-    query.bindValue(":fullPathString", QString("%%1%").arg(paddedFullPath));
-
-    bool ret = query.exec();
-    if (!ret)
+    if(!searchQuery.isActive())
     {
-        qDebug() << "could not query: " << query.lastError();
-        return files;
+        emit dbFailedToInitialize(searchQuery.lastError().text());
+        return;
     }
 
-    while (query.next())
-    {
-        int idId = query.record().indexOf("Id");
-        int idFileName = query.record().indexOf("FileName");
-        int idFullPath = query.record().indexOf("FullPath");
-        int idDirectoryPath = query.record().indexOf("DirectoryPath");
-        int idVolumeName = query.record().indexOf("VolumeName");
-        int idFileType = query.record().indexOf("FileType");
-        int idFileExtension = query.record().indexOf("FileExtension");
-        int idCreatedTime = query.record().indexOf("CreatedTime");
-        int idLastModifiedTime = query.record().indexOf("LastModifiedTime");
-        int idFileHash = query.record().indexOf("FileHash");
-        int idImageHash = query.record().indexOf("ImageHash");
-        int idIsHidden = query.record().indexOf("IsHidden");
-        AstroFile astro;
-        astro.Id = query.value(idId).toInt();
-        astro.FileName = query.value(idFileName).toString();
-        astro.FullPath = query.value(idFullPath).toString();
-        astro.DirectoryPath = query.value(idDirectoryPath).toString();
-        astro.VolumeName = query.value(idVolumeName).toString();
-        astro.FileType = AstroFileType(query.value(idFileType).toInt());
-        astro.FileExtension = query.value(idFileExtension).toString();
-        astro.CreatedTime = query.value(idCreatedTime).toDateTime();
-        astro.LastModifiedTime = query.value(idLastModifiedTime).toDateTime();
-        astro.FileHash = query.value(idFileHash).toString();
-        astro.ImageHash = query.value(idImageHash).toString();
-        astro.IsHidden = query.value(idIsHidden).toInt();
+    QSqlQuery triggerQuery(
+        "CREATE TRIGGER fits_delete_search AFTER DELETE ON fits BEGIN "
+            "DELETE FROM fits_search WHERE rowid = OLD.id; END");
+    if(!triggerQuery.isActive())
+        emit dbFailedToInitialize(triggerQuery.lastError().text());
+}
 
-        files.append(astro);
+/*!
+ * \brief FileRepository::createCatalogStateTable
+ * The catalog_state table has a single row. catalog_id is a random number that
+ * identifies this database, and change_counter is incremented on every write
+ * to the fits table. Together they tell if a catalog snapshot is still current.
+ */
+void FileRepository::createCatalogStateTable()
+{
+    QSqlQuery stateQuery("CREATE TABLE catalog_state (catalog_id INTEGER, change_counter INTEGER)");
+    if(!stateQuery.isActive())
+    {
+        emit dbFailedToInitialize(stateQuery.lastError().text());
+        return;
     }
 
-    return files;
+    QSqlQuery insertStateQuery;
+    insertStateQuery.prepare("INSERT INTO catalog_state (catalog_id, change_counter) VALUES (:catalogId, 0)");
+    insertStateQuery.bindValue(":catalogId", (qint64)QRandomGenerator::global()->generate64());
+    if (!insertStateQuery.exec())
+        emit dbFailedToInitialize(insertStateQuery.lastError().text());
 }
 
-void FileRepository::addOrUpdateAstrofile(const AstroFile& astroFile)
+/*!
+ * \brief FileRepository::createDirectoriesTable
+ * The directories table is the directory manifest. It has the modification time
+ * of every directory the crawler listed, so unchanged directories can be skipped.
+ */
+void FileRepository::createDirectoriesTable()
 {
-    QSqlDatabase::database().transaction();
-
-    int id = insertAstrofile(astroFile);
-    AstroFile insertedAstroFile(astroFile);
-    insertedAstroFile.Id = id;
+    QSqlQuery directoriesQuery(
+        "CREATE TABLE directories ("
+            "Path TEXT PRIMARY KEY, "
+            "LastModifiedTime INTEGER, "
+            "EntryCount INTEGER)");
 
-    addTags(insertedAstroFile);
-    addThumbnail(insertedAstroFile);
+    if(!directoriesQuery.isActive())
+        emit dbFailedToInitialize(directoriesQuery.lastError().text());
+}
 
-    QSqlDatabase::database().commit();
+/*!
+ * \brief FileRepository::createVolumesTable
+ * The volumes the search folders are on, by the identity of the volume, with the
+ * root path they were last mounted at.
+ */
+void FileRepository::createVolumesTable()
+{
+    QSqlQuery volumesQuery(
+        "CREATE TABLE volumes ("
+            "Uuid TEXT PRIMARY KEY, "
+            "RootPath TEXT, "
+            "Label TEXT)");
 
-    emit astroFileUpdated(insertedAstroFile);
+    if(!volumesQuery.isActive())
+        emit dbFailedToInitialize(volumesQuery.lastError().text());
 }
 
-int FileRepository::insertAstrofile(const AstroFile& astroFile)
+/*!
+ * \brief FileRepository::createDetachedFoldersTable
+ * The removed search folders whose files are kept hidden, see detachFolder, with the
+ * time they were removed in milliseconds since the epoch. Attached is 1 for the
+ * folders added back in one, see attachFolder.
+ */
+void FileRepository::createDetachedFoldersTable()
 {
-    QSqlQuery queryAdd;
+    QSqlQuery detachedQuery(
+        "CREATE TABLE detached_folders ("
+            "Path TEXT PRIMARY KEY, "
+            "DetachedTime INTEGER, "
+            "Attached INTEGER DEFAULT 0)");
 
-    queryAdd.prepare("REPLACE INTO fits (FileName,FullPath,DirectoryPath,VolumeName,FileType,FileExtension,CreatedTime,LastModifiedTime,TagStatus,ThumbnailStatus,ProcessStatus,FileHash,ImageHash,IsHidden) "
-                        "VALUES (:FileName,:FullPath,:DirectoryPath,:VolumeName,:FileType,:FileExtension,:CreatedTime,:LastModifiedTime,:TagStatus,:ThumbnailStatus,:ProcessStatus,:FileHash,:ImageHash,:IsHidden)");
-    queryAdd.bindValue(":FileName", astroFile.FileName);
-    queryAdd.bindValue(":FullPath", astroFile.FullPath);
-    queryAdd.bindValue(":DirectoryPath", astroFile.DirectoryPath);
-    queryAdd.bindValue(":VolumeName", astroFile.VolumeName);
-    queryAdd.bindValue(":FileType", astroFile.FileType);
-    queryAdd.bindValue(":FileExtension", astroFile.FileExtension);
-    queryAdd.bindValue(":CreatedTime", astroFile.CreatedTime);
-    queryAdd.bindValue(":LastModifiedTime", astroFile.LastModifiedTime);
-    queryAdd.bindValue(":FileHash", astroFile.FileHash);
-    queryAdd.bindValue(":ImageHash", astroFile.ImageHash);
-    queryAdd.bindValue(":TagStatus", astroFile.tagStatus);
-    queryAdd.bindValue(":ThumbnailStatus", astroFile.thumbnailStatus);
-    queryAdd.bindValue(":ProcessStatus", astroFile.processStatus);
-    queryAdd.bindValue(":IsHidden", astroFile.IsHidden);
+    if(!detachedQuery.isActive())
+        emit dbFailedToInitialize(detachedQuery.lastError().text());
+}
 
-    if(!queryAdd.exec())
-    {
-        // TODO: Handle failures
-        qDebug() << "record could not add: " << queryAdd.lastError();
-        return 0;
-    }
+/*!
+ * \brief FileRepository::createIngestJobsTable
+ * The ingest journal. The files accepted for processing that are not in the db yet,
+ * with the size and modification time they were listed with, see journalIngestJobs.
+ */
+void FileRepository::createIngestJobsTable()
+{
+    QSqlQuery jobsQuery(
+        "CREATE TABLE ingest_jobs ("
+            "FullPath TEXT PRIMARY KEY, "
+            "Size INTEGER, "
+            "LastModifiedTime INTEGER) WITHOUT ROWID");
 
-    return queryAdd.lastInsertId().toInt();
+    if(!jobsQuery.isActive())
+        emit dbFailedToInitialize(jobsQuery.lastError().text());
 }
 
-void FileRepository::deleteAstrofilesInFolder(const QString& fullPath)
+/*!
+ * \brief FileRepository::createIngestRunsTable
+ * A row per ingest, with its totals in columns and the whole report as JSON, see
+ * IndexingEngine::reportIngest.
+ */
+void FileRepository::createIngestRunsTable()
 {
-    auto files = getAstrofilesInFolder(fullPath);
-    QSqlQuery query;
-    QString paddedFullPath;
+    QSqlQuery runsQuery(
+        "CREATE TABLE ingest_runs ("
+            "id INTEGER PRIMARY KEY, "
+            "StartedAt TEXT, "
+            "DurationMsecs INTEGER, "
+            "Files INTEGER, "
+            "Bytes INTEGER, "
+            "Failures INTEGER, "
+            "PeakResidentBytes INTEGER, "
+            "Threads INTEGER, "
+            "Report TEXT)");
 
-    // If the full path does not end with a '/', append it, otherwise the `LIKE` statement
-    // may match other folders that start with the same name.
-    if (fullPath.endsWith('/'))
-        paddedFullPath = fullPath;
-    else
-        paddedFullPath = fullPath + '/';
+    if(!runsQuery.isActive())
+        emit dbFailedToInitialize(runsQuery.lastError().text());
+}
 
-    query.prepare("DELETE FROM fits WHERE FullPath LIKE :fullPathString");
-    auto queryPath = QString("%1%").arg(paddedFullPath);
-//    qDebug()<<queryPath;
-    query.bindValue(":fullPathString", queryPath);
-    bool ret = query.exec();
-    if (!ret)
-        qDebug() << "could not delete: " << query.lastError();
+/*!
+ * \brief FileRepository::createSmartCollectionsTable
+ * The named filter expressions of the smart collections, see SmartCollection. Their
+ * members are kept by the Catalog, not here.
+ */
+void FileRepository::createSmartCollectionsTable()
+{
+    QSqlQuery collectionsQuery(
+        "CREATE TABLE smart_collections ("
+            "Name TEXT PRIMARY KEY, "
+            "Expression TEXT)");
 
-    qDebug()<<"Done deleting from table";
-    emit astroFilesDeleted(files);
-    qDebug()<<"Done deleting";
+    if(!collectionsQuery.isActive())
+        emit dbFailedToInitialize(collectionsQuery.lastError().text());
 }
 
-void FileRepository::addTags(const AstroFile& astroFile)
+/*!
+ * \brief FileRepository::createVerificationsTable
+ * The last verification of each file, see IntegrityVerifier, with the hash it was
+ * checked against. Kept out of the fits table, so a verification is not a change of
+ * the file. Removed with the fits row, and when the file is written again.
+ */
+void FileRepository::createVerificationsTable()
 {
-    int id = astroFile.Id;
-    Q_ASSERT(id != 0);
-
-    for (auto iter = astroFile.Tags.constBegin(); iter != astroFile.Tags.constEnd(); ++iter)
+    const QStringList statements = {
+        "CREATE TABLE verifications ("
+            "fits_id INTEGER PRIMARY KEY, "
+            "VerifiedTime INTEGER, "
+            "Integrity INTEGER, "
+            "FileHash TEXT)",
+        "CREATE TRIGGER fits_delete_verification AFTER DELETE ON fits BEGIN "
+            "DELETE FROM verifications WHERE fits_id = OLD.id; END",
+        "CREATE TRIGGER fits_modified_verification AFTER UPDATE OF LastModifiedTime ON fits "
+            "WHEN NEW.LastModifiedTime IS NOT OLD.LastModifiedTime BEGIN "
+            "DELETE FROM verifications WHERE fits_id = NEW.id; END",
+    };
+    for (auto& statement : statements)
     {
-        auto& key = iter.key();
-        auto& value = iter.value();
-
-        QSqlQuery tagAddQuery;
-        tagAddQuery.prepare("INSERT INTO tags (fits_id,tagKey,tagValue) VALUES (:fits_id,:tagKey,:tagValue)");
-        tagAddQuery.bindValue(":fits_id", id);
-        tagAddQuery.bindValue(":tagKey", key);
-        tagAddQuery.bindValue(":tagValue", value);
-        if (!tagAddQuery.exec())
-            qDebug() << "FAILED to execute INSERT TAG query: " << tagAddQuery.lastError();
+        QSqlQuery query(statement);
+        if(!query.isActive())
+            emit dbFailedToInitialize(query.lastError().text());
     }
-
-    QSqlQuery tagStatusQuery;
-    tagStatusQuery.prepare("UPDATE fits set TagStatus = :tagStatus WHERE FullPath = :fullPath");
-    tagStatusQuery.bindValue(":tagStatus", astroFile.tagStatus);
-    tagStatusQuery.bindValue(":fullPath", astroFile.FullPath);
-    if (!tagStatusQuery.exec())
-        qDebug() << "FAILED to execute UPDATE TAG Status query: " <<tagStatusQuery.lastError() ;
 }
 
-void FileRepository::addThumbnail(const AstroFile &astroFile)
+/*!
+ * \brief FileRepository::createPlateSolutionsTable
+ * The position of each frame PlateSolver tried to solve, NULL when it could not, so it
+ * is not tried again. Like the verifications, removed with the fits row and when the
+ * file is written again.
+ */
+void FileRepository::createPlateSolutionsTable()
 {
-    int id = astroFile.Id;
-    Q_ASSERT(id != 0);
+    const QStringList statements = {
+        "CREATE TABLE plate_solutions ("
+            "fits_id INTEGER PRIMARY KEY, "
+            "SolvedTime INTEGER, "
+            "RaDegrees REAL, "
+            "DecDegrees REAL, "
+            "Rotation REAL, "
+            "Scale REAL)",
+        "CREATE INDEX idx_plate_solutions_decdegrees ON plate_solutions(DecDegrees)",
+        "CREATE TRIGGER fits_delete_plate_solution AFTER DELETE ON fits BEGIN "
+            "DELETE FROM plate_solutions WHERE fits_id = OLD.id; END",
+        "CREATE TRIGGER fits_modified_plate_solution AFTER UPDATE OF LastModifiedTime ON fits "
+            "WHEN NEW.LastModifiedTime IS NOT OLD.LastModifiedTime BEGIN "
+            "DELETE FROM plate_solutions WHERE fits_id = NEW.id; END",
+    };
+    for (auto& statement : statements)
+    {
+        QSqlQuery query(statement);
+        if(!query.isActive())
+            emit dbFailedToInitialize(query.lastError().text());
+    }
+}
 
-    QByteArray inByteArray;
-    QBuffer inBuffer( &inByteArray );
-    inBuffer.open( QIODevice::WriteOnly );
-    astroFile.thumbnail.save( &inBuffer, "PNG" );
+/*!
+ * \brief FileRepository::createTagDictionariesTable
+ * The dictionaries the tag tails are compressed with, by version, see TagTailCodec.
+ * The blobs name theirs by dictionary_id, which is the same in every db, so merged
+ * catalogs bring theirs along.
+ */
+void FileRepository::createTagDictionariesTable()
+{
+    QSqlQuery query(
+        "CREATE TABLE tag_dictionaries ("
+            "version INTEGER PRIMARY KEY, "
+            "dictionary_id INTEGER UNIQUE NOT NULL, "
+            "dictionary BLOB NOT NULL, "
+            "sample_files INTEGER, "
+            "CreatedTime INTEGER)");
 
-    QByteArray inByteArrayTiny;
-    QBuffer inBufferTiny( &inByteArrayTiny );
-    inBufferTiny.open( QIODevice::WriteOnly );
-    astroFile.tinyThumbnail.save( &inBufferTiny, "PNG" );
+    if(!query.isActive())
+        emit dbFailedToInitialize(query.lastError().text());
+}
 
+/*!
+ * \brief FileRepository::loadTagDictionaries
+ * The dictionary trained on the most files encodes, the newest of those, so one merged
+ * from a smaller catalog does not replace the one of this db.
+ */
+void FileRepository::loadTagDictionaries(QSqlDatabase connection)
+{
+    QSqlQuery query(connection);
+    if (!query.exec("SELECT dictionary, sample_files FROM tag_dictionaries ORDER BY sample_files, version"))
+        return;
+    while (query.next())
+    {
+        tagTailCodec.addDictionary(query.value(0).toByteArray());
+        tagDictionaryFiles = query.value(1).toInt();
+    }
+}
 
-    QSqlQuery insertThumbnailQuery;
-    insertThumbnailQuery.prepare("INSERT INTO thumbnails (fits_id, thumbnail, tiny_thumbnail) VALUES (:fits_id, :bytedata, :tinyThumbnail)");
-    insertThumbnailQuery.bindValue(":fits_id", id);
-    insertThumbnailQuery.bindValue(":bytedata", inByteArray);
-    insertThumbnailQuery.bindValue(":tinyThumbnail", inByteArrayTiny);
-    if (!insertThumbnailQuery.exec())
-        qDebug() << "DB: Failed in insert Thubmanailfor " << astroFile.FullPath << insertThumbnailQuery.lastError();
+/*!
+ * \brief FileRepository::trainTagDictionary
+ * Trains a dictionary on a sample of the tag tails once the db has
+ * TAG_DICTIONARY_MIN_FILES of them, and a new version once it has
+ * TAG_DICTIONARY_RETRAIN_FACTOR times the tails the last one was trained on, as the
+ * archive gets frames from new rigs. The tails are then compressed again with it, a
+ * chunk at a time, by the tag_dictionary migration that runMaintenance runs next.
+ */
+void FileRepository::trainTagDictionary(const CancellationToken& token)
+{
+    int tails = 0;
+    QSqlQuery countQuery("SELECT COUNT(*) FROM tag_tails");
+    if (countQuery.first())
+        tails = countQuery.value(0).toInt();
+    countQuery.finish();
+    const int trainedFiles = tagDictionaryFiles;
+    if (tails < TAG_DICTIONARY_MIN_FILES || (trainedFiles > 0 && tails < trainedFiles * TAG_DICTIONARY_RETRAIN_FACTOR))
+        return;
+
+    QSqlQuery sampleQuery;
+    sampleQuery.setForwardOnly(true);
+    sampleQuery.prepare("SELECT tags FROM tag_tails WHERE fits_id % :step = 0 LIMIT :limit");
+    sampleQuery.bindValue(":step", qMax(1, tails / TAG_DICTIONARY_SAMPLE_FILES));
+    sampleQuery.bindValue(":limit", TAG_DICTIONARY_SAMPLE_FILES);
+    QList<QMap<QString, QString>> samples;
+    if (sampleQuery.exec())
+    {
+        while (sampleQuery.next())
+            samples.append(decodeTagTail(tagTailCodec, sampleQuery.value(0).toByteArray()));
+    }
+    sampleQuery.finish();
+    if (token.isCanceled())
+        return;
+
+    const QByteArray dictionary = TagTailCodec::train(samples);
+    const quint32 dictionaryId = TagTailCodec::dictionaryId(dictionary);
+    if (dictionary.isEmpty() || dictionaryId == tagTailCodec.currentDictionaryId())
+        return;
+
+    QSqlQuery insertQuery;
+    insertQuery.prepare("INSERT OR IGNORE INTO tag_dictionaries (dictionary_id, dictionary, sample_files, CreatedTime) "
+                        "VALUES (:dictionary_id, :dictionary, :sample_files, :CreatedTime)");
+    insertQuery.bindValue(":dictionary_id", dictionaryId);
+    insertQuery.bindValue(":dictionary", dictionary);
+    insertQuery.bindValue(":sample_files", tails);
+    insertQuery.bindValue(":CreatedTime", QDateTime::currentSecsSinceEpoch());
+    if (!insertQuery.exec())
+    {
+        qDebug() << "DB: Failed to record the tag dictionary" << insertQuery.lastError();
+        return;
+    }
+    tagTailCodec.addDictionary(dictionary);
+    tagDictionaryFiles = tails;
+    qDebug() << "Trained a tag dictionary of" << dictionary.size() << "bytes on" << samples.count() << "of" << tails << "files";
+
+    // From the start, when the last dictionary was still being applied
+    QSqlQuery migrationQuery;
+    if (!migrationQuery.exec("INSERT OR REPLACE INTO migrations (name, last_id) VALUES ('tag_dictionary', 0)"))
+        qDebug() << "DB: Failed to schedule the tag dictionary migration" << migrationQuery.lastError();
+}
+
+/*!
+ * \brief FileRepository::migrateTagTails
+ * Compresses the tails of a chunk of rows again with the newest dictionary, the ones
+ * of older versions and the ones of older dictionaries.
+ */
+int FileRepository::migrateTagTails(qint64& lastId)
+{
+    const quint32 currentId = tagTailCodec.currentDictionaryId();
 
-    QSqlQuery tagStatusQuery;
-    tagStatusQuery.prepare("UPDATE fits set ThumbnailStatus = :thumbnailStatus WHERE FullPath = :fullPath");
-    tagStatusQuery.bindValue(":thumbnailStatus", astroFile.thumbnailStatus);
-    tagStatusQuery.bindValue(":fullPath", astroFile.FullPath);
-    if (!tagStatusQuery.exec())
-        qDebug() << "FAILED to execute UPDATE Thumbnail Status query" << tagStatusQuery.lastError();
+    QSqlQuery updateQuery;
+    updateQuery.prepare("UPDATE tag_tails SET tags = :tags WHERE fits_id = :fits_id");
+
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare(QString("SELECT fits_id, tags FROM tag_tails WHERE fits_id > :lastId ORDER BY fits_id LIMIT %1").arg(MIGRATION_CHUNK_SIZE));
+    query.bindValue(":lastId", lastId);
+    query.exec();
+    int migrated = 0;
+    while (query.next())
+    {
+        lastId = query.value(0).toLongLong();
+        migrated++;
+        const QByteArray blob = query.value(1).toByteArray();
+        if (blob.isEmpty() || TagTailCodec::dictionaryIdOf(blob) == currentId)
+            continue;
+
+        QMap<QString, QString> tail;
+        if (!tagTailCodec.decode(blob, tail))
+            continue;
+        updateQuery.bindValue(":fits_id", query.value(0).toInt());
+        updateQuery.bindValue(":tags", tagTailCodec.encode(tail));
+        if (!updateQuery.exec())
+            qDebug() << "DB: Failed to compress the tags of" << query.value(0).toInt() << updateQuery.lastError();
+    }
+    return migrated;
 }
 
-void FileRepository::getDuplicateFiles()
+// The key of the integration_stats row of a fits row, OLD or NEW in a trigger
+static QString integrationStatsKey(const QString& row)
 {
-    getDuplicateFilesByFileHash();
-    getDuplicateFilesByImageHash();
+    return QString("Object = COALESCE(%1.Object, '') AND Filter = COALESCE(%1.Filter, '') AND Instrument = COALESCE(%1.Instrument, '')").arg(row);
 }
 
-void FileRepository::getDuplicateFilesByFileHash()
+// An EXPTIME that is not a number counts for nothing
+static QString integrationExposure(const QString& row)
 {
-    QSqlQuery query("SELECT FullPath, COUNT(*) c FROM fits GROUP BY FileHash HAVING c > 1");
-    query.exec();
-    int idCount = query.record().indexOf("c");
-    int idFullPath = query.record().indexOf("FullPath");
+    return QString("CASE WHEN typeof(%1.ExposureTime) IN ('integer', 'real') THEN %1.ExposureTime ELSE 0 END").arg(row);
+}
 
-    while (query.next())
+static QString addToIntegrationStats(const QString& row)
+{
+    return QString(
+        "INSERT INTO integration_stats VALUES (COALESCE(%1.Object, ''), COALESCE(%1.Filter, ''), COALESCE(%1.Instrument, ''), "
+            "1, %2, substr(%1.DateObs, 1, 10), substr(%1.DateObs, 1, 10)) "
+        "ON CONFLICT(Object, Filter, Instrument) DO UPDATE SET "
+            "FrameCount = FrameCount + 1, "
+            "TotalExposure = TotalExposure + excluded.TotalExposure, "
+            "FirstDate = CASE WHEN FirstDate IS NULL OR excluded.FirstDate < FirstDate THEN excluded.FirstDate ELSE FirstDate END, "
+            "LastDate = CASE WHEN LastDate IS NULL OR excluded.LastDate > LastDate THEN excluded.LastDate ELSE LastDate END; ")
+        .arg(row, integrationExposure(row));
+}
+
+// The span is only read again from the fits rows when the row was at one of its ends.
+// Object is indexed, the other columns are tested on its rows.
+static QString removeFromIntegrationStats(const QString& row)
+{
+    const QString key = integrationStatsKey(row);
+    return QString(
+        "UPDATE integration_stats SET FrameCount = FrameCount - 1, TotalExposure = TotalExposure - %2 WHERE %3; "
+        "DELETE FROM integration_stats WHERE %3 AND FrameCount <= 0; "
+        "UPDATE integration_stats SET "
+            "FirstDate = (SELECT substr(MIN(DateObs), 1, 10) FROM fits WHERE %4), "
+            "LastDate = (SELECT substr(MAX(DateObs), 1, 10) FROM fits WHERE %4) "
+        "WHERE %3 AND (FirstDate = substr(%1.DateObs, 1, 10) OR LastDate = substr(%1.DateObs, 1, 10)); ")
+        .arg(row, integrationExposure(row), key,
+             QString("(Object = COALESCE(%1.Object, '') OR (Object IS NULL AND COALESCE(%1.Object, '') = '')) "
+                     "AND COALESCE(Filter, '') = COALESCE(%1.Filter, '') AND COALESCE(Instrument, '') = COALESCE(%1.Instrument, '')").arg(row));
+}
+
+// Fills integration_stats from the fits rows that meet condition
+static QString fillIntegrationStats(const QString& condition)
+{
+    return QString("INSERT INTO integration_stats SELECT COALESCE(fits.Object, ''), COALESCE(fits.Filter, ''), COALESCE(fits.Instrument, ''), "
+                   "COUNT(*), TOTAL(%1), substr(MIN(DateObs), 1, 10), substr(MAX(DateObs), 1, 10) FROM fits WHERE %2 GROUP BY 1, 2, 3")
+        .arg(integrationExposure("fits"), condition);
+}
+
+/*!
+ * \brief FileRepository::createIntegrationStatsTable
+ * The number of frames, total exposure and dates of each object, filter and instrument,
+ * kept by triggers on the fits table. They run in the transaction of the write, so the
+ * batches of addOrUpdateAstrofiles and the deletes keep the table in step at no extra
+ * round trip, and integrationStats reads it without scanning the fits rows.
+ *
+ * Dates are the days of DATE-OBS. The table is filled from the rows already there.
+ */
+void FileRepository::createIntegrationStatsTable()
+{
+    QSqlQuery statsQuery(
+        "CREATE TABLE integration_stats ("
+            "Object TEXT NOT NULL, "
+            "Filter TEXT NOT NULL, "
+            "Instrument TEXT NOT NULL, "
+            "FrameCount INTEGER, "
+            "TotalExposure REAL, "
+            "FirstDate TEXT, "
+            "LastDate TEXT, "
+            "PRIMARY KEY (Object, Filter, Instrument)) WITHOUT ROWID");
+    if(!statsQuery.isActive())
+    {
+        emit dbFailedToInitialize(statsQuery.lastError().text());
+        return;
+    }
+
+    const QStringList statements = {
+        QString("CREATE TRIGGER fits_insert_stats AFTER INSERT ON fits BEGIN %1END").arg(addToIntegrationStats("NEW")),
+        QString("CREATE TRIGGER fits_delete_stats AFTER DELETE ON fits BEGIN %1END").arg(removeFromIntegrationStats("OLD")),
+        QString("CREATE TRIGGER fits_update_stats AFTER UPDATE OF Object, Filter, Instrument, ExposureTime, DateObs ON fits "
+                "WHEN OLD.Object IS NOT NEW.Object OR OLD.Filter IS NOT NEW.Filter OR OLD.Instrument IS NOT NEW.Instrument "
+                "OR OLD.ExposureTime IS NOT NEW.ExposureTime OR OLD.DateObs IS NOT NEW.DateObs BEGIN %1%2END")
+            .arg(removeFromIntegrationStats("OLD"), addToIntegrationStats("NEW")),
+        fillIntegrationStats(attachedCondition("fits.FullPath")),
+    };
+    for (auto& statement : statements)
     {
-        int count = query.value(idCount).toInt();
-        QString fullPath = query.value(idFullPath).toString();
+        QSqlQuery query;
+        if (!query.exec(statement))
+        {
+            emit dbFailedToInitialize(query.lastError().text());
+            return;
+        }
     }
 }
 
-void FileRepository::getDuplicateFilesByImageHash()
+/*!
+ * \brief FileRepository::rebuildIntegrationStats
+ * Fills integration_stats again from the files that are not in a detached folder. The
+ * triggers only follow the writes to the rows, so this runs once folders are detached,
+ * attached or purged, which hide, show or delete rows the table did not count.
+ */
+void FileRepository::rebuildIntegrationStats()
 {
-    QSqlQuery query("SELECT FullPath, COUNT(*) c FROM fits GROUP BY ImageHash HAVING c > 1");
-    query.exec();
-    int idCount = query.record().indexOf("c");
-    int idFullPath = query.record().indexOf("FullPath");
+    static LatencyHistogram& rebuildLatency = Metrics::histogram("repository.rebuild_integration_stats");
+    ScopedLatency latency(rebuildLatency);
+
+    QSqlDatabase::database().transaction();
+    QSqlQuery query;
+    if (!query.exec("DELETE FROM integration_stats") || !query.exec(fillIntegrationStats(attachedCondition("fits.FullPath"))))
+    {
+        qDebug() << "Could not rebuild the integration stats:" << query.lastError();
+        QSqlDatabase::database().rollback();
+        return;
+    }
+    QSqlDatabase::database().commit();
+}
 
+/*!
+ * \brief FileRepository::integrationStats
+ * The rows of the integration_stats table, by object, filter and instrument.
+ */
+QVector<IntegrationStats> FileRepository::integrationStats()
+{
+    QVector<IntegrationStats> stats;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT Object, Filter, Instrument, FrameCount, TotalExposure, FirstDate, LastDate FROM integration_stats"))
+    {
+        qDebug() << "Could not read the integration stats:" << query.lastError();
+        return stats;
+    }
     while (query.next())
     {
-        int count = query.value(idCount).toInt();
-        QString fullPath = query.value(idFullPath).toString();
+        IntegrationStats row;
+        row.Object = query.value(0).toString();
+        row.Filter = query.value(1).toString();
+        row.Instrument = query.value(2).toString();
+        row.FrameCount = query.value(3).toInt();
+        row.TotalExposure = query.value(4).toDouble();
+        row.FirstDate = QDate::fromString(query.value(5).toString(), Qt::ISODate);
+        row.LastDate = QDate::fromString(query.value(6).toString(), Qt::ISODate);
+        stats.append(row);
     }
+    return stats;
 }
 
-void FileRepository::loadThumbnal(const AstroFile &afi)
+/*!
+ * \brief FileRepository::createMigrationsTable
+ * The data migrations still to run, with the id of the last row each one migrated,
+ * so an interrupted migration resumes where it was. Rows are removed once done.
+ */
+void FileRepository::createMigrationsTable()
+{
+    QSqlQuery migrationsQuery(
+        "CREATE TABLE IF NOT EXISTS migrations ("
+            "name TEXT PRIMARY KEY, "
+            "last_id INTEGER DEFAULT 0)");
+
+    if(!migrationsQuery.isActive())
+        emit dbFailedToInitialize(migrationsQuery.lastError().text());
+}
+
+void FileRepository::scheduleMigration(const QString& name)
 {
-    if (cancelSignaled)
-        return;
     QSqlQuery query;
-    query.prepare("SELECT * FROM thumbnails where fits_id = :fitsId");
-    query.bindValue(":fitsId", afi.Id);
-    query.exec();
+    query.prepare("INSERT OR IGNORE INTO migrations (name) VALUES (:name)");
+    query.bindValue(":name", name);
+    if (!query.exec())
+        emit dbFailedToInitialize(query.lastError().text());
+}
 
-    int fits_idId = query.record().indexOf("fits_id");
-    int idThumbnail = query.record().indexOf("thumbnail");
-    int idTinyThumbnail = query.record().indexOf("tiny_thumbnail");
+/*!
+ * \brief FileRepository::migrationSteps
+ * The data migrations, in the order they run. The ones the catalog reads run
+ * before the model is loaded, the others in the background once it is.
+ */
+const QList<FileRepository::MigrationStep>& FileRepository::migrationSteps()
+{
+    static const QList<MigrationStep> steps = {
+        {"sky_positions", "Updating the sky positions", true, true,
+         "SELECT COUNT(*) FROM fits WHERE id > :lastId AND ObjectRa IS NOT NULL AND ObjectDec IS NOT NULL", &FileRepository::migrateSkyPositions},
+        {"search_keywords", "Indexing the files for search", false, true,
+         "SELECT COUNT(*) FROM fits WHERE id > :lastId", &FileRepository::migrateSearchKeywords},
+        {"thumbnail_packs", "Moving the thumbnails out of the catalog", false, true,
+         "SELECT COUNT(*) FROM thumbnail_levels WHERE thumbnail IS NOT NULL AND length(thumbnail) > 0 AND :lastId >= 0", &FileRepository::migrateThumbnailsToPacks},
+        {"tag_dictionary", "Compressing the keywords", false, true,
+         "SELECT COUNT(*) FROM tag_tails WHERE fits_id > :lastId", &FileRepository::migrateTagTails},
+        {"vacuum", "Compacting the catalog", false, false,
+         "SELECT 1 WHERE :lastId >= 0", &FileRepository::vacuumDatabase},
+    };
+    return steps;
+}
 
-    AstroFile astroFile;
-    int id = 0;
-    if (query.first())
+/*!
+ * \brief FileRepository::runMigrations
+ * Runs the scheduled data migrations of the phase, MIGRATION_CHUNK_SIZE rows at a time.
+ * Each chunk is committed with the id it got to, so a migration that is canceled or
+ * interrupted resumes from there. The background migrations let the other requests
+ * run between their chunks. Reports progress with migrationProgress.
+ */
+void FileRepository::runMigrations(bool beforeLoad, const CancellationToken& token)
+{
+    if (accessMode() == SharedReaderAccess)
+        return;
+
+    static LatencyHistogram& chunkLatency = Metrics::histogram("repository.migration_chunk");
+
+    QSqlQuery pendingQuery;
+    pendingQuery.prepare("SELECT last_id FROM migrations WHERE name = :name");
+    QSqlQuery progressQuery;
+    progressQuery.prepare("UPDATE migrations SET last_id = :lastId WHERE name = :name");
+    QSqlQuery doneQuery;
+    doneQuery.prepare("DELETE FROM migrations WHERE name = :name");
+
+    for (auto& step : migrationSteps())
     {
-        id = query.record().value(fits_idId).toInt();
-        QByteArray inByteArray = query.value(idThumbnail).toByteArray();
-        QImage image;
-        image.loadFromData(inByteArray, "PNG");
-        astroFile.thumbnail = image;
-        astroFile.Id = afi.Id;
+        if (step.beforeLoad != beforeLoad)
+            continue;
+
+        pendingQuery.bindValue(":name", step.name);
+        if (!pendingQuery.exec() || !pendingQuery.first())
+            continue;
+        qint64 lastId = pendingQuery.value(0).toLongLong();
+        pendingQuery.finish();
+
+        int total = 0;
+        QSqlQuery countQuery;
+        countQuery.prepare(step.countQuery);
+        countQuery.bindValue(":lastId", lastId);
+        if (countQuery.exec() && countQuery.first())
+            total = countQuery.value(0).toInt();
+        countQuery.finish();
 
-        QByteArray inByteArrayTiny = query.value(idTinyThumbnail).toByteArray();
-        QImage imageTiny;
-        imageTiny.loadFromData(inByteArrayTiny, "PNG");
-        astroFile.tinyThumbnail = imageTiny;
-        astroFile.Id = afi.Id;
+        qDebug() << "Migrating" << step.name << "from" << lastId;
+        int done = 0;
+        emit migrationProgress(step.label, done, total);
+        for (;;)
+        {
+            if (cancellationToken.isCanceled() || token.isCanceled())
+                return;
+            if (!beforeLoad)
+                yieldRequests(MaintenancePriority);
+
+            ScopedLatency latency(chunkLatency);
+            if (step.inTransaction)
+                QSqlDatabase::database().transaction();
+            const int migrated = (this->*step.migrateChunk)(lastId);
+            QSqlQuery& stateQuery = migrated > 0 ? progressQuery : doneQuery;
+            stateQuery.bindValue(":name", step.name);
+            if (migrated > 0)
+                stateQuery.bindValue(":lastId", lastId);
+            if (!stateQuery.exec())
+                qDebug() << "DB: Failed to record the migration of" << step.name << stateQuery.lastError();
+            if (step.inTransaction)
+                QSqlDatabase::database().commit();
+
+            if (migrated <= 0)
+                break;
+            done += migrated;
+            emit migrationProgress(step.label, qMin(done, total), total);
+        }
+        emit migrationProgress(step.label, total, total);
     }
-    emit thumbnailLoaded(astroFile);
 }
 
-QMap<int, AstroFile> FileRepository::_getAllAstrofiles()
+/*!
+ * \brief FileRepository::createThumbnailLevelsTable
+ * One row per level of the thumbnail pyramid of a file, see thumbnailLevelSizes.
+ * The thumbnails table keeps the tiny thumbnail.
+ */
+void FileRepository::createThumbnailLevelsTable()
 {
-    QSqlQuery query("SELECT * FROM fits");
-    query.exec();
-    int idId = query.record().indexOf("Id");
-    int idFileName = query.record().indexOf("FileName");
-    int idFullPath = query.record().indexOf("FullPath");
-    int idDirectoryPath = query.record().indexOf("DirectoryPath");
-    int idVolumeName = query.record().indexOf("VolumeName");
-    int idFileType = query.record().indexOf("FileType");
-    int idFileExtension = query.record().indexOf("FileExtension");
-    int idCreatedTime = query.record().indexOf("CreatedTime");
-    int idLastModifiedTime = query.record().indexOf("LastModifiedTime");
-    int idFileHash = query.record().indexOf("FileHash");
-    int idImageHash = query.record().indexOf("ImageHash");
-    int idTagStatus = query.record().indexOf("TagStatus");
-    int idThumbnailStatus = query.record().indexOf("ThumbnailStatus");
-    int idProcessStatus = query.record().indexOf("ProcessStatus");
-    int idIsHidden = query.record().indexOf("IsHidden");
-
-    QMap<int, AstroFile> files;
+    QSqlQuery levelsQuery(
+        "CREATE TABLE thumbnail_levels ("
+            "fits_id INTEGER, "
+            "level INTEGER, "
+            "thumbnail BLOB, "
+            "format INTEGER, "
+            "PRIMARY KEY(fits_id, level), "
+            "FOREIGN KEY(fits_id) REFERENCES fits(id) ON DELETE CASCADE)");
+
+    if(!levelsQuery.isActive())
+        emit dbFailedToInitialize(levelsQuery.lastError().text());
+}
+
+/*!
+ * \brief FileRepository::addThumbnailPackColumns
+ * Where the thumbnail of a level is in the ThumbnailStore. The thumbnail column is
+ * NULL for those rows, it is only kept for thumbnails the packs could not take.
+ * content_hash finds thumbnails that are already in the packs, so identical
+ * thumbnails are written once.
+ */
+void FileRepository::addThumbnailPackColumns()
+{
+    QStringList statements = {
+        "ALTER TABLE thumbnail_levels ADD COLUMN pack INTEGER",
+        "ALTER TABLE thumbnail_levels ADD COLUMN pack_offset INTEGER",
+        "ALTER TABLE thumbnail_levels ADD COLUMN pack_length INTEGER",
+        "ALTER TABLE thumbnail_levels ADD COLUMN content_hash TEXT",
+        "CREATE INDEX idx_thumbnail_levels_contenthash ON thumbnail_levels(content_hash)",
+    };
+    QSqlQuery query;
+    for (auto& statement : statements)
+    {
+        if (!query.exec(statement))
+        {
+            emit dbFailedToInitialize(query.lastError().text());
+            return;
+        }
+    }
+}
+
+/*!
+ * \brief FileRepository::migrateThumbnailsToPacks
+ * Moves a chunk of the thumbnails of the pyramid out of the db into the ThumbnailStore.
+ * Moved rows are no longer selected, so lastId is not needed. The db is vacuumed by
+ * the step after this one.
+ */
+int FileRepository::migrateThumbnailsToPacks(qint64& lastId)
+{
+    Q_UNUSED(lastId);
+    QSqlQuery packedQuery;
+    packedQuery.prepare("SELECT pack, pack_offset, pack_length FROM thumbnail_levels WHERE content_hash = :content_hash AND pack_length = :pack_length LIMIT 1");
+
+    QSqlQuery updateQuery;
+    updateQuery.prepare("UPDATE thumbnail_levels SET thumbnail = NULL, pack = :pack, pack_offset = :pack_offset, pack_length = :pack_length, content_hash = :content_hash "
+                        "WHERE fits_id = :fits_id AND level = :level");
+
+    QSqlQuery query;
+    if (!query.exec(QString("SELECT fits_id, level, thumbnail FROM thumbnail_levels "
+                            "WHERE thumbnail IS NOT NULL AND length(thumbnail) > 0 LIMIT %1").arg(MIGRATION_CHUNK_SIZE)))
+    {
+        qDebug() << "DB: Failed to read the thumbnails to move to the packs" << query.lastError();
+        return 0;
+    }
+
+    struct Row { int id; int level; QByteArray data; };
+    QList<Row> rows;
     while (query.next())
+        rows.append({query.value(0).toInt(), query.value(1).toInt(), query.value(2).toByteArray()});
+    query.finish();
+
+    int moved = 0;
+    for (auto& row : rows)
     {
-        AstroFile astro;
-        int astroFileId = query.value(idId).toInt();
-        astro.Id = astroFileId;
-        astro.FileName = query.value(idFileName).toString();
-        astro.FullPath = query.value(idFullPath).toString();
-        astro.DirectoryPath = query.value(idDirectoryPath).toString();
-        astro.VolumeName = query.value(idVolumeName).toString();
-        astro.FileType = AstroFileType(query.value(idFileType).toInt());
-        astro.FileExtension = query.value(idFileExtension).toString();
-        astro.FileHash = query.value(idFileHash).toString();
-        astro.ImageHash = query.value(idImageHash).toString();
-        astro.CreatedTime = query.value(idCreatedTime).toDateTime();
-        astro.LastModifiedTime = query.value(idLastModifiedTime).toDateTime();
-        astro.thumbnailStatus = ThumbnailLoadStatus(query.value(idThumbnailStatus).toInt());
-        astro.tagStatus = TagExtractStatus(query.value(idTagStatus).toInt());
-        astro.processStatus = AstroFileProcessStatus(query.value(idProcessStatus).toInt());
-        astro.IsHidden = AstroFileProcessStatus(query.value(idIsHidden).toInt());
+        ThumbnailLocation location;
+        QByteArray contentHash;
+        if (!storeThumbnailLevel(packedQuery, row.data, location, contentHash))
+            continue;
 
-        files.insert(astroFileId, astro);
+        updateQuery.bindValue(":pack", location.pack);
+        updateQuery.bindValue(":pack_offset", location.offset);
+        updateQuery.bindValue(":pack_length", location.length);
+        updateQuery.bindValue(":content_hash", QString::fromLatin1(contentHash));
+        updateQuery.bindValue(":fits_id", row.id);
+        updateQuery.bindValue(":level", row.level);
+        if (updateQuery.exec())
+            moved++;
+        else
+            qDebug() << "DB: Failed to move thumbnail of" << row.id << "to the packs" << updateQuery.lastError();
     }
 
-    return files;
+    // The rows only refer to the packs once the thumbnails are in them. When the packs
+    // cannot be written, the rest stays in the db.
+    thumbnailStore->flush();
+    return moved;
+}
+
+/*!
+ * \brief FileRepository::vacuumDatabase
+ * Gives back the pages of the rows the migrations moved out of the db, and turns on
+ * the incremental vacuum of older dbs. A vacuum cannot run in a transaction.
+ */
+int FileRepository::vacuumDatabase(qint64& lastId)
+{
+    Q_UNUSED(lastId);
+    db.exec("PRAGMA auto_vacuum = INCREMENTAL");
+    db.exec("VACUUM");
+    return 0;
 }
 
-QMap<int, QMap<QString, QString>> _getAllAstrofileTags()
+void FileRepository::createTagTailsTable()
 {
-    QSqlQuery query("SELECT * FROM tags");
-    query.exec();
-    int fits_idId = query.record().indexOf("fits_id");
-    int idtagKey = query.record().indexOf("tagKey");
-    int idtagValue = query.record().indexOf("tagValue");
+    QSqlQuery tailsQuery(
+        "CREATE TABLE tag_tails ("
+            "fits_id INTEGER PRIMARY KEY, "
+            "tags BLOB, "
+            "FOREIGN KEY(fits_id) REFERENCES fits(id) ON DELETE CASCADE)");
 
-    QMap<int, QMap<QString, QString>> map;
-    while (query.next())
+    if(!tailsQuery.isActive())
+        emit dbFailedToInitialize(tailsQuery.lastError().text());
+}
+
+void FileRepository::createTagColumnIndexes()
+{
+    for (auto& column : tagColumns)
     {
-        auto fitsId = query.value(fits_idId).toInt();
-        auto tagKey = query.value(idtagKey).toString();
-        auto tagValue = query.value(idtagValue).toString();
+        if (!column.indexed)
+            continue;
+        QSqlQuery indexQuery(QString("CREATE INDEX idx_fits_%1 ON fits(%2);").arg(QString(column.column).toLower(), column.column));
+        if(!indexQuery.isActive())
+            emit dbFailedToInitialize(indexQuery.lastError().text());
+    }
+}
+
+/*!
+ * \brief FileRepository::createFileChangesTable
+ * The file_changes table is the change log of the fits table, kept by triggers so
+ * that every writer, including mergeCatalog, logs its changes in its own transaction.
+ * A row names the file that was added, updated or deleted, see FileChangeOperation,
+ * the reader looks up what it is now.
+ */
+void FileRepository::createFileChangesTable()
+{
+    QSqlQuery changesQuery(QString(
+        "CREATE TABLE file_changes ("
+            "seq INTEGER PRIMARY KEY AUTOINCREMENT, "
+            "fits_id INTEGER, "
+            "FullPath TEXT, "
+            "operation INTEGER DEFAULT %1)").arg(FileUpdated));
 
-        map[fitsId][tagKey] = tagValue;
+    if(!changesQuery.isActive())
+    {
+        emit dbFailedToInitialize(changesQuery.lastError().text());
+        return;
     }
-    return map;
+    createFileChangesTriggers();
 }
 
-QMap<int, QImage> FileRepository::_getAllThumbnails()
+// Made again by the migrations that change what is logged
+void FileRepository::createFileChangesTriggers()
 {
-    QSqlQuery query("SELECT fits_id, tiny_thumbnail FROM thumbnails");
-    query.exec();
-    int fits_idId = query.record().indexOf("fits_id");
-//    int idThumbnail = query.record().indexOf("thumbnail");
-    int idThumbnailTiny = query.record().indexOf("tiny_thumbnail");
+    const QStringList triggers = {
+        "DROP TRIGGER IF EXISTS fits_insert_change",
+        "DROP TRIGGER IF EXISTS fits_update_change",
+        "DROP TRIGGER IF EXISTS fits_delete_change",
+        QString("CREATE TRIGGER fits_insert_change AFTER INSERT ON fits BEGIN "
+            "INSERT INTO file_changes (fits_id, FullPath, operation) VALUES (NEW.id, NEW.FullPath, %1); END").arg(FileAdded),
+        QString("CREATE TRIGGER fits_update_change AFTER UPDATE ON fits BEGIN "
+            "INSERT INTO file_changes (fits_id, FullPath, operation) VALUES (NEW.id, NEW.FullPath, %1); END").arg(FileUpdated),
+        QString("CREATE TRIGGER fits_delete_change AFTER DELETE ON fits BEGIN "
+            "INSERT INTO file_changes (fits_id, FullPath, operation) VALUES (OLD.id, OLD.FullPath, %1); END").arg(FileDeleted),
+    };
+    for (auto& trigger : triggers)
+    {
+        QSqlQuery triggerQuery(trigger);
+        if(!triggerQuery.isActive())
+            emit dbFailedToInitialize(triggerQuery.lastError().text());
+    }
+}
 
-    QMap<int, QImage> images;
-    while (query.next())
+void FileRepository::pruneFileChanges()
+{
+    QSqlQuery query(QString("DELETE FROM file_changes WHERE seq <= (SELECT MAX(seq) FROM file_changes) - %1").arg(FILE_CHANGES_KEPT));
+    if (!query.isActive())
+        qDebug() << "Failed to prune the change log: " << query.lastError();
+}
+
+/*!
+ * \brief FileRepository::runMaintenance
+ * Submitted at MaintenancePriority when the engine is idle. Does nothing if the db did
+ * not change since the last run, or that was less than MAINTENANCE_INTERVAL ago.
+ *
+ * Deletes the files of the folders detached too long ago, see purgeDetachedFolders,
+ * trains the dictionary of the tag tails when the db has grown enough for a new one,
+ * and runs the pending migrations.
+ * Refreshes the statistics of the query planner with PRAGMA optimize, gives the free
+ * pages back VACUUM_PAGES_PER_SLICE at a time, and checkpoints the WAL. The other
+ * requests run between the slices, and the checkpoint is passive, so the reader
+ * connections are never waited for.
+ */
+void FileRepository::runMaintenance(const CancellationToken& token)
+{
+    if (accessMode() == SharedReaderAccess)
+        return;
+    if (maintainedChangeCounter == changeCounter() || (lastMaintenance.isValid() && !lastMaintenance.hasExpired(MAINTENANCE_INTERVAL)))
+        return;
+
+    static LatencyHistogram& maintenanceLatency = Metrics::histogram("repository.maintenance");
+    static std::atomic<qint64>& vacuumedCount = Metrics::counter("repository.pages_vacuumed");
+    ScopedLatency latency(maintenanceLatency);
+
+    // Before the change log is pruned and the pages are given back
+    purgeDetachedFolders();
+    pruneFileChanges();
+    trainTagDictionary(token);
+    // Before the vacuum, which gives back the pages they free
+    runMigrations(false, token);
+    // Only the tables that changed enough are analyzed, each on a sample of its rows
+    db.exec("PRAGMA analysis_limit = 400");
+    db.exec("PRAGMA optimize");
+
+    QSqlQuery freePagesQuery;
+    QSqlQuery vacuumQuery;
+    for (;;)
     {
-        AstroFile astro;
-        int fitsId = query.value(fits_idId).toInt();
-//        QByteArray inByteArray = query.value(idThumbnail).toByteArray();
-        QByteArray inByteArrayTiny = query.value(idThumbnailTiny).toByteArray();
+        if (cancellationToken.isCanceled() || token.isCanceled())
+            return;
+        yieldRequests(MaintenancePriority);
+
+        int freePages = 0;
+        if (freePagesQuery.exec("PRAGMA freelist_count") && freePagesQuery.first())
+            freePages = freePagesQuery.value(0).toInt();
+        freePagesQuery.finish();
+        if (freePages == 0)
+            break;
 
-        images[fitsId].loadFromData(inByteArrayTiny, "PNG");
+        // Nothing is freed by a db without auto_vacuum. Each step frees one page,
+        // so the statement is stepped to the end.
+        if (!vacuumQuery.exec(QString("PRAGMA incremental_vacuum(%1)").arg(VACUUM_PAGES_PER_SLICE)))
+        {
+            qDebug() << "DB: Failed to vacuum" << vacuumQuery.lastError();
+            break;
+        }
+        while (vacuumQuery.next())
+            ;
+        vacuumQuery.finish();
+
+        int remainingPages = 0;
+        if (freePagesQuery.exec("PRAGMA freelist_count") && freePagesQuery.first())
+            remainingPages = freePagesQuery.value(0).toInt();
+        freePagesQuery.finish();
+        vacuumedCount += freePages - remainingPages;
+        if (remainingPages >= freePages)
+            break;
+    }
+
+    if (accessMode() == LocalAccess)
+    {
+        yieldRequests(MaintenancePriority);
+        db.exec("PRAGMA wal_checkpoint(PASSIVE)");
     }
 
-    return images;
+    // The cache and the map follow the size of the db
+    tuneConnection(db);
+
+    maintainedChangeCounter = changeCounter();
+    lastMaintenance.start();
 }
 
-void FileRepository::loadModel()
+qint64 FileRepository::latestChangeSeq()
+{
+    QSqlQuery query("SELECT MAX(seq) FROM file_changes");
+    if (query.first())
+        return query.value(0).toLongLong();
+    return 0;
+}
+
+/*!
+ * \brief FileRepository::migrateSkyPositions
+ * Fills the RaDegrees and DecDegrees columns of a chunk of rows from the tag columns.
+ */
+int FileRepository::migrateSkyPositions(qint64& lastId)
+{
+    QSqlQuery updateQuery;
+    updateQuery.prepare("UPDATE fits SET RaDegrees = :ra, DecDegrees = :dec WHERE id = :id");
+
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare(QString("SELECT id, ObjectRa, ObjectDec FROM fits WHERE id > :lastId AND ObjectRa IS NOT NULL AND ObjectDec IS NOT NULL "
+                          "ORDER BY id LIMIT %1").arg(MIGRATION_CHUNK_SIZE));
+    query.bindValue(":lastId", lastId);
+    query.exec();
+    int migrated = 0;
+    while (query.next())
+    {
+        lastId = query.value(0).toLongLong();
+        migrated++;
+        double ra;
+        double dec;
+        if (!SkyCoordinates::parseRa(query.value(1).toString(), ra) || !SkyCoordinates::parseDec(query.value(2).toString(), dec))
+            continue;
+        updateQuery.bindValue(":ra", ra);
+        updateQuery.bindValue(":dec", dec);
+        updateQuery.bindValue(":id", query.value(0).toInt());
+        if (!updateQuery.exec())
+            qDebug() << "DB: Failed to migrate the position of" << query.value(0).toInt() << updateQuery.lastError();
+    }
+    return migrated;
+}
+
+/*!
+ * \brief FileRepository::migrateSearchKeywords
+ * Fills the search table for a chunk of the files written before it was kept.
+ * Files written since then are already in it, and are replaced.
+ */
+int FileRepository::migrateSearchKeywords(qint64& lastId)
 {
-    // 1. Get the entire fits table into memory
-    // select * from fits
-    // create a map with key (fits_id), and value Astrofile
-    // insert all into map
+    QSqlQuery insertQuery;
+    insertQuery.prepare("INSERT INTO fits_search (rowid, FileName, DirectoryPath, Keywords) VALUES (:id, :FileName, :DirectoryPath, :Keywords)");
 
-    auto fitsmap = _getAllAstrofiles();
-    emit modelLoadingGotAstrofiles();
-    // 2. Get the entire tags table into memory
-    // select * from tags
+    QSqlQuery deleteQuery;
+    deleteQuery.prepare("DELETE FROM fits_search WHERE rowid = :id");
 
-    auto tagsmap = _getAllAstrofileTags();
+    QString tagColumnNames;
+    for (auto& column : tagColumns)
+        tagColumnNames += QString(", fits.%1").arg(column.column);
 
-    // 3. Add tags to their fits files
-    // insert all tags from #2 into map by fits_id
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare(QString("SELECT fits.id, fits.FileName, fits.DirectoryPath, tag_tails.tags%1 FROM fits LEFT JOIN tag_tails ON tag_tails.fits_id = fits.id "
+                          "WHERE fits.id > :lastId ORDER BY fits.id LIMIT %2").arg(tagColumnNames).arg(MIGRATION_CHUNK_SIZE));
+    query.bindValue(":lastId", lastId);
+    query.exec();
+    int migrated = 0;
+    while (query.next())
+    {
+        lastId = query.value(0).toLongLong();
+        migrated++;
+        deleteQuery.bindValue(":id", query.value(0).toInt());
+        deleteQuery.exec();
 
-    QMapIterator<int, QMap<QString, QString>> iter(tagsmap);
+        QMap<QString, QString> tags = decodeTagTail(tagTailCodec, query.value(3).toByteArray());
+        for (size_t i = 0; i < std::size(tagColumns); i++)
+        {
+            const QVariant value = query.value(int(i) + 4);
+            if (!value.isNull())
+                tags.insert(tagColumns[i].key, value.toString());
+        }
+        insertQuery.bindValue(":id", query.value(0).toInt());
+        insertQuery.bindValue(":FileName", query.value(1).toString());
+        insertQuery.bindValue(":DirectoryPath", query.value(2).toString());
+        insertQuery.bindValue(":Keywords", searchKeywords(tags));
+        if (!insertQuery.exec())
+            qDebug() << "DB: Failed to index" << query.value(0).toInt() << "for search" << insertQuery.lastError();
+    }
+    return migrated;
+}
 
-    while(iter.hasNext())
+/*!
+ * \brief FileRepository::migrateTagsToColumns
+ * Moves the rows of the tags table into the tag columns of the fits table, where
+ * SQLite converts the numbers to the column type, and the rest into tag_tails.
+ * The tags table is dropped once done.
+ */
+void FileRepository::migrateTagsToColumns()
+{
+    for (auto& column : tagColumns)
     {
-        iter.next();
-        auto fitsId = iter.key();
-        auto& tagsList = iter.value();
-        fitsmap[fitsId].Tags.insert(tagsList);
-//        fitsmap[fitsId].thumbnail = QImage(20, 20, QImage::Format::Format_RGB32);
+        db.exec(QString("ALTER TABLE fits ADD COLUMN %1 %2").arg(column.column, column.type));
+
+        QSqlQuery updateQuery;
+        updateQuery.prepare(QString("UPDATE fits SET %1 = (SELECT tagValue FROM tags WHERE tags.fits_id = fits.id AND tagKey = :key LIMIT 1)").arg(column.column));
+        updateQuery.bindValue(":key", column.key);
+        if (!updateQuery.exec())
+            qDebug() << "DB: Failed to migrate tag" << column.key << updateQuery.lastError();
     }
-    emit modelLoadingGotTags();
+    createTagColumnIndexes();
+    createTagTailsTable();
+
+    QSqlQuery tailQuery;
+    tailQuery.prepare("INSERT INTO tag_tails (fits_id, tags) VALUES (:fits_id, :tags)");
+
+    QSqlQuery tagsQuery;
+    tagsQuery.setForwardOnly(true);
+    tagsQuery.exec("SELECT fits_id, tagKey, tagValue FROM tags ORDER BY fits_id");
+    bool hasTag = tagsQuery.next();
+    while (hasTag)
+    {
+        const int id = tagsQuery.value(0).toInt();
+        QMap<QString, QString> tags;
+        while (hasTag && tagsQuery.value(0).toInt() == id)
+        {
+            tags.insert(tagsQuery.value(1).toString(), tagsQuery.value(2).toString());
+            hasTag = tagsQuery.next();
+        }
 
-    // 4. Get the entire thumbnails into memory
-    // select * from thumbnails
+        const QByteArray tail = encodeTagTail(tagTailCodec, tags);
+        if (tail.isEmpty())
+            continue;
+        tailQuery.bindValue(":fits_id", id);
+        tailQuery.bindValue(":tags", tail);
+        if (!tailQuery.exec())
+            qDebug() << "DB: Failed to migrate tags of" << id << tailQuery.lastError();
+    }
+    tagsQuery.finish();
 
-    auto thumbnails = _getAllThumbnails();
-    emit modelLoadingGotThumbnails();
+    db.exec("DROP TABLE tags");
+}
 
-    // 5. Add thumbnails to their fits files
-    // insert all thumbnails from #4 into map by fits_id
+void FileRepository::loadCatalogState()
+{
+    QSqlQuery query("SELECT catalog_id, change_counter FROM catalog_state");
+    if (query.first())
+    {
+        _catalogId.storeRelaxed(query.value(0).toLongLong());
+        _changeCounter.storeRelaxed(query.value(1).toLongLong());
+    }
+}
 
-    QMapIterator<int, QImage> thumbiter(thumbnails);
-    while (thumbiter.hasNext())
+/*!
+ * \brief FileRepository::incrementChangeCounter
+ * Must be called inside the transaction that modifies the fits table.
+ */
+void FileRepository::incrementChangeCounter()
+{
+    QSqlQuery query("UPDATE catalog_state SET change_counter = change_counter + 1");
+    if (!query.isActive())
     {
-        thumbiter.next();
-        auto fitsId = thumbiter.key();
-        auto& image = thumbiter.value();
-        fitsmap[fitsId].tinyThumbnail = image;
-        fitsmap[fitsId].thumbnailStatus = ThumbnailLoaded;
+        qDebug() << "Failed to update change counter: " << query.lastError();
+        return;
     }
+    _changeCounter.fetchAndAddRelaxed(1);
+}
+
+int FileRepository::schemaVersion()
+{
+    return DB_SCHEMA_VERSION;
+}
+
+qint64 FileRepository::catalogId() const
+{
+    return _catalogId.loadRelaxed();
+}
 
-    // 6. convert map's `values` into a list of astroFile, and emit the list
+qint64 FileRepository::changeCounter() const
+{
+    return _changeCounter.loadRelaxed();
+}
 
-    auto list = fitsmap.values();
+QString FileRepository::snapshotFilePath()
+{
+    // The shared db is read-only, the snapshot of its catalog stays on this machine
+    if (accessMode() == SharedReaderAccess)
+        return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/shared-catalog.snapshot";
+    return QFileInfo(databaseFilePath()).absolutePath() + "/catalog.snapshot";
+}
 
-    emit modelLoaded(list);
+/*!
+ * \brief FileRepository::folderPrefix
+ * The prefix of the full paths of the files in the folder and its subfolders. It ends
+ * with a '/', otherwise other folders that start with the same name would match.
+ */
+QString FileRepository::folderPrefix(const QString &fullPath)
+{
+    QString path = QDir::cleanPath(fullPath);
+    return path.endsWith('/') ? path : path + '/';
+}
+
+/*!
+ * \brief FileRepository::folderPrefixEnd
+ * The smallest path after all the paths starting with the prefix: the trailing '/' is
+ * replaced by the next character, '0'. Paths in [prefix, prefixEnd) are in the folder,
+ * which SQLite looks up as a range of a case sensitive index, unlike LIKE 'prefix%'.
+ */
+QString FileRepository::folderPrefixEnd(const QString &prefix)
+{
+    QString end = prefix;
+    end[end.length() - 1] = QChar('/' + 1);
+    return end;
+}
+
+QList<AstroFile> FileRepository::getAstrofilesInFolder(const QString& fullPath)
+{
+    QList<AstroFile> files;
+    QSqlQuery query;
+    const QString prefix = folderPrefix(fullPath);
+
+    query.prepare("SELECT * FROM fits WHERE FullPath >= :prefix AND FullPath < :prefixEnd");
+    query.bindValue(":prefix", prefix);
+    query.bindValue(":prefixEnd", folderPrefixEnd(prefix));
+
+    bool ret = query.exec();
+    if (!ret)
+    {
+        qDebug() << "could not query: " << query.lastError();
+        return files;
+    }
+
+    while (query.next())
+    {
+        int idId = query.record().indexOf("Id");
+        int idFileName = query.record().indexOf("FileName");
+        int idFullPath = query.record().indexOf("FullPath");
+        int idDirectoryPath = query.record().indexOf("DirectoryPath");
+        int idVolumeName = query.record().indexOf("VolumeName");
+        int idFileType = query.record().indexOf("FileType");
+        int idFileExtension = query.record().indexOf("FileExtension");
+        int idCreatedTime = query.record().indexOf("CreatedTime");
+        int idLastModifiedTime = query.record().indexOf("LastModifiedTime");
+        int idFileHash = query.record().indexOf("FileHash");
+        int idImageHash = query.record().indexOf("ImageHash");
+        int idIsHidden = query.record().indexOf("IsHidden");
+        AstroFile astro;
+        astro.Id = query.value(idId).toInt();
+        astro.FileName = query.value(idFileName).toString();
+        astro.FullPath = query.value(idFullPath).toString();
+        astro.DirectoryPath = query.value(idDirectoryPath).toString();
+        astro.VolumeName = query.value(idVolumeName).toString();
+        astro.FileType = AstroFileType(query.value(idFileType).toInt());
+        astro.FileExtension = query.value(idFileExtension).toString();
+        astro.CreatedTime = query.value(idCreatedTime).toDateTime();
+        astro.LastModifiedTime = query.value(idLastModifiedTime).toDateTime();
+        astro.FileHash = query.value(idFileHash).toString();
+        astro.ImageHash = query.value(idImageHash).toString();
+        astro.IsHidden = query.value(idIsHidden).toInt();
+
+        files.append(astro);
+    }
+
+    return files;
+}
+
+void FileRepository::addOrUpdateAstrofile(const AstroFile& astroFile)
+{
+    addOrUpdateAstrofiles({astroFile});
+}
+
+/*!
+ * \brief FileRepository::addOrUpdateAstrofiles
+ * \param astroFiles
+ *
+ * Writes a batch of processed files in a single transaction. The fits, tag_tails and
+ * thumbnails statements are prepared once and reused for every file in the batch.
+ * astroFileUpdated is emitted for each file only after the batch is committed.
+ */
+void FileRepository::addOrUpdateAstrofiles(const QList<AstroFile>& astroFiles)
+{
+    if (astroFiles.isEmpty())
+        return;
+
+    static LatencyHistogram& writeLatency = Metrics::histogram("repository.write_batch");
+    static LatencyHistogram& commitLatency = Metrics::histogram("repository.commit");
+    static std::atomic<qint64>& writtenCount = Metrics::counter("repository.files_written");
+    static AllocationCounter& writeAllocations = AllocationTracker::counter("repository.write_batch");
+    ScopedLatency latency(writeLatency);
+    AllocationScope allocations(writeAllocations);
+
+    QSqlQuery fitsQuery;
+    QSqlQuery idQuery;
+    prepareFitsQueries(fitsQuery, idQuery);
+
+    // The tail is only written when it changed
+    QSqlQuery tagsQuery;
+    tagsQuery.prepare("INSERT INTO tag_tails (fits_id, tags) VALUES (:fits_id, :tags) "
+                      "ON CONFLICT(fits_id) DO UPDATE SET tags = excluded.tags WHERE tags IS NOT excluded.tags");
+
+    QSqlQuery tagsDeleteQuery;
+    tagsDeleteQuery.prepare("DELETE FROM tag_tails WHERE fits_id = :fits_id");
+
+    QSqlQuery thumbnailQuery;
+    QSqlQuery thumbnailLevelQuery;
+    QSqlQuery packedQuery;
+    prepareThumbnailQueries(thumbnailQuery, thumbnailLevelQuery, packedQuery);
+
+    // The thumbnails of an earlier version of the file are kept until the new ones are
+    // made, and dropped if the file is done without one
+    QSqlQuery thumbnailDeleteQuery;
+    thumbnailDeleteQuery.prepare("DELETE FROM thumbnails WHERE fits_id = :fits_id");
+
+    QSqlQuery thumbnailLevelDeleteQuery;
+    thumbnailLevelDeleteQuery.prepare("DELETE FROM thumbnail_levels WHERE fits_id = :fits_id");
+
+    QSqlQuery searchDeleteQuery;
+    searchDeleteQuery.prepare("DELETE FROM fits_search WHERE rowid = :id");
+
+    QSqlQuery searchQuery;
+    searchQuery.prepare("INSERT INTO fits_search (rowid, FileName, DirectoryPath, Keywords) VALUES (:id, :FileName, :DirectoryPath, :Keywords)");
+
+    // The job of a file is done with its pixel phase, in the transaction that writes it
+    QSqlQuery jobQuery;
+    jobQuery.prepare("DELETE FROM ingest_jobs WHERE FullPath = :path");
+
+    QList<AstroFile> insertedAstroFiles;
+    insertedAstroFiles.reserve(astroFiles.count());
+
+    QSqlDatabase::database().transaction();
+
+    for (auto& astroFile : astroFiles)
+    {
+        if (cancellationToken.isCanceled())
+            break;
+
+        if (astroFile.processStatus != NeedsToBeProcessed)
+        {
+            jobQuery.bindValue(":path", astroFile.FullPath);
+            if (!jobQuery.exec())
+                qDebug() << "DB: Failed to finish the job of" << astroFile.FullPath << jobQuery.lastError();
+        }
+
+        int id = insertAstrofile(fitsQuery, idQuery, astroFile);
+        if (id == 0)
+            continue;
+
+        searchDeleteQuery.bindValue(":id", id);
+        if (!searchDeleteQuery.exec())
+            qDebug() << "DB: Failed to remove" << astroFile.FullPath << "from the search" << searchDeleteQuery.lastError();
+        searchQuery.bindValue(":id", id);
+        searchQuery.bindValue(":FileName", astroFile.FileName);
+        searchQuery.bindValue(":DirectoryPath", astroFile.DirectoryPath);
+        searchQuery.bindValue(":Keywords", searchKeywords(astroFile.Tags));
+        if (!searchQuery.exec())
+            qDebug() << "DB: Failed to index" << astroFile.FullPath << "for search" << searchQuery.lastError();
+
+        AstroFile insertedAstroFile(astroFile);
+        insertedAstroFile.Id = id;
+
+        addTags(tagsQuery, tagsDeleteQuery, insertedAstroFile);
+        if (insertedAstroFile.thumbnailStatus == ThumbnailLoaded)
+            addThumbnail(thumbnailQuery, thumbnailLevelQuery, packedQuery, insertedAstroFile);
+        else if (insertedAstroFile.processStatus != NeedsToBeProcessed)
+        {
+            thumbnailDeleteQuery.bindValue(":fits_id", id);
+            thumbnailLevelDeleteQuery.bindValue(":fits_id", id);
+            if (!thumbnailDeleteQuery.exec() || !thumbnailLevelDeleteQuery.exec())
+                qDebug() << "DB: Failed to remove the thumbnails of" << astroFile.FullPath;
+        }
+
+        // The catalog keeps the keywords of the columns, like when it is loaded
+        insertedAstroFile.Tags = columnTags(insertedAstroFile.Tags);
+        // Written, so the signals that queue the file to the catalog do not hold its pixels
+        insertedAstroFile.dropThumbnailPixels();
+
+        insertedAstroFiles.append(insertedAstroFile);
+    }
+
+    incrementChangeCounter();
+    // The rows only refer to the packs once the thumbnails are in them
+    thumbnailStore->flush();
+    {
+        ScopedLatency commit(commitLatency);
+        QSqlDatabase::database().commit();
+    }
+    writtenCount += insertedAstroFiles.count();
+
+    resolveQuickHashCollisions(insertedAstroFiles);
+
+    for (auto& insertedAstroFile : insertedAstroFiles)
+        emit astroFileUpdated(insertedAstroFile);
+}
+
+/*!
+ * \brief FileRepository::updateHeaders
+ * Writes the keywords of files whose header was edited, see FitsHeaderEditor, with
+ * their new modification time, size and quick hash. The FileHash is cleared, and
+ * computed again if the new quick hash collides. The thumbnails and the measures of
+ * the pixels are kept. Returns the files as the catalog keeps them.
+ */
+QList<AstroFile> FileRepository::updateHeaders(const QList<AstroFile> &astroFiles)
+{
+    static LatencyHistogram& updateLatency = Metrics::histogram("repository.update_headers");
+    ScopedLatency latency(updateLatency);
+
+    QStringList assignments = {"LastModifiedTime = :LastModifiedTime", "FileSize = :FileSize", "QuickHash = :QuickHash",
+                               "FileHash = :FileHash", "RaDegrees = :RaDegrees", "DecDegrees = :DecDegrees"};
+    for (auto& column : tagColumns)
+        assignments.append(QString("%1 = :%1").arg(column.column));
+    QSqlQuery fitsQuery;
+    fitsQuery.prepare(QString("UPDATE fits SET %1 WHERE id = :id").arg(assignments.join(", ")));
+
+    QSqlQuery tagsQuery;
+    tagsQuery.prepare("INSERT INTO tag_tails (fits_id, tags) VALUES (:fits_id, :tags) "
+                      "ON CONFLICT(fits_id) DO UPDATE SET tags = excluded.tags WHERE tags IS NOT excluded.tags");
+    QSqlQuery tagsDeleteQuery;
+    tagsDeleteQuery.prepare("DELETE FROM tag_tails WHERE fits_id = :fits_id");
+    QSqlQuery searchQuery;
+    searchQuery.prepare("UPDATE fits_search SET Keywords = :Keywords WHERE rowid = :id");
+
+    QList<AstroFile> updatedAstroFiles;
+    QSqlDatabase::database().transaction();
+    for (auto& astroFile : astroFiles)
+    {
+        fitsQuery.bindValue(":id", astroFile.Id);
+        fitsQuery.bindValue(":LastModifiedTime", astroFile.LastModifiedTime);
+        fitsQuery.bindValue(":FileSize", astroFile.FileSize);
+        fitsQuery.bindValue(":QuickHash", astroFile.QuickHash);
+        fitsQuery.bindValue(":FileHash", astroFile.FileHash);
+        double ra;
+        double dec;
+        const bool hasPosition = SkyCoordinates::parseRa(astroFile.Tags.value(TagObjectRa), ra) && SkyCoordinates::parseDec(astroFile.Tags.value(TagObjectDec), dec);
+        fitsQuery.bindValue(":RaDegrees", hasPosition ? QVariant(ra) : QVariant());
+        fitsQuery.bindValue(":DecDegrees", hasPosition ? QVariant(dec) : QVariant());
+        for (auto& column : tagColumns)
+        {
+            auto iter = astroFile.Tags.constFind(column.key);
+            fitsQuery.bindValue(QString(":%1").arg(column.column), iter != astroFile.Tags.constEnd() ? tagColumnValue(column, iter.value()) : QVariant());
+        }
+        if (!fitsQuery.exec() || fitsQuery.numRowsAffected() == 0)
+        {
+            qDebug() << "DB: Failed to update the header of" << astroFile.FullPath << fitsQuery.lastError();
+            continue;
+        }
+
+        addTags(tagsQuery, tagsDeleteQuery, astroFile);
+        searchQuery.bindValue(":id", astroFile.Id);
+        searchQuery.bindValue(":Keywords", searchKeywords(astroFile.Tags));
+        if (!searchQuery.exec())
+            qDebug() << "DB: Failed to index" << astroFile.FullPath << "for search" << searchQuery.lastError();
+
+        AstroFile updatedAstroFile(astroFile);
+        updatedAstroFile.Tags = columnTags(updatedAstroFile.Tags);
+        updatedAstroFiles.append(updatedAstroFile);
+    }
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+
+    resolveQuickHashCollisions(updatedAstroFiles);
+    return updatedAstroFiles;
+}
+
+/*!
+ * \brief FileRepository::verificationCandidates
+ * The processed files never verified, then the ones verified the longest ago, up to
+ * verifiedBefore. Their FileHash is the hash to check them against: their own, or the
+ * one of their first verification.
+ */
+QList<AstroFile> FileRepository::verificationCandidates(int limit, const QDateTime &verifiedBefore)
+{
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare(QString("SELECT fits.id, fits.FullPath, fits.DirectoryPath, fits.FileSize, fits.LastModifiedTime, "
+                  "COALESCE(NULLIF(fits.FileHash, ''), v.FileHash), COALESCE(v.Integrity, 0) "
+                  "FROM fits LEFT JOIN verifications v ON v.fits_id = fits.id "
+                  "WHERE fits.ProcessStatus = :processed AND (v.VerifiedTime IS NULL OR v.VerifiedTime < :before) AND %1 "
+                  "ORDER BY COALESCE(v.VerifiedTime, 0), fits.id LIMIT :limit").arg(attachedCondition("fits.FullPath")));
+    query.bindValue(":processed", AstroFileProcessed);
+    query.bindValue(":before", verifiedBefore.toMSecsSinceEpoch());
+    query.bindValue(":limit", limit);
+    QList<AstroFile> candidates;
+    if (!query.exec())
+    {
+        qDebug() << "DB: Failed to find the files to verify" << query.lastError();
+        return candidates;
+    }
+    while (query.next())
+    {
+        AstroFile astroFile;
+        astroFile.Id = query.value(0).toInt();
+        astroFile.FullPath = query.value(1).toString();
+        astroFile.DirectoryPath = query.value(2).toString();
+        astroFile.FileSize = query.value(3).toLongLong();
+        astroFile.LastModifiedTime = query.value(4).toDateTime();
+        astroFile.FileHash = query.value(5).toString();
+        astroFile.Integrity = AstroFileIntegrity(query.value(6).toInt());
+        candidates.append(astroFile);
+    }
+    return candidates;
+}
+
+/*!
+ * \brief FileRepository::recordVerifications
+ * Keeps when the files were verified, their Integrity and the hash they were checked
+ * against, and sends the verified ones with integrityVerified. A file left unverified
+ * keeps the result of its last verification.
+ */
+void FileRepository::recordVerifications(const QList<AstroFile> &astroFiles)
+{
+    QSqlQuery query;
+    query.prepare("INSERT INTO verifications (fits_id, VerifiedTime, Integrity, FileHash) VALUES (:id, :time, :integrity, :hash) "
+                  "ON CONFLICT(fits_id) DO UPDATE SET VerifiedTime = excluded.VerifiedTime, "
+                  "Integrity = CASE WHEN excluded.Integrity = 0 THEN Integrity ELSE excluded.Integrity END, "
+                  "FileHash = COALESCE(FileHash, excluded.FileHash)");
+    QSqlQuery existsQuery;
+    existsQuery.prepare("SELECT 1 FROM fits WHERE id = :id");
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<AstroFile> changed;
+    QSqlDatabase::database().transaction();
+    for (auto& astroFile : astroFiles)
+    {
+        // Deleted or written again while it was read
+        existsQuery.bindValue(":id", astroFile.Id);
+        if (!existsQuery.exec() || !existsQuery.first())
+            continue;
+        query.bindValue(":id", astroFile.Id);
+        query.bindValue(":time", now);
+        query.bindValue(":integrity", astroFile.Integrity);
+        query.bindValue(":hash", astroFile.FileHash.isEmpty() ? QVariant() : QVariant(astroFile.FileHash));
+        if (!query.exec())
+            qDebug() << "DB: Failed to record the verification of" << astroFile.FullPath << query.lastError();
+        else if (astroFile.Integrity != IntegrityUnverified)
+            changed.append(astroFile);
+    }
+    // The snapshot keeps the Integrity of the rows
+    if (!changed.isEmpty())
+        incrementChangeCounter();
+    QSqlDatabase::database().commit();
+
+    if (!changed.isEmpty())
+        emit integrityVerified(changed);
+}
+
+/*!
+ * \brief FileRepository::solveCandidates
+ * The processed FITS frames with stars but without a position from their header, that
+ * were not tried yet. Frames measured before the stars were counted are tried too.
+ */
+QList<AstroFile> FileRepository::solveCandidates(int limit)
+{
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare(QString("SELECT fits.id, fits.FullPath, fits.DirectoryPath FROM fits "
+                  "LEFT JOIN plate_solutions s ON s.fits_id = fits.id "
+                  "WHERE fits.ProcessStatus = :processed AND fits.FileType = :fits AND fits.RaDegrees IS NULL "
+                  "AND (fits.StarCount IS NULL OR fits.StarCount > 0) AND s.fits_id IS NULL AND %1 "
+                  "ORDER BY fits.id LIMIT :limit").arg(attachedCondition("fits.FullPath")));
+    query.bindValue(":processed", AstroFileProcessed);
+    query.bindValue(":fits", Fits);
+    query.bindValue(":limit", limit);
+    QList<AstroFile> candidates;
+    if (!query.exec())
+    {
+        qDebug() << "DB: Failed to find the frames to solve" << query.lastError();
+        return candidates;
+    }
+    while (query.next())
+    {
+        AstroFile astroFile;
+        astroFile.Id = query.value(0).toInt();
+        astroFile.FullPath = query.value(1).toString();
+        astroFile.DirectoryPath = query.value(2).toString();
+        candidates.append(astroFile);
+    }
+    return candidates;
+}
+
+/*!
+ * \brief FileRepository::recordSolutions
+ * Keeps the Solution of the frames, and sends the solved ones with platesSolved.
+ */
+void FileRepository::recordSolutions(const QList<AstroFile> &astroFiles)
+{
+    QSqlQuery query;
+    query.prepare("INSERT OR REPLACE INTO plate_solutions (fits_id, SolvedTime, RaDegrees, DecDegrees, Rotation, Scale) "
+                  "SELECT id, :time, :ra, :dec, :rotation, :scale FROM fits WHERE id = :id");
+    auto number = [](double value) { return std::isnan(value) ? QVariant() : QVariant(value); };
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<AstroFile> solved;
+    QSqlDatabase::database().transaction();
+    for (auto& astroFile : astroFiles)
+    {
+        const PlateSolution& solution = astroFile.Solution;
+        query.bindValue(":id", astroFile.Id);
+        query.bindValue(":time", now);
+        query.bindValue(":ra", number(solution.ra));
+        query.bindValue(":dec", number(solution.dec));
+        query.bindValue(":rotation", number(solution.rotation));
+        query.bindValue(":scale", number(solution.scale));
+        // Nothing is inserted for a file deleted while it was solved
+        if (!query.exec())
+            qDebug() << "DB: Failed to record the solution of" << astroFile.FullPath << query.lastError();
+        else if (query.numRowsAffected() > 0 && solution.isSolved())
+            solved.append(astroFile);
+    }
+    // The snapshot keeps the Solution of the rows
+    if (!solved.isEmpty())
+        incrementChangeCounter();
+    QSqlDatabase::database().commit();
+
+    if (!solved.isEmpty())
+        emit platesSolved(solved);
+}
+
+/*!
+ * \brief FileRepository::prepareFitsQueries
+ * The upsert of a fits row, see insertAstrofile, and the query of its id.
+ */
+void FileRepository::prepareFitsQueries(QSqlQuery &fitsQuery, QSqlQuery &idQuery)
+{
+    QStringList columnNames = {"FileName", "FullPath", "DirectoryPath", "VolumeName", "FileType", "FileExtension", "CreatedTime", "LastModifiedTime",
+                               "TagStatus", "ThumbnailStatus", "ProcessStatus", "FileHash", "ImageHash", "IsHidden", "QuickHash", "StretchParameters",
+                               "PerceptualHash", "RaDegrees", "DecDegrees", "Background", "Noise", "StarCount", "Fwhm", "Eccentricity", "FileSize", "FailureReason",
+                               "ThumbnailVersion", "PlaceholderHash", "FileDevice", "FileInode"};
+    for (auto& column : tagColumns)
+        columnNames.append(column.column);
+
+    QStringList placeholders;
+    QStringList assignments;
+    for (auto& column : columnNames)
+    {
+        placeholders.append(":" + column);
+        if (column != "FullPath")
+            assignments.append(QString("%1 = excluded.%1").arg(column));
+    }
+
+    // A file that is written again keeps its row, and its id, instead of being replaced
+    // by a new one that the tags and thumbnails would be deleted and inserted with.
+    fitsQuery.prepare(QString("INSERT INTO fits (%1) VALUES (%2) ON CONFLICT(FullPath) DO UPDATE SET %3")
+                      .arg(columnNames.join(","), placeholders.join(","), assignments.join(",")));
+
+    idQuery.prepare("SELECT id FROM fits WHERE FullPath = :FullPath");
+}
+
+/*!
+ * \brief FileRepository::resolveQuickHashCollisions
+ * \param astroFiles
+ *
+ * The pixel phase only computes the quick hash of a file. When a quick hash is shared
+ * with other rows, the full FileHash of every file in the group is computed (reading
+ * them again from disk) and stored, so duplicates are decided on the full hash.
+ * A FileHash of another algorithm than the current one is computed again, the hashes
+ * of two algorithms never match. The files are read on collisionHashPool, outside of
+ * any transaction and without holding the repository thread, and their hashes written
+ * by a request of their own, see writeFileHashes.
+ */
+void FileRepository::resolveQuickHashCollisions(const QList<AstroFile>& astroFiles)
+{
+    // The files of a replica are on the machine of the server, which resolved them
+    if (accessMode() == ReplicaAccess)
+        return;
+
+    QSqlQuery collisionQuery;
+    collisionQuery.setForwardOnly(true);
+    // The files of the detached folders are hidden, they are neither hashed nor written
+    collisionQuery.prepare(QString("SELECT id, FullPath, DirectoryPath, QuickHash, FileHash FROM fits WHERE QuickHash = :quickHash AND %1")
+                           .arg(attachedCondition("FullPath")));
+
+    QList<AstroFile> members;
+    QSet<QString> quickHashes;
+    for (auto& astroFile : astroFiles)
+    {
+        if (astroFile.QuickHash.isEmpty() || isCurrentHash(astroFile.FileHash) || quickHashes.contains(astroFile.QuickHash))
+            continue;
+        quickHashes.insert(astroFile.QuickHash);
+
+        collisionQuery.bindValue(":quickHash", astroFile.QuickHash);
+        if (!collisionQuery.exec())
+        {
+            qDebug() << "DB: Failed to find quick hash collisions for " << astroFile.FullPath << collisionQuery.lastError();
+            continue;
+        }
+
+        QList<AstroFile> group;
+        while (collisionQuery.next())
+        {
+            AstroFile member;
+            member.Id = collisionQuery.value(0).toInt();
+            member.FullPath = collisionQuery.value(1).toString();
+            member.DirectoryPath = collisionQuery.value(2).toString();
+            member.QuickHash = collisionQuery.value(3).toString();
+            member.FileHash = collisionQuery.value(4).toString();
+            group.append(member);
+        }
+        collisionQuery.finish();
+        if (group.count() < 2)
+            continue;
+
+        for (auto& member : group)
+        {
+            if (!isCurrentHash(member.FileHash))
+                members.append(member);
+        }
+    }
+
+    if (members.isEmpty())
+        return;
+
+    CancellationToken token = cancellationToken;
+    QtConcurrent::run(&collisionHashPool, [this, members, token]() {
+        QList<AstroFile> hashed;
+        for (auto member : members)
+        {
+            if (token.isCanceled())
+                return;
+            FileReader reader;
+            if (!reader.open(member.FullPath, VolumeIo::ofDirectory(member.DirectoryPath), token))
+                continue;
+            member.FileHash = reader.fileHash(token);
+            if (!member.FileHash.isEmpty())
+                hashed.append(member);
+        }
+        if (!hashed.isEmpty())
+            submit<void>(IngestPriority, [this, hashed](const CancellationToken&) { writeFileHashes(hashed); });
+    });
+}
+
+/*!
+ * \brief FileRepository::writeFileHashes
+ * Writes the FileHash of the members of quick hash collisions in a short transaction,
+ * and sends the ones written with fileHashesResolved. A file written again since it
+ * was read has another quick hash, and is left to the collisions of that one. A file
+ * whose folder was detached since is left as it is.
+ */
+void FileRepository::writeFileHashes(const QList<AstroFile>& astroFiles)
+{
+    QSqlQuery updateQuery;
+    updateQuery.prepare(QString("UPDATE fits SET FileHash = :fileHash WHERE id = :id AND QuickHash = :quickHash AND %1").arg(attachedCondition("FullPath")));
+
+    QList<AstroFile> written;
+    QSqlDatabase::database().transaction();
+    for (auto& astroFile : astroFiles)
+    {
+        updateQuery.bindValue(":fileHash", astroFile.FileHash);
+        updateQuery.bindValue(":id", astroFile.Id);
+        updateQuery.bindValue(":quickHash", astroFile.QuickHash);
+        if (!updateQuery.exec())
+            qDebug() << "DB: Failed to update the file hash of " << astroFile.FullPath << updateQuery.lastError();
+        else if (updateQuery.numRowsAffected() > 0)
+            written.append(astroFile);
+    }
+    QSqlDatabase::database().commit();
+
+    if (!written.isEmpty())
+        emit fileHashesResolved(written);
+}
+
+/*!
+ * \brief FileRepository::unresolvedCollisions
+ * The rows whose quick hash is shared without a FileHash of the current algorithm,
+ * like the rows whose quick hash was just backfilled, the ones whose collision was
+ * not resolved before the app quit, or the ones hashed before the algorithm changed.
+ */
+QList<AstroFile> FileRepository::unresolvedCollisions()
+{
+    // Only the hashes of SHA1 have no prefix
+    const QString prefix = Hasher::prefixOf(Hasher::defaultAlgorithm());
+    const QString otherAlgorithm = prefix.isEmpty() ? "FileHash LIKE '%:%'" : QString("FileHash NOT LIKE '%1%'").arg(prefix);
+
+    QList<AstroFile> files;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.exec(QString("SELECT id, FullPath, QuickHash FROM fits WHERE (FileHash IS NULL OR FileHash = '' OR %1) AND QuickHash IN "
+               "(SELECT QuickHash FROM fits WHERE QuickHash != '' AND %2 GROUP BY QuickHash HAVING COUNT(*) > 1) AND %2").arg(otherAlgorithm, attachedCondition("FullPath")));
+    while (query.next())
+    {
+        AstroFile astroFile;
+        astroFile.Id = query.value(0).toInt();
+        astroFile.FullPath = query.value(1).toString();
+        astroFile.QuickHash = query.value(2).toString();
+        files.append(astroFile);
+    }
+    return files;
+}
+
+/*!
+ * \brief FileRepository::insertAstrofile
+ * Inserts the row of the file, or updates the row that has its path.
+ * Returns the id of the row, which is the same for every write of a path.
+ */
+int FileRepository::insertAstrofile(QSqlQuery& queryAdd, QSqlQuery& idQuery, const AstroFile& astroFile)
+{
+    queryAdd.bindValue(":FileName", astroFile.FileName);
+    queryAdd.bindValue(":FullPath", astroFile.FullPath);
+    queryAdd.bindValue(":DirectoryPath", astroFile.DirectoryPath);
+    queryAdd.bindValue(":VolumeName", astroFile.VolumeName);
+    queryAdd.bindValue(":FileType", astroFile.FileType);
+    queryAdd.bindValue(":FileExtension", astroFile.FileExtension);
+    queryAdd.bindValue(":CreatedTime", astroFile.CreatedTime);
+    queryAdd.bindValue(":LastModifiedTime", astroFile.LastModifiedTime);
+    queryAdd.bindValue(":FileHash", astroFile.FileHash);
+    queryAdd.bindValue(":ImageHash", astroFile.ImageHash);
+    queryAdd.bindValue(":QuickHash", astroFile.QuickHash);
+    queryAdd.bindValue(":StretchParameters", astroFile.StretchParameters);
+    // SQLite integers are signed, the bits are kept as they are. NULL until the thumbnail is made.
+    queryAdd.bindValue(":PerceptualHash", astroFile.tinyThumbnail.isNull() ? QVariant() : QVariant(qint64(astroFile.PerceptualHash)));
+    double ra;
+    double dec;
+    const bool hasPosition = SkyCoordinates::parseRa(astroFile.Tags.value(TagObjectRa), ra) && SkyCoordinates::parseDec(astroFile.Tags.value(TagObjectDec), dec);
+    queryAdd.bindValue(":RaDegrees", hasPosition ? QVariant(ra) : QVariant());
+    queryAdd.bindValue(":DecDegrees", hasPosition ? QVariant(dec) : QVariant());
+    // NULL until the frame is measured, and for the values a measure had none of
+    const FrameQuality& quality = astroFile.Quality;
+    auto measured = [&quality](float value) { return quality.isMeasured() && !std::isnan(value) ? QVariant(value) : QVariant(); };
+    queryAdd.bindValue(":Background", measured(quality.background));
+    queryAdd.bindValue(":Noise", measured(quality.noise));
+    queryAdd.bindValue(":StarCount", quality.isMeasured() ? QVariant(quality.starCount) : QVariant());
+    queryAdd.bindValue(":Fwhm", measured(quality.fwhm));
+    queryAdd.bindValue(":Eccentricity", measured(quality.eccentricity));
+    queryAdd.bindValue(":TagStatus", astroFile.tagStatus);
+    queryAdd.bindValue(":ThumbnailStatus", astroFile.thumbnailStatus);
+    queryAdd.bindValue(":ProcessStatus", astroFile.processStatus);
+    queryAdd.bindValue(":FileSize", astroFile.FileSize);
+    queryAdd.bindValue(":FailureReason", astroFile.FailureReason);
+    queryAdd.bindValue(":ThumbnailVersion", astroFile.ThumbnailVersion);
+    queryAdd.bindValue(":PlaceholderHash", astroFile.Placeholder.isNull() ? QVariant() : QVariant(astroFile.Placeholder.toByteArray()));
+    queryAdd.bindValue(":FileDevice", qint64(astroFile.FileDevice));
+    queryAdd.bindValue(":FileInode", qint64(astroFile.FileInode));
+    queryAdd.bindValue(":IsHidden", astroFile.IsHidden);
+    for (auto& column : tagColumns)
+    {
+        auto iter = astroFile.Tags.constFind(column.key);
+        queryAdd.bindValue(QString(":%1").arg(column.column), iter != astroFile.Tags.constEnd() ? tagColumnValue(column, iter.value()) : QVariant());
+    }
+
+    if(!queryAdd.exec())
+    {
+        // TODO: Handle failures
+        qDebug() << "record could not add: " << queryAdd.lastError();
+        return 0;
+    }
+
+    // lastInsertId is not set when the row was updated
+    idQuery.bindValue(":FullPath", astroFile.FullPath);
+    if (!idQuery.exec() || !idQuery.next())
+    {
+        qDebug() << "record id not found: " << idQuery.lastError();
+        return 0;
+    }
+    const int id = idQuery.value(0).toInt();
+    idQuery.finish();
+    return id;
+}
+
+// A string constant of a statement
+static QString sqlText(const QString& text)
+{
+    return '\'' + QString(text).replace('\'', "''") + '\'';
+}
+
+void FileRepository::deleteAstrofilesInFolder(const QString& fullPath)
+{
+    static LatencyHistogram& deleteLatency = Metrics::histogram("repository.delete_folder");
+    ScopedLatency latency(deleteLatency);
+    auto files = getAstrofilesInFolder(fullPath);
+    deleteRowsInFolder(fullPath, "1");
+
+    qDebug()<<"Done deleting from table";
+    emit astroFilesDeleted(files);
+    qDebug()<<"Done deleting";
+}
+
+/*!
+ * \brief FileRepository::deleteRowsInFolder
+ * Deletes the rows of the files in the folder that meet condition, and the state of
+ * its directories.
+ */
+void FileRepository::deleteRowsInFolder(const QString& fullPath, const QString& condition)
+{
+    QSqlQuery query;
+    const QString prefix = folderPrefix(fullPath);
+
+    // The files are deleted DELETE_CHUNK_SIZE at a time, the requests waiting for the
+    // db run in between
+    query.prepare(QString("DELETE FROM fits WHERE id IN (SELECT id FROM fits WHERE FullPath >= :prefix AND FullPath < :prefixEnd AND %2 LIMIT %1)")
+                  .arg(DELETE_CHUNK_SIZE).arg(condition));
+    for (;;)
+    {
+        QSqlDatabase::database().transaction();
+        query.bindValue(":prefix", prefix);
+        query.bindValue(":prefixEnd", folderPrefixEnd(prefix));
+        bool ret = query.exec();
+        if (!ret)
+            qDebug() << "could not delete: " << query.lastError();
+        const int deleted = ret ? query.numRowsAffected() : 0;
+        if (deleted > 0)
+            incrementChangeCounter();
+        QSqlDatabase::database().commit();
+        if (deleted < DELETE_CHUNK_SIZE)
+            break;
+        yieldRequests(IngestPriority);
+    }
+
+    QSqlDatabase::database().transaction();
+    deleteDirectoriesInFolder(query, fullPath);
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+}
+
+// The condition of a statement on the files in folder whose path is in column
+QString FileRepository::folderRange(const QString& column, const QString& folder)
+{
+    const QString prefix = folderPrefix(folder);
+    return QString("(%1 >= %2 AND %1 < %3)").arg(column, sqlText(prefix), sqlText(folderPrefixEnd(prefix)));
+}
+
+/*!
+ * \brief FileRepository::filesWhere
+ * Only what the catalog needs to find the rows of the files that meet condition.
+ */
+QList<AstroFile> FileRepository::filesWhere(const QString &condition)
+{
+    QList<AstroFile> files;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    if (!query.exec(QString("SELECT id, FullPath FROM fits WHERE %1").arg(condition)))
+    {
+        qDebug() << "could not query: " << query.lastError();
+        return files;
+    }
+    while (query.next())
+    {
+        AstroFile astroFile;
+        astroFile.Id = query.value(0).toInt();
+        astroFile.FullPath = query.value(1).toString();
+        files.append(astroFile);
+    }
+    return files;
+}
+
+/*!
+ * \brief FileRepository::forgetFoldersIn
+ * Removes the detached and attached again folders that are path or in it, from
+ * detached_folders and from the lists. Runs in the transaction of the caller.
+ */
+bool FileRepository::forgetFoldersIn(const QString &path)
+{
+    QSqlQuery query;
+    query.prepare("DELETE FROM detached_folders WHERE Path = :path OR (Path >= :prefix AND Path < :prefixEnd)");
+    query.bindValue(":path", path);
+    query.bindValue(":prefix", folderPrefix(path));
+    query.bindValue(":prefixEnd", folderPrefixEnd(folderPrefix(path)));
+    if (!query.exec())
+    {
+        qDebug() << "could not forget detached folders: " << query.lastError();
+        return false;
+    }
+    auto isIn = [&path](const QString& folder) { return folder == path || folder.startsWith(folderPrefix(path)); };
+    detachedFolders.removeIf(isIn);
+    reattachedFolders.removeIf(isIn);
+    return true;
+}
+
+/*!
+ * \brief FileRepository::detachFolder
+ * The search folder was removed. Instead of deleting its files, which deletes every
+ * row, its tags and thumbnails, the folder is recorded in detached_folders and its
+ * files are hidden: they are left out of the catalog and of what is read of the db
+ * for it, see attachedCondition. Adding the folder back shows them again without
+ * processing them, see attachFolder. They are logged as deleted, so the readers of
+ * the change log drop them too.
+ *
+ * The folders detached or attached again in it are forgotten, the whole folder is
+ * hidden. A folder attached again in a detached one is hidden again by forgetting it.
+ *
+ * The files are deleted once the folder was detached for DetachedFolderDays, see
+ * purgeDetachedFolders, right away when it is 0.
+ */
+void FileRepository::detachFolder(const QString &fullPath)
+{
+    const QString path = QDir::cleanPath(fullPath);
+    if (QSettings().value("DetachedFolderDays", DETACHED_FOLDER_DAYS).toInt() <= 0)
+    {
+        deleteAstrofilesInFolder(path);
+        return;
+    }
+    if (isDetached(path))
+        return;
+
+    static LatencyHistogram& detachLatency = Metrics::histogram("repository.detach_folder");
+    ScopedLatency latency(detachLatency);
+    // The files shown until now
+    const QString hiding = QString("%1 AND %2").arg(folderRange("FullPath", path), attachedCondition("FullPath"));
+    const QList<AstroFile> files = filesWhere(hiding);
+
+    QSqlDatabase::database().transaction();
+    QSqlQuery query;
+    bool ret = forgetFoldersIn(path);
+    if (ret && !isDetached(path))
+    {
+        query.prepare("REPLACE INTO detached_folders (Path, DetachedTime, Attached) VALUES (:path, :time, 0)");
+        query.bindValue(":path", path);
+        query.bindValue(":time", QDateTime::currentMSecsSinceEpoch());
+        ret = query.exec();
+        if (ret)
+            detachedFolders.append(path);
+    }
+    if (ret)
+        ret = query.exec(QString("INSERT INTO file_changes (fits_id, FullPath, operation) SELECT id, FullPath, %1 FROM fits WHERE %2").arg(FileDeleted).arg(hiding));
+    if (!ret)
+    {
+        qDebug() << "could not detach folder: " << query.lastError();
+        QSqlDatabase::database().rollback();
+        loadDetachedFolders();
+        return;
+    }
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+    rebuildIntegrationStats();
+
+    emit astroFilesDeleted(files);
+}
+
+/*!
+ * \brief FileRepository::attachFolder
+ * The search folder was added. The files of the folders detached in it are shown
+ * again, loaded into the catalog like the pages of loadModel, so the crawl that
+ * follows finds them known and only processes what changed on disk meanwhile.
+ *
+ * A folder added in a detached one is recorded in detached_folders as attached
+ * again: its files are shown, and the other files of the detached folder stay hidden
+ * until it is added back or purged, see hiddenCondition.
+ */
+void FileRepository::attachFolder(const QString &fullPath)
+{
+    const QString path = QDir::cleanPath(fullPath);
+    bool hasFoldersIn = false;
+    for (auto& folder : detachedFolders + reattachedFolders)
+    {
+        if (folder == path || folder.startsWith(folderPrefix(path)))
+            hasFoldersIn = true;
+    }
+    if (!hasFoldersIn && !isDetached(path))
+        return;
+
+    static LatencyHistogram& attachLatency = Metrics::histogram("repository.attach_folder");
+    ScopedLatency latency(attachLatency);
+    // The files hidden until now
+    const QString showing = QString("%1 AND NOT (%2)").arg(folderRange("FullPath", path), attachedCondition("FullPath"));
+
+    QVector<int> ids;
+    QSqlDatabase::database().transaction();
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    bool ret = forgetFoldersIn(path);
+    if (ret && isDetached(path))
+    {
+        query.prepare("REPLACE INTO detached_folders (Path, DetachedTime, Attached) VALUES (:path, :time, 1)");
+        query.bindValue(":path", path);
+        query.bindValue(":time", QDateTime::currentMSecsSinceEpoch());
+        ret = query.exec();
+        if (ret)
+            reattachedFolders.append(path);
+    }
+    if (ret)
+        ret = query.exec(QString("INSERT INTO file_changes (fits_id, FullPath, operation) SELECT id, FullPath, %1 FROM fits WHERE %2").arg(FileAdded).arg(showing));
+    if (ret)
+        ret = query.exec(QString("SELECT id FROM fits WHERE %1").arg(showing));
+    if (!ret)
+    {
+        qDebug() << "could not attach folder: " << path << query.lastError();
+        QSqlDatabase::database().rollback();
+        loadDetachedFolders();
+        return;
+    }
+    while (query.next())
+        ids.append(query.value(0).toInt());
+    query.finish();
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+    rebuildIntegrationStats();
+
+    qDebug() << "Attached" << ids.count() << "files of" << path;
+    loadModelRows(ids);
+}
+
+void FileRepository::loadDetachedFolders()
+{
+    detachedFolders.clear();
+    reattachedFolders.clear();
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT Path, Attached FROM detached_folders"))
+        qDebug() << "could not load detached folders: " << query.lastError();
+
+    while (query.next())
+        (query.value(1).toBool() ? reattachedFolders : detachedFolders).append(query.value(0).toString());
+}
+
+/*!
+ * \brief FileRepository::enclosingFolder
+ * The innermost detached or attached again folder that path is in, other than path
+ * itself. Empty if there is none.
+ */
+QString FileRepository::enclosingFolder(const QString &path) const
+{
+    QString enclosing;
+    for (auto& folder : detachedFolders + reattachedFolders)
+    {
+        if (folder != path && path.startsWith(folderPrefix(folder)) && folder.length() > enclosing.length())
+            enclosing = folder;
+    }
+    return enclosing;
+}
+
+// Hidden when the innermost detached or attached again folder the file is in is detached
+bool FileRepository::isDetached(const QString &fullPath) const
+{
+    const QString folder = detachedFolders.contains(fullPath) || reattachedFolders.contains(fullPath) ? fullPath : enclosingFolder(fullPath);
+    return !folder.isEmpty() && detachedFolders.contains(folder);
+}
+
+/*!
+ * \brief FileRepository::hiddenCondition
+ * The condition of a statement on the files whose path is in column that the detached
+ * folder hides: the files in it, but the ones in the folders attached again in it,
+ * themselves but the ones in the folders detached in those, and so on.
+ */
+QString FileRepository::hiddenCondition(const QString &column, const QString &folder) const
+{
+    QStringList shown;
+    for (auto& attached : reattachedFolders)
+    {
+        if (enclosingFolder(attached) != folder)
+            continue;
+        QStringList hidden;
+        for (auto& detached : detachedFolders)
+        {
+            if (enclosingFolder(detached) == attached)
+                hidden.append(hiddenCondition(column, detached));
+        }
+        shown.append(hidden.isEmpty() ? folderRange(column, attached) : QString("(%1 AND NOT (%2))").arg(folderRange(column, attached), hidden.join(" OR ")));
+    }
+    return shown.isEmpty() ? folderRange(column, folder) : QString("(%1 AND NOT (%2))").arg(folderRange(column, folder), shown.join(" OR "));
+}
+
+/*!
+ * \brief FileRepository::attachedCondition
+ * The condition of a statement on the files whose path is in column that are not in
+ * a detached folder, a range of the FullPath index per folder.
+ */
+QString FileRepository::attachedCondition(const QString &column) const
+{
+    QStringList ranges;
+    for (auto& folder : detachedFolders)
+    {
+        if (enclosingFolder(folder).isEmpty())
+            ranges.append(hiddenCondition(column, folder));
+    }
+    return ranges.isEmpty() ? QString("1") : QString("NOT (%1)").arg(ranges.join(" OR "));
+}
+
+/*!
+ * \brief FileRepository::purgeDetachedFolders
+ * Deletes the files of the folders detached more than DetachedFolderDays ago. The
+ * files of the folders attached again in them are kept, and shown as before.
+ */
+void FileRepository::purgeDetachedFolders()
+{
+    const int days = QSettings().value("DetachedFolderDays", DETACHED_FOLDER_DAYS).toInt();
+    if (detachedFolders.isEmpty())
+        return;
+
+    QSqlQuery query;
+    query.prepare("SELECT Path FROM detached_folders WHERE DetachedTime < :before AND Attached = 0");
+    query.bindValue(":before", QDateTime::currentDateTimeUtc().addDays(-qMax(0, days)).toMSecsSinceEpoch());
+    if (!query.exec())
+    {
+        qDebug() << "could not find the expired detached folders: " << query.lastError();
+        return;
+    }
+    QStringList expired;
+    while (query.next())
+        expired.append(query.value(0).toString());
+    query.finish();
+
+    query.prepare("DELETE FROM detached_folders WHERE Path = :path");
+    for (auto& folder : expired)
+    {
+        qDebug() << "Deleting the files of the detached folder" << folder;
+        const QString hidden = hiddenCondition("FullPath", folder);
+        const QList<AstroFile> files = filesWhere(hidden);
+        deleteRowsInFolder(folder, hidden);
+
+        // The folders attached again in it are shown without it
+        QStringList forgotten = {folder};
+        for (auto& attached : reattachedFolders)
+        {
+            if (enclosingFolder(attached) == folder)
+                forgotten.append(attached);
+        }
+        for (auto& path : forgotten)
+        {
+            query.bindValue(":path", path);
+            if (!query.exec())
+                qDebug() << "could not forget detached folder: " << query.lastError();
+            detachedFolders.removeAll(path);
+            reattachedFolders.removeAll(path);
+        }
+        emit astroFilesDeleted(files);
+    }
+    // The deletes of the hidden rows were taken off the stats of the files shown
+    if (!expired.isEmpty())
+        rebuildIntegrationStats();
+}
+
+/*!
+ * \brief FileRepository::deleteAstrofiles
+ * Deletes the given files, which were removed from disk, and emits
+ * astroFilesDeleted once with the ones that were in the db.
+ */
+void FileRepository::deleteAstrofiles(const QStringList &fullPaths)
+{
+    QList<AstroFile> deleted;
+    QSqlQuery selectQuery;
+    QSqlQuery deleteQuery;
+    selectQuery.prepare("SELECT id FROM fits WHERE FullPath = :fullPath");
+    deleteQuery.prepare("DELETE FROM fits WHERE id = :id");
+
+    QSqlDatabase::database().transaction();
+    for (auto& fullPath : fullPaths)
+    {
+        selectQuery.bindValue(":fullPath", fullPath);
+        if (!selectQuery.exec() || !selectQuery.first())
+            continue;
+
+        AstroFile astroFile;
+        astroFile.Id = selectQuery.value(0).toInt();
+        astroFile.FullPath = fullPath;
+        selectQuery.finish();
+
+        deleteQuery.bindValue(":id", astroFile.Id);
+        if (!deleteQuery.exec())
+        {
+            qDebug() << "could not delete: " << deleteQuery.lastError();
+            continue;
+        }
+        deleted.append(astroFile);
+    }
+    if (!deleted.isEmpty())
+        incrementChangeCounter();
+    QSqlDatabase::database().commit();
+
+    if (!deleted.isEmpty())
+        emit astroFilesDeleted(deleted);
+}
+
+/*!
+ * \brief FileRepository::moveAstrofile
+ * The file was moved or renamed, see FileProcessFilter::rebindMovedFile. Its row is
+ * updated in place, so its keywords, thumbnails and hashes stay with it.
+ */
+void FileRepository::moveAstrofile(const AstroFile &astroFile)
+{
+    QSqlDatabase::database().transaction();
+    QSqlQuery query;
+    query.prepare("UPDATE fits SET FileName = :FileName, FullPath = :FullPath, DirectoryPath = :DirectoryPath, "
+                  "VolumeName = :VolumeName, FileExtension = :FileExtension, FileDevice = :FileDevice, FileInode = :FileInode WHERE id = :id");
+    query.bindValue(":FileName", astroFile.FileName);
+    query.bindValue(":FullPath", astroFile.FullPath);
+    query.bindValue(":DirectoryPath", astroFile.DirectoryPath);
+    query.bindValue(":VolumeName", astroFile.VolumeName);
+    query.bindValue(":FileExtension", astroFile.FileExtension);
+    query.bindValue(":FileDevice", qint64(astroFile.FileDevice));
+    query.bindValue(":FileInode", qint64(astroFile.FileInode));
+    query.bindValue(":id", astroFile.Id);
+    if (!query.exec() || query.numRowsAffected() == 0)
+    {
+        // Deleted in the meantime. The catalog loaded next time does not have it, and
+        // the crawl then processes the file at its new path.
+        qDebug() << "could not move " << astroFile.FullPath << query.lastError();
+        QSqlDatabase::database().rollback();
+        return;
+    }
+
+    query.prepare("UPDATE fits_search SET FileName = :FileName, DirectoryPath = :DirectoryPath WHERE rowid = :id");
+    query.bindValue(":FileName", astroFile.FileName);
+    query.bindValue(":DirectoryPath", astroFile.DirectoryPath);
+    query.bindValue(":id", astroFile.Id);
+    if (!query.exec())
+        qDebug() << "could not move search row: " << query.lastError();
+
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+}
+
+/*!
+ * \brief FileRepository::aliasAstrofile
+ * A hard link of the file of sourceId, see FileProcessFilter::aliasHardLink. Its row
+ * is the row of the source at the new path, and the tag tail, search keywords and
+ * thumbnails of the source are copied as they are, so the file is not read. The
+ * thumbnails stay where they are in the packs.
+ */
+void FileRepository::aliasAstrofile(const AstroFile &alias, int sourceId)
+{
+    QSqlQuery fitsQuery;
+    QSqlQuery idQuery;
+    prepareFitsQueries(fitsQuery, idQuery);
+
+    QSqlDatabase::database().transaction();
+    const int id = insertAstrofile(fitsQuery, idQuery, alias);
+    if (id == 0)
+    {
+        QSqlDatabase::database().rollback();
+        return;
+    }
+
+    const QStringList statements = {
+        "INSERT OR REPLACE INTO tag_tails (fits_id, tags) SELECT :id, tags FROM tag_tails WHERE fits_id = :source",
+        "INSERT OR REPLACE INTO thumbnails (fits_id, thumbnail, tiny_thumbnail, format) "
+            "SELECT :id, thumbnail, tiny_thumbnail, format FROM thumbnails WHERE fits_id = :source",
+        "INSERT OR REPLACE INTO thumbnail_levels (fits_id, level, thumbnail, format, pack, pack_offset, pack_length, content_hash) "
+            "SELECT :id, level, thumbnail, format, pack, pack_offset, pack_length, content_hash FROM thumbnail_levels WHERE fits_id = :source",
+        "DELETE FROM fits_search WHERE rowid = :id",
+        "INSERT INTO fits_search (rowid, FileName, DirectoryPath, Keywords) "
+            "SELECT :id, :FileName, :DirectoryPath, Keywords FROM fits_search WHERE rowid = :source",
+    };
+    QSqlQuery query;
+    // A hard link journaled while it waited for its file, see FileProcessFilter::filesDeferred
+    query.prepare("DELETE FROM ingest_jobs WHERE FullPath = :path");
+    query.bindValue(":path", alias.FullPath);
+    if (!query.exec())
+        qDebug() << "DB: Failed to finish the job of" << alias.FullPath << query.lastError();
+    for (auto& statement : statements)
+    {
+        query.prepare(statement);
+        query.bindValue(":id", id);
+        if (statement.contains(":source"))
+            query.bindValue(":source", sourceId);
+        if (statement.contains(":FileName"))
+        {
+            query.bindValue(":FileName", alias.FileName);
+            query.bindValue(":DirectoryPath", alias.DirectoryPath);
+        }
+        if (!query.exec())
+            qDebug() << "DB: Failed to copy the row of" << sourceId << "to" << alias.FullPath << query.lastError();
+    }
+
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+
+    AstroFile inserted(alias);
+    inserted.Id = id;
+    emit astroFileAliased(inserted);
+}
+
+/*!
+ * \brief FileRepository::mergeCatalog
+ * Merges the catalog db at path, written by another indexer, into this one. Files
+ * are matched by FullPath: a file of the other db is taken when this db does not
+ * have it, or has an older LastModifiedTime, together with its tags and thumbnails.
+ * Its directory manifest is merged as well. Merging the same db again only takes
+ * what changed since, so partial catalogs can be merged every night.
+ *
+ * The other db must have the current schema, open it with the app once to migrate it.
+ */
+int FileRepository::mergeCatalog(const QString &path)
+{
+    QVector<int> mergedIds;
+    return mergeCatalog(path, QString(), QString(), mergedIds);
+}
+
+// The names of the columns of a table of an attached db
+static QStringList columnsOf(QSqlQuery& query, const QString& schema, const QString& table)
+{
+    QStringList columns;
+    if (query.exec(QString("PRAGMA %1.table_info(%2)").arg(schema, table)))
+    {
+        while (query.next())
+            columns.append(query.value(1).toString());
+    }
+    query.finish();
+    return columns;
+}
+
+/*!
+ * \brief FileRepository::mergeCatalog
+ * The paths of a volume catalog are relative to the root of its volume, see
+ * exportVolumeCatalog. They are merged under rootPath, and their files on volumeName,
+ * when rootPath is given. Only the columns both dbs have are merged, the tag columns
+ * of two catalogs are not always the same. The ids the merged files got are appended
+ * to mergedIds.
+ */
+int FileRepository::mergeCatalog(const QString &path, const QString &rootPath, const QString &volumeName, QVector<int> &mergedIds)
+{
+    QSqlQuery query;
+    query.prepare("ATTACH DATABASE :path AS part");
+    query.bindValue(":path", path);
+    if (!query.exec())
+    {
+        qDebug() << "Could not attach" << path << query.lastError();
+        return -1;
+    }
+
+    int merged = -1;
+    QSqlQuery versionQuery("PRAGMA part.user_version");
+    int partVersion = versionQuery.first() ? versionQuery.value(0).toInt() : 0;
+    versionQuery.finish();
+    if (partVersion != DB_SCHEMA_VERSION)
+    {
+        qDebug() << path << "has schema version" << partVersion << "instead of" << DB_SCHEMA_VERSION;
+    }
+    else
+    {
+        // A relative path is under the root, and an empty one is the root itself
+        const QString prefix = folderPrefix(rootPath);
+        auto mapped = [&](const QString& column) {
+            if (rootPath.isEmpty())
+                return column;
+            return QString("CASE WHEN %1 = '' THEN %2 ELSE %3 || %1 END").arg(column, sqlText(QDir::cleanPath(rootPath)), sqlText(prefix));
+        };
+
+        // Every column but the id, which is assigned again in this db
+        const QStringList partColumns = columnsOf(query, "part", "fits");
+        QStringList columns;
+        QStringList values;
+        QSqlRecord record = db.record("fits");
+        for (int i = 0; i < record.count(); i++)
+        {
+            const QString column = record.fieldName(i);
+            if (column == "id" || !partColumns.contains(column))
+                continue;
+            columns.append(column);
+            if (column == "FullPath" || column == "DirectoryPath")
+                values.append(mapped(column));
+            else if (column == "VolumeName" && !rootPath.isEmpty())
+                values.append(sqlText(volumeName));
+            else
+                values.append(column);
+        }
+
+        QStringList statements = {
+            QString("CREATE TEMP TABLE merge_rows AS SELECT p.id AS part_id, %1 AS FullPath FROM part.fits p "
+                "LEFT JOIN main.fits m ON m.FullPath = %1 "
+                "WHERE m.id IS NULL OR p.LastModifiedTime > m.LastModifiedTime").arg(mapped("p.FullPath")),
+            // Cascades to the thumbnails and tags of the replaced files
+            "DELETE FROM main.fits WHERE FullPath IN (SELECT FullPath FROM merge_rows)",
+            QString("INSERT INTO main.fits (%1) SELECT %2 FROM part.fits WHERE id IN (SELECT part_id FROM merge_rows)").arg(columns.join(", "), values.join(", ")),
+            "CREATE TEMP TABLE merge_ids AS SELECT r.part_id AS part_id, m.id AS main_id FROM merge_rows r "
+                "JOIN main.fits m ON m.FullPath = r.FullPath",
+            "INSERT INTO main.thumbnails (fits_id, thumbnail, tiny_thumbnail, format) "
+                "SELECT i.main_id, t.thumbnail, t.tiny_thumbnail, t.format FROM part.thumbnails t JOIN merge_ids i ON i.part_id = t.fits_id",
+            // The packed ones are copied to the packs of this db by mergeThumbnailPacks
+            "INSERT INTO main.thumbnail_levels (fits_id, level, thumbnail, format) "
+                "SELECT i.main_id, l.level, l.thumbnail, l.format FROM part.thumbnail_levels l JOIN merge_ids i ON i.part_id = l.fits_id "
+                "WHERE l.pack IS NULL",
+            "INSERT INTO main.tag_tails (fits_id, tags) "
+                "SELECT i.main_id, t.tags FROM part.tag_tails t JOIN merge_ids i ON i.part_id = t.fits_id",
+            // The dictionaries the tails were compressed with
+            "INSERT OR IGNORE INTO main.tag_dictionaries (dictionary_id, dictionary, sample_files, CreatedTime) "
+                "SELECT dictionary_id, dictionary, sample_files, CreatedTime FROM part.tag_dictionaries",
+            QString("INSERT INTO main.fits_search (rowid, FileName, DirectoryPath, Keywords) "
+                "SELECT i.main_id, s.FileName, %1, s.Keywords FROM part.fits_search s JOIN merge_ids i ON i.part_id = s.rowid").arg(mapped("s.DirectoryPath")),
+            QString("INSERT OR REPLACE INTO main.directories (Path, LastModifiedTime, EntryCount) "
+                "SELECT %1, LastModifiedTime, EntryCount FROM part.directories").arg(mapped("Path")),
+        };
+
+        QSqlDatabase::database().transaction();
+        bool ok = true;
+        for (auto& statement : statements)
+        {
+            if (!query.exec(statement))
+            {
+                qDebug() << "Could not merge" << path << query.lastError();
+                ok = false;
+                break;
+            }
+        }
+        if (ok)
+            ok = mergeThumbnailPacks(query, path);
+        if (ok && query.exec("SELECT main_id FROM merge_ids"))
+        {
+            while (query.next())
+                mergedIds.append(query.value(0).toInt());
+            query.finish();
+            merged = mergedIds.count();
+            if (merged > 0)
+                incrementChangeCounter();
+            QSqlDatabase::database().commit();
+            loadTagDictionaries(db);
+        }
+        else
+        {
+            QSqlDatabase::database().rollback();
+            mergedIds.clear();
+            merged = -1;
+        }
+        query.exec("DROP TABLE IF EXISTS temp.merge_rows");
+        query.exec("DROP TABLE IF EXISTS temp.merge_ids");
+    }
+
+    query.exec("DETACH DATABASE part");
+    return merged;
+}
+
+/*!
+ * \brief FileRepository::mergeThumbnailPacks
+ * Copies the packed thumbnails of the merged files from the packs of the attached db
+ * at path into the packs of this one.
+ */
+bool FileRepository::mergeThumbnailPacks(QSqlQuery &query, const QString &path)
+{
+    ThumbnailStore partStore(ThumbnailStore::pathForDatabase(path));
+
+    QSqlQuery packedQuery;
+    packedQuery.prepare("SELECT pack, pack_offset, pack_length FROM main.thumbnail_levels WHERE content_hash = :content_hash AND pack_length = :pack_length LIMIT 1");
+
+    QSqlQuery insertQuery;
+    insertQuery.prepare("INSERT INTO main.thumbnail_levels (fits_id, level, thumbnail, format, pack, pack_offset, pack_length, content_hash) "
+                        "VALUES (:fits_id, :level, :bytedata, :format, :pack, :pack_offset, :pack_length, :content_hash)");
+
+    if (!query.exec("SELECT i.main_id, l.level, l.format, l.pack, l.pack_offset, l.pack_length FROM part.thumbnail_levels l "
+                    "JOIN merge_ids i ON i.part_id = l.fits_id WHERE l.pack IS NOT NULL"))
+    {
+        qDebug() << "Could not merge the thumbnails of" << path << query.lastError();
+        return false;
+    }
+    while (query.next())
+    {
+        ThumbnailLocation partLocation;
+        partLocation.pack = query.value(3).toInt();
+        partLocation.offset = query.value(4).toLongLong();
+        partLocation.length = query.value(5).toLongLong();
+        const QByteArray data = partStore.read(partLocation);
+        // Missing from the packs of the other db, the file gets its thumbnail when it is processed again
+        if (data.isEmpty())
+            continue;
+
+        ThumbnailLocation location;
+        QByteArray contentHash;
+        const bool packed = storeThumbnailLevel(packedQuery, data, location, contentHash);
+
+        insertQuery.bindValue(":fits_id", query.value(0));
+        insertQuery.bindValue(":level", query.value(1));
+        insertQuery.bindValue(":bytedata", packed ? QVariant() : QVariant(QByteArray(data.constData(), data.size())));
+        insertQuery.bindValue(":format", query.value(2));
+        insertQuery.bindValue(":pack", packed ? QVariant(location.pack) : QVariant());
+        insertQuery.bindValue(":pack_offset", packed ? QVariant(location.offset) : QVariant());
+        insertQuery.bindValue(":pack_length", packed ? QVariant(location.length) : QVariant());
+        insertQuery.bindValue(":content_hash", packed ? QVariant(QString::fromLatin1(contentHash)) : QVariant());
+        if (!insertQuery.exec())
+        {
+            qDebug() << "Could not merge the thumbnails of" << path << insertQuery.lastError();
+            return false;
+        }
+    }
+    query.finish();
+    return thumbnailStore->flush();
+}
+
+QString FileRepository::volumeCatalogPath(const QString &rootPath)
+{
+    return folderPrefix(rootPath) + VOLUME_CATALOG_FILE;
+}
+
+/*!
+ * \brief FileRepository::exportVolumeCatalog
+ * Writes the files of the folders, all on the volume at rootPath, to the portable
+ * catalog kept at its root, with their tags, thumbnails and directory manifest. Its
+ * paths are relative to the root, so any machine that mounts the volume, wherever it
+ * mounts it, merges it instead of processing the files again, see importVolumeCatalog.
+ *
+ * Only the files logged in file_changes since the last export of this db are looked
+ * at, and all the files of the folders when the log was pruned past it. Of those, the
+ * rows the catalog has the same already are not written again, so the files merged
+ * from it do not go back to it. Several machines update the same catalog, each
+ * keeps its own place in it.
+ */
+int FileRepository::exportVolumeCatalog(const QString &rootPath, const QStringList &folders)
+{
+    static LatencyHistogram& exportLatency = Metrics::histogram("repository.export_volume_catalog");
+    const qint64 changeSeq = latestChangeSeq();
+    if (exportedChangeSeqs.value(rootPath, -1) == changeSeq)
+        return 0;
+    ScopedLatency latency(exportLatency);
+
+    const QString path = volumeCatalogPath(rootPath);
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return -1;
+
+    QSqlQuery query;
+    query.prepare("ATTACH DATABASE :path AS vol");
+    query.bindValue(":path", path);
+    if (!query.exec())
+    {
+        qDebug() << "Could not attach" << path << query.lastError();
+        return -1;
+    }
+    // Machines that share the volume over the network open it too, without the shared memory of a WAL
+    query.exec("PRAGMA vol.journal_mode = DELETE");
+
+    int exported = -1;
+    QSqlDatabase::database().transaction();
+    if (createVolumeCatalog(query, path) && writeVolumeCatalog(query, path, rootPath, folders, changeSeq)
+        && query.exec("SELECT COUNT(*) FROM temp.export_ids") && query.first())
+    {
+        exported = query.value(0).toInt();
+        query.finish();
+        QSqlDatabase::database().commit();
+        exportedChangeSeqs.insert(rootPath, changeSeq);
+    }
+    else
+    {
+        qDebug() << "Could not write the volume catalog" << path << query.lastError();
+        QSqlDatabase::database().rollback();
+    }
+    query.exec("DROP TABLE IF EXISTS temp.export_paths");
+    query.exec("DROP TABLE IF EXISTS temp.export_old");
+    query.exec("DROP TABLE IF EXISTS temp.export_ids");
+    query.exec("DETACH DATABASE vol");
+    return exported;
+}
+
+/*!
+ * \brief FileRepository::createVolumeCatalog
+ * Makes the tables of the attached volume catalog, when it is new or was written with
+ * another schema, which starts it over. The files are the columns of this db, the
+ * other tables keep what mergeCatalog reads of them.
+ */
+bool FileRepository::createVolumeCatalog(QSqlQuery &query, const QString &path)
+{
+    if (query.exec("PRAGMA vol.user_version") && query.first() && query.value(0).toInt() == DB_SCHEMA_VERSION)
+    {
+        query.finish();
+        return true;
+    }
+    query.finish();
+
+    QStringList statements;
+    for (auto& table : {"fits", "thumbnails", "thumbnail_levels", "tag_tails", "tag_dictionaries", "fits_search", "directories", "volume_catalog_state"})
+        statements.append(QString("DROP TABLE IF EXISTS vol.%1").arg(QLatin1String(table)));
+    QDir(ThumbnailStore::pathForDatabase(path)).removeRecursively();
+
+    QStringList columns = {"id INTEGER PRIMARY KEY"};
+    if (!query.exec("PRAGMA main.table_info(fits)"))
+        return false;
+    while (query.next())
+    {
+        if (query.value(1).toString() != "id")
+            columns.append(query.value(1).toString() + ' ' + query.value(2).toString());
+    }
+    query.finish();
+
+    statements += {
+        QString("CREATE TABLE vol.fits (%1)").arg(columns.join(", ")),
+        "CREATE UNIQUE INDEX vol.idx_fits_fullpath ON fits(FullPath)",
+        "CREATE TABLE vol.thumbnails AS SELECT * FROM main.thumbnails WHERE 0",
+        "CREATE INDEX vol.idx_thumbnails_fits_id ON thumbnails(fits_id)",
+        "CREATE TABLE vol.thumbnail_levels AS SELECT * FROM main.thumbnail_levels WHERE 0",
+        "CREATE INDEX vol.idx_thumbnail_levels_fits_id ON thumbnail_levels(fits_id)",
+        "CREATE TABLE vol.tag_tails AS SELECT * FROM main.tag_tails WHERE 0",
+        "CREATE INDEX vol.idx_tag_tails_fits_id ON tag_tails(fits_id)",
+        "CREATE TABLE vol.tag_dictionaries AS SELECT * FROM main.tag_dictionaries WHERE 0",
+        // Not a full text index, it is only copied into the index of the db that merges it
+        "CREATE TABLE vol.fits_search (fits_id INTEGER PRIMARY KEY, FileName TEXT, DirectoryPath TEXT, Keywords TEXT)",
+        "CREATE TABLE vol.directories (Path TEXT PRIMARY KEY, LastModifiedTime INTEGER, EntryCount INTEGER)",
+        // The last change of each db that writes the catalog, by its catalog id
+        "CREATE TABLE vol.volume_catalog_state (catalog_id INTEGER PRIMARY KEY, change_seq INTEGER)",
+        QString("PRAGMA vol.user_version = %1").arg(DB_SCHEMA_VERSION),
+    };
+    for (auto& statement : statements)
+    {
+        if (!query.exec(statement))
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief FileRepository::writeVolumeCatalog
+ * Replaces the rows of the changed files of the folders in the attached volume
+ * catalog. The files deleted from this db are deleted from it. The ids the files got
+ * in it are left in temp.export_ids.
+ */
+bool FileRepository::writeVolumeCatalog(QSqlQuery &query, const QString &path, const QString &rootPath, const QStringList &folders, qint64 changeSeq)
+{
+    const QString prefix = folderPrefix(rootPath);
+    const QString relativeStart = QString::number(prefix.length() + 1);
+    auto relative = [&](const QString& column) {
+        return QString("substr(%1, %2)").arg(column, relativeStart);
+    };
+    auto relativeDirectory = [&](const QString& column) {
+        return QString("CASE WHEN %1 = %2 THEN '' ELSE substr(%1, %3) END").arg(column, sqlText(QDir::cleanPath(rootPath)), relativeStart);
+    };
+
+    qint64 exportedSeq = -1;
+    query.prepare("SELECT change_seq FROM vol.volume_catalog_state WHERE catalog_id = :catalog_id");
+    query.bindValue(":catalog_id", catalogId());
+    if (query.exec() && query.first())
+        exportedSeq = query.value(0).toLongLong();
+    query.finish();
+    qint64 firstSeq = 0;
+    if (query.exec("SELECT MIN(seq) FROM main.file_changes") && query.first())
+        firstSeq = query.value(0).toLongLong();
+    query.finish();
+    const bool isLogged = exportedSeq >= 0 && firstSeq <= exportedSeq + 1;
+
+    if (!query.exec("CREATE TEMP TABLE export_paths (FullPath TEXT PRIMARY KEY)"))
+        return false;
+    for (auto& folder : folders)
+    {
+        const QString folderStart = folderPrefix(folder);
+        const QString folderEnd = folderPrefixEnd(folderStart);
+        const QString inFolder = QString("FullPath >= %1 AND FullPath < %2").arg(sqlText(folderStart), sqlText(folderEnd));
+        QStringList statements;
+        if (isLogged)
+        {
+            statements.append(QString("INSERT OR IGNORE INTO temp.export_paths SELECT FullPath FROM main.file_changes WHERE seq > %1 AND %2")
+                              .arg(exportedSeq).arg(inFolder));
+        }
+        else
+        {
+            // Every file the db or the catalog has, those the catalog has and the db does not are deleted
+            statements.append(QString("INSERT OR IGNORE INTO temp.export_paths SELECT FullPath FROM main.fits WHERE %1").arg(inFolder));
+            statements.append(QString("INSERT OR IGNORE INTO temp.export_paths SELECT %1 || FullPath FROM vol.fits").arg(sqlText(prefix))
+                              + (folderStart == prefix ? QString() : QString(" WHERE FullPath >= %1 AND FullPath < %2")
+                                 .arg(sqlText(folderStart.mid(prefix.length())), sqlText(folderEnd.mid(prefix.length())))));
+        }
+        for (auto& statement : statements)
+        {
+            if (!query.exec(statement))
+                return false;
+        }
+    }
+
+    // The columns both have, the tag columns are those of whichever db made the catalog
+    const QStringList volumeColumns = columnsOf(query, "vol", "fits");
+    QStringList columns;
+    QStringList values;
+    QStringList unchanged;
+    QSqlRecord record = db.record("fits");
+    for (int i = 0; i < record.count(); i++)
+    {
+        const QString column = record.fieldName(i);
+        if (column == "id" || !volumeColumns.contains(column))
+            continue;
+        columns.append(column);
+        if (column == "FullPath")
+            values.append(relative(column));
+        else if (column == "DirectoryPath")
+            values.append(relativeDirectory(column));
+        // The identity of a file is of the machine that read it, see FileRecord::Inode
+        else if (column == "FileDevice" || column == "FileInode")
+            values.append("0");
+        else
+            values.append(column);
+        if (column != "FullPath" && column != "DirectoryPath" && column != "VolumeName" && column != "FileDevice" && column != "FileInode")
+            unchanged.append(QString("v.%1 IS m.%1").arg(column));
+    }
+
+    const QString relativeId = QString("v.FullPath = %1").arg(relative("e.FullPath"));
+    QStringList statements = {
+        // The rows the catalog has the same already, like the ones merged from it
+        QString("DELETE FROM temp.export_paths WHERE FullPath IN (SELECT e.FullPath FROM temp.export_paths e "
+            "JOIN main.fits m ON m.FullPath = e.FullPath JOIN vol.fits v ON %1 WHERE %2)").arg(relativeId, unchanged.join(" AND ")),
+        QString("CREATE TEMP TABLE export_old AS SELECT v.id AS id FROM temp.export_paths e JOIN vol.fits v ON %1").arg(relativeId),
+        "DELETE FROM vol.thumbnails WHERE fits_id IN (SELECT id FROM temp.export_old)",
+        "DELETE FROM vol.thumbnail_levels WHERE fits_id IN (SELECT id FROM temp.export_old)",
+        "DELETE FROM vol.tag_tails WHERE fits_id IN (SELECT id FROM temp.export_old)",
+        "DELETE FROM vol.fits_search WHERE fits_id IN (SELECT id FROM temp.export_old)",
+        "DELETE FROM vol.fits WHERE id IN (SELECT id FROM temp.export_old)",
+        QString("INSERT INTO vol.fits (%1) SELECT %2 FROM main.fits WHERE FullPath IN (SELECT FullPath FROM temp.export_paths)")
+            .arg(columns.join(", "), values.join(", ")),
+        QString("CREATE TEMP TABLE export_ids AS SELECT m.id AS main_id, v.id AS vol_id FROM temp.export_paths e "
+            "JOIN main.fits m ON m.FullPath = e.FullPath JOIN vol.fits v ON %1").arg(relativeId),
+        "INSERT INTO vol.thumbnails (fits_id, thumbnail, tiny_thumbnail, format) "
+            "SELECT i.vol_id, t.thumbnail, t.tiny_thumbnail, t.format FROM main.thumbnails t JOIN temp.export_ids i ON i.main_id = t.fits_id",
+        // The packed ones are copied to the packs of the catalog by exportThumbnailPacks
+        "INSERT INTO vol.thumbnail_levels (fits_id, level, thumbnail, format) "
+            "SELECT i.vol_id, l.level, l.thumbnail, l.format FROM main.thumbnail_levels l JOIN temp.export_ids i ON i.main_id = l.fits_id "
+            "WHERE l.pack IS NULL",
+        "INSERT INTO vol.tag_tails (fits_id, tags) "
+            "SELECT i.vol_id, t.tags FROM main.tag_tails t JOIN temp.export_ids i ON i.main_id = t.fits_id",
+        "INSERT INTO vol.tag_dictionaries SELECT * FROM main.tag_dictionaries "
+            "WHERE dictionary_id NOT IN (SELECT dictionary_id FROM vol.tag_dictionaries)",
+        QString("INSERT INTO vol.fits_search (fits_id, FileName, DirectoryPath, Keywords) "
+            "SELECT i.vol_id, s.FileName, %1, s.Keywords FROM main.fits_search s JOIN temp.export_ids i ON i.main_id = s.rowid")
+            .arg(relativeDirectory("s.DirectoryPath")),
+    };
+    for (auto& folder : folders)
+    {
+        // The manifest of the folder, so the crawls of the other machines skip its unchanged directories
+        const QString folderPath = QDir::cleanPath(folder);
+        const QString folderStart = folderPrefix(folder);
+        const QString folderEnd = folderPrefixEnd(folderStart);
+        const QString inFolder = QString("(Path = %1 OR (Path >= %2 AND Path < %3))")
+            .arg(sqlText(folderPath), sqlText(folderStart), sqlText(folderEnd));
+        const QString inVolumeFolder = folderStart == prefix ? QString("1") : QString("(Path = %1 OR (Path >= %2 AND Path < %3))")
+            .arg(sqlText(folderPath.mid(prefix.length())), sqlText(folderStart.mid(prefix.length())), sqlText(folderEnd.mid(prefix.length())));
+        statements.append(QString("DELETE FROM vol.directories WHERE %1").arg(inVolumeFolder));
+        statements.append(QString("INSERT OR REPLACE INTO vol.directories (Path, LastModifiedTime, EntryCount) "
+            "SELECT %1, LastModifiedTime, EntryCount FROM main.directories WHERE %2").arg(relativeDirectory("Path"), inFolder));
+    }
+    statements.append(QString("INSERT OR REPLACE INTO vol.volume_catalog_state (catalog_id, change_seq) VALUES (%1, %2)")
+                      .arg(catalogId()).arg(changeSeq));
+
+    for (auto& statement : statements)
+    {
+        if (!query.exec(statement))
+            return false;
+    }
+    return exportThumbnailPacks(query, path);
+}
+
+/*!
+ * \brief FileRepository::exportThumbnailPacks
+ * Copies the packed thumbnails of the exported files from the packs of this db into
+ * the packs of the attached volume catalog at path, the reverse of mergeThumbnailPacks.
+ */
+bool FileRepository::exportThumbnailPacks(QSqlQuery &query, const QString &path)
+{
+    ThumbnailStore volumeStore(ThumbnailStore::pathForDatabase(path));
+
+    QSqlQuery insertQuery;
+    insertQuery.prepare("INSERT INTO vol.thumbnail_levels (fits_id, level, format, pack, pack_offset, pack_length, content_hash) "
+                        "VALUES (:fits_id, :level, :format, :pack, :pack_offset, :pack_length, :content_hash)");
+
+    if (!query.exec("SELECT i.vol_id, l.level, l.format, l.pack, l.pack_offset, l.pack_length, l.content_hash FROM main.thumbnail_levels l "
+                    "JOIN temp.export_ids i ON i.main_id = l.fits_id WHERE l.pack IS NOT NULL"))
+        return false;
+    while (query.next())
+    {
+        ThumbnailLocation location;
+        location.pack = query.value(3).toInt();
+        location.offset = query.value(4).toLongLong();
+        location.length = query.value(5).toLongLong();
+        const QByteArray data = thumbnailStore->read(location);
+        ThumbnailLocation volumeLocation;
+        if (data.isEmpty() || !volumeStore.append(data, volumeLocation))
+            continue;
+
+        insertQuery.bindValue(":fits_id", query.value(0));
+        insertQuery.bindValue(":level", query.value(1));
+        insertQuery.bindValue(":format", query.value(2));
+        insertQuery.bindValue(":pack", volumeLocation.pack);
+        insertQuery.bindValue(":pack_offset", volumeLocation.offset);
+        insertQuery.bindValue(":pack_length", volumeLocation.length);
+        insertQuery.bindValue(":content_hash", query.value(6));
+        if (!insertQuery.exec())
+            return false;
+    }
+    query.finish();
+    return volumeStore.flush();
+}
+
+// The file columns of the fits table then the tag columns. RaDegrees and DecDegrees are
+// the last columns before the tags, and the only REAL ones.
+static QStringList exportColumns()
+{
+    QStringList columns = {"id", "FullPath", "DirectoryPath", "FileName", "FileExtension", "VolumeName", "LastModifiedTime", "FileHash", "RaDegrees", "DecDegrees"};
+    for (auto& column : tagColumns)
+        columns.append(column.column);
+    return columns;
+}
+
+// The SQLite type of the exported column i
+static const char* exportColumnType(int i)
+{
+    const int firstTagColumn = exportColumns().count() - int(std::size(tagColumns));
+    if (i == 0)
+        return "INTEGER";
+    if (i >= firstTagColumn)
+        return tagColumns[i - firstTagColumn].type;
+    return i >= firstTagColumn - 2 ? "REAL" : "TEXT";
+}
+
+// Quoted when it has a separator, a quote or a line break, as in RFC 4180
+static void appendCsvText(QByteArray& buffer, const QString& text)
+{
+    QByteArray utf8 = text.toUtf8();
+    if (!utf8.contains(',') && !utf8.contains('"') && !utf8.contains('\n') && !utf8.contains('\r'))
+    {
+        buffer.append(utf8);
+        return;
+    }
+    utf8.replace("\"", "\"\"");
+    buffer.append('"').append(utf8).append('"');
+}
+
+/*!
+ * \brief FileRepository::exportCatalog
+ * Writes the files of the catalog to path as CSV with a header row: the file columns
+ * of the fits table followed by the tag columns, in one forward-only pass. Numeric tag
+ * columns only have numbers, a value that SQLite kept as text is left empty, so
+ * pandas and DuckDB read them with their type.
+ * A path ending in .arrows is written as an Arrow IPC stream instead, see exportArrowStream.
+ * Returns the number of files written, -1 if the file could not be written.
+ */
+int FileRepository::exportCatalog(const QString &path)
+{
+    if (path.endsWith(EXPORT_ARROW_SUFFIX, Qt::CaseInsensitive))
+        return exportArrowStream(path);
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "Could not write" << path << file.errorString();
+        return -1;
+    }
+
+    const QStringList columns = exportColumns();
+
+    // Without the model loaded, by the command line indexer
+    loadDetachedFolders();
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    if (!query.exec(QString("SELECT %1 FROM fits WHERE %2 ORDER BY id").arg(columns.join(", "), attachedCondition("FullPath"))))
+    {
+        qDebug() << "Could not read the catalog:" << query.lastError();
+        return -1;
+    }
+
+    QByteArray buffer = columns.join(',').toUtf8();
+    buffer.append('\n');
+    int exported = 0;
+    while (query.next())
+    {
+        if (cancellationToken.isCanceled())
+            return -1;
+
+        for (int i = 0; i < columns.count(); i++)
+        {
+            if (i > 0)
+                buffer.append(',');
+            const QVariant value = query.value(i);
+            if (value.isNull())
+                continue;
+
+            const char* type = exportColumnType(i);
+            bool ok = false;
+            if (qstrcmp(type, "INTEGER") == 0)
+            {
+                qlonglong number = value.toLongLong(&ok);
+                if (ok)
+                    buffer.append(QByteArray::number(number));
+            }
+            else if (qstrcmp(type, "REAL") == 0)
+            {
+                double number = value.toDouble(&ok);
+                if (ok)
+                    buffer.append(QByteArray::number(number, 'g', QLocale::FloatingPointShortest));
+            }
+            else
+            {
+                appendCsvText(buffer, value.toString());
+            }
+        }
+        buffer.append('\n');
+        exported++;
+
+        if (buffer.size() >= EXPORT_BUFFER_SIZE)
+        {
+            if (file.write(buffer) != buffer.size())
+                return -1;
+            buffer.clear();
+        }
+    }
+
+    if (file.write(buffer) != buffer.size())
+        return -1;
+    return exported;
+}
+
+/*!
+ * \brief FileRepository::exportArrowStream
+ * Writes the files of the catalog to path as an Arrow IPC stream, the columns of the CSV
+ * export with their type: integers and reals as int64 and float64, LastModifiedTime as a
+ * UTC timestamp, and the text columns that repeat across files (directories, objects,
+ * filters...) dictionary-encoded, their distinct values read first. pyarrow, polars and
+ * DuckDB read it without parsing the values.
+ * Returns the number of files written, -1 if the file could not be written.
+ */
+int FileRepository::exportArrowStream(const QString &path)
+{
+    static const QSet<QString> dictionaryColumns = {"DirectoryPath", "FileExtension", "VolumeName", "Object", "Instrument", "Filter", "BayerPattern"};
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "Could not write" << path << file.errorString();
+        return -1;
+    }
+
+    const QStringList columnNames = exportColumns();
+    loadDetachedFolders();
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    QList<ArrowColumn> columns;
+    for (int i = 0; i < columnNames.count(); i++)
+    {
+        const QString& name = columnNames.at(i);
+        const char* type = exportColumnType(i);
+        ArrowColumn column = {name, ArrowUtf8, {}};
+        if (name == "LastModifiedTime")
+            column.type = ArrowTimestampMillis;
+        else if (qstrcmp(type, "INTEGER") == 0)
+            column.type = ArrowInt64;
+        else if (qstrcmp(type, "REAL") == 0)
+            column.type = ArrowFloat64;
+        else if (dictionaryColumns.contains(name))
+        {
+            column.type = ArrowDictionaryUtf8;
+            if (!query.exec(QString("SELECT DISTINCT %1 FROM fits WHERE %1 IS NOT NULL AND %2").arg(name, attachedCondition("FullPath"))))
+            {
+                qDebug() << "Could not read the catalog:" << query.lastError();
+                return -1;
+            }
+            while (query.next())
+                column.dictionary.append(query.value(0).toString());
+            query.finish();
+        }
+        columns.append(column);
+    }
+
+    if (!query.exec(QString("SELECT %1 FROM fits WHERE %2 ORDER BY id").arg(columnNames.join(", "), attachedCondition("FullPath"))))
+    {
+        qDebug() << "Could not read the catalog:" << query.lastError();
+        return -1;
+    }
+
+    ArrowStreamWriter writer(&file, columns);
+    if (!writer.begin())
+        return -1;
+    int exported = 0;
+    while (query.next())
+    {
+        if (cancellationToken.isCanceled())
+            return -1;
+
+        for (int i = 0; i < columns.count(); i++)
+        {
+            const QVariant value = query.value(i);
+            bool ok = !value.isNull();
+            switch (columns.at(i).type)
+            {
+            case ArrowInt64:
+            {
+                const qlonglong number = value.toLongLong(&ok);
+                if (ok)
+                    writer.appendInt(i, number);
+                break;
+            }
+            case ArrowFloat64:
+            {
+                const double number = value.toDouble(&ok);
+                if (ok)
+                    writer.appendDouble(i, number);
+                break;
+            }
+            case ArrowTimestampMillis:
+            {
+                const QDateTime time = value.toDateTime();
+                ok = ok && time.isValid();
+                if (ok)
+                    writer.appendTimestamp(i, time.toMSecsSinceEpoch());
+                break;
+            }
+            case ArrowUtf8:
+            case ArrowDictionaryUtf8:
+                if (ok)
+                    writer.appendText(i, value.toString());
+                break;
+            }
+            if (!ok)
+                writer.appendNull(i);
+        }
+        if (!writer.endRow())
+            return -1;
+        exported++;
+    }
+
+    if (!writer.finish())
+        return -1;
+    return exported;
+}
+
+void FileRepository::deleteDirectoriesInFolder(QSqlQuery& query, const QString& fullPath)
+{
+    const QString prefix = folderPrefix(fullPath);
+    query.prepare("DELETE FROM directories WHERE Path = :path OR (Path >= :prefix AND Path < :prefixEnd)");
+    query.bindValue(":path", QDir::cleanPath(fullPath));
+    query.bindValue(":prefix", prefix);
+    query.bindValue(":prefixEnd", folderPrefixEnd(prefix));
+    if (!query.exec())
+        qDebug() << "could not delete directories: " << query.lastError();
+}
+
+/*!
+ * \brief FileRepository::updateDirectoryManifest
+ * Records the directories listed by a crawl, and forgets the ones that are gone.
+ * Only call this once the files found in those directories are in the db or in the
+ * ingest journal, otherwise an interrupted ingest would be skipped by the next crawl.
+ */
+void FileRepository::updateDirectoryManifest(const QList<DirectoryState> &updated, const QStringList &removed)
+{
+    QSqlDatabase::database().transaction();
+
+    QSqlQuery query;
+    for (auto& path : removed)
+        deleteDirectoriesInFolder(query, path);
+
+    query.prepare("REPLACE INTO directories (Path, LastModifiedTime, EntryCount) VALUES (:path, :lastModifiedTime, :entryCount)");
+    for (auto& directory : updated)
+    {
+        query.bindValue(":path", directory.Path);
+        query.bindValue(":lastModifiedTime", directory.LastModifiedTime);
+        query.bindValue(":entryCount", directory.EntryCount);
+        if (!query.exec())
+            qDebug() << "could not update directory: " << query.lastError();
+    }
+
+    QSqlDatabase::database().commit();
+}
+
+/*!
+ * \brief FileRepository::journalIngestJobs
+ * Records the files accepted for processing, before the directory manifest of their
+ * crawl, so an ingest that is interrupted, by a crash or by closing the app, resumes
+ * with them instead of crawling again. addOrUpdateAstrofiles removes a job in the
+ * transaction that writes its file, finishIngestJobs the jobs dropped on the way.
+ */
+void FileRepository::journalIngestJobs(const QVector<FileRecord> &files)
+{
+    if (files.isEmpty())
+        return;
+
+    static std::atomic<qint64>& journaledCount = Metrics::counter("repository.jobs_journaled");
+    QSqlDatabase::database().transaction();
+
+    QSqlQuery query;
+    query.prepare("REPLACE INTO ingest_jobs (FullPath, Size, LastModifiedTime) VALUES (:path, :size, :lastModifiedTime)");
+    for (auto& record : files)
+    {
+        query.bindValue(":path", record.FullPath);
+        query.bindValue(":size", record.Size);
+        query.bindValue(":lastModifiedTime", record.LastModifiedTime);
+        if (!query.exec())
+            qDebug() << "DB: Failed to journal" << record.FullPath << query.lastError();
+    }
+
+    QSqlDatabase::database().commit();
+    journaledCount += files.count();
+}
+
+void FileRepository::finishIngestJobs(const QStringList &fullPaths)
+{
+    if (fullPaths.isEmpty())
+        return;
+
+    QSqlDatabase::database().transaction();
+
+    QSqlQuery query;
+    query.prepare("DELETE FROM ingest_jobs WHERE FullPath = :path");
+    for (auto& path : fullPaths)
+    {
+        query.bindValue(":path", path);
+        if (!query.exec())
+            qDebug() << "DB: Failed to finish the job of" << path << query.lastError();
+    }
+
+    QSqlDatabase::database().commit();
+}
+
+/*!
+ * \brief FileRepository::loadIngestJobs
+ * The jobs left in the journal by the last session, as listed then. The directory of
+ * each is resolved once, like the crawler does for the files of a listing.
+ */
+void FileRepository::loadIngestJobs()
+{
+    QVector<FileRecord> files;
+    QHash<QString, QString> canonicalDirectories;
+
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT FullPath, Size, LastModifiedTime FROM ingest_jobs"))
+        qDebug() << "could not load the ingest journal: " << query.lastError();
+
+    while (query.next())
+    {
+        FileRecord record;
+        record.FullPath = query.value(0).toString();
+        record.Size = query.value(1).toLongLong();
+        record.LastModifiedTime = query.value(2).toLongLong();
+        const QString directory = record.absolutePath();
+        auto it = canonicalDirectories.constFind(directory);
+        if (it == canonicalDirectories.constEnd())
+            it = canonicalDirectories.insert(directory, QDir(directory).canonicalPath());
+        record.CanonicalDirectory = it.value();
+        files.append(record);
+    }
+
+    if (!files.isEmpty())
+        emit ingestJobsLoaded(files);
+}
+
+/*!
+ * \brief FileRepository::addIngestRun
+ * Records the report of an ingest, and drops the oldest ones past INGEST_RUNS_KEPT.
+ * The readers of a shared catalog do not ingest, they read the runs of the indexer.
+ */
+void FileRepository::addIngestRun(const QJsonObject &report)
+{
+    if (accessMode() == SharedReaderAccess)
+        return;
+
+    QSqlQuery query;
+    query.prepare("INSERT INTO ingest_runs (StartedAt, DurationMsecs, Files, Bytes, Failures, PeakResidentBytes, Threads, Report) "
+                  "VALUES (:startedAt, :duration, :files, :bytes, :failures, :peakResident, :threads, :report)");
+    query.bindValue(":startedAt", report.value("started_at").toString());
+    query.bindValue(":duration", report.value("duration_ms").toInteger());
+    query.bindValue(":files", report.value("files").toInteger());
+    query.bindValue(":bytes", report.value("bytes").toInteger());
+    query.bindValue(":failures", report.value("failed_files").toInteger());
+    query.bindValue(":peakResident", report.value("peak_resident_bytes").toInteger());
+    query.bindValue(":threads", report.value("threads").toInteger());
+    query.bindValue(":report", QString::fromUtf8(QJsonDocument(report).toJson(QJsonDocument::Compact)));
+    if (!query.exec())
+    {
+        qDebug() << "DB: Failed to record the ingest run" << query.lastError();
+        return;
+    }
+
+    QSqlQuery pruneQuery;
+    if (!pruneQuery.exec(QString("DELETE FROM ingest_runs WHERE id <= (SELECT MAX(id) FROM ingest_runs) - %1").arg(INGEST_RUNS_KEPT)))
+        qDebug() << "DB: Failed to drop the old ingest runs" << pruneQuery.lastError();
+}
+
+void FileRepository::saveSmartCollection(const QString &name, const QString &expression)
+{
+    if (accessMode() == SharedReaderAccess)
+        return;
+
+    QSqlQuery query;
+    query.prepare("INSERT INTO smart_collections (Name, Expression) VALUES (:name, :expression) "
+                  "ON CONFLICT(Name) DO UPDATE SET Expression = excluded.Expression");
+    query.bindValue(":name", name);
+    query.bindValue(":expression", expression);
+    if (!query.exec())
+        qDebug() << "DB: Failed to save the smart collection" << name << query.lastError();
+}
+
+void FileRepository::deleteSmartCollection(const QString &name)
+{
+    if (accessMode() == SharedReaderAccess)
+        return;
+
+    QSqlQuery query;
+    query.prepare("DELETE FROM smart_collections WHERE Name = :name");
+    query.bindValue(":name", name);
+    if (!query.exec())
+        qDebug() << "DB: Failed to delete the smart collection" << name << query.lastError();
+}
+
+/*!
+ * \brief FileRepository::smartCollections
+ * The name and the expression of every saved collection, in the order of their names.
+ */
+QList<QPair<QString, QString>> FileRepository::smartCollections()
+{
+    QList<QPair<QString, QString>> collections;
+    QSqlQuery query(readerConnection());
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT Name, Expression FROM smart_collections ORDER BY Name"))
+    {
+        qDebug() << "could not load the smart collections: " << query.lastError();
+        return collections;
+    }
+    while (query.next())
+        collections.append(qMakePair(query.value(0).toString(), query.value(1).toString()));
+    return collections;
+}
+
+/*!
+ * \brief FileRepository::filePaths
+ * The paths of every file in the db, without loading the rows.
+ */
+QStringList FileRepository::filePaths()
+{
+    QStringList paths;
+    QSqlQuery query(readerConnection());
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT FullPath FROM fits"))
+    {
+        qDebug() << "could not read the file paths: " << query.lastError();
+        return paths;
+    }
+    while (query.next())
+        paths.append(query.value(0).toString());
+    return paths;
+}
+
+/*!
+ * \brief FileRepository::ingestRuns
+ * The reports of the last limit ingests, the newest first.
+ */
+QList<QJsonObject> FileRepository::ingestRuns(int limit)
+{
+    QList<QJsonObject> runs;
+    QSqlQuery query(readerConnection());
+    query.setForwardOnly(true);
+    query.prepare("SELECT Report FROM ingest_runs ORDER BY id DESC LIMIT :limit");
+    query.bindValue(":limit", limit);
+    if (!query.exec())
+    {
+        qDebug() << "could not load the ingest runs: " << query.lastError();
+        return runs;
+    }
+    while (query.next())
+        runs.append(QJsonDocument::fromJson(query.value(0).toString().toUtf8()).object());
+    return runs;
+}
+
+/*!
+ * \brief FileRepository::changesSince
+ * Reads the change log from seq on, for the consumers that keep a copy of the catalog.
+ * Ask again from LastSeq until no changes are left. The log keeps FILE_CHANGES_KEPT
+ * changes, so a consumer further behind than that gets IsComplete false.
+ */
+FileChanges FileRepository::changesSince(qint64 seq, int limit)
+{
+    FileChanges changes;
+    changes.LastSeq = seq;
+    QSqlQuery firstQuery(readerConnection());
+    if (!firstQuery.exec("SELECT MIN(seq), MAX(seq) FROM file_changes") || !firstQuery.first())
+    {
+        qDebug() << "could not read the change log: " << firstQuery.lastError();
+        return changes;
+    }
+    if (firstQuery.value(1).toLongLong() <= seq)
+        return changes;
+    changes.IsComplete = firstQuery.value(0).toLongLong() <= seq + 1;
+
+    QSqlQuery query(readerConnection());
+    query.setForwardOnly(true);
+    query.prepare("SELECT seq, fits_id, FullPath, operation FROM file_changes WHERE seq > :seq ORDER BY seq LIMIT :limit");
+    query.bindValue(":seq", seq);
+    query.bindValue(":limit", limit);
+    if (!query.exec())
+    {
+        qDebug() << "could not read the change log: " << query.lastError();
+        return changes;
+    }
+    while (query.next())
+    {
+        FileChange change;
+        change.Seq = query.value(0).toLongLong();
+        change.FitsId = query.value(1).toInt();
+        change.FullPath = query.value(2).toString();
+        change.Operation = FileChangeOperation(query.value(3).toInt());
+        changes.Changes.append(change);
+        changes.LastSeq = change.Seq;
+    }
+    return changes;
+}
+
+void FileRepository::loadVolumes()
+{
+    QList<VolumeRecord> volumes;
+
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT Uuid, RootPath, Label FROM volumes"))
+        qDebug() << "could not load volumes: " << query.lastError();
+
+    while (query.next())
+        volumes.append({query.value(0).toString(), query.value(1).toString(), query.value(2).toString()});
+
+    emit volumesLoaded(volumes);
+}
+
+/*!
+ * \brief FileRepository::recordVolume
+ * Records where the volume is mounted. Another volume recorded at the same root
+ * path was replaced by this one, and is forgotten.
+ */
+void FileRepository::recordVolume(const VolumeRecord &volume)
+{
+    QSqlDatabase::database().transaction();
+    QSqlQuery query;
+    query.prepare("DELETE FROM volumes WHERE RootPath = :rootPath AND Uuid != :uuid");
+    query.bindValue(":rootPath", volume.RootPath);
+    query.bindValue(":uuid", volume.Uuid);
+    if (!query.exec())
+        qDebug() << "could not forget volume: " << query.lastError();
+
+    query.prepare("REPLACE INTO volumes (Uuid, RootPath, Label) VALUES (:uuid, :rootPath, :label)");
+    query.bindValue(":uuid", volume.Uuid);
+    query.bindValue(":rootPath", volume.RootPath);
+    query.bindValue(":label", volume.Label);
+    if (!query.exec())
+        qDebug() << "could not record volume: " << query.lastError();
+    QSqlDatabase::database().commit();
+}
+
+/*!
+ * \brief FileRepository::remapVolume
+ * The volume was mounted at oldRootPath, and is now at the RootPath of the record.
+ * Its files and directories keep their rows, thumbnails and hashes, only the prefix
+ * of their paths changes. Files already in the db at their new path, ingested there
+ * before the volume was known, keep that row and the old one is deleted.
+ *
+ * The volume record is written last, so a remap that did not finish is done again
+ * the next time the volume is found.
+ */
+void FileRepository::remapVolume(const VolumeRecord &volume, const QString &oldRootPath)
+{
+    static LatencyHistogram& remapLatency = Metrics::histogram("repository.remap_volume");
+    ScopedLatency latency(remapLatency);
+
+    const QString oldRoot = QDir::cleanPath(oldRootPath);
+    const QString newRoot = QDir::cleanPath(volume.RootPath);
+    const QString oldPrefix = folderPrefix(oldRoot);
+    const QString newPrefix = folderPrefix(newRoot);
+    // substr counts characters, QString::length UTF-16 code units
+    const int prefixLength = oldPrefix.toUcs4().size();
+
+    QStringList duplicates;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare("SELECT old.FullPath FROM fits old JOIN fits new ON new.FullPath = :newPrefix || substr(old.FullPath, :from) "
+                  "WHERE old.FullPath >= :prefix AND old.FullPath < :prefixEnd");
+    query.bindValue(":newPrefix", newPrefix);
+    query.bindValue(":from", prefixLength + 1);
+    query.bindValue(":prefix", oldPrefix);
+    query.bindValue(":prefixEnd", folderPrefixEnd(oldPrefix));
+    if (query.exec())
+    {
+        while (query.next())
+            duplicates.append(query.value(0).toString());
+    }
+    query.finish();
+    if (!duplicates.isEmpty())
+        deleteAstrofiles(duplicates);
+
+    QSqlDatabase::database().transaction();
+    query.prepare("UPDATE fits SET FullPath = :newPrefix || substr(FullPath, :from), "
+                  "DirectoryPath = CASE WHEN DirectoryPath = :oldRoot THEN :newRoot "
+                  "WHEN substr(DirectoryPath, 1, :length) = :directoryPrefix THEN :newDirectoryPrefix || substr(DirectoryPath, :directoryFrom) "
+                  "ELSE DirectoryPath END "
+                  "WHERE FullPath >= :prefix AND FullPath < :prefixEnd");
+    query.bindValue(":newPrefix", newPrefix);
+    query.bindValue(":from", prefixLength + 1);
+    query.bindValue(":oldRoot", oldRoot);
+    query.bindValue(":newRoot", newRoot);
+    query.bindValue(":length", prefixLength);
+    query.bindValue(":directoryPrefix", oldPrefix);
+    query.bindValue(":newDirectoryPrefix", newPrefix);
+    query.bindValue(":directoryFrom", prefixLength + 1);
+    query.bindValue(":prefix", oldPrefix);
+    query.bindValue(":prefixEnd", folderPrefixEnd(oldPrefix));
+    if (!query.exec())
+    {
+        qDebug() << "could not remap files: " << query.lastError();
+        QSqlDatabase::database().rollback();
+        return;
+    }
+    const int remapped = query.numRowsAffected();
+
+    query.prepare("UPDATE fits_search SET DirectoryPath = (SELECT DirectoryPath FROM fits WHERE fits.id = fits_search.rowid) "
+                  "WHERE rowid IN (SELECT id FROM fits WHERE FullPath >= :prefix AND FullPath < :prefixEnd)");
+    query.bindValue(":prefix", newPrefix);
+    query.bindValue(":prefixEnd", folderPrefixEnd(newPrefix));
+    if (!query.exec())
+        qDebug() << "could not remap search folders: " << query.lastError();
+
+    query.prepare("UPDATE OR REPLACE directories SET Path = CASE WHEN Path = :oldRoot THEN :newRoot ELSE :newPrefix || substr(Path, :from) END "
+                  "WHERE Path = :path OR (Path >= :prefix AND Path < :prefixEnd)");
+    query.bindValue(":oldRoot", oldRoot);
+    query.bindValue(":newRoot", newRoot);
+    query.bindValue(":newPrefix", newPrefix);
+    query.bindValue(":from", prefixLength + 1);
+    query.bindValue(":path", oldRoot);
+    query.bindValue(":prefix", oldPrefix);
+    query.bindValue(":prefixEnd", folderPrefixEnd(oldPrefix));
+    if (!query.exec())
+        qDebug() << "could not remap directories: " << query.lastError();
+
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+    recordVolume(volume);
+    qDebug() << "Remapped" << remapped << "files from" << oldRoot << "to" << newRoot;
+
+    // The crawler skips the unchanged directories at their new paths
+    loadDirectoryManifest();
+    emit volumeRemapped(oldRoot, newRoot);
+}
+
+void FileRepository::loadDirectoryManifest()
+{
+    QList<DirectoryState> directories;
+
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT Path, LastModifiedTime, EntryCount FROM directories"))
+        qDebug() << "could not load directory manifest: " << query.lastError();
+
+    while (query.next())
+    {
+        DirectoryState directory;
+        directory.Path = query.value(0).toString();
+        directory.LastModifiedTime = query.value(1).toLongLong();
+        directory.EntryCount = query.value(2).toInt();
+        directories.append(directory);
+    }
+
+    emit directoryManifestLoaded(directories);
+}
+
+void FileRepository::addTags(QSqlQuery& tagAddQuery, QSqlQuery& tagDeleteQuery, const AstroFile& astroFile)
+{
+    int id = astroFile.Id;
+    Q_ASSERT(id != 0);
+
+    // TagStatus and the tag columns were already written with the fits row,
+    // so only the keywords without a column are written here.
+    const QByteArray tail = encodeTagTail(tagTailCodec, astroFile.Tags);
+    if (tail.isEmpty())
+    {
+        tagDeleteQuery.bindValue(":fits_id", id);
+        if (!tagDeleteQuery.exec())
+            qDebug() << "FAILED to execute DELETE TAG query: " << tagDeleteQuery.lastError();
+        return;
+    }
+    tagAddQuery.bindValue(":fits_id", id);
+    tagAddQuery.bindValue(":tags", tail);
+    if (!tagAddQuery.exec())
+        qDebug() << "FAILED to execute INSERT TAG query: " << tagAddQuery.lastError();
+}
+
+/*!
+ * \brief FileRepository::addThumbnail
+ * Writes the tiny thumbnail, and the thumbnail pyramid: the thumbnail of the file is
+ * the largest level, and each smaller level is scaled from the one above it.
+ * The levels are written to the ThumbnailStore, see storeThumbnailLevel.
+ * The thumbnail column of the thumbnails table is only read for rows older than the pyramid.
+ */
+/*!
+ * \brief FileRepository::prepareThumbnailQueries
+ * The statements addThumbnail writes with.
+ */
+void FileRepository::prepareThumbnailQueries(QSqlQuery &thumbnailQuery, QSqlQuery &levelQuery, QSqlQuery &packedQuery)
+{
+    thumbnailQuery.prepare("INSERT INTO thumbnails (fits_id, thumbnail, tiny_thumbnail, format) VALUES (:fits_id, :bytedata, :tinyThumbnail, :format) "
+                           "ON CONFLICT(fits_id) DO UPDATE SET thumbnail = excluded.thumbnail, tiny_thumbnail = excluded.tiny_thumbnail, format = excluded.format");
+
+    levelQuery.prepare("INSERT INTO thumbnail_levels (fits_id, level, thumbnail, format, pack, pack_offset, pack_length, content_hash) "
+                       "VALUES (:fits_id, :level, :bytedata, :format, :pack, :pack_offset, :pack_length, :content_hash) "
+                       "ON CONFLICT(fits_id, level) DO UPDATE SET thumbnail = excluded.thumbnail, format = excluded.format, pack = excluded.pack, "
+                       "pack_offset = excluded.pack_offset, pack_length = excluded.pack_length, content_hash = excluded.content_hash");
+
+    packedQuery.prepare("SELECT pack, pack_offset, pack_length FROM thumbnail_levels WHERE content_hash = :content_hash AND pack_length = :pack_length LIMIT 1");
+}
+
+void FileRepository::addThumbnail(QSqlQuery& insertThumbnailQuery, QSqlQuery& insertLevelQuery, QSqlQuery& packedQuery, const AstroFile &astroFile)
+{
+    static LatencyHistogram& encodeLatency = Metrics::histogram("repository.encode_thumbnails");
+    ScopedLatency latency(encodeLatency);
+    int id = astroFile.Id;
+    Q_ASSERT(id != 0);
+
+    QByteArray inByteArrayTiny = ThumbnailCodec::encode(astroFile.tinyThumbnail, thumbnailFormat);
+
+    // ThumbnailStatus was already written with the fits row.
+    insertThumbnailQuery.bindValue(":fits_id", id);
+    insertThumbnailQuery.bindValue(":bytedata", QByteArray());
+    insertThumbnailQuery.bindValue(":tinyThumbnail", inByteArrayTiny);
+    insertThumbnailQuery.bindValue(":format", thumbnailFormat);
+    if (!insertThumbnailQuery.exec())
+        qDebug() << "DB: Failed in insert Thubmanailfor " << astroFile.FullPath << insertThumbnailQuery.lastError();
+
+    auto insertLevel = [&](int level, const QByteArray& data, ThumbnailFormat format)
+    {
+        ThumbnailLocation location;
+        QByteArray contentHash;
+        const bool packed = storeThumbnailLevel(packedQuery, data, location, contentHash);
+
+        insertLevelQuery.bindValue(":fits_id", id);
+        insertLevelQuery.bindValue(":level", level);
+        insertLevelQuery.bindValue(":bytedata", packed ? QVariant() : QVariant(data));
+        insertLevelQuery.bindValue(":format", format);
+        insertLevelQuery.bindValue(":pack", packed ? QVariant(location.pack) : QVariant());
+        insertLevelQuery.bindValue(":pack_offset", packed ? QVariant(location.offset) : QVariant());
+        insertLevelQuery.bindValue(":pack_length", packed ? QVariant(location.length) : QVariant());
+        insertLevelQuery.bindValue(":content_hash", packed ? QVariant(QString::fromLatin1(contentHash)) : QVariant());
+        if (!insertLevelQuery.exec())
+            qDebug() << "DB: Failed to insert thumbnail level" << level << "for" << astroFile.FullPath << insertLevelQuery.lastError();
+    };
+
+    QImage image = astroFile.thumbnail;
+    for (int level = THUMBNAIL_LEVEL_COUNT - 1; level >= 0 && !image.isNull(); level--)
+    {
+        const int size = thumbnailLevelSizes[level];
+        if (image.width() > size || image.height() > size)
+            image = image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        insertLevel(level, ThumbnailCodec::encode(image, thumbnailFormat), thumbnailFormat);
+    }
+
+    // Stored next to the pyramid, for restretchThumbnails. A thumbnail made again from
+    // it comes without one, and the one stored is kept.
+    const QByteArray linear = ThumbnailCodec::encode(astroFile.linearThumbnail, ThumbnailFormatLinear16);
+    if (!linear.isEmpty())
+        insertLevel(LINEAR_THUMBNAIL_LEVEL, linear, ThumbnailFormatLinear16);
+}
+
+/*!
+ * \brief FileRepository::restretchThumbnails
+ * Makes the thumbnail pyramid and the tiny thumbnail of every file that has a linear
+ * thumbnail again, stretched with options from the statistics in its StretchParameters,
+ * without reading the files. Commits every RESTRETCH_CHUNK_SIZE files. The catalog
+ * snapshot is made again on the next start, as the change counter moves.
+ * Returns the number of files stretched again, -1 if the thumbnails could not be read.
+ */
+int FileRepository::restretchThumbnails(const StretchOptions &options)
+{
+    QSqlQuery thumbnailQuery;
+    QSqlQuery thumbnailLevelQuery;
+    QSqlQuery packedQuery;
+    prepareThumbnailQueries(thumbnailQuery, thumbnailLevelQuery, packedQuery);
+
+    QSqlQuery linearQuery;
+    linearQuery.setForwardOnly(true);
+    linearQuery.prepare(QString("SELECT l.fits_id, f.StretchParameters, l.thumbnail, l.format, l.pack, l.pack_offset, l.pack_length "
+                                "FROM thumbnail_levels l JOIN fits f ON f.id = l.fits_id "
+                                "WHERE l.level = %1 AND l.fits_id > :lastId ORDER BY l.fits_id LIMIT %2")
+                        .arg(LINEAR_THUMBNAIL_LEVEL).arg(RESTRETCH_CHUNK_SIZE));
+
+    QSqlQuery placeholderQuery;
+    placeholderQuery.prepare("UPDATE fits SET PlaceholderHash = :PlaceholderHash WHERE id = :id");
+
+    struct Row { int id; QByteArray stretchParameters; QByteArray data; ThumbnailFormat format; };
+    int restretched = 0;
+    int lastId = 0;
+    while (!cancellationToken.isCanceled())
+    {
+        linearQuery.bindValue(":lastId", lastId);
+        if (!linearQuery.exec())
+        {
+            qDebug() << "DB: Failed to read the linear thumbnails" << linearQuery.lastError();
+            return -1;
+        }
+        QList<Row> rows;
+        while (linearQuery.next())
+        {
+            QByteArray data;
+            if (linearQuery.isNull(4))
+            {
+                data = linearQuery.value(2).toByteArray();
+            }
+            else
+            {
+                ThumbnailLocation location;
+                location.pack = linearQuery.value(4).toInt();
+                location.offset = linearQuery.value(5).toLongLong();
+                location.length = linearQuery.value(6).toLongLong();
+                data = thumbnailStore->read(location);
+            }
+            rows.append({linearQuery.value(0).toInt(), linearQuery.value(1).toByteArray(), data, ThumbnailFormat(linearQuery.value(3).toInt())});
+        }
+        linearQuery.finish();
+        if (rows.isEmpty())
+            break;
+
+        QSqlDatabase::database().transaction();
+        for (auto& row : rows)
+        {
+            lastId = row.id;
+            StretchParams params;
+            if (!StretchParams::fromByteArray(row.stretchParameters, params))
+                continue;
+            QImage image = LinearThumbnail::stretch(ThumbnailCodec::decode(row.data, row.format), params, options);
+            if (image.isNull())
+                continue;
+
+            AstroFile astroFile;
+            astroFile.Id = row.id;
+            astroFile.thumbnail = image;
+            astroFile.tinyThumbnail = image.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            addThumbnail(thumbnailQuery, thumbnailLevelQuery, packedQuery, astroFile);
+            placeholderQuery.bindValue(":PlaceholderHash", PlaceholderHash::ofImage(image).toByteArray());
+            placeholderQuery.bindValue(":id", row.id);
+            if (!placeholderQuery.exec())
+                qDebug() << "DB: Failed to update the placeholder hash" << placeholderQuery.lastError();
+            restretched++;
+        }
+        incrementChangeCounter();
+        // The rows only refer to the packs once the thumbnails are in them
+        thumbnailStore->flush();
+        QSqlDatabase::database().commit();
+    }
+    return restretched;
+}
+
+/*!
+ * \brief FileRepository::storeThumbnailLevel
+ * Finds where the encoded thumbnail is in the ThumbnailStore. Thumbnails are matched by
+ * the hash of their bytes, so the thumbnails of duplicate files are only written once.
+ * Others are appended to the packs.
+ * Returns false if the packs cannot be written, the thumbnail is then kept in the row.
+ */
+bool FileRepository::storeThumbnailLevel(QSqlQuery &packedQuery, const QByteArray &data, ThumbnailLocation &location, QByteArray &contentHash)
+{
+    contentHash = Hasher::hash(data.constData(), data.size(), HashAlgorithmXxh64);
+
+    packedQuery.bindValue(":content_hash", QString::fromLatin1(contentHash));
+    packedQuery.bindValue(":pack_length", data.size());
+    if (packedQuery.exec() && packedQuery.next())
+    {
+        location.pack = packedQuery.value(0).toInt();
+        location.offset = packedQuery.value(1).toLongLong();
+        location.length = packedQuery.value(2).toLongLong();
+        packedQuery.finish();
+        return true;
+    }
+    packedQuery.finish();
+
+    return thumbnailStore->append(data, location);
+}
+
+/*!
+ * \brief FileRepository::getDuplicateFiles
+ *
+ * Rows written before the quick hash or the perceptual hash existed get them. The
+ * quick hash collisions of new rows are resolved when they are written, see
+ * addOrUpdateAstrofiles, so only the collisions still without a FileHash are resolved
+ * here, see unresolvedCollisions. The duplicate groups are kept by the catalog, see
+ * Catalog::duplicatesOf and Catalog::nearDuplicatesOf.
+ */
+void FileRepository::getDuplicateFiles(const CancellationToken& token)
+{
+    static LatencyHistogram& duplicatesLatency = Metrics::histogram("repository.duplicates");
+    ScopedLatency latency(duplicatesLatency);
+    // The hashes of a shared or served catalog are kept by its indexer
+    if (isIndexedElsewhere())
+        return;
+    backfillQuickHashes(token);
+    backfillPerceptualHashes(token);
+    if (cancellationToken.isCanceled() || token.isCanceled())
+        return;
+
+    resolveQuickHashCollisions(unresolvedCollisions());
+}
+
+/*!
+ * \brief FileRepository::backfillQuickHashes
+ * Computes the quick hash of the rows that do not have one yet.
+ * Every file is read from disk, so the hashes are committed BACKFILL_CHUNK_SIZE at a
+ * time and the ingest and interactive requests run in between.
+ */
+void FileRepository::backfillQuickHashes(const CancellationToken& token)
+{
+    QList<AstroFile> files;
+    QSqlQuery query;
+    query.exec(QString("SELECT id, FullPath FROM fits WHERE (QuickHash IS NULL OR QuickHash = '') AND %1").arg(attachedCondition("FullPath")));
+    while (query.next())
+    {
+        AstroFile astroFile;
+        astroFile.Id = query.value(0).toInt();
+        astroFile.FullPath = query.value(1).toString();
+        files.append(astroFile);
+    }
+    query.finish();
+
+    if (files.isEmpty())
+        return;
+
+    QSqlQuery updateQuery;
+    updateQuery.prepare("UPDATE fits SET QuickHash = :quickHash WHERE id = :id");
+
+    for (int from = 0; from < files.count(); from += BACKFILL_CHUNK_SIZE)
+    {
+        if (cancellationToken.isCanceled() || token.isCanceled())
+            break;
+        if (from > 0)
+            yieldRequests(MaintenancePriority);
+
+        QSqlDatabase::database().transaction();
+        for (int i = from; i < qMin(from + BACKFILL_CHUNK_SIZE, files.count()); i++)
+        {
+            auto& file = files[i];
+            file.QuickHash = FileReader::quickHashOfFile(file.FullPath);
+            if (file.QuickHash.isEmpty())
+                continue;
+            updateQuery.bindValue(":quickHash", file.QuickHash);
+            updateQuery.bindValue(":id", file.Id);
+            if (!updateQuery.exec())
+                qDebug() << "DB: Failed to update the quick hash of " << file.FullPath << updateQuery.lastError();
+        }
+        QSqlDatabase::database().commit();
+    }
+}
+
+/*!
+ * \brief FileRepository::backfillPerceptualHashes
+ * Computes the perceptual hash of the rows that do not have one yet from their tiny
+ * thumbnail, as the processor does, and emits perceptualHashesResolved with them.
+ */
+void FileRepository::backfillPerceptualHashes(const CancellationToken& token)
+{
+    QList<AstroFile> files;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.exec(QString("SELECT f.id, f.FullPath, t.tiny_thumbnail, t.format FROM fits f JOIN thumbnails t ON t.fits_id = f.id "
+               "WHERE f.PerceptualHash IS NULL AND %1").arg(attachedCondition("f.FullPath")));
+    while (query.next())
+    {
+        if (cancellationToken.isCanceled() || token.isCanceled())
+            return;
+        AstroFile astroFile;
+        astroFile.Id = query.value(0).toInt();
+        astroFile.FullPath = query.value(1).toString();
+        astroFile.PerceptualHash = PerceptualHash::ofImage(ThumbnailCodec::decode(query.value(2).toByteArray(), ThumbnailFormat(query.value(3).toInt())));
+        files.append(astroFile);
+    }
+    query.finish();
+
+    if (files.isEmpty())
+        return;
+
+    QSqlQuery updateQuery;
+    updateQuery.prepare("UPDATE fits SET PerceptualHash = :perceptualHash WHERE id = :id");
+
+    QSqlDatabase::database().transaction();
+    for (auto& file : files)
+    {
+        updateQuery.bindValue(":perceptualHash", qint64(file.PerceptualHash));
+        updateQuery.bindValue(":id", file.Id);
+        if (!updateQuery.exec())
+            qDebug() << "DB: Failed to update the perceptual hash of " << file.FullPath << updateQuery.lastError();
+    }
+    incrementChangeCounter();
+    QSqlDatabase::database().commit();
+
+    // Flat thumbnails have no hash, but are not looked at again
+    files.removeIf([](const AstroFile& astroFile) { return astroFile.PerceptualHash == 0; });
+    if (!files.isEmpty())
+        emit perceptualHashesResolved(files);
+}
+
+/*!
+ * \brief FileRepository::loadThumbnal
+ * \param afi
+ *
+ * Loads the thumbnail of a single file, at afi.thumbnailLevel. See loadThumbnails.
+ */
+void FileRepository::loadThumbnal(const AstroFile &afi)
+{
+    loadThumbnails({afi.Id}, afi.thumbnailLevel);
+}
+
+/*!
+ * \brief FileRepository::thumbnailIdList
+ * The placeholders of the ids of a thumbnail batch statement: (:id0, ..., :idN)
+ */
+QString FileRepository::thumbnailIdList()
+{
+    QStringList placeholders;
+    for (int i = 0; i < THUMBNAIL_BATCH_SIZE; i++)
+        placeholders.append(QString(":id%1").arg(i));
+    return QString("(%1)").arg(placeholders.join(","));
+}
+
+/*!
+ * \brief FileRepository::bindThumbnailIds
+ * Binds the next THUMBNAIL_BATCH_SIZE ids starting at from. The statement always has
+ * THUMBNAIL_BATCH_SIZE placeholders so it can be reused; the ones past the end of the
+ * list get an id that does not exist.
+ */
+void FileRepository::bindThumbnailIds(QSqlQuery &query, const QVector<int> &ids, int from)
+{
+    for (int i = 0; i < THUMBNAIL_BATCH_SIZE; i++)
+    {
+        const int index = from + i;
+        query.bindValue(QString(":id%1").arg(i), index < ids.count() ? ids.at(index) : -1);
+    }
+}
+
+/*!
+ * \brief FileRepository::loadThumbnails
+ * \param ids
+ * \param level Level of the thumbnail pyramid, see thumbnailLevelSizes
+ *
+ * Loads the thumbnails of many files with one statement, prepared once and executed
+ * for every THUMBNAIL_BATCH_SIZE ids. Only the thumbnail of the requested level is read,
+ * from the ThumbnailStore unless it was kept in the row.
+ * Rows older than the pyramid fall back to their single thumbnail, and the tiny
+ * thumbnail, which the catalog already has, is never read.
+ *
+ * The thumbnails are decoded here and delivered in one thumbnailsLoaded batch.
+ *
+ * Uses the read-only connection of the calling thread, so this can be called
+ * directly from a reader thread (like the ThumbnailCache) without waiting for the
+ * repository thread.
+ */
+void FileRepository::loadThumbnails(const QVector<int> &ids, int level)
+{
+    if (cancellationToken.isCanceled() || ids.isEmpty())
+        return;
+
+    const ThumbnailBatch batch = readThumbnails(ids, level);
+    if (!batch.ids.isEmpty())
+        emit thumbnailsLoaded(batch);
+}
+
+/*!
+ * \brief FileRepository::readThumbnails
+ * The batch of loadThumbnails, returned instead of emitted, for the callers that keep
+ * the thumbnails apart from the ones of the view, like the DetailPrefetcher.
+ */
+ThumbnailBatch FileRepository::readThumbnails(const QVector<int> &ids, int level)
+{
+    static LatencyHistogram& loadLatency = Metrics::histogram("repository.load_thumbnails");
+    ScopedLatency latency(loadLatency);
+
+    ThumbnailBatch batch;
+    batch.level = level;
+    batch.ids.reserve(ids.count());
+    batch.images.reserve(ids.count());
+    for (auto& stored : readStoredThumbnails(ids, level))
+    {
+        batch.ids.append(stored.id);
+        batch.images.append(ThumbnailCodec::decode(stored.data, stored.format));
+    }
+    return batch;
+}
+
+/*!
+ * \brief FileRepository::readStoredThumbnails
+ * The thumbnails of readThumbnails as they are stored, not decoded. The data of a
+ * packed thumbnail refers to the mapping of its pack.
+ */
+QVector<FileRepository::StoredThumbnail> FileRepository::readStoredThumbnails(const QVector<int> &ids, int level)
+{
+    QVector<StoredThumbnail> thumbnails;
+    thumbnails.reserve(ids.count());
+    QSet<int> found;
+
+    // The level of the pyramid asked for
+    QSqlQuery levelQuery(readerConnection());
+    levelQuery.setForwardOnly(true);
+    levelQuery.prepare("SELECT fits_id, thumbnail, format, pack, pack_offset, pack_length FROM thumbnail_levels WHERE level = :level AND fits_id IN " + thumbnailIdList());
+    for (int from = 0; from < ids.count(); from += THUMBNAIL_BATCH_SIZE)
+    {
+        levelQuery.bindValue(":level", level);
+        bindThumbnailIds(levelQuery, ids, from);
+        if (!levelQuery.exec())
+        {
+            qDebug() << "DB: Failed to load thumbnails" << levelQuery.lastError();
+            continue;
+        }
+        while (levelQuery.next())
+        {
+            // Read in place from the mapping of the pack
+            QByteArray data;
+            if (levelQuery.isNull(3))
+            {
+                data = levelQuery.value(1).toByteArray();
+            }
+            else
+            {
+                ThumbnailLocation location;
+                location.pack = levelQuery.value(3).toInt();
+                location.offset = levelQuery.value(4).toLongLong();
+                location.length = levelQuery.value(5).toLongLong();
+                data = thumbnailStore->read(location);
+            }
+            const int id = levelQuery.value(0).toInt();
+            found.insert(id);
+            thumbnails.append({id, data, ThumbnailFormat(levelQuery.value(2).toInt())});
+        }
+    }
+
+    // Rows older than the pyramid have a single thumbnail
+    QVector<int> missingIds;
+    if (thumbnails.count() < ids.count())
+    {
+        for (int id : ids)
+        {
+            if (!found.contains(id))
+                missingIds.append(id);
+        }
+    }
+    if (!missingIds.isEmpty())
+    {
+        QSqlQuery query(readerConnection());
+        query.setForwardOnly(true);
+        query.prepare("SELECT fits_id, thumbnail, format FROM thumbnails WHERE fits_id IN " + thumbnailIdList());
+        for (int from = 0; from < missingIds.count(); from += THUMBNAIL_BATCH_SIZE)
+        {
+            bindThumbnailIds(query, missingIds, from);
+            if (!query.exec())
+            {
+                qDebug() << "DB: Failed to load thumbnails" << query.lastError();
+                continue;
+            }
+            while (query.next())
+                thumbnails.append({query.value(0).toInt(), query.value(1).toByteArray(), ThumbnailFormat(query.value(2).toInt())});
+        }
+    }
+    return thumbnails;
+}
+
+/*!
+ * \brief The FitsColumns struct
+ * Column positions of the fits table in a query result, looked up once per query
+ * instead of once per row.
+ */
+struct FitsColumns
+{
+    int id;
+    int fileName;
+    int fullPath;
+    int directoryPath;
+    int volumeName;
+    int fileType;
+    int fileExtension;
+    int createdTime;
+    int lastModifiedTime;
+    int fileHash;
+    int imageHash;
+    int quickHash;
+    int stretchParameters;
+    int perceptualHash;
+    int background;
+    int noise;
+    int starCount;
+    int fwhm;
+    int eccentricity;
+    int tagStatus;
+    int thumbnailStatus;
+    int processStatus;
+    int fileSize;
+    int failureReason;
+    int thumbnailVersion;
+    int placeholderHash;
+    int fileDevice;
+    int fileInode;
+    int isHidden;
+    int tags[std::size(tagColumns)];
+
+    FitsColumns(const QSqlRecord& record)
+    {
+        for (size_t i = 0; i < std::size(tagColumns); i++)
+            tags[i] = record.indexOf(tagColumns[i].column);
+        id = record.indexOf("Id");
+        fileName = record.indexOf("FileName");
+        fullPath = record.indexOf("FullPath");
+        directoryPath = record.indexOf("DirectoryPath");
+        volumeName = record.indexOf("VolumeName");
+        fileType = record.indexOf("FileType");
+        fileExtension = record.indexOf("FileExtension");
+        createdTime = record.indexOf("CreatedTime");
+        lastModifiedTime = record.indexOf("LastModifiedTime");
+        fileHash = record.indexOf("FileHash");
+        imageHash = record.indexOf("ImageHash");
+        quickHash = record.indexOf("QuickHash");
+        stretchParameters = record.indexOf("StretchParameters");
+        perceptualHash = record.indexOf("PerceptualHash");
+        background = record.indexOf("Background");
+        noise = record.indexOf("Noise");
+        starCount = record.indexOf("StarCount");
+        fwhm = record.indexOf("Fwhm");
+        eccentricity = record.indexOf("Eccentricity");
+        tagStatus = record.indexOf("TagStatus");
+        thumbnailStatus = record.indexOf("ThumbnailStatus");
+        processStatus = record.indexOf("ProcessStatus");
+        fileSize = record.indexOf("FileSize");
+        failureReason = record.indexOf("FailureReason");
+        thumbnailVersion = record.indexOf("ThumbnailVersion");
+        placeholderHash = record.indexOf("PlaceholderHash");
+        fileDevice = record.indexOf("FileDevice");
+        fileInode = record.indexOf("FileInode");
+        isHidden = record.indexOf("IsHidden");
+    }
+};
+
+static AstroFile astroFileFromQuery(const QSqlQuery& query, const FitsColumns& columns)
+{
+    AstroFile astro;
+    astro.Id = query.value(columns.id).toInt();
+    astro.FileName = query.value(columns.fileName).toString();
+    astro.FullPath = query.value(columns.fullPath).toString();
+    astro.DirectoryPath = StringPool::intern(query.value(columns.directoryPath).toString());
+    astro.VolumeName = StringPool::intern(query.value(columns.volumeName).toString());
+    astro.FileType = AstroFileType(query.value(columns.fileType).toInt());
+    astro.FileExtension = StringPool::intern(query.value(columns.fileExtension).toString());
+    astro.FileHash = query.value(columns.fileHash).toString();
+    astro.ImageHash = query.value(columns.imageHash).toString();
+    astro.QuickHash = query.value(columns.quickHash).toString();
+    astro.StretchParameters = query.value(columns.stretchParameters).toByteArray();
+    astro.PerceptualHash = quint64(query.value(columns.perceptualHash).toLongLong());
+    const QVariant starCount = query.value(columns.starCount);
+    if (!starCount.isNull())
+    {
+        auto measured = [&query](int column) { const QVariant value = query.value(column); return value.isNull() ? std::numeric_limits<float>::quiet_NaN() : value.toFloat(); };
+        astro.Quality.starCount = starCount.toInt();
+        astro.Quality.background = measured(columns.background);
+        astro.Quality.noise = measured(columns.noise);
+        astro.Quality.fwhm = measured(columns.fwhm);
+        astro.Quality.eccentricity = measured(columns.eccentricity);
+    }
+    astro.CreatedTime = query.value(columns.createdTime).toDateTime();
+    astro.LastModifiedTime = query.value(columns.lastModifiedTime).toDateTime();
+    astro.thumbnailStatus = ThumbnailLoadStatus(query.value(columns.thumbnailStatus).toInt());
+    astro.tagStatus = TagExtractStatus(query.value(columns.tagStatus).toInt());
+    astro.processStatus = AstroFileProcessStatus(query.value(columns.processStatus).toInt());
+    astro.FileSize = query.value(columns.fileSize).toLongLong();
+    astro.FailureReason = AstroFileFailureReason(query.value(columns.failureReason).toInt());
+    astro.ThumbnailVersion = query.value(columns.thumbnailVersion).toInt();
+    astro.Placeholder = PlaceholderHash::fromByteArray(query.value(columns.placeholderHash).toByteArray());
+    astro.FileDevice = quint64(query.value(columns.fileDevice).toLongLong());
+    astro.FileInode = quint64(query.value(columns.fileInode).toLongLong());
+    astro.IsHidden = query.value(columns.isHidden).toInt();
+    for (size_t i = 0; i < std::size(tagColumns); i++)
+    {
+        const QVariant value = query.value(columns.tags[i]);
+        if (!value.isNull())
+        {
+            const QString key = QLatin1String(tagColumns[i].key);
+            astro.Tags.insert(key, StringPool::internTagValue(key, value.toString()));
+        }
+    }
+    return astro;
+}
+
+/*!
+ * \brief FileRepository::unchangedFiles
+ * The files the crawl finds while the catalog is still loading are looked up here
+ * instead, by path, with the rules of Catalog::shouldProcessFile: a file is unchanged
+ * when it was processed and is not newer, or failed and did not change at all.
+ */
+QSet<QString> FileRepository::unchangedFiles(const QVector<FileRecord> &files)
+{
+    QSet<QString> unchanged;
+    QSqlQuery query(readerConnection());
+    query.prepare("SELECT LastModifiedTime, ProcessStatus, FileSize FROM fits WHERE FullPath = :path");
+    for (auto& record : files)
+    {
+        query.bindValue(":path", record.FullPath);
+        if (!query.exec() || !query.first())
+            continue;
+        const qint64 lastModified = query.value(0).toDateTime().toMSecsSinceEpoch();
+        const AstroFileProcessStatus status = AstroFileProcessStatus(query.value(1).toInt());
+        if (status == AstroFileProcessed && record.LastModifiedTime <= lastModified)
+            unchanged.insert(record.FullPath);
+        else if (status == AstroFileFailedToProcess && record.LastModifiedTime == lastModified && record.Size == query.value(2).toLongLong())
+            unchanged.insert(record.FullPath);
+    }
+    return unchanged;
+}
+
+/*!
+ * \brief FileRepository::loadTags
+ * \param id
+ *
+ * Emits tagsLoaded with all the keywords of the file: the tag columns, which the
+ * catalog already has, and the tag tail, which is only read here.
+ * Uses the read-only connection of the calling thread.
+ */
+void FileRepository::loadTags(int id)
+{
+    QMap<QString, QString> tags;
+
+    QSqlQuery fitsQuery(readerConnection());
+    fitsQuery.prepare("SELECT * FROM fits WHERE id = :id");
+    fitsQuery.bindValue(":id", id);
+    if (fitsQuery.exec() && fitsQuery.first())
+        tags = astroFileFromQuery(fitsQuery, FitsColumns(fitsQuery.record())).Tags.toMap();
+
+    QSqlQuery tailQuery(readerConnection());
+    tailQuery.prepare("SELECT tags FROM tag_tails WHERE fits_id = :id");
+    tailQuery.bindValue(":id", id);
+    if (tailQuery.exec() && tailQuery.first())
+    {
+        // A dictionary trained by another process since this one loaded them
+        const QByteArray blob = tailQuery.value(0).toByteArray();
+        if (!tagTailCodec.hasDictionary(TagTailCodec::dictionaryIdOf(blob)))
+            loadTagDictionaries(readerConnection());
+        tags.insert(decodeTagTail(tagTailCodec, blob));
+    }
+
+    emit tagsLoaded(id, tags);
+}
+
+/*!
+ * \brief FileRepository::servedFilesAfter
+ * The first limit attached files with an id after afterId, the lowest ids first, as
+ * the CatalogServer sends them: with every keyword, and with the tiny thumbnail and
+ * the thumbnail of the level asked for as they are stored. Paging by id keeps every
+ * page one seek in the primary key, however deep the page.
+ * Runs on the repository thread, as the detached folders are its state.
+ */
+QList<ServedFile> FileRepository::servedFilesAfter(int afterId, int limit, int level)
+{
+    QList<ServedFile> files;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare(QString("SELECT * FROM fits WHERE id > :afterId AND %1 ORDER BY id LIMIT :limit").arg(attachedCondition("FullPath")));
+    query.bindValue(":afterId", afterId);
+    query.bindValue(":limit", limit);
+    if (!query.exec())
+    {
+        qDebug() << "DB: Failed to read the files after" << afterId << query.lastError();
+        return files;
+    }
+    const FitsColumns columns(query.record());
+    while (query.next())
+        files.append({astroFileFromQuery(query, columns)});
+    completeServedFiles(files, level);
+    return files;
+}
+
+/*!
+ * \brief FileRepository::servedFilesAt
+ * The files of servedFilesAfter at fullPaths. The paths the catalog does not have,
+ * or has in a detached folder, are left out.
+ */
+QList<ServedFile> FileRepository::servedFilesAt(const QStringList &fullPaths, int level)
+{
+    QList<ServedFile> files;
+    QSqlQuery query;
+    query.setForwardOnly(true);
+    query.prepare("SELECT * FROM fits WHERE FullPath = :path");
+    for (auto& fullPath : fullPaths)
+    {
+        if (isDetached(fullPath))
+            continue;
+        query.bindValue(":path", fullPath);
+        if (!query.exec())
+        {
+            qDebug() << "DB: Failed to read" << fullPath << query.lastError();
+            continue;
+        }
+        if (query.next())
+            files.append({astroFileFromQuery(query, FitsColumns(query.record()))});
+        query.finish();
+    }
+    completeServedFiles(files, level);
+    return files;
+}
+
+/*!
+ * \brief FileRepository::completeServedFiles
+ * Adds the tag tails and the thumbnails to the rows of servedFilesAfter and servedFilesAt.
+ */
+void FileRepository::completeServedFiles(QList<ServedFile> &files, int level)
+{
+    QVector<int> ids;
+    ids.reserve(files.count());
+    QHash<int, int> indexes;
+    for (int i = 0; i < files.count(); i++)
+    {
+        ids.append(files[i].astroFile.Id);
+        indexes.insert(files[i].astroFile.Id, i);
+    }
+
+    QSqlQuery tailQuery;
+    tailQuery.setForwardOnly(true);
+    tailQuery.prepare("SELECT fits_id, tags FROM tag_tails WHERE fits_id IN " + thumbnailIdList());
+    QSqlQuery tinyQuery;
+    tinyQuery.setForwardOnly(true);
+    tinyQuery.prepare("SELECT fits_id, tiny_thumbnail, format FROM thumbnails WHERE fits_id IN " + thumbnailIdList());
+    for (int from = 0; from < ids.count(); from += THUMBNAIL_BATCH_SIZE)
+    {
+        bindThumbnailIds(tailQuery, ids, from);
+        if (!tailQuery.exec())
+            qDebug() << "DB: Failed to read the tag tails" << tailQuery.lastError();
+        while (tailQuery.next())
+        {
+            const QByteArray blob = tailQuery.value(1).toByteArray();
+            files[indexes.value(tailQuery.value(0).toInt())].astroFile.Tags.insert(TagMap(decodeTagTail(tagTailCodec, blob)));
+        }
+
+        bindThumbnailIds(tinyQuery, ids, from);
+        if (!tinyQuery.exec())
+            qDebug() << "DB: Failed to read the tiny thumbnails" << tinyQuery.lastError();
+        while (tinyQuery.next())
+        {
+            ServedFile& file = files[indexes.value(tinyQuery.value(0).toInt())];
+            file.tinyThumbnail = tinyQuery.value(1).toByteArray();
+            file.tinyThumbnailFormat = ThumbnailFormat(tinyQuery.value(2).toInt());
+        }
+    }
+
+    for (auto& stored : readStoredThumbnails(ids, level))
+    {
+        ServedFile& file = files[indexes.value(stored.id)];
+        file.thumbnail = stored.data;
+        file.thumbnailFormat = stored.format;
+    }
+}
+
+/*!
+ * \brief FileRepository::searchFiles
+ * \param text Words separated by spaces
+ * \param generation Given back with the result, to tell it from the results of older
+ * searches that finish later
+ *
+ * Emits searchFinished with the ids of the files that have every word of the text in
+ * their name, their folder or their keywords, see searchMatch.
+ *
+ * Uses the read-only connection of the calling thread, like loadThumbnails, so a
+ * search does not wait for the ingest batches of the repository thread.
+ */
+void FileRepository::searchFiles(const QString &text, int generation)
+{
+    static LatencyHistogram& searchLatency = Metrics::histogram("repository.search");
+    ScopedLatency latency(searchLatency);
+
+    QVector<int> ids;
+    const QString match = searchMatch(text);
+    if (!match.isEmpty())
+    {
+        QSqlQuery query(readerConnection());
+        query.setForwardOnly(true);
+        query.prepare("SELECT rowid FROM fits_search WHERE fits_search MATCH :match");
+        query.bindValue(":match", match);
+        if (!query.exec())
+            qDebug() << "DB: Failed to search for" << text << query.lastError();
+        while (query.next())
+            ids.append(query.value(0).toInt());
+    }
+    emit searchFinished(generation, ids);
+}
+
+namespace
+{
+// A page of rows whose tiny thumbnails are decoded on the global thread pool, while
+// the next page is read from the db
+struct ModelPage
+{
+    struct TinyThumbnail
+    {
+        int row;
+        QByteArray data;
+        ThumbnailFormat format;
+        QImage image;
+    };
+
+    QList<AstroFile> rows;
+    QVector<TinyThumbnail> tinyThumbnails;
+    QFuture<void> decoding;
+
+    ~ModelPage()
+    {
+        // The pool decodes into tinyThumbnails in place
+        decoding.waitForFinished();
+    }
+
+    void startDecoding()
+    {
+        decoding = QtConcurrent::map(tinyThumbnails, [](TinyThumbnail& tiny) {
+            tiny.image = ThumbnailCodec::decode(tiny.data, tiny.format);
+            tiny.data = QByteArray();
+        });
+    }
+
+    const QList<AstroFile>& assemble()
+    {
+        decoding.waitForFinished();
+        for (auto& tiny : tinyThumbnails)
+            rows[tiny.row].tinyThumbnail = tiny.image;
+        tinyThumbnails.clear();
+        return rows;
+    }
+};
+}
+
+/*!
+ * \brief FileRepository::loadModel
+ * Streams the catalog out of the database in pages of MODEL_PAGE_SIZE files.
+ *
+ * The fits and thumbnails tables are read with two forward-only cursors, both
+ * ordered by the fits id, and merged in a single pass. The tiny thumbnails of a page
+ * are decoded in parallel while the next page is read, and the pages are emitted in
+ * order once they are. Every emitted page contains fully assembled AstroFiles (with
+ * the tag columns and tiny thumbnails), so the Catalog can start showing them before
+ * the whole table is read.
+ *
+ * Emits modelLoadingStarted with the total number of rows, modelPageLoaded and
+ * modelLoadingProgress for every page, and modelLoaded when done.
+ */
+void FileRepository::loadModel()
+{
+    // The crawler needs the manifest before the first crawl, and the engine the
+    // volumes of the search folders, which are only crawled once the model is loaded.
+    loadDirectoryManifest();
+    loadVolumes();
+    loadDetachedFolders();
+    // Changes committed while the model loads are loaded again by loadChanges, which is harmless
+    lastChangeSeq = latestChangeSeq();
+
+    static LatencyHistogram& snapshotLatency = Metrics::histogram("repository.load_snapshot");
+    static LatencyHistogram& loadLatency = Metrics::histogram("repository.load_model");
+    {
+        ScopedLatency latency(snapshotLatency);
+        if (loadModelFromSnapshot())
+            return;
+    }
+    ScopedLatency latency(loadLatency);
+
+    int total = 0;
+    const QString attached = attachedCondition("FullPath");
+    QSqlQuery countQuery(QString("SELECT COUNT(*) FROM fits WHERE %1").arg(attached));
+    if (countQuery.first())
+        total = countQuery.value(0).toInt();
+    emit modelLoadingStarted(total);
+
+    QSqlQuery fitsQuery;
+    fitsQuery.setForwardOnly(true);
+    fitsQuery.exec(QString("SELECT * FROM fits WHERE %1 ORDER BY id").arg(attached));
+    FitsColumns columns(fitsQuery.record());
+
+    QSqlQuery thumbnailsQuery;
+    thumbnailsQuery.setForwardOnly(true);
+    thumbnailsQuery.exec("SELECT fits_id, tiny_thumbnail, format FROM thumbnails ORDER BY fits_id");
+
+    QSqlQuery verificationsQuery;
+    verificationsQuery.setForwardOnly(true);
+    verificationsQuery.exec("SELECT fits_id, Integrity FROM verifications ORDER BY fits_id");
+
+    QSqlQuery solutionsQuery;
+    solutionsQuery.setForwardOnly(true);
+    solutionsQuery.exec("SELECT fits_id, RaDegrees, DecDegrees, Rotation, Scale FROM plate_solutions WHERE RaDegrees IS NOT NULL ORDER BY fits_id");
+
+    bool hasThumbnail = thumbnailsQuery.next();
+    bool hasVerification = verificationsQuery.next();
+    bool hasSolution = solutionsQuery.next();
+
+    auto page = std::make_unique<ModelPage>();
+    page->rows.reserve(MODEL_PAGE_SIZE);
+    std::unique_ptr<ModelPage> decodingPage;
+    int loaded = 0;
+
+    auto emitPage = [&](ModelPage& decoded) {
+        loaded += decoded.rows.count();
+        emit modelPageLoaded(decoded.assemble());
+        emit modelLoadingProgress(loaded, total);
+    };
+
+    while (fitsQuery.next())
+    {
+        if (cancellationToken.isCanceled())
+            return;
+
+        AstroFile astro = astroFileFromQuery(fitsQuery, columns);
+
+        // Skip any orphaned rows of files that are not in the fits table
+        while (hasThumbnail && thumbnailsQuery.value(0).toInt() < astro.Id)
+            hasThumbnail = thumbnailsQuery.next();
+        if (hasThumbnail && thumbnailsQuery.value(0).toInt() == astro.Id)
+        {
+            page->tinyThumbnails.append({int(page->rows.count()), thumbnailsQuery.value(1).toByteArray(), ThumbnailFormat(thumbnailsQuery.value(2).toInt()), QImage()});
+            astro.thumbnailStatus = ThumbnailLoaded;
+            hasThumbnail = thumbnailsQuery.next();
+        }
+        while (hasVerification && verificationsQuery.value(0).toInt() < astro.Id)
+            hasVerification = verificationsQuery.next();
+        if (hasVerification && verificationsQuery.value(0).toInt() == astro.Id)
+            astro.Integrity = AstroFileIntegrity(verificationsQuery.value(1).toInt());
+        while (hasSolution && solutionsQuery.value(0).toInt() < astro.Id)
+            hasSolution = solutionsQuery.next();
+        if (hasSolution && solutionsQuery.value(0).toInt() == astro.Id)
+        {
+            astro.Solution.ra = solutionsQuery.value(1).toDouble();
+            astro.Solution.dec = solutionsQuery.value(2).toDouble();
+            astro.Solution.rotation = solutionsQuery.value(3).toDouble();
+            astro.Solution.scale = solutionsQuery.value(4).toDouble();
+        }
+
+        page->rows.append(astro);
+        if (page->rows.count() >= MODEL_PAGE_SIZE)
+        {
+            page->startDecoding();
+            if (decodingPage)
+                emitPage(*decodingPage);
+            decodingPage = std::move(page);
+            page = std::make_unique<ModelPage>();
+            page->rows.reserve(MODEL_PAGE_SIZE);
+        }
+    }
+
+    if (decodingPage)
+        emitPage(*decodingPage);
+    if (!page->rows.isEmpty())
+    {
+        page->startDecoding();
+        emitPage(*page);
+    }
+
+    emit modelLoaded(loaded);
+}
+
+/*!
+ * \brief FileRepository::loadModelFromSnapshot
+ * If the catalog snapshot was written against the current state of the database,
+ * emits the model pages from the memory-mapped snapshot without reading the
+ * fits or thumbnails tables.
+ * Returns false if there is no valid snapshot, in which case nothing is emitted.
+ */
+bool FileRepository::loadModelFromSnapshot()
+{
+    CatalogSnapshot snapshot;
+    if (!snapshot.open(snapshotFilePath()))
+        return false;
+
+    if (!snapshot.isValidFor(DB_SCHEMA_VERSION, catalogId(), changeCounter()))
+    {
+        qDebug() << "Catalog snapshot is stale";
+        snapshot.close();
+        CatalogSnapshot::remove(snapshotFilePath());
+        return false;
+    }
+
+    TinyThumbnailAtlas tinyThumbnails;
+    if (!snapshot.readTinyThumbnails(tinyThumbnails))
+    {
+        snapshot.close();
+        CatalogSnapshot::remove(snapshotFilePath());
+        return false;
+    }
+
+    int total = snapshot.count();
+    emit modelLoadingStarted(total);
+    emit tinyThumbnailsLoaded(tinyThumbnails);
+    for (int first = 0; first < total; first += MODEL_PAGE_SIZE)
+    {
+        if (cancellationToken.isCanceled())
+            return true;
+        emit modelPageLoaded(snapshot.read(first, MODEL_PAGE_SIZE));
+        emit modelLoadingProgress(qMin(first + MODEL_PAGE_SIZE, total), total);
+    }
+    emit modelLoaded(total);
+    return true;
+}
+
+/*!
+ * \brief FileRepository::watchChanges
+ * \param interval
+ * Calls loadChanges every interval milliseconds, on the thread of the repository.
+ * Used by the readers of a shared catalog, which is written by the indexer.
+ */
+void FileRepository::watchChanges(int interval)
+{
+    if (changesTimer == nullptr)
+    {
+        changesTimer = new QTimer(this);
+        connect(changesTimer, &QTimer::timeout, this, &FileRepository::loadChanges);
+    }
+    changesTimer->start(interval);
+}
+
+/*!
+ * \brief FileRepository::loadChanges
+ * Reads the file_changes logged since the model, or the last changes, were loaded.
+ * A file changed several times is looked up once, unless its last change deleted it:
+ * if it is still in the fits table it is emitted with modelPageLoaded, like the rows of
+ * loadModel, otherwise with astroFilesDeleted. If the change log was pruned past the last change this reader
+ * has, every file is loaded again.
+ */
+void FileRepository::loadChanges()
+{
+    static LatencyHistogram& changesLatency = Metrics::histogram("repository.load_changes");
+
+    // Read the counter first, so a snapshot written later is never newer than the catalog
+    loadCatalogState();
+
+    QSqlQuery firstQuery("SELECT MIN(seq), MAX(seq) FROM file_changes");
+    if (!firstQuery.first() || firstQuery.value(1).toLongLong() <= lastChangeSeq)
+        return;
+    const bool isPruned = firstQuery.value(0).toLongLong() > lastChangeSeq + 1;
+    firstQuery.finish();
+    // The indexer detaches and attaches the folders removed and added since
+    loadDetachedFolders();
+
+    ScopedLatency latency(changesLatency);
+
+    // The id and the operation of the last change of every path
+    QHash<QString, QPair<int, int>> changed;
+    qint64 seq = lastChangeSeq;
+    QSqlQuery changesQuery;
+    changesQuery.setForwardOnly(true);
+    if (isPruned)
+    {
+        qDebug() << "The change log of the shared catalog was pruned, loading every file";
+        changesQuery.exec(QString("SELECT (SELECT MAX(seq) FROM file_changes), id, FullPath, %1 FROM fits WHERE %2").arg(FileUpdated).arg(attachedCondition("FullPath")));
+    }
+    else
+    {
+        changesQuery.prepare("SELECT seq, fits_id, FullPath, operation FROM file_changes WHERE seq > :seq ORDER BY seq");
+        changesQuery.bindValue(":seq", lastChangeSeq);
+        changesQuery.exec();
+    }
+    while (changesQuery.next())
+    {
+        seq = qMax(seq, changesQuery.value(0).toLongLong());
+        changed.insert(changesQuery.value(2).toString(), {changesQuery.value(1).toInt(), changesQuery.value(3).toInt()});
+    }
+    changesQuery.finish();
+
+    QSqlQuery fitsQuery;
+    fitsQuery.prepare("SELECT * FROM fits WHERE FullPath = :fullPath");
+    QSqlQuery thumbnailQuery;
+    thumbnailQuery.prepare("SELECT tiny_thumbnail, format FROM thumbnails WHERE fits_id = :id");
+
+    QList<AstroFile> page;
+    QList<AstroFile> deleted;
+    for (auto iter = changed.constBegin(); iter != changed.constEnd(); ++iter)
+    {
+        if (cancellationToken.isCanceled())
+            return;
+
+        fitsQuery.bindValue(":fullPath", iter.key());
+        if (iter.value().second == FileDeleted || isDetached(iter.key()) || !fitsQuery.exec() || !fitsQuery.first())
+        {
+            AstroFile astroFile;
+            astroFile.Id = iter.value().first;
+            astroFile.FullPath = iter.key();
+            deleted.append(astroFile);
+            continue;
+        }
+
+        AstroFile astro = astroFileFromQuery(fitsQuery, FitsColumns(fitsQuery.record()));
+        fitsQuery.finish();
+
+        thumbnailQuery.bindValue(":id", astro.Id);
+        if (thumbnailQuery.exec() && thumbnailQuery.first())
+        {
+            astro.tinyThumbnail = ThumbnailCodec::decode(thumbnailQuery.value(0).toByteArray(), ThumbnailFormat(thumbnailQuery.value(1).toInt()));
+            astro.thumbnailStatus = ThumbnailLoaded;
+        }
+        thumbnailQuery.finish();
+
+        page.append(astro);
+        if (page.count() >= MODEL_PAGE_SIZE)
+        {
+            emit modelPageLoaded(page);
+            page.clear();
+        }
+    }
+    lastChangeSeq = seq;
+
+    if (!page.isEmpty())
+        emit modelPageLoaded(page);
+    if (!deleted.isEmpty())
+        emit astroFilesDeleted(deleted);
+}
+
+/*!
+ * \brief FileRepository::importVolumeCatalog
+ * Merges the portable catalog at the root of the volume, see exportVolumeCatalog, and
+ * loads the files it merged into the catalog like the pages of loadModel, so a crawl
+ * that follows finds them known and does not process them again.
+ */
+int FileRepository::importVolumeCatalog(const QString &rootPath, const QString &volumeName)
+{
+    static LatencyHistogram& importLatency = Metrics::histogram("repository.import_volume_catalog");
+    const QString path = volumeCatalogPath(rootPath);
+    if (!QFileInfo::exists(path))
+        return 0;
+    ScopedLatency latency(importLatency);
+
+    QVector<int> mergedIds;
+    const int merged = mergeCatalog(path, rootPath, volumeName, mergedIds);
+    if (merged <= 0)
+        return merged;
+    qDebug() << "Merged" << merged << "files from the catalog of" << rootPath;
+    loadModelRows(mergedIds);
+    return merged;
+}
+
+/*!
+ * \brief FileRepository::loadModelRows
+ * Loads the files into the catalog like the pages of loadModel, with their tiny
+ * thumbnails, integrity and plate solution.
+ */
+void FileRepository::loadModelRows(const QVector<int> &ids)
+{
+    QSqlQuery fitsQuery;
+    fitsQuery.prepare("SELECT * FROM fits WHERE id = :id");
+    QSqlQuery thumbnailQuery;
+    thumbnailQuery.prepare("SELECT tiny_thumbnail, format FROM thumbnails WHERE fits_id = :id");
+    QSqlQuery verificationQuery;
+    verificationQuery.prepare("SELECT Integrity FROM verifications WHERE fits_id = :id");
+    QSqlQuery solutionQuery;
+    solutionQuery.prepare("SELECT RaDegrees, DecDegrees, Rotation, Scale FROM plate_solutions WHERE fits_id = :id AND RaDegrees IS NOT NULL");
+    QList<AstroFile> page;
+    for (int id : ids)
+    {
+        fitsQuery.bindValue(":id", id);
+        if (!fitsQuery.exec() || !fitsQuery.first())
+            continue;
+        AstroFile astro = astroFileFromQuery(fitsQuery, FitsColumns(fitsQuery.record()));
+        fitsQuery.finish();
+
+        thumbnailQuery.bindValue(":id", id);
+        if (thumbnailQuery.exec() && thumbnailQuery.first())
+        {
+            astro.tinyThumbnail = ThumbnailCodec::decode(thumbnailQuery.value(0).toByteArray(), ThumbnailFormat(thumbnailQuery.value(1).toInt()));
+            astro.thumbnailStatus = ThumbnailLoaded;
+        }
+        thumbnailQuery.finish();
+
+        verificationQuery.bindValue(":id", id);
+        if (verificationQuery.exec() && verificationQuery.first())
+            astro.Integrity = AstroFileIntegrity(verificationQuery.value(0).toInt());
+        verificationQuery.finish();
+
+        solutionQuery.bindValue(":id", id);
+        if (solutionQuery.exec() && solutionQuery.first())
+        {
+            astro.Solution.ra = solutionQuery.value(0).toDouble();
+            astro.Solution.dec = solutionQuery.value(1).toDouble();
+            astro.Solution.rotation = solutionQuery.value(2).toDouble();
+            astro.Solution.scale = solutionQuery.value(3).toDouble();
+        }
+        solutionQuery.finish();
+
+        page.append(astro);
+        if (page.count() >= MODEL_PAGE_SIZE)
+        {
+            emit modelPageLoaded(page);
+            page.clear();
+        }
+    }
+    if (!page.isEmpty())
+        emit modelPageLoaded(page);
 }
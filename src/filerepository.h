@@ -26,54 +26,351 @@
 #define FILEREPOSITORY_H
 
 #include "astrofile.h"
+#include "directorystate.h"
+#include "filechange.h"
+#include "filerecord.h"
+#include "integrationstats.h"
+#include "repositoryrequest.h"
+#include "servedfile.h"
+#include "tagtailcodec.h"
+#include "thumbnailbatch.h"
+#include "thumbnailcodec.h"
+#include "thumbnailstore.h"
+#include "tinythumbnailatlas.h"
+#include "volumerecord.h"
 
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QHash>
+#include <QJsonObject>
 #include <QObject>
+#include <QPromise>
+#include <QSet>
 #include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QThreadPool>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+class QTimer;
+struct StretchOptions;
 
 class FileRepository : public QObject
 {
     Q_OBJECT
 public:
+    enum AccessMode
+    {
+        // The db is on a local disk and only used by this process
+        LocalAccess,
+        // The db is on a network share, read by other machines. WAL does not work there.
+        SharedWriterAccess,
+        // The db is written by an indexer on another machine, and followed with watchChanges
+        SharedReaderAccess,
+        // The db is a local copy of the catalog of a CatalogServer, only written by the CatalogClient
+        ReplicaAccess,
+    };
+
     FileRepository(QObject *parent = nullptr);
+    ~FileRepository();
+    // Stops the running request, and cancels the waiting maintenance requests
     void cancel();
 
+    // Thread safe. Runs work on the repository thread, before the waiting requests of
+    // a lower priority. The future is canceled if the token was canceled before work
+    // started. Long work checks the token between its chunks, see yieldRequests.
+    template <typename T>
+    QFuture<T> submit(RequestPriority priority, std::function<T(const CancellationToken&)> work, const CancellationToken& token = CancellationToken())
+    {
+        auto promise = QSharedPointer<QPromise<T>>::create();
+        QFuture<T> future = promise->future();
+        requests.push({priority, token, [promise, work, token](bool canceled) {
+            promise->start();
+            if (canceled)
+            {
+                promise->future().cancel();
+            }
+            else
+            {
+                if constexpr (std::is_void_v<T>)
+                    work(token);
+                else
+                    promise->addResult(work(token));
+            }
+            promise->finish();
+        }});
+        QMetaObject::invokeMethod(this, &FileRepository::runNextRequest, Qt::QueuedConnection);
+        return future;
+    }
+
+    static int schemaVersion();
+    static QString snapshotFilePath();
+    static QString databaseFilePath();
+    // Overrides the default location of the db, and of the snapshot next to it. Call before initialize.
+    static void setDatabaseFilePath(const QString& path);
+    // Must be called before initialize
+    static void setAccessMode(AccessMode mode);
+    static AccessMode accessMode();
+    // The files are indexed by another machine, this process only reads its catalog
+    static bool isIndexedElsewhere();
+    // Merges the catalog db at path into this one, see mergeCatalog in the .cpp.
+    // Returns the number of files merged, -1 if the db could not be merged.
+    int mergeCatalog(const QString& path);
+    // The portable catalog kept at the root of a volume, see exportVolumeCatalog in the .cpp
+    static QString volumeCatalogPath(const QString& rootPath);
+    // Writes what changed in the folders, all on the volume at rootPath, to its catalog.
+    // Returns the number of files written, -1 if the catalog could not be written.
+    int exportVolumeCatalog(const QString& rootPath, const QStringList& folders);
+    // Merges the catalog of the volume at rootPath, its files on volumeName. Returns the
+    // number of files merged, -1 if the catalog could not be merged.
+    int importVolumeCatalog(const QString& rootPath, const QString& volumeName);
+    // Thread safe, on a read-only connection of the calling thread. The paths of the
+    // files the db has that did not change since, see unchangedFiles in the .cpp.
+    static QSet<QString> unchangedFiles(const QVector<FileRecord>& files);
+    // Writes the catalog as CSV, or as an Arrow IPC stream to a .arrows path, see
+    // exportCatalog in the .cpp.
+    // Returns the number of files written, -1 if the file could not be written.
+    int exportCatalog(const QString& path);
+    // Stretches the thumbnails again from their linear thumbnails, see restretchThumbnails
+    // in the .cpp. Returns the number of files done, -1 if the thumbnails could not be read.
+    int restretchThumbnails(const StretchOptions& options);
+    // The frames and exposure of each object, filter and instrument, see createIntegrationStatsTable in the .cpp
+    QVector<IntegrationStats> integrationStats();
+    // Thread safe, on a read-only connection of the calling thread. The reports of the
+    // last ingests, the newest first, see addIngestRun in the .cpp.
+    static QList<QJsonObject> ingestRuns(int limit);
+    // Thread safe, on a read-only connection of the calling thread. The name and the
+    // expression of each saved SmartCollection.
+    static QList<QPair<QString, QString>> smartCollections();
+    // Thread safe, on a read-only connection of the calling thread. The first limit
+    // changes logged after seq, the oldest first, so syncing costs what changed.
+    static FileChanges changesSince(qint64 seq, int limit);
+    // Thread safe, on a read-only connection of the calling thread. The paths of every
+    // file in the db, for the CatalogReconciler of the command line indexer.
+    static QStringList filePaths();
+    qint64 catalogId() const;
+    qint64 changeCounter() const;
+    qint64 latestChangeSeq();
+    // The files of a page of the catalog as the CatalogServer sends them, see servedFilesAfter in the .cpp
+    QList<ServedFile> servedFilesAfter(int afterId, int limit, int level);
+    // The files at fullPaths the catalog has, for the changes the CatalogServer sends
+    QList<ServedFile> servedFilesAt(const QStringList& fullPaths, int level);
+    // The keywords of files whose header was edited, see updateHeaders in the .cpp
+    QList<AstroFile> updateHeaders(const QList<AstroFile>& astroFiles);
+    // The files to verify next, see IntegrityVerifier and verificationCandidates in the .cpp
+    QList<AstroFile> verificationCandidates(int limit, const QDateTime& verifiedBefore);
+    void recordVerifications(const QList<AstroFile>& astroFiles);
+    // The frames to plate solve next, see PlateSolver and solveCandidates in the .cpp
+    QList<AstroFile> solveCandidates(int limit);
+    void recordSolutions(const QList<AstroFile>& astroFiles);
+
 public slots:
     void deleteAstrofilesInFolder(const QString& fullPath);
+    // A removed search folder keeps its files hidden until it is added back, see detachFolder in the .cpp
+    void detachFolder(const QString& fullPath);
+    void attachFolder(const QString& fullPath);
+    void deleteAstrofiles(const QStringList& fullPaths);
+    void moveAstrofile(const AstroFile& astroFile);
+    void aliasAstrofile(const AstroFile& alias, int sourceId);
     void initialize();
     void loadModel();
     void addOrUpdateAstrofile(const AstroFile& afi);
-    void getDuplicateFiles();
-    void getDuplicateFilesByFileHash();
-    void getDuplicateFilesByImageHash();
+    void addOrUpdateAstrofiles(const QList<AstroFile>& astroFiles);
+    void getDuplicateFiles(const CancellationToken& token = CancellationToken());
+    void runMaintenance(const CancellationToken& token = CancellationToken());
+    // Runs the scheduled data migrations that run before the model is loaded, or the
+    // ones that run in the background after it, see runMigrations in the .cpp
+    void runMigrations(bool beforeLoad, const CancellationToken& token = CancellationToken());
     void loadThumbnal(const AstroFile& afi);
+    void loadThumbnails(const QVector<int>& ids, int level);
+    ThumbnailBatch readThumbnails(const QVector<int>& ids, int level);
+    void loadTags(int id);
+    void searchFiles(const QString& text, int generation);
+    void updateDirectoryManifest(const QList<DirectoryState>& updated, const QStringList& removed);
+    // The ingest journal, see journalIngestJobs in the .cpp
+    void journalIngestJobs(const QVector<FileRecord>& files);
+    void finishIngestJobs(const QStringList& fullPaths);
+    void loadIngestJobs();
+    void addIngestRun(const QJsonObject& report);
+    void saveSmartCollection(const QString& name, const QString& expression);
+    void deleteSmartCollection(const QString& name);
+    void recordVolume(const VolumeRecord& volume);
+    void remapVolume(const VolumeRecord& volume, const QString& oldRootPath);
+    void watchChanges(int interval);
+    void loadChanges();
 
 signals:
     void getAllAstroFilesFinished(const QList<AstroFile>& astroFiles );
     void getTagsFinished(const QMap<QString, QSet<QString>>& tags);
     void astroFileDeleted(const AstroFile& astroFile);
     void astroFilesDeleted(const QList<AstroFile>& astroFiles);
-    void modelLoaded(const QList<AstroFile>& astroFile);
+    void modelLoadingStarted(int totalCount);
+    // Before the pages of the snapshot, whose rows have their tiny thumbnails in it
+    void tinyThumbnailsLoaded(const TinyThumbnailAtlas& tinyThumbnails);
+    void modelPageLoaded(const QList<AstroFile>& astroFiles);
+    void modelLoadingProgress(int loadedCount, int totalCount);
+    void modelLoaded(int loadedCount);
+    void migrationProgress(const QString& step, int migratedCount, int totalCount);
     void dbFailedToInitialize(const QString& message);
     void astroFileUpdated(const AstroFile& astroFile);
-    void thumbnailLoaded(const AstroFile& astrofile);
-    void modelLoadingGotAstrofiles();
-    void modelLoadingGotTags();
-    void modelLoadingGotThumbnails();
+    // A hard link written with the row of the file it links to, it is not a job of the ingest
+    void astroFileAliased(const AstroFile& astroFile);
+    void thumbnailsLoaded(const ThumbnailBatch& batch);
+    void tagsLoaded(int id, const QMap<QString, QString>& tags);
+    void directoryManifestLoaded(const QList<DirectoryState>& directories);
+    void volumesLoaded(const QList<VolumeRecord>& volumes);
+    // The jobs of an ingest that was interrupted, to be queued again
+    void ingestJobsLoaded(const QVector<FileRecord>& files);
+    // Once the files and directories under oldRootPath are under newRootPath in the db
+    void volumeRemapped(const QString& oldRootPath, const QString& newRootPath);
+    void fileHashesResolved(const QList<AstroFile>& astroFiles);
+    void perceptualHashesResolved(const QList<AstroFile>& astroFiles);
+    // Only the Integrity of these files is up to date
+    void integrityVerified(const QList<AstroFile>& astroFiles);
+    // Only the Solution of these files is up to date
+    void platesSolved(const QList<AstroFile>& astroFiles);
+    void searchFinished(int generation, const QVector<int>& ids);
+
+private slots:
+    void runNextRequest();
 
 private:
+    struct MigrationStep
+    {
+        const char* name;
+        const char* label;
+        // Run before the model is loaded, as the catalog reads what they write
+        bool beforeLoad;
+        bool inTransaction;
+        // The rows left after :lastId, for the progress
+        const char* countQuery;
+        // Migrates the chunk after lastId and moves it past the chunk. Returns the
+        // number of rows migrated, 0 once done.
+        int (FileRepository::*migrateChunk)(qint64& lastId);
+    };
+    static const QList<MigrationStep>& migrationSteps();
+    // The .arrows export of exportCatalog
+    int exportArrowStream(const QString& path);
+
     QSqlDatabase db;
+    RequestQueue requests;
+    void runRequest(RequestQueue::Request& request);
+    void yieldRequests(RequestPriority priority);
     void createTables();
     void createDatabase();
     void migrateDatabase();
     void migrateFromVersion(int oldVersion);
-    int insertAstrofile(const AstroFile& afi);
-    void addTags(const AstroFile& astroFile);
-    void addThumbnail(const AstroFile& astroFile);
+    void createCatalogStateTable();
+    void loadCatalogState();
+    void incrementChangeCounter();
+    void createDirectoriesTable();
+    void createThumbnailLevelsTable();
+    void addThumbnailPackColumns();
+    int migrateThumbnailsToPacks(qint64& lastId);
+    void createTagTailsTable();
+    void createTagColumnIndexes();
+    void createFileChangesTable();
+    void createFileChangesTriggers();
+    void createSearchTable();
+    int migrateSearchKeywords(qint64& lastId);
+    void pruneFileChanges();
+    void migrateTagsToColumns();
+    int migrateSkyPositions(qint64& lastId);
+    int vacuumDatabase(qint64& lastId);
+    void createMigrationsTable();
+    void scheduleMigration(const QString& name);
+    void loadDirectoryManifest();
+    void createVolumesTable();
+    void createIngestJobsTable();
+    void createIntegrationStatsTable();
+    void rebuildIntegrationStats();
+    void createIngestRunsTable();
+    void createSmartCollectionsTable();
+    void createVerificationsTable();
+    void createPlateSolutionsTable();
+    void createTagDictionariesTable();
+    void loadTagDictionaries(QSqlDatabase connection);
+    void trainTagDictionary(const CancellationToken& token);
+    int migrateTagTails(qint64& lastId);
+    void loadVolumes();
+    void createDetachedFoldersTable();
+    void loadDetachedFolders();
+    bool forgetFoldersIn(const QString& path);
+    QString enclosingFolder(const QString& path) const;
+    bool isDetached(const QString& fullPath) const;
+    QString hiddenCondition(const QString& column, const QString& folder) const;
+    QString attachedCondition(const QString& column) const;
+    void purgeDetachedFolders();
+    QList<AstroFile> filesWhere(const QString& condition);
+    void deleteRowsInFolder(const QString& fullPath, const QString& condition);
+    void loadModelRows(const QVector<int>& ids);
+    void deleteDirectoriesInFolder(QSqlQuery& query, const QString& fullPath);
+    bool loadModelFromSnapshot();
+    void prepareFitsQueries(QSqlQuery& fitsQuery, QSqlQuery& idQuery);
+    int insertAstrofile(QSqlQuery& query, QSqlQuery& idQuery, const AstroFile& afi);
+    void addTags(QSqlQuery& query, QSqlQuery& deleteQuery, const AstroFile& astroFile);
+    void prepareThumbnailQueries(QSqlQuery& thumbnailQuery, QSqlQuery& levelQuery, QSqlQuery& packedQuery);
+    void addThumbnail(QSqlQuery& query, QSqlQuery& levelQuery, QSqlQuery& packedQuery, const AstroFile& astroFile);
+    bool storeThumbnailLevel(QSqlQuery& packedQuery, const QByteArray& data, ThumbnailLocation& location, QByteArray& contentHash);
+    int mergeCatalog(const QString& path, const QString& rootPath, const QString& volumeName, QVector<int>& mergedIds);
+    bool mergeThumbnailPacks(QSqlQuery& query, const QString& path);
+    bool createVolumeCatalog(QSqlQuery& query, const QString& path);
+    bool writeVolumeCatalog(QSqlQuery& query, const QString& path, const QString& rootPath, const QStringList& folders, qint64 changeSeq);
+    bool exportThumbnailPacks(QSqlQuery& query, const QString& path);
+    void resolveQuickHashCollisions(const QList<AstroFile>& astroFiles);
+    void writeFileHashes(const QList<AstroFile>& astroFiles);
+    QList<AstroFile> unresolvedCollisions();
+    void backfillQuickHashes(const CancellationToken& token);
+    void backfillPerceptualHashes(const CancellationToken& token);
     QList<AstroFile> getAstrofilesInFolder(const QString& fullPath);
-    QMap<int, AstroFile> _getAllAstrofiles();
-    QMap<int, QImage> _getAllThumbnails();
+    static QString folderPrefix(const QString& fullPath);
+    static QString folderPrefixEnd(const QString& prefix);
+    static QString folderRange(const QString& column, const QString& folder);
+    static QSqlDatabase readerConnection();
+    static void tuneConnection(QSqlDatabase& connection);
+    // A thumbnail as it is stored, before it is decoded
+    struct StoredThumbnail
+    {
+        int id;
+        QByteArray data;
+        ThumbnailFormat format;
+    };
+    QVector<StoredThumbnail> readStoredThumbnails(const QVector<int>& ids, int level);
+    void completeServedFiles(QList<ServedFile>& files, int level);
+    static QString thumbnailIdList();
+    static void bindThumbnailIds(QSqlQuery& query, const QVector<int>& ids, int from);
 
-    volatile bool cancelSignaled = false;
+    // Canceled on shutdown, checked by the long running requests
+    CancellationToken cancellationToken;
+    ThumbnailFormat thumbnailFormat;
+    std::unique_ptr<ThumbnailStore> thumbnailStore;
+    QAtomicInteger<qint64> _catalogId = 0;
+    QAtomicInteger<qint64> _changeCounter = 0;
+    // The file_changes the catalog already has, see loadChanges
+    qint64 lastChangeSeq = 0;
+    QTimer* changesTimer = nullptr;
+    // The removed search folders whose files are kept hidden, see detachFolder
+    QStringList detachedFolders;
+    // The folders added back in them, whose files are shown, see attachFolder
+    QStringList reattachedFolders;
+    // The last change written to the catalog of each volume, by its root, see exportVolumeCatalog
+    QHash<QString, qint64> exportedChangeSeqs;
+    // The keywords without a column, see TagTailCodec. The dictionaries are loaded
+    // from tag_dictionaries, the newest one encodes.
+    TagTailCodec tagTailCodec;
+    // The tails the newest dictionary was trained on
+    std::atomic<int> tagDictionaryFiles {0};
+    // The change counter and time of the last runMaintenance
+    qint64 maintainedChangeCounter = -1;
+    QElapsedTimer lastMaintenance;
+    // Reads the files of quick hash collisions in full, see resolveQuickHashCollisions.
+    // Last, so it is destroyed, waiting for its reads, before what they submit to.
+    QThreadPool collisionHashPool;
 };
 
 #endif // FILEREPOSITORY_H
@@ -23,19 +23,38 @@
 */
 
 #include "fileviewmodel.h"
-
+#include "calibrationindex.h"
+#include "integrityverifier.h"
+#include "memorybudget.h"
+#include "metrics.h"
+#include "stallwatchdog.h"
+#include "thumbnailtrace.h"
+
+#include <QElapsedTimer>
 #include <QIcon>
 #include <QPixmap>
-#include <QPixmapCache>
+#include <QSettings>
+
+#include <algorithm>
 
-FileViewModel::FileViewModel(QObject* parent) : QAbstractItemModel(parent)
+#define DEFAULT_THUMBNAIL_CACHE_MB 256
+
+FileViewModel::FileViewModel(QObject* parent)
+    : QAbstractItemModel(parent),
+      thumbnailCache(QSettings().value("ThumbnailCacheMB", DEFAULT_THUMBNAIL_CACHE_MB).toLongLong() * 1024 * 1024)
 {
     rc = 0;
     cc = 1;
+    memoryBudgetId = MemoryBudget::add("Thumbnails", MemoryBudget::ThumbnailEviction,
+                                       [this]() { return thumbnailCache.usedBytes(); },
+                                       [this](qint64 bytes) { return thumbnailCache.evict(bytes); });
 }
 
 FileViewModel::~FileViewModel()
 {
+    MemoryBudget::remove(memoryBudgetId);
+    qDebug() << "Thumbnail cache hits:" << thumbnailCache.hits() << "misses:" << thumbnailCache.misses()
+             << "used:" << thumbnailCache.usedBytes() / 1024 << "of" << thumbnailCache.budget() / 1024 << "KB";
 }
 
 void FileViewModel::setInitialModel(int count)
@@ -70,8 +89,9 @@ QModelIndex FileViewModel::index(int row, int column, const QModelIndex &parent)
     Q_UNUSED(parent);
     if (row < rc  && row >= 0 && column < cc && column >= 0)
     {
-        auto a = catalog->getAstroFile(row);
-        return createIndex(row, 0, a);
+        // A handle instead of the AstroFile, which the catalog replaces when the row is
+        // written again
+        return createIndex(row, 0, quintptr(catalog->handleOfRow(row)));
     }
     return QModelIndex();
 }
@@ -103,7 +123,8 @@ bool FileViewModel::removeRows(int row, int count, const QModelIndex &parent)
     // Do not "emit" astroFileDeleted, but instead call it directly.
     // Otherwise due to threading, the row will be wrong.
 //    emit astroFileDeleted(row);
-    catalog->deleteAstroFileRow(row);
+    for (int removed = row + count - 1; removed >= row; removed--)
+        catalog->deleteAstroFileRow(removed);
     return true;
 }
 
@@ -128,12 +149,61 @@ void FileViewModel::setCatalog(Catalog *cat)
     this->catalog = cat;
 }
 
+/*!
+ * \brief FileViewModel::setCellSize
+ * Only the size hints change, not the rows, so no layout change is emitted. That
+ * would make the proxy filter and sort every row again. The view lays its items out
+ * again when its icon size is set.
+ */
 void FileViewModel::setCellSize(const int newSize)
 {
-    emit layoutAboutToBeChanged();
     int size = 400 * newSize/100;
+    previousIconSize = iconSize();
     cellSize = QSize(size,size);
-    emit layoutChanged();
+    emit iconSizeChanged(iconSize());
+}
+
+QSize FileViewModel::iconSize() const
+{
+    return cellSize * 0.9;
+}
+
+/*!
+ * \brief FileViewModel::prefetchThumbnails
+ * Rows are given nearest first, the ThumbnailCache loads them in that order after the
+ * thumbnails of the visible rows.
+ */
+void FileViewModel::prefetchThumbnails(const QList<int> &rows)
+{
+    const QSize size = iconSize();
+    const int level = thumbnailLevelFor(qMax(size.width(), size.height()));
+
+    QList<AstroFile> astroFiles;
+    for (int row : rows)
+    {
+        if (row < 0 || row >= rc)
+            continue;
+        const AstroFile* a = catalog->getAstroFile(row);
+        if (a == nullptr || a->thumbnailStatus != ThumbnailLoaded || thumbnailCache.contains(thumbnailKey(a->Id, level, size)))
+            continue;
+        AstroFile request;
+        request.Id = a->Id;
+        request.thumbnailLevel = level;
+        astroFiles.append(request);
+    }
+    emit prefetchThumbnailsFromDb(astroFiles);
+}
+
+// Cache key of a level of the thumbnail pyramid of a file, scaled to the icon size
+QString FileViewModel::thumbnailKey(int id, int level, const QSize& size)
+{
+    return QString("%1/%2/%3").arg(id).arg(level).arg(size.width());
+}
+
+// Cache key of the tiny thumbnail of a file, shown until its thumbnail is loaded
+QString FileViewModel::placeholderKey(int id, const QSize &size)
+{
+    return QString("%1/tiny/%2").arg(id).arg(size.width());
 }
 
 QString FileViewModel::raConverter(QString ra) const
@@ -175,36 +245,80 @@ QString FileViewModel::decConverter(QString dec) const
 
 QVariant FileViewModel::data(const QModelIndex &index, int role) const
 {
+    // Per frame in the GUI benchmark
+    static std::atomic<qint64>& dataCalls = Metrics::counter("file_view.data_calls");
+    dataCalls.fetch_add(1, std::memory_order_relaxed);
+
     if (index.row() >= rc)
     {
         return QVariant();
     }
-    AstroFile a(*catalog->getAstroFile(index.row()));
+    // Read in place, the catalog owns the rows
+    const AstroFile* a = catalog->astroFileOfHandle(index.internalId());
+    if (a == nullptr)
+        return QVariant();
+    return roleData(a, role);
+}
+
+/*!
+ * \brief FileViewModel::multiData
+ * All the roles of the span from one look up of the row, for the views and the
+ * filters that read many roles of the same row.
+ */
+void FileViewModel::multiData(const QModelIndex &index, QModelRoleDataSpan roleDataSpan) const
+{
+    const AstroFile* a = index.row() < rc ? catalog->astroFileOfHandle(index.internalId()) : nullptr;
+    for (QModelRoleData& roleData : roleDataSpan)
+        roleData.setData(a != nullptr ? this->roleData(a, roleData.role()) : QVariant());
+}
 
+QVariant FileViewModel::roleData(const AstroFile *a, int role) const
+{
     switch (role)
     {
         case Qt::DisplayRole:
         {
-            return a.FileName;
+            return a->FileName;
         }
         case Qt::DecorationRole:
         {
-            QPixmap pixmap;
-            if (!QPixmapCache::find(QString::number(a.Id), &pixmap))
+            // The thumbnails come scaled to the icon size from the ThumbnailCache, and are
+            // kept as icons, so painting a cell does no scaling on the GUI thread.
+            const QSize size = iconSize();
+            const int level = thumbnailLevelFor(qMax(size.width(), size.height()));
+
+            QIcon icon;
+            const bool hit = thumbnailCache.find(thumbnailKey(a->Id, level, size), &icon);
+            if (ThumbnailTrace::isEnabled())
+                ThumbnailTrace::request(a->Id, level, size.width(), hit);
+            if (hit)
+                return icon;
+
+            if (a->thumbnailStatus == ThumbnailLoaded)
             {
-//                qDebug()<<"Requesting thumb from db for: " << a.Id;
-                emit loadThumbnailFromDb(a);
-                pixmap = QPixmap::fromImage(a.tinyThumbnail);
+//                qDebug()<<"Requesting thumb from db for: " << a->Id;
+                AstroFile request;
+                request.Id = a->Id;
+                request.thumbnailLevel = level;
+                emit loadThumbnailFromDb(request);
+
+                // Right after a cell size change, the thumbnail of the previous size
+                // is scaled when painted until the new one is loaded
+                const int previousLevel = thumbnailLevelFor(qMax(previousIconSize.width(), previousIconSize.height()));
+                if (previousIconSize.isValid() && thumbnailCache.find(thumbnailKey(a->Id, previousLevel, previousIconSize), &icon))
+                    return icon;
             }
 
-            pixmap = pixmap.scaled( cellSize*0.9, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            QIcon icon;
-//            for (auto state : {QIcon::Off, QIcon::On}){
-//                   for (auto mode : {QIcon::Normal, QIcon::Disabled, QIcon::Active, QIcon::Selected})
-//                       icon.addPixmap(pixmap, mode, state);
-//            }
-            icon.addPixmap(pixmap, QIcon::Normal);
-            icon.addPixmap(pixmap, QIcon::Selected);
+            const QString tinyKey = placeholderKey(a->Id, size);
+            if (!thumbnailCache.find(tinyKey, &icon))
+            {
+                // The placeholder hash of the row when its tiny thumbnail was dropped
+                QImage placeholder = catalog->tinyThumbnail(*a);
+                if (placeholder.isNull())
+                    placeholder = a->Placeholder.toImage();
+                thumbnailCache.insert(tinyKey, QPixmap::fromImage(placeholder).scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation));
+                thumbnailCache.find(tinyKey, &icon);
+            }
             return icon;
         }
         case Qt::SizeHintRole:
@@ -213,83 +327,99 @@ QVariant FileViewModel::data(const QModelIndex &index, int role) const
         }
         case AstroFileRoles::IdRole:
         {
-            return a.Id;
+            return a->Id;
         }
         case AstroFileRoles::ObjectRole:
         {
-            return a.Tags["OBJECT"];
+            return a->Object;
         }
         case AstroFileRoles::InstrumentRole:
         {
-            return a.Tags["INSTRUME"];
+            return a->Instrument;
         }
         case AstroFileRoles::FilterRole:
         {
-            return a.Tags["FILTER"];
+            return a->Filter;
         }
         case AstroFileRoles::DateRole:
         {
-            return a.Tags["DATE-OBS"];
+            return a->Tags.value(TagDateObs);
         }
         case AstroFileRoles::FullPathRole:
         {
-            return a.FullPath;
+            return a->FullPath;
         }
         case AstroFileRoles::DirectoryRole:
         {
-            return a.DirectoryPath;
+            return a->DirectoryPath;
         }
         case AstroFileRoles::VolumeNameRole:
         {
-            return a.VolumeName;
+            return a->VolumeName;
         }
         case AstroFileRoles::RaRole:
         {
-            return a.Tags["OBJCTRA"];
+            return a->Tags.value(TagObjectRa);
         }
         case AstroFileRoles::DecRole:
         {
-            return a.Tags["OBJCTDEC"];
+            return a->Tags.value(TagObjectDec);
         }
         case AstroFileRoles::CcdTempRole:
         {
-            return a.Tags["CCD-TEMP"];
+            return a->Tags.value(TagCcdTemp);
         }
         case AstroFileRoles::ImageXSizeRole:
         {
-            return a.Tags["NAXIS1"];
+            return a->Tags.value(TagWidth);
         }
         case AstroFileRoles::ImageYSizeRole:
         {
-            return a.Tags["NAXIS2"];
+            return a->Tags.value(TagHeight);
+        }
+        case AstroFileRoles::ImageZSizeRole:
+        {
+            return a->Tags.value("NAXIS3");
         }
         case AstroFileRoles::GainRole:
         {
-            return a.Tags["GAIN"];
+            return a->Tags.value(TagGain);
         }
         case AstroFileRoles::ExposureRole:
         {
-            return a.Tags["EXPTIME"];
+            return a->Tags.value(TagExposureTime);
         }
         case AstroFileRoles::BayerModeRole:
         {
-            return a.Tags["BAYERPAT"];
+            return a->Tags.value(TagBayerPattern);
         }
         case AstroFileRoles::OffsetRole:
         {
-            return a.Tags["BLKLEVEL"];
+            return a->Tags.value(TagBlackLevel);
         }
         case AstroFileRoles::FileTypeRole:
         {
-            return a.FileType;
+            return a->FileType;
         }
         case AstroFileRoles::FileExtensionRole:
         {
-            return a.FileExtension;
+            return a->FileExtension;
         }
         case AstroFileRoles::FileHashRole:
         {
-            return a.FileHash;
+            return a->duplicateKey();
+        }
+        case AstroFileRoles::FrameTypeRole:
+        {
+            return CalibrationIndex::frameTypeName(CalibrationIndex::frameType(*a));
+        }
+        case AstroFileRoles::IntegrityRole:
+        {
+            return IntegrityVerifier::integrityName(a->Integrity);
+        }
+        case AstroFileRoles::NightRole:
+        {
+            return a->ObservationNight;
         }
     }
 
@@ -298,33 +428,82 @@ QVariant FileViewModel::data(const QModelIndex &index, int role) const
 
 void FileViewModel::AddAstroFiles(int numberAdded)
 {
+    QElapsedTimer elapsed;
+    elapsed.start();
     insertRows(rc, numberAdded, QModelIndex());
+    catalog->reportNotificationCost(elapsed.elapsed());
 }
 
-void FileViewModel::UpdateAstroFile(AstroFile astroFile, int row)
+void FileViewModel::UpdateAstroFiles(int firstRow, int lastRow)
 {
-    auto index = createIndex(row, 0);
-    emit dataChanged(index, index);
+    QElapsedTimer elapsed;
+    elapsed.start();
+    emit dataChanged(index(firstRow, 0), index(lastRow, 0));
+    catalog->reportNotificationCost(elapsed.elapsed());
 }
 
 void FileViewModel::RemoveAstroFile(const AstroFile& astroFile)
 {
 //    qDebug()<<"Removed from model: " << astroFile.FullPath;
     int row = catalog->astroFileIndex(astroFile);
-    removeRow(row);
+    if (row >= 0 && row < rc)
+        removeRow(row);
 }
 
+/*!
+ * \brief FileViewModel::RemoveAstroFiles
+ * Removes the rows of the files as runs of contiguous rows, one removal signal per run,
+ * then the files from the catalog in one pass. The runs go from the last one, so the
+ * rows of the next run are still where the catalog has them when it is signaled.
+ */
 void FileViewModel::RemoveAstroFiles(const QList<AstroFile> &astroFiles)
 {
-    int row = catalog->astroFileIndex(astroFiles.first());
-    removeRows(row, astroFiles.count(), QModelIndex());
+    StallScope scope("FileViewModel::RemoveAstroFiles");
+    QVector<int> rows;
+    rows.reserve(astroFiles.count());
+    for (auto& astroFile : astroFiles)
+    {
+        int row = catalog->astroFileIndex(astroFile);
+        if (row >= 0 && row < rc)
+            rows.append(row);
+    }
+    if (rows.isEmpty())
+        return;
+    std::sort(rows.begin(), rows.end());
+
+    int last = rows.count() - 1;
+    while (last >= 0)
+    {
+        int first = last;
+        while (first > 0 && rows.at(first - 1) >= rows.at(first) - 1)
+            first--;
+        beginRemoveRows(QModelIndex(), rows.at(first), rows.at(last));
+        rc -= rows.at(last) - rows.at(first) + 1;
+        endRemoveRows();
+        last = first - 1;
+    }
+
+    catalog->deleteAstroFiles(astroFiles);
+    if (rc == 0)
+        emit modelIsEmpty(true);
 }
 
-void FileViewModel::addThumbnail(const AstroFile &astroFile)
+void FileViewModel::addThumbnails(const ThumbnailBatch &batch)
 {
-    int row = catalog->astroFileIndex(astroFile);
-    auto index = createIndex(row, 0);
-//    qDebug()<<"Inserting into PixmapCache: " << astroFile.Id << " row: " << row;
-    QPixmapCache::insert(QString::number(astroFile.Id), QPixmap::fromImage(astroFile.thumbnail));
-    emit dataChanged(index, index, {Qt::DecorationRole});
+    // Made for a cell size that is not shown anymore
+    if (batch.size != iconSize())
+        return;
+
+    for (int i = 0; i < batch.ids.count(); i++)
+    {
+        int row = catalog->astroFileIndex(batch.ids.at(i));
+        if (row < 0)
+            continue;
+        auto index = this->index(row, 0);
+        thumbnailCache.insert(thumbnailKey(batch.ids.at(i), batch.level, batch.size), QPixmap::fromImage(batch.images.at(i)));
+        thumbnailCache.remove(placeholderKey(batch.ids.at(i), batch.size));
+        if (ThumbnailTrace::isEnabled())
+            ThumbnailTrace::loaded(batch.ids.at(i), batch.level, batch.size.width());
+        emit dataChanged(index, index, {Qt::DecorationRole});
+    }
 }
@@ -27,6 +27,8 @@
 
 #include "astrofile.h"
 #include "catalog.h"
+#include "pixmapcache.h"
+#include "thumbnailbatch.h"
 
 #include <QAbstractItemModel>
 #include <QImage>
@@ -46,13 +48,20 @@ enum AstroFileRoles
     CcdTempRole,
     ImageXSizeRole,
     ImageYSizeRole,
+    ImageZSizeRole, // The planes of color images and data cubes, empty for 2D images
     GainRole,
     ExposureRole,
     BayerModeRole,
     OffsetRole,
     FileTypeRole,
     FileExtensionRole,
-    FileHashRole
+    FileHashRole,
+    FrameTypeRole,
+    IntegrityRole, // Of the last verification, see IntegrityVerifier, empty if there was none
+    NightRole, // The QDate of the observing night, see ObservingNight
+    // Of the groups of the GroupedFileModel
+    GroupFrameCountRole,
+    GroupIntegrationRole
 };
 
 class FileViewModel : public QAbstractItemModel
@@ -70,22 +79,32 @@ public:
     int rowCount(const QModelIndex &parent) const override;
     int columnCount(const QModelIndex &parent) const override;
     QVariant data(const QModelIndex &index, int role) const override;
+    void multiData(const QModelIndex &index, QModelRoleDataSpan roleDataSpan) const override;
     QModelIndex parent(const QModelIndex &child) const override;
     bool hasChildren(const QModelIndex &parent) const override;
     void setCatalog(Catalog* cat);
 
+    // Size of the thumbnails in the cells
+    QSize iconSize() const;
+
+    // Asks for the thumbnails of the source rows that are not in the cache yet,
+    // at the level of the current cell size
+    void prefetchThumbnails(const QList<int>& rows);
+
 public slots:
     void setCellSize(const int newSize);
     void setInitialModel(int count);
-    void addThumbnail(const AstroFile& astroFile);
+    void addThumbnails(const ThumbnailBatch& batch);
     void AddAstroFiles(int numberAdded);
-    void UpdateAstroFile(AstroFile astroFile, int row);
+    void UpdateAstroFiles(int firstRow, int lastRow);
     void RemoveAstroFile(const AstroFile& astroFile);
     void RemoveAstroFiles(const QList<AstroFile>& astroFiles);
 
 signals:
     void modelIsEmpty(bool isEmpty);
     void loadThumbnailFromDb(const AstroFile& astroFile) const;
+    void iconSizeChanged(const QSize& size);
+    void prefetchThumbnailsFromDb(const QList<AstroFile>& astroFiles);
     void astroFileDeleted(int row);
 
 private:
@@ -93,10 +112,16 @@ private:
     int cc;
 
     QSize cellSize = QSize(200, 200);
+    QSize previousIconSize; // Shown while the thumbnails of a new cell size load
+    mutable PixmapCache thumbnailCache;
+    int memoryBudgetId;
 
     Catalog* catalog;
+    QVariant roleData(const AstroFile* a, int role) const;
     QString raConverter(QString ra) const;
     QString decConverter(QString dec) const;
+    static QString thumbnailKey(int id, int level, const QSize& size);
+    static QString placeholderKey(int id, const QSize& size);
 };
 
 #endif // FILEVIEWMODEL_H
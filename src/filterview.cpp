@@ -23,29 +23,66 @@
 */
 
 #include "astrofile.h"
+#include "catalogcolumns.h"
 #include "filterview.h"
 #include "fileviewmodel.h"
+#include "memorybudget.h"
+#include "smartcollection.h"
+#include "stallwatchdog.h"
 
+#include <QCalendarWidget>
 #include <QCheckBox>
 #include <QDir>
+#include <QHBoxLayout>
+#include <QInputDialog>
 #include <QLabel>
+#include <QMessageBox>
 #include <QPushButton>
+#include <QTextCharFormat>
 #include <QToolButton>
 #include <QVBoxLayout>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+// The search starts once typing paused this long
+#define SEARCH_TYPING_DELAY 150
+
+// Facet lists grow with their values up to this many rows, and scroll after that
+#define FACET_LIST_MAX_VISIBLE_ROWS 12
+
+// Changes of the files of the nights are shown on the calendar at most this often
+#define NIGHT_CALENDAR_UPDATE_INTERVAL_MS 250
+
+// About what a node of a QSet or QMap takes besides its key
+#define CONTAINER_NODE_OVERHEAD 32
+
 FilterView::FilterView(QWidget *parent)
 {
     _parent = parent;
     vLayout = new QVBoxLayout;
 
-    folderModel = new FolderViewModel();
-
+    folderModel = new FolderViewModel(this);
+    objectsModel = new FacetModel(this);
+    instrumentsModel = new FacetModel(this);
+    filtersModel = new FacetModel(this);
+    extensionsModel = new FacetModel(this);
+    frameTypesModel = new FacetModel(this);
+    integrityModel = new FacetModel(this);
+
+    parent->layout()->addWidget(createSearchBox());
+    parent->layout()->addWidget(createCollectionsBox());
+    parent->layout()->addWidget(createIntegrationBox());
     parent->layout()->addWidget(createObjectsBox());
-    createDateBox();
-//    parent->layout()->addWidget(createDateBox());
+    parent->layout()->addWidget(createDateBox());
     parent->layout()->addWidget(createInstrumentsBox());
     parent->layout()->addWidget(createFiltersBox());
     parent->layout()->addWidget(createFileExtensionsBox());
+    parent->layout()->addWidget(createFrameTypesBox());
+    parent->layout()->addWidget(createIntegrityBox());
+    parent->layout()->addWidget(createSkyBox());
+    parent->layout()->addWidget(createQualityBox());
     parent->layout()->addWidget(createFoldersBox());
 
     QSpacerItem * spacer = new QSpacerItem(0,0, QSizePolicy::Expanding, QSizePolicy::Expanding);
@@ -57,6 +94,22 @@ FilterView::FilterView(QWidget *parent)
     folderTreeSelectionModel = new QItemSelectionModel(folderModel);
     foldersTreeView->setSelectionModel(folderTreeSelectionModel);
     connect(folderTreeSelectionModel, &QItemSelectionModel::selectionChanged, this, &FilterView::treeViewClicked);
+
+    memoryBudgetId = MemoryBudget::add("Filter state", MemoryBudget::NoEviction, [this]() { return memoryUsage(); });
+}
+
+FilterView::~FilterView()
+{
+    MemoryBudget::remove(memoryBudgetId);
+}
+
+// An estimate, for the MemoryBudget
+qint64 FilterView::memoryUsage() const
+{
+    qint64 bytes = acceptedAstroFiles.count() * (sizeof(int) + CONTAINER_NODE_OVERHEAD);
+    bytes += nightCounts.count() * (sizeof(QDate) + sizeof(int) + CONTAINER_NODE_OVERHEAD);
+    bytes += rowIntegrity.count() * (sizeof(int) + sizeof(QString) + CONTAINER_NODE_OVERHEAD);
+    return bytes;
 }
 
 void FilterView::setFilterMinimumDate(QDate date)
@@ -94,114 +147,530 @@ void FilterView::setFoldersModel(QAbstractItemModel* model)
 void FilterView::treeViewClicked(const QItemSelection &selected, const QItemSelection &deselected)
 {
     QModelIndex index = selected[0].indexes()[0];
-    QStringList paths;
-    auto itIndex = index;
-    while (itIndex != QModelIndex())
-    {
-        auto folder = folderModel->data(itIndex, Qt::DisplayRole).toString();
-        paths.prepend(folder);
-        itIndex = itIndex.parent();
-    }
-
-    int counter = 0;
-    QString volume;
-    QString fullPath;
-    for (auto path : paths)
-    {
-        if (counter == 0)
-        {
-            volume = path;
-            counter++;
-            continue;
-        }
-        fullPath = fullPath + "/" + path;
-    }
-    fullPath += "/";
+    const QString fullPath = folderModel->data(index, FolderViewModel::FolderPathRole).toString();
 
     selectedFoldersChanged(fullPath, 2);
 }
 
 void FilterView::resetGroups()
 {
+    StallScope scope("FilterView::resetGroups");
     minDateEdit->setDate(QDate());
     maxDateEdit->setDate(QDate());
-    addObjects();
 //    addDates();
-    addInstruments();
-    addFilters();
-    addFileExtensions();
 //    addFolders();
 }
 
-QWidget* FilterView::createObjectsBox()
+/*!
+ * \brief FilterView::createSearchBox
+ * Words looked up in the names, folders and keywords of the files, see
+ * FileRepository::searchFiles. The files shown follow the typing.
+ */
+QWidget* FilterView::createSearchBox()
 {
-    objectsGroup = new FilterGroupBox(tr("Objects"));
+    searchGroup = new FilterGroupBox(tr("Search"));
+    searchEdit = new QLineEdit();
+    searchEdit->setPlaceholderText("Ha 300s NGC7000");
+    searchEdit->setToolTip(tr("Shows the files that have all the words in their name, folder, object, instrument, telescope, filter, frame type, exposure or date"));
+    searchEdit->setClearButtonEnabled(true);
 
     QVBoxLayout *vbox = new QVBoxLayout;
-    vbox->addStretch(20);
-    objectsGroup->setLayout(vbox);
-//    objectsGroup->layout()->addItem(vbox);
+    vbox->addWidget(searchEdit);
+    searchGroup->setLayout(vbox);
+
+    searchTimer.setSingleShot(true);
+    searchTimer.setInterval(SEARCH_TYPING_DELAY);
+    connect(searchEdit, &QLineEdit::textChanged, this, [this]() { searchTimer.start(); });
+    connect(&searchTimer, &QTimer::timeout, this, [this]() { emit searchTextChanged(searchEdit->text().trimmed()); });
+
+    return searchGroup;
+}
 
+QWidget* FilterView::createObjectsBox()
+{
+    objectsGroup = createFacetBox(tr("Objects"), objectsModel, &FilterView::selectedObjectsChanged);
     return objectsGroup;
 }
 
+/*!
+ * \brief FilterView::createDateBox
+ * The nights with files are marked on a calendar, with their number of files. Clicking
+ * one shows its files, the arrows go to the night before or after with files, and the
+ * date edits show a range of nights.
+ */
 QWidget* FilterView::createDateBox()
 {
-    datesGroup = new FilterGroupBox(tr("Dates"));
+    datesGroup = new FilterGroupBox(tr("Nights"));
+
+    nightCalendar = new QCalendarWidget();
+    nightCalendar->setVerticalHeaderFormat(QCalendarWidget::NoVerticalHeader);
+    nightCalendar->setToolTip(tr("A night runs from noon to noon at the site, and is named by the date of its evening"));
+
+    QToolButton* previousButton = new QToolButton();
+    previousButton->setArrowType(Qt::LeftArrow);
+    previousButton->setToolTip(tr("The night before with files"));
+    QToolButton* nextButton = new QToolButton();
+    nextButton->setArrowType(Qt::RightArrow);
+    nextButton->setToolTip(tr("The night after with files"));
+    QPushButton* allButton = new QPushButton(tr("All Nights"));
+    nightLabel = new QLabel();
+
     minDateEdit = new QDateEdit();
     maxDateEdit = new QDateEdit();
+    minDateEdit->setCalendarPopup(true);
+    maxDateEdit->setCalendarPopup(true);
+    minDateEdit->setToolTip(tr("The first night shown"));
+    maxDateEdit->setToolTip(tr("The last night shown"));
 
-    minDateEdit->setToolTip("Feature Coming Soon");
-    maxDateEdit->setToolTip("Feature Coming Soon");
+    QHBoxLayout* navigation = new QHBoxLayout;
+    navigation->addWidget(previousButton);
+    navigation->addWidget(nextButton);
+    navigation->addWidget(nightLabel, 1);
+    navigation->addWidget(allButton);
 
     QVBoxLayout *vbox = new QVBoxLayout;
+    vbox->addWidget(nightCalendar);
+    vbox->addLayout(navigation);
     vbox->addWidget(minDateEdit);
     vbox->addWidget(maxDateEdit);
-    vbox->addStretch(1);
     datesGroup->setLayout(vbox);
-//    datesGroup->layout()->addItem(vbox);
-    minDateEdit->setDate(QDate::currentDate());
 
-    connect(minDateEdit, &QDateEdit::dateChanged, this, &FilterView::minimumDateChanged);
-    connect(maxDateEdit, &QDateEdit::dateChanged, this, &FilterView::maximumDateChanged);
+    connect(minDateEdit, &QDateEdit::dateChanged, this, [this](QDate date) { isNightRangeActive = true; emit minimumDateChanged(date); });
+    connect(maxDateEdit, &QDateEdit::dateChanged, this, [this](QDate date) { isNightRangeActive = true; emit maximumDateChanged(date); });
+    connect(nightCalendar, &QCalendarWidget::clicked, this, &FilterView::showNight);
+    connect(previousButton, &QToolButton::clicked, this, [this]() { stepNight(-1); });
+    connect(nextButton, &QToolButton::clicked, this, [this]() { stepNight(1); });
+    connect(allButton, &QPushButton::clicked, this, &FilterView::showAllNights);
+
+    nightsTimer.setSingleShot(true);
+    nightsTimer.setInterval(NIGHT_CALENDAR_UPDATE_INTERVAL_MS);
+    connect(&nightsTimer, &QTimer::timeout, this, &FilterView::updateNightCalendar);
 
     return datesGroup;
 }
 
-QWidget* FilterView::createInstrumentsBox()
+void FilterView::setDateEdits(const QDate &minDate, const QDate &maxDate)
+{
+    minDateEdit->blockSignals(true);
+    maxDateEdit->blockSignals(true);
+    minDateEdit->setDate(minDate);
+    maxDateEdit->setDate(maxDate);
+    minDateEdit->blockSignals(false);
+    maxDateEdit->blockSignals(false);
+}
+
+void FilterView::showNight(const QDate &night)
+{
+    isNightRangeActive = true;
+    setDateEdits(night, night);
+    nightCalendar->setSelectedDate(night);
+    emit minimumDateChanged(night);
+    emit maximumDateChanged(night);
+}
+
+/*!
+ * \brief FilterView::stepNight
+ * The nights are sorted, so the one before or after the selected night is a binary
+ * search, however many nights have no files in between.
+ */
+void FilterView::stepNight(int direction)
+{
+    if (nightCounts.isEmpty())
+        return;
+
+    const QMap<QDate, int>& nights = nightCounts;
+    const QDate selected = nightCalendar->selectedDate();
+    auto night = direction > 0 ? nights.upperBound(selected) : nights.lowerBound(selected);
+    if (direction < 0)
+    {
+        if (night == nights.constBegin())
+            return;
+        --night;
+    }
+    if (night != nights.constEnd())
+        showNight(night.key());
+}
+
+void FilterView::showAllNights()
+{
+    isNightRangeActive = false;
+    if (!nightCounts.isEmpty())
+        setDateEdits(nightCounts.firstKey(), nightCounts.lastKey());
+    emit minimumDateChanged(QDate());
+    emit maximumDateChanged(QDate());
+}
+
+void FilterView::changeNightCount(const QDate &night, int change)
+{
+    if (!night.isValid())
+        return;
+    int& count = nightCounts[night];
+    count += change;
+    if (count <= 0)
+        nightCounts.remove(night);
+    changedNights.insert(night);
+    if (!nightsTimer.isActive())
+        nightsTimer.start();
+}
+
+/*!
+ * \brief FilterView::updateNightCalendar
+ * Marks the nights whose number of files changed, and keeps the calendar and the date
+ * edits within the first and the last night.
+ */
+void FilterView::updateNightCalendar()
 {
-    instrumentsGroup = new FilterGroupBox(tr("Instruments"));
+    for (const QDate& night : std::as_const(changedNights))
+    {
+        auto it = nightCounts.constFind(night);
+        QTextCharFormat format;
+        if (it != nightCounts.constEnd())
+        {
+            format.setFontWeight(QFont::Bold);
+            format.setToolTip(tr("%n file(s)", nullptr, it.value()));
+        }
+        nightCalendar->setDateTextFormat(night, format);
+    }
+    changedNights.clear();
 
+    if (nightCounts.isEmpty())
+    {
+        nightLabel->clear();
+        return;
+    }
+    const QDate first = nightCounts.firstKey();
+    const QDate last = nightCounts.lastKey();
+    nightCalendar->setDateRange(first, last);
+    nightLabel->setText(tr("%n night(s)", nullptr, nightCounts.count()));
+    if (!isNightRangeActive)
+        setDateEdits(first, last);
+}
+
+/*!
+ * \brief FilterView::createSkyBox
+ * A position, typed in sexagesimal or degrees, and the radius of the cone or the half
+ * width of the box around it. The files pointed there are shown, whatever their OBJECT.
+ */
+QWidget* FilterView::createSkyBox()
+{
+    skyGroup = new FilterGroupBox(tr("Sky Position"));
+    skyPositionEdit = new QLineEdit();
+    skyPositionEdit->setPlaceholderText("00 42 44 +41 16 09");
+    skyPositionEdit->setToolTip(tr("Right ascension and declination, as hours and degrees (00:42:44 +41:16:09) or both in degrees (10.68 41.27)"));
+    skyPositionEdit->setClearButtonEnabled(true);
+
+    skyShapeCombo = new QComboBox();
+    skyShapeCombo->addItem(tr("Within radius"), SkyRegion::ConeShape);
+    skyShapeCombo->addItem(tr("Within box"), SkyRegion::BoxShape);
+
+    skySizeSpin = new QDoubleSpinBox();
+    skySizeSpin->setRange(0.01, 90);
+    skySizeSpin->setDecimals(2);
+    skySizeSpin->setValue(2);
+    skySizeSpin->setSuffix(QString(QChar(0x00B0)));
+
+    QHBoxLayout *hbox = new QHBoxLayout;
+    hbox->addWidget(skyShapeCombo);
+    hbox->addWidget(skySizeSpin);
     QVBoxLayout *vbox = new QVBoxLayout;
-    vbox->addStretch(1);
-    instrumentsGroup->setLayout(vbox);
-//    instrumentsGroup->layout()->addItem(vbox);
+    vbox->addWidget(skyPositionEdit);
+    vbox->addLayout(hbox);
+    skyGroup->setLayout(vbox);
+
+    connect(skyPositionEdit, &QLineEdit::editingFinished, this, &FilterView::skyRegionEdited);
+    connect(skyPositionEdit, &QLineEdit::textChanged, this, [this](const QString& text) {
+        // The clear button only changes the text
+        if (text.isEmpty())
+            skyRegionEdited();
+    });
+    connect(skyShapeCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &FilterView::skyRegionEdited);
+    connect(skySizeSpin, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, &FilterView::skyRegionEdited);
+
+    return skyGroup;
+}
 
-    return instrumentsGroup;
+/*!
+ * \brief FilterView::setSkyRegion
+ * The size is rounded up to the decimals of the box, so the region is not made smaller.
+ */
+void FilterView::setSkyRegion(const SkyRegion &region)
+{
+    skyPositionEdit->blockSignals(true);
+    skyShapeCombo->blockSignals(true);
+    skySizeSpin->blockSignals(true);
+    skyPositionEdit->setText(QString("%1 %2").arg(region.ra, 0, 'f', 4).arg(region.dec, 0, 'f', 4));
+    skyShapeCombo->setCurrentIndex(qMax(0, skyShapeCombo->findData(region.shape)));
+    skySizeSpin->setValue(std::ceil(region.size * 100) / 100);
+    skyPositionEdit->blockSignals(false);
+    skyShapeCombo->blockSignals(false);
+    skySizeSpin->blockSignals(false);
+    skyRegionEdited();
 }
 
-QWidget *FilterView::createFiltersBox()
+void FilterView::skyRegionEdited()
+{
+    SkyRegion region;
+    if (SkyCoordinates::parsePosition(skyPositionEdit->text(), region.ra, region.dec))
+    {
+        region.shape = SkyRegion::Shape(skyShapeCombo->currentData().toInt());
+        region.size = skySizeSpin->value();
+    }
+    // A position that does not parse shows every file, like an empty one
+    skyPositionEdit->setStyleSheet(region.isActive() || skyPositionEdit->text().isEmpty() ? QString() : "color: red");
+    emit skyRegionChanged(region);
+}
+
+/*!
+ * \brief FilterView::createQualityBox
+ * Limits on the quality measured when the frames were processed, see FrameAnalyzer.
+ * At their minimum the limits are off, and the frames that were not measured show.
+ */
+QWidget* FilterView::createQualityBox()
 {
-    filtersGroup = new FilterGroupBox(tr("Filters"));
+    qualityGroup = new FilterGroupBox(tr("Quality"));
+
+    maxFwhmSpin = new QDoubleSpinBox();
+    maxFwhmSpin->setRange(0, 50);
+    maxFwhmSpin->setDecimals(1);
+    maxFwhmSpin->setSingleStep(0.5);
+    maxFwhmSpin->setPrefix(tr("FWHM at most "));
+    maxFwhmSpin->setSuffix(tr(" px"));
+    maxFwhmSpin->setSpecialValueText(tr("Any FWHM"));
+    maxFwhmSpin->setToolTip(tr("The median FWHM of the stars, in pixels of the full frame"));
+
+    minStarsSpin = new QSpinBox();
+    minStarsSpin->setRange(0, 100000);
+    minStarsSpin->setSingleStep(10);
+    minStarsSpin->setPrefix(tr("At least "));
+    minStarsSpin->setSuffix(tr(" stars"));
+    minStarsSpin->setSpecialValueText(tr("Any number of stars"));
+    minStarsSpin->setToolTip(tr("Clouds and dew take stars away"));
 
     QVBoxLayout *vbox = new QVBoxLayout;
-    vbox->addStretch(1);
-    filtersGroup->setLayout(vbox);
-//    filtersGroup->layout()->addItem(vbox);
+    vbox->addWidget(maxFwhmSpin);
+    vbox->addWidget(minStarsSpin);
+    qualityGroup->setLayout(vbox);
+
+    auto limitsEdited = [this]() { emit qualityLimitsChanged(maxFwhmSpin->value(), minStarsSpin->value()); };
+    connect(maxFwhmSpin, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, limitsEdited);
+    connect(minStarsSpin, QOverload<int>::of(&QSpinBox::valueChanged), this, limitsEdited);
+
+    return qualityGroup;
+}
 
+/*!
+ * \brief FilterView::createIntegrationBox
+ * The integration time of each object, filter and instrument among the files shown,
+ * the longest first.
+ */
+QWidget* FilterView::createIntegrationBox()
+{
+    integrationGroup = new FilterGroupBox(tr("Integration"));
+
+    integrationTree = new QTreeWidget();
+    integrationTree->setColumnCount(6);
+    integrationTree->setHeaderLabels({tr("Object"), tr("Filter"), tr("Instrument"), tr("Frames"), tr("Exposure"), tr("Dates")});
+    integrationTree->setRootIsDecorated(false);
+    integrationTree->setUniformRowHeights(true);
+    integrationTree->setMinimumHeight(FACET_LIST_MAX_VISIBLE_ROWS * integrationTree->fontMetrics().height());
+
+    QVBoxLayout *vbox = new QVBoxLayout;
+    vbox->addWidget(integrationTree);
+    integrationGroup->setLayout(vbox);
+    return integrationGroup;
+}
+
+/*!
+ * \brief FilterView::createCollectionsBox
+ * The saved smart collections and how many files each has. Selecting one shows its
+ * files, clearing the selection shows every file again.
+ */
+QWidget* FilterView::createCollectionsBox()
+{
+    collectionsGroup = new FilterGroupBox(tr("Collections"));
+
+    collectionsTree = new QTreeWidget();
+    collectionsTree->setColumnCount(2);
+    collectionsTree->setHeaderLabels({tr("Collection"), tr("Files")});
+    collectionsTree->setRootIsDecorated(false);
+    collectionsTree->setUniformRowHeights(true);
+    collectionsTree->setSelectionMode(QAbstractItemView::SingleSelection);
+    connect(collectionsTree, &QTreeWidget::itemSelectionChanged, this, [this]() {
+        QList<QTreeWidgetItem*> selected = collectionsTree->selectedItems();
+        emit smartCollectionOpened(selected.isEmpty() ? QString() : selected.first()->text(0));
+    });
+
+    QMenu* menu = new QMenu();
+    connect(menu->addAction(tr("New Collection...")), &QAction::triggered, this, &FilterView::newSmartCollection);
+    connect(menu->addAction(tr("Delete Collection")), &QAction::triggered, this, [this]() {
+        QList<QTreeWidgetItem*> selected = collectionsTree->selectedItems();
+        if (!selected.isEmpty())
+            emit smartCollectionDeleted(selected.first()->text(0));
+    });
+    connect(menu->addAction(tr("Show All Files")), &QAction::triggered, collectionsTree, &QTreeWidget::clearSelection);
+    collectionsGroup->addToolButtonMenu(menu);
+
+    QVBoxLayout *vbox = new QVBoxLayout;
+    vbox->addWidget(collectionsTree);
+    collectionsGroup->setLayout(vbox);
+    return collectionsGroup;
+}
+
+// Asks again until the expression compiles or the user gives up
+void FilterView::newSmartCollection()
+{
+    bool ok = false;
+    const QString name = QInputDialog::getText(this, tr("New Collection"), tr("Name:"), QLineEdit::Normal, QString(), &ok).trimmed();
+    if (!ok || name.isEmpty())
+        return;
+
+    QString expression = "type:Light filter:Ha days:30";
+    for (;;)
+    {
+        expression = QInputDialog::getText(this, tr("New Collection"),
+                                           tr("Files with all of: object, instrument, filter, type, ext, folder, date, days, temp, exposure"),
+                                           QLineEdit::Normal, expression, &ok);
+        if (!ok)
+            return;
+        SmartCollection collection;
+        QString error;
+        if (SmartCollection::compile(name, expression, collection, error))
+            break;
+        QMessageBox::warning(this, tr("New Collection"), error);
+    }
+    emit smartCollectionSaved(name, expression);
+}
+
+void FilterView::setSmartCollections(const QList<QPair<QString, int>> &counts)
+{
+    QList<QTreeWidgetItem*> selected = collectionsTree->selectedItems();
+    const QString selectedName = selected.isEmpty() ? QString() : selected.first()->text(0);
+
+    // Rebuilt without opening the selected collection again
+    QSignalBlocker blocker(collectionsTree);
+    collectionsTree->clear();
+    for (auto& count : counts)
+    {
+        QTreeWidgetItem* item = new QTreeWidgetItem({count.first, QString::number(count.second)});
+        collectionsTree->addTopLevelItem(item);
+        if (count.first == selectedName)
+            item->setSelected(true);
+    }
+    collectionsGroup->setTitle(counts.isEmpty() ? tr("Collections") : tr("Collections: %1").arg(counts.count()));
+}
+
+void FilterView::setFacetProjections(const QVector<QHash<QString, int>> &projections)
+{
+    const QHash<QString, int> none;
+    auto projectionOf = [&](CatalogColumns::Facet facet) -> const QHash<QString, int>& {
+        return facet < projections.count() ? projections.at(facet) : none;
+    };
+    objectsModel->setProjectedCounts(projectionOf(CatalogColumns::ObjectFacet));
+    instrumentsModel->setProjectedCounts(projectionOf(CatalogColumns::InstrumentFacet));
+    filtersModel->setProjectedCounts(projectionOf(CatalogColumns::FilterFacet));
+    extensionsModel->setProjectedCounts(projectionOf(CatalogColumns::ExtensionFacet));
+    frameTypesModel->setProjectedCounts(projectionOf(CatalogColumns::FrameTypeFacet));
+    integrityModel->setProjectedCounts(projectionOf(CatalogColumns::IntegrityFacet));
+}
+
+void FilterView::setIntegrationStats(const QVector<IntegrationStats> &stats)
+{
+    QVector<IntegrationStats> sorted = stats;
+    std::sort(sorted.begin(), sorted.end(), [](const IntegrationStats& a, const IntegrationStats& b) {
+        return a.TotalExposure > b.TotalExposure;
+    });
+
+    double totalExposure = 0;
+    QList<QTreeWidgetItem*> items;
+    for (auto& group : sorted)
+    {
+        totalExposure += group.TotalExposure;
+        QString dates;
+        if (group.FirstDate.isValid())
+            dates = group.FirstDate == group.LastDate ? group.FirstDate.toString(Qt::ISODate)
+                                                      : QString("%1 - %2").arg(group.FirstDate.toString(Qt::ISODate), group.LastDate.toString(Qt::ISODate));
+        items.append(new QTreeWidgetItem({group.Object, group.Filter, group.Instrument, QString::number(group.FrameCount),
+                                          IntegrationStats::formatDuration(group.TotalExposure), dates}));
+    }
+    integrationTree->clear();
+    integrationTree->addTopLevelItems(items);
+    integrationGroup->setTitle(tr("Integration: %1").arg(IntegrationStats::formatDuration(totalExposure)));
+}
+
+QWidget* FilterView::createInstrumentsBox()
+{
+    instrumentsGroup = createFacetBox(tr("Instruments"), instrumentsModel, &FilterView::selectedInstrumentsChanged);
+    return instrumentsGroup;
+}
+
+QWidget *FilterView::createFiltersBox()
+{
+    filtersGroup = createFacetBox(tr("Filters"), filtersModel, &FilterView::selectedFiltersChanged);
     return filtersGroup;
 }
 
 QWidget *FilterView::createFileExtensionsBox()
 {
-    extensionsGroup = new FilterGroupBox(tr("Extensions"));
+    extensionsGroup = createFacetBox(tr("Extensions"), extensionsModel, &FilterView::selectedFileExtensionsChanged);
+    return extensionsGroup;
+}
+
+/*!
+ * \brief FilterView::createFrameTypesBox
+ * Lights, darks, flats and bias frames, from IMAGETYP. Narrows the frames shown by the
+ * matching calibration action to one type.
+ */
+QWidget *FilterView::createFrameTypesBox()
+{
+    frameTypesGroup = createFacetBox(tr("Frame Types"), frameTypesModel, &FilterView::selectedFrameTypesChanged);
+    return frameTypesGroup;
+}
+
+/*!
+ * \brief FilterView::createIntegrityBox
+ * The files found intact, changed or unreadable when they were last verified, see
+ * IntegrityVerifier. Files not verified yet are in none.
+ */
+QWidget *FilterView::createIntegrityBox()
+{
+    integrityGroup = createFacetBox(tr("Integrity"), integrityModel, &FilterView::selectedIntegrityChanged);
+    return integrityGroup;
+}
+
+/*!
+ * \brief FilterView::createFacetBox
+ * A group with a list view of the values of one facet. The view only draws the
+ * visible rows, so it stays fast with thousands of values.
+ */
+FilterGroupBox *FilterView::createFacetBox(const QString &title, FacetModel *facetModel, void (FilterView::*func)(QString, int))
+{
+    FilterGroupBox* group = new FilterGroupBox(title);
+
+    QListView* listView = new QListView();
+    listView->setModel(facetModel);
+    listView->setUniformItemSizes(true);
+    listView->setSelectionMode(QAbstractItemView::NoSelection);
+    listView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    listView->setFrameShape(QFrame::NoFrame);
+    listView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 
     QVBoxLayout *vbox = new QVBoxLayout;
-    vbox->addStretch(1);
-    extensionsGroup->setLayout(vbox);
-//    extensionsGroup->layout()->addItem(vbox);
+    vbox->addWidget(listView);
+    group->setLayout(vbox);
 
-    return extensionsGroup;
+    connect(facetModel, &FacetModel::checkStateChanged, this, func);
+    connect(facetModel, &FacetModel::rowsInserted, this, [=]() { fitFacetList(listView); });
+    connect(facetModel, &FacetModel::rowsRemoved, this, [=]() { fitFacetList(listView); });
+    fitFacetList(listView);
+
+    return group;
+}
+
+void FilterView::fitFacetList(QListView *listView)
+{
+    int rows = qMin(listView->model()->rowCount(), FACET_LIST_MAX_VISIBLE_ROWS);
+    int rowHeight = rows > 0 ? listView->sizeHintForRow(0) : 0;
+    listView->setFixedHeight(rows * rowHeight + 2 * listView->frameWidth());
 }
 
 QWidget *FilterView::createFoldersBox()
@@ -235,21 +704,64 @@ QMenu *FilterView::createFoldersOptionsMenu()
     return myMenu;
 }
 
+namespace
+{
+// The roles of a row the facets count
+struct FacetRoles
+{
+    int id;
+    QString object;
+    QString instrument;
+    QString filter;
+    QDate night;
+    QString directoryPath;
+    QString volumeName;
+    QString fileExtension;
+    QString frameType;
+    QString integrity;
+    double exposure; // 0 without a valid EXPTIME
+};
+
+FacetRoles facetRoles(const QAbstractItemModel* model, const QModelIndex& index)
+{
+    // Read with one call, which looks the row up once
+    std::array<QModelRoleData, 11> roles = {{
+        QModelRoleData(AstroFileRoles::IdRole),
+        QModelRoleData(AstroFileRoles::ObjectRole),
+        QModelRoleData(AstroFileRoles::InstrumentRole),
+        QModelRoleData(AstroFileRoles::FilterRole),
+        QModelRoleData(AstroFileRoles::NightRole),
+        QModelRoleData(AstroFileRoles::DirectoryRole),
+        QModelRoleData(AstroFileRoles::VolumeNameRole),
+        QModelRoleData(AstroFileRoles::FileExtensionRole),
+        QModelRoleData(AstroFileRoles::FrameTypeRole),
+        QModelRoleData(AstroFileRoles::ExposureRole),
+        QModelRoleData(AstroFileRoles::IntegrityRole),
+    }};
+    model->multiData(index, roles);
+    bool exposureOk = false;
+    double exposure = roles[9].data().toDouble(&exposureOk);
+    return {roles[0].data().toInt(), roles[1].data().toString(), roles[2].data().toString(), roles[3].data().toString(),
+            roles[4].data().toDate(), roles[5].data().toString(), roles[6].data().toString(), roles[7].data().toString(),
+            roles[8].data().toString(), roles[10].data().toString(), exposureOk ? exposure : 0};
+}
+}
+
 void FilterView::rowsInserted(const QModelIndex &parent, int start, int end)
 {
+    QList<QPair<QString, QString>> volumeFolders;
     for (int i = start; i <= end; i++)
     {
-        QModelIndex index = model()->index(i, 0, parent);
-        auto data = model()->data(index);
-        auto id = model()->data(index, AstroFileRoles::IdRole).toInt();
-        auto object = model()->data(index, AstroFileRoles::ObjectRole).toString();
-        auto instrument = model()->data(index, AstroFileRoles::InstrumentRole).toString();
-        auto filter = model()->data(index, AstroFileRoles::FilterRole).toString();
-        auto date = model()->data(index, AstroFileRoles::DateRole).toString();
-        auto fullPath = model()->data(index, AstroFileRoles::FullPathRole).toString();
-        auto directoryPath = model()->data(index, AstroFileRoles::DirectoryRole).toString();
-        auto volumeName = model()->data(index, AstroFileRoles::VolumeNameRole).toString();
-        auto fileExtension = model()->data(index, AstroFileRoles::FileExtensionRole).toString();
+        const FacetRoles roles = facetRoles(model(), model()->index(i, 0, parent));
+        const int id = roles.id;
+        const QString& object = roles.object;
+        const QString& instrument = roles.instrument;
+        const QString& filter = roles.filter;
+        const QDate& night = roles.night;
+        const QString& directoryPath = roles.directoryPath;
+        const QString& volumeName = roles.volumeName;
+        const QString& fileExtension = roles.fileExtension;
+        const QString& frameType = roles.frameType;
 
         if (acceptedAstroFiles.contains(id))
         {
@@ -258,101 +770,111 @@ void FilterView::rowsInserted(const QModelIndex &parent, int start, int end)
         else
         {
             if (!object.isEmpty())
-                fileTags["OBJECT"][object]++;
+                objectsModel->addValue(object, roles.exposure);
             if (!instrument.isEmpty())
-                fileTags["INSTRUME"][instrument]++;
+                instrumentsModel->addValue(instrument, roles.exposure);
             if (!filter.isEmpty())
-                fileTags["FILTER"][filter]++;
-            if (!date.isEmpty())
-                fileTags["DATE-OBS"][date]++;
+                filtersModel->addValue(filter, roles.exposure);
+            changeNightCount(night, 1);
             if (!fileExtension.isEmpty())
-                fileTags["FILEEXT"][fileExtension]++;
+                extensionsModel->addValue(fileExtension);
+            if (!frameType.isEmpty())
+                frameTypesModel->addValue(frameType);
+            if (!roles.integrity.isEmpty())
+            {
+                integrityModel->addValue(roles.integrity);
+                rowIntegrity.insert(id, roles.integrity);
+            }
             acceptedFolders[directoryPath]++;
             acceptedAstroFiles.insert(id);
-            folderModel->addItem(volumeName, directoryPath);
+            volumeFolders.append(qMakePair(volumeName, directoryPath));
         }
     }
+    folderModel->addItems(volumeFolders);
 
 //    foldersTreeView->expandToDepth(2);
     emit astroFileAdded(end-start+1);
-    // We should not nuke all groups
-    resetGroups();
 }
 
 void FilterView::rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end)
 {
+    QList<QPair<QString, QString>> volumeFolders;
     for (int i = start; i <= end; i++)
     {
-        QModelIndex index = model()->index(i, 0, parent);
-        auto data = model()->data(index);
-        auto id = model()->data(index, AstroFileRoles::IdRole).toInt();
-        auto object = model()->data(index, AstroFileRoles::ObjectRole).toString();
-        auto instrument = model()->data(index, AstroFileRoles::InstrumentRole).toString();
-        auto filter = model()->data(index, AstroFileRoles::FilterRole).toString();
-        auto date = model()->data(index, AstroFileRoles::DateRole).toString();
-        auto fullPath = model()->data(index, AstroFileRoles::FullPathRole).toString();
-        auto directoryPath = model()->data(index, AstroFileRoles::DirectoryRole).toString();
-        auto volumeName = model()->data(index, AstroFileRoles::VolumeNameRole).toString();
-        auto fileExtension = model()->data(index, AstroFileRoles::FileExtensionRole).toString();
+        const FacetRoles roles = facetRoles(model(), model()->index(i, 0, parent));
+        const int id = roles.id;
+        const QString& object = roles.object;
+        const QString& instrument = roles.instrument;
+        const QString& filter = roles.filter;
+        const QDate& night = roles.night;
+        const QString& directoryPath = roles.directoryPath;
+        const QString& volumeName = roles.volumeName;
+        const QString& fileExtension = roles.fileExtension;
+        const QString& frameType = roles.frameType;
 
         if (acceptedAstroFiles.contains(id))
         {
             if (!object.isEmpty())
-                fileTags["OBJECT"][object]--;
+                objectsModel->removeValue(object, roles.exposure);
             if (!instrument.isEmpty())
-                fileTags["INSTRUME"][instrument]--;
+                instrumentsModel->removeValue(instrument, roles.exposure);
             if (!filter.isEmpty())
-                fileTags["FILTER"][filter]--;
-            if (!date.isEmpty())
-                fileTags["DATE-OBS"][date]--;
+                filtersModel->removeValue(filter, roles.exposure);
+            changeNightCount(night, -1);
             if (!fileExtension.isEmpty())
-                fileTags["FILEEXT"][fileExtension]--;
+                extensionsModel->removeValue(fileExtension);
+            if (!frameType.isEmpty())
+                frameTypesModel->removeValue(frameType);
+            const QString integrity = rowIntegrity.take(id);
+            if (!integrity.isEmpty())
+                integrityModel->removeValue(integrity);
             acceptedFolders[directoryPath]--;
             acceptedAstroFiles.remove(id);
-            folderModel->removeItem(volumeName, directoryPath);
+            volumeFolders.append(qMakePair(volumeName, directoryPath));
         }
     }
+    folderModel->removeItems(volumeFolders);
     emit astroFileRemoved(end-start+1);
-    // We should not nuke all groups
-    resetGroups();
 }
 
-void FilterView::clearLayout(QLayout* layout)
+/*!
+ * \brief FilterView::dataChanged
+ * Rows keep their other facets while they are in the view, the Integrity changes when
+ * the file is verified.
+ */
+void FilterView::dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles)
 {
-    QLayoutItem* child;
-    while ((child = layout->takeAt(0)) != 0)
+    QListView::dataChanged(topLeft, bottomRight, roles);
+    for (int i = topLeft.row(); i <= bottomRight.row(); i++)
     {
-        delete child->widget();
-        delete child;
+        const QModelIndex index = model()->index(i, 0, topLeft.parent());
+        const int id = model()->data(index, AstroFileRoles::IdRole).toInt();
+        if (!acceptedAstroFiles.contains(id))
+            continue;
+        const QString integrity = model()->data(index, AstroFileRoles::IntegrityRole).toString();
+        const QString previous = rowIntegrity.value(id);
+        if (integrity == previous)
+            continue;
+        if (!previous.isEmpty())
+            integrityModel->removeValue(previous);
+        if (integrity.isEmpty())
+            rowIntegrity.remove(id);
+        else
+        {
+            integrityModel->addValue(integrity);
+            rowIntegrity.insert(id, integrity);
+        }
     }
 }
 
-void FilterView::addDates()
+void FilterView::clearLayout(QLayout* layout)
 {
-    QDate minDate, maxDate;
-
-    auto& o = fileTags["DATE-OBS"];
-    QMapIterator setiter(o);
-    while (setiter.hasNext())
+    QLayoutItem* child;
+    while ((child = layout->takeAt(0)) != 0)
     {
-        QString n = setiter.next().key();
-        QDate d = QDate::fromString(n, Qt::ISODate);
-        if (d < minDate) minDate = d;
-        if (d > maxDate) maxDate = d;
+        delete child->widget();
+        delete child;
     }
-
-    // Disable the date pickers until we fix them.
-    minDateEdit->blockSignals(true);
-    minDateEdit->setDate(minDate);
-    minDateEdit->setReadOnly(true);
-    minDateEdit->setEnabled(false);
-    minDateEdit->blockSignals(false);
-
-    maxDateEdit->blockSignals(true);
-    maxDateEdit->setDate(maxDate);
-    maxDateEdit->setReadOnly(true);
-    maxDateEdit->setEnabled(false);
-    maxDateEdit->blockSignals(false);
 }
 
 QCheckBox *FilterView::findCheckBox(QGroupBox *group, QList<QCheckBox *> &checkBoxes, QString titleProperty, void (FilterView::*func)(QString, int))
@@ -380,86 +902,6 @@ QCheckBox *FilterView::findCheckBox(QGroupBox *group, QList<QCheckBox *> &checkB
     return checkBox;
 }
 
-void FilterView::addObjects()
-{
-    auto& o = fileTags["OBJECT"];
-    QMapIterator setiter(o);
-    while (setiter.hasNext())
-    {
-        auto next = setiter.next();
-        QString name = next.key();
-        int num = next.value();
-        QString tagText = QString("%1 (%2)").arg(name).arg(num);
-
-        QCheckBox* checkBox = findCheckBox(objectsGroup, objectsCheckBoxes, name, &FilterView::selectedObjectsChanged);
-
-        checkBox->setEnabled(num != 0);
-        if (checkedTags.contains("OBJ_"+name))
-            checkBox->setChecked(true);
-        checkBox->setText(tagText);
-    }
-}
-
-void FilterView::addInstruments()
-{
-    auto& o = fileTags["INSTRUME"];
-    QMapIterator setiter(o);
-    while (setiter.hasNext())
-    {
-        auto next = setiter.next();
-        QString name = next.key();
-        int num = next.value();
-        QString tagText = QString("%1 (%2)").arg(name).arg(num);
-
-        QCheckBox* checkBox = findCheckBox(instrumentsGroup, instrumentsCheckBoxes, name, &FilterView::selectedInstrumentsChanged);
-
-        checkBox->setEnabled(num != 0);
-        if (checkedTags.contains("INS_"+name))
-            checkBox->setChecked(true);
-        checkBox->setText(tagText);
-    }
-}
-
-void FilterView::addFilters()
-{
-    auto& o = fileTags["FILTER"];
-    QMapIterator setiter(o);
-    while (setiter.hasNext())
-    {
-        auto next = setiter.next();
-        QString name = next.key();
-        int num = next.value();
-        QString tagText = QString("%1 (%2)").arg(name).arg(num);
-
-        QCheckBox* checkBox = findCheckBox(filtersGroup, filtersCheckBoxes, name, &FilterView::selectedFiltersChanged);
-
-        checkBox->setEnabled(num != 0);
-        if (checkedTags.contains("FIL_"+name))
-            checkBox->setChecked(true);
-        checkBox->setText(tagText);
-    }
-}
-
-void FilterView::addFileExtensions()
-{
-    auto& o = fileTags["FILEEXT"];
-    QMapIterator setiter(o);
-    while (setiter.hasNext())
-    {
-        auto next = setiter.next();
-        QString name = next.key();
-        int num = next.value();
-        QString tagText = QString("%1 (%2)").arg(name).arg(num);
-
-        QCheckBox* checkBox = findCheckBox(extensionsGroup, extensionsCheckBoxes, name, &FilterView::selectedFileExtensionsChanged);
-
-        checkBox->setEnabled(num != 0);
-        if (checkedTags.contains("EXT_"+name))
-            checkBox->setChecked(true);
-        checkBox->setText(tagText);
-    }
-}
-
 void FilterView::addFolders()
 {
     auto& o = acceptedFolders;
@@ -541,6 +983,36 @@ void FilterView::selectedFileExtensionsChanged(QString object, int state)
     }
 }
 
+void FilterView::selectedFrameTypesChanged(QString object, int state)
+{
+    switch (state)
+    {
+    case 0:
+        checkedTags.remove("TYP_"+object);
+        emit removeAcceptedFrameType(object);
+        break;
+    case 2:
+        checkedTags.insert("TYP_"+object);
+        emit addAcceptedFrameType(object);
+        break;
+    }
+}
+
+void FilterView::selectedIntegrityChanged(QString object, int state)
+{
+    switch (state)
+    {
+    case 0:
+        checkedTags.remove("INT_"+object);
+        emit removeAcceptedIntegrity(object);
+        break;
+    case 2:
+        checkedTags.insert("INT_"+object);
+        emit addAcceptedIntegrity(object);
+        break;
+    }
+}
+
 void FilterView::selectedFoldersChanged(QString object, int state)
 {
     switch (state)
@@ -26,16 +26,28 @@
 #define FILTERVIEW_H
 
 #include "astrofile.h"
+#include "facetmodel.h"
 #include "filtergroupbox.h"
 #include "folderviewmodel.h"
+#include "integrationstats.h"
+#include "skycoordinates.h"
 
 #include <QAbstractItemView>
+#include <QCalendarWidget>
 #include <QCheckBox>
+#include <QComboBox>
 #include <QDateEdit>
+#include <QDoubleSpinBox>
 #include <QGroupBox>
+#include <QHash>
+#include <QLabel>
+#include <QLineEdit>
 #include <QListView>
 #include <QObject>
+#include <QSpinBox>
+#include <QTimer>
 #include <QTreeView>
+#include <QTreeWidget>
 #include <QVBoxLayout>
 
 class FilterView : public QListView
@@ -43,6 +55,7 @@ class FilterView : public QListView
     Q_OBJECT
 public:
     explicit FilterView(QWidget *parent = nullptr);
+    ~FilterView();
 
 public slots:
     void setFilterMinimumDate(QDate date);
@@ -52,6 +65,14 @@ public slots:
     void foldersIncludeSubfolders();
 
     void setFoldersModel(QAbstractItemModel* model);
+    // Of the files that pass the filters, see SortFilterProxyModel::integrationStats
+    void setIntegrationStats(const QVector<IntegrationStats>& stats);
+    // By facet, see SortFilterProxyModel::facetProjectionsChanged
+    void setFacetProjections(const QVector<QHash<QString, int>>& projections);
+    // The name and the number of files of each smart collection, see Catalog::smartCollectionCounts
+    void setSmartCollections(const QList<QPair<QString, int>>& counts);
+    // Fills in the sky position box, and filters to the region
+    void setSkyRegion(const SkyRegion& region);
     void treeViewClicked(const QItemSelection &selected, const QItemSelection &deselected);
 
 signals:
@@ -67,6 +88,20 @@ signals:
     void removeAcceptedExtension(QString objectName);
     void addAcceptedFolder(QString objectName, bool includeSubfolders);
     void removeAcceptedFolder(QString objectName);
+    void addAcceptedFrameType(QString frameType);
+    void removeAcceptedFrameType(QString frameType);
+    void addAcceptedIntegrity(QString integrity);
+    void removeAcceptedIntegrity(QString integrity);
+    void skyRegionChanged(const SkyRegion& region);
+    // 0 for a limit that is off
+    void qualityLimitsChanged(double maxFwhm, int minStarCount);
+    // Empty when the search is cleared
+    void searchTextChanged(const QString& text);
+    // Empty when every file is shown again
+    void smartCollectionOpened(const QString& name);
+    // The expression compiles, see SmartCollection
+    void smartCollectionSaved(const QString& name, const QString& expression);
+    void smartCollectionDeleted(const QString& name);
     void astroFileAdded(int numberAdded);
     void astroFileRemoved(int numberRemoved);
 
@@ -79,18 +114,42 @@ private:
     FilterGroupBox* extensionsGroup;
     FilterGroupBox* datesGroup;
     FilterGroupBox* foldersGroup;
+    FilterGroupBox* frameTypesGroup;
+    FilterGroupBox* integrityGroup;
+    FilterGroupBox* searchGroup;
+    QLineEdit* searchEdit;
+    QTimer searchTimer;
+    FilterGroupBox* skyGroup;
+    QLineEdit* skyPositionEdit;
+    QComboBox* skyShapeCombo;
+    QDoubleSpinBox* skySizeSpin;
+    FilterGroupBox* integrationGroup;
+    QTreeWidget* integrationTree;
+    FilterGroupBox* collectionsGroup;
+    QTreeWidget* collectionsTree;
+    FilterGroupBox* qualityGroup;
+    QDoubleSpinBox* maxFwhmSpin;
+    QSpinBox* minStarsSpin;
     QDateEdit* minDateEdit;
     QDateEdit* maxDateEdit;
+    QCalendarWidget* nightCalendar;
+    QLabel* nightLabel;
+    QMap<QDate, int> nightCounts; // Files of each observing night, see ObservingNight
+    QSet<QDate> changedNights; // Not shown on the calendar yet
+    QTimer nightsTimer;
+    bool isNightRangeActive = false; // Whether the date edits filter
     QTreeView* foldersTreeView;
     QItemSelectionModel* folderTreeSelectionModel;
 
     FilterGroupBox* myGroup;
     FolderViewModel* folderModel;
 
-    QList<QCheckBox*> objectsCheckBoxes;
-    QList<QCheckBox*> instrumentsCheckBoxes;
-    QList<QCheckBox*> filtersCheckBoxes;
-    QList<QCheckBox*> extensionsCheckBoxes;
+    FacetModel* objectsModel;
+    FacetModel* instrumentsModel;
+    FacetModel* filtersModel;
+    FacetModel* extensionsModel;
+    FacetModel* frameTypesModel;
+    FacetModel* integrityModel;
     QList<QCheckBox*> foldersCheckBoxes;
     QCheckBox* findCheckBox(QGroupBox* group, QList<QCheckBox*>& checkBoxes, QString titleProperty, void (FilterView::* func)(QString,int));
 
@@ -99,22 +158,36 @@ private:
     QWidget* createInstrumentsBox();
     QWidget* createFiltersBox();
     QWidget* createFileExtensionsBox();
+    QWidget* createFrameTypesBox();
+    QWidget* createIntegrityBox();
     QWidget* createFoldersBox();
+    QWidget* createSkyBox();
+    QWidget* createQualityBox();
+    QWidget* createIntegrationBox();
+    QWidget* createCollectionsBox();
+    void newSmartCollection();
+    QWidget* createSearchBox();
+    void skyRegionEdited();
+    FilterGroupBox* createFacetBox(const QString& title, FacetModel* facetModel, void (FilterView::* func)(QString,int));
+    void fitFacetList(QListView* listView);
 
     QMenu* createFoldersOptionsMenu();
 
     QSet<int> acceptedAstroFiles;
-    QMap<QString, QMap<QString,int>> fileTags;
+    QHash<int, QString> rowIntegrity; // Of the rows that were verified, by id
     QMap<QString, int> acceptedFolders;
     QSet<QString> checkedTags;
+    int memoryBudgetId;
+    qint64 memoryUsage() const;
 
     bool bFoldersIncludeSubfolders = true;
 
-    void addObjects();
-    void addDates();
-    void addInstruments();
-    void addFilters();
-    void addFileExtensions();
+    void setDateEdits(const QDate& minDate, const QDate& maxDate);
+    void showNight(const QDate& night);
+    void stepNight(int direction);
+    void showAllNights();
+    void changeNightCount(const QDate& night, int change);
+    void updateNightCalendar();
     void addFolders();
     void resetGroups();
     void clearLayout(QLayout* layout);
@@ -122,12 +195,15 @@ private:
     void selectedInstrumentsChanged(QString object, int state);
     void selectedFiltersChanged(QString object, int state);
     void selectedFileExtensionsChanged(QString object, int state);
+    void selectedFrameTypesChanged(QString object, int state);
+    void selectedIntegrityChanged(QString object, int state);
     void selectedFoldersChanged(QString object, int state);
 
     // QAbstractItemView interface
 protected slots:
     void rowsInserted(const QModelIndex &parent, int start, int end);
     void rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end);
+    void dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles = QList<int>()) override;
 };
 
 #endif // FILTERVIEW_H
@@ -23,21 +23,82 @@
 */
 
 
+#include "allocationtracker.h"
 #include "autostretcher.h"
 
 #include "fitsfile.h"
+#include "fitsheaderscanner.h"
+#include "frameanalyzer.h"
+#include "framebufferpool.h"
+#include "gpubinner.h"
+#include "metrics.h"
 
-#include <QCryptographicHash>
+#include "hasher.h"
+
+#include <algorithm>
+#include <vector>
+
+// Stored pixels are converted and hashed this many at a time
+#define HASH_BLOCK_PIXELS (64 * 1024)
+
+// Rows read by cfitsio between two checks of the cancellation token
+#define READ_BAND_ROWS 256
+
+// Pixels read around the tiles of bayer images, for the interpolation at their edges.
+// The 5x5 neighbourhood of DemosaicVng needs two.
+#define BAYER_TILE_MARGIN 2
+
+// Planes of a data cube the image is the mean of, see readCube
+#define CUBE_SAMPLED_PLANES 16
 
 FitsFile::FitsFile()
 {
     _fptr = 0;
+    _memData = nullptr;
+    _memSize = 0;
+    _thumbnailSize = 0;
+    _imageHdu = 0;
+    _demosaicMethod = DemosaicSuperpixel;
+    _stretchParams = StretchParams();
+    _hasStretchParams = false;
+    _shouldHashImage = true;
+    _shouldAnalyzeFrame = false;
+    _shouldMakeLinearImage = false;
+    _fitsDataType = 0;
+    _fullWidth = 0;
+    _fullHeight = 0;
+    _planes = 1;
+    _bscale = 1;
+    _bzero = 0;
 }
 
 FitsFile::~FitsFile()
 {
-    int status = 0;
-    fits_close_file(_fptr, &status);
+    close();
+}
+
+void FitsFile::close()
+{
+    if (_fptr != 0)
+    {
+        int status = 0;
+        fits_close_file(_fptr, &status);
+        _fptr = 0;
+    }
+    _memData = nullptr;
+    _memSize = 0;
+    _imageHdu = 0;
+    _fitsDataType = 0;
+    _bscale = 1;
+    _bzero = 0;
+    _frameQuality = FrameQuality();
+    _stars.clear();
+    _tags.clear();
+    _qImage = QImage();
+    _linearImage = QImage();
+    _imageHash.clear();
+    _stretchParams = StretchParams();
+    _hasStretchParams = false;
 }
 
 #define CHK_STATUS(status) { if (status)  \
@@ -56,65 +117,127 @@ bool FitsFile::loadFile(QString filePath)
     return status == 0;
 }
 
-void FitsFile::extractTags()
+bool FitsFile::loadFile(QString filePath, const uchar *data, qint64 size)
 {
-    int hdupos, nkeys;
-    char card[FLEN_CARD];
+    // cfitsio only decompresses gzipped files (.fits.gz) itself when it opens them by name
+    if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+        return loadFile(filePath);
+
+    // Opened read-only, cfitsio does not write to or reallocate this buffer
     int status = 0;
+    _memData = const_cast<uchar*>(data);
+    _memSize = size;
+    fits_open_memfile(&_fptr, filePath.toStdString().c_str(), READONLY, &_memData, &_memSize, 0, NULL, &status);
 
-    fits_get_hdu_num(_fptr, &hdupos);
+    return status == 0;
+}
 
-    while (!status)
+/*!
+ * \brief FitsFile::findImageHdu
+ * The number of the first HDU with a 2D (or 3D) image, the primary one or an extension.
+ * Tile compressed images (fpack) are in binary table extensions, which cfitsio
+ * reports as image HDUs. Returns 0 when the file has no image.
+ */
+int FitsFile::findImageHdu()
+{
+    int status = 0;
+    for (int hdu = 1; ; hdu++)
     {
-        hdupos++;
-        fits_get_hdrspace(_fptr, &nkeys, NULL, &status);
+        int hduType;
+        if (fits_movabs_hdu(_fptr, hdu, &hduType, &status))
+            return 0;
+        if (hduType != IMAGE_HDU)
+            continue;
 
-        for (int i = 1; i <= nkeys; i++)
-        {
-           if (fits_read_record(_fptr, i, card, &status))
-               break;
-
-           char keyname[FLEN_KEYWORD];
-           char keyvalue[FLEN_VALUE];
-           char comment[FLEN_COMMENT];
+        int bitpix, naxis = 0;
+        long long naxes[3] = {0, 0, 0};
+        if (fits_get_img_paramll(_fptr, 3, &bitpix, &naxis, naxes, &status))
+            return 0;
+        if (naxis >= 2 && naxes[0] > 0 && naxes[1] > 0)
+            return hdu;
+    }
+}
 
-           fits_read_keyn(_fptr,i, keyname, keyvalue, comment, &status);
-           _tags.insert(QString(keyname).remove("'").trimmed(), QString(keyvalue).remove("'").trimmed());
-        }
+/*!
+ * \brief FitsFile::extractTags
+ * The keywords of the primary header, and of the image extension when the image is
+ * in one. The keywords of the image take precedence.
+ */
+void FitsFile::extractTags()
+{
+    if (_imageHdu == 0)
+        _imageHdu = findImageHdu();
 
-        fits_movrel_hdu(_fptr, 1, NULL, &status);
-    }
+    readHeader(1);
+    if (_imageHdu > 1)
+        readHeader(_imageHdu);
 }
 
-QByteArray calculateHash(QByteArray &array)
+void FitsFile::readHeader(int hdu)
 {
-    QCryptographicHash hash(QCryptographicHash::Sha1);
-    return hash.hash(array,QCryptographicHash::Sha1);
+    int nkeys;
+    int status = 0;
+
+    if (fits_movabs_hdu(_fptr, hdu, NULL, &status))
+        return;
+    bool compressed = fits_is_compressed_image(_fptr, &status);
+    fits_get_hdrspace(_fptr, &nkeys, NULL, &status);
+
+    for (int i = 1; i <= nkeys && !status; i++)
+    {
+       char keyname[FLEN_KEYWORD];
+       char keyvalue[FLEN_VALUE];
+       char comment[FLEN_COMMENT];
+
+       if (fits_read_keyn(_fptr, i, keyname, keyvalue, comment, &status))
+           break;
+       QString keyword = QString(keyname).remove("'").trimmed();
+
+       // The image keywords of a compressed image are kept as ZBITPIX, ZNAXIS, ZNAXISn
+       if (compressed)
+       {
+           if (FitsHeaderScanner::isCompressedTableKeyword(keyword))
+               continue;
+           if (keyword == "ZBITPIX" || keyword.startsWith("ZNAXIS"))
+               keyword.remove(0, 1);
+       }
+       _tags.insert(keyword, QString(keyvalue).remove("'").trimmed());
+    }
 }
 
-void FitsFile::extractImage()
+/*!
+ * \brief FitsFile::readImageParams
+ * Moves to the image HDU and reads its size, pixel type and channels. Returns false
+ * when the file has no 2D image.
+ */
+bool FitsFile::readImageParams(int& bitpix)
 {
     int status = 0;
-    int imageType;
     _qImageFormat = QImage::Format::Format_Invalid;
 
-    fits_get_img_type(_fptr, &imageType, &status);
-    CHK_STATUS(status);
-
-    fits_get_img_equivtype(_fptr, &_imageEquivType, &status);
-    CHK_STATUS(status);
+    if (_imageHdu == 0)
+        _imageHdu = findImageHdu();
+    if (_imageHdu == 0)
+        return false;
+    if (fits_movabs_hdu(_fptr, _imageHdu, NULL, &status) || fits_get_img_equivtype(_fptr, &_imageEquivType, &status))
+    {
+        char err_text[1024];
+        fits_get_errstatus(status, err_text);
+        qDebug() << err_text;
+        return false;
+    }
 
-    int fitsDataType = 0;
     long long naxesLongLongArr[3] = {0,0,0};
-    int bitpix, naxis;
+    int naxis = 0;
 
-    fits_get_img_paramll(_fptr, 2, &bitpix, &naxis, naxesLongLongArr, &status);
+    fits_get_img_paramll(_fptr, 3, &bitpix, &naxis, naxesLongLongArr, &status);
 
     if (naxis < 2)
     {
         // Not a 2D Image
-        return;
+        return false;
     }
+    readScaledAsStored(bitpix);
 
     if (_tags.contains("BAYERPAT"))
     {
@@ -122,450 +245,835 @@ void FitsFile::extractImage()
             _bayerPattern = BayerPattern::RGGB;
         else if (_tags["BAYERPAT"] == "BGGR")
             _bayerPattern = BayerPattern::BGGR;
+        else if (_tags["BAYERPAT"] == "GRBG")
+            _bayerPattern = BayerPattern::GRBG;
+        else if (_tags["BAYERPAT"] == "GBRG")
+            _bayerPattern = BayerPattern::GBRG;
         else _bayerPattern = BayerPattern::Unsupported;
     }
     else
         _bayerPattern = BayerPattern::None;
 
-    _numberOfChannels = _tags.contains("BAYERPAT") || _tags.value("NAXIS3") == "3"? 3: 1;
+    _numberOfChannels = _tags.contains("BAYERPAT") || (naxis == 3 && naxesLongLongArr[2] == 3) ? 3: 1;
 
     _width = naxesLongLongArr[0];
     _height = naxesLongLongArr[1];
-    long long numberOfPixels = _width * _height;
-    _bytesPerPixel = 0;
-
-    switch (_imageEquivType)
-    {
-    case BYTE_IMG:
-        fitsDataType = TBYTE;
-        _bytesPerPixel = sizeof(int8_t);
-        break;
-    case SHORT_IMG:
-        fitsDataType = TUSHORT;
-        _bytesPerPixel = sizeof(int16_t);
-        break;
-    case LONG_IMG:
-        fitsDataType = TULONG;
-        _bytesPerPixel = sizeof(int32_t);
-        break;
-    case LONGLONG_IMG:
-        fitsDataType = TLONGLONG;
-        _bytesPerPixel = sizeof(int64_t);
-        break;
-    case FLOAT_IMG:
-        fitsDataType = TFLOAT;
-        _bytesPerPixel = sizeof(float);
-        break;
-    case DOUBLE_IMG:
-        fitsDataType = TDOUBLE;
-        _bytesPerPixel = sizeof(double);
-        break;
-    case SBYTE_IMG:
-        fitsDataType = TBYTE;
-        _bytesPerPixel = sizeof(int8_t);
-        break;
-    case USHORT_IMG:
-        fitsDataType = TUSHORT;
-        _bytesPerPixel = sizeof(uint16_t);
-        break;
-    case ULONG_IMG:
-        fitsDataType = TULONG;
-        _bytesPerPixel = sizeof(uint32_t);
-        break;
-    case ULONGLONG_IMG:
-        fitsDataType = TULONGLONG;
-        _bytesPerPixel = sizeof(int64_t);
-        break;
-    }
+    _planes = naxis >= 3 ? qMax(1LL, naxesLongLongArr[2]) : 1;
+    _fullWidth = _width;
+    _fullHeight = _height;
+    _fitsDataType = visitFitsSampleType(_imageEquivType, [](auto sample) { return FitsSampleType<decltype(sample)>::dataType; });
+    _bytesPerPixel = visitFitsSampleType(_imageEquivType, [](auto sample) { return int(sizeof(sample)); });
 
     _qImageFormat = _numberOfChannels == 3 ? QImage::Format::Format_RGB32 : QImage::Format::Format_Grayscale8;
+    return _fitsDataType != 0;
+}
 
-    _data = new unsigned char[numberOfPixels * _bytesPerPixel * _numberOfChannels];
-    fits_movabs_hdu(_fptr, 1, IMAGE_HDU, &status);
-    CHK_STATUS(status);
-    int m_FITSBITPIX, ndim;
-    long naxes[3];
-    fits_get_img_param(_fptr, 3, &m_FITSBITPIX, &ndim, naxes, &status);
-    CHK_STATUS(status);
-
-    fits_read_img(_fptr, fitsDataType, 1, numberOfPixels, NULL, _data, NULL, &status);
-    CHK_STATUS(status);
-
-    auto hashData = QByteArray((char*)_data, numberOfPixels * _bytesPerPixel * _numberOfChannels);
-    _imageHash = calculateHash(hashData);
-
-    if (_numberOfChannels == 3)
-    switch (_imageEquivType)
-    {
-    case BYTE_IMG:
-        deBayer<int8_t>();
-        break;
-    case SHORT_IMG:
-        deBayer<int16_t>();
-        break;
-    case LONG_IMG:
-        deBayer<int32_t>();
-        break;
-    case LONGLONG_IMG:
-        deBayer<int64_t>();
-        break;
-    case FLOAT_IMG:
-        deBayer<float>();
-        break;
-    case DOUBLE_IMG:
-        deBayer<double>();
-        break;
-    case SBYTE_IMG:
-        deBayer<int8_t>();
-        break;
-    case USHORT_IMG:
-        deBayer<uint16_t>();
-        break;
-    case ULONG_IMG:
-        deBayer<uint32_t>();
-        break;
-    case ULONGLONG_IMG:
-        deBayer<int64_t>();
-        break;
-    }
-
-    switch (_imageEquivType)
-    {
-        case BYTE_IMG:
-        {
-            AutoStretcher<int8_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((int8_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<int8_t>();
-            break;
-        }
-        case SHORT_IMG:
-        {
-            AutoStretcher<int16_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((int16_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<int16_t>();
-            break;
-        }
-        case LONG_IMG:
-        {
-            AutoStretcher<int32_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((int32_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<int32_t>();
-            break;
-        }
-        case LONGLONG_IMG:
-        {
-            AutoStretcher<int64_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((int64_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<int64_t>();
-            break;
-        }
-        case FLOAT_IMG:
-        {
-            AutoStretcher<float> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((float*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<float>();
-            break;
-        }
-        case DOUBLE_IMG:
-        {
-            AutoStretcher<double> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((double*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<double>();
-            break;
-        }
-        case SBYTE_IMG:
+void FitsFile::extractImage(int thumbnailSize)
+{
+    static AllocationCounter& decodeAllocations = AllocationTracker::counter("fits.decode");
+    AllocationScope allocations(decodeAllocations);
+    _thumbnailSize = thumbnailSize;
+    int status = 0;
+    _imageHash.clear();
+    _linearImage = QImage();
+
+    int bitpix = 0;
+    if (!readImageParams(bitpix))
+        return;
+    const int fitsDataType = _fitsDataType;
+    long long numberOfPixels = _width * _height;
+
+    // A bayer image has a single plane, the other channels are made by deBayer
+    long long numberOfStoredPixels = numberOfPixels * (_bayerPattern == BayerPattern::None ? _numberOfChannels : 1);
+
+    // Uncompressed images opened from memory are used in place, without reading them
+    // into a buffer first
+    const bool cube = isCube();
+    const unsigned char* storedPixels = getStoredPixels(bitpix, numberOfStoredPixels * (cube ? _planes : 1));
+
+    _data = nullptr;
+    if (cube)
+    {
+        const bool read = visitFitsSampleType(_imageEquivType, [&](auto sample) { return readCube<decltype(sample)>(storedPixels); });
+        if (!read)
+            return;
+        numberOfStoredPixels = _width * _height;
+        storedPixels = nullptr;
+    }
+    else if (storedPixels == nullptr && readDecimated(fitsDataType))
+    {
+        // Only every factor-th pixel of every factor-th row was read, and the hash is made of the stored data
+        numberOfStoredPixels = _width * _height * _numberOfChannels;
+    }
+    else if (storedPixels == nullptr && streamImage(fitsDataType))
+    {
+        if (_data == nullptr)
+            return;
+        numberOfStoredPixels = _width * _height * _numberOfChannels;
+    }
+    else if (storedPixels == nullptr)
+    {
+        _data = FrameBufferPool::acquire(numberOfPixels * _bytesPerPixel * _numberOfChannels);
+        if (_data == nullptr)
         {
-            AutoStretcher<int8_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((int8_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<int8_t>();
-            break;
+            qDebug() << "Could not allocate the frame of" << numberOfPixels << "pixels";
+            return;
         }
-        case USHORT_IMG:
+        // A band of rows at a time, so a cancel does not wait for the whole frame
+        const long long bandPixels = READ_BAND_ROWS * _width;
+        for (long long first = 0; first < numberOfStoredPixels && status == 0; first += bandPixels)
         {
-            AutoStretcher<uint16_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((uint16_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<uint16_t>();
-            break;
+            if (_cancellationToken.isCanceled())
+                break;
+            long long count = qMin(bandPixels, numberOfStoredPixels - first);
+            fits_read_img(_fptr, fitsDataType, first + 1, count, NULL, _data + first * _bytesPerPixel, NULL, &status);
         }
-        case ULONG_IMG:
+        if (status || _cancellationToken.isCanceled())
         {
-            AutoStretcher<uint32_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((uint32_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<uint32_t>();
-            break;
+            FrameBufferPool::release(_data);
+            _data = nullptr;
+            CHK_STATUS(status);
+            return;
         }
-        case ULONGLONG_IMG:
+    }
+
+    visitFitsSampleType(_imageEquivType, [&](auto sample) {
+        processImage<decltype(sample)>(storedPixels, numberOfStoredPixels, fitsDataType);
+    });
+
+    FrameBufferPool::release(_data);
+    _data = nullptr;
+
+    // What was made before the cancel is not of the whole frame
+    if (_cancellationToken.isCanceled())
+    {
+        _qImage = QImage();
+        _linearImage = QImage();
+        _imageHash.clear();
+    }
+}
+
+/*!
+ * \brief FitsFile::getStoredPixels
+ * Returns the data unit of the image HDU when the file was opened from memory and
+ * its stored pixels decode with fitsStoredPixel to the values fits_read_img gives:
+ * uncompressed, of a type with a FitsSampleType::storedBitpix, without any scaling
+ * but the one read as stored, see readScaledAsStored.
+ * Returns nullptr otherwise.
+ */
+const unsigned char* FitsFile::getStoredPixels(int bitpix, long long numberOfStoredPixels)
+{
+    if (_memData == nullptr || _bayerPattern == BayerPattern::Unsupported)
+        return nullptr;
+
+    int status = 0;
+    if (fits_is_compressed_image(_fptr, &status) || status)
+        return nullptr;
+
+    // The equivalent type already tells there is no scaling, unless the stored type is floating point
+    const int storedBitpix = visitFitsSampleType(_imageEquivType, [](auto sample) { return FitsSampleType<decltype(sample)>::storedBitpix; });
+    if (storedBitpix == 0)
+        return nullptr;
+    if (bitpix != storedBitpix)
+        return nullptr;
+
+    if (bitpix < 0)
+    {
+        double bscale = 1;
+        double bzero = 0;
+        fits_read_key(_fptr, TDOUBLE, "BSCALE", &bscale, NULL, &status);
+        status = 0;
+        fits_read_key(_fptr, TDOUBLE, "BZERO", &bzero, NULL, &status);
+        status = 0;
+        if (bscale != 1 || bzero != 0)
+            return nullptr;
+    }
+
+    LONGLONG headStart, dataStart, dataEnd;
+    if (fits_get_hduaddrll(_fptr, &headStart, &dataStart, &dataEnd, &status))
+        return nullptr;
+    if (dataStart + numberOfStoredPixels * _bytesPerPixel > (LONGLONG)_memSize)
+        return nullptr;
+
+    return static_cast<const unsigned char*>(_memData) + dataStart;
+}
+
+/*!
+ * \brief FitsFile::hashStoredPixels
+ * Hashes the stored pixels a block at a time, after the same conversion fits_read_img
+ * does, so the hash matches the one of an image that was read into a buffer.
+ * Returns an empty hash when canceled.
+ */
+template <typename T>
+QByteArray FitsFile::hashStoredPixels(const unsigned char* storedPixels, long long numberOfStoredPixels)
+{
+    std::vector<T> block(HASH_BLOCK_PIXELS);
+    Hasher hasher;
+    for (long long first = 0; first < numberOfStoredPixels; first += HASH_BLOCK_PIXELS)
+    {
+        if (_cancellationToken.isCanceled())
+            return QByteArray();
+        long long count = qMin<long long>(HASH_BLOCK_PIXELS, numberOfStoredPixels - first);
+        for (long long i = 0; i < count; i++)
+            block[i] = fitsStoredPixel<T>(storedPixels + (first + i) * sizeof(T));
+        hasher.addData(reinterpret_cast<const char*>(block.data()), count * sizeof(T));
+    }
+    return hasher.result();
+}
+
+/*!
+ * \brief FitsFile::readDecimated
+ * Reads a tile compressed mono or planar image into _data with a stride of the binning
+ * factor, so cfitsio only decompresses the tiles holding the rows read. The image hash is
+ * then made of the compressed data unit, which only matches byte identical copies.
+ * Returns false, having read nothing, when the image is read in full instead.
+ */
+bool FitsFile::readDecimated(int fitsDataType)
+{
+    int status = 0;
+    if (_memData == nullptr || _bayerPattern != BayerPattern::None)
+        return false;
+    if (!fits_is_compressed_image(_fptr, &status) || status)
+        return false;
+
+    int factor = binningFactor(_width, _height);
+    if (factor <= 1)
+        return false;
+
+    LONGLONG headStart, dataStart, dataEnd;
+    if (fits_get_hduaddrll(_fptr, &headStart, &dataStart, &dataEnd, &status) || dataEnd > (LONGLONG)_memSize)
+        return false;
+
+    long long width = (_width - 1) / factor + 1;
+    long long height = (_height - 1) / factor + 1;
+    _data = FrameBufferPool::acquire(width * height * _numberOfChannels * _bytesPerPixel);
+    if (_data == nullptr)
+        return false;
+
+    long firstPixel[3] = {1, 1, 1};
+    long lastPixel[3] = {(long)_width, (long)_height, _numberOfChannels};
+    long increment[3] = {factor, factor, 1};
+    fits_read_subset(_fptr, fitsDataType, firstPixel, lastPixel, increment, NULL, _data, NULL, &status);
+    if (status)
+    {
+        FrameBufferPool::release(_data);
+        _data = nullptr;
+        return false;
+    }
+
+    _imageHash = Hasher::hash(static_cast<const char*>(_memData) + dataStart, dataEnd - dataStart);
+    _width = width;
+    _height = height;
+    return true;
+}
+
+/*!
+ * \brief FitsFile::readScaledAsStored
+ * An integer image with a BSCALE and BZERO other than the unsigned 16 bit one is read
+ * in its stored type, with cfitsio told not to scale it, and the scaling goes to the
+ * AutoStretcher and the FrameAnalyzer. So the pixels are not converted by cfitsio into
+ * a wider type first, 8 and 16 bit images keep the histogram statistics and the lookup
+ * table, and uncompressed ones are used in place, see getStoredPixels. The image hash
+ * is then of the stored values. Compressed images are scaled by cfitsio as before.
+ */
+void FitsFile::readScaledAsStored(int bitpix)
+{
+    _bscale = 1;
+    _bzero = 0;
+    int status = 0;
+    if (bitpix <= 0 || _imageEquivType == bitpix || _imageEquivType == USHORT_IMG)
+        return;
+    if (fits_is_compressed_image(_fptr, &status) || status)
+        return;
+
+    double bscale = 1;
+    double bzero = 0;
+    fits_read_key(_fptr, TDOUBLE, "BSCALE", &bscale, NULL, &status);
+    status = 0;
+    fits_read_key(_fptr, TDOUBLE, "BZERO", &bzero, NULL, &status);
+    status = 0;
+    if (!(bscale > 0) || fits_set_bscale(_fptr, 1.0, 0.0, &status))
+        return;
+    _bscale = bscale;
+    _bzero = bzero;
+    _imageEquivType = bitpix;
+}
+
+/*!
+ * \brief FitsFile::isCube
+ * A mono image with more planes than the three of a color image, like a spectral
+ * cube or a stack of frames. Bayer images keep their first plane.
+ */
+bool FitsFile::isCube() const
+{
+    return _planes > 1 && _planes != 3 && _bayerPattern == BayerPattern::None;
+}
+
+/*!
+ * \brief FitsFile::readCube
+ * Reads the mean of up to CUBE_SAMPLED_PLANES planes spread over the cube into _data,
+ * each plane with fits_read_subset and a stride of the binning factor, so only the
+ * rows of those planes are read. The image hash is still made of the whole cube, see
+ * hashCube. Returns false when the cube could not be read or was canceled.
+ */
+template <typename T>
+bool FitsFile::readCube(const unsigned char* storedPixels)
+{
+    const int factor = binningFactor(_width, _height);
+    const long long width = (_width - 1) / factor + 1;
+    const long long height = (_height - 1) / factor + 1;
+    const long long pixels = width * height;
+    const long long sampled = qMin<long long>(CUBE_SAMPLED_PLANES, _planes);
+
+    std::vector<T> plane(pixels);
+    std::vector<double> sums(pixels, 0);
+    for (long long i = 0; i < sampled; i++)
+    {
+        if (_cancellationToken.isCanceled())
+            return false;
+        // The first and the last planes included
+        const long planeNumber = 1 + (sampled > 1 ? long(i * (_planes - 1) / (sampled - 1)) : 0);
+        long firstPixel[3] = {1, 1, planeNumber};
+        long lastPixel[3] = {(long)_width, (long)_height, planeNumber};
+        long increment[3] = {factor, factor, 1};
+        int status = 0;
+        fits_read_subset(_fptr, FitsSampleType<T>::dataType, firstPixel, lastPixel, increment, NULL, plane.data(), NULL, &status);
+        if (status)
         {
-            AutoStretcher<int64_t> as(_width, _height, _numberOfChannels, fitsDataType);
-            as.setData((int64_t*)_data);
-            as.calculateParams();
-            as.stretch();
-            makeImage<int64_t>();;
-            break;
+            char err_text[1024];
+            fits_get_errstatus(status, err_text);
+            qDebug() << err_text;
+            return false;
         }
+        for (long long k = 0; k < pixels; k++)
+            sums[k] += plane[k];
+    }
+
+    if (_shouldHashImage)
+    {
+        _imageHash = hashCube<T>(storedPixels);
+        if (_imageHash.isEmpty())
+            return false;
+    }
+
+    _data = FrameBufferPool::acquire(pixels * sizeof(T));
+    if (_data == nullptr)
+    {
+        qDebug() << "Could not allocate the image of the cube";
+        return false;
     }
+    T* out = reinterpret_cast<T*>(_data);
+    for (long long k = 0; k < pixels; k++)
+        out[k] = T(sums[k] / sampled);
 
-    delete [] _data;
+    _width = width;
+    _height = height;
+    return true;
 }
 
+/*!
+ * \brief FitsFile::hashCube
+ * Hashes all the planes of the cube, so two cubes sharing the planes readCube samples
+ * are not duplicates. The stored pixels are used when the cube is in memory, otherwise
+ * it is read with fits_read_img a block at a time, both giving the hash of the values
+ * fits_read_img gives. Returns an empty hash when the cube could not be read or was canceled.
+ */
 template <typename T>
-void FitsFile::makeImage()
+QByteArray FitsFile::hashCube(const unsigned char* storedPixels)
 {
-    QImage out(_width, _height, _qImageFormat);
-    long size = _width * _height;
-    T* it = (T*)_data;
+    const long long numberOfPixels = _width * _height * _planes;
+    if (storedPixels != nullptr)
+        return hashStoredPixels<T>(storedPixels, numberOfPixels);
 
-    if (_numberOfChannels == 3)
+    std::vector<T> block(HASH_BLOCK_PIXELS);
+    Hasher hasher;
+    for (long long first = 0; first < numberOfPixels; first += HASH_BLOCK_PIXELS)
     {
-        for (int i = 0; i < _height; i++)
+        if (_cancellationToken.isCanceled())
+            return QByteArray();
+        const long long count = qMin<long long>(HASH_BLOCK_PIXELS, numberOfPixels - first);
+        int status = 0;
+        fits_read_img(_fptr, FitsSampleType<T>::dataType, first + 1, count, NULL, block.data(), NULL, &status);
+        if (status)
         {
-            auto * scanLine = reinterpret_cast<QRgb*>(out.scanLine(i));
-            for (int j = 0; j < _width; j++)
+            char err_text[1024];
+            fits_get_errstatus(status, err_text);
+            qDebug() << err_text;
+            return QByteArray();
+        }
+        hasher.addData(reinterpret_cast<const char*>(block.data()), count * sizeof(T));
+    }
+    return hasher.result();
+}
+
+template <typename T>
+void FitsFile::processImage(const unsigned char* storedPixels, long long numberOfStoredPixels, int fitsDataType)
+{
+    const bool bayer = _numberOfChannels == 3 && _bayerPattern != BayerPattern::None && _bayerPattern != BayerPattern::Unsupported;
+    if (_imageHash.isEmpty() && _shouldHashImage && storedPixels != nullptr && !bayer)
+    {
+        int factor = binningFactor(_width, _height);
+        if (factor > 1)
+        {
+            auto readRows = [storedPixels](long long first, long long count, T* out) {
+                for (long long i = 0; i < count; i++)
+                    out[i] = fitsStoredPixel<T>(storedPixels + (first + i) * sizeof(T));
+                return true;
+            };
+            if (!hashAndBin<T>(readRows, factor))
             {
-                int red = it[0];
-                int green = it[size];
-                int blue = it[2*size];
-                scanLine[j] = qRgb(red, green, blue);
-                it++;
+                qDebug() << "Could not allocate the binned image";
+                return;
             }
+            storedPixels = nullptr;
         }
     }
-    else if (_numberOfChannels == 1)
+    if (_cancellationToken.isCanceled())
+        return;
+
+    // Unless readDecimated or hashAndBin made it already
+    if (_imageHash.isEmpty() && _shouldHashImage)
+    {
+        if (storedPixels != nullptr)
+            _imageHash = hashStoredPixels<T>(storedPixels, numberOfStoredPixels);
+        else
+            _imageHash = Hasher::hash((const char*)_data, numberOfStoredPixels * sizeof(T));
+    }
+    if (_cancellationToken.isCanceled())
+        return;
+
+    // The image is binned (and debayered) from the full frame the hash was made of.
+    // Sub-sampled reads with fits_read_subset would not save anything, as the hash needs every pixel.
+    if (bayer)
     {
-        for (int i = 0; i < _height; i++)
+        bool demosaiced;
+        if (_demosaicMethod == DemosaicSuperpixel)
+            demosaiced = deBayer<T>(storedPixels, binningFactor(_width / 2, _height / 2));
+        else
         {
-            auto * scanLine = out.scanLine(i);
-            for (int j = 0; j < _width; j++)
+            demosaiced = deBayer<T>(storedPixels, 1);
+            int factor = binningFactor(_width, _height);
+            if (demosaiced && factor > 1)
+                demosaiced = bin<T>(nullptr, factor);
+        }
+        if (!demosaiced)
+        {
+            qDebug() << "Could not allocate the demosaiced image";
+            return;
+        }
+        storedPixels = nullptr;
+    }
+    if (_cancellationToken.isCanceled())
+        return;
+    else
+    {
+        int factor = binningFactor(_width, _height);
+        if (factor > 1)
+        {
+            if (!bin<T>(storedPixels, factor))
             {
-                scanLine[j] = (*it);
-                it++;
+                qDebug() << "Could not allocate the binned image";
+                return;
             }
+            storedPixels = nullptr;
         }
     }
+
+    if (_shouldAnalyzeFrame)
+        analyzeFrame<T>(storedPixels);
+
+    // The frame is stretched straight into the image, so the stored pixels need no buffer
+    AutoStretcher<T> as(_width, _height, _numberOfChannels, fitsDataType);
+    as.setCancellationToken(_cancellationToken);
+    as.setScaling(_bscale, _bzero);
+    if (storedPixels != nullptr)
+        as.setStoredData(storedPixels, nullptr);
     else
-        Q_ASSERT(false);
-    this->_qImage = out;
-    return;
+        as.setData((T*)_data);
+    if (!_hasStretchParams || !as.setParams(_stretchParams))
+        as.calculateParams();
+    if (_cancellationToken.isCanceled())
+        return;
+    _stretchParams = as.getParams();
+    _qImage = as.stretchToImage();
+    if (_shouldMakeLinearImage)
+        _linearImage = as.linearImage();
 }
 
+/*!
+ * \brief FitsFile::analyzeFrame
+ * Measures the binned frame, averaged to one plane for color frames. Binning keeps the
+ * stars of a typical frame a few pixels wide, so they can still be measured.
+ */
 template <typename T>
-void FitsFile::deBayer_RGGB()
+void FitsFile::analyzeFrame(const unsigned char* storedPixels)
 {
-    T* data = reinterpret_cast<T*>(_data);
-    T* dataRed = new T[_width * _height/4];
-    T* dataGreen = new T[_width * _height/4];
-    T* dataBlue = new T[_width * _height/4];
-
-    T* redIt = dataRed;
-    T* greenIt = dataGreen;
-    T* blueIt = dataBlue;
+    const long long count = _width * _height;
+    float* plane = reinterpret_cast<float*>(FrameBufferPool::acquire(count * sizeof(float)));
+    if (plane == nullptr)
+    {
+        qDebug() << "Could not allocate the frame to analyze";
+        return;
+    }
 
-    for (int i = 0; (i+1) < _height; i+=2)
+    StoredPixels<T> stored{storedPixels};
+    const T* native = reinterpret_cast<const T*>(_data);
+    for (long long i = 0; i < count; i++)
     {
-        for (int j = 0; (j+1) < _width; j+=2)
-        {
-            T _red    = data[i*_width + j];
-            T _green1 = data[i*_width + j+1];
-            T _green2 = data[(i+1)*_width + j];
-            T _blue   = data[(i+1)*_width + j+1];
-
-            *redIt   = _red;
-            *greenIt = (_green1 + _green2) /2;
-            *blueIt = _blue;
-            redIt++;
-            greenIt++;
-            blueIt++;
-        }
+        float sum = 0;
+        for (int k = 0; k < _numberOfChannels; k++)
+            sum += float(storedPixels != nullptr ? stored(k * count + i) : native[k * count + i]);
+        // In physical values, see readScaledAsStored
+        plane[i] = float(sum / _numberOfChannels * _bscale + _bzero);
     }
-    _width/=2;
-    _height/=2;
-    delete [] _data;
-    _data = (unsigned char*)new T[_width * _height * 3];
-    long size = _width * _height * sizeof(T);
-    memcpy (_data + 0, dataRed, size);
-    memcpy (_data + size, dataGreen, size);
-    memcpy (_data + 2*size, dataBlue, size);
-    delete [] dataRed;
-    delete [] dataGreen;
-    delete [] dataBlue;
+    _stars.clear();
+    _frameQuality = FrameAnalyzer::analyze(plane, int(_width), int(_height), float(_fullWidth) / _width, &_stars);
+    FrameBufferPool::release(reinterpret_cast<unsigned char*>(plane));
+}
+
+/*!
+ * \brief FitsFile::binningFactor
+ * The largest power of two the image can be binned by, keeping its longer side at
+ * least twice the thumbnail size, so the final smooth scaling still has detail to work with.
+ */
+int FitsFile::binningFactor(long long width, long long height)
+{
+    int factor = 1;
+    if (_thumbnailSize <= 0)
+        return factor;
+
+    while (qMax(width, height) / (factor * 2) >= 2 * _thumbnailSize)
+        factor *= 2;
+    return factor;
 }
 
+/*!
+ * \brief FitsFile::deBayer
+ * Replaces _data with the demosaiced image, see demosaic. Returns false, leaving _data
+ * as it is, when the image could not be allocated. Reads the stored pixels when
+ * given, _data otherwise. Full resolution images are demosaiced in parallel.
+ * When canceled, _data is replaced all the same, with an incomplete image.
+ */
 template <typename T>
-void FitsFile::deBayer_BGGR()
+bool FitsFile::deBayer(const unsigned char* storedPixels, int factor)
 {
-    T* data = reinterpret_cast<T*>(_data);
-    T* dataRed = new T[_width * _height/4];
-    T* dataGreen = new T[_width * _height/4];
-    T* dataBlue = new T[_width * _height/4];
+    static LatencyHistogram& debayerLatency = Metrics::histogram(QString("fits.debayer.") + fitsPixelTypeName<T>());
+    static AllocationCounter& debayerAllocations = AllocationTracker::counter("fits.debayer");
+    ScopedLatency latency(debayerLatency);
+    AllocationScope allocations(debayerAllocations);
+    long long width = demosaicedWidth(_demosaicMethod, _width, factor);
+    long long height = demosaicedHeight(_demosaicMethod, _height, factor);
+    T* debayered = reinterpret_cast<T*>(FrameBufferPool::acquire(width * height * 3 * sizeof(T)));
+    if (debayered == nullptr)
+        return false;
+    bool parallel = _demosaicMethod != DemosaicSuperpixel;
 
-    T* redIt = dataRed;
-    T* greenIt = dataGreen;
-    T* blueIt = dataBlue;
+    if (storedPixels != nullptr)
+        demosaic<T>(_demosaicMethod, getBayerPattern(), StoredPixels<T>{storedPixels}, _width, _height, factor, debayered, parallel, _cancellationToken);
+    else
+        demosaic<T>(_demosaicMethod, getBayerPattern(), NativePixels<T>{reinterpret_cast<const T*>(_data)}, _width, _height, factor, debayered, parallel, _cancellationToken);
+
+    _width = width;
+    _height = height;
+    FrameBufferPool::release(_data);
+    _data = (unsigned char*)debayered;
+    return true;
+}
 
-    for (int i = 0; (i+1) < _height; i+=2)
+// Stops at the row it is on when the token is canceled
+template <typename T, typename Pixels>
+static void binPlanes(const Pixels& pixels, long long width, long long height, int planes, int factor, T* out, const CancellationToken& token)
+{
+    const long long outWidth = width / factor;
+    const long long outHeight = height / factor;
+    const long long size = outWidth * outHeight;
+    const long long cells = (long long)factor * factor;
+    std::vector<PixelSum<T>> sums(outWidth);
+
+    for (int c = 0; c < planes; c++)
     {
-        for (int j = 0; (j+1) < _width; j+=2)
+        long long plane = c * width * height;
+        for (long long y = 0; y < outHeight; y++)
         {
-            T _blue   = data[i*_width + j];
-            T _green1 = data[i*_width + j+1];
-            T _green2 = data[(i+1)*_width + j];
-            T _red    = data[(i+1)*_width + j+1];
-
-            *redIt   = _red;
-            *greenIt = (_green1 + _green2) /2;
-            *blueIt = _blue;
-            redIt++;
-            greenIt++;
-            blueIt++;
+            if (token.isCanceled())
+                return;
+            std::fill(sums.begin(), sums.end(), 0);
+            for (long long i = y * factor; i < (y + 1) * factor; i++)
+                addRowToCells(pixels, plane + i * width, outWidth, factor, sums.data());
+            for (long long x = 0; x < outWidth; x++)
+                out[c * size + y * outWidth + x] = T(sums[x] / cells);
         }
     }
-    _width/=2;
-    _height/=2;
-    delete [] _data;
-    _data = (unsigned char*)new T[_width * _height * 3];
-    long size = _width * _height * sizeof(T);
-    memcpy (_data + 0, dataRed, size);
-    memcpy (_data + size, dataGreen, size);
-    memcpy (_data + 2*size, dataBlue, size);
-    delete [] dataRed;
-    delete [] dataGreen;
-    delete [] dataBlue;
 }
 
+/*!
+ * \brief FitsFile::bin
+ * Replaces _data with each plane averaged over factor x factor pixels, or returns false
+ * when the image could not be allocated. Reads the
+ * stored pixels when given, _data otherwise, one row at a time.
+ */
 template <typename T>
-void FitsFile::deBayer_GRBG()
+bool FitsFile::bin(const unsigned char* storedPixels, int factor)
 {
-    T* data = reinterpret_cast<T*>(_data);
-    T* dataRed = new T[_width * _height/4];
-    T* dataGreen = new T[_width * _height/4];
-    T* dataBlue = new T[_width * _height/4];
+    long long width = _width / factor;
+    long long height = _height / factor;
+    T* binned = reinterpret_cast<T*>(FrameBufferPool::acquire(width * height * _numberOfChannels * sizeof(T)));
+    if (binned == nullptr)
+        return false;
+
+    if (storedPixels != nullptr)
+        binPlanes<T>(StoredPixels<T>{storedPixels}, _width, _height, _numberOfChannels, factor, binned, _cancellationToken);
+    else
+        binPlanes<T>(NativePixels<T>{reinterpret_cast<const T*>(_data)}, _width, _height, _numberOfChannels, factor, binned, _cancellationToken);
 
-    T* redIt = dataRed;
-    T* greenIt = dataGreen;
-    T* blueIt = dataBlue;
+    _width = width;
+    _height = height;
+    FrameBufferPool::release(_data);
+    _data = (unsigned char*)binned;
+    return true;
+}
 
-    for (int i = 0; (i+1) < _height; i+=2)
+/*!
+ * \brief FitsFile::hashAndBin
+ * Does what hashing the frame and bin do, in one pass over a mono or planar image:
+ * readRows(first, count, out) decodes count pixels from the first one into out, a band
+ * of rows at a time, and each band is added to the hash, then binned. Only the band
+ * and the binned image are in memory. Returns false, leaving _data as it is, when the
+ * image could not be allocated or read. When canceled, the hash is left empty and _data
+ * is replaced with an incomplete image.
+ * The bands are binned by the GpuBinner when it is available, on the CPU otherwise. This
+ * is the only stage of the thumbnail chain that runs on the GPU, see GpuBinner.
+ */
+template <typename T, typename ReadRows>
+bool FitsFile::hashAndBin(ReadRows readRows, int factor)
+{
+    const long long outWidth = _width / factor;
+    const long long outHeight = _height / factor;
+    const long long size = outWidth * outHeight;
+    const long long cells = (long long)factor * factor;
+    const long long bandRows = qMax<long long>(factor, READ_BAND_ROWS / factor * factor);
+    T* binned = reinterpret_cast<T*>(FrameBufferPool::acquire(size * _numberOfChannels * sizeof(T)));
+    T* rows = reinterpret_cast<T*>(FrameBufferPool::acquire(bandRows * _width * sizeof(T)));
+    if (binned == nullptr || rows == nullptr)
     {
-        for (int j = 0; (j+1) < _width; j+=2)
+        FrameBufferPool::release(reinterpret_cast<unsigned char*>(binned));
+        FrameBufferPool::release(reinterpret_cast<unsigned char*>(rows));
+        return false;
+    }
+
+    std::vector<PixelSum<T>> sums(outWidth);
+    const NativePixels<T> decoded{rows};
+    const bool onGpu = GpuBinner::supports<T>() && GpuBinner::isAvailable();
+    std::vector<float> gpuBinned(onGpu ? bandRows / factor * outWidth : 0);
+    Hasher hasher;
+    bool canceled = false;
+    bool failed = false;
+    for (int c = 0; c < _numberOfChannels && !canceled && !failed; c++)
+    {
+        const long long plane = c * _width * _height;
+        // The rows below the last group of factor rows are only hashed
+        for (long long firstRow = 0; firstRow < _height; firstRow += bandRows)
         {
-            T _green1 = data[i*_width + j];
-            T _red    = data[i*_width + j+1];
-            T _blue   = data[(i+1)*_width + j];
-            T _green2 = data[(i+1)*_width + j+1];
-
-            *redIt   = _red;
-            *greenIt = (_green1 + _green2) /2;
-            *blueIt = _blue;
-            redIt++;
-            greenIt++;
-            blueIt++;
+            if (_cancellationToken.isCanceled())
+            {
+                canceled = true;
+                break;
+            }
+            const long long count = qMin(bandRows, _height - firstRow) * _width;
+            if (!readRows(plane + firstRow * _width, count, rows))
+            {
+                failed = true;
+                break;
+            }
+            if (_shouldHashImage)
+                hasher.addData(reinterpret_cast<const char*>(rows), count * sizeof(T));
+
+            // The band starts on a row of a cell, bandRows is a multiple of factor
+            const long long firstOut = firstRow / factor;
+            const long long lastOut = qMin(outHeight, (firstRow + bandRows) / factor);
+            if (onGpu && GpuBinner::binRows(rows, _width, (lastOut - firstOut) * factor, factor, gpuBinned.data()))
+            {
+                std::transform(gpuBinned.begin(), gpuBinned.begin() + (lastOut - firstOut) * outWidth, binned + c * size + firstOut * outWidth, [](float value) { return T(value); });
+                continue;
+            }
+            for (long long y = firstOut; y < lastOut; y++)
+            {
+                std::fill(sums.begin(), sums.end(), 0);
+                for (long long i = y * factor; i < (y + 1) * factor; i++)
+                    addRowToCells(decoded, (i - firstRow) * _width, outWidth, factor, sums.data());
+                for (long long x = 0; x < outWidth; x++)
+                    binned[c * size + y * outWidth + x] = T(sums[x] / cells);
+            }
         }
     }
-    _width/=2;
-    _height/=2;
-    delete [] _data;
-    _data = (unsigned char*)new T[_width * _height * 3];
-    long size = _width * _height * sizeof(T);
-    memcpy (_data + 0, dataRed, size);
-    memcpy (_data + size, dataGreen, size);
-    memcpy (_data + 2*size, dataBlue, size);
-    delete [] dataRed;
-    delete [] dataGreen;
-    delete [] dataBlue;
+    FrameBufferPool::release(reinterpret_cast<unsigned char*>(rows));
+    if (failed)
+    {
+        FrameBufferPool::release(reinterpret_cast<unsigned char*>(binned));
+        return false;
+    }
+
+    if (!canceled && _shouldHashImage)
+        _imageHash = hasher.result();
+    _width = outWidth;
+    _height = outHeight;
+    FrameBufferPool::release(_data);
+    _data = (unsigned char*)binned;
+    return true;
 }
 
-template <typename T>
-void FitsFile::deBayer_GBRG()
+/*!
+ * \brief FitsFile::streamImage
+ * Reads a mono or planar image of more than STREAMED_FRAME_BYTES that is binned a band of
+ * rows at a time with hashAndBin, so its memory does not grow with the image. Returns
+ * false, having read nothing, when the image is read in full instead. _data is left
+ * null when the image could not be read.
+ */
+bool FitsFile::streamImage(int fitsDataType)
 {
-    T* data = reinterpret_cast<T*>(_data);
-    T* dataRed = new T[_width * _height/4];
-    T* dataGreen = new T[_width * _height/4];
-    T* dataBlue = new T[_width * _height/4];
+    if (_bayerPattern != BayerPattern::None)
+        return false;
+    if (_width * _height * _numberOfChannels * _bytesPerPixel <= STREAMED_FRAME_BYTES)
+        return false;
+    int factor = binningFactor(_width, _height);
+    if (factor <= 1)
+        return false;
+
+    static std::atomic<qint64>& streamedCount = Metrics::counter("fits.streamed_frames");
+    streamedCount++;
+    int status = 0;
+    bool binned = visitFitsSampleType(_imageEquivType, [&](auto sample) {
+        using T = decltype(sample);
+        return hashAndBin<T>([&](long long first, long long count, T* out) {
+            fits_read_img(_fptr, fitsDataType, first + 1, count, NULL, out, NULL, &status);
+            return status == 0;
+        }, factor);
+    });
+    if (!binned && status)
+    {
+        char errorText[FLEN_STATUS];
+        fits_get_errstatus(status, errorText);
+        qDebug() << errorText;
+    }
+    else if (!binned)
+        qDebug() << "Could not allocate the binned image";
+    return true;
+}
 
-    T* redIt = dataRed;
-    T* greenIt = dataGreen;
-    T* blueIt = dataBlue;
+/*!
+ * \brief binRegion
+ * Averages the region at left, top of each plane over factor x factor pixels, into
+ * outWidth x outHeight planes in out.
+ */
+template <typename T>
+static void binRegion(const T* planes, long long width, long long height, int planeCount, long long left, long long top, long long outWidth, long long outHeight, int factor, T* out)
+{
+    const long long cells = (long long)factor * factor;
+    std::vector<PixelSum<T>> sums(outWidth);
 
-    for (int i = 0; (i+1) < _height; i+=2)
+    for (int c = 0; c < planeCount; c++)
     {
-        for (int j = 0; (j+1) < _width; j+=2)
+        const T* plane = planes + c * width * height;
+        for (long long y = 0; y < outHeight; y++)
         {
-            T _green1 = data[i*_width + j];
-            T _blue   = data[i*_width + j+1];
-            T _red    = data[(i+1)*_width + j];
-            T _green2 = data[(i+1)*_width + j+1];
-
-            *redIt   = _red;
-            *greenIt = (_green1 + _green2) /2;
-            *blueIt = _blue;
-            redIt++;
-            greenIt++;
-            blueIt++;
+            std::fill(sums.begin(), sums.end(), 0);
+            for (long long i = top + y * factor; i < top + (y + 1) * factor; i++)
+            {
+                const T* row = plane + i * width + left;
+                for (long long j = 0; j < outWidth * factor; j++)
+                    sums[j / factor] += row[j];
+            }
+            for (long long x = 0; x < outWidth; x++)
+                out[(c * outHeight + y) * outWidth + x] = T(sums[x] / cells);
         }
     }
-    _width/=2;
-    _height/=2;
-    delete [] _data;
-    _data = (unsigned char*)new T[_width * _height * 3];
-    long size = _width * _height * sizeof(T);
-    memcpy (_data + 0, dataRed, size);
-    memcpy (_data + size, dataGreen, size);
-    memcpy (_data + 2*size, dataBlue, size);
-    delete [] dataRed;
-    delete [] dataGreen;
-    delete [] dataBlue;
+}
+
+/*!
+ * \brief FitsFile::extractTile
+ * Renders a region of the full resolution image, averaged over factor x factor pixels,
+ * for the tiles of a preview. Bayer images are demosaiced with the full resolution method
+ * given to setDemosaicMethod, DemosaicBilinear by default, from the region and a margin
+ * around it, so the tiles join without seams. The stretch
+ * parameters are the ones of extractImage, or the ones given to setStretchParams.
+ *
+ * Only the rows and columns of the region are read, so only the tiles holding them are
+ * decompressed from a tile compressed image. Returns a null image on failure.
+ */
+QImage FitsFile::extractTile(const QRect &region, int factor)
+{
+    int bitpix = 0;
+    if (_fitsDataType == 0 && !readImageParams(bitpix))
+        return QImage();
+
+    return visitFitsSampleType(_imageEquivType, [&](auto sample) { return renderTile<decltype(sample)>(region, factor); });
 }
 
 template <typename T>
-void FitsFile::deBayer()
+QImage FitsFile::renderTile(const QRect &region, int factor)
 {
-    switch (getBayerPattern())
+    if (_bayerPattern == BayerPattern::Unsupported || factor < 1)
+        return QImage();
+
+    const long long width = region.width() / factor;
+    const long long height = region.height() / factor;
+    if (width <= 0 || height <= 0 || region.left() < 0 || region.top() < 0 || region.right() >= _fullWidth || region.bottom() >= _fullHeight)
+        return QImage();
+
+    // The region, and with a bayer image a margin around it starting on even pixels, so
+    // the pattern stays in place
+    const bool bayer = _bayerPattern != BayerPattern::None;
+    long long left = region.left();
+    long long top = region.top();
+    long long right = region.right() + 1;
+    long long bottom = region.bottom() + 1;
+    if (bayer)
     {
-        case None:
-        {
-            break;
-        }
-        case Unsupported:
-        {
-            break;
-        }
-        case BGGR:
-        {
-            deBayer_BGGR<T>();
-            break;
-        }
-        case RGGB:
-        {
-            deBayer_RGGB<T>();
-            break;
-        }
-        case GBRG:
-        {
-            deBayer_GBRG<T>();
-            break;
-        }
-        case GRBG:
-        {
-            deBayer_GRBG<T>();
-            break;
-        }
+        left = qMax(0LL, left - BAYER_TILE_MARGIN) & ~1LL;
+        top = qMax(0LL, top - BAYER_TILE_MARGIN) & ~1LL;
+        right = qMin(_fullWidth, right + BAYER_TILE_MARGIN);
+        bottom = qMin(_fullHeight, bottom + BAYER_TILE_MARGIN);
     }
+    const long long readWidth = right - left;
+    const long long readHeight = bottom - top;
+    const int planes = bayer ? 1 : _numberOfChannels;
+
+    std::vector<T> pixels(readWidth * readHeight * planes);
+    long firstPixel[3] = {long(left + 1), long(top + 1), 1};
+    long lastPixel[3] = {long(right), long(bottom), planes};
+    long increment[3] = {1, 1, 1};
+    int status = 0;
+    fits_movabs_hdu(_fptr, _imageHdu, NULL, &status);
+    // Moving to the HDU again may have read its scaling again
+    if (_bscale != 1 || _bzero != 0)
+        fits_set_bscale(_fptr, 1.0, 0.0, &status);
+    fits_read_subset(_fptr, _fitsDataType, firstPixel, lastPixel, increment, NULL, pixels.data(), NULL, &status);
+    if (status)
+    {
+        char err_text[1024];
+        fits_get_errstatus(status, err_text);
+        qDebug() << "Could not read the tile" << region << err_text;
+        return QImage();
+    }
+
+    std::vector<T> demosaiced;
+    const T* data = pixels.data();
+    if (bayer)
+    {
+        demosaiced.resize(readWidth * readHeight * 3);
+        const DemosaicMethod method = _demosaicMethod == DemosaicSuperpixel ? DemosaicBilinear : _demosaicMethod;
+        demosaic<T>(method, _bayerPattern, NativePixels<T>{pixels.data()}, readWidth, readHeight, 1, demosaiced.data(), false, _cancellationToken);
+        data = demosaiced.data();
+    }
+
+    std::vector<T> binned(width * height * _numberOfChannels);
+    binRegion<T>(data, readWidth, readHeight, _numberOfChannels, region.left() - left, region.top() - top, width, height, factor, binned.data());
+
+    AutoStretcher<T> as(width, height, _numberOfChannels, _fitsDataType);
+    as.setCancellationToken(_cancellationToken);
+    as.setScaling(_bscale, _bzero);
+    as.setData(binned.data());
+    if (!as.setParams(_stretchParams))
+        return QImage();
+    return as.stretchToImage();
 }
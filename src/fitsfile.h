@@ -27,19 +27,15 @@
 
 #include <QObject>
 #include <QImage>
+#include <QRect>
+#include <QSize>
 #include "astrofile.h"
+#include "autostretcher.h"
+#include "cancellationtoken.h"
+#include "debayer.h"
+#include "frameanalyzer.h"
 #include "fitsio.h"
 
-enum BayerPattern
-{
-    None, // Mono Image
-    RGGB,
-    BGGR,
-    GRBG,
-    GBRG,
-    Unsupported
-};
-
 enum ImageDataType
 {
     BYTEIMG,
@@ -50,6 +46,44 @@ enum ImageDataType
     DOUBLEIMG
 };
 
+/*
+ * The sample type of each FITS image type (the equivalent BITPIX): the cfitsio data
+ * type it is read with, and the BITPIX its data unit has when fitsStoredPixel decodes
+ * it as is, 0 when it can not. Reading, debayering, stretching and rendering all go
+ * through visitFitsSampleType, so they always agree on the type.
+ */
+template <typename T> struct FitsSampleType;
+template <> struct FitsSampleType<uint8_t>  { static constexpr int dataType = TBYTE;      static constexpr int storedBitpix = BYTE_IMG; };
+template <> struct FitsSampleType<int8_t>   { static constexpr int dataType = TSBYTE;     static constexpr int storedBitpix = 0; };
+template <> struct FitsSampleType<int16_t>  { static constexpr int dataType = TSHORT;     static constexpr int storedBitpix = SHORT_IMG; };
+template <> struct FitsSampleType<uint16_t> { static constexpr int dataType = TUSHORT;    static constexpr int storedBitpix = SHORT_IMG; };
+template <> struct FitsSampleType<int32_t>  { static constexpr int dataType = TINT;       static constexpr int storedBitpix = LONG_IMG; };
+template <> struct FitsSampleType<uint32_t> { static constexpr int dataType = TUINT;      static constexpr int storedBitpix = 0; };
+template <> struct FitsSampleType<int64_t>  { static constexpr int dataType = TLONGLONG;  static constexpr int storedBitpix = LONGLONG_IMG; };
+template <> struct FitsSampleType<uint64_t> { static constexpr int dataType = TULONGLONG; static constexpr int storedBitpix = 0; };
+template <> struct FitsSampleType<float>    { static constexpr int dataType = TFLOAT;     static constexpr int storedBitpix = FLOAT_IMG; };
+template <> struct FitsSampleType<double>   { static constexpr int dataType = TDOUBLE;    static constexpr int storedBitpix = DOUBLE_IMG; };
+
+// Calls visitor with a sample of the type of the image type, or returns a default result for an unknown type
+template <typename Visitor>
+inline auto visitFitsSampleType(int imageType, Visitor&& visitor) -> decltype(visitor(uint8_t()))
+{
+    switch (imageType)
+    {
+    case BYTE_IMG: return visitor(uint8_t());
+    case SBYTE_IMG: return visitor(int8_t());
+    case SHORT_IMG: return visitor(int16_t());
+    case USHORT_IMG: return visitor(uint16_t());
+    case LONG_IMG: return visitor(int32_t());
+    case ULONG_IMG: return visitor(uint32_t());
+    case LONGLONG_IMG: return visitor(int64_t());
+    case ULONGLONG_IMG: return visitor(uint64_t());
+    case FLOAT_IMG: return visitor(float());
+    case DOUBLE_IMG: return visitor(double());
+    }
+    return decltype(visitor(uint8_t()))();
+}
+
 class FitsFile
 {
 public:
@@ -57,6 +91,9 @@ public:
     ~FitsFile();
 
     bool loadFile(QString filaPath);
+    bool loadFile(QString filePath, const uchar* data, qint64 size);
+    // Closes the file and clears what was read from it, the settings are kept
+    void close();
     int getNumberOfChannels()
     {
         return _numberOfChannels;
@@ -67,6 +104,12 @@ public:
         return _bayerPattern;
     }
 
+    // Superpixel by default, which halves the resolution of color images
+    void setDemosaicMethod(DemosaicMethod method)
+    {
+        _demosaicMethod = method;
+    }
+
     QImage getImage()
     {
         return _qImage;
@@ -82,36 +125,134 @@ public:
         return _imageHash;
     }
 
+    // Parameters stored from an earlier extractImage of this file skip the statistics
+    void setStretchParams(const StretchParams& params)
+    {
+        _stretchParams = params;
+        _hasStretchParams = true;
+    }
+
+    StretchParams getStretchParams()
+    {
+        return _stretchParams;
+    }
+
+    // The pixels are hashed by default, previews do not need the hash
+    void setHashImage(bool shouldHash)
+    {
+        _shouldHashImage = shouldHash;
+    }
+
+    // Measures the frame the image is made of during extractImage, see FrameAnalyzer
+    void setAnalyzeFrame(bool shouldAnalyze)
+    {
+        _shouldAnalyzeFrame = shouldAnalyze;
+    }
+
+    FrameQuality getFrameQuality()
+    {
+        return _frameQuality;
+    }
+
+    // The stars the frame was measured with, see FrameAnalyzer
+    const std::vector<DetectedStar>& getStars()
+    {
+        return _stars;
+    }
+
+    // Also makes the image before the stretch during extractImage, see AutoStretcher::linearImage
+    void setMakeLinearImage(bool shouldMake)
+    {
+        _shouldMakeLinearImage = shouldMake;
+    }
+
+    QImage getLinearImage()
+    {
+        return _linearImage;
+    }
+
+    // Checked between bands of rows while the image is read and processed. A canceled
+    // extractImage leaves the image null and the hash empty.
+    void setCancellationToken(const CancellationToken& token)
+    {
+        _cancellationToken = token;
+    }
+
+    // The size of the image at full resolution, see extractTile. Valid after extractImage.
+    QSize getFullSize()
+    {
+        return QSize(int(_fullWidth), int(_fullHeight));
+    }
+
     void extractTags();
-    void extractImage();
+    // With a thumbnailSize, the image is binned down to about twice that size while it is read
+    void extractImage(int thumbnailSize = 0);
+    // A region of the full resolution image, binned by factor, see extractTile in the .cpp
+    QImage extractTile(const QRect& region, int factor);
 
 private:
     int _numberOfChannels;
     BayerPattern _bayerPattern;
+    DemosaicMethod _demosaicMethod;
     ImageDataType _imageDataType;
     QImage _qImage;
     QImage::Format _qImageFormat;
     QMap<QString, QString> _tags;
     QByteArray _imageHash;
     fitsfile* _fptr;
+    void* _memData;
+    size_t _memSize;
     unsigned char* _data;
     int _imageEquivType;
 
     long long _width;
     long long _height;
     int _bytesPerPixel;
+    int _thumbnailSize;
+    int _imageHdu;
+    int _fitsDataType;
+    long long _fullWidth;
+    long long _fullHeight;
+    long long _planes; // NAXIS3, 1 for a 2D image
+    // The scaling of the stored values the pixels are read as, 1 and 0 when cfitsio scales them
+    double _bscale;
+    double _bzero;
+    bool _shouldHashImage;
+    bool _shouldAnalyzeFrame;
+    bool _shouldMakeLinearImage;
+    QImage _linearImage;
+    FrameQuality _frameQuality;
+    std::vector<DetectedStar> _stars;
+    CancellationToken _cancellationToken;
+    int findImageHdu();
+    bool readImageParams(int& bitpix);
+    void readScaledAsStored(int bitpix);
+    void readHeader(int hdu);
+    bool readDecimated(int fitsDataType);
+    bool isCube() const;
+    template <typename T>
+    bool readCube(const unsigned char* storedPixels);
+    template <typename T>
+    QByteArray hashCube(const unsigned char* storedPixels);
+    StretchParams _stretchParams;
+    bool _hasStretchParams;
+    int binningFactor(long long width, long long height);
+    const unsigned char* getStoredPixels(int bitpix, long long numberOfStoredPixels);
     template <typename T>
-    void deBayer();
+    QByteArray hashStoredPixels(const unsigned char* storedPixels, long long numberOfStoredPixels);
     template <typename T>
-    void deBayer_RGGB();
+    void processImage(const unsigned char* storedPixels, long long numberOfStoredPixels, int fitsDataType);
     template <typename T>
-    void deBayer_BGGR();
+    bool deBayer(const unsigned char* storedPixels, int factor);
     template <typename T>
-    void deBayer_GRBG();
+    bool bin(const unsigned char* storedPixels, int factor);
+    template <typename T, typename ReadRows>
+    bool hashAndBin(ReadRows readRows, int factor);
+    bool streamImage(int fitsDataType);
     template <typename T>
-    void deBayer_GBRG();
+    void analyzeFrame(const unsigned char* storedPixels);
     template <typename T>
-    void makeImage();
+    QImage renderTile(const QRect& region, int factor);
 };
 
 #endif // FITSFILE_H
@@ -0,0 +1,211 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fitsheadereditor.h"
+#include "metrics.h"
+
+#include <QFile>
+#include <QRegularExpression>
+#include <QSaveFile>
+
+#define FITS_BLOCK_SIZE         2880
+#define FITS_CARD_SIZE          80
+#define FITS_KEYWORD_SIZE       8
+
+// Headers longer than this are not headers we can edit
+#define MAX_HEADER_BLOCKS       256
+
+// Bytes copied at a time when the file is written again with a larger header
+#define REWRITE_CHUNK_SIZE      (4 * 1024 * 1024)
+
+static const QByteArray endCard = QByteArray("END").leftJustified(FITS_CARD_SIZE, ' ');
+
+bool FitsHeaderEditor::isValidEdit(const HeaderEdit &edit, QString &error)
+{
+    static const QRegularExpression keywordPattern("^[A-Z0-9_-]{1,8}$");
+    // The structure of the file is not ours to change
+    static const QStringList reservedKeywords = {"SIMPLE", "BITPIX", "NAXIS", "EXTEND", "END", "BZERO", "BSCALE", "COMMENT", "HISTORY"};
+    if (!keywordPattern.match(edit.keyword).hasMatch() || edit.keyword.startsWith("NAXIS") || reservedKeywords.contains(edit.keyword))
+    {
+        error = QString("%1 can not be edited").arg(edit.keyword);
+        return false;
+    }
+    for (QChar c : edit.value)
+    {
+        if (c.unicode() < 0x20 || c.unicode() > 0x7e)
+        {
+            error = QString("The value of %1 has characters a FITS header can not hold").arg(edit.keyword);
+            return false;
+        }
+    }
+    if (formatCard(edit.keyword, edit.value, QByteArray()).size() > FITS_CARD_SIZE)
+    {
+        error = QString("The value of %1 is too long").arg(edit.keyword);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief FitsHeaderEditor::formatCard
+ * The fixed format of the standard: numbers and logicals right aligned to column 30,
+ * strings quoted from column 11 and at least 8 characters long. Longer than a card
+ * when the value does not fit, the comment is dropped instead.
+ */
+QByteArray FitsHeaderEditor::formatCard(const QString &keyword, const QString &value, const QByteArray &comment)
+{
+    static const QRegularExpression numberPattern("^[+-]?(\\d+\\.?\\d*|\\.\\d+)([EeDd][+-]?\\d+)?$");
+    QByteArray field;
+    if (value == "T" || value == "F" || numberPattern.match(value).hasMatch())
+        field = value.toLatin1().rightJustified(20, ' ');
+    else
+        field = "'" + QString(value).replace("'", "''").toLatin1().leftJustified(8, ' ') + "'";
+
+    QByteArray card = keyword.toLatin1().leftJustified(FITS_KEYWORD_SIZE, ' ') + "= " + field;
+    if (card.size() > FITS_CARD_SIZE)
+        return card;
+    if (!comment.isEmpty() && card.size() + 3 + comment.size() <= FITS_CARD_SIZE)
+        card += " / " + comment;
+    return card.leftJustified(FITS_CARD_SIZE, ' ');
+}
+
+// The comment after the value of a card, without the slash
+QByteArray FitsHeaderEditor::commentOf(const QByteArray &card)
+{
+    bool inString = false;
+    for (int i = FITS_KEYWORD_SIZE + 2; i < card.size(); i++)
+    {
+        if (card.at(i) == '\'')
+            inString = !inString;
+        else if (card.at(i) == '/' && !inString)
+            return card.mid(i + 1).trimmed();
+    }
+    return QByteArray();
+}
+
+QByteArray FitsHeaderEditor::edit(const QString &path, const QList<HeaderEdit> &edits, QString &error)
+{
+    static std::atomic<qint64>& inPlaceCount = Metrics::counter("header_editor.in_place");
+    static std::atomic<qint64>& rewrittenCount = Metrics::counter("header_editor.rewritten");
+    for (auto& edit : edits)
+    {
+        if (!isValidEdit(edit, error))
+            return QByteArray();
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadWrite))
+    {
+        error = file.errorString();
+        return QByteArray();
+    }
+
+    // The blocks up to the one with END
+    QByteArray header;
+    int endCardIndex = -1;
+    while (endCardIndex < 0 && header.size() < MAX_HEADER_BLOCKS * FITS_BLOCK_SIZE)
+    {
+        const QByteArray block = file.read(FITS_BLOCK_SIZE);
+        if (block.size() != FITS_BLOCK_SIZE)
+            break;
+        const int firstCard = header.size() / FITS_CARD_SIZE;
+        header += block;
+        for (int card = 0; card < FITS_BLOCK_SIZE / FITS_CARD_SIZE; card++)
+        {
+            if (block.mid(card * FITS_CARD_SIZE, FITS_CARD_SIZE) == endCard)
+            {
+                endCardIndex = firstCard + card;
+                break;
+            }
+        }
+    }
+    if (endCardIndex < 0 || !header.startsWith("SIMPLE  ="))
+    {
+        error = "The file has no FITS header";
+        return QByteArray();
+    }
+    const qint64 oldHeaderSize = header.size();
+
+    for (auto& edit : edits)
+    {
+        const QByteArray keyword = edit.keyword.toLatin1().leftJustified(FITS_KEYWORD_SIZE, ' ') + "=";
+        int cardIndex = -1;
+        for (int card = 0; card < endCardIndex && cardIndex < 0; card++)
+        {
+            if (header.mid(card * FITS_CARD_SIZE, FITS_KEYWORD_SIZE + 1) == keyword)
+                cardIndex = card;
+        }
+
+        QByteArray comment;
+        if (cardIndex >= 0)
+            comment = commentOf(header.mid(cardIndex * FITS_CARD_SIZE, FITS_CARD_SIZE));
+        else
+        {
+            // END moves down a card, into a new block when its block is full
+            cardIndex = endCardIndex++;
+            if (endCardIndex * FITS_CARD_SIZE >= header.size())
+                header += QByteArray(FITS_BLOCK_SIZE, ' ');
+            header.replace(endCardIndex * FITS_CARD_SIZE, FITS_CARD_SIZE, endCard);
+        }
+        header.replace(cardIndex * FITS_CARD_SIZE, FITS_CARD_SIZE, formatCard(edit.keyword, edit.value, comment));
+    }
+
+    if (header.size() == oldHeaderSize)
+    {
+        // Only the header blocks are written
+        if (!file.seek(0) || file.write(header) != header.size() || !file.flush())
+        {
+            error = file.errorString();
+            return QByteArray();
+        }
+        inPlaceCount++;
+        return header;
+    }
+
+    // The data moves by the new blocks, the file is written again next to it
+    QSaveFile rewritten(path);
+    if (!rewritten.open(QIODevice::WriteOnly) || rewritten.write(header) != header.size() || !file.seek(oldHeaderSize))
+    {
+        error = rewritten.errorString();
+        return QByteArray();
+    }
+    QByteArray chunk(REWRITE_CHUNK_SIZE, Qt::Uninitialized);
+    qint64 read;
+    bool written = true;
+    while (written && (read = file.read(chunk.data(), chunk.size())) > 0)
+        written = rewritten.write(chunk.constData(), read) == read;
+    // Windows does not replace a file that is open
+    file.close();
+    if (read < 0)
+        error = file.errorString();
+    else if (!written || !rewritten.commit())
+        error = rewritten.errorString();
+    if (!error.isEmpty())
+    {
+        rewritten.cancelWriting();
+        return QByteArray();
+    }
+    rewrittenCount++;
+    return header;
+}
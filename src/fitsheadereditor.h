@@ -0,0 +1,63 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FITSHEADEREDITOR_H
+#define FITSHEADEREDITOR_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+// A keyword of the primary header set to a value, added if the header has none
+struct HeaderEdit
+{
+    QString keyword;
+    QString value;
+};
+
+/*!
+ * \brief The FitsHeaderEditor class
+ * Edits the cards of the primary header of a FITS file where they are. A keyword the
+ * header has gets its card rewritten, keeping the comment when it fits. A new keyword
+ * takes the blank card after END, and only when the last header block is full is the
+ * file written again with one more block, through a temporary file. The data is never
+ * read otherwise.
+ *
+ * Values that read as numbers or logicals (T, F) are written as such, the others as
+ * strings.
+ */
+class FitsHeaderEditor
+{
+public:
+    // Returns the header as it is in the file now, empty with error set when it could not be edited
+    static QByteArray edit(const QString& path, const QList<HeaderEdit>& edits, QString& error);
+    // Whether keyword can be written, and value fits in a card with it
+    static bool isValidEdit(const HeaderEdit& edit, QString& error);
+
+private:
+    static QByteArray formatCard(const QString& keyword, const QString& value, const QByteArray& comment);
+    static QByteArray commentOf(const QByteArray& card);
+};
+
+#endif // FITSHEADEREDITOR_H
@@ -0,0 +1,267 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fitsheaderscanner.h"
+#include "metrics.h"
+
+#include <QFile>
+#include <QStringList>
+
+#include <cstring>
+
+#define FITS_BLOCK_SIZE 2880
+#define FITS_CARD_SIZE 80
+// A header this long is not a FITS header
+#define MAX_HEADER_BLOCKS 1024
+// Extensions looked at for an image, after the primary HDU
+#define MAX_EXTENSIONS 256
+
+// The keyword of the card, and where its value starts, -1 when it has none
+static QByteArray cardKeyword(const char* card, int& valueStart)
+{
+    valueStart = -1;
+    if (qstrncmp(card, "HIERARCH ", 9) == 0)
+    {
+        // ESO long keywords: the name is everything up to the '=', like cfitsio reads it
+        const char* equals = static_cast<const char*>(memchr(card, '=', FITS_CARD_SIZE));
+        if (equals == nullptr)
+            return QByteArray(card + 9, FITS_CARD_SIZE - 9).trimmed();
+        valueStart = int(equals - card) + 1;
+        return QByteArray(card + 9, int(equals - card) - 9).trimmed();
+    }
+
+    if (card[8] == '=' && card[9] == ' ')
+        valueStart = 10;
+    return QByteArray(card, 8).trimmed();
+}
+
+// The value without its comment. The quotes of strings are dropped, like FitsFile did.
+static QByteArray cardValue(const char* card, int valueStart)
+{
+    if (valueStart < 0)
+        return QByteArray();
+
+    int i = valueStart;
+    while (i < FITS_CARD_SIZE && card[i] == ' ')
+        i++;
+    if (i < FITS_CARD_SIZE && card[i] == '\'')
+    {
+        // Two quotes in a row are a quote in the string, which ends at a single one
+        int end = i + 1;
+        while (end < FITS_CARD_SIZE)
+        {
+            if (card[end] == '\'')
+            {
+                if (end + 1 < FITS_CARD_SIZE && card[end + 1] == '\'')
+                {
+                    end += 2;
+                    continue;
+                }
+                break;
+            }
+            end++;
+        }
+        return QByteArray(card + i, end - i).replace('\'', "").trimmed();
+    }
+
+    int end = i;
+    while (end < FITS_CARD_SIZE && card[end] != '/')
+        end++;
+    return QByteArray(card + i, end - i).trimmed();
+}
+
+bool FitsHeaderScanner::isCompressedTableKeyword(const QString &keyword)
+{
+    static const QStringList tableKeywords = {"XTENSION", "BITPIX", "NAXIS", "PCOUNT", "GCOUNT", "TFIELDS", "TTYPE", "TFORM", "TUNIT"};
+    for (auto& tableKeyword : tableKeywords)
+    {
+        if (keyword.startsWith(tableKeyword))
+            return true;
+    }
+    return false;
+}
+
+bool FitsHeaderScanner::scanFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    return scan(file);
+}
+
+bool FitsHeaderScanner::scan(QIODevice &device)
+{
+    static LatencyHistogram& scanLatency = Metrics::histogram("fits.header_scan");
+    ScopedLatency latency(scanLatency);
+
+    _tags.clear();
+    QByteArray header;
+    if (!readHeaderUnit(device, header) || !header.startsWith("SIMPLE  ="))
+        return false;
+    int valueStart;
+    cardKeyword(header.constData(), valueStart);
+    if (cardValue(header.constData(), valueStart) != "T")
+        return false;
+
+    keepKeywords(header, false);
+    HeaderUnit unit = parseHeaderUnit(header);
+    qint64 offset = header.size();
+    for (int extension = 0; !unit.isImage && extension < MAX_EXTENSIONS; extension++)
+    {
+        // Only the headers are read, the data units are skipped
+        offset += unit.dataSize;
+        if (!device.seek(offset) || !readHeaderUnit(device, header))
+            break;
+        unit = parseHeaderUnit(header);
+        if (unit.isImage)
+            keepKeywords(header, unit.isCompressed);
+        offset += header.size();
+    }
+    return true;
+}
+
+/*!
+ * \brief FitsHeaderScanner::readHeaderUnit
+ * Reads blocks from the device until the one with the END card.
+ */
+bool FitsHeaderScanner::readHeaderUnit(QIODevice &device, QByteArray &header)
+{
+    header.clear();
+    for (int block = 0; block < MAX_HEADER_BLOCKS; block++)
+    {
+        const qint64 start = header.size();
+        header.resize(start + FITS_BLOCK_SIZE);
+        if (device.read(header.data() + start, FITS_BLOCK_SIZE) != FITS_BLOCK_SIZE)
+            return false;
+        for (qint64 card = start; card < header.size(); card += FITS_CARD_SIZE)
+        {
+            if (qstrncmp(header.constData() + card, "END     ", 8) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * \brief FitsHeaderScanner::parseHeaderUnit
+ * Whether the HDU has a 2D (or 3D) image, like FitsFile::findImageHdu, and the size of
+ * its data unit. Tile compressed images are binary tables with ZIMAGE = T.
+ */
+FitsHeaderScanner::HeaderUnit FitsHeaderScanner::parseHeaderUnit(const QByteArray &header)
+{
+    QByteArray xtension;
+    bool zimage = false;
+    int bitpix = 0;
+    int naxis = 0;
+    int znaxis = 0;
+    qint64 naxes[4] = {0, 0, 0, 0};
+    qint64 znaxes[3] = {0, 0, 0};
+    qint64 pcount = 0;
+    qint64 gcount = 1;
+    qint64 axisProduct = 1;
+
+    for (qint64 offset = 0; offset + FITS_CARD_SIZE <= header.size(); offset += FITS_CARD_SIZE)
+    {
+        const char* card = header.constData() + offset;
+        int valueStart;
+        const QByteArray keyword = cardKeyword(card, valueStart);
+        if (keyword == "END")
+            break;
+        if (valueStart < 0)
+            continue;
+
+        const QByteArray value = cardValue(card, valueStart);
+        if (keyword == "XTENSION")
+            xtension = value;
+        else if (keyword == "ZIMAGE")
+            zimage = value == "T";
+        else if (keyword == "BITPIX")
+            bitpix = value.toInt();
+        else if (keyword == "NAXIS")
+            naxis = value.toInt();
+        else if (keyword == "ZNAXIS")
+            znaxis = value.toInt();
+        else if (keyword == "PCOUNT")
+            pcount = value.toLongLong();
+        else if (keyword == "GCOUNT")
+            gcount = value.toLongLong();
+        else if (keyword.startsWith("NAXIS"))
+        {
+            const int axis = keyword.mid(5).toInt();
+            if (axis >= 1 && axis <= naxis)
+            {
+                axisProduct *= value.toLongLong();
+                if (axis <= 4)
+                    naxes[axis - 1] = value.toLongLong();
+            }
+        }
+        else if (keyword.startsWith("ZNAXIS"))
+        {
+            const int axis = keyword.mid(6).toInt();
+            if (axis >= 1 && axis <= 3)
+                znaxes[axis - 1] = value.toLongLong();
+        }
+    }
+
+    HeaderUnit unit;
+    if (xtension.isEmpty() || xtension == "IMAGE")
+        unit.isImage = naxis >= 2 && naxes[0] > 0 && naxes[1] > 0;
+    else if (xtension == "BINTABLE" && zimage)
+        unit.isImage = unit.isCompressed = znaxis >= 2 && znaxes[0] > 0 && znaxes[1] > 0;
+
+    if (naxis > 0)
+    {
+        const qint64 bits = qAbs(bitpix) * gcount * (pcount + axisProduct);
+        const qint64 bytes = (bits + 7) / 8;
+        unit.dataSize = (bytes + FITS_BLOCK_SIZE - 1) / FITS_BLOCK_SIZE * FITS_BLOCK_SIZE;
+    }
+    return unit;
+}
+
+/*!
+ * \brief FitsHeaderScanner::keepKeywords
+ * Adds the keywords of the header to the tags, replacing the ones already there.
+ * The image keywords of a compressed image are kept as ZBITPIX, ZNAXIS, ZNAXISn.
+ */
+void FitsHeaderScanner::keepKeywords(const QByteArray &header, bool isCompressed)
+{
+    for (qint64 offset = 0; offset + FITS_CARD_SIZE <= header.size(); offset += FITS_CARD_SIZE)
+    {
+        const char* card = header.constData() + offset;
+        int valueStart;
+        const QByteArray name = cardKeyword(card, valueStart);
+        if (name == "END")
+            break;
+
+        QString keyword = QString::fromLatin1(name).remove('\'');
+        if (isCompressed)
+        {
+            if (isCompressedTableKeyword(keyword))
+                continue;
+            if (keyword == "ZBITPIX" || keyword.startsWith("ZNAXIS"))
+                keyword.remove(0, 1);
+        }
+        _tags.insert(keyword, QString::fromLatin1(cardValue(card, valueStart)));
+    }
+}
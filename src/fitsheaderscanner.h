@@ -0,0 +1,77 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FITSHEADERSCANNER_H
+#define FITSHEADERSCANNER_H
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+
+class QIODevice;
+
+/*!
+ * \brief The FitsHeaderScanner class
+ * Reads the keywords of a FITS file without cfitsio, for the header phase of the
+ * ingest. Only the 2880 byte header blocks are read, the data units are skipped,
+ * and the scan stops at the first HDU with an image, so a file with the image in
+ * its primary HDU takes a single small read.
+ *
+ * The keywords are the ones FitsFile::extractTags reads: those of the primary
+ * header, and of the image extension when the image is in one, which take
+ * precedence. Cards are parsed in place, only the kept keywords and values are
+ * made into strings.
+ *
+ * Gzipped files and files that do not start with SIMPLE are not scanned, they are
+ * read with cfitsio instead.
+ */
+class FitsHeaderScanner
+{
+public:
+    // Returns false when the file is not a FITS file the scanner reads
+    bool scanFile(const QString& path);
+    bool scan(QIODevice& device);
+
+    const QMap<QString, QString>& tags() const { return _tags; }
+
+    // The keywords describing the binary table a compressed image is stored in, not the image
+    static bool isCompressedTableKeyword(const QString& keyword);
+
+private:
+    struct HeaderUnit
+    {
+        bool isImage = false;
+        bool isCompressed = false;
+        // The bytes of the data unit after the header, padded to whole blocks
+        qint64 dataSize = 0;
+    };
+
+    bool readHeaderUnit(QIODevice& device, QByteArray& header);
+    static HeaderUnit parseHeaderUnit(const QByteArray& header);
+    void keepKeywords(const QByteArray& header, bool isCompressed);
+
+    QMap<QString, QString> _tags;
+};
+
+#endif // FITSHEADERSCANNER_H
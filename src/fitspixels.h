@@ -0,0 +1,120 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FITSPIXELS_H
+#define FITSPIXELS_H
+
+#include <QtEndian>
+
+#include <cstdint>
+#include <type_traits>
+
+/*
+ * Decodes one pixel of an uncompressed FITS data unit, as it is stored in the file:
+ * big-endian, and for unsigned 16 bit images with the BZERO of 32768 still to be
+ * applied. Gives the same value fits_read_img would.
+ */
+template <typename T>
+inline T fitsStoredPixel(const unsigned char* p)
+{
+    return qFromBigEndian<T>(p);
+}
+
+template <>
+inline uint16_t fitsStoredPixel<uint16_t>(const unsigned char* p)
+{
+    return qFromBigEndian<uint16_t>(p) ^ 0x8000;
+}
+
+// Names the pixel type in the metrics of the kernels instantiated for it
+template <typename T> constexpr const char* fitsPixelTypeName();
+template <> constexpr const char* fitsPixelTypeName<int8_t>() { return "int8"; }
+template <> constexpr const char* fitsPixelTypeName<uint8_t>() { return "uint8"; }
+template <> constexpr const char* fitsPixelTypeName<int16_t>() { return "int16"; }
+template <> constexpr const char* fitsPixelTypeName<uint16_t>() { return "uint16"; }
+template <> constexpr const char* fitsPixelTypeName<int32_t>() { return "int32"; }
+template <> constexpr const char* fitsPixelTypeName<uint32_t>() { return "uint32"; }
+template <> constexpr const char* fitsPixelTypeName<int64_t>() { return "int64"; }
+template <> constexpr const char* fitsPixelTypeName<uint64_t>() { return "uint64"; }
+template <> constexpr const char* fitsPixelTypeName<float>() { return "float"; }
+template <> constexpr const char* fitsPixelTypeName<double>() { return "double"; }
+
+/*
+ * Pixel readers for the image kernels. Kernels are templated on the reader, so their
+ * inner loops have no branch on where the pixels come from.
+ */
+
+// Pixels already read into memory
+template <typename T>
+struct NativePixels
+{
+    const T* data;
+    inline T operator()(long long index) const { return data[index]; }
+};
+
+// Pixels of a mapped FITS data unit, decoded when read
+template <typename T>
+struct StoredPixels
+{
+    const unsigned char* data;
+    inline T operator()(long long index) const { return fitsStoredPixel<T>(data + index * sizeof(T)); }
+};
+
+// Sums of integer pixels are kept as integers, so an average of one cell gives the exact values
+template <typename T>
+using PixelSum = typename std::conditional<std::is_floating_point<T>::value, double, long long>::type;
+
+template <int Factor, typename Sum, typename Pixels>
+inline void addRowToCellsOf(const Pixels& pixels, long long row, long long outWidth, Sum* sums)
+{
+    for (long long x = 0; x < outWidth; x++)
+    {
+        for (int k = 0; k < Factor; k++)
+            sums[x] += pixels(row + x * Factor + k);
+    }
+}
+
+/*
+ * Adds a row of pixels to the sums of the factor pixel wide cells they are in: pixels
+ * [x * factor, (x + 1) * factor) of the row to sums[x]. The usual factors are template
+ * arguments, so the inner loop is unrolled and the compiler can vectorize the outer one.
+ */
+template <typename Sum, typename Pixels>
+inline void addRowToCells(const Pixels& pixels, long long row, long long outWidth, int factor, Sum* sums)
+{
+    switch (factor)
+    {
+    case 1: addRowToCellsOf<1>(pixels, row, outWidth, sums); return;
+    case 2: addRowToCellsOf<2>(pixels, row, outWidth, sums); return;
+    case 4: addRowToCellsOf<4>(pixels, row, outWidth, sums); return;
+    case 8: addRowToCellsOf<8>(pixels, row, outWidth, sums); return;
+    }
+    for (long long x = 0; x < outWidth; x++)
+    {
+        for (int k = 0; k < factor; k++)
+            sums[x] += pixels(row + x * factor + k);
+    }
+}
+
+#endif // FITSPIXELS_H
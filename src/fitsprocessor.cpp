@@ -23,34 +23,102 @@
 */
 
 #include "fitsprocessor.h"
+#include "asyncfileio.h"
 #include "fitsio.h"
 #include "fitsfile.h"
+#include "linearthumbnail.h"
+#include "metrics.h"
+
+#include <QSettings>
+
+#define THUMBNAIL_SIZE LARGEST_THUMBNAIL_SIZE
+#define ANALYZE_FRAMES true
 
 QImage makeThumbnail(const QImage &image)
 {
-    QImage small = image.scaled( QSize(200, 200), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    QImage small = image.scaled( QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
     return small;
 }
 
 void FitsProcessor::extractTags()
 {
+    if (_headerScanned)
+    {
+        _tags = headerScanner.tags();
+        return;
+    }
     fits.extractTags();
     _tags = fits.getTags();
 }
 
 void FitsProcessor::extractThumbnail()
 {
-    fits.extractImage();
+    // Read once, the processing threads all make a FitsProcessor
+    static const bool analyzeFrames = QSettings().value("AnalyzeFrames", ANALYZE_FRAMES).toBool();
+    fits.setAnalyzeFrame(analyzeFrames);
+    fits.setMakeLinearImage(true);
+    fits.setCancellationToken(cancellationToken);
+
+    // Only the thumbnail is kept, so the image is binned while it is read
+    fits.extractImage(THUMBNAIL_SIZE);
     auto image = fits.getImage();
     _thumbnail = makeThumbnail(image);
+    _linearThumbnail = LinearThumbnail::scaled(fits.getLinearImage(), LINEAR_THUMBNAIL_SIZE);
     _imageHash = fits.getImageHash();
+    _stretchParams = fits.getStretchParams().toByteArray();
+    _frameQuality = fits.getFrameQuality();
 }
 
 bool FitsProcessor::loadFile(const AstroFile &astroFile)
 {
+    useStoredStretchParams(astroFile);
     return fits.loadFile(astroFile.FullPath);
 }
 
+bool FitsProcessor::loadFile(const AstroFile &astroFile, const FileReader &reader)
+{
+    useStoredStretchParams(astroFile);
+    return fits.loadFile(astroFile.FullPath, reader.data(), reader.size());
+}
+
+/*!
+ * \brief FitsProcessor::loadHeader
+ * Reads the headers with the FitsHeaderScanner, which skips the data units. cfitsio
+ * opens the files the scanner does not read, like gzipped ones.
+ */
+bool FitsProcessor::loadHeader(const AstroFile &astroFile)
+{
+    return loadHeader(astroFile, QByteArray());
+}
+
+bool FitsProcessor::loadHeader(const AstroFile &astroFile, const QByteArray &head)
+{
+    static std::atomic<qint64>& fallbackCount = Metrics::counter("fits.header_scan_fallbacks");
+    if (head.isEmpty())
+        _headerScanned = headerScanner.scanFile(astroFile.FullPath);
+    else
+    {
+        PrefetchedFile file(astroFile.FullPath, head);
+        _headerScanned = file.open(QIODevice::ReadOnly) && headerScanner.scan(file);
+    }
+    if (_headerScanned)
+        return true;
+    fallbackCount++;
+    return loadFile(astroFile);
+}
+
+/*!
+ * \brief FitsProcessor::useStoredStretchParams
+ * A file rendered again, at any size, is stretched with the parameters stored when it
+ * was ingested, instead of calculating its statistics again. New files have none.
+ */
+void FitsProcessor::useStoredStretchParams(const AstroFile &astroFile)
+{
+    StretchParams params;
+    if (StretchParams::fromByteArray(astroFile.StretchParameters, params))
+        fits.setStretchParams(params);
+}
+
 
 QMap<QString, QString> FitsProcessor::getTags()
 {
@@ -64,10 +132,41 @@ QImage FitsProcessor::getThumbnail()
 
 QImage FitsProcessor::getTinyThumbnail()
 {
-    return _thumbnail.scaled(20, 20, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    // Scaled once from the thumbnail
+    if (_tinyThumbnail.isNull() && !_thumbnail.isNull())
+        _tinyThumbnail = _thumbnail.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return _tinyThumbnail;
 }
 
 QByteArray FitsProcessor::getImageHash()
 {
     return _imageHash;
 }
+
+QByteArray FitsProcessor::getStretchParams()
+{
+    return _stretchParams;
+}
+
+QImage FitsProcessor::getLinearThumbnail()
+{
+    return _linearThumbnail;
+}
+
+FrameQuality FitsProcessor::getFrameQuality()
+{
+    return _frameQuality;
+}
+
+void FitsProcessor::reset()
+{
+    fits.close();
+    _headerScanned = false;
+    _tags.clear();
+    _thumbnail = QImage();
+    _tinyThumbnail = QImage();
+    _linearThumbnail = QImage();
+    _imageHash.clear();
+    _stretchParams.clear();
+    _frameQuality = FrameQuality();
+}
@@ -27,24 +27,40 @@
 
 #include "fileprocessor.h"
 #include "fitsfile.h"
+#include "fitsheaderscanner.h"
 
 class FitsProcessor : public FileProcessor
 {
 public:
     bool loadFile(const AstroFile &astroFile);
+    bool loadFile(const AstroFile &astroFile, const FileReader& reader);
+    bool loadHeader(const AstroFile &astroFile);
+    bool loadHeader(const AstroFile &astroFile, const QByteArray &head);
     void extractTags();
     void extractThumbnail();
     QByteArray getImageHash();
+    QByteArray getStretchParams();
+    QImage getLinearThumbnail();
+    FrameQuality getFrameQuality();
     QMap<QString, QString> getTags();
     QImage getThumbnail();
     QImage getTinyThumbnail();
+    void reset();
 
 private:
     QMap<QString, QString> _tags;
     QImage _thumbnail;
+    QImage _tinyThumbnail;
+    QImage _linearThumbnail;
     QByteArray _imageHash;
+    QByteArray _stretchParams;
+    FrameQuality _frameQuality;
 
     FitsFile fits;
+    FitsHeaderScanner headerScanner;
+    // The tags are the ones of the headerScanner, the file was not opened with cfitsio
+    bool _headerScanned = false;
+    void useStoredStretchParams(const AstroFile& astroFile);
 };
 
 #endif // FITSPROCESSOR_H
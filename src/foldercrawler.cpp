@@ -23,30 +23,312 @@
 */
 
 #include "foldercrawler.h"
+#include "allocationtracker.h"
+#include "directorywalker.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "volumeio.h"
 
-#include <QDirIterator>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSettings>
+
+#define CRAWL_BATCH_SIZE            256
+#define CRAWL_BATCH_INTERVAL        100
+#define CRAWL_LOCAL_CONCURRENCY     4
+#define CRAWL_NETWORK_CONCURRENCY   1
+#define CRAWL_OBJECT_STORE_CONCURRENCY 8
+
+// File systems with coarse timestamps (FAT, HFS+) may not change a directory's
+// modification time for a change made right after we listed it. Directories
+// modified this recently are not trusted and will be listed again next time.
+#define DIRECTORY_MTIME_SETTLE      2000
+
+struct FolderCrawler::CrawlState
+{
+    QString rootFolder;
+    QMutex mutex;
+    QVector<FileRecord> batch;
+    QElapsedTimer batchTimer;
+    int pendingDirectories = 0;
+    QList<DirectoryState> updated;
+    QStringList removed;
+    QStringList visited;
+};
+
+static QString parentPath(const QString& path)
+{
+    int index = path.lastIndexOf('/');
+    return index > 0 ? path.left(index) : QString();
+}
 
 FolderCrawler::FolderCrawler(QObject *parent) : QObject(parent)
 {
 
 }
 
+FolderCrawler::~FolderCrawler()
+{
+    cancel();
+    for (auto pool : volumePools)
+    {
+        pool->clear();
+        pool->waitForDone();
+        delete pool;
+    }
+}
+
 void FolderCrawler::cancel()
 {
     cancelSignaled = true;
+    setPaused(false);
+}
+
+void FolderCrawler::setPaused(bool shouldPause)
+{
+    QMutexLocker locker(&pauseMutex);
+    paused = shouldPause;
+    if (!paused)
+        pauseCondition.wakeAll();
+}
+
+void FolderCrawler::setConcurrency(int concurrency)
+{
+    QMutexLocker locker(&poolsMutex);
+    concurrencyOverride = qMax(0, concurrency);
+}
+
+void FolderCrawler::waitWhilePaused()
+{
+    QMutexLocker locker(&pauseMutex);
+    while (paused && !cancelSignaled)
+        pauseCondition.wait(&pauseMutex);
+}
+
+void FolderCrawler::setDirectoryManifest(const QList<DirectoryState>& directories)
+{
+    QWriteLocker locker(&manifestLock);
+    manifest.clear();
+    manifestChildren.clear();
+    for (auto& directory : directories)
+    {
+        manifest.insert(directory.Path, directory);
+        manifestChildren.insert(parentPath(directory.Path), directory.Path);
+    }
+}
+
+void FolderCrawler::forgetDirectory(const QString &path)
+{
+    QWriteLocker locker(&manifestLock);
+    removeManifestEntries(QDir::cleanPath(path));
+}
+
+void FolderCrawler::removeManifestEntries(const QString &path)
+{
+    // The caller must hold manifestLock for writing
+    QString prefix = path + '/';
+    for (auto it = manifest.begin(); it != manifest.end(); )
+    {
+        if (it.key() == path || it.key().startsWith(prefix))
+        {
+            manifestChildren.remove(parentPath(it.key()), it.key());
+            it = manifest.erase(it);
+        }
+        else
+            ++it;
+    }
 }
 
 void FolderCrawler::crawl(QString rootFolder)
 {
-    QStringList extensions = {"*.fits", "*.fit", "*.xisf", "*.jpg", "*.jpeg", "*.png", "*.gif", "*.tif", "*.tiff", "*.bmp"};
+    rootFolder = QDir::cleanPath(rootFolder);
+    QThreadPool* pool = poolForVolume(rootFolder);
+
+    QSharedPointer<CrawlState> state(new CrawlState);
+    state->rootFolder = rootFolder;
+    state->batch.reserve(CRAWL_BATCH_SIZE);
+    state->batchTimer.start();
+    state->pendingDirectories = 1;
+
+    pool->start([=]() {
+        walkDirectory(rootFolder, pool, state);
+    });
+}
+
+QThreadPool* FolderCrawler::poolForVolume(const QString &rootFolder)
+{
+    // A bucket is listed a request per directory, the walkers wait on the network and not on a disk
+    const bool isObjectStore = ObjectStore::isObjectPath(rootFolder);
+    QStorageInfo storageInfo;
+    if (!isObjectStore)
+        storageInfo.setPath(rootFolder);
 
-    QDirIterator it(rootFolder, extensions, QDir::Files, QDirIterator::Subdirectories);
-    while (it.hasNext())
+    QMutexLocker locker(&poolsMutex);
+    QString key = isObjectStore ? ObjectStore::bucketRootOf(rootFolder) : storageInfo.isValid() ? storageInfo.rootPath() : QString();
+    QThreadPool* pool = volumePools.value(key, nullptr);
+    if (pool == nullptr)
+    {
+        pool = new QThreadPool;
+        const int concurrency = isObjectStore ? CRAWL_OBJECT_STORE_CONCURRENCY : concurrencyForVolume(storageInfo);
+        pool->setMaxThreadCount(concurrencyOverride > 0 ? concurrencyOverride : concurrency);
+        volumePools.insert(key, pool);
+        qDebug() << "Crawling volume" << key << "with" << pool->maxThreadCount() << "threads";
+    }
+    return pool;
+}
+
+void FolderCrawler::walkDirectory(const QString &directory, QThreadPool* pool, QSharedPointer<CrawlState> state)
+{
+    static LatencyHistogram& directoryLatency = Metrics::histogram("crawler.directory");
+    static AllocationCounter& crawlAllocations = AllocationTracker::counter("crawler.directory");
+    ScopedLatency latency(directoryLatency);
+    AllocationScope allocations(crawlAllocations);
+    // Read before listing, so a change made while we list shows up as modified next time
+    QDateTime lastModifiedTime = QFileInfo(directory).lastModified();
+    qint64 lastModified = lastModifiedTime.isValid() ? lastModifiedTime.toMSecsSinceEpoch() : 0;
+    QStringList knownChildren = knownSubdirectories(directory);
+    {
+        QMutexLocker locker(&state->mutex);
+        state->visited.append(directory);
+    }
+
+    if (isUnchanged(directory, lastModified))
+    {
+        // Nothing was added, removed or renamed in this directory since the last
+        // crawl, so it does not need to be listed. Its subdirectories still might.
+        for (auto& subDirectory : knownChildren)
+        {
+            if (cancelSignaled)
+                break;
+            if (QFileInfo(subDirectory).isDir())
+                walkSubdirectory(subDirectory, pool, state);
+        }
+        finishDirectory(state.data());
+        return;
+    }
+
+    // Listed in bulk, so the files come with their size and times and are not stat'ed again
+    waitWhilePaused();
+    QVector<FileRecord> files;
+    QStringList subDirectories;
+    if (!cancelSignaled)
+        DirectoryWalker::list(directory, files, subDirectories);
+    for (auto& subDirectory : subDirectories)
     {
         if (cancelSignaled)
-            return;
-        it.next();
-        emit fileFound(it.fileInfo());
+            break;
+        walkSubdirectory(subDirectory, pool, state);
+    }
+
+    if (!files.isEmpty() && !cancelSignaled)
+        addFiles(files, state.data());
+
+    if (!cancelSignaled)
+    {
+        DirectoryState directoryState;
+        directoryState.Path = directory;
+        directoryState.EntryCount = files.count();
+        if (QDateTime::currentMSecsSinceEpoch() - lastModified > DIRECTORY_MTIME_SETTLE)
+            directoryState.LastModifiedTime = lastModified;
+
+        QMutexLocker locker(&state->mutex);
+        state->updated.append(directoryState);
+        for (auto& child : knownChildren)
+        {
+            if (!subDirectories.contains(child))
+                state->removed.append(child);
+        }
     }
-    qDebug() << "Done crawling... " << rootFolder;
+    finishDirectory(state.data());
+}
+
+void FolderCrawler::walkSubdirectory(const QString &directory, QThreadPool *pool, QSharedPointer<CrawlState> state)
+{
+    {
+        QMutexLocker locker(&state->mutex);
+        state->pendingDirectories++;
+    }
+    if (pool->maxThreadCount() > 1)
+        pool->start([=]() { walkDirectory(directory, pool, state); });
+    else
+        walkDirectory(directory, pool, state);
+}
+
+bool FolderCrawler::isUnchanged(const QString &directory, qint64 lastModified)
+{
+    if (lastModified == 0)
+        return false;
+
+    QReadLocker locker(&manifestLock);
+    auto it = manifest.constFind(directory);
+    return it != manifest.constEnd() && it->LastModifiedTime == lastModified;
+}
+
+QStringList FolderCrawler::knownSubdirectories(const QString &directory)
+{
+    QReadLocker locker(&manifestLock);
+    return manifestChildren.values(directory);
+}
+
+void FolderCrawler::addFiles(const QVector<FileRecord> &files, CrawlState *state)
+{
+    static std::atomic<qint64>& filesFoundCount = Metrics::counter("crawler.files");
+    filesFoundCount += files.count();
+    QMutexLocker locker(&state->mutex);
+    state->batch.append(files);
+
+    // Slow volumes can take a while to fill a batch, so flush on time as well
+    if (state->batch.count() >= CRAWL_BATCH_SIZE || state->batchTimer.elapsed() >= CRAWL_BATCH_INTERVAL)
+    {
+        emit filesFound(state->batch);
+        state->batch.clear();
+        state->batchTimer.restart();
+    }
+}
+
+void FolderCrawler::finishDirectory(CrawlState *state)
+{
+    QMutexLocker locker(&state->mutex);
+    if (--state->pendingDirectories > 0)
+        return;
+
+    if (cancelSignaled)
+        return;
+
+    if (!state->batch.isEmpty())
+        emit filesFound(state->batch);
+    state->batch.clear();
+
+    // Keep our own copy current, so crawling the same folder again in this session
+    // does not list the directories we just listed
+    {
+        QWriteLocker manifestLocker(&manifestLock);
+        for (auto& removed : state->removed)
+            removeManifestEntries(removed);
+        for (auto& directory : state->updated)
+        {
+            if (!manifest.contains(directory.Path))
+                manifestChildren.insert(parentPath(directory.Path), directory.Path);
+            manifest.insert(directory.Path, directory);
+        }
+    }
+
+    emit directoryManifestUpdated(state->updated, state->removed);
+    emit crawlFinished(state->rootFolder, state->visited);
+    qDebug() << "Done crawling... " << state->rootFolder << ":" << state->updated.count() << "directories listed";
+}
+
+int FolderCrawler::concurrencyForVolume(const QStorageInfo &storageInfo)
+{
+    int concurrency = VolumeIo::isNetworkFileSystem(storageInfo) ? CRAWL_NETWORK_CONCURRENCY : CRAWL_LOCAL_CONCURRENCY;
+
+    QSettings settings;
+    settings.beginGroup("CrawlerVolumeConcurrency");
+    QString name = storageInfo.name();
+    if (!name.isEmpty() && settings.contains(name))
+        concurrency = settings.value(name).toInt();
+    settings.endGroup();
+
+    return qMax(1, concurrency);
 }
@@ -25,24 +25,99 @@
 #ifndef FOLDERCRAWLER_H
 #define FOLDERCRAWLER_H
 
-#include <QFileInfo>
+#include "directorystate.h"
+#include "filerecord.h"
+
+#include <QHash>
+#include <QMap>
+#include <QMultiHash>
+#include <QMutex>
 #include <QObject>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QStorageInfo>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
 
+/*!
+ * \brief The FolderCrawler class
+ * Walks search folders and reports the image files it finds. Directories are
+ * listed with DirectoryWalker, which reads the size and times of the files along
+ * with their names.
+ *
+ * Each volume, as reported by QStorageInfo, gets its own thread pool, so roots
+ * on different disks are walked at the same time. Inside a volume, directories
+ * are walked in parallel up to the volume's concurrency. Network shares default
+ * to a single walker so they are not thrashed. The concurrency can be changed in
+ * the settings, per volume name, under "CrawlerVolumeConcurrency". The buckets of an
+ * object store get a pool each, with more walkers, as listing one is a request away.
+ *
+ * Directories whose modification time matches the directory manifest are not
+ * listed again, only their known subdirectories are checked. Files that are
+ * rewritten in place without touching their directory are not picked up by
+ * such a crawl.
+ */
 class FolderCrawler : public QObject
 {
     Q_OBJECT
 public:
     explicit FolderCrawler(QObject *parent = nullptr);
+    ~FolderCrawler();
     void cancel();
 
+    // Thread safe. While paused, the walkers stop before their next directory.
+    void setPaused(bool shouldPause);
+    // Directories listed at the same time on every volume crawled from now on,
+    // 0 for the default of each volume
+    void setConcurrency(int concurrency);
+
 public slots:
     virtual void crawl(QString rootFolder);
+    void setDirectoryManifest(const QList<DirectoryState>& directories);
+    void forgetDirectory(const QString& path);
 
 signals:
-    void fileFound(QFileInfo filePath);
+    // Files are reported in chunks, bounded by count and by time, so a large crawl
+    // does not flood the receivers with one queued event per file.
+    void filesFound(const QVector<FileRecord>& files);
+
+    // Emitted once a crawl of a root folder is complete, after its last filesFound
+    void directoryManifestUpdated(const QList<DirectoryState>& updated, const QStringList& removed);
+
+    // Every directory of the crawled tree, listed or not, so it can be watched for changes
+    void crawlFinished(const QString& rootFolder, const QStringList& directories);
 
 protected:
     volatile bool cancelSignaled = false;
+
+private:
+    struct CrawlState;
+
+    QThreadPool* poolForVolume(const QString& rootFolder);
+    void walkDirectory(const QString& directory, QThreadPool* pool, QSharedPointer<CrawlState> state);
+    void walkSubdirectory(const QString& directory, QThreadPool* pool, QSharedPointer<CrawlState> state);
+    bool isUnchanged(const QString& directory, qint64 lastModified);
+    QStringList knownSubdirectories(const QString& directory);
+    void removeManifestEntries(const QString& path);
+    void addFiles(const QVector<FileRecord>& files, CrawlState* state);
+    void finishDirectory(CrawlState* state);
+
+    static int concurrencyForVolume(const QStorageInfo& storageInfo);
+
+    void waitWhilePaused();
+
+    QMutex pauseMutex;
+    QWaitCondition pauseCondition;
+    bool paused = false;
+
+    QMutex poolsMutex;
+    QMap<QString, QThreadPool*> volumePools;
+    int concurrencyOverride = 0;
+
+    QReadWriteLock manifestLock;
+    QHash<QString, DirectoryState> manifest;
+    QMultiHash<QString, QString> manifestChildren;
 };
 
 #endif // FOLDERCRAWLER_H
@@ -26,14 +26,23 @@
 
 #include <QDir>
 
-FolderViewModel::FolderViewModel()
+FolderViewModel::FolderViewModel(QObject *parent) : QAbstractItemModel(parent)
 {
-    rootItem = invisibleRootItem();
-    rootFolder = new FolderNode();
+    Node root;
+    root.parent = -1;
+    root.row = 0;
+    // The volumes are always rows
+    root.isFetched = true;
+    nodes.append(root);
 }
 
-QStringList foo(const QString& str) {
-    QDir dir(str);
+/*!
+ * \brief pathComponents
+ * The names of the folders of a path, from the top, without the root.
+ */
+static QStringList pathComponents(const QString& path)
+{
+    QDir dir(path);
     QStringList folders;
     do
     {
@@ -46,72 +55,209 @@ QStringList foo(const QString& str) {
 
 void FolderViewModel::addItem(QString volume, QString folderPath)
 {
-    QStandardItem *parentItem = rootItem;
-    FolderNode* iterator = rootFolder;
-    int rootrow = 0;
-    for (auto child : iterator->children)
+    addItems({qMakePair(volume, folderPath)});
+}
+
+/*!
+ * \brief FolderViewModel::addItems
+ * Folders seen before are found in folderNodes, so only new folders walk the tree.
+ * The new children of the expanded folders become rows once all of them are made,
+ * so each of those folders gets a single model change.
+ */
+void FolderViewModel::addItems(const QList<QPair<QString, QString>>& volumeFolders)
+{
+    QSet<int> changedNodes;
+    for (auto& volumeFolder : volumeFolders)
     {
-        if (child->folderName == volume)
+        if (!folderNodes.contains(volumeFolder))
         {
-            iterator = child;
-            parentItem = parentItem->child(rootrow);
-            break;
+            int node = findOrCreateChild(0, volumeFolder.first);
+            for (auto& name : pathComponents(volumeFolder.second))
+                node = findOrCreateChild(node, name);
+            folderNodes.insert(volumeFolder, node);
         }
-        rootrow++;
+        changeCount(volumeFolder, 1, changedNodes);
     }
-    if (iterator == rootFolder)
+
+    for (int node = 0; node < nodes.count(); node++)
     {
-//        volumes.insert(volume);
-        auto node = new FolderNode();
-        node->folderName = volume;
-        iterator = node;
-        rootFolder->children.append(node);
-
-        QStandardItem *item = new QStandardItem(volume);
-        item->setData(QVariant::fromValue(node));
-        parentItem->appendRow(item);
-        parentItem = item;
+        Node& parent = nodes[node];
+        if (!parent.isFetched || parent.fetchedChildren == parent.children.count() || !isVisible(node))
+            continue;
+        beginInsertRows(indexOf(node), parent.fetchedChildren, parent.children.count() - 1);
+        parent.fetchedChildren = parent.children.count();
+        endInsertRows();
     }
+    notifyCountsChanged(changedNodes);
+}
+
+int FolderViewModel::findOrCreateChild(int parent, const QString &name)
+{
+    const QPair<int, QString> key(parent, name);
+    auto it = childIds.constFind(key);
+    if (it != childIds.constEnd())
+        return it.value();
+
+    Node node;
+    node.name = name;
+    node.parent = parent;
+    node.row = nodes[parent].children.count();
+    const int id = nodes.count();
+    nodes.append(node);
+    nodes[parent].children.append(id);
+    childIds.insert(key, id);
+    return id;
+}
+
+void FolderViewModel::removeItem(QString volume, QString folderPath)
+{
+    removeItems({qMakePair(volume, folderPath)});
+}
+
+void FolderViewModel::removeItems(const QList<QPair<QString, QString>> &volumeFolders)
+{
+    QSet<int> changedNodes;
+    for (auto& volumeFolder : volumeFolders)
+        changeCount(volumeFolder, -1, changedNodes);
+    notifyCountsChanged(changedNodes);
+}
 
-    folders[folderPath]++;
+// The counts of the folder and the folders above it
+void FolderViewModel::changeCount(const QPair<QString, QString> &volumeFolder, int change, QSet<int>& changedNodes)
+{
+    auto it = folderNodes.constFind(volumeFolder);
+    if (it == folderNodes.constEnd())
+        return;
+    for (int node = it.value(); node > 0; node = nodes.at(node).parent)
+    {
+        nodes[node].fileCount += change;
+        changedNodes.insert(node);
+    }
+}
 
-    auto paths = foo(folderPath);
-    for (auto path : paths)
+void FolderViewModel::notifyCountsChanged(const QSet<int> &changedNodes)
+{
+    for (int node : changedNodes)
     {
-        auto original = iterator;
-        int row = 0;
-        for (auto child : iterator->children)
-        {
-            if (child->folderName == path)
-            {
-                parentItem = parentItem->child(row);
-                iterator = child;
-                break;
-            }
-            row++;
-        }
-        if (iterator == original)
-        {
-            // we did not find it
-            auto node = new FolderNode();
-            node->folderName = path;
-            iterator->children.append(node);
-            iterator = node;
-
-            QStandardItem *item = new QStandardItem(path);
-            item->setData(folderPath);
-            parentItem->appendRow(item);
-            parentItem = item;
-        }
-        else
-        {
-            // we found it
+        if (!isVisible(node))
             continue;
-        }
+        const QModelIndex index = indexOf(node);
+        emit dataChanged(index, index, {Qt::DisplayRole, FileCountRole});
     }
 }
 
-void FolderViewModel::removeItem(QString volume, QString folderPath)
+// Whether the node is a row of the model
+bool FolderViewModel::isVisible(int node) const
 {
-    folders[folderPath]--;
+    for (; node > 0; node = nodes.at(node).parent)
+    {
+        if (nodes.at(node).row >= nodes.at(nodes.at(node).parent).fetchedChildren)
+            return false;
+    }
+    return true;
+}
+
+int FolderViewModel::nodeOf(const QModelIndex &index) const
+{
+    return index.isValid() ? int(index.internalId()) : 0;
+}
+
+QModelIndex FolderViewModel::indexOf(int node) const
+{
+    if (node <= 0)
+        return QModelIndex();
+    return createIndex(nodes.at(node).row, 0, quintptr(node));
+}
+
+QModelIndex FolderViewModel::index(int row, int column, const QModelIndex &parent) const
+{
+    const Node& node = nodes.at(nodeOf(parent));
+    if (column != 0 || row < 0 || row >= node.fetchedChildren)
+        return QModelIndex();
+    return createIndex(row, 0, quintptr(node.children.at(row)));
+}
+
+QModelIndex FolderViewModel::parent(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return QModelIndex();
+    return indexOf(nodes.at(nodeOf(index)).parent);
+}
+
+int FolderViewModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.column() > 0)
+        return 0;
+    return nodes.at(nodeOf(parent)).fetchedChildren;
+}
+
+int FolderViewModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return 1;
+}
+
+bool FolderViewModel::hasChildren(const QModelIndex &parent) const
+{
+    return !nodes.at(nodeOf(parent)).children.isEmpty();
+}
+
+bool FolderViewModel::canFetchMore(const QModelIndex &parent) const
+{
+    const Node& node = nodes.at(nodeOf(parent));
+    return node.fetchedChildren < node.children.count();
+}
+
+/*!
+ * \brief FolderViewModel::fetchMore
+ * Called by the view when a folder is expanded. Its children become rows, and the
+ * folders added under it later become rows as they come.
+ */
+void FolderViewModel::fetchMore(const QModelIndex &parent)
+{
+    const int id = nodeOf(parent);
+    Node& node = nodes[id];
+    node.isFetched = true;
+    if (node.fetchedChildren == node.children.count())
+        return;
+    beginInsertRows(parent, node.fetchedChildren, node.children.count() - 1);
+    node.fetchedChildren = node.children.count();
+    endInsertRows();
+}
+
+int FolderViewModel::fetchedCount() const
+{
+    int count = 0;
+    for (auto& node : nodes)
+        count += node.fetchedChildren;
+    return count;
+}
+
+QString FolderViewModel::pathOf(int node) const
+{
+    QStringList names;
+    // The volume is not part of the path
+    for (; node > 0 && nodes.at(node).parent > 0; node = nodes.at(node).parent)
+        names.prepend(nodes.at(node).name);
+    return "/" + names.join('/') + (names.isEmpty() ? "" : "/");
+}
+
+QVariant FolderViewModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
+
+    const int id = nodeOf(index);
+    const Node& node = nodes.at(id);
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        return QString("%1 (%2)").arg(node.name).arg(node.fileCount);
+    case Qt::ToolTipRole:
+    case FolderPathRole:
+        return pathOf(id);
+    case FileCountRole:
+        return node.fileCount;
+    }
+    return QVariant();
 }
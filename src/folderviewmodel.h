@@ -25,34 +25,80 @@
 #ifndef FOLDERVIEWMODEL_H
 #define FOLDERVIEWMODEL_H
 
-#include <QStandardItemModel>
+#include <QAbstractItemModel>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QVector>
 
-class FolderNode
+/*!
+ * \brief The FolderViewModel class
+ * The folders of the catalog as a tree of volumes and path components, with the number
+ * of files under each folder.
+ *
+ * The tree is a compact index of nodes, one per path component. The view only gets the
+ * children of the nodes it expanded, see fetchMore, so the folders of deep per-night
+ * structures nobody opens never become rows of the model. Folders added under a node
+ * that was not expanded are only added to the index.
+ *
+ * Nodes stay when their files are removed, with a count of 0, like folders on the disk.
+ */
+class FolderViewModel : public QAbstractItemModel
 {
+    Q_OBJECT
 public:
-    QString folderName;
-    QList<FolderNode*> children;
-    bool isChecked() const { return checked; }
-    void setChecked( bool set ) { checked = set; }
+    enum Roles
+    {
+        // The path of the folder, ending with a slash, "/" for a volume
+        FolderPathRole = Qt::UserRole + 1,
+        // The number of files in the folder and its subfolders
+        FileCountRole
+    };
 
-private:
-    bool checked;
-};
+    explicit FolderViewModel(QObject *parent = nullptr);
 
-class FolderViewModel : public QStandardItemModel
-{
-    Q_OBJECT
-public:
-    FolderViewModel();
     void addItem(QString volume, QString folderPath);
+    // Adds the folders of many rows, one pair per row, with one model change per expanded parent folder
+    void addItems(const QList<QPair<QString, QString>>& volumeFolders);
     void removeItem(QString volume, QString folderPath);
+    void removeItems(const QList<QPair<QString, QString>>& volumeFolders);
+
+    // QAbstractItemModel interface
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &index) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    // Nodes in the index, and rows the view was given
+    int nodeCount() const { return nodes.count(); }
+    int fetchedCount() const;
 
 private:
-//    QSet<QString> volumes;
-    QMap<QString, int> folders;
-    QStandardItem* rootItem;
-    FolderNode* rootFolder;
+    struct Node
+    {
+        QString name;
+        int parent;
+        int row; // Among the children of the parent
+        int fileCount = 0; // In the folder and its subfolders
+        int fetchedChildren = 0; // The children that are rows of the model
+        bool isFetched = false; // Whether the view asked for the children
+        QVector<int> children;
+    };
+    QVector<Node> nodes; // The invisible root first, its children are the volumes
+    QHash<QPair<int, QString>, int> childIds; // By parent and name
+    QHash<QPair<QString, QString>, int> folderNodes; // By volume and folder path
 
+    int nodeOf(const QModelIndex& index) const;
+    QModelIndex indexOf(int node) const;
+    bool isVisible(int node) const;
+    int findOrCreateChild(int parent, const QString& name);
+    void changeCount(const QPair<QString, QString>& volumeFolder, int change, QSet<int>& changedNodes);
+    void notifyCountsChanged(const QSet<int>& changedNodes);
+    QString pathOf(int node) const;
 };
 
 #endif // FOLDERVIEWMODEL_H
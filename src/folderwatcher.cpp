@@ -0,0 +1,207 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "folderwatcher.h"
+#include "directorywalker.h"
+#include "objectstore.h"
+
+#include <QFileInfo>
+
+// A changed directory is listed this long after its last change notification
+#define WATCH_DEBOUNCE_INTERVAL     2000
+
+// A file modified more recently than this is assumed to be still being written
+#define WATCH_FILE_SETTLE_INTERVAL  3000
+
+FolderWatcher::FolderWatcher(QObject *parent) : QObject(parent),
+    catalog(nullptr),
+    watcher(this),
+    debounceTimer(this)
+{
+    debounceTimer.setSingleShot(true);
+    debounceTimer.setInterval(WATCH_DEBOUNCE_INTERVAL);
+    connect(&watcher, &QFileSystemWatcher::directoryChanged, this, &FolderWatcher::directoryChanged);
+    connect(&debounceTimer, &QTimer::timeout, this, &FolderWatcher::processChangedDirectories);
+}
+
+void FolderWatcher::setCatalog(Catalog *cat)
+{
+    this->catalog = cat;
+}
+
+void FolderWatcher::cancel()
+{
+    cancelSignaled = true;
+}
+
+void FolderWatcher::watchDirectories(const QString &rootFolder, const QStringList &directories)
+{
+    if (cancelSignaled || watchLimitReached)
+        return;
+    // An object store has no change notifications, its objects are picked up by the next crawl
+    if (ObjectStore::isObjectPath(rootFolder))
+        return;
+
+    auto watchedList = watcher.directories();
+    QSet<QString> watched(watchedList.begin(), watchedList.end());
+    QStringList newDirectories;
+    for (auto& directory : directories)
+    {
+        if (!watched.contains(directory))
+            newDirectories.append(directory);
+    }
+    if (newDirectories.isEmpty())
+        return;
+
+    auto failed = watcher.addPaths(newDirectories);
+    if (!failed.isEmpty())
+    {
+        // Most likely the platform's watch limit (fs.inotify.max_user_watches on Linux).
+        // The directories that are not watched are still picked up by the next crawl.
+        watchLimitReached = true;
+        qDebug() << "Could not watch" << failed.count() << "directories under" << rootFolder;
+    }
+}
+
+void FolderWatcher::unwatchFolder(const QString &rootFolder)
+{
+    unwatchDirectories(QDir::cleanPath(rootFolder));
+    watchLimitReached = false;
+}
+
+void FolderWatcher::unwatchDirectories(const QString &folder)
+{
+    QString prefix = folder + '/';
+    QStringList toRemove;
+    for (auto& directory : watcher.directories())
+    {
+        if (directory == folder || directory.startsWith(prefix))
+            toRemove.append(directory);
+    }
+    if (!toRemove.isEmpty())
+        watcher.removePaths(toRemove);
+
+    for (auto it = changedDirectories.begin(); it != changedDirectories.end(); )
+    {
+        if (*it == folder || it->startsWith(prefix))
+            it = changedDirectories.erase(it);
+        else
+            ++it;
+    }
+}
+
+void FolderWatcher::directoryChanged(const QString &path)
+{
+    if (cancelSignaled)
+        return;
+
+    // Capture software writes a file in many small steps, each of which notifies
+    // the directory. Restarting the timer lists the directory once things calm down.
+    changedDirectories.insert(path);
+    debounceTimer.start();
+}
+
+void FolderWatcher::processChangedDirectories()
+{
+    auto directories = changedDirectories;
+    changedDirectories.clear();
+
+    QVector<FileRecord> found;
+    QStringList removed;
+    QStringList removedFolders;
+    for (auto& directory : directories)
+    {
+        if (cancelSignaled)
+            return;
+        processDirectory(directory, found, removed, removedFolders);
+    }
+
+    if (!found.isEmpty())
+        emit filesFound(found);
+    // Files the filter matched as moved are at their new path in the catalog now
+    removed.removeIf([&](const QString& path) { return !catalog->hasFile(path); });
+    if (!removed.isEmpty())
+        emit filesRemoved(removed);
+    for (auto& folder : removedFolders)
+        emit folderRemoved(folder);
+
+    // Files still being written put their directory back into changedDirectories
+    if (!changedDirectories.isEmpty() && !debounceTimer.isActive())
+        debounceTimer.start();
+}
+
+void FolderWatcher::processDirectory(const QString &directory, QVector<FileRecord>& found, QStringList& removed, QStringList& removedFolders)
+{
+    Q_ASSERT(catalog != nullptr);
+
+    if (!QFileInfo(directory).isDir())
+    {
+        unwatchDirectories(directory);
+        removedFolders.append(directory);
+        return;
+    }
+
+    QSet<QString> foundPaths;
+    auto watchedList = watcher.directories();
+    QSet<QString> watched(watchedList.begin(), watchedList.end());
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QVector<FileRecord> files;
+    QStringList subDirectories;
+    DirectoryWalker::list(directory, files, subDirectories);
+
+    // A new folder, maybe copied in with files already in it
+    for (auto& subDirectory : subDirectories)
+    {
+        if (!watched.contains(subDirectory))
+            emit crawlRequested(subDirectory);
+    }
+
+    for (auto& record : files)
+    {
+        const QString& path = record.FullPath;
+        foundPaths.insert(path);
+
+        auto pending = pendingFiles.constFind(path);
+        bool isSettling = now - record.LastModifiedTime < WATCH_FILE_SETTLE_INTERVAL;
+        bool hasChanged = pending != pendingFiles.constEnd() &&
+                (pending->size != record.Size || pending->lastModified != record.LastModifiedTime);
+        if (isSettling || hasChanged)
+        {
+            pendingFiles.insert(path, {record.Size, record.LastModifiedTime});
+            changedDirectories.insert(directory);
+            continue;
+        }
+        pendingFiles.remove(path);
+
+        // The filter drops the files that the catalog already has
+        found.append(record);
+    }
+
+    for (auto& path : catalog->getFilePathsInDirectory(directory))
+    {
+        if (!foundPaths.contains(path))
+            removed.append(path);
+    }
+}
@@ -0,0 +1,94 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#include "catalog.h"
+#include "filerecord.h"
+
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
+
+/*!
+ * \brief The FolderWatcher class
+ * Watches the directories of the search folders, so files written while the
+ * app is running are picked up without a re-crawl.
+ *
+ * Only directories are watched, which keeps the number of watches (inotify,
+ * FSEvents or ReadDirectoryChangesW, depending on the platform) to one per
+ * directory. A changed directory is listed again after a short delay. Files that
+ * are still being written are held back until their size and modification time
+ * stop changing.
+ *
+ * The changes of all the directories listed together are reported at once, files
+ * found before files removed and folders removed last, so a file moved between two
+ * of them is matched to its row before the row is taken for a deleted file.
+ */
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FolderWatcher(QObject *parent = nullptr);
+    void setCatalog(Catalog* cat);
+    void cancel();
+
+public slots:
+    void watchDirectories(const QString& rootFolder, const QStringList& directories);
+    void unwatchFolder(const QString& rootFolder);
+
+signals:
+    void filesFound(const QVector<FileRecord>& files);
+    void filesRemoved(const QStringList& fullPaths);
+    void folderRemoved(const QString& fullPath);
+    void crawlRequested(const QString& folder);
+
+private slots:
+    void directoryChanged(const QString& path);
+    void processChangedDirectories();
+
+private:
+    struct PendingFile
+    {
+        qint64 size;
+        qint64 lastModified;
+    };
+
+    void processDirectory(const QString& directory, QVector<FileRecord>& found, QStringList& removed, QStringList& removedFolders);
+    void unwatchDirectories(const QString& folder);
+
+    Catalog* catalog;
+    QFileSystemWatcher watcher;
+    QTimer debounceTimer;
+    QSet<QString> changedDirectories;
+    QHash<QString, PendingFile> pendingFiles;
+    bool watchLimitReached = false;
+    volatile bool cancelSignaled = false;
+};
+
+#endif // FOLDERWATCHER_H
@@ -0,0 +1,185 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "frameanalyzer.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Pixels sampled for the median and MAD of the background
+#define ANALYSIS_BACKGROUND_SAMPLES 65536
+// Times the noise above the background a peak needs to be a star
+#define ANALYSIS_DETECTION_SIGMA 5.0f
+// Times the noise above the background a pixel needs to count in the moments of a star
+#define ANALYSIS_MOMENT_SIGMA 3.0f
+// Pixels on each side of a peak the moments are taken over
+#define ANALYSIS_STAR_RADIUS 6
+// Pixels above the detection level a star needs, fewer are hot pixels or noise
+#define ANALYSIS_MIN_STAR_PIXELS 3
+// FWHM, in pixels of the plane, a star needs, narrower peaks are hot pixels
+#define ANALYSIS_MIN_FWHM 1.0f
+
+// Converts the standard deviation of a gaussian to its full width at half maximum
+static const float sigmaToFwhm = 2.3548f;
+
+static float median(std::vector<float>& values)
+{
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    return *middle;
+}
+
+/*!
+ * \brief FrameAnalyzer::analyze
+ * The background is estimated from evenly spaced samples, like the statistics of the
+ * stretch. A star is a pixel above the detection level that is the brightest within
+ * ANALYSIS_STAR_RADIUS, so the wings of a bright star and close pairs are only counted
+ * once. Frames without noise, like synthetic ones, are measured as having no stars.
+ */
+FrameQuality FrameAnalyzer::analyze(const float *plane, int width, int height, float pixelScale, std::vector<DetectedStar>* stars)
+{
+    static LatencyHistogram& analysisLatency = Metrics::histogram("analysis.frame");
+    ScopedLatency latency(analysisLatency);
+
+    FrameQuality quality;
+    const int radius = ANALYSIS_STAR_RADIUS;
+    if (width <= 2 * radius || height <= 2 * radius)
+        return quality;
+
+    const long long count = (long long)width * height;
+    const long long stride = std::max(1LL, count / ANALYSIS_BACKGROUND_SAMPLES);
+    std::vector<float> samples;
+    samples.reserve(count / stride + 1);
+    for (long long i = 0; i < count; i += stride)
+    {
+        if (!std::isnan(plane[i]))
+            samples.push_back(plane[i]);
+    }
+    if (samples.empty())
+        return quality;
+
+    const float background = median(samples);
+    for (float& sample : samples)
+        sample = std::fabs(sample - background);
+    const float noise = 1.4826f * median(samples);
+    quality.background = background;
+    quality.noise = noise;
+    quality.starCount = 0;
+    if (!(noise > 0))
+        return quality;
+
+    const float detectionLevel = background + ANALYSIS_DETECTION_SIGMA * noise;
+    const float momentLevel = background + ANALYSIS_MOMENT_SIGMA * noise;
+    std::vector<float> fwhms;
+    std::vector<float> eccentricities;
+    for (int y = radius; y < height - radius; y++)
+    {
+        const float* line = plane + (long long)y * width;
+        for (int x = radius; x < width - radius; x++)
+        {
+            const float peak = line[x];
+            if (!(peak > detectionLevel) || peak < line[x - 1] || peak < line[x + 1])
+                continue;
+
+            // The brightest pixel within the radius, the first one of a flat top
+            bool isPeak = true;
+            int detected = 0;
+            double sum = 0;
+            double sumX = 0;
+            double sumY = 0;
+            for (int dy = -radius; dy <= radius && isPeak; dy++)
+            {
+                const float* row = plane + (long long)(y + dy) * width + x;
+                for (int dx = -radius; dx <= radius; dx++)
+                {
+                    const float v = row[dx];
+                    if (v > peak || (v == peak && (dy < 0 || (dy == 0 && dx < 0))))
+                    {
+                        isPeak = false;
+                        break;
+                    }
+                    if (v > detectionLevel)
+                        detected++;
+                    if (v > momentLevel)
+                    {
+                        const double w = v - background;
+                        sum += w;
+                        sumX += w * dx;
+                        sumY += w * dy;
+                    }
+                }
+            }
+            if (!isPeak || detected < ANALYSIS_MIN_STAR_PIXELS || sum <= 0)
+                continue;
+
+            const double cx = sumX / sum;
+            const double cy = sumY / sum;
+            double xx = 0;
+            double yy = 0;
+            double xy = 0;
+            for (int dy = -radius; dy <= radius; dy++)
+            {
+                const float* row = plane + (long long)(y + dy) * width + x;
+                for (int dx = -radius; dx <= radius; dx++)
+                {
+                    const float v = row[dx];
+                    if (!(v > momentLevel))
+                        continue;
+                    const double w = v - background;
+                    xx += w * (dx - cx) * (dx - cx);
+                    yy += w * (dy - cy) * (dy - cy);
+                    xy += w * (dx - cx) * (dy - cy);
+                }
+            }
+            xx /= sum;
+            yy /= sum;
+            xy /= sum;
+
+            // The axes of the star are the eigenvalues of its second moments
+            const double mean = (xx + yy) / 2;
+            const double spread = std::sqrt((xx - yy) * (xx - yy) / 4 + xy * xy);
+            const double major = mean + spread;
+            const double minor = mean - spread;
+            if (minor <= 0)
+                continue;
+            const float fwhm = float(sigmaToFwhm * std::sqrt(mean));
+            if (fwhm < ANALYSIS_MIN_FWHM)
+                continue;
+
+            quality.starCount++;
+            if (stars != nullptr)
+                stars->push_back({float((x + cx + 0.5) * pixelScale), float((y + cy + 0.5) * pixelScale), float(sum)});
+            fwhms.push_back(fwhm);
+            eccentricities.push_back(float(std::sqrt(1 - minor / major)));
+        }
+    }
+
+    if (!fwhms.empty())
+    {
+        quality.fwhm = median(fwhms) * pixelScale;
+        quality.eccentricity = median(eccentricities);
+    }
+    return quality;
+}
@@ -0,0 +1,57 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef FRAMEANALYZER_H
+#define FRAMEANALYZER_H
+
+#include "astrofile.h"
+
+#include <vector>
+
+// A star found by FrameAnalyzer, in pixels of the full frame
+struct DetectedStar
+{
+    float x;
+    float y;
+    float flux; // Above the background, in pixel values of the plane
+};
+
+/*!
+ * \brief The FrameAnalyzer class
+ * Measures the quality of a frame for culling: the level and noise of its background,
+ * how many stars it has, and how large and how round they are.
+ *
+ * Stars are the local maxima well above the background, and their size and shape
+ * come from the second moments of the pixels around them, so no PSF is fitted.
+ * The frame is the binned one the thumbnail is made of, the FWHM is scaled back
+ * to the pixels of the full frame.
+ */
+class FrameAnalyzer
+{
+public:
+    // One plane of width by height pixels. pixelScale is the pixels of the full frame per pixel of the plane.
+    // The stars found are appended to stars when it is given, see PlateSolver.
+    static FrameQuality analyze(const float* plane, int width, int height, float pixelScale, std::vector<DetectedStar>* stars = nullptr);
+};
+
+#endif // FRAMEANALYZER_H
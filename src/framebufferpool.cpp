@@ -0,0 +1,213 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "framebufferpool.h"
+#include "memorybudget.h"
+
+#include <new>
+
+// Smaller buffers come from the heap directly, the pool is for frames
+#define FRAME_BUFFER_POOL_MIN_SIZE      (1024 * 1024)
+
+#define DEFAULT_FRAME_BUFFER_POOL_CAPACITY  (512LL * 1024 * 1024)
+
+// Buffers start on a page, so FileReader can read into them past the page cache,
+// see DIRECT_IO_ALIGNMENT
+#define FRAME_BUFFER_ALIGNMENT 4096
+
+static unsigned char* allocateBuffer(size_t size)
+{
+    return static_cast<unsigned char*>(operator new[](size, std::align_val_t(FRAME_BUFFER_ALIGNMENT), std::nothrow));
+}
+
+static void freeBuffer(unsigned char* buffer)
+{
+    operator delete[](buffer, std::align_val_t(FRAME_BUFFER_ALIGNMENT));
+}
+
+FrameBufferPool::FrameBufferPool()
+{
+    capacity = DEFAULT_FRAME_BUFFER_POOL_CAPACITY;
+    _releasedBytes = 0;
+    _acquiredBytes = 0;
+
+    // Through this, not instance(), which may still be constructing when the budget asks
+    MemoryBudget::add("Frame buffers in use", MemoryBudget::NoEviction, [this]() { QMutexLocker locker(&mutex); return _acquiredBytes; });
+    MemoryBudget::add("Pooled frame buffers", MemoryBudget::FrameBufferEviction, [this]() { QMutexLocker locker(&mutex); return _releasedBytes; },
+                      [this](qint64 bytes) { QMutexLocker locker(&mutex); return trimReleased(bytes); });
+}
+
+FrameBufferPool& FrameBufferPool::instance()
+{
+    static FrameBufferPool pool;
+    return pool;
+}
+
+/*!
+ * \brief FrameBufferPool::sizeClass
+ * Rounds up to a multiple of a quarter of the largest power of two not above size,
+ * so no more than a quarter of a buffer is wasted.
+ */
+size_t FrameBufferPool::sizeClass(size_t size)
+{
+    size_t power = 1;
+    while (power * 2 <= size)
+        power *= 2;
+    size_t step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+/*!
+ * \brief FrameBufferPool::acquire
+ * Returns an uninitialized buffer of at least size bytes, to be given back with release.
+ * Returns nullptr when the memory could not be allocated.
+ */
+unsigned char* FrameBufferPool::acquire(size_t size)
+{
+    if (size < FRAME_BUFFER_POOL_MIN_SIZE)
+        return allocateBuffer(size);
+
+    FrameBufferPool& pool = instance();
+    size_t bytes = sizeClass(size);
+    QMutexLocker locker(&pool.mutex);
+
+    unsigned char* buffer = nullptr;
+    auto it = pool.released.find(bytes);
+    if (it != pool.released.end())
+    {
+        buffer = it.value();
+        pool.released.erase(it);
+        pool.releaseOrder.removeOne(buffer);
+        pool._releasedBytes -= bytes;
+    }
+    else
+    {
+        buffer = allocateBuffer(bytes);
+        if (buffer == nullptr)
+        {
+            // Give the released buffers back to the heap, and try once more
+            pool.freeReleased(0);
+            buffer = allocateBuffer(bytes);
+            if (buffer == nullptr)
+                return nullptr;
+        }
+    }
+    pool.acquired.insert(buffer, bytes);
+    pool._acquiredBytes += bytes;
+    return buffer;
+}
+
+void FrameBufferPool::release(unsigned char *buffer)
+{
+    if (buffer == nullptr)
+        return;
+
+    FrameBufferPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+
+    auto it = pool.acquired.find(buffer);
+    if (it == pool.acquired.end())
+    {
+        // Below FRAME_BUFFER_POOL_MIN_SIZE
+        freeBuffer(buffer);
+        return;
+    }
+    size_t bytes = it.value();
+    pool.acquired.erase(it);
+    pool._acquiredBytes -= bytes;
+
+    if ((qint64)bytes > pool.capacity)
+    {
+        freeBuffer(buffer);
+        return;
+    }
+    pool.freeReleased(pool.capacity - bytes);
+    pool.released.insert(bytes, buffer);
+    pool.releaseOrder.append(buffer);
+    pool._releasedBytes += bytes;
+}
+
+void FrameBufferPool::releaseImageBuffer(void *buffer)
+{
+    release(static_cast<unsigned char*>(buffer));
+}
+
+void FrameBufferPool::setCapacity(qint64 capacity)
+{
+    FrameBufferPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    pool.capacity = capacity;
+    pool.freeReleased(capacity);
+}
+
+void FrameBufferPool::trim()
+{
+    FrameBufferPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    pool.freeReleased(0);
+}
+
+qint64 FrameBufferPool::trim(qint64 bytes)
+{
+    FrameBufferPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    return pool.trimReleased(bytes);
+}
+
+// Locked by the caller
+qint64 FrameBufferPool::trimReleased(qint64 bytes)
+{
+    const qint64 before = _releasedBytes;
+    freeReleased(qMax<qint64>(0, before - bytes));
+    return before - _releasedBytes;
+}
+
+qint64 FrameBufferPool::acquiredBytes()
+{
+    FrameBufferPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    return pool._acquiredBytes;
+}
+
+qint64 FrameBufferPool::releasedBytes()
+{
+    FrameBufferPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    return pool._releasedBytes;
+}
+
+// Frees the least recently released buffers until at most keep bytes are left. Locked by the caller.
+void FrameBufferPool::freeReleased(qint64 keep)
+{
+    while (_releasedBytes > keep && !releaseOrder.isEmpty())
+    {
+        unsigned char* buffer = releaseOrder.takeFirst();
+        auto it = released.begin();
+        while (it.value() != buffer)
+            ++it;
+        _releasedBytes -= it.key();
+        released.erase(it);
+        freeBuffer(buffer);
+    }
+}
@@ -0,0 +1,78 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef FRAMEBUFFERPOOL_H
+#define FRAMEBUFFERPOOL_H
+
+#include <QHash>
+#include <QList>
+#include <QMultiMap>
+#include <QMutex>
+
+/*!
+ * \brief The FrameBufferPool class
+ * Frame sized, page aligned buffers shared by all processing threads. A released
+ * buffer is kept, and handed out again to the next acquire of the same size class, so
+ * the frames of consecutive files reuse the same memory instead of fragmenting the heap.
+ *
+ * Requests are rounded up to size classes a quarter of a power of two apart. Buffers
+ * below FRAME_BUFFER_POOL_MIN_SIZE bypass the pool. At most capacity bytes are kept
+ * released, the least recently released buffers are freed beyond that, and trim()
+ * frees all of them, once processing is idle. The pool is accounted in the
+ * MemoryBudget, which frees released buffers under pressure.
+ */
+class FrameBufferPool
+{
+public:
+    static unsigned char* acquire(size_t size);
+    static void release(unsigned char* buffer);
+
+    // QImage cleanup function for images made over an acquired buffer
+    static void releaseImageBuffer(void* buffer);
+
+    static void setCapacity(qint64 capacity);
+    static void trim();
+    // Frees the least recently released buffers, about bytes of them. Returns the bytes freed.
+    static qint64 trim(qint64 bytes);
+
+    static qint64 acquiredBytes();
+    static qint64 releasedBytes();
+
+private:
+    FrameBufferPool();
+    static FrameBufferPool& instance();
+    static size_t sizeClass(size_t size);
+    void freeReleased(qint64 keep);
+    qint64 trimReleased(qint64 bytes);
+
+    QMutex mutex;
+    qint64 capacity;
+    qint64 _releasedBytes;
+    qint64 _acquiredBytes;
+    QHash<unsigned char*, size_t> acquired;
+    QMultiMap<size_t, unsigned char*> released;
+    QList<unsigned char*> releaseOrder;
+};
+
+#endif // FRAMEBUFFERPOOL_H
@@ -0,0 +1,301 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "gpubinner.h"
+#include "metrics.h"
+
+#include <QDebug>
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QSurfaceFormat>
+#include <QThread>
+#include <QThreadStorage>
+
+#include <atomic>
+#include <cstring>
+
+// Invocations of a work group, along the binned row
+#define GPU_BIN_LOCAL_SIZE 64
+// Of the samples the shader reads, see GpuBinner::sampleTypeOf
+#define GPU_BIN_SAMPLE_TYPES 5
+
+// Each sample type gets a program. The samples are read from the 32 bit words of the
+// rows as they are in memory, little-endian.
+static const char* binShaderSource = R"(
+layout(local_size_x = %1) in;
+layout(std430, binding = 0) readonly buffer Rows { uint words[]; };
+layout(std430, binding = 1) writeonly buffer Binned { float binned[]; };
+uniform uint width;
+uniform uint outWidth;
+uniform uint outRows;
+uniform uint factor;
+
+#if SAMPLE_TYPE == 0
+uint sampleAt(uint i) { return bitfieldExtract(words[i >> 2], int(i & 3u) * 8, 8); }
+#elif SAMPLE_TYPE == 1
+int sampleAt(uint i) { return bitfieldExtract(int(words[i >> 2]), int(i & 3u) * 8, 8); }
+#elif SAMPLE_TYPE == 2
+uint sampleAt(uint i) { return bitfieldExtract(words[i >> 1], int(i & 1u) * 16, 16); }
+#elif SAMPLE_TYPE == 3
+int sampleAt(uint i) { return bitfieldExtract(int(words[i >> 1]), int(i & 1u) * 16, 16); }
+#else
+float sampleAt(uint i) { return uintBitsToFloat(words[i]); }
+#endif
+
+void main()
+{
+    uint x = gl_GlobalInvocationID.x;
+    uint y = gl_GlobalInvocationID.y;
+    if (x >= outWidth || y >= outRows)
+        return;
+#if SAMPLE_TYPE == 4
+    float sum = 0.0;
+#elif SAMPLE_TYPE == 1 || SAMPLE_TYPE == 3
+    int sum = 0;
+#else
+    uint sum = 0u;
+#endif
+    for (uint row = y * factor; row < (y + 1u) * factor; row++)
+    {
+        for (uint i = row * width + x * factor; i < row * width + (x + 1u) * factor; i++)
+            sum += sampleAt(i);
+    }
+    uint cells = factor * factor;
+#if SAMPLE_TYPE == 4
+    binned[y * outWidth + x] = sum / float(cells);
+#elif SAMPLE_TYPE == 1 || SAMPLE_TYPE == 3
+    // Toward zero, like the integer division of the CPU
+    int average = abs(sum) / int(cells);
+    binned[y * outWidth + x] = float(sum < 0 ? -average : average);
+#else
+    binned[y * outWidth + x] = float(sum / cells);
+#endif
+}
+)";
+
+static QOffscreenSurface* offscreenSurface = nullptr;
+static std::atomic<bool> gpuAvailable {false};
+
+/*!
+ * \brief The GpuBinContext struct
+ * The context of a processing thread, with its programs and the buffers reused from
+ * band to band.
+ */
+struct GpuBinContext
+{
+    QOpenGLContext context;
+    QOpenGLExtraFunctions* functions = nullptr;
+    GLuint programs[GPU_BIN_SAMPLE_TYPES] = {};
+    GLuint rowsBuffer = 0;
+    GLuint binnedBuffer = 0;
+    bool failed = false;
+};
+static QThreadStorage<GpuBinContext*> threadContexts;
+
+static QSurfaceFormat computeFormat()
+{
+    QSurfaceFormat format;
+    if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGLES)
+    {
+        format.setRenderableType(QSurfaceFormat::OpenGLES);
+        format.setVersion(3, 1);
+    }
+    else
+    {
+        format.setRenderableType(QSurfaceFormat::OpenGL);
+        format.setVersion(4, 3);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+    }
+    return format;
+}
+
+static bool hasCompute(const QOpenGLContext& context)
+{
+    const QSurfaceFormat format = context.format();
+    if (context.isOpenGLES())
+        return format.version() >= qMakePair(3, 1);
+    return format.version() >= qMakePair(4, 3);
+}
+
+static GLuint compileProgram(QOpenGLExtraFunctions* f, bool isOpenGLES, int sampleType)
+{
+    const QByteArray source = QByteArray(isOpenGLES ? "#version 310 es\nprecision highp float;\nprecision highp int;\n" : "#version 430 core\n")
+        + "#define SAMPLE_TYPE " + QByteArray::number(sampleType) + "\n"
+        + QByteArray(binShaderSource).replace("%1", QByteArray::number(GPU_BIN_LOCAL_SIZE));
+    const char* sources[] = {source.constData()};
+    GLuint shader = f->glCreateShader(GL_COMPUTE_SHADER);
+    f->glShaderSource(shader, 1, sources, nullptr);
+    f->glCompileShader(shader);
+    GLint compiled = 0;
+    f->glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled)
+    {
+        char log[1024] = {};
+        f->glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        qDebug() << "Could not compile the binning shader:" << log;
+        f->glDeleteShader(shader);
+        return 0;
+    }
+    GLuint program = f->glCreateProgram();
+    f->glAttachShader(program, shader);
+    f->glLinkProgram(program);
+    f->glDeleteShader(shader);
+    GLint linked = 0;
+    f->glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        qDebug() << "Could not link the binning shader";
+        f->glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+/*!
+ * \brief threadContext
+ * The context of the calling thread, made current. Null when it could not be made,
+ * and then for every later call of the thread.
+ */
+static GpuBinContext* threadContext()
+{
+    if (!threadContexts.hasLocalData())
+    {
+        auto gpu = new GpuBinContext;
+        threadContexts.setLocalData(gpu);
+        gpu->context.setFormat(computeFormat());
+        if (!gpu->context.create() || !hasCompute(gpu->context) || !gpu->context.makeCurrent(offscreenSurface))
+        {
+            qDebug() << "No OpenGL compute context on" << QThread::currentThread()->objectName() << ", binning on the CPU";
+            gpu->failed = true;
+            return nullptr;
+        }
+        gpu->functions = gpu->context.extraFunctions();
+        gpu->functions->glGenBuffers(1, &gpu->rowsBuffer);
+        gpu->functions->glGenBuffers(1, &gpu->binnedBuffer);
+    }
+    GpuBinContext* gpu = threadContexts.localData();
+    if (gpu->failed || !gpu->context.makeCurrent(offscreenSurface))
+        return nullptr;
+    return gpu;
+}
+
+bool GpuBinner::initialize()
+{
+    Q_ASSERT(QThread::currentThread() == qApp->thread());
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    if (offscreenSurface != nullptr)
+        return gpuAvailable;
+
+    offscreenSurface = new QOffscreenSurface;
+    offscreenSurface->setFormat(computeFormat());
+    offscreenSurface->create();
+
+    // A context is made once here, to fall back to the CPU before any frame is read
+    QOpenGLContext context;
+    context.setFormat(computeFormat());
+    gpuAvailable = offscreenSurface->isValid() && context.create() && hasCompute(context) && context.makeCurrent(offscreenSurface);
+    if (gpuAvailable)
+    {
+        qDebug() << "Binning frames on" << reinterpret_cast<const char*>(context.functions()->glGetString(GL_RENDERER));
+        context.doneCurrent();
+    }
+    else
+        qDebug() << "No OpenGL 4.3 or OpenGL ES 3.1 context, binning frames on the CPU";
+#endif
+    return gpuAvailable;
+}
+
+bool GpuBinner::isAvailable()
+{
+    return gpuAvailable;
+}
+
+/*!
+ * \brief GpuBinner::binRows
+ * Uploads the rows into the rows buffer as they are, one invocation per binned
+ * sample sums its cell, and the binned rows are read back from the mapped buffer.
+ */
+bool GpuBinner::binRows(const void *rows, int sampleType, int sampleSize, long long width, long long rowCount, int factor, float *out)
+{
+    static LatencyHistogram& binLatency = Metrics::histogram("gpu.bin_rows");
+    static std::atomic<qint64>& binnedCount = Metrics::counter("gpu.binned_bands");
+    if (!gpuAvailable || factor <= 1)
+        return false;
+    const long long outWidth = width / factor;
+    const long long outRows = rowCount / factor;
+    if (outWidth == 0 || outRows == 0)
+        return true;
+
+    GpuBinContext* gpu = threadContext();
+    if (gpu == nullptr)
+        return false;
+    ScopedLatency latency(binLatency);
+    QOpenGLExtraFunctions* f = gpu->functions;
+    GLuint& program = gpu->programs[sampleType];
+    if (program == 0)
+        program = compileProgram(f, gpu->context.isOpenGLES(), sampleType);
+    if (program == 0)
+    {
+        gpu->failed = true;
+        return false;
+    }
+
+    // The words past the last sample are never read
+    const qint64 bytes = qint64(outRows) * factor * width * sampleSize;
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->rowsBuffer);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER, (bytes + 3) / 4 * 4, nullptr, GL_STREAM_DRAW);
+    f->glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, rows);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpu->rowsBuffer);
+    const qint64 binnedBytes = outRows * outWidth * qint64(sizeof(float));
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->binnedBuffer);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER, binnedBytes, nullptr, GL_STREAM_READ);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpu->binnedBuffer);
+
+    f->glUseProgram(program);
+    f->glUniform1ui(f->glGetUniformLocation(program, "width"), GLuint(width));
+    f->glUniform1ui(f->glGetUniformLocation(program, "outWidth"), GLuint(outWidth));
+    f->glUniform1ui(f->glGetUniformLocation(program, "outRows"), GLuint(outRows));
+    f->glUniform1ui(f->glGetUniformLocation(program, "factor"), GLuint(factor));
+    f->glDispatchCompute(GLuint((outWidth + GPU_BIN_LOCAL_SIZE - 1) / GPU_BIN_LOCAL_SIZE), GLuint(outRows), 1);
+    f->glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    const void* binned = f->glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, binnedBytes, GL_MAP_READ_BIT);
+    const bool mapped = binned != nullptr;
+    if (mapped)
+    {
+        std::memcpy(out, binned, binnedBytes);
+        f->glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        binnedCount++;
+    }
+    else
+    {
+        qDebug() << "Could not read the binned rows back, binning on the CPU";
+        gpu->failed = true;
+    }
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    f->glUseProgram(0);
+    return mapped;
+}
@@ -0,0 +1,94 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef GPUBINNER_H
+#define GPUBINNER_H
+
+#include <cstdint>
+#include <type_traits>
+
+/*!
+ * \brief The GpuBinner class
+ * Bins the bands of rows of FitsFile::hashAndBin with an OpenGL compute shader, so the
+ * processing threads only read and hash the frames. Each thread gets a context of its
+ * own, on an offscreen surface made by initialize. The integer samples are summed and
+ * divided as integers, so a frame binned on the GPU is the one binned on the CPU.
+ *
+ * Optional, with the GpuBinning setting. Without OpenGL 4.3 or OpenGL ES 3.1, and for
+ * the sample types the shader does not read, the frames are binned on the CPU.
+ *
+ * The scope is deliberately narrow: only the binning of hashAndBin runs here, which
+ * is reached by the mono and planar frames used in place from the mapped file and by
+ * the ones over STREAMED_FRAME_BYTES that are read a band at a time. Bayer frames,
+ * the stretch statistics and the stretch stay on the CPU, they run on images already
+ * binned to twice the thumbnail size and would not pay for an upload. It only uses
+ * the OpenGL classes of Qt GUI, the opengl and openglwidgets modules of the app are
+ * the ones of the accelerated thumbnail grid.
+ */
+class GpuBinner
+{
+public:
+    // Must be called on the GUI thread, before frames are binned. Returns isAvailable.
+    static bool initialize();
+    // Whether a context with compute shaders could be made
+    static bool isAvailable();
+
+    // Averages rowCount rows of width samples over factor x factor cells, into
+    // rowCount / factor rows of width / factor in out. Returns false when the GPU
+    // could not, and the caller bins the rows itself.
+    template <typename T>
+    static bool binRows(const T* rows, long long width, long long rowCount, int factor, float* out)
+    {
+        const int type = sampleTypeOf<T>();
+        return type >= 0 && binRows(rows, type, int(sizeof(T)), width, rowCount, factor, out);
+    }
+
+    template <typename T>
+    static constexpr bool supports()
+    {
+        return sampleTypeOf<T>() >= 0;
+    }
+
+private:
+    // The sample types of the shader, -1 for the ones it does not read
+    template <typename T>
+    static constexpr int sampleTypeOf()
+    {
+        if constexpr (std::is_same_v<T, uint8_t>)
+            return 0;
+        else if constexpr (std::is_same_v<T, int8_t>)
+            return 1;
+        else if constexpr (std::is_same_v<T, uint16_t>)
+            return 2;
+        else if constexpr (std::is_same_v<T, int16_t>)
+            return 3;
+        else if constexpr (std::is_same_v<T, float>)
+            return 4;
+        return -1;
+    }
+
+    static bool binRows(const void* rows, int sampleType, int sampleSize, long long width, long long rowCount, int factor, float* out);
+};
+
+#endif // GPUBINNER_H
@@ -0,0 +1,442 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "groupedfilemodel.h"
+#include "fileviewmodel.h"
+#include "integrationstats.h"
+
+#include <QDate>
+
+#include <algorithm>
+#include <cmath>
+
+// Total changes are shown at most this often, about once a frame
+#define GROUPED_MODEL_UPDATE_INTERVAL_MS 16
+
+GroupedFileModel::GroupedFileModel(QObject *parent) : QAbstractItemModel(parent)
+{
+    updateTimer.setSingleShot(true);
+    updateTimer.setInterval(GROUPED_MODEL_UPDATE_INTERVAL_MS);
+    connect(&updateTimer, &QTimer::timeout, this, &GroupedFileModel::applyPendingTotals);
+}
+
+GroupedFileModel::~GroupedFileModel()
+{
+    clear(&root);
+}
+
+void GroupedFileModel::setCatalog(Catalog *catalog)
+{
+    this->catalog = catalog;
+}
+
+void GroupedFileModel::setSourceModel(SortFilterProxyModel *sourceModel)
+{
+    for (auto& connection : sourceConnections)
+        disconnect(connection);
+    sourceConnections.clear();
+
+    source = sourceModel;
+    if (source != nullptr)
+    {
+        sourceConnections.append(connect(source, &QAbstractItemModel::rowsInserted, this, &GroupedFileModel::sourceRowsInserted));
+        sourceConnections.append(connect(source, &QAbstractItemModel::rowsAboutToBeRemoved, this, &GroupedFileModel::sourceRowsAboutToBeRemoved));
+        sourceConnections.append(connect(source, &QAbstractItemModel::dataChanged, this, &GroupedFileModel::sourceDataChanged));
+        sourceConnections.append(connect(source, &QAbstractItemModel::modelReset, this, &GroupedFileModel::rebuild));
+    }
+    rebuild();
+}
+
+QModelIndex GroupedFileModel::sourceIndex(const QModelIndex &index) const
+{
+    if (!isFrame(index) || source == nullptr)
+        return QModelIndex();
+
+    const Node* night = static_cast<const Node*>(index.internalPointer());
+    const int row = catalog->astroFileIndex(night->ids.at(index.row()));
+    if (row < 0)
+        return QModelIndex();
+    return source->mapFromSource(source->sourceModel()->index(row, 0));
+}
+
+/*!
+ * \brief GroupedFileModel::rebuild
+ * Groups all the rows of the source again, without notifying them one by one.
+ */
+void GroupedFileModel::rebuild()
+{
+    beginResetModel();
+    updateTimer.stop();
+    pendingTotals.clear();
+    memberships.clear();
+    clear(&root);
+    if (source != nullptr && catalog != nullptr && source->rowCount() > 0)
+    {
+        for (auto& frame : readFrames(0, source->rowCount() - 1))
+            addFrame(frame, false);
+    }
+    pendingTotals.clear();
+    endResetModel();
+}
+
+void GroupedFileModel::sourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    for (auto& frame : readFrames(first, last))
+        addFrame(frame, true);
+}
+
+void GroupedFileModel::sourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    // The rows are still in the catalog until the removal is done
+    for (int row = first; row <= last; row++)
+        removeFrame(source->index(row, 0).data(AstroFileRoles::IdRole).toInt());
+}
+
+/*!
+ * \brief GroupedFileModel::sourceDataChanged
+ * Moves the frames whose object, filter or date changed to their new group. The
+ * thumbnails of the rows change all the time and do not move anything.
+ */
+void GroupedFileModel::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles)
+{
+    if (topLeft.parent().isValid())
+        return;
+    if (!roles.isEmpty() && !roles.contains(Qt::DisplayRole) && !roles.contains(AstroFileRoles::ObjectRole)
+            && !roles.contains(AstroFileRoles::FilterRole) && !roles.contains(AstroFileRoles::DateRole)
+            && !roles.contains(AstroFileRoles::ExposureRole))
+        return;
+
+    for (auto& frame : readFrames(topLeft.row(), bottomRight.row()))
+    {
+        auto it = memberships.constFind(frame.id);
+        if (it != memberships.constEnd())
+        {
+            const Node* night = it->night;
+            if (night->name == frame.names[NightLevel - 1] && night->parent->name == frame.names[FilterLevel - 1]
+                    && night->parent->parent->name == frame.names[ObjectLevel - 1] && it->exposure == frame.exposure)
+                continue;
+        }
+        removeFrame(frame.id);
+        addFrame(frame, true);
+    }
+}
+
+void GroupedFileModel::applyPendingTotals()
+{
+    for (auto node : pendingTotals)
+    {
+        const QModelIndex index = indexOf(node);
+        emit dataChanged(index, index, {Qt::DisplayRole, AstroFileRoles::GroupFrameCountRole, AstroFileRoles::GroupIntegrationRole});
+    }
+    pendingTotals.clear();
+}
+
+/*!
+ * \brief GroupedFileModel::readFrames
+ * The groups of the rows of the source, from the columns of the catalog.
+ */
+QVector<GroupedFileModel::Frame> GroupedFileModel::readFrames(int first, int last) const
+{
+    QVector<Frame> frames;
+    frames.reserve(last - first + 1);
+    catalog->readColumns([&](const CatalogColumns& columns) {
+        for (int row = first; row <= last; row++)
+        {
+            const int sourceRow = source->mapToSource(source->index(row, 0)).row();
+            if (sourceRow < 0 || sourceRow >= columns.count())
+                continue;
+
+            const CatalogColumns::RowView rowView = columns.row(sourceRow);
+            Frame frame;
+            frame.id = rowView.id();
+            frame.names[ObjectLevel - 1] = rowView.facetValue(CatalogColumns::ObjectFacet);
+            frame.names[FilterLevel - 1] = rowView.facetValue(CatalogColumns::FilterFacet);
+            const QDate night = QDate::fromJulianDay(rowView.observationNight());
+            if (night.isValid())
+                frame.names[NightLevel - 1] = night.toString(Qt::ISODate);
+            const double exposure = rowView.exposureTime();
+            frame.exposure = std::isnan(exposure) ? 0 : exposure;
+            frames.append(frame);
+        }
+    });
+    return frames;
+}
+
+void GroupedFileModel::addFrame(const Frame &frame, bool notify)
+{
+    if (memberships.contains(frame.id))
+        return;
+
+    Node* node = &root;
+    for (int level = ObjectLevel; level <= NightLevel; level++)
+        node = child(node, frame.names[level - 1], notify);
+
+    if (notify && node->fetched)
+        beginInsertRows(indexOf(node), node->ids.count(), node->ids.count());
+    node->ids.append(frame.id);
+    if (notify && node->fetched)
+        endInsertRows();
+
+    memberships.insert(frame.id, {node, frame.exposure});
+    changeTotals(node, 1, frame.exposure);
+}
+
+void GroupedFileModel::removeFrame(int id)
+{
+    auto it = memberships.find(id);
+    if (it == memberships.end())
+        return;
+    Node* night = it->night;
+    const double exposure = it->exposure;
+    memberships.erase(it);
+
+    const int row = night->ids.indexOf(id);
+    if (night->fetched)
+        beginRemoveRows(indexOf(night), row, row);
+    night->ids.remove(row);
+    if (night->fetched)
+        endRemoveRows();
+
+    changeTotals(night, -1, -exposure);
+    prune(night);
+}
+
+void GroupedFileModel::changeTotals(Node *night, int frames, double exposure)
+{
+    for (Node* node = night; node != nullptr; node = node->parent)
+    {
+        node->frameCount += frames;
+        node->integration += exposure;
+        if (node != &root)
+            pendingTotals.insert(node);
+    }
+    if (!updateTimer.isActive())
+        updateTimer.start();
+}
+
+/*!
+ * \brief GroupedFileModel::child
+ * The group of this name under parent, added in the order of the names if there is none.
+ */
+GroupedFileModel::Node *GroupedFileModel::child(Node *parent, const QString &name, bool notify)
+{
+    auto it = std::lower_bound(parent->children.begin(), parent->children.end(), name, [](const Node* node, const QString& name) {
+        return node->name < name;
+    });
+    if (it != parent->children.end() && (*it)->name == name)
+        return *it;
+
+    const int row = int(it - parent->children.begin());
+    if (notify)
+        beginInsertRows(indexOf(parent), row, row);
+    Node* node = new Node {static_cast<Level>(parent->level + 1), name, parent};
+    parent->children.insert(row, node);
+    if (notify)
+        endInsertRows();
+    return node;
+}
+
+// Removes the node and then its parents once they have no frame left
+void GroupedFileModel::prune(Node *node)
+{
+    while (node != &root && node->frameCount == 0)
+    {
+        Node* parent = node->parent;
+        const int row = rowOf(node);
+        beginRemoveRows(indexOf(parent), row, row);
+        parent->children.remove(row);
+        endRemoveRows();
+        pendingTotals.remove(node);
+        delete node;
+        node = parent;
+    }
+}
+
+// Deletes the groups under node
+void GroupedFileModel::clear(Node *node)
+{
+    for (auto child : node->children)
+    {
+        clear(child);
+        delete child;
+    }
+    node->children.clear();
+    node->frameCount = 0;
+    node->integration = 0;
+}
+
+int GroupedFileModel::rowOf(const Node *node) const
+{
+    const QVector<Node*>& siblings = node->parent->children;
+    auto it = std::lower_bound(siblings.begin(), siblings.end(), node->name, [](const Node* sibling, const QString& name) {
+        return sibling->name < name;
+    });
+    return int(it - siblings.begin());
+}
+
+// Indexes point to the node of their parent, so the frames of a night need no node of their own
+QModelIndex GroupedFileModel::indexOf(const Node *node) const
+{
+    if (node == &root)
+        return QModelIndex();
+    return createIndex(rowOf(node), 0, node->parent);
+}
+
+GroupedFileModel::Node *GroupedFileModel::nodeOf(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return const_cast<Node*>(&root);
+    if (isFrame(index))
+        return nullptr;
+    return static_cast<Node*>(index.internalPointer())->children.at(index.row());
+}
+
+bool GroupedFileModel::isFrame(const QModelIndex &index) const
+{
+    return index.isValid() && static_cast<const Node*>(index.internalPointer())->level == NightLevel;
+}
+
+QModelIndex GroupedFileModel::index(int row, int column, const QModelIndex &parent) const
+{
+    const Node* node = nodeOf(parent);
+    if (node == nullptr || column != 0 || row < 0 || row >= rowCount(parent))
+        return QModelIndex();
+    return createIndex(row, column, node);
+}
+
+QModelIndex GroupedFileModel::parent(const QModelIndex &child) const
+{
+    if (!child.isValid())
+        return QModelIndex();
+    return indexOf(static_cast<const Node*>(child.internalPointer()));
+}
+
+int GroupedFileModel::rowCount(const QModelIndex &parent) const
+{
+    const Node* node = nodeOf(parent);
+    if (node == nullptr)
+        return 0;
+    if (node->level == NightLevel)
+        return node->fetched ? node->ids.count() : 0;
+    return node->children.count();
+}
+
+int GroupedFileModel::columnCount(const QModelIndex &parent) const
+{
+    Q_UNUSED(parent);
+    return 1;
+}
+
+bool GroupedFileModel::hasChildren(const QModelIndex &parent) const
+{
+    const Node* node = nodeOf(parent);
+    return node != nullptr && (node->level == NightLevel ? !node->ids.isEmpty() : !node->children.isEmpty());
+}
+
+bool GroupedFileModel::canFetchMore(const QModelIndex &parent) const
+{
+    const Node* node = nodeOf(parent);
+    return node != nullptr && node->level == NightLevel && !node->fetched;
+}
+
+/*!
+ * \brief GroupedFileModel::fetchMore
+ * Lists the frames of a night, when the view expands it.
+ */
+void GroupedFileModel::fetchMore(const QModelIndex &parent)
+{
+    Node* node = nodeOf(parent);
+    if (node == nullptr || node->level != NightLevel || node->fetched)
+        return;
+
+    if (node->ids.isEmpty())
+    {
+        node->fetched = true;
+        return;
+    }
+    beginInsertRows(parent, 0, node->ids.count() - 1);
+    node->fetched = true;
+    endInsertRows();
+}
+
+QVariant GroupedFileModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
+
+    // The frames show the rows of the source, without their thumbnails
+    if (isFrame(index))
+    {
+        if (role == Qt::DecorationRole || role == Qt::SizeHintRole)
+            return QVariant();
+        return sourceIndex(index).data(role);
+    }
+
+    const Node* node = nodeOf(index);
+    switch (role)
+    {
+        case Qt::DisplayRole:
+            return label(node);
+        case AstroFileRoles::GroupFrameCountRole:
+            return node->frameCount;
+        case AstroFileRoles::GroupIntegrationRole:
+            return node->integration;
+        default:
+            return QVariant();
+    }
+}
+
+Qt::ItemFlags GroupedFileModel::flags(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return Qt::NoItemFlags;
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+}
+
+// Like "M 31  (120 frames, 3h 20m)"
+QString GroupedFileModel::label(const Node *node) const
+{
+    QString name = node->name;
+    if (name.isEmpty())
+    {
+        switch (node->level)
+        {
+            case ObjectLevel:
+                name = tr("No object");
+                break;
+            case FilterLevel:
+                name = tr("No filter");
+                break;
+            default:
+                name = tr("No date");
+                break;
+        }
+    }
+
+    return QString("%1  (%2, %3)").arg(name, tr("%n frame(s)", nullptr, node->frameCount), IntegrationStats::formatDuration(node->integration));
+}
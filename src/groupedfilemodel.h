@@ -0,0 +1,135 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef GROUPEDFILEMODEL_H
+#define GROUPEDFILEMODEL_H
+
+#include "catalog.h"
+#include "sortfilterproxymodel.h"
+
+#include <QAbstractItemModel>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+
+/*!
+ * \brief The GroupedFileModel class
+ * The rows of the SortFilterProxyModel as a tree of targets, their filters and the
+ * nights they were taken, with the number of frames and the total exposure of each
+ * group.
+ *
+ * The groups and their totals are kept up to date as the rows of the proxy are
+ * inserted, removed and changed, so only a reset of the proxy walks all of them. The
+ * frames of a night are only listed once it is expanded (see fetchMore), in the order
+ * they were added, so expanding a group costs the size of the group.
+ *
+ * A night starts at noon local time. Total changes are shown at most once a frame.
+ */
+class GroupedFileModel : public QAbstractItemModel
+{
+    Q_OBJECT
+public:
+    explicit GroupedFileModel(QObject *parent = nullptr);
+    ~GroupedFileModel();
+
+    void setCatalog(Catalog* catalog);
+    void setSourceModel(SortFilterProxyModel* sourceModel);
+    // The row of the source model of a frame, invalid for a group
+    QModelIndex sourceIndex(const QModelIndex& index) const;
+
+    // QAbstractItemModel interface
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+private slots:
+    void rebuild();
+    void sourceRowsInserted(const QModelIndex& parent, int first, int last);
+    void sourceRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last);
+    void sourceDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QList<int>& roles);
+    void applyPendingTotals();
+
+private:
+    enum Level
+    {
+        RootLevel,
+        ObjectLevel,
+        FilterLevel,
+        NightLevel
+    };
+
+    struct Node
+    {
+        Level level;
+        QString name; // Empty for the frames without a value, nights as ISO dates
+        Node* parent;
+        QVector<Node*> children; // Sorted by name
+        int frameCount = 0;
+        double integration = 0; // Seconds
+        QVector<int> ids; // Of the frames of a night
+        bool fetched = false; // Whether the frames of a night are rows
+    };
+
+    struct Frame
+    {
+        int id;
+        QString names[NightLevel]; // Object, filter and night
+        double exposure;
+    };
+
+    struct Membership
+    {
+        Node* night;
+        double exposure;
+    };
+
+    SortFilterProxyModel* source = nullptr;
+    Catalog* catalog = nullptr;
+    QList<QMetaObject::Connection> sourceConnections;
+    Node root {RootLevel, QString(), nullptr};
+    QHash<int, Membership> memberships; // By file id
+    QSet<Node*> pendingTotals; // Groups whose totals changed since they were last shown
+    QTimer updateTimer;
+
+    QVector<Frame> readFrames(int first, int last) const;
+    void addFrame(const Frame& frame, bool notify);
+    void removeFrame(int id);
+    void changeTotals(Node* night, int frames, double exposure);
+    Node* child(Node* parent, const QString& name, bool notify);
+    void prune(Node* node);
+    void clear(Node* node);
+    int rowOf(const Node* node) const;
+    QModelIndex indexOf(const Node* node) const;
+    Node* nodeOf(const QModelIndex& index) const;
+    bool isFrame(const QModelIndex& index) const;
+    QString label(const Node* node) const;
+};
+
+#endif // GROUPEDFILEMODEL_H
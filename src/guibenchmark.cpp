@@ -0,0 +1,245 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "guibenchmark.h"
+#include "ui_mainwindow.h"
+#include "facetmodel.h"
+#include "fileviewmodel.h"
+#include "filterview.h"
+#include "mainwindow.h"
+#include "metrics.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScrollBar>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include <algorithm>
+
+// The window is this size while measured, so runs on different screens compare
+#define BENCHMARK_WINDOW_WIDTH 1600
+#define BENCHMARK_WINDOW_HEIGHT 1000
+
+// How often the rows loaded are checked, and how long they are waited for, in ms
+#define LOAD_CHECK_INTERVAL 100
+#define LOAD_TIMEOUT (10 * 60 * 1000)
+
+// The events between two frames are processed for at most this long, in ms, about 60 frames per second
+#define FRAME_INTERVAL 16
+
+// Frames of each phase
+#define SCROLL_FRAMES 300
+#define RESIZE_FRAMES 60
+#define DETAILS_FRAMES 100
+
+// The first values of each filter list that are checked and unchecked
+#define FILTER_TOGGLES 3
+
+GuiBenchmark::GuiBenchmark(MainWindow *window, int files, const QString &reportPath)
+    : window(window),
+      files(files),
+      reportPath(reportPath)
+{
+    loadTimer.setInterval(LOAD_CHECK_INTERVAL);
+    connect(&loadTimer, &QTimer::timeout, this, &GuiBenchmark::waitForRows);
+}
+
+void GuiBenchmark::prepare(int files)
+{
+    QCoreApplication::setApplicationName("Astrocat Benchmark");
+    QString location = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    QDir(location).removeRecursively();
+    QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).removeRecursively();
+    QDir().mkpath(location);
+
+    // The mock crawler fabricates the files under the search folder, which has to exist for its volume
+    QSettings settings;
+    settings.clear();
+    settings.setValue("SearchFolders", QStringList(location));
+
+    qputenv("ASTROCAT_MOCK_PIPELINE", "1");
+    qputenv("ASTROCAT_MOCK_FILES", QByteArray::number(files));
+    qputenv("ASTROCAT_MOCK_DELAY", "0");
+}
+
+void GuiBenchmark::start()
+{
+    qInfo() << "GUI benchmark: loading" << files << "synthetic files";
+    window->resize(BENCHMARK_WINDOW_WIDTH, BENCHMARK_WINDOW_HEIGHT);
+    loadClock.start();
+    loadTimer.start();
+}
+
+void GuiBenchmark::waitForRows()
+{
+    if (window->fileViewModel->rowCount(QModelIndex()) >= files)
+    {
+        loadTimer.stop();
+        run();
+    }
+    else if (loadClock.elapsed() > LOAD_TIMEOUT)
+    {
+        loadTimer.stop();
+        qWarning() << "GUI benchmark: only" << window->fileViewModel->rowCount(QModelIndex()) << "of" << files << "files loaded";
+        finish(false);
+    }
+}
+
+void GuiBenchmark::run()
+{
+    loadMs = loadClock.elapsed();
+    qInfo() << "GUI benchmark: loaded in" << loadMs << "ms";
+    Ui::MainWindow* ui = window->ui;
+    ThumbnailGridView* view = ui->astroListView;
+
+    QScrollBar* scrollBar = view->verticalScrollBar();
+    runPhase("scroll", SCROLL_FRAMES, [&](int i) {
+        // Down to the end and back up
+        const int half = SCROLL_FRAMES / 2;
+        int position = i < half ? i : SCROLL_FRAMES - i;
+        scrollBar->setValue(int(qint64(scrollBar->maximum()) * position / half));
+    });
+
+    QSlider* slider = ui->imageSizeSlider;
+    const int initialSize = slider->value();
+    const int sizes = slider->maximum() - slider->minimum();
+    runPhase("slider", 2 * sizes, [&](int i) {
+        slider->setValue(i <= sizes ? slider->minimum() + i : slider->maximum() - (i - sizes));
+    });
+    slider->setValue(initialSize);
+
+    runPhase("resize", RESIZE_FRAMES, [&](int i) {
+        // Shrunk to 60% and grown back
+        const int half = RESIZE_FRAMES / 2;
+        double scale = 1.0 - 0.4 * (i < half ? i : RESIZE_FRAMES - i) / half;
+        window->resize(int(BENCHMARK_WINDOW_WIDTH * scale), int(BENCHMARK_WINDOW_HEIGHT * scale));
+    });
+    window->resize(BENCHMARK_WINDOW_WIDTH, BENCHMARK_WINDOW_HEIGHT);
+
+    QList<QPair<FacetModel*, int>> toggles;
+    for (QAbstractItemView* facetView : window->filterView->findChildren<QAbstractItemView*>())
+    {
+        FacetModel* facets = qobject_cast<FacetModel*>(facetView->model());
+        if (facets == nullptr)
+            continue;
+        for (int row = 0; row < std::min(FILTER_TOGGLES, facets->rowCount(QModelIndex())); row++)
+            toggles.append(qMakePair(facets, row));
+    }
+    runPhase("filters", 2 * toggles.count(), [&](int i) {
+        FacetModel* facets = toggles.at(i / 2).first;
+        facets->setData(facets->index(toggles.at(i / 2).second), i % 2 == 0 ? Qt::Checked : Qt::Unchecked, Qt::CheckStateRole);
+    });
+
+    QAbstractItemModel* model = view->model();
+    runPhase("details", DETAILS_FRAMES, [&](int i) {
+        view->setCurrentIndex(model->index(int(qint64(model->rowCount()) * i / DETAILS_FRAMES), 0));
+    });
+
+    finish(true);
+}
+
+/*!
+ * \brief GuiBenchmark::runPhase
+ * Runs step for each frame of the phase, with the frame index, and adds the phase to
+ * the report. The counters are read around the phase, the thumbnails loaded between
+ * its frames count in it.
+ */
+void GuiBenchmark::runPhase(const QString &name, int frames, const std::function<void(int)> &step)
+{
+    std::atomic<qint64>& dataCalls = Metrics::counter("file_view.data_calls");
+    std::atomic<qint64>& filterCalls = Metrics::counter("proxy.filter_accepts_row_calls");
+    std::atomic<qint64>& hits = Metrics::counter("thumbnail_cache.hits");
+    std::atomic<qint64>& misses = Metrics::counter("thumbnail_cache.misses");
+    LatencyHistogram& histogram = Metrics::histogram("gui.frame." + name);
+
+    const qint64 dataCallsBefore = dataCalls.load();
+    const qint64 filterCallsBefore = filterCalls.load();
+    const qint64 hitsBefore = hits.load();
+    const qint64 missesBefore = misses.load();
+
+    for (int i = 0; i < frames; i++)
+        frame(histogram, [&]() { step(i); });
+
+    const qint64 phaseHits = hits.load() - hitsBefore;
+    const qint64 requests = phaseHits + misses.load() - missesBefore;
+    const double perFrame = frames > 0 ? 1.0 / frames : 0;
+
+    QJsonObject phase;
+    phase["name"] = name;
+    phase["frames"] = frames;
+    phase["p50_us"] = histogram.percentile(0.5);
+    phase["p90_us"] = histogram.percentile(0.9);
+    phase["p99_us"] = histogram.percentile(0.99);
+    phase["max_us"] = histogram.max();
+    phase["data_calls_per_frame"] = (dataCalls.load() - dataCallsBefore) * perFrame;
+    phase["filter_accepts_row_calls_per_frame"] = (filterCalls.load() - filterCallsBefore) * perFrame;
+    phase["thumbnail_requests"] = requests;
+    phase["thumbnail_hit_rate"] = requests > 0 ? double(phaseHits) / requests : 1.0;
+    phases.append(phase);
+
+    qInfo().noquote() << QString("GUI benchmark: %1, %2 frames, p50 %3 us, p90 %4 us, p99 %5 us, max %6 us, %7 data() and %8 filterAcceptsRow() per frame, %9% thumbnail hits")
+                         .arg(name).arg(frames)
+                         .arg(phase["p50_us"].toInteger()).arg(phase["p90_us"].toInteger()).arg(phase["p99_us"].toInteger()).arg(phase["max_us"].toInteger())
+                         .arg(phase["data_calls_per_frame"].toDouble(), 0, 'f', 1).arg(phase["filter_accepts_row_calls_per_frame"].toDouble(), 0, 'f', 1)
+                         .arg(100 * phase["thumbnail_hit_rate"].toDouble(), 0, 'f', 1);
+}
+
+// From the step to the end of the paint it causes
+void GuiBenchmark::frame(LatencyHistogram &histogram, const std::function<void()> &step)
+{
+    QElapsedTimer timer;
+    timer.start();
+    step();
+    // The layouts and updates the step posted, then the paint, as the event loop would
+    QCoreApplication::sendPostedEvents();
+    window->repaint();
+    histogram.record(timer.nsecsElapsed() / 1000);
+
+    // The thumbnails loaded in the background arrive between the frames, as while the user scrolls
+    QCoreApplication::processEvents(QEventLoop::AllEvents, FRAME_INTERVAL);
+}
+
+void GuiBenchmark::finish(bool succeeded)
+{
+    QJsonObject report;
+    report["files"] = files;
+    report["load_ms"] = loadMs;
+    report["succeeded"] = succeeded;
+    report["phases"] = phases;
+
+    if (!reportPath.isEmpty())
+    {
+        QFile file(reportPath);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            file.write(QJsonDocument(report).toJson());
+        else
+            qWarning() << "Failed to write the benchmark report to" << reportPath << file.errorString();
+    }
+    QCoreApplication::exit(succeeded ? 0 : 1);
+}
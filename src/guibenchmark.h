@@ -0,0 +1,83 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef GUIBENCHMARK_H
+#define GUIBENCHMARK_H
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <functional>
+
+class LatencyHistogram;
+class MainWindow;
+
+/*!
+ * \brief The GuiBenchmark class
+ * Scripts the views over a synthetic catalog and measures them, started with
+ * --gui-benchmark. The catalog is fabricated by the mock pipeline, see
+ * ASTROCAT_MOCK_PIPELINE, into settings and a db of their own, so the catalog of
+ * the user is not touched.
+ *
+ * Once every row is loaded, it scrolls the grid, drags the size slider, resizes the
+ * window, toggles the filters and walks the selection through the details. Each step
+ * is one frame: the step, the events it posted, and a paint of the window. The frame
+ * times are recorded in the gui.frame.* histograms, and the report has their
+ * percentiles, with the thumbnail cache hit rate and the FileViewModel::data and
+ * SortFilterProxyModel::filterAcceptsRow calls per frame of each phase. It is printed
+ * and written as JSON, and the app quits.
+ */
+class GuiBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    GuiBenchmark(MainWindow* window, int files, const QString& reportPath);
+
+    // Before the MainWindow is made. Switches to the settings, db and caches of the
+    // benchmark, cleared, and has the mock pipeline fabricate files.
+    static void prepare(int files);
+
+    void start();
+
+private:
+    MainWindow* window;
+    const int files;
+    const QString reportPath;
+    QTimer loadTimer;
+    QElapsedTimer loadClock;
+    qint64 loadMs = 0;
+    QJsonArray phases;
+
+    void waitForRows();
+    void run();
+    void runPhase(const QString& name, int frames, const std::function<void(int)>& step);
+    void frame(LatencyHistogram& histogram, const std::function<void()>& step);
+    void finish(bool succeeded);
+};
+
+#endif // GUIBENCHMARK_H
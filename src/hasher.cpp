@@ -0,0 +1,212 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "hasher.h"
+
+#include <QSettings>
+#include <QtEndian>
+#include <cstring>
+
+#define XXH64_PREFIX "xxh64:"
+
+static const quint64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const quint64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const quint64 PRIME64_3 = 0x165667B19E3779F9ULL;
+static const quint64 PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const quint64 PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline quint64 rotl64(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 read64(const uchar* p)
+{
+    // XXH64 is defined on little endian words
+    quint64 v;
+    std::memcpy(&v, p, sizeof(v));
+    return qFromLittleEndian(v);
+}
+
+static inline quint32 read32(const uchar* p)
+{
+    quint32 v;
+    std::memcpy(&v, p, sizeof(v));
+    return qFromLittleEndian(v);
+}
+
+static inline quint64 xxh64Round(quint64 acc, quint64 input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline quint64 xxh64MergeRound(quint64 acc, quint64 val)
+{
+    acc ^= xxh64Round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+Hasher::Hasher(HashAlgorithm algorithm)
+    : _algorithm(algorithm),
+      _sha1(QCryptographicHash::Sha1)
+{
+    const quint64 seed = 0;
+    _acc[0] = seed + PRIME64_1 + PRIME64_2;
+    _acc[1] = seed + PRIME64_2;
+    _acc[2] = seed;
+    _acc[3] = seed - PRIME64_1;
+    _totalLength = 0;
+    _stripeLength = 0;
+}
+
+void Hasher::addData(const char *data, qint64 length)
+{
+    if (_algorithm == HashAlgorithmXxh64)
+        xxh64Consume(reinterpret_cast<const uchar*>(data), length);
+    else
+        _sha1.addData(QByteArrayView(data, length));
+}
+
+QByteArray Hasher::result()
+{
+    if (_algorithm == HashAlgorithmXxh64)
+    {
+        quint64 digest = qToBigEndian(xxh64Digest());
+        return QByteArray(XXH64_PREFIX) + QByteArray(reinterpret_cast<const char*>(&digest), sizeof(digest)).toHex();
+    }
+    return _sha1.result().toHex();
+}
+
+QByteArray Hasher::hash(const char *data, qint64 length, HashAlgorithm algorithm)
+{
+    Hasher hasher(algorithm);
+    hasher.addData(data, length);
+    return hasher.result();
+}
+
+HashAlgorithm Hasher::defaultAlgorithm()
+{
+    // Read once, changing the algorithm takes effect on the next start
+    static const HashAlgorithm algorithm = []() {
+        QSettings settings;
+        QString name = settings.value("HashAlgorithm", "sha1").toString().toLower();
+        return name == "xxh64" ? HashAlgorithmXxh64 : HashAlgorithmSha1;
+    }();
+    return algorithm;
+}
+
+HashAlgorithm Hasher::algorithmOf(const QString &hash)
+{
+    return hash.startsWith(XXH64_PREFIX) ? HashAlgorithmXxh64 : HashAlgorithmSha1;
+}
+
+QByteArray Hasher::prefixOf(HashAlgorithm algorithm)
+{
+    return algorithm == HashAlgorithmXxh64 ? QByteArray(XXH64_PREFIX) : QByteArray();
+}
+
+void Hasher::xxh64Consume(const uchar *data, qint64 length)
+{
+    _totalLength += length;
+
+    // Complete a stripe left over from the previous call
+    if (_stripeLength > 0)
+    {
+        int fill = qMin<qint64>(32 - _stripeLength, length);
+        std::memcpy(_stripe + _stripeLength, data, fill);
+        _stripeLength += fill;
+        data += fill;
+        length -= fill;
+        if (_stripeLength < 32)
+            return;
+
+        for (int i = 0; i < 4; i++)
+            _acc[i] = xxh64Round(_acc[i], read64(_stripe + 8 * i));
+        _stripeLength = 0;
+    }
+
+    while (length >= 32)
+    {
+        _acc[0] = xxh64Round(_acc[0], read64(data));
+        _acc[1] = xxh64Round(_acc[1], read64(data + 8));
+        _acc[2] = xxh64Round(_acc[2], read64(data + 16));
+        _acc[3] = xxh64Round(_acc[3], read64(data + 24));
+        data += 32;
+        length -= 32;
+    }
+
+    if (length > 0)
+    {
+        std::memcpy(_stripe, data, length);
+        _stripeLength = length;
+    }
+}
+
+quint64 Hasher::xxh64Digest() const
+{
+    quint64 h64;
+    if (_totalLength >= 32)
+    {
+        h64 = rotl64(_acc[0], 1) + rotl64(_acc[1], 7) + rotl64(_acc[2], 12) + rotl64(_acc[3], 18);
+        for (int i = 0; i < 4; i++)
+            h64 = xxh64MergeRound(h64, _acc[i]);
+    }
+    else
+        h64 = _acc[2] + PRIME64_5;
+
+    h64 += _totalLength;
+
+    const uchar* p = _stripe;
+    int remaining = _stripeLength;
+    while (remaining >= 8)
+    {
+        h64 ^= xxh64Round(0, read64(p));
+        h64 = rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        remaining -= 8;
+    }
+    if (remaining >= 4)
+    {
+        h64 ^= quint64(read32(p)) * PRIME64_1;
+        h64 = rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        remaining -= 4;
+    }
+    while (remaining > 0)
+    {
+        h64 ^= (*p) * PRIME64_5;
+        h64 = rotl64(h64, 11) * PRIME64_1;
+        p++;
+        remaining--;
+    }
+
+    h64 ^= h64 >> 33;
+    h64 *= PRIME64_2;
+    h64 ^= h64 >> 29;
+    h64 *= PRIME64_3;
+    h64 ^= h64 >> 32;
+    return h64;
+}
@@ -0,0 +1,77 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef HASHER_H
+#define HASHER_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+
+enum HashAlgorithm
+{
+    HashAlgorithmSha1 = 0,
+    HashAlgorithmXxh64 = 1
+};
+
+/*!
+ * \brief The Hasher class
+ * Computes the FileHash and ImageHash of a file. The hashes are only used to find
+ * duplicates, so a fast non-cryptographic hash can be selected with the
+ * "HashAlgorithm" setting ("sha1" or "xxh64").
+ *
+ * The result is hex encoded. Hashes other than SHA1 are prefixed with the name of
+ * their algorithm, so hashes made before the setting changed never match new ones.
+ * A file gets the new kind of hash the next time it is processed, and the FileHash
+ * of the files that share a quick hash is recomputed when they are compared, see
+ * FileRepository::resolveQuickHashCollisions.
+ */
+class Hasher
+{
+public:
+    explicit Hasher(HashAlgorithm algorithm = defaultAlgorithm());
+
+    void addData(const char* data, qint64 length);
+    QByteArray result();
+
+    static QByteArray hash(const char* data, qint64 length, HashAlgorithm algorithm = defaultAlgorithm());
+    static HashAlgorithm defaultAlgorithm();
+    static HashAlgorithm algorithmOf(const QString& hash);
+    // What the hashes of the algorithm start with, empty for SHA1
+    static QByteArray prefixOf(HashAlgorithm algorithm);
+
+private:
+    HashAlgorithm _algorithm;
+    QCryptographicHash _sha1;
+
+    // XXH64 streaming state
+    quint64 _acc[4];
+    quint64 _totalLength;
+    uchar _stripe[32];
+    int _stripeLength;
+
+    void xxh64Consume(const uchar* data, qint64 length);
+    quint64 xxh64Digest() const;
+};
+
+#endif // HASHER_H
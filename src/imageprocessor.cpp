@@ -22,53 +22,135 @@
     SOFTWARE.
 */
 
+#include "colormanagement.h"
 #include "imageprocessor.h"
+#include "linearimagereader.h"
+#include "linearthumbnail.h"
 
-#include <QCryptographicHash>
+#include <QBuffer>
+#include <QImageReader>
 
-QByteArray ImageProcessor::fileChecksum(const QString &fileName, QCryptographicHash::Algorithm hashAlgorithm)
-{
-    QFile sourceFile(fileName);
-    qint64 fileSize = sourceFile.size();
-    const qint64 bufferSize = 10240;
+#define THUMBNAIL_SIZE LARGEST_THUMBNAIL_SIZE
 
-    if (sourceFile.open(QIODevice::ReadOnly))
+bool ImageProcessor::loadFile(const AstroFile &astroFile)
+{
+    // Stored when the file was ingested, see FitsProcessor::useStoredStretchParams
+    _hasStoredStretchParams = StretchParams::fromByteArray(astroFile.StretchParameters, _storedStretchParams);
+    // Only the header is read here, the pixels are read with a FileReader by extractThumbnail
+    QImageReader imageReader(astroFile.FullPath);
+    if (!imageReader.canRead())
     {
-        char buffer[bufferSize];
-        int bytesRead;
-        int readSize = qMin(fileSize, bufferSize);
-
-        QCryptographicHash hash(hashAlgorithm);
-        while (readSize > 0 && (bytesRead = sourceFile.read(buffer, readSize)) > 0)
-        {
-            fileSize -= bytesRead;
-            hash.addData(buffer, bytesRead);
-            readSize = qMin(fileSize, bufferSize);
-        }
-
-        sourceFile.close();
-        return hash.result();
+        return false;
     }
-    return QByteArray();
+    _filePath = astroFile.FullPath;
+    return true;
 }
 
-bool ImageProcessor::loadFile(const AstroFile &astroFile)
+/*!
+ * \brief ImageProcessor::loadFile
+ * Decodes from the data of the reader, which has to stay open until reset().
+ * The image hash of regular images is the hash of the whole file, from the same read.
+ */
+bool ImageProcessor::loadFile(const AstroFile &astroFile, const FileReader &reader)
 {
-    if (!image.load(astroFile.FullPath))
+    _hasStoredStretchParams = StretchParams::fromByteArray(astroFile.StretchParameters, _storedStretchParams);
+    _filePath = astroFile.FullPath;
+    _fileData = QByteArray::fromRawData(reinterpret_cast<const char*>(reader.data()), reader.size());
+    QBuffer buffer(&_fileData);
+    QImageReader imageReader(&buffer);
+    if (!imageReader.canRead())
     {
         return false;
     }
-    _imageHash = fileChecksum(astroFile.FullPath, QCryptographicHash::Sha1);
+    _imageHash = reader.fileHash();
     return true;
 }
 
+/*!
+ * \brief ImageProcessor::extractTags
+ * The text the image format keeps in its header, like PNG text chunks, TIFF tags or
+ * JPEG comments, without decoding any pixels.
+ */
 void ImageProcessor::extractTags()
 {
+    QBuffer buffer(&_fileData);
+    QImageReader imageReader;
+    if (_fileData.isEmpty())
+        imageReader.setFileName(_filePath);
+    else
+        imageReader.setDevice(&buffer);
+
+    const QStringList keys = imageReader.textKeys();
+    for (auto& key : keys)
+        _tags.insert(key, imageReader.text(key).trimmed());
 }
 
+/*!
+ * \brief ImageProcessor::extractThumbnail
+ * Decodes straight to the thumbnail size. The JPEG decoder scales in the DCT domain,
+ * other formats are scaled by QImageReader as they are read. 16 bit and floating point
+ * TIFF and PNG images are linear data more often than not, they are binned in their own
+ * sample type and stretched like a FITS file, see LinearImageReader.
+ */
 void ImageProcessor::extractThumbnail()
 {
-    _thumbnail = image.scaled( QSize(200, 200), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    FileReader reader;
+    if (_fileData.isEmpty())
+    {
+        // Loaded from the path only
+        if (!reader.open(_filePath))
+            return;
+        _fileData = QByteArray::fromRawData(reinterpret_cast<const char*>(reader.data()), reader.size());
+        _imageHash = reader.fileHash();
+    }
+
+    const LinearImageReader::SampleType sampleType = LinearImageReader::sampleTypeOf(_fileData);
+    if (sampleType == LinearImageReader::UInt16)
+        extractLinearThumbnail<uint16_t>();
+    else if (sampleType == LinearImageReader::Float32)
+        extractLinearThumbnail<float>();
+
+    // 8 bit images, and the others when they could not be read as linear
+    if (_thumbnail.isNull() && !cancellationToken.isCanceled())
+    {
+        QBuffer buffer(&_fileData);
+        QImageReader imageReader(&buffer);
+        QSize size = imageReader.size();
+        if (size.isValid() && (size.width() > THUMBNAIL_SIZE || size.height() > THUMBNAIL_SIZE))
+            imageReader.setScaledSize(size.scaled(THUMBNAIL_SIZE, THUMBNAIL_SIZE, Qt::KeepAspectRatio));
+
+        QImage image = imageReader.read();
+        if (image.width() > THUMBNAIL_SIZE || image.height() > THUMBNAIL_SIZE)
+            image = image.scaled(QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        // The embedded profile, once the image is down to the thumbnail size
+        ColorManagement::convert(image, image.colorSpace().iccProfile());
+        _thumbnail = image;
+    }
+
+    // The data belonged to the local reader
+    if (reader.data() != nullptr)
+        _fileData.clear();
+}
+
+template <typename T>
+void ImageProcessor::extractLinearThumbnail()
+{
+    std::vector<T> samples;
+    int width, height, channels;
+    if (!LinearImageReader::read<T>(_fileData, THUMBNAIL_SIZE, cancellationToken, samples, width, height, channels))
+        return;
+
+    AutoStretcher<T> as(width, height, channels, 0);
+    as.setCancellationToken(cancellationToken);
+    as.setData(samples.data());
+    if (!_hasStoredStretchParams || !as.setParams(_storedStretchParams))
+        as.calculateParams();
+    QImage qimage = as.stretchToImage();
+    if (qimage.isNull())
+        return;
+    _stretchParams = as.getParams().toByteArray();
+    _thumbnail = qimage.scaled(QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    _linearThumbnail = LinearThumbnail::scaled(as.linearImage(), LINEAR_THUMBNAIL_SIZE);
 }
 
 QMap<QString, QString> ImageProcessor::getTags()
@@ -83,7 +165,10 @@ QImage ImageProcessor::getThumbnail()
 
 QImage ImageProcessor::getTinyThumbnail()
 {
-    return _thumbnail.scaled(20, 20, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    // Scaled once from the thumbnail
+    if (_tinyThumbnail.isNull() && !_thumbnail.isNull())
+        _tinyThumbnail = _thumbnail.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return _tinyThumbnail;
 }
 
 QByteArray ImageProcessor::getImageHash()
@@ -91,4 +176,25 @@ QByteArray ImageProcessor::getImageHash()
     return _imageHash;
 }
 
+QByteArray ImageProcessor::getStretchParams()
+{
+    return _stretchParams;
+}
 
+QImage ImageProcessor::getLinearThumbnail()
+{
+    return _linearThumbnail;
+}
+
+void ImageProcessor::reset()
+{
+    _filePath.clear();
+    _fileData.clear();
+    _tags.clear();
+    _thumbnail = QImage();
+    _tinyThumbnail = QImage();
+    _linearThumbnail = QImage();
+    _imageHash.clear();
+    _stretchParams.clear();
+    _hasStoredStretchParams = false;
+}
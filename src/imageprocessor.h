@@ -25,28 +25,39 @@
 #ifndef IMAGEPROCESSOR_H
 #define IMAGEPROCESSOR_H
 
+#include "autostretcher.h"
 #include "fileprocessor.h"
 
-#include <QCryptographicHash>
-
 class ImageProcessor : public FileProcessor
 {
 public:
     bool loadFile(const AstroFile &astroFile);
+    bool loadFile(const AstroFile &astroFile, const FileReader& reader);
     void extractTags();
     void extractThumbnail();
     QMap<QString, QString> getTags();
     QImage getThumbnail();
     QImage getTinyThumbnail();
     QByteArray getImageHash();
+    QByteArray getStretchParams();
+    QImage getLinearThumbnail();
+    void reset();
 
 private:
     QMap<QString, QString> _tags;
     QImage _thumbnail;
+    QImage _tinyThumbnail;
+    QImage _linearThumbnail;
     QByteArray _imageHash;
+    QByteArray _stretchParams;
+    StretchParams _storedStretchParams;
+    bool _hasStoredStretchParams = false;
+
+    QString _filePath;
+    QByteArray _fileData; // Not owned, the data of the FileReader the file was loaded from
 
-    QImage image;
-    QByteArray fileChecksum(const QString &fileName, QCryptographicHash::Algorithm hashAlgorithm);
+    template <typename T>
+    void extractLinearThumbnail();
 };
 
 #endif // IMAGEPROCESSOR_H
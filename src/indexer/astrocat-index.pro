@@ -0,0 +1,22 @@
+# astrocat-index, indexes search folders into a catalog db without a display
+
+QT += core gui sql concurrent
+QT -= widgets
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = astrocat-index
+
+VERSION = 0.1
+DEFINES += CURRENT_APP_VERSION=\"\\\"$${VERSION}\\\"\"
+
+SOURCES += \
+    main.cpp
+
+include(../engine.pri)
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,980 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "catalog.h"
+#include "catalogsnapshot.h"
+#include "catalogreconciler.h"
+#include "catalogserver.h"
+#include "filerepository.h"
+#include "foldercrawler.h"
+#include "gpubinner.h"
+#include "hasher.h"
+#include "indexingengine.h"
+#include "indexingservice.h"
+#include "linearthumbnail.h"
+#include "metrics.h"
+#include "newfileprocessor.h"
+#include "objectstore.h"
+#include "perceptualhash.h"
+#include "quadindex.h"
+#include "sandboxedprocessor.h"
+#include "syntheticframe.h"
+
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <QSettings>
+#include <QSize>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <tuple>
+
+// Progress is printed this often, in milliseconds
+#define PROGRESS_INTERVAL 1000
+
+// Changes read from the change log at a time by --changes-since
+#define CHANGES_PAGE_SIZE 10000
+
+// Frames made at the same time by --generate-corpus, each holds a few copies of its pixels
+#define CORPUS_THREADS 4
+
+// Rows written in a transaction by --generate-db
+#define GENERATED_BATCH_SIZE 1000
+
+// Rows in a folder of --generate-db, a night of frames
+#define GENERATED_FOLDER_SIZE 500
+
+// Every this many rows of the odd folders of --generate-db is a copy of the row a folder before it
+#define GENERATED_DUPLICATE_INTERVAL 20
+
+// Rows whose thumbnails --generate-db reads at a time, about a screen of the grid
+#define GENERATED_THUMBNAIL_PAGE 200
+
+// The near duplicate distance of the app, for timing Catalog::nearDuplicatesOf
+#define GENERATED_NEAR_DUPLICATE_DISTANCE 3
+
+/*
+ * Merges the partial catalogs of sharded indexers into the db, see FileRepository::mergeCatalog
+ */
+static int mergeCatalogs(const QStringList& paths)
+{
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    for (auto& path : paths)
+    {
+        int merged = repository.mergeCatalog(QFileInfo(path).absoluteFilePath());
+        if (merged < 0)
+        {
+            fprintf(stderr, "Could not merge %s\n", qPrintable(path));
+            return 1;
+        }
+        printf("Merged %d files from %s\n", merged, qPrintable(path));
+        fflush(stdout);
+    }
+    return 0;
+}
+
+/*
+ * Writes the catalog as CSV, or as an Arrow IPC stream to a .arrows path, for pandas
+ * or DuckDB, see FileRepository::exportCatalog
+ */
+static int exportCatalog(const QString& path)
+{
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    int exported = repository.exportCatalog(path);
+    if (exported < 0)
+    {
+        fprintf(stderr, "Could not export the catalog to %s\n", qPrintable(path));
+        return 1;
+    }
+    printf("Exported %d files to %s in %.1fs\n", exported, qPrintable(path), elapsed.elapsed() / 1000.0);
+    return 0;
+}
+
+/*
+ * Writes the reports of the ingests kept in the db as a JSON array, the newest first,
+ * see IndexingEngine::reportIngest
+ */
+static int exportIngestRuns(const QString& path)
+{
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    QJsonArray runs;
+    for (auto& run : FileRepository::ingestRuns(std::numeric_limits<int>::max()))
+        runs.append(run);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        fprintf(stderr, "Could not write %s: %s\n", qPrintable(path), qPrintable(file.errorString()));
+        return 1;
+    }
+    file.write(QJsonDocument(runs).toJson());
+    printf("Exported %d ingest runs to %s\n", int(runs.count()), qPrintable(path));
+    return 0;
+}
+
+/*
+ * Prints the changes logged after seq as JSON lines, the oldest first, see
+ * FileRepository::changesSince. Returns 2 when the log no longer goes back that far.
+ */
+static int printChangesSince(qint64 seq)
+{
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    static const char* operations[] = {"added", "updated", "deleted"};
+    for (;;)
+    {
+        const FileChanges changes = FileRepository::changesSince(seq, CHANGES_PAGE_SIZE);
+        if (!changes.IsComplete)
+        {
+            fprintf(stderr, "The change log was pruned past %lld, read the whole catalog with --export\n", seq);
+            return 2;
+        }
+        for (auto& change : changes.Changes)
+        {
+            QJsonObject json;
+            json.insert("seq", change.Seq);
+            json.insert("fits_id", change.FitsId);
+            json.insert("path", change.FullPath);
+            json.insert("operation", operations[qBound(0, int(change.Operation), 2)]);
+            printf("%s\n", QJsonDocument(json).toJson(QJsonDocument::Compact).constData());
+        }
+        if (changes.Changes.isEmpty())
+            return 0;
+        seq = changes.LastSeq;
+    }
+}
+
+/*
+ * Prints the integration time of each object, filter and instrument, see
+ * FileRepository::integrationStats
+ */
+static int printIntegrationStats()
+{
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    QVector<IntegrationStats> stats = repository.integrationStats();
+    std::sort(stats.begin(), stats.end(), [](const IntegrationStats& a, const IntegrationStats& b) {
+        return std::tie(a.Object, a.Filter, a.Instrument) < std::tie(b.Object, b.Filter, b.Instrument);
+    });
+    printf("Object\tFilter\tInstrument\tFrames\tExposure (s)\tFirst date\tLast date\n");
+    for (auto& row : stats)
+    {
+        printf("%s\t%s\t%s\t%d\t%.1f\t%s\t%s\n", qPrintable(row.Object), qPrintable(row.Filter), qPrintable(row.Instrument),
+               row.FrameCount, row.TotalExposure, qPrintable(row.FirstDate.toString(Qt::ISODate)), qPrintable(row.LastDate.toString(Qt::ISODate)));
+    }
+    return 0;
+}
+
+/*
+ * Stretches the thumbnails in the db again from their linear thumbnails, see
+ * FileRepository::restretchThumbnails
+ */
+static int restretchThumbnails(const StretchOptions& options)
+{
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    int restretched = repository.restretchThumbnails(options);
+    if (restretched < 0)
+    {
+        fprintf(stderr, "Could not read the linear thumbnails\n");
+        return 1;
+    }
+    printf("Stretched the thumbnails of %d files again in %.1fs\n", restretched, elapsed.elapsed() / 1000.0);
+    return 0;
+}
+
+/*
+ * Writes the quad index of the PlateSolver, the PlateSolverIndex setting, from a star
+ * catalog, see QuadIndex::build
+ */
+static int buildSolverIndex(const QStringList& starCatalogs, const QString& indexPath)
+{
+    if (starCatalogs.count() != 1)
+    {
+        fprintf(stderr, "--build-solver-index takes the path of the index, and one star catalog\n");
+        return 1;
+    }
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QString error;
+    if (!QuadIndex::build(starCatalogs.first(), indexPath, error))
+    {
+        fprintf(stderr, "Could not build the quad index: %s\n", qPrintable(error));
+        return 1;
+    }
+    printf("Built the quad index %s in %.1fs\n", qPrintable(indexPath), elapsed.elapsed() / 1000.0);
+    return 0;
+}
+
+/*
+ * Prints the files of the db that are gone from the folders, one per line, and deletes
+ * their rows when remove is set, see CatalogReconciler. Nothing is processed.
+ */
+static int reconcileCatalog(const QStringList& folders, bool remove)
+{
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const QStringList missing = CatalogReconciler::missingFiles(FileRepository::filePaths(), folders);
+    for (auto& path : missing)
+        printf("%s\n", qPrintable(path));
+    if (remove)
+        repository.deleteAstrofiles(missing);
+    fprintf(stderr, "%d files missing%s in %.1fs\n", int(missing.count()), remove ? ", removed from the catalog" : "", elapsed.elapsed() / 1000.0);
+    return 0;
+}
+
+struct CorpusFormat
+{
+    int width;
+    int height;
+    int bitpix;
+    BayerPattern pattern;
+    bool xisf;
+    QString folder;
+};
+
+/*
+ * The combinations of the --corpus options, each written into a folder of its own.
+ * Returns an empty list, having printed why, when an option has a value it does not know.
+ */
+static QList<CorpusFormat> corpusFormats(const QStringList& sizes, const QStringList& sampleTypes, const QStringList& patterns, const QStringList& formats)
+{
+    static const QMap<QString, QSize> knownSizes = {{"16", QSize(SYNTHETIC_16MP_WIDTH, SYNTHETIC_16MP_HEIGHT)},
+                                                    {"26", QSize(SYNTHETIC_26MP_WIDTH, SYNTHETIC_26MP_HEIGHT)},
+                                                    {"61", QSize(SYNTHETIC_61MP_WIDTH, SYNTHETIC_61MP_HEIGHT)}};
+    // The BITPIX of the unsigned types cameras write, which XISF also has
+    static const QMap<QString, int> knownSampleTypes = {{"8", BYTE_IMG}, {"16", USHORT_IMG}, {"32", ULONG_IMG}, {"-32", FLOAT_IMG}, {"-64", DOUBLE_IMG}};
+    static const QMap<QString, BayerPattern> knownPatterns = {{"mono", None}, {"RGGB", RGGB}, {"BGGR", BGGR}, {"GRBG", GRBG}, {"GBRG", GBRG}};
+
+    QList<CorpusFormat> combinations;
+    for (auto& size : sizes)
+    {
+        for (auto& sampleType : sampleTypes)
+        {
+            for (auto& pattern : patterns)
+            {
+                for (auto& format : formats)
+                {
+                    if (!knownSizes.contains(size) || !knownSampleTypes.contains(sampleType) || !knownPatterns.contains(pattern) || (format != "fits" && format != "xisf"))
+                    {
+                        fprintf(stderr, "--corpus-sizes takes 16, 26 or 61, --corpus-bitpix 8, 16, 32, -32 or -64, "
+                                        "--corpus-bayer mono, RGGB, BGGR, GRBG or GBRG, and --corpus-formats fits or xisf\n");
+                        return {};
+                    }
+                    const QSize frameSize = knownSizes.value(size);
+                    combinations.append({frameSize.width(), frameSize.height(), knownSampleTypes.value(sampleType), knownPatterns.value(pattern), format == "xisf",
+                                         QString("%1-%2MP-bitpix%3-%4").arg(format, size, sampleType, pattern)});
+                }
+            }
+        }
+    }
+    return combinations;
+}
+
+/*
+ * Writes a corpus of synthetic frames to index, see SyntheticFrame. The files go through
+ * the combinations of the --corpus options in turn, with the keywords of light frames,
+ * and no two of them have the same pixels. Indexing the folder with --metrics then gives
+ * numbers that can be compared between builds.
+ */
+static int generateCorpus(const QString& folder, int files, const QList<CorpusFormat>& combinations)
+{
+    static const char* objects[] = {"M31", "M42", "NGC 7000", "IC 1396"};
+    static const char* filters[] = {"L", "R", "G", "B", "Ha"};
+    const QDateTime firstFrame(QDate(2026, 1, 1), QTime(20, 0), Qt::UTC);
+
+    for (auto& combination : combinations)
+    {
+        if (!QDir().mkpath(QDir(folder).filePath(combination.folder)))
+        {
+            fprintf(stderr, "Could not create %s\n", qPrintable(QDir(folder).filePath(combination.folder)));
+            return 1;
+        }
+    }
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    std::atomic<int> failed = 0;
+    std::atomic<qint64> bytes = 0;
+    QList<int> indexes;
+    for (int i = 0; i < files; i++)
+        indexes.append(i);
+    QThreadPool pool;
+    pool.setMaxThreadCount(CORPUS_THREADS);
+    QtConcurrent::blockingMap(&pool, indexes, [&](int i) {
+        const CorpusFormat& combination = combinations.at(i % combinations.count());
+        SyntheticFrameSpec spec;
+        spec.width = combination.width;
+        spec.height = combination.height;
+        spec.bitpix = combination.bitpix;
+        spec.bayerPattern = combination.pattern;
+        spec.seed = i + 1;
+        spec.keywords.insert("OBJECT", objects[i / 50 % std::size(objects)]);
+        if (combination.pattern == None)
+            spec.keywords.insert("FILTER", filters[i / 10 % std::size(filters)]);
+        spec.keywords.insert("INSTRUME", "Synthetic");
+        spec.keywords.insert("IMAGETYP", "Light Frame");
+        spec.keywords.insert("EXPTIME", 300.0);
+        spec.keywords.insert("DATE-OBS", firstFrame.addSecs(i * 310LL).toString("yyyy-MM-ddTHH:mm:ss"));
+
+        const QString path = QDir(folder).filePath(QString("%1/frame_%2.%3").arg(combination.folder).arg(i, 6, 10, QChar('0')).arg(combination.xisf ? "xisf" : "fits"));
+        SyntheticFrame frame(spec);
+        if (combination.xisf ? frame.writeXisf(path) : frame.writeFits(path))
+            bytes += QFileInfo(path).size();
+        else
+            failed++;
+    });
+
+    printf("Wrote %d files, %lld MB to %s in %.1fs, %d failed\n", files - failed.load(), (long long)(bytes.load() / (1024 * 1024)),
+           qPrintable(folder), elapsed.elapsed() / 1000.0, failed.load());
+    return failed > 0 ? 1 : 0;
+}
+
+// The folder of a night of --generate-db
+static QString generatedFolder(int folder)
+{
+    return QDir::rootPath() + QString("synthetic/Night%1").arg(folder, 5, 10, QChar('0'));
+}
+
+/*
+ * A row of --generate-db. The copies have the hashes, keywords and thumbnail of the row
+ * a folder before them. The thumbnails have a pattern of their own, so the packs do not
+ * deduplicate them and the near duplicates are only the copies.
+ */
+static AstroFile generatedAstroFile(int row, int tagsPerFile, const QList<QImage>& backgrounds)
+{
+    static const char* objects[] = {"M31", "M42", "M45", "M101", "NGC 7000", "IC 1396", "IC 434"};
+    static const char* filters[] = {"L", "R", "G", "B", "Ha", "OIII", "SII"};
+    // Usual keywords of capture software, then made up ones for more tags per file
+    static const char* keywords[] = {"IMAGETYP", "XBINNING", "YBINNING", "CCD-TEMP", "GAIN", "OFFSET", "FOCALLEN", "TELESCOP",
+                                     "SITELAT", "SITELONG", "AIRMASS", "FOCPOS", "PIERSIDE", "XPIXSZ", "YPIXSZ", "SWCREATE"};
+    const QDateTime firstFrame(QDate(2020, 1, 1), QTime(20, 0), Qt::UTC);
+
+    const int folder = row / GENERATED_FOLDER_SIZE;
+    const bool hashed = row % GENERATED_DUPLICATE_INTERVAL == GENERATED_DUPLICATE_INTERVAL - 1;
+    const int content = hashed && folder % 2 == 1 ? row - GENERATED_FOLDER_SIZE : row;
+
+    FileRecord record;
+    record.FullPath = generatedFolder(folder) + QString("/frame_%1.fits").arg(row, 7, 10, QChar('0'));
+    record.CanonicalDirectory = record.absolutePath();
+    record.Size = 2LL * SYNTHETIC_16MP_WIDTH * SYNTHETIC_16MP_HEIGHT + 2880;
+    record.LastModifiedTime = firstFrame.addSecs(content * 310LL).toMSecsSinceEpoch();
+
+    AstroFile astroFile(record);
+    astroFile.processStatus = AstroFileProcessed;
+    astroFile.tagStatus = TagExtracted;
+    astroFile.thumbnailStatus = ThumbnailLoaded;
+    astroFile.ThumbnailVersion = THUMBNAIL_VERSION;
+
+    // The files whose quick hash collides have a FileHash, like after resolveQuickHashCollisions
+    const QByteArray key = QByteArray::number(content);
+    astroFile.QuickHash = Hasher::hash(QByteArray("quick" + key).constData(), key.size() + 5);
+    astroFile.ImageHash = Hasher::hash(QByteArray("image" + key).constData(), key.size() + 5);
+    if (hashed)
+        astroFile.FileHash = Hasher::hash(key.constData(), key.size());
+
+    astroFile.Tags.insert({{"OBJECT", objects[content / GENERATED_FOLDER_SIZE % std::size(objects)]},
+                           {"INSTRUME", "Camera " + QString::number(content % 3 + 1)},
+                           {"FILTER", filters[content / 50 % std::size(filters)]},
+                           {"EXPTIME", QString::number(60 * (content % 5 + 1))},
+                           {"DATE-OBS", firstFrame.addSecs(content * 310LL).toString(Qt::ISODate)}});
+    for (int tag = 5; tag < tagsPerFile; tag++)
+    {
+        const int index = tag - 5;
+        const QString name = index < int(std::size(keywords)) ? QString(keywords[index]) : QString("KEY%1").arg(index, 3, 10, QChar('0'));
+        astroFile.Tags.insert(name, QString::number((content + index) % 97));
+    }
+
+    QImage thumbnail = backgrounds.at(content % backgrounds.count());
+    {
+        QPainter painter(&thumbnail);
+        painter.setOpacity(0.5);
+        const int cell = thumbnail.width() / 4;
+        const quint64 pattern = (quint64(content) + 1) * 0x9E3779B97F4A7C15ULL;
+        for (int bit = 0; bit < 16; bit++)
+        {
+            if (pattern >> (bit + 32) & 1)
+                painter.fillRect(bit % 4 * cell, bit / 4 * cell, cell, cell, Qt::white);
+        }
+    }
+    astroFile.thumbnail = thumbnail;
+    astroFile.tinyThumbnail = thumbnail.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    astroFile.PerceptualHash = PerceptualHash::ofImage(astroFile.tinyThumbnail);
+    astroFile.Placeholder = PlaceholderHash::ofImage(astroFile.tinyThumbnail);
+    return astroFile;
+}
+
+/*
+ * Writes a catalog of rows synthetic files into the db, with tagsPerFile keywords each and
+ * thumbnails of the sizes in turn, then times what the app does with it: loading it from
+ * the db and from the snapshot, reading a screen of thumbnails, the duplicate queries and
+ * deleting a folder. Nothing is read from disk but the db, which the OS has cached by then,
+ * so the numbers are of the db and the catalog and can be compared between builds.
+ */
+static int generateCatalog(int rows, int tagsPerFile, const QList<int>& thumbnailSizes)
+{
+    if (QFileInfo::exists(FileRepository::databaseFilePath()))
+    {
+        fprintf(stderr, "%s exists already, --generate-db writes a new db\n", qPrintable(FileRepository::databaseFilePath()));
+        return 1;
+    }
+
+    FileRepository repository;
+    bool failed = false;
+    QObject::connect(&repository, &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        failed = true;
+    });
+    repository.initialize();
+    if (failed)
+        return 1;
+
+    QList<QImage> backgrounds;
+    for (int size : thumbnailSizes)
+    {
+        QImage background(size, size, QImage::Format_RGB32);
+        QRandomGenerator generator(size);
+        for (int y = 0; y < size; y++)
+        {
+            QRgb* line = reinterpret_cast<QRgb*>(background.scanLine(y));
+            for (int x = 0; x < size; x++)
+            {
+                const int value = 30 + 40 * (x + y) / (2 * size) + generator.bounded(24);
+                line[x] = qRgb(value, value, value);
+            }
+        }
+        backgrounds.append(background);
+    }
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    for (int first = 0; first < rows; first += GENERATED_BATCH_SIZE)
+    {
+        QList<AstroFile> batch;
+        for (int row = first; row < qMin(rows, first + GENERATED_BATCH_SIZE); row++)
+            batch.append(generatedAstroFile(row, tagsPerFile, backgrounds));
+        repository.addOrUpdateAstrofiles(batch);
+        fprintf(stderr, "\r%d of %d rows", qMin(rows, first + GENERATED_BATCH_SIZE), rows);
+    }
+    qint64 bytes = QFileInfo(FileRepository::databaseFilePath()).size();
+    QDirIterator packs(ThumbnailStore::pathForDatabase(FileRepository::databaseFilePath()), QDir::Files);
+    while (packs.hasNext())
+    {
+        packs.next();
+        bytes += packs.fileInfo().size();
+    }
+    printf("\nWrote %d rows with %d tags each, %lld MB with the thumbnail packs, in %.1fs\n", rows, tagsPerFile,
+           (long long)(bytes / (1024 * 1024)), elapsed.elapsed() / 1000.0);
+
+    // Like on the start of the app, see IndexingEngine. The first page is when the view shows rows.
+    auto load = [&repository](const char* source) {
+        std::unique_ptr<Catalog> catalog(new Catalog());
+        QElapsedTimer loading;
+        qint64 firstRows = -1;
+        QList<QMetaObject::Connection> connections = {
+            QObject::connect(&repository, &FileRepository::tinyThumbnailsLoaded, catalog.get(), &Catalog::setTinyThumbnails),
+            QObject::connect(&repository, &FileRepository::modelPageLoaded, catalog.get(), [&](const QList<AstroFile>& astroFiles) {
+                catalog->addAstroFiles(astroFiles);
+                if (firstRows < 0)
+                    firstRows = loading.elapsed();
+            }),
+            QObject::connect(&repository, &FileRepository::modelLoaded, catalog.get(), &Catalog::finishAddingAstroFiles),
+        };
+        loading.start();
+        repository.loadModel();
+        printf("Loaded %d files from the %s in %.2fs, the first page in %.3fs\n", catalog->getNumberOfItems(), source,
+               loading.elapsed() / 1000.0, firstRows / 1000.0);
+        for (auto& connection : connections)
+            QObject::disconnect(connection);
+        return catalog;
+    };
+
+    CatalogSnapshot::remove(FileRepository::snapshotFilePath());
+    std::unique_ptr<Catalog> catalog = load("db");
+    elapsed.restart();
+    catalog->writeSnapshot(FileRepository::snapshotFilePath(), FileRepository::schemaVersion(), repository.catalogId(), repository.changeCounter());
+    printf("Wrote the snapshot in %.2fs\n", elapsed.elapsed() / 1000.0);
+    catalog = load("snapshot");
+
+    QVector<int> ids;
+    for (int row = 0; row < qMin(catalog->getNumberOfItems(), GENERATED_THUMBNAIL_PAGE); row++)
+        ids.append(catalog->getAstroFile(row)->Id);
+    const int largest = *std::max_element(thumbnailSizes.begin(), thumbnailSizes.end());
+    elapsed.restart();
+    ThumbnailBatch thumbnails = repository.readThumbnails(ids, thumbnailLevelFor(largest));
+    printf("Read %d thumbnails of %d pixels in %.3fs\n", int(thumbnails.images.count()), thumbnailLevelSizes[thumbnailLevelFor(largest)], elapsed.elapsed() / 1000.0);
+
+    elapsed.restart();
+    repository.getDuplicateFiles();
+    printf("Checked the hashes for duplicates in %.2fs\n", elapsed.elapsed() / 1000.0);
+    elapsed.restart();
+    const QVector<int> duplicates = catalog->allDuplicates();
+    printf("Found the %d files that have a duplicate in %.3fs\n", int(duplicates.count()), elapsed.elapsed() / 1000.0);
+    if (!duplicates.isEmpty())
+    {
+        const AstroFile* astroFile = catalog->getAstroFile(catalog->astroFileIndex(duplicates.first()));
+        elapsed.restart();
+        const int copies = catalog->duplicatesOf(astroFile->FileHash).count();
+        const int nearCopies = catalog->nearDuplicatesOf(astroFile->Id, GENERATED_NEAR_DUPLICATE_DISTANCE).count();
+        printf("Found the %d duplicates and %d near duplicates of a file in %.3fs\n", copies, nearCopies, elapsed.elapsed() / 1000.0);
+    }
+
+    // Last, it changes the catalog
+    QObject::connect(&repository, &FileRepository::astroFilesDeleted, catalog.get(), &Catalog::deleteAstroFiles);
+    const QString folder = generatedFolder(0);
+    elapsed.restart();
+    repository.deleteAstrofilesInFolder(folder);
+    printf("Deleted the %d files of %s in %.2fs\n", qMin(rows, GENERATED_FOLDER_SIZE), qPrintable(folder), elapsed.elapsed() / 1000.0);
+    return 0;
+}
+
+/*
+ * astrocat-index: indexes search folders into a catalog db without a display, so a
+ * large archive can be ingested on a server and the db opened on workstations.
+ * Exits once every file found is in the db.
+ */
+int main(int argc, char *argv[])
+{
+    // The decoders of a sandboxed ingest are this executable, see SandboxedProcessor
+    if (SandboxedProcessor::isHelper(argc, argv))
+        return SandboxedProcessor::runHelper(argc, argv);
+
+    // Thumbnails are drawn into QImages, which needs a platform but not a display
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+    QCoreApplication::setApplicationName("Astrocat");
+    QCoreApplication::setOrganizationName("Astrocat");
+    QCoreApplication::setOrganizationDomain("astrocat.app");
+    QCoreApplication::setApplicationVersion(CURRENT_APP_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Indexes astronomical images into an Astrocat catalog.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("folders", "Search folders to index, the saved search folders when none are given. "
+                                 "s3://bucket/prefix indexes an object store, see the ObjectStore settings. "
+                                 "With --merge, the partial catalog dbs to merge. With --import, the folders to import.", "[folders...]");
+    QCommandLineOption dbOption("db", "Catalog db to write, the one of the app by default.", "path");
+    QCommandLineOption threadsOption("threads", "Threads decoding files, tuned while indexing by default.", "count");
+    QCommandLineOption readerThreadsOption("reader-threads", "Threads reading files ahead of the decoding, tuned while indexing by default.", "count");
+    QCommandLineOption crawlThreadsOption("crawl-threads", "Directories listed at the same time per volume.", "count");
+    QCommandLineOption memoryOption("memory-budget", "Memory for the frames being processed, in MB.", "MB");
+    QCommandLineOption metricsOption("metrics", "Writes the metrics as JSON to this file when done.", "path");
+    QCommandLineOption traceOption("trace", "Writes a Chrome trace of the ingest to this file.", "path");
+    QCommandLineOption shardOption("shard", "Only indexes the directories of shard index of count, for example 2/8. "
+                                   "The partial catalogs of all shards are combined with --merge.", "index/count");
+    QCommandLineOption mergeOption("merge", "Merges the given catalog dbs into the db instead of indexing. "
+                                   "Files are matched by path, the newest one is kept.");
+    QCommandLineOption serveOption("serve", "Keeps the db as a shared catalog on a network drive, which the app reads "
+                                   "with the SharedCatalogPath setting. Keeps watching the folders until stopped.");
+    QCommandLineOption listenOption("listen", "Serves the catalog over HTTP on this port, to apps that keep a replica of it "
+                                    "with the CatalogServerUrl setting. Keeps watching the folders until stopped.", "port");
+    QCommandLineOption listenTokenOption("listen-token", "The token the apps served with --listen send, with the CatalogServerToken setting.", "token");
+    QCommandLineOption daemonOption("daemon", "Keeps indexing the db of the app and watching the folders after the app was closed, "
+                                    "until the app stops it. Started by the app with the IndexInBackground setting.");
+    QCommandLineOption exportOption("export", "Writes the files of the db as CSV to this file instead of indexing, "
+                                    "one column per keyword of the catalog. As an Arrow IPC stream when the "
+                                    "file ends in .arrows.", "path");
+    QCommandLineOption retryFailedOption("retry-failed", "Processes the files that failed to process again, also the ones "
+                                         "that did not change since.");
+    QCommandLineOption restretchOption("restretch", "Stretches the thumbnails in the db again instead of indexing, without reading "
+                                       "the files, with the channels linked or unlinked.", "linked|unlinked");
+    QCommandLineOption statsOption("stats", "Prints the frames and total exposure of each object, filter and instrument in the db "
+                                   "instead of indexing, tab separated.");
+    QCommandLineOption ingestRunsOption("ingest-runs", "Writes the reports of the last ingests into the db as JSON to this file instead "
+                                        "of indexing, with their throughput, stage latencies and failures.", "path");
+    QCommandLineOption changesSinceOption("changes-since", "Prints the files added, updated or deleted in the db after this change "
+                                          "sequence number as JSON lines instead of indexing. The seq of the last line is the one to ask from next time.", "seq");
+    QCommandLineOption importOption("import", "Copies the given folders, a card or a capture drive, into this folder and indexes the copies "
+                                    "from the bytes read for the copy, instead of reading them back. Only this folder is indexed.", "folder");
+    QCommandLineOption gpuBinningOption("gpu-binning", "Bins the frames for their thumbnails with OpenGL compute shaders, "
+                                        "on the CPU when there is no OpenGL 4.3 or OpenGL ES 3.1.");
+    QCommandLineOption sandboxOption("sandbox", "Decodes the files in helper processes, so a file that crashes a decoder only fails itself.");
+    QCommandLineOption reconcileOption("reconcile", "Lists the files of the db that are gone from the folders instead of indexing, "
+                                       "without processing anything. With remove, also deletes them from the db.", "report|remove");
+    QCommandLineOption solverIndexOption("build-solver-index", "Builds the quad index of the plate solver at this path from the star catalog "
+                                         "given instead of indexing, a CSV of ra, dec and magnitude, in degrees.", "path");
+    QCommandLineOption backgroundOption("target-background", "The background of the thumbnails stretched with --restretch, 0.25 by default.", "value");
+    QCommandLineOption corpusOption("generate-corpus", "Writes synthetic FITS and XISF frames into this folder instead of indexing, "
+                                    "to index for a benchmark. See the --corpus options.", "folder");
+    QCommandLineOption corpusFilesOption("corpus-files", "Frames written by --generate-corpus, 200 by default.", "count");
+    QCommandLineOption corpusSizesOption("corpus-sizes", "Frame sizes of the corpus in megapixels, 16, 26 or 61. 16 by default.", "list");
+    QCommandLineOption corpusBitpixOption("corpus-bitpix", "Sample types of the corpus as BITPIX, 8, 16, 32, -32 or -64. 16 by default.", "list");
+    QCommandLineOption corpusBayerOption("corpus-bayer", "Bayer patterns of the corpus, mono, RGGB, BGGR, GRBG or GBRG. mono,RGGB by default.", "list");
+    QCommandLineOption corpusFormatsOption("corpus-formats", "File formats of the corpus, fits or xisf. fits by default.", "list");
+    QCommandLineOption generateDbOption("generate-db", "Writes a catalog of this many synthetic files into the new db given with --db instead of "
+                                                       "indexing, then times loading it, the duplicate queries and deleting a folder.", "rows");
+    QCommandLineOption dbTagsOption("db-tags", "Keywords of each file of --generate-db, 20 by default.", "count");
+    QCommandLineOption dbThumbnailSizesOption("db-thumbnail-sizes", "Thumbnail sizes of the files of --generate-db in pixels, "
+                                                                    "taken in turn. 512 by default.", "list");
+    parser.addOptions({dbOption, threadsOption, readerThreadsOption, crawlThreadsOption, memoryOption, metricsOption, traceOption, shardOption, mergeOption, serveOption, listenOption, listenTokenOption, daemonOption, exportOption, retryFailedOption,
+                       restretchOption, backgroundOption, statsOption, ingestRunsOption, changesSinceOption, importOption, reconcileOption, sandboxOption, gpuBinningOption, solverIndexOption,
+                       corpusOption, corpusFilesOption, corpusSizesOption, corpusBitpixOption, corpusBayerOption, corpusFormatsOption,
+                       generateDbOption, dbTagsOption, dbThumbnailSizesOption});
+    parser.process(app);
+
+    const bool serve = parser.isSet(serveOption);
+    const bool daemon = parser.isSet(daemonOption);
+    const bool listen = parser.isSet(listenOption);
+    if (parser.isSet(dbOption))
+        FileRepository::setDatabaseFilePath(parser.value(dbOption));
+    if (serve)
+        FileRepository::setAccessMode(FileRepository::SharedWriterAccess);
+    if (parser.isSet(mergeOption))
+        return mergeCatalogs(parser.positionalArguments());
+    if (parser.isSet(exportOption))
+        return exportCatalog(parser.value(exportOption));
+    if (parser.isSet(statsOption))
+        return printIntegrationStats();
+    if (parser.isSet(ingestRunsOption))
+        return exportIngestRuns(parser.value(ingestRunsOption));
+    if (parser.isSet(changesSinceOption))
+        return printChangesSince(parser.value(changesSinceOption).toLongLong());
+    if (parser.isSet(solverIndexOption))
+        return buildSolverIndex(parser.positionalArguments(), parser.value(solverIndexOption));
+    if (parser.isSet(corpusOption))
+    {
+        auto list = [&parser](const QCommandLineOption& option, const QString& defaultValue) {
+            return (parser.isSet(option) ? parser.value(option) : defaultValue).split(',', Qt::SkipEmptyParts);
+        };
+        bool filesOk = true;
+        const int files = parser.isSet(corpusFilesOption) ? parser.value(corpusFilesOption).toInt(&filesOk) : 200;
+        const QList<CorpusFormat> combinations = corpusFormats(list(corpusSizesOption, "16"), list(corpusBitpixOption, "16"),
+                                                               list(corpusBayerOption, "mono,RGGB"), list(corpusFormatsOption, "fits"));
+        if (!filesOk || files < 1)
+            fprintf(stderr, "--corpus-files takes a number of files\n");
+        if (!filesOk || files < 1 || combinations.isEmpty())
+            return 1;
+        return generateCorpus(QDir(parser.value(corpusOption)).absolutePath(), files, combinations);
+    }
+    if (parser.isSet(generateDbOption))
+    {
+        bool rowsOk = true;
+        bool tagsOk = true;
+        const int rows = parser.value(generateDbOption).toInt(&rowsOk);
+        const int tagsPerFile = parser.isSet(dbTagsOption) ? parser.value(dbTagsOption).toInt(&tagsOk) : 20;
+        QList<int> thumbnailSizes;
+        for (auto& value : (parser.isSet(dbThumbnailSizesOption) ? parser.value(dbThumbnailSizesOption) : "512").split(',', Qt::SkipEmptyParts))
+        {
+            bool sizeOk = true;
+            const int size = value.toInt(&sizeOk);
+            if (!sizeOk || size < TINY_THUMBNAIL_SIZE || size > LARGEST_THUMBNAIL_SIZE)
+            {
+                fprintf(stderr, "--db-thumbnail-sizes takes sizes from %d to %d pixels\n", TINY_THUMBNAIL_SIZE, LARGEST_THUMBNAIL_SIZE);
+                return 1;
+            }
+            thumbnailSizes.append(size);
+        }
+        if (!parser.isSet(dbOption) || !rowsOk || rows < 1 || !tagsOk || tagsPerFile < 5 || thumbnailSizes.isEmpty())
+        {
+            fprintf(stderr, "--generate-db takes a number of rows and a new db with --db, and --db-tags at least 5 keywords\n");
+            return 1;
+        }
+        const int result = generateCatalog(rows, tagsPerFile, thumbnailSizes);
+        if (parser.isSet(metricsOption))
+            Metrics::writeJson(parser.value(metricsOption));
+        return result;
+    }
+    if (parser.isSet(restretchOption))
+    {
+        StretchOptions options;
+        const QString channels = parser.value(restretchOption);
+        bool backgroundOk = true;
+        if (parser.isSet(backgroundOption))
+            options.targetBackground = parser.value(backgroundOption).toFloat(&backgroundOk);
+        if ((channels != "linked" && channels != "unlinked") || !backgroundOk || options.targetBackground <= 0 || options.targetBackground >= 1)
+        {
+            fprintf(stderr, "--restretch takes linked or unlinked, and --target-background a value between 0 and 1\n");
+            return 1;
+        }
+        options.linked = channels == "linked";
+        return restretchThumbnails(options);
+    }
+
+    int shardIndex = 0;
+    int shardCount = 1;
+    if (parser.isSet(shardOption))
+    {
+        QStringList shard = parser.value(shardOption).split('/');
+        bool indexOk = false;
+        bool countOk = false;
+        if (shard.count() == 2)
+        {
+            shardIndex = shard.at(0).toInt(&indexOk);
+            shardCount = shard.at(1).toInt(&countOk);
+        }
+        if (!indexOk || !countOk || shardCount < 1 || shardIndex < 0 || shardIndex >= shardCount)
+        {
+            fprintf(stderr, "--shard takes index/count, with 0 <= index < count\n");
+            return 1;
+        }
+    }
+
+    QStringList folders;
+    QStringList importedFolders;
+    if (parser.isSet(importOption))
+    {
+        importedFolders = parser.positionalArguments();
+        const QString destination = QDir(parser.value(importOption)).absolutePath();
+        if (importedFolders.isEmpty() || !QDir().mkpath(destination))
+        {
+            fprintf(stderr, "--import takes a folder it can write to, and the folders to import\n");
+            return 1;
+        }
+        folders.append(destination);
+    }
+    else
+    {
+        for (auto& folder : parser.positionalArguments())
+            folders.append(ObjectStore::isObjectPath(QDir::cleanPath(folder)) ? QDir::cleanPath(folder) : QDir(folder).absolutePath());
+    }
+    if (folders.isEmpty())
+        folders = QSettings().value("SearchFolders").value<QList<QString>>();
+    if (folders.isEmpty())
+    {
+        fprintf(stderr, "No search folders given\n");
+        return 1;
+    }
+
+    if (parser.isSet(reconcileOption))
+    {
+        const QString mode = parser.value(reconcileOption);
+        if (mode != "report" && mode != "remove")
+        {
+            fprintf(stderr, "--reconcile takes report or remove\n");
+            return 1;
+        }
+        return reconcileCatalog(folders, mode == "remove");
+    }
+
+    if (parser.isSet(traceOption))
+    {
+        QThread::currentThread()->setObjectName("main");
+        Tracing::start(parser.value(traceOption));
+    }
+
+    IndexingEngine engine;
+    engine.setWatchFolders(serve || daemon || listen);
+    engine.setShard(shardIndex, shardCount);
+    if (parser.isSet(threadsOption))
+        engine.processor()->setThreadCount(parser.value(threadsOption).toInt());
+    if (parser.isSet(readerThreadsOption))
+        engine.processor()->setReaderThreadCount(parser.value(readerThreadsOption).toInt());
+    if (parser.isSet(memoryOption))
+        engine.processor()->setMemoryBudget(parser.value(memoryOption).toLongLong() * 1024 * 1024);
+    if (parser.isSet(sandboxOption))
+        engine.processor()->setSandboxed(true);
+    if (parser.isSet(gpuBinningOption))
+        GpuBinner::initialize();
+    if (parser.isSet(crawlThreadsOption))
+        engine.crawler()->setConcurrency(parser.value(crawlThreadsOption).toInt());
+
+    int exitCode = 0;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    std::atomic<qint64>& filesWritten = Metrics::counter("repository.files_written");
+
+    QTimer progressTimer;
+    progressTimer.setInterval(PROGRESS_INTERVAL);
+    QObject::connect(&progressTimer, &QTimer::timeout, [&]() {
+        double seconds = qMax<qint64>(elapsed.elapsed(), 1) / 1000.0;
+        printf("%.0fs: %lld files written (%.1f files/s), %d in progress, catalog %d files, peak RSS %lld MB\n",
+               seconds, (long long)filesWritten.load(), filesWritten.load() / seconds, engine.activeJobs(),
+               engine.catalog()->getNumberOfItems(), Metrics::peakResidentBytes() / (1024 * 1024));
+        fflush(stdout);
+    });
+    QObject::connect(&engine, &IndexingEngine::dbFailedToOpen, [&](const QString& message) {
+        fprintf(stderr, "Failed to open the catalog db %s: %s\n", qPrintable(FileRepository::databaseFilePath()), qPrintable(message));
+        exitCode = 1;
+        app.quit();
+    });
+    QObject::connect(&engine, &IndexingEngine::searchFolderMoved, [&](const QString& from, const QString& to) {
+        printf("%s moved to %s with its volume\n", qPrintable(from), qPrintable(to));
+        fflush(stdout);
+    });
+    // Listens once the db is open and the catalog loaded
+    CatalogServer catalogServer(engine.repository());
+    QObject::connect(&engine, &IndexingEngine::catalogLoaded, [&]() {
+        printf("Catalog loaded with %d files, indexing %s\n", engine.catalog()->getNumberOfItems(), qPrintable(folders.join(", ")));
+        fflush(stdout);
+        if (listen)
+        {
+            const quint16 port = parser.value(listenOption).toUShort();
+            if (port == 0 || !catalogServer.listen(port, parser.value(listenTokenOption)))
+            {
+                fprintf(stderr, "Could not serve the catalog on port %s\n", qPrintable(parser.value(listenOption)));
+                exitCode = 1;
+                app.quit();
+                return;
+            }
+            printf("Serving the catalog on port %d\n", port);
+            fflush(stdout);
+        }
+        if (parser.isSet(retryFailedOption))
+            engine.retryFailedFiles();
+        for (auto& source : importedFolders)
+            engine.importFolder(source, folders.first());
+    });
+    QObject::connect(&engine, &IndexingEngine::folderImported, [&](const QString& source, int files, qint64 bytes, int failed) {
+        printf("Copied %d files, %lld MB from %s, %d failed\n", files, (long long)(bytes / (1024 * 1024)), qPrintable(source), failed);
+        fflush(stdout);
+    });
+    // Closed as main returns, after engine.stop(), so the app stopping it waits for the snapshot
+    std::unique_ptr<IndexingService> service;
+    if (daemon)
+    {
+        service = std::make_unique<IndexingService>(&engine);
+        if (!service->listen())
+        {
+            fprintf(stderr, "Another daemon indexes %s\n", qPrintable(FileRepository::databaseFilePath()));
+            return 1;
+        }
+        QObject::connect(service.get(), &IndexingService::stopRequested, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+    }
+    if (serve || daemon || listen)
+    {
+        // Progress is only printed while files are being indexed
+        QObject::connect(&engine, &IndexingEngine::idle, [&]() {
+            progressTimer.stop();
+            printf("Catalog has %d files, watching for changes\n", engine.catalog()->getNumberOfItems());
+            fflush(stdout);
+        });
+        QObject::connect(&engine, &IndexingEngine::activeJobsChanged, [&](int activeJobs) {
+            if (activeJobs > 0 && !progressTimer.isActive())
+                progressTimer.start();
+        });
+    }
+    else
+    {
+        QObject::connect(&engine, &IndexingEngine::idle, &app, &QCoreApplication::quit, Qt::QueuedConnection);
+    }
+
+    printf("Indexing into %s\n", qPrintable(FileRepository::databaseFilePath()));
+    engine.start(folders);
+    progressTimer.start();
+    app.exec();
+    progressTimer.stop();
+
+    if (exitCode == 0)
+    {
+        // The bytes of the files read by the ingest, see IndexingEngine::reportIngest
+        const double seconds = qMax<qint64>(elapsed.elapsed(), 1) / 1000.0;
+        const double megabytes = Metrics::counter("ingest.bytes").load() / (1024.0 * 1024.0);
+        printf("Done in %.1fs, %lld files written (%.1f files/s, %.1f MB/s), catalog %d files, db %lld MB, peak RSS %lld MB\n",
+               seconds, (long long)filesWritten.load(), filesWritten.load() / seconds, megabytes / seconds, engine.catalog()->getNumberOfItems(),
+               QFileInfo(FileRepository::databaseFilePath()).size() / (1024 * 1024), Metrics::peakResidentBytes() / (1024 * 1024));
+    }
+    engine.stop();
+    Tracing::stop();
+
+    if (parser.isSet(metricsOption))
+        Metrics::writeJson(parser.value(metricsOption));
+    return exitCode;
+}
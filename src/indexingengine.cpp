@@ -0,0 +1,1375 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "indexingengine.h"
+#include "allocationtracker.h"
+#include "catalogreconciler.h"
+#include "catalogsnapshot.h"
+#include "filereader.h"
+#include "fitsheadereditor.h"
+#include "fitsprocessor.h"
+#include "gpubinner.h"
+#include "memorybudget.h"
+#include "metrics.h"
+#include "mock_foldercrawler.h"
+#include "mock_newfileprocessor.h"
+#include "objectstore.h"
+#include "taskscheduler.h"
+#include "volumeio.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSettings>
+#include <QStorageInfo>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+// Processed files are coalesced and written to the db in batches of up to
+// DB_WRITE_BATCH_SIZE files, or every DB_WRITE_BATCH_INTERVAL milliseconds.
+#define DB_WRITE_BATCH_SIZE 200
+#define DB_WRITE_BATCH_INTERVAL 500
+
+// A new catalog snapshot is written when an ingest of at least this many files finishes
+#define SNAPSHOT_INGEST_THRESHOLD 1000
+
+// The readers of a shared catalog look for changes written by its indexer this often, in milliseconds
+#define SHARED_CATALOG_POLL_INTERVAL 10000
+// Of the thumbnails a replica keeps, see CatalogClient
+#define DEFAULT_REPLICA_THUMBNAIL_LEVEL 2
+
+// The volumes of offline search folders are looked for this often, in milliseconds
+#define OFFLINE_VOLUME_POLL_INTERVAL 30000
+
+// Outdated thumbnails are made again this many files at a time, each time the engine is idle
+#define THUMBNAIL_REGENERATION_CHUNK 200
+
+// The processing is throttled until the user did nothing for this long, in milliseconds
+#define USER_IDLE_INTERVAL 3000
+
+// Headers edited at once by editHeaders, each file is a few small reads and writes
+#define HEADER_EDIT_THREADS 4
+
+// Files verified at once when the engine is idle, see verifyIntegrity
+#define VERIFY_BATCH_SIZE 50
+// Days until a verified file is verified again, for VerifyIntervalDays
+#define DEFAULT_VERIFY_INTERVAL_DAYS 90
+
+// Frames plate solved at once when the engine is idle, see solvePlates
+#define PLATE_SOLVE_BATCH_SIZE 20
+
+static bool isUnder(const QString& path, const QString& folder)
+{
+    return path == folder || path.startsWith(folder.endsWith('/') ? folder : folder + '/');
+}
+
+IndexingEngine::IndexingEngine(QObject *parent) : QObject(parent)
+{
+    changesPollInterval = QSettings().value("SharedCatalogPollInterval", SHARED_CATALOG_POLL_INTERVAL).toInt();
+
+    catalogThread = new QThread(this);
+    catalogThread->setObjectName("catalog");
+    catalogWorker = new Catalog;
+    catalogWorker->moveToThread(catalogThread);
+
+    folderCrawlerThread = new QThread(this);
+    folderCrawlerThread->setObjectName("folderCrawler");
+    // ASTROCAT_MOCK_PIPELINE=1 swaps in fabricated files and thumbnails, to measure the
+    // catalog, db and views without disk or decoding costs
+    bool mockPipeline = qEnvironmentVariableIntValue("ASTROCAT_MOCK_PIPELINE") != 0;
+    if (mockPipeline)
+        folderCrawlerWorker = new Mock_FolderCrawler;
+    else
+        folderCrawlerWorker = new FolderCrawler;
+    folderCrawlerWorker->moveToThread(folderCrawlerThread);
+
+    fileRepositoryThread = new QThread(this);
+    fileRepositoryThread->setObjectName("fileRepository");
+    fileRepositoryWorker = new FileRepository;
+    fileRepositoryWorker->moveToThread(fileRepositoryThread);
+    if (FileRepository::accessMode() == FileRepository::ReplicaAccess)
+    {
+        catalogClientWorker = new CatalogClient(fileRepositoryWorker);
+        catalogClientWorker->moveToThread(fileRepositoryThread);
+        connect(this,                   &IndexingEngine::clientStart,                       catalogClientWorker,    &CatalogClient::start);
+        connect(fileRepositoryThread,   &QThread::finished,                                 catalogClientWorker,    &QObject::deleteLater);
+    }
+
+    newFileProcessorThread = new QThread(this);
+    newFileProcessorThread->setObjectName("newFileProcessor");
+    if (mockPipeline)
+        newFileProcessorWorker = new Mock_NewFileProcessor;
+    else
+        newFileProcessorWorker = new NewFileProcessor;
+    newFileProcessorWorker->setCatalog(catalogWorker);
+    newFileProcessorWorker->moveToThread(newFileProcessorThread);
+
+    fileFilter = new FileProcessFilter;
+    fileFilter->setCatalog(catalogWorker);
+    fileFilter->moveToThread(folderCrawlerThread);
+
+    folderWatcher = new FolderWatcher;
+    folderWatcher->setCatalog(catalogWorker);
+    folderWatcher->moveToThread(folderCrawlerThread);
+
+    ingestServer = new IngestServer;
+    ingestServer->setCatalog(catalogWorker);
+    ingestServer->setProcessor(newFileProcessorWorker);
+    ingestServer->moveToThread(folderCrawlerThread);
+
+    fileImporterThread = new QThread(this);
+    fileImporterThread->setObjectName("fileImporter");
+    fileImporterWorker = new FileImporter;
+    fileImporterWorker->setProcessor(newFileProcessorWorker);
+    fileImporterWorker->moveToThread(fileImporterThread);
+
+    integrityVerifierThread = new QThread(this);
+    integrityVerifierThread->setObjectName("integrityVerifier");
+    integrityVerifierWorker = new IntegrityVerifier;
+    integrityVerifierWorker->moveToThread(integrityVerifierThread);
+
+    plateSolverThread = new QThread(this);
+    plateSolverThread->setObjectName("plateSolver");
+    plateSolverWorker = new PlateSolver;
+    plateSolverWorker->moveToThread(plateSolverThread);
+
+    pendingDbWritesTimer.setSingleShot(true);
+    pendingDbWritesTimer.setInterval(DB_WRITE_BATCH_INTERVAL);
+    offlineFoldersTimer.setInterval(OFFLINE_VOLUME_POLL_INTERVAL);
+    userIdleTimer.setSingleShot(true);
+    userIdleTimer.setInterval(USER_IDLE_INTERVAL);
+
+    connect(this,                   &IndexingEngine::crawl,                             folderCrawlerWorker,    &FolderCrawler::crawl);
+    connect(this,                   &IndexingEngine::initializeFileRepository,          fileRepositoryWorker,   &FileRepository::initialize);
+    connect(&pendingDbWritesTimer,  &QTimer::timeout,                                   this,                   &IndexingEngine::flushPendingDbWrites);
+    connect(&offlineFoldersTimer,   &QTimer::timeout,                                   this,                   &IndexingEngine::checkOfflineFolders);
+    connect(&userIdleTimer,         &QTimer::timeout,                                   this,                   &IndexingEngine::userIdle);
+    connect(&volumeRegistry,        &VolumeRegistry::mountsChanged,                     this,                   &IndexingEngine::checkOfflineFolders);
+    connect(this,                   &IndexingEngine::dbWatchChanges,                    fileRepositoryWorker,   &FileRepository::watchChanges);
+    connect(catalogThread,          &QThread::finished,                                 catalogWorker,          &QObject::deleteLater);
+    connect(this,                   &IndexingEngine::catalogAddAstroFile,               catalogWorker,          &Catalog::addAstroFile);
+    connect(this,                   &IndexingEngine::catalogWriteSnapshot,              catalogWorker,          &Catalog::writeSnapshot);
+    connect(folderCrawlerThread,    &QThread::finished,                                 folderCrawlerWorker,    &QObject::deleteLater);
+    connect(folderCrawlerWorker,    &FolderCrawler::filesFound,                         fileFilter,             &FileProcessFilter::filterFiles);
+    connect(fileFilter,             &FileProcessFilter::shouldProcess,                  newFileProcessorWorker, &NewFileProcessor::processNewFiles);
+    connect(fileFilter,             &FileProcessFilter::shouldProcess,                  this,                   &IndexingEngine::processQueued);
+    connect(fileFilter,             &FileProcessFilter::fileMoved,                      fileRepositoryWorker,   &FileRepository::moveAstrofile);
+    connect(fileFilter,             &FileProcessFilter::fileAliased,                    fileRepositoryWorker,   &FileRepository::aliasAstrofile);
+    connect(fileFilter,             &FileProcessFilter::filesDeferred,                  this,                   &IndexingEngine::journalJobs);
+    connect(fileRepositoryWorker,   &FileRepository::ingestJobsLoaded,                  this,                   &IndexingEngine::ingestJobsLoaded);
+    connect(fileRepositoryWorker,   &FileRepository::astroFileAliased,                  catalogWorker,          &Catalog::addAstroFile);
+    connect(fileRepositoryWorker,   &FileRepository::directoryManifestLoaded,           folderCrawlerWorker,    &FolderCrawler::setDirectoryManifest);
+    connect(fileRepositoryWorker,   &FileRepository::volumesLoaded,                     this,                   &IndexingEngine::volumesLoaded);
+    connect(fileRepositoryWorker,   &FileRepository::volumeRemapped,                    this,                   &IndexingEngine::volumeRemapped);
+    connect(folderCrawlerWorker,    &FolderCrawler::directoryManifestUpdated,           fileFilter,             &FileProcessFilter::forwardDirectoryManifest);
+    connect(fileFilter,             &FileProcessFilter::directoryManifestUpdated,       this,                   &IndexingEngine::directoryManifestUpdated);
+    connect(this,                   &IndexingEngine::forgetFolder,                      folderCrawlerWorker,    &FolderCrawler::forgetDirectory);
+    connect(this,                   &IndexingEngine::forgetFolder,                      folderWatcher,          &FolderWatcher::unwatchFolder);
+    connect(folderCrawlerThread,    &QThread::finished,                                 fileFilter,             &QObject::deleteLater);
+    connect(folderCrawlerThread,    &QThread::finished,                                 folderWatcher,          &QObject::deleteLater);
+    connect(folderWatcher,          &FolderWatcher::filesFound,                         fileFilter,             &FileProcessFilter::filterFiles);
+    connect(folderWatcher,          &FolderWatcher::filesRemoved,                       fileRepositoryWorker,   &FileRepository::deleteAstrofiles);
+    connect(folderWatcher,          &FolderWatcher::folderRemoved,                      this,                   &IndexingEngine::watchedFolderRemoved);
+    connect(folderWatcher,          &FolderWatcher::crawlRequested,                     this,                   &IndexingEngine::crawlFolder);
+    connect(this,                   &IndexingEngine::ingestServerListen,                ingestServer,           &IngestServer::listen);
+    connect(ingestServer,           &IngestServer::filesFound,                          fileFilter,             &FileProcessFilter::filterFiles);
+    connect(folderCrawlerThread,    &QThread::finished,                                 ingestServer,           &QObject::deleteLater);
+    connect(this,                   &IndexingEngine::importerImportFolder,              fileImporterWorker,     &FileImporter::importFolder);
+    connect(fileImporterWorker,     &FileImporter::filesFound,                          fileFilter,             &FileProcessFilter::filterFiles);
+    connect(fileImporterWorker,     &FileImporter::folderImported,                      this,                   &IndexingEngine::importFinished);
+    connect(fileImporterThread,     &QThread::finished,                                 fileImporterWorker,     &QObject::deleteLater);
+    connect(this,                   &IndexingEngine::verifierVerifyFiles,               integrityVerifierWorker, &IntegrityVerifier::verifyFiles);
+    connect(integrityVerifierWorker, &IntegrityVerifier::filesVerified,                 this,                   &IndexingEngine::integrityVerified);
+    connect(integrityVerifierThread, &QThread::finished,                                integrityVerifierWorker, &QObject::deleteLater);
+    connect(fileRepositoryWorker,   &FileRepository::integrityVerified,                 catalogWorker,          &Catalog::updateIntegrity);
+    connect(this,                   &IndexingEngine::solverSolveFiles,                  plateSolverWorker,      &PlateSolver::solveFiles);
+    connect(plateSolverWorker,      &PlateSolver::filesSolved,                          this,                   &IndexingEngine::platesSolved);
+    connect(plateSolverThread,      &QThread::finished,                                 plateSolverWorker,      &QObject::deleteLater);
+    connect(fileRepositoryWorker,   &FileRepository::platesSolved,                      catalogWorker,          &Catalog::updateSolutions);
+    connect(fileRepositoryWorker,   &FileRepository::astroFileUpdated,                  this,                   &IndexingEngine::dbAstroFileUpdated);
+    connect(fileRepositoryWorker,   &FileRepository::tinyThumbnailsLoaded,              catalogWorker,          &Catalog::setTinyThumbnails);
+    connect(fileRepositoryWorker,   &FileRepository::modelPageLoaded,                   catalogWorker,          &Catalog::addAstroFiles);
+    connect(fileRepositoryWorker,   &FileRepository::modelLoaded,                       catalogWorker,          &Catalog::finishAddingAstroFiles);
+    connect(catalogWorker,          &Catalog::DoneAddingAstrofiles,                     this,                   &IndexingEngine::modelLoadedFromDb);
+    connect(fileRepositoryWorker,   &FileRepository::dbFailedToInitialize,              this,                   &IndexingEngine::dbFailedToOpen);
+    // Through the engine, behind the catalogAddAstroFile of the files the hashes are of
+    connect(fileRepositoryWorker,   &FileRepository::fileHashesResolved,                this,                   &IndexingEngine::catalogUpdateFileHashes);
+    connect(this,                   &IndexingEngine::catalogUpdateFileHashes,           catalogWorker,          &Catalog::updateFileHashes);
+    connect(fileRepositoryWorker,   &FileRepository::perceptualHashesResolved,          catalogWorker,          &Catalog::updatePerceptualHashes);
+    connect(fileRepositoryThread,   &QThread::finished,                                 fileRepositoryWorker,   &QObject::deleteLater);
+    connect(newFileProcessorWorker, &NewFileProcessor::resultsReady,                    this,                   &IndexingEngine::processingResultsReady);
+    // Called from the processing threads, setPaused is thread safe
+    connect(newFileProcessorWorker, &NewFileProcessor::backpressureChanged,             folderCrawlerWorker,    &FolderCrawler::setPaused, Qt::DirectConnection);
+    connect(newFileProcessorThread, &QThread::finished,                                 newFileProcessorWorker, &QObject::deleteLater);
+}
+
+IndexingEngine::~IndexingEngine()
+{
+    stop();
+}
+
+void IndexingEngine::setWatchFolders(bool shouldWatch)
+{
+    watchFolders = shouldWatch;
+}
+
+void IndexingEngine::setChangesPollInterval(int msecs)
+{
+    changesPollInterval = msecs;
+}
+
+void IndexingEngine::setShard(int index, int count)
+{
+    fileFilter->setShard(index, count);
+}
+
+void IndexingEngine::setBackgroundIngest(bool background)
+{
+    newFileProcessorWorker->setBackgroundPriority(background);
+}
+
+/*!
+ * \brief IndexingEngine::noteUserActivity
+ * The user scrolled, or did something else the processing should not slow down. The
+ * processor is throttled until the user did nothing for USER_IDLE_INTERVAL, and no
+ * interaction is in progress, see beginInteraction.
+ */
+void IndexingEngine::noteUserActivity()
+{
+    if (newFileProcessorWorker == nullptr)
+        return;
+    if (!isThrottled)
+    {
+        isThrottled = true;
+        newFileProcessorWorker->setThrottled(true);
+        integrityVerifierWorker->setPaused(true);
+    }
+    userIdleTimer.start();
+}
+
+// Previews and the like, the processing stays throttled until they end
+void IndexingEngine::beginInteraction()
+{
+    interactionsInProgress++;
+    noteUserActivity();
+}
+
+void IndexingEngine::endInteraction()
+{
+    interactionsInProgress = qMax(0, interactionsInProgress - 1);
+    noteUserActivity();
+}
+
+void IndexingEngine::userIdle()
+{
+    if (interactionsInProgress > 0 || newFileProcessorWorker == nullptr)
+        return;
+    isThrottled = false;
+    newFileProcessorWorker->setThrottled(false);
+    integrityVerifierWorker->setPaused(false);
+}
+
+void IndexingEngine::start(const QStringList &folders)
+{
+    if (isStarted)
+        return;
+
+    searchFolders = folders;
+    catalogWorker->addSearchFolder(searchFolders);
+    if (watchFolders)
+        connect(folderCrawlerWorker, &FolderCrawler::crawlFinished, folderWatcher, &FolderWatcher::watchDirectories);
+
+    folderCrawlerThread->start();
+    fileImporterThread->start();
+    integrityVerifierThread->start();
+    plateSolverThread->start();
+    fileRepositoryThread->start();
+    newFileProcessorThread->start();
+    catalogThread->start();
+    isStarted = true;
+
+    emit initializeFileRepository();
+    // On this thread, before the processors bin any frame
+    if (QSettings().value("GpuBinning", false).toBool())
+        GpuBinner::initialize();
+    shouldVerifyIntegrity = QSettings().value("VerifyIntegrity", true).toBool() && !FileRepository::isIndexedElsewhere();
+    shouldSolvePlates = !QSettings().value("PlateSolverIndex").toString().isEmpty() && !FileRepository::isIndexedElsewhere();
+    const QString ingestServerName = QSettings().value("IngestServerName").toString();
+    if (!ingestServerName.isEmpty())
+        emit ingestServerListen(ingestServerName);
+    // The crawl starts once the volumes are loaded, with the catalog still loading. The
+    // filter holds the files to process until the catalog is loaded, see volumesLoaded.
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(InteractivePriority, [repository](const CancellationToken&) { repository->loadModel(); });
+}
+
+void IndexingEngine::addSearchFolder(const QString &folder)
+{
+    searchFolders.append(folder);
+    catalogWorker->addSearchFolder(folder);
+    if (!isStarted || FileRepository::isIndexedElsewhere())
+        return;
+
+    // The files it had when it was removed are shown again first, so the crawl does not
+    // process them again. After the model is loaded, which is submitted first at the
+    // same priority, and otherwise crawled with the others once the volumes are loaded.
+    FileRepository* repository = fileRepositoryWorker;
+    Catalog* catalog = catalogWorker;
+    repository->submit<void>(InteractivePriority, [this, repository, catalog, folder](const CancellationToken&) {
+        repository->attachFolder(folder);
+        // Through the catalog thread, after the files the attach loaded into it
+        QMetaObject::invokeMethod(catalog, [this, folder]() {
+            QMetaObject::invokeMethod(this, [this, folder]() {
+                if (isCrawlStarted && searchFolders.contains(folder) && checkVolume(folder))
+                    crawlFolder(folder);
+            });
+        });
+    });
+}
+
+void IndexingEngine::removeSearchFolder(const QString &folder)
+{
+    searchFolders.removeAll(folder);
+    offlineFolders.removeAll(folder);
+    catalogWorker->removeSearchFolder(folder);
+    emit forgetFolder(folder);
+
+    // Forget the directories of crawls already recorded, and of the ones still held back
+    QString path = QDir::cleanPath(folder);
+    pendingManifestRemoved.append(path);
+    pendingManifestUpdated.removeIf([&](const DirectoryState& directory) {
+        return directory.Path == path || directory.Path.startsWith(path + '/');
+    });
+    flushPendingManifestUpdates();
+
+    // The files of the folder are hidden until it is added back, unless another search
+    // folder still has them. One in it can not keep its files visible in a hidden folder,
+    // they are all deleted then.
+    bool hasFolderInside = false;
+    for (auto& searchFolder : searchFolders)
+    {
+        if (isUnder(path, QDir::cleanPath(searchFolder)))
+            return;
+        hasFolderInside = hasFolderInside || isUnder(QDir::cleanPath(searchFolder), path);
+    }
+    FileRepository* repository = fileRepositoryWorker;
+    if (hasFolderInside)
+        repository->submit<void>(IngestPriority, [repository, folder](const CancellationToken&) { repository->deleteAstrofilesInFolder(folder); });
+    else
+        repository->submit<void>(InteractivePriority, [repository, folder](const CancellationToken&) { repository->detachFolder(folder); });
+}
+
+void IndexingEngine::findDuplicates()
+{
+    // The hashes are backfilled on the repository thread, which also loads the
+    // thumbnails, so this waits until the catalog is loaded and the ingest is done
+    shouldFindDuplicates = true;
+    checkIdle();
+}
+
+/*!
+ * \brief IndexingEngine::retryFailedFiles
+ * Failed files are otherwise skipped by the filter until they change. They go through
+ * the filter all the same, so the shard and the search folders still apply.
+ */
+void IndexingEngine::retryFailedFiles()
+{
+    if (!isLoaded)
+        return;
+
+    queueFiles(catalogWorker->retryFailedFiles());
+}
+
+/*!
+ * \brief IndexingEngine::regenerateThumbnails
+ * The thumbnails of these files are made again if they are outdated, before the
+ * rest that checkIdle goes through. Sent by the views for the rows they show.
+ */
+void IndexingEngine::regenerateThumbnails(const QStringList &paths)
+{
+    if (!isLoaded || paths.isEmpty())
+        return;
+
+    queueFiles(catalogWorker->outdatedThumbnails(paths));
+}
+
+void IndexingEngine::queueFiles(const QVector<FileRecord> &files)
+{
+    if (files.isEmpty())
+        return;
+    FileProcessFilter* filter = fileFilter;
+    QMetaObject::invokeMethod(filter, [filter, files]() { filter->filterFiles(files); });
+}
+
+void IndexingEngine::importFolder(const QString &source, const QString &destination)
+{
+    pendingImports++;
+    emit importerImportFolder(QDir(source).absolutePath(), QDir(destination).absolutePath());
+}
+
+/*!
+ * \brief IndexingEngine::importFinished
+ * The imported files were handed to the filter, which may not have passed them on yet.
+ * The import is only done once the filter went through them, so the engine is not idle
+ * in between.
+ */
+void IndexingEngine::importFinished(const QString &source, int files, qint64 bytes, int failed)
+{
+    QMetaObject::invokeMethod(fileFilter, [this, source, files, bytes, failed]() {
+        QMetaObject::invokeMethod(this, [this, source, files, bytes, failed]() {
+            pendingImports = qMax(0, pendingImports - 1);
+            emit folderImported(source, files, bytes, failed);
+            checkIdle();
+        });
+    });
+}
+
+/*!
+ * \brief IndexingEngine::editHeaders
+ * Writes the edits into the headers of the FITS files, see FitsHeaderEditor, and
+ * updates their rows from the new headers. The pixels are not read again, the
+ * thumbnails and measures of the files are kept. The catalog gets the new
+ * modification times before the watcher sees the files changed, so they are not
+ * processed again.
+ */
+void IndexingEngine::editHeaders(const QList<AstroFile> &astroFiles, const QList<HeaderEdit> &edits)
+{
+    FileRepository* repository = fileRepositoryWorker;
+    Catalog* catalog = catalogWorker;
+    QtConcurrent::run([this, repository, catalog, astroFiles, edits]() {
+        QList<AstroFile> files = astroFiles;
+        QStringList failures;
+        QMutex failuresMutex;
+        QThreadPool pool;
+        pool.setMaxThreadCount(HEADER_EDIT_THREADS);
+        QtConcurrent::blockingMap(&pool, files, [&failures, &failuresMutex, &edits](AstroFile& astroFile) {
+            QString error;
+            QByteArray header;
+            if (astroFile.FileType != AstroFileType::Fits)
+                error = tr("Only FITS headers can be edited");
+            else
+                header = FitsHeaderEditor::edit(astroFile.FullPath, edits, error);
+            if (header.isEmpty())
+            {
+                QMutexLocker locker(&failuresMutex);
+                failures.append(QString("%1: %2").arg(astroFile.FullPath, error));
+                astroFile.Id = 0;
+                return;
+            }
+
+            FitsProcessor processor;
+            processor.loadHeader(astroFile, header);
+            processor.extractTags();
+            astroFile.Tags = TagMap(processor.getTags());
+            processor.reset();
+
+            const FileRecord record = FileRecord::ofPath(astroFile.FullPath);
+            astroFile.LastModifiedTime = record.lastModified();
+            astroFile.FileSize = record.Size;
+            astroFile.QuickHash = FileReader::quickHashOfFile(astroFile.FullPath);
+            astroFile.FileHash.clear();
+            astroFile.Integrity = IntegrityUnverified;
+        });
+        files.removeIf([](const AstroFile& astroFile) { return astroFile.Id == 0; });
+
+        QList<AstroFile> updated;
+        if (!files.isEmpty())
+            updated = repository->submit<QList<AstroFile>>(IngestPriority, [repository, files](const CancellationToken&) {
+                return repository->updateHeaders(files);
+            }).result();
+        QMetaObject::invokeMethod(catalog, [catalog, updated]() { catalog->addAstroFiles(updated); });
+        QMetaObject::invokeMethod(this, [this, edited = updated.count(), failures]() { emit headersEdited(edited, failures); });
+    });
+}
+
+/*!
+ * \brief IndexingEngine::reconcile
+ * Lists the directories of the catalog once each and reports the files they no longer
+ * have. The search folders of volumes that are offline are left out. The files gone
+ * are removed like the ones the watcher sees removed, in one transaction, and the views
+ * drop their rows in ranges. A reader of a shared catalog only reports them.
+ */
+void IndexingEngine::reconcile(bool removeMissing)
+{
+    if (!isLoaded)
+        return;
+
+    QStringList folders;
+    for (auto& folder : searchFolders)
+    {
+        if (!offlineFolders.contains(folder))
+            folders.append(folder);
+    }
+    const bool shouldRemove = removeMissing && !FileRepository::isIndexedElsewhere();
+    FileRepository* repository = fileRepositoryWorker;
+    Catalog* catalog = catalogWorker;
+    QtConcurrent::run([this, repository, catalog, folders, shouldRemove]() {
+        const QStringList missing = CatalogReconciler::missingFiles(catalog->getFilePaths(), folders);
+        if (shouldRemove && !missing.isEmpty())
+            repository->submit<void>(IngestPriority, [repository, missing](const CancellationToken&) { repository->deleteAstrofiles(missing); }).waitForFinished();
+        QMetaObject::invokeMethod(this, [this, missing, shouldRemove]() { emit reconciled(missing, shouldRemove); });
+    });
+}
+
+void IndexingEngine::crawlFolder(const QString &folder)
+{
+    // Matched by the directoryManifestUpdated the crawler emits when it is done
+    pendingCrawls++;
+
+    // The files of the catalog kept on the volume are merged first, so the crawl does
+    // not process them again
+    const QString path = QDir::cleanPath(folder);
+    const MountedVolume volume = VolumeRegistry::volumeOf(path);
+    if (foldersAwaitingImport.contains(volume.RootPath))
+    {
+        foldersAwaitingImport.insert(volume.RootPath, folder);
+        return;
+    }
+    const QFileInfo volumeCatalog(FileRepository::volumeCatalogPath(volume.RootPath));
+    if (!FileRepository::isIndexedElsewhere() && !ObjectStore::isObjectPath(path)
+        && volumeCatalog.exists() && importedVolumeCatalogs.value(volume.RootPath) != volumeCatalog.lastModified())
+    {
+        importedVolumeCatalogs.insert(volume.RootPath, volumeCatalog.lastModified());
+        foldersAwaitingImport.insert(volume.RootPath, folder);
+        FileRepository* repository = fileRepositoryWorker;
+        Catalog* catalog = catalogWorker;
+        repository->submit<void>(IngestPriority, [this, repository, catalog, volume](const CancellationToken&) {
+            repository->importVolumeCatalog(volume.RootPath, volume.Name);
+            // Through the catalog thread, after the files the import loaded into it
+            QMetaObject::invokeMethod(catalog, [this, volume]() {
+                QMetaObject::invokeMethod(this, [this, volume]() { volumeCatalogImported(volume.RootPath); });
+            });
+        });
+        return;
+    }
+    emit crawl(folder);
+}
+
+void IndexingEngine::volumeCatalogImported(const QString &rootPath)
+{
+    const QStringList folders = foldersAwaitingImport.values(rootPath);
+    foldersAwaitingImport.remove(rootPath);
+    for (auto& folder : folders)
+        emit crawl(folder);
+}
+
+/*!
+ * \brief IndexingEngine::exportVolumeCatalogs
+ * Brings the catalogs kept on the volumes of the search folders up to date, once the
+ * ingest is idle. A volume gets a catalog when the WriteVolumeCatalogs setting is on,
+ * and one that has a catalog keeps it up to date either way, so whoever indexes the
+ * volume updates it.
+ */
+void IndexingEngine::exportVolumeCatalogs()
+{
+    if (FileRepository::isIndexedElsewhere())
+        return;
+
+    const bool createCatalogs = QSettings().value("WriteVolumeCatalogs", false).toBool();
+    QMap<QString, QStringList> foldersByVolume;
+    for (auto& folder : searchFolders)
+    {
+        const QString path = QDir::cleanPath(folder);
+        if (!offlineFolders.contains(folder) && !ObjectStore::isObjectPath(path))
+            foldersByVolume[VolumeRegistry::volumeOf(path).RootPath].append(path);
+    }
+
+    FileRepository* repository = fileRepositoryWorker;
+    for (auto it = foldersByVolume.constBegin(); it != foldersByVolume.constEnd(); ++it)
+    {
+        const QString rootPath = it.key();
+        const QStringList folders = it.value();
+        if (!createCatalogs && !QFileInfo::exists(FileRepository::volumeCatalogPath(rootPath)))
+            continue;
+        repository->submit<void>(MaintenancePriority, [repository, rootPath, folders](const CancellationToken&) {
+            repository->exportVolumeCatalog(rootPath, folders);
+        });
+    }
+}
+
+bool IndexingEngine::isIdle() const
+{
+    return isLoaded && pendingCrawls == 0 && pendingImports == 0 && numberOfActiveJobs == 0 && pendingDbWrites.isEmpty();
+}
+
+void IndexingEngine::checkIdle()
+{
+    if (!isIdle())
+        return;
+
+    if (shouldFindDuplicates)
+    {
+        shouldFindDuplicates = false;
+        // A search still waiting or running is replaced by this one
+        duplicatesToken.cancel();
+        duplicatesToken = CancellationToken();
+        FileRepository* repository = fileRepositoryWorker;
+        repository->submit<void>(MaintenancePriority, [repository](const CancellationToken& token) { repository->getDuplicateFiles(token); }, duplicatesToken);
+    }
+
+    // Skipped by the repository when it ran recently, or nothing changed since
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(MaintenancePriority, [repository](const CancellationToken& token) { repository->runMaintenance(token); });
+    exportVolumeCatalogs();
+
+    // The rows made by an older THUMBNAIL_VERSION, a chunk at a time so new files
+    // found meanwhile do not wait for all of them
+    queueFiles(catalogWorker->outdatedThumbnails(THUMBNAIL_REGENERATION_CHUNK));
+    verifyIntegrity();
+    solvePlates();
+    emit idle();
+}
+
+/*!
+ * \brief IndexingEngine::verifyIntegrity
+ * Verifies the next VERIFY_BATCH_SIZE files, the ones never verified first, then the
+ * ones verified the longest ago, see IntegrityVerifier. One batch at a time, started
+ * only while the engine is idle, so an ingest shares the disks with one batch at most.
+ */
+void IndexingEngine::verifyIntegrity()
+{
+    if (!shouldVerifyIntegrity || isVerifying || isCanceled)
+        return;
+    isVerifying = true;
+
+    const QDateTime verifiedBefore = QDateTime::currentDateTime().addDays(-QSettings().value("VerifyIntervalDays", DEFAULT_VERIFY_INTERVAL_DAYS).toInt());
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(MaintenancePriority, [this, repository, verifiedBefore](const CancellationToken&) {
+        const QList<AstroFile> candidates = repository->verificationCandidates(VERIFY_BATCH_SIZE, verifiedBefore);
+        QMetaObject::invokeMethod(this, [this, candidates]() {
+            if (candidates.isEmpty() || isCanceled)
+                isVerifying = false;
+            else
+                emit verifierVerifyFiles(candidates);
+        });
+    });
+}
+
+void IndexingEngine::integrityVerified(const QList<AstroFile> &astroFiles)
+{
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(MaintenancePriority, [this, repository, astroFiles](const CancellationToken&) {
+        repository->recordVerifications(astroFiles);
+        QMetaObject::invokeMethod(this, [this]() {
+            isVerifying = false;
+            if (isIdle())
+                verifyIntegrity();
+        });
+    });
+}
+
+/*!
+ * \brief IndexingEngine::solvePlates
+ * Solves the next PLATE_SOLVE_BATCH_SIZE frames without a position, see PlateSolver.
+ * Like verifyIntegrity, one batch at a time while the engine is idle.
+ */
+void IndexingEngine::solvePlates()
+{
+    if (!shouldSolvePlates || isSolving || isCanceled)
+        return;
+    isSolving = true;
+
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(MaintenancePriority, [this, repository](const CancellationToken&) {
+        const QList<AstroFile> candidates = repository->solveCandidates(PLATE_SOLVE_BATCH_SIZE);
+        QMetaObject::invokeMethod(this, [this, candidates]() {
+            if (candidates.isEmpty() || isCanceled)
+                isSolving = false;
+            else
+                emit solverSolveFiles(candidates);
+        });
+    });
+}
+
+void IndexingEngine::platesSolved(const QList<AstroFile> &astroFiles)
+{
+    // The index could not be opened, there is nothing to solve with until the next start
+    if (astroFiles.isEmpty())
+    {
+        shouldSolvePlates = false;
+        isSolving = false;
+        return;
+    }
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(MaintenancePriority, [this, repository, astroFiles](const CancellationToken&) {
+        repository->recordSolutions(astroFiles);
+        QMetaObject::invokeMethod(this, [this]() {
+            isSolving = false;
+            if (isIdle())
+                solvePlates();
+        });
+    });
+}
+
+void IndexingEngine::cancel()
+{
+    if (folderCrawlerThread == nullptr)
+        return;
+
+    isCanceled = true;
+    // The files already processed are written, the repository does not cancel ingest writes
+    flushPendingDbWrites();
+    catalogWorker->removeAllSearchFolders();
+    catalogWorker->cancel();
+    fileFilter->cancel();
+    folderWatcher->cancel();
+    fileImporterWorker->cancel();
+    integrityVerifierWorker->cancel();
+    plateSolverWorker->cancel();
+    folderCrawlerWorker->cancel();
+    newFileProcessorWorker->cancel();
+    fileRepositoryWorker->cancel();
+}
+
+void IndexingEngine::stopWorkers()
+{
+    if (folderCrawlerThread == nullptr)
+        return;
+
+    pendingDbWritesTimer.stop();
+    userIdleTimer.stop();
+
+    // The importer hands its files to the filter on the crawler thread
+    fileImporterWorker->cancel();
+    qDebug()<<"Cleaning up fileImporterThread";
+    cleanUpWorker(fileImporterThread);
+
+    integrityVerifierWorker->cancel();
+    qDebug()<<"Cleaning up integrityVerifierThread";
+    cleanUpWorker(integrityVerifierThread);
+
+    plateSolverWorker->cancel();
+    qDebug()<<"Cleaning up plateSolverThread";
+    cleanUpWorker(plateSolverThread);
+
+    qDebug()<<"Cleaning up folderCrawlerThread";
+    cleanUpWorker(folderCrawlerThread);
+
+    qDebug()<<"Cleaning up newFileProcessorThread";
+    cleanUpWorker(newFileProcessorThread);
+
+    // Let the repository finish what was already queued to it, like the last manifest update
+    // and the results still waiting for their batch
+    if (isStarted)
+    {
+        flushPendingDbWrites();
+        QMetaObject::invokeMethod(fileRepositoryWorker, []() {}, Qt::BlockingQueuedConnection);
+    }
+
+    // The snapshot is only valid if the db is not in the middle of an ingest.
+    shouldWriteSnapshot = isStarted && numberOfActiveJobs == 0 && pendingDbWrites.isEmpty();
+    snapshotCatalogId = fileRepositoryWorker->catalogId();
+    snapshotChangeCounter = fileRepositoryWorker->changeCounter();
+
+    qDebug()<<"Cleaning up fileRepositoryThread";
+    cleanUpWorker(fileRepositoryThread);
+
+    folderCrawlerWorker = nullptr;
+    fileFilter = nullptr;
+    folderWatcher = nullptr;
+    ingestServer = nullptr;
+    fileImporterWorker = nullptr;
+    integrityVerifierWorker = nullptr;
+    plateSolverWorker = nullptr;
+    newFileProcessorWorker = nullptr;
+    fileRepositoryWorker = nullptr;
+    catalogClientWorker = nullptr;
+}
+
+void IndexingEngine::stop()
+{
+    if (catalogThread == nullptr)
+        return;
+
+    stopWorkers();
+
+    if (shouldWriteSnapshot)
+    {
+        qDebug()<<"Writing catalog snapshot";
+        // Blocking, so that all queued catalog updates are applied before the snapshot is taken
+        QMetaObject::invokeMethod(catalogWorker, [=]() {
+            catalogWorker->writeSnapshot(FileRepository::snapshotFilePath(), FileRepository::schemaVersion(), snapshotCatalogId, snapshotChangeCounter);
+        }, Qt::BlockingQueuedConnection);
+    }
+    else if (isStarted)
+    {
+        CatalogSnapshot::remove(FileRepository::snapshotFilePath());
+    }
+
+    qDebug()<<"Cleaning up catalogThread";
+    cleanUpWorker(catalogThread);
+    catalogWorker = nullptr;
+}
+
+void IndexingEngine::cleanUpWorker(QThread*& thread)
+{
+    thread->quit();
+    thread->wait();
+    delete thread;
+    thread = nullptr;
+}
+
+void IndexingEngine::modelLoadedFromDb()
+{
+    // The catalog has every page from the db now, so the crawler will only
+    // queue files that are new or modified.
+    isLoaded = true;
+    emit catalogLoaded();
+
+    // The members of the saved collections are found once, on the catalog thread, then follow the rows
+    Catalog* catalog = catalogWorker;
+    QMetaObject::invokeMethod(catalog, [catalog]() {
+        for (auto& saved : FileRepository::smartCollections())
+        {
+            SmartCollection collection;
+            QString error;
+            if (SmartCollection::compile(saved.first, saved.second, collection, error))
+                catalog->setSmartCollection(collection);
+            else
+                qDebug() << "Skipping the smart collection" << saved.first << error;
+        }
+    });
+    FileProcessFilter* filter = fileFilter;
+    if (filter != nullptr)
+        QMetaObject::invokeMethod(filter, [filter]() { filter->catalogLoaded(); });
+
+    if (FileRepository::accessMode() == FileRepository::SharedReaderAccess)
+        emit dbWatchChanges(changesPollInterval);
+    if (catalogClientWorker != nullptr)
+    {
+        QSettings settings;
+        emit clientStart(QUrl(settings.value("CatalogServerUrl").toString()), settings.value("CatalogServerToken").toString(),
+                         settings.value("CatalogServerThumbnailLevel", DEFAULT_REPLICA_THUMBNAIL_LEVEL).toInt());
+    }
+
+    // The migrations the catalog does not read run between the other requests
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(MaintenancePriority, [repository](const CancellationToken& token) { repository->runMigrations(false, token); });
+
+    // The jobs of an interrupted ingest, whose directories the crawl skips
+    if (!FileRepository::isIndexedElsewhere())
+        repository->submit<void>(IngestPriority, [repository](const CancellationToken&) { repository->loadIngestJobs(); });
+    checkIdle();
+}
+
+/*!
+ * \brief IndexingEngine::volumesLoaded
+ * The volumes are loaded before the catalog, which is what the crawl waits for: the
+ * enumeration of the folders runs while the pages of the catalog load, instead of
+ * after them.
+ */
+void IndexingEngine::volumesLoaded(const QList<VolumeRecord> &volumes)
+{
+    knownVolumes = volumes;
+    if (isCrawlStarted)
+        return;
+    isCrawlStarted = true;
+
+    for (auto& folder : QStringList(searchFolders))
+    {
+        // Folders moved with their volume are crawled once the db has them at their new path
+        if (searchFolders.contains(folder) && checkVolume(folder))
+            crawlFolder(folder);
+    }
+}
+
+const VolumeRecord *IndexingEngine::knownVolumeOf(const QString &path) const
+{
+    const VolumeRecord* volume = nullptr;
+    for (auto& known : knownVolumes)
+    {
+        if (isUnder(path, known.RootPath) && (volume == nullptr || known.RootPath.length() > volume->RootPath.length()))
+            volume = &known;
+    }
+    return volume;
+}
+
+const VolumeRecord *IndexingEngine::knownVolumeById(const QString &uuid) const
+{
+    for (auto& known : knownVolumes)
+    {
+        if (known.Uuid == uuid)
+            return &known;
+    }
+    return nullptr;
+}
+
+/*!
+ * \brief IndexingEngine::checkVolume
+ * Returns true when the search folder can be crawled, and records its volume.
+ *
+ * A folder under the mount point of a known volume that is not mounted, be it gone or
+ * an empty mount point, is offline: it is not crawled, its files stay in the catalog,
+ * and its volume is looked for again every OFFLINE_VOLUME_POLL_INTERVAL, and as soon
+ * as VolumeRegistry sees a mount. A known volume mounted at another path is remapped
+ * with the search folders on it, which are crawled once the db has them at their new
+ * paths, see moveVolume.
+ */
+bool IndexingEngine::checkVolume(const QString &folder)
+{
+    const QString path = QDir::cleanPath(folder);
+    const VolumeRecord* known = knownVolumeOf(path);
+    if (QFileInfo(path).isDir())
+    {
+        QStorageInfo storage(path);
+        const VolumeRecord current = {VolumeIo::identityOf(storage), QDir::cleanPath(storage.rootPath()), storage.name()};
+        if (current.Uuid.isEmpty())
+            return true;
+
+        const VolumeRecord* moved = knownVolumeById(current.Uuid);
+        if (moved != nullptr && moved->RootPath != current.RootPath)
+        {
+            // Mounted twice, like with a bind mount, is not a move
+            const QString oldRootPath = moved->RootPath;
+            QStorageInfo previous(oldRootPath);
+            if (QDir::cleanPath(previous.rootPath()) == oldRootPath && VolumeIo::identityOf(previous) == current.Uuid)
+                return true;
+            moveVolume(current, oldRootPath);
+            return false;
+        }
+        // A volume we did not know, the known one, or another volume mounted in its place
+        if (known == nullptr || known->Uuid == current.Uuid || known->RootPath == current.RootPath)
+        {
+            recordVolume(current);
+            return true;
+        }
+    }
+    else if (known == nullptr)
+    {
+        return true;
+    }
+
+    for (auto& mounted : QStorageInfo::mountedVolumes())
+    {
+        if (!mounted.isValid() || !mounted.isReady() || VolumeIo::identityOf(mounted) != known->Uuid)
+            continue;
+        const QString rootPath = QDir::cleanPath(mounted.rootPath());
+        // The volume is where it was, the folder itself is gone
+        if (rootPath == known->RootPath)
+            return true;
+        const QString oldRootPath = known->RootPath;
+        moveVolume({known->Uuid, rootPath, mounted.name()}, oldRootPath);
+        return false;
+    }
+
+    if (!offlineFolders.contains(folder))
+    {
+        qDebug() << "The volume of" << folder << "is offline, its files are kept until it is back";
+        offlineFolders.append(folder);
+    }
+    if (!offlineFoldersTimer.isActive())
+        offlineFoldersTimer.start();
+    return false;
+}
+
+void IndexingEngine::recordVolume(const VolumeRecord &volume)
+{
+    const VolumeRecord* known = knownVolumeById(volume.Uuid);
+    if (known != nullptr && known->RootPath == volume.RootPath && known->Label == volume.Label)
+        return;
+
+    knownVolumes.removeIf([&](const VolumeRecord& record) {
+        return record.Uuid == volume.Uuid || record.RootPath == volume.RootPath;
+    });
+    knownVolumes.append(volume);
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(IngestPriority, [repository, volume](const CancellationToken&) { repository->recordVolume(volume); });
+}
+
+/*!
+ * \brief IndexingEngine::moveVolume
+ * The volume mounted at oldRootPath is now at the root path of the record. The
+ * search folders on it move with it, and the files of the catalog and the db are
+ * remapped to their new paths instead of being found and processed again.
+ */
+void IndexingEngine::moveVolume(const VolumeRecord &volume, const QString &oldRootPath)
+{
+    qDebug() << "Volume" << volume.Uuid << "moved from" << oldRootPath << "to" << volume.RootPath;
+    knownVolumes.removeIf([&](const VolumeRecord& record) {
+        return record.Uuid == volume.Uuid || record.RootPath == volume.RootPath;
+    });
+    knownVolumes.append(volume);
+
+    for (auto& folder : QStringList(searchFolders))
+    {
+        const QString path = QDir::cleanPath(folder);
+        if (!isUnder(path, oldRootPath))
+            continue;
+
+        const QString moved = QDir::cleanPath(volume.RootPath + '/' + QDir(oldRootPath).relativeFilePath(path));
+        offlineFolders.removeAll(folder);
+        catalogWorker->removeSearchFolder(folder);
+        emit forgetFolder(folder);
+        if (searchFolders.contains(moved))
+        {
+            searchFolders.removeAll(folder);
+        }
+        else
+        {
+            searchFolders.replace(searchFolders.indexOf(folder), moved);
+            catalogWorker->addSearchFolder(moved);
+        }
+        emit searchFolderMoved(folder, moved);
+    }
+
+    // Right away, so the crawl after the remap finds the files of the catalog at their new paths
+    catalogWorker->remapFolder(oldRootPath, volume.RootPath);
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(IngestPriority, [repository, volume, oldRootPath](const CancellationToken&) { repository->remapVolume(volume, oldRootPath); });
+}
+
+void IndexingEngine::volumeRemapped(const QString &oldRootPath, const QString &newRootPath)
+{
+    Q_UNUSED(oldRootPath);
+    for (auto& folder : searchFolders)
+    {
+        if (isUnder(QDir::cleanPath(folder), newRootPath))
+            crawlFolder(folder);
+    }
+}
+
+void IndexingEngine::checkOfflineFolders()
+{
+    const QStringList folders = offlineFolders;
+    offlineFolders.clear();
+    for (auto& folder : folders)
+    {
+        if (searchFolders.contains(folder) && checkVolume(folder))
+            crawlFolder(folder);
+    }
+    if (offlineFolders.isEmpty())
+        offlineFoldersTimer.stop();
+}
+
+/*!
+ * \brief IndexingEngine::watchedFolderRemoved
+ * A watched folder is gone. An unplugged disk takes all its folders with it, and
+ * their files stay in the catalog until it is back, see checkVolume.
+ */
+void IndexingEngine::watchedFolderRemoved(const QString &folder)
+{
+    const QString path = QDir::cleanPath(folder);
+    for (auto& searchFolder : QStringList(searchFolders))
+    {
+        if (isUnder(path, QDir::cleanPath(searchFolder)) && !checkVolume(searchFolder))
+            return;
+    }
+
+    pendingFolderRemovals.append(folder);
+    flushPendingFolderRemovals();
+}
+
+/*!
+ * \brief IndexingEngine::flushPendingFolderRemovals
+ * Deletes the files of the removed folders once no crawl is pending. A folder moved
+ * elsewhere is found by the crawl the watcher requested at its new place, which
+ * rebinds its files to their new paths, so they are not deleted with the old folder.
+ */
+void IndexingEngine::flushPendingFolderRemovals()
+{
+    if (pendingCrawls > 0)
+        return;
+
+    FolderCrawler* crawler = folderCrawlerWorker;
+    FileRepository* repository = fileRepositoryWorker;
+    for (auto& folder : pendingFolderRemovals)
+    {
+        QMetaObject::invokeMethod(crawler, [crawler, folder]() { crawler->forgetDirectory(folder); });
+        repository->submit<void>(IngestPriority, [repository, folder](const CancellationToken&) { repository->deleteAstrofilesInFolder(folder); });
+    }
+    pendingFolderRemovals.clear();
+}
+
+/*!
+ * \brief IndexingEngine::ingestJobsLoaded
+ * Resumes the ingest the last session did not finish. The jobs that are no longer in
+ * the search folders are dropped from the journal, the rest go through the filter again.
+ */
+void IndexingEngine::ingestJobsLoaded(const QVector<FileRecord> &files)
+{
+    QVector<FileRecord> resumed;
+    QStringList dropped;
+    for (auto& record : files)
+    {
+        if (catalogWorker->isInSearchFolders(record.FullPath))
+            resumed.append(record);
+        else
+            dropped.append(record.FullPath);
+    }
+    qDebug() << "Resuming" << resumed.count() << "files of the last ingest";
+    Metrics::counter("ingest.resumed") += resumed.count();
+    finishJobs(dropped);
+    queueFiles(resumed);
+}
+
+void IndexingEngine::journalJobs(const QVector<FileRecord> &files)
+{
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(IngestPriority, [repository, files](const CancellationToken&) { repository->journalIngestJobs(files); });
+}
+
+// Jobs dropped without being written, which are not resumed
+void IndexingEngine::finishJobs(const QStringList &fullPaths)
+{
+    if (fullPaths.isEmpty())
+        return;
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(IngestPriority, [repository, fullPaths](const CancellationToken&) { repository->finishIngestJobs(fullPaths); });
+}
+
+void IndexingEngine::processQueued(const QVector<FileRecord> &files)
+{
+    // Journaled before the writes of these files, and the manifest of their crawl
+    journalJobs(files);
+
+    if (numberOfActiveJobs == 0)
+    {
+        ingestTimer.start();
+        ingestStartedAt = QDateTime::currentDateTimeUtc();
+        ingestFiles = 0;
+        ingestBytes = 0;
+        ingestMetrics = Metrics::snapshot();
+        ingestFailures.clear();
+    }
+    ingestFiles += files.count();
+    for (auto& record : files)
+        ingestBytes += record.Size;
+    numberOfActiveJobs += files.count();
+    emit activeJobsChanged(numberOfActiveJobs);
+}
+
+/*!
+ * \brief IndexingEngine::processingResultsReady
+ * Takes every result the processor has in its ring, as one batch for one queued call.
+ */
+void IndexingEngine::processingResultsReady()
+{
+    if (newFileProcessorWorker == nullptr)
+        return;
+
+    QVector<ProcessingResult> results;
+    newFileProcessorWorker->takeResults(results);
+    for (auto& result : results)
+    {
+        if (result.cancelled)
+            processingCancelled(result.astroFile.FullPath);
+        else
+            astroFileProcessed(std::move(result.astroFile));
+    }
+}
+
+void IndexingEngine::astroFileProcessed(AstroFile astroFile)
+{
+    if (!catalogWorker->isInSearchFolders(astroFile.FullPath))
+    {
+        // This file is not in the catalog anymore. A header phase result
+        // is followed by its pixel phase, which ends the job.
+        if (astroFile.processStatus != NeedsToBeProcessed)
+        {
+            finishJobs({astroFile.FullPath});
+            jobFinished();
+        }
+        return;
+    }
+
+    if (astroFile.processStatus == AstroFileFailedToProcess)
+        ingestFailures[astroFile.FailureReason]++;
+
+    // do not decrement numberOfActiveJobs yet. It will be decremented
+    // after the db recorded the final (pixel phase) result.
+    pendingDbWrites.append(std::move(astroFile));
+    if (pendingDbWrites.count() >= DB_WRITE_BATCH_SIZE)
+        flushPendingDbWrites();
+    else if (!pendingDbWritesTimer.isActive())
+        pendingDbWritesTimer.start();
+}
+
+void IndexingEngine::flushPendingDbWrites()
+{
+    pendingDbWritesTimer.stop();
+    if (pendingDbWrites.isEmpty())
+        return;
+
+    const QList<AstroFile> astroFiles = pendingDbWrites;
+    pendingDbWrites.clear();
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(IngestPriority, [repository, astroFiles](const CancellationToken&) { repository->addOrUpdateAstrofiles(astroFiles); });
+}
+
+void IndexingEngine::processingCancelled(const QString &fullPath)
+{
+    // The jobs stopped by cancel are resumed by the next session
+    if (!isCanceled)
+        finishJobs({fullPath});
+    releaseAliases(fullPath);
+    jobFinished();
+}
+
+void IndexingEngine::dbAstroFileUpdated(const AstroFile &astroFile)
+{
+    {
+        // The queued call copies the file into its event
+        static AllocationCounter& signalAllocations = AllocationTracker::counter("engine.signal_catalog");
+        AllocationScope allocations(signalAllocations);
+        emit catalogAddAstroFile(astroFile);
+    }
+
+    // The header phase of a file is written first, the job is done after its pixel phase
+    if (astroFile.processStatus == NeedsToBeProcessed)
+        return;
+
+    // The files of a replica are written by the CatalogClient, they are not jobs of an ingest
+    const bool isJob = catalogClientWorker == nullptr;
+    numberIngestedSinceSnapshot++;
+    if (numberOfActiveJobs == (isJob ? 1 : 0) && numberIngestedSinceSnapshot >= SNAPSHOT_INGEST_THRESHOLD)
+    {
+        // Queued after the catalogAddAstroFile calls above, so the catalog has every file by then
+        numberIngestedSinceSnapshot = 0;
+        emit catalogWriteSnapshot(FileRepository::snapshotFilePath(), FileRepository::schemaVersion(), fileRepositoryWorker->catalogId(), fileRepositoryWorker->changeCounter());
+    }
+    if (!isJob)
+        return;
+    releaseAliases(astroFile.FullPath);
+    jobFinished();
+}
+
+/*!
+ * \brief IndexingEngine::releaseAliases
+ * Tells the filter the file is done. The hard links that waited for it are filtered
+ * again once the catalog has its row: the call goes through the catalog thread, behind
+ * the catalogAddAstroFile of the file, and from there to the filter.
+ */
+void IndexingEngine::releaseAliases(const QString &fullPath)
+{
+    FileProcessFilter* filter = fileFilter;
+    if (filter == nullptr)
+        return;
+    QMetaObject::invokeMethod(catalogWorker, [filter, fullPath]() {
+        QMetaObject::invokeMethod(filter, [filter, fullPath]() { filter->releaseAliases(fullPath); });
+    });
+}
+
+void IndexingEngine::jobFinished()
+{
+    numberOfActiveJobs--;
+    emit activeJobsChanged(numberOfActiveJobs);
+
+    if (numberOfActiveJobs == 0)
+        reportIngest();
+    checkIdle();
+}
+
+void IndexingEngine::directoryManifestUpdated(const QList<DirectoryState> &updated, const QStringList &removed)
+{
+    pendingCrawls = qMax(0, pendingCrawls - 1);
+    pendingManifestUpdated.append(updated);
+    pendingManifestRemoved.append(removed);
+    flushPendingManifestUpdates();
+    flushPendingFolderRemovals();
+    checkIdle();
+}
+
+void IndexingEngine::flushPendingManifestUpdates()
+{
+    if (pendingManifestUpdated.isEmpty() && pendingManifestRemoved.isEmpty())
+        return;
+
+    // Submitted after the journal of the files it covers, and run after it like every
+    // request of the same priority. Those files resume from the journal if the ingest
+    // is interrupted, so the manifest does not wait for them to be written.
+    const QList<DirectoryState> updated = pendingManifestUpdated;
+    const QStringList removed = pendingManifestRemoved;
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(IngestPriority, [repository, updated, removed](const CancellationToken&) { repository->updateDirectoryManifest(updated, removed); });
+    pendingManifestUpdated.clear();
+    pendingManifestRemoved.clear();
+}
+
+/*!
+ * \brief IndexingEngine::reportIngest
+ * Logs the throughput of the ingest that just finished, from the first queued file
+ * to the last one done, and keeps it in the metrics. The report of the run, with the
+ * stage latencies and counters recorded during it, its failures by reason and the
+ * settings it ran with, is recorded in the db, see FileRepository::addIngestRun. The
+ * peak RSS is of the process so far.
+ */
+void IndexingEngine::reportIngest()
+{
+    if (!ingestTimer.isValid())
+        return;
+
+    double seconds = qMax<qint64>(ingestTimer.elapsed(), 1) / 1000.0;
+    qint64 peakResident = Metrics::peakResidentBytes();
+    qint64 dbSize = QFileInfo(FileRepository::databaseFilePath()).size();
+    qDebug() << "Ingested" << ingestFiles << "files," << ingestBytes / (1024 * 1024) << "MB in" << seconds << "s:"
+             << ingestFiles / seconds << "files/s," << ingestBytes / (1024.0 * 1024.0) / seconds << "MB/s,"
+             << "peak RSS" << peakResident / (1024 * 1024) << "MB, db" << dbSize / (1024 * 1024) << "MB";
+
+    Metrics::counter("ingest.files") += ingestFiles;
+    Metrics::counter("ingest.bytes") += ingestBytes;
+    Metrics::counter("ingest.msecs") += ingestTimer.elapsed();
+    Metrics::counter("ingest.peak_resident_bytes") = peakResident;
+    Metrics::counter("ingest.db_bytes") = dbSize;
+
+    static const QHash<int, QString> failureNames = {
+        {FailureUnsupportedType, "unsupported_type"},
+        {FailureUnreadable, "unreadable"},
+        {FailureInvalidFile, "invalid_file"},
+    };
+    QJsonObject failures;
+    int failedFiles = 0;
+    for (auto iter = ingestFailures.constBegin(); iter != ingestFailures.constEnd(); ++iter)
+    {
+        const QString name = failureNames.value(iter.key(), "other");
+        failures.insert(name, failures.value(name).toInt() + iter.value());
+        failedFiles += iter.value();
+    }
+
+    QJsonObject settings;
+    settings.insert("scheduler_workers", TaskScheduler::instance().workerCount());
+    settings.insert("decoder_threads", Metrics::counter("processor.decoder_threads").load());
+    settings.insert("memory_budget_bytes", MemoryBudget::budget());
+
+    const QJsonObject metrics = Metrics::toJsonSince(ingestMetrics);
+    QJsonObject report;
+    report.insert("started_at", ingestStartedAt.toString(Qt::ISODate));
+    report.insert("duration_ms", ingestTimer.elapsed());
+    report.insert("files", ingestFiles);
+    report.insert("bytes", ingestBytes);
+    report.insert("files_per_second", ingestFiles / seconds);
+    report.insert("mb_per_second", ingestBytes / (1024.0 * 1024.0) / seconds);
+    report.insert("failed_files", failedFiles);
+    report.insert("failures", failures);
+    report.insert("peak_resident_bytes", peakResident);
+    report.insert("threads", Metrics::threadCount());
+    report.insert("db_bytes", dbSize);
+    report.insert("settings", settings);
+    report.insert("stages", metrics.value("histograms"));
+    report.insert("counters", metrics.value("counters"));
+
+    FileRepository* repository = fileRepositoryWorker;
+    repository->submit<void>(IngestPriority, [repository, report](const CancellationToken&) { repository->addIngestRun(report); });
+    ingestTimer.invalidate();
+}
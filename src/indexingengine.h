@@ -0,0 +1,290 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INDEXINGENGINE_H
+#define INDEXINGENGINE_H
+
+#include "astrofile.h"
+#include "catalog.h"
+#include "catalogclient.h"
+#include "directorystate.h"
+#include "fileimporter.h"
+#include "fitsheadereditor.h"
+#include "fileprocessfilter.h"
+#include "filerepository.h"
+#include "foldercrawler.h"
+#include "folderwatcher.h"
+#include "ingestserver.h"
+#include "integrityverifier.h"
+#include "metrics.h"
+#include "newfileprocessor.h"
+#include "platesolver.h"
+#include "volumerecord.h"
+#include "volumeregistry.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+
+/*!
+ * \brief The IndexingEngine class
+ * The ingest pipeline without any of the views: the Catalog, FolderCrawler,
+ * FileProcessFilter, FolderWatcher, NewFileProcessor and FileRepository, each on
+ * its thread, wired to each other. It counts the files in flight from the crawl to
+ * the db, batches the db writes, and holds the directory manifest back until
+ * every file of a crawl is in the db.
+ *
+ * The volumes of the search folders are recorded by their identity. The folders of
+ * a volume that is not mounted are not crawled, and keep their files, until it is
+ * back. A volume mounted at another path has its files remapped, see checkVolume.
+ * The catalog kept at the root of a volume, if it has one, is merged before its
+ * folders are crawled, and written once the ingest is idle, see crawlFolder.
+ *
+ * Files imported from a capture drive are copied and processed in one read, see
+ * FileImporter. With the IngestServerName setting, capture software can announce the files it
+ * writes on a local endpoint, see IngestServer.
+ *
+ * Once the ingest is idle, the files are read again a batch at a time and checked
+ * against their hashes, see IntegrityVerifier. Off with the VerifyIntegrity setting.
+ * With the PlateSolverIndex setting, the frames without a position in their header are
+ * plate solved a batch at a time too, see PlateSolver.
+ *
+ * Used by the MainWindow, which connects its views to the catalog and the
+ * repository, and by the astrocat-index command line indexer.
+ * Lives on the thread that created it, usually the GUI thread.
+ */
+class IndexingEngine : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IndexingEngine(QObject *parent = nullptr);
+    ~IndexingEngine();
+
+    Catalog* catalog() const { return catalogWorker; }
+    FolderCrawler* crawler() const { return folderCrawlerWorker; }
+    FileRepository* repository() const { return fileRepositoryWorker; }
+    NewFileProcessor* processor() const { return newFileProcessorWorker; }
+    QThread* repositoryThread() const { return fileRepositoryThread; }
+
+    // Must be called before start. Off for the command line indexer, which exits when done.
+    void setWatchFolders(bool shouldWatch);
+    // Must be called before start. How often the reader of a shared db looks for changes,
+    // the SharedCatalogPollInterval setting by default.
+    void setChangesPollInterval(int msecs);
+    // Must be called before start, see FileProcessFilter::setShard
+    void setShard(int index, int count);
+    // The processing threads run at background CPU and I/O priority, see ThreadPriority
+    void setBackgroundIngest(bool background);
+    // The processing yields to the user while they browse, see noteUserActivity in the .cpp
+    void noteUserActivity();
+    void beginInteraction();
+    void endInteraction();
+    // Starts the threads, opens the db and loads the catalog from it. The search
+    // folders are crawled once the catalog is loaded.
+    void start(const QStringList& searchFolders);
+    void addSearchFolder(const QString& folder);
+    void removeSearchFolder(const QString& folder);
+    // Copies the files of source into destination, which must be in a search folder, and
+    // processes them from the bytes read for the copy
+    void importFolder(const QString& source, const QString& destination);
+    // Edits the headers of the FITS files in place and updates their rows, without
+    // processing them again, see editHeaders in the .cpp
+    void editHeaders(const QList<AstroFile>& astroFiles, const QList<HeaderEdit>& edits);
+    // Looks for the files of the catalog that are not on disk any more, without processing
+    // anything, and removes them from the catalog if asked to, see CatalogReconciler
+    void reconcile(bool removeMissing);
+    // Backfills the hashes of older rows, once the engine is idle
+    void findDuplicates();
+    // Processes the files that failed to process again, changed or not
+    void retryFailedFiles();
+    // Makes the outdated thumbnails of these files again first, the rest are made
+    // again in chunks whenever the engine is idle
+    void regenerateThumbnails(const QStringList& paths);
+
+    int activeJobs() const { return numberOfActiveJobs; }
+    bool isIdle() const;
+
+    void cancel();
+    // Stops the crawler, processor and repository threads. The catalog keeps running,
+    // so the views can be taken down before it.
+    void stopWorkers();
+    // Stops the workers if they are running, writes the catalog snapshot if the db is
+    // not in the middle of an ingest, and stops the catalog thread.
+    void stop();
+
+public slots:
+    void crawlFolder(const QString& folder);
+
+signals:
+    // The catalog has every file of the db
+    void catalogLoaded();
+    void activeJobsChanged(int activeJobs);
+    // No crawl, processing or db write is left
+    void idle();
+    void dbFailedToOpen(const QString& message);
+    // The volume of the search folder is mounted somewhere else, and the folder with it
+    void searchFolderMoved(const QString& from, const QString& to);
+    // Once the imported files are queued for processing, not yet processed
+    void folderImported(const QString& source, int files, qint64 bytes, int failed);
+    // The files whose header was edited, and the path and reason of each file that was not
+    void headersEdited(int edited, const QStringList& failures);
+    // The files of the catalog that are gone, and whether they were removed from it
+    void reconciled(const QStringList& missing, bool removed);
+
+    // Queued calls into the workers
+    void crawl(QString rootFolder);
+    void initializeFileRepository();
+    void catalogAddAstroFile(const AstroFile& file);
+    void catalogUpdateFileHashes(const QList<AstroFile>& astroFiles);
+    void catalogWriteSnapshot(const QString& path, int schemaVersion, qint64 catalogId, qint64 changeCounter);
+    void forgetFolder(const QString& path);
+    void dbWatchChanges(int interval);
+    void clientStart(const QUrl& serverUrl, const QString& accessToken, int level);
+    void ingestServerListen(const QString& name);
+    void importerImportFolder(const QString& source, const QString& destination);
+    void verifierVerifyFiles(const QList<AstroFile>& astroFiles);
+    void solverSolveFiles(const QList<AstroFile>& astroFiles);
+
+private slots:
+    void modelLoadedFromDb();
+    void processQueued(const QVector<FileRecord>& files);
+    void journalJobs(const QVector<FileRecord>& files);
+    void ingestJobsLoaded(const QVector<FileRecord>& files);
+    void processingResultsReady();
+    void dbAstroFileUpdated(const AstroFile& astroFile);
+    void flushPendingDbWrites();
+    void directoryManifestUpdated(const QList<DirectoryState>& updated, const QStringList& removed);
+    void volumesLoaded(const QList<VolumeRecord>& volumes);
+    void volumeRemapped(const QString& oldRootPath, const QString& newRootPath);
+    void watchedFolderRemoved(const QString& folder);
+    void checkOfflineFolders();
+    void userIdle();
+    void importFinished(const QString& source, int files, qint64 bytes, int failed);
+    void integrityVerified(const QList<AstroFile>& astroFiles);
+    void platesSolved(const QList<AstroFile>& astroFiles);
+
+private:
+    void queueFiles(const QVector<FileRecord>& files);
+    void astroFileProcessed(AstroFile astroFile);
+    void processingCancelled(const QString& fullPath);
+    bool checkVolume(const QString& folder);
+    void recordVolume(const VolumeRecord& volume);
+    void moveVolume(const VolumeRecord& volume, const QString& oldRootPath);
+    const VolumeRecord* knownVolumeOf(const QString& path) const;
+    const VolumeRecord* knownVolumeById(const QString& uuid) const;
+    void flushPendingManifestUpdates();
+    void flushPendingFolderRemovals();
+    void jobFinished();
+    void finishJobs(const QStringList& fullPaths);
+    void releaseAliases(const QString& fullPath);
+    void checkIdle();
+    void verifyIntegrity();
+    void solvePlates();
+    void volumeCatalogImported(const QString& rootPath);
+    void exportVolumeCatalogs();
+    void reportIngest();
+    static void cleanUpWorker(QThread*& thread);
+
+    QThread* catalogThread;
+    Catalog* catalogWorker;
+    QThread* folderCrawlerThread;
+    FolderCrawler* folderCrawlerWorker;
+    FileProcessFilter* fileFilter;
+    FolderWatcher* folderWatcher;
+    IngestServer* ingestServer;
+    QThread* fileImporterThread;
+    FileImporter* fileImporterWorker;
+    QThread* integrityVerifierThread;
+    IntegrityVerifier* integrityVerifierWorker;
+    QThread* plateSolverThread;
+    PlateSolver* plateSolverWorker;
+    QThread* fileRepositoryThread;
+    FileRepository* fileRepositoryWorker;
+    CatalogClient* catalogClientWorker = nullptr; // On the repository thread, for a ReplicaAccess db only
+    QThread* newFileProcessorThread;
+    NewFileProcessor* newFileProcessorWorker;
+
+    bool watchFolders = true;
+    int changesPollInterval;
+    bool isStarted = false;
+    bool isLoaded = false;
+    bool isCrawlStarted = false; // Once the volumes are loaded, see volumesLoaded
+    bool isCanceled = false;
+    bool shouldWriteSnapshot = false;
+    bool shouldFindDuplicates = false;
+    bool shouldVerifyIntegrity = false;
+    bool isVerifying = false; // A batch is read or recorded, see verifyIntegrity
+    bool shouldSolvePlates = false;
+    bool isSolving = false; // A batch is solved or recorded, see solvePlates
+    qint64 snapshotCatalogId = 0;
+    qint64 snapshotChangeCounter = 0;
+    QStringList searchFolders;
+
+    // Of the db, kept up to date as volumes are found and move
+    QList<VolumeRecord> knownVolumes;
+    // Search folders whose volume is not mounted, checked again by offlineFoldersTimer
+    // and when something is mounted
+    QStringList offlineFolders;
+    QTimer offlineFoldersTimer;
+    VolumeRegistry volumeRegistry;
+    // The catalogs kept on volumes merged so far, by root, as of their modification time,
+    // and the folders whose crawl waits for the merge
+    QHash<QString, QDateTime> importedVolumeCatalogs;
+    QMultiHash<QString, QString> foldersAwaitingImport;
+
+    QTimer userIdleTimer;
+    int interactionsInProgress = 0;
+    bool isThrottled = false;
+
+    int numberOfActiveJobs = 0;
+    int pendingCrawls = 0;
+    int pendingImports = 0;
+    int numberIngestedSinceSnapshot = 0;
+
+    QList<AstroFile> pendingDbWrites;
+    QTimer pendingDbWritesTimer;
+    // Of the last duplicates search submitted to the repository
+    CancellationToken duplicatesToken;
+
+    // Manifest updates are held back until every file found by the crawl is journaled
+    QList<DirectoryState> pendingManifestUpdated;
+    QStringList pendingManifestRemoved;
+    // Folders the watcher saw removed, held back while crawls that may find them moved are pending
+    QStringList pendingFolderRemovals;
+
+    // Throughput of the ingest in progress, reported when its last job is done
+    QElapsedTimer ingestTimer;
+    QDateTime ingestStartedAt;
+    int ingestFiles = 0;
+    qint64 ingestBytes = 0;
+    // The metrics when it started, and its failed files by AstroFileFailureReason
+    MetricsSnapshot ingestMetrics;
+    QHash<int, int> ingestFailures;
+};
+
+#endif // INDEXINGENGINE_H
@@ -0,0 +1,181 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "indexingservice.h"
+#include "filerepository.h"
+#include "indexingengine.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QSettings>
+#include <QThread>
+
+// Commands longer than this are not ones we know, the connection is dropped
+#define MAX_COMMAND_LENGTH 4096
+
+// A daemon that does not answer this fast is taken for not running, in milliseconds
+#define DAEMON_REQUEST_TIMEOUT 500
+
+// The app waits this long for a stopped daemon to write its snapshot and exit
+#define DAEMON_STOP_TIMEOUT 30000
+#define DAEMON_STOP_POLL_MSECS 200
+
+IndexingService::IndexingService(IndexingEngine *engine, QObject *parent) : QObject(parent), engine(engine)
+{
+}
+
+bool IndexingService::listen()
+{
+    const QString name = serverName();
+    if (!request("status").isEmpty())
+        return false;
+
+    server = new QLocalServer(this);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(server, &QLocalServer::newConnection, this, &IndexingService::newConnection);
+    // A socket left behind by a daemon that crashed
+    QLocalServer::removeServer(name);
+    if (!server->listen(name))
+    {
+        qWarning() << "Indexing service could not listen on" << name << ":" << server->errorString();
+        return false;
+    }
+    return true;
+}
+
+QString IndexingService::serverName()
+{
+    const QByteArray path = QFileInfo(FileRepository::databaseFilePath()).absoluteFilePath().toUtf8();
+    return "astrocat-daemon-" + QCryptographicHash::hash(path, QCryptographicHash::Sha1).toHex().left(16);
+}
+
+QJsonObject IndexingService::request(const QString &command)
+{
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if (!socket.waitForConnected(DAEMON_REQUEST_TIMEOUT))
+        return QJsonObject();
+    socket.write(command.toUtf8() + '\n');
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!socket.canReadLine() && elapsed.elapsed() < DAEMON_REQUEST_TIMEOUT)
+    {
+        if (!socket.waitForReadyRead(DAEMON_REQUEST_TIMEOUT - elapsed.elapsed()))
+            break;
+    }
+    if (!socket.canReadLine())
+        return QJsonObject();
+    return QJsonDocument::fromJson(socket.readLine()).object();
+}
+
+/*!
+ * \brief IndexingService::launch
+ * Runs astrocat-index from next to the app, or from the IndexerPath setting.
+ */
+bool IndexingService::launch(const QStringList &folders)
+{
+#if defined(Q_OS_WIN)
+    const QString defaultPath = QCoreApplication::applicationDirPath() + "/astrocat-index.exe";
+#else
+    const QString defaultPath = QCoreApplication::applicationDirPath() + "/astrocat-index";
+#endif
+    const QString program = QSettings().value("IndexerPath", defaultPath).toString();
+    QStringList arguments = {"--daemon", "--db", QFileInfo(FileRepository::databaseFilePath()).absoluteFilePath()};
+    arguments.append(folders);
+    if (!QProcess::startDetached(program, arguments))
+    {
+        qWarning() << "Could not start the indexing daemon" << program;
+        return false;
+    }
+    qDebug() << "The ingest goes on in the indexing daemon";
+    return true;
+}
+
+bool IndexingService::stopDaemon()
+{
+    if (request("stop").isEmpty())
+        return true;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (elapsed.elapsed() < DAEMON_STOP_TIMEOUT)
+    {
+        QThread::msleep(DAEMON_STOP_POLL_MSECS);
+        if (request("status").isEmpty())
+            return true;
+    }
+    return false;
+}
+
+void IndexingService::newConnection()
+{
+    while (QLocalSocket* socket = server->nextPendingConnection())
+    {
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { readCommands(socket); });
+        readCommands(socket);
+    }
+}
+
+void IndexingService::readCommands(QLocalSocket *socket)
+{
+    while (socket->canReadLine())
+    {
+        const QByteArray line = socket->readLine().trimmed();
+        socket->write(QJsonDocument(handle(line)).toJson(QJsonDocument::Compact) + '\n');
+        if (line == "stop")
+        {
+            socket->flush();
+            emit stopRequested();
+        }
+    }
+    if (socket->bytesAvailable() > MAX_COMMAND_LENGTH)
+        socket->abort();
+}
+
+QJsonObject IndexingService::handle(const QByteArray &line)
+{
+    const int space = line.indexOf(' ');
+    const QByteArray command = space < 0 ? line : line.left(space);
+    const QString folder = space < 0 ? QString() : QDir::cleanPath(QString::fromUtf8(line.mid(space + 1)));
+
+    if (command == "status")
+        return {{"idle", engine->isIdle()}, {"activeJobs", engine->activeJobs()}, {"files", engine->catalog()->getNumberOfItems()}};
+    if (command == "stop")
+        return {{"accepted", true}};
+    if ((command == "add" || command == "remove") && QDir::isAbsolutePath(folder))
+    {
+        if (command == "add")
+            engine->addSearchFolder(folder);
+        else
+            engine->removeSearchFolder(folder);
+        return {{"accepted", true}};
+    }
+    return {{"accepted", false}, {"error", "Unknown command"}};
+}
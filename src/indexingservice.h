@@ -0,0 +1,89 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INDEXINGSERVICE_H
+#define INDEXINGSERVICE_H
+
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QStringList>
+
+class IndexingEngine;
+
+/*!
+ * \brief The IndexingService class
+ * Lets an ingest go on once the app is closed. With the IndexInBackground setting, the
+ * app closed in the middle of an ingest starts astrocat-index --daemon on its db, which
+ * picks the ingest up from its journal and keeps watching the search folders. The
+ * daemon serves a local endpoint named after the db, see serverName.
+ *
+ * An app started while the daemon is still ingesting attaches to it: it reads the db
+ * like the reader of a shared catalog, from its snapshot and then the change log, with
+ * the thumbnails from the read-only connections, while the daemon writes. The search
+ * folders added or removed are handed to the daemon. An app started once the daemon is
+ * idle stops it and opens the db itself.
+ *
+ * Each command is a line, answered with a line of JSON:
+ *     status              {"idle": false, "activeJobs": 120, "files": 48210}
+ *     add <folder>        {"accepted": true}
+ *     remove <folder>     {"accepted": true}
+ *     stop                {"accepted": true}, then the daemon exits
+ *
+ * Lives on the thread of the engine, in the daemon.
+ */
+class IndexingService : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IndexingService(IndexingEngine* engine, QObject *parent = nullptr);
+
+    // False when another daemon serves the db already
+    bool listen();
+
+    // Of the db at FileRepository::databaseFilePath
+    static QString serverName();
+    // Sends the command to the daemon of the db. Empty when no daemon answers.
+    static QJsonObject request(const QString& command);
+    // Starts the daemon on the folders, detached from the app
+    static bool launch(const QStringList& folders);
+    // Asks the daemon to exit and waits until it did. False if it is still running.
+    static bool stopDaemon();
+
+signals:
+    void stopRequested();
+
+private slots:
+    void newConnection();
+
+private:
+    void readCommands(QLocalSocket* socket);
+    QJsonObject handle(const QByteArray& line);
+
+    IndexingEngine* engine;
+    QLocalServer* server = nullptr;
+};
+
+#endif // INDEXINGSERVICE_H
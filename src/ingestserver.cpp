@@ -0,0 +1,133 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "ingestserver.h"
+#include "metrics.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSharedMemory>
+
+// Announcements longer than this are not JSON we know, the connection is dropped
+#define MAX_ANNOUNCEMENT_LENGTH 4096
+
+IngestServer::IngestServer(QObject *parent) : QObject(parent)
+{
+}
+
+void IngestServer::setCatalog(Catalog *cat)
+{
+    catalog = cat;
+}
+
+void IngestServer::setProcessor(NewFileProcessor *newFileProcessor)
+{
+    processor = newFileProcessor;
+}
+
+void IngestServer::listen(const QString &name)
+{
+    close();
+    server = new QLocalServer(this);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(server, &QLocalServer::newConnection, this, &IngestServer::newConnection);
+    // A socket left behind by a run that crashed
+    QLocalServer::removeServer(name);
+    if (!server->listen(name))
+        qWarning() << "Ingest server could not listen on" << name << ":" << server->errorString();
+}
+
+void IngestServer::close()
+{
+    delete server;
+    server = nullptr;
+}
+
+void IngestServer::newConnection()
+{
+    while (QLocalSocket* socket = server->nextPendingConnection())
+    {
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { readAnnouncements(socket); });
+        readAnnouncements(socket);
+    }
+}
+
+void IngestServer::readAnnouncements(QLocalSocket *socket)
+{
+    while (socket->canReadLine())
+        socket->write(announce(socket->readLine().trimmed()) + '\n');
+    if (socket->bytesAvailable() > MAX_ANNOUNCEMENT_LENGTH)
+        socket->abort();
+}
+
+/*!
+ * \brief IngestServer::announce
+ * Hands the bytes of the file to the processor, if they came with it, and the file to
+ * the filter like the watcher does. Returns the reply.
+ */
+QByteArray IngestServer::announce(const QByteArray &line)
+{
+    static std::atomic<qint64>& announcedCount = Metrics::counter("ingest_server.files");
+    const QJsonObject announcement = QJsonDocument::fromJson(line).object();
+    const QString path = QDir::cleanPath(announcement.value("path").toString());
+    QJsonObject reply{{"path", path}, {"accepted", false}};
+
+    const QFileInfo fileInfo(path);
+    if (path.isEmpty() || !QDir::isAbsolutePath(path))
+        reply.insert("error", "The path must be absolute");
+    else if (!catalog->isInSearchFolders(path))
+        reply.insert("error", "The file is not in a search folder");
+    else if (!fileInfo.isFile())
+        reply.insert("error", "The file does not exist");
+    if (reply.contains("error"))
+        return QJsonDocument(reply).toJson(QJsonDocument::Compact);
+
+    const FileRecord record = FileRecord::ofFileInfo(fileInfo);
+    const QString key = announcement.value("sharedMemory").toString();
+    if (!key.isEmpty())
+    {
+        const qint64 size = announcement.value("size").toInteger(record.Size);
+        QSharedMemory memory;
+        memory.setNativeKey(key);
+        QString error;
+        if (!memory.attach(QSharedMemory::ReadOnly))
+            error = memory.errorString();
+        else if (size <= 0 || size > memory.size())
+            error = "The shared memory is smaller than the file";
+        else
+            processor->announceContents(record.FullPath, QByteArray(static_cast<const char*>(memory.constData()), size));
+        // The file is still processed, from the disk
+        if (!error.isEmpty())
+            reply.insert("sharedMemoryError", error);
+    }
+
+    announcedCount++;
+    emit filesFound({record});
+    reply.insert("accepted", true);
+    return QJsonDocument(reply).toJson(QJsonDocument::Compact);
+}
@@ -0,0 +1,82 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INGESTSERVER_H
+#define INGESTSERVER_H
+
+#include "catalog.h"
+#include "filerecord.h"
+#include "newfileprocessor.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QVector>
+
+/*!
+ * \brief The IngestServer class
+ * A local endpoint where capture software announces the files it just wrote, so they
+ * are processed right away instead of when the watcher sees their folder change. A
+ * named pipe on Windows and a Unix domain socket elsewhere, only open to the user.
+ *
+ * Each announcement is a line of JSON, with the absolute path of the file:
+ *     {"path": "/data/M31/Light_0001.fits"}
+ * and optionally the native key of a shared memory segment holding the bytes of the
+ * file, from its start, so the header, hash and thumbnail are made from memory:
+ *     {"path": "...", "sharedMemory": "nina-frame-0001", "size": 16784640}
+ * size defaults to the size of the file. The segment is copied before the reply, a
+ * line of JSON with the path and "accepted", and "error" when it is false, after
+ * which the writer can free it. A segment that could not be read is reported in
+ * "sharedMemoryError", and the file is read from the disk instead.
+ *
+ * Lives on the thread of the FolderCrawler.
+ */
+class IngestServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IngestServer(QObject *parent = nullptr);
+    void setCatalog(Catalog* cat);
+    void setProcessor(NewFileProcessor* newFileProcessor);
+
+public slots:
+    void listen(const QString& name);
+    void close();
+
+signals:
+    void filesFound(const QVector<FileRecord>& files);
+
+private slots:
+    void newConnection();
+
+private:
+    void readAnnouncements(QLocalSocket* socket);
+    QByteArray announce(const QByteArray& line);
+
+    Catalog* catalog = nullptr;
+    NewFileProcessor* processor = nullptr;
+    QLocalServer* server = nullptr;
+};
+
+#endif // INGESTSERVER_H
@@ -0,0 +1,59 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INTEGRATIONSTATS_H
+#define INTEGRATIONSTATS_H
+
+#include <QDate>
+#include <QString>
+
+/*!
+ * \brief The IntegrationStats struct
+ * The frames of one object, through one filter, with one instrument: how many, their
+ * total exposure and the dates they span. Frames without a value are grouped under an
+ * empty string.
+ */
+struct IntegrationStats
+{
+    QString Object;
+    QString Filter;
+    QString Instrument;
+    int FrameCount = 0;
+    double TotalExposure = 0; // Seconds
+    QDate FirstDate; // Invalid when no frame has a DATE-OBS
+    QDate LastDate;
+
+    // Like "3h 20m", "45m" or "30s"
+    static QString formatDuration(double seconds)
+    {
+        const qint64 rounded = qRound64(seconds);
+        if (rounded >= 3600)
+            return QString("%1h %2m").arg(rounded / 3600).arg((rounded % 3600) / 60);
+        if (rounded >= 60)
+            return QString("%1m").arg(rounded / 60);
+        return QString("%1s").arg(rounded);
+    }
+};
+
+#endif // INTEGRATIONSTATS_H
@@ -0,0 +1,178 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "integrityverifier.h"
+#include "filerecord.h"
+#include "hasher.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "volumeio.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSettings>
+#include <QThread>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#endif
+
+// Files are read in chunks of this size, or of the chunks of their volume if larger
+#define VERIFY_READ_SIZE (8 * 1024 * 1024)
+
+// MB/s, for VerifyBandwidthLimit. 0 for no limit besides the one of the volume.
+#define DEFAULT_VERIFY_BANDWIDTH_LIMIT 20
+
+// Checked this often while paused
+#define VERIFY_PAUSE_POLL_MSECS 200
+
+IntegrityVerifier::IntegrityVerifier(QObject *parent) : QObject(parent)
+{
+    bandwidthLimit = QSettings().value("VerifyBandwidthLimit", DEFAULT_VERIFY_BANDWIDTH_LIMIT).toLongLong() * 1024 * 1024;
+    clock.start();
+}
+
+void IntegrityVerifier::setPaused(bool paused)
+{
+    this->paused = paused;
+}
+
+void IntegrityVerifier::cancel()
+{
+    cancelSignaled = true;
+}
+
+QString IntegrityVerifier::integrityName(AstroFileIntegrity integrity)
+{
+    switch (integrity)
+    {
+    case IntegrityIntact:
+        return "Intact";
+    case IntegrityMismatch:
+        return "Mismatch";
+    case IntegrityUnreadable:
+        return "Unreadable";
+    case IntegrityUnverified:
+        break;
+    }
+    return QString();
+}
+
+void IntegrityVerifier::verifyFiles(const QList<AstroFile> &astroFiles)
+{
+    static std::atomic<qint64>& verifiedCount = Metrics::counter("integrity.verified");
+    static std::atomic<qint64>& mismatchCount = Metrics::counter("integrity.mismatches");
+    QList<AstroFile> verified;
+    for (auto& file : astroFiles)
+    {
+        if (cancelSignaled || !waitWhilePaused())
+            break;
+        AstroFile astroFile(file);
+        astroFile.Integrity = verifyFile(astroFile);
+        if (astroFile.Integrity == IntegrityIntact)
+            verifiedCount++;
+        else if (astroFile.Integrity != IntegrityUnverified)
+        {
+            mismatchCount++;
+            qWarning() << "Integrity:" << astroFile.FullPath << IntegrityVerifier::integrityName(astroFile.Integrity);
+        }
+        verified.append(astroFile);
+    }
+    // The files not verified when canceled stay the oldest, they are the first next time
+    if (!cancelSignaled)
+        emit filesVerified(verified);
+}
+
+/*!
+ * \brief IntegrityVerifier::verifyFile
+ * Hashes the file with the algorithm of its FileHash, and compares. A file without one
+ * gets the hash it has now, which the next verification checks.
+ */
+AstroFileIntegrity IntegrityVerifier::verifyFile(AstroFile &astroFile)
+{
+    if (ObjectStore::isObjectPath(astroFile.FullPath))
+        return IntegrityUnverified;
+    const FileRecord record = FileRecord::ofPath(astroFile.FullPath);
+    if (record.LastModifiedTime == 0)
+        return IntegrityUnverified;
+    if ((astroFile.FileSize > 0 && record.Size != astroFile.FileSize) || record.LastModifiedTime != astroFile.LastModifiedTime.toMSecsSinceEpoch())
+        return IntegrityUnverified;
+
+    QFile file(astroFile.FullPath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        return IntegrityUnreadable;
+#if defined(Q_OS_LINUX)
+    posix_fadvise(file.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(Q_OS_MAC)
+    fcntl(file.handle(), F_NOCACHE, 1);
+#endif
+
+    VolumeIo* volume = VolumeIo::ofDirectory(astroFile.DirectoryPath);
+    const bool hasHash = !astroFile.FileHash.isEmpty();
+    Hasher hasher(hasHash ? Hasher::algorithmOf(astroFile.FileHash) : Hasher::defaultAlgorithm());
+    QByteArray chunk(qMax<qint64>(VERIFY_READ_SIZE, volume->policy().readChunkSize), Qt::Uninitialized);
+    qint64 total = 0;
+    qint64 read;
+    while ((read = file.read(chunk.data(), chunk.size())) > 0)
+    {
+        hasher.addData(chunk.constData(), read);
+        total += read;
+        volume->throttle(read);
+        pace(read);
+        if (cancelSignaled || !waitWhilePaused())
+            return IntegrityUnverified;
+    }
+#if defined(Q_OS_LINUX)
+    posix_fadvise(file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    if (read < 0 || total != record.Size)
+        return IntegrityUnreadable;
+
+    const QString hash = QString::fromLatin1(hasher.result());
+    if (!hasHash)
+    {
+        astroFile.FileHash = hash;
+        return IntegrityIntact;
+    }
+    return hash == astroFile.FileHash ? IntegrityIntact : IntegrityMismatch;
+}
+
+// Sleeps for as long as the reads are ahead of the bandwidth limit
+void IntegrityVerifier::pace(qint64 bytes)
+{
+    if (bandwidthLimit <= 0)
+        return;
+    const qint64 now = clock.nsecsElapsed();
+    // Time not used while paused is not saved up for later
+    scheduledUntil = qMax(scheduledUntil, now) + bytes * 1000000000LL / bandwidthLimit;
+    QThread::usleep((scheduledUntil - now) / 1000);
+}
+
+// False when canceled while paused
+bool IntegrityVerifier::waitWhilePaused()
+{
+    while (paused && !cancelSignaled)
+        QThread::msleep(VERIFY_PAUSE_POLL_MSECS);
+    return !cancelSignaled;
+}
@@ -0,0 +1,83 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef INTEGRITYVERIFIER_H
+#define INTEGRITYVERIFIER_H
+
+#include "astrofile.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+
+#include <atomic>
+
+/*!
+ * \brief The IntegrityVerifier class
+ * Reads the files of the archive again, in large sequential reads, and checks them
+ * against their hash, so the bits that rotted on an old disk are found while a backup
+ * still has them. The reads are capped in bandwidth (VerifyBandwidthLimit, in MB/s)
+ * on top of the limit of their volume, see VolumeIo, leave nothing in the page cache,
+ * and wait while the user is busy, see setPaused.
+ *
+ * A file without a FileHash is checked against the hash of its first verification.
+ * A file whose size or modification time changed was written again, it is left
+ * unverified for the crawl to process.
+ *
+ * Lives on a thread of its own.
+ */
+class IntegrityVerifier : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IntegrityVerifier(QObject *parent = nullptr);
+
+    // Thread safe. Waits between two reads while paused.
+    void setPaused(bool paused);
+    void cancel();
+
+    // Of the facet, empty for a file that was not verified
+    static QString integrityName(AstroFileIntegrity integrity);
+
+public slots:
+    // The FileHash of the files is the hash they are checked against, empty for none
+    void verifyFiles(const QList<AstroFile>& astroFiles);
+
+signals:
+    // With their Integrity, and the FileHash they were checked against or hashed to
+    void filesVerified(const QList<AstroFile>& astroFiles);
+
+private:
+    AstroFileIntegrity verifyFile(AstroFile& astroFile);
+    void pace(qint64 bytes);
+    bool waitWhilePaused();
+
+    qint64 bandwidthLimit = 0; // Bytes per second
+    QElapsedTimer clock;
+    qint64 scheduledUntil = 0; // Nanoseconds on the clock when the reads so far are paid for
+    std::atomic<bool> paused = false;
+    volatile bool cancelSignaled = false;
+};
+
+#endif // INTEGRITYVERIFIER_H
@@ -0,0 +1,301 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fitspixels.h"
+#include "linearimagereader.h"
+
+#include <QBuffer>
+#include <QImage>
+#include <QImageReader>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+#include <type_traits>
+
+// TIFF tags of the layout of the first image
+#define TIFF_IMAGE_WIDTH         0x0100
+#define TIFF_IMAGE_LENGTH        0x0101
+#define TIFF_BITS_PER_SAMPLE     0x0102
+#define TIFF_COMPRESSION         0x0103
+#define TIFF_PHOTOMETRIC         0x0106
+#define TIFF_STRIP_OFFSETS       0x0111
+#define TIFF_SAMPLES_PER_PIXEL   0x0115
+#define TIFF_ROWS_PER_STRIP      0x0116
+#define TIFF_PLANAR_CONFIG       0x011C
+#define TIFF_TILE_WIDTH          0x0142
+#define TIFF_SAMPLE_FORMAT       0x0153
+#define TIFF_SAMPLE_FORMAT_FLOAT 3
+
+namespace {
+
+// What the first IFD of a TIFF file says about its image
+struct TiffLayout
+{
+    bool bigEndian = false;
+    qint64 width = 0;
+    qint64 height = 0;
+    int bitsPerSample = 0;
+    int sampleFormat = 1;
+    int samplesPerPixel = 1;
+    int compression = 1;
+    int photometric = -1;
+    int planarConfig = 1;
+    qint64 rowsPerStrip = 0;
+    bool tiled = false;
+    QVector<qint64> stripOffsets;
+};
+
+// Interleaved samples of a row, stride of them per pixel
+template <typename T, bool BigEndian>
+struct TiffRowPixels
+{
+    const uchar* row;
+    int stride;
+    int channel;
+    inline T operator()(long long index) const
+    {
+        const uchar* p = row + (index * stride + channel) * sizeof(T);
+        return BigEndian ? qFromBigEndian<T>(p) : qFromLittleEndian<T>(p);
+    }
+};
+
+// Samples of a QImage scanline in native byte order
+template <typename T>
+struct ScanLinePixels
+{
+    const T* row;
+    int stride;
+    int channel;
+    inline T operator()(long long index) const { return row[index * stride + channel]; }
+};
+
+}
+
+static bool parseTiff(const uchar* data, qint64 size, TiffLayout& layout)
+{
+    if (size < 8)
+        return false;
+    if (memcmp(data, "II*\0", 4) == 0)
+        layout.bigEndian = false;
+    else if (memcmp(data, "MM\0*", 4) == 0)
+        layout.bigEndian = true;
+    else
+        return false;
+
+    auto u16 = [&](qint64 offset) -> quint32 { return layout.bigEndian ? qFromBigEndian<quint16>(data + offset) : qFromLittleEndian<quint16>(data + offset); };
+    auto u32 = [&](qint64 offset) -> quint32 { return layout.bigEndian ? qFromBigEndian<quint32>(data + offset) : qFromLittleEndian<quint32>(data + offset); };
+    // Value i of the entry, inline when it fits the entry
+    auto value = [&](qint64 entry, quint32 i) -> qint64 {
+        const int type = u16(entry + 2);
+        const qint64 count = u32(entry + 4);
+        const int length = type == 3 ? 2 : 4;
+        const qint64 values = count * length <= 4 ? entry + 8 : qint64(u32(entry + 8));
+        if (i >= count || values < 0 || values + (i + 1) * length > size)
+            return -1;
+        return length == 2 ? u16(values + i * 2) : u32(values + i * 4);
+    };
+
+    const qint64 ifd = u32(4);
+    if (ifd + 2 > size)
+        return false;
+    const int count = u16(ifd);
+    if (ifd + 2 + qint64(count) * 12 > size)
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        const qint64 entry = ifd + 2 + qint64(i) * 12;
+        switch (u16(entry))
+        {
+        case TIFF_IMAGE_WIDTH: layout.width = value(entry, 0); break;
+        case TIFF_IMAGE_LENGTH: layout.height = value(entry, 0); break;
+        case TIFF_BITS_PER_SAMPLE: layout.bitsPerSample = value(entry, 0); break;
+        case TIFF_COMPRESSION: layout.compression = value(entry, 0); break;
+        case TIFF_PHOTOMETRIC: layout.photometric = value(entry, 0); break;
+        case TIFF_SAMPLES_PER_PIXEL: layout.samplesPerPixel = value(entry, 0); break;
+        case TIFF_ROWS_PER_STRIP: layout.rowsPerStrip = value(entry, 0); break;
+        case TIFF_PLANAR_CONFIG: layout.planarConfig = value(entry, 0); break;
+        case TIFF_SAMPLE_FORMAT: layout.sampleFormat = value(entry, 0); break;
+        case TIFF_TILE_WIDTH: layout.tiled = true; break;
+        case TIFF_STRIP_OFFSETS:
+        {
+            const quint32 strips = u32(entry + 4);
+            if (strips > size / 4)
+                return false;
+            layout.stripOffsets.resize(strips);
+            for (quint32 s = 0; s < strips; s++)
+                layout.stripOffsets[s] = value(entry, s);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return layout.width > 0 && layout.height > 0 && layout.samplesPerPixel > 0;
+}
+
+LinearImageReader::SampleType LinearImageReader::sampleTypeOf(const QByteArray &data)
+{
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    // The bit depth is the first byte after the size in the IHDR chunk, which comes first
+    if (data.size() > 24 && data.startsWith("\x89PNG\r\n\x1A\n"))
+        return bytes[24] == 16 ? UInt16 : NotLinear;
+
+    TiffLayout layout;
+    if (!parseTiff(bytes, data.size(), layout))
+        return NotLinear;
+    if (layout.bitsPerSample == 16 && layout.sampleFormat != TIFF_SAMPLE_FORMAT_FLOAT)
+        return UInt16;
+    if (layout.bitsPerSample == 32 && layout.sampleFormat == TIFF_SAMPLE_FORMAT_FLOAT)
+        return Float32;
+    return NotLinear;
+}
+
+// Like FitsFile::binningFactor, the longer side stays at least twice the thumbnail size
+static int binningFactor(qint64 width, qint64 height, int thumbnailSize)
+{
+    int factor = 1;
+    while (qMax(width, height) / (factor * 2) >= 2 * thumbnailSize)
+        factor *= 2;
+    return factor;
+}
+
+/*
+ * Bins the rows given by rowPixels(row, channel) into samples, factor x factor pixels
+ * averaged, like FitsFile::bin, only the rows of a band of output rows held at a time.
+ */
+template <typename T, typename RowPixels>
+static bool binRows(RowPixels rowPixels, qint64 width, qint64 height, int channels, int factor, const CancellationToken& token,
+                    std::vector<T>& samples, int& outWidth, int& outHeight)
+{
+    outWidth = int(width / factor);
+    outHeight = int(height / factor);
+    const long long planeSize = (long long)outWidth * outHeight;
+    const long long cells = (long long)factor * factor;
+    samples.assign(planeSize * channels, T(0));
+    std::vector<PixelSum<T>> sums(outWidth);
+    for (int y = 0; y < outHeight; y++)
+    {
+        if (token.isCanceled())
+            return false;
+        for (int c = 0; c < channels; c++)
+        {
+            std::fill(sums.begin(), sums.end(), 0);
+            for (qint64 row = (qint64)y * factor; row < (qint64)(y + 1) * factor; row++)
+                addRowToCells(rowPixels(row, c), 0, outWidth, factor, sums.data());
+            T* out = samples.data() + c * planeSize + (long long)y * outWidth;
+            for (int x = 0; x < outWidth; x++)
+                out[x] = T(sums[x] / cells);
+        }
+    }
+    return outWidth > 0 && outHeight > 0;
+}
+
+// Uncompressed, interleaved strips of samples of type T, a row at a time
+template <typename T, bool BigEndian>
+static bool readTiffStrips(const uchar* data, const TiffLayout& layout, int factor, int channels, const CancellationToken& token,
+                           std::vector<T>& samples, int& width, int& height)
+{
+    const qint64 rowBytes = layout.width * layout.samplesPerPixel * qint64(sizeof(T));
+    auto rowPixels = [&](qint64 row, int channel) {
+        const qint64 strip = row / layout.rowsPerStrip;
+        const uchar* start = data + layout.stripOffsets.at(strip) + (row % layout.rowsPerStrip) * rowBytes;
+        return TiffRowPixels<T, BigEndian>{start, layout.samplesPerPixel, channel};
+    };
+    return binRows<T>(rowPixels, layout.width, layout.height, channels, factor, token, samples, width, height);
+}
+
+// Whether the strips hold the rows of the image as they are, and are inside the data
+static bool isStreamable(const TiffLayout& layout, int bytesPerSample, qint64 size)
+{
+    if (layout.compression != 1 || layout.tiled || layout.bitsPerSample != 8 * bytesPerSample)
+        return false;
+    if (layout.planarConfig != 1 && layout.samplesPerPixel > 1)
+        return false;
+    // Min-is-black gray and RGB
+    if (layout.photometric != 1 && layout.photometric != 2)
+        return false;
+
+    const qint64 rowsPerStrip = layout.rowsPerStrip > 0 ? qMin(layout.rowsPerStrip, layout.height) : layout.height;
+    const qint64 strips = (layout.height + rowsPerStrip - 1) / rowsPerStrip;
+    if (layout.stripOffsets.count() != strips)
+        return false;
+    const qint64 rowBytes = layout.width * layout.samplesPerPixel * bytesPerSample;
+    for (qint64 s = 0; s < strips; s++)
+    {
+        const qint64 rows = qMin(rowsPerStrip, layout.height - s * rowsPerStrip);
+        if (layout.stripOffsets.at(s) < 0 || layout.stripOffsets.at(s) + rows * rowBytes > size)
+            return false;
+    }
+    return true;
+}
+
+template <typename T>
+bool LinearImageReader::read(const QByteArray &data, int thumbnailSize, const CancellationToken &token,
+                             std::vector<T> &samples, int &width, int &height, int &channels)
+{
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    TiffLayout layout;
+    if (parseTiff(bytes, data.size(), layout) && isStreamable(layout, sizeof(T), data.size()))
+    {
+        if (layout.rowsPerStrip <= 0 || layout.rowsPerStrip > layout.height)
+            layout.rowsPerStrip = layout.height;
+        // An alpha channel is not shown
+        channels = layout.samplesPerPixel >= 3 ? 3 : 1;
+        const int factor = binningFactor(layout.width, layout.height, thumbnailSize);
+        if (layout.bigEndian)
+            return readTiffStrips<T, true>(bytes, layout, factor, channels, token, samples, width, height);
+        return readTiffStrips<T, false>(bytes, layout, factor, channels, token, samples, width, height);
+    }
+
+    // Decoded whole by Qt, in a format of the precision of the samples
+    QByteArray copy = data;
+    QBuffer buffer(&copy);
+    QImageReader imageReader(&buffer);
+    QImage image = imageReader.read();
+    if (image.isNull() || token.isCanceled())
+        return false;
+
+    int stride;
+    if constexpr (std::is_floating_point<T>::value)
+    {
+        image.convertTo(QImage::Format_RGBX32FPx4);
+        channels = 3;
+        stride = 4;
+    }
+    else
+    {
+        channels = image.format() == QImage::Format_Grayscale16 ? 1 : 3;
+        image.convertTo(channels == 1 ? QImage::Format_Grayscale16 : QImage::Format_RGBX64);
+        stride = channels == 1 ? 1 : 4;
+    }
+    auto rowPixels = [&](qint64 row, int channel) {
+        return ScanLinePixels<T>{reinterpret_cast<const T*>(image.constScanLine(int(row))), stride, channel};
+    };
+    const int factor = binningFactor(image.width(), image.height(), thumbnailSize);
+    return binRows<T>(rowPixels, image.width(), image.height(), channels, factor, token, samples, width, height);
+}
+
+template bool LinearImageReader::read<uint16_t>(const QByteArray&, int, const CancellationToken&, std::vector<uint16_t>&, int&, int&, int&);
+template bool LinearImageReader::read<float>(const QByteArray&, int, const CancellationToken&, std::vector<float>&, int&, int&, int&);
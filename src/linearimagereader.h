@@ -0,0 +1,65 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef LINEARIMAGEREADER_H
+#define LINEARIMAGEREADER_H
+
+#include "cancellationtoken.h"
+
+#include <QByteArray>
+
+#include <vector>
+
+/*!
+ * \brief The LinearImageReader class
+ * Reads the 16 bit and floating point TIFF and PNG images that stacking programs
+ * write, in their own sample type, binned down to about twice the thumbnail size,
+ * into planar channels for the AutoStretcher. QImage would convert them to 8 bits
+ * at full size before they are scaled, and clip or darken linear data.
+ *
+ * Uncompressed TIFF strips are read a row at a time from the mapped file. Other
+ * layouts, compressed TIFF and PNG are decoded by QImageReader in a 16 bit or
+ * floating point format, then binned.
+ */
+class LinearImageReader
+{
+public:
+    enum SampleType
+    {
+        NotLinear, // 8 bit, or not a TIFF or a PNG
+        UInt16,
+        Float32
+    };
+
+    // From the header of the image
+    static SampleType sampleTypeOf(const QByteArray& data);
+
+    // The binned image, channel after channel. Returns false when it could not be read,
+    // or the token was canceled.
+    template <typename T>
+    static bool read(const QByteArray& data, int thumbnailSize, const CancellationToken& token,
+                     std::vector<T>& samples, int& width, int& height, int& channels);
+};
+
+#endif // LINEARIMAGEREADER_H
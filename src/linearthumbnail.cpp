@@ -0,0 +1,123 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "linearthumbnail.h"
+
+#include <vector>
+
+#define LINEAR_VALUES 65536
+
+/*!
+ * \brief LinearThumbnail::scaled
+ * Smooth scaling of Grayscale16 goes through 8 bits, so gray thumbnails are scaled
+ * as RGBX64 and converted back.
+ */
+QImage LinearThumbnail::scaled(const QImage &linear, int size)
+{
+    if (linear.isNull() || (linear.width() <= size && linear.height() <= size))
+        return linear;
+    if (linear.format() != QImage::Format_Grayscale16)
+        return linear.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return linear.convertToFormat(QImage::Format_RGBX64)
+            .scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+            .convertToFormat(QImage::Format_Grayscale16);
+}
+
+/*!
+ * \brief LinearThumbnail::stretch
+ * The display function of each channel, with the parameters made again from the
+ * statistics of the frame, is evaluated once for each of the 65536 values.
+ */
+QImage LinearThumbnail::stretch(const QImage &linear, const StretchParams &params, const StretchOptions &options)
+{
+    const int channels = linear.format() == QImage::Format_RGBX64 ? 3 : 1;
+    if (linear.isNull() || params.numberOfChannels != channels)
+        return QImage();
+
+    StretchParam channelParams[3];
+    float median = 0;
+    float mad = 0;
+    for (int k = 0; k < channels; k++)
+    {
+        median += params.channel[k].median / channels;
+        mad += params.channel[k].mad / channels;
+    }
+    for (int k = 0; k < channels; k++)
+    {
+        const StretchParam& p = params.channel[k];
+        channelParams[k] = options.linked ? StretchParam::fromStatistics(median, mad, options.targetBackground, options.shadowsClipping)
+                                          : StretchParam::fromStatistics(p.median, p.mad, options.targetBackground, options.shadowsClipping);
+    }
+
+    std::vector<uchar> tables(channels * LINEAR_VALUES);
+    for (int k = 0; k < channels; k++)
+    {
+        const StretchParam& p = channelParams[k];
+        uchar* table = tables.data() + k * LINEAR_VALUES;
+        for (int v = 0; v < LINEAR_VALUES; v++)
+        {
+            const float x = v / float(LINEAR_VALUES - 1);
+            if (x < p.S)
+                table[v] = 0;
+            else if (x > p.H || p.H == p.S)
+                table[v] = 255;
+            else
+            {
+                // The MidtonesTransferFunction of the clipped value
+                const float c = (x - p.S) / (p.H - p.S);
+                const float m = p.M;
+                float y;
+                if (c == 0 || c == 1)
+                    y = c;
+                else if (c == m)
+                    y = 0.5f;
+                else
+                    y = (m - 1) * c / ((2 * m - 1) * c - m);
+                table[v] = uchar(y * 255);
+            }
+        }
+    }
+
+    QImage image(linear.width(), linear.height(), channels == 3 ? QImage::Format_RGB32 : QImage::Format_Grayscale8);
+    if (image.isNull())
+        return image;
+    for (int y = 0; y < linear.height(); y++)
+    {
+        if (channels == 3)
+        {
+            auto* in = reinterpret_cast<const QRgba64*>(linear.constScanLine(y));
+            auto* out = reinterpret_cast<QRgb*>(image.scanLine(y));
+            for (int x = 0; x < linear.width(); x++)
+                out[x] = qRgb(tables[in[x].red()], tables[LINEAR_VALUES + in[x].green()], tables[2 * LINEAR_VALUES + in[x].blue()]);
+        }
+        else
+        {
+            auto* in = reinterpret_cast<const quint16*>(linear.constScanLine(y));
+            uchar* out = image.scanLine(y);
+            for (int x = 0; x < linear.width(); x++)
+                out[x] = tables[in[x]];
+        }
+    }
+    return image;
+}
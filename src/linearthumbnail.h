@@ -0,0 +1,59 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef LINEARTHUMBNAIL_H
+#define LINEARTHUMBNAIL_H
+
+#include "autostretcher.h"
+
+#include <QImage>
+
+// How thumbnails are stretched again from their linear thumbnail
+struct StretchOptions
+{
+    // One transfer function for the three channels, of their mean statistics
+    bool linked = false;
+    float targetBackground = 0.25f;
+    // In normalized MADs from the median
+    float shadowsClipping = -2.8f;
+};
+
+/*!
+ * \brief The LinearThumbnail class
+ * A linear thumbnail is a small image of a frame before the stretch, with 16 bits per
+ * channel, see AutoStretcher::linearImage. It is stored with the thumbnails, so they
+ * can be stretched again with other options, from the statistics in the StretchParams
+ * of the file, without reading the file.
+ */
+class LinearThumbnail
+{
+public:
+    // Scaled down to fit size, keeping the 16 bits
+    static QImage scaled(const QImage& linear, int size);
+    // Grayscale8 or RGB32, through a table per channel. A null image when the
+    // parameters are not of the thumbnail.
+    static QImage stretch(const QImage& linear, const StretchParams& params, const StretchOptions& options);
+};
+
+#endif // LINEARTHUMBNAIL_H
@@ -22,21 +22,75 @@
     SOFTWARE.
 */
 
+#include "guibenchmark.h"
 #include "mainwindow.h"
+#include "sandboxedprocessor.h"
+#include "stallwatchdog.h"
+#include "thumbnailtrace.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
 #include <QSettings>
 
+#include <memory>
+
+// The GUI thread is logged as stalled when it does not answer for this many milliseconds
+#define STALL_THRESHOLD 1000
+
 int main(int argc, char *argv[])
 {
+    // The decoders of a sandboxed ingest are this executable, see SandboxedProcessor
+    if (SandboxedProcessor::isHelper(argc, argv))
+        return SandboxedProcessor::runHelper(argc, argv);
+
     QApplication a(argc, argv);
 
     QSettings::setDefaultFormat(QSettings::IniFormat);
     QCoreApplication::setApplicationName("Astrocat");
     QCoreApplication::setOrganizationName("Astrocat");
     QCoreApplication::setOrganizationDomain("astrocat.app");
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption benchmarkOption("gui-benchmark", "Scrolls, resizes and filters a synthetic catalog of this many files, "
+                                       "prints the frame times and quits. The catalog of the app is not touched.", "files");
+    QCommandLineOption reportOption("benchmark-report", "Writes the results of --gui-benchmark as JSON to this file.", "path");
+    QCommandLineOption thumbnailTraceOption("record-thumbnail-trace", "Records the thumbnails the grid asks for and loads, "
+                                            "with the rows in view, to this file for thumbnail-replay.", "path");
+    parser.addOptions({benchmarkOption, reportOption, thumbnailTraceOption});
+    parser.process(a);
+
+    if (parser.isSet(thumbnailTraceOption) && !ThumbnailTrace::start(parser.value(thumbnailTraceOption)))
+        qWarning() << "Failed to record the thumbnail trace to" << parser.value(thumbnailTraceOption);
+
+    int benchmarkFiles = parser.value(benchmarkOption).toInt();
+    if (benchmarkFiles > 0)
+        GuiBenchmark::prepare(benchmarkFiles);
+
     MainWindow w;
     w.initialize();
     w.show();
-    return a.exec();
+
+    std::unique_ptr<GuiBenchmark> benchmark;
+    if (benchmarkFiles > 0)
+    {
+        benchmark = std::make_unique<GuiBenchmark>(&w, benchmarkFiles, parser.value(reportOption));
+        benchmark->start();
+    }
+
+    // Logs the stack of the GUI thread to stalls.log when it freezes, 0 turns it off.
+    // Only while the event loop runs, the startup and the shutdown do not answer pings.
+    std::unique_ptr<StallWatchdog> watchdog;
+    int stallThreshold = QSettings().value("StallThreshold", STALL_THRESHOLD).toInt();
+    if (stallThreshold > 0)
+    {
+        watchdog = std::make_unique<StallWatchdog>(stallThreshold);
+        watchdog->start(QThread::LowPriority);
+    }
+
+    int result = a.exec();
+    watchdog.reset();
+    ThumbnailTrace::stop();
+    return result;
 }
@@ -26,77 +26,150 @@
 #include "ui_mainwindow.h"
 #include "searchfolderdialog.h"
 #include "aboutwindow.h"
-#include "mock_newfileprocessor.h"
 #include "catalog.h"
-#include "mock_foldercrawler.h"
 #include "modelloadingdialog.h"
+#include "diagnosticsdialog.h"
+#include "exportdialog.h"
+#include "indexingservice.h"
+#include "memorybudget.h"
+#include "metrics.h"
+#include "previewwindow.h"
+#include "blinkwindow.h"
+#include "contactsheetdialog.h"
+#include "stackwindow.h"
+#include "stallwatchdog.h"
+#include "thumbnailtrace.h"
 
 #include <QContextMenuEvent>
+#include <QInputDialog>
 #include <QMessageBox>
 #include <QPainter>
 #include <QDesktopServices>
 #include <QProcess>
-#include <QPixmapCache>
+#include <QPushButton>
 #include <QDir>
+#include <QScrollBar>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+
+// Processing priority hints are sent this long after the view stopped changing,
+// and cover this many rows past each edge of the viewport
+#define PRIORITY_HINTS_INTERVAL 100
+#define PRIORITY_HINTS_PREFETCH_ROWS 50
+
+// Bits of the perceptual hashes that may differ between near duplicates, see PerceptualHash. Frames of one
+// field taken in a row can be this close as well, so it is kept small.
+#define NEAR_DUPLICATE_DISTANCE 3
+
+// Calibration frames match light frames taken this many days around them, at this many degrees of CCD-TEMP
+#define CALIBRATION_MAX_DAYS 30
+#define CALIBRATION_TEMPERATURE_TOLERANCE 1.0
+
+// While attached to the indexing daemon, its changes are read and its progress shown this often, in milliseconds
+#define DAEMON_CHANGES_POLL_INTERVAL 1000
+#define DAEMON_STATUS_INTERVAL 2000
+
+// How often the caches are checked against the MemoryBudget
+#define MEMORY_CHECK_INTERVAL 2000
+
+// The integration totals are summed again this long after the rows shown changed
+#define INTEGRATION_STATS_INTERVAL 250
+
+// Pages of thumbnails loaded past the view, ThumbnailPrefetchPages, see thumbnail-replay to tune it
+#define THUMBNAIL_PREFETCH_PAGES 1.0
+
+// Pages on each side of the view whose ids go into a thumbnail trace, so deeper prefetching can be replayed
+#define TRACE_VIEWPORT_PAGES 4
+
+// The counts of the smart collections are read again this long after the catalog changed
+#define SMART_COLLECTIONS_INTERVAL 500
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
       ui(new Ui::MainWindow),
       isInitialized(false)
 {
+    startupTimer.start();
     ui->setupUi(this);
 
-    catalogThread = new QThread(this);
-    catalog = new Catalog;
-    catalog->moveToThread(catalogThread);
-
-    folderCrawlerThread = new QThread(this);
-    folderCrawlerWorker = new FolderCrawler;
-//    folderCrawlerWorker = new Mock_FolderCrawler;
-    folderCrawlerWorker->moveToThread(folderCrawlerThread);
-
-    fileRepositoryThread = new QThread(this);
-    fileRepositoryWorker = new FileRepository;
-    fileRepositoryWorker->moveToThread(fileRepositoryThread);
-
-    newFileProcessorThread = new QThread(this);
-
-//    newFileProcessorWorker = new Mock_NewFileProcessor;
-    newFileProcessorWorker = new NewFileProcessor;
-    newFileProcessorWorker->setCatalog(catalog);
+    // Opt-in, e.g. ASTROCAT_TRACE=/tmp/astrocat-trace.json, the file opens in chrome://tracing or Perfetto
+    QString tracePath = qEnvironmentVariable("ASTROCAT_TRACE", QSettings().value("TraceFile").toString());
+    if (!tracePath.isEmpty())
+    {
+        QThread::currentThread()->setObjectName("gui");
+        Tracing::start(tracePath);
+    }
 
-    newFileProcessorWorker->moveToThread(newFileProcessorThread);
+    // A catalog kept by astrocat-index --serve on a network drive is only read here,
+    // and followed through its change log, see FileRepository::loadChanges
+    QString sharedCatalogPath = QSettings().value("SharedCatalogPath").toString();
+    // A catalog served by astrocat-index --listen is copied to a db of its own, and
+    // followed from there, see CatalogClient
+    QString catalogServerUrl = QSettings().value("CatalogServerUrl").toString();
+    if (!catalogServerUrl.isEmpty())
+    {
+        const QString replicaPath = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/replica";
+        QDir().mkpath(replicaPath);
+        FileRepository::setDatabaseFilePath(replicaPath + "/astrocat.db");
+        FileRepository::setAccessMode(FileRepository::ReplicaAccess);
+        ui->actionFolders->setEnabled(false);
+    }
+    else if (!sharedCatalogPath.isEmpty())
+    {
+        FileRepository::setDatabaseFilePath(sharedCatalogPath);
+        FileRepository::setAccessMode(FileRepository::SharedReaderAccess);
+        ui->actionFolders->setEnabled(false);
+    }
+    else
+    {
+        // The daemon the ingest was left to when the app was closed. Attached while it is
+        // still ingesting, otherwise the db is taken back from it.
+        const QJsonObject status = IndexingService::request("status");
+        if (!status.isEmpty() && (!status.value("idle").toBool() || !IndexingService::stopDaemon()))
+        {
+            FileRepository::setAccessMode(FileRepository::SharedReaderAccess);
+            isAttachedToDaemon = true;
+        }
+    }
 
-    fileFilter = new FileProcessFilter;
-    fileFilter->setCatalog(catalog);
-    fileFilter->moveToThread(folderCrawlerThread);
+    engine = new IndexingEngine(this);
+    if (isAttachedToDaemon)
+        engine->setChangesPollInterval(DAEMON_CHANGES_POLL_INTERVAL);
+    // The ingest leaves the cores and the disk to browsing, unless told otherwise
+    engine->setBackgroundIngest(QSettings().value("BackgroundIngest", true).toBool());
+    catalog = engine->catalog();
+    FileRepository* fileRepositoryWorker = engine->repository();
 
     fileViewModel = new FileViewModel(ui->astroListView);
     fileViewModel->setCatalog(catalog);
     sortFilterProxyModel = new SortFilterProxyModel(ui->astroListView);
+    sortFilterProxyModel->setCatalog(catalog);
     sortFilterProxyModel->setSourceModel(fileViewModel);
-    ui->astroListView->setViewMode(QListView::IconMode);
-    ui->astroListView->setResizeMode(QListView::Adjust);
     ui->astroListView->setModel(sortFilterProxyModel);
     ui->astroListView->setEditTriggers(QAbstractItemView::NoEditTriggers);
-    ui->astroListView->setUniformItemSizes(true);
+    ui->astroListView->setAcceleratedRendering(QSettings().value("AcceleratedThumbnailGrid", true).toBool());
     ui->astroListView->setIconSize(QSize(200,200));
 
     ui->astroListView->setStyleSheet(
-                "QListView {"
+                "ThumbnailGridView {"
                     "background-color: #232323;"
                     "color: white;"
                     "}"
-                "QListView::item {"
+                "ThumbnailGridView::item {"
                     "background-color: #232323;"
                     "color: white;"
                     "}"
-                "QListView::item:selected {"
+                "ThumbnailGridView::item:selected {"
                     "border: 1px solid #6a6ea9;"
                     "background-color: #232323;"
                     "color: white;"
                     "}"
-                "QListView::item:selected:active {"
+                "ThumbnailGridView::item:selected:active {"
                     "border: 1px solid #6a6ea9;"
                     "background-color: #232323;"
                     "color: white;"
@@ -104,11 +177,17 @@ MainWindow::MainWindow(QWidget *parent)
                 );
 
     QItemSelectionModel *selectionModel = ui->astroListView->selectionModel();
+    selectionStats.setCatalog(catalog);
+    selectionStats.setModel(sortFilterProxyModel);
+    updateSelectionLabel();
+    tagDetailsCache = new TagDetailsCache(fileRepositoryWorker, this);
+    detailPrefetcher = new DetailPrefetcher(fileRepositoryWorker, catalog, sortFilterProxyModel, tagDetailsCache, this);
+    ui->astroListView->setMouseTracking(true);
     filterView = new FilterView(ui->scrollAreaWidgetContents_2);
     filterView->setModel(sortFilterProxyModel);
 
 //    thumbnailCache = new ThumbnailCache();
-    thumbnailCache.moveToThread(fileRepositoryThread);
+    thumbnailCache.moveToThread(engine->repositoryThread());
     thumbnailCache.start();
 
     ui->statusbar->setStyleSheet(
@@ -124,67 +203,117 @@ MainWindow::MainWindow(QWidget *parent)
 
     ui->astroListView->setContextMenuPolicy(Qt::ContextMenuPolicy::CustomContextMenu);
     createActions();
-    QPixmapCache::setCacheLimit(100*1024);
 
     loading = new ModelLoadingDialog(this);
 
-    connect(this,                   &MainWindow::crawl,                                 folderCrawlerWorker,    &FolderCrawler::crawl);
-    connect(this,                   &MainWindow::initializeFileRepository,              fileRepositoryWorker,   &FileRepository::initialize);
-    connect(this,                   &MainWindow::deleteAstrofilesInFolder,              fileRepositoryWorker,   &FileRepository::deleteAstrofilesInFolder);
-    connect(this,                   &MainWindow::loadModelFromDb,                       fileRepositoryWorker,   &FileRepository::loadModel);
-    connect(this,                   &MainWindow::dbAddOrUpdateAstroFile,                fileRepositoryWorker,   &FileRepository::addOrUpdateAstrofile);
-    connect(this,                   &MainWindow::processNewFile,                        newFileProcessorWorker, &NewFileProcessor::processNewFile);
-    connect(this,                   &MainWindow::dbGetDuplicates,                       fileRepositoryWorker,   &FileRepository::getDuplicateFiles);
-    connect(catalogThread,          &QThread::finished,                                 catalog,                &QObject::deleteLater);
+    priorityHintsTimer.setSingleShot(true);
+    priorityHintsTimer.setInterval(PRIORITY_HINTS_INTERVAL);
+    integrationStatsTimer.setSingleShot(true);
+    integrationStatsTimer.setInterval(INTEGRATION_STATS_INTERVAL);
+    smartCollectionsTimer.setSingleShot(true);
+    smartCollectionsTimer.setInterval(SMART_COLLECTIONS_INTERVAL);
+
+    // The tiny thumbnails of the visible rows are kept, the others are shown from the
+    // full thumbnail once it is loaded
+    tinyThumbnailsBudgetId = MemoryBudget::add("Tiny thumbnails", MemoryBudget::TinyThumbnailEviction,
+                                               [this]() { return catalog->tinyThumbnailBytes(); },
+                                               [this](qint64 bytes) { return catalog->dropTinyThumbnails(bytes, visibleIds); });
+    memoryCheckTimer.setInterval(MEMORY_CHECK_INTERVAL);
+    connect(&memoryCheckTimer, &QTimer::timeout, this, []() { MemoryBudget::check(); });
+    memoryCheckTimer.start();
+
+    daemonStatusTimer.setInterval(DAEMON_STATUS_INTERVAL);
+    connect(&daemonStatusTimer, &QTimer::timeout, this, &MainWindow::updateDaemonStatus);
+    if (isAttachedToDaemon)
+        daemonStatusTimer.start();
+
+    connect(engine,                 &IndexingEngine::catalogLoaded,                     this,                   &MainWindow::modelLoadedFromDb);
+    connect(engine,                 &IndexingEngine::activeJobsChanged,                 this,                   &MainWindow::activeJobsChanged);
+    connect(engine,                 &IndexingEngine::dbFailedToOpen,                    this,                   &MainWindow::dbFailedToOpen);
+    connect(engine,                 &IndexingEngine::searchFolderMoved,                 &searchFolderDialog,    &SearchFolderDialog::replaceSearchFolder);
+    connect(engine,                 &IndexingEngine::headersEdited,                     this,                   &MainWindow::headersEdited);
+    connect(engine,                 &IndexingEngine::reconciled,                        this,                   &MainWindow::reconciled);
     connect(catalog,                &Catalog::AstroFilesAdded,                          fileViewModel,          &FileViewModel::AddAstroFiles);
-    connect(catalog,                &Catalog::AstroFileUpdated,                         fileViewModel,          &FileViewModel::UpdateAstroFile);
-    connect(this,                   &MainWindow::catalogAddAstroFile,                   catalog,                &Catalog::addAstroFile);
-    connect(this,                   &MainWindow::catalogAddAstroFiles,                  catalog,                &Catalog::addAstroFiles);
-    connect(folderCrawlerThread,    &QThread::finished,                                 folderCrawlerWorker,    &QObject::deleteLater);
-    connect(folderCrawlerWorker,    &FolderCrawler::fileFound,                          fileFilter,             &FileProcessFilter::filterFile);
-    connect(fileFilter,             &FileProcessFilter::shouldProcess,                  newFileProcessorWorker, &NewFileProcessor::processNewFile);
-    connect(fileFilter,             &FileProcessFilter::shouldProcess,                  this,                   &MainWindow::processQueued);
-    connect(fileRepositoryWorker,   &FileRepository::astroFileUpdated,                  this,                   &MainWindow::dbAstroFileUpdated);
+    connect(catalog,                &Catalog::AstroFilesUpdated,                        fileViewModel,          &FileViewModel::UpdateAstroFiles);
     connect(fileRepositoryWorker,   &FileRepository::astroFileDeleted,                  fileViewModel,          &FileViewModel::RemoveAstroFile);
     connect(fileRepositoryWorker,   &FileRepository::astroFilesDeleted,                 fileViewModel,          &FileViewModel::RemoveAstroFiles);
-    connect(fileRepositoryWorker,   &FileRepository::modelLoaded,                       this,                   &MainWindow::modelLoadedFromDb);
-    connect(fileRepositoryWorker,   &FileRepository::dbFailedToInitialize,              this,                   &MainWindow::dbFailedToOpen);
-    connect(fileRepositoryWorker,   &FileRepository::thumbnailLoaded,                   fileViewModel,          &FileViewModel::addThumbnail);
-    connect(fileRepositoryThread,   &QThread::finished,                                 fileRepositoryWorker,   &QObject::deleteLater);
-    connect(newFileProcessorWorker, &NewFileProcessor::astrofileProcessed,              this,                   &MainWindow::astroFileProcessed);
-    connect(newFileProcessorWorker, &NewFileProcessor::processingCancelled,             this,                   &MainWindow::processingCancelled);
-    connect(newFileProcessorThread, &QThread::finished,                                 newFileProcessorWorker, &QObject::deleteLater);
     connect(&searchFolderDialog,    &SearchFolderDialog::searchFolderAdded,             this,                   &MainWindow::searchFolderAdded);
     connect(&searchFolderDialog,    &SearchFolderDialog::searchFolderRemoved,           this,                   &MainWindow::searchFolderRemoved);
     connect(sortFilterProxyModel,   &SortFilterProxyModel::filterMinimumDateChanged,    filterView,             &FilterView::setFilterMinimumDate);
     connect(sortFilterProxyModel,   &SortFilterProxyModel::filterMaximumDateChanged,    filterView,             &FilterView::setFilterMaximumDate);
     connect(sortFilterProxyModel,   &SortFilterProxyModel::filterReset,                 filterView,             &FilterView::searchFilterReset);
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::facetProjectionsChanged,     filterView,             &FilterView::setFacetProjections);
     connect(fileViewModel,          &FileViewModel::modelIsEmpty,                       this,                   &MainWindow::setWatermark);
     connect(fileViewModel,          &FileViewModel::rowsInserted,                       this,                   &MainWindow::rowsAddedToModel);
     connect(fileViewModel,          &FileViewModel::rowsRemoved,                        this,                   &MainWindow::rowsRemovedFromModel);
     connect(fileViewModel,          &FileViewModel::modelReset,                         this,                   &MainWindow::modelReset);
-    connect(fileViewModel,          &FileViewModel::loadThumbnailFromDb,                &thumbnailCache,        &ThumbnailCache::enqueueLoadThumbnail);
-    connect(&thumbnailCache,        &ThumbnailCache::dbLoadThumbnail,                   fileRepositoryWorker,   &FileRepository::loadThumbnal);
+    // The ThumbnailCache is thread safe, so requests do not wait for the fileRepositoryThread it lives in
+    connect(fileViewModel,          &FileViewModel::loadThumbnailFromDb,                &thumbnailCache,        &ThumbnailCache::enqueueLoadThumbnail, Qt::DirectConnection);
+    connect(fileViewModel,          &FileViewModel::prefetchThumbnailsFromDb,           &thumbnailCache,        &ThumbnailCache::prefetchThumbnails, Qt::DirectConnection);
+    // Thumbnails are loaded on the ThumbnailCache thread with its own read-only connection,
+    // so scrolling does not wait behind ingest writes on the fileRepositoryThread.
+    connect(&thumbnailCache,        &ThumbnailCache::dbLoadThumbnails,                  fileRepositoryWorker,   &FileRepository::loadThumbnails, Qt::DirectConnection);
+    // The loaded thumbnails are scaled on the ThumbnailCache thread too, the GUI thread only makes pixmaps of them
+    connect(fileRepositoryWorker,   &FileRepository::thumbnailsLoaded,                  &thumbnailCache,        &ThumbnailCache::prepareThumbnails, Qt::DirectConnection);
+    connect(&thumbnailCache,        &ThumbnailCache::thumbnailsReady,                   fileViewModel,          &FileViewModel::addThumbnails);
+    connect(fileViewModel,          &FileViewModel::iconSizeChanged,                    &thumbnailCache,        &ThumbnailCache::setIconSize, Qt::DirectConnection);
+    thumbnailCache.setIconSize(fileViewModel->iconSize());
     connect(filterView,             &FilterView::minimumDateChanged,                    sortFilterProxyModel,   &SortFilterProxyModel::setFilterMinimumDate);
+    connect(filterView,             &FilterView::skyRegionChanged,                      sortFilterProxyModel,   &SortFilterProxyModel::setSkyRegion);
+    connect(filterView,             &FilterView::qualityLimitsChanged,                  sortFilterProxyModel,   &SortFilterProxyModel::setQualityLimits);
+    connect(filterView,             &FilterView::searchTextChanged,                     this,                   &MainWindow::search);
+    connect(fileRepositoryWorker,   &FileRepository::searchFinished,                    this,                   &MainWindow::searchFinished);
+    connect(tagDetailsCache,        &TagDetailsCache::tagsReady,                        this,                   &MainWindow::tagDetailsReady);
     connect(filterView,             &FilterView::maximumDateChanged,                    sortFilterProxyModel,   &SortFilterProxyModel::setFilterMaximumDate);
     connect(filterView,             &FilterView::addAcceptedFilter,                     sortFilterProxyModel,   &SortFilterProxyModel::addAcceptedFilter);
     connect(filterView,             &FilterView::addAcceptedInstrument,                 sortFilterProxyModel,   &SortFilterProxyModel::addAcceptedInstrument);
     connect(filterView,             &FilterView::addAcceptedObject,                     sortFilterProxyModel,   &SortFilterProxyModel::addAcceptedObject);
     connect(filterView,             &FilterView::addAcceptedExtension,                  sortFilterProxyModel,   &SortFilterProxyModel::addAcceptedExtension);
     connect(filterView,             &FilterView::addAcceptedFolder,                     sortFilterProxyModel,   &SortFilterProxyModel::addAcceptedFolder);
+    connect(filterView,             &FilterView::addAcceptedFrameType,                  sortFilterProxyModel,   &SortFilterProxyModel::addAcceptedFrameType);
     connect(filterView,             &FilterView::removeAcceptedFilter,                  sortFilterProxyModel,   &SortFilterProxyModel::removeAcceptedFilter);
     connect(filterView,             &FilterView::removeAcceptedInstrument,              sortFilterProxyModel,   &SortFilterProxyModel::removeAcceptedInstrument);
     connect(filterView,             &FilterView::removeAcceptedObject,                  sortFilterProxyModel,   &SortFilterProxyModel::removeAcceptedObject);
     connect(filterView,             &FilterView::removeAcceptedExtension,               sortFilterProxyModel,   &SortFilterProxyModel::removeAcceptedExtension);
     connect(filterView,             &FilterView::removeAcceptedFolder,                  sortFilterProxyModel,   &SortFilterProxyModel::removeAcceptedFolder);
+    connect(filterView,             &FilterView::removeAcceptedFrameType,               sortFilterProxyModel,   &SortFilterProxyModel::removeAcceptedFrameType);
+    connect(filterView,             &FilterView::addAcceptedIntegrity,                  sortFilterProxyModel,   &SortFilterProxyModel::addAcceptedIntegrity);
+    connect(filterView,             &FilterView::removeAcceptedIntegrity,               sortFilterProxyModel,   &SortFilterProxyModel::removeAcceptedIntegrity);
     connect(filterView,             &FilterView::astroFileAdded,                        this,                   &MainWindow::itemAddedToSortFilterView);
     connect(filterView,             &FilterView::astroFileRemoved,                      this,                   &MainWindow::itemRemovedFromSortFilterView);
     connect(ui->astroListView,      &QWidget::customContextMenuRequested,               this,                   &MainWindow::itemContextMenuRequested);
+    connect(ui->astroListView,      &QAbstractItemView::doubleClicked,                  this,                   &MainWindow::openPreview);
+    connect(&priorityHintsTimer,    &QTimer::timeout,                                   this,                   &MainWindow::updateProcessingPriorityHints);
+    connect(this,                   &MainWindow::processingPriorityHints,               engine->processor(),    &NewFileProcessor::setPriorityHints, Qt::DirectConnection);
+    connect(ui->astroListView->verticalScrollBar(), &QScrollBar::valueChanged,          &priorityHintsTimer,    qOverload<>(&QTimer::start));
+    connect(ui->astroListView->verticalScrollBar(), &QScrollBar::valueChanged,          engine,                 &IndexingEngine::noteUserActivity);
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::rowsInserted,                &priorityHintsTimer,    qOverload<>(&QTimer::start));
+    // Rows are removed from the proxy when a filter is narrowed
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::rowsRemoved,                 this,                   [this]() { filteredOutHintsStale = true; priorityHintsTimer.start(); });
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::modelReset,                  this,                   [this]() { filteredOutHintsStale = true; priorityHintsTimer.start(); });
+    // A reset clears the selection without telling
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::modelReset,                  this,                   [this]() { selectionStats.clear(); updateSelectionLabel(); });
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::rowsInserted,                &integrationStatsTimer, qOverload<>(&QTimer::start));
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::rowsRemoved,                 &integrationStatsTimer, qOverload<>(&QTimer::start));
+    connect(sortFilterProxyModel,   &SortFilterProxyModel::modelReset,                  &integrationStatsTimer, qOverload<>(&QTimer::start));
+    connect(&integrationStatsTimer, &QTimer::timeout,                                   this,                   [this]() { filterView->setIntegrationStats(sortFilterProxyModel->integrationStats()); });
+    connect(filterView,             &FilterView::smartCollectionOpened,                 this,                   &MainWindow::openSmartCollection);
+    connect(filterView,             &FilterView::smartCollectionSaved,                  this,                   &MainWindow::saveSmartCollection);
+    connect(filterView,             &FilterView::smartCollectionDeleted,                this,                   &MainWindow::deleteSmartCollection);
+    connect(catalog,                &Catalog::smartCollectionsChanged,                  &smartCollectionsTimer, qOverload<>(&QTimer::start));
+    // Not restarted by every change, so the counts follow a long ingest
+    auto scheduleSmartCollections = [this]() { if (!smartCollectionsTimer.isActive()) smartCollectionsTimer.start(); };
+    connect(fileViewModel,          &FileViewModel::rowsInserted,                       this,                   scheduleSmartCollections);
+    connect(fileViewModel,          &FileViewModel::rowsRemoved,                        this,                   scheduleSmartCollections);
+    connect(fileViewModel,          &FileViewModel::dataChanged,                        this,                   scheduleSmartCollections);
+    connect(&smartCollectionsTimer, &QTimer::timeout,                                   this,                   &MainWindow::updateSmartCollections);
     connect(selectionModel,         &QItemSelectionModel::selectionChanged,             this,                   &MainWindow::handleSelectionChanged);
-    connect(fileRepositoryWorker,   &FileRepository::modelLoadingGotAstrofiles,         loading,                &ModelLoadingDialog::modelLoadingFromDbGotAstrofiles);
-    connect(fileRepositoryWorker,   &FileRepository::modelLoadingGotTags,               loading,                &ModelLoadingDialog::modelLoadingFromDbGotTag);
-    connect(fileRepositoryWorker,   &FileRepository::modelLoadingGotThumbnails,         loading,                &ModelLoadingDialog::modelLoadingFromDbGotThumbnails);
+    connect(selectionModel,         &QItemSelectionModel::currentChanged,               detailPrefetcher,       &DetailPrefetcher::setCurrent);
+    connect(ui->astroListView,      &QAbstractItemView::entered,                        detailPrefetcher,       &DetailPrefetcher::setHovered);
+    connect(fileRepositoryWorker,   &FileRepository::modelLoadingStarted,               loading,                &ModelLoadingDialog::modelLoadingStarted);
+    connect(fileRepositoryWorker,   &FileRepository::modelLoadingProgress,              loading,                &ModelLoadingDialog::modelLoadingProgress);
     connect(fileRepositoryWorker,   &FileRepository::modelLoaded,                       loading,                &ModelLoadingDialog::modelLoaded);
+    connect(fileRepositoryWorker,   &FileRepository::migrationProgress,                 loading,                &ModelLoadingDialog::migrationProgress);
     connect(catalog,                &Catalog::DoneAddingAstrofiles,                     loading,                &ModelLoadingDialog::closeWindow);
 
     // Enable the tester during development and debugging. Disble before committing
@@ -193,22 +322,28 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    memoryCheckTimer.stop();
+    daemonStatusTimer.stop();
+    MemoryBudget::remove(tinyThumbnailsBudgetId);
+    // An ingest in progress goes on in the daemon, once this db connection is closed
+    const bool shouldLaunchDaemon = FileRepository::accessMode() == FileRepository::LocalAccess &&
+            QSettings().value("IndexInBackground", false).toBool() && !engine->isIdle();
     cancelPendingOperations();
-
-    qDebug()<<"Cleaning up folderCrawlerThread";
-    cleanUpWorker(folderCrawlerThread);
-
-    qDebug()<<"Cleaning up newFileProcessorThread";    
-    cleanUpWorker(newFileProcessorThread);
-
-    qDebug()<<"Cleaning up fileRepositoryThread";
-    cleanUpWorker(fileRepositoryThread);
+    engine->stopWorkers();
 
     qDebug()<<"Cleaning up fileViewModel";
     delete fileViewModel;
 
-    qDebug()<<"Cleaning up catalogThread";
-    cleanUpWorker(catalogThread);
+    engine->stop();
+    if (shouldLaunchDaemon)
+        IndexingService::launch(getSearchFolders());
+
+    // All workers stopped, so their trace buffers are complete
+    Tracing::stop();
+
+    QString metricsPath = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/metrics.json";
+    qDebug()<<"Writing metrics to" << metricsPath;
+    Metrics::writeJson(metricsPath);
 
     qDebug()<<"Cleaning up ui";
     delete ui;
@@ -217,13 +352,8 @@ MainWindow::~MainWindow()
 
 void MainWindow::cancelPendingOperations()
 {
-    catalog->removeAllSearchFolders();
-    catalog->cancel();
     thumbnailCache.cancel();
-    fileFilter->cancel();
-    folderCrawlerWorker->cancel();
-    newFileProcessorWorker->cancel();
-    fileRepositoryWorker->cancel();
+    engine->cancel();
 }
 
 void MainWindow::initialize()
@@ -231,44 +361,35 @@ void MainWindow::initialize()
     if (isInitialized)
         return;
 
-    auto foldersFromList = getSearchFolders();
-    catalog->addSearchFolder(foldersFromList);
-    folderCrawlerThread->start();
-    fileRepositoryThread->start();
-    newFileProcessorThread->start();
-    catalogThread->start();
-
-    emit initializeFileRepository();
     _watermarkMessage = "Loading Catalog...";
     setWatermark(true);
 
     loading->open();
-    emit loadModelFromDb();
+    // The indexer of a shared or served catalog crawls its folders
+    if (FileRepository::isIndexedElsewhere())
+        engine->start(QStringList());
+    else
+        engine->start(getSearchFolders());
 
     isInitialized = true;
-    emit dbGetDuplicates();
-}
-
-void MainWindow::cleanUpWorker(QThread* thread)
-{
-    thread->quit();
-    thread->wait();
-    delete thread;
+    engine->findDuplicates();
 }
 
 void MainWindow::searchFolderAdded(const QString folder)
 {
-    catalog->addSearchFolder(folder);
-
-    emit folderCrawlerWorker->crawl(folder);
+    // The files the daemon finds come through the change log
+    if (isAttachedToDaemon)
+        IndexingService::request("add " + folder);
+    else
+        engine->addSearchFolder(folder);
 }
 
 void MainWindow::searchFolderRemoved(const QString folder)
 {
-    catalog->removeSearchFolder(folder);
-
-    // The source folder was removed by the user. We will need to remove all images in this source folder from the db.
-    emit deleteAstrofilesInFolder(folder);
+    if (isAttachedToDaemon)
+        IndexingService::request("remove " + folder);
+    else
+        engine->removeSearchFolder(folder);
 }
 
 void MainWindow::on_imageSizeSlider_valueChanged(int value)
@@ -276,15 +397,14 @@ void MainWindow::on_imageSizeSlider_valueChanged(int value)
     auto currentIndex = ui->astroListView->currentIndex();
 
     if (!currentIndex.isValid())
-        currentIndex = ui->astroListView->indexAt(QPoint(0,0));
+        currentIndex = sortFilterProxyModel->index(ui->astroListView->firstVisibleRow(), 0);
 
     QPersistentModelIndex pIndex(currentIndex);
 
-    // TODO: This call causes filterAcceptsRow() to be called in the sortFilterProxyModel. Investigate and see if we need to fix.
+    // The view lays its items out again with the new size hints when its icon size is set
     fileViewModel->setCellSize(value);
     ui->astroListView->setIconSize(QSize(4,4)*value);
 
-    // TODO: This call causes filterAcceptsRow() to be called in the sortFilterProxyModel. Investigate and see if we need to fix.
 //    auto scrollToIndex = sortFilterProxyModel->index(currentIndex.row(), currentIndex.column(), QModelIndex());
 //    auto scrollToIndex = sortFilterProxyModel->mapFromSource(currentIndex);
 
@@ -299,17 +419,110 @@ QImage MainWindow::makeThumbnail(const QImage &image)
     return small;
 }
 
+void MainWindow::on_sortComboBox_currentIndexChanged(int index)
+{
+    // The items of the combo box are in the order of the sort keys. The frames with the most stars go first.
+    auto key = static_cast<CatalogColumns::SortKey>(index);
+    sortFilterProxyModel->setSortKey(key, key == CatalogColumns::StarCountKey ? Qt::DescendingOrder : Qt::AscendingOrder);
+}
+
+/*!
+ * \brief MainWindow::on_groupCheckBox_toggled
+ * Shows the files grouped by target, filter and night instead of the grid. The groups
+ * are only kept once they were shown.
+ */
+void MainWindow::on_groupCheckBox_toggled(bool checked)
+{
+    if (checked && groupedFileModel == nullptr)
+    {
+        groupedFileModel = new GroupedFileModel(ui->groupedView);
+        groupedFileModel->setCatalog(catalog);
+        groupedFileModel->setSourceModel(sortFilterProxyModel);
+        ui->groupedView->setModel(groupedFileModel);
+        ui->groupedView->setStyleSheet("QTreeView { background-color: #232323; color: white; }");
+        connect(ui->groupedView, &QAbstractItemView::doubleClicked, this, [this](const QModelIndex& index) {
+            const QModelIndex sourceIndex = groupedFileModel->sourceIndex(index);
+            if (sourceIndex.isValid())
+                openPreview(sourceIndex);
+        });
+    }
+    ui->groupedView->setVisible(checked);
+    ui->astroListView->setVisible(!checked);
+}
+
 void MainWindow::on_actionFolders_triggered()
 {
     searchFolderDialog.exec();
 }
 
+void MainWindow::on_actionRetryFailedFiles_triggered()
+{
+    engine->retryFailedFiles();
+}
+
+void MainWindow::on_actionFindMissingFiles_triggered()
+{
+    numberOfActiveJobsLabel.setText(tr("Looking for missing files..."));
+    engine->reconcile(false);
+}
+
+/*!
+ * \brief MainWindow::reconciled
+ * Lists the files that are gone from disk, and removes them from the catalog when the
+ * user asks to. They are looked for again then, so a file that came back is kept.
+ */
+void MainWindow::reconciled(const QStringList &missing, bool removed)
+{
+    if (removed)
+    {
+        numberOfActiveJobsLabel.setText(tr("Removed %n missing file(s) from the catalog", "", missing.count()));
+        return;
+    }
+    numberOfActiveJobsLabel.setText(tr("%n file(s) missing", "", missing.count()));
+    if (missing.isEmpty())
+    {
+        QMessageBox::information(this, tr("Find Missing Files"), tr("Every file of the catalog is on disk."));
+        return;
+    }
+
+    QMessageBox messageBox(QMessageBox::Warning, tr("Find Missing Files"),
+        tr("%n file(s) of the catalog are not on disk any more.", "", missing.count()), QMessageBox::Close, this);
+    messageBox.setDetailedText(missing.join('\n'));
+    QPushButton* removeButton = nullptr;
+    if (!FileRepository::isIndexedElsewhere())
+        removeButton = messageBox.addButton(tr("Remove From Catalog"), QMessageBox::DestructiveRole);
+    messageBox.exec();
+    if (removeButton != nullptr && messageBox.clickedButton() == removeButton)
+        engine->reconcile(true);
+}
+
 void MainWindow::on_actionAbout_triggered()
 {
     AboutWindow about(this);
     about.exec();
 }
 
+void MainWindow::on_actionDiagnostics_triggered()
+{
+    // Not modal, so the metrics can be watched during an ingest
+    if (diagnosticsDialog == nullptr)
+        diagnosticsDialog = new DiagnosticsDialog(this);
+    diagnosticsDialog->show();
+    diagnosticsDialog->raise();
+}
+
+void MainWindow::on_actionSkyMap_triggered()
+{
+    // Not modal, so the files of a tile can be looked at while it is open
+    if (skyMapDialog == nullptr)
+    {
+        skyMapDialog = new SkyMapDialog(catalog, this);
+        connect(skyMapDialog, &SkyMapDialog::skyRegionSelected, filterView, &FilterView::setSkyRegion);
+    }
+    skyMapDialog->show();
+    skyMapDialog->raise();
+}
+
 void MainWindow::clearDetailLabels()
 {
     ui->filenameLabel->clear();
@@ -326,15 +539,37 @@ void MainWindow::clearDetailLabels()
     ui->temperatureLabel->clear();
     ui->fullPathLabel->clear();
     ui->imagesizeLabel->clear();
+    ui->keywordsTree->clear();
+    detailsId = 0;
 }
 
-void MainWindow::crawlAllSearchFolders()
+void MainWindow::showKeywords(const QMap<QString, QString> &tags)
 {
-    auto foldersFromList = getSearchFolders();
-    for (auto& f : foldersFromList)
-    {
-        emit crawl(f);
-    }
+    ui->keywordsTree->clear();
+    QList<QTreeWidgetItem*> items;
+    items.reserve(tags.count());
+    for (auto iter = tags.constBegin(); iter != tags.constEnd(); ++iter)
+        items.append(new QTreeWidgetItem({iter.key(), iter.value()}));
+    ui->keywordsTree->addTopLevelItems(items);
+}
+
+/*!
+ * \brief MainWindow::tagDetailsReady
+ * The keywords of a selected file were loaded. Dropped if another file is selected by now.
+ */
+void MainWindow::tagDetailsReady(int id, const QMap<QString, QString> &tags)
+{
+    if (id == detailsId)
+        showKeywords(tags);
+}
+
+// Like "Selected Items: 120, 3h 20m, 4.1 GB"
+void MainWindow::updateSelectionLabel()
+{
+    QString text = QString("Selected Items: %1").arg(selectionStats.count());
+    if (selectionStats.count() > 0)
+        text += QString(", %1, %2").arg(IntegrationStats::formatDuration(selectionStats.exposure()), locale().formattedDataSize(selectionStats.bytes()));
+    numberOfSelectedItemsLabel.setText(text);
 }
 
 QList<QString> MainWindow::getSearchFolders()
@@ -344,9 +579,12 @@ QList<QString> MainWindow::getSearchFolders()
     return foldersFromList;
 }
 
-void MainWindow::handleSelectionChanged(QItemSelection selection)
+void MainWindow::handleSelectionChanged(const QItemSelection& selection, const QItemSelection& deselection)
 {
-    int numSelectedRows =  ui->astroListView->selectionModel()->selectedRows().count();
+    selectionStats.apply(selection, deselection);
+    updateSelectionLabel();
+
+    int numSelectedRows = selectionStats.count();
     if (numSelectedRows == 0)
     {
         clearDetailLabels();
@@ -372,67 +610,88 @@ void MainWindow::handleSelectionChanged(QItemSelection selection)
     }
 
     QModelIndex index = selection[0].indexes()[0];
-
-    auto xSize = sortFilterProxyModel->data(index, AstroFileRoles::ImageXSizeRole).toString();
-    auto ySize = sortFilterProxyModel->data(index, AstroFileRoles::ImageYSizeRole).toString();
-
-    ui->filenameLabel->setText(sortFilterProxyModel->data(index, Qt::DisplayRole).toString());
-    ui->objectLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::ObjectRole).toString());
-    ui->insturmentLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::InstrumentRole).toString());
-    ui->filterLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::FilterRole).toString());
-    ui->dateLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::DateRole).toString());
-    ui->bayerpatternLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::BayerModeRole).toString());
-    ui->exposureLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::ExposureRole).toString());
-    ui->gainLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::GainRole).toString());
-    ui->offsetLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::OffsetRole).toString());
-    ui->raLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::RaRole).toString());
-    ui->decLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::DecRole).toString());
-    ui->temperatureLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::CcdTempRole).toString());
-    ui->fullPathLabel->setText(sortFilterProxyModel->data(index, AstroFileRoles::FullPathRole).toString());
-
+    detailPrefetcher->setCurrent(index);
+
+    // The labels and their roles, read with one call to the model
+    std::array<QModelRoleData, 17> roles = {{
+        QModelRoleData(Qt::DisplayRole),
+        QModelRoleData(AstroFileRoles::ObjectRole),
+        QModelRoleData(AstroFileRoles::InstrumentRole),
+        QModelRoleData(AstroFileRoles::FilterRole),
+        QModelRoleData(AstroFileRoles::DateRole),
+        QModelRoleData(AstroFileRoles::BayerModeRole),
+        QModelRoleData(AstroFileRoles::ExposureRole),
+        QModelRoleData(AstroFileRoles::GainRole),
+        QModelRoleData(AstroFileRoles::OffsetRole),
+        QModelRoleData(AstroFileRoles::RaRole),
+        QModelRoleData(AstroFileRoles::DecRole),
+        QModelRoleData(AstroFileRoles::CcdTempRole),
+        QModelRoleData(AstroFileRoles::FullPathRole),
+        QModelRoleData(AstroFileRoles::ImageXSizeRole),
+        QModelRoleData(AstroFileRoles::ImageYSizeRole),
+        QModelRoleData(AstroFileRoles::IdRole),
+        QModelRoleData(AstroFileRoles::ImageZSizeRole),
+    }};
+    sortFilterProxyModel->multiData(index, roles);
+    QLabel* labels[] = {ui->filenameLabel, ui->objectLabel, ui->insturmentLabel, ui->filterLabel, ui->dateLabel,
+                        ui->bayerpatternLabel, ui->exposureLabel, ui->gainLabel, ui->offsetLabel, ui->raLabel,
+                        ui->decLabel, ui->temperatureLabel, ui->fullPathLabel};
+    for (size_t i = 0; i < std::size(labels); i++)
+        labels[i]->setText(roles[i].data().toString());
+
+    auto xSize = roles[13].data().toString();
+    auto ySize = roles[14].data().toString();
+    auto zSize = roles[16].data().toString();
     if (! xSize.isEmpty() && ! ySize.isEmpty())
-        ui->imagesizeLabel->setText(xSize+"x"+ySize);
-}
+        ui->imagesizeLabel->setText(xSize+"x"+ySize+(zSize.isEmpty() || zSize == "1" ? QString() : "x"+zSize));
 
-void MainWindow::modelLoadedFromDb(const QList<AstroFile> &files)
-{
-    _watermarkMessage = DEFAULT_WATERMARK_MESSAGE;
-    setWatermark(true);
-    emit catalogAddAstroFiles(files);
-
-    crawlAllSearchFolders();
+    // The labels are from the tag columns the catalog has, the other keywords are loaded now
+    detailsId = roles[15].data().toInt();
+    QMap<QString, QString> tags;
+    if (tagDetailsCache->find(detailsId, &tags))
+        showKeywords(tags);
+    else
+        ui->keywordsTree->clear();
 }
 
-void MainWindow::astroFileProcessed(const AstroFile &astroFile)
+void MainWindow::modelLoadedFromDb()
 {
-    QFileInfo fileInfo(astroFile.FullPath);
-    if (!catalog->shouldProcessFile(fileInfo))
+    if (!startupLoaded)
     {
-        // This file is not in the catalog anymore.
-        numberOfActiveJobs--;
-        ui->statusbar->showMessage(QString("Jobs Queue: %1").arg(numberOfActiveJobs));
-        return;
+        startupLoaded = true;
+        Metrics::counter("startup.loaded_msecs") = startupTimer.elapsed();
+        qDebug() << "Catalog loaded" << startupTimer.elapsed() << "ms after start";
     }
 
-    // do not decrement numberOfActiveJobs yet. It will be decremented
-    // after the db recorded it.
-    emit dbAddOrUpdateAstroFile(astroFile);
+    _watermarkMessage = DEFAULT_WATERMARK_MESSAGE;
+    setWatermark(true);
 }
 
-void MainWindow::processingCancelled(const QFileInfo &fileInfo)
+void MainWindow::activeJobsChanged(int activeJobs)
 {
-    numberOfActiveJobs--;
-    ui->statusbar->showMessage(QString("Jobs Queue: %1").arg(numberOfActiveJobs));
+    ui->statusbar->showMessage(QString("Jobs Queue: %1").arg(activeJobs));
 }
 
-void MainWindow::processQueued(const QFileInfo &fileInfo)
+/*!
+ * \brief MainWindow::updateDaemonStatus
+ * Shows the progress of the daemon this window is attached to. The window stays a
+ * reader of the db once the daemon is done, until the app is started again.
+ */
+void MainWindow::updateDaemonStatus()
 {
-    numberOfActiveJobs++;
-    ui->statusbar->showMessage(QString("Jobs Queue: %1").arg(numberOfActiveJobs));
+    const QJsonObject status = IndexingService::request("status");
+    if (status.isEmpty() || status.value("idle").toBool())
+    {
+        daemonStatusTimer.stop();
+        ui->statusbar->showMessage(tr("Indexed in the background, restart to edit the catalog"));
+        return;
+    }
+    ui->statusbar->showMessage(tr("Indexing in the background: %1 jobs in progress").arg(status.value("activeJobs").toInt()));
 }
 
 void MainWindow::setWatermark(bool shouldSet)
 {
+    StallScope scope("MainWindow::setWatermark");
     shouldShowWatermark = shouldSet;
     if (shouldSet)
     {
@@ -480,6 +739,12 @@ void MainWindow::modelReset()
 
 void MainWindow::itemAddedToSortFilterView(int numberAdded)
 {
+    if (!startupRowsShown)
+    {
+        startupRowsShown = true;
+        Metrics::counter("startup.first_rows_msecs") = startupTimer.elapsed();
+        qDebug() << "First rows shown" << startupTimer.elapsed() << "ms after start";
+    }
     this->numberOfVisibleItems+= numberAdded;
     this->numberOfVisibleItemsLabel.setText(QString("Shown Items: %1").arg(numberOfVisibleItems));
 }
@@ -501,6 +766,12 @@ void MainWindow::itemContextMenuRequested(const QPoint &pos)
 
     QMenu menu(this);
     menu.addAction(revealAct);
+    menu.addAction(exportAct);
+    menu.addAction(contactSheetAct);
+    menu.addAction(editKeywordsAct);
+    menu.addAction(calibrationAct);
+    menu.addAction(blinkAct);
+    menu.addAction(stackAct);
 //    menu.addAction(removeAct);
     auto menuPos = ui->astroListView->viewport()->mapToGlobal(pos);
     menu.exec(menuPos);
@@ -510,6 +781,124 @@ void MainWindow::resizeEvent(QResizeEvent *event)
 {
     Q_UNUSED(event);
     setWatermark(shouldShowWatermark);
+    priorityHintsTimer.start();
+}
+
+/*!
+ * \brief MainWindow::updateProcessingPriorityHints
+ * Sends the files in and around the viewport, and the files hidden by the
+ * current filter, to the processor. Only files still waiting for their pixel
+ * phase are sent, and the ones with outdated thumbnails, which are made again.
+ */
+void MainWindow::updateProcessingPriorityHints()
+{
+    QStringList visiblePaths;
+    QStringList outdatedPaths;
+    int proxyRows = sortFilterProxyModel->rowCount();
+    if (proxyRows > 0)
+    {
+        int first = qMax(0, ui->astroListView->firstVisibleRow());
+        int last = ui->astroListView->lastVisibleRow();
+        if (last == -1)
+            last = proxyRows - 1;
+        first = qMax(0, first - PRIORITY_HINTS_PREFETCH_ROWS);
+        last = qMin(proxyRows - 1, last + PRIORITY_HINTS_PREFETCH_ROWS);
+
+        for (int row = first; row <= last; row++)
+        {
+            auto sourceIndex = sortFilterProxyModel->mapToSource(sortFilterProxyModel->index(row, 0));
+            auto astroFile = catalog->getAstroFile(sourceIndex.row());
+            if (astroFile->processStatus == NeedsToBeProcessed)
+                visiblePaths.append(astroFile->FullPath);
+            else if (astroFile->processStatus == AstroFileProcessed && astroFile->ThumbnailVersion < THUMBNAIL_VERSION)
+                outdatedPaths.append(astroFile->FullPath);
+        }
+    }
+    engine->regenerateThumbnails(outdatedPaths);
+    visiblePaths.append(outdatedPaths);
+
+    if (filteredOutHintsStale)
+    {
+        // Walks every row, so only done when the filter changed
+        filteredOutHints.clear();
+        int sourceRows = fileViewModel->rowCount(QModelIndex());
+        for (int row = 0; row < sourceRows; row++)
+        {
+            auto astroFile = catalog->getAstroFile(row);
+            if (astroFile->processStatus != NeedsToBeProcessed)
+                continue;
+            if (!sortFilterProxyModel->mapFromSource(fileViewModel->index(row, 0)).isValid())
+                filteredOutHints.append(astroFile->FullPath);
+        }
+        filteredOutHintsStale = false;
+    }
+
+    emit processingPriorityHints(visiblePaths, filteredOutHints);
+    updateThumbnailPrefetch();
+}
+
+/*!
+ * \brief MainWindow::updateThumbnailPrefetch
+ * Tells the ThumbnailCache which files are visible, and prefetches the thumbnails of
+ * the next viewport of rows in the direction of the last scroll, or half a viewport on
+ * both sides when not scrolled.
+ */
+void MainWindow::updateThumbnailPrefetch()
+{
+    int proxyRows = sortFilterProxyModel->rowCount();
+    if (proxyRows == 0)
+        return;
+
+    int first = qMax(0, ui->astroListView->firstVisibleRow());
+    int last = ui->astroListView->lastVisibleRow();
+    if (last == -1)
+        last = proxyRows - 1;
+    int pageRows = last - first + 1;
+
+    auto sourceRow = [this](int row) { return sortFilterProxyModel->mapToSource(sortFilterProxyModel->index(row, 0)).row(); };
+
+    QList<int> visibleIdList;
+    for (int row = first; row <= last; row++)
+        visibleIdList.append(catalog->getAstroFile(sourceRow(row))->Id);
+    thumbnailCache.setVisibleIds(visibleIdList);
+    visibleIds = QSet<int>(visibleIdList.begin(), visibleIdList.end());
+
+    int scrollValue = ui->astroListView->verticalScrollBar()->value();
+    if (ThumbnailTrace::isEnabled())
+    {
+        int around = qMax(0, first - TRACE_VIEWPORT_PAGES * pageRows);
+        int end = qMin(proxyRows - 1, last + TRACE_VIEWPORT_PAGES * pageRows);
+        QVector<int> ids;
+        for (int row = around; row <= end; row++)
+            ids.append(catalog->getAstroFile(sourceRow(row))->Id);
+        ThumbnailTrace::viewport(first, last, scrollValue, around, ids);
+    }
+
+    int depth = int(pageRows * QSettings().value("ThumbnailPrefetchPages", THUMBNAIL_PREFETCH_PAGES).toDouble());
+    int before = depth / 2;
+    int after = depth / 2;
+    if (scrollValue > lastScrollValue)
+    {
+        before = 0;
+        after = depth;
+    }
+    else if (scrollValue < lastScrollValue)
+    {
+        before = depth;
+        after = 0;
+    }
+    lastScrollValue = scrollValue;
+
+    // Nearest rows first
+    QList<int> rows;
+    for (int i = 1; i <= qMax(before, after); i++)
+    {
+        if (i <= after && last + i < proxyRows)
+            rows.append(sourceRow(last + i));
+        if (i <= before && first - i >= 0)
+            rows.append(sourceRow(first - i));
+    }
+    fileViewModel->prefetchThumbnails(rows);
 }
 
 void MainWindow::showEvent(QShowEvent *event)
@@ -559,6 +948,331 @@ void MainWindow::reveal()
     }
 }
 
+void MainWindow::exportSelection()
+{
+    QVector<FileExporter::Item> items;
+    for (auto& item : ui->astroListView->selectionModel()->selectedRows())
+    {
+        auto sourceIndex = sortFilterProxyModel->mapToSource(item);
+        if (!sourceIndex.isValid())
+            continue;
+        auto astroFile = catalog->getAstroFile(sourceIndex.row());
+        items.append({astroFile->FullPath, astroFile->FileSize, astroFile->FileHash});
+    }
+    if (items.isEmpty())
+        return;
+
+    ExportDialog* exportDialog = new ExportDialog(items, this);
+    exportDialog->setAttribute(Qt::WA_DeleteOnClose);
+    exportDialog->show();
+}
+
+/*!
+ * \brief MainWindow::exportContactSheet
+ * Contact sheets of the selected files, or of every file in view when fewer than two
+ * are selected, in the order of the view. The captions are from the catalog, so no
+ * file is read. The title is the observing night when the files are all of one.
+ */
+void MainWindow::exportContactSheet()
+{
+    QModelIndexList rows = ui->astroListView->selectionModel()->selectedRows();
+    if (rows.count() < 2)
+    {
+        rows.clear();
+        for (int row = 0; row < sortFilterProxyModel->rowCount(); row++)
+            rows.append(sortFilterProxyModel->index(row, 0));
+    }
+    std::sort(rows.begin(), rows.end(), [](const QModelIndex& a, const QModelIndex& b) { return a.row() < b.row(); });
+
+    QVector<ContactSheetExporter::Item> items;
+    QSet<QDate> nights;
+    for (auto& index : rows)
+    {
+        auto line = [&](std::initializer_list<int> roles, const QString& separator) {
+            QStringList values;
+            for (int role : roles)
+            {
+                const QString value = sortFilterProxyModel->data(index, role).toString();
+                if (!value.isEmpty())
+                    values.append(value);
+            }
+            return values.join(separator);
+        };
+        ContactSheetExporter::Item item;
+        item.id = sortFilterProxyModel->data(index, AstroFileRoles::IdRole).toInt();
+        item.title = sortFilterProxyModel->data(index, Qt::DisplayRole).toString();
+        item.caption.append(line({AstroFileRoles::ObjectRole, AstroFileRoles::FilterRole, AstroFileRoles::FrameTypeRole}, "  "));
+        const QString exposure = sortFilterProxyModel->data(index, AstroFileRoles::ExposureRole).toString();
+        item.caption.append(line({AstroFileRoles::DateRole}, "") + (exposure.isEmpty() ? QString() : "  " + exposure + " s"));
+        item.caption.append(line({AstroFileRoles::InstrumentRole, AstroFileRoles::GainRole, AstroFileRoles::CcdTempRole}, "  "));
+        items.append(item);
+        nights.insert(sortFilterProxyModel->data(index, AstroFileRoles::NightRole).toDate());
+    }
+    if (items.isEmpty())
+        return;
+
+    const QString title = nights.count() == 1 && nights.begin()->isValid()
+            ? tr("Night of %1").arg(locale().toString(*nights.begin(), QLocale::LongFormat)) : QString();
+    ContactSheetDialog* dialog = new ContactSheetDialog(engine->repository(), items, title, this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->show();
+}
+
+/*!
+ * \brief MainWindow::editKeywords
+ * Sets a keyword in the headers of the selected FITS files, see IndexingEngine::editHeaders.
+ */
+void MainWindow::editKeywords()
+{
+    QList<AstroFile> astroFiles;
+    for (auto& item : ui->astroListView->selectionModel()->selectedRows())
+    {
+        auto sourceIndex = sortFilterProxyModel->mapToSource(item);
+        if (!sourceIndex.isValid())
+            continue;
+        auto astroFile = catalog->getAstroFile(sourceIndex.row());
+        if (astroFile->FileType == AstroFileType::Fits)
+            astroFiles.append(*astroFile);
+    }
+    if (astroFiles.isEmpty())
+        return;
+
+    bool ok;
+    const QStringList keywords = {"OBJECT", "FILTER", "IMAGETYP", "TELESCOP", "INSTRUME", "OBSERVER", "SITENAME"};
+    const QString keyword = QInputDialog::getItem(this, tr("Edit Keyword"), tr("Keyword:"), keywords, 0, true, &ok).trimmed().toUpper();
+    if (!ok || keyword.isEmpty())
+        return;
+    const QString value = QInputDialog::getText(this, tr("Edit Keyword"),
+        tr("Value of %1 in %n file(s):", "", astroFiles.count()).arg(keyword), QLineEdit::Normal, QString(), &ok);
+    if (!ok)
+        return;
+
+    HeaderEdit edit = {keyword, value.trimmed()};
+    QString error;
+    if (!FitsHeaderEditor::isValidEdit(edit, error))
+    {
+        QMessageBox::warning(this, tr("Edit Keyword"), error);
+        return;
+    }
+    engine->editHeaders(astroFiles, {edit});
+}
+
+void MainWindow::headersEdited(int edited, const QStringList &failures)
+{
+    numberOfActiveJobsLabel.setText(tr("Edited the headers of %n file(s)", "", edited));
+    if (failures.isEmpty())
+        return;
+
+    QMessageBox messageBox(QMessageBox::Warning, tr("Edit Keyword"),
+        tr("%n header(s) could not be edited.", "", failures.count()), QMessageBox::Ok, this);
+    messageBox.setDetailedText(failures.join('\n'));
+    messageBox.exec();
+}
+
+/*!
+ * \brief MainWindow::openPreview
+ * Opens the FITS file at full resolution, stretched like its thumbnail. Other files are revealed.
+ */
+void MainWindow::openPreview(const QModelIndex &index)
+{
+    auto sourceIndex = sortFilterProxyModel->mapToSource(index);
+    if (!sourceIndex.isValid())
+        return;
+
+    auto astroFile = catalog->getAstroFile(sourceIndex.row());
+    if (astroFile->FileType != AstroFileType::Fits)
+    {
+        revealFile(this, astroFile->FullPath);
+        return;
+    }
+
+    auto previewWindow = new PreviewWindow(astroFile->FullPath, astroFile->StretchParameters, this);
+    previewWindow->setPlaceholder(detailPrefetcher->previewImage(astroFile->Id));
+    previewWindow->setAttribute(Qt::WA_DeleteOnClose);
+    engine->beginInteraction();
+    connect(previewWindow, &QObject::destroyed, engine, &IndexingEngine::endInteraction);
+    previewWindow->show();
+}
+
+/*!
+ * \brief MainWindow::blink
+ * Blinks the FITS files that pass the filter, in the order of the view, starting at the
+ * current one. They are all stretched like it.
+ */
+void MainWindow::blink()
+{
+    auto current = ui->astroListView->currentIndex();
+    if (!current.isValid())
+        return;
+
+    QStringList paths;
+    int startIndex = 0;
+    QByteArray stretchParameters;
+    int rows = sortFilterProxyModel->rowCount();
+    for (int row = 0; row < rows; row++)
+    {
+        auto sourceIndex = sortFilterProxyModel->mapToSource(sortFilterProxyModel->index(row, 0));
+        auto astroFile = catalog->getAstroFile(sourceIndex.row());
+        if (astroFile->FileType != AstroFileType::Fits)
+            continue;
+        if (row <= current.row())
+        {
+            startIndex = paths.size();
+            stretchParameters = astroFile->StretchParameters;
+        }
+        paths.append(astroFile->FullPath);
+    }
+    if (paths.isEmpty())
+        return;
+
+    auto blinkWindow = new BlinkWindow(paths, startIndex, stretchParameters, this);
+    blinkWindow->setAttribute(Qt::WA_DeleteOnClose);
+    engine->beginInteraction();
+    connect(blinkWindow, &QObject::destroyed, engine, &IndexingEngine::endInteraction);
+    blinkWindow->show();
+}
+
+/*!
+ * \brief MainWindow::stackSelection
+ * Stacks the selected FITS files roughly, in the order of the view, aligned on the first
+ * one and normalized like it, see PreviewStacker.
+ */
+void MainWindow::stackSelection()
+{
+    QModelIndexList items = ui->astroListView->selectionModel()->selectedRows();
+    std::sort(items.begin(), items.end(), [](const QModelIndex& a, const QModelIndex& b) { return a.row() < b.row(); });
+
+    QStringList paths;
+    QByteArray stretchParameters;
+    for (auto& item : items)
+    {
+        auto sourceIndex = sortFilterProxyModel->mapToSource(item);
+        if (!sourceIndex.isValid())
+            continue;
+        auto astroFile = catalog->getAstroFile(sourceIndex.row());
+        if (astroFile->FileType != AstroFileType::Fits)
+            continue;
+        if (paths.isEmpty())
+            stretchParameters = astroFile->StretchParameters;
+        paths.append(astroFile->FullPath);
+    }
+    if (paths.isEmpty())
+        return;
+
+    auto stackWindow = new StackWindow(paths, stretchParameters, this);
+    stackWindow->setAttribute(Qt::WA_DeleteOnClose);
+    engine->beginInteraction();
+    connect(stackWindow, &QObject::destroyed, engine, &IndexingEngine::endInteraction);
+    stackWindow->show();
+}
+
+/*!
+ * \brief MainWindow::findMatchingCalibration
+ * Shows the selected frames and the darks, flats and bias frames that calibrate them.
+ * The Frame Types facet narrows them down to one type.
+ */
+void MainWindow::findMatchingCalibration()
+{
+    QItemSelectionModel *select = ui->astroListView->selectionModel();
+    auto items = select->selectedRows();
+    if (items.isEmpty())
+        return;
+
+    QVector<int> ids;
+    for (auto item: items)
+        ids.append(sortFilterProxyModel->data(item, AstroFileRoles::IdRole).toInt());
+
+    QSettings settings;
+    int days = settings.value("CalibrationMaxDays", CALIBRATION_MAX_DAYS).toInt();
+    double temperatureTolerance = settings.value("CalibrationTemperatureTolerance", CALIBRATION_TEMPERATURE_TOLERANCE).toDouble();
+    QVector<int> matches = catalog->matchingCalibration(ids, days, temperatureTolerance);
+    matches.append(ids);
+    this->sortFilterProxyModel->setIdFilter(matches);
+    this->sortFilterProxyModel->activateIdFilter(true);
+}
+
+/*!
+ * \brief MainWindow::search
+ * Runs the search on the thread pool, with a read-only connection of its own, so
+ * typing does not wait for the db.
+ */
+void MainWindow::search(const QString &text)
+{
+    const int generation = ++searchGeneration;
+    if (text.isEmpty())
+    {
+        sortFilterProxyModel->clearSearchResults();
+        return;
+    }
+
+    FileRepository* repository = engine->repository();
+    QThreadPool::globalInstance()->start([repository, text, generation]() { repository->searchFiles(text, generation); });
+}
+
+void MainWindow::searchFinished(int generation, const QVector<int> &ids)
+{
+    if (generation != searchGeneration)
+        return;
+    sortFilterProxyModel->setSearchResults(ids);
+}
+
+/*!
+ * \brief MainWindow::openSmartCollection
+ * Shows the files of the collection, which the catalog keeps, so they are not filtered
+ * again. An empty name shows every file.
+ */
+void MainWindow::openSmartCollection(const QString &name)
+{
+    openCollection = name;
+    if (name.isEmpty())
+    {
+        openCollectionCount = -1;
+        sortFilterProxyModel->activateIdFilter(false);
+        return;
+    }
+    const QVector<int> members = catalog->smartCollectionMembers(name);
+    openCollectionCount = members.count();
+    sortFilterProxyModel->setIdFilter(members);
+    sortFilterProxyModel->activateIdFilter(true);
+}
+
+void MainWindow::saveSmartCollection(const QString &name, const QString &expression)
+{
+    SmartCollection collection;
+    QString error;
+    if (!SmartCollection::compile(name, expression, collection, error))
+        return;
+
+    // Its files are found on the catalog thread, which then tells smartCollectionsChanged
+    Catalog* catalogWorker = catalog;
+    QMetaObject::invokeMethod(catalogWorker, [catalogWorker, collection]() { catalogWorker->setSmartCollection(collection); });
+    FileRepository* repository = engine->repository();
+    repository->submit<void>(InteractivePriority, [repository, name, expression](const CancellationToken&) { repository->saveSmartCollection(name, expression); });
+}
+
+void MainWindow::deleteSmartCollection(const QString &name)
+{
+    if (name == openCollection)
+        openSmartCollection(QString());
+    catalog->removeSmartCollection(name);
+    FileRepository* repository = engine->repository();
+    repository->submit<void>(InteractivePriority, [repository, name](const CancellationToken&) { repository->deleteSmartCollection(name); });
+}
+
+// The open collection is shown again when its files changed
+void MainWindow::updateSmartCollections()
+{
+    const QList<QPair<QString, int>> counts = catalog->smartCollectionCounts();
+    filterView->setSmartCollections(counts);
+    if (openCollection.isEmpty())
+        return;
+    for (auto& count : counts)
+    {
+        if (count.first == openCollection && count.second != openCollectionCount)
+            openSmartCollection(openCollection);
+    }
+}
+
 void MainWindow::remove()
 {
     QItemSelectionModel *select = ui->astroListView->selectionModel();
@@ -585,6 +1299,30 @@ void MainWindow::createActions()
     revealAct->setStatusTip(tr("Open the file in the file browser"));
     connect(revealAct, &QAction::triggered, this, &MainWindow::reveal);
 
+    exportAct = new QAction(tr("Export..."), this);
+    exportAct->setStatusTip(tr("Copy or link the selected files to a folder"));
+    connect(exportAct, &QAction::triggered, this, &MainWindow::exportSelection);
+
+    contactSheetAct = new QAction(tr("Export Contact Sheet..."), this);
+    contactSheetAct->setStatusTip(tr("Write pages of the thumbnails of the selected files, or of the files in view, with their keywords"));
+    connect(contactSheetAct, &QAction::triggered, this, &MainWindow::exportContactSheet);
+
+    editKeywordsAct = new QAction(tr("Edit Keyword..."), this);
+    editKeywordsAct->setStatusTip(tr("Set a keyword in the headers of the selected FITS files"));
+    connect(editKeywordsAct, &QAction::triggered, this, &MainWindow::editKeywords);
+
+    calibrationAct = new QAction(tr("Show Matching Calibration"), this);
+    calibrationAct->setStatusTip(tr("Show the darks, flats and bias frames taken with the same setup as the selected frames"));
+    connect(calibrationAct, &QAction::triggered, this, &MainWindow::findMatchingCalibration);
+
+    blinkAct = new QAction(tr("Blink From Here"), this);
+    blinkAct->setStatusTip(tr("Step through the FITS files in view, in their current order"));
+    connect(blinkAct, &QAction::triggered, this, &MainWindow::blink);
+
+    stackAct = new QAction(tr("Stack Preview"), this);
+    stackAct->setStatusTip(tr("Stack the selected FITS files roughly, to judge how much data they make"));
+    connect(stackAct, &QAction::triggered, this, &MainWindow::stackSelection);
+
     removeAct = new QAction(tr("Remove"), this);
     removeAct->setStatusTip(tr("Removes the image from the catalog. Does not delete the file."));
     connect(removeAct, &QAction::triggered, this, &MainWindow::remove);
@@ -594,12 +1332,26 @@ void MainWindow::on_duplicatesButton_clicked()
 {
     QItemSelectionModel *select = ui->astroListView->selectionModel();
     auto items = select->selectedRows();
-    if (items.count() != 1)
+    if (items.count() > 1)
         return;
 
+    // Without a selection, every file that has a duplicate is shown
+    if (items.isEmpty())
+    {
+        this->sortFilterProxyModel->setIdFilter(catalog->allDuplicates());
+        this->sortFilterProxyModel->activateIdFilter(true);
+        return;
+    }
+
     auto hash = sortFilterProxyModel->data(items[0], AstroFileRoles::FileHashRole).toString();
-    this->sortFilterProxyModel->setDuplicatesFilter(hash);
-    this->sortFilterProxyModel->activateDuplicatesFilter(true);
+    int id = sortFilterProxyModel->data(items[0], AstroFileRoles::IdRole).toInt();
+    QVector<int> duplicates = catalog->duplicatesOf(hash);
+    // Copies saved again or with an edited header have a different hash, but look the same
+    int radius = QSettings().value("NearDuplicateDistance", NEAR_DUPLICATE_DISTANCE).toInt();
+    duplicates.append(catalog->nearDuplicatesOf(id, radius));
+    duplicates.append(id);
+    this->sortFilterProxyModel->setIdFilter(duplicates);
+    this->sortFilterProxyModel->activateIdFilter(true);
 }
 
 void MainWindow::dbFailedToOpen(const QString message)
@@ -612,13 +1364,6 @@ void MainWindow::dbFailedToOpen(const QString message)
     QApplication::quit();
 }
 
-void MainWindow::dbAstroFileUpdated(const AstroFile &astroFile)
-{
-    emit catalogAddAstroFile(astroFile);
-    numberOfActiveJobs--;
-    ui->statusbar->showMessage(QString("Jobs Queue: %1").arg(numberOfActiveJobs));
-}
-
 //void MainWindow::dbAstroFileDeleted(const AstroFile &astroFile)
 //{
 //    catalog->deleteAstroFile(astroFile);
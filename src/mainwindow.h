@@ -26,24 +26,29 @@
 #define MAINWINDOW_H
 
 #include "astrofile.h"
-#include "filerepository.h"
+#include "detailprefetcher.h"
 #include "fileviewmodel.h"
-#include "fitsprocessor.h"
-#include "foldercrawler.h"
-#include "newfileprocessor.h"
+#include "groupedfilemodel.h"
+#include "indexingengine.h"
 #include "searchfolderdialog.h"
+#include "selectionstats.h"
 #include "sortfilterproxymodel.h"
 #include "filterview.h"
 #include "catalog.h"
-#include "fileprocessfilter.h"
 #include "thumbnailcache.h"
 #include "modelloadingdialog.h"
+#include "diagnosticsdialog.h"
+#include "skymapdialog.h"
+#include "tagdetailscache.h"
 
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QMainWindow>
 #include <QThread>
 #include <QItemSelection>
 #include <QLabel>
+#include <QSet>
+#include <QTimer>
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -64,36 +69,24 @@ public slots:
     void searchFolderRemoved(const QString folder);
 
 signals:
-    void crawl(QString rootFolder);
-    void deleteAstrofilesInFolder(const QString fullPath);
-    void dbAddOrUpdateAstroFile(const AstroFile& astroFile);
-    void dbAddTags(const AstroFile& astroFile);
-    void dbAddThumbnail(const AstroFile& astroFile, const QImage& image);
-    void dbUpdateProcessStatus(const AstroFile& astroFile);
-    void initializeFileRepository();
-    void loadModelFromDb();
-    void loadModelIntoViewModel(const QList<AstroFile> &files);
-    void resetModel();
-    void dbGetDuplicates();
-
-    void extractTags(const AstroFile& astroFile);
-    void extractThumbnail(const AstroFile& astroFile);
-    void processNewFile(const QFileInfo& fileInfo);
-
-    void catalogAddAstroFile(const AstroFile &file);
-    void catalogAddAstroFiles(const QList<AstroFile> &files);
+    void processingPriorityHints(const QStringList& visiblePaths, const QStringList& filteredOutPaths);
 
 private slots:
     void on_imageSizeSlider_valueChanged(int value);
+    void on_sortComboBox_currentIndexChanged(int index);
+    void on_groupCheckBox_toggled(bool checked);
     void on_actionFolders_triggered();
-    void handleSelectionChanged(QItemSelection selection);
-    void modelLoadedFromDb(const QList<AstroFile> &files);
-
-    void astroFileProcessed(const AstroFile& astroFile);
-    void processingCancelled(const QFileInfo& fileInfo);
-    void processQueued(const QFileInfo &fileInfo);
+    void on_actionRetryFailedFiles_triggered();
+    void on_actionFindMissingFiles_triggered();
+    void reconciled(const QStringList& missing, bool removed);
+    void updateDaemonStatus();
+    void handleSelectionChanged(const QItemSelection& selection, const QItemSelection& deselection);
+    void modelLoadedFromDb();
+    void activeJobsChanged(int activeJobs);
 
     void on_actionAbout_triggered();
+    void on_actionDiagnostics_triggered();
+    void on_actionSkyMap_triggered();
     void setWatermark(bool shoudSet);
 
     void rowsAddedToModel(const QModelIndex &parent, int first, int last);
@@ -104,36 +97,50 @@ private slots:
     void itemContextMenuRequested(const QPoint &pos);
 
     void reveal();
+    void exportSelection();
+    void editKeywords();
+    void headersEdited(int edited, const QStringList& failures);
     void remove();
+    void openPreview(const QModelIndex& index);
+    void blink();
+    void stackSelection();
+    void exportContactSheet();
+    void findMatchingCalibration();
+    void search(const QString& text);
+    void searchFinished(int generation, const QVector<int>& ids);
+    void tagDetailsReady(int id, const QMap<QString, QString>& tags);
     void on_duplicatesButton_clicked();
+    void openSmartCollection(const QString& name);
+    void saveSmartCollection(const QString& name, const QString& expression);
+    void deleteSmartCollection(const QString& name);
+    void updateSmartCollections();
 
     void dbFailedToOpen(const QString message);
-    void dbAstroFileUpdated(const AstroFile& astroFile);
+    void updateProcessingPriorityHints();
+    void updateThumbnailPrefetch();
 //    void dbAstroFileDeleted(const AstroFile& astroFile);
 
 private:
+    // Scripts the views, see GuiBenchmark
+    friend class GuiBenchmark;
+
     Ui::MainWindow *ui;
     bool isInitialized;
 
-    QThread* folderCrawlerThread;
-    FolderCrawler* folderCrawlerWorker;
-
-    QThread* fileRepositoryThread;
-    FileRepository* fileRepositoryWorker;
-
-    QThread* newFileProcessorThread;
-    NewFileProcessor* newFileProcessorWorker;
+    IndexingEngine* engine;
+    Catalog* catalog;
 
     FileViewModel* fileViewModel;
     SortFilterProxyModel* sortFilterProxyModel;
+    GroupedFileModel* groupedFileModel = nullptr; // Made when the view is first grouped
 
     SearchFolderDialog searchFolderDialog;
     FilterView* filterView;
 
     QImage makeThumbnail(const QImage& image);
-    void cleanUpWorker(QThread* thread);
     void clearDetailLabels();
-    void crawlAllSearchFolders();
+    void updateSelectionLabel();
+    void showKeywords(const QMap<QString, QString>& tags);
     QList<QString> getSearchFolders();
 
     bool shouldShowWatermark = true;
@@ -143,7 +150,12 @@ private:
     int numberOfItems = 0;
     int numberOfVisibleItems = 0;
     int numberOfSelectedItems = 0;
-    int numberOfActiveJobs = 0;
+    SelectionStats selectionStats;
+
+    // From the constructor to the first rows shown, and to every row of the db loaded
+    QElapsedTimer startupTimer;
+    bool startupRowsShown = false;
+    bool startupLoaded = false;
 
     QLabel numberOfItemsLabel;
     QLabel numberOfVisibleItemsLabel;
@@ -151,15 +163,47 @@ private:
     QLabel numberOfActiveJobsLabel;
 
     QAction *revealAct;
+    QAction *exportAct;
+    QAction *editKeywordsAct;
+    QAction *calibrationAct;
+    QAction *blinkAct;
+    QAction *stackAct;
+    QAction *contactSheetAct;
+    // Of the last search, the results of older ones are dropped
+    int searchGeneration = 0;
     QAction *removeAct;
     void createActions();
 
-    QThread* catalogThread;
-    Catalog* catalog;
-    FileProcessFilter* fileFilter;
-
     ThumbnailCache thumbnailCache;
+    TagDetailsCache* tagDetailsCache;
+    DetailPrefetcher* detailPrefetcher;
+    // The file shown in the details, 0 when there is none
+    int detailsId = 0;
     ModelLoadingDialog* loading;
+    DiagnosticsDialog* diagnosticsDialog = nullptr;
+    SkyMapDialog* skyMapDialog = nullptr;
+
+    // Tells the processor which files the user is looking at
+    QTimer priorityHintsTimer;
+    // Sums the integration time of the rows shown, see SortFilterProxyModel::integrationStats
+    QTimer integrationStatsTimer;
+    // Reads the counts of the smart collections, see Catalog::smartCollectionCounts
+    QTimer smartCollectionsTimer;
+    // Empty when no collection is open
+    QString openCollection;
+    int openCollectionCount = -1;
+    bool filteredOutHintsStale = true;
+    QStringList filteredOutHints;
+    int lastScrollValue = 0;
+    // The ids of the rows in the viewport, which keep their tiny thumbnails
+    QSet<int> visibleIds;
+
+    QTimer memoryCheckTimer;
+    int tinyThumbnailsBudgetId;
+
+    // Attached to the indexing daemon that goes on with an ingest, see IndexingService
+    bool isAttachedToDaemon = false;
+    QTimer daemonStatusTimer;
 
 protected:
     void resizeEvent(QResizeEvent *event);
@@ -0,0 +1,120 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "memorybudget.h"
+#include "metrics.h"
+
+#include <QSettings>
+
+#include <algorithm>
+
+#define DEFAULT_MEMORY_BUDGET_MB 1024
+
+MemoryBudget::MemoryBudget()
+{
+    budgetBytes = QSettings().value("MemoryBudgetMB", DEFAULT_MEMORY_BUDGET_MB).toLongLong() * 1024 * 1024;
+}
+
+MemoryBudget& MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+int MemoryBudget::add(const QString &name, EvictionOrder order, std::function<qint64 ()> usage, std::function<qint64 (qint64)> evict)
+{
+    MemoryBudget& budget = instance();
+    QMutexLocker locker(&budget.mutex);
+    const int id = budget.nextId++;
+    budget.consumers.insert(id, {name, evict ? order : NoEviction, usage, evict});
+    return id;
+}
+
+void MemoryBudget::remove(int id)
+{
+    MemoryBudget& budget = instance();
+    QMutexLocker locker(&budget.mutex);
+    budget.consumers.remove(id);
+}
+
+qint64 MemoryBudget::budget()
+{
+    MemoryBudget& budget = instance();
+    QMutexLocker locker(&budget.mutex);
+    return budget.budgetBytes;
+}
+
+void MemoryBudget::setBudget(qint64 bytes)
+{
+    MemoryBudget& budget = instance();
+    QMutexLocker locker(&budget.mutex);
+    budget.budgetBytes = bytes;
+}
+
+QList<MemoryBudget::Usage> MemoryBudget::usage()
+{
+    MemoryBudget& budget = instance();
+    QMutexLocker locker(&budget.mutex);
+    QList<Usage> usages;
+    for (auto& consumer : budget.consumers)
+        usages.append({consumer.name, consumer.usage(), consumer.order != NoEviction});
+    return usages;
+}
+
+/*!
+ * \brief MemoryBudget::check
+ * Asks the consumers for the bytes over the budget, in their EvictionOrder, until
+ * none is left over. What one consumer cannot free is asked from the next one.
+ */
+qint64 MemoryBudget::check()
+{
+    static std::atomic<qint64>& evictedBytes = Metrics::counter("memory.evicted_bytes");
+
+    MemoryBudget& budget = instance();
+    QMutexLocker locker(&budget.mutex);
+
+    qint64 total = 0;
+    QList<Consumer*> evictable;
+    for (auto& consumer : budget.consumers)
+    {
+        total += consumer.usage();
+        if (consumer.order != NoEviction)
+            evictable.append(&consumer);
+    }
+    if (total <= budget.budgetBytes)
+        return 0;
+
+    std::stable_sort(evictable.begin(), evictable.end(), [](const Consumer* a, const Consumer* b) { return a->order < b->order; });
+
+    qint64 freed = 0;
+    for (auto consumer : evictable)
+    {
+        const qint64 over = total - freed - budget.budgetBytes;
+        if (over <= 0)
+            break;
+        freed += consumer->evict(over);
+    }
+    evictedBytes += freed;
+    return freed;
+}
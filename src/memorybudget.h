@@ -0,0 +1,93 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+
+#include <functional>
+
+/*!
+ * \brief The MemoryBudget class
+ * The caches and pools register the bytes they hold, and how to give some of them
+ * back. check() evicts from them, lowest EvictionOrder first, until the total is
+ * within the budget, the MemoryBudgetMB setting.
+ *
+ * Thread safe. The evict functions run on the thread calling check(), which is the
+ * GUI thread in the app, so they have to be safe to call from it.
+ */
+class MemoryBudget
+{
+public:
+    // In the order they are evicted from
+    enum EvictionOrder
+    {
+        ThumbnailEviction = 0,
+        TinyThumbnailEviction = 1,
+        FrameBufferEviction = 2,
+        // Only accounted
+        NoEviction = 100
+    };
+
+    struct Usage
+    {
+        QString name;
+        qint64 bytes;
+        bool evictable;
+    };
+
+    // usage returns the bytes held. evict frees about the bytes it is given, and
+    // returns the bytes it freed. Returns the id to remove the consumer with.
+    static int add(const QString& name, EvictionOrder order, std::function<qint64()> usage, std::function<qint64(qint64)> evict = {});
+    static void remove(int id);
+
+    static qint64 budget();
+    static void setBudget(qint64 bytes);
+    static QList<Usage> usage();
+    // Evicts until the total is within the budget. Returns the bytes freed.
+    static qint64 check();
+
+private:
+    struct Consumer
+    {
+        QString name;
+        EvictionOrder order;
+        std::function<qint64()> usage;
+        std::function<qint64(qint64)> evict;
+    };
+
+    MemoryBudget();
+    static MemoryBudget& instance();
+
+    QMutex mutex;
+    qint64 budgetBytes;
+    int nextId = 1;
+    QMap<int, Consumer> consumers;
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,459 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "metrics.h"
+#include "allocationtracker.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QThread>
+#include <QVector>
+
+#include <mutex>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#if defined(Q_OS_MAC)
+#include <mach/mach.h>
+#endif
+
+// Events kept per thread while tracing, the oldest are overwritten
+#define TRACE_BUFFER_EVENTS 65536
+
+int LatencyHistogram::bucketOf(qint64 micros)
+{
+    if (micros < LATENCY_HISTOGRAM_SUB_BUCKETS)
+        return int(qMax<qint64>(0, micros));
+
+    int msb = 63 - qCountLeadingZeroBits(quint64(micros));
+    int sub = int(micros >> (msb - 3)) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+    return qMin((msb - 2) * LATENCY_HISTOGRAM_SUB_BUCKETS + sub, LATENCY_HISTOGRAM_BUCKETS - 1);
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int bucket)
+{
+    if (bucket < LATENCY_HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+
+    int msb = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS + 2;
+    int sub = bucket % LATENCY_HISTOGRAM_SUB_BUCKETS;
+    return ((qint64(LATENCY_HISTOGRAM_SUB_BUCKETS + sub + 1)) << (msb - 3)) - 1;
+}
+
+void LatencyHistogram::record(qint64 micros)
+{
+    buckets[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    recorded.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(micros, std::memory_order_relaxed);
+
+    qint64 current = largest.load(std::memory_order_relaxed);
+    while (micros > current && !largest.compare_exchange_weak(current, micros, std::memory_order_relaxed))
+        ;
+}
+
+qint64 LatencyHistogram::percentile(double quantile) const
+{
+    // Read while other threads record, so the buckets may be a few records ahead of count
+    qint64 target = qint64(quantile * count());
+    qint64 seen = 0;
+    for (int bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += buckets[bucket].load(std::memory_order_relaxed);
+        if (seen > target)
+            return qMin(bucketUpperBound(bucket), max());
+    }
+    return max();
+}
+
+QVector<qint64> LatencyHistogram::bucketCounts() const
+{
+    QVector<qint64> counts(LATENCY_HISTOGRAM_BUCKETS);
+    for (int bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; bucket++)
+        counts[bucket] = buckets[bucket].load(std::memory_order_relaxed);
+    return counts;
+}
+
+QJsonObject LatencyHistogram::summaryOf(const QVector<qint64> &bucketCounts, qint64 sum)
+{
+    qint64 count = 0;
+    int last = 0;
+    for (int bucket = 0; bucket < bucketCounts.count(); bucket++)
+    {
+        count += bucketCounts.at(bucket);
+        if (bucketCounts.at(bucket) > 0)
+            last = bucket;
+    }
+
+    auto percentileOf = [&](double quantile) {
+        qint64 target = qint64(quantile * count);
+        qint64 seen = 0;
+        for (int bucket = 0; bucket < bucketCounts.count(); bucket++)
+        {
+            seen += bucketCounts.at(bucket);
+            if (seen > target)
+                return bucketUpperBound(bucket);
+        }
+        return bucketUpperBound(last);
+    };
+
+    QJsonObject summary;
+    summary.insert("count", count);
+    summary.insert("total_us", sum);
+    summary.insert("mean_us", count > 0 ? sum / count : 0);
+    summary.insert("p50_us", percentileOf(0.5));
+    summary.insert("p90_us", percentileOf(0.9));
+    summary.insert("p99_us", percentileOf(0.99));
+    summary.insert("max_us", count > 0 ? bucketUpperBound(last) : 0);
+    return summary;
+}
+
+Metrics::Metrics()
+{
+}
+
+Metrics &Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+std::atomic<qint64> &Metrics::counter(const QString &name)
+{
+    Metrics& metrics = instance();
+    QMutexLocker locker(&metrics.mutex);
+    auto& value = metrics.counters[name];
+    if (value == nullptr)
+        value = new std::atomic<qint64>(0);
+    return *value;
+}
+
+LatencyHistogram &Metrics::histogram(const QString &name)
+{
+    Metrics& metrics = instance();
+    QMutexLocker locker(&metrics.mutex);
+    auto& value = metrics.histograms[name];
+    if (value == nullptr)
+        value = new LatencyHistogram(name);
+    return *value;
+}
+
+QJsonObject Metrics::toJson()
+{
+    Metrics& metrics = instance();
+    QMutexLocker locker(&metrics.mutex);
+
+    QJsonObject counters;
+    for (auto iter = metrics.counters.constBegin(); iter != metrics.counters.constEnd(); ++iter)
+        counters.insert(iter.key(), iter.value()->load(std::memory_order_relaxed));
+
+    QJsonObject histograms;
+    for (auto iter = metrics.histograms.constBegin(); iter != metrics.histograms.constEnd(); ++iter)
+    {
+        const LatencyHistogram* histogram = iter.value();
+        const qint64 count = histogram->count();
+        QJsonObject summary;
+        summary.insert("count", count);
+        summary.insert("mean_us", count > 0 ? histogram->sum() / count : 0);
+        summary.insert("p50_us", histogram->percentile(0.5));
+        summary.insert("p90_us", histogram->percentile(0.9));
+        summary.insert("p99_us", histogram->percentile(0.99));
+        summary.insert("max_us", histogram->max());
+        histograms.insert(iter.key(), summary);
+    }
+
+    QJsonObject json;
+    json.insert("counters", counters);
+    json.insert("histograms", histograms);
+    if (AllocationTracker::isEnabled())
+        json.insert("allocations", AllocationTracker::toJson());
+    return json;
+}
+
+MetricsSnapshot Metrics::snapshot()
+{
+    Metrics& metrics = instance();
+    QMutexLocker locker(&metrics.mutex);
+
+    MetricsSnapshot snapshot;
+    for (auto iter = metrics.counters.constBegin(); iter != metrics.counters.constEnd(); ++iter)
+        snapshot.counters.insert(iter.key(), iter.value()->load(std::memory_order_relaxed));
+    for (auto iter = metrics.histograms.constBegin(); iter != metrics.histograms.constEnd(); ++iter)
+    {
+        snapshot.bucketCounts.insert(iter.key(), iter.value()->bucketCounts());
+        snapshot.sums.insert(iter.key(), iter.value()->sum());
+    }
+    return snapshot;
+}
+
+/*!
+ * \brief Metrics::toJsonSince
+ * The percentiles are of the difference of the buckets, so they are of the records
+ * since the snapshot only. Counters that are set rather than added to, like the
+ * ingest.peak_resident_bytes, come out as the change of their value.
+ */
+QJsonObject Metrics::toJsonSince(const MetricsSnapshot &since)
+{
+    const MetricsSnapshot now = snapshot();
+
+    QJsonObject counters;
+    for (auto iter = now.counters.constBegin(); iter != now.counters.constEnd(); ++iter)
+    {
+        qint64 change = iter.value() - since.counters.value(iter.key());
+        if (change != 0)
+            counters.insert(iter.key(), change);
+    }
+
+    QJsonObject histograms;
+    for (auto iter = now.bucketCounts.constBegin(); iter != now.bucketCounts.constEnd(); ++iter)
+    {
+        QVector<qint64> counts = iter.value();
+        const QVector<qint64> before = since.bucketCounts.value(iter.key());
+        bool changed = false;
+        for (int bucket = 0; bucket < counts.count(); bucket++)
+        {
+            if (bucket < before.count())
+                counts[bucket] -= before.at(bucket);
+            changed = changed || counts.at(bucket) > 0;
+        }
+        if (changed)
+            histograms.insert(iter.key(), LatencyHistogram::summaryOf(counts, now.sums.value(iter.key()) - since.sums.value(iter.key())));
+    }
+
+    QJsonObject json;
+    json.insert("counters", counters);
+    json.insert("histograms", histograms);
+    return json;
+}
+
+bool Metrics::writeJson(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "Failed to write the metrics to" << path << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(toJson()).toJson());
+    return true;
+}
+
+qint64 Metrics::peakResidentBytes()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(Q_OS_MAC)
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024LL;
+#endif
+#else
+    return 0;
+#endif
+}
+
+qint64 Metrics::residentBytes()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#elif defined(Q_OS_MAC)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0;
+    return info.resident_size;
+#elif defined(Q_OS_LINUX)
+    // The second field of statm is the resident pages
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.count() < 2)
+        return 0;
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+int Metrics::threadCount()
+{
+#if defined(Q_OS_WIN)
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE)
+        return 0;
+    int count = 0;
+    const DWORD processId = GetCurrentProcessId();
+    THREADENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+    for (BOOL found = Thread32First(snapshot, &entry); found; found = Thread32Next(snapshot, &entry))
+    {
+        if (entry.th32OwnerProcessID == processId)
+            count++;
+    }
+    CloseHandle(snapshot);
+    return count;
+#elif defined(Q_OS_MAC)
+    thread_act_array_t threads;
+    mach_msg_type_number_t count = 0;
+    if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS)
+        return 0;
+    for (mach_msg_type_number_t i = 0; i < count; i++)
+        mach_port_deallocate(mach_task_self(), threads[i]);
+    vm_deallocate(mach_task_self(), vm_address_t(threads), count * sizeof(thread_act_t));
+    return int(count);
+#elif defined(Q_OS_LINUX)
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly))
+        return 0;
+    for (const QByteArray& line : status.readAll().split('\n'))
+    {
+        if (line.startsWith("Threads:"))
+            return line.mid(8).trimmed().toInt();
+    }
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+struct TraceEvent
+{
+    const QString* name;
+    qint64 start;
+    qint64 duration;
+};
+
+struct TraceBuffer
+{
+    int threadId;
+    QString threadName;
+    QVector<TraceEvent> events;
+    quint64 written = 0;
+};
+
+std::atomic<bool> Tracing::enabled {false};
+static QString tracePath;
+static QMutex traceBuffersMutex;
+static QList<TraceBuffer*> traceBuffers; // Kept after their threads end, so their events are written
+static thread_local TraceBuffer* threadTraceBuffer = nullptr;
+
+static QElapsedTimer& traceClock()
+{
+    static QElapsedTimer clock;
+    static std::once_flag started;
+    std::call_once(started, []() { clock.start(); });
+    return clock;
+}
+
+qint64 Tracing::now()
+{
+    return traceClock().nsecsElapsed();
+}
+
+void Tracing::start(const QString &path)
+{
+    tracePath = path;
+    traceClock();
+    enabled = true;
+    qDebug() << "Tracing to" << path;
+}
+
+void Tracing::record(const QString &name, qint64 start, qint64 duration)
+{
+    TraceBuffer* buffer = threadTraceBuffer;
+    if (buffer == nullptr)
+    {
+        buffer = new TraceBuffer;
+        buffer->threadName = QThread::currentThread()->objectName();
+        buffer->events.resize(TRACE_BUFFER_EVENTS);
+        QMutexLocker locker(&traceBuffersMutex);
+        buffer->threadId = traceBuffers.count() + 1;
+        traceBuffers.append(buffer);
+        threadTraceBuffer = buffer;
+    }
+    buffer->events[buffer->written % TRACE_BUFFER_EVENTS] = {&name, start, duration};
+    buffer->written++;
+}
+
+bool Tracing::stop()
+{
+    if (!enabled.exchange(false))
+        return false;
+
+    QJsonArray events;
+    QMutexLocker locker(&traceBuffersMutex);
+    for (const TraceBuffer* buffer : traceBuffers)
+    {
+        QJsonObject threadName;
+        threadName.insert("name", "thread_name");
+        threadName.insert("ph", "M");
+        threadName.insert("pid", 1);
+        threadName.insert("tid", buffer->threadId);
+        QString name = buffer->threadName.isEmpty() ? QString("Thread %1").arg(buffer->threadId) : buffer->threadName;
+        threadName.insert("args", QJsonObject{{"name", name}});
+        events.append(threadName);
+
+        quint64 first = buffer->written > TRACE_BUFFER_EVENTS ? buffer->written - TRACE_BUFFER_EVENTS : 0;
+        for (quint64 i = first; i < buffer->written; i++)
+        {
+            const TraceEvent& event = buffer->events.at(i % TRACE_BUFFER_EVENTS);
+            QJsonObject json;
+            json.insert("name", *event.name);
+            json.insert("ph", "X");
+            json.insert("pid", 1);
+            json.insert("tid", buffer->threadId);
+            json.insert("ts", event.start / 1000.0);
+            json.insert("dur", event.duration / 1000.0);
+            events.append(json);
+        }
+    }
+
+    QFile file(tracePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "Failed to write the trace to" << tracePath << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(QJsonObject{{"traceEvents", events}}).toJson(QJsonDocument::Compact));
+    return true;
+}
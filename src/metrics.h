@@ -0,0 +1,166 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+
+// Log-linear buckets, 8 per power of two, so a value is off by at most 12.5%
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 8
+#define LATENCY_HISTOGRAM_BUCKETS 320
+
+/*!
+ * \brief The LatencyHistogram class
+ * Durations in microseconds, counted in buckets of roughly constant relative width
+ * like an HDR histogram. Recording is a few atomic adds, so any thread can record.
+ */
+class LatencyHistogram
+{
+public:
+    explicit LatencyHistogram(const QString& name) : histogramName(name) {}
+
+    const QString& name() const { return histogramName; }
+    void record(qint64 micros);
+
+    qint64 count() const { return recorded.load(std::memory_order_relaxed); }
+    qint64 sum() const { return total.load(std::memory_order_relaxed); }
+    qint64 max() const { return largest.load(std::memory_order_relaxed); }
+    // The upper bound of the bucket the quantile falls in, 0 <= quantile <= 1
+    qint64 percentile(double quantile) const;
+
+    QVector<qint64> bucketCounts() const;
+    // Count, total, mean and percentiles of the records counted in buckets, as
+    // Metrics::toJson has them. The max is the upper bound of the last bucket with records.
+    static QJsonObject summaryOf(const QVector<qint64>& bucketCounts, qint64 sum);
+
+private:
+    const QString histogramName;
+    std::atomic<qint64> buckets[LATENCY_HISTOGRAM_BUCKETS] = {};
+    std::atomic<qint64> recorded {0};
+    std::atomic<qint64> total {0};
+    std::atomic<qint64> largest {0};
+
+    static int bucketOf(qint64 micros);
+    static qint64 bucketUpperBound(int bucket);
+};
+
+// The counters and histograms at one moment, see Metrics::toJsonSince
+struct MetricsSnapshot
+{
+    QHash<QString, qint64> counters;
+    QHash<QString, QVector<qint64>> bucketCounts;
+    QHash<QString, qint64> sums;
+};
+
+/*!
+ * \brief The Metrics class
+ * Named counters and latency histograms of the processing pipeline. They are made on
+ * first use and kept for the life of the application, so the references they return
+ * can be kept in statics at the call sites, and recording takes no lock.
+ *
+ * Names are "stage.step", like "fits.read" or "repository.commit".
+ */
+class Metrics
+{
+public:
+    static std::atomic<qint64>& counter(const QString& name);
+    static LatencyHistogram& histogram(const QString& name);
+
+    static QJsonObject toJson();
+    static bool writeJson(const QString& path);
+    static MetricsSnapshot snapshot();
+    // Like toJson, of what was recorded since the snapshot. Counters and histograms that
+    // did not change are left out.
+    static QJsonObject toJsonSince(const MetricsSnapshot& since);
+
+    // The most memory the process had resident so far, 0 where it is not known
+    static qint64 peakResidentBytes();
+    // The memory the process has resident now, 0 where it is not known
+    static qint64 residentBytes();
+    // The threads of the process now, 0 where it is not known
+    static int threadCount();
+
+private:
+    Metrics();
+    static Metrics& instance();
+
+    QMutex mutex;
+    QHash<QString, std::atomic<qint64>*> counters;
+    QHash<QString, LatencyHistogram*> histograms;
+};
+
+/*!
+ * \brief The Tracing class
+ * Opt-in timeline of the same scopes the histograms measure. Each thread records into
+ * its own ring buffer, which keeps its last TRACE_BUFFER_EVENTS events, so recording
+ * takes no lock. stop writes them as a Chrome trace-event JSON file, which
+ * chrome://tracing and Perfetto open.
+ */
+class Tracing
+{
+public:
+    static void start(const QString& path);
+    // Call once the worker threads have stopped, their buffers are read without a lock
+    static bool stop();
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // Nanoseconds on the clock of the trace
+    static qint64 now();
+    static void record(const QString& name, qint64 start, qint64 duration);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+/*!
+ * \brief The ScopedLatency class
+ * Records the time from its construction to its destruction in a histogram, and in
+ * the trace when tracing.
+ */
+class ScopedLatency
+{
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram) : histogram(histogram), start(Tracing::now()) {}
+    ~ScopedLatency()
+    {
+        qint64 duration = Tracing::now() - start;
+        histogram.record(duration / 1000);
+        if (Tracing::isEnabled())
+            Tracing::record(histogram.name(), start, duration);
+    }
+
+private:
+    LatencyHistogram& histogram;
+    qint64 start;
+};
+
+#endif // METRICS_H
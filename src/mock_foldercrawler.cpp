@@ -24,6 +24,9 @@
 
 #include "mock_foldercrawler.h"
 
+// The files fabricated per crawl, ASTROCAT_MOCK_FILES overrides it
+#define MOCK_FILE_COUNT 100000
+
 Mock_FolderCrawler::Mock_FolderCrawler()
 {
 
@@ -33,13 +36,29 @@ void Mock_FolderCrawler::crawl(QString rootFolder)
 {
     qDebug()<<"In mock foldercrawler";
     int count = 0;
+    QVector<FileRecord> batch;
+    bool isSet = false;
+    int fileCount = qEnvironmentVariableIntValue("ASTROCAT_MOCK_FILES", &isSet);
+    if (!isSet)
+        fileCount = MOCK_FILE_COUNT;
 
-    while (count < 100000)
+    while (count < fileCount)
     {
         if (cancelSignaled)
             return;
-        QFileInfo fileInfo(rootFolder + "/some_dummy_file_" + QString::number(count) + ".fits");
-        emit fileFound(fileInfo);
+        FileRecord record;
+        record.FullPath = rootFolder + "/some_dummy_file_" + QString::number(count) + ".fits";
+        record.CanonicalDirectory = rootFolder;
+        batch.append(record);
+        if (batch.count() >= 256)
+        {
+            emit filesFound(batch);
+            batch.clear();
+        }
         count++;
     }
+    if (!batch.isEmpty())
+        emit filesFound(batch);
+    emit directoryManifestUpdated({}, {});
+    emit crawlFinished(rootFolder, {});
 }
@@ -23,13 +23,18 @@
 */
 
 #include "mock_newfileprocessor.h"
+#include "perceptualhash.h"
 
+#include <QDateTime>
 #include <QPainter>
 #include <QThread>
 
+// The time each file takes, ASTROCAT_MOCK_DELAY overrides it in milliseconds
+#define MOCK_PROCESSING_DELAY 50
+
 QImage makeImage(int num, bool isTiny)
 {
-    int size = isTiny ? 20 : 200;
+    int size = isTiny ? 20 : LARGEST_THUMBNAIL_SIZE;
 
     QImage image(QSize(size,size),QImage::Format_RGB32);
     QPainter painter(&image);
@@ -41,9 +46,9 @@ QImage makeImage(int num, bool isTiny)
     return image;
 }
 
-void Mock_NewFileProcessor::processNewFile(const QFileInfo &fileInfo)
+void Mock_NewFileProcessor::processNewFile(const FileRecord &record)
 {
-    if (cancelSignaled)
+    if (cancellationToken.isCanceled())
         return;
 
     // Let's put some back pressure. If we emit too fast, the Db won't be able
@@ -53,22 +58,32 @@ void Mock_NewFileProcessor::processNewFile(const QFileInfo &fileInfo)
     // then we will consume huge amounts of memory due to piling up emits with large
     // thumbnails in them. (Ex: if we implement parallel file processing, and the
     // files are on a fast disk, but the DB is on a slow or busy disk).
-    QThread::msleep(50);
+    bool isSet = false;
+    int delay = qEnvironmentVariableIntValue("ASTROCAT_MOCK_DELAY", &isSet);
+    QThread::msleep(isSet ? delay : MOCK_PROCESSING_DELAY);
 
     static int lastId = 1;
     QImage tiny = makeImage(lastId, true);
     QImage thum = makeImage(lastId, false);
 
-    AstroFile astroFile(fileInfo);
+    AstroFile astroFile(record);
     astroFile.processStatus = AstroFileProcessed;
-    astroFile.Tags.insert({{"OBJECT", "value1"}, {"INSTRUME", "value2"}});
+    // Spread over a few values, so the filters have groups to toggle
+    static const char* filters[] = {"L", "R", "G", "B", "Ha", "OIII", "SII"};
+    astroFile.Tags.insert({{"OBJECT", "M" + QString::number(lastId % 40 + 1)},
+                           {"INSTRUME", "Camera " + QString::number(lastId % 3 + 1)},
+                           {"FILTER", filters[lastId % 7]},
+                           {"EXPTIME", QString::number(60 * (lastId % 5 + 1))},
+                           {"DATE-OBS", QDateTime(QDate(2021, 1, 1).addDays(lastId / 200), QTime(22, 0), Qt::UTC).toString(Qt::ISODate)}});
     astroFile.tagStatus = TagExtracted;
     astroFile.thumbnail = thum;
     astroFile.tinyThumbnail = tiny;
     astroFile.ImageHash = "hash" + QString::number(lastId);
+    astroFile.PerceptualHash = PerceptualHash::ofImage(tiny);
+    astroFile.Placeholder = PlaceholderHash::ofImage(tiny);
 
     lastId++;
-    emit astrofileProcessed(astroFile);
+    deliverProcessed(std::move(astroFile));
 }
 
 void Mock_NewFileProcessor::setCatalog(Catalog *cat)
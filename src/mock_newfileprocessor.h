@@ -37,7 +37,7 @@ public:
 signals:
 
 public:
-    void processNewFile(const QFileInfo &fileInfo);
+    void processNewFile(const FileRecord &record);
 
     // NewFileProcessor interface
 public:
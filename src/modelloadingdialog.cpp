@@ -39,32 +39,33 @@ ModelLoadingDialog::~ModelLoadingDialog()
     delete ui;
 }
 
-void ModelLoadingDialog::modelLoadingFromDbGotAstrofiles()
+void ModelLoadingDialog::modelLoadingStarted(int totalCount)
 {
-    this->ui->statusLabel->setText("Loading Tags");
-    this->ui->progressBar->setValue(20);
+    this->ui->statusLabel->setText(QString("Loading %1 images").arg(totalCount));
+    this->ui->progressBar->setRange(0, totalCount);
+    this->ui->progressBar->setValue(0);
 }
 
-void ModelLoadingDialog::modelLoadingFromDbGotTag()
+void ModelLoadingDialog::modelLoadingProgress(int loadedCount, int totalCount)
 {
-    this->ui->statusLabel->setText("Loading Thumbnails");
-    this->ui->progressBar->setValue(40);
+    this->ui->statusLabel->setText(QString("Loaded %1 of %2 images").arg(loadedCount).arg(totalCount));
+    this->ui->progressBar->setValue(loadedCount);
 }
 
-void ModelLoadingDialog::modelLoadingFromDbGotThumbnails()
+void ModelLoadingDialog::migrationProgress(const QString &step, int migratedCount, int totalCount)
 {
-    this->ui->statusLabel->setText("Loaded Thumbnails");
-    this->ui->progressBar->setValue(60);
+    this->ui->statusLabel->setText(QString("Upgrading the catalog: %1 (%2 of %3)").arg(step).arg(migratedCount).arg(totalCount));
+    this->ui->progressBar->setRange(0, qMax(totalCount, 1));
+    this->ui->progressBar->setValue(migratedCount);
 }
 
 void ModelLoadingDialog::modelLoaded()
 {
     this->ui->statusLabel->setText("Drawing Thumbnails");
-    this->ui->progressBar->setValue(80);
 }
 
 void ModelLoadingDialog::closeWindow()
 {
-    this->ui->progressBar->setValue(100);
+    this->ui->progressBar->setValue(this->ui->progressBar->maximum());
     this->close();
 }
@@ -40,10 +40,10 @@ public:
     ~ModelLoadingDialog();
 
 public slots:
-    void modelLoadingFromDbGotAstrofiles();
-    void modelLoadingFromDbGotTag();
-    void modelLoadingFromDbGotThumbnails();
+    void modelLoadingStarted(int totalCount);
+    void modelLoadingProgress(int loadedCount, int totalCount);
     void modelLoaded();
+    void migrationProgress(const QString& step, int migratedCount, int totalCount);
     void closeWindow();
 
 private:
@@ -22,18 +22,101 @@
     SOFTWARE.
 */
 
+#include "asyncfileio.h"
+#include "fileformats.h"
 #include "fileprocessor.h"
 #include "imageprocessor.h"
 #include "xisfprocessor.h"
 #include "newfileprocessor.h"
+#include "rawprocessor.h"
+#include "sandboxedprocessor.h"
+#include "serprocessor.h"
 #include "fitsprocessor.h"
+#include "framebufferpool.h"
+#include "memorybudget.h"
+#include "metrics.h"
+#include "perceptualhash.h"
+#include "taskscheduler.h"
+#include "threadpriority.h"
+#include "volumeregistry.h"
 
-#include <QCryptographicHash>
-#include <QtConcurrent>
+#include <QDebug>
+#include <QSettings>
+#include <QThread>
+#include <QThreadStorage>
 
-NewFileProcessor::NewFileProcessor(QObject *parent) : QObject(parent)
+#include <memory>
+
+// Headers of every queued file are read before any pixels are decoded
+#define HEADER_PHASE_PRIORITY   1
+#define PIXEL_PHASE_PRIORITY    0
+
+// The header phases of up to HEADER_BATCH_SIZE files run as one task, which reads the
+// first HEADER_HEAD_SIZE bytes of all of them at once. All FITS and XISF headers we
+// have seen fit in it, see QUICK_HASH_HEAD_SIZE.
+#define HEADER_BATCH_SIZE       32
+#define HEADER_HEAD_SIZE        (64 * 1024)
+
+// The crawler is paused above MAX_QUEUED_FILES files in flight, and resumed
+// once the queue drained to RESUME_QUEUED_FILES.
+#define MAX_QUEUED_FILES        2000
+#define RESUME_QUEUED_FILES     1000
+
+// Files whose pixel phase is estimated at most SMALL_FILE_FRAME_BYTES, such as JPEG
+// exports, guide frames and planetary snapshots, are read and decoded back to back in
+// one pixel phase, up to PIXEL_BATCH_FILES and PIXEL_BATCH_BYTES of them, see takeSmallFiles
+#define SMALL_FILE_FRAME_BYTES  (8 * 1024 * 1024)
+#define PIXEL_BATCH_FILES       16
+#define PIXEL_BATCH_BYTES       (64 * 1024 * 1024)
+
+// Pixel phases only start while their estimated frame memory fits in this budget
+#define DEFAULT_PIXEL_MEMORY_BUDGET_MB  2048
+
+// Released frame buffers kept for the next files, as a fraction of the budget
+#define FRAME_BUFFER_POOL_BUDGET_DIVISOR    4
+
+// The reader threads tuned between these, starting from the first
+#define INITIAL_READER_THREADS  2
+#define MAX_READER_THREADS      8
+
+// Results waiting for the engine, past which the threads of the pools wait for it
+#define RESULT_QUEUE_CAPACITY   4096
+
+// The bytes of announced files kept until they are processed, see announceContents
+#define ANNOUNCED_CONTENTS_BUDGET_MB    512
+
+// Pixel phases in flight while the processor yields to the user, see setThrottled
+#define THROTTLED_PIXEL_PHASES  1
+
+// The decoding threads tuned between 1 and the workers of the TaskScheduler, from the
+// throughput of windows of at least TUNE_WINDOW_MSECS and TUNE_WINDOW_FILES files.
+// Changes of less than TUNE_THROUGHPUT_TOLERANCE are noise.
+#define TUNE_WINDOW_MSECS               2000
+#define TUNE_WINDOW_FILES               8
+#define TUNE_THROUGHPUT_TOLERANCE       0.05
+
+NewFileProcessor::NewFileProcessor(QObject *parent) : QObject(parent), results(RESULT_QUEUE_CAPACITY)
 {
     catalog = nullptr;
+
+    QSettings settings;
+    pixelMemoryBudget = settings.value("ProcessingMemoryBudgetMB", DEFAULT_PIXEL_MEMORY_BUDGET_MB).toLongLong() * 1024 * 1024;
+    FrameBufferPool::setCapacity(pixelMemoryBudget / FRAME_BUFFER_POOL_BUDGET_DIVISOR);
+    setReaderThreadCount(settings.value("ProcessingReaderThreads", 0).toInt());
+    sandboxed = settings.value("SandboxedDecoding", false).toBool();
+    updateFormatLimits();
+}
+
+NewFileProcessor::~NewFileProcessor()
+{
+    // A read starts a decode and a decode can start the next read, so the pools are
+    // waited for until neither has anything left
+    cancel();
+    do
+    {
+        readerPool.waitForDone();
+        threadPool.waitForDone();
+    } while (readerPool.activeThreadCount() > 0);
 }
 
 void NewFileProcessor::setCatalog(Catalog *cat)
@@ -41,114 +124,846 @@ void NewFileProcessor::setCatalog(Catalog *cat)
     this->catalog = cat;
 }
 
-void NewFileProcessor::processNewFile(const QFileInfo& fileInfo)
+void NewFileProcessor::setThreadCount(int threadCount)
+{
+    {
+        QMutexLocker locker(&queueMutex);
+        tuneDecoderThreads = threadCount <= 0;
+    }
+    threadPool.setMaxThreadCount(threadCount > 0 ? threadCount : TaskScheduler::instance().workerCount());
+    updateFormatLimits();
+}
+
+void NewFileProcessor::setReaderThreadCount(int threadCount)
+{
+    QMutexLocker locker(&queueMutex);
+    tuneReaderThreads = threadCount <= 0;
+    readerPool.setMaxThreadCount(tuneReaderThreads ? INITIAL_READER_THREADS : threadCount);
+}
+
+/*!
+ * \brief NewFileProcessor::updateFormatLimits
+ * The pixel phases in flight of each format, from reading the file to the end of the
+ * decode. FITS files, images and raws get two per decoding thread, so one can be read
+ * while the other is decoded. PCL decodes XISF files with threads of its own, so they
+ * only get half the decoding threads, unless each is decoded in a process of its own.
+ * SER videos read a few frames, and get one.
+ */
+void NewFileProcessor::updateFormatLimits()
+{
+    QSettings settings;
+    QMutexLocker locker(&queueMutex);
+    pixelPhaseSettings[formatIndex(AstroFileType::Fits)] = settings.value("MaxPixelPhasesFits", 0).toInt();
+    pixelPhaseSettings[formatIndex(AstroFileType::Xisf)] = settings.value("MaxPixelPhasesXisf", 0).toInt();
+    pixelPhaseSettings[formatIndex(AstroFileType::Image)] = settings.value("MaxPixelPhasesImage", 0).toInt();
+    pixelPhaseSettings[formatIndex(AstroFileType::Raw)] = settings.value("MaxPixelPhasesRaw", 0).toInt();
+    pixelPhaseSettings[formatIndex(AstroFileType::Ser)] = settings.value("MaxPixelPhasesSer", 0).toInt();
+    applyFormatLimits();
+}
+
+// From the decoding threads there are now. The caller must hold queueMutex.
+void NewFileProcessor::applyFormatLimits()
+{
+    const int decoders = threadPool.maxThreadCount();
+    auto limit = [this](AstroFileType type, int fallback)
+    {
+        const int value = pixelPhaseSettings[formatIndex(type)];
+        return value > 0 ? value : fallback;
+    };
+    pixelPhaseLimits[formatIndex(AstroFileType::Fits)] = limit(AstroFileType::Fits, 2 * decoders);
+    pixelPhaseLimits[formatIndex(AstroFileType::Xisf)] = limit(AstroFileType::Xisf, sandboxed ? 2 * decoders : qMax(1, decoders / 2));
+    pixelPhaseLimits[formatIndex(AstroFileType::Image)] = limit(AstroFileType::Image, 2 * decoders);
+    pixelPhaseLimits[formatIndex(AstroFileType::Raw)] = limit(AstroFileType::Raw, 2 * decoders);
+    pixelPhaseLimits[formatIndex(AstroFileType::Ser)] = limit(AstroFileType::Ser, decoders);
+}
+
+int NewFileProcessor::formatIndex(AstroFileType type)
+{
+    // Files of an unknown type fail in the header phase, and never get here
+    return type == AstroFileType::UnknownType ? int(AstroFileType::Fits) : int(type);
+}
+
+/*!
+ * \brief NewFileProcessor::readsWholeFile
+ * Whether the pixel phase reads the file with a FileReader. The processors of the
+ * others read the parts of the file they need themselves, see SerProcessor.
+ */
+bool NewFileProcessor::readsWholeFile(AstroFileType type)
+{
+    return type != AstroFileType::Ser;
+}
+
+void NewFileProcessor::setSandboxed(bool sandboxed)
+{
+    this->sandboxed = sandboxed;
+    QMutexLocker locker(&queueMutex);
+    applyFormatLimits();
+}
+
+void NewFileProcessor::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&queueMutex);
+    pixelMemoryBudget = bytes;
+    FrameBufferPool::setCapacity(pixelMemoryBudget / FRAME_BUFFER_POOL_BUDGET_DIVISOR);
+}
+
+/*!
+ * \brief NewFileProcessor::processNewFile
+ * Files are processed in two phases. The header phase only reads the tags, and
+ * delivers the file with processStatus still NeedsToBeProcessed, so it shows up
+ * in the grid and the filters right away. The pixel phase then makes the thumbnail
+ * and the hashes at a lower priority, and delivers the file again as
+ * AstroFileProcessed (or AstroFileFailedToProcess).
+ *
+ * The file waits for the next files of processNewFiles, and their header phases
+ * start together, see startHeaderBatch.
+ */
+void NewFileProcessor::processNewFile(const FileRecord& record)
 {
     Q_ASSERT(catalog != nullptr);
 
-    if (cancelSignaled)
+    if (cancellationToken.isCanceled())
     {
-        emit processingCancelled(fileInfo);
+        deliverCancelled(record.FullPath);
         return;
     }
 
-    QStorageInfo storageInfo = QStorageInfo(fileInfo.canonicalFilePath());
+    const QString volumeName = VolumeRegistry::nameOf(record.CanonicalDirectory);
 
-    QFuture<void> future = QtConcurrent::run(&threadPool, [=]() {
-        AstroFile astroFile(fileInfo);
-
-        if (!catalog->shouldProcessFile(fileInfo))
+    {
+        QMutexLocker locker(&queueMutex);
+        queuedFiles++;
+        if (!backpressureApplied && queuedFiles >= MAX_QUEUED_FILES)
         {
-            // This file is not in the catalog anymore.
-            emit processingCancelled(fileInfo);
-            return;
+            backpressureApplied = true;
+            emit backpressureChanged(true);
         }
+    }
+
+    headerBatch.append({record, volumeName});
+    if (!batchingHeaders || headerBatch.count() >= HEADER_BATCH_SIZE)
+        startHeaderBatch();
+}
 
-        FileProcessor* processor = getProcessorForFile(astroFile);
+/*!
+ * \brief NewFileProcessor::startHeaderBatch
+ * Starts the header phases of the files waiting in headerBatch as one task. The task
+ * reads the heads of the FITS and XISF files among them with one queue of reads,
+ * and the headers are then parsed from memory.
+ */
+void NewFileProcessor::startHeaderBatch()
+{
+    if (headerBatch.isEmpty())
+        return;
 
-        if (!processor->loadFile(astroFile))
+    threadPool.start([this, batch = std::move(headerBatch)]() {
+        static LatencyHistogram& headsLatency = Metrics::histogram("processor.read_heads");
+        QVector<AstroFile> astroFiles;
+        QStringList headPaths;
+        QVector<QByteArray> announcedHeads;
+        for (auto& header : batch)
         {
-            // This is an invalid file.
-            astroFile.processStatus = AstroFileFailedToProcess;
-            emit astrofileProcessed(astroFile);
-            return;
+            if (cancellationToken.isCanceled() || !catalog->shouldProcessFile(header.record))
+            {
+                // This file is not in the catalog anymore.
+                dropAnnouncedContents(header.record.FullPath);
+                deliverCancelled(header.record.FullPath);
+                finishFile();
+                continue;
+            }
+            AstroFile astroFile(header.record);
+            astroFile.VolumeName = header.volumeName;
+            // Images are read by QImageReader, which does not take a head. The others, and
+            // the files of no known suffix, have theirs read to pick the processor by,
+            // unless the file was announced with its bytes.
+            const bool readsHead = astroFile.FileType != AstroFileType::Image;
+            const QByteArray contents = readsHead ? announcedContentsOf(astroFile.FullPath) : QByteArray();
+            headPaths.append(readsHead && contents.isEmpty() ? astroFile.FullPath : QString());
+            announcedHeads.append(contents.left(HEADER_HEAD_SIZE));
+            astroFiles.append(std::move(astroFile));
         }
-        processor->extractTags();
 
-        auto tags = processor->getTags();
-        astroFile.Tags.swap(tags);
-        astroFile.tagStatus = TagExtracted;
+        QVector<QByteArray> heads;
+        {
+            ScopedLatency latency(headsLatency);
+            heads = AsyncFileIo::readHeads(headPaths, HEADER_HEAD_SIZE);
+        }
+        for (int i = 0; i < astroFiles.count(); i++)
+            processHeader(std::move(astroFiles[i]), announcedHeads.at(i).isEmpty() ? heads.at(i) : announcedHeads.at(i));
+    }, HEADER_PHASE_PRIORITY);
+    headerBatch.clear();
+}
+
+void NewFileProcessor::processHeader(AstroFile astroFile, const QByteArray& head)
+{
+    static LatencyHistogram& headerLatency = Metrics::histogram("processor.header");
+    ScopedLatency latency(headerLatency);
+    astroFile.thumbnailStatus = ThumbnailNotProcessedYet;
+    astroFile.tagStatus = TagNotProcessedYet;
+
+    // The signature wins over the suffix, a misnamed file goes to the decoder that reads it.
+    // A file that has a signature of the type of its suffix keeps it, a raw is also a TIFF.
+    const AstroFileType headType = FileFormats::hasSignatureOf(astroFile.FileType, head) ? astroFile.FileType : FileFormats::typeOfHead(head);
+    if (headType != AstroFileType::UnknownType && headType != astroFile.FileType)
+    {
+        static std::atomic<qint64>& misnamedCount = Metrics::counter("processor.misnamed");
+        misnamedCount++;
+        astroFile.FileType = headType;
+    }
+
+    FileProcessor* processor = getProcessorForFile(astroFile);
+    if (processor == nullptr || !processor->loadHeader(astroFile, head))
+    {
+        // This is an invalid file.
+        if (processor != nullptr)
+            processor->reset();
+        dropAnnouncedContents(astroFile.FullPath);
+        astroFile.processStatus = AstroFileFailedToProcess;
+        astroFile.FailureReason = processor == nullptr ? FailureUnsupportedType : FailureInvalidFile;
+        deliverProcessed(std::move(astroFile));
+        finishFile();
+        return;
+    }
+    processor->extractTags();
+    astroFile.Tags = TagMap(processor->getTags());
+    processor->reset();
+
+    astroFile.tagStatus = TagExtracted;
+    astroFile.processStatus = NeedsToBeProcessed;
+    deliverProcessed(astroFile);
 
-        processor->extractThumbnail();
-        auto thumbnail = processor->getThumbnail();
-        astroFile.thumbnail = thumbnail;
-        astroFile.tinyThumbnail = processor->getTinyThumbnail();
-        astroFile.thumbnailStatus = ThumbnailLoaded;
+    enqueuePixels(std::move(astroFile));
+}
+
+void NewFileProcessor::enqueuePixels(AstroFile astroFile)
+{
+    VolumeIo* volume = VolumeIo::ofDirectory(astroFile.DirectoryPath);
+    QMutexLocker locker(&queueMutex);
+    pixelQueue.append({std::move(astroFile), volume});
+    startPixelTasks();
+}
+
+void NewFileProcessor::setPriorityHints(const QStringList &visiblePaths, const QStringList &filteredOutPaths)
+{
+    QMutexLocker locker(&queueMutex);
+    visibleHints = QSet<QString>(visiblePaths.begin(), visiblePaths.end());
+    filteredOutHints = QSet<QString>(filteredOutPaths.begin(), filteredOutPaths.end());
+}
+
+/*!
+ * \brief NewFileProcessor::deliverProcessed
+ * Pushes the result into the ring, and signals the engine when it is the first one
+ * since its last takeResults, so a burst of results costs one queued call.
+ */
+void NewFileProcessor::deliverProcessed(AstroFile astroFile)
+{
+    deliver({std::move(astroFile), false});
+}
+
+void NewFileProcessor::deliverCancelled(const QString &fullPath)
+{
+    ProcessingResult result;
+    result.astroFile.FullPath = fullPath;
+    result.cancelled = true;
+    deliver(std::move(result));
+}
 
-        QString hash = getFileHash(fileInfo).toHex();
-        astroFile.FileHash = hash;
+// A full ring waits for the engine, unless the processor is cancelled and nobody may take them
+void NewFileProcessor::deliver(ProcessingResult&& result)
+{
+    while (!results.tryPush(std::move(result)))
+    {
+        if (cancellationToken.isCanceled())
+            return;
+        QThread::yieldCurrentThread();
+    }
+    if (!resultsSignaled.exchange(true))
+        emit resultsReady();
+}
 
-        QString imageHash = processor->getImageHash().toHex();
-        astroFile.ImageHash = imageHash;
-        delete processor;
-        astroFile.processStatus = AstroFileProcessed;
+void NewFileProcessor::takeResults(QVector<ProcessingResult> &taken)
+{
+    // Cleared first, a result pushed after this signals again
+    resultsSignaled = false;
+    ProcessingResult result;
+    while (results.tryPop(result))
+        taken.append(std::move(result));
+}
 
-        astroFile.VolumeName = storageInfo.name();
+void NewFileProcessor::setBackgroundPriority(bool background)
+{
+    backgroundPriority = background;
+    threadPool.setBackground(background);
+}
 
-        emit astrofileProcessed(astroFile);
-    });
+void NewFileProcessor::setThrottled(bool throttled)
+{
+    QMutexLocker locker(&queueMutex);
+    if (this->throttled == throttled)
+        return;
+    this->throttled = throttled;
+    // Lifted, the cap grows back as the pixel phases in flight finish
+    if (throttled)
+        pixelPhaseCap = THROTTLED_PIXEL_PHASES;
 }
 
-QByteArray fileChecksum(const QString &fileName, QCryptographicHash::Algorithm hashAlgorithm)
+/*!
+ * \brief NewFileProcessor::applyThreadPriority
+ * Called by the reads as they start, so each reader thread takes the priority set by
+ * setBackgroundPriority before it does any work. The scheduler applies it to the decoding.
+ */
+void NewFileProcessor::applyThreadPriority()
 {
-    QFile sourceFile(fileName);
-    qint64 fileSize = sourceFile.size();
-    const qint64 bufferSize = 10240;
+    static thread_local int appliedPriority = -1;
+    const int priority = backgroundPriority ? 1 : 0;
+    if (priority == appliedPriority)
+        return;
+    if (!ThreadPriority::setBackground(priority == 1))
+        qDebug() << "Could not change the priority of a processing thread";
+    appliedPriority = priority;
+}
 
-    if (sourceFile.open(QIODevice::ReadOnly))
+/*!
+ * \brief NewFileProcessor::nextPixelTaskIndex
+ * Visible files first, then the backlog in the order it was queued, and files
+ * hidden by the filter last. Files of a format at its limit wait, and so do
+ * files of a volume reading as many files as its policy allows, while files
+ * of other volumes go ahead. Returns -1 when none can start. The caller must hold queueMutex.
+ */
+int NewFileProcessor::nextPixelTaskIndex() const
+{
+    if (pixelPhaseCap > 0)
     {
-        char buffer[bufferSize];
-        int bytesRead;
-        int readSize = qMin(fileSize, bufferSize);
+        int inFlight = 0;
+        for (int format = 0; format < PROCESSING_FORMAT_COUNT; format++)
+            inFlight += pixelPhasesInFlight[format];
+        if (inFlight >= pixelPhaseCap)
+            return -1;
+    }
 
-        QCryptographicHash hash(hashAlgorithm);
-        while (readSize > 0 && (bytesRead = sourceFile.read(buffer, readSize)) > 0)
+    int firstFilteredOut = -1;
+    int firstBacklog = -1;
+    for (int i = 0; i < pixelQueue.count(); i++)
+    {
+        const PixelTask& task = pixelQueue.at(i);
+        const int format = formatIndex(task.astroFile.FileType);
+        if (pixelPhasesInFlight[format] >= pixelPhaseLimits[format])
+            continue;
+        const int maxReads = task.volume->policy().maxConcurrentReads;
+        if (maxReads > 0 && readsInFlight.value(task.volume) >= maxReads)
+            continue;
+        const QString& path = task.astroFile.FullPath;
+        if (visibleHints.contains(path))
+            return i;
+        if (filteredOutHints.contains(path))
         {
-            fileSize -= bytesRead;
-            hash.addData(buffer, bytesRead);
-            readSize = qMin(fileSize, bufferSize);
+            if (firstFilteredOut == -1)
+                firstFilteredOut = i;
         }
+        else if (firstBacklog == -1)
+        {
+            firstBacklog = i;
+            // Nothing can be promoted ahead of the backlog
+            if (visibleHints.isEmpty())
+                return i;
+        }
+    }
+    return firstBacklog != -1 ? firstBacklog : firstFilteredOut;
+}
 
-        sourceFile.close();
-        return hash.result();
+/*!
+ * \brief NewFileProcessor::startPixelTasks
+ * Starts as many queued pixel phases as the memory budget and the limits of the
+ * formats allow. A single frame larger than the whole budget still runs, but alone.
+ * A pixel phase is read on the reader pool first, see readPixels. A small file takes
+ * other small files along into its pixel phase, see takeSmallFiles.
+ * The caller must hold queueMutex.
+ */
+void NewFileProcessor::startPixelTasks()
+{
+    while (!pixelQueue.isEmpty())
+    {
+        int index = nextPixelTaskIndex();
+        if (index == -1)
+            return;
+        qint64 frameBytes = estimateFrameBytes(pixelQueue.at(index).astroFile);
+        if (pixelBytesInFlight > 0 && pixelBytesInFlight + frameBytes > pixelMemoryBudget)
+        {
+            tuneWindowMemoryBound = true;
+            return;
+        }
+
+        PixelTask task = pixelQueue.takeAt(index);
+        QVector<AstroFile> astroFiles = {std::move(task.astroFile)};
+        if (frameBytes <= SMALL_FILE_FRAME_BYTES)
+            takeSmallFiles(astroFiles, task.volume, frameBytes);
+        pixelBytesInFlight += frameBytes;
+        pixelPhasesInFlight[formatIndex(astroFiles.first().FileType)]++;
+        if (task.volume->policy().maxConcurrentReads > 0)
+            readsInFlight[task.volume]++;
+        readerPool.start([this, astroFiles = std::move(astroFiles), volume = task.volume, frameBytes]() mutable {
+            applyThreadPriority();
+            readPixels(std::move(astroFiles), volume, frameBytes);
+        });
     }
-    return QByteArray();
 }
 
-QByteArray NewFileProcessor::getFileHash(const QFileInfo &fileInfo)
+/*!
+ * \brief NewFileProcessor::takeSmallFiles
+ * Takes the small files of the same format and volume as the ones in astroFiles out of
+ * the queue, in the order they were queued, and adds their frame memory to frameBytes.
+ * They then cost one task on each pool, one pass of the bookkeeping and one wake of
+ * the engine, instead of one each, and the processors and frame buffers of the thread
+ * stay warm from one to the next.
+ *
+ * The batch is only as large as it takes to keep every decoding thread busy, so a few
+ * files still decode in parallel. Files hidden by the filter wait for their turn.
+ * The caller must hold queueMutex.
+ */
+void NewFileProcessor::takeSmallFiles(QVector<AstroFile> &astroFiles, VolumeIo *volume, qint64 &frameBytes)
 {
-    return fileChecksum(fileInfo.absoluteFilePath(), QCryptographicHash::Sha1);
+    static std::atomic<qint64>& batchedCount = Metrics::counter("processor.batched_files");
+    const int format = formatIndex(astroFiles.first().FileType);
+    const int batchFiles = qMin(PIXEL_BATCH_FILES, 1 + int(pixelQueue.count() / qMax(1, threadPool.maxThreadCount())));
+    for (int i = 0; i < pixelQueue.count() && astroFiles.count() < batchFiles; )
+    {
+        const PixelTask& task = pixelQueue.at(i);
+        const qint64 bytes = task.volume == volume && formatIndex(task.astroFile.FileType) == format && !filteredOutHints.contains(task.astroFile.FullPath)
+                ? estimateFrameBytes(task.astroFile) : 0;
+        if (bytes <= 0 || bytes > SMALL_FILE_FRAME_BYTES || frameBytes + bytes > PIXEL_BATCH_BYTES
+                || pixelBytesInFlight + frameBytes + bytes > pixelMemoryBudget)
+        {
+            i++;
+            continue;
+        }
+        astroFiles.append(std::move(pixelQueue[i].astroFile));
+        pixelQueue.removeAt(i);
+        frameBytes += bytes;
+        batchedCount++;
+    }
 }
 
-void NewFileProcessor::cancel()
+/*!
+ * \brief NewFileProcessor::readPixels
+ * The I/O half of a pixel phase: opens the files and reads them in the way of their
+ * volume, one after the other, then queues their decode on the decoding threads with
+ * the readers.
+ */
+void NewFileProcessor::readPixels(QVector<AstroFile> astroFiles, VolumeIo* volume, qint64 frameBytes)
+{
+    QVector<std::shared_ptr<FileReader>> readers;
+    QVector<bool> opened;
+    for (auto& astroFile : astroFiles)
+    {
+        readers.append(std::make_shared<FileReader>());
+        opened.append(readFile(astroFile, volume, *readers.last()));
+    }
+
+    QMutexLocker locker(&queueMutex);
+    decodesWaiting++;
+    tuneReaders();
+    if (volume->policy().maxConcurrentReads > 0)
+    {
+        // The volume can read the next file while this one decodes
+        readsInFlight[volume]--;
+        startPixelTasks();
+    }
+    locker.unlock();
+
+    threadPool.start([this, astroFiles = std::move(astroFiles), readers = std::move(readers), opened = std::move(opened), frameBytes]() mutable {
+        const int format = formatIndex(astroFiles.first().FileType);
+        const int files = astroFiles.count();
+        {
+            QMutexLocker locker(&queueMutex);
+            decodesWaiting--;
+        }
+        for (int i = 0; i < files; i++)
+        {
+            processPixels(std::move(astroFiles[i]), *readers.at(i), opened.at(i));
+            // The bytes of the file go as soon as it is done
+            readers[i].reset();
+        }
+
+        QMutexLocker locker(&queueMutex);
+        pixelBytesInFlight -= frameBytes;
+        pixelPhasesInFlight[format]--;
+        if (!throttled && pixelPhaseCap > 0)
+        {
+            int limit = 0;
+            for (int i = 0; i < PROCESSING_FORMAT_COUNT; i++)
+                limit += pixelPhaseLimits[i];
+            if (++pixelPhaseCap >= limit)
+                pixelPhaseCap = 0;
+        }
+        tuneDecoders(files, frameBytes);
+        startPixelTasks();
+        locker.unlock();
+        finishFile(files);
+    }, PIXEL_PHASE_PRIORITY);
+}
+
+// The file is not opened when it was canceled or its search folder removed
+bool NewFileProcessor::readFile(const AstroFile &astroFile, VolumeIo *volume, FileReader &reader)
+{
+    static LatencyHistogram& readLatency = Metrics::histogram("processor.read");
+    bool opened = false;
+    const QByteArray contents = announcedContentsOf(astroFile.FullPath);
+    dropAnnouncedContents(astroFile.FullPath);
+    if (!cancellationToken.isCanceled() && catalog->isInSearchFolders(astroFile.FullPath))
+    {
+        ScopedLatency latency(readLatency);
+        // The processor, or the helper of a sandboxed one, reads the file as it decodes
+        if (!readsWholeFile(astroFile.FileType) || sandboxed)
+            opened = QFile::exists(astroFile.FullPath);
+        else if (!contents.isEmpty())
+            opened = reader.openContents(astroFile.FullPath, contents);
+        else
+        {
+            opened = reader.open(astroFile.FullPath, volume);
+            if (opened)
+                reader.prefetch(cancellationToken);
+        }
+    }
+    return opened;
+}
+
+/*!
+ * \brief NewFileProcessor::tuneReaders
+ * Called as each read is done. A decoding thread with nothing read for it gets
+ * another reader, and more read files waiting than there are decoding threads give
+ * one back. The caller must hold queueMutex.
+ */
+void NewFileProcessor::tuneReaders()
+{
+    if (!tuneReaderThreads)
+        return;
+
+    const int readers = readerPool.maxThreadCount();
+    const int decoders = threadPool.maxThreadCount();
+    if (decodesWaiting <= 1 && threadPool.activeThreadCount() < decoders && readers < MAX_READER_THREADS)
+        readerPool.setMaxThreadCount(readers + 1);
+    else if (decodesWaiting > decoders && readers > 1)
+        readerPool.setMaxThreadCount(readers - 1);
+}
+
+/*!
+ * \brief NewFileProcessor::tuneDecoders
+ * Called as each pixel phase is done. Climbs the throughput of the decoding threads,
+ * one thread at a time: a step that made more bytes per second is taken again, one
+ * that made less is taken back, and one that made no difference goes on down, so the
+ * fewest threads that reach the top are kept.
+ *
+ * It does not add threads when the frames in flight are at the memory budget, when
+ * most decodes found nothing read for them, which only more readers help, see
+ * tuneReaders, or when the process is using more memory than the budgets allow. It
+ * takes one away in that last case. A window that ran out of files is not measured,
+ * and neither is one that was throttled. The caller must hold queueMutex.
+ */
+void NewFileProcessor::tuneDecoders(int files, qint64 frameBytes)
+{
+    static std::atomic<qint64>& decoderThreads = Metrics::counter("processor.decoder_threads");
+    if (!tuneDecoderThreads)
+        return;
+    if (throttled || pixelPhaseCap > 0 || pixelQueue.isEmpty() || !tuneWindow.isValid())
+    {
+        // Not a measure of what the threads can do
+        tuneWindow.start();
+        tuneWindowFiles = 0;
+        tuneWindowBytes = 0;
+        tuneWindowStarved = 0;
+        tuneWindowMemoryBound = false;
+        return;
+    }
+
+    tuneWindowFiles += files;
+    tuneWindowBytes += frameBytes;
+    if (decodesWaiting == 0)
+        tuneWindowStarved += files;
+    if (tuneWindowFiles < TUNE_WINDOW_FILES || tuneWindow.elapsed() < TUNE_WINDOW_MSECS)
+        return;
+
+    const double throughput = tuneWindowBytes * 1000.0 / tuneWindow.elapsed();
+    const int decoders = threadPool.maxThreadCount();
+    const bool overMemory = Metrics::residentBytes() > pixelMemoryBudget + MemoryBudget::budget();
+    const bool ioBound = tuneWindowStarved * 2 > tuneWindowFiles;
+
+    if (throughput < lastThroughput * (1 - TUNE_THROUGHPUT_TOLERANCE))
+        tuneDirection = -tuneDirection;
+    else if (throughput < lastThroughput * (1 + TUNE_THROUGHPUT_TOLERANCE))
+        tuneDirection = -1;
+    if (tuneDirection > 0 && (tuneWindowMemoryBound || ioBound))
+        tuneDirection = 0;
+    if (overMemory)
+        tuneDirection = -1;
+
+    const int maxDecoders = TaskScheduler::instance().workerCount();
+    const int next = qBound(1, decoders + tuneDirection, maxDecoders);
+    if (next != decoders)
+    {
+        threadPool.setMaxThreadCount(next);
+        applyFormatLimits();
+    }
+    // Held still, the next window climbs again from here
+    if (tuneDirection == 0)
+        tuneDirection = 1;
+    decoderThreads = next;
+    lastThroughput = throughput;
+
+    tuneWindow.start();
+    tuneWindowFiles = 0;
+    tuneWindowBytes = 0;
+    tuneWindowStarved = 0;
+    tuneWindowMemoryBound = false;
+}
+
+void NewFileProcessor::finishFile(int files)
+{
+    QMutexLocker locker(&queueMutex);
+    queuedFiles -= files;
+    if (backpressureApplied && queuedFiles <= RESUME_QUEUED_FILES)
+    {
+        backpressureApplied = false;
+        emit backpressureChanged(false);
+    }
+
+    // Nothing left to process, the kept frame buffers go back to the system
+    if (queuedFiles == 0)
+        FrameBufferPool::trim();
+}
+
+/*!
+ * \brief NewFileProcessor::announceContents
+ * The oldest contents are dropped past ANNOUNCED_CONTENTS_BUDGET_MB, their files are
+ * read from the disk then. So are the contents of files the filter did not pass on.
+ */
+void NewFileProcessor::announceContents(const QString &fullPath, const QByteArray &contents)
+{
+    static std::atomic<qint64>& announcedCount = Metrics::counter("processor.announced_contents");
+    const qint64 budget = qint64(ANNOUNCED_CONTENTS_BUDGET_MB) * 1024 * 1024;
+    if (contents.isEmpty() || contents.size() > budget)
+        return;
+
+    QMutexLocker locker(&queueMutex);
+    if (announcedContents.contains(fullPath))
+    {
+        announcedBytes -= announcedContents.value(fullPath).size();
+        announcedOrder.removeOne(fullPath);
+    }
+    while (announcedBytes + contents.size() > budget && !announcedOrder.isEmpty())
+        announcedBytes -= announcedContents.take(announcedOrder.takeFirst()).size();
+    announcedContents.insert(fullPath, contents);
+    announcedOrder.append(fullPath);
+    announcedBytes += contents.size();
+    announcedCount++;
+}
+
+bool NewFileProcessor::hasRoomForContents(qint64 bytes)
+{
+    QMutexLocker locker(&queueMutex);
+    return announcedBytes + bytes <= qint64(ANNOUNCED_CONTENTS_BUDGET_MB) * 1024 * 1024;
+}
+
+QByteArray NewFileProcessor::announcedContentsOf(const QString &fullPath)
+{
+    QMutexLocker locker(&queueMutex);
+    return announcedContents.value(fullPath);
+}
+
+void NewFileProcessor::dropAnnouncedContents(const QString &fullPath)
+{
+    QMutexLocker locker(&queueMutex);
+    if (!announcedContents.contains(fullPath))
+        return;
+    announcedBytes -= announcedContents.take(fullPath).size();
+    announcedOrder.removeOne(fullPath);
+}
+
+/*!
+ * \brief NewFileProcessor::estimateFrameBytes
+ * Estimates the peak memory of the pixel phase from the header: the mapped file,
+ * the frame buffer the image is stretched in and the 32 bit image.
+ * Falls back to a multiple of the file size when the header has no geometry.
+ */
+qint64 NewFileProcessor::estimateFrameBytes(const AstroFile &astroFile)
+{
+    qint64 width = astroFile.Tags.value(TagWidth).toLongLong();
+    qint64 height = astroFile.Tags.value(TagHeight).toLongLong();
+    if (width <= 0 || height <= 0)
+        return astroFile.FileSize * 4;
+
+    qint64 pixels = width * height;
+    const bool bayer = astroFile.Tags.contains(TagBayerPattern);
+    qint64 channels = bayer || astroFile.Tags.value("NAXIS3") == "3" ? 3 : 1;
+    qint64 bytesPerSample = qMax(1, qAbs(astroFile.Tags.value("BITPIX", "16").toInt()) / 8);
+    qint64 frameBytes = pixels * channels * bytesPerSample + pixels * 4;
+
+    // Only the sampled frames are read, and binned as they are
+    if (!readsWholeFile(astroFile.FileType))
+        return frameBytes;
+
+    // Larger mono and planar FITS frames are binned a band at a time, see FitsFile::streamImage
+    if (astroFile.FileType == AstroFileType::Fits && !bayer)
+        frameBytes = qMin(frameBytes, STREAMED_FRAME_BYTES);
+
+    // The file itself is mapped or read whole for the single read in the pixel phase
+    return astroFile.FileSize + frameBytes;
+}
+
+void NewFileProcessor::processPixels(AstroFile astroFile, const FileReader& reader, bool opened)
+{
+    static LatencyHistogram& pixelsLatency = Metrics::histogram("processor.pixels");
+    static LatencyHistogram& loadLatency = Metrics::histogram("processor.load");
+    static LatencyHistogram& thumbnailLatency = Metrics::histogram("processor.thumbnail");
+    static std::atomic<qint64>& failedCount = Metrics::counter("processor.failed");
+    ScopedLatency latency(pixelsLatency);
+
+    // The header phase put this file in the catalog already, so only check that
+    // its search folder was not removed in the meantime.
+    if (cancellationToken.isCanceled() || !catalog->isInSearchFolders(astroFile.FullPath))
+    {
+        deliverCancelled(astroFile.FullPath);
+        return;
+    }
+
+    // The file was read once, and the same bytes are used for the file hash and the pixels
+    FileProcessor* processor = getProcessorForFile(astroFile);
+    if (processor != nullptr)
+        processor->setCancellationToken(cancellationToken);
+    QElapsedTimer step;
+    step.start();
+    AstroFileFailureReason failure = NoFailure;
+    if (processor == nullptr)
+        failure = FailureUnsupportedType;
+    else if (!opened)
+        failure = FailureUnreadable;
+    else if (!(readsWholeFile(astroFile.FileType) && !sandboxed ? processor->loadFile(astroFile, reader) : processor->loadFile(astroFile)))
+        failure = FailureInvalidFile;
+    loadLatency.record(step.nsecsElapsed() / 1000);
+    if (failure != NoFailure)
+    {
+        failedCount++;
+        if (processor != nullptr)
+            processor->reset();
+        astroFile.thumbnailStatus = ThumbnailFailedToProcess;
+        astroFile.processStatus = AstroFileFailedToProcess;
+        astroFile.FailureReason = failure;
+        deliverProcessed(std::move(astroFile));
+        return;
+    }
+
+    // Debayering needs the header, so the tags are read again
+    processor->extractTags();
+    step.restart();
+    processor->extractThumbnail();
+    thumbnailLatency.record(step.nsecsElapsed() / 1000);
+    if (cancellationToken.isCanceled())
+    {
+        // Stopped part way, nothing of it is kept
+        processor->reset();
+        deliverCancelled(astroFile.FullPath);
+        return;
+    }
+    astroFile.thumbnail = processor->getThumbnail();
+    astroFile.tinyThumbnail = processor->getTinyThumbnail();
+    astroFile.linearThumbnail = processor->getLinearThumbnail();
+    // From the tiny thumbnail, which is all the repository has of older rows
+    astroFile.PerceptualHash = PerceptualHash::ofImage(astroFile.tinyThumbnail);
+    astroFile.Placeholder = PlaceholderHash::ofImage(astroFile.thumbnail);
+    astroFile.thumbnailStatus = ThumbnailLoaded;
+    astroFile.ImageHash = processor->getImageHash();
+    astroFile.StretchParameters = processor->getStretchParams();
+    astroFile.Quality = processor->getFrameQuality();
+    // Before the reader goes away, a FITS file was opened over its data
+    processor->reset();
+
+    astroFile.QuickHash = readsWholeFile(astroFile.FileType) && !sandboxed ? reader.quickHash() : FileReader::quickHashOfFile(astroFile.FullPath);
+    astroFile.ThumbnailVersion = THUMBNAIL_VERSION;
+    astroFile.processStatus = AstroFileProcessed;
+
+    deliverProcessed(std::move(astroFile));
+}
+
+void NewFileProcessor::processNewFiles(const QVector<FileRecord> &files)
 {
-    cancelSignaled = true;
+    batchingHeaders = true;
+    for (auto& record : files)
+        processNewFile(record);
+    batchingHeaders = false;
+    startHeaderBatch();
 }
 
-FileProcessor* NewFileProcessor::getProcessorForFile(const QFileInfo &fileInfo)
+/*!
+ * \brief NewFileProcessor::cancel
+ * Files not started are dropped, and the ones being decoded stop at their next band of rows.
+ */
+void NewFileProcessor::cancel()
 {
-    const AstroFile af(fileInfo);
-    return getProcessorForFile(af);
+    cancellationToken.cancel();
+    QMutexLocker locker(&queueMutex);
+    announcedContents.clear();
+    announcedOrder.clear();
+    announcedBytes = 0;
 }
 
+// The processors of a pool thread, made the first time the thread needs each type
+struct ThreadFileProcessors
+{
+    std::unique_ptr<FitsProcessor> fits;
+    std::unique_ptr<XisfProcessor> xisf;
+    std::unique_ptr<ImageProcessor> image;
+    std::unique_ptr<RawProcessor> raw;
+    std::unique_ptr<SerProcessor> ser;
+    std::unique_ptr<SandboxedProcessor> sandboxed; // Of every type, with its helper
+};
+
+// Deleted along with the thread, when the pool expires it
+static QThreadStorage<ThreadFileProcessors*> threadFileProcessors;
+
+/*!
+ * \brief NewFileProcessor::getProcessorForFile
+ * Returns the processor of the calling thread for the type of the file, which is reused
+ * for every file of that type the thread processes, or its SandboxedProcessor when
+ * sandboxed. The caller does not own it, and calls reset() once done with the file,
+ * also when loading failed.
+ * Returns nullptr for files of an unknown type.
+ */
 FileProcessor* NewFileProcessor::getProcessorForFile(const AstroFile &astroFile)
 {
+    if (!threadFileProcessors.hasLocalData())
+        threadFileProcessors.setLocalData(new ThreadFileProcessors);
+    ThreadFileProcessors* processors = threadFileProcessors.localData();
+
+    if (sandboxed && astroFile.FileType != AstroFileType::UnknownType)
+    {
+        if (!processors->sandboxed)
+            processors->sandboxed.reset(new SandboxedProcessor());
+        return processors->sandboxed.get();
+    }
+
     switch (astroFile.FileType)
     {
         case AstroFileType::Fits:
-            return new FitsProcessor();
+            if (!processors->fits)
+                processors->fits.reset(new FitsProcessor());
+            return processors->fits.get();
         case AstroFileType::Xisf:
-            return new XisfProcessor();
+            if (!processors->xisf)
+                processors->xisf.reset(new XisfProcessor());
+            return processors->xisf.get();
         case AstroFileType::Image:
-            return new ImageProcessor();
+            if (!processors->image)
+                processors->image.reset(new ImageProcessor());
+            return processors->image.get();
+        case AstroFileType::Raw:
+            if (!processors->raw)
+                processors->raw.reset(new RawProcessor());
+            return processors->raw.get();
+        case AstroFileType::Ser:
+            if (!processors->ser)
+                processors->ser.reset(new SerProcessor());
+            return processors->ser.get();
+        case AstroFileType::UnknownType:
+            break;
     }
+    return nullptr;
 }
@@ -26,36 +26,178 @@
 #define NEWFILEPROCESSOR_H
 
 #include "astrofile.h"
+#include "cancellationtoken.h"
 #include "catalog.h"
 #include "fileprocessor.h"
+#include "filereader.h"
+#include "stagequeue.h"
+#include "taskscheduler.h"
+#include "volumeio.h"
 
-#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
 #include <QObject>
+#include <QSet>
 #include <QThreadPool>
+#include <QVector>
+
+#include <atomic>
+
+// Fits, Xisf, Image, Raw and Ser, see NewFileProcessor::formatIndex
+#define PROCESSING_FORMAT_COUNT 5
+
+// A job done or dropped, handed to the engine through the ring of the processor
+struct ProcessingResult
+{
+    AstroFile astroFile;
+    bool cancelled = false; // Only the FullPath of astroFile is set then
+};
 
 class NewFileProcessor : public QObject
 {
     Q_OBJECT
 public:
     explicit NewFileProcessor(QObject *parent = nullptr);
+    ~NewFileProcessor();
     virtual void setCatalog(Catalog* cat);
-    virtual void processNewFile(const QFileInfo& fileInfo);
+    virtual void processNewFile(const FileRecord& record);
+    void processNewFiles(const QVector<FileRecord>& files);
     virtual void cancel();
 
+    // Threads decoding files. 0, the default, tunes them while processing, starting from the
+    // ideal thread count. The pixel phases of each format in flight are limited from it,
+    // unless set with the MaxPixelPhases settings.
+    void setThreadCount(int threadCount);
+    // Threads reading files ahead of the decoding. 0, the default, tunes them while processing.
+    void setReaderThreadCount(int threadCount);
+    // Call before processing starts. The ProcessingMemoryBudgetMB setting by default.
+    void setMemoryBudget(qint64 bytes);
+    // Call before processing starts. Decodes the files in helper processes, see
+    // SandboxedProcessor. The SandboxedDecoding setting by default.
+    void setSandboxed(bool sandboxed);
+
+    // Thread safe. Queued pixel phases of visible files run first, and the ones of
+    // files hidden by the current filter run last.
+    void setPriorityHints(const QStringList& visiblePaths, const QStringList& filteredOutPaths);
+
+    // Thread safe. The threads of the processor run in the background, see ThreadPriority.
+    void setBackgroundPriority(bool background);
+    // Thread safe. Throttled, a single pixel phase is in flight. Once the throttle is
+    // lifted, each pixel phase done lets one more start, until they are all back.
+    void setThrottled(bool throttled);
+
+    // Thread safe. The bytes of a file about to be processed, handed over by the program
+    // that wrote it, so the processing does not read the file again. Kept until the file
+    // is processed, within a budget, see IngestServer.
+    void announceContents(const QString& fullPath, const QByteArray& contents);
+    // Thread safe. Whether contents of bytes would be kept without dropping others.
+    bool hasRoomForContents(qint64 bytes);
+
+    // Moves the results delivered so far into results, in the order they were delivered.
+    // Called by the single consumer, on resultsReady.
+    void takeResults(QVector<ProcessingResult>& results);
+
 signals:
-    void astrofileProcessed(const AstroFile& astroFile);
-    void processingCancelled(const QFileInfo& fileInfo);
+    // Emitted once for the results delivered until the next takeResults
+    void resultsReady();
+
+    // true when too many files are queued, and the crawler should stop finding more for a while
+    void backpressureChanged(bool shouldPause);
 
 protected:
-    volatile bool cancelSignaled = false;
+    // Shared with the processors, which check it while they decode
+    CancellationToken cancellationToken;
     Catalog* catalog;
 
+    // Thread safe. The header phase result of a file, or its final one.
+    void deliverProcessed(AstroFile astroFile);
+    void deliverCancelled(const QString& fullPath);
+
 private:
-    FileProcessor* getProcessorForFile(const QFileInfo& fileInfo);
     FileProcessor* getProcessorForFile(const AstroFile& astroFile);
 
-    QByteArray getFileHash(const QFileInfo& fileInfo);
-    QThreadPool threadPool;
+    // A pixel phase waiting to start, with the volume its file is read from
+    struct PixelTask
+    {
+        AstroFile astroFile;
+        VolumeIo* volume;
+    };
+
+    // A file waiting for its header phase, see startHeaderBatch
+    struct HeaderTask
+    {
+        FileRecord record;
+        QString volumeName;
+    };
+
+    void startHeaderBatch();
+    void processHeader(AstroFile astroFile, const QByteArray& head);
+    void takeSmallFiles(QVector<AstroFile>& astroFiles, VolumeIo* volume, qint64& frameBytes);
+    void readPixels(QVector<AstroFile> astroFiles, VolumeIo* volume, qint64 frameBytes);
+    bool readFile(const AstroFile& astroFile, VolumeIo* volume, FileReader& reader);
+    void processPixels(AstroFile astroFile, const FileReader& reader, bool opened);
+    void enqueuePixels(AstroFile astroFile);
+    void startPixelTasks();
+    int nextPixelTaskIndex() const;
+    void finishFile(int files = 1);
+    QByteArray announcedContentsOf(const QString& fullPath);
+    void dropAnnouncedContents(const QString& fullPath);
+    void deliver(ProcessingResult&& result);
+    void applyThreadPriority();
+    void updateFormatLimits();
+    void applyFormatLimits();
+    void tuneReaders();
+    void tuneDecoders(int files, qint64 frameBytes);
+    static int formatIndex(AstroFileType type);
+    static qint64 estimateFrameBytes(const AstroFile& astroFile);
+    static bool readsWholeFile(AstroFileType type);
+    TaskGroup threadPool; // Header phases and decoding
+    QThreadPool readerPool; // Reads ahead of the decoding
+
+    // Only used by the thread of the processor
+    QVector<HeaderTask> headerBatch;
+    bool batchingHeaders = false;
+
+    // Files that were handed to processNewFile and are not done yet, and the pixel
+    // phases waiting for memory. Guarded by queueMutex.
+    QMutex queueMutex;
+    int queuedFiles = 0;
+    bool backpressureApplied = false;
+    QList<PixelTask> pixelQueue;
+    QSet<QString> visibleHints;
+    QSet<QString> filteredOutHints;
+    qint64 pixelBytesInFlight = 0;
+    QHash<QString, QByteArray> announcedContents;
+    QStringList announcedOrder; // Oldest first, dropped first past the budget
+    qint64 announcedBytes = 0;
+    qint64 pixelMemoryBudget;
+    int pixelPhasesInFlight[PROCESSING_FORMAT_COUNT] = {};
+    int pixelPhaseLimits[PROCESSING_FORMAT_COUNT];
+    int pixelPhaseSettings[PROCESSING_FORMAT_COUNT] = {}; // The MaxPixelPhases settings, 0 when not set
+    int pixelPhaseCap = 0; // Of all formats, 0 when there is none, see setThrottled
+    bool throttled = false;
+    bool tuneReaderThreads = true;
+    int decodesWaiting = 0; // Files read, waiting for a decoding thread
+    QHash<VolumeIo*, int> readsInFlight; // Of the volumes that limit them
+
+    // The window of pixel phases tuneDecoders measures, and the step it took last
+    bool tuneDecoderThreads = true;
+    QElapsedTimer tuneWindow;
+    int tuneWindowFiles = 0;
+    qint64 tuneWindowBytes = 0;
+    int tuneWindowStarved = 0; // Decodes that found no other file read
+    bool tuneWindowMemoryBound = false;
+    double lastThroughput = 0;
+    int tuneDirection = 1;
+
+    // From the threads of the pools to the engine, without an event and a copy per file
+    StageQueue<ProcessingResult> results;
+    std::atomic<bool> resultsSignaled = false;
+
+    // Taken by each thread of the pools as it starts a task
+    std::atomic<bool> backgroundPriority = false;
+    std::atomic<bool> sandboxed = false;
 };
 
 #endif // NEWFILEPROCESSOR_H
@@ -0,0 +1,823 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "objectstore.h"
+#include "directorywalker.h"
+#include "metrics.h"
+
+#include <QBitArray>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMessageAuthenticationCode>
+#include <QMutex>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QThreadStorage>
+#include <QUrl>
+#include <QXmlStreamReader>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+
+// Blocks of the on-disk cache, and the alignment of the ranges fetched for it
+#define OBJECT_CACHE_BLOCK_SIZE         (64 * 1024)
+#define OBJECT_CACHE_INDEX_MAGIC        0x4f424331
+#define DEFAULT_OBJECT_CACHE_SIZE_MB    4096
+
+// Ranges fetched at once when there is no volume to take the depth from
+#define DEFAULT_PARALLEL_FETCHES    8
+
+// A request that makes no progress for this long fails, and is sent once more
+#define OBJECT_FETCH_TIMEOUT        30000
+#define OBJECT_FETCH_ATTEMPTS       2
+
+#define DEFAULT_OBJECT_STORE_REGION "us-east-1"
+
+namespace {
+
+typedef QList<QPair<QString, QString>> Query;
+
+// The ObjectStore group of the settings, read once
+struct StoreConfig
+{
+    QUrl endpoint;
+    QString region;
+    QByteArray accessKeyId;
+    QByteArray secretAccessKey;
+    QByteArray sessionToken;
+    bool pathStyle = false;
+};
+
+const StoreConfig& config()
+{
+    static const StoreConfig store = []() {
+        StoreConfig loaded;
+        QSettings settings;
+        settings.beginGroup("ObjectStore");
+        loaded.region = settings.value("Region", DEFAULT_OBJECT_STORE_REGION).toString();
+        const QString endpoint = settings.value("Endpoint").toString();
+        loaded.endpoint = QUrl(endpoint.isEmpty() ? QString("https://s3.%1.amazonaws.com").arg(loaded.region) : endpoint);
+        // The other S3 compatible stores, MinIO and the like, mostly only take path-style requests
+        loaded.pathStyle = settings.value("PathStyle", !endpoint.isEmpty()).toBool();
+        loaded.accessKeyId = settings.value("AccessKeyId").toString().toUtf8();
+        loaded.secretAccessKey = settings.value("SecretAccessKey").toString().toUtf8();
+        loaded.sessionToken = settings.value("SessionToken").toString().toUtf8();
+        settings.endGroup();
+        return loaded;
+    }();
+    return store;
+}
+
+// The size and modification time of an object, the version of it the cached blocks are of
+struct ObjectInfo
+{
+    qint64 size = -1;
+    qint64 lastModified = 0; // msecs since epoch, in whole seconds as HTTP dates have them
+};
+
+QMutex objectsMutex;
+QHash<QString, ObjectInfo> objects;
+
+void rememberObject(const QString& path, qint64 size, qint64 lastModified)
+{
+    QMutexLocker locker(&objectsMutex);
+    objects.insert(path, {size, lastModified / 1000 * 1000});
+}
+
+ObjectInfo knownObject(const QString& path)
+{
+    QMutexLocker locker(&objectsMutex);
+    return objects.value(path);
+}
+
+/*!
+ * \brief The BlockCache class
+ * The blocks fetched of each object, in a sparse data file, and the bitmap of the
+ * blocks it holds, in an index file along with the version of the object. Files are
+ * named by the hash of the object path.
+ */
+class BlockCache
+{
+public:
+    BlockCache();
+
+    // Copies the request out of the cache when all of its blocks are there for this version of the object
+    bool read(const QString& path, const ObjectInfo& info, FileReadRequest& request);
+    // Keeps the whole blocks of data, fetched from the block aligned offset
+    void write(const QString& path, const ObjectInfo& info, qint64 offset, const QByteArray& data);
+
+private:
+    struct Entry
+    {
+        qint64 size = 0;
+        qint64 lastModified = 0;
+        QBitArray blocks;
+        qint64 lastUsed = 0;
+
+        qint64 cachedBytes() const { return qint64(blocks.count(true)) * OBJECT_CACHE_BLOCK_SIZE; }
+    };
+
+    Entry& entryOf(const QString& name, const ObjectInfo& info);
+    void saveIndex(const QString& name, const Entry& entry);
+    void remove(const QString& name);
+    void evict(const QString& keep);
+
+    static QString nameOf(const QString& path);
+
+    QMutex mutex;
+    QString directory;
+    qint64 limit;
+    qint64 totalBytes = 0;
+    QHash<QString, Entry> entries;
+};
+
+BlockCache::BlockCache()
+{
+    directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/objects";
+    limit = QSettings().value("ObjectStore/CacheSizeMB", DEFAULT_OBJECT_CACHE_SIZE_MB).toLongLong() * 1024 * 1024;
+    if (limit <= 0 || !QDir().mkpath(directory))
+    {
+        limit = 0;
+        return;
+    }
+
+    // The indexes are small, they are all loaded to know what is cached and what was used last
+    const QFileInfoList indexes = QDir(directory).entryInfoList({"*.index"}, QDir::Files);
+    for (auto& index : indexes)
+    {
+        QFile file(index.filePath());
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        QDataStream stream(&file);
+        quint32 magic = 0;
+        Entry entry;
+        stream >> magic >> entry.size >> entry.lastModified >> entry.blocks;
+        if (stream.status() != QDataStream::Ok || magic != OBJECT_CACHE_INDEX_MAGIC)
+        {
+            file.close();
+            remove(index.completeBaseName());
+            continue;
+        }
+        entry.lastUsed = index.lastModified().toMSecsSinceEpoch();
+        totalBytes += entry.cachedBytes();
+        entries.insert(index.completeBaseName(), entry);
+    }
+    evict(QString());
+}
+
+QString BlockCache::nameOf(const QString &path)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+BlockCache::Entry &BlockCache::entryOf(const QString &name, const ObjectInfo &info)
+{
+    auto it = entries.find(name);
+    if (it != entries.end() && it->size == info.size && it->lastModified == info.lastModified)
+        return *it;
+
+    // Not cached yet, or the blocks are of another version of the object
+    if (it != entries.end())
+        remove(name);
+    Entry& entry = entries[name];
+    entry.size = info.size;
+    entry.lastModified = info.lastModified;
+    entry.blocks.resize(int((info.size + OBJECT_CACHE_BLOCK_SIZE - 1) / OBJECT_CACHE_BLOCK_SIZE));
+    return entry;
+}
+
+bool BlockCache::read(const QString &path, const ObjectInfo &info, FileReadRequest &request)
+{
+    if (limit <= 0 || info.size < 0)
+        return false;
+
+    QMutexLocker locker(&mutex);
+    const QString name = nameOf(path);
+    Entry& entry = entryOf(name, info);
+    const qint64 length = qBound<qint64>(0, info.size - request.offset, request.length);
+    if (length > 0)
+    {
+        const int last = int((request.offset + length - 1) / OBJECT_CACHE_BLOCK_SIZE);
+        for (int block = int(request.offset / OBJECT_CACHE_BLOCK_SIZE); block <= last; block++)
+        {
+            if (!entry.blocks.testBit(block))
+                return false;
+        }
+        QFile data(directory + '/' + name + ".data");
+        if (!data.open(QIODevice::ReadOnly) || !data.seek(request.offset) || data.read(request.buffer, length) != length)
+        {
+            remove(name);
+            return false;
+        }
+    }
+    request.bytesRead = length;
+    entry.lastUsed = QDateTime::currentMSecsSinceEpoch();
+    return true;
+}
+
+void BlockCache::write(const QString &path, const ObjectInfo &info, qint64 offset, const QByteArray &data)
+{
+    if (limit <= 0 || info.size < 0 || offset % OBJECT_CACHE_BLOCK_SIZE != 0)
+        return;
+
+    QMutexLocker locker(&mutex);
+    const QString name = nameOf(path);
+    Entry& entry = entryOf(name, info);
+    QFile file(directory + '/' + name + ".data");
+    if (!file.open(QIODevice::ReadWrite))
+        return;
+
+    bool added = false;
+    for (qint64 start = 0; start < data.size(); start += OBJECT_CACHE_BLOCK_SIZE)
+    {
+        const qint64 length = qMin<qint64>(OBJECT_CACHE_BLOCK_SIZE, data.size() - start);
+        // A block cut short is only whole at the end of the object
+        if (length < OBJECT_CACHE_BLOCK_SIZE && offset + start + length != info.size)
+            break;
+        const int block = int((offset + start) / OBJECT_CACHE_BLOCK_SIZE);
+        if (block >= entry.blocks.size() || entry.blocks.testBit(block))
+            continue;
+        // Seeking past the end leaves a hole, the data file is as sparse as the blocks fetched
+        if (!file.seek(offset + start) || file.write(data.constData() + start, length) != length)
+            break;
+        entry.blocks.setBit(block);
+        totalBytes += OBJECT_CACHE_BLOCK_SIZE;
+        added = true;
+    }
+    file.close();
+    entry.lastUsed = QDateTime::currentMSecsSinceEpoch();
+    if (!added)
+        return;
+    saveIndex(name, entry);
+    evict(name);
+}
+
+void BlockCache::saveIndex(const QString &name, const Entry &entry)
+{
+    QSaveFile file(directory + '/' + name + ".index");
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    QDataStream stream(&file);
+    stream << quint32(OBJECT_CACHE_INDEX_MAGIC) << entry.size << entry.lastModified << entry.blocks;
+    file.commit();
+}
+
+void BlockCache::remove(const QString &name)
+{
+    auto it = entries.find(name);
+    if (it != entries.end())
+    {
+        totalBytes -= it->cachedBytes();
+        entries.erase(it);
+    }
+    QFile::remove(directory + '/' + name + ".data");
+    QFile::remove(directory + '/' + name + ".index");
+}
+
+// Whole objects are evicted, the least recently used first
+void BlockCache::evict(const QString &keep)
+{
+    while (totalBytes > limit)
+    {
+        QString oldest;
+        qint64 oldestUse = std::numeric_limits<qint64>::max();
+        for (auto it = entries.constBegin(); it != entries.constEnd(); ++it)
+        {
+            if (it.key() != keep && it->lastUsed < oldestUse)
+            {
+                oldest = it.key();
+                oldestUse = it->lastUsed;
+            }
+        }
+        if (oldest.isEmpty())
+            return;
+        remove(oldest);
+    }
+}
+
+BlockCache& blockCache()
+{
+    static BlockCache cache;
+    return cache;
+}
+
+// Deleted along with the thread
+QThreadStorage<QNetworkAccessManager*> threadNetworks;
+
+QNetworkAccessManager* networkOfThread()
+{
+    if (!threadNetworks.hasLocalData())
+        threadNetworks.setLocalData(new QNetworkAccessManager);
+    return threadNetworks.localData();
+}
+
+// s3:/bucket/dir/file.fits to bucket and dir/file.fits
+void splitPath(const QString& path, QString& bucket, QString& key)
+{
+    const QString rest = path.mid(int(strlen(OBJECT_PATH_PREFIX)));
+    const int slash = rest.indexOf('/');
+    bucket = slash < 0 ? rest : rest.left(slash);
+    key = slash < 0 ? QString() : rest.mid(slash + 1);
+}
+
+QByteArray uriEncode(const QString& value, bool keepSlashes)
+{
+    return QUrl::toPercentEncoding(value, keepSlashes ? "/" : "");
+}
+
+QByteArray hmac(const QByteArray& key, const QByteArray& message)
+{
+    return QMessageAuthenticationCode::hash(message, key, QCryptographicHash::Sha256);
+}
+
+/*!
+ * \brief signedRequest
+ * The request for the object, or the bucket for an empty key, signed with AWS Signature
+ * Version 4 when there are credentials. The payload is not signed, the requests have none.
+ */
+QNetworkRequest signedRequest(const QByteArray& method, const QString& bucket, const QString& key, const Query& query = Query())
+{
+    const StoreConfig& store = config();
+    QString host = store.endpoint.host();
+    QByteArray path;
+    if (store.pathStyle)
+        path = '/' + uriEncode(bucket, false);
+    else
+        host = bucket + '.' + host;
+    if (!key.isEmpty() || !store.pathStyle)
+        path += '/' + uriEncode(key, true);
+
+    QList<QPair<QByteArray, QByteArray>> encodedQuery;
+    for (auto& parameter : query)
+        encodedQuery.append({uriEncode(parameter.first, false), uriEncode(parameter.second, false)});
+    std::sort(encodedQuery.begin(), encodedQuery.end());
+    QByteArray canonicalQuery;
+    for (auto& parameter : encodedQuery)
+        canonicalQuery += (canonicalQuery.isEmpty() ? "" : "&") + parameter.first + '=' + parameter.second;
+
+    QByteArray hostHeader = host.toUtf8();
+    const int defaultPort = store.endpoint.scheme() == "https" ? 443 : 80;
+    if (store.endpoint.port() != -1 && store.endpoint.port() != defaultPort)
+        hostHeader += ':' + QByteArray::number(store.endpoint.port());
+
+    QUrl url = store.endpoint;
+    url.setHost(host);
+    url.setPath(QString::fromLatin1(path), QUrl::TolerantMode);
+    if (!canonicalQuery.isEmpty())
+        url.setQuery(QString::fromLatin1(canonicalQuery), QUrl::TolerantMode);
+
+    QNetworkRequest request(url);
+    request.setTransferTimeout(OBJECT_FETCH_TIMEOUT);
+    if (store.accessKeyId.isEmpty())
+        return request;
+
+    const QByteArray amzDate = QDateTime::currentDateTimeUtc().toString("yyyyMMdd'T'HHmmss'Z'").toLatin1();
+    QByteArray signedHeaders = "host;x-amz-content-sha256;x-amz-date";
+    QByteArray canonicalHeaders = "host:" + hostHeader + "\nx-amz-content-sha256:UNSIGNED-PAYLOAD\nx-amz-date:" + amzDate + '\n';
+    request.setRawHeader("Host", hostHeader);
+    request.setRawHeader("x-amz-content-sha256", "UNSIGNED-PAYLOAD");
+    request.setRawHeader("x-amz-date", amzDate);
+    if (!store.sessionToken.isEmpty())
+    {
+        signedHeaders += ";x-amz-security-token";
+        canonicalHeaders += "x-amz-security-token:" + store.sessionToken + '\n';
+        request.setRawHeader("x-amz-security-token", store.sessionToken);
+    }
+
+    const QByteArray canonicalRequest = method + '\n' + path + '\n' + canonicalQuery + '\n' + canonicalHeaders + '\n' + signedHeaders + "\nUNSIGNED-PAYLOAD";
+    const QByteArray date = amzDate.left(8);
+    const QByteArray scope = date + '/' + store.region.toUtf8() + "/s3/aws4_request";
+    const QByteArray stringToSign = "AWS4-HMAC-SHA256\n" + amzDate + '\n' + scope + '\n' + QCryptographicHash::hash(canonicalRequest, QCryptographicHash::Sha256).toHex();
+    QByteArray signingKey = hmac("AWS4" + store.secretAccessKey, date);
+    signingKey = hmac(signingKey, store.region.toUtf8());
+    signingKey = hmac(signingKey, "s3");
+    signingKey = hmac(signingKey, "aws4_request");
+    request.setRawHeader("Authorization", "AWS4-HMAC-SHA256 Credential=" + store.accessKeyId + '/' + scope
+                         + ", SignedHeaders=" + signedHeaders + ", Signature=" + hmac(signingKey, stringToSign).toHex());
+    return request;
+}
+
+int statusOf(QNetworkReply* reply)
+{
+    return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+}
+
+// Timeouts, dropped connections and the 5xx of a busy store are worth another try
+bool isRetryable(QNetworkReply* reply)
+{
+    return reply->error() != QNetworkReply::NoError && (statusOf(reply) == 0 || statusOf(reply) >= 500);
+}
+
+// Sends the request and waits for its reply in a local event loop, once more when it failed
+std::unique_ptr<QNetworkReply> send(const QByteArray& method, const QString& bucket, const QString& key, const Query& query = Query())
+{
+    std::unique_ptr<QNetworkReply> reply;
+    for (int attempt = 0; attempt < OBJECT_FETCH_ATTEMPTS; attempt++)
+    {
+        const QNetworkRequest request = signedRequest(method, bucket, key, query);
+        reply.reset(method == "HEAD" ? networkOfThread()->head(request) : networkOfThread()->get(request));
+        if (!reply->isFinished())
+        {
+            QEventLoop loop;
+            QObject::connect(reply.get(), &QNetworkReply::finished, &loop, &QEventLoop::quit);
+            loop.exec();
+        }
+        if (!isRetryable(reply.get()))
+            break;
+    }
+    return reply;
+}
+
+qint64 lastModifiedOf(QNetworkReply* reply)
+{
+    const QDateTime lastModified = reply->header(QNetworkRequest::LastModifiedHeader).toDateTime();
+    return lastModified.isValid() ? lastModified.toMSecsSinceEpoch() : 0;
+}
+
+// The size of the object from the "bytes first-last/size" of a range reply, -1 when the store did not say
+qint64 totalOfContentRange(const QByteArray& contentRange)
+{
+    bool ok = false;
+    const qint64 total = contentRange.mid(contentRange.lastIndexOf('/') + 1).toLongLong(&ok);
+    return ok ? total : -1;
+}
+
+// A request of an object, and the block aligned range fetched for it when the cache does not have it
+struct RangeFetch
+{
+    QString path;
+    QString bucket;
+    QString key;
+    FileReadRequest* request = nullptr;
+    qint64 offset = 0;
+    qint64 length = 0;
+    int attempts = 0;
+    bool fetched = false;
+    ObjectInfo info;
+    QByteArray data;
+};
+
+void completeFetch(RangeFetch& fetch, QNetworkReply* reply)
+{
+    const int status = statusOf(reply);
+    fetch.info.lastModified = lastModifiedOf(reply) / 1000 * 1000;
+    if (status == 416)
+    {
+        // Past the end of the object
+        fetch.info.size = totalOfContentRange(reply->rawHeader("Content-Range"));
+        fetch.fetched = true;
+        return;
+    }
+    if (reply->error() != QNetworkReply::NoError || (status != 200 && status != 206))
+    {
+        qDebug() << "Could not fetch" << fetch.path << reply->errorString();
+        return;
+    }
+
+    fetch.data = reply->readAll();
+    if (status == 206)
+    {
+        fetch.info.size = totalOfContentRange(reply->rawHeader("Content-Range"));
+    }
+    else
+    {
+        // The store ignored the range and sent the whole object
+        fetch.info.size = fetch.data.size();
+        fetch.data = fetch.data.mid(qMin<qint64>(fetch.offset, fetch.data.size()), fetch.length);
+    }
+    fetch.fetched = true;
+}
+
+/*!
+ * \brief fetchAll
+ * Sends the range requests, parallel of them at a time, and waits for all of them in
+ * a local event loop. A request that failed for a reason worth another try is sent
+ * again at the back of the queue.
+ */
+void fetchAll(QVector<RangeFetch>& fetches, int parallel)
+{
+    if (fetches.isEmpty())
+        return;
+
+    static std::atomic<qint64>& fetchCount = Metrics::counter("objectstore.range_fetches");
+    QNetworkAccessManager* network = networkOfThread();
+    QEventLoop loop;
+    QList<QNetworkReply*> replies;
+    QList<int> queue;
+    for (int i = 0; i < fetches.count(); i++)
+        queue.append(i);
+    int running = 0;
+
+    std::function<void()> startQueued = [&]() {
+        while (running < qMax(1, parallel) && !queue.isEmpty())
+        {
+            const int index = queue.takeFirst();
+            const RangeFetch& fetch = fetches.at(index);
+            QNetworkRequest request = signedRequest("GET", fetch.bucket, fetch.key);
+            request.setRawHeader("Range", "bytes=" + QByteArray::number(fetch.offset) + '-' + QByteArray::number(fetch.offset + fetch.length - 1));
+            QNetworkReply* reply = network->get(request);
+            replies.append(reply);
+            running++;
+            fetchCount++;
+            QObject::connect(reply, &QNetworkReply::finished, &loop, [&, reply, index]() {
+                running--;
+                RangeFetch& finished = fetches[index];
+                if (isRetryable(reply) && ++finished.attempts < OBJECT_FETCH_ATTEMPTS)
+                    queue.append(index);
+                else
+                    completeFetch(finished, reply);
+                startQueued();
+                if (running == 0)
+                    loop.quit();
+            });
+        }
+    };
+    startQueued();
+    loop.exec();
+    // The replies are deleted here, the thread may have no event loop for deleteLater
+    qDeleteAll(replies);
+}
+
+// Whether the request got all of the object it asked for
+bool isComplete(const FileReadRequest& request, const ObjectInfo& info)
+{
+    if (request.bytesRead < 0)
+        return false;
+    return request.bytesRead == request.length || (info.size >= 0 && request.offset + request.bytesRead == info.size);
+}
+
+/*!
+ * \brief readRequests
+ * Serves the requests out of the block cache, and fetches the block aligned ranges of
+ * those it does not have. What was fetched is cached.
+ */
+bool readRequests(const QVector<QPair<QString, FileReadRequest*>>& requests, int parallel, VolumeIo* volume)
+{
+    static std::atomic<qint64>& cachedCount = Metrics::counter("objectstore.cached_reads");
+    QVector<RangeFetch> fetches;
+    for (auto& pair : requests)
+    {
+        FileReadRequest* request = pair.second;
+        const ObjectInfo info = knownObject(pair.first);
+        if (blockCache().read(pair.first, info, *request))
+        {
+            cachedCount++;
+            continue;
+        }
+
+        RangeFetch fetch;
+        fetch.path = pair.first;
+        splitPath(pair.first, fetch.bucket, fetch.key);
+        fetch.request = request;
+        fetch.offset = request->offset / OBJECT_CACHE_BLOCK_SIZE * OBJECT_CACHE_BLOCK_SIZE;
+        qint64 end = (request->offset + request->length + OBJECT_CACHE_BLOCK_SIZE - 1) / OBJECT_CACHE_BLOCK_SIZE * OBJECT_CACHE_BLOCK_SIZE;
+        if (info.size >= 0)
+            end = qMin(end, info.size);
+        fetch.length = end - fetch.offset;
+        if (fetch.length <= 0)
+        {
+            request->bytesRead = 0;
+            continue;
+        }
+        fetches.append(fetch);
+    }
+
+    fetchAll(fetches, parallel);
+
+    bool ok = true;
+    for (auto& fetch : fetches)
+    {
+        FileReadRequest* request = fetch.request;
+        if (!fetch.fetched)
+        {
+            request->bytesRead = -1;
+            ok = false;
+            continue;
+        }
+        if (fetch.info.size >= 0)
+            rememberObject(fetch.path, fetch.info.size, fetch.info.lastModified);
+        const qint64 skip = request->offset - fetch.offset;
+        const qint64 length = qBound<qint64>(0, fetch.data.size() - skip, request->length);
+        if (length > 0)
+            memcpy(request->buffer, fetch.data.constData() + skip, size_t(length));
+        request->bytesRead = length;
+        blockCache().write(fetch.path, fetch.info, fetch.offset, fetch.data);
+        if (volume != nullptr)
+            volume->throttle(fetch.data.size());
+        ok = ok && isComplete(*request, fetch.info);
+    }
+    return ok;
+}
+
+int parallelFetchesOf(VolumeIo* volume)
+{
+    return volume != nullptr ? volume->policy().queueDepth : DEFAULT_PARALLEL_FETCHES;
+}
+
+} // namespace
+
+bool ObjectStore::isObjectPath(const QString &path)
+{
+    return path.startsWith(OBJECT_PATH_PREFIX);
+}
+
+QString ObjectStore::bucketRootOf(const QString &path)
+{
+    return OBJECT_PATH_PREFIX + bucketOf(path);
+}
+
+QString ObjectStore::bucketOf(const QString &path)
+{
+    QString bucket;
+    QString key;
+    splitPath(path, bucket, key);
+    return bucket;
+}
+
+/*!
+ * \brief ObjectStore::list
+ * ListObjectsV2 of the prefix of the directory, a thousand keys per page. Like
+ * DirectoryWalker, hidden entries are skipped, and so are the empty objects some
+ * tools make as folders.
+ */
+bool ObjectStore::list(const QString &directory, QVector<FileRecord> &files, QStringList &subDirectories)
+{
+    static LatencyHistogram& listLatency = Metrics::histogram("objectstore.list");
+    ScopedLatency latency(listLatency);
+    QString bucket;
+    QString prefix;
+    splitPath(directory, bucket, prefix);
+    if (bucket.isEmpty())
+        return false;
+    if (!prefix.isEmpty())
+        prefix += '/';
+    const QString root = bucketRootOf(directory) + '/';
+
+    QVector<FileRecord> listedFiles;
+    QStringList listedDirectories;
+    QString continuationToken;
+    do
+    {
+        Query query = {{"list-type", "2"}, {"delimiter", "/"}, {"prefix", prefix}};
+        if (!continuationToken.isEmpty())
+            query.append({"continuation-token", continuationToken});
+        std::unique_ptr<QNetworkReply> reply = send("GET", bucket, QString(), query);
+        if (reply->error() != QNetworkReply::NoError)
+        {
+            qDebug() << "Could not list" << directory << reply->errorString();
+            return false;
+        }
+
+        continuationToken.clear();
+        QXmlStreamReader xml(reply->readAll());
+        while (!xml.atEnd())
+        {
+            if (xml.readNext() != QXmlStreamReader::StartElement)
+                continue;
+            if (xml.name() == QLatin1String("Contents"))
+            {
+                QString key;
+                FileRecord record;
+                while (xml.readNextStartElement())
+                {
+                    if (xml.name() == QLatin1String("Key"))
+                        key = xml.readElementText();
+                    else if (xml.name() == QLatin1String("Size"))
+                        record.Size = xml.readElementText().toLongLong();
+                    else if (xml.name() == QLatin1String("LastModified"))
+                        record.LastModifiedTime = QDateTime::fromString(xml.readElementText(), Qt::ISODateWithMs).toMSecsSinceEpoch();
+                    else
+                        xml.skipCurrentElement();
+                }
+                const QString name = key.mid(prefix.size());
+                if (name.isEmpty() || name.contains('/') || name.startsWith('.') || !DirectoryWalker::isImageFileName(name))
+                    continue;
+                record.FullPath = root + key;
+                record.CanonicalDirectory = directory;
+                rememberObject(record.FullPath, record.Size, record.LastModifiedTime);
+                listedFiles.append(record);
+            }
+            else if (xml.name() == QLatin1String("CommonPrefixes"))
+            {
+                while (xml.readNextStartElement())
+                {
+                    if (xml.name() != QLatin1String("Prefix"))
+                    {
+                        xml.skipCurrentElement();
+                        continue;
+                    }
+                    QString subPrefix = xml.readElementText();
+                    subPrefix.chop(1);
+                    const QString name = subPrefix.mid(prefix.size());
+                    if (!name.isEmpty() && !name.startsWith('.'))
+                        listedDirectories.append(root + subPrefix);
+                }
+            }
+            else if (xml.name() == QLatin1String("NextContinuationToken"))
+            {
+                continuationToken = xml.readElementText();
+            }
+        }
+        if (xml.hasError())
+        {
+            qDebug() << "Could not list" << directory << xml.errorString();
+            return false;
+        }
+    } while (!continuationToken.isEmpty());
+
+    files.append(listedFiles);
+    subDirectories.append(listedDirectories);
+    return true;
+}
+
+bool ObjectStore::read(const QString &path, QVector<FileReadRequest> &requests, VolumeIo *volume)
+{
+    QVector<QPair<QString, FileReadRequest*>> reads;
+    reads.reserve(requests.count());
+    for (auto& request : requests)
+        reads.append({path, &request});
+    return readRequests(reads, parallelFetchesOf(volume), volume);
+}
+
+QVector<QByteArray> ObjectStore::readHeads(const QStringList &paths, qint64 length)
+{
+    QVector<QByteArray> heads(paths.count());
+    QVector<FileReadRequest> requests(paths.count());
+    QVector<QPair<QString, FileReadRequest*>> reads;
+    VolumeIo* volume = nullptr;
+    for (int i = 0; i < paths.count(); i++)
+    {
+        const QString& path = paths.at(i);
+        if (path.isEmpty())
+            continue;
+        if (volume == nullptr)
+            volume = VolumeIo::ofDirectory(path.left(path.lastIndexOf('/')));
+        heads[i].resize(int(length));
+        requests[i] = {0, length, heads[i].data()};
+        reads.append({path, &requests[i]});
+    }
+    // The heads are small, they are not paced
+    readRequests(reads, parallelFetchesOf(volume), nullptr);
+
+    for (int i = 0; i < heads.count(); i++)
+    {
+        if (requests.at(i).bytesRead <= 0)
+            heads[i].clear();
+        else
+            heads[i].truncate(int(requests.at(i).bytesRead));
+    }
+    return heads;
+}
+
+qint64 ObjectStore::sizeOf(const QString &path)
+{
+    const ObjectInfo known = knownObject(path);
+    if (known.size >= 0)
+        return known.size;
+
+    QString bucket;
+    QString key;
+    splitPath(path, bucket, key);
+    std::unique_ptr<QNetworkReply> reply = send("HEAD", bucket, key);
+    if (reply->error() != QNetworkReply::NoError)
+        return -1;
+    const qint64 size = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    rememberObject(path, size, lastModifiedOf(reply.get()));
+    return size;
+}
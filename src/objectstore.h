@@ -0,0 +1,84 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef OBJECTSTORE_H
+#define OBJECTSTORE_H
+
+#include "asyncfileio.h"
+#include "filerecord.h"
+#include "volumeio.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Object paths are the key of the object under the bucket, s3:/bucket/key. A search
+// folder of s3://bucket/prefix is cleaned to that form like any other path.
+#define OBJECT_PATH_PREFIX "s3:/"
+
+/*!
+ * \brief The ObjectStore class
+ * Archives kept in an S3 compatible object store, read with HTTP range requests.
+ * A bucket is the volume of its objects, and the "directories" under it are the
+ * common prefixes of ListObjectsV2 with a '/' delimiter. Only the head of an object
+ * is fetched for its header, and the pixels of a file are fetched as ranges in
+ * parallel, see read.
+ *
+ * What was fetched is kept in an on-disk cache of blocks, under the cache location
+ * of the app, so the objects are not fetched again for a thumbnail or a preview. A
+ * block is only served for the version of the object it was fetched from, by size
+ * and modification time, and the least recently used objects are evicted past
+ * ObjectStore/CacheSizeMB.
+ *
+ * The endpoint, region and credentials are the ObjectStore group of the settings,
+ * requests are signed with AWS Signature Version 4, and are anonymous without
+ * credentials. The calls block the calling thread, and are thread safe.
+ */
+class ObjectStore
+{
+public:
+    static bool isObjectPath(const QString& path);
+
+    // The bucket of an object path, s3:/bucket
+    static QString bucketRootOf(const QString& path);
+    static QString bucketOf(const QString& path);
+
+    // Appends the image objects and the common prefixes under directory, same as
+    // DirectoryWalker::list. False if the bucket could not be listed.
+    static bool list(const QString& directory, QVector<FileRecord>& files, QStringList& subDirectories);
+
+    // Reads the ranges of the object, as many fetched at once as the queue depth of the
+    // volume, paced by the volume. Returns false when a range could not be read in full,
+    // up to the end of the object.
+    static bool read(const QString& path, QVector<FileReadRequest>& requests, VolumeIo* volume = nullptr);
+
+    // The first length bytes of each object, all fetched together, like AsyncFileIo::readHeads
+    static QVector<QByteArray> readHeads(const QStringList& paths, qint64 length);
+
+    // The size of the object as last listed, asked for when it was not. -1 when it could not be found.
+    static qint64 sizeOf(const QString& path);
+};
+
+#endif // OBJECTSTORE_H
@@ -0,0 +1,122 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "observingnight.h"
+
+#include <QDateTime>
+#include <QList>
+#include <QPair>
+#include <QSettings>
+#include <QTimeZone>
+
+#include <algorithm>
+
+#define MSECS_PER_DAY (24 * 3600 * 1000LL)
+// A night starts at local noon
+#define NIGHT_START_MSECS (12 * 3600 * 1000LL)
+// Julian day of the epoch, 1970-01-01
+#define EPOCH_JULIAN_DAY 2440588
+
+namespace
+{
+struct ObservingSites
+{
+    QList<QPair<QString, QTimeZone>> folders; // Longest first, ending with a slash
+    QTimeZone defaultZone;
+
+    ObservingSites()
+    {
+        QSettings settings;
+        defaultZone = QTimeZone(settings.value("ObservingTimeZone").toByteArray());
+        if (!defaultZone.isValid())
+            defaultZone = QTimeZone::systemTimeZone();
+
+        const int count = settings.beginReadArray("ObservingSites");
+        for (int i = 0; i < count; i++)
+        {
+            settings.setArrayIndex(i);
+            QString folder = settings.value("Folder").toString();
+            const QTimeZone zone(settings.value("TimeZone").toByteArray());
+            if (folder.isEmpty() || !zone.isValid())
+                continue;
+            if (!folder.endsWith('/'))
+                folder.append('/');
+            folders.append(qMakePair(folder, zone));
+        }
+        settings.endArray();
+        std::sort(folders.begin(), folders.end(), [](const QPair<QString, QTimeZone>& a, const QPair<QString, QTimeZone>& b) {
+            return a.first.size() > b.first.size();
+        });
+    }
+
+    const QTimeZone& zoneOf(const QString& directoryPath) const
+    {
+        for (auto& folder : folders)
+        {
+            if (directoryPath.startsWith(folder.first) || directoryPath + '/' == folder.first)
+                return folder.second;
+        }
+        return defaultZone;
+    }
+};
+
+// Read once, the first time a night is asked for
+const ObservingSites& observingSites()
+{
+    static const ObservingSites sites;
+    return sites;
+}
+}
+
+qint64 ObservingNight::parseTime(const QString &dateObs)
+{
+    if (dateObs.isEmpty())
+        return missingTime;
+    QDateTime dateTime = QDateTime::fromString(dateObs.trimmed(), Qt::ISODateWithMs);
+    if (!dateTime.isValid())
+        return missingTime;
+    if (dateTime.timeSpec() == Qt::LocalTime)
+        dateTime = QDateTime(dateTime.date(), dateTime.time(), Qt::UTC);
+    return dateTime.toMSecsSinceEpoch();
+}
+
+/*!
+ * \brief ObservingNight::nightOf
+ * The offset of the site at the time of the frame, so the nights follow the daylight
+ * saving time of the site.
+ */
+QDate ObservingNight::nightOf(qint64 time, const QString &directoryPath)
+{
+    if (time == missingTime)
+        return QDate();
+
+    const QTimeZone& zone = observingSites().zoneOf(directoryPath);
+    const qint64 offset = zone.offsetFromUtc(QDateTime::fromMSecsSinceEpoch(time, Qt::UTC)) * 1000LL;
+    const qint64 localTime = time + offset - NIGHT_START_MSECS;
+    // Rounded down, for the times before the epoch
+    qint64 day = localTime / MSECS_PER_DAY;
+    if (localTime % MSECS_PER_DAY < 0)
+        day--;
+    return QDate::fromJulianDay(day + EPOCH_JULIAN_DAY);
+}
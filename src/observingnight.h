@@ -0,0 +1,53 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef OBSERVINGNIGHT_H
+#define OBSERVINGNIGHT_H
+
+#include <QDate>
+#include <QString>
+
+#include <limits>
+
+/*!
+ * \brief The ObservingNight class
+ * The time of DATE-OBS as a number, and the night it belongs to. A night runs from
+ * noon to noon in the time zone of the site, and is named by the date of its evening,
+ * so the frames taken after midnight are in the same night as the ones before.
+ *
+ * The time zone of a file is the one of the longest folder of the ObservingSites
+ * setting it is in, else ObservingTimeZone, else the time zone of the system.
+ */
+class ObservingNight
+{
+public:
+    static constexpr qint64 missingTime = std::numeric_limits<qint64>::min();
+
+    // Milliseconds since the epoch, missingTime if DATE-OBS does not parse. Without an offset it is UTC, like FITS has it.
+    static qint64 parseTime(const QString& dateObs);
+    // Invalid for missingTime
+    static QDate nightOf(qint64 time, const QString& directoryPath);
+};
+
+#endif // OBSERVINGNIGHT_H
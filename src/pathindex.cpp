@@ -0,0 +1,145 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "pathindex.h"
+
+// The smallest table, a power of two
+#define PATH_INDEX_MIN_CAPACITY 1024
+
+PathIndex::PathIndex()
+{
+    clear();
+}
+
+/*!
+ * \brief PathIndex::find
+ * The slot of the path, or of the empty slot that ends its probe sequence. There is
+ * always one, as the table is never more than 3/4 full.
+ */
+int PathIndex::find(const QString &path, quint64 hash) const
+{
+    quint64 index = hash & mask;
+    while (true)
+    {
+        const Slot& slot = table.at(int(index));
+        if (slot.astroFile == nullptr)
+            return int(index);
+        // Two paths may have the same hash, so the match is verified
+        if (slot.hash == hash && slot.astroFile->FullPath == path)
+            return int(index);
+        index = (index + 1) & mask;
+    }
+}
+
+AstroFile *PathIndex::value(const QString &path, quint64 hash) const
+{
+    return table.at(find(path, hash)).astroFile;
+}
+
+AstroFile *PathIndex::value(const QString &path) const
+{
+    return value(path, FileRecord::hashOf(path));
+}
+
+void PathIndex::insert(AstroFile *astroFile, quint64 hash)
+{
+    Slot& slot = table[find(astroFile->FullPath, hash)];
+    if (slot.astroFile == nullptr)
+    {
+        used++;
+        slot.hash = hash;
+    }
+    slot.astroFile = astroFile;
+    if (used * 4 > table.count() * 3)
+        grow();
+}
+
+void PathIndex::insert(AstroFile *astroFile)
+{
+    insert(astroFile, FileRecord::hashOf(astroFile->FullPath));
+}
+
+/*!
+ * \brief PathIndex::remove
+ * Backward shift deletion: the entries after the hole that probed past it move back
+ * into it, so lookups never have to skip over tombstones.
+ */
+void PathIndex::remove(const QString &path, quint64 hash)
+{
+    quint64 hole = quint64(find(path, hash));
+    if (table.at(int(hole)).astroFile == nullptr)
+        return;
+
+    quint64 index = hole;
+    while (true)
+    {
+        index = (index + 1) & mask;
+        const Slot& slot = table.at(int(index));
+        if (slot.astroFile == nullptr)
+            break;
+        // Distance from where the entry wants to be, to where it is and to the hole
+        const quint64 home = slot.hash & mask;
+        if (((index - home) & mask) >= ((index - hole) & mask))
+        {
+            table[int(hole)] = slot;
+            hole = index;
+        }
+    }
+    table[int(hole)] = Slot();
+    used--;
+}
+
+void PathIndex::remove(const QString &path)
+{
+    remove(path, FileRecord::hashOf(path));
+}
+
+void PathIndex::clear()
+{
+    table.fill(Slot(), PATH_INDEX_MIN_CAPACITY);
+    mask = PATH_INDEX_MIN_CAPACITY - 1;
+    used = 0;
+}
+
+int PathIndex::count() const
+{
+    return used;
+}
+
+void PathIndex::grow()
+{
+    // The hashes are kept, so the paths are not hashed again
+    QVector<Slot> old(table.count() * 2);
+    old.swap(table);
+    mask = quint64(table.count()) - 1;
+    for (auto& slot : old)
+    {
+        if (slot.astroFile == nullptr)
+            continue;
+        quint64 index = slot.hash & mask;
+        while (table.at(int(index)).astroFile != nullptr)
+            index = (index + 1) & mask;
+        table[int(index)] = slot;
+    }
+}
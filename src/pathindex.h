@@ -0,0 +1,73 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include "astrofile.h"
+
+#include <QString>
+#include <QVector>
+
+/*!
+ * \brief The PathIndex class
+ * The catalog's files by full path. An open addressing table with linear probing,
+ * keyed by FileRecord::hashOf of the path, which the crawler already worked out for
+ * the records it lists. A lookup costs one probe sequence of 64 bit compares, and one
+ * string compare to verify the file that matched, instead of a string compare at every
+ * level of a tree.
+ *
+ * The paths are not kept in order. Not thread safe, the owner is expected to guard it.
+ */
+class PathIndex
+{
+public:
+    PathIndex();
+
+    AstroFile* value(const QString& path, quint64 hash) const;
+    AstroFile* value(const QString& path) const;
+    // Replaces the file that has the same path
+    void insert(AstroFile* astroFile, quint64 hash);
+    void insert(AstroFile* astroFile);
+    void remove(const QString& path, quint64 hash);
+    void remove(const QString& path);
+    void clear();
+    int count() const;
+
+private:
+    struct Slot
+    {
+        quint64 hash = 0;
+        AstroFile* astroFile = nullptr; // nullptr if empty
+    };
+
+    QVector<Slot> table;
+    int used = 0;
+    quint64 mask = 0;
+
+    int find(const QString& path, quint64 hash) const;
+    void grow();
+};
+
+#endif // PATHINDEX_H
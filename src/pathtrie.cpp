@@ -0,0 +1,112 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "pathtrie.h"
+
+#include <QDir>
+
+PathTrie::PathTrie()
+{
+    root = new Node();
+}
+
+PathTrie::~PathTrie()
+{
+    delete root;
+}
+
+QStringList PathTrie::components(const QString &path)
+{
+    return QDir::cleanPath(QDir::fromNativeSeparators(path)).split('/', Qt::SkipEmptyParts);
+}
+
+void PathTrie::insert(const QString &path)
+{
+    Node* node = root;
+    for (auto& part : components(path))
+    {
+        Node*& child = node->children[part];
+        if (child == nullptr)
+            child = new Node();
+        node = child;
+    }
+    // The same root may be inserted more than once, so count it
+    node->terminalCount++;
+}
+
+void PathTrie::remove(const QString &path)
+{
+    removeFrom(root, components(path), 0);
+}
+
+bool PathTrie::removeFrom(Node *node, const QStringList &parts, int depth)
+{
+    // Returns true if the node is no longer needed by any inserted path
+    if (depth == parts.count())
+    {
+        if (node->terminalCount > 0)
+            node->terminalCount--;
+        return node->terminalCount == 0 && node->children.isEmpty();
+    }
+
+    auto it = node->children.find(parts[depth]);
+    if (it == node->children.end())
+        return false;
+
+    if (removeFrom(it.value(), parts, depth + 1))
+    {
+        delete it.value();
+        node->children.erase(it);
+    }
+    return node->terminalCount == 0 && node->children.isEmpty();
+}
+
+void PathTrie::clear()
+{
+    delete root;
+    root = new Node();
+}
+
+bool PathTrie::isEmpty() const
+{
+    return root->terminalCount == 0 && root->children.isEmpty();
+}
+
+bool PathTrie::containsPrefixOf(const QString &path) const
+{
+    const Node* node = root;
+    if (node->terminalCount > 0)
+        return true;
+
+    for (auto& part : components(path))
+    {
+        auto it = node->children.constFind(part);
+        if (it == node->children.constEnd())
+            return false;
+        node = it.value();
+        if (node->terminalCount > 0)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,67 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef PATHTRIE_H
+#define PATHTRIE_H
+
+#include <QHash>
+#include <QString>
+
+/*!
+ * \brief The PathTrie class
+ * A trie of path components, used to check if a path is inside any of a set
+ * of root folders. A lookup costs O(path depth), independent of how many roots
+ * there are, and only matches on whole path components, so "/data/night1" is
+ * not considered to be inside "/data/night".
+ *
+ * Not thread safe. The owner is expected to guard it.
+ */
+class PathTrie
+{
+public:
+    PathTrie();
+    ~PathTrie();
+
+    void insert(const QString& path);
+    void remove(const QString& path);
+    void clear();
+    bool isEmpty() const;
+
+    // Returns true if the path is one of the inserted paths, or is inside one of them
+    bool containsPrefixOf(const QString& path) const;
+
+private:
+    struct Node
+    {
+        ~Node() { qDeleteAll(children); }
+        QHash<QString, Node*> children;
+        int terminalCount = 0;
+    };
+
+    Node* root;
+    static QStringList components(const QString& path);
+    static bool removeFrom(Node* node, const QStringList& parts, int depth);
+};
+
+#endif // PATHTRIE_H
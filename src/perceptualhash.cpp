@@ -0,0 +1,111 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "perceptualhash.h"
+
+#define DHASH_WIDTH 9
+#define DHASH_HEIGHT 8
+
+quint64 PerceptualHash::ofImage(const QImage &image)
+{
+    if (image.isNull())
+        return 0;
+
+    // Scaling down smoothly averages the pixels of every cell
+    const QImage small = image.scaled(DHASH_WIDTH, DHASH_HEIGHT, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+                             .convertToFormat(QImage::Format_Grayscale8);
+    quint64 hash = 0;
+    for (int y = 0; y < DHASH_HEIGHT; y++)
+    {
+        const uchar* line = small.constScanLine(y);
+        for (int x = 0; x < DHASH_WIDTH - 1; x++)
+        {
+            hash <<= 1;
+            if (line[x] > line[x + 1])
+                hash |= 1;
+        }
+    }
+    return hash;
+}
+
+void PerceptualHashIndex::clear()
+{
+    nodes.clear();
+}
+
+void PerceptualHashIndex::reserve(int count)
+{
+    nodes.reserve(count);
+}
+
+void PerceptualHashIndex::insert(int id, quint64 hash)
+{
+    Node node = {hash, id, 0, -1, -1};
+    if (nodes.isEmpty())
+    {
+        nodes.append(node);
+        return;
+    }
+
+    int parent = 0;
+    while (true)
+    {
+        const int distance = PerceptualHash::distance(hash, nodes.at(parent).hash);
+        int child = nodes.at(parent).firstChild;
+        while (child != -1 && nodes.at(child).distance != distance)
+            child = nodes.at(child).nextSibling;
+        if (child == -1)
+        {
+            node.distance = distance;
+            node.nextSibling = nodes.at(parent).firstChild;
+            nodes.append(node);
+            nodes[parent].firstChild = nodes.count() - 1;
+            return;
+        }
+        parent = child;
+    }
+}
+
+QVector<int> PerceptualHashIndex::find(quint64 hash, int radius) const
+{
+    QVector<int> ids;
+    if (nodes.isEmpty())
+        return ids;
+
+    QVector<int> pending = {0};
+    while (!pending.isEmpty())
+    {
+        const Node& node = nodes.at(pending.takeLast());
+        const int distance = PerceptualHash::distance(hash, node.hash);
+        if (distance <= radius)
+            ids.append(node.id);
+
+        // By the triangle inequality, only children at distance - radius to distance + radius can match
+        for (int child = node.firstChild; child != -1; child = nodes.at(child).nextSibling)
+        {
+            if (qAbs(nodes.at(child).distance - distance) <= radius)
+                pending.append(child);
+        }
+    }
+    return ids;
+}
@@ -0,0 +1,79 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef PERCEPTUALHASH_H
+#define PERCEPTUALHASH_H
+
+#include <QImage>
+#include <QVector>
+#include <QtAlgorithms>
+
+/*!
+ * \brief The PerceptualHash class
+ * A 64 bit difference hash (dHash) of an image: the image is reduced to 9x8 gray
+ * pixels, and every bit tells if a pixel is brighter than its right neighbour.
+ * Copies of a frame that were saved again, compressed differently or had their
+ * header edited have the same hash or one a few bits away, unlike the ImageHash.
+ *
+ * Computed from the stretched thumbnail, so frames of different bit depths compare.
+ * 0 means no hash, which is also the hash of a flat frame, that matches nothing useful.
+ */
+class PerceptualHash
+{
+public:
+    static quint64 ofImage(const QImage& image);
+    static int distance(quint64 a, quint64 b) { return qPopulationCount(a ^ b); }
+};
+
+/*!
+ * \brief The PerceptualHashIndex class
+ * A BK-tree of perceptual hashes, for the ids within a Hamming distance of a hash.
+ * Every child of a node is at a different distance from it, so a search only
+ * descends into the children whose distance is within the radius of the distance
+ * to the hash, which skips most of the tree for small radii.
+ *
+ * Nodes are kept in one array, with the children of a node in a linked list.
+ */
+class PerceptualHashIndex
+{
+public:
+    void clear();
+    void reserve(int count);
+    void insert(int id, quint64 hash);
+    // The ids whose hash is at most radius bits away from hash
+    QVector<int> find(quint64 hash, int radius) const;
+    int count() const { return nodes.count(); }
+
+private:
+    struct Node
+    {
+        quint64 hash;
+        int id;
+        int distance; // From the parent
+        int firstChild;
+        int nextSibling;
+    };
+    QVector<Node> nodes;
+};
+
+#endif // PERCEPTUALHASH_H
@@ -0,0 +1,205 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "pixelkernels.h"
+
+#include <QDebug>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define PIXEL_KERNELS_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define KERNEL_TARGET_AVX2
+#else
+#define KERNEL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// The same display function as AutoStretcher::stretchedValue
+static inline unsigned char stretchedValue(const DisplayConstants& c, float v)
+{
+    if (v < c.s)
+        return 0;
+    if (v > c.h)
+        return 255;
+    return (unsigned char)(c.A / (c.B - c.C / (v - c.s)) * 255);
+}
+
+static void floatRangeBaseline(const float* values, long long count, float& min, float& max)
+{
+    for (long long i = 0; i < count; i++)
+    {
+        const float x = values[i];
+        if (x > max)
+            max = x;
+        if (x < min)
+            min = x;
+    }
+}
+
+static void stretchFloatsBaseline(const float* values, long long count, const DisplayConstants& constants, unsigned char* out)
+{
+    for (long long i = 0; i < count; i++)
+        out[i] = stretchedValue(constants, values[i]);
+}
+
+static void packRgb32Baseline(const unsigned char* red, const unsigned char* green, const unsigned char* blue, long long count, unsigned int* out)
+{
+    for (long long i = 0; i < count; i++)
+        out[i] = 0xff000000u | (unsigned int)red[i] << 16 | (unsigned int)green[i] << 8 | blue[i];
+}
+
+#ifdef PIXEL_KERNELS_X86
+
+/*!
+ * \brief floatRangeAvx2
+ * Eight running minimums and maximums, started from min and max. A lane keeps its value
+ * when the pixel is NaN, as max_ps and min_ps return their second operand then.
+ */
+KERNEL_TARGET_AVX2 static void floatRangeAvx2(const float* values, long long count, float& min, float& max)
+{
+    __m256 lowest = _mm256_set1_ps(min);
+    __m256 highest = _mm256_set1_ps(max);
+    long long i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(values + i);
+        highest = _mm256_max_ps(x, highest);
+        lowest = _mm256_min_ps(x, lowest);
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, highest);
+    floatRangeBaseline(lanes, 8, min, max);
+    _mm256_storeu_ps(lanes, lowest);
+    floatRangeBaseline(lanes, 8, min, max);
+    floatRangeBaseline(values + i, count - i, min, max);
+}
+
+// The same operations as stretchedValue, in the same order, so the results match
+KERNEL_TARGET_AVX2 static void stretchFloatsAvx2(const float* values, long long count, const DisplayConstants& constants, unsigned char* out)
+{
+    const __m256 s = _mm256_set1_ps(constants.s);
+    const __m256 h = _mm256_set1_ps(constants.h);
+    const __m256 A = _mm256_set1_ps(constants.A);
+    const __m256 B = _mm256_set1_ps(constants.B);
+    const __m256 C = _mm256_set1_ps(constants.C);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 full = _mm256_set1_ps(255);
+    long long i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256 v = _mm256_loadu_ps(values + i);
+        __m256 y = _mm256_mul_ps(_mm256_div_ps(A, _mm256_sub_ps(B, _mm256_div_ps(C, _mm256_sub_ps(v, s)))), full);
+        y = _mm256_blendv_ps(y, full, _mm256_cmp_ps(v, h, _CMP_GT_OQ));
+        y = _mm256_blendv_ps(y, zero, _mm256_cmp_ps(v, s, _CMP_LT_OQ));
+
+        // Truncated, and packed to bytes: 32 to 16 bits, 16 to 8 bits, lanes put back in order
+        const __m256i words = _mm256_packus_epi32(_mm256_cvttps_epi32(y), _mm256_setzero_si256());
+        const __m256i bytes = _mm256_packus_epi16(words, _mm256_setzero_si256());
+        const __m256i ordered = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm256_castsi256_si128(ordered));
+    }
+    stretchFloatsBaseline(values + i, count - i, constants, out + i);
+}
+
+KERNEL_TARGET_AVX2 static void packRgb32Avx2(const unsigned char* red, const unsigned char* green, const unsigned char* blue, long long count, unsigned int* out)
+{
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+    long long i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256i r = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(red + i)));
+        const __m256i g = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(green + i)));
+        const __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(blue + i)));
+        const __m256i rgb = _mm256_or_si256(_mm256_or_si256(alpha, _mm256_slli_epi32(r, 16)), _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), rgb);
+    }
+    packRgb32Baseline(red + i, green + i, blue + i, count - i, out + i);
+}
+
+#endif
+
+CpuLevel PixelKernels::supportedLevel()
+{
+#ifdef PIXEL_KERNELS_X86
+#ifdef _MSC_VER
+    // AVX2 is leaf 7 EBX bit 5, and needs the OS to save the YMM registers
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    __cpuidex(info, 7, 0);
+    if (osxsave && (info[1] & (1 << 5)) != 0 && (_xgetbv(0) & 6) == 6)
+        return CpuAvx2;
+#else
+    if (__builtin_cpu_supports("avx2"))
+        return CpuAvx2;
+#endif
+#endif
+    return CpuBaseline;
+}
+
+QString PixelKernels::levelName(CpuLevel level)
+{
+    switch (level)
+    {
+    case CpuBaseline:
+        return "baseline";
+    case CpuAvx2:
+        return "avx2";
+    }
+    return QString();
+}
+
+CpuLevel PixelKernels::level()
+{
+    static const CpuLevel selected = []() {
+        CpuLevel supported = supportedLevel();
+        const QString requested = qEnvironmentVariable("ASTROCAT_CPU_LEVEL");
+        if (requested.isEmpty())
+            return supported;
+        for (CpuLevel level : {CpuBaseline, CpuAvx2})
+        {
+            if (levelName(level) == requested && level <= supported)
+                return level;
+        }
+        qWarning() << "ASTROCAT_CPU_LEVEL" << requested << "is not supported, using" << levelName(supported);
+        return supported;
+    }();
+    return selected;
+}
+
+const PixelKernels &PixelKernels::get()
+{
+    static const PixelKernels kernels = []() {
+        PixelKernels baseline = {floatRangeBaseline, stretchFloatsBaseline, packRgb32Baseline};
+#ifdef PIXEL_KERNELS_X86
+        if (level() == CpuAvx2)
+            return PixelKernels {floatRangeAvx2, stretchFloatsAvx2, packRgb32Avx2};
+#endif
+        return baseline;
+    }();
+    return kernels;
+}
@@ -0,0 +1,71 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+#include <QString>
+
+enum CpuLevel
+{
+    CpuBaseline, // What the build targets, SSE2 on x86-64
+    CpuAvx2
+};
+
+// The display function of AutoStretcher for one channel, in pixel values, see AutoStretcher::stretchedValue
+struct DisplayConstants
+{
+    float s;
+    float h;
+    float A;
+    float B;
+    float C;
+};
+
+/*!
+ * \brief The PixelKernels struct
+ * The hot loops over float frames, compiled for each CpuLevel. The kernels of the
+ * best level the CPU supports are picked once, on first use. Every level gives the
+ * same results as the baseline one, bit for bit.
+ *
+ * The level can be lowered with the ASTROCAT_CPU_LEVEL environment variable
+ * ("baseline" or "avx2"), to compare the levels. A level the CPU does not support
+ * is ignored.
+ */
+struct PixelKernels
+{
+    // Lowers min and raises max to the range of the values. NaNs are skipped, like a > and < compare does.
+    void (*floatRange)(const float* values, long long count, float& min, float& max);
+    // The display function of the values, truncated to 8 bits
+    void (*stretchFloats)(const float* values, long long count, const DisplayConstants& constants, unsigned char* out);
+    // Interleaves three 8 bit planes into RGB32 pixels, like qRgb
+    void (*packRgb32)(const unsigned char* red, const unsigned char* green, const unsigned char* blue, long long count, unsigned int* out);
+
+    static const PixelKernels& get();
+    static CpuLevel level();
+    static CpuLevel supportedLevel();
+    static QString levelName(CpuLevel level);
+};
+
+#endif // PIXELKERNELS_H
@@ -0,0 +1,106 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "pixmapcache.h"
+#include "metrics.h"
+
+static qsizetype kilobytesOf(const QPixmap& pixmap)
+{
+    return qMax<qsizetype>(1, (qint64)pixmap.width() * pixmap.height() * pixmap.depth() / 8 / 1024);
+}
+
+PixmapCache::PixmapCache(qint64 budgetBytes)
+{
+    setBudget(budgetBytes);
+}
+
+bool PixmapCache::find(const QString &key, QIcon *icon)
+{
+    static std::atomic<qint64>& hitCount = Metrics::counter("thumbnail_cache.hits");
+    static std::atomic<qint64>& missCount = Metrics::counter("thumbnail_cache.misses");
+
+    QIcon* cached = cache.object(key);
+    if (cached == nullptr)
+    {
+        _misses++;
+        missCount++;
+        return false;
+    }
+    _hits++;
+    hitCount++;
+    *icon = *cached;
+    return true;
+}
+
+bool PixmapCache::contains(const QString &key) const
+{
+    return cache.contains(key);
+}
+
+void PixmapCache::insert(const QString &key, const QPixmap &pixmap)
+{
+    if (pixmap.isNull())
+        return;
+
+    // The selected icon is the thumbnail itself, not tinted by the style
+    QIcon* icon = new QIcon;
+    icon->addPixmap(pixmap, QIcon::Normal);
+    icon->addPixmap(pixmap, QIcon::Selected);
+    cache.insert(key, icon, kilobytesOf(pixmap));
+}
+
+void PixmapCache::remove(const QString &key)
+{
+    cache.remove(key);
+}
+
+void PixmapCache::clear()
+{
+    cache.clear();
+}
+
+qint64 PixmapCache::evict(qint64 bytes)
+{
+    // QCache drops the least recently used objects when the cost is lowered
+    const qsizetype maxCost = cache.maxCost();
+    const qsizetype before = cache.totalCost();
+    cache.setMaxCost(qMax<qsizetype>(0, before - bytes / 1024));
+    cache.setMaxCost(maxCost);
+    return (qint64)(before - cache.totalCost()) * 1024;
+}
+
+void PixmapCache::setBudget(qint64 budgetBytes)
+{
+    cache.setMaxCost(qMax<qint64>(1, budgetBytes / 1024));
+}
+
+qint64 PixmapCache::budget() const
+{
+    return (qint64)cache.maxCost() * 1024;
+}
+
+qint64 PixmapCache::usedBytes() const
+{
+    return (qint64)cache.totalCost() * 1024;
+}
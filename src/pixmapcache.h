@@ -0,0 +1,72 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef PIXMAPCACHE_H
+#define PIXMAPCACHE_H
+
+#include <QCache>
+#include <QIcon>
+#include <QPixmap>
+#include <QString>
+
+/*!
+ * \brief The PixmapCache class
+ * The thumbnails shown by the FileViewModel, least recently used first out once they
+ * take more than the budget. Only used from the GUI thread, like QPixmap.
+ *
+ * Unlike the global QPixmapCache, the budget is for thumbnails only, and the hits and
+ * misses are counted, so the budget can be sized from them.
+ *
+ * Pixmaps are kept as the QIcon the view shows, made once when inserted instead of
+ * on every paint.
+ */
+class PixmapCache
+{
+public:
+    explicit PixmapCache(qint64 budgetBytes);
+
+    // Counts a hit or a miss, and makes the pixmap the most recently used one
+    bool find(const QString& key, QIcon* icon);
+    // Does not count, for checking what still has to be loaded
+    bool contains(const QString& key) const;
+    void insert(const QString& key, const QPixmap& pixmap);
+    void remove(const QString& key);
+    void clear();
+    // Removes the least recently used pixmaps, about bytes of them. Returns the bytes removed.
+    qint64 evict(qint64 bytes);
+
+    void setBudget(qint64 budgetBytes);
+    qint64 budget() const;
+    qint64 usedBytes() const;
+    qint64 hits() const { return _hits; }
+    qint64 misses() const { return _misses; }
+
+private:
+    // Costs are in kilobytes, so the budget fits in a qsizetype on 32 bit too
+    QCache<QString, QIcon> cache;
+    qint64 _hits = 0;
+    qint64 _misses = 0;
+};
+
+#endif // PIXMAPCACHE_H
@@ -0,0 +1,251 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "placeholderhash.h"
+
+#include <cmath>
+#include <cstring>
+
+#define PLACEHOLDER_HASH_VERSION 1
+// Of the image the coefficients are taken from, and of the one made from them
+#define PLACEHOLDER_HASH_IMAGE_SIZE 32
+#define LUMINANCE_COMPONENTS 5
+#define COLOR_COMPONENTS 3
+#define HEADER_BYTES 8
+
+namespace
+{
+// The luminance and the two color channels, the same ones ThumbHash uses
+struct Channels
+{
+    QVector<float> l;
+    QVector<float> p;
+    QVector<float> q;
+};
+
+// The coefficients of the first components x components cosines, the average first
+QVector<float> transform(const QVector<float>& channel, int width, int height, int components)
+{
+    QVector<float> coefficients;
+    coefficients.reserve(components * components);
+    QVector<float> cosX(width);
+    for (int cy = 0; cy < components; cy++)
+    {
+        for (int cx = 0; cx < components; cx++)
+        {
+            for (int x = 0; x < width; x++)
+                cosX[x] = std::cos(float(M_PI) / width * cx * (x + 0.5f));
+            float sum = 0;
+            for (int y = 0; y < height; y++)
+            {
+                const float cosY = std::cos(float(M_PI) / height * cy * (y + 0.5f));
+                const float* line = channel.constData() + y * width;
+                for (int x = 0; x < width; x++)
+                    sum += line[x] * cosX[x] * cosY;
+            }
+            coefficients.append(sum / (width * height));
+        }
+    }
+    return coefficients;
+}
+
+// The largest of the coefficients but the average, that the others are stored relative to
+float scaleOf(const QVector<float>& coefficients)
+{
+    float scale = 0;
+    for (int i = 1; i < coefficients.count(); i++)
+        scale = qMax(scale, std::fabs(coefficients.at(i)));
+    return scale;
+}
+
+quint8 toByte(float value)
+{
+    return quint8(qBound(0, int(std::lround(value * 255)), 255));
+}
+
+class NibbleWriter
+{
+public:
+    explicit NibbleWriter(quint8* bytes) : bytes(bytes) {}
+    void write(float value, float scale)
+    {
+        // -scale..scale to 0..15
+        const float normalized = scale > 0 ? value / scale : 0;
+        const int nibble = qBound(0, int(std::lround((normalized * 0.5f + 0.5f) * 15)), 15);
+        bytes[position / 2] |= (position % 2 == 0) ? nibble : nibble << 4;
+        position++;
+    }
+
+private:
+    quint8* bytes;
+    int position = 0;
+};
+
+class NibbleReader
+{
+public:
+    explicit NibbleReader(const quint8* bytes) : bytes(bytes) {}
+    float read(float scale)
+    {
+        const int nibble = (position % 2 == 0) ? bytes[position / 2] & 0xf : bytes[position / 2] >> 4;
+        position++;
+        return (nibble / 15.0f - 0.5f) * 2 * scale;
+    }
+
+private:
+    const quint8* bytes;
+    int position = 0;
+};
+}
+
+PlaceholderHash PlaceholderHash::ofImage(const QImage &image)
+{
+    PlaceholderHash hash;
+    if (image.isNull())
+        return hash;
+
+    const QImage small = image.scaled(PLACEHOLDER_HASH_IMAGE_SIZE, PLACEHOLDER_HASH_IMAGE_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation)
+                             .convertToFormat(QImage::Format_RGB32);
+    const int width = small.width();
+    const int height = small.height();
+
+    Channels channels;
+    channels.l.reserve(width * height);
+    channels.p.reserve(width * height);
+    channels.q.reserve(width * height);
+    for (int y = 0; y < height; y++)
+    {
+        const QRgb* line = reinterpret_cast<const QRgb*>(small.constScanLine(y));
+        for (int x = 0; x < width; x++)
+        {
+            const float r = qRed(line[x]) / 255.0f;
+            const float g = qGreen(line[x]) / 255.0f;
+            const float b = qBlue(line[x]) / 255.0f;
+            channels.l.append((r + g + b) / 3);
+            channels.p.append((r + g) / 2 - b);
+            channels.q.append(r - g);
+        }
+    }
+
+    const QVector<float> l = transform(channels.l, width, height, LUMINANCE_COMPONENTS);
+    const QVector<float> p = transform(channels.p, width, height, COLOR_COMPONENTS);
+    const QVector<float> q = transform(channels.q, width, height, COLOR_COMPONENTS);
+    const float lScale = scaleOf(l);
+    const float pScale = scaleOf(p);
+    const float qScale = scaleOf(q);
+
+    quint8* bytes = hash.bytes.data();
+    bytes[0] = PLACEHOLDER_HASH_VERSION;
+    // The short side over the long one, with the top bit set when the image is wider
+    const int shortSide = qMin(width, height);
+    const int longSide = qMax(width, height);
+    bytes[1] = quint8((width >= height ? 0x80 : 0) | qBound(1, int(std::lround(127.0f * shortSide / longSide)), 127));
+    bytes[2] = toByte(l.at(0));
+    bytes[3] = toByte(p.at(0) * 0.5f + 0.5f);
+    bytes[4] = toByte(q.at(0) * 0.5f + 0.5f);
+    bytes[5] = toByte(lScale);
+    bytes[6] = toByte(pScale);
+    bytes[7] = toByte(qScale);
+
+    NibbleWriter writer(bytes + HEADER_BYTES);
+    for (int i = 1; i < l.count(); i++)
+        writer.write(l.at(i), lScale);
+    for (int i = 1; i < p.count(); i++)
+        writer.write(p.at(i), pScale);
+    for (int i = 1; i < q.count(); i++)
+        writer.write(q.at(i), qScale);
+    return hash;
+}
+
+PlaceholderHash PlaceholderHash::fromByteArray(const QByteArray &bytes)
+{
+    PlaceholderHash hash;
+    // Hashes of another version are not read, the thumbnail is made again anyway
+    if (bytes.size() != PLACEHOLDER_HASH_BYTES || quint8(bytes.at(0)) != PLACEHOLDER_HASH_VERSION)
+        return hash;
+    memcpy(hash.bytes.data(), bytes.constData(), PLACEHOLDER_HASH_BYTES);
+    return hash;
+}
+
+QByteArray PlaceholderHash::toByteArray() const
+{
+    if (isNull())
+        return QByteArray();
+    return QByteArray(reinterpret_cast<const char*>(bytes.data()), PLACEHOLDER_HASH_BYTES);
+}
+
+QImage PlaceholderHash::toImage() const
+{
+    if (isNull())
+        return QImage();
+
+    const int ratio = bytes[1] & 0x7f;
+    const int shortSide = qMax(1, int(std::lround(float(PLACEHOLDER_HASH_IMAGE_SIZE) * ratio / 127)));
+    const int width = (bytes[1] & 0x80) ? PLACEHOLDER_HASH_IMAGE_SIZE : shortSide;
+    const int height = (bytes[1] & 0x80) ? shortSide : PLACEHOLDER_HASH_IMAGE_SIZE;
+
+    auto readChannel = [](NibbleReader& reader, float average, float scale, int components) {
+        QVector<float> coefficients(components * components);
+        coefficients[0] = average;
+        for (int i = 1; i < coefficients.count(); i++)
+            coefficients[i] = reader.read(scale);
+        return coefficients;
+    };
+    NibbleReader reader(bytes.data() + HEADER_BYTES);
+    const QVector<float> l = readChannel(reader, bytes[2] / 255.0f, bytes[5] / 255.0f, LUMINANCE_COMPONENTS);
+    const QVector<float> p = readChannel(reader, bytes[3] / 255.0f * 2 - 1, bytes[6] / 255.0f, COLOR_COMPONENTS);
+    const QVector<float> q = readChannel(reader, bytes[4] / 255.0f * 2 - 1, bytes[7] / 255.0f, COLOR_COMPONENTS);
+
+    // The inverse transform, the cosines other than the first have half the energy
+    auto valueAt = [](const QVector<float>& coefficients, int components, int x, int y, int width, int height) {
+        float value = 0;
+        for (int cy = 0; cy < components; cy++)
+        {
+            const float cosY = std::cos(float(M_PI) / height * cy * (y + 0.5f)) * (cy > 0 ? 2 : 1);
+            for (int cx = 0; cx < components; cx++)
+            {
+                const float cosX = std::cos(float(M_PI) / width * cx * (x + 0.5f)) * (cx > 0 ? 2 : 1);
+                value += coefficients.at(cy * components + cx) * cosX * cosY;
+            }
+        }
+        return value;
+    };
+
+    QImage image(width, height, QImage::Format_RGB32);
+    for (int y = 0; y < height; y++)
+    {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < width; x++)
+        {
+            const float lValue = valueAt(l, LUMINANCE_COMPONENTS, x, y, width, height);
+            const float pValue = valueAt(p, COLOR_COMPONENTS, x, y, width, height);
+            const float qValue = valueAt(q, COLOR_COMPONENTS, x, y, width, height);
+            const float b = lValue - 2.0f / 3 * pValue;
+            const float r = pValue + b + qValue / 2;
+            const float g = pValue + b - qValue / 2;
+            line[x] = qRgb(toByte(r), toByte(g), toByte(b));
+        }
+    }
+    return image;
+}
@@ -0,0 +1,62 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef PLACEHOLDERHASH_H
+#define PLACEHOLDERHASH_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+
+#include <array>
+
+#define PLACEHOLDER_HASH_BYTES 28
+
+/*!
+ * \brief The PlaceholderHash class
+ * A few bytes that a blurred version of a thumbnail is made again from, so a row can
+ * be painted before its thumbnail is loaded. Like ThumbHash, the image is reduced to
+ * a luminance and two color channels, which keep the low frequencies of their
+ * discrete cosine transform: 5x5 for the luminance and 3x3 for the colors, with the
+ * aspect ratio.
+ *
+ * Layout: version, aspect ratio, the averages of the three channels, the scales of
+ * their other coefficients, then the coefficients as 4 bit values. All zero bytes
+ * mean no hash.
+ */
+class PlaceholderHash
+{
+public:
+    static PlaceholderHash ofImage(const QImage& image);
+    static PlaceholderHash fromByteArray(const QByteArray& bytes);
+
+    bool isNull() const { return bytes[0] == 0; }
+    QByteArray toByteArray() const;
+    // Up to 32 pixels large, to be scaled up smoothly
+    QImage toImage() const;
+
+    std::array<quint8, PLACEHOLDER_HASH_BYTES> bytes {};
+};
+
+#endif // PLACEHOLDERHASH_H
@@ -0,0 +1,275 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "platesolver.h"
+#include "fitsfile.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "threadpriority.h"
+
+#include <QDebug>
+#include <QSettings>
+#include <QtConcurrent>
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
+// Frames solved at the same time, see solveFiles
+#define PLATE_SOLVE_THREADS 2
+// Frames are binned down to about twice this size to find their stars, like a thumbnail
+#define PLATE_SOLVE_FRAME_SIZE 1024
+// The brightest stars of a frame that make the quads
+#define PLATE_SOLVE_QUAD_STARS 25
+// The nearest stars each of them makes quads with
+#define PLATE_SOLVE_NEIGHBOURS 6
+// The brightest stars of a frame that must land on stars of the catalog
+#define PLATE_SOLVE_VERIFY_STARS 100
+// A frame with fewer stars is not solved
+#define PLATE_SOLVE_MIN_STARS 8
+// Of each coordinate of the code of a quad
+#define PLATE_SOLVE_CODE_TOLERANCE 0.01f
+// How far C and D of a quad may land from their stars of the catalog, relative to the distance of A and B
+#define PLATE_SOLVE_QUAD_TOLERANCE 0.02
+// Pixels between a star of the frame and a star of the catalog that match, at least
+#define PLATE_SOLVE_MATCH_PIXELS 3.0
+// ... or this part of the diagonal of the frame
+#define PLATE_SOLVE_MATCH_FRACTION 0.003
+// Stars of the frame on stars of the catalog a solution needs
+#define PLATE_SOLVE_MIN_MATCHES 10
+// Arcseconds per pixel, the scales a solution can have
+#define PLATE_SOLVE_MIN_SCALE 0.05
+#define PLATE_SOLVE_MAX_SCALE 600.0
+
+static const double arcsecondsPerRadian = 206264.806;
+
+PlateSolver::PlateSolver(QObject *parent) : QObject(parent)
+{
+    pool.setMaxThreadCount(PLATE_SOLVE_THREADS);
+}
+
+void PlateSolver::cancel()
+{
+    cancellationToken.cancel();
+}
+
+/*
+ * A frame mapped onto the plane tangent to the sky at a star of the catalog: a pixel
+ * is a * t + b, with t the point of the plane, or its conjugate for a mirrored frame.
+ */
+struct SkyMapping
+{
+    double centerRa;
+    double centerDec;
+    std::complex<double> a;
+    std::complex<double> b;
+    bool mirrored;
+
+    std::complex<double> pixelOf(std::complex<double> t) const { return a * (mirrored ? std::conj(t) : t) + b; }
+    std::complex<double> planeOf(std::complex<double> pixel) const
+    {
+        const std::complex<double> t = (pixel - b) / a;
+        return mirrored ? std::conj(t) : t;
+    }
+};
+
+// The stars of the frame that land on a star of the catalog
+static int countMatches(const QuadIndex& index, const SkyMapping& mapping, const std::vector<std::complex<double>>& stars,
+                        int width, int height, double& ra, double& dec)
+{
+    const double diagonal = std::hypot(width, height);
+    QuadIndex::deproject(mapping.planeOf({width / 2.0, height / 2.0}), mapping.centerRa, mapping.centerDec, ra, dec);
+    const double radius = diagonal / 2 * arcsecondsPerRadian / std::abs(mapping.a) / 3600;
+
+    QVector<int> near;
+    index.starsNear(ra, dec, radius, near);
+    std::vector<std::complex<double>> catalogPixels;
+    catalogPixels.reserve(near.count());
+    for (int s : near)
+    {
+        const QuadIndex::Star& star = index.star(s);
+        const std::complex<double> pixel = mapping.pixelOf(QuadIndex::project(star.ra, star.dec, mapping.centerRa, mapping.centerDec));
+        if (pixel.real() >= 0 && pixel.real() < width && pixel.imag() >= 0 && pixel.imag() < height)
+            catalogPixels.push_back(pixel);
+    }
+
+    const double matchRadius = std::max(PLATE_SOLVE_MATCH_PIXELS, PLATE_SOLVE_MATCH_FRACTION * diagonal);
+    int matches = 0;
+    for (auto& star : stars)
+    {
+        for (auto& pixel : catalogPixels)
+        {
+            if (std::abs(pixel - star) <= matchRadius)
+            {
+                matches++;
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+/*!
+ * \brief PlateSolver::solve
+ * Each of the PLATE_SOLVE_QUAD_STARS brightest stars makes quads with every three of its
+ * PLATE_SOLVE_NEIGHBOURS nearest ones, like the quads of the index. A quad is looked up
+ * as it is and mirrored, for the optics that flip the frame. The first mapping with
+ * PLATE_SOLVE_MIN_MATCHES stars on the catalog is the solution.
+ */
+bool PlateSolver::solve(const QuadIndex &index, std::vector<DetectedStar> stars, int width, int height,
+                        PlateSolution &solution, const CancellationToken &token)
+{
+    if (!index.isOpen() || stars.size() < PLATE_SOLVE_MIN_STARS || width <= 0 || height <= 0)
+        return false;
+
+    std::sort(stars.begin(), stars.end(), [](const DetectedStar& a, const DetectedStar& b) { return a.flux > b.flux; });
+    std::vector<std::complex<double>> points;
+    for (size_t i = 0; i < std::min<size_t>(stars.size(), PLATE_SOLVE_VERIFY_STARS); i++)
+        points.push_back({stars[i].x, stars[i].y});
+    const int quadStars = std::min<int>(int(points.size()), PLATE_SOLVE_QUAD_STARS);
+
+    QVector<int> candidates;
+    std::vector<QPair<double, int>> neighbours;
+    for (int i = 0; i < quadStars; i++)
+    {
+        neighbours.clear();
+        for (int j = 0; j < quadStars; j++)
+            if (j != i)
+                neighbours.push_back({std::abs(points[j] - points[i]), j});
+        const int count = std::min<int>(PLATE_SOLVE_NEIGHBOURS, int(neighbours.size()));
+        std::partial_sort(neighbours.begin(), neighbours.begin() + count, neighbours.end());
+
+        for (int p = 0; p < count; p++)
+        for (int q = p + 1; q < count; q++)
+        for (int r = q + 1; r < count; r++)
+        {
+            if (token.isCanceled())
+                return false;
+            const int members[4] = {i, neighbours[p].second, neighbours[q].second, neighbours[r].second};
+            for (bool mirrored : {false, true})
+            {
+                std::complex<double> quadPoints[4];
+                for (int k = 0; k < 4; k++)
+                    quadPoints[k] = mirrored ? std::conj(points[members[k]]) : points[members[k]];
+                int order[4];
+                float code[4];
+                if (!QuadIndex::quadCode(quadPoints, order, code))
+                    continue;
+
+                candidates.clear();
+                index.findQuads(code, PLATE_SOLVE_CODE_TOLERANCE, candidates);
+                for (int candidate : candidates)
+                {
+                    const QuadIndex::Quad& quad = index.quad(candidate);
+                    const QuadIndex::Star& a = index.star(int(quad.stars[0]));
+                    SkyMapping mapping = {a.ra, a.dec, 0, 0, mirrored};
+                    std::complex<double> plane[4];
+                    std::complex<double> pixels[4];
+                    for (int k = 0; k < 4; k++)
+                    {
+                        const QuadIndex::Star& star = index.star(int(quad.stars[k]));
+                        const std::complex<double> t = QuadIndex::project(star.ra, star.dec, a.ra, a.dec);
+                        plane[k] = mirrored ? std::conj(t) : t;
+                        pixels[k] = points[members[order[k]]];
+                    }
+                    mapping.a = (pixels[1] - pixels[0]) / (plane[1] - plane[0]);
+                    mapping.b = pixels[0] - mapping.a * plane[0];
+                    const double scale = arcsecondsPerRadian / std::abs(mapping.a);
+                    if (!(scale >= PLATE_SOLVE_MIN_SCALE && scale <= PLATE_SOLVE_MAX_SCALE))
+                        continue;
+                    const double tolerance = PLATE_SOLVE_QUAD_TOLERANCE * std::abs(pixels[1] - pixels[0]);
+                    if (std::abs(mapping.a * plane[2] + mapping.b - pixels[2]) > tolerance ||
+                        std::abs(mapping.a * plane[3] + mapping.b - pixels[3]) > tolerance)
+                        continue;
+
+                    double ra, dec;
+                    if (countMatches(index, mapping, points, width, height, ra, dec) < PLATE_SOLVE_MIN_MATCHES)
+                        continue;
+
+                    // North is eta, the imaginary axis of the plane
+                    const std::complex<double> north = mapping.a * (mirrored ? std::complex<double>(0, -1) : std::complex<double>(0, 1));
+                    solution.ra = ra;
+                    solution.dec = dec;
+                    solution.rotation = std::fmod(qRadiansToDegrees(std::arg(north)) - 90 + 720, 360);
+                    solution.scale = scale;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/*!
+ * \brief PlateSolver::solveFiles
+ * The index is opened with the first batch, and again when the setting changed.
+ */
+void PlateSolver::solveFiles(const QList<AstroFile> &astroFiles)
+{
+    const QString indexPath = QSettings().value("PlateSolverIndex").toString();
+    if (!index.isOpen() || index.path() != indexPath)
+    {
+        if (indexPath.isEmpty() || !index.open(indexPath))
+        {
+            qWarning() << "Plate solving: could not open the quad index" << indexPath;
+            emit filesSolved(QList<AstroFile>());
+            return;
+        }
+    }
+
+    static std::atomic<qint64>& solvedCount = Metrics::counter("platesolve.solved");
+    static std::atomic<qint64>& unsolvedCount = Metrics::counter("platesolve.unsolved");
+    QList<AstroFile> solved = astroFiles;
+    QtConcurrent::blockingMap(&pool, solved, [this](AstroFile& astroFile) {
+        ThreadPriority::setBackground(true);
+        astroFile.Solution = solveFile(astroFile);
+        (astroFile.Solution.isSolved() ? solvedCount : unsolvedCount)++;
+    });
+    // The files not solved when canceled are the first ones next time
+    if (!cancellationToken.isCanceled())
+        emit filesSolved(solved);
+}
+
+PlateSolution PlateSolver::solveFile(const AstroFile &astroFile)
+{
+    static LatencyHistogram& solveLatency = Metrics::histogram("platesolve.frame");
+    ScopedLatency latency(solveLatency);
+
+    PlateSolution solution;
+    if (cancellationToken.isCanceled() || ObjectStore::isObjectPath(astroFile.FullPath))
+        return solution;
+
+    // The stars of the binned frame, measured like for the FrameQuality
+    FitsFile fitsFile;
+    fitsFile.setHashImage(false);
+    fitsFile.setAnalyzeFrame(true);
+    fitsFile.setCancellationToken(cancellationToken);
+    if (!fitsFile.loadFile(astroFile.FullPath))
+        return solution;
+    fitsFile.extractImage(PLATE_SOLVE_FRAME_SIZE);
+    const QSize size = fitsFile.getFullSize();
+    if (!solve(index, fitsFile.getStars(), size.width(), size.height(), solution, cancellationToken))
+        return PlateSolution();
+    return solution;
+}
@@ -0,0 +1,79 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef PLATESOLVER_H
+#define PLATESOLVER_H
+
+#include "astrofile.h"
+#include "cancellationtoken.h"
+#include "frameanalyzer.h"
+#include "quadindex.h"
+
+#include <QList>
+#include <QObject>
+#include <QThreadPool>
+
+#include <vector>
+
+/*!
+ * \brief The PlateSolver class
+ * Finds where on the sky the frames without OBJCTRA and OBJCTDEC were taken, from the
+ * stars FrameAnalyzer finds in them, so they have a position in the catalog too.
+ *
+ * The quads of the brightest stars of a frame are looked up by their code in the
+ * QuadIndex of a star catalog, the PlateSolverIndex setting. Each quad found there
+ * maps the frame onto the sky, which is kept when enough of the other stars of the
+ * frame land on stars of the catalog. Nothing is known of the scale of the frame.
+ *
+ * Frames are solved on PLATE_SOLVE_THREADS threads in the background priority, see
+ * ThreadPriority. Lives on a thread of its own.
+ */
+class PlateSolver : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PlateSolver(QObject *parent = nullptr);
+
+    void cancel();
+
+    // The stars in pixels of a frame of width by height pixels. False when it could not be solved.
+    static bool solve(const QuadIndex& index, std::vector<DetectedStar> stars, int width, int height,
+                      PlateSolution& solution, const CancellationToken& token = CancellationToken());
+
+public slots:
+    void solveFiles(const QList<AstroFile>& astroFiles);
+
+signals:
+    // With their Solution, NaN for the ones that could not be solved. Empty when there is no index.
+    void filesSolved(const QList<AstroFile>& astroFiles);
+
+private:
+    PlateSolution solveFile(const AstroFile& astroFile);
+
+    QuadIndex index;
+    QThreadPool pool;
+    CancellationToken cancellationToken;
+};
+
+#endif // PLATESOLVER_H
@@ -0,0 +1,412 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "previewstacker.h"
+#include "filereader.h"
+#include "fitsfile.h"
+#include "metrics.h"
+
+#include <QSettings>
+
+#include <algorithm>
+#include <cmath>
+
+// Pixels on the longer side of the stack, about
+#define STACK_PREVIEW_SIZE 1024
+// Pixels this many standard deviations from the mean are rejected
+#define STACK_CLIP_SIGMA 3.0
+// Frames integrated before pixels are rejected
+#define STACK_CLIP_MIN_FRAMES 3
+// The brightest stars of each frame that the translation is found with
+#define STACK_ALIGN_STARS 40
+// Stars of two frames match when they are this close once aligned, in pixels of the stack
+#define STACK_MATCH_RADIUS 1.5f
+// Matched stars a translation needs
+#define STACK_MIN_MATCHES 4
+
+PreviewStacker::PreviewStacker(QObject *parent) : QObject(parent)
+{
+    frameSize = qMax(64, QSettings().value("StackPreviewSize", STACK_PREVIEW_SIZE).toInt());
+    clipSigma = float(QSettings().value("StackClipSigma", STACK_CLIP_SIGMA).toDouble());
+}
+
+PreviewStacker::~PreviewStacker()
+{
+    token.cancel();
+    pool.clear();
+    pool.waitForDone();
+}
+
+/*!
+ * \brief PreviewStacker::start
+ * The reference is read first, alone, the other frames only once it is known.
+ */
+void PreviewStacker::start(const QStringList &paths, const QByteArray &stretchParameters)
+{
+    QMutexLocker locker(&mutex);
+    token.cancel();
+    pool.clear();
+    token = CancellationToken();
+    this->paths = paths;
+    hasParams = StretchParams::fromByteArray(stretchParameters, params);
+    reference = Frame();
+    counts.clear();
+    means.clear();
+    deviations.clear();
+    integrated = 0;
+    skipped = 0;
+    stacked = QImage();
+
+    const CancellationToken frameToken = token;
+    pool.start([this, frameToken]() { stackReference(0, frameToken); });
+}
+
+int PreviewStacker::frameCount() const
+{
+    QMutexLocker locker(&mutex);
+    return paths.size();
+}
+
+int PreviewStacker::integratedCount() const
+{
+    QMutexLocker locker(&mutex);
+    return integrated;
+}
+
+int PreviewStacker::skippedCount() const
+{
+    QMutexLocker locker(&mutex);
+    return skipped;
+}
+
+QImage PreviewStacker::image() const
+{
+    QMutexLocker locker(&mutex);
+    return stacked;
+}
+
+/*!
+ * \brief PreviewStacker::stackReference
+ * Runs on the pool. A frame that cannot be read is skipped, and the next one tried.
+ * The frames after the reference are queued in their order.
+ */
+void PreviewStacker::stackReference(int index, CancellationToken frameToken)
+{
+    QString path;
+    {
+        QMutexLocker locker(&mutex);
+        if (frameToken.isCanceled() || index >= paths.size())
+            return;
+        path = paths.at(index);
+    }
+
+    Frame frame;
+    if (!readFrame(path, frameToken, frame))
+    {
+        QMutexLocker locker(&mutex);
+        if (frameToken.isCanceled())
+            return;
+        skipped++;
+        pool.start([this, index, frameToken]() { stackReference(index + 1, frameToken); });
+        locker.unlock();
+        emit imageReady();
+        return;
+    }
+
+    {
+        QMutexLocker locker(&mutex);
+        if (frameToken.isCanceled())
+            return;
+        params = frame.params;
+        hasParams = true;
+        const size_t size = frame.pixels.size();
+        counts.assign(size, 0);
+        means.assign(size, 0);
+        deviations.assign(size, 0);
+        integrate(frame, 0, 0);
+        frame.pixels = std::vector<float>();
+        reference = std::move(frame);
+        for (int next = index + 1; next < paths.size(); next++)
+            pool.start([this, next, frameToken]() { stackFrame(next, frameToken); }, paths.size() - next);
+    }
+    render();
+}
+
+// Runs on the pool
+void PreviewStacker::stackFrame(int index, CancellationToken frameToken)
+{
+    QString path;
+    Frame target; // The reference, without its pixels
+    {
+        QMutexLocker locker(&mutex);
+        if (frameToken.isCanceled())
+            return;
+        path = paths.at(index);
+        target = reference;
+    }
+
+    static LatencyHistogram& frameLatency = Metrics::histogram("stack.frame");
+    Frame frame;
+    float dx = 0;
+    float dy = 0;
+    bool aligned;
+    {
+        ScopedLatency latency(frameLatency);
+        aligned = readFrame(path, frameToken, frame) && frame.width == target.width && frame.height == target.height
+                && frame.channels == target.channels && align(frame, target, dx, dy);
+    }
+
+    {
+        QMutexLocker locker(&mutex);
+        if (frameToken.isCanceled())
+            return;
+        if (aligned)
+            integrate(frame, dx, dy);
+        else
+            skipped++;
+    }
+    if (aligned)
+        render();
+    else
+        emit imageReady();
+}
+
+/*!
+ * \brief PreviewStacker::readFrame
+ * The frame is binned while it is read, and its stars measured on the binned frame.
+ * The linear image is normalized to the range of the stretch of the reference, so
+ * the frames have the same scale.
+ */
+bool PreviewStacker::readFrame(const QString &path, const CancellationToken &frameToken, Frame &frame)
+{
+    StretchParams frameParams;
+    bool hasFrameParams;
+    {
+        QMutexLocker locker(&mutex);
+        frameParams = params;
+        hasFrameParams = hasParams;
+    }
+
+    FileReader reader;
+    FitsFile fits;
+    fits.setHashImage(false);
+    fits.setAnalyzeFrame(true);
+    fits.setMakeLinearImage(true);
+    fits.setCancellationToken(frameToken);
+    if (hasFrameParams)
+        fits.setStretchParams(frameParams);
+    if (!reader.open(path) || !fits.loadFile(path, reader.data(), reader.size()))
+        return false;
+    fits.extractTags();
+    fits.extractImage(frameSize / 2);
+    const QImage linear = fits.getLinearImage();
+    if (linear.isNull() || frameToken.isCanceled())
+        return false;
+
+    frame.width = linear.width();
+    frame.height = linear.height();
+    frame.channels = linear.format() == QImage::Format_Grayscale16 ? 1 : 3;
+    frame.params = fits.getStretchParams();
+    const size_t count = size_t(frame.width) * frame.height;
+    frame.pixels.resize(count * frame.channels);
+    for (int y = 0; y < frame.height; y++)
+    {
+        float* row = frame.pixels.data() + size_t(y) * frame.width;
+        if (frame.channels == 1)
+        {
+            const quint16* line = reinterpret_cast<const quint16*>(linear.constScanLine(y));
+            for (int x = 0; x < frame.width; x++)
+                row[x] = line[x] / 65535.0f;
+        }
+        else
+        {
+            const QRgba64* line = reinterpret_cast<const QRgba64*>(linear.constScanLine(y));
+            for (int x = 0; x < frame.width; x++)
+            {
+                row[x] = line[x].red() / 65535.0f;
+                row[count + x] = line[x].green() / 65535.0f;
+                row[2 * count + x] = line[x].blue() / 65535.0f;
+            }
+        }
+    }
+
+    // The stars are in pixels of the full frame
+    const float scale = float(fits.getFullSize().width()) / frame.width;
+    frame.stars = fits.getStars();
+    for (auto& star : frame.stars)
+    {
+        star.x /= scale;
+        star.y /= scale;
+    }
+    std::sort(frame.stars.begin(), frame.stars.end(), [](const DetectedStar& a, const DetectedStar& b) { return a.flux > b.flux; });
+    if (frame.stars.size() > STACK_ALIGN_STARS)
+        frame.stars.resize(STACK_ALIGN_STARS);
+    return true;
+}
+
+/*!
+ * \brief PreviewStacker::align
+ * The translation from the reference to the frame, (dx, dy). Every pair of a star of
+ * each is a candidate, and the one most other stars agree with wins. The agreeing
+ * offsets are averaged, so the translation is finer than a pixel.
+ */
+bool PreviewStacker::align(const Frame &frame, const Frame &reference, float &dx, float &dy)
+{
+    const int minMatches = qMin<int>(STACK_MIN_MATCHES, int(reference.stars.size()));
+    if (minMatches < 2 || frame.stars.size() < size_t(minMatches))
+        return false;
+
+    const float radius2 = STACK_MATCH_RADIUS * STACK_MATCH_RADIUS;
+    int bestMatches = 0;
+    float bestX = 0;
+    float bestY = 0;
+    for (const auto& from : reference.stars)
+    {
+        for (const auto& to : frame.stars)
+        {
+            const float offsetX = to.x - from.x;
+            const float offsetY = to.y - from.y;
+            int matches = 0;
+            float sumX = 0;
+            float sumY = 0;
+            for (const auto& star : reference.stars)
+            {
+                for (const auto& candidate : frame.stars)
+                {
+                    const float ex = candidate.x - star.x - offsetX;
+                    const float ey = candidate.y - star.y - offsetY;
+                    if (ex * ex + ey * ey <= radius2)
+                    {
+                        matches++;
+                        sumX += candidate.x - star.x;
+                        sumY += candidate.y - star.y;
+                        break;
+                    }
+                }
+            }
+            if (matches > bestMatches)
+            {
+                bestMatches = matches;
+                bestX = sumX / matches;
+                bestY = sumY / matches;
+            }
+        }
+    }
+    if (bestMatches < minMatches)
+        return false;
+    dx = bestX;
+    dy = bestY;
+    return true;
+}
+
+/*!
+ * \brief PreviewStacker::integrate
+ * Adds the frame, sampled bilinearly at the pixels of the reference shifted by (dx, dy),
+ * to the running mean of each pixel. Pixels of the reference the frame does not cover
+ * get nothing. The caller must hold the mutex.
+ */
+void PreviewStacker::integrate(const Frame &frame, float dx, float dy)
+{
+    const int width = frame.width;
+    const int height = frame.height;
+    const size_t count = size_t(width) * height;
+    for (int k = 0; k < frame.channels; k++)
+    {
+        const float* plane = frame.pixels.data() + k * count;
+        for (int y = 0; y < height; y++)
+        {
+            const float sy = y + dy;
+            const int y0 = int(std::floor(sy));
+            if (y0 < 0 || y0 + 1 >= height)
+                continue;
+            const float fy = sy - y0;
+            for (int x = 0; x < width; x++)
+            {
+                const float sx = x + dx;
+                const int x0 = int(std::floor(sx));
+                if (x0 < 0 || x0 + 1 >= width)
+                    continue;
+                const float fx = sx - x0;
+                const float* p = plane + size_t(y0) * width + x0;
+                const float value = (p[0] * (1 - fx) + p[1] * fx) * (1 - fy) + (p[width] * (1 - fx) + p[width + 1] * fx) * fy;
+
+                // Welford's running mean and variance
+                const size_t i = k * count + size_t(y) * width + x;
+                const int n = counts[i];
+                const float delta = value - means[i];
+                if (n >= STACK_CLIP_MIN_FRAMES && delta * delta > clipSigma * clipSigma * deviations[i] / (n - 1))
+                    continue;
+                counts[i] = quint16(n + 1);
+                means[i] += delta / (n + 1);
+                deviations[i] += delta * (value - means[i]);
+            }
+        }
+    }
+    integrated++;
+}
+
+/*!
+ * \brief PreviewStacker::render
+ * Stretches the mean, with statistics of its own, since noise goes down as frames are
+ * added. A frame integrated while the stack is stretched gets one more pass, the
+ * others wait for none.
+ */
+void PreviewStacker::render()
+{
+    QMutexLocker locker(&mutex);
+    if (rendering)
+    {
+        renderAgain = true;
+        return;
+    }
+    rendering = true;
+    do
+    {
+        renderAgain = false;
+        std::vector<float> mean = means;
+        const int width = reference.width;
+        const int height = reference.height;
+        const int channels = reference.channels;
+        const CancellationToken frameToken = token;
+        locker.unlock();
+
+        QImage image;
+        if (!mean.empty())
+        {
+            AutoStretcher<float> as(width, height, channels, 0);
+            as.setCancellationToken(frameToken);
+            as.setData(mean.data());
+            as.calculateParams();
+            if (!frameToken.isCanceled())
+                image = as.stretchToImage(true);
+        }
+
+        locker.relock();
+        if (!frameToken.isCanceled())
+            stacked = image;
+    } while (renderAgain && !token.isCanceled());
+    rendering = false;
+    locker.unlock();
+    emit imageReady();
+}
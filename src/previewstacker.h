@@ -0,0 +1,114 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef PREVIEWSTACKER_H
+#define PREVIEWSTACKER_H
+
+#include "autostretcher.h"
+#include "cancellationtoken.h"
+#include "frameanalyzer.h"
+#include "taskscheduler.h"
+
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+
+#include <vector>
+
+/*!
+ * \brief The PreviewStacker class
+ * A rough stack of FITS frames, to judge how much data a target has.
+ *
+ * The frames are binned while they are read, like blink frames, to about
+ * StackPreviewSize pixels on the longer side, and normalized like the first one. The
+ * first frame that can be read is the reference: the others are aligned on it by a
+ * translation, from the offsets of the stars FrameAnalyzer finds in both, and are
+ * integrated into a running mean. From the third frame on, a pixel further than
+ * StackClipSigma standard deviations from the mean so far is rejected, which keeps out
+ * satellites, planes and hot pixels.
+ *
+ * The frames are read and aligned on worker threads in parallel, and integrated as they
+ * come. The stack is stretched again after each one, see imageReady. Frames of another
+ * size or number of channels than the reference, or that could not be aligned, are
+ * skipped.
+ */
+class PreviewStacker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PreviewStacker(QObject *parent = nullptr);
+    ~PreviewStacker();
+
+    // Starts stacking the frames, in place of the ones before. The stretch is the stored one of the first frame, or empty.
+    void start(const QStringList& paths, const QByteArray& stretchParameters);
+    int frameCount() const;
+    int integratedCount() const;
+    int skippedCount() const;
+    // The stretched stack of the frames integrated so far, null before the first one
+    QImage image() const;
+
+signals:
+    void imageReady();
+
+private:
+    struct Frame
+    {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        std::vector<float> pixels; // Channel after channel, in [0, 1]
+        std::vector<DetectedStar> stars; // In pixels of this frame, brightest first
+        StretchParams params;
+    };
+
+    QStringList paths;
+    int frameSize;
+    float clipSigma;
+
+    mutable QMutex mutex;
+    CancellationToken token;
+    bool hasParams = false;
+    StretchParams params;
+    Frame reference; // Without its pixels, once they are integrated
+    // Of every pixel of every channel, the frames integrated, their mean and the sum of their squared deviations
+    std::vector<quint16> counts;
+    std::vector<float> means;
+    std::vector<float> deviations;
+    int integrated = 0;
+    int skipped = 0;
+    QImage stacked;
+    bool rendering = false;
+    bool renderAgain = false;
+    TaskGroup pool {InteractivePriority};
+
+    void stackReference(int index, CancellationToken frameToken);
+    void stackFrame(int index, CancellationToken frameToken);
+    bool readFrame(const QString& path, const CancellationToken& frameToken, Frame& frame);
+    void integrate(const Frame& frame, float dx, float dy);
+    void render();
+    static bool align(const Frame& frame, const Frame& reference, float& dx, float& dy);
+};
+
+#endif // PREVIEWSTACKER_H
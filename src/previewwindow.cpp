@@ -0,0 +1,144 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "previewwindow.h"
+
+#include <QFileInfo>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QWheelEvent>
+
+#include <cmath>
+
+#define PREVIEW_ZOOM_STEP 1.25
+// Displayed pixels per image pixel at the closest zoom
+#define PREVIEW_MAX_SCALE 16.0
+
+PreviewWindow::PreviewWindow(const QString &filePath, const QByteArray &stretchParameters, QWidget *parent) : QWidget(parent, Qt::Window)
+{
+    setWindowTitle(QFileInfo(filePath).fileName());
+    resize(1024, 768);
+
+    connect(&preview, &TiledPreview::coarseImageReady, this, [this]() { placeholder = QImage(); fitToWindow(); update(); });
+    connect(&preview, &TiledPreview::tileReady, this, QOverload<>::of(&QWidget::update));
+    failedToOpen = !preview.open(filePath, stretchParameters);
+}
+
+void PreviewWindow::setPlaceholder(const QImage &image)
+{
+    placeholder = image;
+    update();
+}
+
+void PreviewWindow::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::black);
+
+    const QImage coarse = preview.coarseImage();
+    if ((coarse.isNull() || scale == 0) && !placeholder.isNull() && !failedToOpen)
+    {
+        const QSize fitted = placeholder.size().scaled(size(), Qt::KeepAspectRatio);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(QRect(QPoint((width() - fitted.width()) / 2, (height() - fitted.height()) / 2), fitted), placeholder);
+        return;
+    }
+    if (coarse.isNull() || scale == 0)
+    {
+        painter.setPen(Qt::gray);
+        painter.drawText(rect(), Qt::AlignCenter, failedToOpen ? tr("Could not open the file") : tr("Loading..."));
+        return;
+    }
+
+    // Smoothed while zoomed out, single pixels show as squares when zoomed in
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, scale < 1);
+    const QSize size = preview.imageSize();
+    painter.drawImage(toWidget(QRectF(QPointF(0, 0), QSizeF(size))), coarse);
+
+    const int level = preview.levelForScale(scale);
+    if (level < 0)
+        return;
+    const QRectF visible(center - QPointF(width(), height()) / (2 * scale), QSizeF(width(), height()) / scale);
+    for (auto& tile : preview.tiles(level, visible.toAlignedRect()))
+        painter.drawImage(toWidget(QRectF(tile.rect)), tile.image);
+}
+
+void PreviewWindow::wheelEvent(QWheelEvent *event)
+{
+    if (scale == 0)
+        return;
+
+    // The image pixel under the cursor stays there
+    const QPointF offset = event->position() - QPointF(width(), height()) / 2;
+    const QPointF anchor = center + offset / scale;
+    const double steps = event->angleDelta().y() / 120.0;
+    scale = qBound(fitScale() / 2, scale * std::pow(PREVIEW_ZOOM_STEP, steps), PREVIEW_MAX_SCALE);
+    center = anchor - offset / scale;
+    update();
+}
+
+void PreviewWindow::mousePressEvent(QMouseEvent *event)
+{
+    lastMousePosition = event->pos();
+}
+
+void PreviewWindow::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!(event->buttons() & Qt::LeftButton) || scale == 0)
+        return;
+
+    center -= QPointF(event->pos() - lastMousePosition) / scale;
+    lastMousePosition = event->pos();
+    update();
+}
+
+void PreviewWindow::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+    fitToWindow();
+    update();
+}
+
+void PreviewWindow::fitToWindow()
+{
+    const QSize size = preview.imageSize();
+    if (size.isEmpty())
+        return;
+    scale = fitScale();
+    center = QPointF(size.width(), size.height()) / 2;
+}
+
+double PreviewWindow::fitScale() const
+{
+    const QSize size = preview.imageSize();
+    if (size.isEmpty())
+        return 1;
+    return qMin(double(width()) / size.width(), double(height()) / size.height());
+}
+
+QRectF PreviewWindow::toWidget(const QRectF &imageRect) const
+{
+    const QPointF topLeft = (imageRect.topLeft() - center) * scale + QPointF(width(), height()) / 2;
+    return QRectF(topLeft, imageRect.size() * scale);
+}
@@ -0,0 +1,65 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef PREVIEWWINDOW_H
+#define PREVIEWWINDOW_H
+
+#include "tiledpreview.h"
+
+#include <QWidget>
+
+/*!
+ * \brief The PreviewWindow class
+ * A zoomable view of a FITS file at full resolution. The coarse image shows at once,
+ * and the tiles in view replace it as they are rendered, see TiledPreview. Until the
+ * coarse image is rendered, a placeholder, the largest thumbnail of the file, shows.
+ * The wheel zooms around the cursor, dragging pans and a double-click fits the image.
+ */
+class PreviewWindow : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit PreviewWindow(const QString& filePath, const QByteArray& stretchParameters, QWidget *parent = nullptr);
+    void setPlaceholder(const QImage& image);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private:
+    TiledPreview preview;
+    QImage placeholder;
+    bool failedToOpen = false;
+    double scale = 0; // Displayed pixels per image pixel, 0 until the image is fitted
+    QPointF center; // The image pixel at the center of the window
+    QPoint lastMousePosition;
+
+    void fitToWindow();
+    double fitScale() const;
+    QRectF toWidget(const QRectF& imageRect) const;
+};
+
+#endif // PREVIEWWINDOW_H
@@ -0,0 +1,28 @@
+# The astrocat Python module, see module.cpp. Built against the python3 of the path:
+#   import astrocat, numpy
+#   catalog = astrocat.open()
+#   exposures = numpy.asarray(catalog.column("exposure_time"))
+
+QT += core gui sql concurrent
+QT -= widgets
+
+TEMPLATE = lib
+CONFIG += c++17 plugin no_plugin_name_prefix
+CONFIG -= app_bundle
+
+TARGET = astrocat
+
+VERSION = 0.1
+DEFINES += CURRENT_APP_VERSION=\"\\\"$${VERSION}\\\"\"
+
+SOURCES += \
+    module.cpp
+
+include(../engine.pri)
+
+PYTHON_CONFIG = python3-config
+QMAKE_CXXFLAGS += $$system($$PYTHON_CONFIG --includes)
+unix: QMAKE_EXTENSION_SHLIB = so
+win32: QMAKE_EXTENSION_SHLIB = pyd
+# The symbols of Python come from the interpreter that imports the module
+macx: QMAKE_LFLAGS += -undefined dynamic_lookup
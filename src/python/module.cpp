@@ -0,0 +1,738 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Python.h comes first, before Qt defines its slots keyword and the standard headers
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "autostretcher.h"
+#include "catalog.h"
+#include "filerepository.h"
+#include "fitsfile.h"
+#include "framebufferpool.h"
+#include "linearimagereader.h"
+#include "smartcollection.h"
+#include "thumbnailbatch.h"
+
+#include <QDate>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImage>
+
+#include <cctype>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// A thumbnail size LinearImageReader never bins down to, for the full resolution
+#define FRAME_FULL_SIZE (1 << 28)
+
+/*
+ * The astrocat module. Opens the catalog db read only and hands out its columns, the
+ * ids of a query, thumbnails and frames as Buffers, which numpy.asarray, memoryview
+ * and pyarrow.py_buffer read in place through the buffer protocol. There is no
+ * dependency on NumPy or Arrow at build time.
+ *
+ * A column is a copy of the QVector of CatalogColumns, which shares its data until the
+ * catalog changes it, so it is not copied. A frame is read into a buffer of the
+ * FrameBufferPool, in the sample type of the file, and goes back to the pool with the
+ * last array that uses it.
+ */
+
+/*
+ * What keeps the memory of a Buffer alive: a column, an image, a vector or a buffer
+ * of the pool.
+ */
+struct BufferOwner
+{
+    virtual ~BufferOwner() {}
+};
+
+template <typename T>
+struct ValueOwner : BufferOwner
+{
+    explicit ValueOwner(T value) : value(std::move(value)) {}
+    T value;
+};
+
+struct PoolOwner : BufferOwner
+{
+    explicit PoolOwner(unsigned char* buffer) : buffer(buffer) {}
+    ~PoolOwner() { FrameBufferPool::release(buffer); }
+    unsigned char* buffer;
+};
+
+// Read only and C contiguous, with up to 3 dimensions
+struct BufferObject
+{
+    PyObject_HEAD
+    BufferOwner* owner;
+    const void* data;
+    const char* format;
+    Py_ssize_t itemSize;
+    int ndim;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+};
+
+struct CatalogObject
+{
+    PyObject_HEAD
+    FileRepository* repository;
+    Catalog* catalog;
+};
+
+static PyTypeObject BufferType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+static PyTypeObject CatalogType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+// The struct module format of the sample type
+template <typename T>
+static const char* bufferFormat()
+{
+    if (std::is_floating_point<T>::value)
+        return sizeof(T) == 4 ? "f" : "d";
+    const bool isSigned = std::is_signed<T>::value;
+    switch (sizeof(T))
+    {
+    case 1: return isSigned ? "b" : "B";
+    case 2: return isSigned ? "h" : "H";
+    case 4: return isSigned ? "i" : "I";
+    }
+    return isSigned ? "q" : "Q";
+}
+
+// Takes the owner, which is deleted with the Buffer
+template <typename T>
+static PyObject* newBuffer(BufferOwner* owner, const T* data, std::initializer_list<Py_ssize_t> shape)
+{
+    BufferObject* buffer = PyObject_New(BufferObject, &BufferType);
+    if (buffer == nullptr)
+    {
+        delete owner;
+        return nullptr;
+    }
+    buffer->owner = owner;
+    buffer->data = data;
+    buffer->format = bufferFormat<T>();
+    buffer->itemSize = sizeof(T);
+    buffer->ndim = int(shape.size());
+    Py_ssize_t stride = sizeof(T);
+    for (int i = buffer->ndim - 1; i >= 0; i--)
+    {
+        buffer->shape[i] = shape.begin()[i];
+        buffer->strides[i] = stride;
+        stride *= buffer->shape[i];
+    }
+    return reinterpret_cast<PyObject*>(buffer);
+}
+
+template <typename T>
+static PyObject* vectorBuffer(const QVector<T>& column)
+{
+    auto owner = new ValueOwner<QVector<T>>(column);
+    return newBuffer(owner, owner->value.constData(), {owner->value.count()});
+}
+
+// Rows of RGBA pixels
+static PyObject* imageBuffer(const QImage& image)
+{
+    auto owner = new ValueOwner<QImage>(image.convertToFormat(QImage::Format_RGBA8888));
+    const QImage& rgba = owner->value;
+    if (rgba.bytesPerLine() != rgba.width() * 4)
+    {
+        delete owner;
+        PyErr_SetString(PyExc_ValueError, "The image has padded rows");
+        return nullptr;
+    }
+    return newBuffer(owner, rgba.constBits(), {rgba.height(), rgba.width(), 4});
+}
+
+static void bufferDealloc(PyObject* self)
+{
+    delete reinterpret_cast<BufferObject*>(self)->owner;
+    PyObject_Free(self);
+}
+
+static int bufferGetBuffer(PyObject* self, Py_buffer* view, int flags)
+{
+    BufferObject* buffer = reinterpret_cast<BufferObject*>(self);
+    if (flags & PyBUF_WRITABLE)
+    {
+        view->obj = nullptr;
+        PyErr_SetString(PyExc_BufferError, "The buffers of the catalog are read only");
+        return -1;
+    }
+    Py_ssize_t length = buffer->itemSize;
+    for (int i = 0; i < buffer->ndim; i++)
+        length *= buffer->shape[i];
+
+    view->buf = const_cast<void*>(buffer->data);
+    view->obj = self;
+    Py_INCREF(self);
+    view->len = length;
+    view->readonly = 1;
+    view->itemsize = buffer->itemSize;
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(buffer->format) : nullptr;
+    view->ndim = buffer->ndim;
+    view->shape = (flags & PyBUF_ND) ? buffer->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? buffer->strides : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+static PyBufferProcs bufferProcs = { bufferGetBuffer, nullptr };
+
+// The engine needs an application for its settings, threads and images. No display is used.
+static void ensureApplication()
+{
+    if (QCoreApplication::instance() != nullptr)
+        return;
+    static int argc = 1;
+    static char name[] = "astrocat";
+    static char* argv[] = { name, nullptr };
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    new QGuiApplication(argc, argv);
+    QCoreApplication::setApplicationName("Astrocat");
+    QCoreApplication::setOrganizationName("Astrocat");
+    QCoreApplication::setOrganizationDomain("astrocat.app");
+}
+
+/*
+ * open(db=None)
+ * Loads the catalog of the db, the one of the app by default. The db is only read, as
+ * a shared catalog, so the app or the indexer may be writing it at the same time.
+ */
+static PyObject* openCatalog(PyObject*, PyObject* args, PyObject* kwargs)
+{
+    const char* db = nullptr;
+    static const char* keywords[] = { "db", nullptr };
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|z", const_cast<char**>(keywords), &db))
+        return nullptr;
+
+    ensureApplication();
+    if (db != nullptr)
+        FileRepository::setDatabaseFilePath(QString::fromUtf8(db));
+    FileRepository::setAccessMode(FileRepository::SharedReaderAccess);
+
+    std::unique_ptr<FileRepository> repository(new FileRepository());
+    std::unique_ptr<Catalog> catalog(new Catalog());
+    QString failure;
+    auto failed = QObject::connect(repository.get(), &FileRepository::dbFailedToInitialize, [&](const QString& message) {
+        failure = message;
+    });
+    // Everything runs on this thread, so the pages are added as they are read
+    QObject::connect(repository.get(), &FileRepository::tinyThumbnailsLoaded, catalog.get(), &Catalog::setTinyThumbnails);
+    QObject::connect(repository.get(), &FileRepository::modelPageLoaded, catalog.get(), &Catalog::addAstroFiles);
+    QObject::connect(repository.get(), &FileRepository::modelLoaded, catalog.get(), &Catalog::finishAddingAstroFiles);
+
+    Py_BEGIN_ALLOW_THREADS
+    repository->initialize();
+    if (failure.isEmpty())
+        repository->loadModel();
+    Py_END_ALLOW_THREADS
+    QObject::disconnect(failed);
+    if (!failure.isEmpty())
+    {
+        PyErr_Format(PyExc_OSError, "Failed to open the catalog db %s: %s",
+                     qPrintable(FileRepository::databaseFilePath()), qPrintable(failure));
+        return nullptr;
+    }
+
+    CatalogObject* object = PyObject_New(CatalogObject, &CatalogType);
+    if (object == nullptr)
+        return nullptr;
+    object->repository = repository.release();
+    object->catalog = catalog.release();
+    return reinterpret_cast<PyObject*>(object);
+}
+
+static void catalogDealloc(PyObject* self)
+{
+    CatalogObject* object = reinterpret_cast<CatalogObject*>(self);
+    delete object->catalog;
+    delete object->repository;
+    PyObject_Free(self);
+}
+
+static Py_ssize_t catalogLength(PyObject* self)
+{
+    return reinterpret_cast<CatalogObject*>(self)->catalog->getNumberOfItems();
+}
+
+// The names of the facets and the number columns in Python, in the order of their enums
+static const char* const facetNames[CatalogColumns::FacetCount] = {
+    "object", "instrument", "filter", "extension", "folder", "frame_type", "integrity"
+};
+static const char* const numberColumnNames[CatalogColumns::NumberColumnCount] = {
+    "observation_time", "exposure_time", "temperature", "ra", "dec", "star_count", "fwhm"
+};
+
+static int facetOfName(const char* name)
+{
+    for (int facet = 0; facet < CatalogColumns::FacetCount; facet++)
+        if (strcmp(name, facetNames[facet]) == 0)
+            return facet;
+    return -1;
+}
+
+/*
+ * Catalog.column(name)
+ * A column, row for row: the ids, the value ids of a facet, see Catalog.values, or the
+ * numbers with NaN for the rows without a value.
+ */
+static PyObject* catalogColumn(PyObject* self, PyObject* args)
+{
+    const char* name;
+    if (!PyArg_ParseTuple(args, "s", &name))
+        return nullptr;
+
+    PyObject* result = nullptr;
+    bool found = true;
+    const int facet = facetOfName(name);
+    reinterpret_cast<CatalogObject*>(self)->catalog->readColumns([&](const CatalogColumns& columns) {
+        if (strcmp(name, "id") == 0)
+            result = vectorBuffer(columns.idColumn());
+        else if (facet >= 0)
+            result = vectorBuffer(columns.facetColumn(CatalogColumns::Facet(facet)));
+        else if (strcmp(name, "observation_night") == 0)
+            result = vectorBuffer(columns.observationNightColumn());
+        else if (strcmp(name, "file_size") == 0)
+            result = vectorBuffer(columns.fileSizeColumn());
+        else
+        {
+            for (int column = 0; column < CatalogColumns::NumberColumnCount; column++)
+            {
+                if (strcmp(name, numberColumnNames[column]) == 0)
+                {
+                    result = vectorBuffer(columns.numberColumn(CatalogColumns::NumberColumn(column)));
+                    return;
+                }
+            }
+            found = false;
+        }
+    });
+    if (!found)
+        PyErr_Format(PyExc_KeyError, "No column %s", name);
+    return result;
+}
+
+/*
+ * Catalog.values()
+ * The facet values, by the value ids of the facet columns
+ */
+static PyObject* catalogValues(PyObject* self, PyObject*)
+{
+    QStringList values;
+    reinterpret_cast<CatalogObject*>(self)->catalog->readColumns([&](const CatalogColumns& columns) {
+        values = columns.valueList();
+    });
+    PyObject* list = PyList_New(values.count());
+    if (list == nullptr)
+        return nullptr;
+    for (int i = 0; i < values.count(); i++)
+    {
+        PyObject* value = PyUnicode_FromString(values.at(i).toUtf8().constData());
+        if (value == nullptr)
+        {
+            Py_DECREF(list);
+            return nullptr;
+        }
+        PyList_SET_ITEM(list, i, value);
+    }
+    return list;
+}
+
+/*
+ * Catalog.facet_counts(name)
+ * The number of files of each value of the facet
+ */
+static PyObject* catalogFacetCounts(PyObject* self, PyObject* args)
+{
+    const char* name;
+    if (!PyArg_ParseTuple(args, "s", &name))
+        return nullptr;
+    const int facet = facetOfName(name);
+    if (facet < 0)
+    {
+        PyErr_Format(PyExc_KeyError, "No facet %s", name);
+        return nullptr;
+    }
+
+    QStringList values;
+    QVector<int> counts;
+    reinterpret_cast<CatalogObject*>(self)->catalog->readColumns([&](const CatalogColumns& columns) {
+        values = columns.valueList();
+        counts.fill(0, values.count());
+        for (int valueId : columns.facetColumn(CatalogColumns::Facet(facet)))
+            counts[valueId]++;
+    });
+    PyObject* dict = PyDict_New();
+    if (dict == nullptr)
+        return nullptr;
+    for (int valueId = 0; valueId < counts.count(); valueId++)
+    {
+        if (counts.at(valueId) == 0)
+            continue;
+        PyObject* count = PyLong_FromLong(counts.at(valueId));
+        const int failed = count == nullptr ? -1 : PyDict_SetItemString(dict, values.at(valueId).toUtf8().constData(), count);
+        Py_XDECREF(count);
+        if (failed < 0)
+        {
+            Py_DECREF(dict);
+            return nullptr;
+        }
+    }
+    return dict;
+}
+
+/*
+ * Catalog.query(expression)
+ * The ids of the files the expression of a smart collection accepts, see SmartCollection
+ */
+static PyObject* catalogQuery(PyObject* self, PyObject* args)
+{
+    const char* expression;
+    if (!PyArg_ParseTuple(args, "s", &expression))
+        return nullptr;
+
+    SmartCollection collection;
+    QString error;
+    if (!SmartCollection::compile("query", QString::fromUtf8(expression), collection, error))
+    {
+        PyErr_SetString(PyExc_ValueError, error.toUtf8().constData());
+        return nullptr;
+    }
+
+    QVector<int> ids;
+    Py_BEGIN_ALLOW_THREADS
+    const QDate today = QDate::currentDate();
+    for (const AstroFile& astroFile : reinterpret_cast<CatalogObject*>(self)->catalog->getAstroFiles())
+        if (collection.accepts(astroFile, today))
+            ids.append(astroFile.Id);
+    Py_END_ALLOW_THREADS
+    return vectorBuffer(ids);
+}
+
+/*
+ * Catalog.path(id)
+ * The path of the file, None when there is no file with the id
+ */
+static PyObject* catalogPath(PyObject* self, PyObject* args)
+{
+    int id;
+    if (!PyArg_ParseTuple(args, "i", &id))
+        return nullptr;
+    Catalog* catalog = reinterpret_cast<CatalogObject*>(self)->catalog;
+    const int row = catalog->astroFileIndex(id);
+    AstroFile* astroFile = row < 0 ? nullptr : catalog->getAstroFile(row);
+    if (astroFile == nullptr)
+        Py_RETURN_NONE;
+    return PyUnicode_FromString(astroFile->FullPath.toUtf8().constData());
+}
+
+/*
+ * Catalog.thumbnail(id, level=0)
+ * The thumbnail of the file at the level of the pyramid, as rows of RGBA pixels. None
+ * when the file has none.
+ */
+static PyObject* catalogThumbnail(PyObject* self, PyObject* args)
+{
+    int id;
+    int level = 0;
+    if (!PyArg_ParseTuple(args, "i|i", &id, &level))
+        return nullptr;
+
+    FileRepository* repository = reinterpret_cast<CatalogObject*>(self)->repository;
+    QImage thumbnail;
+    auto loaded = QObject::connect(repository, &FileRepository::thumbnailsLoaded, [&](const ThumbnailBatch& batch) {
+        if (!batch.images.isEmpty())
+            thumbnail = batch.images.first();
+    });
+    Py_BEGIN_ALLOW_THREADS
+    repository->loadThumbnails({id}, level);
+    Py_END_ALLOW_THREADS
+    QObject::disconnect(loaded);
+    if (thumbnail.isNull())
+        Py_RETURN_NONE;
+    return imageBuffer(thumbnail);
+}
+
+static PyObject* fitsError(int status)
+{
+    char text[FLEN_STATUS];
+    fits_get_errstatus(status, text);
+    PyErr_SetString(PyExc_OSError, text);
+    return nullptr;
+}
+
+// The first image of the FITS file, planes of rows, into a buffer of the pool
+static PyObject* readFitsFrame(const QString& path)
+{
+    fitsfile* fptr = nullptr;
+    int status = 0;
+    if (fits_open_diskfile(&fptr, path.toUtf8().constData(), READONLY, &status))
+        return fitsError(status);
+
+    int naxis = 0;
+    long naxes[3] = {1, 1, 1};
+    int equivType = 0;
+    int hduType = IMAGE_HDU;
+    // The primary unit of a file with the image in an extension has no axes
+    while (!fits_get_img_dim(fptr, &naxis, &status) && naxis == 0)
+    {
+        if (fits_movrel_hdu(fptr, 1, &hduType, &status))
+            break;
+    }
+    if (!status && (naxis < 2 || naxis > 3))
+    {
+        fits_close_file(fptr, &status);
+        PyErr_SetString(PyExc_ValueError, "The FITS file has no 2 or 3 dimensional image");
+        return nullptr;
+    }
+    if (status || fits_get_img_size(fptr, 3, naxes, &status) || fits_get_img_equivtype(fptr, &equivType, &status))
+    {
+        int closeStatus = 0;
+        fits_close_file(fptr, &closeStatus);
+        return fitsError(status);
+    }
+
+    const long long count = (long long)naxes[0] * naxes[1] * naxes[2];
+    PyObject* frame = visitFitsSampleType(equivType, [&](auto sample) -> PyObject* {
+        using T = decltype(sample);
+        unsigned char* buffer = FrameBufferPool::acquire(count * sizeof(T));
+        int anyNull = 0;
+        Py_BEGIN_ALLOW_THREADS
+        fits_read_img(fptr, FitsSampleType<T>::dataType, 1, count, nullptr, buffer, &anyNull, &status);
+        Py_END_ALLOW_THREADS
+        auto owner = new PoolOwner(buffer);
+        if (status)
+        {
+            delete owner;
+            return nullptr;
+        }
+        const T* data = reinterpret_cast<const T*>(buffer);
+        if (naxis == 3)
+            return newBuffer(owner, data, {naxes[2], naxes[1], naxes[0]});
+        return newBuffer(owner, data, {naxes[1], naxes[0]});
+    });
+    const int readStatus = status;
+    status = 0;
+    fits_close_file(fptr, &status);
+    if (readStatus)
+        return fitsError(readStatus);
+    if (frame == nullptr && !PyErr_Occurred())
+        PyErr_Format(PyExc_ValueError, "Unknown FITS image type %d", equivType);
+    return frame;
+}
+
+// A 16 bit or floating point TIFF or PNG, planes of rows, see LinearImageReader
+template <typename T>
+static PyObject* readLinearFrame(const QByteArray& data)
+{
+    std::vector<T> samples;
+    int width, height, channels;
+    bool read;
+    Py_BEGIN_ALLOW_THREADS
+    read = LinearImageReader::read<T>(data, FRAME_FULL_SIZE, CancellationToken(), samples, width, height, channels);
+    Py_END_ALLOW_THREADS
+    if (!read)
+    {
+        PyErr_SetString(PyExc_ValueError, "The image could not be read");
+        return nullptr;
+    }
+    auto owner = new ValueOwner<std::vector<T>>(std::move(samples));
+    return newBuffer(owner, owner->value.data(), {channels, height, width});
+}
+
+/*
+ * read_frame(path)
+ * The full resolution frame of a FITS file, or of a 16 bit or floating point TIFF or
+ * PNG, in the sample type of the file: (height, width), or (channels, height, width).
+ * FITS pixels are the physical values, scaled by BSCALE and BZERO.
+ */
+static PyObject* readFrame(PyObject*, PyObject* args)
+{
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return nullptr;
+    ensureApplication();
+
+    const QString filePath = QString::fromUtf8(path);
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        PyErr_Format(PyExc_OSError, "Could not open %s: %s", path, qPrintable(file.errorString()));
+        return nullptr;
+    }
+    if (file.peek(6) == "SIMPLE")
+    {
+        file.close();
+        return readFitsFrame(filePath);
+    }
+
+    const QByteArray data = file.readAll();
+    switch (LinearImageReader::sampleTypeOf(data))
+    {
+    case LinearImageReader::UInt16:
+        return readLinearFrame<uint16_t>(data);
+    case LinearImageReader::Float32:
+        return readLinearFrame<float>(data);
+    case LinearImageReader::NotLinear:
+        break;
+    }
+    PyErr_SetString(PyExc_ValueError, "Not a FITS file, or a 16 bit or floating point TIFF or PNG image");
+    return nullptr;
+}
+
+// The FITS image type of the format of a buffer, 0 if there is none
+static int imageTypeOfFormat(const char* format, Py_ssize_t itemSize)
+{
+    if (format == nullptr)
+        format = "B";
+    if (*format == '@' || *format == '=' || *format == '<')
+        format++;
+    const char code = *format;
+    if (code == 'f' && itemSize == 4)
+        return FLOAT_IMG;
+    if (code == 'd' && itemSize == 8)
+        return DOUBLE_IMG;
+    if (strchr("bhilqBHILQ", code) == nullptr)
+        return 0;
+    const bool isSigned = islower(code);
+    switch (itemSize)
+    {
+    case 1: return isSigned ? SBYTE_IMG : BYTE_IMG;
+    case 2: return isSigned ? SHORT_IMG : USHORT_IMG;
+    case 4: return isSigned ? LONG_IMG : ULONG_IMG;
+    case 8: return isSigned ? LONGLONG_IMG : ULONGLONG_IMG;
+    }
+    return 0;
+}
+
+/*
+ * stretch(frame)
+ * The frame stretched like the thumbnails, see AutoStretcher, as rows of RGBA pixels.
+ * The frame is any C contiguous array of (height, width) or (1 or 3, height, width)
+ * little endian samples, a frame of read_frame or a NumPy array.
+ */
+static PyObject* stretchFrame(PyObject*, PyObject* args)
+{
+    PyObject* frame;
+    if (!PyArg_ParseTuple(args, "O", &frame))
+        return nullptr;
+    ensureApplication();
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(frame, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+        return nullptr;
+    const int imageType = imageTypeOfFormat(view.format, view.itemsize);
+    const int channels = view.ndim == 3 ? int(view.shape[0]) : 1;
+    if (imageType == 0 || (view.ndim != 2 && view.ndim != 3) || (channels != 1 && channels != 3))
+    {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "The frame is not (height, width) or (1 or 3, height, width) samples of a known type");
+        return nullptr;
+    }
+    const int height = int(view.shape[view.ndim - 2]);
+    const int width = int(view.shape[view.ndim - 1]);
+
+    QImage image;
+    Py_BEGIN_ALLOW_THREADS
+    image = visitFitsSampleType(imageType, [&](auto sample) {
+        using T = decltype(sample);
+        AutoStretcher<T> stretcher(width, height, channels, 0);
+        // stretchToImage only reads the samples
+        stretcher.setData(static_cast<T*>(view.buf));
+        stretcher.calculateParams();
+        return stretcher.stretchToImage(true);
+    });
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if (image.isNull())
+    {
+        PyErr_SetString(PyExc_ValueError, "The frame could not be stretched");
+        return nullptr;
+    }
+    return imageBuffer(image);
+}
+
+static PyMethodDef catalogMethods[] = {
+    {"column", catalogColumn, METH_VARARGS, "column(name): a column of the rows, without copying it"},
+    {"values", catalogValues, METH_NOARGS, "values(): the facet values, by the value ids of the facet columns"},
+    {"facet_counts", catalogFacetCounts, METH_VARARGS, "facet_counts(name): the number of files of each value of the facet"},
+    {"query", catalogQuery, METH_VARARGS, "query(expression): the ids of the files of a smart collection expression"},
+    {"path", catalogPath, METH_VARARGS, "path(id): the path of the file"},
+    {"thumbnail", catalogThumbnail, METH_VARARGS, "thumbnail(id, level=0): the RGBA thumbnail of the file"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PySequenceMethods catalogSequence = { catalogLength };
+
+static PyMethodDef moduleMethods[] = {
+    {"open", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(openCatalog)), METH_VARARGS | METH_KEYWORDS,
+     "open(db=None): the catalog of the db, the one of the app by default, read only"},
+    {"read_frame", readFrame, METH_VARARGS, "read_frame(path): the full resolution frame in the sample type of the file"},
+    {"stretch", stretchFrame, METH_VARARGS, "stretch(frame): the frame stretched like the thumbnails, as RGBA pixels"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyModuleDef moduleDef = {
+    PyModuleDef_HEAD_INIT, "astrocat", "Zero copy access to the Astrocat catalog", -1, moduleMethods,
+    nullptr, nullptr, nullptr, nullptr
+};
+
+PyMODINIT_FUNC PyInit_astrocat()
+{
+    BufferType.tp_name = "astrocat.Buffer";
+    BufferType.tp_doc = "Read only memory of the catalog, for numpy.asarray, memoryview or pyarrow.py_buffer";
+    BufferType.tp_basicsize = sizeof(BufferObject);
+    BufferType.tp_flags = Py_TPFLAGS_DEFAULT;
+    BufferType.tp_dealloc = bufferDealloc;
+    BufferType.tp_as_buffer = &bufferProcs;
+
+    CatalogType.tp_name = "astrocat.Catalog";
+    CatalogType.tp_doc = "The catalog of a db, see astrocat.open";
+    CatalogType.tp_basicsize = sizeof(CatalogObject);
+    CatalogType.tp_flags = Py_TPFLAGS_DEFAULT;
+    CatalogType.tp_dealloc = catalogDealloc;
+    CatalogType.tp_methods = catalogMethods;
+    CatalogType.tp_as_sequence = &catalogSequence;
+
+    if (PyType_Ready(&BufferType) < 0 || PyType_Ready(&CatalogType) < 0)
+        return nullptr;
+    PyObject* module = PyModule_Create(&moduleDef);
+    if (module == nullptr)
+        return nullptr;
+    Py_INCREF(&BufferType);
+    Py_INCREF(&CatalogType);
+    if (PyModule_AddObject(module, "Buffer", reinterpret_cast<PyObject*>(&BufferType)) < 0
+        || PyModule_AddObject(module, "Catalog", reinterpret_cast<PyObject*>(&CatalogType)) < 0)
+    {
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
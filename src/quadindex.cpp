@@ -0,0 +1,429 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "quadindex.h"
+
+#include <QDebug>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QtMath>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#define QUAD_INDEX_MAGIC 0x44515341 // "ASQD" in native byte order
+#define QUAD_INDEX_VERSION 1
+// The brightest stars of the catalog kept in the index
+#define QUAD_INDEX_MAX_STARS 500000
+// The nearest stars each star makes quads with
+#define QUAD_INDEX_NEIGHBOURS 5
+// Degrees, the furthest a star of a quad is from the star it was made around
+#define QUAD_INDEX_RADIUS 1.0
+// Bins of each coordinate of the codes, so there are QUAD_CODE_BINS^4 bins in all
+#define QUAD_CODE_BINS 20
+// The range of the coordinates of the codes. C and D are no further from A and B than
+// they are from each other, so within 1 - sqrt(2) and sqrt(2).
+#define QUAD_CODE_MIN -0.42f
+#define QUAD_CODE_MAX 1.42f
+
+/*
+ * File layout, in native byte order like the CatalogSnapshot:
+ *
+ *  QuadIndexHeader
+ *  Star[starCount]                   sorted by declination
+ *  Quad[quadCount]                   sorted by the bin of their code
+ *  quint32[binCount + 1]             the first quad of each bin
+ */
+struct QuadIndexHeader
+{
+    quint32 magic;
+    qint32 version;
+    qint32 starCount;
+    qint32 quadCount;
+    qint32 bins;
+    qint32 reserved;
+};
+
+static int codeBin(float value)
+{
+    const int bin = int((value - QUAD_CODE_MIN) / (QUAD_CODE_MAX - QUAD_CODE_MIN) * QUAD_CODE_BINS);
+    return qBound(0, bin, QUAD_CODE_BINS - 1);
+}
+
+static int binOfCode(const float code[4])
+{
+    int bin = 0;
+    for (int k = 3; k >= 0; k--)
+        bin = bin * QUAD_CODE_BINS + codeBin(code[k]);
+    return bin;
+}
+
+struct UnitVector
+{
+    double x, y, z;
+
+    static UnitVector of(double ra, double dec)
+    {
+        const double r = qDegreesToRadians(ra);
+        const double d = qDegreesToRadians(dec);
+        return {std::cos(d) * std::cos(r), std::cos(d) * std::sin(r), std::sin(d)};
+    }
+    double dot(const UnitVector& other) const { return x * other.x + y * other.y + z * other.z; }
+};
+
+QuadIndex::QuadIndex()
+{
+    data = nullptr;
+    size = 0;
+}
+
+QuadIndex::~QuadIndex()
+{
+    close();
+}
+
+/*!
+ * \brief QuadIndex::project
+ * The gnomonic projection, in which the great circles are straight lines.
+ */
+std::complex<double> QuadIndex::project(double ra, double dec, double centerRa, double centerDec)
+{
+    const double d0 = qDegreesToRadians(centerDec);
+    const double d = qDegreesToRadians(dec);
+    const double dra = qDegreesToRadians(ra - centerRa);
+    const double cosc = std::sin(d0) * std::sin(d) + std::cos(d0) * std::cos(d) * std::cos(dra);
+    return {std::cos(d) * std::sin(dra) / cosc, (std::cos(d0) * std::sin(d) - std::sin(d0) * std::cos(d) * std::cos(dra)) / cosc};
+}
+
+void QuadIndex::deproject(std::complex<double> point, double centerRa, double centerDec, double &ra, double &dec)
+{
+    const double d0 = qDegreesToRadians(centerDec);
+    const double rho = std::abs(point);
+    if (rho == 0)
+    {
+        ra = centerRa;
+        dec = centerDec;
+        return;
+    }
+    const double c = std::atan(rho);
+    dec = qRadiansToDegrees(std::asin(std::cos(c) * std::sin(d0) + point.imag() * std::sin(c) * std::cos(d0) / rho));
+    ra = centerRa + qRadiansToDegrees(std::atan2(point.real() * std::sin(c), rho * std::cos(d0) * std::cos(c) - point.imag() * std::sin(d0) * std::sin(c)));
+    ra = std::fmod(ra + 360, 360);
+}
+
+/*!
+ * \brief QuadIndex::quadCode
+ * A and B are the pair of points the furthest apart. They are swapped when xC + xD
+ * would be over 1, and C and D when xC would be over xD, so each quad has one code
+ * whatever order its points come in.
+ */
+bool QuadIndex::quadCode(const std::complex<double> points[4], int order[4], float code[4])
+{
+    int a = 0;
+    int b = 1;
+    double widest = -1;
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = i + 1; j < 4; j++)
+        {
+            const double distance = std::norm(points[j] - points[i]);
+            if (distance > widest)
+            {
+                widest = distance;
+                a = i;
+                b = j;
+            }
+        }
+    }
+    if (!(widest > 0))
+        return false;
+
+    int c = -1;
+    int d = -1;
+    for (int i = 0; i < 4; i++)
+    {
+        if (i == a || i == b)
+            continue;
+        (c < 0 ? c : d) = i;
+    }
+
+    // Maps A to 0 and B to 1 + i
+    auto frame = [&](int from, int to, int point) {
+        return (points[point] - points[from]) / (points[to] - points[from]) * std::complex<double>(1, 1);
+    };
+    std::complex<double> pc = frame(a, b, c);
+    std::complex<double> pd = frame(a, b, d);
+    if (pc.real() + pd.real() > 1)
+    {
+        std::swap(a, b);
+        pc = frame(a, b, c);
+        pd = frame(a, b, d);
+    }
+    if (pc.real() > pd.real())
+    {
+        std::swap(c, d);
+        std::swap(pc, pd);
+    }
+
+    order[0] = a;
+    order[1] = b;
+    order[2] = c;
+    order[3] = d;
+    code[0] = float(pc.real());
+    code[1] = float(pc.imag());
+    code[2] = float(pd.real());
+    code[3] = float(pd.imag());
+    return true;
+}
+
+/*!
+ * \brief QuadIndex::build
+ * Each star makes quads with every three of its QUAD_INDEX_NEIGHBOURS nearest stars
+ * within QUAD_INDEX_RADIUS, projected on the plane tangent to the sky at the star. A
+ * quad made around several of its stars is kept once.
+ */
+bool QuadIndex::build(const QString &starCatalogPath, const QString &indexPath, QString &error)
+{
+    QFile input(starCatalogPath);
+    if (!input.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        error = input.errorString();
+        return false;
+    }
+
+    QVector<Star> stars;
+    QTextStream stream(&input);
+    static const QRegularExpression separators("[,;\\s]+");
+    while (!stream.atEnd())
+    {
+        const QStringList fields = stream.readLine().trimmed().split(separators, Qt::SkipEmptyParts);
+        if (fields.count() < 3)
+            continue;
+        bool raOk, decOk, magnitudeOk;
+        Star star = {fields[0].toDouble(&raOk), fields[1].toDouble(&decOk), fields[2].toFloat(&magnitudeOk), 0};
+        if (raOk && decOk && magnitudeOk && star.dec >= -90 && star.dec <= 90)
+            stars.append(star);
+    }
+    if (stars.count() < 4)
+    {
+        error = "The star catalog has fewer than 4 stars";
+        return false;
+    }
+
+    std::sort(stars.begin(), stars.end(), [](const Star& a, const Star& b) { return a.magnitude < b.magnitude; });
+    if (stars.count() > QUAD_INDEX_MAX_STARS)
+        stars.resize(QUAD_INDEX_MAX_STARS);
+    std::sort(stars.begin(), stars.end(), [](const Star& a, const Star& b) { return a.dec < b.dec; });
+
+    QVector<UnitVector> vectors;
+    vectors.reserve(stars.count());
+    for (auto& star : stars)
+        vectors.append(UnitVector::of(star.ra, star.dec));
+
+    const double minCos = std::cos(qDegreesToRadians(QUAD_INDEX_RADIUS));
+    QVector<Quad> quads;
+    QVector<QPair<double, int>> neighbours;
+    for (int i = 0; i < stars.count(); i++)
+    {
+        // The stars within the radius are within the same band of declinations
+        neighbours.clear();
+        for (int direction = -1; direction <= 1; direction += 2)
+        {
+            for (int j = i + direction; j >= 0 && j < stars.count() && std::fabs(stars[j].dec - stars[i].dec) <= QUAD_INDEX_RADIUS; j += direction)
+            {
+                const double cosine = vectors[i].dot(vectors[j]);
+                if (cosine >= minCos)
+                    neighbours.append({-cosine, j});
+            }
+        }
+        const int count = std::min<int>(QUAD_INDEX_NEIGHBOURS, neighbours.count());
+        std::partial_sort(neighbours.begin(), neighbours.begin() + count, neighbours.end());
+
+        for (int p = 0; p < count; p++)
+        {
+            for (int q = p + 1; q < count; q++)
+            {
+                for (int r = q + 1; r < count; r++)
+                {
+                    const int members[4] = {i, neighbours[p].second, neighbours[q].second, neighbours[r].second};
+                    std::complex<double> points[4];
+                    for (int k = 0; k < 4; k++)
+                        points[k] = project(stars[members[k]].ra, stars[members[k]].dec, stars[i].ra, stars[i].dec);
+                    int order[4];
+                    Quad quad;
+                    if (!quadCode(points, order, quad.code))
+                        continue;
+                    for (int k = 0; k < 4; k++)
+                        quad.stars[k] = members[order[k]];
+                    quads.append(quad);
+                }
+            }
+        }
+    }
+
+    // The same stars make the same code, whichever star the quad was made around
+    auto sortedStars = [](const Quad& quad) {
+        std::array<quint32, 4> members = {quad.stars[0], quad.stars[1], quad.stars[2], quad.stars[3]};
+        std::sort(members.begin(), members.end());
+        return members;
+    };
+    std::sort(quads.begin(), quads.end(), [&](const Quad& a, const Quad& b) { return sortedStars(a) < sortedStars(b); });
+    quads.erase(std::unique(quads.begin(), quads.end(), [&](const Quad& a, const Quad& b) { return sortedStars(a) == sortedStars(b); }), quads.end());
+    std::stable_sort(quads.begin(), quads.end(), [](const Quad& a, const Quad& b) { return binOfCode(a.code) < binOfCode(b.code); });
+
+    const int binCount = QUAD_CODE_BINS * QUAD_CODE_BINS * QUAD_CODE_BINS * QUAD_CODE_BINS;
+    QVector<quint32> binStarts(binCount + 1, 0);
+    for (auto& quad : quads)
+        binStarts[binOfCode(quad.code) + 1]++;
+    for (int bin = 0; bin < binCount; bin++)
+        binStarts[bin + 1] += binStarts[bin];
+
+    QuadIndexHeader header = {QUAD_INDEX_MAGIC, QUAD_INDEX_VERSION, int(stars.count()), int(quads.count()), QUAD_CODE_BINS, 0};
+    QSaveFile output(indexPath);
+    if (!output.open(QIODevice::WriteOnly))
+    {
+        error = output.errorString();
+        return false;
+    }
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(stars.constData()), stars.count() * sizeof(Star));
+    output.write(reinterpret_cast<const char*>(quads.constData()), quads.count() * sizeof(Quad));
+    output.write(reinterpret_cast<const char*>(binStarts.constData()), binStarts.count() * sizeof(quint32));
+    if (!output.commit())
+    {
+        error = output.errorString();
+        return false;
+    }
+    qDebug() << "Quad index of" << stars.count() << "stars and" << quads.count() << "quads written to" << indexPath;
+    return true;
+}
+
+bool QuadIndex::open(const QString &path)
+{
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    size = file.size();
+    if (size < qint64(sizeof(QuadIndexHeader)))
+    {
+        close();
+        return false;
+    }
+    data = file.map(0, size);
+    if (data == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    auto header = reinterpret_cast<const QuadIndexHeader*>(data);
+    const qint64 binCount = qint64(header->bins) * header->bins * header->bins * header->bins;
+    if (header->magic != QUAD_INDEX_MAGIC || header->version != QUAD_INDEX_VERSION || header->bins != QUAD_CODE_BINS ||
+        header->starCount < 0 || header->quadCount < 0 ||
+        qint64(sizeof(QuadIndexHeader)) + header->starCount * qint64(sizeof(Star)) + header->quadCount * qint64(sizeof(Quad))
+            + (binCount + 1) * qint64(sizeof(quint32)) != size)
+    {
+        qDebug() << path << "is not a quad index of this version";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void QuadIndex::close()
+{
+    if (data != nullptr)
+        file.unmap(const_cast<uchar*>(data));
+    data = nullptr;
+    size = 0;
+    file.close();
+}
+
+int QuadIndex::starCount() const
+{
+    return reinterpret_cast<const QuadIndexHeader*>(data)->starCount;
+}
+
+const QuadIndex::Star &QuadIndex::star(int index) const
+{
+    return reinterpret_cast<const Star*>(data + sizeof(QuadIndexHeader))[index];
+}
+
+const QuadIndex::Quad &QuadIndex::quad(int index) const
+{
+    auto header = reinterpret_cast<const QuadIndexHeader*>(data);
+    return reinterpret_cast<const Quad*>(data + sizeof(QuadIndexHeader) + header->starCount * sizeof(Star))[index];
+}
+
+/*!
+ * \brief QuadIndex::findQuads
+ * Only the bins the tolerance reaches are read, each one a contiguous run of quads.
+ */
+void QuadIndex::findQuads(const float code[4], float tolerance, QVector<int> &quads) const
+{
+    auto header = reinterpret_cast<const QuadIndexHeader*>(data);
+    auto binStarts = reinterpret_cast<const quint32*>(data + sizeof(QuadIndexHeader) + header->starCount * sizeof(Star) + header->quadCount * sizeof(Quad));
+    int low[4];
+    int high[4];
+    for (int k = 0; k < 4; k++)
+    {
+        low[k] = codeBin(code[k] - tolerance);
+        high[k] = codeBin(code[k] + tolerance);
+    }
+
+    int bin[4];
+    for (bin[3] = low[3]; bin[3] <= high[3]; bin[3]++)
+    for (bin[2] = low[2]; bin[2] <= high[2]; bin[2]++)
+    for (bin[1] = low[1]; bin[1] <= high[1]; bin[1]++)
+    for (bin[0] = low[0]; bin[0] <= high[0]; bin[0]++)
+    {
+        const int index = ((bin[3] * QUAD_CODE_BINS + bin[2]) * QUAD_CODE_BINS + bin[1]) * QUAD_CODE_BINS + bin[0];
+        for (quint32 q = binStarts[index]; q < binStarts[index + 1]; q++)
+        {
+            const Quad& candidate = quad(int(q));
+            bool matches = true;
+            for (int k = 0; k < 4 && matches; k++)
+                matches = std::fabs(candidate.code[k] - code[k]) <= tolerance;
+            if (matches)
+                quads.append(int(q));
+        }
+    }
+}
+
+void QuadIndex::starsNear(double ra, double dec, double radius, QVector<int> &stars) const
+{
+    const Star* first = &star(0);
+    const Star* last = first + starCount();
+    const Star* from = std::lower_bound(first, last, dec - radius, [](const Star& star, double value) { return star.dec < value; });
+    const UnitVector center = UnitVector::of(ra, dec);
+    const double minCos = std::cos(qDegreesToRadians(radius));
+    for (const Star* s = from; s != last && s->dec <= dec + radius; s++)
+    {
+        if (UnitVector::of(s->ra, s->dec).dot(center) >= minCos)
+            stars.append(int(s - first));
+    }
+}
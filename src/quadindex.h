@@ -0,0 +1,97 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef QUADINDEX_H
+#define QUADINDEX_H
+
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+#include <complex>
+
+/*!
+ * \brief The QuadIndex class
+ * The quads of a star catalog, looked up by their geometric hash, for PlateSolver.
+ * A quad is four stars near each other. Its two stars the furthest apart, A and B, are
+ * put at (0, 0) and (1, 1), and the positions of the other two, C and D, there are its
+ * code: (xC, yC, xD, yD). The code does not change when the quad is moved, turned or
+ * scaled, so the quads of a frame have the codes of the same quads of the catalog.
+ *
+ * The index is built once from a star catalog by build, and memory-mapped by open.
+ * The stars are sorted by declination, for starsNear, and the quads by the bin of
+ * their code, for findQuads.
+ */
+class QuadIndex
+{
+public:
+    struct Star
+    {
+        double ra; // Degrees
+        double dec;
+        float magnitude;
+        float reserved;
+    };
+
+    struct Quad
+    {
+        quint32 stars[4]; // A, B, C and D
+        float code[4];
+    };
+
+    QuadIndex();
+    ~QuadIndex();
+
+    // Reads ra, dec and magnitude in degrees from the first three numbers of each line of the
+    // CSV file, lines without them are skipped, and writes the index to indexPath.
+    static bool build(const QString& starCatalogPath, const QString& indexPath, QString& error);
+
+    bool open(const QString& path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+    QString path() const { return file.fileName(); }
+
+    int starCount() const;
+    const Star& star(int index) const;
+    const Quad& quad(int index) const;
+    // Appends the quads whose code is within tolerance of the code in each coordinate
+    void findQuads(const float code[4], float tolerance, QVector<int>& quads) const;
+    // Appends the stars within radius degrees of the position
+    void starsNear(double ra, double dec, double radius, QVector<int>& stars) const;
+
+    // The code of the points, and their order as A, B, C and D. False when A and B
+    // coincide. The code of the mirror image of a quad is the one of its conjugates.
+    static bool quadCode(const std::complex<double> points[4], int order[4], float code[4]);
+    // On the plane tangent to the sky at the center, in radians with xi to the east and
+    // eta to the north, and back
+    static std::complex<double> project(double ra, double dec, double centerRa, double centerDec);
+    static void deproject(std::complex<double> point, double centerRa, double centerDec, double& ra, double& dec);
+
+private:
+    QFile file;
+    const uchar* data;
+    qint64 size;
+};
+
+#endif // QUADINDEX_H
@@ -0,0 +1,469 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "colormanagement.h"
+#include "rawprocessor.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QImageReader>
+#include <QTransform>
+
+#include <cstring>
+
+#define THUMBNAIL_SIZE LARGEST_THUMBNAIL_SIZE
+
+// Nested IFDs and boxes followed at most, against files that point in circles
+#define RAW_MAX_DEPTH 4
+#define RAW_MAX_CHAINED_IFDS 8
+
+// The TIFF tags and the CR3 boxes that are read
+#define TIFF_IMAGE_WIDTH        0x0100
+#define TIFF_COMPRESSION        0x0103
+#define TIFF_PHOTOMETRIC        0x0106
+#define TIFF_MAKE               0x010F
+#define TIFF_MODEL              0x0110
+#define TIFF_STRIP_OFFSETS      0x0111
+#define TIFF_ORIENTATION        0x0112
+#define TIFF_STRIP_BYTE_COUNTS  0x0117
+#define TIFF_DATE_TIME          0x0132
+#define TIFF_SUB_IFDS           0x014A
+#define TIFF_JPEG_OFFSET        0x0201
+#define TIFF_JPEG_LENGTH        0x0202
+#define TIFF_EXIF_IFD           0x8769
+#define TIFF_RW2_JPEG           0x002E
+#define EXIF_EXPOSURE_TIME      0x829A
+#define EXIF_ISO                0x8827
+#define EXIF_DATE_TIME_ORIGINAL 0x9003
+#define PHOTOMETRIC_CFA         32803
+#define PHOTOMETRIC_LINEAR_RAW  34892
+
+static const uchar canonMetadataUuid[16] = {0x85, 0xc0, 0xb6, 0x87, 0x82, 0x0f, 0x11, 0xe0, 0x81, 0x11, 0xf4, 0xce, 0x46, 0x2b, 0x6a, 0x48};
+static const uchar canonPreviewUuid[16] = {0xea, 0xf4, 0x2b, 0x5e, 0x1c, 0x98, 0x4b, 0x88, 0xb9, 0xfb, 0xb7, 0xdc, 0x40, 0x6e, 0x4d, 0x16};
+
+namespace {
+
+// The bytes of a TIFF structure that starts at base, in its byte order
+struct TiffView
+{
+    const uchar* data;
+    qint64 size;
+    qint64 base;
+    bool bigEndian;
+
+    bool has(qint64 offset, qint64 length) const
+    {
+        return offset >= 0 && length >= 0 && base + offset <= size - length;
+    }
+
+    quint16 u16(qint64 offset) const
+    {
+        const uchar* p = data + base + offset;
+        return bigEndian ? quint16(p[0] << 8 | p[1]) : quint16(p[1] << 8 | p[0]);
+    }
+
+    quint32 u32(qint64 offset) const
+    {
+        const uchar* p = data + base + offset;
+        return bigEndian ? quint32(p[0]) << 24 | quint32(p[1]) << 16 | quint32(p[2]) << 8 | p[3]
+                         : quint32(p[3]) << 24 | quint32(p[2]) << 16 | quint32(p[1]) << 8 | p[0];
+    }
+};
+
+struct Preview
+{
+    qint64 offset;
+    qint64 length;
+};
+
+}
+
+static quint32 bigEndian32(const uchar* p)
+{
+    return quint32(p[0]) << 24 | quint32(p[1]) << 16 | quint32(p[2]) << 8 | p[3];
+}
+
+/*!
+ * \brief isDecodableJpeg
+ * Raws keep their sensor data as lossless JPEG too, which Qt does not decode. Only the
+ * baseline, extended and progressive frames are previews.
+ */
+static bool isDecodableJpeg(const uchar* data, qint64 length)
+{
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+    qint64 pos = 2;
+    while (pos + 4 <= length)
+    {
+        if (data[pos] != 0xFF)
+            return false;
+        const uchar marker = data[pos + 1];
+        if (marker == 0xFF)
+        {
+            pos++;
+            continue;
+        }
+        if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2)
+            return true;
+        // Any other start of frame, or the scan before a frame
+        if ((marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) || marker == 0xDA)
+            return false;
+        pos += 2 + (data[pos + 2] << 8 | data[pos + 3]);
+    }
+    return false;
+}
+
+static QString tiffString(const TiffView& tiff, qint64 entry, quint32 count)
+{
+    const qint64 offset = count <= 4 ? entry + 8 : qint64(tiff.u32(entry + 8));
+    if (!tiff.has(offset, count))
+        return QString();
+    const char* text = reinterpret_cast<const char*>(tiff.data + tiff.base + offset);
+    return QString::fromLatin1(text, int(strnlen(text, count))).trimmed();
+}
+
+static quint32 tiffValue(const TiffView& tiff, qint64 entry, quint16 type)
+{
+    return type == 3 ? tiff.u16(entry + 8) : tiff.u32(entry + 8);
+}
+
+static void readIfd(const TiffView& tiff, qint64 offset, int depth, RawProcessor::Metadata& metadata, QVector<Preview>& previews)
+{
+    for (int chained = 0; offset != 0 && chained < RAW_MAX_CHAINED_IFDS; chained++)
+    {
+        if (!tiff.has(offset, 2))
+            return;
+        const int count = tiff.u16(offset);
+        if (!tiff.has(offset + 2, qint64(count) * 12 + 4))
+            return;
+
+        int compression = 0;
+        int photometric = 0;
+        qint64 stripOffset = -1;
+        qint64 stripLength = 0;
+        qint64 jpegOffset = -1;
+        qint64 jpegLength = 0;
+        for (int i = 0; i < count; i++)
+        {
+            const qint64 entry = offset + 2 + qint64(i) * 12;
+            const quint16 tag = tiff.u16(entry);
+            const quint16 type = tiff.u16(entry + 2);
+            const quint32 valueCount = tiff.u32(entry + 4);
+            switch (tag)
+            {
+            case TIFF_COMPRESSION: compression = tiffValue(tiff, entry, type); break;
+            case TIFF_PHOTOMETRIC: photometric = tiffValue(tiff, entry, type); break;
+            case TIFF_MAKE: metadata.make = tiffString(tiff, entry, valueCount); break;
+            case TIFF_MODEL: metadata.model = tiffString(tiff, entry, valueCount); break;
+            case TIFF_ORIENTATION:
+                if (depth == 0 && chained == 0)
+                    metadata.orientation = tiffValue(tiff, entry, type);
+                break;
+            case TIFF_DATE_TIME:
+                if (metadata.dateTimeOriginal.isEmpty())
+                    metadata.dateTimeOriginal = tiffString(tiff, entry, valueCount);
+                break;
+            case TIFF_STRIP_OFFSETS:
+                if (valueCount == 1)
+                    stripOffset = tiffValue(tiff, entry, type);
+                break;
+            case TIFF_STRIP_BYTE_COUNTS:
+                if (valueCount == 1)
+                    stripLength = tiffValue(tiff, entry, type);
+                break;
+            case TIFF_JPEG_OFFSET: jpegOffset = tiffValue(tiff, entry, type); break;
+            case TIFF_JPEG_LENGTH: jpegLength = tiffValue(tiff, entry, type); break;
+            case TIFF_RW2_JPEG:
+                previews.append({tiff.base + tiff.u32(entry + 8), valueCount});
+                break;
+            case TIFF_SUB_IFDS:
+                if (depth >= RAW_MAX_DEPTH)
+                    break;
+                if (valueCount == 1)
+                    readIfd(tiff, tiff.u32(entry + 8), depth + 1, metadata, previews);
+                else if (tiff.has(tiff.u32(entry + 8), qint64(valueCount) * 4))
+                {
+                    for (quint32 j = 0; j < valueCount && j < RAW_MAX_CHAINED_IFDS; j++)
+                        readIfd(tiff, tiff.u32(tiff.u32(entry + 8) + j * 4), depth + 1, metadata, previews);
+                }
+                break;
+            case TIFF_EXIF_IFD:
+                if (depth < RAW_MAX_DEPTH)
+                    readIfd(tiff, tiff.u32(entry + 8), depth + 1, metadata, previews);
+                break;
+            case EXIF_EXPOSURE_TIME:
+            {
+                const qint64 rational = tiff.u32(entry + 8);
+                if (tiff.has(rational, 8) && tiff.u32(rational + 4) != 0)
+                    metadata.exposureTime = double(tiff.u32(rational)) / tiff.u32(rational + 4);
+                metadata.hasExif = true;
+                break;
+            }
+            case EXIF_ISO: metadata.iso = tiffValue(tiff, entry, type); break;
+            case EXIF_DATE_TIME_ORIGINAL:
+                metadata.dateTimeOriginal = tiffString(tiff, entry, valueCount);
+                metadata.hasExif = true;
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (jpegOffset >= 0 && jpegLength > 0)
+            previews.append({tiff.base + jpegOffset, jpegLength});
+        // A JPEG strip that is not the sensor data
+        if ((compression == 6 || compression == 7) && stripOffset >= 0 && stripLength > 0 &&
+            photometric != PHOTOMETRIC_CFA && photometric != PHOTOMETRIC_LINEAR_RAW)
+            previews.append({tiff.base + stripOffset, stripLength});
+
+        // Only the main chain of IFDs is followed
+        if (depth > 0)
+            return;
+        offset = tiff.u32(offset + 2 + qint64(count) * 12);
+    }
+}
+
+// A TIFF header at base, then its first IFD
+static bool readTiff(const uchar* data, qint64 size, qint64 base, RawProcessor::Metadata& metadata, QVector<Preview>& previews)
+{
+    if (base < 0 || base + 8 > size)
+        return false;
+    const uchar* header = data + base;
+    const bool bigEndian = header[0] == 'M' && header[1] == 'M';
+    if (!bigEndian && !(header[0] == 'I' && header[1] == 'I'))
+        return false;
+    const TiffView tiff = {data, size, base, bigEndian};
+    readIfd(tiff, tiff.u32(4), 0, metadata, previews);
+    return true;
+}
+
+static void readBoxes(const uchar* data, qint64 size, qint64 begin, qint64 end, int depth, RawProcessor::Metadata& metadata, QVector<Preview>& previews)
+{
+    qint64 pos = begin;
+    end = qMin(end, size);
+    while (pos + 8 <= end)
+    {
+        qint64 boxSize = bigEndian32(data + pos);
+        const char* type = reinterpret_cast<const char*>(data + pos + 4);
+        qint64 header = 8;
+        if (boxSize == 1 && pos + 16 <= end)
+        {
+            boxSize = qint64(bigEndian32(data + pos + 8)) << 32 | bigEndian32(data + pos + 12);
+            header = 16;
+        }
+        else if (boxSize == 0)
+            boxSize = end - pos;
+        if (boxSize < header)
+            return;
+        // Clipped to the data, a head has the start of the boxes it cuts
+        const qint64 boxEnd = qMin(pos + boxSize, end);
+        const qint64 content = pos + header;
+
+        if (memcmp(type, "moov", 4) == 0 && depth < RAW_MAX_DEPTH)
+            readBoxes(data, size, content, boxEnd, depth + 1, metadata, previews);
+        else if (memcmp(type, "uuid", 4) == 0 && content + 16 <= boxEnd)
+        {
+            if (memcmp(data + content, canonMetadataUuid, 16) == 0 && depth < RAW_MAX_DEPTH)
+                readBoxes(data, size, content + 16, boxEnd, depth + 1, metadata, previews);
+            else if (memcmp(data + content, canonPreviewUuid, 16) == 0)
+            {
+                // 8 bytes, then the PRVW box: 8 of its own, a size and the JPEG at 24
+                const qint64 prvw = content + 16 + 8;
+                if (prvw + 24 <= boxEnd && memcmp(data + prvw + 4, "PRVW", 4) == 0)
+                    previews.append({prvw + 24, bigEndian32(data + prvw + 20)});
+            }
+        }
+        else if (memcmp(type, "CMT1", 4) == 0 || memcmp(type, "CMT2", 4) == 0)
+            readTiff(data, boxEnd, content, metadata, previews);
+
+        pos += boxSize;
+    }
+}
+
+RawProcessor::Metadata RawProcessor::parse(const uchar *data, qint64 size)
+{
+    Metadata metadata;
+    QVector<Preview> previews;
+    if (size >= 12 && memcmp(data + 4, "ftypcrx ", 8) == 0)
+    {
+        metadata.isRaw = true;
+        readBoxes(data, size, 0, size, 0, metadata, previews);
+    }
+    else if (size >= 8 && memcmp(data, "IIU\0", 4) == 0)
+    {
+        // RW2 is a TIFF with a magic number of its own
+        metadata.isRaw = true;
+        const TiffView tiff = {data, size, 0, false};
+        readIfd(tiff, tiff.u32(4), 0, metadata, previews);
+    }
+    else
+        metadata.isRaw = readTiff(data, size, 0, metadata, previews);
+
+    for (auto& preview : previews)
+    {
+        if (preview.length <= metadata.previewLength || preview.offset < 0 || preview.offset > size - preview.length)
+            continue;
+        if (!isDecodableJpeg(data + preview.offset, preview.length))
+            continue;
+        metadata.previewOffset = preview.offset;
+        metadata.previewLength = preview.length;
+    }
+    return metadata;
+}
+
+bool RawProcessor::loadFile(const AstroFile &astroFile)
+{
+    // Read here for the tags only, the preview is read by extractThumbnail
+    FileReader reader;
+    if (!reader.open(astroFile.FullPath))
+        return false;
+    _filePath = astroFile.FullPath;
+    _metadata = parse(reader.data(), reader.size());
+    return _metadata.isRaw;
+}
+
+bool RawProcessor::loadFile(const AstroFile &astroFile, const FileReader &reader)
+{
+    _filePath = astroFile.FullPath;
+    _fileData = QByteArray::fromRawData(reinterpret_cast<const char*>(reader.data()), reader.size());
+    _metadata = parse(reader.data(), reader.size());
+    _imageHash = reader.fileHash();
+    return _metadata.isRaw;
+}
+
+/*!
+ * \brief RawProcessor::loadHeader
+ * The EXIF of a raw is nearly always near its start. When it is past the head, the
+ * file is read for it.
+ */
+bool RawProcessor::loadHeader(const AstroFile &astroFile, const QByteArray &head)
+{
+    if (head.isEmpty())
+        return loadFile(astroFile);
+    _filePath = astroFile.FullPath;
+    _metadata = parse(reinterpret_cast<const uchar*>(head.constData()), head.size());
+    if (_metadata.isRaw && !_metadata.hasExif && head.size() < astroFile.FileSize)
+        return loadFile(astroFile);
+    return _metadata.isRaw;
+}
+
+void RawProcessor::extractTags()
+{
+    QString camera = _metadata.model;
+    // Most models start with the make already, "Canon EOS 6D", "NIKON D810"
+    const QString brand = _metadata.make.section(' ', 0, 0);
+    if (!brand.isEmpty() && !camera.startsWith(brand, Qt::CaseInsensitive))
+        camera = _metadata.make + " " + camera;
+    if (!camera.trimmed().isEmpty())
+        _tags.insert("INSTRUME", camera.trimmed());
+
+    // The camera clock, which is usually set to local time
+    const QDateTime date = QDateTime::fromString(_metadata.dateTimeOriginal, "yyyy:MM:dd HH:mm:ss");
+    if (date.isValid())
+        _tags.insert("DATE-OBS", date.toString("yyyy-MM-ddTHH:mm:ss"));
+    if (_metadata.exposureTime > 0)
+        _tags.insert("EXPTIME", QString::number(_metadata.exposureTime));
+    if (_metadata.iso > 0)
+        _tags.insert("ISOSPEED", QString::number(_metadata.iso));
+}
+
+/*!
+ * \brief RawProcessor::extractThumbnail
+ * Decodes the embedded preview straight to the thumbnail size, the JPEG decoder scales
+ * in the DCT domain. The raw data itself is not read.
+ */
+void RawProcessor::extractThumbnail()
+{
+    FileReader reader;
+    if (_fileData.isEmpty())
+    {
+        // Loaded for the tags only
+        if (!reader.open(_filePath))
+            return;
+        _fileData = QByteArray::fromRawData(reinterpret_cast<const char*>(reader.data()), reader.size());
+        _metadata = parse(reader.data(), reader.size());
+        _imageHash = reader.fileHash();
+    }
+
+    if (_metadata.previewOffset >= 0 && !cancellationToken.isCanceled())
+    {
+        QByteArray preview = QByteArray::fromRawData(_fileData.constData() + _metadata.previewOffset, int(_metadata.previewLength));
+        QBuffer buffer(&preview);
+        QImageReader imageReader(&buffer, "jpeg");
+        QSize size = imageReader.size();
+        if (size.isValid() && (size.width() > THUMBNAIL_SIZE || size.height() > THUMBNAIL_SIZE))
+            imageReader.setScaledSize(size.scaled(THUMBNAIL_SIZE, THUMBNAIL_SIZE, Qt::KeepAspectRatio));
+        QImage image = imageReader.read();
+        if (image.width() > THUMBNAIL_SIZE || image.height() > THUMBNAIL_SIZE)
+            image = image.scaled(QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        ColorManagement::convert(image, image.colorSpace().iccProfile());
+
+        // The previews are stored as the sensor reads, the camera only tags its orientation
+        if (_metadata.orientation == 3)
+            image = image.transformed(QTransform().rotate(180));
+        else if (_metadata.orientation == 6)
+            image = image.transformed(QTransform().rotate(90));
+        else if (_metadata.orientation == 8)
+            image = image.transformed(QTransform().rotate(270));
+        _thumbnail = image;
+    }
+
+    // The data belonged to the local reader
+    if (reader.data() != nullptr)
+        _fileData.clear();
+}
+
+QMap<QString, QString> RawProcessor::getTags()
+{
+    return _tags;
+}
+
+QImage RawProcessor::getThumbnail()
+{
+    return _thumbnail;
+}
+
+QImage RawProcessor::getTinyThumbnail()
+{
+    // Scaled once from the thumbnail
+    if (_tinyThumbnail.isNull() && !_thumbnail.isNull())
+        _tinyThumbnail = _thumbnail.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return _tinyThumbnail;
+}
+
+QByteArray RawProcessor::getImageHash()
+{
+    return _imageHash;
+}
+
+void RawProcessor::reset()
+{
+    _filePath.clear();
+    _fileData.clear();
+    _metadata = Metadata();
+    _tags.clear();
+    _thumbnail = QImage();
+    _tinyThumbnail = QImage();
+    _imageHash.clear();
+}
@@ -0,0 +1,79 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef RAWPROCESSOR_H
+#define RAWPROCESSOR_H
+
+#include "fileprocessor.h"
+
+/*!
+ * \brief The RawProcessor class
+ * Camera raw files of one shot color DSLRs and mirrorless cameras. Nothing is
+ * demosaiced: the tags come from the EXIF of the file and the thumbnail from the
+ * largest JPEG preview the camera embedded in it, decoded scaled like an image.
+ *
+ * The TIFF based raws (CR2, NEF, NRW, ARW, DNG, PEF and RW2) are read through their
+ * IFDs, CR3 through its ISO media boxes.
+ */
+class RawProcessor : public FileProcessor
+{
+public:
+    bool loadFile(const AstroFile &astroFile);
+    bool loadFile(const AstroFile &astroFile, const FileReader& reader);
+    bool loadHeader(const AstroFile &astroFile, const QByteArray &head);
+    void extractTags();
+    void extractThumbnail();
+    QMap<QString, QString> getTags();
+    QImage getThumbnail();
+    QImage getTinyThumbnail();
+    QByteArray getImageHash();
+    void reset();
+
+    // What the container says about the shot and where its preview is
+    struct Metadata
+    {
+        bool isRaw = false; // A container we read
+        bool hasExif = false;
+        QString make;
+        QString model;
+        QString dateTimeOriginal; // As EXIF has it, "yyyy:MM:dd HH:mm:ss" of the camera clock
+        double exposureTime = 0; // Seconds
+        int iso = 0;
+        int orientation = 1; // EXIF, 1 is upright
+        qint64 previewOffset = -1; // Of the largest JPEG preview Qt decodes
+        qint64 previewLength = 0;
+    };
+    static Metadata parse(const uchar* data, qint64 size);
+
+private:
+    QString _filePath;
+    QByteArray _fileData; // Not owned, the data of the FileReader the file was loaded from
+    Metadata _metadata;
+    QMap<QString, QString> _tags;
+    QImage _thumbnail;
+    QImage _tinyThumbnail;
+    QByteArray _imageHash;
+};
+
+#endif // RAWPROCESSOR_H
@@ -0,0 +1,70 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef REPOSITORYREQUEST_H
+#define REPOSITORYREQUEST_H
+
+#include "cancellationtoken.h"
+
+#include <QList>
+#include <QMutex>
+
+#include <functional>
+
+// Do not renumber, requests of a lower value run first
+enum RequestPriority
+{
+    InteractivePriority = 0,
+    IngestPriority = 1,
+    MaintenancePriority = 2,
+    RequestPriorityCount
+};
+
+/*!
+ * \brief The RequestQueue class
+ * The requests waiting for the repository thread, one FIFO per priority. Thread safe.
+ */
+class RequestQueue
+{
+public:
+    struct Request
+    {
+        RequestPriority priority = MaintenancePriority;
+        CancellationToken token;
+        // Called with true when the request was canceled before it ran
+        std::function<void(bool canceled)> run;
+    };
+
+    void push(const Request& request);
+    // Takes the oldest request of the highest priority above `below`
+    bool take(Request& request, RequestPriority below = RequestPriorityCount);
+    // Cancels the waiting requests of this priority and the ones below it
+    void cancelFrom(RequestPriority priority);
+
+private:
+    QMutex mutex;
+    QList<Request> queues[RequestPriorityCount];
+};
+
+#endif // REPOSITORYREQUEST_H
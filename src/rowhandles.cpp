@@ -0,0 +1,137 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "rowhandles.h"
+
+#include <QCoreApplication>
+
+// Slots per chunk, and chunks at most, so up to 16M rows
+#define ROW_HANDLE_CHUNK_SHIFT 12
+#define ROW_HANDLE_CHUNK_SIZE (1 << ROW_HANDLE_CHUNK_SHIFT)
+#define ROW_HANDLE_MAX_CHUNKS 4096
+
+RowHandles::RowHandles()
+    : retired(std::make_shared<Retired>())
+{
+    chunks = new std::atomic<Slot*>[ROW_HANDLE_MAX_CHUNKS];
+    for (int i = 0; i < ROW_HANDLE_MAX_CHUNKS; i++)
+        chunks[i].store(nullptr);
+}
+
+RowHandles::~RowHandles()
+{
+    for (int i = 0; i < ROW_HANDLE_MAX_CHUNKS; i++)
+        delete[] chunks[i].load();
+    delete[] chunks;
+}
+
+RowHandles::Slot *RowHandles::slotOf(quint32 index) const
+{
+    const quint32 chunk = index >> ROW_HANDLE_CHUNK_SHIFT;
+    if (chunk >= ROW_HANDLE_MAX_CHUNKS)
+        return nullptr;
+    Slot* chunkSlots = chunks[chunk].load(std::memory_order_acquire);
+    return chunkSlots != nullptr ? &chunkSlots[index & (ROW_HANDLE_CHUNK_SIZE - 1)] : nullptr;
+}
+
+RowHandles::Handle RowHandles::add(AstroFile *astroFile)
+{
+    quint32 index;
+    if (!freeSlots.isEmpty())
+        index = freeSlots.takeLast();
+    else
+    {
+        index = slotCount++;
+        const quint32 chunk = index >> ROW_HANDLE_CHUNK_SHIFT;
+        Q_ASSERT(chunk < ROW_HANDLE_MAX_CHUNKS);
+        if (chunks[chunk].load(std::memory_order_relaxed) == nullptr)
+            chunks[chunk].store(new Slot[ROW_HANDLE_CHUNK_SIZE], std::memory_order_release);
+    }
+    Slot* slot = slotOf(index);
+    slot->astroFile.store(astroFile, std::memory_order_release);
+    return (Handle(slot->generation.load(std::memory_order_relaxed)) << 32) | index;
+}
+
+void RowHandles::replace(Handle handle, AstroFile *astroFile)
+{
+    Slot* slot = slotOf(quint32(handle));
+    if (slot != nullptr && slot->generation.load(std::memory_order_relaxed) == quint32(handle >> 32))
+        slot->astroFile.store(astroFile, std::memory_order_release);
+}
+
+void RowHandles::remove(Handle handle)
+{
+    const quint32 index = quint32(handle);
+    Slot* slot = slotOf(index);
+    const quint32 generation = quint32(handle >> 32);
+    if (slot == nullptr || slot->generation.load(std::memory_order_relaxed) != generation)
+        return;
+    // The generation changes first, so a reader that still gets the old file sees that
+    // its handle went stale. 0 is skipped, so no handle is ever 0.
+    slot->generation.store(generation + 1 != 0 ? generation + 1 : 1, std::memory_order_release);
+    slot->astroFile.store(nullptr, std::memory_order_release);
+    freeSlots.append(index);
+}
+
+/*!
+ * \brief RowHandles::value
+ * The file is read before the generation is checked: if the slot was reused in between,
+ * its generation already changed, and the old file is not freed until the reader is
+ * back in its event loop.
+ */
+AstroFile *RowHandles::value(Handle handle) const
+{
+    const Slot* slot = slotOf(quint32(handle));
+    if (slot == nullptr)
+        return nullptr;
+    AstroFile* astroFile = slot->astroFile.load(std::memory_order_acquire);
+    if (slot->generation.load(std::memory_order_acquire) != quint32(handle >> 32))
+        return nullptr;
+    return astroFile;
+}
+
+void RowHandles::retire(AstroFile *astroFile)
+{
+    QCoreApplication* application = QCoreApplication::instance();
+    if (application == nullptr)
+    {
+        delete astroFile;
+        return;
+    }
+
+    QMutexLocker locker(&retired->mutex);
+    retired->files.append(astroFile);
+    if (retired->reclaimPosted)
+        return;
+    retired->reclaimPosted = true;
+    QMetaObject::invokeMethod(application, [retired = retired]() {
+        QList<AstroFile*> files;
+        {
+            QMutexLocker locker(&retired->mutex);
+            files.swap(retired->files);
+            retired->reclaimPosted = false;
+        }
+        qDeleteAll(files);
+    }, Qt::QueuedConnection);
+}
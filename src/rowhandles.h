@@ -0,0 +1,89 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef ROWHANDLES_H
+#define ROWHANDLES_H
+
+#include "astrofile.h"
+
+#include <QMutex>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+/*!
+ * \brief The RowHandles class
+ * Stable handles of the rows of the Catalog, for the model indexes. A handle is a slot
+ * index and the generation of the slot. The slot keeps its handle when the Catalog
+ * replaces the AstroFile of a row, and changes generation when the row is removed, so
+ * a stale handle finds nothing instead of a freed or reused file.
+ *
+ * The slots are in chunks that never move, so value() takes no lock. The writers are
+ * the Catalog, under its list lock. An AstroFile reached through a handle is never
+ * changed, but for its atomic tinyThumbnailSlot: a writer replaces it with a changed
+ * copy, see Catalog::replaceRow. A removed or replaced AstroFile is not deleted right
+ * away, see retire.
+ */
+class RowHandles
+{
+public:
+    typedef quint64 Handle; // 0 is no row
+
+    RowHandles();
+    ~RowHandles();
+
+    Handle add(AstroFile* astroFile);
+    void replace(Handle handle, AstroFile* astroFile);
+    void remove(Handle handle);
+    // Lock free. nullptr if the row of the handle was removed.
+    AstroFile* value(Handle handle) const;
+
+    // Deletes the AstroFile once the main thread is back in its event loop. The GUI only
+    // uses the files it looked up there, so none of them is freed while it reads them.
+    void retire(AstroFile* astroFile);
+
+private:
+    struct Slot
+    {
+        std::atomic<quint32> generation {1};
+        std::atomic<AstroFile*> astroFile {nullptr};
+    };
+
+    struct Retired
+    {
+        QMutex mutex;
+        QList<AstroFile*> files;
+        bool reclaimPosted = false;
+    };
+
+    std::atomic<Slot*>* chunks;
+    quint32 slotCount = 0;
+    QVector<quint32> freeSlots;
+    std::shared_ptr<Retired> retired; // Outlives the Catalog until the main thread reclaims it
+
+    Slot* slotOf(quint32 index) const;
+};
+
+#endif // ROWHANDLES_H
@@ -0,0 +1,350 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "sandboxedprocessor.h"
+#include "fitsprocessor.h"
+#include "imageprocessor.h"
+#include "metrics.h"
+#include "rawprocessor.h"
+#include "serprocessor.h"
+#include "xisfprocessor.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+// The argument a helper is started with, followed by the native key of its segment
+#define HELPER_ARGUMENT "--decoder-helper"
+
+// Of the shared memory of each helper. The largest thumbnail, the linear one and the
+// tags of a file take less than 2 MB, and a request the head of the file.
+#define SANDBOX_SEGMENT_SIZE (8 * 1024 * 1024)
+
+// A helper that is not started after this long, or takes longer than this to decode a
+// file, is taken for hung and killed, in milliseconds
+#define SANDBOX_START_TIMEOUT 10000
+#define SANDBOX_DECODE_TIMEOUT 120000
+
+// The cancellation is checked this often while a helper decodes, in milliseconds
+#define SANDBOX_POLL_MSECS 100
+
+// A helper is given this long to exit once its pipe is closed, then killed
+#define SANDBOX_EXIT_TIMEOUT 1000
+
+// Makes the native keys of the segments unique in the app
+static std::atomic<int> nextHelperId = 0;
+
+// The pixels as they are, instead of the PNG QDataStream writes for a QImage
+static void writeImage(QDataStream& out, const QImage& image)
+{
+    out << qint32(image.width()) << qint32(image.height()) << qint32(image.format());
+    if (!image.isNull())
+        out.writeRawData(reinterpret_cast<const char*>(image.constBits()), int(image.sizeInBytes()));
+}
+
+static QImage readImage(QDataStream& in)
+{
+    qint32 width = 0;
+    qint32 height = 0;
+    qint32 format = 0;
+    in >> width >> height >> format;
+    if (width <= 0 || height <= 0)
+        return QImage();
+    QImage image(width, height, QImage::Format(format));
+    in.readRawData(reinterpret_cast<char*>(image.bits()), int(image.sizeInBytes()));
+    return in.status() == QDataStream::Ok ? image : QImage();
+}
+
+static void writeQuality(QDataStream& out, const FrameQuality& quality)
+{
+    out << quality.background << quality.noise << qint32(quality.starCount) << quality.fwhm << quality.eccentricity;
+}
+
+static FrameQuality readQuality(QDataStream& in)
+{
+    FrameQuality quality;
+    qint32 starCount = -1;
+    in >> quality.background >> quality.noise >> starCount >> quality.fwhm >> quality.eccentricity;
+    quality.starCount = starCount;
+    return quality;
+}
+
+SandboxedProcessor::SandboxedProcessor()
+{
+}
+
+SandboxedProcessor::~SandboxedProcessor()
+{
+    stopHelper();
+}
+
+bool SandboxedProcessor::loadHeader(const AstroFile &astroFile, const QByteArray &head)
+{
+    return decode(HeaderPhase, astroFile, head);
+}
+
+bool SandboxedProcessor::loadFile(const AstroFile &astroFile)
+{
+    return decode(PixelPhase, astroFile, QByteArray());
+}
+
+void SandboxedProcessor::reset()
+{
+    tags.clear();
+    thumbnail = QImage();
+    tinyThumbnail = QImage();
+    linearThumbnail = QImage();
+    imageHash.clear();
+    stretchParams.clear();
+    quality = FrameQuality();
+}
+
+/*!
+ * \brief SandboxedProcessor::decode
+ * Writes the request into the segment, tells the helper to run the phase and waits for
+ * its answer, then reads the results from the segment. Returns false when the file
+ * could not be loaded, also when the helper crashed or hung on it. The header phase
+ * is short and not canceled.
+ */
+bool SandboxedProcessor::decode(Phase phase, const AstroFile &astroFile, const QByteArray &head)
+{
+    static std::atomic<qint64>& crashCount = Metrics::counter("sandbox.crashes");
+    static std::atomic<qint64>& timeoutCount = Metrics::counter("sandbox.timeouts");
+    static LatencyHistogram& decodeLatency = Metrics::histogram("sandbox.decode");
+    ScopedLatency latency(decodeLatency);
+    reset();
+
+    if (!helper && !startHelper())
+        return false;
+
+    QByteArray request;
+    QDataStream out(&request, QIODevice::WriteOnly);
+    out << astroFile.FullPath << qint32(astroFile.FileType) << astroFile.FileSize << astroFile.StretchParameters << head;
+    if (request.size() > segment.size())
+        return false;
+    memcpy(segment.data(), request.constData(), request.size());
+    helper->write(QString("%1 %2\n").arg(phase == HeaderPhase ? "header" : "pixels").arg(request.size()).toLatin1());
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (!helper->canReadLine())
+    {
+        if (phase == PixelPhase && cancellationToken.isCanceled())
+        {
+            // Left for processPixels to drop
+            stopHelper();
+            return true;
+        }
+        if (helper->state() == QProcess::NotRunning)
+        {
+            crashCount++;
+            qWarning() << "The decoder crashed on" << astroFile.FullPath;
+            stopHelper();
+            return false;
+        }
+        if (elapsed.elapsed() > SANDBOX_DECODE_TIMEOUT)
+        {
+            timeoutCount++;
+            qWarning() << "The decoder hung on" << astroFile.FullPath;
+            stopHelper();
+            return false;
+        }
+        helper->waitForReadyRead(SANDBOX_POLL_MSECS);
+    }
+
+    const QList<QByteArray> reply = helper->readLine().trimmed().split(' ');
+    if (reply.count() != 2 || reply.at(0) != "done")
+        return false;
+    const int size = reply.at(1).toInt();
+    if (size <= 0 || size > segment.size())
+        return false;
+
+    const QByteArray results = QByteArray::fromRawData(static_cast<const char*>(segment.constData()), size);
+    QDataStream in(results);
+    in >> tags;
+    if (phase == PixelPhase)
+    {
+        thumbnail = readImage(in);
+        tinyThumbnail = readImage(in);
+        linearThumbnail = readImage(in);
+        in >> imageHash >> stretchParams;
+        quality = readQuality(in);
+    }
+    if (in.status() != QDataStream::Ok)
+    {
+        reset();
+        return false;
+    }
+    return true;
+}
+
+bool SandboxedProcessor::startHelper()
+{
+    const QString key = QString("astrocat-decoder-%1-%2").arg(QCoreApplication::applicationPid()).arg(nextHelperId++);
+    segment.setNativeKey(key);
+    if (!segment.create(SANDBOX_SEGMENT_SIZE))
+    {
+        qWarning() << "Could not create the segment of a decoder:" << segment.errorString();
+        return false;
+    }
+
+    helper = std::make_unique<QProcess>();
+    helper->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    helper->start(QCoreApplication::applicationFilePath(), {HELPER_ARGUMENT, key});
+    if (!helper->waitForStarted(SANDBOX_START_TIMEOUT))
+    {
+        qWarning() << "Could not start a decoder:" << helper->errorString();
+        stopHelper();
+        return false;
+    }
+    return true;
+}
+
+void SandboxedProcessor::stopHelper()
+{
+    if (helper)
+    {
+        helper->closeWriteChannel();
+        if (!helper->waitForFinished(SANDBOX_EXIT_TIMEOUT))
+        {
+            helper->kill();
+            helper->waitForFinished(SANDBOX_EXIT_TIMEOUT);
+        }
+        helper.reset();
+    }
+    if (segment.isAttached())
+        segment.detach();
+}
+
+bool SandboxedProcessor::isHelper(int argc, char *argv[])
+{
+    return argc == 3 && strcmp(argv[1], HELPER_ARGUMENT) == 0;
+}
+
+// The processor of each type, made the first time the helper needs it
+static FileProcessor* processorOf(AstroFileType type, std::unique_ptr<FileProcessor> (&processors)[AstroFileType::Ser + 1])
+{
+    std::unique_ptr<FileProcessor>& processor = processors[int(type)];
+    if (!processor)
+    {
+        switch (type)
+        {
+            case AstroFileType::Fits: processor.reset(new FitsProcessor()); break;
+            case AstroFileType::Xisf: processor.reset(new XisfProcessor()); break;
+            case AstroFileType::Image: processor.reset(new ImageProcessor()); break;
+            case AstroFileType::Raw: processor.reset(new RawProcessor()); break;
+            case AstroFileType::Ser: processor.reset(new SerProcessor()); break;
+            case AstroFileType::UnknownType: break;
+        }
+    }
+    return processor.get();
+}
+
+/*!
+ * \brief SandboxedProcessor::runHelper
+ * Answers each line of the app, "header" or "pixels" and the bytes of the request in
+ * the segment, with "done" and the bytes of the results written over it, or "failed"
+ * when the file could not be loaded. Exits when the app closes the pipe, or goes away.
+ */
+int SandboxedProcessor::runHelper(int argc, char *argv[])
+{
+    // Thumbnails are drawn into QImages, which needs a platform but not a display
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("Astrocat");
+    QCoreApplication::setOrganizationName("Astrocat");
+    QCoreApplication::setOrganizationDomain("astrocat.app");
+
+    QSharedMemory segment;
+    segment.setNativeKey(QString::fromLocal8Bit(argv[2]));
+    if (!segment.attach())
+    {
+        fprintf(stderr, "Could not attach the segment of the decoder: %s\n", qPrintable(segment.errorString()));
+        return 1;
+    }
+    QFile input;
+    QFile output;
+    if (!input.open(stdin, QIODevice::ReadOnly) || !output.open(stdout, QIODevice::WriteOnly | QIODevice::Unbuffered))
+        return 1;
+
+    std::unique_ptr<FileProcessor> processors[AstroFileType::Ser + 1];
+    for (;;)
+    {
+        const QList<QByteArray> command = input.readLine().trimmed().split(' ');
+        if (command.count() != 2)
+            return 0;
+        const bool pixels = command.at(0) == "pixels";
+        const int size = command.at(1).toInt();
+        if (size <= 0 || size > segment.size())
+            return 1;
+
+        AstroFile astroFile;
+        qint32 type = 0;
+        QByteArray head;
+        {
+            // Read before the results are written over it
+            QDataStream in(QByteArray::fromRawData(static_cast<const char*>(segment.constData()), size));
+            in >> astroFile.FullPath >> type >> astroFile.FileSize >> astroFile.StretchParameters >> head;
+        }
+        astroFile.FileType = AstroFileType(type);
+
+        const bool known = type >= AstroFileType::Fits && type <= AstroFileType::Ser;
+        FileProcessor* processor = known ? processorOf(astroFile.FileType, processors) : nullptr;
+        const bool loaded = processor != nullptr && (pixels ? processor->loadFile(astroFile) : processor->loadHeader(astroFile, head));
+        QByteArray results;
+        if (loaded)
+        {
+            QDataStream out(&results, QIODevice::WriteOnly);
+            processor->extractTags();
+            out << processor->getTags();
+            if (pixels)
+            {
+                processor->extractThumbnail();
+                writeImage(out, processor->getThumbnail());
+                writeImage(out, processor->getTinyThumbnail());
+                writeImage(out, processor->getLinearThumbnail());
+                out << processor->getImageHash() << processor->getStretchParams();
+                writeQuality(out, processor->getFrameQuality());
+            }
+        }
+        if (processor != nullptr)
+            processor->reset();
+
+        if (!loaded || results.size() > segment.size())
+        {
+            output.write("failed\n");
+            continue;
+        }
+        memcpy(segment.data(), results.constData(), results.size());
+        output.write(QString("done %1\n").arg(results.size()).toLatin1());
+    }
+}
@@ -0,0 +1,103 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SANDBOXEDPROCESSOR_H
+#define SANDBOXEDPROCESSOR_H
+
+#include "fileprocessor.h"
+
+#include <QProcess>
+#include <QSharedMemory>
+
+#include <memory>
+
+/*!
+ * \brief The SandboxedProcessor class
+ * Decodes files in a helper process instead of in the app, so a corrupted file that
+ * crashes cfitsio or PCL only loses that file, and the global state of PCL is not
+ * shared by the decoding threads. Used by NewFileProcessor for every file type with
+ * the SandboxedDecoding setting, or astrocat-index --sandbox.
+ *
+ * Each decoding thread has its own helper, which is this executable started with
+ * --decoder-helper, so the helpers scale with the threads. A request and its results
+ * are handed over in a shared memory segment of the helper, and the pipe only carries
+ * a line saying which phase to run and how many bytes were written. The thumbnails
+ * go through as raw pixels.
+ *
+ * A helper that crashes or hangs fails the file it was decoding, and a new one is
+ * started for the next file. The helper reads the file itself, the bytes read ahead
+ * by the app are not used.
+ */
+class SandboxedProcessor : public FileProcessor
+{
+public:
+    SandboxedProcessor();
+    ~SandboxedProcessor();
+
+    // The header phase, the head is read again by the helper when empty
+    bool loadHeader(const AstroFile& astroFile) override { return loadHeader(astroFile, QByteArray()); }
+    bool loadHeader(const AstroFile& astroFile, const QByteArray& head) override;
+    // The whole pixel phase. Canceled, the helper is stopped and the thumbnail left null.
+    bool loadFile(const AstroFile& astroFile) override;
+    // Done by the helper along with the load
+    void extractTags() override {}
+    void extractThumbnail() override {}
+    QMap<QString, QString> getTags() override { return tags; }
+    QImage getThumbnail() override { return thumbnail; }
+    QImage getTinyThumbnail() override { return tinyThumbnail; }
+    QImage getLinearThumbnail() override { return linearThumbnail; }
+    QByteArray getImageHash() override { return imageHash; }
+    QByteArray getStretchParams() override { return stretchParams; }
+    FrameQuality getFrameQuality() override { return quality; }
+    void reset() override;
+
+    // Whether the executable was started as a helper, see runHelper
+    static bool isHelper(int argc, char *argv[]);
+    // The loop of a helper, until the app closes its pipe. Called first thing by main.
+    static int runHelper(int argc, char *argv[]);
+
+private:
+    enum Phase
+    {
+        HeaderPhase,
+        PixelPhase
+    };
+
+    bool decode(Phase phase, const AstroFile& astroFile, const QByteArray& head);
+    bool startHelper();
+    void stopHelper();
+
+    std::unique_ptr<QProcess> helper;
+    QSharedMemory segment;
+
+    QMap<QString, QString> tags;
+    QImage thumbnail;
+    QImage tinyThumbnail;
+    QImage linearThumbnail;
+    QByteArray imageHash;
+    QByteArray stretchParams;
+    FrameQuality quality;
+};
+
+#endif // SANDBOXEDPROCESSOR_H
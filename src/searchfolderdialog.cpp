@@ -49,6 +49,25 @@ SearchFolderDialog::~SearchFolderDialog()
     delete ui;
 }
 
+void SearchFolderDialog::replaceSearchFolder(const QString &from, const QString &to)
+{
+    int index = searchFolders.indexOf(from);
+    if (index == -1)
+        return;
+
+    if (searchFolders.contains(to))
+    {
+        searchFolders.removeAt(index);
+        delete ui->searchFoldersWidget->takeItem(index);
+    }
+    else
+    {
+        searchFolders.replace(index, to);
+        ui->searchFoldersWidget->item(index)->setText(to);
+    }
+    settings.setValue("SearchFolders", searchFolders);
+}
+
 void SearchFolderDialog::addNewClicked()
 {
     auto OutputFolder = QFileDialog::getExistingDirectory(0, ("Select Output Folder"), QDir::homePath());
@@ -38,6 +38,8 @@ class SearchFolderDialog : public QDialog
 public:
     explicit SearchFolderDialog(QWidget *parent = nullptr);
     ~SearchFolderDialog();
+    // Saves the folder at its new path, after its volume was mounted somewhere else
+    void replaceSearchFolder(const QString& from, const QString& to);
 
 public slots:
     // QDialog interface
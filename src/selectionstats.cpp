@@ -0,0 +1,80 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "selectionstats.h"
+
+#include <cmath>
+
+void SelectionStats::setCatalog(Catalog *catalog)
+{
+    this->catalog = catalog;
+}
+
+void SelectionStats::setModel(QSortFilterProxyModel *model)
+{
+    this->model = model;
+}
+
+void SelectionStats::apply(const QItemSelection &selected, const QItemSelection &deselected)
+{
+    add(deselected, -1);
+    add(selected, 1);
+    // The sums drift from rounding after many changes
+    if (selectedCount <= 0)
+        clear();
+}
+
+void SelectionStats::clear()
+{
+    selectedCount = 0;
+    totalExposure = 0;
+    totalBytes = 0;
+}
+
+// Rows are counted once, whichever columns of them the ranges have
+void SelectionStats::add(const QItemSelection &selection, int sign)
+{
+    if (selection.isEmpty() || catalog == nullptr || model == nullptr)
+        return;
+
+    catalog->readColumns([&](const CatalogColumns& columns) {
+        for (auto& range : selection)
+        {
+            if (range.left() != 0 || range.parent().isValid())
+                continue;
+            selectedCount += sign * range.height();
+            for (int row = range.top(); row <= range.bottom(); row++)
+            {
+                const int sourceRow = model->mapToSource(model->index(row, 0)).row();
+                if (sourceRow < 0 || sourceRow >= columns.count())
+                    continue;
+                const CatalogColumns::RowView rowView = columns.row(sourceRow);
+                const double exposure = rowView.exposureTime();
+                if (!std::isnan(exposure))
+                    totalExposure += sign * exposure;
+                totalBytes += sign * rowView.fileSize();
+            }
+        }
+    });
+}
@@ -0,0 +1,65 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SELECTIONSTATS_H
+#define SELECTIONSTATS_H
+
+#include "catalog.h"
+
+#include <QItemSelection>
+#include <QSortFilterProxyModel>
+
+/*!
+ * \brief The SelectionStats class
+ * The number of files selected in the view, their total exposure and size. They are
+ * kept from the ranges of each selection change instead of the selected rows, so
+ * selecting many rows at once costs a lookup in the catalog columns per changed row,
+ * and no call to the model.
+ */
+class SelectionStats
+{
+public:
+    void setCatalog(Catalog* catalog);
+    void setModel(QSortFilterProxyModel* model);
+
+    // The ranges of QItemSelectionModel::selectionChanged, while their rows are in the model
+    void apply(const QItemSelection& selected, const QItemSelection& deselected);
+    // When the selection was cleared without a change, like on a reset of the model
+    void clear();
+
+    int count() const { return selectedCount; }
+    double exposure() const { return totalExposure; }
+    qint64 bytes() const { return totalBytes; }
+
+private:
+    Catalog* catalog = nullptr;
+    QSortFilterProxyModel* model = nullptr;
+    int selectedCount = 0;
+    double totalExposure = 0; // Seconds
+    qint64 totalBytes = 0;
+
+    void add(const QItemSelection& selection, int sign);
+};
+
+#endif // SELECTIONSTATS_H
@@ -0,0 +1,392 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "debayer.h"
+#include "framebufferpool.h"
+#include "hasher.h"
+#include "linearthumbnail.h"
+#include "serprocessor.h"
+
+#include <QDateTime>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#define THUMBNAIL_SIZE LARGEST_THUMBNAIL_SIZE
+
+// The fixed header, the frames start right after it
+#define SER_HEADER_SIZE 178
+
+// Larger frames are taken for a damaged header
+#define SER_MAX_SIDE 65535
+
+// Frames the thumbnail is the median of
+#define SER_SAMPLED_FRAMES 16
+
+// Ticks of 100 ns from 0001-01-01 to the Unix epoch
+#define SER_TICKS_TO_EPOCH 621355968000000000LL
+
+/*
+ * A sample of a mapped SER frame. Samples of color frames are interleaved, stride
+ * of them per pixel.
+ */
+template <typename T, bool BigEndian>
+struct SerPixels
+{
+    const uchar* data;
+    int stride;
+    int channel;
+    inline T operator()(long long index) const
+    {
+        const uchar* p = data + (index * stride + channel) * sizeof(T);
+        if constexpr (sizeof(T) == 1)
+            return *p;
+        else
+            return BigEndian ? qFromBigEndian<T>(p) : qFromLittleEndian<T>(p);
+    }
+};
+
+static QString headerString(const uchar* data)
+{
+    const char* text = reinterpret_cast<const char*>(data);
+    return QString::fromLatin1(text, int(strnlen(text, 40))).trimmed();
+}
+
+static BayerPattern bayerPatternOf(int colorId)
+{
+    switch (colorId)
+    {
+    case 8: return RGGB;
+    case 9: return GRBG;
+    case 10: return GBRG;
+    case 11: return BGGR;
+    default: return None;
+    }
+}
+
+static QDateTime dateTimeOfTicks(qint64 ticks)
+{
+    return QDateTime::fromMSecsSinceEpoch((ticks - SER_TICKS_TO_EPOCH) / 10000, Qt::UTC);
+}
+
+bool SerProcessor::parseHeader(const uchar *data, qint64 size, qint64 fileSize, Header &header)
+{
+    if (size < SER_HEADER_SIZE || memcmp(data, "LUCAM-RECORDER", 14) != 0)
+        return false;
+    header.colorId = qFromLittleEndian<qint32>(data + 18);
+    // Nearly every capture program writes this flag the other way round from the
+    // specification, 0 for little endian samples
+    header.bigEndian = qFromLittleEndian<qint32>(data + 22) != 0;
+    header.width = qFromLittleEndian<qint32>(data + 26);
+    header.height = qFromLittleEndian<qint32>(data + 30);
+    header.pixelDepth = qFromLittleEndian<qint32>(data + 34);
+    const qint64 frameCount = qFromLittleEndian<qint32>(data + 38);
+    header.observer = headerString(data + 42);
+    header.instrument = headerString(data + 82);
+    header.telescope = headerString(data + 122);
+    header.dateTimeUtc = qFromLittleEndian<qint64>(data + 170);
+    if (header.width <= 0 || header.height <= 0 || header.width > SER_MAX_SIDE || header.height > SER_MAX_SIDE
+        || header.pixelDepth < 1 || header.pixelDepth > 16 || frameCount <= 0)
+        return false;
+
+    // A capture that was cut short has fewer frames than it declares, and no table
+    const qint64 frameSize = header.frameSize();
+    header.frameCount = qMin(frameCount, (fileSize - SER_HEADER_SIZE) / frameSize);
+    const qint64 timestampsOffset = SER_HEADER_SIZE + frameCount * frameSize;
+    header.timestampsOffset = timestampsOffset + frameCount * 8 <= fileSize ? timestampsOffset : -1;
+    return header.frameCount > 0;
+}
+
+/*!
+ * \brief SerProcessor::loadFile
+ * Maps the file, nothing is read until the frames are. A file that can not be mapped
+ * has its sampled frames read.
+ */
+bool SerProcessor::loadFile(const AstroFile &astroFile)
+{
+    // Stored when the file was ingested, see FitsProcessor::useStoredStretchParams
+    _hasStoredStretchParams = StretchParams::fromByteArray(astroFile.StretchParameters, _storedStretchParams);
+    _filePath = astroFile.FullPath;
+    _file.setFileName(astroFile.FullPath);
+    if (!_file.open(QIODevice::ReadOnly))
+        return false;
+    _mapped = _file.map(0, _file.size());
+    const QByteArray head = _mapped != nullptr ? QByteArray::fromRawData(reinterpret_cast<const char*>(_mapped), SER_HEADER_SIZE)
+                                               : _file.read(SER_HEADER_SIZE);
+    if (!parseHeader(reinterpret_cast<const uchar*>(head.constData()), head.size(), _file.size(), _header))
+        return false;
+    readTimestamps();
+    return true;
+}
+
+bool SerProcessor::loadHeader(const AstroFile &astroFile, const QByteArray &head)
+{
+    if (head.size() < SER_HEADER_SIZE)
+        return loadFile(astroFile);
+    _filePath = astroFile.FullPath;
+    if (!parseHeader(reinterpret_cast<const uchar*>(head.constData()), head.size(), astroFile.FileSize, _header))
+        return false;
+    // Two time stamps at the end of the file, the rest of it is not read
+    _file.setFileName(astroFile.FullPath);
+    if (_header.timestampsOffset >= 0 && _file.open(QIODevice::ReadOnly))
+        readTimestamps();
+    return true;
+}
+
+// The first and the last stamp of the table, of the file opened or mapped
+bool SerProcessor::readTimestamps()
+{
+    if (_header.timestampsOffset < 0)
+        return false;
+    const qint64 last = _header.timestampsOffset + (_header.frameCount - 1) * 8;
+    if (_mapped != nullptr)
+    {
+        _header.firstTimestamp = qFromLittleEndian<qint64>(_mapped + _header.timestampsOffset);
+        _header.lastTimestamp = qFromLittleEndian<qint64>(_mapped + last);
+        return true;
+    }
+    QByteArray first, lastStamp;
+    if (_file.seek(_header.timestampsOffset))
+        first = _file.read(8);
+    if (_file.seek(last))
+        lastStamp = _file.read(8);
+    if (first.size() != 8 || lastStamp.size() != 8)
+        return false;
+    _header.firstTimestamp = qFromLittleEndian<qint64>(first.constData());
+    _header.lastTimestamp = qFromLittleEndian<qint64>(lastStamp.constData());
+    return true;
+}
+
+void SerProcessor::extractTags()
+{
+    _tags.insert("NAXIS1", QString::number(_header.width));
+    _tags.insert("NAXIS2", QString::number(_header.height));
+    _tags.insert("BITPIX", QString::number(8 * _header.bytesPerSample()));
+    if (_header.samplesPerPixel() == 3)
+        _tags.insert("NAXIS3", "3");
+    const BayerPattern pattern = bayerPatternOf(_header.colorId);
+    if (pattern != None)
+        _tags.insert("BAYERPAT", QStringList{"", "RGGB", "BGGR", "GRBG", "GBRG"}.at(pattern));
+    if (!_header.instrument.isEmpty())
+        _tags.insert("INSTRUME", _header.instrument);
+    if (!_header.telescope.isEmpty())
+        _tags.insert("TELESCOP", _header.telescope);
+    if (!_header.observer.isEmpty())
+        _tags.insert("OBSERVER", _header.observer);
+
+    // The stamp of the first frame when there is a table, the start of the capture otherwise
+    const qint64 start = _header.firstTimestamp > 0 ? _header.firstTimestamp : _header.dateTimeUtc;
+    if (start > SER_TICKS_TO_EPOCH)
+        _tags.insert("DATE-OBS", dateTimeOfTicks(start).toString("yyyy-MM-ddTHH:mm:ss.zzz"));
+
+    _tags.insert("FRAMES", QString::number(_header.frameCount));
+    const qint64 ticks = _header.lastTimestamp - _header.firstTimestamp;
+    if (_header.firstTimestamp > 0 && ticks > 0)
+    {
+        const double duration = ticks / 1e7;
+        _tags.insert("DURATION", QString::number(duration, 'f', 3));
+        _tags.insert("FRAMERATE", QString::number((_header.frameCount - 1) / duration, 'f', 2));
+    }
+}
+
+// The bytes of a frame, mapped or read
+QByteArray SerProcessor::readFrame(qint64 index)
+{
+    const qint64 frameSize = _header.frameSize();
+    const qint64 offset = SER_HEADER_SIZE + index * frameSize;
+    if (_mapped != nullptr)
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(_mapped + offset), frameSize);
+    if (!_file.seek(offset))
+        return QByteArray();
+    QByteArray frame = _file.read(frameSize);
+    return frame.size() == frameSize ? frame : QByteArray();
+}
+
+void SerProcessor::extractThumbnail()
+{
+    if (!_file.isOpen())
+        return;
+    if (_header.bytesPerSample() == 1)
+        readFrames<uint8_t, false>();
+    else if (_header.bigEndian)
+        readFrames<uint16_t, true>();
+    else
+        readFrames<uint16_t, false>();
+}
+
+/*!
+ * \brief SerProcessor::readFrames
+ * Bins each sampled frame, a bayer frame as superpixels, and takes the median of each
+ * binned sample over the frames, which drops the frames a cloud or a bad seeing moment
+ * spoiled. The image hash is of the header, the sampled frames and the time stamps,
+ * since hashing every frame would read the whole file.
+ */
+template <typename T, bool BigEndian>
+void SerProcessor::readFrames()
+{
+    const long long width = _header.width;
+    const long long height = _header.height;
+    const BayerPattern pattern = bayerPatternOf(_header.colorId);
+    const bool bayer = pattern != None && width >= 2 && height >= 2;
+    const int channels = bayer ? 3 : _header.samplesPerPixel();
+
+    // Like FitsFile::binningFactor, the longer side stays at least twice the thumbnail size
+    const long long binnedSide = bayer ? qMax(width, height) / 2 : qMax(width, height);
+    int factor = 1;
+    while (binnedSide / (factor * 2) >= 2 * THUMBNAIL_SIZE)
+        factor *= 2;
+    const long long outWidth = bayer ? demosaicedWidth(DemosaicSuperpixel, width, factor) : width / factor;
+    const long long outHeight = bayer ? demosaicedHeight(DemosaicSuperpixel, height, factor) : height / factor;
+    const long long planeSize = outWidth * outHeight * channels;
+    if (planeSize == 0)
+        return;
+
+    const qint64 sampled = qMin<qint64>(SER_SAMPLED_FRAMES, _header.frameCount);
+    std::vector<T> stack(planeSize * sampled);
+    std::vector<PixelSum<T>> sums(outWidth);
+    const long long cells = (long long)factor * factor;
+
+    Hasher hasher;
+    QByteArray head = _mapped != nullptr ? QByteArray::fromRawData(reinterpret_cast<const char*>(_mapped), SER_HEADER_SIZE)
+                                         : (_file.seek(0) ? _file.read(SER_HEADER_SIZE) : QByteArray());
+    hasher.addData(head.constData(), head.size());
+    for (qint64 i = 0; i < sampled; i++)
+    {
+        if (cancellationToken.isCanceled())
+            return;
+        // Spread over the whole capture, the first and the last frames included
+        const qint64 index = sampled > 1 ? i * (_header.frameCount - 1) / (sampled - 1) : 0;
+        const QByteArray frame = readFrame(index);
+        if (frame.isEmpty())
+            return;
+        hasher.addData(frame.constData(), frame.size());
+        const uchar* data = reinterpret_cast<const uchar*>(frame.constData());
+        T* out = stack.data() + i * planeSize;
+
+        if (bayer)
+        {
+            demosaic(DemosaicSuperpixel, pattern, SerPixels<T, BigEndian>{data, 1, 0}, width, height, factor, out);
+            continue;
+        }
+        // Averaged over factor x factor pixels, like FitsFile::bin
+        for (int c = 0; c < channels; c++)
+        {
+            // BGR frames have their samples the other way round
+            const SerPixels<T, BigEndian> pixels{data, channels, _header.colorId == 101 ? 2 - c : c};
+            for (long long y = 0; y < outHeight; y++)
+            {
+                std::fill(sums.begin(), sums.end(), 0);
+                for (long long row = y * factor; row < (y + 1) * factor; row++)
+                    addRowToCells(pixels, row * width, outWidth, factor, sums.data());
+                T* outRow = out + (c * outHeight + y) * outWidth;
+                for (long long x = 0; x < outWidth; x++)
+                    outRow[x] = T(sums[x] / cells);
+            }
+        }
+    }
+    if (_header.firstTimestamp > 0)
+    {
+        hasher.addData(reinterpret_cast<const char*>(&_header.firstTimestamp), sizeof(qint64));
+        hasher.addData(reinterpret_cast<const char*>(&_header.lastTimestamp), sizeof(qint64));
+    }
+    _imageHash = hasher.result();
+
+    T* thumbnailData = reinterpret_cast<T*>(FrameBufferPool::acquire(planeSize * sizeof(T)));
+    if (thumbnailData == nullptr)
+        return;
+    std::vector<T> values(sampled);
+    for (long long k = 0; k < planeSize; k++)
+    {
+        for (qint64 i = 0; i < sampled; i++)
+            values[i] = stack[i * planeSize + k];
+        std::nth_element(values.begin(), values.begin() + sampled / 2, values.end());
+        thumbnailData[k] = values[sampled / 2];
+    }
+
+    AutoStretcher<T> as(outWidth, outHeight, channels, 0);
+    as.setCancellationToken(cancellationToken);
+    as.setData(thumbnailData);
+    if (!_hasStoredStretchParams || !as.setParams(_storedStretchParams))
+        as.calculateParams();
+    QImage qimage = as.stretchToImage();
+    if (!qimage.isNull())
+    {
+        _stretchParams = as.getParams().toByteArray();
+        _thumbnail = qimage.scaled(QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        _linearThumbnail = LinearThumbnail::scaled(as.linearImage(), LINEAR_THUMBNAIL_SIZE);
+    }
+    FrameBufferPool::release(reinterpret_cast<unsigned char*>(thumbnailData));
+}
+
+QMap<QString, QString> SerProcessor::getTags()
+{
+    return _tags;
+}
+
+QImage SerProcessor::getThumbnail()
+{
+    return _thumbnail;
+}
+
+QImage SerProcessor::getTinyThumbnail()
+{
+    // Scaled once from the thumbnail
+    if (_tinyThumbnail.isNull() && !_thumbnail.isNull())
+        _tinyThumbnail = _thumbnail.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return _tinyThumbnail;
+}
+
+QByteArray SerProcessor::getImageHash()
+{
+    return _imageHash;
+}
+
+QByteArray SerProcessor::getStretchParams()
+{
+    return _stretchParams;
+}
+
+QImage SerProcessor::getLinearThumbnail()
+{
+    return _linearThumbnail;
+}
+
+void SerProcessor::reset()
+{
+    if (_mapped != nullptr)
+        _file.unmap(_mapped);
+    _mapped = nullptr;
+    _file.close();
+    _filePath.clear();
+    _header = Header();
+    _tags.clear();
+    _thumbnail = QImage();
+    _tinyThumbnail = QImage();
+    _linearThumbnail = QImage();
+    _imageHash.clear();
+    _stretchParams.clear();
+    _hasStoredStretchParams = false;
+}
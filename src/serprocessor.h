@@ -0,0 +1,100 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SERPROCESSOR_H
+#define SERPROCESSOR_H
+
+#include "autostretcher.h"
+#include "fileprocessor.h"
+
+#include <QFile>
+
+/*!
+ * \brief The SerProcessor class
+ * SER videos of planetary and lunar sessions. The file is mapped rather than read
+ * through a FileReader, and only the fixed header, a few sampled frames and the
+ * first and last time stamps of the table after the frames are touched. The
+ * thumbnail is the median of the sampled frames, debayered as superpixels, so a
+ * video of many gigabytes costs a few megabytes of reads.
+ */
+class SerProcessor : public FileProcessor
+{
+public:
+    bool loadFile(const AstroFile &astroFile);
+    bool loadHeader(const AstroFile &astroFile, const QByteArray &head);
+    void extractTags();
+    void extractThumbnail();
+    QMap<QString, QString> getTags();
+    QImage getThumbnail();
+    QImage getTinyThumbnail();
+    QByteArray getImageHash();
+    QByteArray getStretchParams();
+    QImage getLinearThumbnail();
+    void reset();
+
+    // The fixed header, and what the time stamps say
+    struct Header
+    {
+        int colorId = 0;
+        bool bigEndian = false;
+        int width = 0;
+        int height = 0;
+        int pixelDepth = 0; // Bits per sample, 1 to 16
+        qint64 frameCount = 0; // Of the frames the file has the bytes of
+        QString observer;
+        QString instrument;
+        QString telescope;
+        qint64 dateTimeUtc = 0; // In ticks of 100 ns since 0001-01-01, 0 when not set
+        qint64 timestampsOffset = -1; // -1 when the file ends before the table
+        qint64 firstTimestamp = 0; // Of the table after the frames, 0 when it has none
+        qint64 lastTimestamp = 0;
+
+        int bytesPerSample() const { return pixelDepth > 8 ? 2 : 1; }
+        int samplesPerPixel() const { return colorId == 100 || colorId == 101 ? 3 : 1; }
+        qint64 frameSize() const { return qint64(width) * height * samplesPerPixel() * bytesPerSample(); }
+    };
+    // From the start of the file, which is fileSize bytes long
+    static bool parseHeader(const uchar* data, qint64 size, qint64 fileSize, Header& header);
+
+private:
+    QString _filePath;
+    QFile _file;
+    uchar* _mapped = nullptr;
+    Header _header;
+    QMap<QString, QString> _tags;
+    QImage _thumbnail;
+    QImage _tinyThumbnail;
+    QImage _linearThumbnail;
+    QByteArray _imageHash;
+    QByteArray _stretchParams;
+    StretchParams _storedStretchParams;
+    bool _hasStoredStretchParams = false;
+
+    bool readTimestamps();
+    QByteArray readFrame(qint64 index);
+    template <typename T, bool BigEndian>
+    void readFrames();
+};
+
+#endif // SERPROCESSOR_H
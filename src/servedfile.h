@@ -0,0 +1,48 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SERVEDFILE_H
+#define SERVEDFILE_H
+
+#include "astrofile.h"
+#include "thumbnailcodec.h"
+
+#include <QByteArray>
+
+/*!
+ * \brief The ServedFile struct
+ * A file of the catalog as the CatalogServer sends it: the row with every keyword,
+ * and the tiny thumbnail and the thumbnail of one level encoded as they are stored.
+ * The thumbnails are empty when the file has none.
+ */
+struct ServedFile
+{
+    AstroFile astroFile;
+    QByteArray tinyThumbnail;
+    ThumbnailFormat tinyThumbnailFormat = ThumbnailFormatPng;
+    QByteArray thumbnail;
+    ThumbnailFormat thumbnailFormat = ThumbnailFormatPng;
+};
+
+#endif // SERVEDFILE_H
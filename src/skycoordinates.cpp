@@ -0,0 +1,131 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "skycoordinates.h"
+
+#include <QRegularExpression>
+#include <QStringList>
+
+#include <cmath>
+
+static const double degreesToRadians = 3.14159265358979323846 / 180.0;
+
+/*
+ * The fields of a sexagesimal value, or the single field of a decimal one. The sign
+ * is returned separately, so "-00 30 00" keeps it.
+ */
+static bool parseSexagesimal(const QString& text, double& value, bool& isSexagesimal)
+{
+    static const QRegularExpression separators("[\\s:hdms\\x{00B0}'\"]+");
+    QString trimmed = text.trimmed();
+    bool isNegative = trimmed.startsWith('-');
+    if (isNegative || trimmed.startsWith('+'))
+        trimmed.remove(0, 1);
+
+    const QStringList fields = trimmed.split(separators, Qt::SkipEmptyParts);
+    if (fields.isEmpty() || fields.count() > 3)
+        return false;
+
+    value = 0;
+    double scale = 1;
+    for (auto& field : fields)
+    {
+        bool ok = false;
+        double number = field.toDouble(&ok);
+        if (!ok || number < 0)
+            return false;
+        value += number / scale;
+        scale *= 60;
+    }
+    if (isNegative)
+        value = -value;
+    isSexagesimal = fields.count() > 1 || trimmed.contains(separators);
+    return true;
+}
+
+bool SkyCoordinates::parseRa(const QString &text, double &degrees)
+{
+    double value;
+    bool isSexagesimal;
+    if (!parseSexagesimal(text, value, isSexagesimal))
+        return false;
+
+    degrees = isSexagesimal ? value * 15 : value;
+    return degrees >= 0 && degrees < 360;
+}
+
+bool SkyCoordinates::parseDec(const QString &text, double &degrees)
+{
+    double value;
+    bool isSexagesimal;
+    if (!parseSexagesimal(text, value, isSexagesimal))
+        return false;
+
+    degrees = value;
+    return degrees >= -90 && degrees <= 90;
+}
+
+bool SkyCoordinates::parsePosition(const QString &text, double &ra, double &dec)
+{
+    const QStringList fields = text.split(QRegularExpression("[\\s,]+"), Qt::SkipEmptyParts);
+    if (fields.count() == 2)
+        return parseRa(fields.at(0), ra) && parseDec(fields.at(1), dec);
+    if (fields.count() == 6)
+        return parseRa(fields.mid(0, 3).join(' '), ra) && parseDec(fields.mid(3, 3).join(' '), dec);
+    return false;
+}
+
+double SkyCoordinates::distance(double ra1, double dec1, double ra2, double dec2)
+{
+    // Haversine, which stays accurate for the small distances of a cone search
+    const double sinDec = std::sin((dec2 - dec1) * degreesToRadians / 2);
+    const double sinRa = std::sin((ra2 - ra1) * degreesToRadians / 2);
+    const double a = sinDec * sinDec + std::cos(dec1 * degreesToRadians) * std::cos(dec2 * degreesToRadians) * sinRa * sinRa;
+    return 2 * std::asin(std::sqrt(qMin(1.0, a))) / degreesToRadians;
+}
+
+bool SkyRegion::contains(double ra, double dec) const
+{
+    switch (shape)
+    {
+    case ConeShape:
+        return SkyCoordinates::distance(this->ra, this->dec, ra, dec) <= size;
+    case BoxShape:
+    {
+        if (std::abs(dec - this->dec) > size)
+            return false;
+        double deltaRa = std::fmod(std::abs(ra - this->ra), 360.0);
+        if (deltaRa > 180)
+            deltaRa = 360 - deltaRa;
+        return deltaRa * std::cos(dec * degreesToRadians) <= size;
+    }
+    case NoShape:
+        break;
+    }
+    return true;
+}
+
+bool SkyRegion::operator==(const SkyRegion &other) const
+{
+    return shape == other.shape && ra == other.ra && dec == other.dec && size == other.size;
+}
@@ -0,0 +1,75 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef SKYCOORDINATES_H
+#define SKYCOORDINATES_H
+
+#include <QString>
+
+/*!
+ * \brief The SkyCoordinates class
+ * Parses the OBJCTRA and OBJCTDEC keywords, and positions typed by the user, into
+ * degrees. Sexagesimal values are read as written by most capture programs
+ * ("00 42 44.3", "00:42:44.3" or "00h42m44.3s", right ascension in hours), a
+ * single number is read as degrees.
+ */
+class SkyCoordinates
+{
+public:
+    static bool parseRa(const QString& text, double& degrees);
+    static bool parseDec(const QString& text, double& degrees);
+    // "00 42 44 +41 16 09", "00:42:44 +41:16:09" or "10.68 41.27"
+    static bool parsePosition(const QString& text, double& ra, double& dec);
+    // Great circle distance in degrees
+    static double distance(double ra1, double dec1, double ra2, double dec2);
+};
+
+/*!
+ * \brief The SkyRegion struct
+ * A cone of radius size, or a box of half width size, around a position, in degrees.
+ * The box is size degrees of declination and size degrees on the sky in right
+ * ascension, so it stays square away from the equator.
+ */
+struct SkyRegion
+{
+    enum Shape
+    {
+        NoShape,
+        ConeShape,
+        BoxShape
+    };
+
+    Shape shape = NoShape;
+    double ra = 0;
+    double dec = 0;
+    double size = 0;
+
+    bool isActive() const { return shape != NoShape; }
+    // Every position in the region has a declination in this range
+    double minDec() const { return dec - size; }
+    double maxDec() const { return dec + size; }
+    bool contains(double ra, double dec) const;
+    bool operator==(const SkyRegion& other) const;
+};
+
+#endif // SKYCOORDINATES_H
@@ -0,0 +1,215 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "skycoverage.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <cmath>
+
+// The cone of regionOf is this much wider than the distance to the farthest corner,
+// as the edges of the pixels are not great circles
+#define SKY_COVERAGE_REGION_MARGIN 1.02
+
+// The ring and the longitude of the southern corner of each base pixel, in units of
+// the pixels of the base pixel and of 45 degrees
+static const int baseRings[12] = {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
+static const int baseLongitudes[12] = {1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7};
+
+// Moves the bits of value to the even bits, so two of them interleave
+static qint64 spreadBits(qint64 value)
+{
+    qint64 result = 0;
+    for (int bit = 0; bit < 32; bit++)
+        result |= ((value >> bit) & 1) << (2 * bit);
+    return result;
+}
+
+static qint64 compressBits(qint64 value)
+{
+    qint64 result = 0;
+    for (int bit = 0; bit < 32; bit++)
+        result |= ((value >> (2 * bit)) & 1) << bit;
+    return result;
+}
+
+void SkyCoverage::clear()
+{
+    for (auto& tiles : orders)
+        tiles.clear();
+}
+
+void SkyCoverage::add(double ra, double dec, int filterId, double exposure)
+{
+    change(ra, dec, filterId, exposure, 1);
+}
+
+void SkyCoverage::remove(double ra, double dec, int filterId, double exposure)
+{
+    change(ra, dec, filterId, exposure, -1);
+}
+
+void SkyCoverage::change(double ra, double dec, int filterId, double exposure, int sign)
+{
+    if (std::isnan(ra) || std::isnan(dec))
+        return;
+
+    const double seconds = std::isnan(exposure) ? 0 : exposure * sign;
+    const qint64 pixel = pixelOf(maxOrder, ra, dec);
+    for (int order = 0; order <= maxOrder; order++)
+    {
+        QHash<qint64, Tile>& tiles = orders[order];
+        const qint64 key = pixel >> (2 * (maxOrder - order));
+        Tile& tile = tiles[key];
+        tile.count += sign;
+        if (tile.count <= 0)
+        {
+            // Also drops the rounding errors of the exposures
+            tiles.remove(key);
+            continue;
+        }
+        tile.exposure += seconds;
+
+        auto filter = std::find_if(tile.filters.begin(), tile.filters.end(), [filterId](const FilterTotal& total) { return total.filterId == filterId; });
+        if (filter == tile.filters.end())
+        {
+            if (sign > 0)
+                tile.filters.append({filterId, 1, seconds});
+            continue;
+        }
+        filter->count += sign;
+        filter->exposure += seconds;
+        if (filter->count <= 0)
+            tile.filters.erase(filter);
+    }
+}
+
+/*!
+ * \brief SkyCoverage::pixelOf
+ * The nested pixel of the position, as computed by the HEALPix library. The sky is
+ * twelve base pixels, each a grid of 2^order by 2^order pixels, on rings of constant
+ * area above and below the declination where the polar base pixels begin.
+ */
+qint64 SkyCoverage::pixelOf(int order, double ra, double dec)
+{
+    const qint64 side = qint64(1) << order;
+    const double z = std::sin(qDegreesToRadians(qBound(-90.0, dec, 90.0)));
+    const double absZ = std::fabs(z);
+    // The longitude in units of 90 degrees, from 0 to 4
+    double t = std::fmod(ra / 90.0, 4.0);
+    if (t < 0)
+        t += 4.0;
+
+    int face;
+    qint64 x;
+    qint64 y;
+    if (absZ <= 2.0 / 3.0)
+    {
+        // Equatorial base pixels, between the lines of their ascending and descending edges
+        const double t1 = side * (0.5 + t);
+        const double t2 = side * z * 0.75;
+        const qint64 ascending = qint64(t1 - t2);
+        const qint64 descending = qint64(t1 + t2);
+        const qint64 ascendingFace = ascending >> order;
+        const qint64 descendingFace = descending >> order;
+        face = int(ascendingFace == descendingFace ? (ascendingFace | 4) : ascendingFace < descendingFace ? ascendingFace : descendingFace + 8);
+        x = descending & (side - 1);
+        y = side - (ascending & (side - 1)) - 1;
+    }
+    else
+    {
+        const int column = qMin(3, int(t));
+        const double offset = t - column;
+        const double distance = side * std::sqrt(3 * (1 - absZ));
+        const qint64 ascending = qMin(side - 1, qint64(offset * distance));
+        const qint64 descending = qMin(side - 1, qint64((1.0 - offset) * distance));
+        if (z >= 0)
+        {
+            face = column;
+            x = side - descending - 1;
+            y = side - ascending - 1;
+        }
+        else
+        {
+            face = column + 8;
+            x = ascending;
+            y = descending;
+        }
+    }
+    return (qint64(face) << (2 * order)) + spreadBits(x) + (spreadBits(y) << 1);
+}
+
+void SkyCoverage::positionOf(int order, qint64 pixel, double x, double y, double &ra, double &dec)
+{
+    const int face = int(pixel >> (2 * order));
+    const qint64 inFace = pixel & ((qint64(1) << (2 * order)) - 1);
+    const double side = double(qint64(1) << order);
+    // Within the base pixel, from 0 to 1
+    const double faceX = (compressBits(inFace) + x) / side;
+    const double faceY = (compressBits(inFace >> 1) + y) / side;
+
+    const double ring = baseRings[face] - faceX - faceY;
+    double z;
+    double ringPixels;
+    if (ring < 1)
+    {
+        ringPixels = ring;
+        z = 1 - ringPixels * ringPixels / 3.0;
+    }
+    else if (ring > 3)
+    {
+        ringPixels = 4 - ring;
+        z = ringPixels * ringPixels / 3.0 - 1;
+    }
+    else
+    {
+        ringPixels = 1;
+        z = (2 - ring) * 2.0 / 3.0;
+    }
+
+    double longitude = baseLongitudes[face] * ringPixels + faceX - faceY;
+    if (longitude < 0)
+        longitude += 8;
+    if (longitude >= 8)
+        longitude -= 8;
+    ra = ringPixels < 1e-15 ? 0 : 45.0 * longitude / ringPixels;
+    dec = qRadiansToDegrees(std::asin(qBound(-1.0, z, 1.0)));
+}
+
+SkyRegion SkyCoverage::regionOf(int order, qint64 pixel)
+{
+    SkyRegion region;
+    region.shape = SkyRegion::ConeShape;
+    positionOf(order, pixel, 0.5, 0.5, region.ra, region.dec);
+    for (int corner = 0; corner < 4; corner++)
+    {
+        double ra;
+        double dec;
+        positionOf(order, pixel, corner & 1, corner >> 1, ra, dec);
+        region.size = qMax(region.size, SkyCoordinates::distance(region.ra, region.dec, ra, dec));
+    }
+    region.size *= SKY_COVERAGE_REGION_MARGIN;
+    return region;
+}
@@ -0,0 +1,86 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SKYCOVERAGE_H
+#define SKYCOVERAGE_H
+
+#include "skycoordinates.h"
+
+#include <QHash>
+#include <QVector>
+
+/*!
+ * \brief The SkyCoverage class
+ * How many frames, and how much exposure by filter, the catalog has in each part of the
+ * sky, for the sky map. The sky is divided into the equal area pixels of HEALPix in the
+ * nested scheme, at every order up to maxOrder, and each frame is added to its pixel at
+ * every order. The map then reads the order that fits its zoom, and never the frames.
+ *
+ * In the nested scheme the pixel of order n - 1 holding a pixel of order n is that pixel
+ * shifted right by two bits, so a frame is located once, at maxOrder.
+ *
+ * Kept up to date with the rows by CatalogColumns. Pixels without frames are not kept.
+ */
+class SkyCoverage
+{
+public:
+    // Order 8 has pixels of about 0.23 degrees
+    static const int maxOrder = 8;
+
+    struct FilterTotal
+    {
+        int filterId; // Value id of the CatalogColumns
+        int count;
+        double exposure; // Seconds
+    };
+
+    struct Tile
+    {
+        int count = 0;
+        double exposure = 0;
+        QVector<FilterTotal> filters;
+    };
+
+    void clear();
+    // A NaN exposure counts the frame without exposure
+    void add(double ra, double dec, int filterId, double exposure);
+    void remove(double ra, double dec, int filterId, double exposure);
+    // By pixel. A copy shares the tiles until the coverage is changed.
+    const QHash<qint64, Tile>& tiles(int order) const { return orders[order]; }
+
+    static qint64 pixelCount(int order) { return 12LL << (2 * order); }
+    static qint64 pixelOf(int order, double ra, double dec);
+    // The position at x and y within the pixel, from 0 to 1 along its two edges from its
+    // southern corner. The center is at 0.5, 0.5.
+    static void positionOf(int order, qint64 pixel, double x, double y, double& ra, double& dec);
+    // A cone around the center of the pixel with all of it inside
+    static SkyRegion regionOf(int order, qint64 pixel);
+
+private:
+    QHash<qint64, Tile> orders[maxOrder + 1];
+
+    void change(double ra, double dec, int filterId, double exposure, int sign);
+};
+
+#endif // SKYCOVERAGE_H
@@ -0,0 +1,83 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "skymapdialog.h"
+
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+
+SkyMapDialog::SkyMapDialog(Catalog *catalog, QWidget *parent) : QDialog(parent)
+{
+    setWindowTitle(tr("Sky Map"));
+    resize(960, 560);
+
+    mapView = new SkyMapView(catalog);
+    measureCombo = new QComboBox;
+    measureCombo->addItem(tr("Frames"), SkyMapView::FrameCount);
+    measureCombo->addItem(tr("Exposure"), SkyMapView::Exposure);
+    filterCombo = new QComboBox;
+    filterCombo->addItem(tr("All filters"), -1);
+    filterCombo->setSizeAdjustPolicy(QComboBox::AdjustToContents);
+    tileLabel = new QLabel;
+    tileLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+
+    QHBoxLayout* controls = new QHBoxLayout;
+    controls->addWidget(measureCombo);
+    controls->addWidget(filterCombo);
+    controls->addStretch();
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addLayout(controls);
+    layout->addWidget(mapView, 1);
+    layout->addWidget(tileLabel);
+
+    connect(measureCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this]() {
+        mapView->setMeasure(SkyMapView::Measure(measureCombo->currentData().toInt()));
+    });
+    connect(filterCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this]() {
+        mapView->setFilterId(filterCombo->currentData().toInt());
+    });
+    connect(mapView, &SkyMapView::tilesChanged, this, &SkyMapDialog::updateFilters);
+    connect(mapView, &SkyMapView::tileHovered, tileLabel, &QLabel::setText);
+    connect(mapView, &SkyMapView::tileClicked, this, &SkyMapDialog::skyRegionSelected);
+}
+
+/*!
+ * \brief SkyMapDialog::updateFilters
+ * The filters of the frames on the sky, keeping the one chosen while it has frames.
+ */
+void SkyMapDialog::updateFilters()
+{
+    const int chosenId = filterCombo->currentData().toInt();
+    const QList<QPair<QString, int>> filters = mapView->filters();
+    filterCombo->blockSignals(true);
+    filterCombo->clear();
+    filterCombo->addItem(tr("All filters"), -1);
+    for (auto& filter : filters)
+        filterCombo->addItem(filter.first.isEmpty() ? tr("No filter") : filter.first, filter.second);
+    const int index = filterCombo->findData(chosenId);
+    filterCombo->setCurrentIndex(qMax(0, index));
+    filterCombo->blockSignals(false);
+    if (index < 0 && chosenId != -1)
+        mapView->setFilterId(-1);
+}
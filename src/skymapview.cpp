@@ -0,0 +1,417 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "skymapview.h"
+
+#include <QApplication>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QSet>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <cmath>
+
+// At most one read of the tiles per interval while files are added
+#define SKY_MAP_REFRESH_INTERVAL_MS 1000
+
+// The order is the finest whose tiles are at least this wide on the screen
+#define SKY_MAP_MIN_TILE_PIXELS 8
+
+// How wide the tiles of SkyCoverage::maxOrder are at the most zoomed in
+#define SKY_MAP_MAX_TILE_PIXELS 64
+
+// Points along each edge of a tile, so the large tiles follow the projection
+#define SKY_MAP_EDGE_POINTS 4
+
+// Per step of the mouse wheel
+#define SKY_MAP_ZOOM_FACTOR 1.25
+
+#define SKY_MAP_GRID_DEGREES 30
+
+// Square degrees of the whole sky
+static const double skyArea = 41252.96;
+
+static double tileDegrees(int order)
+{
+    return std::sqrt(skyArea / SkyCoverage::pixelCount(order));
+}
+
+// From -180 to 180
+static double wrapDegrees(double degrees)
+{
+    double wrapped = std::fmod(degrees + 180.0, 360.0);
+    if (wrapped < 0)
+        wrapped += 360.0;
+    return wrapped - 180.0;
+}
+
+SkyMapView::SkyMapView(Catalog *catalog, QWidget *parent) : QWidget(parent), catalog(catalog)
+{
+    setMouseTracking(true);
+    setMinimumSize(360, 180);
+
+    refreshTimer.setSingleShot(true);
+    refreshTimer.setInterval(SKY_MAP_REFRESH_INTERVAL_MS);
+    connect(&refreshTimer, &QTimer::timeout, this, &SkyMapView::refresh);
+    auto scheduleRefresh = [this]() {
+        if (isVisible() && !refreshTimer.isActive())
+            refreshTimer.start();
+    };
+    connect(catalog, &Catalog::AstroFilesAdded, this, scheduleRefresh);
+    connect(catalog, &Catalog::AstroFilesUpdated, this, scheduleRefresh);
+    connect(catalog, &Catalog::AstroFileRemoved, this, scheduleRefresh);
+}
+
+void SkyMapView::setMeasure(Measure measure)
+{
+    this->measure = measure;
+    updateMaxValue();
+    update();
+}
+
+void SkyMapView::setFilterId(int filterId)
+{
+    this->filterId = filterId;
+    updateMaxValue();
+    update();
+}
+
+void SkyMapView::refresh()
+{
+    order = fittingOrder();
+    readTiles();
+    update();
+    emit tilesChanged();
+}
+
+/*!
+ * \brief SkyMapView::readTiles
+ * The tiles are shared with the catalog until it changes them, so this does not copy
+ * them, and the catalog is only locked for as long as it takes to take a reference.
+ */
+void SkyMapView::readTiles()
+{
+    QHash<qint64, SkyCoverage::Tile> baseTiles;
+    catalog->readColumns([&](const CatalogColumns& columns) {
+        tiles = columns.skyCoverage().tiles(order);
+        baseTiles = columns.skyCoverage().tiles(0);
+        values = columns.valueList();
+    });
+
+    // The twelve tiles of order 0 have every filter
+    QSet<int> filterIds;
+    for (auto& tile : baseTiles)
+    {
+        for (auto& total : tile.filters)
+            filterIds.insert(total.filterId);
+    }
+    filterList.clear();
+    for (int id : filterIds)
+        filterList.append(qMakePair(values.value(id), id));
+    std::sort(filterList.begin(), filterList.end());
+    updateMaxValue();
+}
+
+void SkyMapView::updateMaxValue()
+{
+    maxValue = 0;
+    for (auto& tile : tiles)
+        maxValue = qMax(maxValue, valueOf(tile));
+}
+
+double SkyMapView::valueOf(const SkyCoverage::Tile &tile) const
+{
+    if (filterId < 0)
+        return measure == FrameCount ? tile.count : tile.exposure;
+    for (auto& total : tile.filters)
+    {
+        if (total.filterId == filterId)
+            return measure == FrameCount ? total.count : total.exposure;
+    }
+    return 0;
+}
+
+double SkyMapView::minDegreesPerPixel() const
+{
+    return tileDegrees(SkyCoverage::maxOrder) / SKY_MAP_MAX_TILE_PIXELS;
+}
+
+double SkyMapView::maxDegreesPerPixel() const
+{
+    return 360.0 / qMax(1, width());
+}
+
+int SkyMapView::fittingOrder() const
+{
+    for (int order = SkyCoverage::maxOrder; order > 0; order--)
+    {
+        if (tileDegrees(order) / degreesPerPixel >= SKY_MAP_MIN_TILE_PIXELS)
+            return order;
+    }
+    return 0;
+}
+
+QPointF SkyMapView::toScreen(double ra, double dec) const
+{
+    return QPointF(width() / 2.0 - wrapDegrees(ra - centerRa) / degreesPerPixel, height() / 2.0 - (dec - centerDec) / degreesPerPixel);
+}
+
+bool SkyMapView::toSky(const QPointF &position, double &ra, double &dec) const
+{
+    const double offset = (width() / 2.0 - position.x()) * degreesPerPixel;
+    dec = centerDec - (position.y() - height() / 2.0) * degreesPerPixel;
+    if (std::abs(offset) > 180 || std::abs(dec) > 90)
+        return false;
+    ra = wrapDegrees(centerRa + offset - 180.0) + 180.0;
+    return true;
+}
+
+/*!
+ * \brief SkyMapView::tilePolygon
+ * The outline of the pixel, with the right ascensions of its points taken around the
+ * one of its center, so a tile across 0h is not torn in two. A corner on a pole is a
+ * line along it in this projection.
+ */
+QPolygonF SkyMapView::tilePolygon(int order, qint64 pixel) const
+{
+    double tileRa;
+    double tileDec;
+    SkyCoverage::positionOf(order, pixel, 0.5, 0.5, tileRa, tileDec);
+
+    QVector<QPointF> points; // Right ascension and declination
+    for (int edge = 0; edge < 4; edge++)
+    {
+        for (int point = 0; point < SKY_MAP_EDGE_POINTS; point++)
+        {
+            const double along = double(point) / SKY_MAP_EDGE_POINTS;
+            const double x[4] = {along, 1, 1 - along, 0};
+            const double y[4] = {0, along, 1, 1 - along};
+            double ra;
+            double dec;
+            SkyCoverage::positionOf(order, pixel, x[edge], y[edge], ra, dec);
+            points.append(QPointF(tileRa + wrapDegrees(ra - tileRa), dec));
+        }
+    }
+
+    QPolygonF polygon;
+    const QPointF center = toScreen(tileRa, tileDec);
+    for (int index = 0; index < points.count(); index++)
+    {
+        const QPointF& point = points.at(index);
+        if (std::abs(point.y()) < 90 - 1e-9)
+        {
+            polygon.append(QPointF(center.x() - (point.x() - tileRa) / degreesPerPixel, toScreen(point.x(), point.y()).y()));
+            continue;
+        }
+        const QPointF& previous = points.at((index + points.count() - 1) % points.count());
+        const QPointF& next = points.at((index + 1) % points.count());
+        const double y = toScreen(0, point.y()).y();
+        polygon.append(QPointF(center.x() - (previous.x() - tileRa) / degreesPerPixel, y));
+        polygon.append(QPointF(center.x() - (next.x() - tileRa) / degreesPerPixel, y));
+    }
+    return polygon;
+}
+
+/*!
+ * \brief SkyMapView::paintEvent
+ * Only the tiles on the screen are drawn. When the order has more tiles than there are
+ * tiles on the screen, they are found by locating the points of a grid over the screen
+ * instead of going through all of them.
+ */
+void SkyMapView::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::black);
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    const double skyLeft = width() / 2.0 - 180.0 / degreesPerPixel;
+    const double skyRight = width() / 2.0 + 180.0 / degreesPerPixel;
+    painter.setPen(QColor(64, 64, 64));
+    for (int ra = 0; ra < 360; ra += SKY_MAP_GRID_DEGREES)
+        painter.drawLine(QLineF(toScreen(ra, 90), toScreen(ra, -90)));
+    for (int dec = -90; dec <= 90; dec += SKY_MAP_GRID_DEGREES)
+    {
+        const double y = toScreen(0, dec).y();
+        painter.drawLine(QLineF(skyLeft, y, skyRight, y));
+    }
+
+    const double tilePixels = tileDegrees(order) / degreesPerPixel;
+    const double step = qMax(1.0, tilePixels / 2);
+    const qint64 samples = qint64(width() / step + 1) * qint64(height() / step + 1);
+    QList<qint64> visible;
+    if (samples < tiles.count())
+    {
+        QSet<qint64> found;
+        for (double y = 0; y <= height(); y += step)
+        {
+            for (double x = 0; x <= width(); x += step)
+            {
+                double ra;
+                double dec;
+                if (!toSky(QPointF(x, y), ra, dec))
+                    continue;
+                const qint64 pixel = SkyCoverage::pixelOf(order, ra, dec);
+                if (tiles.contains(pixel))
+                    found.insert(pixel);
+            }
+        }
+        visible = found.values();
+    }
+    else
+    {
+        visible = tiles.keys();
+    }
+
+    const double logMax = std::log1p(maxValue);
+    for (qint64 pixel : visible)
+    {
+        const double value = valueOf(tiles.value(pixel));
+        if (value <= 0)
+            continue;
+        const double level = logMax > 0 ? std::log1p(value) / logMax : 1;
+        const QColor color = QColor::fromHsvF(0.66 * (1 - level), 0.9, 0.4 + 0.6 * level);
+        painter.setBrush(color);
+        painter.setPen(tilePixels >= 2 * SKY_MAP_MIN_TILE_PIXELS ? QPen(color.darker(150)) : QPen(Qt::NoPen));
+        // A tile across the edge of the sky is drawn on both sides
+        const QPolygonF polygon = tilePolygon(order, pixel);
+        const QRectF bounds = polygon.boundingRect();
+        painter.drawPolygon(polygon);
+        if (bounds.left() < skyLeft)
+            painter.drawPolygon(polygon.translated(360.0 / degreesPerPixel, 0));
+        if (bounds.right() > skyRight)
+            painter.drawPolygon(polygon.translated(-360.0 / degreesPerPixel, 0));
+    }
+
+    if (selectedPixel >= 0)
+    {
+        painter.setBrush(Qt::NoBrush);
+        painter.setPen(QPen(Qt::white, 2));
+        painter.drawPolygon(tilePolygon(selectedOrder, selectedPixel));
+    }
+}
+
+void SkyMapView::wheelEvent(QWheelEvent *event)
+{
+    double ra;
+    double dec;
+    const QPointF position = event->position();
+    const bool isOnSky = toSky(position, ra, dec);
+    const double steps = event->angleDelta().y() / 120.0;
+    degreesPerPixel = qBound(minDegreesPerPixel(), degreesPerPixel * std::pow(SKY_MAP_ZOOM_FACTOR, -steps), qMax(minDegreesPerPixel(), maxDegreesPerPixel()));
+    if (isOnSky)
+    {
+        // The position under the cursor stays there
+        centerRa = wrapDegrees(ra - (width() / 2.0 - position.x()) * degreesPerPixel - 180.0) + 180.0;
+        centerDec = qBound(-90.0, dec + (position.y() - height() / 2.0) * degreesPerPixel, 90.0);
+    }
+    if (fittingOrder() != order)
+        refresh();
+    else
+        update();
+    event->accept();
+}
+
+void SkyMapView::mousePressEvent(QMouseEvent *event)
+{
+    pressPosition = event->pos();
+    lastPosition = event->pos();
+    isDragging = false;
+}
+
+void SkyMapView::mouseMoveEvent(QMouseEvent *event)
+{
+    if (event->buttons() & Qt::LeftButton)
+    {
+        if ((event->pos() - pressPosition).manhattanLength() >= QApplication::startDragDistance())
+            isDragging = true;
+        if (isDragging)
+        {
+            const QPoint moved = event->pos() - lastPosition;
+            centerRa = wrapDegrees(centerRa + moved.x() * degreesPerPixel - 180.0) + 180.0;
+            centerDec = qBound(-90.0, centerDec + moved.y() * degreesPerPixel, 90.0);
+            lastPosition = event->pos();
+            update();
+        }
+        return;
+    }
+
+    double ra;
+    double dec;
+    auto tile = tiles.constEnd();
+    if (toSky(event->position(), ra, dec))
+        tile = tiles.constFind(SkyCoverage::pixelOf(order, ra, dec));
+    emit tileHovered(tile != tiles.constEnd() ? describe(tile.value()) : QString());
+}
+
+void SkyMapView::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (isDragging || event->button() != Qt::LeftButton)
+        return;
+
+    double ra;
+    double dec;
+    if (!toSky(event->position(), ra, dec))
+        return;
+    const qint64 pixel = SkyCoverage::pixelOf(order, ra, dec);
+    if (!tiles.contains(pixel))
+        return;
+    selectedPixel = pixel;
+    selectedOrder = order;
+    update();
+    emit tileClicked(SkyCoverage::regionOf(order, pixel));
+}
+
+void SkyMapView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    degreesPerPixel = qBound(minDegreesPerPixel(), degreesPerPixel, qMax(minDegreesPerPixel(), maxDegreesPerPixel()));
+    if (fittingOrder() != order)
+        refresh();
+}
+
+void SkyMapView::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+    refresh();
+}
+
+QString SkyMapView::describe(const SkyCoverage::Tile &tile) const
+{
+    auto totals = [this](int count, double exposure) {
+        return tr("%n frame(s), %1 h", "", count).arg(exposure / 3600, 0, 'f', 1);
+    };
+    QStringList parts = {totals(tile.count, tile.exposure)};
+    QList<SkyCoverage::FilterTotal> filters(tile.filters.constBegin(), tile.filters.constEnd());
+    std::sort(filters.begin(), filters.end(), [this](const SkyCoverage::FilterTotal& a, const SkyCoverage::FilterTotal& b) {
+        return values.value(a.filterId) < values.value(b.filterId);
+    });
+    for (auto& total : filters)
+    {
+        const QString name = values.value(total.filterId);
+        parts.append(QString("%1: %2").arg(name.isEmpty() ? tr("No filter") : name, totals(total.count, total.exposure)));
+    }
+    return parts.join("; ");
+}
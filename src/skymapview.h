@@ -0,0 +1,117 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SKYMAPVIEW_H
+#define SKYMAPVIEW_H
+
+#include "catalog.h"
+#include "skycoverage.h"
+
+#include <QHash>
+#include <QPoint>
+#include <QPolygonF>
+#include <QStringList>
+#include <QTimer>
+#include <QWidget>
+
+/*!
+ * \brief The SkyMapView class
+ * The sky coverage of the catalog, as an equirectangular map with east to the left.
+ * Each tile is a pixel of the SkyCoverage at the order that fits the zoom, colored by
+ * the number of frames or the exposure in it, of every filter or of one of them.
+ *
+ * Zooming and panning only read the tiles of one order, and only the visible ones are
+ * drawn. Clicking a tile selects the cone around it.
+ */
+class SkyMapView : public QWidget
+{
+    Q_OBJECT
+public:
+    enum Measure
+    {
+        FrameCount,
+        Exposure
+    };
+
+    explicit SkyMapView(Catalog* catalog, QWidget *parent = nullptr);
+
+    // The value id of each filter with a frame on the sky, see CatalogColumns
+    QList<QPair<QString, int>> filters() const { return filterList; }
+
+public slots:
+    void setMeasure(Measure measure);
+    // -1 for every filter
+    void setFilterId(int filterId);
+    // Reads the tiles of the catalog again
+    void refresh();
+
+signals:
+    void tileClicked(const SkyRegion& region);
+    // Empty when the cursor is on no tile
+    void tileHovered(const QString& description);
+    // After refresh, the filters may have changed
+    void tilesChanged();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void showEvent(QShowEvent *event) override;
+
+private:
+    Catalog* catalog;
+    QTimer refreshTimer;
+    int order = 0;
+    QHash<qint64, SkyCoverage::Tile> tiles; // Of order
+    QStringList values; // Of the CatalogColumns, for the names of the filters
+    QList<QPair<QString, int>> filterList;
+    double maxValue = 0; // Of the tiles, for the colors
+    Measure measure = FrameCount;
+    int filterId = -1;
+    qint64 selectedPixel = -1; // Of selectedOrder
+    int selectedOrder = 0;
+
+    double centerRa = 180;
+    double centerDec = 0;
+    double degreesPerPixel = 360; // Until the first resize fits the sky in the width
+    QPoint pressPosition;
+    QPoint lastPosition;
+    bool isDragging = false;
+
+    double minDegreesPerPixel() const;
+    double maxDegreesPerPixel() const;
+    int fittingOrder() const;
+    void readTiles();
+    void updateMaxValue();
+    double valueOf(const SkyCoverage::Tile& tile) const;
+    QPointF toScreen(double ra, double dec) const;
+    bool toSky(const QPointF& position, double& ra, double& dec) const;
+    QPolygonF tilePolygon(int order, qint64 pixel) const;
+    QString describe(const SkyCoverage::Tile& tile) const;
+};
+
+#endif // SKYMAPVIEW_H
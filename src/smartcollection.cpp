@@ -0,0 +1,306 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "smartcollection.h"
+#include "calibrationindex.h"
+
+#include <QObject>
+
+#include <limits>
+
+// The temperature or exposure accepted either way of a single value, in degrees or seconds
+#define SMART_COLLECTION_TOLERANCE 0.5
+
+// Terms split at the spaces outside of double quotes, the quotes removed
+static QStringList splitTerms(const QString& expression, QString& error)
+{
+    QStringList terms;
+    QString term;
+    bool quoted = false;
+    for (const QChar c : expression)
+    {
+        if (c == '"')
+            quoted = !quoted;
+        else if (c.isSpace() && !quoted)
+        {
+            if (!term.isEmpty())
+                terms.append(term);
+            term.clear();
+        }
+        else
+            term.append(c);
+    }
+    if (quoted)
+        error = QObject::tr("A quote is not closed");
+    if (!term.isEmpty())
+        terms.append(term);
+    return terms;
+}
+
+// a..b, either end empty for an open end, or a single value
+static bool parseRange(const QString& value, double tolerance, QPair<double, double>& range)
+{
+    bool minOk = true;
+    bool maxOk = true;
+    const int dots = value.indexOf("..");
+    if (dots == -1)
+    {
+        const double single = value.toDouble(&minOk);
+        range = qMakePair(single - tolerance, single + tolerance);
+        return minOk;
+    }
+    const QString min = value.left(dots);
+    const QString max = value.mid(dots + 2);
+    range.first = min.isEmpty() ? -std::numeric_limits<double>::infinity() : min.toDouble(&minOk);
+    range.second = max.isEmpty() ? std::numeric_limits<double>::infinity() : max.toDouble(&maxOk);
+    return minOk && maxOk;
+}
+
+static bool parseDateRange(const QString& value, QDate& minDate, QDate& maxDate)
+{
+    const int dots = value.indexOf("..");
+    const QString min = dots == -1 ? value : value.left(dots);
+    const QString max = dots == -1 ? value : value.mid(dots + 2);
+    minDate = QDate::fromString(min, Qt::ISODate);
+    maxDate = QDate::fromString(max, Qt::ISODate);
+    return (min.isEmpty() || minDate.isValid()) && (max.isEmpty() || maxDate.isValid());
+}
+
+bool SmartCollection::compile(const QString &name, const QString &expression, SmartCollection &collection, QString &error)
+{
+    collection = SmartCollection();
+    collection.collectionName = name;
+    collection.collectionExpression = expression;
+
+    const QStringList terms = splitTerms(expression, error);
+    if (!error.isEmpty())
+        return false;
+    if (terms.isEmpty())
+    {
+        error = QObject::tr("The expression has no terms");
+        return false;
+    }
+
+    static const QHash<QString, Term> facetTerms = {
+        {"object", ObjectTerm},
+        {"instrument", InstrumentTerm},
+        {"filter", FilterTerm},
+        {"ext", ExtensionTerm},
+        {"type", FrameTypeTerm},
+    };
+    for (auto& term : terms)
+    {
+        const int colon = term.indexOf(':');
+        const QString key = term.left(colon).toLower();
+        const QString value = colon == -1 ? QString() : term.mid(colon + 1);
+        if (value.isEmpty())
+        {
+            error = QObject::tr("%1 has no value").arg(term);
+            return false;
+        }
+
+        bool ok = true;
+        if (facetTerms.contains(key))
+        {
+            for (auto& part : value.split(',', Qt::SkipEmptyParts))
+                collection.acceptedValues[facetTerms.value(key)].insert(part.toCaseFolded());
+        }
+        else if (key == "folder")
+        {
+            for (auto& part : value.split(',', Qt::SkipEmptyParts))
+                collection.folders.append(part.endsWith('/') ? part : part + '/');
+        }
+        else if (key == "date")
+            ok = parseDateRange(value, collection.minDate, collection.maxDate);
+        else if (key == "days")
+            collection.lastDays = value.toInt(&ok);
+        else if (key == "temp")
+            ok = collection.hasTemperature = parseRange(value, SMART_COLLECTION_TOLERANCE, collection.temperatureRange);
+        else if (key == "exposure")
+            ok = collection.hasExposure = parseRange(value, SMART_COLLECTION_TOLERANCE, collection.exposureRange);
+        else
+        {
+            error = QObject::tr("Unknown term %1").arg(key);
+            return false;
+        }
+
+        if (!ok || (key == "days" && collection.lastDays < 1))
+        {
+            error = QObject::tr("Cannot read the value of %1").arg(term);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SmartCollection::valueAcceptedBy(Term term, const QString &value) const
+{
+    if (acceptedValues[term].isEmpty())
+        return true;
+    auto cached = valueAccepted[term].constFind(value);
+    if (cached != valueAccepted[term].constEnd())
+        return cached.value();
+    const bool accepted = acceptedValues[term].contains(value.toCaseFolded());
+    valueAccepted[term].insert(value, accepted);
+    return accepted;
+}
+
+bool SmartCollection::accepts(const AstroFile &astroFile, const QDate &today) const
+{
+    if (!valueAcceptedBy(ObjectTerm, astroFile.Object)
+        || !valueAcceptedBy(InstrumentTerm, astroFile.Instrument)
+        || !valueAcceptedBy(FilterTerm, astroFile.Filter)
+        || !valueAcceptedBy(ExtensionTerm, astroFile.FileExtension))
+        return false;
+    if (!acceptedValues[FrameTypeTerm].isEmpty()
+        && !valueAcceptedBy(FrameTypeTerm, CalibrationIndex::frameTypeName(CalibrationIndex::frameType(astroFile))))
+        return false;
+
+    if (!folders.isEmpty())
+    {
+        const QString folder = astroFile.DirectoryPath.endsWith('/') ? astroFile.DirectoryPath : astroFile.DirectoryPath + '/';
+        bool inFolder = false;
+        for (auto& accepted : folders)
+            inFolder = inFolder || folder.startsWith(accepted);
+        if (!inFolder)
+            return false;
+    }
+
+    // Files without a DATE-OBS are in no range of dates
+    const QDate& date = astroFile.ObservationDate;
+    if ((minDate.isValid() || maxDate.isValid() || lastDays > 0) && !date.isValid())
+        return false;
+    if ((minDate.isValid() && date < minDate) || (maxDate.isValid() && date > maxDate))
+        return false;
+    if (lastDays > 0 && (date <= today.addDays(-lastDays) || date > today))
+        return false;
+
+    if (hasTemperature)
+    {
+        bool ok = false;
+        const double temperature = astroFile.Tags.value(TagCcdTemp).toDouble(&ok);
+        if (!ok || temperature < temperatureRange.first || temperature > temperatureRange.second)
+            return false;
+    }
+    if (hasExposure && (astroFile.ExposureTime <= 0 || astroFile.ExposureTime < exposureRange.first || astroFile.ExposureTime > exposureRange.second))
+        return false;
+    return true;
+}
+
+void SmartCollectionIndex::clear()
+{
+    entries.clear();
+}
+
+void SmartCollectionIndex::evaluate(Entry &entry, const QList<AstroFile *> &files)
+{
+    const QDate today = QDate::currentDate();
+    entry.members.clear();
+    for (const AstroFile* astroFile : files)
+    {
+        if (entry.collection.accepts(*astroFile, today))
+            entry.members.insert(astroFile->Id);
+    }
+    entry.evaluatedOn = today;
+}
+
+void SmartCollectionIndex::setCollection(const SmartCollection &collection, const QList<AstroFile *> &files)
+{
+    Entry entry;
+    entry.collection = collection;
+    evaluate(entry, files);
+    for (auto& existing : entries)
+    {
+        if (existing.collection.name() == collection.name())
+        {
+            existing = std::move(entry);
+            return;
+        }
+    }
+    entries.append(std::move(entry));
+}
+
+void SmartCollectionIndex::removeCollection(const QString &name)
+{
+    entries.removeIf([&name](const Entry& entry) { return entry.collection.name() == name; });
+}
+
+void SmartCollectionIndex::insert(const AstroFile &astroFile)
+{
+    if (entries.isEmpty())
+        return;
+    const QDate today = QDate::currentDate();
+    for (auto& entry : entries)
+    {
+        if (entry.collection.accepts(astroFile, today))
+            entry.members.insert(astroFile.Id);
+        else
+            entry.members.remove(astroFile.Id);
+    }
+}
+
+void SmartCollectionIndex::remove(int id)
+{
+    for (auto& entry : entries)
+        entry.members.remove(id);
+}
+
+bool SmartCollectionIndex::isStale() const
+{
+    const QDate today = QDate::currentDate();
+    for (auto& entry : entries)
+    {
+        if (entry.collection.isRelative() && entry.evaluatedOn != today)
+            return true;
+    }
+    return false;
+}
+
+void SmartCollectionIndex::refresh(const QList<AstroFile *> &files)
+{
+    const QDate today = QDate::currentDate();
+    for (auto& entry : entries)
+    {
+        if (entry.collection.isRelative() && entry.evaluatedOn != today)
+            evaluate(entry, files);
+    }
+}
+
+QVector<int> SmartCollectionIndex::members(const QString &name) const
+{
+    for (auto& entry : entries)
+    {
+        if (entry.collection.name() == name)
+            return QVector<int>(entry.members.constBegin(), entry.members.constEnd());
+    }
+    return QVector<int>();
+}
+
+QList<QPair<QString, int>> SmartCollectionIndex::counts() const
+{
+    QList<QPair<QString, int>> counts;
+    for (auto& entry : entries)
+        counts.append(qMakePair(entry.collection.name(), int(entry.members.count())));
+    return counts;
+}
@@ -0,0 +1,131 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SMARTCOLLECTION_H
+#define SMARTCOLLECTION_H
+
+#include "astrofile.h"
+
+#include <QDate>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/*!
+ * \brief The SmartCollection class
+ * A saved, named filter expression, compiled once. The expression is terms separated
+ * by spaces, which a file must all pass, each a key and its values:
+ *
+ *   object:M31,M33 instrument:"ZWO ASI2600MM Pro" filter:Ha type:Light ext:fits
+ *   folder:/archive/2024 date:2024-01-01..2024-03-31 days:30 temp:-10 exposure:300
+ *
+ * The values of one term are alternatives. Names are compared without case, a folder
+ * includes its subfolders, and a range of numbers or dates is written a..b with either
+ * end left open. temp and exposure without a range accept SMART_COLLECTION_TOLERANCE
+ * either way. days is the last number of days, today included.
+ *
+ * Facet values are tested once each, the result kept for the next file with the value.
+ */
+class SmartCollection
+{
+public:
+    // false with the reason in error when the expression cannot be parsed
+    static bool compile(const QString& name, const QString& expression, SmartCollection& collection, QString& error);
+
+    const QString& name() const { return collectionName; }
+    const QString& expression() const { return collectionExpression; }
+    // The members change with the date, see days
+    bool isRelative() const { return lastDays > 0; }
+    // today is the last day of days
+    bool accepts(const AstroFile& astroFile, const QDate& today) const;
+
+private:
+    enum Term
+    {
+        ObjectTerm,
+        InstrumentTerm,
+        FilterTerm,
+        ExtensionTerm,
+        FrameTypeTerm,
+        TermCount
+    };
+
+    QString collectionName;
+    QString collectionExpression;
+    QSet<QString> acceptedValues[TermCount]; // Case folded, empty for any value
+    mutable QHash<QString, bool> valueAccepted[TermCount];
+    QStringList folders; // Ending with a slash
+    QDate minDate;
+    QDate maxDate;
+    int lastDays = 0;
+    bool hasTemperature = false;
+    QPair<double, double> temperatureRange;
+    bool hasExposure = false;
+    QPair<double, double> exposureRange;
+
+    bool valueAcceptedBy(Term term, const QString& value) const;
+};
+
+/*!
+ * \brief The SmartCollectionIndex class
+ * The members of each SmartCollection, kept up to date as the rows of the catalog are
+ * added, changed and removed, so a collection is opened and counted without a scan of
+ * every file. Collections that count back days from today are evaluated again once
+ * the date changed, see refresh.
+ */
+class SmartCollectionIndex
+{
+public:
+    void clear();
+    // Replaces the collection of the same name, its members found among the files
+    void setCollection(const SmartCollection& collection, const QList<AstroFile*>& files);
+    void removeCollection(const QString& name);
+    // A file added or changed
+    void insert(const AstroFile& astroFile);
+    void remove(int id);
+    // Whether a collection has to be evaluated again for today
+    bool isStale() const;
+    void refresh(const QList<AstroFile*>& files);
+
+    QVector<int> members(const QString& name) const;
+    // The name and the number of members of each collection, in the order they were set
+    QList<QPair<QString, int>> counts() const;
+
+private:
+    struct Entry
+    {
+        SmartCollection collection;
+        QSet<int> members;
+        QDate evaluatedOn;
+    };
+    QList<Entry> entries;
+
+    static void evaluate(Entry& entry, const QList<AstroFile*>& files);
+};
+
+#endif // SMARTCOLLECTION_H
@@ -23,40 +23,596 @@
 */
 
 #include "sortfilterproxymodel.h"
+#include "calibrationindex.h"
 #include "fileviewmodel.h"
+#include "integrityverifier.h"
+#include "metrics.h"
+#include "skycoordinates.h"
 
 #include <QDate>
+#include <QHash>
+#include <QPromise>
+#include <QtConcurrent>
+
+#include <cmath>
+#include <limits>
+
+// Filter states whose accepted rows are kept, about 128 KB each for a million files
+#define FILTER_RESULT_CACHE_SIZE 16
 
 SortFilterProxyModel::SortFilterProxyModel(QObject *parent) : QSortFilterProxyModel(parent)
 {
-    isDuplicatedFilterActive = false;
+    isIdFilterActive = false;
+    connect(&projectionWatcher, &QFutureWatcher<FacetProjections>::finished, this, &SortFilterProxyModel::projectionFinished);
+}
+
+/*!
+ * \brief SortFilterProxyModel::setSourceModel
+ * The FacetIndex follows the source before QSortFilterProxyModel handles its signals,
+ * so the rows it filters again are already up to date.
+ */
+void SortFilterProxyModel::setSourceModel(QAbstractItemModel *newSourceModel)
+{
+    for (auto& connection : sourceConnections)
+        disconnect(connection);
+    sourceConnections.clear();
+
+    if (newSourceModel != nullptr)
+    {
+        sourceConnections
+            << connect(newSourceModel, &QAbstractItemModel::rowsInserted,  this, &SortFilterProxyModel::sourceRowsInserted)
+            << connect(newSourceModel, &QAbstractItemModel::rowsRemoved,   this, &SortFilterProxyModel::invalidateFacetIndex)
+            << connect(newSourceModel, &QAbstractItemModel::rowsMoved,     this, &SortFilterProxyModel::invalidateFacetIndex)
+            << connect(newSourceModel, &QAbstractItemModel::modelReset,    this, &SortFilterProxyModel::invalidateFacetIndex)
+            << connect(newSourceModel, &QAbstractItemModel::dataChanged,   this, &SortFilterProxyModel::sourceDataChanged);
+    }
+    invalidateFacetIndex();
+    QSortFilterProxyModel::setSourceModel(newSourceModel);
+}
+
+void SortFilterProxyModel::multiData(const QModelIndex &index, QModelRoleDataSpan roleDataSpan) const
+{
+    sourceModel()->multiData(mapToSource(index), roleDataSpan);
+}
+
+const AstroFile* SortFilterProxyModel::astroFileAt(int source_row) const
+{
+    QModelIndex index = sourceModel()->index(source_row, 0);
+    return catalog != nullptr ? catalog->astroFileOfHandle(index.internalId()) : nullptr;
 }
 
 bool SortFilterProxyModel::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
 {
-    QModelIndex index = sourceModel()->index(source_row, 0, source_parent);
-    const AstroFile* astroFile = static_cast<AstroFile*>(index.internalPointer());
-    Q_ASSERT(astroFile != NULL);
+    Q_UNUSED(source_parent);
+    static std::atomic<qint64>& filterCalls = Metrics::counter("proxy.filter_accepts_row_calls");
+    filterCalls.fetch_add(1, std::memory_order_relaxed);
 
-    QString dateString = astroFile->Tags["DATE-OBS"];
-    QDate d = QDate::fromString(dateString, Qt::ISODate);
+    const AstroFile* astroFile = astroFileAt(source_row);
+    // Removed since the source counted its rows
+    if (astroFile == nullptr)
+        return false;
 
-    bool shouldAccept = dateInRange(d) && objectAccepted(astroFile->Tags["OBJECT"]) && instrumentAccepted(astroFile->Tags["INSTRUME"]) && filterAccepted(astroFile->Tags["FILTER"]) && extensionAccepted(astroFile->FileExtension) && folderAccepted(astroFile->DirectoryPath);
+    bool shouldAccept = source_row < acceptedRowCount ? acceptedRows.testBit(source_row) : rowAccepted(astroFile);
 
-    if (isDuplicatedFilterActive)
-        shouldAccept = shouldAccept && isDuplicateOf(astroFile->FileHash);
+    if (isIdFilterActive)
+        shouldAccept = shouldAccept && filterIds.contains(astroFile->Id);
     return shouldAccept;
 }
 
-bool SortFilterProxyModel::lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const
+bool SortFilterProxyModel::rowAccepted(const AstroFile *astroFile) const
+{
+    if (isSearchActive && !searchIds.contains(astroFile->Id))
+        return false;
+    if (skyRegion.isActive())
+    {
+        double ra;
+        double dec;
+        if (!SkyCoordinates::parseRa(astroFile->Tags.value(TagObjectRa), ra) || !SkyCoordinates::parseDec(astroFile->Tags.value(TagObjectDec), dec) || !skyRegion.contains(ra, dec))
+            return false;
+    }
+    if (isQualityLimited())
+    {
+        const FrameQuality& quality = astroFile->Quality;
+        if (!quality.isMeasured() || !qualityAccepted(quality.starCount, quality.fwhm))
+            return false;
+    }
+    return dateInRange(astroFile->ObservationNight) && objectAccepted(astroFile->Object) && instrumentAccepted(astroFile->Instrument) && filterAccepted(astroFile->Filter) && extensionAccepted(astroFile->FileExtension) && folderAccepted(astroFile->DirectoryPath)
+        && frameTypeAccepted(CalibrationIndex::frameTypeName(CalibrationIndex::frameType(*astroFile)))
+        && integrityAccepted(IntegrityVerifier::integrityName(astroFile->Integrity));
+}
+
+/*!
+ * \brief SortFilterProxyModel::applyFilters
+ * Evaluates the filters on the FacetIndex, building it first if the source rows were
+ * removed since, and filters the proxy again in one pass. The accepted rows of a filter
+ * state evaluated since the rows last changed are taken from filterResults instead.
+ */
+void SortFilterProxyModel::applyFilters()
+{
+    static std::atomic<qint64>& cacheHits = Metrics::counter("proxy.filter_result_cache_hits");
+    static std::atomic<qint64>& cacheMisses = Metrics::counter("proxy.filter_result_cache_misses");
+    for (auto& accepted : valueAccepted)
+        accepted.clear();
+
+    if (sourceModel() != nullptr && catalog != nullptr)
+    {
+        // The catalog may have rows the source model was not told about yet
+        const int rowCount = sourceModel()->rowCount();
+        const FilterState state = filterState();
+        int cached = -1;
+        QBitArray searchRows;
+        QBitArray qualityRows;
+        catalog->readColumns([&](const CatalogColumns& columns) {
+            const int indexedRows = qMin(rowCount, columns.count());
+            if (!facetIndexValid || facetIndex.rowCount() != indexedRows)
+            {
+                facetIndex.clear();
+                for (int row = 0; row < indexedRows; row++)
+                    facetIndex.appendRow(columns.row(row));
+                facetIndexValid = true;
+                filterResults.clear();
+            }
+
+            for (int i = 0; i < filterResults.count() && cached == -1; i++)
+            {
+                if (filterResults.at(i).state == state && filterResults.at(i).rowCount == facetIndex.rowCount())
+                    cached = i;
+            }
+            if (cached != -1)
+                return;
+
+            // The ids found by the search, as a bitmap of the rows
+            if (isSearchActive)
+            {
+                searchRows.resize(facetIndex.rowCount());
+                for (int row = 0; row < searchRows.size(); row++)
+                {
+                    if (searchIds.contains(columns.row(row).id()))
+                        searchRows.setBit(row);
+                }
+            }
+
+            if (isQualityLimited())
+            {
+                qualityRows.resize(facetIndex.rowCount());
+                for (int row = 0; row < qualityRows.size(); row++)
+                {
+                    const CatalogColumns::RowView rowView = columns.row(row);
+                    qualityRows.setBit(row, qualityAccepted(rowView.starCount(), rowView.fwhm()));
+                }
+            }
+        });
+
+        if (cached != -1)
+        {
+            cacheHits.fetch_add(1, std::memory_order_relaxed);
+            filterResults.move(cached, 0);
+            const FilterResult& result = filterResults.first();
+            acceptedRows = result.rows;
+            acceptedRowCount = result.rowCount;
+
+            // A projection still running is for another state
+            projectionWatcher.cancel();
+            projectionGeneration++;
+            emit facetProjectionsChanged(result.projections);
+        }
+        else
+        {
+            cacheMisses.fetch_add(1, std::memory_order_relaxed);
+            QBitArray baseRows = facetIndex.rowsInDateRange(minDate, maxDate);
+            if (skyRegion.isActive())
+                baseRows &= facetIndex.rowsInRegion(skyRegion);
+            if (isSearchActive)
+                baseRows &= searchRows;
+            if (isQualityLimited())
+                baseRows &= qualityRows;
+
+            // Null for the facets that are not filtered
+            QVector<QBitArray> facetRows(CatalogColumns::FacetCount);
+            if (!acceptedObjects.isEmpty())
+                facetRows[CatalogColumns::ObjectFacet] = facetIndex.rowsWhere(CatalogColumns::ObjectFacet, [this](const QString& value) { return objectAccepted(value); });
+            if (!acceptedInstruments.isEmpty())
+                facetRows[CatalogColumns::InstrumentFacet] = facetIndex.rowsWhere(CatalogColumns::InstrumentFacet, [this](const QString& value) { return instrumentAccepted(value); });
+            if (!acceptedFilters.isEmpty())
+                facetRows[CatalogColumns::FilterFacet] = facetIndex.rowsWhere(CatalogColumns::FilterFacet, [this](const QString& value) { return filterAccepted(value); });
+            if (!acceptedExtensions.isEmpty())
+                facetRows[CatalogColumns::ExtensionFacet] = facetIndex.rowsWhere(CatalogColumns::ExtensionFacet, [this](const QString& value) { return extensionAccepted(value); });
+            if (!acceptedFolders.isEmpty())
+                facetRows[CatalogColumns::FolderFacet] = facetIndex.rowsWhere(CatalogColumns::FolderFacet, [this](const QString& value) { return folderAccepted(value); });
+            if (!acceptedFrameTypes.isEmpty())
+                facetRows[CatalogColumns::FrameTypeFacet] = facetIndex.rowsWhere(CatalogColumns::FrameTypeFacet, [this](const QString& value) { return frameTypeAccepted(value); });
+            if (!acceptedIntegrity.isEmpty())
+                facetRows[CatalogColumns::IntegrityFacet] = facetIndex.rowsWhere(CatalogColumns::IntegrityFacet, [this](const QString& value) { return integrityAccepted(value); });
+
+            QBitArray rows = baseRows;
+            for (const QBitArray& bitmap : facetRows)
+            {
+                if (!bitmap.isNull())
+                    rows &= bitmap;
+            }
+            acceptedRows = rows;
+            acceptedRowCount = facetIndex.rowCount();
+
+            FilterResult result;
+            result.state = state;
+            result.rows = rows;
+            result.rowCount = acceptedRowCount;
+            result.projection = projectionGeneration + 1;
+            filterResults.prepend(result);
+            while (filterResults.count() > FILTER_RESULT_CACHE_SIZE)
+                filterResults.removeLast();
+            projectFacets(baseRows, facetRows, rows);
+        }
+    }
+    invalidateFilter();
+}
+
+SortFilterProxyModel::FilterState SortFilterProxyModel::filterState() const
+{
+    FilterState state;
+    state.minDate = minDate;
+    state.maxDate = maxDate;
+    state.facetValues[CatalogColumns::ObjectFacet] = acceptedObjects;
+    state.facetValues[CatalogColumns::InstrumentFacet] = acceptedInstruments;
+    state.facetValues[CatalogColumns::FilterFacet] = acceptedFilters;
+    state.facetValues[CatalogColumns::ExtensionFacet] = acceptedExtensions;
+    state.facetValues[CatalogColumns::FrameTypeFacet] = acceptedFrameTypes;
+    state.facetValues[CatalogColumns::IntegrityFacet] = acceptedIntegrity;
+    if (!acceptedFolders.isEmpty())
+        state.facetValues[CatalogColumns::FolderFacet] = QStringList{acceptedFolders};
+    // Checking values in another order accepts the same rows
+    for (auto& values : state.facetValues)
+        values.sort();
+    state.includeSubfolders = includeSubfolders;
+    state.skyRegion = skyRegion;
+    state.maxFwhm = maxFwhm;
+    state.minStarCount = minStarCount;
+    state.isSearchActive = isSearchActive;
+    return state;
+}
+
+bool SortFilterProxyModel::FilterState::operator==(const FilterState &other) const
+{
+    for (int facet = 0; facet < CatalogColumns::FacetCount; facet++)
+    {
+        if (facetValues[facet] != other.facetValues[facet])
+            return false;
+    }
+    return minDate == other.minDate && maxDate == other.maxDate && includeSubfolders == other.includeSubfolders && skyRegion == other.skyRegion
+        && maxFwhm == other.maxFwhm && minStarCount == other.minStarCount && isSearchActive == other.isSearchActive;
+}
+
+/*!
+ * \brief SortFilterProxyModel::projectFacets
+ * Counts, in the background, the files each unchecked facet value would add. Checking
+ * a value of a facet keeps the rows that pass the filters of the other facets and have
+ * one of its checked values, so they are counted on those other filters only. The
+ * bitmaps are shared with the job, and the FacetIndex is only copied if rows change
+ * before it is done.
+ */
+void SortFilterProxyModel::projectFacets(const QBitArray &baseRows, const QVector<QBitArray> &facetRows, const QBitArray &rows)
+{
+    static LatencyHistogram& projectionLatency = Metrics::histogram("proxy.facet_projection");
+    projectionWatcher.cancel();
+    runningProjection = ++projectionGeneration;
+    const int acceptedCount = rows.count(true);
+    projectionWatcher.setFuture(QtConcurrent::run([index = facetIndex, baseRows, facetRows, acceptedCount](QPromise<FacetProjections>& promise) {
+        ScopedLatency latency(projectionLatency);
+        FacetProjections projections(CatalogColumns::FacetCount);
+        for (int facet = 0; facet < CatalogColumns::FacetCount; facet++)
+        {
+            // The folders are a tree without counts
+            if (facet == CatalogColumns::FolderFacet)
+                continue;
+            if (promise.isCanceled())
+                return;
+
+            QBitArray otherRows = baseRows;
+            for (int other = 0; other < CatalogColumns::FacetCount; other++)
+            {
+                if (other != facet && !facetRows.at(other).isNull())
+                    otherRows &= facetRows.at(other);
+            }
+            // Checked values are excluded, an unchecked one adds its rows to the ones shown
+            QHash<QString, int> counts = index.countValues(CatalogColumns::Facet(facet), otherRows, facetRows.at(facet));
+            if (!facetRows.at(facet).isNull())
+            {
+                for (auto& count : counts)
+                    count += acceptedCount;
+            }
+            projections[facet] = counts;
+        }
+        promise.addResult(projections);
+    }));
+}
+
+void SortFilterProxyModel::projectionFinished()
+{
+    if (projectionWatcher.isCanceled() || projectionWatcher.future().resultCount() == 0 || runningProjection != projectionGeneration)
+        return;
+
+    const FacetProjections projections = projectionWatcher.result();
+    for (auto& result : filterResults)
+    {
+        if (result.projection == runningProjection)
+            result.projections = projections;
+    }
+    emit facetProjectionsChanged(projections);
+}
+
+/*!
+ * \brief SortFilterProxyModel::integrationStats
+ * Sums the rows of the accepted bitmap by their facet values, so the totals follow a
+ * change of the filters at once. Rows added since the bitmap was evaluated are tested
+ * on their columns.
+ */
+QVector<IntegrationStats> SortFilterProxyModel::integrationStats()
 {
-    // TODO: Sorting logic should be implemented here.
-    Q_UNUSED(source_left);
-    Q_UNUSED(source_right);
+    QVector<IntegrationStats> stats;
+    if (sourceModel() == nullptr || catalog == nullptr)
+        return stats;
+
+    const int rowCount = sourceModel()->rowCount();
+    catalog->readColumns([&](const CatalogColumns& columns) {
+        // By the value ids of the object and filter, then of the instrument
+        QHash<QPair<qint64, int>, int> statsIndexes;
+        QVector<QPair<qint64, qint64>> days; // First and last, as Julian days
+        const qint64 missingDay = std::numeric_limits<qint64>::min();
+        for (int row = 0; row < qMin(rowCount, columns.count()); row++)
+        {
+            if (!(row < acceptedRowCount ? acceptedRows.testBit(row) : rowAccepted(columns, row)))
+                continue;
+            const CatalogColumns::RowView rowView = columns.row(row);
+            if (isIdFilterActive && !filterIds.contains(rowView.id()))
+                continue;
+
+            const int objectId = rowView.facetId(CatalogColumns::ObjectFacet);
+            const int filterId = rowView.facetId(CatalogColumns::FilterFacet);
+            const int instrumentId = rowView.facetId(CatalogColumns::InstrumentFacet);
+            const QPair<qint64, int> key((qint64(objectId) << 32) | quint32(filterId), instrumentId);
+            auto it = statsIndexes.find(key);
+            if (it == statsIndexes.end())
+            {
+                IntegrationStats group;
+                group.Object = columns.value(objectId);
+                group.Filter = columns.value(filterId);
+                group.Instrument = columns.value(instrumentId);
+                it = statsIndexes.insert(key, stats.count());
+                stats.append(group);
+                days.append(qMakePair(missingDay, missingDay));
+            }
+
+            IntegrationStats& group = stats[it.value()];
+            group.FrameCount++;
+            const double exposure = rowView.exposureTime();
+            if (!std::isnan(exposure))
+                group.TotalExposure += exposure;
+            const qint64 day = rowView.observationNight();
+            QPair<qint64, qint64>& span = days[it.value()];
+            if (day != missingDay)
+            {
+                span.first = span.first == missingDay ? day : qMin(span.first, day);
+                span.second = qMax(span.second, day);
+            }
+        }
+        for (int i = 0; i < stats.count(); i++)
+        {
+            if (days.at(i).first == missingDay)
+                continue;
+            stats[i].FirstDate = QDate::fromJulianDay(days.at(i).first);
+            stats[i].LastDate = QDate::fromJulianDay(days.at(i).second);
+        }
+    });
+    return stats;
+}
 
+void SortFilterProxyModel::invalidateFacetIndex()
+{
+    facetIndexValid = false;
+    filterResults.clear();
+    acceptedRowCount = 0;
+    sortKeysValid = false;
+}
+
+/*!
+ * \brief SortFilterProxyModel::sourceRowsInserted
+ * Appended rows are indexed and keyed as they come, so QSortFilterProxyModel inserts
+ * them at their place in the sort without sorting the other rows again. Other inserts
+ * move rows.
+ */
+void SortFilterProxyModel::sourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    filterResults.clear();
+    if (catalog == nullptr)
+    {
+        invalidateFacetIndex();
+        return;
+    }
+
+    if (first != sortKeys.rowCount())
+        sortKeysValid = false;
+    if (first != facetIndex.rowCount())
+    {
+        facetIndexValid = false;
+        acceptedRowCount = 0;
+    }
+    if (!facetIndexValid && !sortKeysValid)
+        return;
+
+    catalog->readColumns([&](const CatalogColumns& columns) {
+        if (last >= columns.count())
+        {
+            invalidateFacetIndex();
+            return;
+        }
+        if (sortKeysValid)
+        {
+            for (int row = first; row <= last; row++)
+                sortKeys.appendRow(columns, row);
+        }
+        if (!facetIndexValid)
+            return;
+
+        for (int row = first; row <= last; row++)
+            facetIndex.appendRow(columns.row(row));
+
+        // Rows appended right after the evaluated ones get their bit now
+        if (first == acceptedRowCount)
+        {
+            acceptedRows.resize(last + 1);
+            for (int row = first; row <= last; row++)
+                acceptedRows.setBit(row, rowAccepted(columns, row));
+            acceptedRowCount = last + 1;
+        }
+    });
+}
+
+/*!
+ * \brief SortFilterProxyModel::rowAccepted
+ * The filters applied to one row of the columns. The result for each facet value is
+ * kept, so a batch of new rows mostly looks up value ids it has seen before.
+ */
+bool SortFilterProxyModel::rowAccepted(const CatalogColumns &columns, int row)
+{
+    const CatalogColumns::RowView rowView = columns.row(row);
+    if (!dateInRange(QDate::fromJulianDay(rowView.observationNight())))
+        return false;
+    // Rows without a position have a NaN declination
+    if (isSearchActive && !searchIds.contains(rowView.id()))
+        return false;
+    if (skyRegion.isActive() && (std::isnan(rowView.dec()) || !skyRegion.contains(rowView.ra(), rowView.dec())))
+        return false;
+    if (isQualityLimited() && !qualityAccepted(rowView.starCount(), rowView.fwhm()))
+        return false;
+
+    for (int facet = 0; facet < CatalogColumns::FacetCount; facet++)
+    {
+        auto f = static_cast<CatalogColumns::Facet>(facet);
+        if (!facetValueAccepted(columns, f, rowView.facetId(f)))
+            return false;
+    }
     return true;
 }
 
+bool SortFilterProxyModel::facetValueAccepted(const CatalogColumns &columns, CatalogColumns::Facet facet, int valueId)
+{
+    QVector<qint8>& accepted = valueAccepted[facet];
+    if (valueId >= accepted.count())
+        accepted.resize(columns.valueCount());
+
+    if (accepted.at(valueId) == 0)
+    {
+        const QString& value = columns.value(valueId);
+        bool isAccepted = true;
+        switch (facet)
+        {
+        case CatalogColumns::ObjectFacet:
+            isAccepted = objectAccepted(value);
+            break;
+        case CatalogColumns::InstrumentFacet:
+            isAccepted = instrumentAccepted(value);
+            break;
+        case CatalogColumns::FilterFacet:
+            isAccepted = filterAccepted(value);
+            break;
+        case CatalogColumns::ExtensionFacet:
+            isAccepted = extensionAccepted(value);
+            break;
+        case CatalogColumns::FolderFacet:
+            isAccepted = folderAccepted(value);
+            break;
+        case CatalogColumns::FrameTypeFacet:
+            isAccepted = frameTypeAccepted(value);
+            break;
+        case CatalogColumns::IntegrityFacet:
+            isAccepted = integrityAccepted(value);
+            break;
+        case CatalogColumns::FacetCount:
+            break;
+        }
+        accepted[valueId] = isAccepted ? 1 : -1;
+    }
+    return accepted.at(valueId) > 0;
+}
+
+void SortFilterProxyModel::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles)
+{
+    // Loaded thumbnails do not change what is filtered on
+    if (roles == QList<int>{Qt::DecorationRole})
+        return;
+    filterResults.clear();
+    if ((!facetIndexValid && !sortKeysValid) || catalog == nullptr)
+        return;
+
+    catalog->readColumns([&](const CatalogColumns& columns) {
+        for (int row = topLeft.row(); row <= bottomRight.row() && row < columns.count(); row++)
+        {
+            if (sortKeysValid)
+                sortKeys.updateRow(columns, row);
+            if (!facetIndexValid)
+                continue;
+            facetIndex.updateRow(row, columns.row(row));
+            if (row < acceptedRowCount)
+                acceptedRows.setBit(row, rowAccepted(columns, row));
+        }
+    });
+}
+
+void SortFilterProxyModel::setCatalog(Catalog *catalog)
+{
+    this->catalog = catalog;
+    invalidateFacetIndex();
+}
+
+bool SortFilterProxyModel::lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const
+{
+    if (sortKey == CatalogColumns::NoSortKey)
+        return source_left.row() < source_right.row();
+
+    if (!sortKeysValid)
+        updateSortKeys();
+    return sortKeys.lessThan(source_left.row(), source_right.row());
+}
+
+/*!
+ * \brief SortFilterProxyModel::setSortKey
+ * The sort order is already in the SortKeys, so the proxy always sorts ascending on
+ * them. NoSortKey shows the rows in the order of the source again.
+ */
+void SortFilterProxyModel::setSortKey(CatalogColumns::SortKey key, Qt::SortOrder order)
+{
+    sortKey = key;
+    sortKeyOrder = order;
+    sortKeysValid = false;
+
+    if (key == CatalogColumns::NoSortKey)
+        sort(-1);
+    else if (sortColumn() == 0)
+        invalidate();
+    else
+        sort(0, Qt::AscendingOrder);
+}
+
+void SortFilterProxyModel::updateSortKeys() const
+{
+    // Once per sort, and after rows were removed or moved, not per batch of new rows
+    static std::atomic<qint64>& builds = Metrics::counter("proxy.sort_key_builds");
+    builds.fetch_add(1, std::memory_order_relaxed);
+    sortKeysValid = true;
+    if (sourceModel() == nullptr || catalog == nullptr)
+    {
+        sortKeys = SortKeys();
+        return;
+    }
+
+    const int rowCount = sourceModel()->rowCount();
+    catalog->readColumns([&](const CatalogColumns& columns) {
+        sortKeys.build(columns, sortKey, sortKeyOrder, rowCount);
+    });
+}
+
 bool SortFilterProxyModel::dateInRange(QDate date) const
 {
     return (!minDate.isValid() || date >= minDate) &&
@@ -95,22 +651,58 @@ bool SortFilterProxyModel::folderAccepted(QString folder) const
     return acceptedFolders.isEmpty() || acceptedFolders == folder || (includeSubfolders && folder.startsWith(acceptedFolders)) || (acceptedFolders.contains("None") && folder.isEmpty());
 }
 
-bool SortFilterProxyModel::isDuplicateOf(QString hash) const
+bool SortFilterProxyModel::frameTypeAccepted(QString frameType) const
+{
+    return acceptedFrameTypes.empty() || acceptedFrameTypes.contains(frameType) || (acceptedFrameTypes.contains("None") && frameType.isEmpty());
+}
+
+bool SortFilterProxyModel::integrityAccepted(QString integrity) const
+{
+    return acceptedIntegrity.empty() || acceptedIntegrity.contains(integrity);
+}
+
+void SortFilterProxyModel::setSkyRegion(const SkyRegion &region)
 {
-    return hash == this->duplicatesFilter;
+    if (region == skyRegion)
+        return;
+    skyRegion = region;
+    applyFilters();
+}
+
+void SortFilterProxyModel::setQualityLimits(double maxFwhm, int minStarCount)
+{
+    if (maxFwhm == this->maxFwhm && minStarCount == this->minStarCount)
+        return;
+    this->maxFwhm = maxFwhm;
+    this->minStarCount = minStarCount;
+    applyFilters();
+}
+
+/*!
+ * \brief SortFilterProxyModel::qualityAccepted
+ * Frames that were not measured, or had no stars to measure the FWHM of, do not pass
+ * the limit on it. NaN is false in every comparison.
+ */
+bool SortFilterProxyModel::qualityAccepted(double starCount, double fwhm) const
+{
+    if (minStarCount > 0 && !(starCount >= minStarCount))
+        return false;
+    if (maxFwhm > 0 && !(fwhm <= maxFwhm))
+        return false;
+    return !std::isnan(starCount);
 }
 
 void SortFilterProxyModel::setFilterMinimumDate(QDate date)
 {
     minDate = date;
-    invalidateFilter();
+    applyFilters();
 //    emit filterReset();
 }
 
 void SortFilterProxyModel::setFilterMaximumDate(QDate date)
 {
     maxDate = date;
-    invalidateFilter();
+    applyFilters();
 //    emit filterReset();
 }
 
@@ -120,7 +712,7 @@ void SortFilterProxyModel::addAcceptedFilter(QString filterName)
     {
         acceptedFilters.append(filterName);
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -129,7 +721,7 @@ void SortFilterProxyModel::removeAcceptedFilter(QString filterName)
     if (acceptedFilters.removeOne(filterName))
     {
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -139,7 +731,7 @@ void SortFilterProxyModel::addAcceptedInstrument(QString instrumentName)
     {
         acceptedInstruments.append(instrumentName);
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -148,7 +740,7 @@ void SortFilterProxyModel::removeAcceptedInstrument(QString instrumentName)
     if (acceptedInstruments.removeOne(instrumentName))
     {
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -158,7 +750,7 @@ void SortFilterProxyModel::addAcceptedObject(QString objectName)
     {
         acceptedObjects.append(objectName);
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -167,7 +759,7 @@ void SortFilterProxyModel::removeAcceptedObject(QString objectName)
     if (acceptedObjects.removeOne(objectName))
     {
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -177,7 +769,7 @@ void SortFilterProxyModel::addAcceptedExtension(QString extensionName)
     {
         acceptedExtensions.append(extensionName);
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -186,7 +778,7 @@ void SortFilterProxyModel::removeAcceptedExtension(QString extensionName)
     if (acceptedExtensions.removeOne(extensionName))
     {
 //        emit filterReset();
-        invalidateFilter();
+        applyFilters();
     }
 }
 
@@ -194,7 +786,7 @@ void SortFilterProxyModel::addAcceptedFolder(QString folderName, bool includeSub
 {
     this->includeSubfolders = includeSubfolders;
     acceptedFolders = folderName;
-    invalidateFilter();
+    applyFilters();
 
 //    acceptedFolders.clear();
 //    if (!acceptedFolders.contains(folderName))
@@ -214,15 +806,63 @@ void SortFilterProxyModel::removeAcceptedFolder(QString folderName)
 //    }
 }
 
-void SortFilterProxyModel::activateDuplicatesFilter(bool shouldActivate)
+void SortFilterProxyModel::addAcceptedFrameType(QString frameType)
+{
+    if (!acceptedFrameTypes.contains(frameType))
+    {
+        acceptedFrameTypes.append(frameType);
+        applyFilters();
+    }
+}
+
+void SortFilterProxyModel::removeAcceptedFrameType(QString frameType)
 {
-    isDuplicatedFilterActive = shouldActivate;
+    if (acceptedFrameTypes.removeOne(frameType))
+        applyFilters();
+}
+
+void SortFilterProxyModel::addAcceptedIntegrity(QString integrity)
+{
+    if (!acceptedIntegrity.contains(integrity))
+    {
+        acceptedIntegrity.append(integrity);
+        applyFilters();
+    }
+}
+
+void SortFilterProxyModel::removeAcceptedIntegrity(QString integrity)
+{
+    if (acceptedIntegrity.removeOne(integrity))
+        applyFilters();
+}
+
+void SortFilterProxyModel::activateIdFilter(bool shouldActivate)
+{
+    isIdFilterActive = shouldActivate;
     invalidateFilter();
 }
 
-void SortFilterProxyModel::setDuplicatesFilter(QString filter)
+void SortFilterProxyModel::setIdFilter(const QVector<int>& ids)
+{
+    this->filterIds = QSet<int>(ids.begin(), ids.end());
+}
+
+void SortFilterProxyModel::setSearchResults(const QVector<int> &ids)
+{
+    searchIds = QSet<int>(ids.begin(), ids.end());
+    isSearchActive = true;
+    // The state does not have the ids found
+    filterResults.clear();
+    applyFilters();
+}
+
+void SortFilterProxyModel::clearSearchResults()
 {
-    this->duplicatesFilter = filter;
+    if (!isSearchActive)
+        return;
+    searchIds.clear();
+    isSearchActive = false;
+    applyFilters();
 }
 
 
@@ -26,19 +26,56 @@
 #define SORTFILTERPROXYMODEL_H
 
 #include "astrofile.h"
+#include "catalog.h"
+#include "facetindex.h"
+#include "integrationstats.h"
+#include "sortkeys.h"
 
+#include <QBitArray>
 #include <QDate>
+#include <QFutureWatcher>
+#include <QHash>
 #include <QObject>
+#include <QSet>
 #include <QSortFilterProxyModel>
 
+/*!
+ * \brief The SortFilterProxyModel class
+ * Filters the catalog by observing night, object, instrument, filter, extension and
+ * folder. When a filter changes, the accepted rows are evaluated at once on the
+ * FacetIndex of the source rows, built from the CatalogColumns, and filterAcceptsRow
+ * only tests a bit. Rows added or changed
+ * since are checked once against the filters on their columns, with the result for
+ * each facet value kept until the filters change.
+ *
+ * The accepted rows of the last few filter states are kept, so going back to one of
+ * them, like unchecking the value just checked, skips evaluating the bitmaps. After
+ * each evaluation, the number of files every unchecked facet value would show if it
+ * were checked is counted on the bitmaps in the background, see facetProjectionsChanged.
+ *
+ * Sorting reads the key of each source row from the CatalogColumns into SortKeys, so
+ * lessThan only compares two keys, and rows appended during an ingest only add theirs.
+ */
 class SortFilterProxyModel : public  QSortFilterProxyModel
 {
     Q_OBJECT
 public:
+    // By facet, the number of files shown if each unchecked value were checked too
+    typedef QVector<QHash<QString, int>> FacetProjections;
+
     explicit SortFilterProxyModel(QObject *parent = nullptr);
     QDate filterMinimumDate() const { return minDate; }
     QDate filterMaximumDate() const { return maxDate; }
 
+    // QAbstractProxyModel interface
+    void setSourceModel(QAbstractItemModel *sourceModel) override;
+    // The roles of a row in one call to the source model
+    void multiData(const QModelIndex &index, QModelRoleDataSpan roleDataSpan) const override;
+    // The FacetIndex is built from the columns of the catalog
+    void setCatalog(Catalog* catalog);
+    // The frames and exposure of each object, filter and instrument among the rows that pass the filters
+    QVector<IntegrationStats> integrationStats();
+
 public slots:
     void setFilterMinimumDate(QDate date);
     void setFilterMaximumDate(QDate date);
@@ -52,13 +89,27 @@ public slots:
     void removeAcceptedExtension(QString extensionName);
     void addAcceptedFolder(QString folderName, bool includeSubfolders);
     void removeAcceptedFolder(QString folderName);
-    void activateDuplicatesFilter(bool shouldActivate);
-    void setDuplicatesFilter(QString filter);
+    void addAcceptedFrameType(QString frameType);
+    void removeAcceptedFrameType(QString frameType);
+    void addAcceptedIntegrity(QString integrity);
+    void removeAcceptedIntegrity(QString integrity);
+    void activateIdFilter(bool shouldActivate);
+    // The ids of the files to show, see Catalog::duplicatesOf, Catalog::nearDuplicatesOf and Catalog::matchingCalibration
+    void setIdFilter(const QVector<int>& ids);
+    // The files found by FileRepository::searchFiles, see clearSearchResults
+    void setSearchResults(const QVector<int>& ids);
+    void clearSearchResults();
+    void setSortKey(CatalogColumns::SortKey key, Qt::SortOrder order = Qt::AscendingOrder);
+    // Only the files pointed within the region, any file without an active region
+    void setSkyRegion(const SkyRegion& region);
+    // Only the measured frames within the limits, see FrameQuality. A limit of 0 is off.
+    void setQualityLimits(double maxFwhm, int minStarCount);
 
 signals:
     void filterMinimumDateChanged(QDate date);
     void filterMaximumDateChanged(QDate date);
     void filterReset();
+    void facetProjectionsChanged(const SortFilterProxyModel::FacetProjections& projections);
 
 protected:
     // QSortFilterProxyModel interface
@@ -72,6 +123,8 @@ private:
     QList<QString> acceptedObjects;
     QList<QString> acceptedInstruments;
     QList<QString> acceptedExtensions;
+    QList<QString> acceptedFrameTypes;
+    QList<QString> acceptedIntegrity;
 //    QList<QString> acceptedFolders;
     QString acceptedFolders;
     bool dateInRange(QDate date) const;
@@ -80,10 +133,70 @@ private:
     bool filterAccepted(QString filter) const;
     bool extensionAccepted(QString filter) const;
     bool folderAccepted(QString folder) const;
-    bool isDuplicatedFilterActive;
-    QString duplicatesFilter;
-    bool isDuplicateOf(QString hash) const;
+    bool frameTypeAccepted(QString frameType) const;
+    bool integrityAccepted(QString integrity) const;
+    bool isIdFilterActive;
+    QSet<int> filterIds;
+    bool isSearchActive = false;
+    QSet<int> searchIds;
     bool includeSubfolders = true;
+    SkyRegion skyRegion;
+    double maxFwhm = 0;
+    int minStarCount = 0;
+    bool isQualityLimited() const { return maxFwhm > 0 || minStarCount > 0; }
+    bool qualityAccepted(double starCount, double fwhm) const;
+
+    QList<QMetaObject::Connection> sourceConnections;
+    Catalog* catalog = nullptr;
+    FacetIndex facetIndex;
+    bool facetIndexValid = false;
+    QBitArray acceptedRows;
+    int acceptedRowCount = 0; // Rows of the source when acceptedRows was evaluated, 0 if stale
+    const AstroFile* astroFileAt(int source_row) const;
+    bool rowAccepted(const AstroFile* astroFile) const;
+    // Whether each value id of a facet passes its filter, 0 while not evaluated yet
+    QVector<qint8> valueAccepted[CatalogColumns::FacetCount];
+    bool rowAccepted(const CatalogColumns& columns, int row);
+    bool facetValueAccepted(const CatalogColumns& columns, CatalogColumns::Facet facet, int valueId);
+    void applyFilters();
+    void invalidateFacetIndex();
+
+    // What the accepted rows depend on besides the rows, the id filter is applied after
+    struct FilterState
+    {
+        QDate minDate;
+        QDate maxDate;
+        QStringList facetValues[CatalogColumns::FacetCount]; // Sorted
+        bool includeSubfolders = true;
+        SkyRegion skyRegion;
+        double maxFwhm = 0;
+        int minStarCount = 0;
+        bool isSearchActive = false;
+        bool operator==(const FilterState& other) const;
+    };
+    struct FilterResult
+    {
+        FilterState state;
+        QBitArray rows;
+        int rowCount;
+        int projection; // The projection evaluated for it, see projectionGeneration
+        FacetProjections projections; // Empty until evaluated
+    };
+    QList<FilterResult> filterResults; // Most recently used first, cleared when the rows change
+    FilterState filterState() const;
+    int projectionGeneration = 0;
+    int runningProjection = 0;
+    QFutureWatcher<FacetProjections> projectionWatcher;
+    void projectFacets(const QBitArray& baseRows, const QVector<QBitArray>& facetRows, const QBitArray& rows);
+    void projectionFinished();
+
+    CatalogColumns::SortKey sortKey = CatalogColumns::NoSortKey;
+    Qt::SortOrder sortKeyOrder = Qt::AscendingOrder;
+    mutable SortKeys sortKeys;
+    mutable bool sortKeysValid = false;
+    void updateSortKeys() const;
+    void sourceRowsInserted(const QModelIndex& parent, int first, int last);
+    void sourceDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QList<int>& roles);
 
 protected slots:
     virtual void resetInternalData();
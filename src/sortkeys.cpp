@@ -0,0 +1,154 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "sortkeys.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const double missingKey = std::numeric_limits<double>::quiet_NaN();
+
+SortKeys::SortKeys()
+{
+    collator.setNumericMode(true);
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+}
+
+/*!
+ * \brief SortKeys::build
+ * The names of the objects are sorted once, then every row only looks its rank up.
+ */
+void SortKeys::build(const CatalogColumns &columns, CatalogColumns::SortKey key, Qt::SortOrder order, int rowCount)
+{
+    sortKey = key;
+    this->order = order;
+    keys.clear();
+    objectRanks.clear();
+    rankedObjects.clear();
+    rankedNames.clear();
+    rowCount = qBound(0, rowCount, columns.count());
+
+    if (key == CatalogColumns::ObjectKey)
+    {
+        QVector<bool> seen(columns.valueCount(), false);
+        for (int row = 0; row < rowCount; row++)
+        {
+            const int id = columns.row(row).facetId(CatalogColumns::ObjectFacet);
+            if (!seen.at(id) && !columns.value(id).isEmpty())
+                rankedObjects.append(id);
+            seen[id] = true;
+        }
+        std::sort(rankedObjects.begin(), rankedObjects.end(), [&](int a, int b) {
+            return collator.compare(columns.value(a), columns.value(b)) < 0;
+        });
+        objectRanks.fill(missingKey, columns.valueCount());
+        for (int rank = 0; rank < rankedObjects.count(); rank++)
+        {
+            objectRanks[rankedObjects.at(rank)] = rank;
+            rankedNames.append(columns.value(rankedObjects.at(rank)));
+        }
+    }
+
+    keys.reserve(rowCount);
+    for (int row = 0; row < rowCount; row++)
+        keys.append(keyOf(columns, row));
+}
+
+void SortKeys::appendRow(const CatalogColumns &columns, int row)
+{
+    if (row != keys.count() || row >= columns.count())
+        return;
+    keys.append(keyOf(columns, row));
+}
+
+void SortKeys::updateRow(const CatalogColumns &columns, int row)
+{
+    if (row < 0 || row >= keys.count() || row >= columns.count())
+        return;
+    keys[row] = keyOf(columns, row);
+}
+
+double SortKeys::keyOf(const CatalogColumns &columns, int row)
+{
+    if (sortKey != CatalogColumns::ObjectKey)
+        return columns.sortValue(sortKey, row);
+
+    const int id = columns.row(row).facetId(CatalogColumns::ObjectFacet);
+    if (columns.value(id).isEmpty())
+        return missingKey;
+    rankObject(columns, id);
+    return id;
+}
+
+/*!
+ * \brief SortKeys::rankObject
+ * Inserts a name seen for the first time among the sorted names. The names after it
+ * move down one rank, which keeps the order of the rows that have them.
+ */
+void SortKeys::rankObject(const CatalogColumns &columns, int valueId)
+{
+    if (valueId < objectRanks.count() && !std::isnan(objectRanks.at(valueId)))
+        return;
+    if (valueId >= objectRanks.count())
+        objectRanks.resize(columns.valueCount(), missingKey);
+
+    const QString& name = columns.value(valueId);
+    auto position = std::lower_bound(rankedNames.begin(), rankedNames.end(), name, [&](const QString& a, const QString& b) {
+        return collator.compare(a, b) < 0;
+    });
+    const int rank = position - rankedNames.begin();
+    rankedNames.insert(rank, name);
+    rankedObjects.insert(rank, valueId);
+    for (int i = rank; i < rankedObjects.count(); i++)
+        objectRanks[rankedObjects.at(i)] = i;
+}
+
+double SortKeys::rankOf(int row) const
+{
+    if (row >= keys.count())
+        return missingKey;
+    const double key = keys.at(row);
+    if (sortKey != CatalogColumns::ObjectKey || std::isnan(key))
+        return key;
+    return objectRanks.at(int(key));
+}
+
+/*!
+ * \brief SortKeys::lessThan
+ * The same order as CatalogColumns::sortedRows: by key, then by row, and the rows
+ * without a value last.
+ */
+bool SortKeys::lessThan(int left, int right) const
+{
+    const double leftKey = rankOf(left);
+    const double rightKey = rankOf(right);
+    const bool leftMissing = std::isnan(leftKey);
+    const bool rightMissing = std::isnan(rightKey);
+    if (leftMissing != rightMissing)
+        return rightMissing;
+    if (!leftMissing && leftKey != rightKey)
+        return order == Qt::AscendingOrder ? leftKey < rightKey : leftKey > rightKey;
+    return left < right;
+}
@@ -0,0 +1,74 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SORTKEYS_H
+#define SORTKEYS_H
+
+#include "catalogcolumns.h"
+
+#include <QCollator>
+#include <QStringList>
+#include <QVector>
+
+/*!
+ * \brief The SortKeys class
+ * The key each source row of the SortFilterProxyModel sorts on, read from the
+ * CatalogColumns. Rows compare on their keys, so the rows appended while the files are
+ * sorted, or whose key changed, only read their own keys, and QSortFilterProxyModel
+ * moves them to their place with binary searches instead of sorting every row again.
+ *
+ * Objects compare by their collated names. The distinct names are kept sorted, so a
+ * new name is a binary search, and only the ranks of the names are numbered again.
+ *
+ * Rows without a value come last, in source order, whatever the order.
+ */
+class SortKeys
+{
+public:
+    SortKeys();
+
+    // Reads the keys of the first rowCount rows
+    void build(const CatalogColumns& columns, CatalogColumns::SortKey key, Qt::SortOrder order, int rowCount);
+    int rowCount() const { return keys.count(); }
+    // Only a row right after the last one is appended
+    void appendRow(const CatalogColumns& columns, int row);
+    void updateRow(const CatalogColumns& columns, int row);
+    // Rows past rowCount() come after the others, in source order
+    bool lessThan(int left, int right) const;
+
+private:
+    CatalogColumns::SortKey sortKey = CatalogColumns::NoSortKey;
+    Qt::SortOrder order = Qt::AscendingOrder;
+    QVector<double> keys; // NaN without a value, the value id of the object for ObjectKey
+    QVector<double> objectRanks; // By value id, NaN for the values that are not ranked
+    QVector<int> rankedObjects; // Value ids, in collation order
+    QStringList rankedNames; // Their names
+    QCollator collator;
+
+    double keyOf(const CatalogColumns& columns, int row);
+    double rankOf(int row) const;
+    void rankObject(const CatalogColumns& columns, int valueId);
+};
+
+#endif // SORTKEYS_H
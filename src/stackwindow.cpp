@@ -0,0 +1,77 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "stackwindow.h"
+
+#include <QKeyEvent>
+#include <QPainter>
+
+StackWindow::StackWindow(const QStringList &paths, const QByteArray &stretchParameters, QWidget *parent) : QWidget(parent, Qt::Window)
+{
+    setWindowTitle(tr("Stack Preview"));
+    resize(1024, 768);
+    setFocusPolicy(Qt::StrongFocus);
+
+    connect(&stacker, &PreviewStacker::imageReady, this, QOverload<>::of(&QWidget::update));
+    stacker.start(paths, stretchParameters);
+}
+
+void StackWindow::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::black);
+    painter.setPen(Qt::gray);
+
+    const QImage image = stacker.image();
+    const int integrated = stacker.integratedCount();
+    const int skipped = stacker.skippedCount();
+    const int frames = stacker.frameCount();
+    if (image.isNull())
+    {
+        painter.drawText(rect(), Qt::AlignCenter, skipped == frames ? tr("Could not read the frames") : tr("Loading..."));
+    }
+    else
+    {
+        QSize size = image.size().scaled(this->size(), Qt::KeepAspectRatio);
+        QRect target(QPoint((width() - size.width()) / 2, (height() - size.height()) / 2), size);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        painter.drawImage(target, image);
+    }
+
+    QString caption = tr("%1 of %2 frames stacked").arg(integrated).arg(frames);
+    if (skipped > 0)
+        caption += tr(", %1 skipped").arg(skipped);
+    if (integrated + skipped < frames)
+        caption += tr(", stacking...");
+    painter.drawText(rect().adjusted(8, 8, -8, -8), Qt::AlignLeft | Qt::AlignTop, caption);
+}
+
+void StackWindow::keyPressEvent(QKeyEvent *event)
+{
+    if (event->key() == Qt::Key_Escape)
+        close();
+    else
+        QWidget::keyPressEvent(event);
+}
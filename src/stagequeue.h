@@ -0,0 +1,124 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef STAGEQUEUE_H
+#define STAGEQUEUE_H
+
+#include <atomic>
+#include <memory>
+
+/*!
+ * \brief The StageQueue class
+ * A bounded lock-free ring between the stages of the ingest, for any number of
+ * producers and consumers. Each cell has a sequence number that tells whose turn it
+ * is, so a push or a pop is one compare and swap on its end of the ring, and the
+ * items are moved in and out instead of copied.
+ *
+ * Capacity is rounded up to a power of two. tryPush fails when the ring is full, and
+ * leaves the item with the caller, who waits for a consumer to make room, which is how
+ * the ring holds a stage back.
+ */
+template <typename T>
+class StageQueue
+{
+public:
+    explicit StageQueue(int capacity)
+    {
+        size_t size = 2;
+        while (size < size_t(capacity))
+            size <<= 1;
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    StageQueue(const StageQueue&) = delete;
+    StageQueue& operator=(const StageQueue&) = delete;
+
+    bool tryPush(T&& item)
+    {
+        size_t position = pushPosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells[position & mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0)
+            {
+                if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.item = std::move(item);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+                return false; // Full
+            else
+                position = pushPosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPop(T& item)
+    {
+        size_t position = popPosition.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = cells[position & mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+            if (difference == 0)
+            {
+                if (popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    item = std::move(cell.item);
+                    // The moved from item would keep its buffers until the cell is used again
+                    cell.item = T();
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+                return false; // Empty
+            else
+                position = popPosition.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    // On cache lines of their own, the producers and the consumers write one each
+    alignas(64) std::atomic<size_t> pushPosition = 0;
+    alignas(64) std::atomic<size_t> popPosition = 0;
+};
+
+#endif // STAGEQUEUE_H
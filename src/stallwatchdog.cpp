@@ -0,0 +1,316 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "stallwatchdog.h"
+#include "metrics.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QEvent>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(Q_OS_WIN) && defined(Q_PROCESSOR_X86_64)
+#define STALL_STACK_WINDOWS
+#include <windows.h>
+#include <dbghelp.h>
+#elif defined(Q_OS_LINUX) || defined(Q_OS_MAC)
+#define STALL_STACK_SIGNAL
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+// How often the GUI thread is pinged, and the stall checked
+#define STALL_POLL_INTERVAL 100
+
+// The frames of the GUI thread stack that are logged
+#define STALL_STACK_DEPTH 64
+
+// How long the signal handler of the GUI thread is waited for, when it is blocked in the kernel it runs late
+#define STALL_CAPTURE_TIMEOUT 500
+
+// The log is rotated at this size, keeping this many files
+#define STALL_LOG_MAX_SIZE (1024 * 1024)
+#define STALL_LOG_FILES 3
+
+std::atomic<const char*> StallWatchdog::scopes[STALL_SCOPE_DEPTH] = {};
+std::atomic<int> StallWatchdog::scopeDepth {0};
+
+namespace
+{
+#if defined(STALL_STACK_WINDOWS)
+    HANDLE guiThread = nullptr;
+#elif defined(STALL_STACK_SIGNAL)
+    pthread_t guiThread;
+    void* capturedStack[STALL_STACK_DEPTH];
+    std::atomic<int> capturedFrames {-1};
+
+    // Runs on the GUI thread, interrupted wherever it is stuck
+    void captureStack(int)
+    {
+        capturedFrames.store(backtrace(capturedStack, STALL_STACK_DEPTH), std::memory_order_release);
+    }
+#endif
+}
+
+StallWatchdog::StallWatchdog(int thresholdMs)
+    : threshold(thresholdMs)
+{
+    setObjectName("stall watchdog");
+    QString location = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    QDir().mkpath(location);
+    logPath = location + "/stalls.log";
+
+#if defined(STALL_STACK_WINDOWS)
+    guiThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE, GetCurrentThreadId());
+#elif defined(STALL_STACK_SIGNAL)
+    guiThread = pthread_self();
+    // The first call loads the unwinder, which is not safe in a signal handler
+    void* frame;
+    backtrace(&frame, 1);
+    struct sigaction action = {};
+    action.sa_handler = captureStack;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, nullptr);
+#endif
+
+    QCoreApplication::instance()->installEventFilter(this);
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    stop();
+    QCoreApplication::instance()->removeEventFilter(this);
+#if defined(STALL_STACK_WINDOWS)
+    if (guiThread != nullptr)
+        CloseHandle(guiThread);
+    guiThread = nullptr;
+#endif
+}
+
+void StallWatchdog::stop()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        wake.wakeAll();
+    }
+    wait();
+}
+
+/*!
+ * \brief StallWatchdog::eventFilter
+ * Every event of the GUI thread passes here, so it only keeps the class of the receiver
+ * and the type. The class name is static data, safe to read from the watchdog.
+ */
+bool StallWatchdog::eventFilter(QObject *watched, QEvent *event)
+{
+    lastEventReceiver.store(watched->metaObject()->className(), std::memory_order_relaxed);
+    lastEventType.store(event->type(), std::memory_order_relaxed);
+    return false;
+}
+
+void StallWatchdog::run()
+{
+#if defined(STALL_STACK_WINDOWS)
+    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS);
+    SymInitialize(GetCurrentProcess(), nullptr, TRUE);
+#endif
+
+    QMutexLocker locker(&mutex);
+    while (!stopping)
+    {
+        if (!pingPending)
+        {
+            pingPending = true;
+            pingTimer.start();
+            QMetaObject::invokeMethod(QCoreApplication::instance(), [this]() { answer(); }, Qt::QueuedConnection);
+        }
+        else if (!reported && pingTimer.elapsed() > threshold)
+        {
+            reported = true;
+            qint64 stalledMs = pingTimer.elapsed();
+            locker.unlock();
+            report(stalledMs);
+            locker.relock();
+        }
+        wake.wait(&mutex, STALL_POLL_INTERVAL);
+    }
+
+#if defined(STALL_STACK_WINDOWS)
+    SymCleanup(GetCurrentProcess());
+#endif
+}
+
+// On the GUI thread, once its event loop runs again
+void StallWatchdog::answer()
+{
+    static LatencyHistogram& stalls = Metrics::histogram("gui.stall");
+
+    QMutexLocker locker(&mutex);
+    qint64 stalledMs = pingTimer.elapsed();
+    bool wasReported = reported;
+    pingPending = false;
+    reported = false;
+    locker.unlock();
+
+    if (wasReported)
+    {
+        stalls.record(stalledMs * 1000);
+        writeLog({ QString("%1 GUI thread answered after %2 ms").arg(QDateTime::currentDateTime().toString(Qt::ISODateWithMs)).arg(stalledMs) });
+    }
+}
+
+void StallWatchdog::report(qint64 stalledMs)
+{
+    static std::atomic<qint64>& stallCount = Metrics::counter("gui.stalls");
+    stallCount++;
+
+    QStringList lines;
+    lines << QString("%1 GUI thread stalled for %2 ms").arg(QDateTime::currentDateTime().toString(Qt::ISODateWithMs)).arg(stalledMs);
+
+    const char* receiver = lastEventReceiver.load(std::memory_order_relaxed);
+    if (receiver != nullptr)
+        lines << QString("  last event: type %1 to %2").arg(lastEventType.load(std::memory_order_relaxed)).arg(receiver);
+
+    int depth = scopeDepth.load(std::memory_order_acquire);
+    QStringList names;
+    for (int i = 0; i < std::min(depth, STALL_SCOPE_DEPTH); i++)
+        names << scopes[i].load(std::memory_order_relaxed);
+    if (depth > STALL_SCOPE_DEPTH)
+        names << "...";
+    if (!names.isEmpty())
+        lines << "  in: " + names.join(" > ");
+
+    QStringList stack = captureGuiStack();
+    for (int i = 0; i < stack.count(); i++)
+        lines << QString("  #%1 %2").arg(i).arg(stack.at(i));
+
+    writeLog(lines);
+}
+
+/*!
+ * \brief StallWatchdog::captureGuiStack
+ * The frames are only collected while the GUI thread is stopped, they are symbolized
+ * after it runs again. Symbols come from the exported names on Linux and macOS, and
+ * from the pdb files next to the binaries on Windows.
+ */
+QStringList StallWatchdog::captureGuiStack()
+{
+    QStringList stack;
+#if defined(STALL_STACK_WINDOWS)
+    if (guiThread == nullptr)
+        return stack;
+
+    DWORD64 addresses[STALL_STACK_DEPTH];
+    int frames = 0;
+    if (SuspendThread(guiThread) == DWORD(-1))
+        return stack;
+    CONTEXT context = {};
+    context.ContextFlags = CONTEXT_FULL;
+    if (GetThreadContext(guiThread, &context))
+    {
+        STACKFRAME64 frame = {};
+        frame.AddrPC.Offset = context.Rip;
+        frame.AddrPC.Mode = AddrModeFlat;
+        frame.AddrFrame.Offset = context.Rbp;
+        frame.AddrFrame.Mode = AddrModeFlat;
+        frame.AddrStack.Offset = context.Rsp;
+        frame.AddrStack.Mode = AddrModeFlat;
+        while (frames < STALL_STACK_DEPTH
+               && StackWalk64(IMAGE_FILE_MACHINE_AMD64, GetCurrentProcess(), guiThread, &frame, &context,
+                              nullptr, SymFunctionTableAccess64, SymGetModuleBase64, nullptr)
+               && frame.AddrPC.Offset != 0)
+            addresses[frames++] = frame.AddrPC.Offset;
+    }
+    ResumeThread(guiThread);
+
+    alignas(SYMBOL_INFO) char buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME];
+    SYMBOL_INFO* symbol = reinterpret_cast<SYMBOL_INFO*>(buffer);
+    for (int i = 0; i < frames; i++)
+    {
+        symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+        symbol->MaxNameLen = MAX_SYM_NAME;
+        DWORD64 displacement = 0;
+        if (SymFromAddr(GetCurrentProcess(), addresses[i], &displacement, symbol))
+            stack << QString("%1+0x%2").arg(QString::fromLocal8Bit(symbol->Name, int(symbol->NameLen))).arg(displacement, 0, 16);
+        else
+            stack << QString("0x%1").arg(addresses[i], 0, 16);
+    }
+#elif defined(STALL_STACK_SIGNAL)
+    capturedFrames.store(-1, std::memory_order_relaxed);
+    if (pthread_kill(guiThread, SIGUSR2) != 0)
+        return stack;
+    QElapsedTimer timer;
+    timer.start();
+    int frames = -1;
+    while ((frames = capturedFrames.load(std::memory_order_acquire)) < 0 && timer.elapsed() < STALL_CAPTURE_TIMEOUT)
+        QThread::msleep(1);
+    if (frames <= 0)
+        return stack;
+
+    char** symbols = backtrace_symbols(capturedStack, frames);
+    if (symbols == nullptr)
+        return stack;
+    // The first frame is the signal handler
+    for (int i = 1; i < frames; i++)
+        stack << QString::fromLocal8Bit(symbols[i]);
+    free(symbols);
+#endif
+    return stack;
+}
+
+// Appended, the files are rotated as stalls.log.1, stalls.log.2 when the log is full
+void StallWatchdog::writeLog(const QStringList &lines)
+{
+    static QMutex logMutex;
+    QMutexLocker locker(&logMutex);
+
+    if (QFileInfo(logPath).size() >= STALL_LOG_MAX_SIZE)
+    {
+        QFile::remove(QString("%1.%2").arg(logPath).arg(STALL_LOG_FILES - 1));
+        for (int i = STALL_LOG_FILES - 2; i >= 1; i--)
+            QFile::rename(QString("%1.%2").arg(logPath).arg(i), QString("%1.%2").arg(logPath).arg(i + 1));
+        QFile::rename(logPath, logPath + ".1");
+    }
+
+    QFile file(logPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+    {
+        qDebug() << "Failed to write the stall log" << logPath << file.errorString();
+        return;
+    }
+    file.write((lines.join('\n') + '\n').toUtf8());
+    for (const QString& line : lines)
+        qDebug().noquote() << line;
+}
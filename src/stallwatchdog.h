@@ -0,0 +1,110 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+
+// The named scopes of the GUI thread kept for the stall log, deeper ones are not named
+#define STALL_SCOPE_DEPTH 8
+
+/*!
+ * \brief The StallWatchdog class
+ * Pings the GUI event loop from a thread of its own. When a ping is not answered within
+ * the threshold, the stack of the GUI thread is captured and written to a rotating log,
+ * stalls.log in the app data folder, with the last event the GUI thread was delivered
+ * and the StallScopes it is in. The log gets another line when the GUI thread answers,
+ * with the length of the stall.
+ *
+ * The stack is captured with a signal on Linux and macOS, and by suspending the thread
+ * on 64 bit Windows. Elsewhere only the event and the scopes are logged.
+ *
+ * Create and start it on the GUI thread.
+ */
+class StallWatchdog : public QThread
+{
+public:
+    explicit StallWatchdog(int thresholdMs);
+    ~StallWatchdog();
+
+    void stop();
+
+protected:
+    void run() override;
+    bool eventFilter(QObject* watched, QEvent* event) override;
+
+private:
+    friend class StallScope;
+
+    void answer();
+    void report(qint64 stalledMs);
+    QStringList captureGuiStack();
+    void writeLog(const QStringList& lines);
+
+    const int threshold;
+    QString logPath;
+
+    QMutex mutex;
+    QWaitCondition wake;
+    bool stopping = false;
+    bool pingPending = false;
+    bool reported = false;
+    QElapsedTimer pingTimer;
+
+    // Written by the GUI thread only, read by the watchdog
+    std::atomic<const char*> lastEventReceiver {nullptr};
+    std::atomic<int> lastEventType {0};
+    static std::atomic<const char*> scopes[STALL_SCOPE_DEPTH];
+    static std::atomic<int> scopeDepth;
+};
+
+/*!
+ * \brief The StallScope class
+ * Names the code the GUI thread runs while it is constructed, for the stall log. Use
+ * it on the GUI thread only, it costs two atomic stores. The name must be a literal,
+ * or live as long as the app.
+ */
+class StallScope
+{
+public:
+    explicit StallScope(const char* name)
+    {
+        int depth = StallWatchdog::scopeDepth.load(std::memory_order_relaxed);
+        if (depth < STALL_SCOPE_DEPTH)
+            StallWatchdog::scopes[depth].store(name, std::memory_order_relaxed);
+        StallWatchdog::scopeDepth.store(depth + 1, std::memory_order_release);
+    }
+    ~StallScope()
+    {
+        StallWatchdog::scopeDepth.fetch_sub(1, std::memory_order_release);
+    }
+};
+
+#endif // STALLWATCHDOG_H
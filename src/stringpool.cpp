@@ -0,0 +1,100 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#include "stringpool.h"
+
+#include <QMutexLocker>
+
+// Allocation header of a QString, added to what sharing one saves
+#define STRING_POOL_HEADER_BYTES 24
+
+StringPool::StringPool() : saved(0)
+{
+}
+
+StringPool& StringPool::instance()
+{
+    static StringPool pool;
+    return pool;
+}
+
+/*!
+ * \brief StringPool::intern
+ * Returns the pooled string equal to value, adding value to the pool if it is new.
+ */
+QString StringPool::intern(const QString &value)
+{
+    if (value.isEmpty())
+        return QString();
+
+    StringPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    auto iter = pool.strings.constFind(value);
+    if (iter == pool.strings.constEnd())
+    {
+        pool.strings.insert(value);
+        return value;
+    }
+
+    // Only counted when value was not the pooled string already
+    if (iter->constData() != value.constData())
+        pool.saved += value.size() * sizeof(QChar) + STRING_POOL_HEADER_BYTES;
+    return *iter;
+}
+
+QString StringPool::internTagValue(const QString &key, const QString &value)
+{
+    // Observation times are unique to each file
+    if (key == QLatin1String("DATE-OBS"))
+        return value;
+    return intern(value);
+}
+
+TagMap StringPool::internTags(const TagMap &tags)
+{
+    // Rows from the repository loaders are interned already, keep their map
+    bool isInterned = true;
+    for (auto iter = tags.constBegin(); iter != tags.constEnd() && isInterned; ++iter)
+        isInterned = internTagValue(iter.key(), iter.value()).constData() == iter.value().constData();
+    if (isInterned)
+        return tags;
+
+    TagMap interned;
+    for (auto iter = tags.constBegin(); iter != tags.constEnd(); ++iter)
+        interned.insert(iter.key(), internTagValue(iter.key(), iter.value()));
+    return interned;
+}
+
+int StringPool::count()
+{
+    StringPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    return pool.strings.count();
+}
+
+qint64 StringPool::savedBytes()
+{
+    StringPool& pool = instance();
+    QMutexLocker locker(&pool.mutex);
+    return pool.saved;
+}
@@ -0,0 +1,65 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include "tagmap.h"
+
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+/*!
+ * \brief The StringPool class
+ * Interned copies of the strings repeated across the rows of the catalog, like folders,
+ * extensions and tag values. Interning returns the pooled copy, so all the rows with
+ * the same value share one string instead of owning their own.
+ *
+ * Strings are kept for the life of the application, so only intern values that repeat.
+ * Thread safe, the repository loads rows on its thread while the Catalog adds them.
+ */
+class StringPool
+{
+public:
+    static QString intern(const QString& value);
+    // Interns the value if the keyword repeats across files
+    static QString internTagValue(const QString& key, const QString& value);
+    // Interns the values of the keywords that repeat across files, the keys are ids already
+    static TagMap internTags(const TagMap& tags);
+
+    // Counted since the start, for the instrumentation
+    static int count();
+    static qint64 savedBytes();
+
+private:
+    StringPool();
+    static StringPool& instance();
+
+    QMutex mutex;
+    QSet<QString> strings;
+    qint64 saved;
+};
+
+#endif // STRINGPOOL_H
@@ -0,0 +1,248 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "fitsfile.h"
+#include "syntheticframe.h"
+
+#ifdef __llvm__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdangling-else"
+#pragma GCC diagnostic ignored "-Wlogical-op-parentheses"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+
+#include <pcl/XISF.h>
+
+#ifdef __llvm__
+#pragma GCC diagnostic pop
+#endif
+
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+
+// Sky level and noise of the background, normalized
+#define SYNTHETIC_BACKGROUND 0.06f
+#define SYNTHETIC_NOISE 0.004f
+
+// Brightening of the background from the left edge to the right one
+#define SYNTHETIC_GRADIENT 0.2f
+
+// The brightest sample, below 1 so the largest integer types do not overflow
+#define SYNTHETIC_MAX_SAMPLE 0.999f
+
+// Growth of the buffer of the FITS file while it is written, a multiple of the 2880 byte blocks
+#define SYNTHETIC_FITS_GROWTH (2880 * 1024)
+
+static const char* bayerPatternName(BayerPattern pattern)
+{
+    switch (pattern)
+    {
+    case RGGB: return "RGGB";
+    case BGGR: return "BGGR";
+    case GRBG: return "GRBG";
+    case GBRG: return "GBRG";
+    default: return nullptr;
+    }
+}
+
+SyntheticFrame::SyntheticFrame(const SyntheticFrameSpec& spec) : _spec(spec)
+{
+    const long long width = spec.width;
+    const long long height = spec.height;
+    _samples.resize(width * height);
+
+    // The position of the red pixel in the 2x2 cell, like the templates of demosaic
+    int redX = -1;
+    int redY = -1;
+    switch (spec.bayerPattern)
+    {
+    case RGGB: redX = 0; redY = 0; break;
+    case BGGR: redX = 1; redY = 1; break;
+    case GRBG: redX = 1; redY = 0; break;
+    case GBRG: redX = 0; redY = 1; break;
+    default: break;
+    }
+    // 0 red, 1 green, 2 blue. A mono frame is all green.
+    auto channelOf = [redX, redY](long long x, long long y) {
+        if (redX < 0)
+            return 1;
+        const bool redRow = (y & 1) == redY;
+        const bool redColumn = (x & 1) == redX;
+        return redRow == redColumn ? (redRow ? 0 : 2) : 1;
+    };
+    const float skyColor[3] = {0.9f, 1.0f, 0.7f};
+
+    std::mt19937 random(spec.seed);
+    std::normal_distribution<float> noise(0, SYNTHETIC_NOISE);
+    std::uniform_real_distribution<float> uniform(0, 1);
+
+    for (long long y = 0; y < height; y++)
+    {
+        for (long long x = 0; x < width; x++)
+        {
+            const float sky = SYNTHETIC_BACKGROUND * (1 + SYNTHETIC_GRADIENT * x / width) * skyColor[channelOf(x, y)];
+            _samples[y * width + x] = sky + noise(random);
+        }
+    }
+
+    for (int i = 0; i < spec.stars; i++)
+    {
+        const float centerX = uniform(random) * width;
+        const float centerY = uniform(random) * height;
+        // Mostly faint stars, and a few bright ones
+        const float peak = 0.02f + 0.95f * std::pow(uniform(random), 4.0f);
+        const float sigma = 1.2f + 1.5f * uniform(random);
+        const float color[3] = {0.7f + 0.6f * uniform(random), 1.0f, 0.7f + 0.6f * uniform(random)};
+        const long long radius = (long long)std::ceil(4 * sigma);
+        for (long long y = qMax(0LL, (long long)centerY - radius); y < qMin(height, (long long)centerY + radius + 1); y++)
+        {
+            for (long long x = qMax(0LL, (long long)centerX - radius); x < qMin(width, (long long)centerX + radius + 1); x++)
+            {
+                const float dx = x + 0.5f - centerX;
+                const float dy = y + 0.5f - centerY;
+                _samples[y * width + x] += peak * color[channelOf(x, y)] * std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+    }
+
+    for (auto& sample : _samples)
+        sample = std::clamp(sample, 0.0f, SYNTHETIC_MAX_SAMPLE);
+}
+
+/*!
+ * \brief SyntheticFrame::toFits
+ * Writes the frame with cfitsio into memory, with a BAYERPAT keyword for color frames.
+ * Returns an empty array when cfitsio fails.
+ */
+QByteArray SyntheticFrame::toFits() const
+{
+    size_t size = SYNTHETIC_FITS_GROWTH;
+    void* buffer = malloc(size);
+    fitsfile* fptr = nullptr;
+    int status = 0;
+    fits_create_memfile(&fptr, &buffer, &size, SYNTHETIC_FITS_GROWTH, realloc, &status);
+
+    long naxes[2] = {_spec.width, _spec.height};
+    fits_create_img(fptr, _spec.bitpix, 2, naxes, &status);
+    if (const char* pattern = bayerPatternName(_spec.bayerPattern))
+        fits_update_key(fptr, TSTRING, "BAYERPAT", const_cast<char*>(pattern), "Color filter array", &status);
+    for (auto keyword = _spec.keywords.constBegin(); keyword != _spec.keywords.constEnd(); ++keyword)
+    {
+        QByteArray name = keyword.key().toLatin1();
+        if (keyword.value().typeId() == QMetaType::QString)
+        {
+            QByteArray value = keyword.value().toString().toLatin1();
+            fits_update_key(fptr, TSTRING, name.data(), value.data(), NULL, &status);
+        }
+        else
+        {
+            double value = keyword.value().toDouble();
+            fits_update_key(fptr, TDOUBLE, name.data(), &value, NULL, &status);
+        }
+    }
+    visitFitsSampleType(_spec.bitpix, [&](auto sample) {
+        using T = decltype(sample);
+        std::vector<T> data = pixels<T>();
+        fits_write_img(fptr, FitsSampleType<T>::dataType, 1, (LONGLONG)data.size(), data.data(), &status);
+    });
+
+    LONGLONG headStart = 0;
+    LONGLONG dataStart = 0;
+    LONGLONG dataEnd = 0;
+    fits_get_hduaddrll(fptr, &headStart, &dataStart, &dataEnd, &status);
+    fits_close_file(fptr, &status);
+
+    QByteArray file;
+    if (status == 0)
+        file = QByteArray(static_cast<const char*>(buffer), dataEnd);
+    else
+        qDebug() << "Could not write the synthetic frame, cfitsio status" << status;
+    free(buffer);
+    return file;
+}
+
+bool SyntheticFrame::writeFits(const QString& path) const
+{
+    const QByteArray fits = toFits();
+    QFile file(path);
+    if (fits.isEmpty() || !file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write(fits) == fits.size();
+}
+
+template <typename Image, typename T>
+static void writeXisfImage(pcl::XISFWriter& xisf, const std::vector<T>& pixels, int width, int height)
+{
+    Image image(width, height);
+    std::copy(pixels.begin(), pixels.end(), image.PixelData());
+    xisf.WriteImage(image);
+}
+
+/*!
+ * \brief SyntheticFrame::writeXisf
+ * Writes the frame with the XISF writer of PCL, with the keywords and the BAYERPAT of
+ * the spec as FITS keywords. Returns false for the sample types XISF does not have.
+ */
+bool SyntheticFrame::writeXisf(const QString& path) const
+{
+    const int bitpix = _spec.bitpix;
+    if (bitpix != BYTE_IMG && bitpix != USHORT_IMG && bitpix != ULONG_IMG && bitpix != FLOAT_IMG && bitpix != DOUBLE_IMG)
+        return false;
+
+    pcl::FITSKeywordArray keywords;
+    if (const char* pattern = bayerPatternName(_spec.bayerPattern))
+        keywords.Add(pcl::FITSHeaderKeyword("BAYERPAT", pcl::IsoString("'") + pattern + "'", "Color filter array"));
+    for (auto keyword = _spec.keywords.constBegin(); keyword != _spec.keywords.constEnd(); ++keyword)
+    {
+        // PCL keeps the values as they are written in the header, strings quoted
+        const QString value = keyword.value().typeId() == QMetaType::QString ? "'" + keyword.value().toString() + "'" : keyword.value().toString();
+        keywords.Add(pcl::FITSHeaderKeyword(pcl::IsoString(keyword.key().toLatin1().constData()), pcl::IsoString(value.toLatin1().constData()), pcl::IsoString()));
+    }
+
+    try
+    {
+        pcl::XISFWriter xisf;
+        xisf.Create(path.toStdWString().c_str(), 1);
+        xisf.WriteFITSKeywords(keywords);
+        switch (bitpix)
+        {
+        case BYTE_IMG: writeXisfImage<pcl::UInt8Image>(xisf, pixels<uint8_t>(), _spec.width, _spec.height); break;
+        case USHORT_IMG: writeXisfImage<pcl::UInt16Image>(xisf, pixels<uint16_t>(), _spec.width, _spec.height); break;
+        case ULONG_IMG: writeXisfImage<pcl::UInt32Image>(xisf, pixels<uint32_t>(), _spec.width, _spec.height); break;
+        case FLOAT_IMG: writeXisfImage<pcl::FImage>(xisf, pixels<float>(), _spec.width, _spec.height); break;
+        case DOUBLE_IMG: writeXisfImage<pcl::DImage>(xisf, pixels<double>(), _spec.width, _spec.height); break;
+        }
+        xisf.Close();
+    }
+    catch (pcl::Error&)
+    {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,112 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef SYNTHETICFRAME_H
+#define SYNTHETICFRAME_H
+
+#include "debayer.h"
+#include "fitsio.h"
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+#include <QVariant>
+
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// Frame sizes of common astronomy cameras, in pixels
+#define SYNTHETIC_16MP_WIDTH 4656
+#define SYNTHETIC_16MP_HEIGHT 3520
+#define SYNTHETIC_26MP_WIDTH 6248
+#define SYNTHETIC_26MP_HEIGHT 4176
+#define SYNTHETIC_61MP_WIDTH 9576
+#define SYNTHETIC_61MP_HEIGHT 6388
+
+struct SyntheticFrameSpec
+{
+    int width = SYNTHETIC_16MP_WIDTH;
+    int height = SYNTHETIC_16MP_HEIGHT;
+    // The equivalent BITPIX of the FITS file
+    int bitpix = USHORT_IMG;
+    BayerPattern bayerPattern = None;
+    int stars = 2000;
+    unsigned int seed = 1;
+    // Written to the header, strings as strings and the rest as numbers
+    QMap<QString, QVariant> keywords;
+};
+
+/*!
+ * \brief The SyntheticFrame class
+ * A made up frame for the benchmarks: a sky background with a gradient, noise and
+ * gaussian stars, mosaiced in the bayer pattern of the spec for a one shot color
+ * camera. The same spec always makes the same frame.
+ */
+class SyntheticFrame
+{
+public:
+    explicit SyntheticFrame(const SyntheticFrameSpec& spec);
+
+    const SyntheticFrameSpec& spec() const
+    {
+        return _spec;
+    }
+
+    // Normalized, between 0 and 1
+    const std::vector<float>& samples() const
+    {
+        return _samples;
+    }
+
+    template <typename T>
+    std::vector<T> pixels() const;
+
+    // A FITS file of the frame, in the BITPIX of the spec
+    QByteArray toFits() const;
+    bool writeFits(const QString& path) const;
+    // Only the unsigned integer and floating point types XISF has
+    bool writeXisf(const QString& path) const;
+
+private:
+    SyntheticFrameSpec _spec;
+    std::vector<float> _samples;
+};
+
+/*!
+ * \brief SyntheticFrame::pixels
+ * The samples in the type of a frame: normalized for floating point types, over the
+ * positive range of the type for integer ones.
+ */
+template <typename T>
+std::vector<T> SyntheticFrame::pixels() const
+{
+    const double scale = std::is_floating_point<T>::value ? 1.0 : double(std::numeric_limits<T>::max());
+    std::vector<T> out(_samples.size());
+    for (size_t i = 0; i < _samples.size(); i++)
+        out[i] = T(_samples[i] * scale);
+    return out;
+}
+
+#endif // SYNTHETICFRAME_H
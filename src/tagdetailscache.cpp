@@ -0,0 +1,114 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "tagdetailscache.h"
+#include "filerepository.h"
+
+#include <QThreadPool>
+
+// Files whose keywords are kept
+#define TAG_DETAILS_CACHE_SIZE 64
+// Prefetches loaded at once
+#define TAG_PREFETCH_THREADS 2
+
+TagDetailsCache::TagDetailsCache(FileRepository* repository, QObject *parent)
+    : QObject(parent), repository(repository), cache(TAG_DETAILS_CACHE_SIZE)
+{
+    connect(repository, &FileRepository::tagsLoaded, this, &TagDetailsCache::tagsLoaded);
+    connect(repository, &FileRepository::astroFileUpdated, this, &TagDetailsCache::astroFileUpdated);
+    prefetchPool.setMaxThreadCount(TAG_PREFETCH_THREADS);
+}
+
+TagDetailsCache::~TagDetailsCache()
+{
+    prefetchPool.clear();
+    prefetchPool.waitForDone();
+}
+
+bool TagDetailsCache::find(int id, QMap<QString, QString> *tags)
+{
+    auto cached = cache.object(id);
+    if (cached == nullptr)
+    {
+        load(id);
+        return false;
+    }
+    *tags = *cached;
+    return true;
+}
+
+void TagDetailsCache::load(int id)
+{
+    // A prefetch of the file may still be dropped, so it is loaded now as well
+    if (pending.contains(id) && !prefetching.remove(id))
+        return;
+    pending.insert(id);
+
+    FileRepository* repository = this->repository;
+    QThreadPool::globalInstance()->start([repository, id]() { repository->loadTags(id); });
+}
+
+/*!
+ * \brief TagDetailsCache::prefetch
+ * The prefetches that did not start are cleared and are not pending anymore. The
+ * result of one that did still comes, and is dropped unless it is asked for again.
+ */
+void TagDetailsCache::prefetch(const QVector<int> &ids)
+{
+    prefetchPool.clear();
+    for (int id : std::as_const(prefetching))
+        pending.remove(id);
+    prefetching.clear();
+
+    FileRepository* repository = this->repository;
+    for (int i = 0; i < ids.count(); i++)
+    {
+        const int id = ids.at(i);
+        if (cache.contains(id) || pending.contains(id))
+            continue;
+        pending.insert(id);
+        prefetching.insert(id);
+        prefetchPool.start([repository, id]() { repository->loadTags(id); }, ids.count() - i);
+    }
+}
+
+void TagDetailsCache::remove(int id)
+{
+    cache.remove(id);
+}
+
+void TagDetailsCache::tagsLoaded(int id, const QMap<QString, QString> &tags)
+{
+    // Loaded for someone else
+    if (!pending.remove(id))
+        return;
+    prefetching.remove(id);
+    cache.insert(id, new QMap<QString, QString>(tags));
+    emit tagsReady(id, tags);
+}
+
+void TagDetailsCache::astroFileUpdated(const AstroFile &astroFile)
+{
+    remove(astroFile.Id);
+}
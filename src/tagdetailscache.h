@@ -0,0 +1,77 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef TAGDETAILSCACHE_H
+#define TAGDETAILSCACHE_H
+
+#include "astrofile.h"
+#include "taskscheduler.h"
+
+#include <QCache>
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QString>
+
+class FileRepository;
+
+/*!
+ * \brief The TagDetailsCache class
+ * All the keywords of the files last shown in the details, least recently used first
+ * out. The catalog only has the keywords of the tag columns, the others are loaded
+ * from the db when a file is selected, on the thread pool with a read-only connection.
+ * The keywords of the files about to be selected are prefetched, and a prefetch that
+ * did not start yet is dropped by the next one.
+ * Only used from the GUI thread.
+ */
+class TagDetailsCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TagDetailsCache(FileRepository* repository, QObject *parent = nullptr);
+    ~TagDetailsCache();
+
+    // The keywords of the file if they are cached, otherwise loads them and emits tagsReady
+    bool find(int id, QMap<QString, QString>* tags);
+    void load(int id);
+    // Loads the keywords of the files that are not cached, in the order given, in place of the earlier prefetch
+    void prefetch(const QVector<int>& ids);
+    void remove(int id);
+
+signals:
+    void tagsReady(int id, const QMap<QString, QString>& tags);
+
+private slots:
+    void tagsLoaded(int id, const QMap<QString, QString>& tags);
+    void astroFileUpdated(const AstroFile& astroFile);
+
+private:
+    FileRepository* repository;
+    QCache<int, QMap<QString, QString>> cache;
+    QSet<int> pending;
+    QSet<int> prefetching; // Of pending, the ones of the prefetch
+    TaskGroup prefetchPool {InteractivePriority};
+};
+
+#endif // TAGDETAILSCACHE_H
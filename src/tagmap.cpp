@@ -0,0 +1,245 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "tagmap.h"
+
+#include <QHash>
+#include <QReadWriteLock>
+
+#include <algorithm>
+
+static const char* const wellKnownTagNames[WellKnownTagCount] = {
+    "OBJECT", "INSTRUME", "FILTER", "DATE-OBS", "EXPTIME", "GAIN", "CCD-TEMP", "OBJCTRA", "OBJCTDEC",
+    "NAXIS1", "NAXIS2", "BAYERPAT", "BLKLEVEL", "IMAGETYP", "OFFSET", "XBINNING", "YBINNING", "TELESCOP",
+};
+
+namespace
+{
+// The ids of the keys, for the life of the application. Thread safe, the maps are
+// filled by the processors and the repository, and read by the GUI.
+class TagKeys
+{
+public:
+    static TagKeys& instance()
+    {
+        static TagKeys keys;
+        return keys;
+    }
+
+    int find(const QString& key)
+    {
+        QReadLocker locker(&lock);
+        return ids.value(key, -1);
+    }
+
+    int add(const QString& key)
+    {
+        int id = find(key);
+        if (id != -1)
+            return id;
+        QWriteLocker locker(&lock);
+        auto iter = ids.constFind(key);
+        if (iter != ids.constEnd())
+            return iter.value();
+        id = names.count();
+        names.append(key);
+        ids.insert(key, id);
+        return id;
+    }
+
+    QString name(int id)
+    {
+        QReadLocker locker(&lock);
+        return names.value(id);
+    }
+
+private:
+    TagKeys()
+    {
+        for (int i = 0; i < WellKnownTagCount; i++)
+        {
+            names.append(QString::fromLatin1(wellKnownTagNames[i]));
+            ids.insert(names.last(), i);
+        }
+    }
+
+    QReadWriteLock lock;
+    QHash<QString, int> ids;
+    QVector<QString> names;
+};
+}
+
+QString TagMap::const_iterator::key() const
+{
+    return TagKeys::instance().name(entry->key);
+}
+
+TagMap::Data::Data()
+{
+    std::fill(std::begin(slots), std::end(slots), -1);
+}
+
+TagMap::TagMap(const QMap<QString, QString> &map)
+{
+    if (map.isEmpty())
+        return;
+    d = new Data;
+    d->entries.reserve(map.count());
+    for (auto iter = map.constBegin(); iter != map.constEnd(); ++iter)
+        insert(keyId(iter.key()), iter.value());
+}
+
+TagMap::TagMap(std::initializer_list<std::pair<QString, QString>> list)
+{
+    insert(list);
+}
+
+int TagMap::keyId(const QString &key)
+{
+    return TagKeys::instance().add(key);
+}
+
+QString TagMap::keyName(int id)
+{
+    return TagKeys::instance().name(id);
+}
+
+int TagMap::findKeyId(const QString &key)
+{
+    return TagKeys::instance().find(key);
+}
+
+const TagMap::Entry* TagMap::find(int key) const
+{
+    if (!d || key < 0)
+        return nullptr;
+    if (key < WellKnownTagCount)
+    {
+        const int slot = d->slots[key];
+        return slot == -1 ? nullptr : &d->entries.at(slot);
+    }
+    auto iter = std::lower_bound(d->entries.constBegin(), d->entries.constEnd(), key,
+                                 [](const Entry& entry, int key) { return entry.key < key; });
+    return iter != d->entries.constEnd() && iter->key == key ? &*iter : nullptr;
+}
+
+QString TagMap::value(WellKnownTag tag, const QString &defaultValue) const
+{
+    const Entry* entry = find(int(tag));
+    return entry != nullptr ? entry->value : defaultValue;
+}
+
+QString TagMap::value(const QString &key, const QString &defaultValue) const
+{
+    const Entry* entry = find(findKeyId(key));
+    return entry != nullptr ? entry->value : defaultValue;
+}
+
+bool TagMap::contains(WellKnownTag tag) const
+{
+    return find(int(tag)) != nullptr;
+}
+
+bool TagMap::contains(const QString &key) const
+{
+    return find(findKeyId(key)) != nullptr;
+}
+
+TagMap::const_iterator TagMap::constFind(const QString &key) const
+{
+    const Entry* entry = find(findKeyId(key));
+    return entry != nullptr ? const_iterator(entry) : constEnd();
+}
+
+void TagMap::insert(const QString &key, const QString &value)
+{
+    insert(keyId(key), value);
+}
+
+void TagMap::insert(int key, const QString &value)
+{
+    if (!d)
+        d = new Data;
+    auto& entries = d->entries;
+    auto iter = std::lower_bound(entries.begin(), entries.end(), key,
+                                 [](const Entry& entry, int key) { return entry.key < key; });
+    if (iter != entries.end() && iter->key == key)
+    {
+        iter->value = value;
+        return;
+    }
+    entries.insert(iter, {key, value});
+    if (key < WellKnownTagCount)
+        updateSlots();
+}
+
+void TagMap::insert(const TagMap &other)
+{
+    if (!other.d)
+        return;
+    for (auto& entry : other.d->entries)
+        insert(entry.key, entry.value);
+}
+
+void TagMap::insert(std::initializer_list<std::pair<QString, QString>> list)
+{
+    for (auto& pair : list)
+        insert(pair.first, pair.second);
+}
+
+int TagMap::remove(const QString &key)
+{
+    const int id = findKeyId(key);
+    if (find(id) == nullptr)
+        return 0;
+    auto& entries = d->entries;
+    entries.erase(std::find_if(entries.begin(), entries.end(), [id](const Entry& entry) { return entry.key == id; }));
+    if (id < WellKnownTagCount)
+        updateSlots();
+    return 1;
+}
+
+void TagMap::updateSlots()
+{
+    // The well-known keywords come first, the rest of the entries do not move them
+    std::fill(std::begin(d->slots), std::end(d->slots), -1);
+    for (int i = 0; i < d->entries.count() && d->entries.at(i).key < WellKnownTagCount; i++)
+        d->slots[d->entries.at(i).key] = qint8(i);
+}
+
+QStringList TagMap::keys() const
+{
+    QStringList keys;
+    for (auto iter = constBegin(); iter != constEnd(); ++iter)
+        keys.append(iter.key());
+    return keys;
+}
+
+QMap<QString, QString> TagMap::toMap() const
+{
+    QMap<QString, QString> map;
+    for (auto iter = constBegin(); iter != constEnd(); ++iter)
+        map.insert(iter.key(), iter.value());
+    return map;
+}
@@ -0,0 +1,143 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef TAGMAP_H
+#define TAGMAP_H
+
+#include <QMap>
+#include <QSharedData>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <initializer_list>
+#include <utility>
+
+// The keywords most files have, and that are looked up the most. They have a fixed
+// slot in every TagMap.
+enum WellKnownTag
+{
+    TagObject,
+    TagInstrument,
+    TagFilter,
+    TagDateObs,
+    TagExposureTime,
+    TagGain,
+    TagCcdTemp,
+    TagObjectRa,
+    TagObjectDec,
+    TagWidth,
+    TagHeight,
+    TagBayerPattern,
+    TagBlackLevel,
+    TagImageType,
+    TagOffset,
+    TagXBinning,
+    TagYBinning,
+    TagTelescope,
+    WellKnownTagCount
+};
+
+/*!
+ * \brief The TagMap class
+ * The keywords of a file, in place of a QMap<QString, QString>. Keys are interned
+ * to ids shared by every map, and the pairs are kept in one implicitly shared vector
+ * sorted by key id, instead of a tree node per keyword. The well-known keywords have
+ * the first ids and a fixed slot, so looking them up takes no search.
+ *
+ * Iterates in the order of the key ids, not alphabetically, see toMap.
+ */
+class TagMap
+{
+    struct Entry
+    {
+        int key;
+        QString value;
+    };
+
+public:
+    class const_iterator
+    {
+    public:
+        const_iterator(const Entry* entry = nullptr) : entry(entry) {}
+        QString key() const;
+        const QString& value() const { return entry->value; }
+        const QString& operator*() const { return entry->value; }
+        const_iterator& operator++() { ++entry; return *this; }
+        bool operator==(const const_iterator& other) const { return entry == other.entry; }
+        bool operator!=(const const_iterator& other) const { return entry != other.entry; }
+
+    private:
+        const Entry* entry;
+    };
+
+    TagMap() = default;
+    TagMap(const QMap<QString, QString>& map);
+    TagMap(std::initializer_list<std::pair<QString, QString>> list);
+
+    // The id of the key in every map, registered if it is new
+    static int keyId(const QString& key);
+    static QString keyName(int id);
+    static QString keyName(WellKnownTag tag) { return keyName(int(tag)); }
+
+    QString value(WellKnownTag tag, const QString& defaultValue = QString()) const;
+    QString value(const QString& key, const QString& defaultValue = QString()) const;
+    bool contains(WellKnownTag tag) const;
+    bool contains(const QString& key) const;
+    void insert(const QString& key, const QString& value);
+    void insert(const TagMap& other);
+    void insert(std::initializer_list<std::pair<QString, QString>> list);
+    int remove(const QString& key);
+    void clear() { d.reset(); }
+    void swap(TagMap& other) { d.swap(other.d); }
+
+    int count() const { return d ? d->entries.count() : 0; }
+    int size() const { return count(); }
+    bool isEmpty() const { return count() == 0; }
+    QStringList keys() const;
+    QMap<QString, QString> toMap() const;
+
+    const_iterator constBegin() const { return d ? const_iterator(d->entries.constData()) : const_iterator(); }
+    const_iterator constEnd() const { return d ? const_iterator(d->entries.constData() + d->entries.count()) : const_iterator(); }
+    const_iterator begin() const { return constBegin(); }
+    const_iterator end() const { return constEnd(); }
+    const_iterator constFind(const QString& key) const;
+
+private:
+    class Data : public QSharedData
+    {
+    public:
+        Data();
+        QVector<Entry> entries;
+        qint8 slots[WellKnownTagCount]; // Index of the entry of the well-known keyword, -1 if none
+    };
+    QSharedDataPointer<Data> d;
+
+    static int findKeyId(const QString& key);
+    const Entry* find(int key) const;
+    void insert(int key, const QString& value);
+    void updateSlots();
+};
+
+#endif // TAGMAP_H
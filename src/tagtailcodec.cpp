@@ -0,0 +1,256 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "tagtailcodec.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "lz4.h"
+
+// How far back LZ4 finds matches, so a longer dictionary would not be read
+#define TAG_DICTIONARY_MAX_BYTES 65536
+
+/*
+ * A blob is a small header followed by the LZ4 compressed tail:
+ *
+ *  char[2] magic "TT"
+ *  quint8 format, 1
+ *  quint8 reserved
+ *  quint32 dictionary id, 0 without a dictionary
+ *  quint32 uncompressed size
+ *  LZ4 block
+ *
+ * The tail is the UTF-8 keywords and values, each followed by a 0. The blobs of older
+ * versions are a QDataStream of the tail, compressed by qCompress, which starts with
+ * its size in big endian: "TT" would be a size of over a gigabyte.
+ */
+struct TagTailHeader
+{
+    char magic[2];
+    quint8 format;
+    quint8 reserved;
+    quint32 dictionaryId;
+    quint32 rawSize;
+};
+
+static const quint8 tagTailFormat = 1;
+
+static bool isTagTailBlob(const QByteArray& blob)
+{
+    return blob.size() >= int(sizeof(TagTailHeader)) && blob.at(0) == 'T' && blob.at(1) == 'T' && quint8(blob.at(2)) == tagTailFormat;
+}
+
+static QByteArray serialize(const QMap<QString, QString>& tail)
+{
+    QByteArray raw;
+    for (auto iter = tail.constBegin(); iter != tail.constEnd(); ++iter)
+    {
+        raw += iter.key().toUtf8();
+        raw += '\0';
+        raw += iter.value().toUtf8();
+        raw += '\0';
+    }
+    return raw;
+}
+
+static bool deserialize(const char* raw, int size, QMap<QString, QString>& tail)
+{
+    int position = 0;
+    while (position < size)
+    {
+        const char* key = raw + position;
+        const char* keyEnd = static_cast<const char*>(memchr(key, 0, size - position));
+        if (keyEnd == nullptr)
+            return false;
+        const char* value = keyEnd + 1;
+        const char* valueEnd = static_cast<const char*>(memchr(value, 0, raw + size - value));
+        if (valueEnd == nullptr)
+            return false;
+        tail.insert(QString::fromUtf8(key, keyEnd - key), QString::fromUtf8(value, valueEnd - value));
+        position = valueEnd + 1 - raw;
+    }
+    return true;
+}
+
+/*!
+ * \brief TagTailCodec::train
+ * Counts the keyword and value pairs of the tails, and the keywords alone for the values
+ * that change from frame to frame, such as DATE-LOC. The dictionary is the ones that
+ * save the most bytes, those repeated at least twice, with the ones saving the most at
+ * its end, the closest to the tail being compressed.
+ */
+QByteArray TagTailCodec::train(const QList<QMap<QString, QString>>& tails)
+{
+    QHash<QByteArray, int> counts;
+    for (auto& tail : tails)
+    {
+        for (auto iter = tail.constBegin(); iter != tail.constEnd(); ++iter)
+        {
+            const QByteArray key = iter.key().toUtf8() + '\0';
+            counts[key]++;
+            counts[key + iter.value().toUtf8() + '\0']++;
+        }
+    }
+
+    QList<QPair<qint64, QByteArray>> entries;
+    for (auto iter = counts.constBegin(); iter != counts.constEnd(); ++iter)
+    {
+        if (iter.value() >= 2)
+            entries.append(qMakePair(qint64(iter.value()) * iter.key().size(), iter.key()));
+    }
+    std::sort(entries.begin(), entries.end(), [](const QPair<qint64, QByteArray>& a, const QPair<qint64, QByteArray>& b) {
+        return a.first > b.first;
+    });
+
+    QList<QByteArray> chosen;
+    int size = 0;
+    for (auto& entry : entries)
+    {
+        if (size + entry.second.size() > TAG_DICTIONARY_MAX_BYTES)
+            continue;
+        chosen.append(entry.second);
+        size += entry.second.size();
+    }
+
+    QByteArray dictionary;
+    dictionary.reserve(size);
+    for (auto iter = chosen.crbegin(); iter != chosen.crend(); ++iter)
+        dictionary += *iter;
+    return dictionary;
+}
+
+quint32 TagTailCodec::dictionaryId(const QByteArray &dictionary)
+{
+    const QByteArray hash = QCryptographicHash::hash(dictionary, QCryptographicHash::Sha1);
+    // 0 is no dictionary
+    return qMax(1u, qFromBigEndian<quint32>(hash.constData()));
+}
+
+quint32 TagTailCodec::dictionaryIdOf(const QByteArray &blob)
+{
+    if (!isTagTailBlob(blob))
+        return 0;
+    TagTailHeader header;
+    memcpy(&header, blob.constData(), sizeof(TagTailHeader));
+    return header.dictionaryId;
+}
+
+void TagTailCodec::addDictionary(const QByteArray &dictionary)
+{
+    if (dictionary.isEmpty())
+        return;
+    QWriteLocker locker(&lock);
+    currentId = dictionaryId(dictionary);
+    dictionaries.insert(currentId, dictionary);
+}
+
+bool TagTailCodec::hasDictionary(quint32 id) const
+{
+    QReadLocker locker(&lock);
+    return id == 0 || dictionaries.contains(id);
+}
+
+quint32 TagTailCodec::currentDictionaryId() const
+{
+    QReadLocker locker(&lock);
+    return currentId;
+}
+
+QByteArray TagTailCodec::encode(const QMap<QString, QString> &tail) const
+{
+    if (tail.isEmpty())
+        return QByteArray();
+
+    const QByteArray raw = serialize(tail);
+    QReadLocker locker(&lock);
+    TagTailHeader header = {{'T', 'T'}, tagTailFormat, 0, currentId, quint32(raw.size())};
+    const int bound = LZ4_compressBound(raw.size());
+    QByteArray out(sizeof(TagTailHeader) + bound, Qt::Uninitialized);
+    memcpy(out.data(), &header, sizeof(TagTailHeader));
+
+    int compressedSize;
+    if (currentId == 0)
+    {
+        compressedSize = LZ4_compress_default(raw.constData(), out.data() + sizeof(TagTailHeader), raw.size(), bound);
+    }
+    else
+    {
+        const QByteArray dictionary = dictionaries.value(currentId);
+        LZ4_stream_t stream;
+        LZ4_initStream(&stream, sizeof(stream));
+        LZ4_loadDict(&stream, dictionary.constData(), dictionary.size());
+        compressedSize = LZ4_compress_fast_continue(&stream, raw.constData(), out.data() + sizeof(TagTailHeader), raw.size(), bound, 1);
+    }
+    if (compressedSize <= 0)
+    {
+        qDebug() << "LZ4 tag compression failed";
+        return QByteArray();
+    }
+    out.resize(sizeof(TagTailHeader) + compressedSize);
+    return out;
+}
+
+bool TagTailCodec::decode(const QByteArray &blob, QMap<QString, QString> &tail) const
+{
+    if (blob.isEmpty())
+        return true;
+
+    if (!isTagTailBlob(blob))
+    {
+        QDataStream stream(qUncompress(blob));
+        stream.setVersion(QDataStream::Qt_6_0);
+        stream >> tail;
+        return stream.status() == QDataStream::Ok;
+    }
+
+    TagTailHeader header;
+    memcpy(&header, blob.constData(), sizeof(TagTailHeader));
+    QReadLocker locker(&lock);
+    if ((header.dictionaryId != 0 && !dictionaries.contains(header.dictionaryId)) || header.rawSize > quint32(std::numeric_limits<int>::max()))
+        return false;
+
+    QByteArray raw(int(header.rawSize), Qt::Uninitialized);
+    const char* compressed = blob.constData() + sizeof(TagTailHeader);
+    const int compressedSize = blob.size() - int(sizeof(TagTailHeader));
+    int decompressed;
+    if (header.dictionaryId == 0)
+    {
+        decompressed = LZ4_decompress_safe(compressed, raw.data(), compressedSize, raw.size());
+    }
+    else
+    {
+        const QByteArray dictionary = dictionaries.value(header.dictionaryId);
+        decompressed = LZ4_decompress_safe_usingDict(compressed, raw.data(), compressedSize, raw.size(), dictionary.constData(), dictionary.size());
+    }
+    if (decompressed != raw.size())
+        return false;
+    return deserialize(raw.constData(), raw.size(), tail);
+}
@@ -0,0 +1,74 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef TAGTAILCODEC_H
+#define TAGTAILCODEC_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QReadWriteLock>
+#include <QString>
+
+/*!
+ * \brief The TagTailCodec class
+ * Compresses the keywords of a file that have no column of their own, its tag tail,
+ * into one small blob. The HISTORY, COMMENT and capture program keywords repeat from
+ * frame to frame of the same rig, so a tail is compressed with LZ4 against a shared
+ * dictionary of the keywords and values that are frequent in the catalog, see train.
+ *
+ * Each blob names its dictionary by an id computed from its bytes, so blobs can be
+ * copied to another catalog together with their dictionary. Dictionaries are never
+ * dropped, and blobs are read with the one they name.
+ *
+ * Thread safe.
+ */
+class TagTailCodec
+{
+public:
+    // The dictionary that repeats the most of the tails, up to the 64 KB that LZ4 reaches back
+    static QByteArray train(const QList<QMap<QString, QString>>& tails);
+    static quint32 dictionaryId(const QByteArray& dictionary);
+    // 0 for the blobs without a dictionary, and the qCompress blobs of older versions
+    static quint32 dictionaryIdOf(const QByteArray& blob);
+
+    // The dictionary added last is the one encode uses
+    void addDictionary(const QByteArray& dictionary);
+    bool hasDictionary(quint32 id) const;
+    // 0 without a dictionary
+    quint32 currentDictionaryId() const;
+
+    // Empty for an empty tail
+    QByteArray encode(const QMap<QString, QString>& tail) const;
+    // False when the blob is damaged, or its dictionary was not added
+    bool decode(const QByteArray& blob, QMap<QString, QString>& tail) const;
+
+private:
+    mutable QReadWriteLock lock;
+    QHash<quint32, QByteArray> dictionaries;
+    quint32 currentId = 0;
+};
+
+#endif // TAGTAILCODEC_H
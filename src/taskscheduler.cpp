@@ -0,0 +1,328 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "taskscheduler.h"
+#include "metrics.h"
+#include "threadpriority.h"
+
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QFile>
+
+#if defined(Q_OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The worker running on this thread, -1 on the other threads
+static thread_local int currentWorker = -1;
+
+TaskScheduler& TaskScheduler::instance()
+{
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+TaskScheduler::TaskScheduler()
+{
+    const int count = qMax(1, QThread::idealThreadCount());
+    nodes = numaNodes();
+    for (int i = 0; i < count; i++)
+    {
+        workers.push_back(std::make_unique<Worker>());
+        // Consecutive workers on the same node, so each node gets its share
+        workers.back()->node = nodes.isEmpty() ? 0 : i * nodes.count() / count;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        QThread* thread = QThread::create([this, i]() { runWorker(i); });
+        thread->setObjectName(QString("scheduler-%1").arg(i));
+        workers[i]->thread = thread;
+        thread->start();
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        QMutexLocker locker(&sleepMutex);
+        stopping = true;
+        wake.wakeAll();
+    }
+    for (auto& worker : workers)
+    {
+        worker->thread->wait();
+        delete worker->thread;
+    }
+}
+
+int TaskScheduler::workerCount() const
+{
+    return int(workers.size());
+}
+
+void TaskScheduler::submit(std::function<void()> task, RequestPriority priority, bool background)
+{
+    const int index = currentWorker >= 0 ? currentWorker : int(nextWorker++ % workers.size());
+    {
+        Worker& worker = *workers[index];
+        QMutexLocker locker(&worker.mutex);
+        worker.deques[priority].push_back({std::move(task), background});
+    }
+    pending[priority]++;
+
+    // A worker about to sleep holds sleepMutex until it waits, so it sees the task or the wake
+    QMutexLocker locker(&sleepMutex);
+    if (sleeping > 0)
+        wake.wakeOne();
+}
+
+bool TaskScheduler::hasPending() const
+{
+    for (int priority = 0; priority < RequestPriorityCount; priority++)
+    {
+        if (pending[priority] > 0)
+            return true;
+    }
+    return false;
+}
+
+void TaskScheduler::runWorker(int index)
+{
+    currentWorker = index;
+#if defined(Q_OS_LINUX)
+    if (!nodes.isEmpty())
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu : nodes.at(workers[index]->node))
+            CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+
+    bool backgroundApplied = false;
+    Task task;
+    while (!stopping)
+    {
+        if (!take(index, task))
+        {
+            QMutexLocker locker(&sleepMutex);
+            if (stopping || hasPending())
+                continue;
+            sleeping++;
+            wake.wait(&sleepMutex);
+            sleeping--;
+            continue;
+        }
+
+        // Changed only between tasks of a different kind, the calls are not free
+        if (task.background != backgroundApplied)
+        {
+            ThreadPriority::setBackground(task.background);
+            backgroundApplied = task.background;
+        }
+        task.run();
+        task.run = nullptr;
+    }
+}
+
+/*!
+ * \brief TaskScheduler::take
+ * The highest priority with a task waiting, from the deque of the worker if it has one,
+ * stolen otherwise.
+ */
+bool TaskScheduler::take(int index, Task &task)
+{
+    Worker& worker = *workers[index];
+    for (int priority = 0; priority < RequestPriorityCount; priority++)
+    {
+        if (pending[priority] <= 0)
+            continue;
+        {
+            QMutexLocker locker(&worker.mutex);
+            std::deque<Task>& deque = worker.deques[priority];
+            if (!deque.empty())
+            {
+                task = std::move(deque.back());
+                deque.pop_back();
+                pending[priority]--;
+                return true;
+            }
+        }
+        if (steal(index, priority, task))
+            return true;
+    }
+    return false;
+}
+
+bool TaskScheduler::steal(int index, int priority, Task &task)
+{
+    static std::atomic<qint64>& stealCount = Metrics::counter("scheduler.steals");
+    const int count = int(workers.size());
+    const int node = workers[index]->node;
+    // The workers of the same node first
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int offset = 1; offset < count; offset++)
+        {
+            Worker& victim = *workers[(index + offset) % count];
+            if ((victim.node == node) != (pass == 0))
+                continue;
+            QMutexLocker locker(&victim.mutex);
+            std::deque<Task>& deque = victim.deques[priority];
+            if (deque.empty())
+                continue;
+            task = std::move(deque.front());
+            deque.pop_front();
+            pending[priority]--;
+            stealCount++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * \brief TaskScheduler::numaNodes
+ * The cpus of each online node, from sysfs. Empty on a machine with a single node,
+ * and on the other platforms.
+ */
+QList<QList<int>> TaskScheduler::numaNodes()
+{
+    QList<QList<int>> nodes;
+#if defined(Q_OS_LINUX)
+    const QStringList nodeDirectories = QDir("/sys/devices/system/node").entryList({"node*"}, QDir::Dirs, QDir::Name);
+    for (auto& directory : nodeDirectories)
+    {
+        QFile cpuList(QString("/sys/devices/system/node/%1/cpulist").arg(directory));
+        if (!cpuList.open(QIODevice::ReadOnly))
+            continue;
+        // Like "0-15,32-47"
+        QList<int> cpus;
+        for (auto& range : QString::fromLatin1(cpuList.readAll()).trimmed().split(',', Qt::SkipEmptyParts))
+        {
+            const QStringList bounds = range.split('-');
+            const int first = bounds.first().toInt();
+            const int last = bounds.last().toInt();
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.append(cpu);
+        }
+        if (!cpus.isEmpty())
+            nodes.append(cpus);
+    }
+#endif
+    if (nodes.count() < 2)
+        nodes.clear();
+    return nodes;
+}
+
+TaskGroup::TaskGroup(RequestPriority priority) : priority(priority)
+{
+    maxThreads = TaskScheduler::instance().workerCount();
+}
+
+TaskGroup::~TaskGroup()
+{
+    clear();
+    waitForDone();
+}
+
+void TaskGroup::start(std::function<void()> task, int taskPriority)
+{
+    QMutexLocker locker(&mutex);
+    waiting[-taskPriority].push_back(std::move(task));
+    dispatch();
+}
+
+void TaskGroup::clear()
+{
+    QMutexLocker locker(&mutex);
+    waiting.clear();
+    if (active == 0)
+        done.wakeAll();
+}
+
+bool TaskGroup::waitForDone(int msecs)
+{
+    const QDeadlineTimer deadline = msecs < 0 ? QDeadlineTimer(QDeadlineTimer::Forever) : QDeadlineTimer(msecs);
+    QMutexLocker locker(&mutex);
+    while (active > 0 || !waiting.isEmpty())
+    {
+        if (!done.wait(&mutex, deadline))
+            return false;
+    }
+    return true;
+}
+
+void TaskGroup::setMaxThreadCount(int count)
+{
+    QMutexLocker locker(&mutex);
+    maxThreads = qMax(1, count);
+    dispatch();
+}
+
+int TaskGroup::maxThreadCount() const
+{
+    QMutexLocker locker(&mutex);
+    return maxThreads;
+}
+
+int TaskGroup::activeThreadCount() const
+{
+    QMutexLocker locker(&mutex);
+    return active;
+}
+
+void TaskGroup::setBackground(bool background)
+{
+    this->background = background;
+}
+
+// Hands the waiting tasks to the scheduler, up to maxThreads. The caller must hold mutex.
+void TaskGroup::dispatch()
+{
+    while (active < maxThreads && !waiting.isEmpty())
+    {
+        auto first = waiting.begin();
+        std::function<void()> task = std::move(first->front());
+        first->pop_front();
+        if (first->empty())
+            waiting.erase(first);
+        active++;
+        TaskScheduler::instance().submit([this, task = std::move(task)]() {
+            task();
+            taskDone();
+        }, priority, background);
+    }
+}
+
+void TaskGroup::taskDone()
+{
+    QMutexLocker locker(&mutex);
+    active--;
+    dispatch();
+    if (active == 0 && waiting.isEmpty())
+        done.wakeAll();
+}
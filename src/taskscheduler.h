@@ -0,0 +1,133 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include "repositoryrequest.h"
+
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/*!
+ * \brief The TaskScheduler class
+ * The worker threads shared by the CPU work of the app: the header phases and decoding
+ * of the ingest, the tiles of previews and the frames blink prefetches. There is one
+ * worker per core, each with a deque per RequestPriority. A worker runs the newest task
+ * of its own deque, and when it has none steals the oldest task of another worker, of
+ * its NUMA node first. No task runs while one of a higher priority is waiting anywhere.
+ *
+ * The clients submit through a TaskGroup. Listing directories and reading files stay on
+ * pools of their own, sized for their volumes, since a worker blocked on I/O holds a core.
+ *
+ * On Linux machines with more than one NUMA node, the workers are spread over the nodes
+ * and kept on the cores of their node, so the frames a worker decodes stay in its memory.
+ */
+class TaskScheduler
+{
+public:
+    static TaskScheduler& instance();
+    ~TaskScheduler();
+
+    // Thread safe. From a worker, the task goes to the deque of that worker.
+    void submit(std::function<void()> task, RequestPriority priority, bool background);
+    int workerCount() const;
+
+private:
+    struct Task
+    {
+        std::function<void()> run;
+        bool background = false;
+    };
+
+    struct Worker
+    {
+        QMutex mutex;
+        std::deque<Task> deques[RequestPriorityCount];
+        QThread* thread = nullptr;
+        int node = 0;
+    };
+
+    TaskScheduler();
+    void runWorker(int index);
+    bool take(int index, Task& task);
+    bool steal(int index, int priority, Task& task);
+    bool hasPending() const;
+    static QList<QList<int>> numaNodes();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    QList<QList<int>> nodes; // The cpus of each node, empty without NUMA
+    std::atomic<int> pending[RequestPriorityCount] = {};
+    std::atomic<unsigned> nextWorker = 0;
+    std::atomic<bool> stopping = false;
+
+    QMutex sleepMutex;
+    QWaitCondition wake;
+    int sleeping = 0;
+};
+
+/*!
+ * \brief The TaskGroup class
+ * The tasks of one client of the TaskScheduler, used like a QThreadPool of its own. At
+ * most maxThreadCount of them run at once, the waiting ones by their priority within
+ * the group, highest first, and they can be cleared and waited for. Thread safe.
+ */
+class TaskGroup
+{
+public:
+    explicit TaskGroup(RequestPriority priority = IngestPriority);
+    ~TaskGroup();
+
+    void start(std::function<void()> task, int priority = 0);
+    // Removes the tasks that did not start yet
+    void clear();
+    bool waitForDone(int msecs = -1);
+    void setMaxThreadCount(int count);
+    int maxThreadCount() const;
+    int activeThreadCount() const;
+    // The tasks run at background CPU and I/O priority, see ThreadPriority
+    void setBackground(bool background);
+
+private:
+    void dispatch();
+    void taskDone();
+
+    const RequestPriority priority;
+    mutable QMutex mutex;
+    QWaitCondition done;
+    QMap<int, std::deque<std::function<void()>>> waiting; // By the negated priority
+    int maxThreads;
+    int active = 0;
+    std::atomic<bool> background = false;
+};
+
+#endif // TASKSCHEDULER_H
@@ -0,0 +1,14 @@
+# astrocat-tests, QTest checks of the catalog db
+
+QT += core gui sql concurrent testlib
+QT -= widgets
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = astrocat-tests
+
+SOURCES += \
+    repositorytest.cpp
+
+include(../engine.pri)
@@ -0,0 +1,173 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "filerecord.h"
+#include "filerepository.h"
+
+#include <QCoreApplication>
+#include <QSettings>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <memory>
+
+#define TEST_ROOT "/archive/M31"
+
+class RepositoryTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void attachSubfolderOfDetached();
+    void purgeKeepsAttachedSubfolder();
+
+private:
+    QTemporaryDir dir;
+    std::unique_ptr<FileRepository> repository;
+
+    void addFile(const QString& fullPath, double exposure);
+    QStringList exportedPaths();
+    QStringList storedPaths();
+    int integrationFrames();
+};
+
+void RepositoryTest::initTestCase()
+{
+    // The settings of the tests are kept apart from the ones of the app
+    QCoreApplication::setOrganizationName("AstrocatTests");
+    QCoreApplication::setApplicationName("astrocat-tests");
+    QVERIFY(dir.isValid());
+}
+
+void RepositoryTest::init()
+{
+    QSettings().setValue("DetachedFolderDays", 30);
+    FileRepository::setDatabaseFilePath(dir.filePath(QString("%1.db").arg(QTest::currentTestFunction())));
+    repository.reset(new FileRepository());
+    repository->initialize();
+
+    addFile(TEST_ROOT "/Lights/Ha/frame1.fits", 300);
+    addFile(TEST_ROOT "/Lights/OIII/frame2.fits", 300);
+    addFile(TEST_ROOT "/Flats/flat1.fits", 1);
+    addFile(TEST_ROOT "/notes.fits", 60);
+}
+
+void RepositoryTest::cleanup()
+{
+    repository.reset();
+    QSettings().clear();
+}
+
+void RepositoryTest::addFile(const QString &fullPath, double exposure)
+{
+    FileRecord record;
+    record.FullPath = fullPath;
+    record.CanonicalDirectory = record.absolutePath();
+    record.Size = 2880;
+    record.LastModifiedTime = QDateTime::currentMSecsSinceEpoch();
+    AstroFile astroFile(record);
+    astroFile.processStatus = AstroFileProcessed;
+    astroFile.tagStatus = TagExtracted;
+    astroFile.thumbnailStatus = ThumbnailLoaded;
+    astroFile.Tags.insert({{"OBJECT", "M31"}, {"EXPTIME", QString::number(exposure)}});
+    repository->addOrUpdateAstrofiles({astroFile});
+}
+
+// The files shown, as the export reads them
+QStringList RepositoryTest::exportedPaths()
+{
+    const QString path = dir.filePath("export.csv");
+    if (repository->exportCatalog(path) < 0)
+        return {};
+    QFile file(path);
+    file.open(QIODevice::ReadOnly);
+    QStringList paths;
+    file.readLine();
+    while (!file.atEnd())
+        paths.append(QString::fromUtf8(file.readLine()).section(',', 1, 1));
+    paths.sort();
+    return paths;
+}
+
+// Every row, shown or hidden
+QStringList RepositoryTest::storedPaths()
+{
+    QStringList paths;
+    QSqlQuery query("SELECT FullPath FROM fits ORDER BY FullPath");
+    while (query.next())
+        paths.append(query.value(0).toString());
+    return paths;
+}
+
+int RepositoryTest::integrationFrames()
+{
+    int frames = 0;
+    for (auto& stats : repository->integrationStats())
+        frames += stats.FrameCount;
+    return frames;
+}
+
+void RepositoryTest::attachSubfolderOfDetached()
+{
+    repository->detachFolder(TEST_ROOT);
+    QCOMPARE(exportedPaths(), QStringList());
+    QCOMPARE(integrationFrames(), 0);
+
+    // Adding back a subfolder shows its files, and keeps the ones of its siblings hidden
+    repository->attachFolder(TEST_ROOT "/Lights/Ha");
+    QCOMPARE(exportedPaths(), QStringList({TEST_ROOT "/Lights/Ha/frame1.fits"}));
+    QCOMPARE(storedPaths().count(), 4);
+    QCOMPARE(integrationFrames(), 1);
+
+    // Removing it hides it again, adding back the whole folder shows everything
+    repository->detachFolder(TEST_ROOT "/Lights/Ha");
+    QCOMPARE(exportedPaths(), QStringList());
+    repository->attachFolder(TEST_ROOT);
+    QCOMPARE(exportedPaths(), storedPaths());
+    QCOMPARE(storedPaths().count(), 4);
+    QCOMPARE(integrationFrames(), 4);
+}
+
+void RepositoryTest::purgeKeepsAttachedSubfolder()
+{
+    repository->detachFolder(TEST_ROOT);
+    repository->attachFolder(TEST_ROOT "/Lights");
+    repository->detachFolder(TEST_ROOT "/Lights/OIII");
+
+    // Purged by the maintenance once expired, only the hidden files are deleted
+    QSettings().setValue("DetachedFolderDays", 0);
+    QTest::qWait(2);
+    repository->runMaintenance();
+    QCOMPARE(storedPaths(), QStringList({TEST_ROOT "/Lights/Ha/frame1.fits"}));
+    QCOMPARE(exportedPaths(), QStringList({TEST_ROOT "/Lights/Ha/frame1.fits"}));
+    QCOMPARE(integrationFrames(), 1);
+}
+
+QTEST_GUILESS_MAIN(RepositoryTest)
+
+#include "repositorytest.moc"
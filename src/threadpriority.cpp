@@ -0,0 +1,73 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "threadpriority.h"
+
+#include <QtGlobal>
+
+#if defined(Q_OS_LINUX)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(Q_OS_MAC)
+#include <pthread.h>
+#include <pthread/qos.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+#if defined(Q_OS_LINUX)
+// From linux/ioprio.h, which the C libraries do not wrap. The I/O classes are only
+// honored by the BFQ and CFQ schedulers, the others treat every thread the same.
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_CLASS_BE         2
+#define IOPRIO_CLASS_IDLE       3
+#define IOPRIO_WHO_PROCESS      1
+#define IOPRIO_DEFAULT_LEVEL    4
+#endif
+
+bool ThreadPriority::setBackground(bool background)
+{
+#if defined(Q_OS_LINUX)
+    // The scheduling policy and the I/O priority of a thread id only apply to that thread
+    const pid_t thread = syscall(SYS_gettid);
+    bool applied = true;
+    const sched_param param = {};
+    if (sched_setscheduler(thread, background ? SCHED_BATCH : SCHED_OTHER, &param) != 0)
+        applied = false;
+    const int ioClass = background ? IOPRIO_CLASS_IDLE : IOPRIO_CLASS_BE;
+    const int ioLevel = background ? 0 : IOPRIO_DEFAULT_LEVEL;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, thread, (ioClass << IOPRIO_CLASS_SHIFT) | ioLevel) != 0)
+        applied = false;
+    return applied;
+#elif defined(Q_OS_MAC)
+    return pthread_set_qos_class_self_np(background ? QOS_CLASS_BACKGROUND : QOS_CLASS_DEFAULT, 0) == 0;
+#elif defined(Q_OS_WIN)
+    // Lowers the I/O and memory priority of the thread too
+    return SetThreadPriority(GetCurrentThread(), background ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END);
+#else
+    Q_UNUSED(background);
+    return false;
+#endif
+}
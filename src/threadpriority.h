@@ -0,0 +1,45 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef THREADPRIORITY_H
+#define THREADPRIORITY_H
+
+/*!
+ * \brief The ThreadPriority class
+ * The CPU and I/O priority of the calling thread. In the background a thread yields
+ * the cores and the disk to the rest of the system: the batch policy and the idle I/O
+ * class on Linux, the background QoS class on macOS, and the background mode of
+ * SetThreadPriority on Windows.
+ *
+ * Unlike a raised nice value, an unprivileged Linux thread can leave the batch policy
+ * again, so the threads of the TaskScheduler can switch between tasks of both kinds.
+ */
+class ThreadPriority
+{
+public:
+    // Returns false if the platform refused
+    static bool setBackground(bool background);
+};
+
+#endif // THREADPRIORITY_H
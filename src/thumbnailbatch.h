@@ -0,0 +1,45 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+
+#ifndef THUMBNAILBATCH_H
+#define THUMBNAILBATCH_H
+
+#include <QImage>
+#include <QSize>
+#include <QVector>
+
+/*!
+ * \brief The ThumbnailBatch struct
+ * Thumbnails of one level of the pyramid loaded from the repository in one query.
+ * images[i] is the thumbnail of ids[i]. Ids without a stored thumbnail are left out.
+ * Once the ThumbnailCache has prepared the batch, the images are scaled to fit size.
+ */
+struct ThumbnailBatch
+{
+    int level = 0;
+    QSize size; // Empty until the images are scaled
+    QVector<int> ids;
+    QVector<QImage> images;
+};
+
+#endif // THUMBNAILBATCH_H
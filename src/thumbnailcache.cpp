@@ -24,7 +24,10 @@
 
 #include "thumbnailcache.h"
 
-#define MAX_REQUEST 5
+// Waiting requests of the view, beyond which the ones of rows scrolled out are dropped
+#define MAX_REQUEST 64
+// Thumbnails loaded with one query of the repository
+#define MAX_BATCH 32
 
 ThumbnailCache::ThumbnailCache(QObject *parent) : QThread(parent)
 {
@@ -36,20 +39,77 @@ void ThumbnailCache::run()
     while (!isCanceled)
     {
         mutex.lock();
-        if (requests.isEmpty())
+        if (requests.isEmpty() && prefetches.isEmpty())
             bufferNotEmpty.wait(&mutex);
-        mutex.unlock();
 
         if (isCanceled)
+        {
+            mutex.unlock();
             break;
+        }
+        if (requests.isEmpty() && prefetches.isEmpty())
+        {
+            mutex.unlock();
+            continue;
+        }
 
-        mutex.lock();
-        int id = requests.pop();
-        AstroFile a;
-        a.Id = id;
-        emit dbLoadThumbnail(a);
+        // The level of the next request, and the other waiting requests of that level
+        const int level = !requests.isEmpty() ? requests.last().second : prefetches.first().second;
+        QVector<int> ids;
+        takeRequests(requests, true, level, ids);
+        takeRequests(prefetches, false, level, ids);
+        batchSize = iconSize;
         mutex.unlock();
+
+        emit dbLoadThumbnails(ids, level);
+    }
+}
+
+/*!
+ * \brief ThumbnailCache::takeRequests
+ * Moves the requests of the level from the queue to ids, up to MAX_BATCH ids.
+ * The caller must hold the mutex.
+ */
+void ThumbnailCache::takeRequests(QList<Request> &queue, bool newestFirst, int level, QVector<int> &ids)
+{
+    if (newestFirst)
+    {
+        for (int i = queue.count() - 1; i >= 0 && ids.count() < MAX_BATCH; i--)
+        {
+            if (queue.at(i).second == level)
+                ids.append(queue.takeAt(i).first);
+        }
     }
+    else
+    {
+        for (int i = 0; i < queue.count() && ids.count() < MAX_BATCH; )
+        {
+            if (queue.at(i).second == level)
+                ids.append(queue.takeAt(i).first);
+            else
+                i++;
+        }
+    }
+}
+
+/*!
+ * \brief ThumbnailCache::prepareThumbnails
+ * Scales the loaded thumbnails to the icon size the batch was asked for. The level of
+ * the pyramid is less than twice the icon size, so this is a single smooth scale.
+ */
+void ThumbnailCache::prepareThumbnails(const ThumbnailBatch &batch)
+{
+    ThumbnailBatch prepared = batch;
+    prepared.size = batchSize;
+    if (!batchSize.isEmpty())
+    {
+        for (QImage& image : prepared.images)
+        {
+            if (!image.isNull() && image.size() != image.size().scaled(batchSize, Qt::KeepAspectRatio))
+                image = image.scaled(batchSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        }
+    }
+    emit thumbnailsReady(prepared);
 }
 
 void ThumbnailCache::cancel()
@@ -62,19 +122,54 @@ void ThumbnailCache::cancel()
 
 void ThumbnailCache::enqueueLoadThumbnail(const AstroFile &astroFile)
 {
-    mutex.lock();
-    int requestsSize = requests.size();
-    if (requests.contains(astroFile.Id))
-    {
-        mutex.unlock();
+    QMutexLocker locker(&mutex);
+    Request request(astroFile.Id, astroFile.thumbnailLevel);
+    if (requests.contains(request))
         return;
-    }
-    if (requestsSize >= MAX_REQUEST)
+    prefetches.removeOne(request);
+
+    if (requests.count() >= MAX_REQUEST)
     {
-        requests.removeLast();
-        qDebug()<<"Dropping one request";
+        // The oldest request of a row that was scrolled out of view
+        for (int i = 0; i < requests.count(); i++)
+        {
+            if (!visibleIds.contains(requests.at(i).first))
+            {
+                requests.removeAt(i);
+                break;
+            }
+        }
     }
-    requests.push(astroFile.Id);
+    requests.append(request);
     bufferNotEmpty.wakeOne();
-    mutex.unlock();
+}
+
+/*!
+ * \brief ThumbnailCache::prefetchThumbnails
+ * Replaces the waiting prefetches, which were for an earlier scroll position.
+ */
+void ThumbnailCache::prefetchThumbnails(const QList<AstroFile> &astroFiles)
+{
+    QMutexLocker locker(&mutex);
+    prefetches.clear();
+    for (auto& astroFile : astroFiles)
+    {
+        Request request(astroFile.Id, astroFile.thumbnailLevel);
+        if (!requests.contains(request))
+            prefetches.append(request);
+    }
+    if (!prefetches.isEmpty())
+        bufferNotEmpty.wakeOne();
+}
+
+void ThumbnailCache::setIconSize(const QSize &size)
+{
+    QMutexLocker locker(&mutex);
+    iconSize = size;
+}
+
+void ThumbnailCache::setVisibleIds(const QList<int> &ids)
+{
+    QMutexLocker locker(&mutex);
+    visibleIds = QSet<int>(ids.begin(), ids.end());
 }
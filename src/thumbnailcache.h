@@ -26,13 +26,29 @@
 #define THUMBNAILCACHE_H
 
 #include "astrofile.h"
+#include "thumbnailbatch.h"
 
+#include <QList>
 #include <QObject>
-#include <QStack>
+#include <QPair>
+#include <QSet>
+#include <QSize>
 #include <QThread>
+#include <QVector>
 #include <QWaitCondition>
 #include <QMutex>
 
+/*!
+ * \brief The ThumbnailCache class
+ * Loads thumbnails from the repository on its own thread. Thumbnails asked for by the
+ * view are loaded first, newest first. Prefetched thumbnails of the rows about to be
+ * scrolled in are loaded after them, nearest first. Waiting requests of the same level
+ * are loaded together, in one query of the repository, and scaled to the icon size on
+ * this thread, so the GUI thread only makes pixmaps of them.
+ *
+ * Only requests of rows that are not visible anymore are dropped when too many are
+ * waiting. The thumbnails themselves are kept by the FileViewModel.
+ */
 class ThumbnailCache : public QThread
 {
     Q_OBJECT
@@ -41,15 +57,29 @@ public:
     void cancel();
 
 //public slots:
+    // Thread safe
     void enqueueLoadThumbnail(const AstroFile& astroFile);
+    void prefetchThumbnails(const QList<AstroFile>& astroFiles);
+    void setVisibleIds(const QList<int>& ids);
+    void setIconSize(const QSize& size);
+
+    // Called on this thread by the repository from dbLoadThumbnails
+    void prepareThumbnails(const ThumbnailBatch& batch);
 signals:
-    void dbLoadThumbnail(const AstroFile& astroFile);
+    void thumbnailsReady(const ThumbnailBatch& batch);
+    void dbLoadThumbnails(const QVector<int>& ids, int level);
 
 private:
-    QStack<int> requests;
+    typedef QPair<int, int> Request; // Id and thumbnail level
+    QList<Request> requests;
+    QList<Request> prefetches;
+    QSet<int> visibleIds;
+    QSize iconSize;
+    QSize batchSize; // Icon size when the loading batch was taken, only used on this thread
     QWaitCondition bufferNotEmpty;
     QMutex mutex;
     volatile bool isCanceled = false;
+    void takeRequests(QList<Request>& queue, bool newestFirst, int level, QVector<int>& ids);
 
     // QThread interface
 protected:
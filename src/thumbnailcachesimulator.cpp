@@ -0,0 +1,369 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "thumbnailcachesimulator.h"
+
+#include <QHash>
+#include <QSet>
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <list>
+
+// Loads served together, like the waiting requests of a level the ThumbnailCache takes
+#define SIMULATED_LOAD_BATCH 32
+// Of the budget, the protected segment of SegmentedLru
+#define PROTECTED_SEGMENT_FRACTION 0.8
+
+namespace
+{
+
+// A level of a thumbnail at an icon size
+quint64 keyOf(int id, int level, int size)
+{
+    return (quint64(quint32(id)) << 24) | (quint64(level & 0xf) << 20) | quint64(size & 0xfffff);
+}
+
+// Bytes of the icon, square at most, like the kilobytes PixmapCache counts
+qint64 costOf(quint64 key)
+{
+    const qint64 size = qint64(key & 0xfffff);
+    return qMax<qint64>(1, size * size * 4);
+}
+
+/*
+ * The cache of the view, least recently used first out. FIFO does not move what is
+ * hit, and the segmented one keeps what was hit twice in a protected segment.
+ */
+class SimulatedCache
+{
+public:
+    SimulatedCache(ThumbnailCacheSimulator::Policy policy, qint64 budget)
+        : policy(policy), budget(budget), protectedBudget(policy == ThumbnailCacheSimulator::SegmentedLru ? qint64(budget * PROTECTED_SEGMENT_FRACTION) : 0)
+    {
+    }
+
+    bool find(quint64 key)
+    {
+        auto found = entries.find(key);
+        if (found == entries.end())
+            return false;
+        Entry& entry = found.value();
+        if (policy == ThumbnailCacheSimulator::LeastRecentlyUsed)
+        {
+            probation.splice(probation.end(), probation, entry.position);
+        }
+        else if (policy == ThumbnailCacheSimulator::SegmentedLru)
+        {
+            if (entry.isProtected)
+            {
+                protectedSegment.splice(protectedSegment.end(), protectedSegment, entry.position);
+            }
+            else
+            {
+                probation.erase(entry.position);
+                protectedSegment.push_back(key);
+                entry.position = std::prev(protectedSegment.end());
+                entry.isProtected = true;
+                protectedBytes += costOf(key);
+                // The least recently used of the protected segment goes back on probation
+                while (protectedBytes > protectedBudget && protectedSegment.size() > 1)
+                {
+                    const quint64 demoted = protectedSegment.front();
+                    protectedSegment.pop_front();
+                    protectedBytes -= costOf(demoted);
+                    probation.push_back(demoted);
+                    Entry& demotedEntry = entries[demoted];
+                    demotedEntry.position = std::prev(probation.end());
+                    demotedEntry.isProtected = false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool contains(quint64 key) const
+    {
+        return entries.contains(key);
+    }
+
+    // Returns the keys evicted to make room
+    void insert(quint64 key, QVector<quint64>& evicted)
+    {
+        if (entries.contains(key))
+            return;
+        probation.push_back(key);
+        entries.insert(key, {std::prev(probation.end()), false});
+        used += costOf(key);
+        while (used > budget && !probation.empty())
+        {
+            const quint64 victim = probation.front();
+            probation.pop_front();
+            entries.remove(victim);
+            used -= costOf(victim);
+            evicted.append(victim);
+        }
+        while (used > budget && !protectedSegment.empty())
+        {
+            const quint64 victim = protectedSegment.front();
+            protectedSegment.pop_front();
+            entries.remove(victim);
+            used -= costOf(victim);
+            protectedBytes -= costOf(victim);
+            evicted.append(victim);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::list<quint64>::iterator position;
+        bool isProtected;
+    };
+
+    const ThumbnailCacheSimulator::Policy policy;
+    const qint64 budget;
+    const qint64 protectedBudget;
+    std::list<quint64> probation; // Least recently used, or first in, first
+    std::list<quint64> protectedSegment;
+    QHash<quint64, Entry> entries;
+    qint64 used = 0;
+    qint64 protectedBytes = 0;
+};
+
+void setLatencies(ThumbnailCacheSimulator::Result& result, std::vector<qint64>& latencies)
+{
+    if (latencies.empty())
+        return;
+    std::sort(latencies.begin(), latencies.end());
+    qint64 sum = 0;
+    for (qint64 latency : latencies)
+        sum += latency;
+    result.missLatencyMeanUsecs = sum / qint64(latencies.size());
+    result.missLatencyP50Usecs = latencies[latencies.size() / 2];
+    result.missLatencyP95Usecs = latencies[std::min(latencies.size() - 1, latencies.size() * 95 / 100)];
+}
+
+}
+
+ThumbnailCacheSimulator::Result ThumbnailCacheSimulator::replay(const QVector<ThumbnailTrace::Event> &events, const Config &config)
+{
+    Result result;
+    SimulatedCache cache(config.policy, config.budgetBytes);
+    std::deque<quint64> missQueue;
+    std::deque<quint64> prefetchQueue;
+    QHash<quint64, qint64> firstMisses; // Of the thumbnails waiting or loading that were asked for
+    QSet<quint64> waiting; // Queued or loading
+    QSet<quint64> prefetchedInCache;
+    std::vector<quint64> batch;
+    qint64 batchDone = -1; // No batch is loading
+    std::vector<qint64> latencies;
+    QVector<quint64> evicted;
+
+    auto startBatch = [&](qint64 now) {
+        batch.clear();
+        while (batch.size() < SIMULATED_LOAD_BATCH && (!missQueue.empty() || !prefetchQueue.empty()))
+        {
+            std::deque<quint64>& queue = !missQueue.empty() ? missQueue : prefetchQueue;
+            batch.push_back(queue.front());
+            queue.pop_front();
+        }
+        batchDone = batch.empty() ? -1 : now + config.loadUsecs;
+    };
+
+    // Finishes the batches done by now, and starts the next ones
+    auto advance = [&](qint64 now) {
+        while (batchDone >= 0 && batchDone <= now)
+        {
+            for (quint64 key : batch)
+            {
+                waiting.remove(key);
+                auto firstMiss = firstMisses.find(key);
+                if (firstMiss != firstMisses.end())
+                {
+                    latencies.push_back(batchDone - firstMiss.value());
+                    firstMisses.erase(firstMiss);
+                }
+                else
+                {
+                    result.prefetched++;
+                    prefetchedInCache.insert(key);
+                }
+                evicted.clear();
+                cache.insert(key, evicted);
+                for (quint64 victim : evicted)
+                    prefetchedInCache.remove(victim);
+            }
+            startBatch(batchDone);
+        }
+    };
+
+    auto enqueue = [&](quint64 key, bool isMiss, qint64 now) {
+        waiting.insert(key);
+        (isMiss ? missQueue : prefetchQueue).push_back(key);
+        if (batchDone < 0)
+            startBatch(now);
+    };
+
+    int lastLevel = -1;
+    int lastSize = 0;
+    int lastScroll = 0;
+    for (const auto& event : events)
+    {
+        advance(event.usecs);
+        if (event.kind == ThumbnailTrace::Event::Request)
+        {
+            const quint64 key = keyOf(event.id, event.level, event.size);
+            lastLevel = event.level;
+            lastSize = event.size;
+            result.requests++;
+            if (cache.find(key))
+            {
+                result.hits++;
+                if (prefetchedInCache.remove(key))
+                    result.prefetchHits++;
+                continue;
+            }
+            if (!waiting.contains(key))
+            {
+                result.misses++;
+                firstMisses.insert(key, event.usecs);
+                enqueue(key, true, event.usecs);
+            }
+            else if (!firstMisses.contains(key))
+            {
+                // Asked for while it was prefetched, the prefetch is not counted
+                firstMisses.insert(key, event.usecs);
+                result.misses++;
+            }
+        }
+        else if (event.kind == ThumbnailTrace::Event::Viewport && lastLevel >= 0)
+        {
+            // Like MainWindow::updateThumbnailPrefetch, the waiting prefetches are replaced
+            for (quint64 key : prefetchQueue)
+                waiting.remove(key);
+            prefetchQueue.clear();
+
+            const int pageRows = event.last - event.first + 1;
+            const int depth = int(pageRows * config.prefetchPages);
+            int before = depth / 2;
+            int after = depth / 2;
+            if (event.scroll > lastScroll)
+            {
+                before = 0;
+                after = depth;
+            }
+            else if (event.scroll < lastScroll)
+            {
+                before = depth;
+                after = 0;
+            }
+            lastScroll = event.scroll;
+
+            auto idOfRow = [&](int row) { return row - event.around >= 0 && row - event.around < event.ids.count() ? event.ids.at(row - event.around) : -1; };
+            for (int i = 1; i <= qMax(before, after); i++)
+            {
+                for (int row : {i <= after ? event.last + i : -1, i <= before ? event.first - i : -1})
+                {
+                    const int id = row >= 0 ? idOfRow(row) : -1;
+                    if (id < 0)
+                        continue;
+                    const quint64 key = keyOf(id, lastLevel, lastSize);
+                    if (!cache.contains(key) && !waiting.contains(key))
+                        enqueue(key, false, event.usecs);
+                }
+            }
+        }
+    }
+    advance(std::numeric_limits<qint64>::max());
+    setLatencies(result, latencies);
+    return result;
+}
+
+ThumbnailCacheSimulator::Result ThumbnailCacheSimulator::recorded(const QVector<ThumbnailTrace::Event> &events)
+{
+    Result result;
+    QHash<quint64, qint64> firstMisses;
+    std::vector<qint64> latencies;
+    for (const auto& event : events)
+    {
+        const quint64 key = keyOf(event.id, event.level, event.size);
+        if (event.kind == ThumbnailTrace::Event::Request)
+        {
+            result.requests++;
+            if (event.hit)
+            {
+                result.hits++;
+            }
+            else if (!firstMisses.contains(key))
+            {
+                result.misses++;
+                firstMisses.insert(key, event.usecs);
+            }
+        }
+        else if (event.kind == ThumbnailTrace::Event::Loaded)
+        {
+            auto firstMiss = firstMisses.find(key);
+            if (firstMiss == firstMisses.end())
+            {
+                result.prefetched++;
+                continue;
+            }
+            latencies.push_back(event.usecs - firstMiss.value());
+            firstMisses.erase(firstMiss);
+        }
+    }
+    setLatencies(result, latencies);
+    return result;
+}
+
+qint64 ThumbnailCacheSimulator::recordedLoadUsecs(const QVector<ThumbnailTrace::Event> &events)
+{
+    return recorded(events).missLatencyP50Usecs;
+}
+
+QString ThumbnailCacheSimulator::policyName(Policy policy)
+{
+    switch (policy)
+    {
+    case LeastRecentlyUsed: return "lru";
+    case FirstInFirstOut: return "fifo";
+    case SegmentedLru: return "slru";
+    }
+    return QString();
+}
+
+bool ThumbnailCacheSimulator::policyFromName(const QString &name, Policy &policy)
+{
+    for (Policy candidate : {LeastRecentlyUsed, FirstInFirstOut, SegmentedLru})
+    {
+        if (policyName(candidate) == name.toLower())
+        {
+            policy = candidate;
+            return true;
+        }
+    }
+    return false;
+}
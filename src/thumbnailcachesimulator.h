@@ -0,0 +1,85 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef THUMBNAILCACHESIMULATOR_H
+#define THUMBNAILCACHESIMULATOR_H
+
+#include "thumbnailtrace.h"
+
+#include <QString>
+
+/*!
+ * \brief The ThumbnailCacheSimulator class
+ * Replays a ThumbnailTrace against a cache of the view with another policy, budget
+ * and prefetch depth, to choose the defaults from data.
+ *
+ * Each request of the trace is looked up in the simulated cache. A miss queues a load,
+ * and so do the rows the view would prefetch at each viewport of the trace, like
+ * MainWindow::updateThumbnailPrefetch, after the misses. The loads are served like the
+ * ThumbnailCache does, up to SIMULATED_LOAD_BATCH at a time, each batch taking the
+ * load time, and go into the cache when their batch is done. The latency of a miss is
+ * the time from its first request to the end of its load.
+ */
+class ThumbnailCacheSimulator
+{
+public:
+    enum Policy
+    {
+        LeastRecentlyUsed, // The policy of PixmapCache
+        FirstInFirstOut,
+        SegmentedLru // Hit twice goes to a protected segment of 80% of the budget
+    };
+
+    struct Config
+    {
+        Policy policy = LeastRecentlyUsed;
+        qint64 budgetBytes = 0;
+        double prefetchPages = 1; // On the side the view was last scrolled to, half of it each side when it was not
+        qint64 loadUsecs = 0; // Of a batch of loads
+    };
+
+    struct Result
+    {
+        qint64 requests = 0;
+        qint64 hits = 0;
+        qint64 misses = 0; // Thumbnails loaded because they were asked for, not the repeated lookups while loading
+        qint64 prefetched = 0;
+        qint64 prefetchHits = 0; // Prefetched thumbnails looked up before they were evicted
+        qint64 missLatencyMeanUsecs = 0;
+        qint64 missLatencyP50Usecs = 0;
+        qint64 missLatencyP95Usecs = 0;
+        double hitRate() const { return requests > 0 ? double(hits) / requests : 0; }
+    };
+
+    static Result replay(const QVector<ThumbnailTrace::Event>& events, const Config& config);
+    // Of the session itself, from the hits of its requests and its loads
+    static Result recorded(const QVector<ThumbnailTrace::Event>& events);
+    // The median time from a miss to its load in the trace, 0 when there was none
+    static qint64 recordedLoadUsecs(const QVector<ThumbnailTrace::Event>& events);
+
+    static QString policyName(Policy policy);
+    static bool policyFromName(const QString& name, Policy& policy);
+};
+
+#endif // THUMBNAILCACHESIMULATOR_H
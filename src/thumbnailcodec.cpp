@@ -0,0 +1,263 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "thumbnailcodec.h"
+#include "allocationtracker.h"
+
+#include <QBuffer>
+#include <QDebug>
+
+#include "lz4.h"
+
+#define JPEG_THUMBNAIL_QUALITY 85
+
+// Widths and heights past this are taken as a corrupt header. It keeps the raw sizes,
+// up to 6 bytes a pixel, within the qint32 of the headers and of LZ4.
+#define THUMBNAIL_MAX_DIMENSION 16384
+
+/*
+ * The Lz4Raw format is a small header followed by the LZ4 compressed RGB32 pixels:
+ *
+ *  qint32 width
+ *  qint32 height
+ *  qint32 uncompressed size in bytes (width * height * 4)
+ *  LZ4 block
+ *
+ * Encoding and decoding are close to memcpy speed, which is what we want for the
+ * ingest and model loading paths. PNG is still supported for reading older catalogs.
+ */
+struct Lz4RawHeader
+{
+    qint32 width;
+    qint32 height;
+    qint32 rawSize;
+};
+
+static bool isValidSize(qint64 width, qint64 height)
+{
+    return width > 0 && height > 0 && width <= THUMBNAIL_MAX_DIMENSION && height <= THUMBNAIL_MAX_DIMENSION;
+}
+
+static QByteArray encodeLz4Raw(const QImage& image)
+{
+    if (image.isNull())
+        return QByteArray();
+
+    if (!isValidSize(image.width(), image.height()))
+        return QByteArray();
+    QImage rgb = image.format() == QImage::Format_RGB32 ? image : image.convertToFormat(QImage::Format_RGB32);
+
+    Lz4RawHeader header;
+    header.width = rgb.width();
+    header.height = rgb.height();
+    header.rawSize = qint32(qint64(rgb.width()) * rgb.height() * 4);
+
+    // RGB32 scanlines are always 4-byte aligned, so the pixels are contiguous.
+    int bound = LZ4_compressBound(header.rawSize);
+    QByteArray out(sizeof(Lz4RawHeader) + bound, Qt::Uninitialized);
+    memcpy(out.data(), &header, sizeof(Lz4RawHeader));
+    int compressedSize = LZ4_compress_default((const char*)rgb.constBits(), out.data() + sizeof(Lz4RawHeader), header.rawSize, bound);
+    if (compressedSize <= 0)
+    {
+        qDebug() << "LZ4 thumbnail compression failed";
+        return QByteArray();
+    }
+    out.resize(sizeof(Lz4RawHeader) + compressedSize);
+    return out;
+}
+
+static QImage decodeLz4Raw(const QByteArray& data)
+{
+    if (data.size() < (int)sizeof(Lz4RawHeader))
+        return QImage();
+
+    Lz4RawHeader header;
+    memcpy(&header, data.constData(), sizeof(Lz4RawHeader));
+    if (!isValidSize(header.width, header.height) || header.rawSize != qint64(header.width) * header.height * 4)
+        return QImage();
+
+    QImage image(header.width, header.height, QImage::Format_RGB32);
+    if (image.isNull())
+        return QImage();
+    int decompressed = LZ4_decompress_safe(data.constData() + sizeof(Lz4RawHeader), (char*)image.bits(), data.size() - sizeof(Lz4RawHeader), header.rawSize);
+    if (decompressed != header.rawSize)
+        return QImage();
+    return image;
+}
+
+/*
+ * The Linear16 format keeps the 16 bit samples of a linear thumbnail, Grayscale16 or
+ * RGBX64 without the X, in the same kind of header and LZ4 block:
+ *
+ *  qint32 width
+ *  qint32 height
+ *  qint32 channels
+ *  qint32 uncompressed size in bytes (width * height * channels * 2)
+ *  LZ4 block
+ *
+ * The low bytes of all the samples come before the high bytes, which compress better
+ * as the high bytes of nearby samples are mostly the same.
+ */
+struct Linear16Header
+{
+    qint32 width;
+    qint32 height;
+    qint32 channels;
+    qint32 rawSize;
+};
+
+static QByteArray encodeLinear16(const QImage& image)
+{
+    const int channels = image.format() == QImage::Format_RGBX64 ? 3 : 1;
+    if (image.isNull() || (channels == 1 && image.format() != QImage::Format_Grayscale16) || !isValidSize(image.width(), image.height()))
+        return QByteArray();
+
+    Linear16Header header;
+    header.width = image.width();
+    header.height = image.height();
+    header.channels = channels;
+    header.rawSize = qint32(qint64(image.width()) * image.height() * channels * 2);
+
+    const qsizetype samples = qsizetype(image.width()) * image.height() * channels;
+    QByteArray shuffled(header.rawSize, Qt::Uninitialized);
+    qsizetype i = 0;
+    for (int y = 0; y < image.height(); y++)
+    {
+        // RGBX64 has 4 samples a pixel, the X is not kept
+        auto* line = reinterpret_cast<const quint16*>(image.constScanLine(y));
+        for (int x = 0; x < image.width(); x++)
+        {
+            for (int k = 0; k < channels; k++, i++)
+            {
+                const quint16 sample = line[x * (channels == 3 ? 4 : 1) + k];
+                shuffled[i] = char(sample & 0xff);
+                shuffled[samples + i] = char(sample >> 8);
+            }
+        }
+    }
+
+    int bound = LZ4_compressBound(header.rawSize);
+    QByteArray out(sizeof(Linear16Header) + bound, Qt::Uninitialized);
+    memcpy(out.data(), &header, sizeof(Linear16Header));
+    int compressedSize = LZ4_compress_default(shuffled.constData(), out.data() + sizeof(Linear16Header), header.rawSize, bound);
+    if (compressedSize <= 0)
+    {
+        qDebug() << "LZ4 linear thumbnail compression failed";
+        return QByteArray();
+    }
+    out.resize(sizeof(Linear16Header) + compressedSize);
+    return out;
+}
+
+static QImage decodeLinear16(const QByteArray& data)
+{
+    if (data.size() < (int)sizeof(Linear16Header))
+        return QImage();
+
+    Linear16Header header;
+    memcpy(&header, data.constData(), sizeof(Linear16Header));
+    if (!isValidSize(header.width, header.height) || (header.channels != 1 && header.channels != 3)
+            || header.rawSize != qint64(header.width) * header.height * header.channels * 2)
+        return QImage();
+
+    QByteArray shuffled(header.rawSize, Qt::Uninitialized);
+    int decompressed = LZ4_decompress_safe(data.constData() + sizeof(Linear16Header), shuffled.data(), data.size() - sizeof(Linear16Header), header.rawSize);
+    if (decompressed != header.rawSize)
+        return QImage();
+
+    const int channels = header.channels;
+    QImage image(header.width, header.height, channels == 3 ? QImage::Format_RGBX64 : QImage::Format_Grayscale16);
+    if (image.isNull())
+        return QImage();
+    const qsizetype samples = qsizetype(header.width) * header.height * channels;
+    const auto* bytes = reinterpret_cast<const uchar*>(shuffled.constData());
+    qsizetype i = 0;
+    for (int y = 0; y < header.height; y++)
+    {
+        auto* line = reinterpret_cast<quint16*>(image.scanLine(y));
+        for (int x = 0; x < header.width; x++)
+        {
+            for (int k = 0; k < channels; k++, i++)
+                line[x * (channels == 3 ? 4 : 1) + k] = quint16(bytes[i] | (bytes[samples + i] << 8));
+            if (channels == 3)
+                line[x * 4 + 3] = 0xffff;
+        }
+    }
+    return image;
+}
+
+QByteArray ThumbnailCodec::encode(const QImage &image, ThumbnailFormat format)
+{
+    static AllocationCounter& encodeAllocations = AllocationTracker::counter("thumbnail.encode");
+    AllocationScope allocations(encodeAllocations);
+    switch (format)
+    {
+        case ThumbnailFormatLz4Raw:
+            return encodeLz4Raw(image);
+        case ThumbnailFormatLinear16:
+            return encodeLinear16(image);
+        case ThumbnailFormatJpeg:
+        case ThumbnailFormatPng:
+        {
+            QByteArray byteArray;
+            QBuffer buffer(&byteArray);
+            buffer.open(QIODevice::WriteOnly);
+            if (format == ThumbnailFormatJpeg)
+                image.save(&buffer, "JPG", JPEG_THUMBNAIL_QUALITY);
+            else
+                image.save(&buffer, "PNG");
+            return byteArray;
+        }
+    }
+    return QByteArray();
+}
+
+QImage ThumbnailCodec::decode(const QByteArray &data, ThumbnailFormat format)
+{
+    QImage image;
+    switch (format)
+    {
+        case ThumbnailFormatLz4Raw:
+            return decodeLz4Raw(data);
+        case ThumbnailFormatLinear16:
+            return decodeLinear16(data);
+        case ThumbnailFormatJpeg:
+            image.loadFromData(data, "JPG");
+            break;
+        case ThumbnailFormatPng:
+            image.loadFromData(data, "PNG");
+            break;
+    }
+    return image;
+}
+
+ThumbnailFormat ThumbnailCodec::formatFromString(const QString &name)
+{
+    QString lower = name.toLower();
+    if (lower == "png")
+        return ThumbnailFormatPng;
+    if (lower == "jpeg" || lower == "jpg")
+        return ThumbnailFormatJpeg;
+    return ThumbnailFormatLz4Raw;
+}
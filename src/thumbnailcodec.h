@@ -0,0 +1,50 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef THUMBNAILCODEC_H
+#define THUMBNAILCODEC_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+// Stored in the `format` column of the thumbnails table. Do not renumber.
+enum ThumbnailFormat
+{
+    ThumbnailFormatPng = 0,
+    ThumbnailFormatLz4Raw = 1,
+    ThumbnailFormatJpeg = 2,
+    ThumbnailFormatLinear16 = 3 // Linear thumbnails only, see LinearThumbnail
+};
+
+class ThumbnailCodec
+{
+public:
+    static QByteArray encode(const QImage& image, ThumbnailFormat format);
+    static QImage decode(const QByteArray& data, ThumbnailFormat format);
+
+    static ThumbnailFormat formatFromString(const QString& name);
+};
+
+#endif // THUMBNAILCODEC_H
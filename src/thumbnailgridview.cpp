@@ -0,0 +1,442 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "thumbnailgridview.h"
+#include "metrics.h"
+
+#include <QApplication>
+#include <QDebug>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLWidget>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QScrollBar>
+#include <QStyledItemDelegate>
+
+#include <algorithm>
+
+// Pixels between the cells and around the grid
+#define GRID_CELL_SPACING 4
+
+/*!
+ * \brief The AcceleratedItemDelegate class
+ * Lets the style draw the cell without its icon, then draws the largest pixmap of the
+ * icon scaled into the cell, which the OpenGL paint engine does on the GPU.
+ */
+class AcceleratedItemDelegate : public QStyledItemDelegate
+{
+public:
+    using QStyledItemDelegate::QStyledItemDelegate;
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override
+    {
+        QStyleOptionViewItem cellOption = option;
+        initStyleOption(&cellOption, index);
+        const QIcon icon = cellOption.icon;
+        cellOption.icon = QIcon();
+        cellOption.features &= ~QStyleOptionViewItem::HasDecoration;
+        const QWidget* widget = option.widget;
+        QStyle* style = widget != nullptr ? widget->style() : QApplication::style();
+        style->drawControl(QStyle::CE_ItemViewItem, &cellOption, painter, widget);
+
+        QList<QSize> sizes = icon.availableSizes();
+        if (sizes.isEmpty())
+            return;
+        QSize largest = *std::max_element(sizes.begin(), sizes.end(), [](const QSize& a, const QSize& b) { return a.width() * a.height() < b.width() * b.height(); });
+        QIcon::Mode mode = option.state & QStyle::State_Selected ? QIcon::Selected : QIcon::Normal;
+        QPixmap pixmap = icon.pixmap(largest, mode);
+
+        // The room above the file name
+        QSize room = option.rect.size() - QSize(0, option.fontMetrics.height());
+        QSize target = pixmap.size().scaled(room.boundedTo(option.decorationSize), Qt::KeepAspectRatio);
+        QRect rect = QStyle::alignedRect(Qt::LeftToRight, Qt::AlignHCenter | Qt::AlignTop, target, option.rect);
+        painter->save();
+        painter->setRenderHint(QPainter::SmoothPixmapTransform);
+        painter->drawPixmap(rect, pixmap);
+        painter->restore();
+    }
+};
+
+ThumbnailGridView::ThumbnailGridView(QWidget *parent) : QAbstractItemView(parent)
+{
+    setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+}
+
+bool ThumbnailGridView::acceleratedRenderingAvailable()
+{
+    QOffscreenSurface surface;
+    surface.create();
+    QOpenGLContext context;
+    return context.create() && context.makeCurrent(&surface);
+}
+
+void ThumbnailGridView::setAcceleratedRendering(bool enabled)
+{
+    if (enabled && !acceleratedRenderingAvailable())
+    {
+        qDebug() << "No OpenGL context, the thumbnail grid is drawn without acceleration";
+        enabled = false;
+    }
+    if (enabled == acceleratedRendering)
+        return;
+
+    acceleratedRendering = enabled;
+    if (enabled)
+    {
+        rasterDelegate = itemDelegate();
+        setItemDelegate(new AcceleratedItemDelegate(this));
+        setViewport(new QOpenGLWidget());
+    }
+    else
+    {
+        QAbstractItemDelegate* acceleratedDelegate = itemDelegate();
+        setItemDelegate(rasterDelegate);
+        delete acceleratedDelegate;
+        setViewport(new QWidget());
+    }
+    scheduleDelayedItemsLayout();
+}
+
+int ThumbnailGridView::rowCount() const
+{
+    return model() != nullptr ? model()->rowCount(rootIndex()) : 0;
+}
+
+int ThumbnailGridView::lineCount() const
+{
+    return (rowCount() + columnCount - 1) / columnCount;
+}
+
+int ThumbnailGridView::lineHeight() const
+{
+    return cellSize.height() + GRID_CELL_SPACING;
+}
+
+int ThumbnailGridView::columnWidth() const
+{
+    return cellSize.width() + GRID_CELL_SPACING;
+}
+
+QRect ThumbnailGridView::cellRect(int row) const
+{
+    int line = row / columnCount;
+    int column = row % columnCount;
+    return QRect(GRID_CELL_SPACING + column * columnWidth(), GRID_CELL_SPACING + line * lineHeight(), cellSize.width(), cellSize.height());
+}
+
+QRect ThumbnailGridView::rangeRect(int firstRow, int lastRow) const
+{
+    int firstLine = firstRow / columnCount;
+    int lastLine = lastRow / columnCount;
+    int left = firstLine == lastLine ? cellRect(firstRow).left() : GRID_CELL_SPACING;
+    int right = firstLine == lastLine ? cellRect(lastRow).right() : GRID_CELL_SPACING + columnCount * columnWidth() - GRID_CELL_SPACING - 1;
+    return QRect(QPoint(left, cellRect(firstRow).top()), QPoint(right, cellRect(lastRow).bottom()));
+}
+
+int ThumbnailGridView::firstVisibleRow() const
+{
+    if (rowCount() == 0 || cellSize.isEmpty())
+        return -1;
+    int line = qMax(0, (verticalOffset() - GRID_CELL_SPACING) / lineHeight());
+    int row = line * columnCount;
+    return row < rowCount() ? row : -1;
+}
+
+int ThumbnailGridView::lastVisibleRow() const
+{
+    int first = firstVisibleRow();
+    if (first == -1)
+        return -1;
+    int line = (verticalOffset() + viewport()->height() - GRID_CELL_SPACING) / lineHeight();
+    return qMin(rowCount() - 1, (line + 1) * columnCount - 1);
+}
+
+QRect ThumbnailGridView::visualRect(const QModelIndex &index) const
+{
+    if (!index.isValid() || index.parent() != rootIndex() || cellSize.isEmpty())
+        return QRect();
+    return cellRect(index.row()).translated(-horizontalOffset(), -verticalOffset());
+}
+
+void ThumbnailGridView::scrollTo(const QModelIndex &index, ScrollHint hint)
+{
+    if (!index.isValid() || cellSize.isEmpty())
+        return;
+
+    QRect rect = cellRect(index.row());
+    int viewportHeight = viewport()->height();
+    int value = verticalScrollBar()->value();
+    switch (hint)
+    {
+    case EnsureVisible:
+        if (rect.top() < value)
+            value = rect.top() - GRID_CELL_SPACING;
+        else if (rect.bottom() > value + viewportHeight)
+            value = rect.bottom() + GRID_CELL_SPACING - viewportHeight;
+        break;
+    case PositionAtTop:
+        value = rect.top() - GRID_CELL_SPACING;
+        break;
+    case PositionAtBottom:
+        value = rect.bottom() + GRID_CELL_SPACING - viewportHeight;
+        break;
+    case PositionAtCenter:
+        value = rect.center().y() - viewportHeight / 2;
+        break;
+    }
+    verticalScrollBar()->setValue(value);
+}
+
+QModelIndex ThumbnailGridView::indexAt(const QPoint &point) const
+{
+    if (cellSize.isEmpty())
+        return QModelIndex();
+
+    QPoint contentPoint = point + QPoint(horizontalOffset(), verticalOffset());
+    if (contentPoint.x() < GRID_CELL_SPACING || contentPoint.y() < GRID_CELL_SPACING)
+        return QModelIndex();
+
+    int column = (contentPoint.x() - GRID_CELL_SPACING) / columnWidth();
+    int line = (contentPoint.y() - GRID_CELL_SPACING) / lineHeight();
+    if (column >= columnCount)
+        return QModelIndex();
+
+    int row = line * columnCount + column;
+    if (row >= rowCount() || !cellRect(row).contains(contentPoint))
+        return QModelIndex();
+    return model()->index(row, 0, rootIndex());
+}
+
+void ThumbnailGridView::doItemsLayout()
+{
+    // Rows are not laid out one by one, only the grid is measured again
+    updateGeometries();
+    viewport()->update();
+}
+
+QModelIndex ThumbnailGridView::moveCursor(CursorAction cursorAction, Qt::KeyboardModifiers modifiers)
+{
+    Q_UNUSED(modifiers);
+    int count = rowCount();
+    if (count == 0)
+        return QModelIndex();
+
+    int row = currentIndex().isValid() ? currentIndex().row() : 0;
+    int pageRows = qMax(1, viewport()->height() / qMax(1, lineHeight())) * columnCount;
+    switch (cursorAction)
+    {
+    case MoveLeft:
+    case MovePrevious:
+        row--;
+        break;
+    case MoveRight:
+    case MoveNext:
+        row++;
+        break;
+    case MoveUp:
+        row -= columnCount;
+        break;
+    case MoveDown:
+        row += columnCount;
+        break;
+    case MovePageUp:
+        row -= pageRows;
+        break;
+    case MovePageDown:
+        row += pageRows;
+        break;
+    case MoveHome:
+        row = 0;
+        break;
+    case MoveEnd:
+        row = count - 1;
+        break;
+    }
+    return model()->index(qBound(0, row, count - 1), 0, rootIndex());
+}
+
+int ThumbnailGridView::horizontalOffset() const
+{
+    return 0;
+}
+
+int ThumbnailGridView::verticalOffset() const
+{
+    return verticalScrollBar()->value();
+}
+
+bool ThumbnailGridView::isIndexHidden(const QModelIndex &index) const
+{
+    Q_UNUSED(index);
+    return false;
+}
+
+/*!
+ * \brief ThumbnailGridView::setSelection
+ * Selects the cells the rect covers, as one row range per line of cells.
+ */
+void ThumbnailGridView::setSelection(const QRect &rect, QItemSelectionModel::SelectionFlags command)
+{
+    QItemSelection selection;
+    int count = rowCount();
+    if (count > 0 && !cellSize.isEmpty())
+    {
+        QRect contentRect = rect.normalized().translated(horizontalOffset(), verticalOffset());
+        int firstColumn = qBound(0, (contentRect.left() - GRID_CELL_SPACING) / columnWidth(), columnCount - 1);
+        int lastColumn = qBound(0, (contentRect.right() - GRID_CELL_SPACING) / columnWidth(), columnCount - 1);
+        int firstLine = qMax(0, (contentRect.top() - GRID_CELL_SPACING) / lineHeight());
+        int lastLine = qMin(lineCount() - 1, (contentRect.bottom() - GRID_CELL_SPACING) / lineHeight());
+
+        for (int line = firstLine; line <= lastLine; line++)
+        {
+            int first = line * columnCount + firstColumn;
+            int last = qMin(count - 1, line * columnCount + lastColumn);
+            if (first <= last)
+                selection.select(model()->index(first, 0, rootIndex()), model()->index(last, 0, rootIndex()));
+        }
+    }
+    selectionModel()->select(selection, command);
+}
+
+/*!
+ * \brief ThumbnailGridView::visualRegionForSelection
+ * Each range is at most its first partial line, its full lines and its last partial
+ * line, clipped to the viewport, so a large selection does not make a large region.
+ */
+QRegion ThumbnailGridView::visualRegionForSelection(const QItemSelection &selection) const
+{
+    QRegion region;
+    if (cellSize.isEmpty())
+        return region;
+
+    QRect visible = viewport()->rect().translated(horizontalOffset(), verticalOffset());
+    for (auto& range : selection)
+    {
+        if (!range.isValid() || range.parent() != rootIndex())
+            continue;
+        int first = range.top();
+        int last = range.bottom();
+        int firstLineEnd = qMin(last, (first / columnCount + 1) * columnCount - 1);
+        int lastLineStart = qMax(first, last / columnCount * columnCount);
+
+        QRect rects[] = {rangeRect(first, firstLineEnd), QRect(), rangeRect(lastLineStart, last)};
+        if (firstLineEnd + 1 <= lastLineStart - 1)
+            rects[1] = rangeRect(firstLineEnd + 1, lastLineStart - 1);
+        for (auto& rect : rects)
+        {
+            QRect clipped = rect.intersected(visible);
+            if (!clipped.isEmpty())
+                region += clipped.translated(-horizontalOffset(), -verticalOffset());
+        }
+    }
+    return region;
+}
+
+void ThumbnailGridView::initViewItemOption(QStyleOptionViewItem *option) const
+{
+    QAbstractItemView::initViewItemOption(option);
+    // As a QListView in IconMode
+    option->decorationPosition = QStyleOptionViewItem::Top;
+    option->decorationAlignment = Qt::AlignCenter;
+    option->displayAlignment = Qt::AlignHCenter | Qt::AlignBottom;
+    option->showDecorationSelected = true;
+}
+
+void ThumbnailGridView::updateGeometries()
+{
+    cellSize = QSize();
+    if (rowCount() > 0)
+    {
+        QStyleOptionViewItem option;
+        initViewItemOption(&option);
+        cellSize = itemDelegate()->sizeHint(option, model()->index(0, 0, rootIndex()));
+    }
+    if (cellSize.isEmpty())
+        cellSize = iconSize();
+
+    if (cellSize.isEmpty())
+    {
+        columnCount = 1;
+        verticalScrollBar()->setRange(0, 0);
+    }
+    else
+    {
+        columnCount = qMax(1, (viewport()->width() - GRID_CELL_SPACING) / columnWidth());
+        int contentHeight = GRID_CELL_SPACING + lineCount() * lineHeight();
+        verticalScrollBar()->setSingleStep(lineHeight() / 4 + 1);
+        verticalScrollBar()->setPageStep(viewport()->height());
+        verticalScrollBar()->setRange(0, qMax(0, contentHeight - viewport()->height()));
+    }
+    QAbstractItemView::updateGeometries();
+}
+
+void ThumbnailGridView::paintEvent(QPaintEvent *event)
+{
+    static LatencyHistogram& paintLatency = Metrics::histogram("gui.paint");
+    ScopedLatency latency(paintLatency);
+    QPainter painter(viewport());
+    // A QOpenGLWidget does not fill its background
+    if (acceleratedRendering)
+        painter.fillRect(event->rect(), viewport()->palette().brush(QPalette::Base));
+
+    int first = firstVisibleRow();
+    if (first == -1)
+        return;
+
+    QStyleOptionViewItem option;
+    initViewItemOption(&option);
+    const QModelIndex current = currentIndex();
+    const bool focus = hasFocus() && current.isValid();
+    const QStyle::State state = option.state;
+
+    for (int row = first, last = lastVisibleRow(); row <= last; row++)
+    {
+        QModelIndex index = model()->index(row, 0, rootIndex());
+        option.rect = visualRect(index);
+        if (!event->region().intersects(option.rect))
+            continue;
+
+        option.state = state;
+        if (selectionModel() != nullptr && selectionModel()->isSelected(index))
+            option.state |= QStyle::State_Selected;
+        if (focus && index == current)
+            option.state |= QStyle::State_HasFocus;
+        itemDelegate()->paint(&painter, option, index);
+    }
+}
+
+void ThumbnailGridView::rowsInserted(const QModelIndex &parent, int start, int end)
+{
+    QAbstractItemView::rowsInserted(parent, start, end);
+    scheduleDelayedItemsLayout();
+}
+
+void ThumbnailGridView::rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end)
+{
+    QAbstractItemView::rowsAboutToBeRemoved(parent, start, end);
+    scheduleDelayedItemsLayout();
+}
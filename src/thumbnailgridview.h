@@ -0,0 +1,93 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef THUMBNAILGRIDVIEW_H
+#define THUMBNAILGRIDVIEW_H
+
+#include <QAbstractItemView>
+
+/*!
+ * \brief The ThumbnailGridView class
+ * Shows the rows of a model as a grid of cells of the same size, the size hint of the
+ * first row. Cell positions, hit tests and selections are computed from the row
+ * number, so scrolling and resizing take the same time whatever the model size, and
+ * only the visible cells are painted. A rubber band selects one row range per line of
+ * cells it covers.
+ *
+ * With accelerated rendering, the viewport is a QOpenGLWidget. Its paint engine keeps
+ * the pixmaps of the PixmapCache as textures and scales them when drawing, so the
+ * largest thumbnail of each icon is drawn to the cell size on the GPU, also while the
+ * cell size changes.
+ */
+class ThumbnailGridView : public QAbstractItemView
+{
+    Q_OBJECT
+public:
+    explicit ThumbnailGridView(QWidget *parent = nullptr);
+
+    // The first and last rows with a cell in the viewport, -1 when there are none
+    int firstVisibleRow() const;
+    int lastVisibleRow() const;
+
+    // Falls back to the QPainter raster path when no OpenGL context can be made
+    void setAcceleratedRendering(bool enabled);
+    bool isAcceleratedRendering() const { return acceleratedRendering; }
+    static bool acceleratedRenderingAvailable();
+
+    // QAbstractItemView interface
+    QRect visualRect(const QModelIndex &index) const override;
+    void scrollTo(const QModelIndex &index, ScrollHint hint = EnsureVisible) override;
+    QModelIndex indexAt(const QPoint &point) const override;
+    void doItemsLayout() override;
+
+protected:
+    QModelIndex moveCursor(CursorAction cursorAction, Qt::KeyboardModifiers modifiers) override;
+    int horizontalOffset() const override;
+    int verticalOffset() const override;
+    bool isIndexHidden(const QModelIndex &index) const override;
+    void setSelection(const QRect &rect, QItemSelectionModel::SelectionFlags command) override;
+    QRegion visualRegionForSelection(const QItemSelection &selection) const override;
+    void initViewItemOption(QStyleOptionViewItem *option) const override;
+    void updateGeometries() override;
+    void paintEvent(QPaintEvent *event) override;
+
+protected slots:
+    void rowsInserted(const QModelIndex &parent, int start, int end) override;
+    void rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end) override;
+
+private:
+    QSize cellSize;
+    int columnCount = 1;
+    bool acceleratedRendering = false;
+    QAbstractItemDelegate* rasterDelegate = nullptr;
+
+    int rowCount() const;
+    int lineCount() const;
+    int lineHeight() const;
+    int columnWidth() const;
+    QRect cellRect(int row) const; // In content coordinates
+    QRect rangeRect(int firstRow, int lastRow) const; // Bounds of the lines of the rows
+};
+
+#endif // THUMBNAILGRIDVIEW_H
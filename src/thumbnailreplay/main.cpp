@@ -0,0 +1,171 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "thumbnailcachesimulator.h"
+#include "thumbnailtrace.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <cstdio>
+
+static bool parseDoubles(const QString& text, QVector<double>& values)
+{
+    values.clear();
+    for (auto& part : text.split(',', Qt::SkipEmptyParts))
+    {
+        bool ok = false;
+        double value = part.trimmed().toDouble(&ok);
+        if (!ok || value < 0)
+            return false;
+        values.append(value);
+    }
+    return !values.isEmpty();
+}
+
+static QJsonObject resultObject(const ThumbnailCacheSimulator::Result& result)
+{
+    QJsonObject object;
+    object["requests"] = result.requests;
+    object["hits"] = result.hits;
+    object["hit_rate"] = result.hitRate();
+    object["misses"] = result.misses;
+    object["prefetched"] = result.prefetched;
+    object["prefetch_hits"] = result.prefetchHits;
+    object["miss_latency_mean_ms"] = result.missLatencyMeanUsecs / 1000.0;
+    object["miss_latency_p50_ms"] = result.missLatencyP50Usecs / 1000.0;
+    object["miss_latency_p95_ms"] = result.missLatencyP95Usecs / 1000.0;
+    return object;
+}
+
+static void printRow(const QString& policy, const QString& budget, const QString& prefetch, const ThumbnailCacheSimulator::Result& result)
+{
+    printf("%-8s %10s %9s %8.1f%% %8lld %10lld %9.1f %9.1f %9.1f\n", qPrintable(policy), qPrintable(budget), qPrintable(prefetch),
+           result.hitRate() * 100, result.misses, result.prefetched,
+           result.missLatencyMeanUsecs / 1000.0, result.missLatencyP50Usecs / 1000.0, result.missLatencyP95Usecs / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("thumbnail-replay");
+    QCoreApplication::setApplicationVersion(CURRENT_APP_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays a thumbnail trace recorded by AstrocatApp --record-thumbnail-trace "
+                                     "against other cache policies, budgets and prefetch depths.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("trace", "The recorded trace.");
+    QCommandLineOption policiesOption("policies", "Cache policies to replay, of lru, fifo and slru.", "list", "lru,fifo,slru");
+    QCommandLineOption budgetsOption("budgets-mb", "Cache budgets to replay, in MB.", "list", "25,50,100,200,400");
+    QCommandLineOption prefetchOption("prefetch-pages", "Pages prefetched past the view to replay.", "list", "0,0.5,1,2");
+    QCommandLineOption loadOption("load-ms", "Time to load a batch of thumbnails, the median miss latency of the trace by default.", "ms");
+    QCommandLineOption reportOption("report", "Writes the results as JSON to this file.", "path");
+    parser.addOptions({policiesOption, budgetsOption, prefetchOption, loadOption, reportOption});
+    parser.process(app);
+
+    if (parser.positionalArguments().count() != 1)
+        parser.showHelp(1);
+
+    QVector<ThumbnailTrace::Event> events;
+    QString error;
+    if (!ThumbnailTrace::read(parser.positionalArguments().first(), events, error))
+    {
+        fprintf(stderr, "Failed to read the trace: %s\n", qPrintable(error));
+        return 1;
+    }
+
+    QVector<ThumbnailCacheSimulator::Policy> policies;
+    for (auto& name : parser.value(policiesOption).split(',', Qt::SkipEmptyParts))
+    {
+        ThumbnailCacheSimulator::Policy policy;
+        if (!ThumbnailCacheSimulator::policyFromName(name.trimmed(), policy))
+        {
+            fprintf(stderr, "Unknown cache policy %s\n", qPrintable(name));
+            return 1;
+        }
+        policies.append(policy);
+    }
+    QVector<double> budgets;
+    QVector<double> prefetchPages;
+    if (policies.isEmpty() || !parseDoubles(parser.value(budgetsOption), budgets) || !parseDoubles(parser.value(prefetchOption), prefetchPages))
+    {
+        fprintf(stderr, "The policies, budgets and prefetch pages are comma separated lists\n");
+        return 1;
+    }
+
+    const auto recorded = ThumbnailCacheSimulator::recorded(events);
+    qint64 loadUsecs = ThumbnailCacheSimulator::recordedLoadUsecs(events);
+    if (parser.isSet(loadOption))
+        loadUsecs = qint64(parser.value(loadOption).toDouble() * 1000);
+
+    printf("%lld requests, %.1f ms per batch of loads\n\n", recorded.requests, loadUsecs / 1000.0);
+    printf("%-8s %10s %9s %9s %8s %10s %9s %9s %9s\n", "policy", "budget MB", "prefetch", "hit rate", "misses", "prefetched", "mean ms", "p50 ms", "p95 ms");
+    printRow("recorded", "", "", recorded);
+
+    QJsonArray runs;
+    for (auto policy : policies)
+    {
+        for (double budget : budgets)
+        {
+            for (double pages : prefetchPages)
+            {
+                ThumbnailCacheSimulator::Config config;
+                config.policy = policy;
+                config.budgetBytes = qint64(budget * 1024 * 1024);
+                config.prefetchPages = pages;
+                config.loadUsecs = loadUsecs;
+                const auto result = ThumbnailCacheSimulator::replay(events, config);
+                printRow(ThumbnailCacheSimulator::policyName(policy), QString::number(budget), QString::number(pages), result);
+
+                QJsonObject run = resultObject(result);
+                run["policy"] = ThumbnailCacheSimulator::policyName(policy);
+                run["budget_mb"] = budget;
+                run["prefetch_pages"] = pages;
+                runs.append(run);
+            }
+        }
+    }
+
+    if (parser.isSet(reportOption))
+    {
+        QJsonObject report;
+        report["trace"] = parser.positionalArguments().first();
+        report["load_ms"] = loadUsecs / 1000.0;
+        report["recorded"] = resultObject(recorded);
+        report["runs"] = runs;
+        QFile file(parser.value(reportOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(report).toJson()) < 0)
+        {
+            fprintf(stderr, "Failed to write the report %s\n", qPrintable(parser.value(reportOption)));
+            return 1;
+        }
+    }
+    return 0;
+}
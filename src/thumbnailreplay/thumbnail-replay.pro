@@ -0,0 +1,22 @@
+# thumbnail-replay, replays thumbnail traces of the app against other cache policies and budgets
+
+QT += core gui sql concurrent
+QT -= widgets
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = thumbnail-replay
+
+VERSION = 0.1
+DEFINES += CURRENT_APP_VERSION=\"\\\"$${VERSION}\\\"\"
+
+SOURCES += \
+    main.cpp
+
+include(../engine.pri)
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,163 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "thumbnailstore.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+// A new pack is started once the last one would grow past this many bytes
+#define THUMBNAIL_PACK_SIZE (Q_INT64_C(1) << 30)
+
+ThumbnailStore::ThumbnailStore(const QString& path) : _path(path)
+{
+}
+
+ThumbnailStore::~ThumbnailStore()
+{
+    flush();
+}
+
+/*!
+ * \brief ThumbnailStore::pathForDatabase
+ * astrocat.db keeps its thumbnails in astrocat.thumbnails/ next to it
+ */
+QString ThumbnailStore::pathForDatabase(const QString& databasePath)
+{
+    QFileInfo info(databasePath);
+    return info.absolutePath() + "/" + info.completeBaseName() + ".thumbnails";
+}
+
+QString ThumbnailStore::packFilePath(int pack) const
+{
+    return QString("%1/%2.pack").arg(_path).arg(pack, 5, 10, QChar('0'));
+}
+
+int ThumbnailStore::lastPack() const
+{
+    int last = -1;
+    const QStringList names = QDir(_path).entryList({"*.pack"}, QDir::Files);
+    for (auto& name : names)
+    {
+        bool ok = false;
+        int pack = QFileInfo(name).completeBaseName().toInt(&ok);
+        if (ok)
+            last = qMax(last, pack);
+    }
+    return last;
+}
+
+bool ThumbnailStore::openWriter(int pack)
+{
+    writer.close();
+    writerPack = -1;
+    writer.setFileName(packFilePath(pack));
+    if (!writer.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qDebug() << "Could not open thumbnail pack" << writer.fileName() << writer.errorString();
+        return false;
+    }
+    writerPack = pack;
+    return true;
+}
+
+/*!
+ * \brief ThumbnailStore::append
+ * Writes data at the end of the last pack, starting a new one when it is full.
+ * The db must only refer to the location once the store is flushed.
+ */
+bool ThumbnailStore::append(const QByteArray& data, ThumbnailLocation& location)
+{
+    if (writerPack < 0)
+    {
+        QDir().mkpath(_path);
+        if (!openWriter(qMax(0, lastPack())))
+            return false;
+    }
+    if (writer.size() > 0 && writer.size() + data.size() > THUMBNAIL_PACK_SIZE)
+    {
+        flush();
+        if (!openWriter(writerPack + 1))
+            return false;
+    }
+
+    const qint64 offset = writer.size();
+    if (writer.write(data) != data.size())
+    {
+        qDebug() << "Could not write thumbnail pack" << writer.fileName() << writer.errorString();
+        return false;
+    }
+    location.pack = writerPack;
+    location.offset = offset;
+    location.length = data.size();
+    return true;
+}
+
+bool ThumbnailStore::flush()
+{
+    if (writerPack < 0)
+        return true;
+    return writer.flush();
+}
+
+/*!
+ * \brief ThumbnailStore::read
+ * The bytes of the thumbnail at location, in the mapping of its pack. The pack is
+ * mapped again when the thumbnail was written after the last mapping was made.
+ */
+QByteArray ThumbnailStore::read(const ThumbnailLocation& location)
+{
+    if (!location.isValid() || location.offset < 0 || location.length <= 0)
+        return QByteArray();
+
+    QMutexLocker locker(&mutex);
+    Pack& pack = packs[location.pack];
+    if (!pack.file)
+    {
+        pack.file.reset(new QFile(packFilePath(location.pack)));
+        if (!pack.file->open(QIODevice::ReadOnly))
+        {
+            qDebug() << "Could not open thumbnail pack" << pack.file->fileName() << pack.file->errorString();
+            pack.file.reset();
+            return QByteArray();
+        }
+    }
+
+    const qint64 end = location.offset + location.length;
+    if (pack.mappings.isEmpty() || pack.mappings.last().second < end)
+    {
+        const qint64 size = pack.file->size();
+        if (size < end)
+            return QByteArray();
+        const uchar* data = pack.file->map(0, size);
+        if (data == nullptr)
+            return QByteArray();
+        pack.mappings.append({data, size});
+    }
+
+    const uchar* data = pack.mappings.last().first;
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(data + location.offset), int(location.length));
+}
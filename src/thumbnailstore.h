@@ -0,0 +1,98 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef THUMBNAILSTORE_H
+#define THUMBNAILSTORE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#include <map>
+#include <memory>
+
+/*!
+ * \brief The ThumbnailLocation struct
+ * Where the encoded bytes of a thumbnail are in the pack files of a ThumbnailStore.
+ */
+struct ThumbnailLocation
+{
+    int pack = -1;
+    qint64 offset = 0;
+    qint64 length = 0;
+
+    bool isValid() const { return pack >= 0; }
+};
+
+/*!
+ * \brief The ThumbnailStore class
+ * The thumbnail pyramid is kept out of the db, in append-only pack files in a folder
+ * next to it. The db only records where each thumbnail is, so it stays small, and the
+ * thumbnail bytes are read from memory-mapped packs without a copy.
+ *
+ * There is one writer, the repository thread. Reads are thread safe. The packs are
+ * mapped again as they grow, earlier mappings are kept until the store is destroyed,
+ * so the bytes returned by read stay valid as long as the store.
+ *
+ * Packs are never rewritten: thumbnails of deleted files stay in them.
+ */
+class ThumbnailStore
+{
+public:
+    explicit ThumbnailStore(const QString& path);
+    ~ThumbnailStore();
+
+    // The folder of the packs of the db at databasePath
+    static QString pathForDatabase(const QString& databasePath);
+
+    // Appends data to the last pack. The bytes are visible to read after flush.
+    bool append(const QByteArray& data, ThumbnailLocation& location);
+    bool flush();
+
+    // Thread safe. A null QByteArray if the thumbnail is not in the packs.
+    QByteArray read(const ThumbnailLocation& location);
+
+private:
+    struct Pack
+    {
+        std::unique_ptr<QFile> file;
+        QVector<QPair<const uchar*, qint64>> mappings; // Latest last
+    };
+
+    QString _path;
+    QMutex mutex;
+    std::map<int, Pack> packs;
+
+    QFile writer;
+    int writerPack = -1;
+
+    QString packFilePath(int pack) const;
+    int lastPack() const;
+    bool openWriter(int pack);
+};
+
+#endif // THUMBNAILSTORE_H
@@ -0,0 +1,144 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "thumbnailtrace.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+
+#include <memory>
+
+bool ThumbnailTrace::enabled = false;
+
+static std::unique_ptr<QFile> traceFile;
+static std::unique_ptr<QTextStream> traceStream;
+static QElapsedTimer traceClock;
+
+bool ThumbnailTrace::start(const QString &path)
+{
+    stop();
+    traceFile = std::make_unique<QFile>(path);
+    if (!traceFile->open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        traceFile.reset();
+        return false;
+    }
+    traceStream = std::make_unique<QTextStream>(traceFile.get());
+    traceClock.start();
+    enabled = true;
+    return true;
+}
+
+void ThumbnailTrace::stop()
+{
+    enabled = false;
+    if (traceStream != nullptr)
+        traceStream->flush();
+    traceStream.reset();
+    traceFile.reset();
+}
+
+void ThumbnailTrace::request(int id, int level, int size, bool hit)
+{
+    write(QString("R\t%1\t%2\t%3\t%4\t%5").arg(traceClock.nsecsElapsed() / 1000).arg(id).arg(level).arg(size).arg(hit ? 1 : 0));
+}
+
+void ThumbnailTrace::loaded(int id, int level, int size)
+{
+    write(QString("L\t%1\t%2\t%3\t%4").arg(traceClock.nsecsElapsed() / 1000).arg(id).arg(level).arg(size));
+}
+
+void ThumbnailTrace::viewport(int first, int last, int scroll, int around, const QVector<int> &ids)
+{
+    QStringList idList;
+    idList.reserve(ids.count());
+    for (int id : ids)
+        idList.append(QString::number(id));
+    write(QString("V\t%1\t%2\t%3\t%4\t%5\t%6").arg(traceClock.nsecsElapsed() / 1000).arg(first).arg(last).arg(scroll).arg(around).arg(idList.join(',')));
+}
+
+void ThumbnailTrace::write(const QString &line)
+{
+    if (traceStream == nullptr)
+        return;
+    *traceStream << line << '\n';
+}
+
+bool ThumbnailTrace::read(const QString &path, QVector<Event> &events, QString &error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        error = file.errorString();
+        return false;
+    }
+
+    QTextStream stream(&file);
+    QString line;
+    while (stream.readLineInto(&line))
+    {
+        const QStringList fields = line.split('\t');
+        if (fields.count() < 5)
+            continue;
+        Event event;
+        event.usecs = fields.at(1).toLongLong();
+        if (fields.at(0) == "R" && fields.count() >= 6)
+        {
+            event.kind = Event::Request;
+            event.id = fields.at(2).toInt();
+            event.level = fields.at(3).toInt();
+            event.size = fields.at(4).toInt();
+            event.hit = fields.at(5) == "1";
+        }
+        else if (fields.at(0) == "L")
+        {
+            event.kind = Event::Loaded;
+            event.id = fields.at(2).toInt();
+            event.level = fields.at(3).toInt();
+            event.size = fields.at(4).toInt();
+        }
+        else if (fields.at(0) == "V" && fields.count() >= 6)
+        {
+            event.kind = Event::Viewport;
+            event.first = fields.at(2).toInt();
+            event.last = fields.at(3).toInt();
+            event.scroll = fields.at(4).toInt();
+            event.around = fields.at(5).toInt();
+            if (fields.count() >= 7 && !fields.at(6).isEmpty())
+            {
+                const QStringList ids = fields.at(6).split(',');
+                event.ids.reserve(ids.count());
+                for (const QString& id : ids)
+                    event.ids.append(id.toInt());
+            }
+        }
+        else
+        {
+            continue;
+        }
+        events.append(event);
+    }
+    return true;
+}
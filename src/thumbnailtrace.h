@@ -0,0 +1,90 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef THUMBNAILTRACE_H
+#define THUMBNAILTRACE_H
+
+#include <QString>
+#include <QVector>
+
+/*!
+ * \brief The ThumbnailTrace class
+ * The thumbnail requests of a session, recorded with --record-thumbnail-trace, so
+ * the caches can be tuned from real scrolling, see ThumbnailCacheSimulator.
+ *
+ * The trace is text, an event per line with its fields separated by tabs, the time
+ * first, in microseconds since the recording started:
+ *
+ *   R time id level size hit   The view looked up the thumbnail of a file, at a level
+ *                              of the pyramid and an icon size, and found it or not
+ *   L time id level size       The thumbnail was loaded into the cache of the view
+ *   V time first last scroll around ids
+ *                              The rows in view and the scroll position, with the ids of
+ *                              the rows from around on, comma separated, a few pages
+ *                              past the view on both sides, so prefetching them can be
+ *                              replayed
+ *
+ * Recording is only done from the GUI thread.
+ */
+class ThumbnailTrace
+{
+public:
+    struct Event
+    {
+        enum Kind
+        {
+            Request,
+            Loaded,
+            Viewport
+        };
+
+        Kind kind = Request;
+        qint64 usecs = 0;
+        int id = 0;
+        int level = 0;
+        int size = 0;
+        bool hit = false;
+        int first = 0;
+        int last = 0;
+        int scroll = 0;
+        int around = 0; // The row of ids.first()
+        QVector<int> ids;
+    };
+
+    static bool start(const QString& path);
+    static void stop();
+    static bool isEnabled() { return enabled; }
+    static void request(int id, int level, int size, bool hit);
+    static void loaded(int id, int level, int size);
+    static void viewport(int first, int last, int scroll, int around, const QVector<int>& ids);
+
+    // Reads a whole trace. Lines that can not be parsed are skipped.
+    static bool read(const QString& path, QVector<Event>& events, QString& error);
+
+private:
+    static bool enabled;
+    static void write(const QString& line);
+};
+
+#endif // THUMBNAILTRACE_H
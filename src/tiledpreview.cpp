@@ -0,0 +1,215 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#include "tiledpreview.h"
+#include "fitsfile.h"
+#include "metrics.h"
+
+#include <QSettings>
+
+// The coarse image is binned to at least twice this size, like a thumbnail
+#define PREVIEW_COARSE_SIZE 1024
+// Pixels on a side of the tiles, at every level
+#define PREVIEW_TILE_SIZE 512
+// Megabytes of rendered tiles kept
+#define PREVIEW_CACHE_SIZE 256
+
+TiledPreview::TiledPreview(QObject *parent) : QObject(parent)
+{
+    cache.setMaxCost(qint64(QSettings().value("PreviewCacheSize", PREVIEW_CACHE_SIZE).toInt()) * 1024 * 1024);
+}
+
+TiledPreview::~TiledPreview()
+{
+    // The workers read the mapped file, which the reader unmaps
+    closing = true;
+    pool.clear();
+    pool.waitForDone();
+}
+
+bool TiledPreview::open(const QString &filePath, const QByteArray &stretchParameters)
+{
+    if (!reader.open(filePath))
+        return false;
+
+    this->filePath = filePath;
+    hasStretchParams = StretchParams::fromByteArray(stretchParameters, stretchParams);
+    canRenderTiles = !(reader.size() >= 2 && reader.data()[0] == 0x1f && reader.data()[1] == 0x8b);
+    pool.start([this]() { renderCoarse(); });
+    return true;
+}
+
+QSize TiledPreview::imageSize() const
+{
+    QMutexLocker locker(&mutex);
+    return size;
+}
+
+QImage TiledPreview::coarseImage() const
+{
+    QMutexLocker locker(&mutex);
+    return coarse;
+}
+
+int TiledPreview::levelForScale(double scale) const
+{
+    QMutexLocker locker(&mutex);
+    if (!canRenderTiles || coarse.isNull() || scale <= 0 || scale * coarseFactor <= 1)
+        return -1;
+
+    int level = 0;
+    while ((2 << level) * scale <= 1 && (2 << level) < coarseFactor)
+        level++;
+    return level;
+}
+
+QList<TiledPreview::Tile> TiledPreview::tiles(int level, const QRect &rect)
+{
+    QList<Tile> found;
+    QMutexLocker locker(&mutex);
+    wanted.clear();
+    if (!canRenderTiles || level < 0 || size.isEmpty())
+        return found;
+
+    const int span = PREVIEW_TILE_SIZE << level;
+    const QRect visible = rect.intersected(QRect(QPoint(0, 0), size));
+    if (visible.isEmpty())
+        return found;
+
+    for (int row = visible.top() / span; row <= visible.bottom() / span; row++)
+    {
+        for (int column = visible.left() / span; column <= visible.right() / span; column++)
+        {
+            const quint64 key = tileKey(level, column, row);
+            if (QImage* image = cache.object(key))
+            {
+                found.append({tileRect(level, column, row), *image});
+                continue;
+            }
+            if (failed.contains(key))
+                continue;
+            wanted.insert(key);
+            if (!queued.contains(key))
+            {
+                queued.insert(key);
+                pool.start([this, key]() { renderTile(key); });
+            }
+        }
+    }
+    return found;
+}
+
+/*!
+ * \brief TiledPreview::renderCoarse
+ * Runs on the pool. The pixels are not hashed, and with the stored stretch parameters
+ * the frame is not scanned for statistics either.
+ */
+void TiledPreview::renderCoarse()
+{
+    static LatencyHistogram& coarseLatency = Metrics::histogram("preview.coarse");
+    ScopedLatency latency(coarseLatency);
+
+    FitsFile fits;
+    fits.setHashImage(false);
+    if (hasStretchParams)
+        fits.setStretchParams(stretchParams);
+    if (!fits.loadFile(filePath, reader.data(), reader.size()))
+        return;
+    fits.extractTags();
+    fits.extractImage(PREVIEW_COARSE_SIZE);
+
+    QImage image = fits.getImage();
+    if (image.isNull())
+        return;
+    {
+        QMutexLocker locker(&mutex);
+        coarse = image;
+        size = fits.getFullSize();
+        coarseFactor = qMax(1, size.width() / image.width());
+        // The tiles are stretched like the coarse image
+        stretchParams = fits.getStretchParams();
+        hasStretchParams = true;
+    }
+    emit coarseImageReady();
+}
+
+/*!
+ * \brief TiledPreview::renderTile
+ * Runs on the pool, with a FitsFile of its own over the mapped file, as cfitsio handles
+ * cannot be shared between threads.
+ */
+void TiledPreview::renderTile(quint64 key)
+{
+    const int level = int(key >> 48);
+    const int row = int((key >> 24) & 0xFFFFFF);
+    const int column = int(key & 0xFFFFFF);
+    QRect rect;
+    StretchParams params;
+    {
+        QMutexLocker locker(&mutex);
+        if (closing || !wanted.contains(key))
+        {
+            queued.remove(key);
+            return;
+        }
+        rect = tileRect(level, column, row);
+        params = stretchParams;
+    }
+
+    QImage image;
+    {
+        static LatencyHistogram& tileLatency = Metrics::histogram("preview.tile");
+        ScopedLatency latency(tileLatency);
+
+        FitsFile fits;
+        fits.setStretchParams(params);
+        // Binning averages the fringes of bilinear away, VNG only pays at full resolution
+        fits.setDemosaicMethod(level == 0 ? DemosaicVng : DemosaicBilinear);
+        if (fits.loadFile(filePath, reader.data(), reader.size()))
+        {
+            fits.extractTags();
+            image = fits.extractTile(rect, 1 << level);
+        }
+    }
+
+    {
+        QMutexLocker locker(&mutex);
+        queued.remove(key);
+        if (image.isNull())
+            failed.insert(key);
+        else
+            cache.insert(key, new QImage(image), image.sizeInBytes());
+    }
+    emit tileReady();
+}
+
+QRect TiledPreview::tileRect(int level, int column, int row) const
+{
+    const int span = PREVIEW_TILE_SIZE << level;
+    return QRect(column * span, row * span, span, span).intersected(QRect(QPoint(0, 0), size));
+}
+
+quint64 TiledPreview::tileKey(int level, int column, int row)
+{
+    return (quint64(level) << 48) | (quint64(row) << 24) | quint64(column);
+}
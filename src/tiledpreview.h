@@ -0,0 +1,109 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+#ifndef TILEDPREVIEW_H
+#define TILEDPREVIEW_H
+
+#include "autostretcher.h"
+#include "filereader.h"
+#include "taskscheduler.h"
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QRect>
+#include <QSet>
+
+#include <atomic>
+
+/*!
+ * \brief The TiledPreview class
+ * A full resolution preview of a FITS file, as a pyramid of tiles rendered on demand.
+ *
+ * The file is memory-mapped once. A coarse image, about as large as a screen, is
+ * rendered first, binned while it is read and stretched with the parameters stored in
+ * the catalog. Tiles of the finer levels are rendered on worker threads as they are
+ * asked for, each from a region of the mapped file (see FitsFile::extractTile), so
+ * a zoom only reads the part of the image in view. Level L is binned by 2^L, and only
+ * the levels finer than the coarse image are rendered. Bayer tiles of level 0 are
+ * demosaiced with DemosaicVng, which keeps stars and edges free of color fringes, the
+ * binned ones with DemosaicBilinear, whose fringes the binning averages away.
+ *
+ * Rendered tiles are kept in a cache of PreviewCacheSize MB. Tiles that were asked for
+ * but scrolled out of view before a worker got to them are dropped.
+ *
+ * Gzipped files are not tiled, cfitsio would decompress the whole file for every tile.
+ */
+class TiledPreview : public QObject
+{
+    Q_OBJECT
+public:
+    struct Tile
+    {
+        QRect rect; // In pixels of the full resolution image
+        QImage image;
+    };
+
+    explicit TiledPreview(QObject *parent = nullptr);
+    ~TiledPreview();
+
+    // Maps the file and starts rendering the coarse image, see coarseImageReady.
+    // Returns false when the file could not be opened.
+    bool open(const QString& filePath, const QByteArray& stretchParameters);
+    QSize imageSize() const;
+    QImage coarseImage() const;
+    // The level of the tiles shown at scale (displayed pixels per image pixel), -1 when the coarse image is enough
+    int levelForScale(double scale) const;
+    // The rendered tiles of the level in rect. The missing ones are queued, and tileReady is emitted as they are done.
+    QList<Tile> tiles(int level, const QRect& rect);
+
+signals:
+    void coarseImageReady();
+    void tileReady();
+
+private:
+    FileReader reader;
+    QString filePath;
+    bool canRenderTiles = false;
+
+    mutable QMutex mutex;
+    StretchParams stretchParams;
+    bool hasStretchParams = false;
+    QImage coarse;
+    QSize size;
+    int coarseFactor = 1; // Image pixels per pixel of the coarse image
+    QCache<quint64, QImage> cache;
+    QSet<quint64> queued;
+    QSet<quint64> wanted; // The tiles of the last call of tiles
+    QSet<quint64> failed;
+    TaskGroup pool {InteractivePriority};
+    std::atomic<bool> closing {false};
+
+    void renderCoarse();
+    void renderTile(quint64 key);
+    QRect tileRect(int level, int column, int row) const;
+    static quint64 tileKey(int level, int column, int row);
+};
+
+#endif // TILEDPREVIEW_H
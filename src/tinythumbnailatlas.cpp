@@ -0,0 +1,123 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "tinythumbnailatlas.h"
+#include "astrofile.h"
+
+#include <cstring>
+
+#define TILE_BYTES_PER_LINE (TINY_THUMBNAIL_SIZE * 3)
+
+qint64 TinyThumbnailAtlas::tileBytes()
+{
+    return qint64(TILE_BYTES_PER_LINE) * TINY_THUMBNAIL_SIZE;
+}
+
+int TinyThumbnailAtlas::insert(const QImage &image)
+{
+    if (image.isNull())
+        return -1;
+
+    QImage rgb = image.convertToFormat(QImage::Format_RGB888);
+    if (rgb.width() > TINY_THUMBNAIL_SIZE || rgb.height() > TINY_THUMBNAIL_SIZE)
+        rgb = rgb.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    int slot;
+    if (!freeSlots.isEmpty())
+    {
+        slot = freeSlots.takeLast();
+    }
+    else
+    {
+        slot = sizes.count();
+        sizes.append({0, 0});
+        pixels.resize(pixels.size() + tileBytes());
+    }
+
+    uchar* tile = reinterpret_cast<uchar*>(pixels.data()) + slot * tileBytes();
+    for (int y = 0; y < rgb.height(); y++)
+        memcpy(tile + y * TILE_BYTES_PER_LINE, rgb.constScanLine(y), rgb.width() * 3);
+    sizes[slot] = {quint8(rgb.width()), quint8(rgb.height())};
+    return slot;
+}
+
+void TinyThumbnailAtlas::remove(int slot)
+{
+    if (slot < 0 || slot >= sizes.count() || sizes.at(slot).width == 0)
+        return;
+    sizes[slot] = {0, 0};
+    freeSlots.append(slot);
+}
+
+QImage TinyThumbnailAtlas::tile(int slot) const
+{
+    if (slot < 0 || slot >= sizes.count() || sizes.at(slot).width == 0)
+        return QImage();
+    const TileSize size = sizes.at(slot);
+    const uchar* tile = reinterpret_cast<const uchar*>(pixels.constData()) + slot * tileBytes();
+    return QImage(tile, size.width, size.height, TILE_BYTES_PER_LINE, QImage::Format_RGB888);
+}
+
+QVector<int> TinyThumbnailAtlas::compact()
+{
+    QVector<int> newSlots(sizes.count(), -1);
+    char* data = pixels.data();
+    int next = 0;
+    for (int slot = 0; slot < sizes.count(); slot++)
+    {
+        if (sizes.at(slot).width == 0)
+            continue;
+        if (slot != next)
+        {
+            memcpy(data + next * tileBytes(), data + slot * tileBytes(), tileBytes());
+            sizes[next] = sizes.at(slot);
+        }
+        newSlots[slot] = next++;
+    }
+    sizes.resize(next);
+    sizes.squeeze();
+    pixels.resize(next * tileBytes());
+    pixels.squeeze();
+    freeSlots.clear();
+    return newSlots;
+}
+
+bool TinyThumbnailAtlas::assign(const char *tiles, qint64 tilesSize, const TileSize *tileSizes, int count)
+{
+    if (count < 0 || tilesSize != count * tileBytes())
+        return false;
+
+    pixels = QByteArray(tiles, tilesSize);
+    sizes.resize(count);
+    memcpy(sizes.data(), tileSizes, count * sizeof(TileSize));
+    freeSlots.clear();
+    for (int slot = 0; slot < count; slot++)
+    {
+        if (sizes.at(slot).width > TINY_THUMBNAIL_SIZE || sizes.at(slot).height > TINY_THUMBNAIL_SIZE)
+            sizes[slot] = {0, 0};
+        if (sizes.at(slot).width == 0)
+            freeSlots.append(slot);
+    }
+    return true;
+}
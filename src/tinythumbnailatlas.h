@@ -0,0 +1,78 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef TINYTHUMBNAILATLAS_H
+#define TINYTHUMBNAILATLAS_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+
+/*!
+ * \brief The TinyThumbnailAtlas class
+ * The tiny thumbnails of the catalog rows as fixed size RGB888 tiles in one contiguous
+ * block, instead of one QImage per row. A row keeps the slot of its tile. Tiles
+ * smaller than TINY_THUMBNAIL_SIZE, the thumbnails keep their aspect ratio, are
+ * stored in the top left of their tile.
+ *
+ * The block is implicitly shared, copying the atlas to another thread is cheap.
+ * Not thread safe, the Catalog guards it with its listLock.
+ */
+class TinyThumbnailAtlas
+{
+public:
+    struct TileSize
+    {
+        quint8 width;
+        quint8 height;
+    };
+
+    static qint64 tileBytes();
+
+    // Returns the slot of the tile, -1 for a null image
+    int insert(const QImage& image);
+    void remove(int slot);
+    // Shares the memory of the atlas, so it is only valid as long as the atlas
+    // is not changed. Null for a free or invalid slot.
+    QImage tile(int slot) const;
+    int slotCount() const { return sizes.count(); }
+    // The bytes of the block, free slots included
+    qint64 bytes() const { return pixels.size() + sizes.count() * qint64(sizeof(TileSize)); }
+    // Moves the tiles over the free slots and shrinks the block. Returns the new slot of
+    // every old slot, -1 for the free ones.
+    QVector<int> compact();
+
+    // The raw block and tile sizes, for the catalog snapshot
+    const QByteArray& tileData() const { return pixels; }
+    const QVector<TileSize>& tileSizes() const { return sizes; }
+    // Takes the tiles as written by tileData, with one copy. False if they do not match.
+    bool assign(const char* tiles, qint64 tilesSize, const TileSize* tileSizes, int count);
+
+private:
+    QByteArray pixels;
+    QVector<TileSize> sizes; // 0 x 0 for a free slot
+    QVector<int> freeSlots;
+};
+
+#endif // TINYTHUMBNAILATLAS_H
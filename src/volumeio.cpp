@@ -0,0 +1,229 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "volumeio.h"
+#include "asyncfileio.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "volumeregistry.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSettings>
+#include <QThread>
+
+#include <map>
+#include <memory>
+
+// Sequential reads of spinning disks and network volumes
+#define SEQUENTIAL_READ_CHUNK_SIZE (8 * 1024 * 1024)
+
+// Queued reads of solid state volumes, enough of them in flight to keep an NVMe busy
+#define QUEUED_READ_CHUNK_SIZE  (1024 * 1024)
+#define QUEUED_READ_DEPTH       32
+
+// Chunks of the sequential reads in flight, the next one is asked for while one is read
+#define SEQUENTIAL_READ_DEPTH   2
+
+// Files read at the same time from one volume. A spinning disk reads one file at
+// a time fastest, a NAS takes a few to hide its latency.
+#define DEFAULT_ROTATIONAL_READS    1
+#define DEFAULT_NETWORK_READS       2
+
+// Range requests of an object store: a few objects at a time, each fetched in ranges
+// in parallel, so the latency of a request is hidden behind the others
+#define OBJECT_STORE_READ_CHUNK_SIZE    (8 * 1024 * 1024)
+#define DEFAULT_OBJECT_STORE_FETCHES    8
+#define DEFAULT_OBJECT_STORE_READS      4
+
+static const QList<QByteArray> networkFileSystems = {
+    "nfs", "nfs4", "cifs", "smbfs", "smb2", "smb3", "afpfs", "webdav", "davfs", "sshfs", "fuse.sshfs", "9p"
+};
+
+VolumeIo::VolumeIo(const QStorageInfo &storage) : VolumeIo(storage.rootPath(), kindOf(storage))
+{
+}
+
+VolumeIo::VolumeIo(const QString &rootPath, VolumeKind kind)
+{
+    _rootPath = rootPath;
+    _policy.kind = kind;
+    clock.start();
+
+    QSettings settings;
+    switch (_policy.kind)
+    {
+    case SolidStateVolume:
+        // A mapped file is read by page faults in the threads that decode it
+        if (AsyncFileIo::isQueued())
+        {
+            _policy.mapFiles = false;
+            _policy.readChunkSize = QUEUED_READ_CHUNK_SIZE;
+            _policy.queueDepth = settings.value("SolidStateQueueDepth", QUEUED_READ_DEPTH).toInt();
+        }
+        break;
+    case RotationalVolume:
+        _policy.mapFiles = false;
+        _policy.readChunkSize = SEQUENTIAL_READ_CHUNK_SIZE;
+        _policy.queueDepth = SEQUENTIAL_READ_DEPTH;
+        _policy.maxConcurrentReads = settings.value("RotationalReadsPerVolume", DEFAULT_ROTATIONAL_READS).toInt();
+        break;
+    case NetworkVolume:
+        _policy.mapFiles = false;
+        _policy.readChunkSize = SEQUENTIAL_READ_CHUNK_SIZE;
+        _policy.queueDepth = SEQUENTIAL_READ_DEPTH;
+        _policy.maxConcurrentReads = settings.value("NetworkReadsPerVolume", DEFAULT_NETWORK_READS).toInt();
+        _policy.bandwidthLimit = settings.value("NetworkBandwidthLimitMBps", 0).toLongLong() * 1024 * 1024;
+        break;
+    case ObjectStoreVolume:
+        _policy.mapFiles = false;
+        _policy.readChunkSize = OBJECT_STORE_READ_CHUNK_SIZE;
+        _policy.queueDepth = settings.value("ObjectStore/ParallelFetches", DEFAULT_OBJECT_STORE_FETCHES).toInt();
+        _policy.maxConcurrentReads = settings.value("ObjectStore/ReadsPerBucket", DEFAULT_OBJECT_STORE_READS).toInt();
+        _policy.bandwidthLimit = settings.value("ObjectStore/BandwidthLimitMBps", 0).toLongLong() * 1024 * 1024;
+        break;
+    }
+    _policy.cacheMode = cacheModeOf(_policy.kind);
+}
+
+/*!
+ * \brief VolumeIo::cacheModeOf
+ * The IngestCacheMode setting, "cached", "dropped" or "direct". An archive indexed
+ * overnight would otherwise push everything else out of the page cache, so files are
+ * dropped from it by default. Network volumes are not read direct, the file systems
+ * of shares do not all honour it the same way.
+ */
+IngestCacheMode VolumeIo::cacheModeOf(VolumeKind kind)
+{
+    QSettings settings;
+    const QString mode = settings.value("IngestCacheMode", "dropped").toString().toLower();
+    if (mode == "cached")
+        return CachedIngest;
+    if (mode == "direct" && kind != NetworkVolume && kind != ObjectStoreVolume)
+        return DirectIngest;
+    return DroppedIngest;
+}
+
+VolumeKind VolumeIo::kindOf(const QStorageInfo &storage)
+{
+    if (isNetworkFileSystem(storage))
+        return NetworkVolume;
+
+#if defined(Q_OS_LINUX)
+    // The device links to its block device, and a partition has the queue of its disk one level up
+    const QString device = QFileInfo(QString::fromLocal8Bit(storage.device())).canonicalFilePath();
+    if (device.startsWith("/dev/"))
+    {
+        const QString block = QFileInfo("/sys/class/block/" + device.mid(5)).canonicalFilePath();
+        for (const QString& path : {block + "/queue/rotational", block + "/../queue/rotational"})
+        {
+            QFile rotational(path);
+            if (rotational.open(QIODevice::ReadOnly))
+                return rotational.readAll().trimmed() == "1" ? RotationalVolume : SolidStateVolume;
+        }
+    }
+#endif
+    return SolidStateVolume;
+}
+
+bool VolumeIo::isNetworkFileSystem(const QStorageInfo &storage)
+{
+    if (networkFileSystems.contains(storage.fileSystemType().toLower()))
+        return true;
+
+    // Windows mapped drives and UNC paths
+    return storage.rootPath().startsWith("//") || storage.device().startsWith("//");
+}
+
+QString VolumeIo::identityOf(const QStorageInfo &storage)
+{
+    if (!storage.isValid() || !storage.isReady())
+        return QString();
+
+    const QString device = QString::fromLocal8Bit(storage.device());
+    if (isNetworkFileSystem(storage))
+        return "share:" + device;
+
+#if defined(Q_OS_WIN)
+    if (device.startsWith("\\\\?\\Volume{"))
+        return device;
+#elif defined(Q_OS_LINUX)
+    // The entries of /dev/disk/by-uuid link to the block devices
+    const QString canonicalDevice = QFileInfo(device).canonicalFilePath();
+    if (!canonicalDevice.isEmpty())
+    {
+        const QFileInfoList uuids = QDir("/dev/disk/by-uuid").entryInfoList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+        for (auto& uuid : uuids)
+        {
+            if (uuid.canonicalFilePath() == canonicalDevice)
+                return "uuid:" + uuid.fileName();
+        }
+    }
+#endif
+
+    if (storage.name().isEmpty())
+        return QString();
+    return QString("label:%1:%2").arg(storage.name()).arg(storage.bytesTotal());
+}
+
+void VolumeIo::throttle(qint64 bytes)
+{
+    if (_policy.bandwidthLimit <= 0 || bytes <= 0)
+        return;
+
+    static LatencyHistogram& throttleWait = Metrics::histogram("io.throttle_wait");
+    QMutexLocker locker(&mutex);
+    const qint64 now = clock.nsecsElapsed();
+    // Time not used while the volume was idle is not saved up for later
+    scheduledUntil = qMax(scheduledUntil, now) + bytes * 1000000000LL / _policy.bandwidthLimit;
+    const qint64 wait = scheduledUntil - now;
+    locker.unlock();
+
+    throttleWait.record(wait / 1000);
+    QThread::usleep(wait / 1000);
+}
+
+VolumeIo *VolumeIo::ofDirectory(const QString &directory)
+{
+    static QMutex registryMutex;
+    static std::map<QString, std::unique_ptr<VolumeIo>> volumes;
+    static QHash<QString, VolumeIo*> directories;
+
+    QMutexLocker locker(&registryMutex);
+    VolumeIo*& volume = directories[directory];
+    if (volume != nullptr)
+        return volume;
+
+    // Only a volume not seen before needs a QStorageInfo
+    const QString rootPath = VolumeRegistry::volumeOf(directory).RootPath;
+    std::unique_ptr<VolumeIo>& known = volumes[rootPath];
+    if (!known && ObjectStore::isObjectPath(rootPath))
+        known.reset(new VolumeIo(rootPath, ObjectStoreVolume));
+    else if (!known)
+        known.reset(new VolumeIo(QStorageInfo(rootPath)));
+    volume = known.get();
+    return volume;
+}
@@ -0,0 +1,106 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef VOLUMEIO_H
+#define VOLUMEIO_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QStorageInfo>
+#include <QString>
+
+enum VolumeKind
+{
+    SolidStateVolume,
+    RotationalVolume,
+    NetworkVolume,
+    ObjectStoreVolume   // A bucket, see ObjectStore
+};
+
+// What the ingest leaves in the page cache of the files it read, see FileReader
+enum IngestCacheMode
+{
+    CachedIngest,       // The files stay cached, like any other read
+    DroppedIngest,      // Dropped from the cache once read (POSIX_FADV_DONTNEED, F_NOCACHE)
+    DirectIngest        // Read past the cache, with O_DIRECT or FILE_FLAG_NO_BUFFERING
+};
+
+// How the files of a volume are read
+struct VolumeIoPolicy
+{
+    VolumeKind kind = SolidStateVolume;
+    bool mapFiles = true;           // Memory-mapped, or read sequentially in chunks of readChunkSize
+    qint64 readChunkSize = 0;
+    int queueDepth = 1;             // Chunks of a file in flight at once, see AsyncFileIo
+    int maxConcurrentReads = 0;     // Files read at the same time, 0 for no limit
+    qint64 bandwidthLimit = 0;      // Bytes per second, 0 for no limit
+    IngestCacheMode cacheMode = DroppedIngest;
+};
+
+/*!
+ * \brief The VolumeIo class
+ * The I/O policy of a volume, and the pacing of its reads. Local solid state volumes
+ * are read with deep queues of reads where the reads can be queued, and mapped
+ * otherwise, without limits. Spinning disks and network volumes are read in large
+ * sequential chunks by a few files at a time, and network volumes can be capped in
+ * bandwidth, so indexing does not starve other users of a NAS. A bucket of an object
+ * store is fetched in large ranges, many of them at once to hide the latency of each
+ * request. Thread safe.
+ */
+class VolumeIo
+{
+public:
+    explicit VolumeIo(const QStorageInfo& storage);
+    VolumeIo(const QString& rootPath, VolumeKind kind);
+
+    const VolumeIoPolicy& policy() const { return _policy; }
+    QString rootPath() const { return _rootPath; }
+
+    // Called after reading bytes from the volume. Sleeps for as long as the reads of
+    // every thread together are ahead of the bandwidth limit.
+    void throttle(qint64 bytes);
+
+    // The volume of the directory, made the first time one of its directories is seen
+    static VolumeIo* ofDirectory(const QString& directory);
+
+    // What identifies the volume wherever it is mounted: the file system UUID on Linux,
+    // the volume GUID on Windows, the share of a network volume, and otherwise its
+    // label and size. Empty when the volume can not be told apart from others.
+    static QString identityOf(const QStorageInfo& storage);
+    static bool isNetworkFileSystem(const QStorageInfo& storage);
+
+private:
+    static IngestCacheMode cacheModeOf(VolumeKind kind);
+
+    QString _rootPath;
+    VolumeIoPolicy _policy;
+
+    QMutex mutex;
+    QElapsedTimer clock;
+    qint64 scheduledUntil = 0; // Nanoseconds on the clock when the reads so far are paid for
+
+    static VolumeKind kindOf(const QStorageInfo& storage);
+};
+
+#endif // VOLUMEIO_H
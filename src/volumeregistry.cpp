@@ -0,0 +1,184 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "volumeregistry.h"
+#include "objectstore.h"
+
+#include <QDir>
+#include <QFileSystemWatcher>
+#include <QList>
+#include <QReadWriteLock>
+#include <QSocketNotifier>
+#include <QStorageInfo>
+#include <QTimer>
+
+#include <algorithm>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+// Windows has no notification without a window, the drive letters are polled instead
+#define LOGICAL_DRIVES_POLL_INTERVAL 2000
+
+#if defined(Q_OS_WIN)
+static const Qt::CaseSensitivity pathCase = Qt::CaseInsensitive;
+#else
+static const Qt::CaseSensitivity pathCase = Qt::CaseSensitive;
+#endif
+
+namespace
+{
+struct MountTable
+{
+    QReadWriteLock lock;
+    bool isLoaded = false;
+    // Longest root path first, so the first match is the volume of the path
+    QList<MountedVolume> volumes;
+
+    void load()
+    {
+        // The caller must hold lock for writing
+        volumes.clear();
+        for (auto& storage : QStorageInfo::mountedVolumes())
+        {
+            if (!storage.isValid())
+                continue;
+            volumes.append({QDir::cleanPath(storage.rootPath()), storage.name()});
+        }
+        std::stable_sort(volumes.begin(), volumes.end(), [](const MountedVolume& a, const MountedVolume& b) {
+            return a.RootPath.size() > b.RootPath.size();
+        });
+        isLoaded = true;
+    }
+
+    const MountedVolume* find(const QString& path) const
+    {
+        // The caller must hold lock
+        for (auto& volume : volumes)
+        {
+            const QString& root = volume.RootPath;
+            if (!path.startsWith(root, pathCase))
+                continue;
+            // cleanPath keeps the separator of "/" and "C:/" only
+            if (path.size() == root.size() || root.endsWith('/') || path.at(root.size()) == '/')
+                return &volume;
+        }
+        return nullptr;
+    }
+};
+
+MountTable& mountTable()
+{
+    static MountTable table;
+    return table;
+}
+}
+
+VolumeRegistry::VolumeRegistry(QObject *parent) : QObject(parent)
+{
+#if defined(Q_OS_LINUX)
+    // The kernel flags the mount table as exceptional on every mount and unmount
+    mountInfoFd = ::open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+    if (mountInfoFd >= 0)
+    {
+        QSocketNotifier* notifier = new QSocketNotifier(mountInfoFd, QSocketNotifier::Exception, this);
+        connect(notifier, &QSocketNotifier::activated, this, &VolumeRegistry::mountTableChanged);
+    }
+#elif defined(Q_OS_MAC)
+    QFileSystemWatcher* watcher = new QFileSystemWatcher({"/Volumes"}, this);
+    connect(watcher, &QFileSystemWatcher::directoryChanged, this, &VolumeRegistry::mountTableChanged);
+#elif defined(Q_OS_WIN)
+    logicalDrives = GetLogicalDrives();
+    QTimer* timer = new QTimer(this);
+    timer->setInterval(LOGICAL_DRIVES_POLL_INTERVAL);
+    connect(timer, &QTimer::timeout, this, [this]() {
+        const quint32 drives = GetLogicalDrives();
+        if (drives == logicalDrives)
+            return;
+        logicalDrives = drives;
+        mountTableChanged();
+    });
+    timer->start();
+#endif
+}
+
+VolumeRegistry::~VolumeRegistry()
+{
+#if defined(Q_OS_LINUX)
+    if (mountInfoFd >= 0)
+        ::close(mountInfoFd);
+#endif
+}
+
+MountedVolume VolumeRegistry::volumeOf(const QString &path)
+{
+    // The volume of an object is its bucket
+    if (ObjectStore::isObjectPath(path))
+        return {ObjectStore::bucketRootOf(path), ObjectStore::bucketOf(path)};
+
+    MountTable& table = mountTable();
+    {
+        QReadLocker locker(&table.lock);
+        if (table.isLoaded)
+        {
+            const MountedVolume* volume = table.find(path);
+            if (volume != nullptr)
+                return *volume;
+        }
+    }
+    {
+        QWriteLocker locker(&table.lock);
+        if (!table.isLoaded)
+            table.load();
+        const MountedVolume* volume = table.find(path);
+        if (volume != nullptr)
+            return *volume;
+    }
+
+    // Not under any mount point we know of, which QStorageInfo may still resolve
+    QStorageInfo storage(path);
+    return {QDir::cleanPath(storage.rootPath()), storage.name()};
+}
+
+QString VolumeRegistry::nameOf(const QString &path)
+{
+    return volumeOf(path).Name;
+}
+
+void VolumeRegistry::invalidate()
+{
+    MountTable& table = mountTable();
+    QWriteLocker locker(&table.lock);
+    table.isLoaded = false;
+}
+
+void VolumeRegistry::mountTableChanged()
+{
+    invalidate();
+    emit mountsChanged();
+}
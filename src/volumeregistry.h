@@ -0,0 +1,73 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef VOLUMEREGISTRY_H
+#define VOLUMEREGISTRY_H
+
+#include <QObject>
+#include <QString>
+
+// A volume of the mount table, as the registry last read it
+struct MountedVolume
+{
+    QString RootPath;
+    QString Name;
+};
+
+/*!
+ * \brief The VolumeRegistry class
+ * The mount table, read once and kept until it changes. The volume of a path is
+ * then the longest mount point the path is under, instead of the canonicalization,
+ * statfs and mount table scan of a QStorageInfo per file.
+ *
+ * The lookups are static and thread safe. An instance watches for mounts and
+ * unmounts from the thread it lives in, /proc/self/mountinfo on Linux, /Volumes on
+ * macOS and the drive letters on Windows, and drops the table when they change.
+ */
+class VolumeRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VolumeRegistry(QObject *parent = nullptr);
+    ~VolumeRegistry();
+
+    // The path must be canonical, like AstroFile::DirectoryPath
+    static MountedVolume volumeOf(const QString& path);
+    static QString nameOf(const QString& path);
+
+    // The mount table is read again on the next lookup
+    static void invalidate();
+
+signals:
+    void mountsChanged();
+
+private slots:
+    void mountTableChanged();
+
+private:
+    int mountInfoFd = -1;
+    quint32 logicalDrives = 0;
+};
+
+#endif // VOLUMEREGISTRY_H
@@ -0,0 +1,213 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "framebufferpool.h"
+#include "metrics.h"
+#include "xisfblockdecoder.h"
+
+#include "lz4.h"
+#include "zlib.h"
+
+#include <QtConcurrent>
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define XISF_UNSHUFFLE_SSE2
+#endif
+
+// Items unshuffled by one task, a multiple of 16
+#define UNSHUFFLE_BAND_ITEMS (1 << 18)
+
+/*!
+ * \brief XisfBlockDecoder::decode
+ * Every subblock is a stream of its own, so they are decompressed on the thread
+ * pool, each at its offset in the destination. Shuffled data is decompressed to a
+ * pooled buffer first, and unshuffled from there into the destination. Returns
+ * false when the block is not one this decodes, is corrupt, or the token was
+ * canceled, the destination is then not all written.
+ */
+bool XisfBlockDecoder::decode(const XisfDataBlock &block, const uchar *fileData, uchar *destination, const CancellationToken &token)
+{
+    static LatencyHistogram& decodeLatency = Metrics::histogram("xisf.block_decode");
+    ScopedLatency latency(decodeLatency);
+
+    if (!block.isAttachment() || !block.isCompressed() || block.bigEndian || block.subblocks.isEmpty() || block.itemSize < 1)
+        return false;
+
+    // Where each subblock starts, in the file and in the uncompressed data
+    QList<qint64> compressedOffsets;
+    QList<qint64> uncompressedOffsets;
+    qint64 compressedOffset = block.position;
+    qint64 uncompressedOffset = 0;
+    for (auto& subblock : block.subblocks)
+    {
+        if (subblock.first <= 0 || subblock.second <= 0)
+            return false;
+        compressedOffsets.append(compressedOffset);
+        uncompressedOffsets.append(uncompressedOffset);
+        compressedOffset += subblock.first;
+        uncompressedOffset += subblock.second;
+    }
+    if (compressedOffset != block.position + block.size || uncompressedOffset != block.uncompressedSize)
+        return false;
+
+    const bool unshuffle = block.byteShuffled && block.itemSize > 1;
+    uchar* decompressed = destination;
+    if (unshuffle)
+    {
+        decompressed = FrameBufferPool::acquire(block.uncompressedSize);
+        if (decompressed == nullptr)
+            return false;
+    }
+
+    std::atomic<bool> failed {false};
+    auto decompress = [&](int i) {
+        if (failed || token.isCanceled())
+            return;
+        if (!decompressSubblock(block.codec, fileData + compressedOffsets[i], block.subblocks[i].first,
+                                decompressed + uncompressedOffsets[i], block.subblocks[i].second))
+            failed = true;
+    };
+    QList<int> subblocks;
+    for (int i = 0; i < block.subblocks.size(); i++)
+        subblocks.append(i);
+    if (subblocks.size() == 1)
+        decompress(0);
+    else
+        QtConcurrent::blockingMap(subblocks, decompress);
+
+    if (unshuffle)
+    {
+        if (!failed && !token.isCanceled())
+            XisfBlockDecoder::unshuffle(decompressed, destination, block.uncompressedSize, block.itemSize);
+        FrameBufferPool::release(decompressed);
+    }
+    return !failed && !token.isCanceled();
+}
+
+/*!
+ * \brief XisfBlockDecoder::decompressSubblock
+ * A subblock that would not compress is stored as it is, like PCL writes it.
+ */
+bool XisfBlockDecoder::decompressSubblock(const QByteArray &codec, const uchar *compressed, qint64 compressedSize, uchar *destination, qint64 uncompressedSize)
+{
+    if (compressedSize >= uncompressedSize)
+    {
+        if (compressedSize != uncompressedSize)
+            return false;
+        memcpy(destination, compressed, uncompressedSize);
+        return true;
+    }
+
+    if (codec == "zlib")
+    {
+        uLongf size = uLongf(uncompressedSize);
+        if (uncompress(destination, &size, compressed, uLong(compressedSize)) != Z_OK)
+            return false;
+        return qint64(size) == uncompressedSize;
+    }
+    if (codec == "lz4" || codec == "lz4hc")
+    {
+        if (compressedSize > INT_MAX || uncompressedSize > INT_MAX)
+            return false;
+        const int size = LZ4_decompress_safe(reinterpret_cast<const char*>(compressed), reinterpret_cast<char*>(destination),
+                                             int(compressedSize), int(uncompressedSize));
+        return size == uncompressedSize;
+    }
+    return false;
+}
+
+void XisfBlockDecoder::unshuffle(const uchar *shuffled, uchar *destination, qint64 size, int itemSize)
+{
+    const qint64 itemCount = size / itemSize;
+    auto unshuffleBand = [&](qint64 firstItem) {
+        unshuffleItems(shuffled, destination, itemCount, itemSize, firstItem, qMin(firstItem + UNSHUFFLE_BAND_ITEMS, itemCount));
+    };
+
+    if (itemCount <= UNSHUFFLE_BAND_ITEMS)
+        unshuffleBand(0);
+    else
+    {
+        QList<qint64> bands;
+        for (qint64 firstItem = 0; firstItem < itemCount; firstItem += UNSHUFFLE_BAND_ITEMS)
+            bands.append(firstItem);
+        QtConcurrent::blockingMap(bands, unshuffleBand);
+    }
+
+    // The bytes after the last whole item are not shuffled
+    memcpy(destination + itemCount * itemSize, shuffled + itemCount * itemSize, size % itemSize);
+}
+
+/*!
+ * \brief XisfBlockDecoder::unshuffleItems
+ * The shuffled data has the first byte of every item, then the second byte of
+ * every item, and so on. Items firstItem to lastItem are gathered back together.
+ */
+void XisfBlockDecoder::unshuffleItems(const uchar *shuffled, uchar *destination, qint64 itemCount, int itemSize, qint64 firstItem, qint64 lastItem)
+{
+    qint64 i = firstItem;
+#ifdef XISF_UNSHUFFLE_SSE2
+    // Interleaving the byte planes, 16 items at a time
+    if (itemSize == 2)
+    {
+        for (; i + 16 <= lastItem; i += 16)
+        {
+            const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffled + i));
+            const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffled + itemCount + i));
+            __m128i* out = reinterpret_cast<__m128i*>(destination + i * 2);
+            _mm_storeu_si128(out, _mm_unpacklo_epi8(p0, p1));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(p0, p1));
+        }
+    }
+    else if (itemSize == 4)
+    {
+        for (; i + 16 <= lastItem; i += 16)
+        {
+            const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffled + i));
+            const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffled + itemCount + i));
+            const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffled + 2 * itemCount + i));
+            const __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffled + 3 * itemCount + i));
+            const __m128i low01 = _mm_unpacklo_epi8(p0, p1);
+            const __m128i high01 = _mm_unpackhi_epi8(p0, p1);
+            const __m128i low23 = _mm_unpacklo_epi8(p2, p3);
+            const __m128i high23 = _mm_unpackhi_epi8(p2, p3);
+            __m128i* out = reinterpret_cast<__m128i*>(destination + i * 4);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(low01, low23));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(low01, low23));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(high01, high23));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(high01, high23));
+        }
+    }
+#endif
+
+    for (int j = 0; j < itemSize; j++)
+    {
+        const uchar* plane = shuffled + j * itemCount;
+        for (qint64 item = i; item < lastItem; item++)
+            destination[item * itemSize + j] = plane[item];
+    }
+}
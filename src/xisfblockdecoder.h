@@ -0,0 +1,83 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef XISFBLOCKDECODER_H
+#define XISFBLOCKDECODER_H
+
+#include "cancellationtoken.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+
+/*!
+ * \brief The XisfDataBlock struct
+ * Where the data of an XISF image is in the file and how it is stored, as the
+ * attributes of its Image element describe it.
+ */
+struct XisfDataBlock
+{
+    // An attachment, at position in the file. Inline and embedded blocks are not decoded.
+    qint64 position = 0;
+    qint64 size = 0;
+
+    // zlib, lz4 or lz4hc, empty when the block is not compressed
+    QByteArray codec;
+    bool byteShuffled = false;
+    qint64 uncompressedSize = 0;
+    int itemSize = 1;
+    // The compressed and uncompressed sizes of the subblocks, in order
+    QList<QPair<qint64, qint64>> subblocks;
+
+    // The channels one after the other, not interleaved
+    bool planar = true;
+    bool bigEndian = false;
+
+    bool isAttachment() const { return size > 0; }
+    bool isCompressed() const { return !codec.isEmpty(); }
+};
+
+/*!
+ * \brief The XisfBlockDecoder class
+ * Decompresses XISF data blocks without PCL. The subblocks are decompressed in
+ * parallel, straight into the destination, and byte shuffled data is unshuffled
+ * in parallel too, with SSE2 for 2 and 4 byte samples.
+ */
+class XisfBlockDecoder
+{
+public:
+    // Decompresses the block of the file data into destination, of block.uncompressedSize bytes
+    static bool decode(const XisfDataBlock& block, const uchar* fileData, uchar* destination, const CancellationToken& token);
+
+    // Reverses the byte shuffling of size bytes of items of itemSize bytes, like pcl::Compression::Unshuffle
+    static void unshuffle(const uchar* shuffled, uchar* destination, qint64 size, int itemSize);
+
+private:
+    static bool decompressSubblock(const QByteArray& codec, const uchar* compressed, qint64 compressedSize,
+                                   uchar* destination, qint64 uncompressedSize);
+    static void unshuffleItems(const uchar* shuffled, uchar* destination, qint64 itemCount, int itemSize,
+                               qint64 firstItem, qint64 lastItem);
+};
+
+#endif // XISFBLOCKDECODER_H
@@ -0,0 +1,145 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "xisfheaderreader.h"
+#include "metrics.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <QXmlStreamReader>
+
+// The signature, the length of the XML header, and a reserved field
+#define XISF_SIGNATURE "XISF0100"
+#define XISF_PREAMBLE_SIZE 16
+// A header this long is not an XISF header
+#define MAX_XML_HEADER_SIZE (64 * 1024 * 1024)
+
+bool XisfHeaderReader::readFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    return read(file);
+}
+
+bool XisfHeaderReader::read(QIODevice &device)
+{
+    static LatencyHistogram& readLatency = Metrics::histogram("xisf.header_read");
+    ScopedLatency latency(readLatency);
+
+    _tags.clear();
+    _imageBlock = XisfDataBlock();
+    const QByteArray preamble = device.read(XISF_PREAMBLE_SIZE);
+    if (preamble.size() != XISF_PREAMBLE_SIZE || !preamble.startsWith(XISF_SIGNATURE))
+        return false;
+    const quint32 headerSize = qFromLittleEndian<quint32>(preamble.constData() + 8);
+    if (headerSize == 0 || headerSize > MAX_XML_HEADER_SIZE)
+        return false;
+
+    const QByteArray header = device.read(headerSize);
+    if (header.size() != qint64(headerSize))
+        return false;
+    return parseHeader(header);
+}
+
+/*!
+ * \brief XisfHeaderReader::parseHeader
+ * Keeps the FITSKeyword elements of the first Image. The image needs a geometry, as
+ * width:height:channels, for the pixel phase to read it.
+ */
+bool XisfHeaderReader::parseHeader(const QByteArray &header)
+{
+    QXmlStreamReader xml(header);
+    bool inImage = false;
+    bool hasGeometry = false;
+    while (!xml.atEnd())
+    {
+        const QXmlStreamReader::TokenType token = xml.readNext();
+        if (token == QXmlStreamReader::EndElement && inImage && xml.name() == u"Image")
+            return hasGeometry;
+        if (token != QXmlStreamReader::StartElement)
+            continue;
+
+        const QXmlStreamAttributes attributes = xml.attributes();
+        if (!inImage)
+        {
+            if (xml.name() != u"Image")
+                continue;
+            inImage = true;
+            _imageBlock = dataBlockOf(attributes);
+            const QList<QStringView> geometry = attributes.value(u"geometry").split(u':');
+            hasGeometry = geometry.size() >= 3 && geometry[0].toInt() > 0 && geometry[1].toInt() > 0;
+        }
+        else if (xml.name() == u"FITSKeyword")
+        {
+            // Like XisfProcessor::extractTags, the quotes of strings are dropped
+            _tags.insert(attributes.value(u"name").toString().remove('\'').trimmed(),
+                         attributes.value(u"value").toString().remove('\'').trimmed());
+        }
+    }
+    return false;
+}
+
+/*!
+ * \brief XisfHeaderReader::dataBlockOf
+ * The location is attachment:position:size, the compression codec:size or
+ * codec:size:itemsize, and the subblocks compressed,uncompressed:... A block that
+ * is not an attachment is left with no size.
+ */
+XisfDataBlock XisfHeaderReader::dataBlockOf(const QXmlStreamAttributes &attributes)
+{
+    XisfDataBlock block;
+    block.planar = attributes.value(u"pixelStorage").isEmpty() || attributes.value(u"pixelStorage") == u"Planar";
+    block.bigEndian = attributes.value(u"byteOrder") == u"big";
+
+    const QList<QStringView> location = attributes.value(u"location").split(u':');
+    if (location.size() != 3 || location[0] != u"attachment")
+        return block;
+    block.position = location[1].toLongLong();
+    block.size = location[2].toLongLong();
+
+    const QList<QStringView> compression = attributes.value(u"compression").split(u':');
+    if (compression.size() < 2)
+        return block;
+    QString codec = compression[0].toString().toLower();
+    block.byteShuffled = codec.endsWith(u"+sh");
+    if (block.byteShuffled)
+        codec.chop(3);
+    block.codec = codec.toLatin1();
+    block.uncompressedSize = compression[1].toLongLong();
+    if (compression.size() > 2)
+        block.itemSize = compression[2].toInt();
+
+    const QStringView subblocks = attributes.value(u"subblocks");
+    if (subblocks.isEmpty())
+        block.subblocks.append({block.size, block.uncompressedSize});
+    for (QStringView subblock : subblocks.split(u':', Qt::SkipEmptyParts))
+    {
+        const QList<QStringView> sizes = subblock.split(u',');
+        if (sizes.size() != 2)
+            return XisfDataBlock();
+        block.subblocks.append({sizes[0].toLongLong(), sizes[1].toLongLong()});
+    }
+    return block;
+}
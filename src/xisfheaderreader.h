@@ -0,0 +1,65 @@
+/*
+    MIT License
+
+    Copyright (c) 2021 Astrocat.App
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#ifndef XISFHEADERREADER_H
+#define XISFHEADERREADER_H
+
+#include "xisfblockdecoder.h"
+
+#include <QMap>
+#include <QString>
+
+class QIODevice;
+class QXmlStreamAttributes;
+
+/*!
+ * \brief The XisfHeaderReader class
+ * Reads the FITS keywords of a monolithic XISF file without PCL, for the header
+ * phase of the ingest. Only the signature and the XML header are read, and the XML
+ * is parsed with a pull parser that stops at the end of the first Image element,
+ * the one XISFReader opens.
+ *
+ * The keywords are cleaned up like XisfProcessor::extractTags does. Files the reader
+ * does not read are opened with PCL instead. The data block of the image is kept
+ * too, for the XisfBlockDecoder.
+ */
+class XisfHeaderReader
+{
+public:
+    // Returns false when the file is not an XISF file with an image
+    bool readFile(const QString& path);
+    bool read(QIODevice& device);
+
+    const QMap<QString, QString>& tags() const { return _tags; }
+    const XisfDataBlock& imageBlock() const { return _imageBlock; }
+
+private:
+    bool parseHeader(const QByteArray& header);
+    static XisfDataBlock dataBlockOf(const QXmlStreamAttributes& attributes);
+
+    QMap<QString, QString> _tags;
+    XisfDataBlock _imageBlock;
+};
+
+#endif // XISFHEADERREADER_H
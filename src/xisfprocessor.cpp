@@ -22,11 +22,27 @@
     SOFTWARE.
 */
 
+#include "asyncfileio.h"
 #include "autostretcher.h"
+#include "colormanagement.h"
+#include "framebufferpool.h"
+#include "hasher.h"
+#include "linearthumbnail.h"
+#include "metrics.h"
+#include "xisfblockdecoder.h"
 #include "xisfprocessor.h"
 
-#include <QCryptographicHash>
+#include <QBuffer>
 
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#define THUMBNAIL_SIZE LARGEST_THUMBNAIL_SIZE
+
+// Rows read from the file at a time
+#define XISF_READ_BAND_ROWS 64
 
 using namespace pcl;
 
@@ -37,6 +53,8 @@ XisfProcessor::~XisfProcessor() noexcept
 
 bool XisfProcessor::loadFile(const AstroFile &astroFile)
 {
+    // Stored when the file was ingested, see FitsProcessor::useStoredStretchParams
+    _hasStoredStretchParams = StretchParams::fromByteArray(astroFile.StretchParameters, _storedStretchParams);
     try
     {
         xisf.Open(astroFile.FullPath.toStdWString().c_str());
@@ -48,46 +66,47 @@ bool XisfProcessor::loadFile(const AstroFile &astroFile)
     return true;
 }
 
-QImage makeImage(int _width, int _height, float* _data, QImage::Format _qImageFormat, int _numberOfChannels)
+bool XisfProcessor::loadFile(const AstroFile &astroFile, const FileReader &reader)
 {
-    QImage out(_width, _height, _qImageFormat);
-    long size = _width * _height;
-    float* it = _data;
+    // PCL opens the file itself, the bytes are only used to decompress the image
+    _fileData = reader.data();
+    _fileSize = reader.size();
+    return loadFile(astroFile);
+}
 
-    if (_numberOfChannels == 3)
-    {
-        for (int i = 0; i < _height; i++)
-        {
-            auto * scanLine = reinterpret_cast<QRgb*>(out.scanLine(i));
-            for (int j = 0; j < _width; j++)
-            {
-                int red = it[0];
-                int green = it[size];
-                int blue = it[2*size];
-                scanLine[j] = qRgb(red, green, blue);
-                it++;
-            }
-        }
-    }
-    else if (_numberOfChannels == 1)
+/*!
+ * \brief XisfProcessor::loadHeader
+ * Reads the keywords with the XisfHeaderReader, which only parses the XML header.
+ * PCL opens the files the reader does not read.
+ */
+bool XisfProcessor::loadHeader(const AstroFile &astroFile)
+{
+    return loadHeader(astroFile, QByteArray());
+}
+
+bool XisfProcessor::loadHeader(const AstroFile &astroFile, const QByteArray &head)
+{
+    static std::atomic<qint64>& fallbackCount = Metrics::counter("xisf.header_read_fallbacks");
+    if (head.isEmpty())
+        _headerRead = headerReader.readFile(astroFile.FullPath);
+    else
     {
-        for (int i = 0; i < _height; i++)
-        {
-            auto * scanLine = out.scanLine(i);
-            for (int j = 0; j < _width; j++)
-            {
-                scanLine[j] = (*it);
-                it++;
-            }
-        }
+        PrefetchedFile file(astroFile.FullPath, head);
+        _headerRead = file.open(QIODevice::ReadOnly) && headerReader.read(file);
     }
-    else
-        Q_ASSERT(false);
-    return out;
+    if (_headerRead)
+        return true;
+    fallbackCount++;
+    return loadFile(astroFile);
 }
 
 void XisfProcessor::extractTags()
-{    
+{
+    if (_headerRead)
+    {
+        _tags = headerReader.tags();
+        return;
+    }
     auto fitsTags = xisf.ReadFITSKeywords();
     for (auto& f : fitsTags)
     {
@@ -95,52 +114,250 @@ void XisfProcessor::extractTags()
     }
 }
 
-QByteArray XisfProcessor::calculateHash(QByteArray &array)
+/*!
+ * \brief XisfProcessor::extractThumbnail
+ * The image is read in its own sample type, a band of rows at a time. Every row is
+ * hashed, and binned by factor for the thumbnail, so the statistics and the stretch
+ * run on the binned image. When the file has an embedded thumbnail, that one is used
+ * and the samples are only hashed. The token is checked between the bands. A
+ * compressed image can not be read a band at a time, it is decompressed whole by
+ * decodeImage when it can be, and by PCL otherwise.
+ */
+void XisfProcessor::extractThumbnail()
 {
-    QCryptographicHash hash(QCryptographicHash::Sha1);
-    return hash.hash(array,QCryptographicHash::Sha1);
+    try
+    {
+        UInt8Image embedded = xisf.ReadThumbnail();
+        if (!embedded.IsEmpty())
+            _thumbnail = imageOf(embedded).scaled(QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        bool makeThumbnail = embedded.IsEmpty();
+
+        pcl::ImageOptions options = xisf.ImageOptions();
+        if (options.complexSample)
+            return;
+        if (options.ieeefpSampleFormat)
+        {
+            if (options.bitsPerSample == 64)
+                readImage<double>(makeThumbnail);
+            else
+                readImage<float>(makeThumbnail);
+        }
+        else if (options.bitsPerSample == 8)
+            readImage<uint8_t>(makeThumbnail);
+        else if (options.bitsPerSample == 16)
+            readImage<uint16_t>(makeThumbnail);
+        else
+            readImage<uint32_t>(makeThumbnail);
+
+        // The profile of the image, applied to the stretched thumbnail as PixInsight displays it
+        pcl::ICCProfile icc = xisf.ReadICCProfile();
+        if (!_thumbnail.isNull() && icc.IsProfile())
+        {
+            const pcl::ByteArray& data = icc.ProfileData();
+            ColorManagement::convert(_thumbnail, QByteArray(reinterpret_cast<const char*>(data.Begin()), int(data.Length())));
+        }
+    }
+    catch (pcl::Error)
+    {
+        _thumbnail = QImage();
+    }
 }
 
-void XisfProcessor::extractThumbnail()
+template <typename T>
+void XisfProcessor::readImage(bool makeThumbnail)
 {
-    FImage image;
-    xisf.ReadImage(image);
+    pcl::ImageInfo info = xisf.ImageInfo();
+    const int width = info.width;
+    const int height = info.height;
 
-    int channels = image.NumberOfChannels();
+    // An alpha channel is hashed, but not shown
+    const int channels = info.numberOfChannels >= 3 ? 3 : 1;
 
-    int height = image.Height();
-    int width = image.Width();
+    // Like FitsFile::binningFactor, the longer side stays at least twice the thumbnail size
+    int factor = 1;
+    while (qMax(width, height) / (factor * 2) >= 2 * THUMBNAIL_SIZE)
+        factor *= 2;
+    const long long outWidth = width / factor;
+    const long long outHeight = height / factor;
+    const long long cells = (long long)factor * factor;
+    std::vector<PixelSum<T>> sums(outWidth);
 
-    QImage::Format format = channels == 3 ? QImage::Format_RGB32 : QImage::Format_Grayscale8;
-
-    float* data = new float[width*height*channels];
-    float* it = data;
+    T* thumbnailData = nullptr;
+    if (makeThumbnail)
+    {
+        thumbnailData = reinterpret_cast<T*>(FrameBufferPool::acquire(outWidth * outHeight * channels * sizeof(T)));
+        if (thumbnailData == nullptr)
+            return;
+    }
 
-    for (int c = 0; c < channels; c++)
+    Hasher hasher;
+    T* decoded = decodeImage<T>(info);
+    std::vector<T> band(decoded == nullptr ? (size_t)width * XISF_READ_BAND_ROWS : 0);
+    const pcl::ImageOptions options = xisf.ImageOptions();
+    for (int c = 0; c < info.numberOfChannels; c++)
     {
-        for (int h = 0; h < height; h++)
+        for (int firstRow = 0; firstRow < height; firstRow += XISF_READ_BAND_ROWS)
         {
-            auto fscanLine = image.ScanLine(h, c);
-            for (int w = 0; w < width; w++)
+            if (cancellationToken.isCanceled())
+            {
+                FrameBufferPool::release(reinterpret_cast<unsigned char*>(thumbnailData));
+                FrameBufferPool::release(reinterpret_cast<unsigned char*>(decoded));
+                _thumbnail = QImage();
+                return;
+            }
+            int rows = qMin(XISF_READ_BAND_ROWS, height - firstRow);
+            T* samples = band.data();
+            if (decoded == nullptr)
+                xisf.ReadSamples(samples, firstRow, rows, c);
+            else
+            {
+                samples = decoded + ((size_t)c * height + firstRow) * width;
+                normalizeSamples(samples, (size_t)width * rows, options);
+            }
+            hasher.addData(reinterpret_cast<const char*>(samples), (qint64)width * rows * sizeof(T));
+
+            if (thumbnailData == nullptr || c >= channels)
+                continue;
+            // Averaged over factor x factor pixels, like FitsFile::bin, as the rows go by
+            for (int i = 0; i < rows; i++)
             {
-                *it = fscanLine[w];
-                it++;
+                int y = firstRow + i;
+                if (y >= outHeight * factor)
+                    break;
+                addRowToCells(NativePixels<T>{samples}, (long long)i * width, outWidth, factor, sums.data());
+                if (y % factor != factor - 1)
+                    continue;
+                T* out = thumbnailData + (c * outHeight + y / factor) * outWidth;
+                for (long long x = 0; x < outWidth; x++)
+                    out[x] = T(sums[x] / cells);
+                std::fill(sums.begin(), sums.end(), 0);
             }
         }
     }
+    _imageHash = hasher.result();
+    FrameBufferPool::release(reinterpret_cast<unsigned char*>(decoded));
+
+    if (thumbnailData == nullptr)
+        return;
 
-    auto hashData = QByteArray((char*)data, width * height * channels * sizeof(float));
-    _imageHash = calculateHash(hashData);
+    AutoStretcher<T> as(outWidth, outHeight, channels, 0);
+    as.setCancellationToken(cancellationToken);
+    as.setData(thumbnailData);
+    if (!_hasStoredStretchParams || !as.setParams(_storedStretchParams))
+        as.calculateParams();
+    QImage qimage = as.stretchToImage();
+    if (!qimage.isNull())
+    {
+        _stretchParams = as.getParams().toByteArray();
+        _thumbnail = qimage.scaled(QSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        _linearThumbnail = LinearThumbnail::scaled(as.linearImage(), LINEAR_THUMBNAIL_SIZE);
+    }
 
-    AutoStretcher<float> as(width, height, channels, 0);
-    as.setData(data);
-    as.calculateParams();
-    as.stretch();
-    QImage qimage = makeImage(width, height, data, format, channels);
+    FrameBufferPool::release(reinterpret_cast<unsigned char*>(thumbnailData));
+}
 
-    this->_thumbnail = qimage.scaled( QSize(200, 200), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+/*!
+ * \brief XisfProcessor::decodeImage
+ * Decompresses the whole image, from the bytes of the FileReader, into a pooled
+ * buffer with XisfBlockDecoder. Returns nullptr when the image is not compressed,
+ * or not stored in a way the decoder reads, PCL then reads it. Integer samples
+ * that PCL would rescale to their bounds are left to PCL too.
+ */
+template <typename T>
+T* XisfProcessor::decodeImage(const pcl::ImageInfo &info)
+{
+    if (_fileData == nullptr || xisf.ImplementsIncrementalRead())
+        return nullptr;
+    const pcl::ImageOptions options = xisf.ImageOptions();
+    if (std::is_integral_v<T> && options.readNormalized && (options.lowerRange > 0 || options.upperRange < std::numeric_limits<T>::max()))
+        return nullptr;
 
-    delete [] data;
+    QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char*>(_fileData), _fileSize);
+    QBuffer buffer(&data);
+    XisfHeaderReader header;
+    if (!buffer.open(QIODevice::ReadOnly) || !header.read(buffer))
+        return nullptr;
+    const XisfDataBlock& block = header.imageBlock();
+    const qint64 size = (qint64)info.width * info.height * info.numberOfChannels * sizeof(T);
+    if (!block.isCompressed() || (!block.planar && info.numberOfChannels > 1) || block.uncompressedSize != size
+        || block.position + block.size > _fileSize)
+        return nullptr;
+
+    T* decoded = reinterpret_cast<T*>(FrameBufferPool::acquire(size));
+    if (decoded != nullptr && !XisfBlockDecoder::decode(block, _fileData, reinterpret_cast<uchar*>(decoded), cancellationToken))
+    {
+        FrameBufferPool::release(reinterpret_cast<unsigned char*>(decoded));
+        return nullptr;
+    }
+    return decoded;
+}
+
+/*!
+ * \brief XisfProcessor::normalizeSamples
+ * What XISFReader::ReadSamples does to floating point samples: non-finite values are
+ * replaced with the lower bound, and the samples are clamped to the bounds and
+ * scaled to [0,1]. The image hash stays the one of the samples PCL reads.
+ */
+template <typename T>
+void XisfProcessor::normalizeSamples(T *samples, size_t count, const pcl::ImageOptions &options)
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if (!options.readNormalized)
+            return;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!std::isfinite(samples[i]) || (samples[i] == 0 && std::signbit(samples[i])))
+                samples[i] = T(options.lowerRange);
+            if (samples[i] < options.lowerRange)
+                samples[i] = T(options.lowerRange);
+            else if (samples[i] > options.upperRange)
+                samples[i] = T(options.upperRange);
+        }
+        if (options.lowerRange != 0 || options.upperRange != 1)
+        {
+            const double range = options.upperRange - options.lowerRange;
+            if (1 + range != 1)
+            {
+                for (size_t i = 0; i < count; i++)
+                    samples[i] = T((samples[i] - options.lowerRange) / range);
+            }
+            else if (options.lowerRange < 0 || options.lowerRange > 1)
+                std::fill(samples, samples + count, T(qBound(0.0, options.lowerRange, 1.0)));
+        }
+    }
+    else
+    {
+        Q_UNUSED(samples);
+        Q_UNUSED(count);
+        Q_UNUSED(options);
+    }
+}
+
+// The embedded thumbnail, gray or RGB, as an image
+QImage XisfProcessor::imageOf(const UInt8Image &thumbnail)
+{
+    const int width = thumbnail.Width();
+    const int height = thumbnail.Height();
+    const bool color = thumbnail.NumberOfChannels() >= 3;
+    QImage image(width, height, color ? QImage::Format_RGB32 : QImage::Format_Grayscale8);
+
+    for (int y = 0; y < height; y++)
+    {
+        if (color)
+        {
+            auto* scanLine = reinterpret_cast<QRgb*>(image.scanLine(y));
+            for (int x = 0; x < width; x++)
+                scanLine[x] = qRgb(thumbnail.Pixel(x, y, 0), thumbnail.Pixel(x, y, 1), thumbnail.Pixel(x, y, 2));
+        }
+        else
+        {
+            uchar* scanLine = image.scanLine(y);
+            for (int x = 0; x < width; x++)
+                scanLine[x] = thumbnail.Pixel(x, y, 0);
+        }
+    }
+    return image;
 }
 
 QByteArray XisfProcessor::getImageHash()
@@ -148,6 +365,31 @@ QByteArray XisfProcessor::getImageHash()
     return _imageHash;
 }
 
+QByteArray XisfProcessor::getStretchParams()
+{
+    return _stretchParams;
+}
+
+QImage XisfProcessor::getLinearThumbnail()
+{
+    return _linearThumbnail;
+}
+
+void XisfProcessor::reset()
+{
+    xisf.Close();
+    _headerRead = false;
+    _fileData = nullptr;
+    _fileSize = 0;
+    _tags.clear();
+    _thumbnail = QImage();
+    _tinyThumbnail = QImage();
+    _linearThumbnail = QImage();
+    _imageHash.clear();
+    _stretchParams.clear();
+    _hasStoredStretchParams = false;
+}
+
 QMap<QString, QString> XisfProcessor::getTags()
 {
     return _tags;
@@ -160,5 +402,8 @@ QImage XisfProcessor::getThumbnail()
 
 QImage XisfProcessor::getTinyThumbnail()
 {
-    return _thumbnail.scaled(20, 20, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    // Scaled once from the thumbnail
+    if (_tinyThumbnail.isNull() && !_thumbnail.isNull())
+        _tinyThumbnail = _thumbnail.scaled(TINY_THUMBNAIL_SIZE, TINY_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return _tinyThumbnail;
 }
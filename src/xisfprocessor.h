@@ -39,27 +39,53 @@
 #pragma GCC diagnostic pop
 #endif
 
+#include "autostretcher.h"
 #include "fileprocessor.h"
+#include "xisfheaderreader.h"
 
 class XisfProcessor : public FileProcessor
 {
 public:
     ~XisfProcessor() noexcept;
     bool loadFile(const AstroFile &astroFile);
+    bool loadFile(const AstroFile &astroFile, const FileReader& reader);
+    bool loadHeader(const AstroFile &astroFile);
+    bool loadHeader(const AstroFile &astroFile, const QByteArray &head);
     void extractTags();
     void extractThumbnail();
     QMap<QString, QString> getTags();
     QImage getThumbnail();
     QImage getTinyThumbnail();
     QByteArray getImageHash();
+    QByteArray getStretchParams();
+    QImage getLinearThumbnail();
+    void reset();
 
 private:
     QMap<QString, QString> _tags;
     QImage _thumbnail;
+    QImage _tinyThumbnail;
+    QImage _linearThumbnail;
     QByteArray _imageHash;
+    QByteArray _stretchParams;
+    StretchParams _storedStretchParams;
+    bool _hasStoredStretchParams = false;
 
     pcl::XISFReader xisf;
-    QByteArray calculateHash(QByteArray &array);
+    XisfHeaderReader headerReader;
+    // The tags are the ones of the headerReader, the file was not opened with PCL
+    bool _headerRead = false;
+    // The bytes of the FileReader the file was loaded from, if any
+    const uchar* _fileData = nullptr;
+    qint64 _fileSize = 0;
+
+    template <typename T>
+    void readImage(bool makeThumbnail);
+    template <typename T>
+    T* decodeImage(const pcl::ImageInfo& info);
+    template <typename T>
+    static void normalizeSamples(T* samples, size_t count, const pcl::ImageOptions& options);
+    static QImage imageOf(const pcl::UInt8Image& thumbnail);
 };
 
 #endif // XISFPROCESSOR_H